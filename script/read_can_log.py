@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+"""Print the frames in a raw CAN log written to the SD card by a VI built with
+DEFAULT_FS_RAW_CAN_LOG=1.
+
+Each frame is a fixed 24 byte little endian record:
+
+    offset  size  field
+    0       1     sync byte, 0xA5
+    1       1     flags, bit 0 set for a 29-bit extended ID
+    2       1     bus address
+    3       1     data length, 0 to 8
+    4       4     message ID
+    8       8     timestamp, in milliseconds
+    16      8     data bytes, zero padded past the data length
+
+Usage: read_can_log.py [--json] LOG_FILE...
+"""
+
+from __future__ import print_function
+
+import json
+import struct
+import sys
+
+RECORD = struct.Struct("<BBBBIQ8s")
+RECORD_SYNC = 0xa5
+FLAG_EXTENDED = 0x1
+
+
+def read_records(log):
+    """Yield a (timestamp, bus, id, extended, data) tuple for each record in
+    the file, skipping forward to the next sync byte after a corrupt record.
+    """
+    buffer = bytearray(log.read())
+    offset = 0
+    while offset + RECORD.size <= len(buffer):
+        sync, flags, bus, length, message_id, timestamp, data = \
+                RECORD.unpack_from(bytes(buffer), offset)
+        if sync != RECORD_SYNC or length > 8:
+            offset += 1
+            continue
+        offset += RECORD.size
+        yield (timestamp, bus, message_id, bool(flags & FLAG_EXTENDED),
+                bytearray(data)[:length])
+
+
+def format_text(timestamp, bus, message_id, extended, data):
+    return "%d %d %s [%d] %s" % (timestamp, bus,
+            ("%08X" if extended else "%03X") % message_id, len(data),
+            " ".join("%02X" % byte for byte in data))
+
+
+def format_json(timestamp, bus, message_id, extended, data):
+    message = {"bus": bus, "id": message_id, "timestamp": timestamp,
+            "data": "0x" + "".join("%02x" % byte for byte in data)}
+    if extended:
+        message["frame_format"] = "extended"
+    return json.dumps(message, sort_keys=True)
+
+
+def main(argv):
+    formatter = format_text
+    if argv and argv[0] == "--json":
+        formatter = format_json
+        argv = argv[1:]
+
+    if not argv:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 1
+
+    for path in argv:
+        with open(path, "rb") as log:
+            for record in read_records(log):
+                print(formatter(*record))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
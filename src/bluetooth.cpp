@@ -38,6 +38,55 @@ static void writeByte(void* device, uint8_t byte) {
     uart::writeByte((UartDevice*)device, byte);
 }
 
+// The standard rates to try above the UART's configured baud rate, fastest
+// first
+static const int FAST_BAUD_RATES[] = {921600, 460800, 230400};
+
+/* Private: Returns true if the module answers BLUETOOTH_BAUD_VERIFY_COUNT
+ * firmware version queries in a row at the current baud rate.
+ */
+static bool linkReliable(AtCommanderConfig* config) {
+    AtCommand firmwareVersionCommand = {
+        request_format: "V\r",
+        expected_response: NULL,
+        error_response: "ERR"
+    };
+
+    char versionString[64];
+    for(int i = 0; i < BLUETOOTH_BAUD_VERIFY_COUNT; i++) {
+        if(!at_commander_get(config, &firmwareVersionCommand, versionString,
+                    sizeof(versionString)) || versionString[0] == '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Private: Move the module, and the UART, to the fastest rate it works
+ * reliably at, from BLUETOOTH_MAX_BAUD_RATE down to the UART's baudRate.
+ */
+static void negotiateBaudRate(AtCommanderConfig* config, UartDevice* device) {
+    for(size_t i = 0; i < sizeof(FAST_BAUD_RATES) / sizeof(int); i++) {
+        int baud = FAST_BAUD_RATES[i];
+        if(baud > BLUETOOTH_MAX_BAUD_RATE || baud <= device->baudRate) {
+            continue;
+        }
+
+        if(at_commander_set_baud(config, baud) && linkReliable(config)) {
+            debug("Bluetooth module is reliable at %d baud", baud);
+            device->baudRate = baud;
+            return;
+        }
+        debug("Bluetooth module isn't reliable at %d baud", baud);
+    }
+
+    // Whatever rate the module was left at, put it back where it started
+    if(!at_commander_set_baud(config, device->baudRate)) {
+        debug("Unable to return Bluetooth module to %d baud",
+                device->baudRate);
+    }
+}
+
 void openxc::bluetooth::configureExternalModule(UartDevice* device) {
 #ifdef CHIPKIT
     if(!uart::connected(device)) {
@@ -60,6 +109,7 @@ void openxc::bluetooth::configureExternalModule(UartDevice* device) {
     delayMs(1000);
     if(at_commander_set_baud(&config, device->baudRate)) {
         debug("Successfully set baud rate");
+        negotiateBaudRate(&config, device);
         if(at_commander_set_name(&config, BLUETOOTH_DEVICE_NAME, true)) {
             debug("Successfully set Bluetooth device name");
         } else {
@@ -3,6 +3,22 @@
 
 #include "interface/uart.h"
 
+/* Public: The fastest baud rate to try to move an external Bluetooth module up
+ * to, from the UART's baudRate. Each faster rate is only kept if the module
+ * answers reliably at it (see configureExternalModule). Set it to the UART's
+ * baud rate to leave the module there.
+ */
+#ifndef BLUETOOTH_MAX_BAUD_RATE
+#define BLUETOOTH_MAX_BAUD_RATE 921600
+#endif
+
+/* Public: How many commands in a row the module must answer at a new baud
+ * rate before it's kept.
+ */
+#ifndef BLUETOOTH_BAUD_VERIFY_COUNT
+#define BLUETOOTH_BAUD_VERIFY_COUNT 3
+#endif
+
 namespace openxc {
 namespace bluetooth {
 
@@ -24,6 +40,14 @@ void deinitialize();
 
 /* Public: Configure the baud rate and other parameters on an external Bluetooth
  * module.
+ *
+ * The module is first set to the device's baudRate, then moved up through the
+ * faster standard rates, up to BLUETOOTH_MAX_BAUD_RATE, highest first. A rate
+ * is kept once the module answers BLUETOOTH_BAUD_VERIFY_COUNT commands in a row
+ * at it; otherwise the next lower one is tried, back down to baudRate. The
+ * UART is left at the rate that was kept, and it's stored in baudRate. The
+ * UART drivers use RTS/CTS flow control, so the module can hold off output
+ * rather than overrun at the higher rate.
  */
 void configureExternalModule(openxc::interface::uart::UartDevice* device);
 
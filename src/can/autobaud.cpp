@@ -0,0 +1,111 @@
+#include "can/autobaud.h"
+#include "can/canqueue.h"
+#include "saved_config.h"
+#include "util/log.h"
+#include "util/timer.h"
+
+namespace time = openxc::util::time;
+namespace queue = openxc::can::queue;
+
+using openxc::util::log::debug;
+
+// The speeds tried after the bus's own, most common in vehicles first.
+static const unsigned int CANDIDATE_SPEEDS[] = {
+    500000, 250000, 125000, 1000000, 100000, 83333, 50000, 33333
+};
+
+#define CANDIDATE_SPEED_COUNT \
+        (sizeof(CANDIDATE_SPEEDS) / sizeof(CANDIDATE_SPEEDS[0]))
+
+/* Private: Returns the speed to try for a candidate index, 0 being the speed
+ * the search started with. The candidates skip that speed so it isn't tried
+ * twice in a pass.
+ */
+static unsigned int candidateSpeed(const CanBus* bus, uint8_t candidate) {
+    if(candidate == 0) {
+        return bus->autoBaudFirstSpeed;
+    }
+
+    for(size_t i = 0; i < CANDIDATE_SPEED_COUNT; i++) {
+        if(CANDIDATE_SPEEDS[i] != bus->autoBaudFirstSpeed &&
+                --candidate == 0) {
+            return CANDIDATE_SPEEDS[i];
+        }
+    }
+    return 0;
+}
+
+/* Private: Returns the messages received at any speed so far, counting the
+ * ones still waiting in the receive queue as of when they arrived.
+ */
+static unsigned int framesHeard(CanBus* bus) {
+    return bus->messagesReceived + bus->messagesDropped +
+            queue::length(&bus->receiveQueue);
+}
+
+/* Private: Listen at the candidate speed, counting from now.
+ */
+static void tryCandidate(CanBus* bus, uint8_t candidate) {
+    unsigned int speed = candidateSpeed(bus, candidate);
+    if(speed == 0) {
+        candidate = 0;
+        speed = bus->autoBaudFirstSpeed;
+    }
+
+    bus->autoBaudCandidate = candidate;
+    openxc::can::setBitRate(bus, speed, true);
+    bus->autoBaudStartedMs = time::systemTimeMs();
+    bus->autoBaudFrames = framesHeard(bus);
+    bus->autoBaudErrors = bus->receiveErrorCount;
+}
+
+bool openxc::can::autobaud::enabled(const CanBus* bus) {
+    return (bus->autoBaud || CAN_AUTO_BAUD) && !bus->loopback;
+}
+
+void openxc::can::autobaud::start(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    debug("Searching for the speed of CAN%d, starting at %d", bus->address,
+            bus->speed);
+    bus->autoBaudFirstSpeed = bus->speed;
+    // Starting over, the filters are already bypassed by the last search
+    if(!bus->autoBaudSearching) {
+        bus->autoBaudBypassFilters = bus->bypassFilters;
+        bus->autoBaudSearching = true;
+        if(!bus->bypassFilters) {
+            setAcceptanceFilterStatus(bus, false, buses, busCount);
+        }
+    }
+    tryCandidate(bus, 0);
+}
+
+bool openxc::can::autobaud::searching(const CanBus* bus) {
+    return bus->autoBaudSearching;
+}
+
+void openxc::can::autobaud::update(CanBus* bus, bool writable, CanBus* buses,
+        const int busCount) {
+    if(!bus->autoBaudSearching) {
+        return;
+    }
+
+    unsigned int frames = framesHeard(bus) - bus->autoBaudFrames;
+    unsigned int errors = bus->receiveErrorCount > bus->autoBaudErrors ?
+            bus->receiveErrorCount - bus->autoBaudErrors : 0;
+    if(frames >= CAN_AUTO_BAUD_MIN_FRAMES && frames > errors) {
+        bus->speed = candidateSpeed(bus, bus->autoBaudCandidate);
+        bus->autoBaudSearching = false;
+        setBitRate(bus, bus->speed, !writable);
+        if(!bus->autoBaudBypassFilters) {
+            setAcceptanceFilterStatus(bus, true, buses, busCount);
+        }
+        debug("CAN%d is running at %d", bus->address, bus->speed);
+
+        if(bus->speed != bus->autoBaudFirstSpeed) {
+            openxc::config::saveConfiguration();
+        }
+    } else if(time::systemTimeMs() - bus->autoBaudStartedMs >=
+            CAN_AUTO_BAUD_DWELL_MS) {
+        tryCandidate(bus, bus->autoBaudCandidate + 1);
+    }
+}
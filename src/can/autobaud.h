@@ -0,0 +1,76 @@
+#ifndef __AUTOBAUD_H__
+#define __AUTOBAUD_H__
+
+#include "can/canutil.h"
+
+// 1 to find the speed of every bus by listening to it, instead of only the
+// buses with autoBaud set.
+#ifndef CAN_AUTO_BAUD
+#define CAN_AUTO_BAUD 0
+#endif
+
+// How long each candidate speed is listened to before moving on to the next.
+// A pass through all 8 candidates takes 8 times this, which bounds how long a
+// busy bus takes to lock on.
+#ifndef CAN_AUTO_BAUD_DWELL_MS
+#define CAN_AUTO_BAUD_DWELL_MS 250
+#endif
+
+// The messages that have to be received at a speed to lock onto it. At the
+// wrong speed a frame almost never passes its CRC, so a few are enough.
+#ifndef CAN_AUTO_BAUD_MIN_FRAMES
+#define CAN_AUTO_BAUD_MIN_FRAMES 3
+#endif
+
+// Finds a bus's speed by trying each common one in listen only mode, so the
+// VI never sends an ACK or an error frame at the wrong speed and disturbs the
+// bus. The speed from the configuration (or saved by a previous search) is
+// tried first, then the others in the order they're most common in vehicles.
+// A speed is locked onto once it's received CAN_AUTO_BAUD_MIN_FRAMES messages,
+// more than the receive errors it's seen. The controller then goes back to the
+// mode it was configured for, and a speed that differs from the one the search
+// started with is saved with the rest of the configuration.
+//
+// The acceptance filters are bypassed while searching, so messages that
+// aren't in the message set still count.
+
+namespace openxc {
+namespace can {
+namespace autobaud {
+
+/* Public: Returns true if the bus's speed should be searched for, i.e. it
+ * has autoBaud set or CAN_AUTO_BAUD is on, and it's not in loopback mode.
+ */
+bool enabled(const CanBus* bus);
+
+/* Public: Start searching for the bus's speed, beginning with bus->speed.
+ * Call it after can::initialize, which should leave the controller in listen
+ * only mode. If a search is already running, it starts over from bus->speed,
+ * and the acceptance filters are restored to how they were before the first.
+ *
+ * bus - The bus to search for the speed of.
+ * buses - An array of all CAN buses.
+ * busCount - The length of the buses array.
+ */
+void start(CanBus* bus, CanBus* buses, const int busCount);
+
+/* Public: Returns true while the bus's speed is being searched for.
+ */
+bool searching(const CanBus* bus);
+
+/* Public: Move the search along, from the main loop. Does nothing if the bus
+ * isn't being searched.
+ *
+ * bus - The bus being searched.
+ * writable - True if the controller should send ACKs (and writes) once the
+ *      speed is found, as it would have been initialized.
+ * buses - An array of all CAN buses.
+ * busCount - The length of the buses array.
+ */
+void update(CanBus* bus, bool writable, CanBus* buses, const int busCount);
+
+} // namespace autobaud
+} // namespace can
+} // namespace openxc
+
+#endif // __AUTOBAUD_H__
@@ -0,0 +1,192 @@
+#include "can/canqueue.h"
+#include "util/ram_function.h"
+#include <string.h>
+
+// Keep the compiler (and on cores with a write buffer, the CPU) from moving
+// element accesses across the index update that publishes them to the other
+// side of the ring.
+#define RING_BARRIER() __sync_synchronize()
+
+// The header byte of a packed frame
+#define FRAME_EXTENDED 0x80
+#define FRAME_LENGTH_MASK 0x7f
+// A header that says the next frame is at the start of the storage
+#define FRAME_WRAP 0xff
+
+#define FRAME_TIME_SIZE sizeof(unsigned long)
+#define FRAME_MAX_SIZE (1 + sizeof(uint32_t) + FRAME_TIME_SIZE + \
+        CAN_MAX_MESSAGE_SIZE)
+
+static_assert(CAN_RECEIVE_QUEUE_BYTES >= FRAME_MAX_SIZE * 2 &&
+        CAN_RECEIVE_QUEUE_BYTES <= 0xffff,
+        "CAN_RECEIVE_QUEUE_BYTES must hold at least two of the largest frames");
+
+/* Private: The number of data bytes stored for a frame. Some messages are
+ * built without a length, which has always meant a full classic frame.
+ */
+static uint8_t storedLength(uint8_t length) {
+    if(length == 0) {
+        return CAN_MESSAGE_SIZE;
+    }
+    return length > CAN_MAX_MESSAGE_SIZE ? CAN_MAX_MESSAGE_SIZE : length;
+}
+
+static uint8_t idSize(bool extended) {
+    return extended ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+void openxc::can::queue::initialize(CanMessageRing* ring, uint16_t depth) {
+    if(depth == 0 || depth > CAN_RECEIVE_QUEUE_MAX_DEPTH) {
+        depth = CAN_RECEIVE_QUEUE_MAX_DEPTH;
+    }
+
+    // round down to a power of two, the same depths as an unpacked ring
+    uint16_t roundedDepth = 1;
+    while(roundedDepth <= depth / 2) {
+        roundedDepth <<= 1;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = roundedDepth - 1;
+    ring->pushed = 0;
+    ring->popped = 0;
+    ring->peak = 0;
+}
+
+bool openxc::can::queue::peekReceivedUs(const CanMessageRing* ring,
+        unsigned long* receivedUs) {
+    if(ring->pushed == ring->popped) {
+        return false;
+    }
+
+    RING_BARRIER();
+    uint16_t tail = ring->tail;
+    if(ring->bytes[tail] == FRAME_WRAP) {
+        tail = 0;
+    }
+    const uint8_t* frame = &ring->bytes[tail];
+    frame += 1 + idSize(*frame & FRAME_EXTENDED);
+    memcpy(receivedUs, frame, FRAME_TIME_SIZE);
+    return true;
+}
+
+uint16_t openxc::can::queue::length(const CanMessageRing* ring) {
+    return (uint16_t)(ring->pushed - ring->popped);
+}
+
+uint16_t openxc::can::queue::capacity(const CanMessageRing* ring) {
+    return ring->mask + 1;
+}
+
+uint16_t openxc::can::queue::peak(const CanMessageRing* ring) {
+    return ring->peak;
+}
+
+bool openxc::can::queue::empty(const CanMessageRing* ring) {
+    return length(ring) == 0;
+}
+
+bool openxc::can::queue::full(const CanMessageRing* ring) {
+    return length(ring) >= capacity(ring);
+}
+
+RAM_FUNCTION
+bool openxc::can::queue::push(CanMessageRing* ring, const CanMessage* message) {
+    // Read tail before popped - the consumer updates them in the other order,
+    // so a frame counted as popped has always been copied out.
+    uint16_t tail = ring->tail;
+    RING_BARRIER();
+    uint16_t popped = ring->popped;
+    uint16_t pushed = ring->pushed;
+    if((uint16_t)(pushed - popped) > ring->mask) {
+        return false;
+    }
+
+    bool extended = message->format == CanMessageFormat::EXTENDED;
+    uint8_t length = storedLength(message->length);
+    uint16_t frameSize = 1 + idSize(extended) + FRAME_TIME_SIZE + length;
+    uint16_t head = ring->head;
+    bool ringEmpty = pushed == popped;
+    if(!ringEmpty && head == tail) {
+        return false;
+    }
+
+    uint16_t start = head;
+    if(head >= tail || ringEmpty) {
+        if(CAN_RECEIVE_QUEUE_BYTES - head < frameSize) {
+            // doesn't fit before the end, so wrap to the start if it fits
+            // there without reaching the oldest frame
+            if((ringEmpty ? head : tail) < frameSize) {
+                return false;
+            }
+            start = 0;
+        }
+    } else if(tail - head < frameSize) {
+        return false;
+    }
+
+    uint8_t* frame = &ring->bytes[start];
+    // the length is stored as given, so a message without one stays that way
+    *frame++ = (extended ? FRAME_EXTENDED : 0) |
+            (message->length > CAN_MAX_MESSAGE_SIZE ?
+                CAN_MAX_MESSAGE_SIZE : message->length);
+    for(int i = 0; i < idSize(extended); i++) {
+        *frame++ = message->id >> (i * 8);
+    }
+    memcpy(frame, &message->receivedUs, FRAME_TIME_SIZE);
+    frame += FRAME_TIME_SIZE;
+    memcpy(frame, message->data, length);
+    if(start != head) {
+        ring->bytes[head] = FRAME_WRAP;
+    }
+
+    uint16_t newHead = start + frameSize;
+    if(newHead == CAN_RECEIVE_QUEUE_BYTES) {
+        newHead = 0;
+    }
+    RING_BARRIER();
+    ring->head = newHead;
+    ring->pushed = pushed + 1;
+    if((uint16_t)(pushed + 1 - popped) > ring->peak) {
+        ring->peak = pushed + 1 - popped;
+    }
+    return true;
+}
+
+RAM_FUNCTION
+bool openxc::can::queue::pop(CanMessageRing* ring, CanMessage* message) {
+    uint16_t popped = ring->popped;
+    if(ring->pushed == popped) {
+        return false;
+    }
+
+    RING_BARRIER();
+    uint16_t tail = ring->tail;
+    if(ring->bytes[tail] == FRAME_WRAP) {
+        tail = 0;
+    }
+    const uint8_t* frame = &ring->bytes[tail];
+    bool extended = *frame & FRAME_EXTENDED;
+    memset(message, 0, sizeof(CanMessage));
+    message->length = *frame++ & FRAME_LENGTH_MASK;
+    message->format = extended ? CanMessageFormat::EXTENDED :
+            CanMessageFormat::STANDARD;
+    for(int i = 0; i < idSize(extended); i++) {
+        message->id |= (uint32_t) *frame++ << (i * 8);
+    }
+    memcpy(&message->receivedUs, frame, FRAME_TIME_SIZE);
+    frame += FRAME_TIME_SIZE;
+    uint8_t length = storedLength(message->length);
+    memcpy(message->data, frame, length);
+
+    tail = frame + length - ring->bytes;
+    if(tail == CAN_RECEIVE_QUEUE_BYTES) {
+        tail = 0;
+    }
+    RING_BARRIER();
+    ring->popped = popped + 1;
+    RING_BARRIER();
+    ring->tail = tail;
+    return true;
+}
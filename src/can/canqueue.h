@@ -0,0 +1,69 @@
+#ifndef __CANQUEUE_H__
+#define __CANQUEUE_H__
+
+#include "can/canutil.h"
+
+namespace openxc {
+namespace can {
+namespace queue {
+
+/* Public: Reset a ring to empty and set its depth.
+ *
+ * Not ISR-safe - call only while the receive interrupt is disabled, e.g.
+ * before the CAN controller is initialized.
+ *
+ * ring - the ring to initialize.
+ * depth - the number of messages the ring should hold. It's rounded down to a
+ *      power of two and clamped to CAN_RECEIVE_QUEUE_MAX_DEPTH. If 0,
+ *      CAN_RECEIVE_QUEUE_MAX_DEPTH is used.
+ */
+void initialize(CanMessageRing* ring, uint16_t depth);
+
+/* Public: Append a message to the ring. Call only from the producer (the CAN
+ * receive ISR).
+ *
+ * Returns true if the message was added, false if the ring was full.
+ */
+bool push(CanMessageRing* ring, const CanMessage* message);
+
+/* Public: Remove the oldest message from the ring. Call only from the consumer
+ * (the main loop).
+ *
+ * message - the destination for the removed message.
+ *
+ * Returns true if a message was removed, false if the ring was empty.
+ */
+bool pop(CanMessageRing* ring, CanMessage* message);
+
+/* Public: Read when the oldest message in the ring was received, without
+ * removing it. Call only from the consumer (the main loop).
+ *
+ * receivedUs - the destination for the message's receivedUs.
+ *
+ * Returns true if there was a message, false if the ring was empty.
+ */
+bool peekReceivedUs(const CanMessageRing* ring, unsigned long* receivedUs);
+
+/* Public: Returns the number of messages in the ring. Safe to call from either
+ * side, although the result may be stale by the time it's used.
+ */
+uint16_t length(const CanMessageRing* ring);
+
+/* Public: Returns the maximum number of messages the ring can hold.
+ */
+uint16_t capacity(const CanMessageRing* ring);
+
+/* Public: Returns the most messages the ring has held at once since it was
+ * initialized, to size CAN_RECEIVE_QUEUE_MAX_DEPTH by.
+ */
+uint16_t peak(const CanMessageRing* ring);
+
+bool empty(const CanMessageRing* ring);
+
+bool full(const CanMessageRing* ring);
+
+} // namespace queue
+} // namespace can
+} // namespace openxc
+
+#endif // __CANQUEUE_H__
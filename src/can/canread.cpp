@@ -1,10 +1,17 @@
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
 #include <canutil/read.h>
 #include <pb_encode.h>
 #include "can/canread.h"
+#include "can/e2e.h"
+#include "payload/json.h"
 #include "config.h"
 #include "util/log.h"
 #include "util/timer.h"
+#include "util/statistics.h"
+#include "util/ram_function.h"
+#include "virtual_signals.h"
 
 using openxc::util::log::debug;
 using openxc::pipeline::MessageClass;
@@ -12,45 +19,219 @@ using openxc::pipeline::Pipeline;
 using openxc::config::getConfiguration;
 using openxc::pipeline::publish;
 
+#define UNASSIGNED_SIGNAL_RANGE 0xffff
+
+// Passthrough copies whole frames into the CanMessage payload, so a CAN FD
+// build needs a message format whose data field holds 64 bytes.
+static_assert(sizeof(((openxc_CanMessage*)0)->data.bytes) >=
+        CAN_MAX_MESSAGE_SIZE,
+        "openxc_CanMessage data is too small for CAN_MAX_MESSAGE_SIZE");
+
+// Every integer with at most this many bits converts to a float exactly.
+#define FLOAT_EXACT_INTEGER_BITS 24
+
 namespace pipeline = openxc::pipeline;
 namespace time = openxc::util::time;
+namespace statistics = openxc::util::statistics;
+namespace virtuals = openxc::signals::virtuals;
+namespace e2e = openxc::can::e2e;
 
-float openxc::can::read::parseSignalBitfield(CanSignal* signal,
+// The most decimal places a signal's values can be rounded to.
+#define MAX_DECIMAL_PLACES 6
+
+static const float DECIMAL_SCALES[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+    1e6f};
+
+/* Private: Round a value to a number of decimal places (clamped to
+ * MAX_DECIMAL_PLACES), keeping it exactly representable as a float.
+ */
+static float roundToDecimalPlaces(float value, uint8_t places) {
+    if(places > MAX_DECIMAL_PLACES) {
+        places = MAX_DECIMAL_PLACES;
+    }
+    float scale = DECIMAL_SCALES[places];
+    return roundf(value * scale) / scale;
+}
+
+/* Private: Decide how to extract a signal, and precompute the shift and mask
+ * if it will fit in a single uint64_t. The fields are the same ones
+ * bitfield_parse_float would use, with bit 0 the most significant bit of the
+ * first byte.
+ */
+/* Private: The mask that keeps a signal's bits once they're shifted to the
+ * bottom of the frame data. It's cheap enough to work out from bitSize on each
+ * frame instead of storing another uint64_t with every signal.
+ */
+static inline uint64_t extractMask(const CanSignal* signal) {
+    return signal->bitSize >= CAN_MESSAGE_SIZE * CHAR_BIT ?
+            ~(uint64_t)0 : ((uint64_t)1 << signal->bitSize) - 1;
+}
+
+static void prepareExtraction(CanSignal* signal) {
+    int width = CAN_MESSAGE_SIZE * CHAR_BIT;
+    // A signal past the first 8 bytes of a CAN FD frame is shifted out of the
+    // 8 bytes starting with its first one, as far as they stay in the frame.
+    int window = 0;
+    if(signal->bitPosition + signal->bitSize > width) {
+        window = signal->bitPosition / CHAR_BIT;
+        if(window > CAN_MAX_MESSAGE_SIZE - CAN_MESSAGE_SIZE) {
+            window = CAN_MAX_MESSAGE_SIZE - CAN_MESSAGE_SIZE;
+        }
+    }
+    int position = signal->bitPosition - window * CHAR_BIT;
+    if(signal->bitSize == 0 || signal->bitSize > width ||
+            position + signal->bitSize > width) {
+        signal->extraction = SIGNAL_EXTRACTION_GENERIC;
+        return;
+    }
+
+    signal->extractByte = window;
+    signal->extractShift = width - position - signal->bitSize;
+    signal->extraction = SIGNAL_EXTRACTION_SHIFT_MASK;
+    signal->integerScaling = false;
+
+    // If the factor and offset are whole numbers and every scaled value is
+    // exactly representable as a float, integer math gives the same result as
+    // the float multiply-add without the soft-float calls.
+    float exactLimit = (float)(1L << FLOAT_EXACT_INTEGER_BITS);
+    if(signal->bitSize <= FLOAT_EXACT_INTEGER_BITS &&
+            fabsf(signal->factor) < exactLimit &&
+            fabsf(signal->offset) < exactLimit &&
+            signal->factor == (int32_t)signal->factor &&
+            signal->offset == (int32_t)signal->offset) {
+        float largest = fabsf(signal->factor) * extractMask(signal) +
+                fabsf(signal->offset);
+        if(largest < exactLimit) {
+            signal->integerFactor = (int32_t)signal->factor;
+            signal->integerOffset = (int32_t)signal->offset;
+            signal->integerScaling = true;
+        }
+    }
+}
+
+/* Private: Measure the signal's name once, so publishing it as JSON can copy
+ * the name instead of checking every character for escaping.
+ */
+static void prepareJsonName(CanSignal* signal) {
+    size_t length = openxc::payload::json::plainStringLength(
+            signal->genericName);
+    signal->jsonNameLength = length > 0 && length < SIGNAL_JSON_NAME_ESCAPED ?
+            length : SIGNAL_JSON_NAME_ESCAPED;
+}
+
+static uint64_t loadBigEndian(const uint8_t* data) {
+    uint64_t value = 0;
+    for(int i = 0; i < CAN_MESSAGE_SIZE; i++) {
+        value = (value << CHAR_BIT) | data[i];
+    }
+    return value;
+}
+
+RAM_FUNCTION
+CanFrame openxc::can::read::loadFrame(CanMessageDefinition* definition,
         const CanMessage* message) {
-    return bitfield_parse_float(message->data, CAN_MESSAGE_SIZE,
-            signal->bitPosition, signal->bitSize, signal->factor,
-            signal->offset);
+    CanFrame frame = {
+        message: message,
+        data: loadBigEndian(message->data),
+        changedBytes: 0xff
+    };
+
+    if(definition != NULL) {
+        if(definition->frameLoaded) {
+            uint64_t difference = frame.data ^ definition->lastFrame;
+            frame.changedBytes = 0;
+            for(int i = 0; i < CAN_MESSAGE_SIZE; i++) {
+                if((difference >> ((CAN_MESSAGE_SIZE - 1 - i) * CHAR_BIT))
+                        & 0xff) {
+                    frame.changedBytes |= 1 << i;
+                }
+            }
+        }
+        definition->lastFrame = frame.data;
+        definition->frameLoaded = true;
+    }
+    return frame;
 }
 
-openxc_DynamicField openxc::can::read::noopDecoder(CanSignal* signal,
-        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
-        bool* send) {
-    return payload::wrapNumber(value);
+RAM_FUNCTION
+bool openxc::can::read::signalChanged(const CanSignal* signal,
+        const CanFrame* frame) {
+    if(signal->bitSize == 0) {
+        return true;
+    }
+
+    int firstByte = signal->bitPosition / CHAR_BIT;
+    int lastByte = (signal->bitPosition + signal->bitSize - 1) / CHAR_BIT;
+    if(lastByte >= CAN_MESSAGE_SIZE) {
+        return true;
+    }
+
+    uint8_t signalBytes = (uint8_t)(((1 << (lastByte + 1)) - 1) &
+            ~((1 << firstByte) - 1));
+    return (frame->changedBytes & signalBytes) != 0;
 }
 
-openxc_DynamicField openxc::can::read::booleanDecoder(CanSignal* signal,
-        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
-        bool* send) {
+RAM_FUNCTION
+float openxc::can::read::parseSignalBitfield(CanSignal* signal,
+        const CanFrame* frame) {
+    if(signal->extraction == SIGNAL_EXTRACTION_UNPREPARED) {
+        prepareExtraction(signal);
+    }
+    if(signal->stateLookup == SIGNAL_STATES_UNPREPARED) {
+        openxc::can::prepareSignalStates(signal);
+    }
+    signal->lastReceivedMs = time::systemTimeMs();
+
+    if(signal->extraction == SIGNAL_EXTRACTION_SHIFT_MASK) {
+        uint64_t data = signal->extractByte == 0 ? frame->data :
+                loadBigEndian(&frame->message->data[signal->extractByte]);
+        uint64_t raw = (data >> signal->extractShift) & extractMask(signal);
+        if(signal->integerScaling) {
+            return (float)((int32_t)raw * signal->integerFactor +
+                    signal->integerOffset);
+        }
+        return raw * signal->factor + signal->offset;
+    }
+
+    // bitfield_parse_float takes an 8-bit offset, so start from the signal's
+    // first byte to reach all of a CAN FD frame
+    int firstByte = signal->bitPosition / CHAR_BIT;
+    if(firstByte >= CAN_MAX_MESSAGE_SIZE) {
+        return signal->offset;
+    }
+    return bitfield_parse_float(&frame->message->data[firstByte],
+            CAN_MAX_MESSAGE_SIZE - firstByte, signal->bitPosition % CHAR_BIT,
+            signal->bitSize, signal->factor, signal->offset);
+}
+
+float openxc::can::read::parseSignalBitfield(CanSignal* signal,
+        const CanMessage* message) {
+    CanFrame frame = loadFrame(NULL, message);
+    return parseSignalBitfield(signal, &frame);
+}
+
+/* Private: The bodies of the built-in decoders, which decodeSignal calls
+ * directly instead of through the signal's decoder pointer.
+ */
+static inline openxc_DynamicField decodeBoolean(float value) {
     return payload::wrapBoolean(value == 0.0 ? false : true);
 }
 
-openxc_DynamicField openxc::can::read::ignoreDecoder(CanSignal* signal,
-        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
-        bool* send) {
+static inline openxc_DynamicField decodeIgnored(bool* send) {
     *send = false;
     openxc_DynamicField decodedValue = {0};
     return decodedValue;
 }
 
-openxc_DynamicField openxc::can::read::stateDecoder(CanSignal* signal,
-        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
-        bool* send) {
+static inline openxc_DynamicField decodeState(const CanSignal* signal,
+        float value, bool* send) {
     openxc_DynamicField decodedValue = {0};
     decodedValue.has_type = true;
     decodedValue.type = openxc_DynamicField_Type_STRING;
     decodedValue.has_string_value = true;
 
-    const CanSignalState* signalState = lookupSignalState(value, signal);
+    const CanSignalState* signalState = openxc::can::lookupSignalState(value,
+            signal);
     if(signalState != NULL) {
         strcpy(decodedValue.string_value, signalState->name);
     } else {
@@ -59,33 +240,34 @@ openxc_DynamicField openxc::can::read::stateDecoder(CanSignal* signal,
     return decodedValue;
 }
 
-static void buildBaseSimpleVehicleMessage(openxc_VehicleMessage* message,
-        const char* name) {
-    message->has_type = true;
-    message->type = openxc_VehicleMessage_Type_SIMPLE;
-    message->has_simple_message = true;
-    message->simple_message = {0};
-    message->simple_message.has_name = true;
-    strcpy(message->simple_message.name, name);
+openxc_DynamicField openxc::can::read::noopDecoder(CanSignal* signal,
+        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
+        bool* send) {
+    return payload::wrapNumber(value);
 }
 
-void openxc::can::read::publishVehicleMessage(const char* name,
-        openxc_DynamicField* value, openxc_DynamicField* event,
-        openxc::pipeline::Pipeline* pipeline) {
-    openxc_VehicleMessage message = {0};
-    buildBaseSimpleVehicleMessage(&message, name);
+openxc_DynamicField openxc::can::read::booleanDecoder(CanSignal* signal,
+        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
+        bool* send) {
+    return decodeBoolean(value);
+}
 
-    if(value != NULL) {
-        message.simple_message.has_value = true;
-        message.simple_message.value = *value;
-    }
+openxc_DynamicField openxc::can::read::ignoreDecoder(CanSignal* signal,
+        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
+        bool* send) {
+    return decodeIgnored(send);
+}
 
-    if(event != NULL) {
-        message.simple_message.has_event = true;
-        message.simple_message.event = *event;
-    }
+openxc_DynamicField openxc::can::read::stateDecoder(CanSignal* signal,
+        CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
+        bool* send) {
+    return decodeState(signal, value, send);
+}
 
-    pipeline::publish(&message, pipeline);
+void openxc::can::read::publishVehicleMessage(const char* name,
+        openxc_DynamicField* value, openxc_DynamicField* event,
+        openxc::pipeline::Pipeline* pipeline) {
+    pipeline::publishSimple(name, value, event, pipeline);
 }
 
 void openxc::can::read::publishVehicleMessage(const char* name,
@@ -93,6 +275,38 @@ void openxc::can::read::publishVehicleMessage(const char* name,
     publishVehicleMessage(name, value, NULL, pipeline);
 }
 
+void openxc::can::read::publishNameDictionary(const CanSignal* signals,
+        int signalCount, openxc::pipeline::Pipeline* pipeline) {
+    for(int i = 0; i < signalCount; i++) {
+        openxc_DynamicField id = payload::wrapNumber(i);
+        openxc_DynamicField name = payload::wrapString(signals[i].genericName);
+        pipeline::publishSimple(NAME_DICTIONARY_MESSAGE_NAME, &id, &name,
+                pipeline);
+    }
+}
+
+bool openxc::can::read::publishLatestValue(const CanSignal* signal,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(signal == NULL || !signal->received) {
+        return false;
+    }
+
+    openxc_DynamicField value;
+    const CanSignalState* state = NULL;
+    if(signal->stateCount > 0) {
+        state = lookupSignalState(signal->lastValue, signal);
+    }
+    if(state != NULL) {
+        value = payload::wrapString(state->name);
+    } else {
+        value = payload::wrapNumber(signal->lastValue);
+    }
+    openxc_DynamicField age = payload::wrapNumber(
+            time::systemTimeMs() - signal->lastReceivedMs);
+    pipeline::publishSimple(signal->genericName, &value, &age, pipeline);
+    return true;
+}
+
 void openxc::can::read::publishNumericalMessage(const char* name, float value,
         openxc::pipeline::Pipeline* pipeline) {
     openxc_DynamicField decodedValue = payload::wrapNumber(value);
@@ -125,8 +339,56 @@ void openxc::can::read::publishBooleanMessage(const char* name, bool value,
     publishVehicleMessage(name, &decodedValue, pipeline);
 }
 
+/* Private: Encode a passthrough frame against the last one sent for its
+ * message, as described for CanBus.passthroughDeltas, and remember it as the
+ * new reference.
+ *
+ * output - the destination for the encoded data, at least size bytes long.
+ *
+ * Returns the number of bytes written to output.
+ */
+static size_t encodePassthroughDelta(CanMessageDefinition* definition,
+        const uint8_t* data, size_t size, uint8_t* output) {
+    // the mask only covers a classic frame, so CAN FD frames are always sent
+    // in full
+    size_t encodedSize = size;
+    uint8_t mask = 0;
+    if(size <= CAN_MESSAGE_SIZE) {
+        encodedSize = 1;
+        for(size_t i = 0; i < size; i++) {
+            if(data[i] != definition->sentValue[i]) {
+                mask |= 1 << i;
+                // a delta that doesn't fit is sent as a keyframe instead
+                if(encodedSize < size) {
+                    output[encodedSize] = data[i];
+                }
+                ++encodedSize;
+            }
+        }
+    }
+
+    if(definition->sentLength != size || encodedSize >= size ||
+            definition->framesSinceKeyframe + 1 >=
+                CAN_PASSTHROUGH_KEYFRAME_INTERVAL) {
+        memcpy(output, data, size);
+        encodedSize = size;
+        definition->framesSinceKeyframe = 0;
+    } else {
+        output[0] = mask;
+        ++definition->framesSinceKeyframe;
+    }
+
+    memcpy(definition->sentValue, data, size);
+    definition->sentLength = size;
+    return encodedSize;
+}
+
 void openxc::can::read::passthroughMessage(CanBus* bus, CanMessage* message,
         CanMessageDefinition* messages, int messageCount, Pipeline* pipeline) {
+    if(!passthroughSelected(bus, message)) {
+        return;
+    }
+
     bool send = true;
     CanMessageDefinition* messageDefinition = lookupMessageDefinition(bus,
             message->id, message->format, messages, messageCount);
@@ -138,17 +400,28 @@ void openxc::can::read::passthroughMessage(CanBus* bus, CanMessage* message,
         // else you couldn't add it to the list for some reason, but don't
         // spam the log about it.
         }
-    } else if(time::conditionalTick(&messageDefinition->frequencyClock) ||
+    } else if(time::scaledConditionalTick(
+                &messageDefinition->frequencyClock, pipeline::rateScale()) ||
             (memcmp(message->data, messageDefinition->lastValue,
-                    CAN_MESSAGE_SIZE) &&
+                    CAN_MAX_MESSAGE_SIZE) &&
                  messageDefinition->forceSendChanged)) {
         send = true;
     } else {
         send = false;
     }
 
+    if(send && pipeline::backedUp(pipeline, MessageClass::CAN)) {
+        // Nothing can take it until the pipeline is flushed again, so don't
+        // bother building the message
+        ++bus->passthroughDropped;
+        send = false;
+    }
+
     size_t adjustedSize = message->length == 0 ?
             CAN_MESSAGE_SIZE : message->length;
+    if(adjustedSize > CAN_MAX_MESSAGE_SIZE) {
+        adjustedSize = CAN_MAX_MESSAGE_SIZE;
+    }
     if(send) {
         openxc_VehicleMessage vehicleMessage = {0};
         vehicleMessage.has_type = true;
@@ -160,9 +433,15 @@ void openxc::can::read::passthroughMessage(CanBus* bus, CanMessage* message,
         vehicleMessage.can_message.has_bus = true;
         vehicleMessage.can_message.bus = bus->address;
         vehicleMessage.can_message.has_data = true;
-        vehicleMessage.can_message.data.size = adjustedSize;
-        memcpy(vehicleMessage.can_message.data.bytes, message->data,
-                adjustedSize);
+        if(bus->passthroughDeltas && messageDefinition != NULL) {
+            vehicleMessage.can_message.data.size = encodePassthroughDelta(
+                    messageDefinition, message->data, adjustedSize,
+                    vehicleMessage.can_message.data.bytes);
+        } else {
+            vehicleMessage.can_message.data.size = adjustedSize;
+            memcpy(vehicleMessage.can_message.data.bytes, message->data,
+                    adjustedSize);
+        }
 
         pipeline::publish(&vehicleMessage, pipeline);
     }
@@ -180,40 +459,490 @@ void openxc::can::read::translateSignal(CanSignal* signal,
         return;
     }
 
-    float value = parseSignalBitfield(signal, message);
+    CanFrame frame = loadFrame(NULL, message);
+    translateSignal(signal, &frame, signals, signalCount, pipeline);
+}
+
+/* Private: A signal whose values are summarized over a window instead of each
+ * being published.
+ *
+ * signal - The aggregated signal.
+ * windowMs - The length of each window.
+ * windowStartMs - When the current window started.
+ * lastValue - The last decoded value, which is sampled again when a frame
+ *      skips decoding because its raw value didn't change.
+ * sampled - True if lastValue has been set since aggregation started.
+ * statistic - The values seen in the current window.
+ */
+typedef struct {
+    const CanSignal* signal;
+    unsigned long windowMs;
+    unsigned long windowStartMs;
+    float lastValue;
+    bool sampled;
+    statistics::WindowStatistic statistic;
+} SignalAggregate;
+
+static SignalAggregate AGGREGATES[MAX_AGGREGATED_SIGNALS];
+static int aggregateCount = 0;
+
+static SignalAggregate* findAggregate(const CanSignal* signal) {
+    for(int i = 0; i < aggregateCount; i++) {
+        if(AGGREGATES[i].signal == signal) {
+            return &AGGREGATES[i];
+        }
+    }
+    return NULL;
+}
+
+/* Private: Publish the summary of an aggregate's window, if it saw any values,
+ * and start a new one.
+ */
+static void publishAggregate(SignalAggregate* aggregate,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(aggregate->statistic.count > 0) {
+        const char* name = aggregate->signal->genericName;
+        openxc_DynamicField value = payload::wrapNumber(
+                aggregate->statistic.min);
+        openxc_DynamicField event = payload::wrapString("min");
+        pipeline::publishSimple(name, &value, &event, pipeline);
+
+        value = payload::wrapNumber(aggregate->statistic.max);
+        event = payload::wrapString("max");
+        pipeline::publishSimple(name, &value, &event, pipeline);
+
+        value = payload::wrapNumber(statistics::mean(&aggregate->statistic));
+        event = payload::wrapString("mean");
+        pipeline::publishSimple(name, &value, &event, pipeline);
+
+        value = payload::wrapNumber(aggregate->statistic.count);
+        event = payload::wrapString("count");
+        pipeline::publishSimple(name, &value, &event, pipeline);
+    }
+    statistics::initialize(&aggregate->statistic);
+    aggregate->windowStartMs = time::systemTimeMs();
+}
+
+static bool windowEnded(const SignalAggregate* aggregate) {
+    return time::systemTimeMs() - aggregate->windowStartMs >=
+            aggregate->windowMs;
+}
+
+static void sampleAggregate(SignalAggregate* aggregate, float value,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(windowEnded(aggregate)) {
+        publishAggregate(aggregate, pipeline);
+    }
+    statistics::update(&aggregate->statistic, value);
+    aggregate->lastValue = value;
+    aggregate->sampled = true;
+}
+
+bool openxc::can::read::setAggregation(const CanSignal* signal,
+        unsigned long windowMs) {
+    if(signal == NULL) {
+        return false;
+    }
+
+    SignalAggregate* aggregate = findAggregate(signal);
+    if(windowMs == 0) {
+        if(aggregate != NULL) {
+            *aggregate = AGGREGATES[--aggregateCount];
+        }
+        return true;
+    }
+
+    if(aggregate == NULL) {
+        if(aggregateCount >= MAX_AGGREGATED_SIGNALS) {
+            debug("Can't aggregate more than %d signals",
+                    MAX_AGGREGATED_SIGNALS);
+            return false;
+        }
+        aggregate = &AGGREGATES[aggregateCount++];
+        aggregate->signal = signal;
+    }
+    aggregate->windowMs = windowMs;
+    aggregate->windowStartMs = time::systemTimeMs();
+    // without a decoder, the last value received is also the last decoded one
+    aggregate->sampled = signal->received && signal->decoder == NULL;
+    aggregate->lastValue = signal->lastValue;
+    statistics::initialize(&aggregate->statistic);
+    return true;
+}
+
+unsigned long openxc::can::read::aggregationWindow(const CanSignal* signal) {
+    const SignalAggregate* aggregate = findAggregate(signal);
+    return aggregate != NULL ? aggregate->windowMs : 0;
+}
+
+void openxc::can::read::resetAggregations() {
+    aggregateCount = 0;
+}
+
+void openxc::can::read::publishAggregates(
+        openxc::pipeline::Pipeline* pipeline) {
+    for(int i = 0; i < aggregateCount; i++) {
+        if(windowEnded(&AGGREGATES[i])) {
+            publishAggregate(&AGGREGATES[i], pipeline);
+        }
+    }
+}
+
+RAM_FUNCTION
+void openxc::can::read::translateSignal(CanSignal* signal,
+        const CanFrame* frame, CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(signal == NULL || frame == NULL) {
+        return;
+    }
+
+    if(signal->extraction == SIGNAL_EXTRACTION_UNPREPARED) {
+        prepareExtraction(signal);
+    }
+
+    if(signal->extraction == SIGNAL_EXTRACTION_SHIFT_MASK) {
+        uint64_t raw = (frame->data >> signal->extractShift)
+                & extractMask(signal);
+        // shouldSend never publishes an unchanged value from a signal that
+        // doesn't send the same value twice, so unless the decoder wants to
+        // see every frame there's nothing to do - other than keep the
+        // frequency clock in step with what shouldSend would have done.
+        if(signal->received && !signal->sendSame && !signal->alwaysDecode &&
+                raw == signal->lastRawValue) {
+            time::scaledConditionalTick(&signal->frequencyClock,
+                    pipeline::rateScale());
+            if(aggregateCount > 0) {
+                // still a sample, with the same value as the last one
+                SignalAggregate* aggregate = findAggregate(signal);
+                if(aggregate != NULL && aggregate->sampled) {
+                    sampleAggregate(aggregate, aggregate->lastValue,
+                            pipeline);
+                }
+            }
+            return;
+        }
+        signal->lastRawValue = raw;
+    }
+
+    float value = parseSignalBitfield(signal, frame);
 
     bool send = true;
-    // Must call the decoders every time, regardless of if we are going to
+    // Otherwise call the decoders every time, regardless of if we are going to
     // decide to send the signal or not.
     openxc_DynamicField decodedValue = openxc::can::read::decodeSignal(signal,
             value, signals, signalCount, &send);
-    if(send && shouldSend(signal, value)) {
-        openxc::can::read::publishVehicleMessage(signal->genericName, &decodedValue, pipeline);
+    SignalAggregate* aggregate = NULL;
+    if(aggregateCount > 0 && decodedValue.type == openxc_DynamicField_Type_NUM) {
+        aggregate = findAggregate(signal);
     }
+    if(aggregate != NULL) {
+        if(send) {
+            sampleAggregate(aggregate, decodedValue.numeric_value, pipeline);
+        }
+    } else if(send && shouldSend(signal, value)) {
+        if(signals != NULL && signal >= signals &&
+                signal < signals + signalCount) {
+            if(signal->jsonNameLength == 0) {
+                prepareJsonName(signal);
+            }
+            pipeline::publishSignal(signal->genericName,
+                    signal->jsonNameLength == SIGNAL_JSON_NAME_ESCAPED ?
+                        0 : signal->jsonNameLength,
+                    signal - signals, signal->factor, &decodedValue, NULL,
+                    pipeline);
+        } else {
+            openxc::can::read::publishVehicleMessage(signal->genericName,
+                    &decodedValue, pipeline);
+        }
+    }
+    float previous = signal->received ? signal->lastValue : value;
+    bool changed = !signal->received || value != previous;
     signal->received = true;
     signal->lastValue = value;
+    if(changed) {
+        virtuals::inputChanged(signal, previous, pipeline);
+    }
+}
+
+/* Private: Indices into the signal arrays passed to indexSignalDispatch,
+ * grouped by message. Each indexed array (one per resident message set) has
+ * its own slice of the order table, starting at 'first', and each message's
+ * firstSignal and signalCount select its range of that slice.
+ */
+static struct {
+    struct {
+        const CanSignal* signals;
+        int signalCount;
+        uint16_t first;
+    } arrays[RESIDENT_MESSAGE_SET_COUNT];
+    int arrayCount;
+    uint16_t used;
+    uint16_t order[SIGNAL_DISPATCH_TABLE_SIZE];
+} dispatchTable;
+
+/* Private: Return the position of an indexed signal array in the dispatch
+ * table, or -1 if it isn't indexed.
+ */
+static int findDispatchArray(const CanSignal* signals, int signalCount) {
+    for(int i = 0; i < dispatchTable.arrayCount; i++) {
+        if(dispatchTable.arrays[i].signals == signals &&
+                dispatchTable.arrays[i].signalCount == signalCount) {
+            return i;
+        }
+    }
+    return -1;
 }
 
+bool openxc::can::read::indexSignalDispatch(CanSignal* signals,
+        int signalCount) {
+    if(signals == NULL || signalCount <= 0) {
+        dispatchTable.arrayCount = 0;
+        dispatchTable.used = 0;
+        return false;
+    }
+
+    if(signalCount > SIGNAL_DISPATCH_TABLE_SIZE) {
+        debug("%d signals don't fit in the dispatch table, decoding will be "
+                "slower", signalCount);
+        return false;
+    }
+
+    for(int i = 0; i < signalCount; i++) {
+        if(signals[i].message == NULL) {
+            debug("Signal %s has no message, not building dispatch table",
+                    signals[i].genericName);
+            return false;
+        }
+    }
+
+    // Re-indexing an array reuses its slice. Otherwise it's added after the
+    // others, and if there's no room left the table starts over with just
+    // this array.
+    int array = findDispatchArray(signals, signalCount);
+    if(array == -1) {
+        if(dispatchTable.arrayCount == RESIDENT_MESSAGE_SET_COUNT ||
+                dispatchTable.used + signalCount >
+                    SIGNAL_DISPATCH_TABLE_SIZE) {
+            dispatchTable.arrayCount = 0;
+            dispatchTable.used = 0;
+        }
+        array = dispatchTable.arrayCount++;
+        dispatchTable.arrays[array].first = dispatchTable.used;
+        dispatchTable.used += signalCount;
+    }
+    // not usable until it's complete
+    dispatchTable.arrays[array].signals = NULL;
+
+    for(int i = 0; i < signalCount; i++) {
+        signals[i].message->firstSignal = UNASSIGNED_SIGNAL_RANGE;
+        signals[i].message->signalCount = 0;
+    }
+
+    for(int i = 0; i < signalCount; i++) {
+        ++signals[i].message->signalCount;
+    }
+
+    // The first time a message is seen, give it the next range of the slice
+    // and reset its count so it can be used as the fill cursor.
+    uint16_t nextRange = dispatchTable.arrays[array].first;
+    for(int i = 0; i < signalCount; i++) {
+        CanMessageDefinition* message = signals[i].message;
+        if(message->firstSignal == UNASSIGNED_SIGNAL_RANGE) {
+            message->firstSignal = nextRange;
+            nextRange += message->signalCount;
+            message->signalCount = 0;
+        }
+        dispatchTable.order[message->firstSignal + message->signalCount++] = i;
+    }
+
+    dispatchTable.arrays[array].signals = signals;
+    dispatchTable.arrays[array].signalCount = signalCount;
+    return true;
+}
+
+void openxc::can::read::staggerSignalClocks(CanSignal* signals,
+        int signalCount) {
+    for(int i = 0; i < signalCount; i++) {
+        unsigned long period = time::period(&signals[i].frequencyClock);
+        if(period == 0) {
+            continue;
+        }
+
+        int index = 0;
+        int count = 0;
+        for(int j = 0; j < signalCount; j++) {
+            if(time::period(&signals[j].frequencyClock) == period) {
+                if(j < i) {
+                    ++index;
+                }
+                ++count;
+            }
+        }
+        time::setPhase(&signals[i].frequencyClock,
+                time::phaseOffset(index, count, period));
+    }
+}
+
+/* Private: Returns until when translateSignal would do nothing but tick the
+ * signal's frequency clock for a frame with the same data as the last one, or
+ * 0 if it has to see the frame. A clock with no frequency ticks every time, but
+ * that only matters once it has a frequency, so it never holds a frame up.
+ */
+static unsigned long signalQuietUntil(CanSignal* signal) {
+    if(!signal->received || signal->sendSame || signal->alwaysDecode ||
+            signal->extraction != SIGNAL_EXTRACTION_SHIFT_MASK) {
+        return 0;
+    }
+
+    time::FrequencyClock* clock = &signal->frequencyClock;
+    unsigned long period = time::period(clock);
+    if(period == 0) {
+        return ULONG_MAX;
+    }
+
+    if(clock->lastTick == 0 || (clock->timeFunction != NULL &&
+                clock->timeFunction != time::systemTimeMs)) {
+        return 0;
+    }
+    return clock->lastTick + period;
+}
+
+RAM_FUNCTION
+void openxc::can::read::translateMessageSignals(
+        CanMessageDefinition* definition, const CanMessage* message,
+        CanSignal* signals, int signalCount, Pipeline* pipeline) {
+    if(definition == NULL || message == NULL) {
+        return;
+    }
+
+    // Before the frame is loaded, so a rejected one isn't what the next is
+    // compared to
+    if(!e2e::validate(definition, message)) {
+        return;
+    }
+
+    CanFrame frame = loadFrame(definition, message);
+    // The frequency clocks are worked out at the unthrottled rate, and an
+    // aggregated signal takes a sample from every frame
+    if(frame.changedBytes == 0 && message->length <= CAN_MESSAGE_SIZE &&
+            aggregateCount == 0 && pipeline::rateScale() == 1 &&
+            time::systemTimeMs() < definition->quietUntilMs) {
+        return;
+    }
+
+    unsigned long quietUntil = ULONG_MAX;
+    int array = findDispatchArray(signals, signalCount);
+    if(array != -1) {
+        int first = dispatchTable.arrays[array].first;
+        int end = definition->firstSignal + definition->signalCount;
+        for(int i = MAX(definition->firstSignal, first); i < end &&
+                i < first + signalCount; i++) {
+            CanSignal* signal = &signals[dispatchTable.order[i]];
+            // a definition that isn't in the indexed message set may still
+            // carry a range from an earlier one
+            if(signal->message == definition && !signal->disabled &&
+                    !signal->profileDisabled) {
+                translateSignal(signal, &frame, signals, signalCount,
+                        pipeline);
+                quietUntil = MIN(quietUntil, signalQuietUntil(signal));
+            }
+        }
+    } else {
+        for(int i = 0; i < signalCount; i++) {
+            if(signals[i].message == definition && !signals[i].disabled &&
+                    !signals[i].profileDisabled) {
+                translateSignal(&signals[i], &frame, signals, signalCount,
+                        pipeline);
+                quietUntil = MIN(quietUntil, signalQuietUntil(&signals[i]));
+            }
+        }
+    }
+    definition->quietUntilMs = quietUntil;
+}
+
+RAM_FUNCTION
+bool openxc::can::read::dispatchMessage(CanBus* bus,
+        const CanMessage* message, CanMessageDefinition* messages,
+        int messageCount, CanSignal* signals, int signalCount,
+        Pipeline* pipeline) {
+    CanMessageDefinition* definition = lookupMessageDefinition(bus,
+            message->id, message->format, messages, messageCount);
+    if(definition == NULL) {
+        return false;
+    }
+
+    translateMessageSignals(definition, message, signals, signalCount,
+            pipeline);
+    return true;
+}
+
+static bool hasDeadband(const CanSignal* signal) {
+    return signal->deadband > 0 || signal->relativeDeadband > 0;
+}
+
+/* Private: Returns true if the value is different enough from the signal's
+ * last value to be worth sending - any difference at all, unless the signal has
+ * a deadband.
+ */
+static bool changedSignificantly(const CanSignal* signal, float value) {
+    if(!hasDeadband(signal)) {
+        return value != signal->lastValue;
+    }
+
+    if(!signal->received) {
+        return true;
+    }
+    float band = MAX(signal->deadband,
+            signal->relativeDeadband * fabsf(signal->lastSentValue));
+    return fabsf(value - signal->lastSentValue) > band;
+}
+
+RAM_FUNCTION
 bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
     bool send = true;
-    if(time::conditionalTick(&signal->frequencyClock) ||
-            (value != signal->lastValue && signal->forceSendChanged)) {
-        if(signal->received && !signal->sendSame
-                && value == signal->lastValue) {
+    bool changed = changedSignificantly(signal, value);
+    if(time::scaledConditionalTick(&signal->frequencyClock,
+                    pipeline::rateScale()) ||
+            (changed && signal->forceSendChanged)) {
+        // a deadband suppresses small changes even if the signal otherwise
+        // sends the same value again
+        if(signal->received && (!signal->sendSame || hasDeadband(signal))
+                && !changed) {
             send = false;
         }
     } else {
         send = false;
     }
+
+    if(send) {
+        signal->lastSentValue = value;
+    }
     return send;
 }
 
+RAM_FUNCTION
 openxc_DynamicField openxc::can::read::decodeSignal(CanSignal* signal,
         float value, CanSignal* signals, int signalCount, bool* send) {
-    SignalDecoder decoder = signal->decoder == NULL ?
-            noopDecoder : signal->decoder;
-    openxc_DynamicField decodedValue = decoder(signal, signals,
-            signalCount, &getConfiguration()->pipeline, value, send);
+    // The built-in decoders are recognized by address and decoded inline, so
+    // only custom decoders cost an indirect call
+    openxc_DynamicField decodedValue;
+    SignalDecoder decoder = signal->decoder;
+    if(decoder == NULL || decoder == noopDecoder) {
+        decodedValue = payload::wrapNumber(value);
+    } else if(decoder == booleanDecoder) {
+        decodedValue = decodeBoolean(value);
+    } else if(decoder == stateDecoder) {
+        decodedValue = decodeState(signal, value, send);
+    } else if(decoder == ignoreDecoder) {
+        decodedValue = decodeIgnored(send);
+    } else {
+        decodedValue = decoder(signal, signals, signalCount,
+                &getConfiguration()->pipeline, value, send);
+    }
+    if(signal->decimalPlaces > 0 && decodedValue.has_numeric_value) {
+        decodedValue.numeric_value = roundToDecimalPlaces(
+                decodedValue.numeric_value, signal->decimalPlaces);
+    }
     return decodedValue;
 }
 
@@ -5,10 +5,51 @@
 #include "pipeline.h"
 #include "openxc.pb.h"
 
+// The name of the simple messages published by publishNameDictionary.
+#define NAME_DICTIONARY_MESSAGE_NAME "signal_dictionary"
+
+// The most signals that can be aggregated at once (see setAggregation).
+#ifndef MAX_AGGREGATED_SIGNALS
+#define MAX_AGGREGATED_SIGNALS 8
+#endif
+
+/* Public: A received CAN message loaded once for decoding, shared by all of
+ * the signals in the message.
+ *
+ * message - The received message.
+ * data - The first 8 bytes of the message's data field as a big-endian
+ *      uint64_t, so bit 0 in CanSignal bitPosition numbering is its most
+ *      significant bit.
+ * changedBytes - Bit i is set if byte i of the data is different than in the
+ *      last frame loaded for the same message definition. All bits are set if
+ *      there was no previous frame. Signals past the first 8 bytes of a CAN FD
+ *      frame are always treated as changed.
+ */
+struct CanFrame {
+    const CanMessage* message;
+    uint64_t data;
+    uint8_t changedBytes;
+};
+typedef struct CanFrame CanFrame;
+
 namespace openxc {
 namespace can {
 namespace read {
 
+/* Public: Load a received message into a CanFrame and compare it to the last
+ * frame loaded for the same definition.
+ *
+ * definition - The definition of the received message, which will remember
+ *      this frame. If NULL, every byte is considered changed.
+ * message - The received CAN message. It must outlive the returned frame.
+ */
+CanFrame loadFrame(CanMessageDefinition* definition, const CanMessage* message);
+
+/* Public: Returns true if any byte that holds part of the signal changed in
+ * the frame, according to its changedBytes.
+ */
+bool signalChanged(const CanSignal* signal, const CanFrame* frame);
+
 /* Public: Parse a signal from a CAN message, apply any required transforations
  *      to get a human readable value and public the result to the pipeline.
  *
@@ -30,6 +71,136 @@ void translateSignal(CanSignal* signal,
         const CanMessage* message, CanSignal* signals, int signalCount,
         openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Parse, translate and publish a signal from a frame that's already
+ * been loaded with loadFrame. This is the same as translateSignal(CanSignal*,
+ * const CanMessage*, CanSignal*, int, Pipeline*), but doesn't re-read the
+ * message data for each signal.
+ *
+ * Both versions skip the decoder when the signal has sendSame set to false,
+ * its raw bits haven't changed since the last frame and alwaysDecode isn't
+ * set.
+ */
+void translateSignal(CanSignal* signal, const CanFrame* frame,
+        CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Summarize a signal's values over fixed windows instead of publishing
+ * each one. At the end of each window that saw any values, translateSignal
+ * publishes four messages named after the signal, with the minimum, maximum,
+ * mean and number of values, e.g.
+ *
+ *      {"name": "vehicle_speed", "value": 42.5, "event": "mean"}
+ *
+ * Only numerical values are aggregated - a value the signal's decoder turns
+ * into a string or boolean is published as usual. Frames that skip decoding
+ * because the signal's raw bits didn't change still count as samples.
+ *
+ * signal - The signal to aggregate.
+ * windowMs - The length of each window, or 0 to publish every value again.
+ *
+ * Returns false if MAX_AGGREGATED_SIGNALS signals are already aggregated.
+ */
+bool setAggregation(const CanSignal* signal, unsigned long windowMs);
+
+/* Public: Return the aggregation window for a signal, or 0 if its values are
+ * each published.
+ */
+unsigned long aggregationWindow(const CanSignal* signal);
+
+/* Public: Stop aggregating every signal. */
+void resetAggregations();
+
+/* Public: Publish the summary of every aggregation window that has ended,
+ * so a signal that stops being received still gets its last window sent. Call
+ * this once per main loop.
+ *
+ * pipeline - The pipeline to publish the summaries on.
+ */
+void publishAggregates(openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Group the signals of the active message set by the message they
+ * belong to, so translateMessageSignals can find all of a message's signals
+ * without scanning the whole array. Call this once the active message set is
+ * known, e.g. right after signals::initialize().
+ *
+ * Signals keep their original relative order within each message.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ *
+ * Up to RESIDENT_MESSAGE_SET_COUNT arrays (one per message set) stay indexed
+ * at once, sharing the SIGNAL_DISPATCH_TABLE_SIZE entries of the table, so
+ * switching the active message set doesn't need to index it again. When another
+ * array doesn't fit, the table is cleared first. Passing a NULL array clears
+ * it.
+ *
+ * Returns true if the array was indexed. If any signal doesn't have a message
+ * or the array is larger than SIGNAL_DISPATCH_TABLE_SIZE, it's left out of the
+ * table and translateMessageSignals falls back to scanning every signal.
+ */
+bool indexSignalDispatch(CanSignal* signals, int signalCount);
+
+/* Public: Spread the frequency clocks of signals that share a frequency evenly
+ * over their period, so they aren't all due to send on the same pass through
+ * the main loop. The k-th of N signals with a period next sends no sooner than
+ * k/N of the period from now. Which signal gets which offset only depends on
+ * its position in the array, so the schedule is the same on every startup.
+ *
+ * Call this once the active message set is known, after indexSignalDispatch.
+ * Signals with a frequency of 0 (unlimited) aren't changed.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ */
+void staggerSignalClocks(CanSignal* signals, int signalCount);
+
+/* Public: Parse, translate and publish every signal in a received CAN
+ * message.
+ *
+ * If the signals array has been passed to indexSignalDispatch, this is a
+ * single lookup in the dispatch table plus a loop over the message's own
+ * signals. The message data is loaded into a CanFrame once and shared by all
+ * of them. Signals that are disabled are skipped before anything is parsed.
+ *
+ * Most messages repeat the same data over and over. If the data is the same as
+ * the last frame's and none of the message's signals could publish it (each
+ * has been received, doesn't set sendSame or alwaysDecode, and isn't due for a
+ * frequency clock tick), the frame is skipped without looking at any signals.
+ * That's only done while no signal is aggregated and the pipeline isn't
+ * throttling, and a change to a signal's settings at runtime should reset its
+ * message's quietUntilMs.
+ *
+ * A frame that fails its message's alive counter or checksum check (see
+ * CanMessageProtection) is dropped before anything else.
+ *
+ * definition - The definition of the received message.
+ * message - The received CAN message.
+ * signals - An array of all active signals.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to send any translated signals.
+ */
+void translateMessageSignals(CanMessageDefinition* definition,
+        const CanMessage* message, CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Find the definition of a received message and translate all of its
+ * signals. This can be used from signals::decodeCanMessage in place of a
+ * switch over message IDs.
+ *
+ * bus - The CAN bus on which this message was received.
+ * message - The received CAN message.
+ * messages - The list of all predefined CAN messages.
+ * messageCount - The length of the messages array.
+ * signals - An array of all active signals.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to send any translated signals.
+ *
+ * Returns true if the message has a definition.
+ */
+bool dispatchMessage(CanBus* bus, const CanMessage* message,
+        CanMessageDefinition* messages, int messageCount, CanSignal* signals,
+        int signalCount, openxc::pipeline::Pipeline* pipeline);
+
 /* Public: Publish a CAN message to the pipeline without any parsing or
  * processing - just encapsulate it in a VehicleMessage.
  *
@@ -74,6 +245,38 @@ void publishVehicleMessage(const char* name, openxc_DynamicField* value,
 void publishVehicleMessage(const char* name, openxc_DynamicField* value,
                 openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Publish the ID of every signal in the signal table, for receivers of
+ * signals published while the pipeline's name dictionary is enabled. Each
+ * signal is sent as a simple message named NAME_DICTIONARY_MESSAGE_NAME, with
+ * the ID as its value and the signal's name as its event, e.g.
+ *
+ *      {"name": "signal_dictionary", "value": 3, "event": "vehicle_speed"}
+ *
+ * signals - The signal table.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to publish the dictionary on.
+ */
+void publishNameDictionary(const CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Publish the last value received for a signal, named after the signal
+ * and with the number of milliseconds since its last frame as the event, e.g.
+ *
+ *      {"name": "vehicle_speed", "value": 42, "event": 120}
+ *
+ * State-based signals are sent as their state name. Signals with a custom
+ * decoder are sent as their numerical value, since the decoder isn't called
+ * again.
+ *
+ * signal - The signal to publish.
+ * pipeline - The pipeline to publish the value on.
+ *
+ * Returns true if the value was published, or false if the signal hasn't been
+ * received.
+ */
+bool publishLatestValue(const CanSignal* signal,
+        openxc::pipeline::Pipeline* pipeline);
+
 /* Public: Create a new OpenXC message and publish it on the pipeline.
  *
  * There are three versions of this function, each taking a different type for
@@ -199,6 +402,11 @@ openxc_DynamicField noopDecoder(CanSignal* signal, CanSignal* signals,
  */
 float parseSignalBitfield(CanSignal* signal, const CanMessage* message);
 
+/* Public: Parse the signal's bitfield from a frame loaded with loadFrame and
+ * return the raw value.
+ */
+float parseSignalBitfield(CanSignal* signal, const CanFrame* frame);
+
 /* Public: Parse a signal from a CAN message and apply any required
  * transforations to get a human readable value.
  *
@@ -226,6 +434,10 @@ openxc_DynamicField decodeSignal(CanSignal* signal,
  * bool*) but you must parse the bitfield value of the signal from the CAN
  * message yourself. This is useful if you need that raw value for something
  * else.
+ *
+ * Signals using noopDecoder, booleanDecoder, stateDecoder or ignoreDecoder (or
+ * no decoder) are decoded inline, without calling through the decoder pointer.
+ * Any other decoder is called as usual.
  */
 openxc_DynamicField decodeSignal(CanSignal* signal, float value,
         CanSignal* signals, int signalCount, bool* send);
@@ -235,7 +447,9 @@ openxc_DynamicField decodeSignal(CanSignal* signal, float value,
  *
  * A signal may decide not to publish if it has a limited frequency and the
  * timer hasn't expired yet, or if it's configured to only send if the value
- * changes and the it has not.
+ * changes and the it has not. With a deadband (see CanSignal), the value has
+ * to move beyond the band around the last value sent to count as a change, and
+ * values inside the band are never sent.
  *
  * Returns true of the value should be published.
  */
@@ -1,47 +1,169 @@
 #include "can/canutil.h"
+#include "can/canqueue.h"
 #include "can/canwrite.h"
+#include "can/j1939.h"
 #include "util/log.h"
+#include "util/ram_function.h"
 #include "config.h"
 
 #define BUS_STATS_LOG_FREQUENCY_S 15
-#define CAN_MESSAGE_TOTAL_BIT_SIZE 128
+// The bits of a frame after the CRC, which aren't stuffed: the CRC delimiter,
+// ACK slot and delimiter, end of frame and interframe space.
+#define CAN_FRAME_TRAILER_BITS (1 + 2 + 7 + 3)
+#define CAN_CRC15_POLYNOMIAL 0x4599
+#define CAN_STANDARD_ID_BITS 11
+#define CAN_EXTENDED_ID_BITS 18
+#define CAN_ERROR_PASSIVE_LIMIT 128
+#define MESSAGE_INDEX_DYNAMIC_FLAG 0x8000
+// Keep the load factor of the message index under 75% so probe chains stay
+// short.
+#define MESSAGE_INDEX_MAX_ENTRIES (CAN_MESSAGE_INDEX_SIZE * 3 / 4)
 
 namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
 namespace config = openxc::config;
+namespace queue = openxc::can::queue;
 
 using openxc::util::log::debug;
 using openxc::util::statistics::DeltaStatistic;
 
+// The dynamic message definitions shared by all buses. An entry is in use if
+// its definition has a bus, in which case it's in that bus's dynamicMessages.
+static CanMessageDefinitionListEntry DYNAMIC_MESSAGE_POOL[
+        MAX_DYNAMIC_MESSAGE_COUNT];
+static CanMessageDefinitionList freeDynamicMessages;
+static bool dynamicMessagePoolInitialized = false;
+static int dynamicMessagePoolUsed = 0;
+static uint32_t dynamicMessageUseCount = 0;
+
+static void initializeDynamicMessagePool() {
+    if(dynamicMessagePoolInitialized) {
+        return;
+    }
+
+    LIST_INIT(&freeDynamicMessages);
+    for(size_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        DYNAMIC_MESSAGE_POOL[i].definition.bus = NULL;
+        LIST_INSERT_HEAD(&freeDynamicMessages, &DYNAMIC_MESSAGE_POOL[i],
+                entries);
+    }
+    dynamicMessagePoolInitialized = true;
+}
+
+static void releaseDynamicMessage(CanMessageDefinitionListEntry* entry) {
+    CanBus* bus = entry->definition.bus;
+    LIST_REMOVE(entry, entries);
+    --bus->dynamicMessageCount;
+    bus->messageIndexValid = false;
+    entry->definition.bus = NULL;
+}
+
+/* Private: Take a free entry from the dynamic message pool, or if there are
+ * none, the one (on any bus) that was looked up least recently.
+ *
+ * Returns NULL only if the pool is empty.
+ */
+static CanMessageDefinitionListEntry* allocateDynamicMessage() {
+    CanMessageDefinitionListEntry* entry = LIST_FIRST(&freeDynamicMessages);
+    if(entry != NULL) {
+        LIST_REMOVE(entry, entries);
+        ++dynamicMessagePoolUsed;
+        return entry;
+    }
+
+    uint32_t oldestAge = 0;
+    for(size_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        CanMessageDefinitionListEntry* candidate = &DYNAMIC_MESSAGE_POOL[i];
+        uint32_t age = dynamicMessageUseCount - candidate->lastUsed;
+        if(candidate->definition.bus != NULL &&
+                (entry == NULL || age > oldestAge)) {
+            entry = candidate;
+            oldestAge = age;
+        }
+    }
+
+    if(entry != NULL) {
+        ++entry->definition.bus->dynamicMessagesEvicted;
+        releaseDynamicMessage(entry);
+    }
+    return entry;
+}
+
+static void touchDynamicMessage(CanMessageDefinitionListEntry* entry) {
+    entry->lastUsed = ++dynamicMessageUseCount;
+}
+
 const int openxc::can::CAN_ACTIVE_TIMEOUT_S = 30;
 
 void openxc::can::initializeCommon(CanBus* bus) {
     debug("Initializing CAN node %d...", bus->address);
-    QUEUE_INIT(CanMessage, &bus->receiveQueue);
+    queue::initialize(&bus->receiveQueue, bus->receiveQueueDepth);
     QUEUE_INIT(CanMessage, &bus->sendQueue);
+    bus->sendQueuePeak = 0;
+    bus->pendingWriteCount = 0;
+    bus->writesExpired = 0;
+    bus->passthroughFilterCount = 0;
+    bus->gatewayRouteCount = 0;
+    bus->gatewayForwarded = 0;
+    bus->gatewayDropped = 0;
+    bus->writing = false;
 
     LIST_INIT(&bus->acceptanceFilters);
     LIST_INIT(&bus->freeAcceptanceFilters);
+    memset((void*)bus->acceptedStandardIds, 0,
+            sizeof(bus->acceptedStandardIds));
+    bus->acceptedExtendedIdCount = 0;
     for(size_t i = 0; i < MAX_ACCEPTANCE_FILTERS; i++) {
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters,
                 &bus->acceptanceFilterEntries[i], entries);
     }
 
+    bus->indexedMessages = NULL;
+    bus->indexedMessageCount = 0;
+    bus->messageIndexEntries = 0;
+    bus->messageIndexValid = false;
+    bus->messageIndexOverflow = false;
+
     bus->writeHandler = openxc::can::write::sendMessage;
     bus->lastMessageReceived = 0;
-    LIST_INIT(&bus->dynamicMessages);
-    LIST_INIT(&bus->freeMessageDefinitions);
-    for(size_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
-        LIST_INSERT_HEAD(&bus->freeMessageDefinitions,
-                &bus->definitionEntries[i], entries);
+    bus->lastReceiveBatchSize = 0;
+    bus->bitsReceived = 0;
+    bus->loadWindowStartMs = time::systemTimeMs();
+    bus->loadWindowBits = 0;
+    bus->loadWindowReceived = bus->messagesReceived;
+    bus->loadWindowDropped = bus->messagesDropped;
+    bus->busLoad = 0;
+    bus->peakBusLoad = 0;
+    bus->transmitErrorCount = 0;
+    bus->receiveErrorCount = 0;
+    bus->peakErrorCount = 0;
+    bus->busOff = false;
+    bus->busOffCount = 0;
+    bus->autoBaudSearching = false;
+    bus->surveying = false;
+    bus->learningFilters = false;
+    bus->filtersLearned = false;
+
+    initializeDynamicMessagePool();
+    CanMessageDefinitionListEntry* entry;
+    while((entry = LIST_FIRST(&bus->dynamicMessages)) != NULL) {
+        releaseDynamicMessage(entry);
+        LIST_INSERT_HEAD(&freeDynamicMessages, entry, entries);
+        --dynamicMessagePoolUsed;
     }
+    LIST_INIT(&bus->dynamicMessages);
+    bus->dynamicMessageCount = 0;
+    bus->dynamicMessagesEvicted = 0;
 
+    #if METRICS_SUPPORT
     statistics::initialize(&bus->totalMessageStats);
     statistics::initialize(&bus->droppedMessageStats);
     statistics::initialize(&bus->receivedMessageStats);
     statistics::initialize(&bus->receivedDataStats);
     statistics::initialize(&bus->sendQueueStats);
     statistics::initialize(&bus->receiveQueueStats);
+    statistics::initialize(&bus->receiveBatchStats);
+    #endif
 }
 
 void openxc::can::destroy(CanBus* bus) {
@@ -83,8 +205,59 @@ static bool signalStateValueComparator(void* value, int index, void* states) {
     return (*(int*)value) == ((CanSignalState*)states)[index].value;
 }
 
+void openxc::can::prepareSignalStates(CanSignal* signal) {
+    if(signal->stateLookup != SIGNAL_STATES_UNPREPARED) {
+        return;
+    }
+
+    bool consecutive = true;
+    bool sorted = true;
+    for(int i = 1; i < signal->stateCount; i++) {
+        if(signal->states[i].value != signal->states[i - 1].value + 1) {
+            consecutive = false;
+        }
+        if(signal->states[i].value <= signal->states[i - 1].value) {
+            sorted = false;
+            break;
+        }
+    }
+
+    if(sorted && consecutive) {
+        signal->stateLookup = SIGNAL_STATES_DIRECT;
+    } else if(sorted) {
+        signal->stateLookup = SIGNAL_STATES_SORTED;
+    } else {
+        signal->stateLookup = SIGNAL_STATES_LINEAR;
+    }
+}
+
 const CanSignalState* openxc::can::lookupSignalState(int value,
         const CanSignal* signal) {
+    if(signal->states == NULL || signal->stateCount == 0) {
+        return NULL;
+    }
+
+    if(signal->stateLookup == SIGNAL_STATES_DIRECT) {
+        // unsigned, so a value below the first is out of range too
+        unsigned int index = value - signal->states[0].value;
+        return index < signal->stateCount ? &signal->states[index] : NULL;
+    }
+
+    if(signal->stateLookup == SIGNAL_STATES_SORTED) {
+        int low = 0;
+        int high = signal->stateCount;
+        while(low < high) {
+            int middle = low + (high - low) / 2;
+            if(signal->states[middle].value < value) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < signal->stateCount && signal->states[low].value == value ?
+                &signal->states[low] : NULL;
+    }
+
     int index = lookup((void*)&value, signalStateValueComparator,
             (void*)signal->states, signal->stateCount);
     if(index != -1) {
@@ -94,6 +267,163 @@ const CanSignalState* openxc::can::lookupSignalState(int value,
     }
 }
 
+/* Private: Sorted indices into the signal and command arrays passed to
+ * indexSignalNames, ordered by generic name. Entries with the same name keep
+ * their original relative order, so a search returns the same element the
+ * linear lookup would have.
+ *
+ * Each indexed array (one per resident message set) has its own slice of the
+ * order table, starting at 'first'.
+ */
+typedef struct {
+    const void* array;
+    int count;
+    uint16_t first;
+} NameIndexSlice;
+
+static struct {
+    NameIndexSlice signals[RESIDENT_MESSAGE_SET_COUNT];
+    int signalArrayCount;
+    uint16_t signalsUsed;
+    uint16_t signalOrder[SIGNAL_NAME_INDEX_SIZE];
+    NameIndexSlice commands[RESIDENT_MESSAGE_SET_COUNT];
+    int commandArrayCount;
+    uint16_t commandsUsed;
+    uint16_t commandOrder[COMMAND_NAME_INDEX_SIZE];
+} nameIndex;
+
+/* Private: Return the slice of the name index for an array, or NULL if it isn't
+ * indexed.
+ */
+static const NameIndexSlice* findNameIndexSlice(const NameIndexSlice* slices,
+        int sliceCount, const void* array, int count) {
+    for(int i = 0; i < sliceCount; i++) {
+        if(slices[i].array == array && slices[i].count == count) {
+            return &slices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Private: Reserve a slice of the name index for an array - the one it already
+ * has, or a new one after the others. If there isn't room, the index starts
+ * over with only this array.
+ *
+ * Returns the slice, or NULL if the array is larger than the whole index.
+ */
+static NameIndexSlice* reserveNameIndexSlice(NameIndexSlice* slices,
+        int* sliceCount, uint16_t* used, int size, const void* array,
+        int count) {
+    if(count > size) {
+        return NULL;
+    }
+
+    NameIndexSlice* slice = (NameIndexSlice*)findNameIndexSlice(slices,
+            *sliceCount, array, count);
+    if(slice == NULL) {
+        if(*sliceCount == RESIDENT_MESSAGE_SET_COUNT || *used + count > size) {
+            *sliceCount = 0;
+            *used = 0;
+        }
+        slice = &slices[(*sliceCount)++];
+        slice->first = *used;
+        slice->count = count;
+        *used += count;
+    }
+    // not usable until it's sorted
+    slice->array = NULL;
+    return slice;
+}
+
+/* Private: Insertion sort the first count entries of order so that
+ * name(order[i]) is non-decreasing.
+ */
+static void sortByName(uint16_t* order, int count,
+        const char* (*name)(const void* candidates, int index),
+        const void* candidates) {
+    for(int i = 0; i < count; i++) {
+        uint16_t entry = i;
+        int j = i;
+        while(j > 0 && strcmp(name(candidates, order[j - 1]),
+                    name(candidates, entry)) > 0) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = entry;
+    }
+}
+
+/* Private: Find the first position in a sorted order whose name matches.
+ *
+ * Returns the position in order, or -1 if the name isn't present.
+ */
+static int searchByName(const char* key, const uint16_t* order, int count,
+        const char* (*name)(const void* candidates, int index),
+        const void* candidates) {
+    int low = 0;
+    int high = count;
+    while(low < high) {
+        int middle = low + (high - low) / 2;
+        if(strcmp(name(candidates, order[middle]), key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if(low < count && !strcmp(name(candidates, order[low]), key)) {
+        return low;
+    }
+    return -1;
+}
+
+static const char* signalName(const void* signals, int index) {
+    return ((const CanSignal*)signals)[index].genericName;
+}
+
+static const char* commandName(const void* commands, int index) {
+    return ((const CanCommand*)commands)[index].genericName;
+}
+
+void openxc::can::indexSignalNames(CanSignal* signals, int signalCount,
+        CanCommand* commands, int commandCount) {
+    if(signals == NULL && commands == NULL) {
+        nameIndex.signalArrayCount = 0;
+        nameIndex.signalsUsed = 0;
+        nameIndex.commandArrayCount = 0;
+        nameIndex.commandsUsed = 0;
+        return;
+    }
+
+    if(signals != NULL && signalCount > 0) {
+        NameIndexSlice* slice = reserveNameIndexSlice(nameIndex.signals,
+                &nameIndex.signalArrayCount, &nameIndex.signalsUsed,
+                SIGNAL_NAME_INDEX_SIZE, signals, signalCount);
+        if(slice != NULL) {
+            sortByName(&nameIndex.signalOrder[slice->first], signalCount,
+                    signalName, signals);
+            slice->array = signals;
+        } else {
+            debug("%d signals don't fit in the name index, using linear "
+                    "lookup", signalCount);
+        }
+    }
+
+    if(commands != NULL && commandCount > 0) {
+        NameIndexSlice* slice = reserveNameIndexSlice(nameIndex.commands,
+                &nameIndex.commandArrayCount, &nameIndex.commandsUsed,
+                COMMAND_NAME_INDEX_SIZE, commands, commandCount);
+        if(slice != NULL) {
+            sortByName(&nameIndex.commandOrder[slice->first], commandCount,
+                    commandName, commands);
+            slice->array = commands;
+        } else {
+            debug("%d commands don't fit in the name index, using linear "
+                    "lookup", commandCount);
+        }
+    }
+}
+
 static bool signalComparator(void* name, int index, void* signals) {
     return !strcmp((const char*)name, ((CanSignal*)signals)[index].genericName);
 }
@@ -105,6 +435,24 @@ static bool writableSignalComparator(void* name, int index, void* signals) {
 
 CanSignal* openxc::can::lookupSignal(const char* name, CanSignal* signals,
         int signalCount, bool writable) {
+    const NameIndexSlice* slice = signals == NULL ? NULL :
+            findNameIndexSlice(nameIndex.signals, nameIndex.signalArrayCount,
+                    signals, signalCount);
+    if(slice != NULL) {
+        const uint16_t* order = &nameIndex.signalOrder[slice->first];
+        int position = searchByName(name, order, signalCount, signalName,
+                signals);
+        for(; position != -1 && position < signalCount &&
+                !strcmp(signals[order[position]].genericName, name);
+                ++position) {
+            CanSignal* signal = &signals[order[position]];
+            if(!writable || signal->writable) {
+                return signal;
+            }
+        }
+        return NULL;
+    }
+
     bool (*comparator)(void* key, int index, void* candidates) =
             signalComparator;
     if(writable) {
@@ -130,6 +478,16 @@ static bool commandComparator(void* name, int index, void* commands) {
 
 CanCommand* openxc::can::lookupCommand(const char* name, CanCommand* commands,
         int commandCount) {
+    const NameIndexSlice* slice = commands == NULL ? NULL :
+            findNameIndexSlice(nameIndex.commands,
+                    nameIndex.commandArrayCount, commands, commandCount);
+    if(slice != NULL) {
+        const uint16_t* order = &nameIndex.commandOrder[slice->first];
+        int position = searchByName(name, order, commandCount, commandName,
+                commands);
+        return position != -1 ? &commands[order[position]] : NULL;
+    }
+
     int index = lookup((void*)name, commandComparator, (void*)commands,
             commandCount);
     if(index != -1) {
@@ -139,8 +497,29 @@ CanCommand* openxc::can::lookupCommand(const char* name, CanCommand* commands,
     }
 }
 
+/* Private: Returns the ID a message is matched to its definition by - on a
+ * J1939 bus, an extended ID's PGN (see j1939::messageKey), so a message from
+ * any source and at any priority has the same definition.
+ */
+static uint32_t matchingId(const CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    if(bus->j1939 && format == CanMessageFormat::EXTENDED) {
+        return openxc::can::j1939::messageKey(id);
+    }
+    return id;
+}
+
+static bool sameMessage(const CanBus* bus,
+        const CanMessageDefinition* definition, uint32_t id,
+        CanMessageFormat format) {
+    return definition->format == format &&
+            matchingId(bus, definition->id, format) ==
+                matchingId(bus, id, format);
+}
+
 /* Private: Retreive a CanMessage struct from the array given the message's ID
- * and the bus it should occur on.
+ * and the bus it should occur on, by brute force. This is only used if there
+ * are too many messages on the bus to fit in its index.
  *
  * bus - The CanBus to search for the message.
  * id - The ID of the CAN message.
@@ -154,29 +533,157 @@ static CanMessageDefinition* lookupMessage(CanBus* bus, uint32_t id,
         CanMessageDefinition* messages, int messageCount) {
     CanMessageDefinition* message = NULL;
     for(int i = 0; i < messageCount; i++) {
-        if(messages[i].bus == bus && messages[i].id == id) {
+        if(messages[i].bus == bus && sameMessage(bus, &messages[i], id,
+                    format)) {
             message = &messages[i];
         }
     }
     return message;
 }
 
+static CanMessageDefinition* lookupDynamicMessage(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    CanMessageDefinitionListEntry* entry;
+    LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
+        if(sameMessage(bus, &entry->definition, id, format)) {
+            touchDynamicMessage(entry);
+            return &entry->definition;
+        }
+    }
+    return NULL;
+}
+
+static uint16_t messageIndexStart(const CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    // Knuth's multiplicative hash - the upper bits are the best mixed
+    uint32_t hash = (matchingId(bus, id, format) ^
+            ((uint32_t)format << 31)) * 2654435761u;
+    return (hash >> 16) & (CAN_MESSAGE_INDEX_SIZE - 1);
+}
+
+static CanMessageDefinition* messageIndexSlotDefinition(CanBus* bus,
+        uint16_t slot) {
+    if(slot & MESSAGE_INDEX_DYNAMIC_FLAG) {
+        return &DYNAMIC_MESSAGE_POOL[
+            slot & ~MESSAGE_INDEX_DYNAMIC_FLAG].definition;
+    }
+    return (CanMessageDefinition*) &bus->indexedMessages[slot - 1];
+}
+
+/* Private: Add a message definition to the bus's index.
+ *
+ * If there is already an entry with the same ID and format, a predefined
+ * message replaces it (matching the old linear search, where the last match
+ * won) but a dynamic one never shadows a predefined message.
+ *
+ * Returns false if the index is full.
+ */
+static bool indexMessageDefinition(CanBus* bus,
+        const CanMessageDefinition* definition, uint16_t slot) {
+    uint16_t position = messageIndexStart(bus, definition->id,
+            definition->format);
+    while(bus->messageIndex[position] != 0) {
+        uint16_t existingSlot = bus->messageIndex[position];
+        CanMessageDefinition* existing = messageIndexSlotDefinition(bus,
+                existingSlot);
+        if(sameMessage(bus, existing, definition->id, definition->format)) {
+            if(!(slot & MESSAGE_INDEX_DYNAMIC_FLAG) ||
+                    (existingSlot & MESSAGE_INDEX_DYNAMIC_FLAG)) {
+                bus->messageIndex[position] = slot;
+            }
+            return true;
+        }
+        position = (position + 1) & (CAN_MESSAGE_INDEX_SIZE - 1);
+    }
+
+    if(bus->messageIndexEntries >= MESSAGE_INDEX_MAX_ENTRIES) {
+        return false;
+    }
+    bus->messageIndex[position] = slot;
+    ++bus->messageIndexEntries;
+    return true;
+}
+
+static uint16_t dynamicMessageSlot(CanMessageDefinitionListEntry* entry) {
+    return MESSAGE_INDEX_DYNAMIC_FLAG | (entry - DYNAMIC_MESSAGE_POOL);
+}
+
+static void rebuildMessageIndex(CanBus* bus,
+        const CanMessageDefinition* predefinedMessages,
+        int predefinedMessageCount) {
+    memset(bus->messageIndex, 0, sizeof(bus->messageIndex));
+    bus->indexedMessages = predefinedMessages;
+    bus->indexedMessageCount = predefinedMessageCount;
+    bus->messageIndexEntries = 0;
+    bus->messageIndexOverflow = false;
+    bus->messageIndexValid = true;
+
+    for(int i = 0; i < predefinedMessageCount; i++) {
+        if(predefinedMessages[i].bus == bus && !indexMessageDefinition(bus,
+                    &predefinedMessages[i], i + 1)) {
+            bus->messageIndexOverflow = true;
+            break;
+        }
+    }
+
+    CanMessageDefinitionListEntry* entry;
+    LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
+        if(bus->messageIndexOverflow) {
+            break;
+        }
+        bus->messageIndexOverflow = !indexMessageDefinition(bus,
+                &entry->definition, dynamicMessageSlot(entry));
+    }
+
+    if(bus->messageIndexOverflow) {
+        debug("Too many messages on bus %d to index, using linear lookup",
+                bus->address);
+    }
+}
+
+RAM_FUNCTION
 CanMessageDefinition* openxc::can::lookupMessageDefinition(CanBus* bus,
         uint32_t id, CanMessageFormat format,
         CanMessageDefinition* predefinedMessages,
         int predefinedMessageCount) {
-    CanMessageDefinition* message = lookupMessage(bus, id, format,
-            predefinedMessages, predefinedMessageCount);
-    if(message == NULL) {
-        CanMessageDefinitionListEntry* entry;
-        LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-            if(entry->definition.id == id) {
-                message = &entry->definition;
-                break;
+    if(predefinedMessages != NULL && (!bus->messageIndexValid ||
+            bus->indexedMessages != predefinedMessages ||
+            bus->indexedMessageCount != predefinedMessageCount)) {
+        rebuildMessageIndex(bus, predefinedMessages, predefinedMessageCount);
+    } else if(!bus->messageIndexValid) {
+        rebuildMessageIndex(bus, bus->indexedMessages,
+                bus->indexedMessageCount);
+    }
+
+    if(bus->messageIndexOverflow) {
+        CanMessageDefinition* message = lookupMessage(bus, id, format,
+                predefinedMessages, predefinedMessageCount);
+        if(message == NULL) {
+            message = lookupDynamicMessage(bus, id, format);
+        }
+        return message;
+    }
+
+    uint16_t position = messageIndexStart(bus, id, format);
+    while(bus->messageIndex[position] != 0) {
+        uint16_t slot = bus->messageIndex[position];
+        CanMessageDefinition* candidate = messageIndexSlotDefinition(bus, slot);
+        if(sameMessage(bus, candidate, id, format)) {
+            // A NULL predefinedMessages means the caller only wants dynamic
+            // definitions
+            if(!(slot & MESSAGE_INDEX_DYNAMIC_FLAG)) {
+                if(predefinedMessages == NULL) {
+                    return lookupDynamicMessage(bus, id, format);
+                }
+            } else {
+                touchDynamicMessage(&DYNAMIC_MESSAGE_POOL[
+                        slot & ~MESSAGE_INDEX_DYNAMIC_FLAG]);
             }
+            return candidate;
         }
+        position = (position + 1) & (CAN_MESSAGE_INDEX_SIZE - 1);
     }
-    return message;
+    return NULL;
 }
 
 CanBus* openxc::can::lookupBus(uint8_t address, CanBus* buses, const int busCount) {
@@ -195,17 +702,29 @@ bool openxc::can::registerMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageDefinition* predefinedMessages, int predefinedMessageCount) {
     CanMessageDefinition* message = lookupMessageDefinition(
             bus, id, format, NULL, 0);
-    if(message == NULL && LIST_FIRST(&bus->freeMessageDefinitions) != NULL) {
-        CanMessageDefinitionListEntry* entry = LIST_FIRST(
-                &bus->freeMessageDefinitions);
-        LIST_REMOVE(entry, entries);
+    CanMessageDefinitionListEntry* entry = NULL;
+    if(message == NULL && (entry = allocateDynamicMessage()) != NULL) {
         entry->definition.bus = bus;
         entry->definition.id = id;
+        entry->definition.format = format;
         entry->definition.frequencyClock = {bus->maxMessageFrequency};
         entry->definition.forceSendChanged = true;
+        entry->definition.firstSignal = 0;
+        entry->definition.signalCount = 0;
+        entry->definition.frameLoaded = false;
+        entry->definition.quietUntilMs = 0;
+        entry->definition.sentLength = 0;
+        entry->definition.framesSinceKeyframe = 0;
+
+        touchDynamicMessage(entry);
 
         LIST_INSERT_HEAD(&bus->dynamicMessages, entry, entries);
+        ++bus->dynamicMessageCount;
         message = &entry->definition;
+        if(bus->messageIndexValid && !bus->messageIndexOverflow) {
+            bus->messageIndexOverflow = !indexMessageDefinition(bus,
+                    message, dynamicMessageSlot(entry));
+        }
     }
     return message != NULL;
 }
@@ -214,20 +733,83 @@ bool openxc::can::unregisterMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageFormat format) {
     CanMessageDefinitionListEntry* entry, *match = NULL;
     LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-        if(entry->definition.id == id) {
+        if(sameMessage(bus, &entry->definition, id, format)) {
             match = entry;
             break;
         }
     }
 
     if(match != NULL) {
-        LIST_REMOVE(entry, entries);
-        LIST_INSERT_HEAD(&bus->freeMessageDefinitions, entry, entries);
+        releaseDynamicMessage(match);
+        LIST_INSERT_HEAD(&freeDynamicMessages, match, entries);
+        --dynamicMessagePoolUsed;
         return true;
     }
     return false;
 }
 
+int openxc::can::dynamicMessagePoolUsage() {
+    return dynamicMessagePoolUsed;
+}
+
+static uint32_t fullIdMask(CanMessageFormat format) {
+    return format == CanMessageFormat::EXTENDED ? 0x1fffffff : 0x7ff;
+}
+
+bool openxc::can::addPassthroughFilter(CanBus* bus, uint32_t id,
+        uint32_t mask, CanMessageFormat format, float frequency,
+        CanMessageDefinition* predefinedMessages, int predefinedMessageCount,
+        CanBus* buses, const int busCount) {
+    if(bus->passthroughFilterCount >= CAN_PASSTHROUGH_FILTER_COUNT) {
+        debug("Bus %d already passes through %d selections of IDs",
+                bus->address, CAN_PASSTHROUGH_FILTER_COUNT);
+        return false;
+    }
+
+    mask &= fullIdMask(format);
+    PassthroughFilter* filter =
+            &bus->passthroughFilters[bus->passthroughFilterCount++];
+    filter->id = id & mask;
+    filter->mask = mask;
+    filter->format = format;
+
+    if(mask == fullIdMask(format)) {
+        registerMessageDefinition(bus, id, format, predefinedMessages,
+                predefinedMessageCount);
+        CanMessageDefinition* message = lookupMessageDefinition(bus, id,
+                format, predefinedMessages, predefinedMessageCount);
+        if(message != NULL && frequency > 0) {
+            message->frequencyClock.frequency = frequency;
+        }
+
+        if(!addAcceptanceFilter(bus, id, format, buses, busCount)) {
+            debug("No acceptance filter for passthrough of 0x%x on bus %d",
+                    id, bus->address);
+        }
+    }
+    return true;
+}
+
+void openxc::can::clearPassthroughFilters(CanBus* bus) {
+    bus->passthroughFilterCount = 0;
+}
+
+bool openxc::can::passthroughSelected(const CanBus* bus,
+        const CanMessage* message) {
+    if(bus->passthroughFilterCount == 0) {
+        return true;
+    }
+
+    for(int i = 0; i < bus->passthroughFilterCount; i++) {
+        const PassthroughFilter* filter = &bus->passthroughFilters[i];
+        if(filter->format == message->format &&
+                (message->id & filter->mask) == filter->id) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool openxc::can::signalsWritable(CanBus* bus, CanSignal* signals,
         int signalCount) {
     for(int i = 0; i < signalCount; i++) {
@@ -238,7 +820,143 @@ bool openxc::can::signalsWritable(CanBus* bus, CanSignal* signals,
     return false;
 }
 
+void openxc::can::snapshotCounters(CanBus* bus, CanBusCounters* counters) {
+    counters->received = bus->messagesReceived;
+    counters->dropped = bus->messagesDropped + bus->passthroughDropped;
+    counters->receiveQueueLength = queue::length(&bus->receiveQueue);
+    counters->sendQueueLength = QUEUE_LENGTH(CanMessage, &bus->sendQueue);
+    counters->receiveQueuePeak = queue::peak(&bus->receiveQueue);
+    counters->receiveQueueCapacity = queue::capacity(&bus->receiveQueue);
+    counters->sendQueuePeak = bus->sendQueuePeak;
+    counters->sendQueueCapacity = QUEUE_MAX_LENGTH(CanMessage);
+}
+
+/* Private: The bits of a frame so far, as they'd go on the wire.
+ *
+ * crc - the CRC of the bits added so far.
+ * length - the number of bits, including stuff bits.
+ * lastBit - the value of the last bit on the wire, or -1 before the first.
+ * run - the number of bits in a row on the wire with that value.
+ */
+typedef struct {
+    uint16_t crc;
+    unsigned int length;
+    int lastBit;
+    int run;
+} FrameBits;
+
+/* Private: Add a field to a frame, most significant bit first, inserting a
+ * stuff bit of the opposite value after every 5 bits of the same value.
+ */
+static void addFrameBits(FrameBits* frame, uint32_t value, int width,
+        bool checked) {
+    for(int i = width - 1; i >= 0; i--) {
+        int bit = (value >> i) & 1;
+        if(checked) {
+            bool feedback = bit ^ ((frame->crc >> 14) & 1);
+            frame->crc = (frame->crc << 1) & 0x7fff;
+            if(feedback) {
+                frame->crc ^= CAN_CRC15_POLYNOMIAL;
+            }
+        }
+
+        ++frame->length;
+        if(bit == frame->lastBit) {
+            if(++frame->run == 5) {
+                // The stuff bit starts the next run
+                ++frame->length;
+                frame->lastBit = !bit;
+                frame->run = 1;
+            }
+        } else {
+            frame->lastBit = bit;
+            frame->run = 1;
+        }
+    }
+}
+
+unsigned int openxc::can::frameBitLength(const CanMessage* message) {
+    FrameBits frame = {0, 0, -1, 0};
+    // Start of frame
+    addFrameBits(&frame, 0, 1, true);
+    if(message->format == CanMessageFormat::EXTENDED) {
+        addFrameBits(&frame, message->id >> CAN_EXTENDED_ID_BITS,
+                CAN_STANDARD_ID_BITS, true);
+        // SRR and IDE, both recessive
+        addFrameBits(&frame, 3, 2, true);
+        addFrameBits(&frame, message->id, CAN_EXTENDED_ID_BITS, true);
+        // RTR, r1 and r0
+        addFrameBits(&frame, 0, 3, true);
+    } else {
+        addFrameBits(&frame, message->id, CAN_STANDARD_ID_BITS, true);
+        // RTR, IDE and r0
+        addFrameBits(&frame, 0, 3, true);
+    }
+
+    int length = MIN(message->length, CAN_MAX_MESSAGE_SIZE);
+    addFrameBits(&frame, MIN(length, 15), 4, true);
+    for(int i = 0; i < length; i++) {
+        addFrameBits(&frame, message->data[i], 8, true);
+    }
+    addFrameBits(&frame, frame.crc, 15, false);
+    return frame.length + CAN_FRAME_TRAILER_BITS;
+}
+
+/* Private: Finish the bus load measurement once it's run for
+ * CAN_BUS_LOAD_WINDOW_MS and start the next.
+ *
+ * Messages the receive interrupt dropped were on the bus too, but weren't kept
+ * to be measured, so they're counted at the average length of the ones that
+ * were.
+ */
+static void updateBusLoad(CanBus* bus) {
+    unsigned long elapsedMs = time::systemTimeMs() - bus->loadWindowStartMs;
+    if(elapsedMs < CAN_BUS_LOAD_WINDOW_MS) {
+        return;
+    }
+
+    uint64_t bits = bus->bitsReceived - bus->loadWindowBits;
+    unsigned int received = bus->messagesReceived - bus->loadWindowReceived;
+    unsigned int dropped = bus->messagesDropped - bus->loadWindowDropped;
+    if(received > 0) {
+        bits += bits * dropped / received;
+    }
+
+    if(bus->speed > 0) {
+        bus->busLoad = bits * 1000 * 1000 / ((uint64_t) bus->speed * elapsedMs);
+        bus->peakBusLoad = MAX(bus->peakBusLoad, bus->busLoad);
+    }
+
+    bus->loadWindowStartMs += elapsedMs;
+    bus->loadWindowBits = bus->bitsReceived;
+    bus->loadWindowReceived += received;
+    bus->loadWindowDropped += dropped;
+}
+
+void openxc::can::updateBusStatus(CanBus* bus) {
+    CanErrorCounters errors;
+    readErrorCounters(bus, &errors);
+    bus->transmitErrorCount = errors.transmitErrors;
+    bus->receiveErrorCount = errors.receiveErrors;
+    bus->peakErrorCount = MAX(bus->peakErrorCount,
+            MAX(errors.transmitErrors, errors.receiveErrors));
+
+    if(errors.busOff) {
+        if(!bus->busOff) {
+            ++bus->busOffCount;
+            debug("CAN%d went bus off, recovering", bus->address);
+        }
+        recoverFromBusOff(bus);
+    } else if(bus->busOff) {
+        debug("CAN%d is back on the bus", bus->address);
+    }
+    bus->busOff = errors.busOff;
+
+    updateBusLoad(bus);
+}
+
 void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
+    #if METRICS_SUPPORT
     if(!config::getConfiguration()->calculateMetrics) {
         return;
     }
@@ -265,33 +983,37 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
         unsigned int dataReceived = 0;
         for(int i = 0; i < busCount; i++) {
             CanBus* bus = &buses[i];
+            CanBusCounters counters;
+            snapshotCounters(bus, &counters);
 
             statistics::update(&bus->receivedDataStats,
-                    bus->messagesReceived * CAN_MESSAGE_TOTAL_BIT_SIZE / 8192);
+                    bus->bitsReceived / 8192);
             statistics::update(&bus->totalMessageStats,
-                    bus->messagesReceived + bus->messagesDropped);
-            statistics::update(&bus->receivedMessageStats,
-                    bus->messagesReceived);
-            statistics::update(&bus->droppedMessageStats, bus->messagesDropped);
+                    counters.received + counters.dropped);
+            statistics::update(&bus->receivedMessageStats, counters.received);
+            statistics::update(&bus->droppedMessageStats, counters.dropped);
 
             statistics::update(&bus->sendQueueStats,
-                    QUEUE_LENGTH(CanMessage, &bus->sendQueue));
+                    counters.sendQueueLength);
             statistics::update(&bus->receiveQueueStats,
-                    QUEUE_LENGTH(CanMessage, &bus->receiveQueue));
+                    counters.receiveQueueLength);
 
             if(bus->totalMessageStats.total > 0) {
                 debug("CAN%d Rx queue length: %d, avg: %f percent",
-                        bus->address,
-                        QUEUE_LENGTH(CanMessage, &bus->receiveQueue),
+                        bus->address, counters.receiveQueueLength,
                         statistics::exponentialMovingAverage(
                             &bus->receiveQueueStats) /
-                                QUEUE_MAX_LENGTH(CanMessage) * 100);
+                                queue::capacity(&bus->receiveQueue) * 100);
                 debug("CAN%d Tx queue length: %d, avg: %f percent",
-                        bus->address,
-                        QUEUE_LENGTH(CanMessage, &bus->sendQueue),
+                        bus->address, counters.sendQueueLength,
                         statistics::exponentialMovingAverage(
                             &bus->sendQueueStats) /
                                 QUEUE_MAX_LENGTH(CanMessage) * 100);
+                debug("CAN%d Rx frames per pass: %d, avg: %f, max: %d",
+                        bus->address, bus->lastReceiveBatchSize,
+                        statistics::exponentialMovingAverage(
+                            &bus->receiveBatchStats),
+                        statistics::maximum(&bus->receiveBatchStats));
                 debug("CAN%d msgs Rx: %d (%dKB)",
                         bus->address, bus->receivedMessageStats.total,
                         bus->receivedDataStats.total);
@@ -305,11 +1027,34 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
                         statistics::exponentialMovingAverage(
                             &bus->receivedDataStats) /
                             BUS_STATS_LOG_FREQUENCY_S);
+                debug("CAN%d load: %d.%d percent, peak %d.%d percent",
+                        bus->address, bus->busLoad / 10, bus->busLoad % 10,
+                        bus->peakBusLoad / 10, bus->peakBusLoad % 10);
+                debug("CAN%d TEC: %d, REC: %d%s, peak: %d, bus off %d times",
+                        bus->address, bus->transmitErrorCount,
+                        bus->receiveErrorCount,
+                        bus->transmitErrorCount >= CAN_ERROR_PASSIVE_LIMIT ||
+                            bus->receiveErrorCount >= CAN_ERROR_PASSIVE_LIMIT ?
+                            " (error passive)" : "",
+                        bus->peakErrorCount, bus->busOffCount);
+                if(bus->gatewayRouteCount > 0) {
+                    debug("CAN%d gateway forwarded: %d, dropped: %d",
+                            bus->address, bus->gatewayForwarded,
+                            bus->gatewayDropped);
+                }
+                if(bus->framesRejected > 0) {
+                    debug("CAN%d frames failing counter or checksum: %d",
+                            bus->address, bus->framesRejected);
+                }
+                debug("CAN%d dynamic msg definitions: %d (pool %d / %d), "
+                        "evicted: %d", bus->address, bus->dynamicMessageCount,
+                        dynamicMessagePoolUsed, MAX_DYNAMIC_MESSAGE_COUNT,
+                        bus->dynamicMessagesEvicted);
             }
 
             totalMessages += bus->totalMessageStats.total;
-            messagesReceived += bus->messagesReceived;
-            messagesDropped += bus->messagesDropped;
+            messagesReceived += counters.received;
+            messagesDropped += counters.dropped;
             dataReceived += bus->receivedDataStats.total;
         }
         statistics::update(&totalMessageStats, totalMessages);
@@ -336,12 +1081,63 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
         lastTimeLogged = time::systemTimeMs();
 
         for(int i = 0; i < busCount; i++) {
-            if(QUEUE_LENGTH(CanMessage, &buses[i].receiveQueue) ==
-                    QUEUE_MAX_LENGTH(CanMessage)) {
+            if(queue::full(&buses[i].receiveQueue)) {
                 debug("Dropped CAN messages while running stats on bus %d", i);
             }
         }
     }
+    #endif // METRICS_SUPPORT
+}
+
+/* Private: The depth of nested acceptance filter update batches, and whether
+ * any filter list changed since the outermost batch began.
+ */
+static uint8_t filterUpdateDepth = 0;
+static bool filterUpdatePending = false;
+
+/* Private: Mirror the software filter lists to the CAN controllers, unless a
+ * batch is open - then just note that it needs to happen when it's committed.
+ */
+static bool applyAcceptanceFilters(CanBus* buses, const int busCount) {
+    if(filterUpdateDepth > 0) {
+        filterUpdatePending = true;
+        return true;
+    }
+    return openxc::can::updateAcceptanceFilterTable(buses, busCount);
+}
+
+void openxc::can::beginAcceptanceFilterUpdate() {
+    ++filterUpdateDepth;
+}
+
+bool openxc::can::commitAcceptanceFilterUpdate(CanBus* buses,
+        const int busCount) {
+    if(filterUpdateDepth == 0) {
+        debug("No acceptance filter update in progress to commit");
+        return false;
+    }
+
+    bool status = true;
+    if(--filterUpdateDepth == 0 && filterUpdatePending) {
+        filterUpdatePending = false;
+        status = updateAcceptanceFilterTable(buses, busCount);
+        if(!status) {
+            debug("Unable to update AF table after a batch of filter changes");
+        }
+    }
+    return status;
+}
+
+bool openxc::can::discardAcceptanceFilterUpdate() {
+    if(filterUpdateDepth == 0) {
+        debug("No acceptance filter update in progress to discard");
+        return false;
+    }
+
+    if(--filterUpdateDepth == 0) {
+        filterUpdatePending = false;
+    }
+    return true;
 }
 
 bool openxc::can::configureDefaultFilters(CanBus* bus,
@@ -349,6 +1145,7 @@ bool openxc::can::configureDefaultFilters(CanBus* bus,
         CanBus* buses, const int busCount) {
     uint8_t filterCount = 0;
     bool status = true;
+    beginAcceptanceFilterUpdate();
     if(messageCount > 0) {
         for(int i = 0; i < messageCount; i++) {
             if(messages[i].bus == bus) {
@@ -368,7 +1165,9 @@ bool openxc::can::configureDefaultFilters(CanBus* bus,
                     bus->address);
         }
     }
-    status &= updateAcceptanceFilterTable(buses, busCount);
+    // Always push the table to hardware at least once, even with no filters
+    filterUpdatePending = true;
+    status &= commitAcceptanceFilterUpdate(buses, busCount);
     return status;
 }
 
@@ -380,6 +1179,100 @@ static AcceptanceFilterListEntry* popListEntry(AcceptanceFilterList* list) {
     return result;
 }
 
+/* Private: Rebuild the bus's tables of accepted IDs from its list of
+ * acceptance filters. This must be called any time the list changes.
+ *
+ * The tables are shared with the receive ISR, so they're built off to the side
+ * and then published. The standard ID bitmap is copied a word at a time, so an
+ * ID is always either accepted under the old filters or under the new ones.
+ * While the extended IDs are being copied in their count is 0 and the bus
+ * rejects them in software, but the hardware AF (if enabled) still has the old
+ * filters.
+ */
+static void rebuildAcceptedIdTable(CanBus* bus) {
+    uint32_t standardIds[CAN_STANDARD_ID_COUNT / 32] = {0};
+    uint32_t extendedIds[MAX_ACCEPTANCE_FILTERS];
+    uint8_t extendedCount = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        if(entry->filter < CAN_STANDARD_ID_COUNT) {
+            standardIds[entry->filter / 32] |= 1UL << (entry->filter % 32);
+            continue;
+        }
+
+        if(extendedCount >= MAX_ACCEPTANCE_FILTERS) {
+            break;
+        }
+
+        // insertion sort - the list is never more than a couple dozen long
+        int i = extendedCount - 1;
+        while(i >= 0 && extendedIds[i] > entry->filter) {
+            extendedIds[i + 1] = extendedIds[i];
+            --i;
+        }
+        extendedIds[i + 1] = entry->filter;
+        ++extendedCount;
+    }
+
+    for(int i = 0; i < CAN_STANDARD_ID_COUNT / 32; i++) {
+        bus->acceptedStandardIds[i] = standardIds[i];
+    }
+
+    bus->acceptedExtendedIdCount = 0;
+    memcpy(bus->acceptedExtendedIds, extendedIds,
+            extendedCount * sizeof(uint32_t));
+    bus->acceptedExtendedIdCount = extendedCount;
+}
+
+/* Private: Returns true if the filter should come before other in a compiled
+ * filter table - standard IDs first, then in ascending order.
+ */
+static bool filterPrecedes(AcceptanceFilterListEntry* filter,
+        AcceptanceFilterListEntry* other) {
+    if(filter->format != other->format) {
+        return filter->format == CanMessageFormat::STANDARD;
+    }
+    return filter->filter < other->filter;
+}
+
+int openxc::can::compileAcceptanceFilters(CanBus* bus,
+        AcceptanceFilterRange* ranges, int maxRanges) {
+    AcceptanceFilterListEntry* sorted[MAX_ACCEPTANCE_FILTERS];
+    int count = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        if(count >= MAX_ACCEPTANCE_FILTERS) {
+            break;
+        }
+
+        int i = count - 1;
+        while(i >= 0 && filterPrecedes(entry, sorted[i])) {
+            sorted[i + 1] = sorted[i];
+            --i;
+        }
+        sorted[i + 1] = entry;
+        ++count;
+    }
+
+    int rangeCount = 0;
+    for(int i = 0; i < count; i++) {
+        AcceptanceFilterRange* last = rangeCount > 0 ?
+                &ranges[rangeCount - 1] : NULL;
+        if(last != NULL && last->format == sorted[i]->format &&
+                last->highId + 1 == sorted[i]->filter) {
+            last->highId = sorted[i]->filter;
+        } else if(rangeCount < maxRanges) {
+            ranges[rangeCount].lowId = sorted[i]->filter;
+            ranges[rangeCount].highId = sorted[i]->filter;
+            ranges[rangeCount].format = sorted[i]->format;
+            ++rangeCount;
+        } else {
+            return -1;
+        }
+    }
+    return rangeCount;
+}
+
 bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
         CanMessageFormat format, CanBus* buses, int busCount) {
     AcceptanceFilterListEntry* entry;
@@ -404,14 +1297,16 @@ bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
     availableFilter->format = format;
     availableFilter->activeUserCount = 1;
     LIST_INSERT_HEAD(&bus->acceptanceFilters, availableFilter, entries);
+    rebuildAcceptedIdTable(bus);
     debug("Added acceptance filter for 0x%x on bus %d", availableFilter->filter,
             bus->address);
-    bool status = updateAcceptanceFilterTable(buses, busCount);
+    bool status = applyAcceptanceFilters(buses, busCount);
     if(!status) {
         debug("Unable to update AF table after adding filter for 0x%x on bus %d",
                 availableFilter->filter, bus->address);
         LIST_REMOVE(availableFilter, entries);
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, availableFilter, entries);
+        rebuildAcceptedIdTable(bus);
     }
     return status;
 }
@@ -433,9 +1328,49 @@ void openxc::can::removeAcceptanceFilter(CanBus* bus, uint32_t id,
             debug("No active users - disabling filter");
             LIST_REMOVE(entry, entries);
             LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
-            updateAcceptanceFilterTable(buses, busCount);
+            rebuildAcceptedIdTable(bus);
+            applyAcceptanceFilters(buses, busCount);
+        }
+    }
+}
+
+bool openxc::can::addAcceptanceFilterRange(CanBus* bus, uint32_t firstId,
+        uint8_t count, CanMessageFormat format, CanBus* buses,
+        const int busCount) {
+    beginAcceptanceFilterUpdate();
+    uint8_t added = 0;
+    while(added < count && addAcceptanceFilter(bus, firstId + added, format,
+                buses, busCount)) {
+        ++added;
+    }
+
+    bool status = added == count;
+    if(!status) {
+        debug("Couldn't add filter 0x%x to bus %d, rolling back range",
+                firstId + added, bus->address);
+        while(added > 0) {
+            --added;
+            removeAcceptanceFilter(bus, firstId + added, format, buses,
+                    busCount);
         }
     }
+
+    if(!commitAcceptanceFilterUpdate(buses, busCount) && status) {
+        status = false;
+        removeAcceptanceFilterRange(bus, firstId, count, format, buses,
+                busCount);
+    }
+    return status;
+}
+
+void openxc::can::removeAcceptanceFilterRange(CanBus* bus, uint32_t firstId,
+        uint8_t count, CanMessageFormat format, CanBus* buses,
+        const int busCount) {
+    beginAcceptanceFilterUpdate();
+    for(uint8_t i = 0; i < count; i++) {
+        removeAcceptanceFilter(bus, firstId + i, format, buses, busCount);
+    }
+    commitAcceptanceFilterUpdate(buses, busCount);
 }
 
 bool openxc::can::setAcceptanceFilterStatus(CanBus* bus, bool enabled,
@@ -446,16 +1381,29 @@ bool openxc::can::setAcceptanceFilterStatus(CanBus* bus, bool enabled,
     return updateAcceptanceFilterTable(buses, busCount);
 }
 
+RAM_FUNCTION
 bool openxc::can::shouldAcceptMessage(CanBus* bus, uint32_t messageId) {
-    bool acceptMessage = bus->bypassFilters;
-    if(!acceptMessage) {
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(entry->filter == messageId) {
-                acceptMessage = true;
-                break;
-            }
+    if(bus->bypassFilters) {
+        return true;
+    }
+
+    if(messageId < CAN_STANDARD_ID_COUNT) {
+        return (bus->acceptedStandardIds[messageId / 32] >>
+                (messageId % 32)) & 1;
+    }
+
+    int low = 0;
+    int high = bus->acceptedExtendedIdCount - 1;
+    while(low <= high) {
+        int middle = (low + high) / 2;
+        uint32_t candidate = bus->acceptedExtendedIds[middle];
+        if(candidate == messageId) {
+            return true;
+        } else if(candidate < messageId) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
         }
     }
-    return acceptMessage;
+    return false;
 }
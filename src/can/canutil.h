@@ -12,13 +12,178 @@
 #include "cJSON.h"
 #include "openxc.pb.h"
 
-// TODO actual max is 32 but dropped to 24 for memory considerations
+// The number of acceptance filter IDs each bus can track in software. Before
+// they're loaded into the CAN controller, contiguous IDs are merged into
+// range or mask entries, so this can be larger than the number of hardware
+// filter slots.
+#ifndef MAX_ACCEPTANCE_FILTERS
 #define MAX_ACCEPTANCE_FILTERS 24
-// TODO this takes up a ton of memory
-#define MAX_DYNAMIC_MESSAGE_COUNT 12
+#endif
+
+#if MAX_ACCEPTANCE_FILTERS > 255
+#error "MAX_ACCEPTANCE_FILTERS must fit in 8 bits"
+#endif
+
+// The most CAN controllers a VI can have. Each bus is on its own controller,
+// addressed from 1 by CanBus.address, so this is also the most buses and the
+// highest bus address. A platform can only use as many as it has in hardware.
+#ifndef MAX_CAN_CONTROLLERS
+#define MAX_CAN_CONTROLLERS 2
+#endif
+
+// The number of distinct 11-bit CAN IDs, i.e. the size of each bus's bitmap of
+// accepted standard IDs.
+#define CAN_STANDARD_ID_COUNT 0x800
+// The number of message definitions shared by all buses for messages that
+// aren't predefined, e.g. for rate limiting passthrough. When it's full, the
+// least recently used definition is reused. Each slot costs about 64 bytes of
+// RAM.
+#ifndef MAX_DYNAMIC_MESSAGE_COUNT
+#define MAX_DYNAMIC_MESSAGE_COUNT 24
+#endif
+
+#if MAX_DYNAMIC_MESSAGE_COUNT > 0x7fff
+#error "MAX_DYNAMIC_MESSAGE_COUNT must fit in 15 bits"
+#endif
+
+// The number of slots in each bus's hashed index of message definitions. Must
+// be a power of two, and should be at least 1.5x the number of messages (both
+// predefined and dynamic) on the busiest bus. If a bus has more messages than
+// fit in the index, lookups fall back to a linear search.
+#ifndef CAN_MESSAGE_INDEX_SIZE
+#define CAN_MESSAGE_INDEX_SIZE 128
+#endif
+
+#if (CAN_MESSAGE_INDEX_SIZE & (CAN_MESSAGE_INDEX_SIZE - 1)) != 0
+#error "CAN_MESSAGE_INDEX_SIZE must be a power of two"
+#endif
+
+// The largest signal and command arrays that indexSignalNames will sort by
+// name. Lookups in larger arrays fall back to a linear search.
+#ifndef SIGNAL_NAME_INDEX_SIZE
+#define SIGNAL_NAME_INDEX_SIZE 256
+#endif
+
+#ifndef COMMAND_NAME_INDEX_SIZE
+#define COMMAND_NAME_INDEX_SIZE 32
+#endif
+
+// The largest signal array that can::read::indexSignalDispatch will group by
+// message. Messages in larger arrays are decoded by scanning every signal.
+#ifndef SIGNAL_DISPATCH_TABLE_SIZE
+#define SIGNAL_DISPATCH_TABLE_SIZE 256
+#endif
+
+// The number of message sets whose signal arrays can be indexed by name and by
+// message at the same time, so switching between them doesn't re-sort
+// anything. Together they share SIGNAL_NAME_INDEX_SIZE,
+// COMMAND_NAME_INDEX_SIZE and SIGNAL_DISPATCH_TABLE_SIZE.
+#ifndef RESIDENT_MESSAGE_SET_COUNT
+#define RESIDENT_MESSAGE_SET_COUNT 4
+#endif
 
 #define CAN_MESSAGE_SIZE 8
 
+// Set to 1 to carry CAN FD frames, with up to CAN_FD_MESSAGE_SIZE bytes of
+// data, through the receive queues, signal decoding, passthrough and capture.
+// Every CanMessage grows to hold the larger payload, so leave this off unless
+// a bus actually uses FD.
+#ifndef CAN_FD_SUPPORT
+#define CAN_FD_SUPPORT 0
+#endif
+
+#define CAN_FD_MESSAGE_SIZE 64
+
+// The largest data field of a frame this build can carry.
+#if CAN_FD_SUPPORT
+#define CAN_MAX_MESSAGE_SIZE CAN_FD_MESSAGE_SIZE
+#else
+#define CAN_MAX_MESSAGE_SIZE CAN_MESSAGE_SIZE
+#endif
+
+// How long each bus load measurement runs for (see CanBus.busLoad).
+#ifndef CAN_BUS_LOAD_WINDOW_MS
+#define CAN_BUS_LOAD_WINDOW_MS 1000
+#endif
+
+// The number of outgoing messages each bus holds in arbitration order while
+// they wait for the controller (see can::write::flushOutgoingCanMessageQueue).
+#ifndef CAN_PENDING_WRITE_COUNT
+#define CAN_PENDING_WRITE_COUNT 8
+#endif
+
+// How long a message queued without a deadline keeps being retried before it's
+// dropped, if the controller can't take it.
+#ifndef CAN_WRITE_RETRY_MS
+#define CAN_WRITE_RETRY_MS 100
+#endif
+
+// The number of CAN messages that can be set up to be sent repeatedly, across
+// all buses (see can::write::addPeriodicWrite).
+#ifndef CAN_PERIODIC_WRITE_COUNT
+#define CAN_PERIODIC_WRITE_COUNT 8
+#endif
+
+// When a bus sends passthroughDeltas, at least every this many passthrough
+// frames of a message is sent in full, so a receiver that missed a delta
+// catches up.
+#ifndef CAN_PASSTHROUGH_KEYFRAME_INTERVAL
+#define CAN_PASSTHROUGH_KEYFRAME_INTERVAL 16
+#endif
+
+// The number of ID selections each bus can limit its passthrough messages to
+// (see can::addPassthroughFilter).
+#ifndef CAN_PASSTHROUGH_FILTER_COUNT
+#define CAN_PASSTHROUGH_FILTER_COUNT 8
+#endif
+
+// The number of ID selections each bus can forward to another bus (see
+// can::gateway::addRoute).
+#ifndef CAN_GATEWAY_ROUTE_COUNT
+#define CAN_GATEWAY_ROUTE_COUNT 8
+#endif
+
+// The number of received frames to decode per bus for each pass of the main
+// loop when a bus doesn't set its own maxReceiveBatchSize.
+#ifndef DEFAULT_CAN_RECEIVE_BATCH_SIZE
+#define DEFAULT_CAN_RECEIVE_BATCH_SIZE 1
+#endif
+
+// If 1, the main loop takes received frames from all of the buses at once,
+// oldest first by the time the receive interrupt stamped on them, instead of a
+// bus at a time - so frames from different buses are decoded and published in
+// the order they were received. Up to 32 buses.
+#ifndef CAN_ORDERED_RECEIVE
+#define CAN_ORDERED_RECEIVE 0
+#endif
+
+// The storage allocated for each bus's receive ring. A bus can use a smaller
+// depth by setting receiveQueueDepth, but never a larger one. Must be a power
+// of two.
+#ifndef CAN_RECEIVE_QUEUE_MAX_DEPTH
+#define CAN_RECEIVE_QUEUE_MAX_DEPTH 32
+#endif
+
+#if (CAN_RECEIVE_QUEUE_MAX_DEPTH & (CAN_RECEIVE_QUEUE_MAX_DEPTH - 1)) != 0
+#error "CAN_RECEIVE_QUEUE_MAX_DEPTH must be a power of two"
+#endif
+
+// The bytes of storage for each bus's receive ring, which packs each frame
+// into only as many bytes as its ID and data need (see CanMessageRing). The
+// default (or 0) holds CAN_RECEIVE_QUEUE_MAX_DEPTH standard frames with 8 bytes
+// of data, in about two thirds of the RAM a CanMessage for each would take.
+#if !defined(CAN_RECEIVE_QUEUE_BYTES) || CAN_RECEIVE_QUEUE_BYTES == 0
+#undef CAN_RECEIVE_QUEUE_BYTES
+#define CAN_RECEIVE_QUEUE_BYTES (CAN_RECEIVE_QUEUE_MAX_DEPTH * \
+        (3 + sizeof(unsigned long) + CAN_MESSAGE_SIZE))
+#endif
+
+// The number of frames, across all buses, held back from the receive queues
+// while the output interfaces are starting up and replayed once they're ready.
+#ifndef CAN_EARLY_CAPTURE_DEPTH
+#define CAN_EARLY_CAPTURE_DEPTH 64
+#endif
+
 /* Public: The type signature for a CAN signal decoder.
  *
  * A SignalDecoder transforms a raw floating point CAN signal into a number,
@@ -64,6 +229,44 @@ enum CanMessageFormat {
 };
 typedef enum CanMessageFormat CanMessageFormat;
 
+/* Public: The ways a signal's raw value can be extracted from message data.
+ *
+ * SIGNAL_EXTRACTION_UNPREPARED - not decided yet, the signal hasn't been
+ *      parsed.
+ * SIGNAL_EXTRACTION_SHIFT_MASK - the signal fits in the 8 byte data field, so
+ *      it's a shift and mask of the data as a uint64_t.
+ * SIGNAL_EXTRACTION_GENERIC - an unusual layout, parsed bit by bit with
+ *      bitfield_parse_float.
+ */
+enum SignalExtraction {
+    SIGNAL_EXTRACTION_UNPREPARED,
+    SIGNAL_EXTRACTION_SHIFT_MASK,
+    SIGNAL_EXTRACTION_GENERIC,
+};
+
+/* Public: How lookupSignalState finds a state by value in a signal's states.
+ *
+ * SIGNAL_STATES_UNPREPARED - not decided yet, searched linearly.
+ * SIGNAL_STATES_LINEAR - the values are in no particular order, so every state
+ *      is compared.
+ * SIGNAL_STATES_DIRECT - the values are consecutive and in order, so the value
+ *      minus the first value is the index.
+ * SIGNAL_STATES_SORTED - the values are in increasing order, so they're
+ *      binary searched.
+ */
+enum SignalStateLookup {
+    SIGNAL_STATES_UNPREPARED,
+    SIGNAL_STATES_LINEAR,
+    SIGNAL_STATES_DIRECT,
+    SIGNAL_STATES_SORTED,
+};
+
+/* Public: The jsonNameLength of a signal whose generic name can't be copied
+ * into a JSON string as it is, because it has characters that need escaping or
+ * is too long to count in a uint8_t.
+ */
+#define SIGNAL_JSON_NAME_ESCAPED 0xff
+
 /* Public: A state encoded (SED) signal's mapping from numerical values to
  * OpenXC state names.
  *
@@ -77,6 +280,17 @@ struct CanSignalState {
 typedef struct CanSignalState CanSignalState;
 
 /* Public: A CAN signal to decode from the bus and output over USB.
+ *
+ * Generated configurations (and the test signals) initialize this struct
+ * positionally up to 'lastValue', so those fields can't be reordered, or the
+ * constant ones split into a separate table, without the code generator
+ * changing at the same time. 'received' and everything after it is state the
+ * firmware updates at runtime, except for the fields a generator may fill in
+ * ahead of time (extraction, extractShift, extractByte, alwaysDecode,
+ * decimalPlaces, deadband, relativeDeadband and stateLookup) - set those by
+ * name. The fields after 'lastValue' are ordered by size to keep padding out
+ * of the signal array, which is the largest block of RAM in most
+ * configurations.
  *
  * message     - The message this signal is a part of.
  * genericName - The name of the signal to be output over USB.
@@ -109,11 +323,66 @@ typedef struct CanSignalState CanSignalState;
  * received    - True if this signal has ever been received.
  * lastValue   - The last received value of the signal. If 'received' is false,
  *      this value is undefined.
+ * extraction  - How the raw value is pulled from a message's data. Leave this
+ *      as SIGNAL_EXTRACTION_UNPREPARED and it will be chosen the first time
+ *      the signal is parsed, or a code generator can set it to
+ *      SIGNAL_EXTRACTION_SHIFT_MASK along with extractShift.
+ * extractShift - The right shift that moves the signal to the least
+ *      significant bits of the message data loaded as a big-endian uint64_t,
+ *      before it's masked to bitSize bits.
+ * extractByte - The first of the 8 bytes of the message data that
+ *      extractShift applies to. This is 0 unless the signal is past the first
+ *      8 bytes of a CAN FD frame.
+ * alwaysDecode - If true, the decoder is called for every received frame. By
+ *      default, a signal with sendSame set to false skips decoding when its
+ *      raw bits are the same as in the last frame, since the value couldn't be
+ *      sent anyway. Set this for decoders with side effects.
+ * lastRawValue - The raw bits of the last received value, for signals using
+ *      SIGNAL_EXTRACTION_SHIFT_MASK. Undefined if 'received' is false.
+ * integerScaling - If true, a SIGNAL_EXTRACTION_SHIFT_MASK signal is scaled
+ *      with integerFactor and integerOffset instead of the float factor and
+ *      offset. This is chosen along with the extraction when the factor and
+ *      offset are whole numbers and the result always fits exactly in a float,
+ *      so it gives identical values without soft-float math.
+ * integerFactor - The factor as an integer, if integerScaling is true.
+ * integerOffset - The offset as an integer, if integerScaling is true.
+ * decimalPlaces - If nonzero, numerical values are rounded to this many decimal
+ *      places before they're published, which also keeps them short in JSON.
+ *      A code generator can set it from the signal's resolution. Use 0 to
+ *      send the full float value.
+ * lastReceivedMs - The system time when a frame carrying this signal was last
+ *      received, whether or not the value changed. Undefined if 'received'
+ *      is false.
+ * deadband    - If nonzero, a value only counts as changed once it's more than
+ *      this far from the last value sent, so noise in the last digits doesn't
+ *      get published. In the same units as the value (after factor and offset).
+ * relativeDeadband - Like deadband, but as a fraction of the last value sent,
+ *      e.g. .01 for 1%. If both are set, the larger band applies.
+ * lastSentValue - The last value published for the signal, for the deadband.
+ * stateLookup - How states are looked up by value. Leave this as
+ *      SIGNAL_STATES_UNPREPARED and prepareSignalStates picks the fastest one
+ *      the first time the signal is translated, or a code generator can set
+ *      it for a states array it has laid out.
+ * disabled    - If true, the signal is skipped when its message is dispatched,
+ *      so it's neither decoded nor published until it's enabled again. Set at
+ *      runtime by the signal_control command.
+ * profileDisabled - If true, the signal is skipped like a disabled one, because
+ *      the active decode profile doesn't decode it (see openxc::profiles).
+ *      Kept apart from 'disabled' so switching profiles doesn't undo the
+ *      signal_control command.
+ * jsonNameLength - The length of genericName, if it can go in a JSON message
+ *      without escaping, so the name is copied into each message in one go.
+ *      Leave this as 0 and it's measured the first time the signal is
+ *      published, or SIGNAL_JSON_NAME_ESCAPED if the name needs escaping.
  */
 struct CanSignal {
     struct CanMessageDefinition* message;
     const char* genericName;
+#if CAN_FD_SUPPORT
+    uint16_t bitPosition;
+#else
     uint8_t bitPosition;
+#endif
     uint8_t bitSize;
     float factor;
     float offset;
@@ -129,9 +398,74 @@ struct CanSignal {
     SignalEncoder encoder;
     bool received;
     float lastValue;
+    uint8_t extraction;
+    uint8_t extractShift;
+    bool alwaysDecode;
+    bool integerScaling;
+    uint64_t lastRawValue;
+    int32_t integerFactor;
+    int32_t integerOffset;
+    unsigned long lastReceivedMs;
+    float deadband;
+    float relativeDeadband;
+    float lastSentValue;
+    uint8_t decimalPlaces;
+    uint8_t stateLookup;
+    uint8_t extractByte;
+    bool disabled;
+    bool profileDisabled;
+    uint8_t jsonNameLength;
 };
 typedef struct CanSignal CanSignal;
 
+/* Public: The checksums a message's end-to-end protection can check.
+ *
+ * CHECKSUM_NONE - the message has no checksum.
+ * CHECKSUM_XOR - the XOR of every other byte of the frame.
+ * CHECKSUM_CRC8_SAE_J1850 - the CRC-8 of every other byte of the frame in
+ *      order, with polynomial 0x1d, an initial value of 0xff and the result
+ *      inverted.
+ */
+enum CanChecksumType {
+    CHECKSUM_NONE,
+    CHECKSUM_XOR,
+    CHECKSUM_CRC8_SAE_J1850,
+};
+
+/* Public: The alive counter and checksum a message carries to show it's fresh
+ * and intact (end-to-end protection). A frame that fails either check is
+ * dropped before its signals are decoded - see can::e2e::validate.
+ *
+ * checksumType - The checksum in the frame, or CHECKSUM_NONE.
+ * checksumByte - The byte of the frame the checksum is in. It covers every
+ *      other byte of the frame.
+ * counterBitPosition - The starting bit of the counter, numbered like a
+ *      signal's bitPosition.
+ * counterBitSize - The width of the counter, at most 8 bits, or 0 if the
+ *      message has no counter.
+ * maxCounterDelta - The most the counter can advance from one frame to the
+ *      next, counting frames the VI may have missed. 0 is the same as 1 -
+ *      every frame is expected. A counter that repeats, goes back or jumps
+ *      further fails the check.
+ * lastCounter - Private: the counter of the last frame that had an intact
+ *      checksum.
+ * counterSynced - Private: true once lastCounter is valid.
+ * checksumErrors - The number of frames dropped for a bad checksum.
+ * counterErrors - The number of frames dropped for an unexpected counter.
+ */
+struct CanMessageProtection {
+    CanChecksumType checksumType;
+    uint8_t checksumByte;
+    uint8_t counterBitPosition;
+    uint8_t counterBitSize;
+    uint8_t maxCounterDelta;
+    uint8_t lastCounter;
+    bool counterSynced;
+    unsigned int checksumErrors;
+    unsigned int counterErrors;
+};
+typedef struct CanMessageProtection CanMessageProtection;
+
 /* Public: The definition of a CAN message. This includes a lot of metadata, so
  * to save memory this struct should not be used for storing incoming and
  * outgoing CAN messages.
@@ -147,6 +481,28 @@ typedef struct CanSignal CanSignal;
  * lastValue - The last received value of the message. Defaults to undefined.
  *      This is required for the forceSendChanged functionality, as the stack
  *      needs to compare an incoming CAN message with the previous frame.
+ * firstSignal - Private: the start of this message's signals in the dispatch
+ *      table built by can::read::indexSignalDispatch.
+ * signalCount - Private: the number of signals in this message's range of the
+ *      dispatch table.
+ * lastFrame - Private: the data of the last frame decoded with
+ *      can::read::loadFrame, as a big-endian uint64_t.
+ * frameLoaded - Private: true if lastFrame is valid.
+ * sentValue - Private: the data of the last passthrough frame published for
+ *      this message, which deltas are encoded against.
+ * sentLength - Private: the length of sentValue, or 0 if no frame has been
+ *      published yet.
+ * framesSinceKeyframe - Private: the number of deltas published since the
+ *      last full frame.
+ * filterSuspended - Private: true if the active decode profile removed this
+ *      message's acceptance filter, because none of its signals are decoded.
+ * filterUnlearned - Private: true if can::learn removed this message's
+ *      acceptance filter, because it wasn't heard on the bus.
+ * quietUntilMs - Private: until when a frame identical to the last one can't
+ *      change anything its signals publish, so translateMessageSignals skips
+ *      it - the time the first of their frequency clocks is due to tick. 0 if
+ *      any of them has to see every frame. * protection - An optional alive counter and checksum to check each frame
+ *      against before decoding it, or NULL.
  */
 struct CanMessageDefinition {
     struct CanBus* bus;
@@ -154,7 +510,18 @@ struct CanMessageDefinition {
     CanMessageFormat format;
     openxc::util::time::FrequencyClock frequencyClock;
     bool forceSendChanged;
-    uint8_t lastValue[CAN_MESSAGE_SIZE];
+    uint8_t lastValue[CAN_MAX_MESSAGE_SIZE];
+    uint16_t firstSignal;
+    uint16_t signalCount;
+    uint64_t lastFrame;
+    bool frameLoaded;
+    uint8_t sentValue[CAN_MAX_MESSAGE_SIZE];
+    uint8_t sentLength;
+    uint8_t framesSinceKeyframe;
+    bool filterSuspended;
+    bool filterUnlearned;
+    unsigned long quietUntilMs;
+    CanMessageProtection* protection;
 };
 typedef struct CanMessageDefinition CanMessageDefinition;
 
@@ -164,18 +531,108 @@ typedef struct CanMessageDefinition CanMessageDefinition;
  * id - The ID of the message.
  * format - the format of the message's ID.
  * data  - The message's data field.
- * length - the length of the data array (max 8).
+ * length - the length of the data array (max 8, or CAN_FD_MESSAGE_SIZE for a
+ *      CAN FD frame if CAN_FD_SUPPORT is enabled).
+ * receivedUs - the system time in microseconds (see
+ *      openxc::util::time::systemTimeUs) when the message was read from the CAN
+ *      controller, or 0 if it wasn't received from a bus.
  */
 struct CanMessage {
     uint32_t id;
     CanMessageFormat format;
-    uint8_t data[CAN_MESSAGE_SIZE];
+    uint8_t data[CAN_MAX_MESSAGE_SIZE];
     uint8_t length;
+    unsigned long receivedUs;
 };
 typedef struct CanMessage CanMessage;
 
 QUEUE_DECLARE(CanMessage, 8);
 
+/* Public: A CAN message ID, or group of IDs, selected for passthrough.
+ *
+ * id - The ID to match.
+ * mask - The bits of the ID that must match.
+ * format - The format of the matching IDs.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    CanMessageFormat format;
+} PassthroughFilter;
+
+/* Public: A CAN message ID, or group of IDs, forwarded from one bus to another
+ * by can::gateway.
+ *
+ * id - The ID to match.
+ * mask - The bits of the ID that must match.
+ * format - The format of the matching IDs, which the forwarded messages keep.
+ * destination - The bus to forward the messages to.
+ * destinationId - What the bits under the mask are replaced with in the
+ *      forwarded ID - the same as id unless the messages are remapped.
+ * filterCount - The number of IDs added to the source bus's acceptance
+ *      filters for the route, from id up, to remove along with it.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    CanMessageFormat format;
+    struct CanBus* destination;
+    uint32_t destinationId;
+    uint8_t filterCount;
+} CanGatewayRoute;
+
+/* Public: An outgoing CAN message waiting for its turn on the bus.
+ *
+ * message - The message to send.
+ * deadlineMs - The system time after which the message is dropped instead of
+ *      sent.
+ */
+struct PendingCanWrite {
+    CanMessage message;
+    unsigned long deadlineMs;
+};
+typedef struct PendingCanWrite PendingCanWrite;
+
+/* Public: A single-producer, single-consumer ring buffer of received CAN
+ * messages. See can/canqueue.h for the operations on it.
+ *
+ * The producer is the CAN receive interrupt handler and the consumer is the
+ * main loop. With exactly one of each, no locks are required and it's safe to
+ * push from an ISR while the main loop is popping: only the producer writes
+ * 'head' and 'pushed' and only the consumer writes 'tail' and 'popped', and
+ * each publishes them only after the frame they guard has been written or
+ * read.
+ *
+ * A CanMessage reserves the largest data field, a 32-bit ID and an enum for
+ * the format, so frames are packed into a byte ring instead: a header byte
+ * with the format in the top bit and the length below it, the ID in 2 bytes
+ * for a standard frame or 4 for an extended one, the receive time, then only
+ * 'length' bytes of data. A frame never wraps around the end of the storage -
+ * a 0xff header byte tells the consumer to continue from the start.
+ * Since head == tail could mean it's either empty or completely full, the
+ * frame counts decide which.
+ *
+ * head - the offset in 'bytes' of the next frame to push.
+ * tail - the offset in 'bytes' of the next frame to pop.
+ * mask - the ring's depth - 1, where the depth is a power of two. It limits
+ *      the number of frames even if more would fit in 'bytes'.
+ * pushed - the number of messages ever pushed.
+ * popped - the number of messages ever popped.
+ * peak - the most messages the ring has held since it was initialized, only
+ *      written by the producer.
+ * bytes - static storage for the ring.
+ */
+struct CanMessageRing {
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    uint16_t mask;
+    volatile uint16_t pushed;
+    volatile uint16_t popped;
+    uint16_t peak;
+    uint8_t bytes[CAN_RECEIVE_QUEUE_BYTES];
+};
+typedef struct CanMessageRing CanMessageRing;
+
 /* Private: An entry in the list of acceptance filters for each CanBus.
  *
  * This struct is meant to be used with a LIST type from <sys/queue.h>.
@@ -196,8 +653,29 @@ struct AcceptanceFilterListEntry {
  */
 LIST_HEAD(AcceptanceFilterList, AcceptanceFilterListEntry);
 
+/* Private: A contiguous range of IDs accepted on a bus, as compiled from its
+ * acceptance filter list by compileAcceptanceFilters.
+ *
+ * lowId - the first ID in the range.
+ * highId - the last ID in the range, inclusive. Equal to lowId for a single ID.
+ * format - the format of the IDs in the range.
+ */
+struct AcceptanceFilterRange {
+    uint32_t lowId;
+    uint32_t highId;
+    CanMessageFormat format;
+};
+
+/* Private: A slot in the shared pool of dynamic message definitions.
+ *
+ * definition - The message definition.
+ * lastUsed - When the definition was last looked up, as a count of dynamic
+ *      lookups, so the least recently used one can be reused.
+ * entries - The bus's list of dynamic messages, or the pool's free list.
+ */
 struct CanMessageDefinitionListEntry {
     CanMessageDefinition definition;
+    uint32_t lastUsed;
     LIST_ENTRY(CanMessageDefinitionListEntry) entries;
 };
 LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
@@ -221,6 +699,14 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  *      can be set to still allow translated writes back to this bus.
  * passthroughCanMessages - True if low-level CAN messages should be send to the
  *      output interface, not just signals as simple vehicle messages.
+ * passthroughDeltas - True if passthrough messages with a definition should
+ *      only carry the bytes that changed since the last one sent. A delta
+ *      frame's data is a mask byte, with bit n set if byte n changed,
+ *      followed by the changed bytes in order. It's always shorter than the
+ *      message; a frame of the message's full length is a keyframe with every
+ *      byte. Keyframes are sent for the first frame, when the length changes,
+ *      when a delta wouldn't be shorter and at least every
+ *      CAN_PASSTHROUGH_KEYFRAME_INTERVAL frames.
  * bypassFilters - a boolean to indicate if the CAN controller's
  *      acceptance filter should be in bypass mode. Set to true to receive all
  *      messages for this bus, regardless of what is defined in the
@@ -228,17 +714,55 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  *      are no acceptance filters configured.
  * loopback - True if the controller should be configured in loopback mode, so
  *         all sent messages are received immediately on that same controller.
+ * maxReceiveBatchSize - The maximum number of frames to pull from the
+ *      receiveQueue and decode in a single pass of the main loop. If 0, the
+ *      DEFAULT_CAN_RECEIVE_BATCH_SIZE is used.
+ * receiveBatchBudgetMs - The maximum amount of time (in ms) to spend draining
+ *      the receiveQueue in a single pass of the main loop. At least one frame
+ *      is always handled. To put no time limit on a pass, set this to 0.
+ * receiveQueueDepth - The number of frames the receiveQueue can hold, rounded
+ *      down to a power of two. If 0, CAN_RECEIVE_QUEUE_MAX_DEPTH is used.
+ * autoBaud - True if the bus's speed should be found by listening to it,
+ *      starting with speed (see can::autobaud).
+ * j1939 - True if the bus's extended IDs are J1939, so they're matched to
+ *      message definitions by PGN whatever their priority and source address,
+ *      and transport protocol transfers are reassembled (see can::j1939). The
+ *      acceptance filters still match the definitions' IDs exactly, so set
+ *      bypassFilters too if a PGN can come from other sources.
  *
  * acceptanceFilters - a list of active acceptance filters for this bus.
  * freeAcceptanceFilters - a list of available slots for acceptance filters.
  * acceptanceFilterEntries - static memory allocated for entires in the
  *      acceptanceFilters and freeAcceptanceFilters list.
- * dynamicMessages - a list of CAN message IDs ever received on this bus. This
- *      is used for message frequency control and metrics.
- * freeMessageDefinitions - a list of available slots for dynamic message
- *      definitions.
- * definitionEntries - static memory allocated for entires in the
- *      dynamicMessages and freeMessageDefinitions list.
+ * acceptedStandardIds - a bitmap of the IDs in the acceptanceFilters list that
+ *      fit in 11 bits, so shouldAcceptMessage can check them from an ISR with a
+ *      single bit test. Bit (id % 32) of word (id / 32) is set if id is
+ *      accepted.
+ * acceptedExtendedIds - the IDs in the acceptanceFilters list that don't fit
+ *      in 11 bits, sorted in ascending order so shouldAcceptMessage can binary
+ *      search them from an ISR.
+ * acceptedExtendedIdCount - the number of valid entries in
+ *      acceptedExtendedIds.
+ * dynamicMessages - a list of the CAN messages received on this bus that
+ *      aren't predefined, taken from a pool of MAX_DYNAMIC_MESSAGE_COUNT
+ *      shared by all buses. This is used for message frequency control and
+ *      metrics.
+ * dynamicMessageCount - the number of entries in dynamicMessages.
+ * dynamicMessagesEvicted - the number of this bus's dynamic messages that were
+ *      reused for another message because the pool was full.
+ * messageIndex - an open-addressing hash table of the message definitions on
+ *      this bus, keyed on ID (or PGN, on a J1939 bus) and format. Each slot
+ *      is 0 if empty, otherwise the index + 1 of a predefined message, or
+ *      MESSAGE_INDEX_DYNAMIC_FLAG | the index of a dynamic entry in the shared
+ *      pool.
+ * indexedMessages - the array of predefined messages the messageIndex was built
+ *      from.
+ * indexedMessageCount - the length of the indexedMessages array.
+ * messageIndexEntries - the number of occupied slots in the messageIndex.
+ * messageIndexValid - false if the messageIndex needs to be rebuilt before it's
+ *      used.
+ * messageIndexOverflow - true if there are too many messages on this bus to
+ *      index, and lookups must fall back to a linear search.
  * writeHandler - a function that actually writes out a CanMessage object to the
  *      CAN interface (implementation is platform specific);
  * lastMessageReceived - the time (in ms) when the last CAN message was
@@ -246,10 +770,71 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  * messagesReceived - A count of the number of CAN messages received.
  * messagesDropped - A count of the number of CAN messages we knowingly dropped
  * - i.e. we received an interrupt with a new CAN message but the incoming CAN
- *   message queue was full.
+ *   message queue was full. Only the receive interrupt handler writes this.
+ * passthroughDropped - A count of the messages that weren't passed through
+ *      because the pipeline was backed up. Only the main loop writes this, so
+ *      neither counter needs a lock.
+ * framesRejected - A count of the frames that weren't decoded because they
+ *      failed their message's alive counter or checksum check (see
+ *      CanMessageProtection). Only the main loop writes this.
+ * sendQueuePeak - The most messages the sendQueue has held since startup.
+ * bitsReceived - The bits on the wire of every message received, including
+ *      stuff bits (see can::frameBitLength). Only the main loop writes this.
+ * loadWindowStartMs - The time the current bus load measurement began.
+ * loadWindowBits - bitsReceived when the current measurement began.
+ * loadWindowReceived - messagesReceived when the current measurement began.
+ * loadWindowDropped - messagesDropped when the current measurement began.
+ * busLoad - The share of the bus's bandwidth used by the messages received
+ *      in the last complete CAN_BUS_LOAD_WINDOW_MS, in tenths of a percent.
+ * peakBusLoad - The highest busLoad since startup.
+ * transmitErrorCount - The controller's transmit error counter (TEC) when
+ *      it was last read by can::updateBusStatus.
+ * receiveErrorCount - The controller's receive error counter (REC), likewise.
+ * peakErrorCount - The highest either error counter has been since startup.
+ * busOff - True if the controller was bus off when it was last read.
+ * busOffCount - The number of times the controller has gone bus off.
+ * autoBaudSearching - True while can::autobaud is looking for the bus speed.
+ * autoBaudFirstSpeed - The speed the search started with.
+ * autoBaudCandidate - The index of the speed being tried, 0 for the first.
+ * autoBaudStartedMs - The time the current speed was tried from.
+ * autoBaudFrames - The messages heard before it was tried.
+ * autoBaudErrors - The receive error counter before it was tried.
+ * autoBaudBypassFilters - bypassFilters from before the search, which bypasses
+ *      the acceptance filters to hear every message on the bus.
+ * surveying - True while the bus is surveyed by can::survey, which holds off
+ *      its raw passthrough.
+ * surveyBypassFilters - bypassFilters from before the survey.
+ * learningFilters - True while can::learn is listening for the IDs the bus's
+ *      acceptance filters should have.
+ * filtersLearned - True once it's changed the filters to them.
+ * learnBypassFilters - bypassFilters from before learning.
+ * learnUntilMs - When learning is over.
+ * lastReceiveBatchSize - The number of frames handled in the most recent pass
+ *      of the main loop that found the receiveQueue non-empty.
+ * receiveBatchStats - Statistics on the number of frames handled per pass.
+ *      This and the other statistics are only included with METRICS_SUPPORT.
  * sendQueue - a queue of CanMessage instances that need to be written to CAN.
- * receiveQueue - a queue of messages received from CAN that have yet to be
- *      translated.
+ * pendingWrites - messages taken from the sendQueue (or queued with a
+ *      deadline) that haven't been written yet, in the order they were queued.
+ * pendingWriteCount - the number of messages in pendingWrites.
+ * writing - True while the main loop is handing messages to the controller,
+ *      so a receive interrupt forwarding a message (see can::gateway) doesn't
+ *      write to the same transmit buffers at the same time.
+ * writesExpired - A count of the outgoing messages dropped because they
+ *      passed their deadline before the controller could take them.
+ * passthroughFilters - the IDs (or groups of IDs) passthrough is limited to,
+ *      see can::addPassthroughFilter.
+ * passthroughFilterCount - the number of entries in passthroughFilters. If 0,
+ *      every message is passed through.
+ * gatewayRoutes - the messages forwarded from this bus to other buses, see
+ *      can::gateway::addRoute. The receive interrupt reads these, so a route is
+ *      only counted in gatewayRouteCount once it's complete.
+ * gatewayRouteCount - the number of entries in gatewayRoutes.
+ * gatewayForwarded - A count of the messages forwarded to another bus.
+ * gatewayDropped - A count of the messages that should have been forwarded,
+ *      but the destination controller couldn't take them right away.
+ * receiveQueue - a ring of messages received from CAN that have yet to be
+ *      translated, filled by the receive interrupt handler.
  */
 struct CanBus {
     unsigned int speed;
@@ -257,32 +842,87 @@ struct CanBus {
     float maxMessageFrequency;
     bool rawWritable;
     bool passthroughCanMessages;
+    bool passthroughDeltas;
     bool bypassFilters;
     bool loopback;
+    uint8_t maxReceiveBatchSize;
+    unsigned int receiveBatchBudgetMs;
+    uint16_t receiveQueueDepth;
+    bool autoBaud;
+    bool j1939;
 
     // Private
     AcceptanceFilterList acceptanceFilters;
     AcceptanceFilterList freeAcceptanceFilters;
     AcceptanceFilterListEntry acceptanceFilterEntries[MAX_ACCEPTANCE_FILTERS];
+    volatile uint32_t acceptedStandardIds[CAN_STANDARD_ID_COUNT / 32];
+    uint32_t acceptedExtendedIds[MAX_ACCEPTANCE_FILTERS];
+    volatile uint8_t acceptedExtendedIdCount;
     CanMessageDefinitionList dynamicMessages;
-    CanMessageDefinitionList freeMessageDefinitions;
-    CanMessageDefinitionListEntry definitionEntries[MAX_DYNAMIC_MESSAGE_COUNT];
+    uint16_t dynamicMessageCount;
+    unsigned int dynamicMessagesEvicted;
+    uint16_t messageIndex[CAN_MESSAGE_INDEX_SIZE];
+    const CanMessageDefinition* indexedMessages;
+    int indexedMessageCount;
+    uint16_t messageIndexEntries;
+    bool messageIndexValid;
+    bool messageIndexOverflow;
     bool (*writeHandler)(const CanBus*, const CanMessage*);
     unsigned long lastMessageReceived;
     unsigned int messagesReceived;
-    unsigned int messagesDropped;
+    volatile unsigned int messagesDropped;
+    unsigned int passthroughDropped;
+    unsigned int framesRejected;
+    unsigned int sendQueuePeak;
+    uint64_t bitsReceived;
+    unsigned long loadWindowStartMs;
+    uint64_t loadWindowBits;
+    unsigned int loadWindowReceived;
+    unsigned int loadWindowDropped;
+    uint16_t busLoad;
+    uint16_t peakBusLoad;
+    uint8_t transmitErrorCount;
+    uint8_t receiveErrorCount;
+    uint8_t peakErrorCount;
+    bool busOff;
+    unsigned int busOffCount;
+    bool autoBaudSearching;
+    unsigned int autoBaudFirstSpeed;
+    uint8_t autoBaudCandidate;
+    unsigned long autoBaudStartedMs;
+    unsigned int autoBaudFrames;
+    uint8_t autoBaudErrors;
+    bool autoBaudBypassFilters;
+    bool surveying;
+    bool surveyBypassFilters;
+    bool learningFilters;
+    bool filtersLearned;
+    bool learnBypassFilters;
+    unsigned long learnUntilMs;
+    uint8_t lastReceiveBatchSize;
 
-    // TODO These are unnecessary if you aren't calculating metrics, and they do
-    // take up a bit of memory.
+    #if METRICS_SUPPORT
     openxc::util::statistics::DeltaStatistic totalMessageStats;
     openxc::util::statistics::DeltaStatistic droppedMessageStats;
     openxc::util::statistics::DeltaStatistic receivedMessageStats;
     openxc::util::statistics::DeltaStatistic receivedDataStats;
     openxc::util::statistics::Statistic sendQueueStats;
     openxc::util::statistics::Statistic receiveQueueStats;
+    openxc::util::statistics::FixedStatistic receiveBatchStats;
+    #endif
 
     QUEUE_TYPE(CanMessage) sendQueue;
-    QUEUE_TYPE(CanMessage) receiveQueue;
+    PendingCanWrite pendingWrites[CAN_PENDING_WRITE_COUNT];
+    uint8_t pendingWriteCount;
+    volatile bool writing;
+    unsigned int writesExpired;
+    PassthroughFilter passthroughFilters[CAN_PASSTHROUGH_FILTER_COUNT];
+    uint8_t passthroughFilterCount;
+    CanGatewayRoute gatewayRoutes[CAN_GATEWAY_ROUTE_COUNT];
+    volatile uint8_t gatewayRouteCount;
+    volatile unsigned int gatewayForwarded;
+    volatile unsigned int gatewayDropped;
+    CanMessageRing receiveQueue;
 };
 typedef struct CanBus CanBus;
 
@@ -377,6 +1017,30 @@ void destroy(CanBus* bus);
  */
 void deinitialize(CanBus* bus);
 
+/* Public: Change the controller's bit rate without initializing it again,
+ * e.g. to try another speed while listening for the right one.
+ *
+ * This function must be defined for each platform - it's hardware dependent.
+ *
+ * bus - The bus to change.
+ * speed - The new bit rate in bits per second.
+ * listenOnly - True to only listen at the new rate, without sending ACKs or
+ *      error frames. If false, the controller goes to normal operation.
+ */
+void setBitRate(CanBus* bus, unsigned int speed, bool listenOnly);
+
+/* Public: Switch the controller to the mode it would be initialized in -
+ * loopback if bus->loopback is set, otherwise normal operation if writable or
+ * listen only - without initializing it again, so its filters and queues are
+ * kept.
+ *
+ * This function must be defined for each platform - it's hardware dependent.
+ *
+ * bus - The bus to change.
+ * writable - True to send ACKs and writes when not in loopback mode.
+ */
+void setOperatingMode(CanBus* bus, bool writable);
+
 /* Public: Perform platform-agnostic CAN initialization.
  */
 void initializeCommon(CanBus* bus);
@@ -426,6 +1090,26 @@ CanSignal* lookupSignal(const char* name, CanSignal* signals, int signalCount,
 CanCommand* lookupCommand(const char* name, CanCommand* commands,
         int commandCount);
 
+/* Public: Build the name indices used by lookupSignal and lookupCommand. Call
+ * this once the active message set's signals and commands are known, e.g.
+ * right after signals::initialize().
+ *
+ * Up to RESIDENT_MESSAGE_SET_COUNT message sets stay indexed at once, sharing
+ * the SIGNAL_NAME_INDEX_SIZE and COMMAND_NAME_INDEX_SIZE entries, so switching
+ * the active message set doesn't need to sort it again. Indexing an array that
+ * doesn't fit clears the others first, and passing NULL arrays clears them all.
+ *
+ * Lookups in any other array (or in these arrays, if they are larger than
+ * SIGNAL_NAME_INDEX_SIZE or COMMAND_NAME_INDEX_SIZE) use a linear search.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ * commands - The list of all commands.
+ * commandCount - The length of the commands array.
+ */
+void indexSignalNames(CanSignal* signals, int signalCount,
+        CanCommand* commands, int commandCount);
+
 /* Public: Look up a CanSignalState for a CanSignal by its textual name. Use
  * this to find the numerical value to write back to CAN when a string state is
  * received from the user.
@@ -449,9 +1133,23 @@ const CanSignalState* lookupSignalState(const char* name, const CanSignal* signa
  */
 const CanSignalState* lookupSignalState(int value, const CanSignal* signal);
 
+/* Public: Choose how lookupSignalState finds the signal's states by value -
+ * by index if the values are consecutive and in order, by binary search if
+ * they're in order and otherwise linearly. See SignalStateLookup.
+ *
+ * signal - The signal to prepare. If its stateLookup has already been chosen,
+ *      it's left alone.
+ */
+void prepareSignalStates(CanSignal* signal);
+
 /* Public: Search all predefined and dynamically configured CAN messages for one
  * matching the given ID.
  *
+ * This uses the bus's hashed message index, which is (re)built on the first
+ * lookup after the predefinedMessages array changes or a dynamic message is
+ * unregistered. On a J1939 bus, an extended ID matches the definition of any ID
+ * with the same PGN.
+ *
  * bus - The CanBus to search for the message.
  * id - The ID of the CAN message.
  * format - The format of the ID of the message.
@@ -480,7 +1178,9 @@ CanBus* lookupBus(uint8_t address, CanBus* buses, const int busCount);
  * definition or a dynamic), nothing will be added.
  *
  * If it is not already defined, a CanMessageDefinition will be
- * created and stored on the CanBus. This is useful for statistics, logging and
+ * created and stored on the CanBus, from a pool shared by all buses. If the pool
+ * is full, the dynamic definition (on any bus) that was looked up least recently
+ * is reused. This is useful for statistics, logging and
  * potentially changing CAN acceptance filters on the fly (although that is not
  * supported at the moment). The "forceSendChanged" will be true for the new
  * message definition.
@@ -499,6 +1199,11 @@ bool registerMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageDefinition* predefinedMessages,
         int predefinedMessageCount);
 
+/* Public: Return the number of slots in use in the pool of dynamic message
+ * definitions shared by all buses, out of MAX_DYNAMIC_MESSAGE_COUNT.
+ */
+int dynamicMessagePoolUsage();
+
 /* Public: The opposite of registerMessageDefinition(...) - removes a definition
  * if it exists for the ID on the given bus.
  *
@@ -512,6 +1217,49 @@ bool registerMessageDefinition(CanBus* bus, uint32_t id,
 bool unregisterMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageFormat format);
 
+/* Public: Add a CAN message ID, or a group of IDs, to the ones a bus passes
+ * through (see passthroughCanMessages). Once a bus has any, only messages
+ * matching one of them are passed through.
+ *
+ * If the mask covers every bit of the ID, the message is also registered on the
+ * bus (see registerMessageDefinition) and an acceptance filter is added for it,
+ * so it's received even when the bus filters messages. A group of IDs is only
+ * received if it's already accepted or the bus's acceptance filter is bypassed.
+ *
+ * bus - The CanBus to pass the messages through from.
+ * id - The ID to match.
+ * mask - The bits of the ID that must match, e.g. 0x7f8 for a group of 8 IDs
+ *      or 0x7ff (0x1fffffff for an extended ID) for one.
+ * format - The format of the IDs.
+ * frequency - For a single ID, the most times a second to pass it through
+ *      (replacing the message definition's maxMessageFrequency) or 0 to keep
+ *      its current limit. Ignored for a group of IDs.
+ * predefinedMessages - The list of predefined CAN messages to search for an
+ *      existing definition.
+ * predefinedMessageCount - The length of the predefined messages array.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if the bus already has CAN_PASSTHROUGH_FILTER_COUNT
+ * selections.
+ */
+bool addPassthroughFilter(CanBus* bus, uint32_t id, uint32_t mask,
+        CanMessageFormat format, float frequency,
+        CanMessageDefinition* predefinedMessages, int predefinedMessageCount,
+        CanBus* buses, const int busCount);
+
+/* Public: Go back to passing through every message on the bus. Any message
+ * definitions and acceptance filters added by addPassthroughFilter are left
+ * in place.
+ */
+void clearPassthroughFilters(CanBus* bus);
+
+/* Public: Check a received message against a bus's passthrough selections.
+ *
+ * Returns true if the bus has no selections or the message matches one.
+ */
+bool passthroughSelected(const CanBus* bus, const CanMessage* message);
+
 /* Public: Based on the predefined CAN messages for a bus, add the required
  * CAN acceptance filters to receive all messages.
  *
@@ -562,6 +1310,92 @@ bool addAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
 void removeAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
         CanBus* buses, const int busCount);
 
+/* Public: Start a batch of acceptance filter changes.
+ *
+ * Until the matching commitAcceptanceFilterUpdate(...), addAcceptanceFilter
+ * and removeAcceptanceFilter only change the filter lists in software - the
+ * hardware AF table is rewritten once when the batch is committed, instead of
+ * once per change. Batches may be nested; only the outermost commit touches
+ * the hardware.
+ */
+void beginAcceptanceFilterUpdate();
+
+/* Public: Finish a batch of acceptance filter changes started with
+ * beginAcceptanceFilterUpdate(), and if it was the outermost batch and any
+ * filter changed, apply the filter lists to the CAN controllers.
+ *
+ * Filters added during the batch are not rolled back if the hardware update
+ * fails - the caller should remove them.
+ *
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns true if the hardware AF table was updated successfully or didn't need
+ * to be updated yet. Returns false if no batch was in progress.
+ */
+bool commitAcceptanceFilterUpdate(CanBus* buses, const int busCount);
+
+/* Public: Finish a batch of acceptance filter changes started with
+ * beginAcceptanceFilterUpdate() without applying them to the CAN controllers,
+ * e.g. to prepare the filter lists of buses in a message set that isn't active
+ * yet. Their filters are loaded into the controllers with
+ * updateAcceptanceFilterTable(...) once they're active.
+ *
+ * Returns false if no batch was in progress.
+ */
+bool discardAcceptanceFilterUpdate();
+
+/* Public: Add acceptance filters for a contiguous range of IDs, e.g. all of the
+ * responses to an OBD-II functional broadcast request, with a single update of
+ * the hardware AF table.
+ *
+ * Each ID in the range is reference counted just like a filter added with
+ * addAcceptanceFilter(...), so ranges may overlap each other and individual
+ * filters.
+ *
+ * bus - The CanBus to add the filters on.
+ * firstId - The lowest ID in the range.
+ * count - The number of IDs in the range.
+ * format - the format of the IDs for the new filters.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns true if the whole range was added. If any filter couldn't be added,
+ * none of the range is left added and this returns false.
+ */
+bool addAcceptanceFilterRange(CanBus* bus, uint32_t firstId, uint8_t count,
+        CanMessageFormat format, CanBus* buses, const int busCount);
+
+/* Public: Remove a range of acceptance filters previously added with
+ * addAcceptanceFilterRange(...), with a single update of the hardware AF table.
+ *
+ * bus - The CanBus to remove the filters from.
+ * firstId - The lowest ID in the range.
+ * count - The number of IDs in the range.
+ * format - the format of the IDs for the filters.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ */
+void removeAcceptanceFilterRange(CanBus* bus, uint32_t firstId, uint8_t count,
+        CanMessageFormat format, CanBus* buses, const int busCount);
+
+/* Private: Merge a bus's acceptance filters into the fewest ranges of
+ * contiguous IDs, for loading into the hardware AF table.
+ *
+ * Each platform's updateAcceptanceFilterTable loads these in whatever form
+ * its controller supports best - e.g. group entries in the LPC17xx AF RAM, or
+ * aligned blocks under a shared mask on the PIC32.
+ *
+ * bus - The bus with the acceptance filters to compile.
+ * ranges - An array to store the compiled ranges, sorted by format (standard
+ *      first) and then ID.
+ * maxRanges - The length of the ranges array.
+ *
+ * Returns the number of ranges stored, or -1 if they didn't fit in the array.
+ */
+int compileAcceptanceFilters(CanBus* bus, AcceptanceFilterRange* ranges,
+        int maxRanges);
+
 /* Private: Apply the CAN acceptance filter configuration from software (on the
  * CanBus struct) to the actual hardware CAN controllers.
  *
@@ -609,6 +1443,84 @@ bool setAcceptanceFilterStatus(CanBus* bus, bool enabled,
  */
 bool signalsWritable(CanBus* bus, CanSignal* signals, int signalCount);
 
+/* Public: A consistent copy of a bus's counters, which the receive interrupt
+ * may be updating.
+ *
+ * received - the number of CAN messages received.
+ * dropped - the number of CAN messages dropped, because the receive queue or
+ *      the pipeline was full.
+ * receiveQueueLength - the number of messages waiting in the receive queue.
+ * sendQueueLength - the number of messages waiting in the send queue.
+ * receiveQueuePeak - the most messages the receive queue has held.
+ * receiveQueueCapacity - the most messages the receive queue can hold.
+ * sendQueuePeak - the most messages the send queue has held.
+ * sendQueueCapacity - the most messages the send queue can hold.
+ */
+typedef struct {
+    unsigned int received;
+    unsigned int dropped;
+    unsigned int receiveQueueLength;
+    unsigned int sendQueueLength;
+    unsigned int receiveQueuePeak;
+    unsigned int receiveQueueCapacity;
+    unsigned int sendQueuePeak;
+    unsigned int sendQueueCapacity;
+} CanBusCounters;
+
+/* Public: Copy a bus's counters, reading each value shared with the interrupt
+ * handler exactly once.
+ */
+void snapshotCounters(CanBus* bus, CanBusCounters* counters);
+
+/* Public: The error state of a CAN controller, as read from the hardware.
+ *
+ * transmitErrors - the transmit error counter (TEC).
+ * receiveErrors - the receive error counter (REC).
+ * busOff - true if the controller has taken itself off the bus after too many
+ *      transmit errors.
+ *
+ * Either counter at 128 or above means the controller is error passive. They
+ * rise when the controller sees errors on the bus and fall as frames go
+ * through cleanly, so they point at wiring, termination or another node
+ * rather than anything the VI dropped.
+ */
+typedef struct {
+    uint8_t transmitErrors;
+    uint8_t receiveErrors;
+    bool busOff;
+} CanErrorCounters;
+
+/* Public: Read a controller's error counters.
+ *
+ * This function must be defined for each platform - it's hardware dependent.
+ */
+void readErrorCounters(CanBus* bus, CanErrorCounters* counters);
+
+/* Public: Start a controller that went bus off back on its way to rejoining
+ * the bus, as soon as the CAN spec allows (after 128 runs of 11 recessive
+ * bits). Does nothing if it's already recovering.
+ *
+ * This function must be defined for each platform - it's hardware dependent.
+ */
+void recoverFromBusOff(CanBus* bus);
+
+/* Public: Returns the number of bits a message took on the wire, from the
+ * start of frame to the end of the interframe space, with the stuff bits the
+ * transmitter inserted after every 5 bits of the same value. Counting those
+ * needs the frame's CRC, so it's computed bit by bit - call this from the main
+ * loop, not an interrupt handler.
+ *
+ * A CAN FD frame is counted as if its data went at the nominal bit rate, with
+ * a classic CAN CRC, so it's only an estimate.
+ */
+unsigned int frameBitLength(const CanMessage* message);
+
+/* Public: Read the controller's error counters and update the bus load, from
+ * the main loop. If the controller has gone bus off, it's counted and
+ * recovery is started right away instead of waiting for a reset.
+ */
+void updateBusStatus(CanBus* bus);
+
 /* Public: Log transfer statistics about all active CAN buses to the debug log.
  *
  * buses - an array of active CAN buses.
@@ -622,6 +1534,10 @@ void logBusStatistics(CanBus* buses, const int busCount);
  * bus has the AF off but we still want to filter on the other, we use this to
  * do software filtering based on the registered CAN messages.
  *
+ * This is called from the CAN receive ISR, so instead of walking the
+ * acceptanceFilters list it tests a bit in the bus's acceptedStandardIds
+ * bitmap, or for a larger ID searches its sorted acceptedExtendedIds table.
+ *
  * bus - The bus the message was received on.
  * messageId - the ID of the message.
  *
@@ -2,13 +2,27 @@
 #include <canutil/write.h>
 #include "can/canwrite.h"
 #include "util/log.h"
+#include "util/timer.h"
 
 namespace can = openxc::can;
+namespace time = openxc::util::time;
 
 using openxc::util::log::debug;
+using openxc::util::log::warning;
 
 QUEUE_DEFINE(CanMessage);
 
+/* Private: A message sent repeatedly, see can::write::addPeriodicWrite.
+ */
+typedef struct {
+    CanBus* bus;
+    CanMessage message;
+    openxc::util::time::FrequencyClock clock;
+} PeriodicCanWrite;
+
+static PeriodicCanWrite PERIODIC_WRITES[CAN_PERIODIC_WRITE_COUNT];
+static int periodicWriteCount = 0;
+
 void openxc::can::write::buildMessage(const CanSignal* signal, uint64_t value,
         uint8_t data[], size_t length) {
     bitfield_encode_float(value, signal->bitPosition, signal->bitSize,
@@ -43,7 +57,7 @@ uint64_t openxc::can::write::encodeNumber(const CanSignal* signal, float value,
     return float_to_fixed_point(value, signal->factor, signal->offset);
 }
 
-void openxc::can::write::enqueueMessage(CanBus* bus, CanMessage* message) {
+static CanMessage outgoingCopy(const CanMessage* message) {
     CanMessage outgoingMessage = {
         id: message->id,
         format: message->format
@@ -51,7 +65,117 @@ void openxc::can::write::enqueueMessage(CanBus* bus, CanMessage* message) {
     memcpy(outgoingMessage.data, message->data, CAN_MESSAGE_SIZE);
     outgoingMessage.length = (uint8_t)(message->length == 0 ?
             CAN_MESSAGE_SIZE : message->length);
-    QUEUE_PUSH(CanMessage, &bus->sendQueue, outgoingMessage);
+    return outgoingMessage;
+}
+
+static bool addPendingWrite(CanBus* bus, const CanMessage* message,
+        unsigned long deadlineMs) {
+    if(bus->pendingWriteCount >= CAN_PENDING_WRITE_COUNT) {
+        return false;
+    }
+    PendingCanWrite* write = &bus->pendingWrites[bus->pendingWriteCount++];
+    write->message = *message;
+    write->deadlineMs = deadlineMs;
+    return true;
+}
+
+static void removePendingWrite(CanBus* bus, int index) {
+    memmove(&bus->pendingWrites[index], &bus->pendingWrites[index + 1],
+            (bus->pendingWriteCount - index - 1) * sizeof(PendingCanWrite));
+    --bus->pendingWriteCount;
+}
+
+/* Private: Return a key that orders messages the way the bus arbitrates them.
+ * The 11 bit base ID is compared first, then the IDE bit (so a standard frame
+ * wins over an extended one with the same base ID) and then the 18 bit ID
+ * extension.
+ */
+static uint32_t arbitrationKey(const CanMessage* message) {
+    if(message->format == CanMessageFormat::EXTENDED) {
+        return ((message->id >> 18) & 0x7ff) << 19 | 1 << 18 |
+                (message->id & 0x3ffff);
+    }
+    return (message->id & 0x7ff) << 19;
+}
+
+static bool expired(const PendingCanWrite* write, unsigned long now) {
+    return (long)(now - write->deadlineMs) > 0;
+}
+
+void openxc::can::write::enqueueMessage(CanBus* bus, CanMessage* message) {
+    QUEUE_PUSH(CanMessage, &bus->sendQueue, outgoingCopy(message));
+    unsigned int length = QUEUE_LENGTH(CanMessage, &bus->sendQueue);
+    if(length > bus->sendQueuePeak) {
+        bus->sendQueuePeak = length;
+    }
+}
+
+bool openxc::can::write::enqueueMessage(CanBus* bus, CanMessage* message,
+        unsigned long timeoutMs) {
+    CanMessage outgoingMessage = outgoingCopy(message);
+    if(!addPendingWrite(bus, &outgoingMessage,
+                time::systemTimeMs() + timeoutMs)) {
+        warning("Too many pending writes on bus %d, dropped 0x%x",
+                bus->address, message->id);
+        return false;
+    }
+    return true;
+}
+
+static PeriodicCanWrite* lookupPeriodicWrite(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    for(int i = 0; i < periodicWriteCount; i++) {
+        PeriodicCanWrite* write = &PERIODIC_WRITES[i];
+        if(write->bus == bus && write->message.id == id &&
+                write->message.format == format) {
+            return write;
+        }
+    }
+    return NULL;
+}
+
+bool openxc::can::write::addPeriodicWrite(CanBus* bus, CanMessage* message,
+        float frequency) {
+    if(frequency <= 0) {
+        debug("Periodic CAN message 0x%x needs a frequency above 0",
+                message->id);
+        return false;
+    }
+
+    PeriodicCanWrite* write = lookupPeriodicWrite(bus, message->id,
+            message->format);
+    if(write == NULL) {
+        if(periodicWriteCount >= CAN_PERIODIC_WRITE_COUNT) {
+            debug("Already sending %d periodic CAN messages, can't add 0x%x",
+                    CAN_PERIODIC_WRITE_COUNT, message->id);
+            return false;
+        }
+        write = &PERIODIC_WRITES[periodicWriteCount++];
+        write->bus = bus;
+        time::initializeClock(&write->clock);
+    }
+
+    write->message = *message;
+    write->clock.frequency = frequency;
+    return true;
+}
+
+bool openxc::can::write::removePeriodicWrite(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    PeriodicCanWrite* write = lookupPeriodicWrite(bus, id, format);
+    if(write == NULL) {
+        return false;
+    }
+
+    int index = write - PERIODIC_WRITES;
+    memmove(write, write + 1,
+            (periodicWriteCount - index - 1) * sizeof(PeriodicCanWrite));
+    --periodicWriteCount;
+    return true;
+}
+
+void openxc::can::write::clearPeriodicWrites() {
+    periodicWriteCount = 0;
 }
 
 uint64_t openxc::can::write::encodeDynamicField(const CanSignal* signal,
@@ -144,11 +268,121 @@ bool openxc::can::write::sendEncodedSignal(CanSignal* signal, uint64_t value, bo
     return send;
 }
 
+void openxc::can::write::beginTransaction(CanWriteTransaction* transaction,
+        CanMessageDefinition* message, bool force) {
+    memset(transaction, 0, sizeof(CanWriteTransaction));
+    transaction->message = message;
+    transaction->force = force;
+}
+
+bool openxc::can::write::addSignal(CanWriteTransaction* transaction,
+        CanSignal* signal, openxc_DynamicField* value) {
+    if(signal->message != transaction->message) {
+        debug("Signal %s isn't in message 0x%x, can't write them together",
+                signal->genericName, transaction->message->id);
+        transaction->failed = true;
+        return false;
+    }
+
+    if(!signal->writable && !transaction->force) {
+        debug("Writing not allowed for signal with name %s",
+                signal->genericName);
+        transaction->failed = true;
+        return false;
+    }
+
+    bool send = true;
+    uint64_t encodedValue = 0;
+    if(signal->encoder == NULL) {
+        encodedValue = encodeDynamicField(signal, value, &send);
+    } else {
+        encodedValue = signal->encoder(signal, value, &send);
+    }
+
+    if(!send && !transaction->force) {
+        transaction->failed = true;
+        return false;
+    }
+
+    buildMessage(signal, encodedValue, transaction->data,
+            sizeof(transaction->data));
+    ++transaction->signalCount;
+    return true;
+}
+
+bool openxc::can::write::commitTransaction(CanWriteTransaction* transaction) {
+    if(transaction->failed || transaction->signalCount == 0) {
+        return false;
+    }
+
+    CanMessage message = {
+        id: transaction->message->id,
+        format: transaction->message->format
+    };
+    memcpy(message.data, transaction->data, CAN_MESSAGE_SIZE);
+    enqueueMessage(transaction->message->bus, &message);
+    return true;
+}
+
+void openxc::can::write::sendPendingWrites(CanBus* bus) {
+    // This runs in the transmit interrupt, so no logging
+    unsigned long now = time::systemTimeMs();
+    while(bus->pendingWriteCount > 0) {
+        int next = -1;
+        for(int i = 0; i < bus->pendingWriteCount; i++) {
+            if(expired(&bus->pendingWrites[i], now)) {
+                ++bus->writesExpired;
+                removePendingWrite(bus, i--);
+            } else if(next == -1 ||
+                    arbitrationKey(&bus->pendingWrites[i].message) <
+                    arbitrationKey(&bus->pendingWrites[next].message)) {
+                // strictly less, so messages with the same ID stay in order
+                next = i;
+            }
+        }
+
+        if(next == -1) {
+            break;
+        }
+
+        if(bus->writeHandler != NULL && !bus->writeHandler(bus,
+                    &bus->pendingWrites[next].message)) {
+            // Every transmit buffer is full - the transmit interrupt or the
+            // next flush picks up from here, still in order
+            break;
+        }
+        removePendingWrite(bus, next);
+    }
+}
+
 void openxc::can::write::flushOutgoingCanMessageQueue(CanBus* bus) {
-    while(!QUEUE_EMPTY(CanMessage, &bus->sendQueue)) {
+    for(int i = 0; i < periodicWriteCount; i++) {
+        if(PERIODIC_WRITES[i].bus == bus &&
+                time::conditionalTick(&PERIODIC_WRITES[i].clock)) {
+            enqueueMessage(bus, &PERIODIC_WRITES[i].message);
+        }
+    }
+
+    if(QUEUE_EMPTY(CanMessage, &bus->sendQueue) &&
+            bus->pendingWriteCount == 0) {
+        return;
+    }
+
+    if(bus->writeHandler == NULL) {
+        debug("No function available for writing to CAN -- dropped");
+    }
+
+    disableTransmitInterrupt(bus);
+    bus->writing = true;
+    unsigned long now = time::systemTimeMs();
+    while(!QUEUE_EMPTY(CanMessage, &bus->sendQueue) &&
+            bus->pendingWriteCount < CAN_PENDING_WRITE_COUNT) {
         const CanMessage message = QUEUE_POP(CanMessage, &bus->sendQueue);
-        sendCanMessage(bus, &message);
+        addPendingWrite(bus, &message, now + CAN_WRITE_RETRY_MS);
     }
+    sendPendingWrites(bus);
+    bus->writing = false;
+    enableTransmitInterrupt(bus);
 }
 
 bool openxc::can::write::sendCanMessage(const CanBus* bus, const CanMessage* message) {
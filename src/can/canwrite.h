@@ -127,6 +127,63 @@ bool encodeAndSendSignal(CanSignal* signal, openxc_DynamicField* value, bool for
  */
 bool sendEncodedSignal(CanSignal* signal, uint64_t value, bool force);
 
+/* Public: A CAN frame being built up from several signal values, to send them
+ * all at once.
+ *
+ * Sending signals one at a time (e.g. with encodeAndSendSignal) writes one
+ * frame per signal, each with every other signal in the message zeroed. When
+ * signals share a message, add them to a transaction instead and they're all
+ * written in a single frame.
+ *
+ * message - The message definition every signal in the transaction belongs to.
+ * data - The frame built so far.
+ * signalCount - The number of signals added so far.
+ * force - true if the signals should be sent regardless of their writable
+ *      status.
+ * failed - true if a signal couldn't be added, in which case the transaction
+ *      won't be sent.
+ */
+typedef struct {
+    CanMessageDefinition* message;
+    uint8_t data[CAN_MESSAGE_SIZE];
+    uint8_t signalCount;
+    bool force;
+    bool failed;
+} CanWriteTransaction;
+
+/* Public: Start a new, empty transaction for a CAN message.
+ *
+ * transaction - The transaction to initialize.
+ * message - The message the signals will be written in.
+ * force - true if the signals should be sent regardless of their writable
+ *      status.
+ */
+void beginTransaction(CanWriteTransaction* transaction,
+        CanMessageDefinition* message, bool force);
+
+/* Public: Encode a signal value into a transaction's frame, using the signal's
+ * own encoder if it has one.
+ *
+ * If the signal is in a different message than the transaction, isn't writable
+ * (and the transaction isn't forced) or the value can't be encoded, the whole
+ * transaction is marked as failed.
+ *
+ * transaction - The transaction to add to.
+ * signal - The CanSignal to write.
+ * value - The value to write in the signal.
+ *
+ * Returns true if the value was added.
+ */
+bool addSignal(CanWriteTransaction* transaction, CanSignal* signal,
+        openxc_DynamicField* value);
+
+/* Public: Queue a transaction's frame to be written to its message's bus.
+ *
+ * Returns true if the frame was queued, or false if the transaction is empty
+ * or any of its signals failed.
+ */
+bool commitTransaction(CanWriteTransaction* transaction);
+
 /* Public: Three shortcut functions to encode and send a signal without manually
  * creating an openxc_DynamicField.
  */
@@ -148,12 +205,89 @@ bool encodeAndSendNumericSignal(CanSignal* signal, float value, bool force);
  */
 void enqueueMessage(CanBus* bus, CanMessage* message);
 
+/* Public: Queue a CAN message that's only worth sending within a time limit,
+ * e.g. a periodic command that would be wrong if it arrived late. It's sent in
+ * arbitration order with everything else, but dropped if it can't be written
+ * before the limit.
+ *
+ * bus - the bus to send the message.
+ * message - the CAN message to send, as for enqueueMessage.
+ * timeoutMs - how long from now the message may still be sent.
+ *
+ * Returns false if the bus already has CAN_PENDING_WRITE_COUNT messages
+ * waiting, in which case the message is dropped.
+ */
+bool enqueueMessage(CanBus* bus, CanMessage* message, unsigned long timeoutMs);
+
+/* Public: Send a CAN message repeatedly, e.g. as a keep-alive or to simulate an
+ * ECU, without a host having to write it at that rate.
+ *
+ * Each time flushOutgoingCanMessageQueue runs for the bus, a copy of the
+ * message is queued if its period has passed (the first one right away).
+ * Adding a message with the same bus, ID and format as one already set up
+ * replaces its data and frequency.
+ *
+ * bus - the bus to send the message on.
+ * message - the CAN message to send.
+ * frequency - how many times a second to send it, more than 0.
+ *
+ * Returns false if the frequency is invalid or CAN_PERIODIC_WRITE_COUNT
+ * messages are already set up.
+ */
+bool addPeriodicWrite(CanBus* bus, CanMessage* message, float frequency);
+
+/* Public: Stop sending a CAN message set up with addPeriodicWrite.
+ *
+ * Returns false if no periodic message with that ID and format was set up on the
+ * bus.
+ */
+bool removePeriodicWrite(CanBus* bus, uint32_t id, CanMessageFormat format);
+
+/* Public: Stop sending every periodic message, on all buses.
+ */
+void clearPeriodicWrites();
+
 /* Public: Write any queued outgoing messages to the CAN bus.
+ *
+ * Any periodic messages for the bus that are due (see addPeriodicWrite) are
+ * queued first.
+ *
+ * Messages are written in the order the bus would arbitrate them - lowest ID
+ * first, and a standard frame before an extended one with the same base ID -
+ * so a time critical write isn't stuck behind bulk diagnostic traffic.
+ * Messages with the same ID keep the order they were queued in. If the
+ * controller can't take a message, it and the rest are kept for the next call,
+ * until their deadline (CAN_WRITE_RETRY_MS after they're flushed, unless they
+ * were queued with their own) passes and they're dropped. Platforms with a
+ * transmit complete interrupt also keep sending them from there as the
+ * controller's transmit buffers empty, between calls.
  *
  * bus - The CanBus instance that has a queued to be flushed out to CAN.
  */
 void flushOutgoingCanMessageQueue(CanBus* bus);
 
+/* Public: Write the bus's pending messages in arbitration order until the
+ * controller can't take any more, dropping any past their deadline.
+ *
+ * This is called by flushOutgoingCanMessageQueue with the transmit interrupt
+ * disabled, and by the platform's transmit complete interrupt to refill the
+ * controller's transmit buffers as soon as they empty. It doesn't log, and
+ * calls the bus's writeHandler directly.
+ *
+ * bus - The CanBus instance with pending writes.
+ */
+void sendPendingWrites(CanBus* bus);
+
+/* Public: Keep the platform's transmit complete interrupt from calling
+ * sendPendingWrites while the main loop changes the bus's pending writes, and
+ * let it again afterwards.
+ *
+ * Defined per-platform.
+ */
+void disableTransmitInterrupt(CanBus* bus);
+
+void enableTransmitInterrupt(CanBus* bus);
+
 /* Public: Write a CAN message with the given data and node ID to the bus
  * immediately.
  *
@@ -0,0 +1,49 @@
+#ifndef __E2E_H__
+#define __E2E_H__
+
+#include "can/canutil.h"
+
+// End-to-end protection of received messages. Many messages carry an alive
+// counter that the sender increments with every frame and a checksum of the
+// rest of the frame, so a receiver can tell a stale or corrupt frame from a
+// good one. A message definition with a CanMessageProtection has each frame
+// checked before any of its signals are decoded, and a frame that fails is
+// dropped there - its signals keep their last values and nothing is
+// published for it. Raw passthrough still sends every frame as received.
+
+namespace openxc {
+namespace can {
+namespace e2e {
+
+/* Public: Calculate a checksum of a frame's data.
+ *
+ * type - The kind of checksum.
+ * data - The frame's data.
+ * length - The length of the data.
+ * checksumByte - The byte the checksum is sent in, which is left out of it.
+ *
+ * Returns the checksum, or 0 for CHECKSUM_NONE.
+ */
+uint8_t checksum(CanChecksumType type, const uint8_t data[], uint8_t length,
+        uint8_t checksumByte);
+
+/* Public: Check a frame against its message's alive counter and checksum, and
+ * count it against the message and its bus if it fails.
+ *
+ * A frame with a good checksum moves the message's counter on even if the
+ * counter is unexpected, so after a glitch only one frame is dropped. The
+ * first frame only sets the counter.
+ *
+ * definition - The message's definition.
+ * message - The frame received.
+ *
+ * Returns true if the frame should be decoded - it passed, or the definition
+ * has no protection.
+ */
+bool validate(CanMessageDefinition* definition, const CanMessage* message);
+
+} // namespace e2e
+} // namespace can
+} // namespace openxc
+
+#endif // __E2E_H__
@@ -0,0 +1,113 @@
+#include "can/gateway.h"
+#include "util/log.h"
+#include "util/ram_function.h"
+
+using openxc::util::log::debug;
+
+// The largest group of IDs that acceptance filters are added for, which is as
+// many as addAcceptanceFilterRange takes at once rounded down to a power of 2.
+#define MAX_FILTERED_GROUP_SIZE 128
+
+static uint32_t fullIdMask(CanMessageFormat format) {
+    return format == CanMessageFormat::EXTENDED ? 0x1fffffff : 0x7ff;
+}
+
+/* Private: Returns the number of IDs to add acceptance filters for, from the
+ * route's ID up, or 0 if the mask doesn't select a small enough block of
+ * consecutive IDs.
+ */
+static uint8_t filteredGroupSize(uint32_t mask, CanMessageFormat format) {
+    uint32_t groupSize = (~mask & fullIdMask(format)) + 1;
+    if((groupSize & (groupSize - 1)) != 0 ||
+            groupSize > MAX_FILTERED_GROUP_SIZE) {
+        return 0;
+    }
+    return (uint8_t) groupSize;
+}
+
+bool openxc::can::gateway::addRoute(CanBus* source, uint32_t id,
+        uint32_t mask, CanMessageFormat format, CanBus* destination,
+        uint32_t destinationId, CanBus* buses, const int busCount) {
+    if(source->gatewayRouteCount >= CAN_GATEWAY_ROUTE_COUNT) {
+        debug("Bus %d already forwards %d selections of IDs",
+                source->address, CAN_GATEWAY_ROUTE_COUNT);
+        return false;
+    }
+
+    if(destination == source) {
+        debug("Can't forward messages from bus %d to itself",
+                source->address);
+        return false;
+    }
+
+    if(!destination->rawWritable) {
+        debug("Bus %d isn't writable, can't forward messages to it",
+                destination->address);
+        return false;
+    }
+
+    mask &= fullIdMask(format);
+    CanGatewayRoute* route =
+            &source->gatewayRoutes[source->gatewayRouteCount];
+    route->id = id & mask;
+    route->mask = mask;
+    route->format = format;
+    route->destination = destination;
+    route->destinationId = destinationId & mask;
+    route->filterCount = filteredGroupSize(mask, format);
+    if(route->filterCount > 0 && !addAcceptanceFilterRange(source, route->id,
+                route->filterCount, format, buses, busCount)) {
+        debug("No acceptance filter for forwarding 0x%x on bus %d",
+                id, source->address);
+        route->filterCount = 0;
+    }
+
+    // The receive interrupt may be reading the routes, so only count this one
+    // once it's all there
+    __sync_synchronize();
+    ++source->gatewayRouteCount;
+    return true;
+}
+
+void openxc::can::gateway::clearRoutes(CanBus* source, CanBus* buses,
+        const int busCount) {
+    int routeCount = source->gatewayRouteCount;
+    source->gatewayRouteCount = 0;
+    __sync_synchronize();
+
+    beginAcceptanceFilterUpdate();
+    for(int i = 0; i < routeCount; i++) {
+        CanGatewayRoute* route = &source->gatewayRoutes[i];
+        if(route->filterCount > 0) {
+            removeAcceptanceFilterRange(source, route->id, route->filterCount,
+                    route->format, buses, busCount);
+        }
+    }
+    commitAcceptanceFilterUpdate(buses, busCount);
+}
+
+RAM_FUNCTION
+bool openxc::can::gateway::forward(CanBus* source,
+        const CanMessage* message) {
+    // This runs in the receive interrupt, so no logging
+    bool forwarded = false;
+    for(int i = 0; i < source->gatewayRouteCount; i++) {
+        const CanGatewayRoute* route = &source->gatewayRoutes[i];
+        if(route->format != message->format ||
+                (message->id & route->mask) != route->id) {
+            continue;
+        }
+
+        CanBus* destination = route->destination;
+        CanMessage copy = *message;
+        copy.id = (message->id & ~route->mask) | route->destinationId;
+        if(!destination->writing && destination->writeHandler != NULL &&
+                destination->writeHandler(destination, &copy)) {
+            ++source->gatewayForwarded;
+            forwarded = true;
+        } else {
+            ++source->gatewayDropped;
+        }
+    }
+    return forwarded;
+}
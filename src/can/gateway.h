@@ -0,0 +1,74 @@
+#ifndef __GATEWAY_H__
+#define __GATEWAY_H__
+
+#include "can/canutil.h"
+
+// Forwards selected messages from one bus to another without a round trip
+// through the host, e.g. to bridge a message between two networks. The
+// receive interrupt hands a matching message straight to the destination
+// controller's transmit buffers, so it's on the other bus within microseconds,
+// ahead of anything still waiting in the destination's send queue.
+//
+// A message is never queued for later - if the destination controller has no
+// free transmit buffer, or the main loop is in the middle of writing to it,
+// the message is dropped and counted in the source bus's gatewayDropped. A
+// late copy of a forwarded message is usually worse than none, and the next
+// one is on its way.
+
+namespace openxc {
+namespace can {
+namespace gateway {
+
+/* Public: Forward a CAN message ID, or a group of IDs, from one bus to
+ * another, optionally under a different ID.
+ *
+ * The IDs are added to the source bus's acceptance filters, so they're
+ * received even when the bus filters messages, if the mask leaves up to 7 of
+ * the lowest bits free (i.e. a group of up to 128 consecutive IDs). Any other
+ * group is only received if it's already accepted or the bus's acceptance
+ * filter is bypassed.
+ *
+ * source - The bus to forward messages from.
+ * id - The ID to match.
+ * mask - The bits of the ID that must match, e.g. 0x7f8 for a group of 8 IDs
+ *      or 0x7ff (0x1fffffff for an extended ID) for one.
+ * format - The format of the IDs.
+ * destination - The bus to forward them to, which must be rawWritable.
+ * destinationId - The ID to forward the messages under, or the first of the
+ *      group - the bits of a message's ID outside the mask are kept. Use id to
+ *      forward them unchanged.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if the destination is the source bus or isn't rawWritable,
+ * or the source bus already has CAN_GATEWAY_ROUTE_COUNT routes.
+ */
+bool addRoute(CanBus* source, uint32_t id, uint32_t mask,
+        CanMessageFormat format, CanBus* destination, uint32_t destinationId,
+        CanBus* buses, const int busCount);
+
+/* Public: Stop forwarding messages from a bus, and remove the acceptance
+ * filters added for its routes.
+ *
+ * source - The bus to stop forwarding from.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ */
+void clearRoutes(CanBus* source, CanBus* buses, const int busCount);
+
+/* Public: Forward a message just received on a bus along any of its routes it
+ * matches. Call this from the CAN receive interrupt, for every message the
+ * controller received, whether or not it's accepted for decoding.
+ *
+ * source - The bus the message was received on.
+ * message - The received message.
+ *
+ * Returns true if the message was written to any other bus.
+ */
+bool forward(CanBus* source, const CanMessage* message);
+
+} // namespace gateway
+} // namespace can
+} // namespace openxc
+
+#endif // __GATEWAY_H__
@@ -0,0 +1,256 @@
+#include "can/j1939.h"
+#include "can/canread.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace time = openxc::util::time;
+
+using openxc::util::log::debug;
+using openxc::pipeline::Pipeline;
+using openxc::can::read::publishStringEventedMessage;
+
+// The PDU formats below this have a destination address in their PDU specific
+// byte
+#define J1939_PDU2_FORMAT 240
+
+#define J1939_TP_RTS 16
+#define J1939_TP_BAM 32
+#define J1939_TP_ABORT 255
+#define J1939_TP_PACKET_SIZE 7
+#define J1939_TP_MAX_SIZE 1785
+
+uint32_t openxc::can::j1939::pgn(uint32_t id) {
+    uint32_t pgn = (id >> 8) & 0x3ffff;
+    if(((pgn >> 8) & 0xff) < J1939_PDU2_FORMAT) {
+        pgn &= 0x3ff00;
+    }
+    return pgn;
+}
+
+uint8_t openxc::can::j1939::priority(uint32_t id) {
+    return (id >> 26) & 0x7;
+}
+
+uint8_t openxc::can::j1939::sourceAddress(uint32_t id) {
+    return id & 0xff;
+}
+
+uint8_t openxc::can::j1939::destinationAddress(uint32_t id) {
+    if(((id >> 16) & 0xff) < J1939_PDU2_FORMAT) {
+        return (id >> 8) & 0xff;
+    }
+    return J1939_GLOBAL_ADDRESS;
+}
+
+uint32_t openxc::can::j1939::messageKey(uint32_t id) {
+    return pgn(id) << 8;
+}
+
+#if J1939_TP_SESSION_COUNT > 0
+
+/* Private: A transfer being reassembled.
+ *
+ * bus - The bus it's on, or NULL if the session is free.
+ * source - The address of the sender.
+ * destination - The address it's sent to, J1939_GLOBAL_ADDRESS for a BAM.
+ * pgn - The PGN of the message being transferred.
+ * size - The size of the message in bytes.
+ * packetCount - The number of TP.DT packets it's sent in.
+ * nextSequence - The sequence number of the next packet expected.
+ * lastFrameMs - When the last frame of the transfer was received.
+ * data - The message so far.
+ */
+typedef struct {
+    const CanBus* bus;
+    uint8_t source;
+    uint8_t destination;
+    uint32_t pgn;
+    uint16_t size;
+    uint8_t packetCount;
+    uint16_t nextSequence;
+    unsigned long lastFrameMs;
+    uint8_t data[J1939_TP_BUFFER_SIZE];
+} TransportSession;
+
+static TransportSession SESSIONS[J1939_TP_SESSION_COUNT];
+static unsigned int droppedTransfers = 0;
+
+static bool expired(const TransportSession* session) {
+    return time::systemTimeMs() - session->lastFrameMs > J1939_TP_TIMEOUT_MS;
+}
+
+/* Private: Find the transfer in progress from a source to a destination on a
+ * bus. A transfer that's timed out is freed instead.
+ */
+static TransportSession* findSession(const CanBus* bus, uint8_t source,
+        uint8_t destination) {
+    for(int i = 0; i < J1939_TP_SESSION_COUNT; i++) {
+        TransportSession* session = &SESSIONS[i];
+        if(session->bus == bus && session->source == source &&
+                session->destination == destination) {
+            if(expired(session)) {
+                session->bus = NULL;
+                return NULL;
+            }
+            return session;
+        }
+    }
+    return NULL;
+}
+
+static TransportSession* allocateSession() {
+    for(int i = 0; i < J1939_TP_SESSION_COUNT; i++) {
+        TransportSession* session = &SESSIONS[i];
+        if(session->bus == NULL || expired(session)) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+static void publishTransfer(const TransportSession* session,
+        Pipeline* pipeline) {
+    char value[24];
+    snprintf(value, sizeof(value), "%d:0x%lx:0x%02x", session->bus->address,
+            (unsigned long) session->pgn, session->source);
+    char event[J1939_TP_BUFFER_SIZE * 2 + 1];
+    for(int i = 0; i < session->size; i++) {
+        snprintf(&event[i * 2], 3, "%02x", session->data[i]);
+    }
+    event[session->size * 2] = '\0';
+    publishStringEventedMessage(J1939_TP_MESSAGE_NAME, value, event,
+            pipeline);
+}
+
+/* Private: Start following a transfer announced by a BAM or RTS, giving up on
+ * any that was in progress between the same nodes.
+ */
+static void openSession(const CanBus* bus, uint8_t source,
+        uint8_t destination, const uint8_t data[]) {
+    TransportSession* session = findSession(bus, source, destination);
+    if(session != NULL) {
+        session->bus = NULL;
+    }
+
+    uint16_t size = data[1] | (data[2] << 8);
+    uint8_t packetCount = data[3];
+    if(size <= CAN_MESSAGE_SIZE || size > J1939_TP_MAX_SIZE ||
+            packetCount != (size + J1939_TP_PACKET_SIZE - 1) /
+                J1939_TP_PACKET_SIZE) {
+        return;
+    }
+
+    if(size > J1939_TP_BUFFER_SIZE ||
+            (session = allocateSession()) == NULL) {
+        ++droppedTransfers;
+        return;
+    }
+
+    session->bus = bus;
+    session->source = source;
+    session->destination = destination;
+    session->pgn = data[5] | (data[6] << 8) | ((uint32_t) data[7] << 16);
+    session->size = size;
+    session->packetCount = packetCount;
+    session->nextSequence = 1;
+    session->lastFrameMs = time::systemTimeMs();
+}
+
+static void receiveConnectionManagement(const CanBus* bus, uint8_t source,
+        uint8_t destination, const uint8_t data[]) {
+    switch(data[0]) {
+    case J1939_TP_RTS:
+    case J1939_TP_BAM:
+        openSession(bus, source, destination, data);
+        break;
+    case J1939_TP_ABORT: {
+        // Either end of a connection can abort it
+        TransportSession* session = findSession(bus, source, destination);
+        if(session == NULL) {
+            session = findSession(bus, destination, source);
+        }
+        if(session != NULL) {
+            session->bus = NULL;
+        }
+        break;
+    }
+    default:
+        // The CTS and end of message acknowledgement only matter to the ends
+        // of the connection
+        break;
+    }
+}
+
+static void receiveDataTransfer(const CanBus* bus, uint8_t source,
+        uint8_t destination, const uint8_t data[], Pipeline* pipeline) {
+    TransportSession* session = findSession(bus, source, destination);
+    uint8_t sequence = data[0];
+    if(session == NULL || sequence == 0 ||
+            sequence > session->packetCount) {
+        return;
+    }
+
+    if(sequence > session->nextSequence) {
+        // A packet was missed. A BAM is never sent again, but the receiver of
+        // a connection asks for what it missed with a CTS, so wait for it.
+        if(session->destination == J1939_GLOBAL_ADDRESS) {
+            session->bus = NULL;
+        }
+        return;
+    }
+
+    int offset = (sequence - 1) * J1939_TP_PACKET_SIZE;
+    int length = session->size - offset;
+    if(length > J1939_TP_PACKET_SIZE) {
+        length = J1939_TP_PACKET_SIZE;
+    }
+    memcpy(&session->data[offset], &data[1], length);
+    session->lastFrameMs = time::systemTimeMs();
+    if(sequence == session->nextSequence &&
+            ++session->nextSequence > session->packetCount) {
+        publishTransfer(session, pipeline);
+        session->bus = NULL;
+    }
+}
+
+void openxc::can::j1939::receive(const CanBus* bus,
+        const CanMessage* message, Pipeline* pipeline) {
+    if(message->format != CanMessageFormat::EXTENDED ||
+            message->length < CAN_MESSAGE_SIZE) {
+        return;
+    }
+
+    uint32_t group = pgn(message->id);
+    uint8_t source = sourceAddress(message->id);
+    uint8_t destination = destinationAddress(message->id);
+    if(group == J1939_PGN_TP_CM) {
+        receiveConnectionManagement(bus, source, destination, message->data);
+    } else if(group == J1939_PGN_TP_DT) {
+        receiveDataTransfer(bus, source, destination, message->data,
+                pipeline);
+    }
+}
+
+unsigned int openxc::can::j1939::droppedTransferCount() {
+    return droppedTransfers;
+}
+
+void openxc::can::j1939::reset() {
+    memset(SESSIONS, 0, sizeof(SESSIONS));
+    droppedTransfers = 0;
+}
+
+#else
+
+void openxc::can::j1939::receive(const CanBus* bus,
+        const CanMessage* message, Pipeline* pipeline) { }
+
+unsigned int openxc::can::j1939::droppedTransferCount() {
+    return 0;
+}
+
+void openxc::can::j1939::reset() { }
+
+#endif // J1939_TP_SESSION_COUNT > 0
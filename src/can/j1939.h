@@ -0,0 +1,113 @@
+#ifndef __J1939_H__
+#define __J1939_H__
+
+#include "can/canutil.h"
+#include "pipeline.h"
+
+// The number of J1939 transport protocol transfers, across all buses, that can
+// be reassembled at once. Each one costs about J1939_TP_BUFFER_SIZE + 20 bytes
+// of RAM. Use 0 to leave transport protocol reassembly out of the firmware.
+#ifndef J1939_TP_SESSION_COUNT
+#define J1939_TP_SESSION_COUNT 0
+#endif
+
+// The largest transfer that's reassembled, in bytes. Larger ones are ignored.
+// At most 49 (7 packets), so the payload fits in a simple message as hex.
+#ifndef J1939_TP_BUFFER_SIZE
+#define J1939_TP_BUFFER_SIZE 49
+#endif
+
+#if J1939_TP_BUFFER_SIZE > 49
+#error "J1939_TP_BUFFER_SIZE can be at most 49"
+#endif
+
+// How long a transfer waits for its next packet before it's given up on - the
+// longest of the J1939-21 T1 and T2 timeouts.
+#ifndef J1939_TP_TIMEOUT_MS
+#define J1939_TP_TIMEOUT_MS 1250
+#endif
+
+#define J1939_PGN_TP_CM 0xec00
+#define J1939_PGN_TP_DT 0xeb00
+#define J1939_GLOBAL_ADDRESS 0xff
+
+// The name of the simple messages reassembled transfers are published in.
+#define J1939_TP_MESSAGE_NAME "j1939"
+
+// SAE J1939 on 29-bit IDs. An ID packs a priority, the parameter group number
+// (PGN) that says what the data is, and the source address of the sender - and
+// for PDU1 PGNs (a PDU format below 240) a destination address in place of the
+// PGN's low byte:
+//
+//      priority (3) | EDP, DP (2) | PDU format (8) | PDU specific (8) | SA (8)
+//
+// The same message from another ECU, or at another priority, has a different
+// ID. On a bus with j1939 set, extended IDs are matched to message
+// definitions by their PGN alone (see messageKey), so one definition covers
+// them all.
+//
+// Messages of more than 8 bytes are sent with the transport protocol, either
+// broadcast (BAM) or to one node (CMDT, with RTS/CTS handshakes). Both are
+// reassembled by listening - the VI doesn't claim an address, so it never
+// sends a CTS itself - in a pool of J1939_TP_SESSION_COUNT buffers shared by
+// all buses, and published when complete, e.g.
+//
+//      {"name": "j1939", "value": "1:0xfeca:0x00",
+//          "event": "0300ffff0400f000010800"}
+//
+// with the bus, the PGN and the source address as the value, and the data in
+// hex as the event.
+
+namespace openxc {
+namespace can {
+namespace j1939 {
+
+/* Public: Returns the PGN of a 29-bit ID, with the destination address of a
+ * PDU1 PGN cleared.
+ */
+uint32_t pgn(uint32_t id);
+
+/* Public: Returns the priority of a 29-bit ID, 0 being the highest. */
+uint8_t priority(uint32_t id);
+
+/* Public: Returns the source address of a 29-bit ID. */
+uint8_t sourceAddress(uint32_t id);
+
+/* Public: Returns the destination address of a 29-bit ID, or
+ * J1939_GLOBAL_ADDRESS if its PGN is PDU2 and so broadcast.
+ */
+uint8_t destinationAddress(uint32_t id);
+
+/* Public: Returns the ID that every ID of the same PGN is matched to a
+ * message definition by - the PGN shifted into place, with the priority and
+ * addresses 0.
+ */
+uint32_t messageKey(uint32_t id);
+
+/* Public: Follow the transport protocol transfers on a J1939 bus, and
+ * publish each one that completes. Call this from the main loop for every
+ * message received on the bus - any that aren't TP.CM or TP.DT frames are
+ * ignored.
+ *
+ * bus - The bus the message was received on.
+ * message - The message.
+ * pipeline - The pipeline to publish completed transfers to.
+ */
+void receive(const CanBus* bus, const CanMessage* message,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Returns the number of announced transfers that weren't reassembled,
+ * because they were bigger than J1939_TP_BUFFER_SIZE or every buffer was in
+ * use.
+ */
+unsigned int droppedTransferCount();
+
+/* Public: Give up on every transfer in progress.
+ */
+void reset();
+
+} // namespace j1939
+} // namespace can
+} // namespace openxc
+
+#endif // __J1939_H__
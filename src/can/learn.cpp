@@ -0,0 +1,230 @@
+#include "can/learn.h"
+#include "util/log.h"
+#include "util/timer.h"
+
+namespace time = openxc::util::time;
+
+using openxc::util::log::debug;
+using openxc::util::log::info;
+using openxc::can::lookupMessageDefinition;
+using openxc::can::addAcceptanceFilter;
+using openxc::can::removeAcceptanceFilter;
+using openxc::can::setAcceptanceFilterStatus;
+
+#if CAN_FILTER_LEARN_ID_COUNT > 0
+
+/* Private: An ID heard on a bus while it's learning, or once it's learned, one
+ * that learning added an acceptance filter for.
+ */
+typedef struct {
+    uint32_t id;
+    uint8_t busAddress;
+    uint8_t format;
+    bool filterAdded;
+} LearnedId;
+
+static LearnedId LEARNED_IDS[CAN_FILTER_LEARN_ID_COUNT];
+static int learnedIdCount = 0;
+
+static int findId(uint8_t busAddress, uint32_t id, CanMessageFormat format) {
+    for(int i = 0; i < learnedIdCount; i++) {
+        if(LEARNED_IDS[i].busAddress == busAddress &&
+                LEARNED_IDS[i].id == id && LEARNED_IDS[i].format == format) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void removeId(int index) {
+    LEARNED_IDS[index] = LEARNED_IDS[--learnedIdCount];
+}
+
+/* Private: Drop everything kept for a bus. If restoreFilters is true, the
+ * acceptance filters learning added are removed and the message set's filters
+ * it removed are put back - if not, they were already reset with the bus.
+ */
+static void clear(CanBus* bus, bool restoreFilters,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount) {
+    for(int i = 0; i < messageCount; i++) {
+        CanMessageDefinition* message = &messages[i];
+        if(message->bus != bus || !message->filterUnlearned) {
+            continue;
+        }
+
+        message->filterUnlearned = false;
+        // a decode profile may have removed the same filter, which it will
+        // put back itself
+        if(restoreFilters && !message->filterSuspended) {
+            addAcceptanceFilter(bus, message->id, message->format, buses,
+                    busCount);
+        }
+    }
+
+    for(int i = learnedIdCount - 1; i >= 0; i--) {
+        const LearnedId* entry = &LEARNED_IDS[i];
+        if(entry->busAddress != bus->address) {
+            continue;
+        }
+
+        if(restoreFilters && entry->filterAdded) {
+            removeAcceptanceFilter(bus, entry->id,
+                    (CanMessageFormat) entry->format, buses, busCount);
+        }
+        removeId(i);
+    }
+}
+
+bool openxc::can::learn::start(CanBus* bus, unsigned long windowMs,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount) {
+    if(bus->surveying || bus->autoBaudSearching) {
+        debug("Can't learn the filters of CAN%d while it's surveyed or its "
+                "speed is searched for", bus->address);
+        return false;
+    }
+
+    forget(bus, messages, messageCount, buses, busCount);
+    bus->learnBypassFilters = bus->bypassFilters;
+    bus->learningFilters = true;
+    bus->learnUntilMs = time::systemTimeMs() + windowMs;
+    if(!bus->bypassFilters) {
+        setAcceptanceFilterStatus(bus, false, buses, busCount);
+    }
+    debug("Learning the acceptance filters of CAN%d for %lums", bus->address,
+            windowMs);
+    return true;
+}
+
+void openxc::can::learn::forget(CanBus* bus, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, const int busCount) {
+    if(bus->learningFilters) {
+        bus->learningFilters = false;
+        clear(bus, false, messages, messageCount, buses, busCount);
+    } else if(bus->filtersLearned) {
+        bus->filtersLearned = false;
+        beginAcceptanceFilterUpdate();
+        clear(bus, true, messages, messageCount, buses, busCount);
+        commitAcceptanceFilterUpdate(buses, busCount);
+    } else {
+        // Anything left is from before the bus was last initialized, which
+        // reset its filters too
+        clear(bus, false, messages, messageCount, buses, busCount);
+        return;
+    }
+    setAcceptanceFilterStatus(bus, !bus->learnBypassFilters, buses, busCount);
+}
+
+void openxc::can::learn::record(CanBus* bus, const CanMessage* message,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount) {
+    if(!bus->learningFilters ||
+            findId(bus->address, message->id, message->format) != -1) {
+        return;
+    }
+
+    if(lookupMessageDefinition(bus, message->id, message->format, messages,
+                messageCount) == NULL && !(bus->passthroughCanMessages &&
+                passthroughSelected(bus, message))) {
+        return;
+    }
+
+    if(learnedIdCount >= CAN_FILTER_LEARN_ID_COUNT) {
+        debug("Too many IDs on CAN%d to learn its filters", bus->address);
+        forget(bus, messages, messageCount, buses, busCount);
+        return;
+    }
+
+    LearnedId* entry = &LEARNED_IDS[learnedIdCount++];
+    entry->id = message->id;
+    entry->busAddress = bus->address;
+    entry->format = message->format;
+    entry->filterAdded = false;
+}
+
+void openxc::can::learn::update(CanBus* bus, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, const int busCount) {
+    if(!bus->learningFilters || time::systemTimeMs() < bus->learnUntilMs) {
+        return;
+    }
+
+    bus->learningFilters = false;
+    bus->filtersLearned = true;
+    beginAcceptanceFilterUpdate();
+
+    // Heard IDs outside of the message set need filters of their own
+    int added = 0;
+    bool status = true;
+    for(int i = 0; i < learnedIdCount && status; i++) {
+        LearnedId* entry = &LEARNED_IDS[i];
+        CanMessageFormat format = (CanMessageFormat) entry->format;
+        if(entry->busAddress != bus->address ||
+                lookupMessageDefinition(bus, entry->id, format, messages,
+                    messageCount) != NULL) {
+            continue;
+        }
+
+        status = addAcceptanceFilter(bus, entry->id, format, buses, busCount);
+        entry->filterAdded = status;
+        added += status;
+    }
+
+    int removed = 0;
+    if(status) {
+        for(int i = 0; i < messageCount; i++) {
+            CanMessageDefinition* message = &messages[i];
+            if(message->bus != bus || message->filterUnlearned ||
+                    findId(bus->address, message->id, message->format) != -1) {
+                continue;
+            }
+
+            message->filterUnlearned = true;
+            if(!message->filterSuspended) {
+                removeAcceptanceFilter(bus, message->id, message->format,
+                        buses, busCount);
+            }
+            ++removed;
+        }
+
+        // the heard IDs in the message set keep the filters they had
+        for(int i = learnedIdCount - 1; i >= 0; i--) {
+            if(LEARNED_IDS[i].busAddress == bus->address &&
+                    !LEARNED_IDS[i].filterAdded) {
+                removeId(i);
+            }
+        }
+    }
+
+    if(!commitAcceptanceFilterUpdate(buses, busCount) || !status) {
+        debug("The IDs heard on CAN%d don't fit in its acceptance filters",
+                bus->address);
+        forget(bus, messages, messageCount, buses, busCount);
+        return;
+    }
+
+    setAcceptanceFilterStatus(bus, true, buses, busCount);
+    info("Learned the filters of CAN%d: %d IDs not heard, %d added",
+            bus->address, removed, added);
+}
+
+#else
+
+bool openxc::can::learn::start(CanBus* bus, unsigned long windowMs,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount) {
+    debug("Built without CAN_FILTER_LEARN_ID_COUNT, can't learn filters");
+    return false;
+}
+
+void openxc::can::learn::forget(CanBus* bus, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, const int busCount) { }
+
+void openxc::can::learn::record(CanBus* bus, const CanMessage* message,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount) { }
+
+void openxc::can::learn::update(CanBus* bus, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, const int busCount) { }
+
+#endif // CAN_FILTER_LEARN_ID_COUNT > 0
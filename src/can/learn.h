@@ -0,0 +1,88 @@
+#ifndef __LEARN_H__
+#define __LEARN_H__
+
+#include "can/canutil.h"
+
+// The number of IDs, across all buses, that filter learning can keep track of
+// - the ones heard while learning, and afterwards the ones it added acceptance
+// filters for that aren't in the message set. Each one costs 8 bytes of RAM.
+// Use 0 to leave filter learning out of the firmware.
+#ifndef CAN_FILTER_LEARN_ID_COUNT
+#define CAN_FILTER_LEARN_ID_COUNT 0
+#endif
+
+// How long a bus listens for, if the command doesn't say.
+#ifndef CAN_FILTER_LEARN_WINDOW_MS
+#define CAN_FILTER_LEARN_WINDOW_MS 10000
+#endif
+
+// Narrows a bus's acceptance filters to the IDs that are actually on it. The
+// default filters come from the message set, which is usually written for a
+// whole family of vehicles, and a host that passes through groups of IDs by
+// mask has to bypass the filters altogether - either way the receive interrupt
+// and queues see traffic nobody wants.
+//
+// While learning, the filters are bypassed and every ID the VI would use is
+// noted: the ones in the message set, and on a passthrough bus the ones the
+// host selected. When the window is over, the filters of message set IDs that
+// weren't heard are removed, filters are added for the selected IDs that were,
+// and the filters are enabled. Filters others added - e.g. for diagnostic
+// responses - are left as they are. If the IDs don't fit in the filters or in
+// CAN_FILTER_LEARN_ID_COUNT, the bus goes back to how it was.
+
+namespace openxc {
+namespace can {
+namespace learn {
+
+/* Public: Start learning the filters of a bus, forgetting any it learned
+ * before. The acceptance filters are bypassed until the window is over.
+ *
+ * bus - The bus to learn the filters of.
+ * windowMs - How long to listen to the bus for.
+ * messages - The active message set.
+ * messageCount - The length of the messages array.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if the bus is being surveyed or its speed searched for, or the
+ * firmware was built without CAN_FILTER_LEARN_ID_COUNT.
+ */
+bool start(CanBus* bus, unsigned long windowMs,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount);
+
+/* Public: Stop learning, or put back the filters learning changed, and return
+ * the acceptance filters to bypassed or not, as they were before.
+ *
+ * Arguments are the same as for start(), without the window.
+ */
+void forget(CanBus* bus, CanMessageDefinition* messages, int messageCount,
+        CanBus* buses, const int busCount);
+
+/* Public: Note a message received on a bus that's learning. Call this from the
+ * main loop for every received message.
+ *
+ * bus - The bus the message was received on.
+ * message - The message.
+ * messages - The active message set.
+ * messageCount - The length of the messages array.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ */
+void record(CanBus* bus, const CanMessage* message,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        const int busCount);
+
+/* Public: Compile what a bus heard into its acceptance filters once its window
+ * is over. Call this once per bus per pass of the main loop.
+ *
+ * Arguments are the same as for forget().
+ */
+void update(CanBus* bus, CanMessageDefinition* messages, int messageCount,
+        CanBus* buses, const int busCount);
+
+} // namespace learn
+} // namespace can
+} // namespace openxc
+
+#endif // __LEARN_H__
@@ -0,0 +1,238 @@
+#include "can/selftest.h"
+#include "can/autobaud.h"
+#include "can/canread.h"
+#include "can/canwrite.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include <stdio.h>
+
+namespace time = openxc::util::time;
+namespace pipeline = openxc::pipeline;
+
+using openxc::util::log::debug;
+using openxc::pipeline::Pipeline;
+using openxc::pipeline::MessageClass;
+using openxc::interface::InterfaceType;
+using openxc::can::read::publishStringEventedMessage;
+
+#if CAN_SELF_TEST
+
+// The bus being tested, or NULL
+static CanBus* testBus = NULL;
+// True once the test is over, until the bus is put back
+static bool stopping;
+static bool savedLoopback;
+static bool savedBypassFilters;
+static bool savedPassthrough;
+
+static uint8_t step;
+static unsigned int rate;
+static unsigned int kneeRate;
+static unsigned long stepStartedMs;
+static unsigned int sent;
+static unsigned int received;
+static unsigned int droppedAtStart;
+static unsigned int outputDroppedAtStart;
+
+/* Private: Returns the frames the bus has dropped on the way in - the receive
+ * queue overflowing, or a passthrough the pipeline had no room for.
+ */
+static unsigned int receiveDrops(const CanBus* bus) {
+    return bus->messagesDropped + bus->passthroughDropped;
+}
+
+/* Private: Returns the CAN messages dropped by every output's send queue.
+ */
+static unsigned int outputDrops() {
+    unsigned int dropped = 0;
+    for(int endpoint = InterfaceType::USB; endpoint <= InterfaceType::FS;
+            endpoint++) {
+        dropped += pipeline::droppedMessageCount((InterfaceType) endpoint,
+                MessageClass::CAN);
+    }
+    return dropped;
+}
+
+static void beginStep(CanBus* bus) {
+    stepStartedMs = time::systemTimeMs();
+    sent = 0;
+    received = 0;
+    droppedAtStart = receiveDrops(bus);
+    outputDroppedAtStart = outputDrops();
+}
+
+/* Private: Queue the frames the step should have sent by now, as far as the
+ * send queue has room for them.
+ */
+static void sendDue(CanBus* bus, unsigned long elapsedMs) {
+    unsigned long due = (unsigned long) rate * elapsedMs / 1000 + 1;
+    CanMessage frame = {
+        id: CAN_SELF_TEST_MESSAGE_ID,
+        format: CanMessageFormat::STANDARD,
+        data: {step},
+        length: 8
+    };
+    while(sent < due && QUEUE_LENGTH(CanMessage, &bus->sendQueue) <
+            QUEUE_MAX_LENGTH(CanMessage)) {
+        frame.data[4] = sent >> 24;
+        frame.data[5] = sent >> 16;
+        frame.data[6] = sent >> 8;
+        frame.data[7] = sent;
+        openxc::can::write::enqueueMessage(bus, &frame);
+        ++sent;
+    }
+}
+
+/* Private: Publish the results of a step, and move to the next one or end
+ * the test.
+ */
+static void finishStep(CanBus* bus, Pipeline* pipeline) {
+    unsigned int dropped = receiveDrops(bus) - droppedAtStart;
+    unsigned int outputDropped = outputDrops() - outputDroppedAtStart;
+    // The main loop doesn't come around exactly on the last millisecond of a
+    // step, so a few frames short of the rate still counts as keeping up
+    unsigned long planned = (unsigned long) rate * CAN_SELF_TEST_STEP_MS /
+            1000;
+    bool clean = received == sent && dropped == 0 && outputDropped == 0 &&
+            sent >= planned * 9 / 10;
+
+    char value[16];
+    snprintf(value, sizeof(value), "%d:%u", bus->address, rate);
+    char event[80];
+    snprintf(event, sizeof(event),
+            "sent=%u,received=%u,dropped=%u,output_dropped=%u", sent,
+            received, dropped, outputDropped);
+    publishStringEventedMessage(CAN_SELF_TEST_MESSAGE_NAME, value, event,
+            pipeline);
+
+    if(clean) {
+        kneeRate = rate;
+    }
+    if(!clean || rate * 2 > CAN_SELF_TEST_MAX_RATE) {
+        snprintf(value, sizeof(value), "%d:knee", bus->address);
+        snprintf(event, sizeof(event), "rate=%u", kneeRate);
+        publishStringEventedMessage(CAN_SELF_TEST_MESSAGE_NAME, value, event,
+                pipeline);
+        debug("CAN%d self test done, knee at %u frames/s", bus->address,
+                kneeRate);
+        stopping = true;
+        return;
+    }
+
+    ++step;
+    rate *= 2;
+    beginStep(bus);
+}
+
+/* Private: Take the bus out of loopback mode and put its filters and
+ * passthrough back, once no test frames are left to be written - they'd go
+ * out on the real bus.
+ */
+static void restore(CanBus* bus, bool writable, CanBus* buses,
+        const int busCount) {
+    if(!QUEUE_EMPTY(CanMessage, &bus->sendQueue) ||
+            bus->pendingWriteCount > 0) {
+        return;
+    }
+
+    bus->loopback = savedLoopback;
+    openxc::can::setOperatingMode(bus, writable);
+    if(!savedBypassFilters) {
+        openxc::can::setAcceptanceFilterStatus(bus, true, buses, busCount);
+    }
+    bus->passthroughCanMessages = savedPassthrough;
+    testBus = NULL;
+}
+
+bool openxc::can::selftest::start(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    if(testBus != NULL) {
+        debug("Already self testing CAN%d", testBus->address);
+        return false;
+    }
+    if(openxc::can::autobaud::searching(bus)) {
+        debug("Can't self test CAN%d until its speed is found", bus->address);
+        return false;
+    }
+
+    testBus = bus;
+    stopping = false;
+    savedLoopback = bus->loopback;
+    savedBypassFilters = bus->bypassFilters;
+    savedPassthrough = bus->passthroughCanMessages;
+
+    bus->loopback = true;
+    openxc::can::setOperatingMode(bus, true);
+    if(!bus->bypassFilters) {
+        setAcceptanceFilterStatus(bus, false, buses, busCount);
+    }
+    bus->passthroughCanMessages = true;
+
+    step = 0;
+    rate = CAN_SELF_TEST_START_RATE;
+    kneeRate = 0;
+    beginStep(bus);
+    debug("Self testing CAN%d", bus->address);
+    return true;
+}
+
+void openxc::can::selftest::stop(CanBus* bus) {
+    if(bus == testBus) {
+        stopping = true;
+    }
+}
+
+bool openxc::can::selftest::running(const CanBus* bus) {
+    return bus == testBus;
+}
+
+void openxc::can::selftest::record(const CanBus* bus,
+        const CanMessage* message) {
+    if(bus == testBus && !stopping &&
+            message->id == CAN_SELF_TEST_MESSAGE_ID &&
+            message->format == CanMessageFormat::STANDARD &&
+            message->data[0] == step) {
+        ++received;
+    }
+}
+
+void openxc::can::selftest::update(CanBus* bus, bool writable, CanBus* buses,
+        const int busCount, Pipeline* pipeline) {
+    if(bus != testBus) {
+        return;
+    }
+
+    if(stopping) {
+        restore(bus, writable, buses, busCount);
+        return;
+    }
+
+    unsigned long elapsedMs = time::systemTimeMs() - stepStartedMs;
+    if(elapsedMs < CAN_SELF_TEST_STEP_MS) {
+        sendDue(bus, elapsedMs);
+    } else if(elapsedMs >= CAN_SELF_TEST_STEP_MS + CAN_SELF_TEST_SETTLE_MS) {
+        finishStep(bus, pipeline);
+    }
+}
+
+#else
+
+bool openxc::can::selftest::start(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    debug("Built without CAN_SELF_TEST, can't self test CAN");
+    return false;
+}
+
+void openxc::can::selftest::stop(CanBus* bus) { }
+
+bool openxc::can::selftest::running(const CanBus* bus) {
+    return false;
+}
+
+void openxc::can::selftest::record(const CanBus* bus,
+        const CanMessage* message) { }
+
+void openxc::can::selftest::update(CanBus* bus, bool writable, CanBus* buses,
+        const int busCount, Pipeline* pipeline) { }
+
+#endif // CAN_SELF_TEST
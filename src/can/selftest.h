@@ -0,0 +1,117 @@
+#ifndef __SELFTEST_H__
+#define __SELFTEST_H__
+
+#include "can/canutil.h"
+#include "pipeline.h"
+
+// 1 to build in the CAN loopback self test, 0 to leave it out of the firmware.
+#ifndef CAN_SELF_TEST
+#define CAN_SELF_TEST 0
+#endif
+
+// The frames per second sent in the first step of a self test. Each step after
+// it doubles the rate.
+#ifndef CAN_SELF_TEST_START_RATE
+#define CAN_SELF_TEST_START_RATE 250
+#endif
+
+// The fastest rate tried, in frames per second.
+#ifndef CAN_SELF_TEST_MAX_RATE
+#define CAN_SELF_TEST_MAX_RATE 16000
+#endif
+
+// How long frames are sent for at each rate.
+#ifndef CAN_SELF_TEST_STEP_MS
+#define CAN_SELF_TEST_STEP_MS 1000
+#endif
+
+// How long after the last frame of a step the ones still on their way through
+// the controller and the receive queue are waited for before it's counted.
+#ifndef CAN_SELF_TEST_SETTLE_MS
+#define CAN_SELF_TEST_SETTLE_MS 200
+#endif
+
+// The ID of the synthetic frames, which are standard frames with 8 bytes of
+// data - the most expensive kind to receive and pass through.
+#ifndef CAN_SELF_TEST_MESSAGE_ID
+#define CAN_SELF_TEST_MESSAGE_ID 0x7fe
+#endif
+
+// The name of the simple messages a self test's results are published in.
+#define CAN_SELF_TEST_MESSAGE_NAME "can_self_test"
+
+// Measures how many frames a second the VI can take through its whole receive
+// path - the receive interrupt and queue, decoding, passthrough to the
+// pipeline and the output interfaces - on the hardware it's running on.
+//
+// The controller is put in loopback mode and sent synthetic frames at
+// CAN_SELF_TEST_START_RATE, doubling each CAN_SELF_TEST_STEP_MS, with the
+// acceptance filters bypassed and raw passthrough on so every frame is
+// published like a received one. After each step the VI sends what became of
+// its frames, e.g.
+//
+//      {"name": "can_self_test", "value": "1:2000",
+//          "event": "sent=2000,received=2000,dropped=0,output_dropped=0"}
+//
+// The test stops after the first step where frames are lost on the way, the
+// send queue can't keep up with the rate or outputs drop passed through
+// frames, and then sends the knee - the rate of the last step that didn't:
+//
+//      {"name": "can_self_test", "value": "1:knee", "event": "rate=4000"}
+//
+// The controller and the bus's filters and passthrough then go back to how
+// they were. Some controllers (e.g. the LPC17xx's self test mode) still drive
+// the frames onto the bus in loopback mode, so run it on a bench.
+
+namespace openxc {
+namespace can {
+namespace selftest {
+
+/* Public: Start a self test of a bus. Only one bus is tested at a time.
+ *
+ * bus - The bus to test.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if the firmware was built without CAN_SELF_TEST, a test is
+ * already running or the bus's speed is still being searched for.
+ */
+bool start(CanBus* bus, CanBus* buses, const int busCount);
+
+/* Public: Stop a self test early, without a result. The bus goes back to how
+ * it was on the next update().
+ */
+void stop(CanBus* bus);
+
+/* Public: Returns true while a bus is being tested, including until update()
+ * has put it back after the test.
+ */
+bool running(const CanBus* bus);
+
+/* Public: Count a frame received on a bus. Call this from the main loop for
+ * every received message - any that aren't the test's are ignored.
+ *
+ * bus - The bus the message was received on.
+ * message - The message.
+ */
+void record(const CanBus* bus, const CanMessage* message);
+
+/* Public: Send the frames that are due, move to the next step and publish the
+ * results. Call this for each bus once per pass of the main loop. Does nothing
+ * if the bus isn't being tested.
+ *
+ * bus - The bus.
+ * writable - True if the controller should send ACKs (and writes) when it
+ *      leaves loopback mode, as it would have been initialized.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ * pipeline - The pipeline to publish the results to.
+ */
+void update(CanBus* bus, bool writable, CanBus* buses, const int busCount,
+        openxc::pipeline::Pipeline* pipeline);
+
+} // namespace selftest
+} // namespace can
+} // namespace openxc
+
+#endif // __SELFTEST_H__
@@ -0,0 +1,258 @@
+#include "can/survey.h"
+#include "can/canread.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace time = openxc::util::time;
+namespace pipeline = openxc::pipeline;
+
+using openxc::util::log::debug;
+using openxc::pipeline::Pipeline;
+using openxc::pipeline::MessageClass;
+using openxc::can::read::publishStringEventedMessage;
+using openxc::can::survey::SurveyStatistics;
+
+#if CAN_SURVEY_ID_COUNT > 0
+
+// An open addressed hash table of the surveyed IDs, keyed by bus and ID
+static SurveyStatistics STATISTICS[CAN_SURVEY_ID_COUNT];
+static unsigned int untracked = 0;
+static unsigned long nextRoundMs = 0;
+// The next entry to publish in the round in progress, or CAN_SURVEY_ID_COUNT
+// if there isn't one
+static int publishIndex = CAN_SURVEY_ID_COUNT;
+
+static int slotFor(uint8_t busAddress, uint32_t id) {
+    return ((id * 2654435761u) ^ busAddress) & (CAN_SURVEY_ID_COUNT - 1);
+}
+
+/* Private: Find the entry for an ID, or the free slot it would go in if
+ * create is true. Returns NULL if it's not there and there's no room.
+ */
+static SurveyStatistics* findEntry(uint8_t busAddress, uint32_t id,
+        CanMessageFormat format, bool create) {
+    int slot = slotFor(busAddress, id);
+    for(int i = 0; i < CAN_SURVEY_ID_COUNT; i++) {
+        SurveyStatistics* entry = &STATISTICS[slot];
+        if(entry->busAddress == 0) {
+            return create ? entry : NULL;
+        }
+        if(entry->busAddress == busAddress && entry->id == id &&
+                entry->format == format) {
+            return entry;
+        }
+        slot = (slot + 1) & (CAN_SURVEY_ID_COUNT - 1);
+    }
+    return NULL;
+}
+
+/* Private: Empty a slot, moving later entries of its probe sequence back so
+ * none is left behind a gap.
+ */
+static void removeEntry(int slot) {
+    int next = slot;
+    for(int i = 1; i < CAN_SURVEY_ID_COUNT; i++) {
+        next = (next + 1) & (CAN_SURVEY_ID_COUNT - 1);
+        const SurveyStatistics* entry = &STATISTICS[next];
+        if(entry->busAddress == 0) {
+            break;
+        }
+
+        // an entry whose home slot is cyclically between the gap and itself
+        // is still reachable, so it stays where it is
+        int home = slotFor(entry->busAddress, entry->id);
+        bool reachable = slot <= next ? (slot < home && home <= next) :
+                (slot < home || home <= next);
+        if(!reachable) {
+            STATISTICS[slot] = *entry;
+            slot = next;
+        }
+    }
+    memset(&STATISTICS[slot], 0, sizeof(STATISTICS[slot]));
+}
+
+/* Private: Drop the statistics of every ID on a bus. */
+static void clearBus(uint8_t busAddress) {
+    bool removed;
+    do {
+        removed = false;
+        for(int i = 0; i < CAN_SURVEY_ID_COUNT; i++) {
+            if(STATISTICS[i].busAddress == busAddress) {
+                removeEntry(i);
+                removed = true;
+            }
+        }
+    } while(removed);
+    publishIndex = CAN_SURVEY_ID_COUNT;
+}
+
+bool openxc::can::survey::start(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    clearBus(bus->address);
+    untracked = 0;
+    if(!bus->surveying) {
+        bus->surveyBypassFilters = bus->bypassFilters;
+        bus->surveying = true;
+        if(!bus->bypassFilters) {
+            setAcceptanceFilterStatus(bus, false, buses, busCount);
+        }
+    }
+    nextRoundMs = time::systemTimeMs() + CAN_SURVEY_INTERVAL_MS;
+    debug("Surveying CAN%d", bus->address);
+    return true;
+}
+
+void openxc::can::survey::stop(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    if(!bus->surveying) {
+        return;
+    }
+
+    bus->surveying = false;
+    if(!bus->surveyBypassFilters) {
+        setAcceptanceFilterStatus(bus, true, buses, busCount);
+    }
+    clearBus(bus->address);
+    untracked = 0;
+}
+
+void openxc::can::survey::record(const CanBus* bus,
+        const CanMessage* message) {
+    SurveyStatistics* entry = findEntry(bus->address, message->id,
+            message->format, true);
+    if(entry == NULL) {
+        ++untracked;
+        return;
+    }
+
+    unsigned long receivedUs = message->receivedUs != 0 ?
+            message->receivedUs : time::systemTimeUs();
+    uint8_t length = message->length > CAN_MAX_MESSAGE_SIZE ?
+            CAN_MAX_MESSAGE_SIZE : message->length;
+    if(entry->busAddress == 0) {
+        entry->busAddress = bus->address;
+        entry->id = message->id;
+        entry->format = message->format;
+        entry->minLength = length;
+        entry->maxLength = length;
+    } else {
+        // Welford's method, so the mean and variance of the period don't need
+        // every sample
+        float period = receivedUs - entry->lastReceivedUs;
+        float delta = period - entry->meanPeriodUs;
+        entry->meanPeriodUs += delta / entry->count;
+        entry->periodM2 += delta * (period - entry->meanPeriodUs);
+
+        for(int i = 0; i < length; i++) {
+            if(message->data[i] != entry->lastData[i]) {
+                entry->changedBytes |= (uint64_t) 1 << i;
+            }
+        }
+        if(length < entry->minLength) {
+            entry->minLength = length;
+        } else if(length > entry->maxLength) {
+            entry->maxLength = length;
+        }
+    }
+
+    ++entry->count;
+    entry->lastReceivedUs = receivedUs;
+    memcpy(entry->lastData, message->data, length);
+}
+
+const SurveyStatistics* openxc::can::survey::lookup(const CanBus* bus,
+        uint32_t id, CanMessageFormat format) {
+    return findEntry(bus->address, id, format, false);
+}
+
+unsigned int openxc::can::survey::untrackedCount() {
+    return untracked;
+}
+
+static void publishEntry(const SurveyStatistics* entry, Pipeline* pipeline) {
+    char value[16];
+    snprintf(value, sizeof(value), "%d:0x%lx", entry->busAddress,
+            (unsigned long) entry->id);
+
+    unsigned long jitterUs = entry->count > 2 ?
+            sqrtf(entry->periodM2 / (entry->count - 1)) : 0;
+    char changed[20];
+    if((entry->changedBytes >> 32) != 0) {
+        snprintf(changed, sizeof(changed), "0x%lx%08lx",
+                (unsigned long) (entry->changedBytes >> 32),
+                (unsigned long) (entry->changedBytes & 0xffffffff));
+    } else {
+        snprintf(changed, sizeof(changed), "0x%lx",
+                (unsigned long) entry->changedBytes);
+    }
+
+    char event[96];
+    snprintf(event, sizeof(event),
+            "count=%lu,period_us=%lu,jitter_us=%lu,length=%d-%d,changed=%s",
+            (unsigned long) entry->count,
+            (unsigned long) entry->meanPeriodUs, jitterUs, entry->minLength,
+            entry->maxLength, changed);
+    publishStringEventedMessage(CAN_SURVEY_MESSAGE_NAME, value, event,
+            pipeline);
+}
+
+void openxc::can::survey::process(Pipeline* pipeline) {
+    if(publishIndex == CAN_SURVEY_ID_COUNT) {
+        if(time::systemTimeMs() < nextRoundMs) {
+            return;
+        }
+        nextRoundMs = time::systemTimeMs() + CAN_SURVEY_INTERVAL_MS;
+        publishIndex = 0;
+    }
+
+    for(int sent = 0; sent < CAN_SURVEY_PUBLISH_BATCH_SIZE &&
+            publishIndex < CAN_SURVEY_ID_COUNT; ++publishIndex) {
+        const SurveyStatistics* entry = &STATISTICS[publishIndex];
+        if(entry->busAddress == 0) {
+            continue;
+        }
+
+        if(pipeline::backedUp(pipeline, MessageClass::SIMPLE)) {
+            return;
+        }
+        publishEntry(entry, pipeline);
+        ++sent;
+    }
+
+    if(publishIndex == CAN_SURVEY_ID_COUNT && untracked > 0) {
+        char event[24];
+        snprintf(event, sizeof(event), "count=%u", untracked);
+        publishStringEventedMessage(CAN_SURVEY_MESSAGE_NAME, "untracked",
+                event, pipeline);
+    }
+}
+
+#else
+
+bool openxc::can::survey::start(CanBus* bus, CanBus* buses,
+        const int busCount) {
+    debug("Built without CAN_SURVEY_ID_COUNT, can't survey CAN");
+    return false;
+}
+
+void openxc::can::survey::stop(CanBus* bus, CanBus* buses,
+        const int busCount) { }
+
+void openxc::can::survey::record(const CanBus* bus,
+        const CanMessage* message) { }
+
+const SurveyStatistics* openxc::can::survey::lookup(const CanBus* bus,
+        uint32_t id, CanMessageFormat format) {
+    return NULL;
+}
+
+unsigned int openxc::can::survey::untrackedCount() {
+    return 0;
+}
+
+void openxc::can::survey::process(Pipeline* pipeline) { }
+
+#endif // CAN_SURVEY_ID_COUNT > 0
@@ -0,0 +1,132 @@
+#ifndef __SURVEY_H__
+#define __SURVEY_H__
+
+#include "can/canutil.h"
+#include "pipeline.h"
+
+// The number of distinct message IDs, across all buses, that a survey keeps
+// statistics for. Must be a power of two. Each one costs about 40 bytes of
+// RAM (more with CAN FD). Use 0 to leave the bus survey out of the firmware.
+#ifndef CAN_SURVEY_ID_COUNT
+#define CAN_SURVEY_ID_COUNT 0
+#endif
+
+#if (CAN_SURVEY_ID_COUNT & (CAN_SURVEY_ID_COUNT - 1)) != 0
+#error "CAN_SURVEY_ID_COUNT must be a power of two"
+#endif
+
+// How often the statistics of every surveyed ID are published.
+#ifndef CAN_SURVEY_INTERVAL_MS
+#define CAN_SURVEY_INTERVAL_MS 5000
+#endif
+
+// The most summaries published per pass of the main loop, so a large survey
+// doesn't hold up CAN receive.
+#ifndef CAN_SURVEY_PUBLISH_BATCH_SIZE
+#define CAN_SURVEY_PUBLISH_BATCH_SIZE 8
+#endif
+
+// The name of the simple messages a survey is published in, with the bus and
+// ID as the value and the statistics as the event.
+#define CAN_SURVEY_MESSAGE_NAME "can_survey"
+
+// Maps a bus while reverse engineering a vehicle, without the bandwidth of
+// passing every frame through. Instead of the frames, a surveyed bus sends a
+// summary of each ID it receives every CAN_SURVEY_INTERVAL_MS - how many
+// frames, how often and how regularly they arrive, their lengths and which of
+// their bytes change - e.g.
+//
+//      {"name": "can_survey", "value": "1:0x3b5",
+//          "event": "count=120,period_us=100213,jitter_us=1302,length=8-8,
+//          changed=0x0f"}
+//
+// The acceptance filters are bypassed while surveying, so every message on the
+// bus is counted, and the bus's raw passthrough is held off.
+
+namespace openxc {
+namespace can {
+namespace survey {
+
+/* Public: The statistics a survey keeps for one message ID.
+ *
+ * id - The message ID.
+ * busAddress - The address of the bus it's received on, or 0 for an unused
+ *      entry.
+ * format - The format of the ID.
+ * minLength - The shortest data length received.
+ * maxLength - The longest data length received.
+ * count - The number of frames received.
+ * lastReceivedUs - When the last one was received.
+ * meanPeriodUs - The mean time between frames.
+ * periodM2 - The sum of the squared differences of each period from the mean,
+ *      which the jitter (the standard deviation of the period) comes from.
+ * changedBytes - A mask of the bytes that have changed, bit n for byte n.
+ * lastData - The data of the last frame, to compare the next one to.
+ */
+typedef struct {
+    uint32_t id;
+    uint8_t busAddress;
+    uint8_t format;
+    uint8_t minLength;
+    uint8_t maxLength;
+    uint32_t count;
+    unsigned long lastReceivedUs;
+    float meanPeriodUs;
+    float periodM2;
+    uint64_t changedBytes;
+    uint8_t lastData[CAN_MAX_MESSAGE_SIZE];
+} SurveyStatistics;
+
+/* Public: Start surveying a bus, from no statistics. This bypasses the bus's
+ * acceptance filters until the survey is stopped.
+ *
+ * bus - The bus to survey.
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if the firmware was built without CAN_SURVEY_ID_COUNT.
+ */
+bool start(CanBus* bus, CanBus* buses, const int busCount);
+
+/* Public: Stop surveying a bus, drop its statistics and put its acceptance
+ * filters back how they were.
+ *
+ * Arguments are the same as for start().
+ */
+void stop(CanBus* bus, CanBus* buses, const int busCount);
+
+/* Public: Count a message received on a bus being surveyed. Call this from the
+ * main loop for every received message, instead of passing it through.
+ *
+ * bus - The bus the message was received on.
+ * message - The message.
+ */
+void record(const CanBus* bus, const CanMessage* message);
+
+/* Public: Return the statistics for a message ID on a bus, or NULL if none
+ * have been received or there was no room to keep them.
+ */
+const SurveyStatistics* lookup(const CanBus* bus, uint32_t id,
+        CanMessageFormat format);
+
+/* Public: Return the number of frames received on surveyed buses whose IDs
+ * didn't fit in the CAN_SURVEY_ID_COUNT statistics. If it's not 0, it's
+ * published at the end of each round as
+ *
+ *      {"name": "can_survey", "value": "untracked", "event": "count=42"}
+ */
+unsigned int untrackedCount();
+
+/* Public: Publish the next summaries every CAN_SURVEY_INTERVAL_MS. A round
+ * stops early if the pipeline is backed up, and picks up where it left off on
+ * the next call. Call this once per pass of the main loop.
+ *
+ * pipeline - The pipeline to publish the summaries to.
+ */
+void process(openxc::pipeline::Pipeline* pipeline);
+
+} // namespace survey
+} // namespace can
+} // namespace openxc
+
+#endif // __SURVEY_H__
@@ -0,0 +1,291 @@
+#include "capture.h"
+#include "signals.h"
+#include "virtual_signals.h"
+#include "can/canread.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include "diagnostics.h"
+#include <string.h>
+
+namespace time = openxc::util::time;
+namespace pipeline = openxc::pipeline;
+namespace virtuals = openxc::signals::virtuals;
+
+using openxc::util::log::debug;
+using openxc::pipeline::Pipeline;
+using openxc::pipeline::MessageClass;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::signals::virtuals::VirtualSignal;
+using openxc::can::lookupSignal;
+using openxc::can::read::publishStringEventedMessage;
+using openxc::capture::TriggerCondition;
+
+#if CAN_CAPTURE_FRAME_COUNT > 0
+
+typedef struct {
+    uint8_t busAddress;
+    CanMessage message;
+} CapturedFrame;
+
+/* Private: A signal trigger. The virtual signal comes first so the trigger
+ * can be found from the pointer its computation is called with.
+ */
+typedef struct {
+    VirtualSignal watch;
+    TriggerCondition condition;
+    float threshold;
+    char signalName[MAX_GENERIC_NAME_LENGTH];
+} CaptureTrigger;
+
+static CapturedFrame RING[CAN_CAPTURE_FRAME_COUNT];
+// The oldest frame is at ringStart
+static int ringStart = 0;
+static int ringCount = 0;
+
+static CaptureTrigger TRIGGERS[MAX_CAPTURE_TRIGGERS];
+static int triggerCount = 0;
+
+static bool dumpInProgress = false;
+static bool dumpStartPending = false;
+// The next frame to dump, counted from the oldest frame in the ring
+static int dumpOffset = 0;
+static unsigned long dumpEndUs = 0;
+static unsigned int dumpLostFrames = 0;
+static const char* dumpReason = NULL;
+
+/* Private: Compare two system times in microseconds across a rollover.
+ *
+ * Returns true if a is after b.
+ */
+static bool after(unsigned long a, unsigned long b) {
+    return (long) (a - b) > 0;
+}
+
+void openxc::capture::record(const CanBus* bus, const CanMessage* message) {
+    if(ringCount == CAN_CAPTURE_FRAME_COUNT) {
+        ringStart = (ringStart + 1) % CAN_CAPTURE_FRAME_COUNT;
+        if(dumpInProgress) {
+            if(dumpOffset > 0) {
+                --dumpOffset;
+            } else {
+                ++dumpLostFrames;
+            }
+        }
+    } else {
+        ++ringCount;
+    }
+
+    CapturedFrame* frame = &RING[(ringStart + ringCount - 1) %
+            CAN_CAPTURE_FRAME_COUNT];
+    frame->busAddress = bus->address;
+    frame->message = *message;
+    if(frame->message.receivedUs == 0) {
+        frame->message.receivedUs = time::systemTimeUs();
+    }
+}
+
+bool openxc::capture::trigger(const char* reason) {
+    unsigned long now = time::systemTimeUs();
+    if(!dumpInProgress) {
+        dumpOffset = 0;
+        while(dumpOffset < ringCount && after(now,
+                    RING[(ringStart + dumpOffset) %
+                        CAN_CAPTURE_FRAME_COUNT].message.receivedUs +
+                    DEFAULT_CAN_CAPTURE_PRE_TRIGGER_MS * 1000UL)) {
+            ++dumpOffset;
+        }
+        dumpInProgress = true;
+        dumpStartPending = true;
+        dumpLostFrames = 0;
+        dumpReason = reason;
+        debug("CAN capture triggered by %s", reason);
+    }
+    dumpEndUs = now + DEFAULT_CAN_CAPTURE_POST_TRIGGER_MS * 1000UL;
+    return true;
+}
+
+bool openxc::capture::dumping() {
+    return dumpInProgress;
+}
+
+static void publishFrame(const CapturedFrame* frame, Pipeline* pipeline) {
+    const CanMessage* message = &frame->message;
+    openxc_VehicleMessage vehicleMessage = {0};
+    vehicleMessage.has_type = true;
+    vehicleMessage.type = openxc_VehicleMessage_Type_CAN;
+    vehicleMessage.has_can_message = true;
+    vehicleMessage.can_message = {0};
+    vehicleMessage.can_message.has_id = true;
+    vehicleMessage.can_message.id = message->id;
+    vehicleMessage.can_message.has_bus = true;
+    vehicleMessage.can_message.bus = frame->busAddress;
+    vehicleMessage.can_message.has_data = true;
+    vehicleMessage.can_message.data.size = message->length == 0 ?
+            CAN_MESSAGE_SIZE : message->length;
+    if(vehicleMessage.can_message.data.size > CAN_MAX_MESSAGE_SIZE) {
+        vehicleMessage.can_message.data.size = CAN_MAX_MESSAGE_SIZE;
+    }
+    memcpy(vehicleMessage.can_message.data.bytes, message->data,
+            vehicleMessage.can_message.data.size);
+
+    pipeline::setReceiveTime(message->receivedUs);
+    pipeline::publish(&vehicleMessage, pipeline);
+    pipeline::setReceiveTime(0);
+}
+
+/* Private: End the dump, and drop the frames that were dumped from the ring so
+ * they aren't dumped again by the next trigger.
+ */
+static void finishDump(Pipeline* pipeline) {
+    if(dumpLostFrames > 0) {
+        debug("CAN capture lost %d frames that were overwritten before they "
+                "could be sent", dumpLostFrames);
+    }
+    publishStringEventedMessage(CAN_CAPTURE_MESSAGE_NAME, dumpReason, "end",
+            pipeline);
+    ringStart = (ringStart + dumpOffset) % CAN_CAPTURE_FRAME_COUNT;
+    ringCount -= dumpOffset;
+    dumpOffset = 0;
+    dumpInProgress = false;
+}
+
+void openxc::capture::process(Pipeline* pipeline) {
+    if(!dumpInProgress) {
+        return;
+    }
+
+    if(dumpStartPending) {
+        publishStringEventedMessage(CAN_CAPTURE_MESSAGE_NAME, dumpReason,
+                "start", pipeline);
+        dumpStartPending = false;
+    }
+
+    for(int sent = 0; sent < CAN_CAPTURE_DUMP_BATCH_SIZE &&
+            dumpOffset < ringCount; ++sent) {
+        const CapturedFrame* frame = &RING[(ringStart + dumpOffset) %
+                CAN_CAPTURE_FRAME_COUNT];
+        if(after(frame->message.receivedUs, dumpEndUs)) {
+            finishDump(pipeline);
+            return;
+        }
+
+        if(pipeline::backedUp(pipeline, MessageClass::CAN)) {
+            return;
+        }
+        publishFrame(frame, pipeline);
+        ++dumpOffset;
+    }
+
+    if(dumpOffset == ringCount && after(time::systemTimeUs(), dumpEndUs)) {
+        finishDump(pipeline);
+    }
+}
+
+/* Private: The computation of a signal trigger's virtual signal, which never
+ * publishes anything itself.
+ */
+static float checkTrigger(VirtualSignal* signal, int input, float previous,
+        bool* send) {
+    CaptureTrigger* trigger = (CaptureTrigger*) signal;
+    float value = signal->inputs[0]->lastValue;
+    // The first time a signal is received, previous is the same as its value
+    bool first = previous == value;
+    *send = false;
+
+    bool fire = false;
+    switch(trigger->condition) {
+    case openxc::capture::CHANGED:
+        fire = !first;
+        break;
+    case openxc::capture::ABOVE:
+        fire = value > trigger->threshold &&
+                (first || previous <= trigger->threshold);
+        break;
+    case openxc::capture::BELOW:
+        fire = value < trigger->threshold &&
+                (first || previous >= trigger->threshold);
+        break;
+    case openxc::capture::EQUAL:
+        fire = value == trigger->threshold &&
+                (first || previous != trigger->threshold);
+        break;
+    }
+
+    if(fire) {
+        openxc::capture::trigger(trigger->signalName);
+    }
+    return value;
+}
+
+bool openxc::capture::addTrigger(const char* signalName,
+        TriggerCondition condition, float threshold) {
+    if(triggerCount >= MAX_CAPTURE_TRIGGERS) {
+        debug("Can't add more than %d capture triggers",
+                MAX_CAPTURE_TRIGGERS);
+        return false;
+    }
+
+    if(signalName == NULL || strlen(signalName) >= MAX_GENERIC_NAME_LENGTH ||
+            lookupSignal(signalName, getSignals(), getSignalCount()) == NULL) {
+        debug("Can't trigger a capture on unknown signal %s", signalName);
+        return false;
+    }
+
+    CaptureTrigger* trigger = &TRIGGERS[triggerCount];
+    memset(trigger, 0, sizeof(CaptureTrigger));
+    strcpy(trigger->signalName, signalName);
+    trigger->condition = condition;
+    trigger->threshold = threshold;
+    trigger->watch.output.genericName = trigger->signalName;
+    trigger->watch.inputNames[0] = trigger->signalName;
+    trigger->watch.inputCount = 1;
+    trigger->watch.compute = checkTrigger;
+    if(!virtuals::addVirtualSignal(&trigger->watch)) {
+        return false;
+    }
+    ++triggerCount;
+    return true;
+}
+
+void openxc::capture::clearTriggers() {
+    for(int i = 0; i < triggerCount; i++) {
+        virtuals::removeVirtualSignal(&TRIGGERS[i].watch);
+    }
+    triggerCount = 0;
+}
+
+void openxc::capture::reset() {
+    ringStart = 0;
+    ringCount = 0;
+    dumpOffset = 0;
+    dumpInProgress = false;
+    dumpStartPending = false;
+}
+
+#else
+
+void openxc::capture::record(const CanBus* bus, const CanMessage* message) { }
+
+bool openxc::capture::trigger(const char* reason) {
+    debug("Built without CAN_CAPTURE_FRAME_COUNT, can't capture CAN");
+    return false;
+}
+
+bool openxc::capture::dumping() {
+    return false;
+}
+
+void openxc::capture::process(Pipeline* pipeline) { }
+
+bool openxc::capture::addTrigger(const char* signalName,
+        TriggerCondition condition, float threshold) {
+    debug("Built without CAN_CAPTURE_FRAME_COUNT, can't capture CAN");
+    return false;
+}
+
+void openxc::capture::clearTriggers() { }
+
+void openxc::capture::reset() { }
+
+#endif // CAN_CAPTURE_FRAME_COUNT > 0
@@ -0,0 +1,117 @@
+/* A RAM ring of the most recent raw CAN frames, dumped with a window before
+ * and after a trigger - e.g. a signal crossing a threshold - to capture what
+ * the bus was doing around an intermittent event.
+ */
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include "can/canutil.h"
+#include "pipeline.h"
+
+// The number of raw CAN frames kept in the capture ring. Use 0 to leave
+// capture out of the firmware.
+#ifndef CAN_CAPTURE_FRAME_COUNT
+#define CAN_CAPTURE_FRAME_COUNT 0
+#endif
+
+// How far back from a trigger the dump starts, as far as the ring reaches.
+#ifndef DEFAULT_CAN_CAPTURE_PRE_TRIGGER_MS
+#define DEFAULT_CAN_CAPTURE_PRE_TRIGGER_MS 5000
+#endif
+
+// How long after a trigger frames keep being dumped.
+#ifndef DEFAULT_CAN_CAPTURE_POST_TRIGGER_MS
+#define DEFAULT_CAN_CAPTURE_POST_TRIGGER_MS 2000
+#endif
+
+// The most frames dumped per pass of the main loop, so a dump doesn't hold up
+// CAN receive.
+#ifndef CAN_CAPTURE_DUMP_BATCH_SIZE
+#define CAN_CAPTURE_DUMP_BATCH_SIZE 16
+#endif
+
+#ifndef MAX_CAPTURE_TRIGGERS
+#define MAX_CAPTURE_TRIGGERS 4
+#endif
+
+// The name of the simple messages that mark the start and end of a dump, with
+// the reason for the trigger as the value and "start" or "end" as the event.
+#define CAN_CAPTURE_MESSAGE_NAME "can_capture"
+
+namespace openxc {
+namespace capture {
+
+/* Public: When a signal trigger fires.
+ *
+ * CHANGED - whenever the signal's value changes.
+ * ABOVE - when the signal goes above the threshold.
+ * BELOW - when the signal goes below the threshold.
+ * EQUAL - when the signal becomes equal to the threshold, e.g. a state.
+ */
+typedef enum {
+    CHANGED,
+    ABOVE,
+    BELOW,
+    EQUAL,
+} TriggerCondition;
+
+/* Public: Keep a received CAN frame in the capture ring, overwriting the
+ * oldest one if it's full. This is called for every frame the VI receives,
+ * before it's decoded, so a frame that sets off a trigger is part of the dump.
+ *
+ * bus - The bus the frame was received on.
+ * message - The frame.
+ */
+void record(const CanBus* bus, const CanMessage* message);
+
+/* Public: Start dumping the capture ring, from
+ * DEFAULT_CAN_CAPTURE_PRE_TRIGGER_MS before now until
+ * DEFAULT_CAN_CAPTURE_POST_TRIGGER_MS after. Triggering again during a dump
+ * extends it instead of starting over. Custom code can call this for events
+ * the signal triggers don't cover, e.g. a new DTC in a diagnostic response.
+ *
+ * reason - A short description of the trigger, published with the dump. It
+ *      must stay valid until the dump ends, e.g. be a string literal.
+ *
+ * Returns true if a dump was started or extended.
+ */
+bool trigger(const char* reason);
+
+/* Public: Return true while a dump is in progress. */
+bool dumping();
+
+/* Public: Publish the next frames of a dump in progress, as CAN messages
+ * stamped with when they were received. This stops early if the pipeline is
+ * backed up, and picks up where it left off on the next call - frames that
+ * are overwritten in the ring in the meantime are lost from the dump. Call
+ * this once per pass of the main loop.
+ *
+ * pipeline - The pipeline to publish the dump to.
+ */
+void process(openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Trigger a dump when a signal meets a condition. Each trigger is a
+ * virtual signal (see signals::virtuals) watching the signal, so it's checked
+ * only when the signal's value changes, and takes one of the
+ * MAX_VIRTUAL_SIGNALS.
+ *
+ * signalName - The generic name of the signal in the active message set.
+ * condition - When to trigger.
+ * threshold - The value compared against, unless the condition is CHANGED.
+ *
+ * Returns true if the trigger was added, false if the signal is unknown or
+ * MAX_CAPTURE_TRIGGERS are already set.
+ */
+bool addTrigger(const char* signalName, TriggerCondition condition,
+        float threshold);
+
+/* Public: Remove all signal triggers. A dump in progress continues. */
+void clearTriggers();
+
+/* Public: Empty the capture ring, ending any dump in progress. */
+void reset();
+
+} // namespace capture
+} // namespace openxc
+
+#endif // __CAPTURE_H__
@@ -0,0 +1,55 @@
+#include "af_learn_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <can/learn.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::can::lookupBus;
+
+namespace learn = openxc::can::learn;
+
+bool openxc::commands::isFilterLearnCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, AF_LEARN_COMMAND_NAME);
+}
+
+bool openxc::commands::handleFilterLearnCommand(
+        openxc_SimpleMessage* message) {
+    unsigned long windowMs;
+    if(!message->has_value || !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("AF learn request must have a window and a bus");
+        return false;
+    } else if(message->value.type == openxc_DynamicField_Type_BOOL) {
+        windowMs = message->value.boolean_value ?
+                CAN_FILTER_LEARN_WINDOW_MS : 0;
+    } else if(message->value.type == openxc_DynamicField_Type_NUM &&
+            message->value.numeric_value >= 0) {
+        windowMs = message->value.numeric_value * 1000;
+    } else {
+        debug("AF learn window must be true, false or a number of seconds");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for AF learn: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    if(windowMs == 0) {
+        learn::forget(bus, getMessages(), getMessageCount(), getCanBuses(),
+                getCanBusCount());
+        return true;
+    }
+    return learn::start(bus, windowMs, getMessages(), getMessageCount(),
+            getCanBuses(), getCanBusCount());
+}
@@ -0,0 +1,29 @@
+#ifndef __AF_LEARN_COMMAND_H__
+#define __AF_LEARN_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that has a bus learn its acceptance
+ * filters, or forget them, e.g.
+ *
+ *      {"name": "af_learn", "value": 30, "event": 1}
+ *
+ * value - how many seconds to listen to the bus for, or true for
+ *      CAN_FILTER_LEARN_WINDOW_MS. false or 0 forgets what was learned.
+ * event - the address of the bus.
+ *
+ * See openxc::can::learn.
+ */
+#define AF_LEARN_COMMAND_NAME "af_learn"
+
+bool isFilterLearnCommand(openxc_SimpleMessage* message);
+
+bool handleFilterLearnCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __AF_LEARN_COMMAND_H__
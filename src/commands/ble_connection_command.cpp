@@ -0,0 +1,50 @@
+#include "ble_connection_command.h"
+
+#include "config.h"
+#include "util/log.h"
+#include "interface/ble.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::interface::ble::BleConnectionMode;
+
+namespace ble = openxc::interface::ble;
+
+// Indexed by BleConnectionMode
+static const char* const CONNECTION_MODE_NAMES[] = {
+    "auto",
+    "power",
+    "throughput",
+};
+
+bool openxc::commands::isBleConnectionCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, BLE_CONNECTION_COMMAND_NAME);
+}
+
+bool openxc::commands::handleBleConnectionCommand(
+        openxc_SimpleMessage* message) {
+    if(getConfiguration()->ble == NULL) {
+        debug("No BLE device to configure");
+        return false;
+    }
+
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("BLE connection mode must be a string");
+        return false;
+    }
+
+    for(size_t i = 0; i < sizeof(CONNECTION_MODE_NAMES) /
+            sizeof(CONNECTION_MODE_NAMES[0]); i++) {
+        if(!strcmp(message->value.string_value, CONNECTION_MODE_NAMES[i])) {
+            ble::setConnectionMode(getConfiguration()->ble,
+                    (BleConnectionMode)i);
+            return true;
+        }
+    }
+
+    debug("Unknown BLE connection mode %s", message->value.string_value);
+    return false;
+}
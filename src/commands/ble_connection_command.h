@@ -0,0 +1,27 @@
+#ifndef __BLE_CONNECTION_COMMAND_H__
+#define __BLE_CONNECTION_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that chooses how the BLE connection
+ * parameters are negotiated, e.g.
+ *
+ *      {"name": "ble_connection", "value": "throughput"}
+ *
+ * value - "auto" to follow the send queue (see
+ *      openxc::interface::ble::updateConnectionProfile), "power" to always use
+ *      the low power parameters or "throughput" to always use the fast ones.
+ */
+#define BLE_CONNECTION_COMMAND_NAME "ble_connection"
+
+bool isBleConnectionCommand(openxc_SimpleMessage* message);
+
+bool handleBleConnectionCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __BLE_CONNECTION_COMMAND_H__
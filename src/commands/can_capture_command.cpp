@@ -0,0 +1,60 @@
+#include "can_capture_command.h"
+
+#include "capture.h"
+#include "util/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+
+namespace capture = openxc::capture;
+
+bool openxc::commands::isCanCaptureCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, CAN_CAPTURE_COMMAND_NAME);
+}
+
+bool openxc::commands::handleCanCaptureCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("CAN capture command is missing \"now\", \"clear\" or a signal");
+        return false;
+    }
+
+    const char* value = message->value.string_value;
+    if(!strcmp(value, "now")) {
+        return capture::trigger("now");
+    } else if(!strcmp(value, "clear")) {
+        capture::clearTriggers();
+        return true;
+    }
+
+    if(!message->has_event) {
+        return capture::addTrigger(value, capture::CHANGED, 0);
+    }
+
+    const char* condition = message->event.string_value;
+    char* end = NULL;
+    float threshold = 0;
+    if(message->event.type == openxc_DynamicField_Type_STRING &&
+            condition[0] != '\0') {
+        threshold = strtof(&condition[1], &end);
+    }
+    if(end == NULL || end == &condition[1] || *end != '\0') {
+        debug("CAN capture trigger condition must be >, < or = and a value");
+        return false;
+    }
+
+    switch(condition[0]) {
+    case '>':
+        return capture::addTrigger(value, capture::ABOVE, threshold);
+    case '<':
+        return capture::addTrigger(value, capture::BELOW, threshold);
+    case '=':
+        return capture::addTrigger(value, capture::EQUAL, threshold);
+    default:
+        debug("CAN capture trigger condition must be >, < or = and a value");
+        return false;
+    }
+}
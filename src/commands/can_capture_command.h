@@ -0,0 +1,30 @@
+#ifndef __CAN_CAPTURE_COMMAND_H__
+#define __CAN_CAPTURE_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that controls the CAN capture ring
+ * (see capture::trigger):
+ *
+ *      {"name": "can_capture", "value": "brake_pedal_status", "event": "=1"}
+ *
+ * value - "now" to dump the ring right away, "clear" to remove all signal
+ *      triggers, or the name of a signal to trigger a dump on.
+ * event - for a signal trigger, the condition to trigger on: ">" or "<" and a
+ *      threshold to trigger when the signal crosses it, or "=" and a value to
+ *      trigger when the signal becomes equal to it. Without an event, any
+ *      change of the signal's value triggers a dump.
+ */
+#define CAN_CAPTURE_COMMAND_NAME "can_capture"
+
+bool isCanCaptureCommand(openxc_SimpleMessage* message);
+
+bool handleCanCaptureCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __CAN_CAPTURE_COMMAND_H__
@@ -0,0 +1,133 @@
+#include "can_gateway_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <can/gateway.h>
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupBus;
+
+namespace gateway = openxc::can::gateway;
+
+/* Private: One parsed "id/mask>bus:destinationId" entry of a gateway request.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    CanMessageFormat format;
+    CanBus* destination;
+    uint32_t destinationId;
+} GatewaySelection;
+
+static bool parseSelection(char* text, GatewaySelection* selection) {
+    char* end = NULL;
+    selection->id = strtoul(text, &end, 0);
+    if(end == text) {
+        return false;
+    }
+
+    selection->format = selection->id > 0x7ff ? CanMessageFormat::EXTENDED :
+            CanMessageFormat::STANDARD;
+    selection->mask = 0xffffffff;
+    if(*end == '/') {
+        char* maskStart = end + 1;
+        selection->mask = strtoul(maskStart, &end, 0);
+        if(end == maskStart) {
+            return false;
+        }
+    }
+
+    if(*end != '>') {
+        return false;
+    }
+    char* busStart = end + 1;
+    int address = strtol(busStart, &end, 0);
+    if(end == busStart) {
+        return false;
+    }
+    selection->destination = lookupBus(address, getCanBuses(),
+            getCanBusCount());
+    if(selection->destination == NULL) {
+        return false;
+    }
+
+    selection->destinationId = selection->id;
+    if(*end == ':') {
+        char* idStart = end + 1;
+        selection->destinationId = strtoul(idStart, &end, 0);
+        if(end == idStart) {
+            return false;
+        }
+    }
+    return *end == '\0';
+}
+
+bool openxc::commands::isCanGatewayCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, CAN_GATEWAY_COMMAND_NAME);
+}
+
+bool openxc::commands::handleCanGatewayCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("CAN gateway request must have a list of routes and a bus");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for CAN gateway: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    if(!strcmp(message->value.string_value, "none")) {
+        gateway::clearRoutes(bus, getCanBuses(), getCanBusCount());
+        return true;
+    }
+
+    // Parse every entry before changing anything, so a bad request leaves the
+    // current routes alone
+    GatewaySelection selections[CAN_GATEWAY_ROUTE_COUNT];
+    int selectionCount = 0;
+    char entries[sizeof(message->value.string_value)];
+    strncpy(entries, message->value.string_value, sizeof(entries) - 1);
+    entries[sizeof(entries) - 1] = '\0';
+    for(char* token = strtok(entries, ", "); token != NULL;
+            token = strtok(NULL, ", ")) {
+        if(selectionCount >= CAN_GATEWAY_ROUTE_COUNT) {
+            debug("Can't forward more than %d selections of IDs",
+                    CAN_GATEWAY_ROUTE_COUNT);
+            return false;
+        }
+
+        if(!parseSelection(token, &selections[selectionCount])) {
+            debug("Invalid CAN gateway route: %s", token);
+            return false;
+        }
+        ++selectionCount;
+    }
+
+    if(selectionCount == 0) {
+        debug("CAN gateway request must have a list of routes and a bus");
+        return false;
+    }
+
+    gateway::clearRoutes(bus, getCanBuses(), getCanBusCount());
+    bool status = true;
+    for(int i = 0; i < selectionCount; i++) {
+        status = gateway::addRoute(bus, selections[i].id, selections[i].mask,
+                selections[i].format, selections[i].destination,
+                selections[i].destinationId, getCanBuses(),
+                getCanBusCount()) && status;
+    }
+    return status;
+}
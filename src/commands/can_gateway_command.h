@@ -0,0 +1,33 @@
+#ifndef __CAN_GATEWAY_COMMAND_H__
+#define __CAN_GATEWAY_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that sets which messages a bus
+ * forwards to other buses, e.g.
+ *
+ *      {"name": "can_gateway", "value": "0x3b5>2,0x100/0x7f0>2:0x200",
+ *          "event": 1}
+ *
+ * value - a comma-separated list of routes, replacing any set before. Each is
+ *      an ID, with a "/mask" to match a group of IDs, then ">" and the address
+ *      of the bus to forward it to. A ":" and another ID after the bus
+ *      forwards the messages under that ID instead. An ID above 0x7ff is an
+ *      extended ID. "none" stops forwarding messages from the bus.
+ * event - the address of the bus to forward messages from.
+ *
+ * See openxc::can::gateway::addRoute.
+ */
+#define CAN_GATEWAY_COMMAND_NAME "can_gateway"
+
+bool isCanGatewayCommand(openxc_SimpleMessage* message);
+
+bool handleCanGatewayCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __CAN_GATEWAY_COMMAND_H__
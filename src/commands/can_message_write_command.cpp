@@ -1,4 +1,5 @@
 #include "commands/can_message_write_command.h"
+#include "commands/write_ack_command.h"
 
 #include "config.h"
 #include "diagnostics.h"
@@ -65,6 +66,7 @@ bool openxc::commands::handleCan(openxc_VehicleMessage* message,
             debug("Raw CAN writes not allowed for bus %d", matchingBus->address);
             status = false;
         }
+        recordWriteStatus(status);
     }
     return status;
 }
@@ -0,0 +1,43 @@
+#include "can_self_test_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <can/selftest.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupBus;
+
+namespace selftest = openxc::can::selftest;
+
+bool openxc::commands::isCanSelfTestCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, CAN_SELF_TEST_COMMAND_NAME);
+}
+
+bool openxc::commands::handleCanSelfTestCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_BOOL ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("CAN self test request must have true or false and a bus");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for CAN self test: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    if(!message->value.boolean_value) {
+        selftest::stop(bus);
+        return true;
+    }
+    return selftest::start(bus, getCanBuses(), getCanBusCount());
+}
@@ -0,0 +1,28 @@
+#ifndef __CAN_SELF_TEST_COMMAND_H__
+#define __CAN_SELF_TEST_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that starts or stops a loopback
+ * self test of a bus, e.g.
+ *
+ *      {"name": "can_self_test", "value": true, "event": 1}
+ *
+ * value - true to start testing the bus, false to stop early.
+ * event - the address of the bus.
+ *
+ * See openxc::can::selftest.
+ */
+#define CAN_SELF_TEST_COMMAND_NAME "can_self_test"
+
+bool isCanSelfTestCommand(openxc_SimpleMessage* message);
+
+bool handleCanSelfTestCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __CAN_SELF_TEST_COMMAND_H__
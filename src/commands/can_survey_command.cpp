@@ -0,0 +1,43 @@
+#include "can_survey_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <can/survey.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupBus;
+
+namespace survey = openxc::can::survey;
+
+bool openxc::commands::isCanSurveyCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, CAN_SURVEY_COMMAND_NAME);
+}
+
+bool openxc::commands::handleCanSurveyCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_BOOL ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("CAN survey request must have true or false and a bus");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for CAN survey: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    if(!message->value.boolean_value) {
+        survey::stop(bus, getCanBuses(), getCanBusCount());
+        return true;
+    }
+    return survey::start(bus, getCanBuses(), getCanBusCount());
+}
@@ -0,0 +1,28 @@
+#ifndef __CAN_SURVEY_COMMAND_H__
+#define __CAN_SURVEY_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that starts or stops surveying a
+ * bus, e.g.
+ *
+ *      {"name": "can_survey", "value": true, "event": 1}
+ *
+ * value - true to start surveying the bus from scratch, false to stop.
+ * event - the address of the bus.
+ *
+ * See openxc::can::survey.
+ */
+#define CAN_SURVEY_COMMAND_NAME "can_survey"
+
+bool isCanSurveyCommand(openxc_SimpleMessage* message);
+
+bool handleCanSurveyCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __CAN_SURVEY_COMMAND_H__
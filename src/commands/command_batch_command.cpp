@@ -0,0 +1,73 @@
+#include "command_batch_command.h"
+
+#include "config.h"
+#include "util/log.h"
+#include "pipeline.h"
+#include <payload/payload.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+namespace payload = openxc::payload;
+namespace pipeline = openxc::pipeline;
+
+static bool batchStarted = false;
+static int batchItemCount = 0;
+static int batchFailureCount = 0;
+static char batchStatuses[COMMAND_BATCH_MAX_ITEMS + 1];
+
+bool openxc::commands::isCommandBatchCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, COMMAND_BATCH_COMMAND_NAME);
+}
+
+bool openxc::commands::batchOpen() {
+    return batchStarted;
+}
+
+void openxc::commands::recordBatchStatus(bool status) {
+    if(batchItemCount < COMMAND_BATCH_MAX_ITEMS) {
+        batchStatuses[batchItemCount] = status ? '1' : '0';
+        batchStatuses[batchItemCount + 1] = '\0';
+    }
+    ++batchItemCount;
+    if(!status) {
+        ++batchFailureCount;
+    }
+}
+
+bool openxc::commands::handleCommandBatchCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Command batch request must be \"begin\" or \"end\"");
+        return false;
+    }
+
+    if(!strcmp(message->value.string_value, "begin")) {
+        batchStarted = true;
+        batchItemCount = 0;
+        batchFailureCount = 0;
+        batchStatuses[0] = '\0';
+        return true;
+    }
+
+    if(!strcmp(message->value.string_value, "end")) {
+        if(!batchStarted) {
+            debug("No command batch to end");
+            return false;
+        }
+
+        batchStarted = false;
+        openxc_DynamicField statuses = payload::wrapString(batchStatuses);
+        openxc_DynamicField failures = payload::wrapNumber(batchFailureCount);
+        pipeline::publishSimple(COMMAND_BATCH_COMMAND_NAME, &statuses,
+                &failures, &getConfiguration()->pipeline);
+        return true;
+    }
+
+    debug("Unrecognized command batch request: %s",
+            message->value.string_value);
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef __COMMAND_BATCH_COMMAND_H__
+#define __COMMAND_BATCH_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that groups the control commands
+ * following it into a batch, answered with one response instead of one per
+ * command. A host can then send many commands (e.g. 30 recurring diagnostic
+ * requests) back to back without waiting for each ACK:
+ *
+ *      {"name": "command_batch", "value": "begin"}
+ *      {"command": "diagnostic_request", ...}
+ *      ...
+ *      {"name": "command_batch", "value": "end"}
+ *
+ * value - "begin" to start a batch (dropping any batch already started), or
+ *      "end" to finish it.
+ *
+ * While a batch is open, control commands are still applied as they arrive,
+ * but responses without a message are held back. Commands that reply with
+ * information (e.g. the version) still send it. On "end" the VI sends:
+ *
+ *      {"name": "command_batch", "value": "1101", "event": 1}
+ *
+ * where the value has a 1 or 0 for the status of each command, in order, and
+ * the event is the number that failed. Only the first COMMAND_BATCH_MAX_ITEMS
+ * are listed, but every failure is counted.
+ */
+#define COMMAND_BATCH_COMMAND_NAME "command_batch"
+
+// The most per-command statuses listed in a batch's response.
+#ifndef COMMAND_BATCH_MAX_ITEMS
+#define COMMAND_BATCH_MAX_ITEMS 64
+#endif
+
+bool isCommandBatchCommand(openxc_SimpleMessage* message);
+
+bool handleCommandBatchCommand(openxc_SimpleMessage* message);
+
+/* Public: Return true if a command batch is open, in which case the status of
+ * each command should be passed to recordBatchStatus instead of being sent in
+ * its own response.
+ */
+bool batchOpen();
+
+/* Public: Add the status of one command to the open batch.
+ *
+ * status - true if the command was successful.
+ */
+void recordBatchStatus(bool status);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __COMMAND_BATCH_COMMAND_H__
@@ -19,6 +19,8 @@
 #include "commands/modem_config_command.h"
 #include "commands/rtc_config_command.h"
 #include "commands/sd_mount_status_command.h"
+#include "commands/command_batch_command.h"
+#include "commands/write_ack_command.h"
 
 
 using openxc::util::log::debug;
@@ -26,63 +28,92 @@ using openxc::config::getConfiguration;
 using openxc::payload::PayloadFormat;
 using openxc::interface::InterfaceType;
 
+/* Private: How to validate and handle one type of control command.
+ *
+ * type - The control command type.
+ * validate - A function to check a whole message containing the command, or
+ *      NULL if the command has no arguments to check.
+ * handle - The function to carry out the command.
+ */
+typedef struct {
+    openxc_ControlCommand_Type type;
+    bool (*validate)(openxc_VehicleMessage* message);
+    bool (*handle)(openxc_ControlCommand* command);
+} CommandDefinition;
+
+static bool handleVersion(openxc_ControlCommand* command) {
+    return openxc::commands::handleVersionCommand();
+}
+
+static bool handleDeviceId(openxc_ControlCommand* command) {
+    return openxc::commands::handleDeviceIdCommmand();
+}
+
+static bool handleDevicePlatform(openxc_ControlCommand* command) {
+    return openxc::commands::handleDevicePlatformCommmand();
+}
+
+static bool handleSDMountStatus(openxc_ControlCommand* command) {
+    return openxc::commands::handleSDMountStatusCommand();
+}
+
+static const CommandDefinition COMMANDS[] = {
+    {openxc_ControlCommand_Type_VERSION, NULL, handleVersion},
+    {openxc_ControlCommand_Type_DEVICE_ID, NULL, handleDeviceId},
+    {openxc_ControlCommand_Type_DIAGNOSTIC,
+        openxc::commands::validateDiagnosticRequest,
+        openxc::commands::handleDiagnosticRequestCommand},
+    {openxc_ControlCommand_Type_PASSTHROUGH,
+        openxc::commands::validatePassthroughRequest,
+        openxc::commands::handlePassthroughModeCommand},
+    {openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS,
+        openxc::commands::validateFilterBypassCommand,
+        openxc::commands::handleFilterBypassCommand},
+    {openxc_ControlCommand_Type_PAYLOAD_FORMAT,
+        openxc::commands::validatePayloadFormatCommand,
+        openxc::commands::handlePayloadFormatCommand},
+    {openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS,
+        openxc::commands::validatePredefinedObd2RequestsCommand,
+        openxc::commands::handlePredefinedObd2RequestsCommand},
+    {openxc_ControlCommand_Type_MODEM_CONFIGURATION,
+        openxc::commands::validateModemConfigurationCommand,
+        openxc::commands::handleModemConfigurationCommand},
+    {openxc_ControlCommand_Type_PLATFORM, NULL, handleDevicePlatform},
+    {openxc_ControlCommand_Type_RTC_CONFIGURATION,
+        openxc::commands::validateRTCConfigurationCommand,
+        openxc::commands::handleRTCConfigurationCommand},
+    {openxc_ControlCommand_Type_SD_MOUNT_STATUS, NULL, handleSDMountStatus},
+};
+
+static const CommandDefinition* lookupCommandDefinition(
+        openxc_ControlCommand_Type type) {
+    for(size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+        if(COMMANDS[i].type == type) {
+            return &COMMANDS[i];
+        }
+    }
+    return NULL;
+}
+
 static bool handleComplexCommand(openxc_VehicleMessage* message) {
     bool status = true;
     if(message != NULL && message->has_control_command) {
-        openxc_ControlCommand* command = &message->control_command;
-        switch(command->type) {
-        case openxc_ControlCommand_Type_DIAGNOSTIC:
-            status = openxc::commands::handleDiagnosticRequestCommand(command);
-            break;
-        case openxc_ControlCommand_Type_VERSION:
-            status = openxc::commands::handleVersionCommand();
-            break;
-        case openxc_ControlCommand_Type_DEVICE_ID:
-            status = openxc::commands::handleDeviceIdCommmand();
-            break;
-        case openxc_ControlCommand_Type_PLATFORM:
-            status = openxc::commands::handleDevicePlatformCommmand();
-            break;
-        case openxc_ControlCommand_Type_PASSTHROUGH:
-            status = openxc::commands::handlePassthroughModeCommand(command);
-            break;
-        case openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS:
-            status = openxc::commands::handlePredefinedObd2RequestsCommand(command);
-            break;
-        case openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS:
-            status = openxc::commands::handleFilterBypassCommand(command);
-            break;
-        case openxc_ControlCommand_Type_PAYLOAD_FORMAT:
-            status = openxc::commands::handlePayloadFormatCommand(command);
-            break;
-        case openxc_ControlCommand_Type_MODEM_CONFIGURATION:
-            status = openxc::commands::handleModemConfigurationCommand(command);
-            break;
-        case openxc_ControlCommand_Type_RTC_CONFIGURATION:
-            status = openxc::commands::handleRTCConfigurationCommand(command);
-        break;
-        case openxc_ControlCommand_Type_SD_MOUNT_STATUS:
-            status =  openxc::commands::handleSDMountStatusCommand();
-        default:
-            status = false;
-            break;
-        }
+        const CommandDefinition* definition = lookupCommandDefinition(
+                message->control_command.type);
+        status = definition != NULL &&
+                definition->handle(&message->control_command);
     }
     return status;
 }
 
 size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
         openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor) {
-    openxc_VehicleMessage message = {0};
+    // Not cleared here - the deserializer clears it only once it has a
+    // complete message to fill in, so the many attempts on a partial payload
+    // don't each pay for it
+    openxc_VehicleMessage message;
     size_t bytesRead = 0;
 
-    // TODO Not attempting to deserialize binary messages via UART,
-    // see https://github.com/openxc/vi-firmware/issues/313
-    if(sourceInterfaceDescriptor->type == InterfaceType::UART &&
-            getConfiguration()->payloadFormat == PayloadFormat::PROTOBUF) {
-        return 0;
-    }
-
     // Ignore anything less than 2 bytes, we know it's an incomplete payload -
     // wait for more to come in before trying to parse it
     if(length > 2) {
@@ -105,6 +136,14 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
                 }
             } else {
                 debug("Incoming message is complete but invalid");
+                if(batchOpen() && message.has_type && message.type ==
+                        openxc_VehicleMessage_Type_CONTROL_COMMAND) {
+                    recordBatchStatus(false);
+                } else if(message.has_type && (message.type ==
+                            openxc_VehicleMessage_Type_CAN ||
+                        message.type == openxc_VehicleMessage_Type_SIMPLE)) {
+                    recordWriteStatus(false);
+                }
             }
         } else {
             // This is very noisy when using UART as the packet tends to arrive
@@ -124,38 +163,10 @@ static bool validateControlCommand(openxc_VehicleMessage* message) {
             message->has_control_command &&
             message->control_command.has_type;
     if(valid) {
-        switch(message->control_command.type) {
-        case openxc_ControlCommand_Type_DIAGNOSTIC:
-            valid = openxc::commands::validateDiagnosticRequest(message);
-            break;
-        case openxc_ControlCommand_Type_PASSTHROUGH:
-            valid = openxc::commands::validatePassthroughRequest(message);
-            break;
-        case openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS:
-            valid = openxc::commands::validatePredefinedObd2RequestsCommand(message);
-            break;
-        case openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS:
-            valid = openxc::commands::validateFilterBypassCommand(message);
-            break;
-        case openxc_ControlCommand_Type_PAYLOAD_FORMAT:
-            valid = openxc::commands::validatePayloadFormatCommand(message);
-            break;
-        case openxc_ControlCommand_Type_VERSION:
-        case openxc_ControlCommand_Type_DEVICE_ID:
-        case openxc_ControlCommand_Type_PLATFORM:
-        case openxc_ControlCommand_Type_SD_MOUNT_STATUS:
-            valid =  true;
-            break;
-        case openxc_ControlCommand_Type_MODEM_CONFIGURATION:
-            valid = openxc::commands::validateModemConfigurationCommand(message);
-            break;
-        case openxc_ControlCommand_Type_RTC_CONFIGURATION:
-            valid = openxc::commands::validateRTCConfigurationCommand(message);
-            break;    
-        default:
-            valid = false;
-            break;
-        }
+        const CommandDefinition* definition = lookupCommandDefinition(
+                message->control_command.type);
+        valid = definition != NULL && (definition->validate == NULL ||
+                definition->validate(message));
     }
     return valid;
 }
@@ -183,6 +194,14 @@ bool openxc::commands::validate(openxc_VehicleMessage* message) {
 
 void openxc::commands::sendCommandResponse(openxc_ControlCommand_Type commandType,
         bool status, char* responseMessage, size_t responseMessageLength) {
+    if(batchOpen()) {
+        recordBatchStatus(status);
+        if(responseMessage == NULL || responseMessageLength == 0) {
+            // The batch's response covers this one
+            return;
+        }
+    }
+
     openxc_VehicleMessage message = {0};
     message.has_type = true;
     message.type = openxc_VehicleMessage_Type_COMMAND_RESPONSE;
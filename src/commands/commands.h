@@ -40,6 +40,10 @@ size_t handleIncomingMessage(uint8_t payload[], size_t payloadLength,
 bool validate(openxc_VehicleMessage* message);
 
 /* Public: Send a command response ACK message with an optional message.
+ *
+ * If a command batch is open (see COMMAND_BATCH_COMMAND_NAME), the status is
+ * added to the batch's response instead, and the ACK is only sent if it has a
+ * message.
  *
  * commandType - the command to ACK.
  * status - the status of the command, true if it was successful.
@@ -0,0 +1,148 @@
+#include "decode_profile_command.h"
+
+#include "decode_profiles.h"
+#include "util/log.h"
+#include "signals.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupSignal;
+using openxc::can::lookupSignalState;
+using openxc::profiles::DecodeProfile;
+using openxc::profiles::ProfileRule;
+
+namespace profiles = openxc::profiles;
+
+/* Private: Parse a "signal<threshold" condition into the profile. The value of
+ * an "=" condition may be one of the signal's states.
+ */
+static bool parseCondition(char* text, DecodeProfile* profile) {
+    char* operation = strpbrk(text, "<>=");
+    if(operation == NULL || operation == text ||
+            (size_t)(operation - text) >= sizeof(profile->signalName)) {
+        return false;
+    }
+
+    switch(*operation) {
+    case '<':
+        profile->condition = profiles::BELOW;
+        break;
+    case '>':
+        profile->condition = profiles::ABOVE;
+        break;
+    default:
+        profile->condition = profiles::EQUAL;
+        break;
+    }
+    strncpy(profile->signalName, text, operation - text);
+    profile->signalName[operation - text] = '\0';
+
+    char* value = operation + 1;
+    char* end = NULL;
+    profile->threshold = strtof(value, &end);
+    if(end != value && *end == '\0') {
+        return true;
+    }
+
+    const CanSignal* signal = lookupSignal(profile->signalName, getSignals(),
+            getSignalCount());
+    const CanSignalState* state = signal == NULL ? NULL :
+            lookupSignalState(value, signal);
+    if(profile->condition != profiles::EQUAL || state == NULL) {
+        return false;
+    }
+    profile->threshold = state->value;
+    return true;
+}
+
+/* Private: Parse a "pattern=off|on|frequency" rule. */
+static bool parseRule(char* text, ProfileRule* rule) {
+    char* separator = strchr(text, '=');
+    if(separator == NULL || separator == text ||
+            (size_t)(separator - text) >= sizeof(rule->pattern)) {
+        return false;
+    }
+    strncpy(rule->pattern, text, separator - text);
+    rule->pattern[separator - text] = '\0';
+
+    char* value = separator + 1;
+    rule->decoded = true;
+    rule->frequency = -1;
+    if(!strcmp(value, "off")) {
+        rule->decoded = false;
+        return true;
+    } else if(!strcmp(value, "on")) {
+        return true;
+    }
+
+    char* end = NULL;
+    rule->frequency = strtof(value, &end);
+    return end != value && *end == '\0' && rule->frequency >= 0;
+}
+
+bool openxc::commands::isDecodeProfileCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, DECODE_PROFILE_COMMAND_NAME);
+}
+
+bool openxc::commands::handleDecodeProfileCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_STRING) {
+        debug("Decode profile request must have a name and a condition");
+        return false;
+    }
+
+    const char* name = message->value.string_value;
+    if(strlen(name) == 0 || strlen(name) >= DECODE_PROFILE_NAME_LENGTH) {
+        debug("Decode profile name must be 1 to %d characters",
+                DECODE_PROFILE_NAME_LENGTH - 1);
+        return false;
+    }
+
+    if(!strcmp(message->event.string_value, "none")) {
+        return profiles::undefine(name, getSignals(), getSignalCount(),
+                getMessages(), getMessageCount(), getCanBuses(),
+                getCanBusCount());
+    }
+
+    DecodeProfile profile = {};
+    strcpy(profile.name, name);
+
+    char entries[sizeof(message->event.string_value)];
+    strncpy(entries, message->event.string_value, sizeof(entries) - 1);
+    entries[sizeof(entries) - 1] = '\0';
+    char* token = strtok(entries, ", ");
+    if(token == NULL || !parseCondition(token, &profile)) {
+        debug("Invalid decode profile condition: %s",
+                token == NULL ? "" : token);
+        return false;
+    }
+
+    while((token = strtok(NULL, ", ")) != NULL) {
+        if(profile.ruleCount >= DECODE_PROFILE_RULE_COUNT) {
+            debug("Decode profile can't have more than %d rules",
+                    DECODE_PROFILE_RULE_COUNT);
+            return false;
+        }
+
+        if(!parseRule(token, &profile.rules[profile.ruleCount])) {
+            debug("Invalid decode profile rule: %s", token);
+            return false;
+        }
+        ++profile.ruleCount;
+    }
+
+    return profiles::define(&profile, getSignals(), getSignalCount(),
+            getMessages(), getMessageCount(), getCanBuses(), getCanBusCount());
+}
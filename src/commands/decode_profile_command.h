@@ -0,0 +1,33 @@
+#ifndef __DECODE_PROFILE_COMMAND_H__
+#define __DECODE_PROFILE_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that defines a decode profile, e.g.
+ *
+ *      {"name": "decode_profile", "value": "parked",
+ *          "event": "vehicle_speed<1,engine_*=off,door_*=on,fuel_level=0.1"}
+ *
+ * value - the name of the profile.
+ * event - the condition for the profile to be active - a signal name, then
+ *      ">" or "<" and a threshold, or "=" and a value or state - followed by a
+ *      comma-separated list of rules. Each rule is a signal name or a prefix
+ *      followed by "*", "=" and "off" to stop decoding the signals, "on" to
+ *      decode them as usual or a maximum frequency in Hz. "none" removes the
+ *      profile.
+ *
+ * See openxc::profiles::define.
+ */
+#define DECODE_PROFILE_COMMAND_NAME "decode_profile"
+
+bool isDecodeProfileCommand(openxc_SimpleMessage* message);
+
+bool handleDecodeProfileCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __DECODE_PROFILE_COMMAND_H__
@@ -0,0 +1,88 @@
+#include "diagnostic_flow_control_command.h"
+
+#include "config.h"
+#include "diagnostics.h"
+#include "util/log.h"
+#include "signals.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupBus;
+
+namespace diagnostics = openxc::diagnostics;
+
+/* Private: Parse a "blockSize/separationTime" pair, optionally after an
+ * "arbitrationId:".
+ */
+static bool parseFlowControl(const char* text, uint32_t* arbitrationId,
+        uint8_t* blockSize, uint8_t* separationTime) {
+    char* end = NULL;
+    unsigned long first = strtoul(text, &end, 0);
+    if(end == text) {
+        return false;
+    }
+
+    *arbitrationId = 0;
+    if(*end == ':') {
+        *arbitrationId = first;
+        const char* blockStart = end + 1;
+        first = strtoul(blockStart, &end, 0);
+        if(end == blockStart) {
+            return false;
+        }
+    }
+
+    if(*end != '/' || first > 0xff) {
+        return false;
+    }
+    const char* separationStart = end + 1;
+    unsigned long separation = strtoul(separationStart, &end, 0);
+    if(end == separationStart || *end != '\0' || separation > 0xff) {
+        return false;
+    }
+
+    *blockSize = first;
+    *separationTime = separation;
+    return true;
+}
+
+bool openxc::commands::isDiagnosticFlowControlCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, DIAGNOSTIC_FLOW_CONTROL_COMMAND_NAME);
+}
+
+bool openxc::commands::handleDiagnosticFlowControlCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("Diagnostic flow control request must have parameters and a bus");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for diagnostic flow control: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    uint32_t arbitrationId;
+    uint8_t blockSize, separationTime;
+    if(!parseFlowControl(message->value.string_value, &arbitrationId,
+                &blockSize, &separationTime)) {
+        debug("Invalid diagnostic flow control: %s",
+                message->value.string_value);
+        return false;
+    }
+
+    return diagnostics::setFlowControl(&getConfiguration()->diagnosticsManager,
+            bus, arbitrationId, blockSize, separationTime);
+}
@@ -0,0 +1,31 @@
+#ifndef __DIAGNOSTIC_FLOW_CONTROL_COMMAND_H__
+#define __DIAGNOSTIC_FLOW_CONTROL_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that sets the ISO-TP flow control
+ * parameters the VI sends for streamed diagnostic responses, e.g.
+ *
+ *      {"name": "diagnostic_flow_control", "value": "0x7e0:8/2", "event": 1}
+ *
+ * value - the block size and separation time (STmin, encoded as in ISO
+ *      15765-2) separated by a "/", optionally after the arbitration ID the
+ *      ECU's requests are sent to and a ":". Without an ID, they're the default
+ *      for every ECU on the bus.
+ * event - the address of the bus.
+ *
+ * See openxc::diagnostics::setFlowControl.
+ */
+#define DIAGNOSTIC_FLOW_CONTROL_COMMAND_NAME "diagnostic_flow_control"
+
+bool isDiagnosticFlowControlCommand(openxc_SimpleMessage* message);
+
+bool handleDiagnosticFlowControlCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __DIAGNOSTIC_FLOW_CONTROL_COMMAND_H__
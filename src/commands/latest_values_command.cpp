@@ -0,0 +1,66 @@
+#include "latest_values_command.h"
+
+#include "config.h"
+#include "util/log.h"
+#include "signals.h"
+#include "can/canread.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
+using openxc::can::read::publishLatestValue;
+
+bool openxc::commands::isLatestValuesCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, LATEST_VALUES_COMMAND_NAME);
+}
+
+bool openxc::commands::handleLatestValuesCommand(
+        openxc_SimpleMessage* message) {
+    openxc::pipeline::Pipeline* pipeline = &getConfiguration()->pipeline;
+    if(!message->has_value || (
+                message->value.type == openxc_DynamicField_Type_STRING &&
+                !strcmp(message->value.string_value, "all"))) {
+        for(int i = 0; i < getSignalCount(); i++) {
+            publishLatestValue(&getSignals()[i], pipeline);
+        }
+        return true;
+    }
+
+    if(message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Latest values request must be a list of signal names");
+        return false;
+    }
+
+    // Resolve every name before sending anything, so a bad request doesn't
+    // get a partial answer
+    CanSignal* signals[LATEST_VALUES_MAX_SIGNALS];
+    int signalCount = 0;
+    char names[sizeof(message->value.string_value)];
+    strncpy(names, message->value.string_value, sizeof(names) - 1);
+    names[sizeof(names) - 1] = '\0';
+    for(char* token = strtok(names, ", "); token != NULL;
+            token = strtok(NULL, ", ")) {
+        CanSignal* signal = lookupSignal(token, getSignals(),
+                getSignalCount());
+        if(signal == NULL) {
+            debug("Can't send latest value of unknown signal %s", token);
+            return false;
+        }
+
+        if(signalCount >= LATEST_VALUES_MAX_SIGNALS) {
+            debug("Can't send the latest values of more than %d signals",
+                    LATEST_VALUES_MAX_SIGNALS);
+            return false;
+        }
+        signals[signalCount++] = signal;
+    }
+
+    for(int i = 0; i < signalCount; i++) {
+        publishLatestValue(signals[i], pipeline);
+    }
+    return true;
+}
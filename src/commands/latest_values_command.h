@@ -0,0 +1,33 @@
+#ifndef __LATEST_VALUES_COMMAND_H__
+#define __LATEST_VALUES_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that asks for the last value received
+ * for some signals, e.g.
+ *
+ *      {"name": "latest_values", "value": "vehicle_speed,engine_speed"}
+ *
+ * value - a comma-separated list of the signals to send. Leaving out the
+ *      value, or "all", sends every signal that's been received.
+ *
+ * The VI replies with one message per signal (see
+ * openxc::can::read::publishLatestValue), skipping signals it hasn't received
+ * yet. If any of the names is unknown, nothing is sent.
+ */
+#define LATEST_VALUES_COMMAND_NAME "latest_values"
+
+// The most signals that can be named in one latest values request.
+#define LATEST_VALUES_MAX_SIGNALS 16
+
+bool isLatestValuesCommand(openxc_SimpleMessage* message);
+
+bool handleLatestValuesCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __LATEST_VALUES_COMMAND_H__
@@ -0,0 +1,37 @@
+#include "log_level_command.h"
+
+#include "util/log.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::util::log::LogLevel;
+using openxc::util::log::setLevel;
+
+// Indexed by LogLevel
+static const char* const LEVEL_NAMES[LOG_LEVEL_COUNT] = {
+    "error",
+    "warning",
+    "info",
+    "debug",
+};
+
+bool openxc::commands::isLogLevelCommand(openxc_SimpleMessage* message) {
+    return message->has_name && !strcmp(message->name, LOG_LEVEL_COMMAND_NAME);
+}
+
+bool openxc::commands::handleLogLevelCommand(openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Log level request must have a level name");
+        return false;
+    }
+
+    for(int i = 0; i < LOG_LEVEL_COUNT; i++) {
+        if(!strcmp(message->value.string_value, LEVEL_NAMES[i])) {
+            return setLevel((LogLevel) i);
+        }
+    }
+
+    debug("Unknown log level: %s", message->value.string_value);
+    return false;
+}
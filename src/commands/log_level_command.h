@@ -0,0 +1,28 @@
+#ifndef __LOG_LEVEL_COMMAND_H__
+#define __LOG_LEVEL_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that sets which log messages the VI
+ * sends, e.g.
+ *
+ *      {"name": "log_level", "value": "warning"}
+ *
+ * value - the least important level to send: "error", "warning", "info" or
+ *      "debug" (everything).
+ *
+ * See openxc::util::log::setLevel.
+ */
+#define LOG_LEVEL_COMMAND_NAME "log_level"
+
+bool isLogLevelCommand(openxc_SimpleMessage* message);
+
+bool handleLogLevelCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __LOG_LEVEL_COMMAND_H__
@@ -0,0 +1,42 @@
+#include "message_set_command.h"
+
+#include "message_sets.h"
+#include "signals.h"
+#include "util/log.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getMessageSets;
+using openxc::signals::getMessageSetCount;
+
+bool openxc::commands::isMessageSetCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, MESSAGE_SET_COMMAND_NAME);
+}
+
+bool openxc::commands::handleMessageSetCommand(openxc_SimpleMessage* message) {
+    if(!message->has_value) {
+        debug("Message set command is missing the set to switch to");
+        return false;
+    }
+
+    int index = -1;
+    if(message->value.type == openxc_DynamicField_Type_NUM) {
+        index = (int) message->value.numeric_value;
+    } else if(message->value.type == openxc_DynamicField_Type_STRING) {
+        for(int i = 0; i < getMessageSetCount(); i++) {
+            if(getMessageSets()[i].name != NULL &&
+                    !strcmp(getMessageSets()[i].name,
+                        message->value.string_value)) {
+                index = i;
+                break;
+            }
+        }
+    }
+
+    if(index < 0 || index >= getMessageSetCount()) {
+        debug("Unknown message set, not switching");
+        return false;
+    }
+    return openxc::signals::sets::activate(index);
+}
@@ -0,0 +1,29 @@
+#ifndef __MESSAGE_SET_COMMAND_H__
+#define __MESSAGE_SET_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that switches the active message set,
+ * e.g. when a different variant of the vehicle is detected:
+ *
+ *      {"name": "message_set", "value": "shared_handler_tests"}
+ *
+ * value - the name of the message set, or its index in the firmware's list of
+ *      message sets.
+ *
+ * Only message sets kept resident by signals::sets::prepare() can be switched
+ * to (see signals::sets::activate).
+ */
+#define MESSAGE_SET_COMMAND_NAME "message_set"
+
+bool isMessageSetCommand(openxc_SimpleMessage* message);
+
+bool handleMessageSetCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __MESSAGE_SET_COMMAND_H__
@@ -0,0 +1,129 @@
+#include "metrics_command.h"
+
+#include "config.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "can/canutil.h"
+#include "payload/payload.h"
+#include "util/timer.h"
+#include "util/memory.h"
+#include <stdio.h>
+#include <string.h>
+
+using openxc::config::getConfiguration;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::interface::InterfaceType;
+using openxc::pipeline::EndpointMetrics;
+using openxc::can::CanBusCounters;
+
+namespace pipeline = openxc::pipeline;
+namespace payload = openxc::payload;
+namespace time = openxc::util::time;
+namespace memory = openxc::util::memory;
+
+// Indexed by InterfaceType, the same names as pipeline routes use
+static const char* const ENDPOINT_NAMES[PIPELINE_ENDPOINT_COUNT] = {
+    "usb",
+    "uart",
+    "network",
+    "telit",
+    "ble",
+    "fs",
+};
+
+static void publishCounters(const char* source, unsigned int first,
+        unsigned int second, unsigned int third, unsigned int fourth) {
+    char counters[48];
+    snprintf(counters, sizeof(counters), "%u,%u,%u,%u", first, second, third,
+            fourth);
+    openxc_DynamicField value = payload::wrapString(source);
+    openxc_DynamicField event = payload::wrapString(counters);
+    pipeline::publishSimple(METRICS_COMMAND_NAME, &value, &event,
+            &getConfiguration()->pipeline);
+}
+
+/* Private: Publish an endpoint's latency histogram, if it has any samples.
+ */
+static void publishLatencyHistogram(InterfaceType endpoint) {
+    unsigned int buckets[PIPELINE_LATENCY_BUCKET_COUNT];
+    if(!pipeline::getLatencyHistogram(endpoint, buckets)) {
+        return;
+    }
+
+    char counts[PIPELINE_LATENCY_BUCKET_COUNT * 11];
+    size_t length = 0;
+    unsigned int total = 0;
+    for(int i = 0; i < PIPELINE_LATENCY_BUCKET_COUNT &&
+            length < sizeof(counts); i++) {
+        length += snprintf(&counts[length], sizeof(counts) - length,
+                i == 0 ? "%u" : ",%u", buckets[i]);
+        total += buckets[i];
+    }
+
+    if(total > 0) {
+        char source[20];
+        snprintf(source, sizeof(source), "%s_latency", ENDPOINT_NAMES[endpoint]);
+        openxc_DynamicField value = payload::wrapString(source);
+        openxc_DynamicField event = payload::wrapString(counts);
+        pipeline::publishSimple(METRICS_COMMAND_NAME, &value, &event,
+                &getConfiguration()->pipeline);
+    }
+}
+
+bool openxc::commands::isMetricsCommand(openxc_SimpleMessage* message) {
+    return message->has_name && !strcmp(message->name, METRICS_COMMAND_NAME);
+}
+
+bool openxc::commands::handleMetricsCommand(openxc_SimpleMessage* message) {
+    // As a string, since a float would lose milliseconds after a few hours
+    char uptimeMs[12];
+    snprintf(uptimeMs, sizeof(uptimeMs), "%lu", time::uptimeMs());
+    openxc_DynamicField value = payload::wrapString("uptime");
+    openxc_DynamicField uptime = payload::wrapString(uptimeMs);
+    pipeline::publishSimple(METRICS_COMMAND_NAME, &value, &uptime,
+            &getConfiguration()->pipeline);
+
+    size_t heapUsed;
+    size_t heapReserved;
+    memory::heapUsage(&heapUsed, &heapReserved);
+    publishCounters("memory", memory::stackHighWater(), memory::stackSize(),
+            heapUsed, heapReserved);
+
+    for(int i = 0; i < getCanBusCount(); i++) {
+        CanBus* bus = &getCanBuses()[i];
+        CanBusCounters counters;
+        openxc::can::snapshotCounters(bus, &counters);
+        char source[16];
+        snprintf(source, sizeof(source), "can%d", bus->address);
+        publishCounters(source, counters.received, counters.dropped,
+                counters.receiveQueueLength, counters.sendQueueLength);
+        snprintf(source, sizeof(source), "can%d_queue", bus->address);
+        publishCounters(source, counters.receiveQueuePeak,
+                counters.receiveQueueCapacity, counters.sendQueuePeak,
+                counters.sendQueueCapacity);
+        snprintf(source, sizeof(source), "can%d_load", bus->address);
+        publishCounters(source, (unsigned int) (bus->bitsReceived / 1000),
+                bus->speed / 1000, bus->busLoad, bus->peakBusLoad);
+        snprintf(source, sizeof(source), "can%d_errors", bus->address);
+        publishCounters(source, bus->transmitErrorCount,
+                bus->receiveErrorCount, bus->peakErrorCount,
+                bus->busOffCount);
+    }
+
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        EndpointMetrics metrics;
+        if(pipeline::getEndpointMetrics((InterfaceType) i, &metrics) &&
+                metrics.sent + metrics.dropped > 0) {
+            publishCounters(ENDPOINT_NAMES[i], metrics.sent, metrics.dropped,
+                    metrics.bytesSent, metrics.sendQueueLength);
+            char source[20];
+            snprintf(source, sizeof(source), "%s_queue", ENDPOINT_NAMES[i]);
+            publishCounters(source, metrics.sendQueuePeak,
+                    metrics.sendQueueCapacity, metrics.receiveQueuePeak,
+                    metrics.receiveQueueCapacity);
+        }
+        publishLatencyHistogram((InterfaceType) i);
+    }
+    return true;
+}
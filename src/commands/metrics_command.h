@@ -0,0 +1,72 @@
+#ifndef __METRICS_COMMAND_H__
+#define __METRICS_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that asks for a snapshot of the VI's
+ * counters, e.g.
+ *
+ *      {"name": "metrics"}
+ *
+ * The VI replies with simple messages of the same name: one with the value
+ * "uptime" and the uptime in ms (as a string) as the event, then one per CAN bus and one
+ * per output endpoint that has sent anything. The value names the source
+ * ("can1", "can2", or the endpoint as in pipeline routes) and the event is a
+ * comma-separated list of counters since startup:
+ *
+ *      {"name": "metrics", "value": "can1", "event": "18234,2,3,0"}
+ *      {"name": "metrics", "value": "usb", "event": "18003,12,1034512,140"}
+ *
+ * For a bus: messages received, messages dropped, messages in the receive
+ * queue, messages in the send queue. For an endpoint: messages sent, messages
+ * dropped, bytes sent, bytes in the send queue. Rates are the difference
+ * between two snapshots divided by the difference in uptime.
+ *
+ * Then the high-water marks, to size the stack and queues by. A "memory"
+ * message has the most bytes of the stack used since startup, the bytes the
+ * stack can grow to, the bytes allocated from the heap and the bytes the heap
+ * has taken (see openxc::util::memory):
+ *
+ *      {"name": "metrics", "value": "memory", "event": "3480,28612,1204,2048"}
+ *
+ * Each bus and endpoint above also gets a "<source>_queue" message with the
+ * peak and capacity of its queues. For a bus, in messages: receive queue peak,
+ * receive queue capacity, send queue peak, send queue capacity. For an
+ * endpoint, in bytes: send queue peak, send queue capacity, receive queue peak
+ * (only sampled when sending), receive queue capacity:
+ *
+ *      {"name": "metrics", "value": "can1_queue", "event": "11,32,2,64"}
+ *
+ * Each bus also gets a "<bus>_load" message with the kilobits received
+ * (counting every bit on the wire, see openxc::can::frameBitLength), the bus
+ * speed in kbit/s, and the share of the bus used by received messages over the
+ * last second and at its peak, both in tenths of a percent:
+ *
+ *      {"name": "metrics", "value": "can1_load", "event": "91744,500,412,687"}
+ *
+ * and a "<bus>_errors" message with the controller's transmit and receive
+ * error counters, the highest either has been, and the number of times it's
+ * gone bus off. Those count errors on the bus itself, where dropped messages
+ * above are the VI falling behind:
+ *
+ *      {"name": "metrics", "value": "can1_errors", "event": "0,3,96,0"}
+ *
+ * Endpoints that have sampled any CAN to output latencies (see
+ * openxc::pipeline::getLatencyHistogram) also get an "<endpoint>_latency"
+ * message with the count in each histogram bucket:
+ *
+ *      {"name": "metrics", "value": "usb_latency", "event": "0,4,31,2,0,0,0,0,0,0"}
+ */
+#define METRICS_COMMAND_NAME "metrics"
+
+bool isMetricsCommand(openxc_SimpleMessage* message);
+
+bool handleMetricsCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __METRICS_COMMAND_H__
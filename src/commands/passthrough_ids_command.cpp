@@ -0,0 +1,119 @@
+#include "passthrough_ids_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <can/canutil.h>
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::can::lookupBus;
+
+namespace can = openxc::can;
+
+/* Private: One parsed "id/mask@frequency" entry of a passthrough IDs request.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    CanMessageFormat format;
+    float frequency;
+} PassthroughSelection;
+
+static bool parseSelection(char* text, PassthroughSelection* selection) {
+    char* end = NULL;
+    selection->id = strtoul(text, &end, 0);
+    if(end == text) {
+        return false;
+    }
+
+    selection->format = selection->id > 0x7ff ? CanMessageFormat::EXTENDED :
+            CanMessageFormat::STANDARD;
+    selection->mask = 0xffffffff;
+    selection->frequency = 0;
+    if(*end == '/') {
+        char* maskStart = end + 1;
+        selection->mask = strtoul(maskStart, &end, 0);
+        if(end == maskStart) {
+            return false;
+        }
+    }
+
+    if(*end == '@') {
+        char* frequencyStart = end + 1;
+        selection->frequency = strtof(frequencyStart, &end);
+        if(end == frequencyStart || selection->frequency < 0) {
+            return false;
+        }
+    }
+    return *end == '\0';
+}
+
+bool openxc::commands::isPassthroughIdsCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, PASSTHROUGH_IDS_COMMAND_NAME);
+}
+
+bool openxc::commands::handlePassthroughIdsCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING ||
+            !message->has_event ||
+            message->event.type != openxc_DynamicField_Type_NUM) {
+        debug("Passthrough IDs request must have a list of IDs and a bus");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(message->event.numeric_value, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for passthrough IDs: %d",
+                (int) message->event.numeric_value);
+        return false;
+    }
+
+    if(!strcmp(message->value.string_value, "all")) {
+        can::clearPassthroughFilters(bus);
+        return true;
+    }
+
+    // Parse every entry before changing anything, so a bad request leaves the
+    // current selection alone
+    PassthroughSelection selections[CAN_PASSTHROUGH_FILTER_COUNT];
+    int selectionCount = 0;
+    char entries[sizeof(message->value.string_value)];
+    strncpy(entries, message->value.string_value, sizeof(entries) - 1);
+    entries[sizeof(entries) - 1] = '\0';
+    for(char* token = strtok(entries, ", "); token != NULL;
+            token = strtok(NULL, ", ")) {
+        if(selectionCount >= CAN_PASSTHROUGH_FILTER_COUNT) {
+            debug("Can't pass through more than %d selections of IDs",
+                    CAN_PASSTHROUGH_FILTER_COUNT);
+            return false;
+        }
+
+        if(!parseSelection(token, &selections[selectionCount])) {
+            debug("Invalid passthrough ID: %s", token);
+            return false;
+        }
+        ++selectionCount;
+    }
+
+    if(selectionCount == 0) {
+        debug("Passthrough IDs request must have a list of IDs and a bus");
+        return false;
+    }
+
+    can::clearPassthroughFilters(bus);
+    for(int i = 0; i < selectionCount; i++) {
+        can::addPassthroughFilter(bus, selections[i].id, selections[i].mask,
+                selections[i].format, selections[i].frequency, getMessages(),
+                getMessageCount(), getCanBuses(), getCanBusCount());
+    }
+    bus->passthroughCanMessages = true;
+    return true;
+}
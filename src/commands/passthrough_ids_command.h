@@ -0,0 +1,33 @@
+#ifndef __PASSTHROUGH_IDS_COMMAND_H__
+#define __PASSTHROUGH_IDS_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that limits a bus's passthrough to
+ * some message IDs, e.g.
+ *
+ *      {"name": "passthrough_ids", "value": "0x7e8/0x7f8,0x3b5@5", "event": 1}
+ *
+ * value - a comma-separated list of IDs to pass through, replacing any set
+ *      before. Each can have a "/mask" to match a group of IDs and, for a
+ *      single ID, an "@frequency" to pass it through at most that many times
+ *      a second. An ID above 0x7ff is an extended ID. "all" goes back to
+ *      passing through every message.
+ * event - the address of the bus.
+ *
+ * Passthrough is turned on for the bus, if it wasn't already (see
+ * openxc::can::addPassthroughFilter).
+ */
+#define PASSTHROUGH_IDS_COMMAND_NAME "passthrough_ids"
+
+bool isPassthroughIdsCommand(openxc_SimpleMessage* message);
+
+bool handlePassthroughIdsCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __PASSTHROUGH_IDS_COMMAND_H__
@@ -44,6 +44,9 @@ bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command
                 case openxc_PayloadFormatCommand_PayloadFormat_MESSAGEPACK:
                     format = PayloadFormat::MESSAGEPACK;
                     break;    
+                case PAYLOAD_FORMAT_COMMAND_MESSAGEPACK_COMPACT:
+                    format = PayloadFormat::MESSAGEPACK_COMPACT;
+                    break;
             }
 
             status = true;
@@ -0,0 +1,102 @@
+#include "periodic_write_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include "can/canwrite.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::can::lookupBus;
+
+namespace write = openxc::can::write;
+
+/* Private: Parse a hex string, with or without a "0x" prefix, into at most
+ * CAN_MESSAGE_SIZE bytes.
+ *
+ * Returns the number of bytes, or -1 if the string isn't valid.
+ */
+static int parseData(const char* text, uint8_t data[]) {
+    if(!strncmp(text, "0x", 2) || !strncmp(text, "0X", 2)) {
+        text += 2;
+    }
+
+    size_t digits = strlen(text);
+    if(digits == 0 || digits % 2 != 0 || digits / 2 > CAN_MESSAGE_SIZE) {
+        return -1;
+    }
+
+    for(size_t i = 0; i < digits / 2; i++) {
+        char byte[3] = {text[i * 2], text[i * 2 + 1], '\0'};
+        char* end = NULL;
+        data[i] = (uint8_t) strtoul(byte, &end, 16);
+        if(*end != '\0') {
+            return -1;
+        }
+    }
+    return digits / 2;
+}
+
+bool openxc::commands::isPeriodicWriteCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, PERIODIC_WRITE_COMMAND_NAME);
+}
+
+bool openxc::commands::handlePeriodicWriteCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Periodic write request must be \"bus,id,data\"");
+        return false;
+    }
+
+    char fields[sizeof(message->value.string_value)];
+    strncpy(fields, message->value.string_value, sizeof(fields) - 1);
+    fields[sizeof(fields) - 1] = '\0';
+    char* busField = strtok(fields, ", ");
+    char* idField = strtok(NULL, ", ");
+    char* dataField = strtok(NULL, ", ");
+    if(busField == NULL || idField == NULL) {
+        debug("Periodic write request must be \"bus,id,data\"");
+        return false;
+    }
+
+    CanBus* bus = lookupBus(atoi(busField), getCanBuses(), getCanBusCount());
+    if(bus == NULL) {
+        debug("No matching active bus for periodic write: %s", busField);
+        return false;
+    }
+
+    if(!bus->rawWritable) {
+        debug("Raw CAN writes not allowed for bus %d", bus->address);
+        return false;
+    }
+
+    uint32_t id = strtoul(idField, NULL, 0);
+    CanMessageFormat format = id > 0x7ff ? CanMessageFormat::EXTENDED :
+            CanMessageFormat::STANDARD;
+    float frequency = 0;
+    if(message->has_event && message->event.type ==
+            openxc_DynamicField_Type_NUM) {
+        frequency = message->event.numeric_value;
+    }
+
+    if(frequency <= 0) {
+        return write::removePeriodicWrite(bus, id, format);
+    }
+
+    CanMessage canMessage = {
+        id: id,
+        format: format
+    };
+    int length = dataField == NULL ? -1 : parseData(dataField,
+            canMessage.data);
+    if(length < 0) {
+        debug("Invalid data for periodic write of 0x%x", id);
+        return false;
+    }
+    canMessage.length = length;
+    return write::addPeriodicWrite(bus, &canMessage, frequency);
+}
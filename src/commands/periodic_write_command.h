@@ -0,0 +1,30 @@
+#ifndef __PERIODIC_WRITE_COMMAND_H__
+#define __PERIODIC_WRITE_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that sets up a CAN message to be sent
+ * repeatedly by the VI, e.g. a tester present keep-alive every 2 seconds:
+ *
+ *      {"name": "periodic_write", "value": "1,0x7df,0x023e00", "event": 0.5}
+ *
+ * value - the bus address, message ID and data, separated by commas. An ID
+ *      above 0x7ff is sent as an extended frame.
+ * event - how many times a second to send the message. 0, or leaving out the
+ *      event, stops sending it.
+ *
+ * The bus must allow raw CAN writes (see openxc::can::write::addPeriodicWrite).
+ */
+#define PERIODIC_WRITE_COMMAND_NAME "periodic_write"
+
+bool isPeriodicWriteCommand(openxc_SimpleMessage* message);
+
+bool handlePeriodicWriteCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __PERIODIC_WRITE_COMMAND_H__
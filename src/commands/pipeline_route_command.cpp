@@ -0,0 +1,208 @@
+#include "pipeline_route_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include "pipeline.h"
+#include <can/canutil.h>
+#include <string.h>
+#include <stdlib.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
+using openxc::interface::InterfaceType;
+using openxc::pipeline::MessageClass;
+using openxc::payload::PayloadFormat;
+
+namespace pipeline = openxc::pipeline;
+
+// Indexed by InterfaceType
+static const char* const ENDPOINT_NAMES[PIPELINE_ENDPOINT_COUNT] = {
+    "usb",
+    "uart",
+    "network",
+    "telit",
+    "ble",
+    "fs",
+};
+
+// Indexed by MessageClass
+static const char* const MESSAGE_CLASS_NAMES[MESSAGE_CLASS_COUNT] = {
+    "simple",
+    "can",
+    "diagnostic",
+    "log",
+    "command_response",
+};
+
+// Indexed by PayloadFormat
+static const char* const PAYLOAD_FORMAT_NAMES[PAYLOAD_FORMAT_COUNT] = {
+    "json",
+    "protobuf",
+    "messagepack",
+    "messagepack_compact",
+};
+
+#define BATCH_TOKEN_PREFIX "batch="
+#define RATE_TOKEN_PREFIX "rate="
+#define DELTAS_TOKEN "deltas"
+#define ABSOLUTE_TOKEN "absolute"
+#define COLUMNAR_TOKEN "columnar"
+#define RECORDS_TOKEN "records"
+
+static int lookupName(const char* name, const char* const names[],
+        int nameCount) {
+    for(int i = 0; i < nameCount; i++) {
+        if(!strcmp(name, names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool openxc::commands::isPipelineRouteCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, PIPELINE_ROUTE_COMMAND_NAME);
+}
+
+bool openxc::commands::handlePipelineRouteCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Route command is missing an endpoint");
+        return false;
+    }
+
+    int endpoint = lookupName(message->value.string_value, ENDPOINT_NAMES,
+            PIPELINE_ENDPOINT_COUNT);
+    if(endpoint < 0) {
+        debug("Can't route unknown endpoint %s", message->value.string_value);
+        return false;
+    }
+
+    if(!message->has_event) {
+        return pipeline::setRoute((InterfaceType) endpoint,
+                ALL_MESSAGE_CLASSES);
+    }
+
+    if(message->event.type != openxc_DynamicField_Type_STRING) {
+        debug("Route for %s must be a string", ENDPOINT_NAMES[endpoint]);
+        return false;
+    }
+
+    // Resolve everything before touching the route, so a bad request leaves
+    // the old one in place
+    uint8_t messageClasses = 0;
+    int format = -1;
+    int batchSize = -1;
+    int deltas = -1;
+    int columnar = -1;
+    float frequency = -1;
+    const char* signalNames[PIPELINE_ROUTE_MAX_SIGNALS];
+    int signalCount = 0;
+
+    char routes[sizeof(message->event.string_value)];
+    strncpy(routes, message->event.string_value, sizeof(routes) - 1);
+    routes[sizeof(routes) - 1] = '\0';
+    for(char* token = strtok(routes, ", "); token != NULL;
+            token = strtok(NULL, ", ")) {
+        int messageClass = lookupName(token, MESSAGE_CLASS_NAMES,
+                MESSAGE_CLASS_COUNT);
+        int tokenFormat = lookupName(token, PAYLOAD_FORMAT_NAMES,
+                PAYLOAD_FORMAT_COUNT);
+        if(messageClass >= 0) {
+            messageClasses |= MESSAGE_CLASS_FLAG(messageClass);
+        } else if(tokenFormat >= 0) {
+            format = tokenFormat;
+        } else if(!strcmp(token, "all")) {
+            messageClasses |= ALL_MESSAGE_CLASSES;
+        } else if(!strcmp(token, "none")) {
+            continue;
+        } else if(!strcmp(token, DELTAS_TOKEN)) {
+            deltas = true;
+        } else if(!strcmp(token, ABSOLUTE_TOKEN)) {
+            deltas = false;
+        } else if(!strcmp(token, COLUMNAR_TOKEN) ||
+                !strcmp(token, RECORDS_TOKEN)) {
+            columnar = !strcmp(token, COLUMNAR_TOKEN);
+            if(endpoint != InterfaceType::TELIT &&
+                    endpoint != InterfaceType::FS) {
+                debug("Can't send %s as %s", ENDPOINT_NAMES[endpoint], token);
+                return false;
+            }
+        } else if(!strncmp(token, BATCH_TOKEN_PREFIX,
+                    strlen(BATCH_TOKEN_PREFIX))) {
+            batchSize = atoi(token + strlen(BATCH_TOKEN_PREFIX));
+            if(batchSize < 0 || batchSize > 255 ||
+                    endpoint == InterfaceType::TELIT) {
+                debug("Can't batch %s by %s", ENDPOINT_NAMES[endpoint],
+                        token);
+                return false;
+            }
+        } else if(!strncmp(token, RATE_TOKEN_PREFIX,
+                    strlen(RATE_TOKEN_PREFIX))) {
+            frequency = atof(token + strlen(RATE_TOKEN_PREFIX));
+            if(frequency < 0) {
+                debug("Can't send to %s at %s", ENDPOINT_NAMES[endpoint],
+                        token);
+                return false;
+            }
+        } else {
+            // The route keeps a pointer to the name, so it has to be one that
+            // lives as long as the signal
+            CanSignal* signal = lookupSignal(token, getSignals(),
+                    getSignalCount());
+            if(signal == NULL) {
+                debug("Can't route unknown signal %s", token);
+                return false;
+            }
+
+            if(signalCount >= PIPELINE_ROUTE_MAX_SIGNALS) {
+                debug("Too many signals in route for %s",
+                        ENDPOINT_NAMES[endpoint]);
+                return false;
+            }
+            signalNames[signalCount++] = signal->genericName;
+            messageClasses |= MESSAGE_CLASS_FLAG(MessageClass::SIMPLE);
+        }
+    }
+
+    if(frequency >= 0 && signalCount == 0) {
+        debug("A rate for %s needs the signals it applies to",
+                ENDPOINT_NAMES[endpoint]);
+        return false;
+    }
+
+    if(messageClasses == 0 && signalCount == 0 &&
+            (format >= 0 || batchSize >= 0 || deltas >= 0 ||
+                columnar >= 0)) {
+        // Only the format, batching, timestamps or columnar mode were given,
+        // so keep sending the same messages - "none" has to be explicit
+        messageClasses = ALL_MESSAGE_CLASSES;
+    }
+
+    pipeline::setRoute((InterfaceType) endpoint, messageClasses);
+    if(format >= 0) {
+        pipeline::setPayloadFormat((InterfaceType) endpoint,
+                (PayloadFormat) format);
+    }
+    if(batchSize >= 0) {
+        pipeline::setBatching((InterfaceType) endpoint, batchSize,
+                PIPELINE_BATCH_MAX_DELAY_MS);
+    }
+    if(deltas >= 0) {
+        pipeline::setTimestampDeltas((InterfaceType) endpoint, deltas);
+    }
+    if(columnar >= 0) {
+        pipeline::setColumnar((InterfaceType) endpoint, columnar);
+    }
+    for(int i = 0; i < signalCount; i++) {
+        pipeline::addRouteSignal((InterfaceType) endpoint, signalNames[i]);
+    }
+    if(frequency >= 0) {
+        pipeline::setRouteFrequency((InterfaceType) endpoint, frequency);
+    }
+    debug("Updated route for %s", ENDPOINT_NAMES[endpoint]);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __PIPELINE_ROUTE_COMMAND_H__
+#define __PIPELINE_ROUTE_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that configures pipeline routes, e.g.
+ *
+ *      {"name": "pipeline_route", "value": "telit",
+ *          "event": "diagnostic,vehicle_speed,engine_speed"}
+ *
+ * value - the endpoint to configure: usb, uart, network, telit, ble or fs.
+ * event - a comma-separated list of the message classes (simple, can,
+ *      diagnostic, log, command_response) and signal names to send to the
+ *      endpoint. Listing any signal limits the endpoint's simple messages to
+ *      those signals. "all", or leaving out the event, sends everything again
+ *      and "none" sends nothing. It may also include a payload format (json,
+ *      protobuf, messagepack or messagepack_compact) for the endpoint; a
+ *      format on its own changes only the format. Likewise "batch=N" sends
+ *      simple and CAN messages in batches of N (see pipeline::setBatching),
+ *      where 1 turns batching off and 0 restores the default, "deltas"
+ *      or "absolute" chooses how timestamps are sent (see
+ *      pipeline::setTimestampDeltas), "columnar" or "records" chooses whether
+ *      the telit and fs endpoints send signal values in columnar blocks (see
+ *      pipeline::setColumnar), and "rate=N" sends each of the listed signals
+ *      at most N times per second (see pipeline::setRouteFrequency).
+ */
+#define PIPELINE_ROUTE_COMMAND_NAME "pipeline_route"
+
+bool isPipelineRouteCommand(openxc_SimpleMessage* message);
+
+bool handlePipelineRouteCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __PIPELINE_ROUTE_COMMAND_H__
@@ -4,6 +4,7 @@
 
 #include "config.h"
 #include "util/log.h"
+#include "util/wall_clock.h"
 #ifdef RTC_SUPPORT
 #include "rtc.h"
 #endif
@@ -32,6 +33,9 @@ bool openxc::commands::handleRTCConfigurationCommand(openxc_ControlCommand* comm
             uint32_t new_unix_time =
               rtcConfigurationCommand->unix_time;            
             status = RTC_SetTimeUnix(new_unix_time);
+            if(status) {
+                openxc::util::wallclock::setFromSeconds(new_unix_time);
+            }
 #endif                
         }
     }
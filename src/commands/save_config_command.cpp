@@ -0,0 +1,32 @@
+#include "save_config_command.h"
+
+#include "saved_config.h"
+#include "util/log.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+
+namespace config = openxc::config;
+
+bool openxc::commands::isSaveConfigCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SAVE_CONFIG_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSaveConfigCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Save config command is missing \"save\" or \"clear\"");
+        return false;
+    }
+
+    const char* value = message->value.string_value;
+    if(!strcmp(value, "save")) {
+        return config::saveConfiguration();
+    } else if(!strcmp(value, "clear")) {
+        return config::clearSavedConfiguration();
+    }
+    debug("Unknown save config action %s", value);
+    return false;
+}
@@ -0,0 +1,28 @@
+#ifndef __SAVE_CONFIG_COMMAND_H__
+#define __SAVE_CONFIG_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that saves the runtime configuration
+ * to flash, to be applied again at startup (see config::saveConfiguration):
+ *
+ *      {"name": "save_config", "value": "save"}
+ *
+ * value - "save" to save the payload format, the passthrough and acceptance
+ *      filter bypass settings of each bus, whether the automatic OBD-II
+ *      requests are on and the recurring diagnostic requests added by
+ *      commands, or "clear" to erase what was saved.
+ */
+#define SAVE_CONFIG_COMMAND_NAME "save_config"
+
+bool isSaveConfigCommand(openxc_SimpleMessage* message);
+
+bool handleSaveConfigCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SAVE_CONFIG_COMMAND_H__
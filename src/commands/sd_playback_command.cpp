@@ -0,0 +1,40 @@
+#include "sd_playback_command.h"
+
+#include "config.h"
+#include "data_emulator.h"
+#include "util/log.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+namespace emulator = openxc::emulator;
+
+bool openxc::commands::isSdPlaybackCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SD_PLAYBACK_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSdPlaybackCommand(openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            (message->value.type != openxc_DynamicField_Type_STRING &&
+             (message->value.type != openxc_DynamicField_Type_BOOL ||
+              message->value.boolean_value)) ||
+            (message->has_event &&
+             (message->event.type != openxc_DynamicField_Type_NUM ||
+              message->event.numeric_value < 0))) {
+        debug("SD playback request must have a file name or false, and "
+                "optionally a speed");
+        return false;
+    }
+
+    if(message->value.type == openxc_DynamicField_Type_BOOL) {
+        emulator::stopPlayback();
+        return true;
+    }
+
+    unsigned int speed = message->has_event ?
+            (unsigned int) message->event.numeric_value : 100;
+    return emulator::startPlayback(getConfiguration()->fs,
+            message->value.string_value, speed);
+}
@@ -0,0 +1,31 @@
+#ifndef __SD_PLAYBACK_COMMAND_H__
+#define __SD_PLAYBACK_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that plays back a raw CAN log from
+ * the SD card into the CAN receive queues, as if the frames were arriving from
+ * the vehicle, e.g.
+ *
+ *      {"name": "sd_playback", "value": "5A3B1C00.TXT", "event": 100}
+ *
+ * value - the name of a raw CAN log file, or false to stop playing back.
+ * event - optional, the speed as a percentage of the rate the frames were
+ *      logged at, 100 if not given. 0 plays them back as fast as they can be
+ *      received.
+ *
+ * See openxc::emulator::startPlayback.
+ */
+#define SD_PLAYBACK_COMMAND_NAME "sd_playback"
+
+bool isSdPlaybackCommand(openxc_SimpleMessage* message);
+
+bool handleSdPlaybackCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SD_PLAYBACK_COMMAND_H__
@@ -0,0 +1,48 @@
+#include "sd_stream_command.h"
+
+#include "config.h"
+#include "interface/fs.h"
+#include "util/log.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+namespace fs = openxc::interface::fs;
+
+bool openxc::commands::isSdStreamCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SD_STREAM_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSdStreamCommand(openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            (message->value.type != openxc_DynamicField_Type_STRING &&
+             message->value.type != openxc_DynamicField_Type_BOOL) ||
+            (message->has_event &&
+             (message->event.type != openxc_DynamicField_Type_NUM ||
+              message->event.numeric_value < 0))) {
+        debug("SD stream request must have a file name, true or false, and "
+                "optionally an offset");
+        return false;
+    }
+
+#ifdef FS_SUPPORT
+    if(message->value.type == openxc_DynamicField_Type_BOOL &&
+            !message->value.boolean_value) {
+        fs::stopStream(getConfiguration()->fs);
+        return true;
+    }
+
+    int32_t offset = message->has_event ?
+            (int32_t) message->event.numeric_value : -1;
+    if(message->value.type == openxc_DynamicField_Type_STRING) {
+        return fs::startStream(getConfiguration()->fs,
+                message->value.string_value, offset < 0 ? 0 : offset);
+    }
+    return fs::startStream(getConfiguration()->fs, NULL, offset);
+#else
+    debug("Built without MSD_ENABLE, can't stream the SD card");
+    return false;
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef __SD_STREAM_COMMAND_H__
+#define __SD_STREAM_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that streams a log file off the SD
+ * card over the USB file endpoint, while logging carries on, e.g.
+ *
+ *      {"name": "sd_stream", "value": "5A3B1C00.TXT", "event": 4096}
+ *
+ * value - the name of a log file, true for the file being written now, or
+ *      false to stop streaming.
+ * event - optional, the offset in the file to start at. Without it a named
+ *      file is sent from the start, and the file being written now from its
+ *      end, so only what's logged from then on is sent.
+ *
+ * When the stream is done, a message with the same name is published, with
+ * the file's name as the value and the offset it stopped at as the event.
+ *
+ * See openxc::interface::fs::startStream.
+ */
+#define SD_STREAM_COMMAND_NAME "sd_stream"
+
+bool isSdStreamCommand(openxc_SimpleMessage* message);
+
+bool handleSdStreamCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SD_STREAM_COMMAND_H__
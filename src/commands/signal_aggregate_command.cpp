@@ -0,0 +1,46 @@
+#include "signal_aggregate_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include "can/canread.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
+
+bool openxc::commands::isSignalAggregateCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SIGNAL_AGGREGATE_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSignalAggregateCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Aggregate command is missing a signal name");
+        return false;
+    }
+
+    CanSignal* signal = lookupSignal(message->value.string_value,
+            getSignals(), getSignalCount());
+    if(signal == NULL) {
+        debug("Can't aggregate unknown signal %s",
+                message->value.string_value);
+        return false;
+    }
+
+    unsigned long windowMs = 0;
+    if(message->has_event) {
+        if(message->event.type != openxc_DynamicField_Type_NUM ||
+                message->event.numeric_value < 0) {
+            debug("Aggregation window for %s must be a number of ms",
+                    signal->genericName);
+            return false;
+        }
+        windowMs = message->event.numeric_value;
+    }
+    return openxc::can::read::setAggregation(signal, windowMs);
+}
@@ -0,0 +1,28 @@
+#ifndef __SIGNAL_AGGREGATE_COMMAND_H__
+#define __SIGNAL_AGGREGATE_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that aggregates a signal's values over
+ * fixed windows, e.g.
+ *
+ *      {"name": "signal_aggregate", "value": "vehicle_speed", "event": 1000}
+ *
+ * value - the name of the signal to aggregate.
+ * event - the window length in milliseconds (see
+ *      openxc::can::read::setAggregation). 0, or leaving out the event, goes
+ *      back to publishing every value.
+ */
+#define SIGNAL_AGGREGATE_COMMAND_NAME "signal_aggregate"
+
+bool isSignalAggregateCommand(openxc_SimpleMessage* message);
+
+bool handleSignalAggregateCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SIGNAL_AGGREGATE_COMMAND_H__
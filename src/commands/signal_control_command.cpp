@@ -0,0 +1,71 @@
+#include "signal_control_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+
+/* Private: Returns true if the signal is selected by the command's value - its
+ * exact name, or a prefix followed by '*'.
+ */
+static bool matchesSignal(const char* pattern, const CanSignal* signal) {
+    size_t length = strlen(pattern);
+    if(length > 0 && pattern[length - 1] == '*') {
+        return !strncmp(signal->genericName, pattern, length - 1);
+    }
+    return !strcmp(signal->genericName, pattern);
+}
+
+bool openxc::commands::isSignalControlCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SIGNAL_CONTROL_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSignalControlCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Signal control command is missing a signal name");
+        return false;
+    }
+
+    if(!message->has_event || (message->event.type !=
+                openxc_DynamicField_Type_BOOL &&
+            (message->event.type != openxc_DynamicField_Type_NUM ||
+                message->event.numeric_value < 0))) {
+        debug("Signal control for %s needs true, false or a frequency",
+                message->value.string_value);
+        return false;
+    }
+
+    int matched = 0;
+    CanSignal* signals = getSignals();
+    for(int i = 0; i < getSignalCount(); i++) {
+        CanSignal* signal = &signals[i];
+        if(!matchesSignal(message->value.string_value, signal)) {
+            continue;
+        }
+
+        if(message->event.type == openxc_DynamicField_Type_BOOL) {
+            signal->disabled = !message->event.boolean_value;
+        } else {
+            // the clock recomputes its period when it sees the new frequency
+            signal->frequencyClock.frequency = message->event.numeric_value;
+        }
+        // let its message's next frame through, even if it's unchanged
+        signal->message->quietUntilMs = 0;
+        ++matched;
+    }
+
+    if(matched == 0) {
+        debug("No signals match %s", message->value.string_value);
+        return false;
+    }
+    debug("Updated %d signals matching %s", matched,
+            message->value.string_value);
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef __SIGNAL_CONTROL_COMMAND_H__
+#define __SIGNAL_CONTROL_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that turns signals on and off, or
+ * overrides their maximum frequency, e.g.
+ *
+ *      {"name": "signal_control", "value": "engine_*", "event": false}
+ *      {"name": "signal_control", "value": "vehicle_speed", "event": 2}
+ *
+ * value - the name of a signal, or a prefix ending in '*' for every signal
+ *      whose name starts with it ("*" alone is all of them).
+ * event - false to stop decoding the signals, true to decode them again, or a
+ *      number to set their maximum frequency in Hz, where 0 sends every value.
+ *
+ * The changes last until the VI is reset.
+ */
+#define SIGNAL_CONTROL_COMMAND_NAME "signal_control"
+
+bool isSignalControlCommand(openxc_SimpleMessage* message);
+
+bool handleSignalControlCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SIGNAL_CONTROL_COMMAND_H__
@@ -0,0 +1,54 @@
+#include "signal_definitions_command.h"
+
+#include "signal_loader.h"
+#include "util/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+
+namespace loader = openxc::signals::loader;
+
+bool openxc::commands::isSignalDefinitionsCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, SIGNAL_DEFINITIONS_COMMAND_NAME);
+}
+
+bool openxc::commands::handleSignalDefinitionsCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Signal definitions must be sent as a hex string");
+        return false;
+    }
+
+    size_t offset = 0;
+    if(message->has_event) {
+        if(message->event.type != openxc_DynamicField_Type_NUM ||
+                message->event.numeric_value < 0) {
+            debug("Signal definitions offset must be a number");
+            return false;
+        }
+        offset = (size_t) message->event.numeric_value;
+    }
+
+    const char* text = message->value.string_value;
+    size_t digits = strlen(text);
+    uint8_t data[sizeof(message->value.string_value) / 2];
+    if(digits == 0 || digits % 2 != 0) {
+        debug("Signal definitions must be sent as a hex string");
+        return false;
+    }
+
+    for(size_t i = 0; i < digits / 2; i++) {
+        char byte[3] = {text[i * 2], text[i * 2 + 1], '\0'};
+        char* end = NULL;
+        data[i] = (uint8_t) strtoul(byte, &end, 16);
+        if(*end != '\0') {
+            debug("Signal definitions must be sent as a hex string");
+            return false;
+        }
+    }
+    return loader::receive(offset, data, digits / 2);
+}
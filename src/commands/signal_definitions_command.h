@@ -0,0 +1,32 @@
+#ifndef __SIGNAL_DEFINITIONS_COMMAND_H__
+#define __SIGNAL_DEFINITIONS_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that sends the VI a signal
+ * definitions image (see SIGNAL_DEFINITIONS_MAGIC) to decode with, in place of
+ * the compiled in definitions. The image is sent in order, as many chunks as
+ * fit in a message:
+ *
+ *      {"name": "signal_definitions", "value": "4f58534401000100...",
+ *          "event": 0}
+ *
+ * value - the next bytes of the image, as a hex string.
+ * event - the offset of those bytes in the image. 0 starts a new image.
+ *
+ * The definitions are loaded when the last chunk arrives, and the response to
+ * that command says whether they could be loaded.
+ */
+#define SIGNAL_DEFINITIONS_COMMAND_NAME "signal_definitions"
+
+bool isSignalDefinitionsCommand(openxc_SimpleMessage* message);
+
+bool handleSignalDefinitionsCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SIGNAL_DEFINITIONS_COMMAND_H__
@@ -0,0 +1,40 @@
+#include "signal_dictionary_command.h"
+
+#include "config.h"
+#include "util/log.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "can/canread.h"
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+
+namespace pipeline = openxc::pipeline;
+
+bool openxc::commands::isSignalDictionaryCommand(
+        openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, NAME_DICTIONARY_MESSAGE_NAME);
+}
+
+bool openxc::commands::handleSignalDictionaryCommand(
+        openxc_SimpleMessage* message) {
+    if(message->has_value) {
+        if(message->value.type != openxc_DynamicField_Type_BOOL) {
+            debug("Signal dictionary request must be a boolean");
+            return false;
+        }
+
+        pipeline::setNameDictionary(message->value.boolean_value);
+        if(!message->value.boolean_value) {
+            return true;
+        }
+    }
+
+    openxc::can::read::publishNameDictionary(getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef __SIGNAL_DICTIONARY_COMMAND_H__
+#define __SIGNAL_DICTIONARY_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The simple message that requests the signal name dictionary, e.g.
+ *
+ *      {"name": "signal_dictionary", "value": true}
+ *
+ * value - true to publish signals by ID from now on, false to go back to
+ *      publishing them by name. The dictionary is published (see
+ *      openxc::can::read::publishNameDictionary) unless the value is false, and
+ *      leaving the value out publishes it again without changing the mode.
+ *
+ * The request shares its name with the dictionary messages the VI sends back.
+ */
+bool isSignalDictionaryCommand(openxc_SimpleMessage* message);
+
+bool handleSignalDictionaryCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SIGNAL_DICTIONARY_COMMAND_H__
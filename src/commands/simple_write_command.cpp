@@ -1,4 +1,30 @@
 #include "simple_write_command.h"
+#include "pipeline_route_command.h"
+#include "signal_dictionary_command.h"
+#include "latest_values_command.h"
+#include "signal_aggregate_command.h"
+#include "write_signals_command.h"
+#include "periodic_write_command.h"
+#include "command_batch_command.h"
+#include "write_ack_command.h"
+#include "passthrough_ids_command.h"
+#include "can_gateway_command.h"
+#include "diagnostic_flow_control_command.h"
+#include "metrics_command.h"
+#include "ble_connection_command.h"
+#include "message_set_command.h"
+#include "signal_definitions_command.h"
+#include "can_capture_command.h"
+#include "save_config_command.h"
+#include "time_sync_command.h"
+#include "signal_control_command.h"
+#include "log_level_command.h"
+#include "decode_profile_command.h"
+#include "can_survey_command.h"
+#include "can_self_test_command.h"
+#include "af_learn_command.h"
+#include "sd_stream_command.h"
+#include "sd_playback_command.h"
 
 #include "config.h"
 #include "diagnostics.h"
@@ -37,7 +63,74 @@ bool openxc::commands::handleSimple(openxc_VehicleMessage* message) {
     if(message->has_simple_message) {
         openxc_SimpleMessage* simpleMessage =
                 &message->simple_message;
-        if(simpleMessage->has_name) {
+        if(openxc::commands::isPipelineRouteCommand(simpleMessage)) {
+            status = openxc::commands::handlePipelineRouteCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isSignalDictionaryCommand(simpleMessage)) {
+            status = openxc::commands::handleSignalDictionaryCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isLatestValuesCommand(simpleMessage)) {
+            status = openxc::commands::handleLatestValuesCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isSignalAggregateCommand(simpleMessage)) {
+            status = openxc::commands::handleSignalAggregateCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isWriteSignalsCommand(simpleMessage)) {
+            status = openxc::commands::handleWriteSignalsCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isPeriodicWriteCommand(simpleMessage)) {
+            status = openxc::commands::handlePeriodicWriteCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isCommandBatchCommand(simpleMessage)) {
+            status = openxc::commands::handleCommandBatchCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isWriteAckCommand(simpleMessage)) {
+            status = openxc::commands::handleWriteAckCommand(simpleMessage);
+        } else if(openxc::commands::isPassthroughIdsCommand(simpleMessage)) {
+            status = openxc::commands::handlePassthroughIdsCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isCanGatewayCommand(simpleMessage)) {
+            status = openxc::commands::handleCanGatewayCommand(simpleMessage);
+        } else if(openxc::commands::isDiagnosticFlowControlCommand(
+                    simpleMessage)) {
+            status = openxc::commands::handleDiagnosticFlowControlCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isMetricsCommand(simpleMessage)) {
+            status = openxc::commands::handleMetricsCommand(simpleMessage);
+        } else if(openxc::commands::isBleConnectionCommand(simpleMessage)) {
+            status = openxc::commands::handleBleConnectionCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isMessageSetCommand(simpleMessage)) {
+            status = openxc::commands::handleMessageSetCommand(simpleMessage);
+        } else if(openxc::commands::isSignalDefinitionsCommand(
+                    simpleMessage)) {
+            status = openxc::commands::handleSignalDefinitionsCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isCanCaptureCommand(simpleMessage)) {
+            status = openxc::commands::handleCanCaptureCommand(simpleMessage);
+        } else if(openxc::commands::isSaveConfigCommand(simpleMessage)) {
+            status = openxc::commands::handleSaveConfigCommand(simpleMessage);
+        } else if(openxc::commands::isTimeSyncCommand(simpleMessage)) {
+            status = openxc::commands::handleTimeSyncCommand(simpleMessage);
+        } else if(openxc::commands::isSignalControlCommand(simpleMessage)) {
+            status = openxc::commands::handleSignalControlCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isLogLevelCommand(simpleMessage)) {
+            status = openxc::commands::handleLogLevelCommand(simpleMessage);
+        } else if(openxc::commands::isDecodeProfileCommand(simpleMessage)) {
+            status = openxc::commands::handleDecodeProfileCommand(
+                    simpleMessage);
+        } else if(openxc::commands::isCanSurveyCommand(simpleMessage)) {
+            status = openxc::commands::handleCanSurveyCommand(simpleMessage);
+        } else if(openxc::commands::isCanSelfTestCommand(simpleMessage)) {
+            status = openxc::commands::handleCanSelfTestCommand(simpleMessage);
+        } else if(openxc::commands::isFilterLearnCommand(simpleMessage)) {
+            status = openxc::commands::handleFilterLearnCommand(simpleMessage);
+        } else if(openxc::commands::isSdStreamCommand(simpleMessage)) {
+            status = openxc::commands::handleSdStreamCommand(simpleMessage);
+        } else if(openxc::commands::isSdPlaybackCommand(simpleMessage)) {
+            status = openxc::commands::handleSdPlaybackCommand(simpleMessage);
+        } else if(simpleMessage->has_name) {
             CanSignal* signal = lookupSignal(simpleMessage->name,
                     getSignals(), getSignalCount(), true);
             if(signal != NULL) {
@@ -46,7 +139,10 @@ bool openxc::commands::handleSimple(openxc_VehicleMessage* message) {
                     status = false;
                 }
 
-                can::write::encodeAndSendSignal(signal, &simpleMessage->value, false);
+                if(!can::write::encodeAndSendSignal(signal,
+                            &simpleMessage->value, false)) {
+                    status = false;
+                }
                 // TODO support writing evented signals
             } else {
                 CanCommand* command = lookupCommand(simpleMessage->name,
@@ -68,6 +164,7 @@ bool openxc::commands::handleSimple(openxc_VehicleMessage* message) {
                     status = false;
                 }
             }
+            openxc::commands::recordWriteStatus(status);
         }
     }
     return status;
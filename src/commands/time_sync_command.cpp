@@ -0,0 +1,91 @@
+#include "time_sync_command.h"
+
+#include "config.h"
+#include "pipeline.h"
+#include "platform_profile.h"
+#include "util/log.h"
+#include "util/wall_clock.h"
+#include <payload/payload.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef RTC_SUPPORT
+#include "platform/pic32/rtc.h"
+#endif
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+namespace pipeline = openxc::pipeline;
+namespace payload = openxc::payload;
+namespace wallclock = openxc::util::wallclock;
+
+// The request the VI last answered, waiting for the host to say when the
+// answer arrived
+static uint64_t pendingHostSentUs;
+static uint64_t pendingReceivedUs;
+static uint64_t pendingSentUs;
+static bool pending;
+
+/* Private: Parse a time in microseconds from a string field.
+ *
+ * Returns true if the field held a time.
+ */
+static bool parseTime(openxc_DynamicField* field, uint64_t* timeUs) {
+    if(field->type != openxc_DynamicField_Type_STRING) {
+        return false;
+    }
+    char* end;
+    *timeUs = strtoull(field->string_value, &end, 10);
+    return end != field->string_value && *end == '\0';
+}
+
+bool openxc::commands::isTimeSyncCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, TIME_SYNC_COMMAND_NAME);
+}
+
+bool openxc::commands::handleTimeSyncCommand(openxc_SimpleMessage* message) {
+    uint64_t receivedUs = wallclock::localTimeUs();
+    uint64_t hostSentUs;
+    if(!message->has_value || !parseTime(&message->value, &hostSentUs)) {
+        debug("Time sync command is missing the host's time");
+        return false;
+    }
+
+    if(!message->has_event) {
+        openxc_DynamicField echo = payload::wrapString(
+                message->value.string_value);
+        pipeline::publishSimple(TIME_SYNC_COMMAND_NAME, &echo, NULL,
+                &getConfiguration()->pipeline);
+        pendingHostSentUs = hostSentUs;
+        pendingReceivedUs = receivedUs;
+        pendingSentUs = wallclock::localTimeUs();
+        pending = true;
+        return true;
+    }
+
+    uint64_t hostReceivedUs;
+    if(!parseTime(&message->event, &hostReceivedUs)) {
+        debug("Time sync command has a bad arrival time");
+        return false;
+    }
+    if(!pending || hostSentUs != pendingHostSentUs) {
+        debug("Time sync doesn't match the last request, ignoring it");
+        return false;
+    }
+
+    pending = false;
+    if(!wallclock::synchronize(pendingHostSentUs, pendingReceivedUs,
+                pendingSentUs, hostReceivedUs)) {
+        return false;
+    }
+
+    #ifdef RTC_SUPPORT
+    // So the RTC starts out closer after a reset
+    uint64_t timeUs;
+    if(wallclock::now(&timeUs)) {
+        RTC_SetTimeUnix(timeUs / 1000000);
+    }
+    #endif
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef __TIME_SYNC_COMMAND_H__
+#define __TIME_SYNC_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that syncs the VI's clock with the
+ * host's (see util::wallclock::synchronize). Times are microseconds since the
+ * Unix epoch, as strings since a float would lose the microseconds. The host
+ * sends its time:
+ *
+ *      {"name": "time_sync", "value": "1760000000123456"}
+ *
+ * and the VI echoes it back straight away. When the echo arrives, the host
+ * sends both its original time and when the echo arrived:
+ *
+ *      {"name": "time_sync", "value": "1760000000123456",
+ *          "event": "1760000000161007"}
+ *
+ * and the VI sets its clock from the exchange. Only the last request is
+ * remembered, and a host can skip the second step for an exchange that took
+ * too long to be accurate.
+ */
+#define TIME_SYNC_COMMAND_NAME "time_sync"
+
+bool isTimeSyncCommand(openxc_SimpleMessage* message);
+
+bool handleTimeSyncCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __TIME_SYNC_COMMAND_H__
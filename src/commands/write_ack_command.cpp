@@ -0,0 +1,93 @@
+#include "write_ack_command.h"
+
+#include "config.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include "pipeline.h"
+#include <payload/payload.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+
+namespace payload = openxc::payload;
+namespace pipeline = openxc::pipeline;
+namespace time = openxc::util::time;
+
+static int windowSize = 0;
+static unsigned long intervalMs = WRITE_ACK_DEFAULT_INTERVAL_MS;
+static uint32_t writeCount = 0;
+static int windowItemCount = 0;
+static unsigned long windowStartMs = 0;
+static char windowStatuses[WRITE_ACK_MAX_ITEMS + 1];
+
+static void sendAck() {
+    if(windowItemCount == 0) {
+        return;
+    }
+
+    openxc_DynamicField last = payload::wrapNumber(writeCount);
+    openxc_DynamicField statuses = payload::wrapString(windowStatuses);
+    pipeline::publishSimple(WRITE_ACK_COMMAND_NAME, &last, &statuses,
+            &getConfiguration()->pipeline);
+    windowItemCount = 0;
+    windowStatuses[0] = '\0';
+}
+
+bool openxc::commands::isWriteAckCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, WRITE_ACK_COMMAND_NAME);
+}
+
+void openxc::commands::recordWriteStatus(bool status) {
+    if(windowSize == 0) {
+        return;
+    }
+
+    if(windowItemCount == 0) {
+        windowStartMs = time::systemTimeMs();
+    }
+    windowStatuses[windowItemCount] = status ? '1' : '0';
+    windowStatuses[++windowItemCount] = '\0';
+    ++writeCount;
+    if(windowItemCount >= windowSize) {
+        sendAck();
+    }
+}
+
+void openxc::commands::updateWriteAcks() {
+    if(windowItemCount > 0 &&
+            time::systemTimeMs() - windowStartMs >= intervalMs) {
+        sendAck();
+    }
+}
+
+bool openxc::commands::handleWriteAckCommand(openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_NUM ||
+            message->value.numeric_value < 0 ||
+            message->value.numeric_value > WRITE_ACK_MAX_ITEMS) {
+        debug("Write acknowledgement window must be 0 to %d writes",
+                WRITE_ACK_MAX_ITEMS);
+        return false;
+    }
+
+    unsigned long interval = WRITE_ACK_DEFAULT_INTERVAL_MS;
+    if(message->has_event) {
+        if(message->event.type != openxc_DynamicField_Type_NUM ||
+                message->event.numeric_value < 0) {
+            debug("Write acknowledgement interval must be a number of ms");
+            return false;
+        }
+        interval = message->event.numeric_value;
+    }
+
+    // Acknowledge what's been written under the old settings first
+    sendAck();
+    if(windowSize == 0) {
+        writeCount = 0;
+    }
+    windowSize = message->value.numeric_value;
+    intervalMs = interval;
+    return true;
+}
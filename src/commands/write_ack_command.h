@@ -0,0 +1,64 @@
+#ifndef __WRITE_ACK_COMMAND_H__
+#define __WRITE_ACK_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that has the VI acknowledge writes -
+ * raw CAN messages, and signal and custom command writes by name, which get no
+ * response of their own - a window at a time instead of one by one. A host
+ * driving a signal at a high rate then learns which writes failed without a
+ * response per write competing with the vehicle data:
+ *
+ *      {"name": "write_acks", "value": 16, "event": 100}
+ *
+ * value - the most writes in a window, up to WRITE_ACK_MAX_ITEMS, or 0 to stop
+ *      acknowledging writes.
+ * event - the most milliseconds the first write of a window waits for its
+ *      acknowledgement, WRITE_ACK_DEFAULT_INTERVAL_MS if left out.
+ *
+ * Writes are numbered from 1 as they arrive, starting when acknowledgements are
+ * turned on. Each window is acknowledged with:
+ *
+ *      {"name": "write_acks", "value": 48, "event": "1111111111101111"}
+ *
+ * where the value is the number of the window's last write, and the event has a
+ * 1 or 0 for the status of each write in it, oldest first. A malformed write
+ * counts as failed.
+ */
+#define WRITE_ACK_COMMAND_NAME "write_acks"
+
+// The most writes acknowledged at once.
+#ifndef WRITE_ACK_MAX_ITEMS
+#define WRITE_ACK_MAX_ITEMS 64
+#endif
+
+// How long the first write of a window waits for its acknowledgement if the
+// write_acks command doesn't say.
+#ifndef WRITE_ACK_DEFAULT_INTERVAL_MS
+#define WRITE_ACK_DEFAULT_INTERVAL_MS 100
+#endif
+
+bool isWriteAckCommand(openxc_SimpleMessage* message);
+
+bool handleWriteAckCommand(openxc_SimpleMessage* message);
+
+/* Public: Add the status of one write to the window being acknowledged, if
+ * writes are being acknowledged, and send the acknowledgement once the window
+ * is full.
+ *
+ * status - true if the write was successful.
+ */
+void recordWriteStatus(bool status);
+
+/* Public: Send the acknowledgement of the window in progress once its first
+ * write has waited long enough. Call this from the main loop.
+ */
+void updateWriteAcks();
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __WRITE_ACK_COMMAND_H__
@@ -0,0 +1,88 @@
+#include "write_signals_command.h"
+
+#include "util/log.h"
+#include "signals.h"
+#include "can/canwrite.h"
+#include <stdlib.h>
+#include <string.h>
+
+using openxc::util::log::debug;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
+using openxc::can::write::CanWriteTransaction;
+
+namespace write = openxc::can::write;
+
+/* Private: Fill a dynamic field from the text of one signal value - a boolean
+ * for "true" or "false", a number if the whole value parses as one and
+ * otherwise a state name.
+ */
+static void parseValue(const char* text, openxc_DynamicField* field) {
+    memset(field, 0, sizeof(openxc_DynamicField));
+    field->has_type = true;
+    char* end = NULL;
+    float number = strtof(text, &end);
+    if(!strcmp(text, "true") || !strcmp(text, "false")) {
+        field->type = openxc_DynamicField_Type_BOOL;
+        field->has_boolean_value = true;
+        field->boolean_value = !strcmp(text, "true");
+    } else if(end != text && *end == '\0') {
+        field->type = openxc_DynamicField_Type_NUM;
+        field->has_numeric_value = true;
+        field->numeric_value = number;
+    } else {
+        field->type = openxc_DynamicField_Type_STRING;
+        field->has_string_value = true;
+        strncpy(field->string_value, text, sizeof(field->string_value) - 1);
+    }
+}
+
+bool openxc::commands::isWriteSignalsCommand(openxc_SimpleMessage* message) {
+    return message->has_name &&
+            !strcmp(message->name, WRITE_SIGNALS_COMMAND_NAME);
+}
+
+bool openxc::commands::handleWriteSignalsCommand(
+        openxc_SimpleMessage* message) {
+    if(!message->has_value ||
+            message->value.type != openxc_DynamicField_Type_STRING) {
+        debug("Write signals request must be a list of signal=value pairs");
+        return false;
+    }
+
+    CanWriteTransaction transaction;
+    bool started = false;
+    char pairs[sizeof(message->value.string_value)];
+    strncpy(pairs, message->value.string_value, sizeof(pairs) - 1);
+    pairs[sizeof(pairs) - 1] = '\0';
+    for(char* token = strtok(pairs, ", "); token != NULL;
+            token = strtok(NULL, ", ")) {
+        char* value = strchr(token, '=');
+        if(value == NULL) {
+            debug("Missing value for %s in write signals request", token);
+            return false;
+        }
+        *value++ = '\0';
+
+        CanSignal* signal = lookupSignal(token, getSignals(), getSignalCount(),
+                true);
+        if(signal == NULL) {
+            debug("Can't write unknown or read-only signal %s", token);
+            return false;
+        }
+
+        if(!started) {
+            write::beginTransaction(&transaction, signal->message, false);
+            started = true;
+        }
+
+        openxc_DynamicField field;
+        parseValue(value, &field);
+        if(!write::addSignal(&transaction, signal, &field)) {
+            return false;
+        }
+    }
+
+    return started && write::commitTransaction(&transaction);
+}
@@ -0,0 +1,32 @@
+#ifndef __WRITE_SIGNALS_COMMAND_H__
+#define __WRITE_SIGNALS_COMMAND_H__
+
+#include "openxc.pb.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: The name of the simple message that writes several signals from the
+ * same CAN message in a single frame, e.g.
+ *
+ *      {"name": "write_signals",
+ *          "value": "headlamp_status=true,wiper_speed=3,gear=reverse"}
+ *
+ * value - a comma-separated list of signal=value pairs. A value of "true" or
+ *      "false" is written as a boolean, one that's a number as a number and
+ *      anything else as a state.
+ *
+ * All of the signals must be writable and in the same message. If any of them
+ * isn't, or a value can't be encoded, nothing is written (see
+ * openxc::can::write::CanWriteTransaction).
+ */
+#define WRITE_SIGNALS_COMMAND_NAME "write_signals"
+
+bool isWriteSignalsCommand(openxc_SimpleMessage* message);
+
+bool handleWriteSignalsCommand(openxc_SimpleMessage* message);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __WRITE_SIGNALS_COMMAND_H__
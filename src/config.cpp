@@ -1,6 +1,11 @@
 #include "config.h"
 #include "signals.h"
 #include "md5.h"
+#include "util/log.h"
+#include "util/timer.h"
+#ifdef TELIT_HE910_SUPPORT
+#include "platform/pic32/nvm.h"
+#endif
 
 using openxc::pipeline::Pipeline;
 using openxc::interface::uart::UartDevice;
@@ -11,12 +16,65 @@ namespace ble = openxc::interface::ble;
 namespace fs =  openxc::interface::fs;
 namespace telit = openxc::telitHE910;
 namespace signals = openxc::signals;
+namespace time = openxc::util::time;
+namespace nvm = openxc::nvm;
+
+using openxc::util::log::debug;
 
+// Each interface's byte queues are sized for what they carry - see the
+// *_QUEUE_SIZE options - instead of all sharing one size.
+static BYTE_QUEUE_STORAGE(usbSendQueue, USB_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(usbReceiveQueue, USB_RECEIVE_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(usbLogQueue, USB_LOG_QUEUE_SIZE);
+#ifdef FS_SUPPORT
+static BYTE_QUEUE_STORAGE(usbFileQueue, USB_FILE_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(fsSendQueue, FS_SEND_QUEUE_SIZE);
+#endif
+static BYTE_QUEUE_STORAGE(uartSendQueue, UART_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(uartReceiveQueue, UART_RECEIVE_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(networkSendQueue, NETWORK_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(networkReceiveQueue, NETWORK_RECEIVE_QUEUE_SIZE);
+#ifdef BLE_SUPPORT
+static BYTE_QUEUE_STORAGE(bleSendQueue, BLE_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(bleReceiveQueue, BLE_RECEIVE_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(bleChannelQueues[BLE_CHANNEL_COUNT],
+        BLE_CHANNEL_QUEUE_SIZE);
+#endif
 #ifdef TELIT_HE910_SUPPORT
-static void getFlashHash(openxc::config::Configuration* config);
+static BYTE_QUEUE_STORAGE(telitSendQueue, TELIT_SEND_QUEUE_SIZE);
 #endif
 
+static void initializeQueues(openxc::config::Configuration* config) {
+    BYTE_QUEUE_INIT(&config->usb.endpoints[IN_ENDPOINT_INDEX].queue,
+            usbSendQueue);
+    BYTE_QUEUE_INIT(&config->usb.endpoints[OUT_ENDPOINT_INDEX].queue,
+            usbReceiveQueue);
+    BYTE_QUEUE_INIT(&config->usb.endpoints[LOG_ENDPOINT_INDEX].queue,
+            usbLogQueue);
+#ifdef FS_SUPPORT
+    BYTE_QUEUE_INIT(&config->usb.endpoints[FILE_ENDPOINT_INDEX].queue,
+            usbFileQueue);
+    BYTE_QUEUE_INIT(&config->fs->sendQueue, fsSendQueue);
+#endif
+    BYTE_QUEUE_INIT(&config->uart.sendQueue, uartSendQueue);
+    BYTE_QUEUE_INIT(&config->uart.receiveQueue, uartReceiveQueue);
+    BYTE_QUEUE_INIT(&config->network.sendQueue, networkSendQueue);
+    BYTE_QUEUE_INIT(&config->network.receiveQueue, networkReceiveQueue);
+#ifdef BLE_SUPPORT
+    BYTE_QUEUE_INIT(&config->ble->sendQueue, bleSendQueue);
+    BYTE_QUEUE_INIT(&config->ble->receiveQueue, bleReceiveQueue);
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++) {
+        BYTE_QUEUE_INIT(&config->ble->channels[i].sendQueue,
+                bleChannelQueues[i]);
+    }
+#endif
+#ifdef TELIT_HE910_SUPPORT
+    BYTE_QUEUE_INIT(&config->telit->sendQueue, telitSendQueue);
+#endif
+}
+
 static void initialize(openxc::config::Configuration* config) {
+    initializeQueues(config);
     config->pipeline = {
         &config->usb,
         &config->uart,
@@ -34,10 +92,6 @@ static void initialize(openxc::config::Configuration* config) {
 #endif // __USE_NETWORK__
     };
     #ifdef TELIT_HE910_SUPPORT
-    // run flashHash
-    getFlashHash(config);
-    #endif
-    #ifdef TELIT_HE910_SUPPORT
     config->telit->uart = &config->uart;
     #endif
     config->initialized = true;
@@ -60,6 +114,9 @@ ble::BleDevice bleDevice = {
         adv_max_ms: 100,
         slave_min_ms : 8, //range 0x0006 to 0x0C80
         slave_max_ms : 16,
+        slave_latency : 4, //connection events the VI may skip while idle
+        fast_min_ms : 6,
+        fast_max_ms : 12,
     }
 };        
 #endif
@@ -107,7 +164,7 @@ openxc::telitHE910::TelitDevice telitDevice = {
         },
         serverConnectSettings: {
             "openxcserverdemo.azurewebsites.net",
-            port: 80
+            port: DEFAULT_SERVER_TLS ? 443 : 80
         }
     }
 };
@@ -123,10 +180,14 @@ openxc::config::Configuration* openxc::config::getConfiguration() {
         environmentMode: ENVIRONMENT_MODE,
         payloadFormat: PayloadFormat::DEFAULT_OUTPUT_FORMAT,
         recurringObd2Requests: DEFAULT_RECURRING_OBD2_REQUESTS_STATUS,
+        adaptiveObd2Polling: DEFAULT_ADAPTIVE_OBD2_POLLING_STATUS,
+        passiveIgnitionCheck: DEFAULT_PASSIVE_IGNITION_CHECK_STATUS,
         obd2BusAddress: DEFAULT_OBD2_BUS,
         powerManagement: PowerManagement::DEFAULT_POWER_MANAGEMENT,
         sendCanAcks: DEFAULT_CAN_ACK_STATUS,
         emulatedData: DEFAULT_EMULATED_DATA_STATUS,
+        emulatedFrameRate: DEFAULT_EMULATED_FRAME_RATE,
+        emulatedUnknownIdPercent: DEFAULT_EMULATED_UNKNOWN_ID_PERCENT,
         loggingOutput: DEFAULT_LOGGING_OUTPUT,
         calculateMetrics: DEFAULT_METRICS_STATUS,
         desiredRunLevel: RunLevel::CAN_ONLY,
@@ -154,6 +215,10 @@ openxc::config::Configuration* openxc::config::getConfiguration() {
                     usb::UsbEndpointDirection::USB_ENDPOINT_DIRECTION_OUT},
                 {LOG_ENDPOINT_NUMBER, DATA_ENDPOINT_SIZE,
                     usb::UsbEndpointDirection::USB_ENDPOINT_DIRECTION_IN},
+                #ifdef FS_SUPPORT
+                {FILE_ENDPOINT_NUMBER, DATA_ENDPOINT_SIZE,
+                    usb::UsbEndpointDirection::USB_ENDPOINT_DIRECTION_IN},
+                #endif
             }
         },
         #ifdef BLE_SUPPORT
@@ -199,18 +264,107 @@ void openxc::config::getFirmwareDescriptor(char* buffer, size_t length) {
 }
 
 #ifdef TELIT_HE910_SUPPORT
-static void getFlashHash(openxc::config::Configuration* config) {
-    MD5_CTX md5Context;
-    unsigned char result[16];
-    MD5_Init(&md5Context);
-    MD5_Update(&md5Context, (const void*)0x9D001000, (unsigned long)0x2FC);
-    MD5_Update(&md5Context, (const void*)0x9D001348, (unsigned long)0x7DCB8);
-    MD5_Final(result, &md5Context);
-    sprintf(config->flashHash, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x", 
-    result[0], result[1], result[2], result[3],
-    result[4], result[5], result[6], result[7],
-    result[8], result[9], result[10], result[11],
-    result[12], result[13], result[14], result[15]);
+typedef struct {
+    uintptr_t start;
+    unsigned long length;
+} FlashRange;
+
+// The parts of the firmware image in flash that are hashed
+static const FlashRange FLASH_HASH_RANGES[] = {
+    {0x9D001000, 0x2FC},
+    {0x9D001348, 0x7DCB8},
+};
+
+static const int FLASH_HASH_RANGE_COUNT = sizeof(FLASH_HASH_RANGES) /
+        sizeof(FlashRange);
+
+typedef enum {
+    HASH_CHECKSUM,
+    HASH_MD5,
+    HASH_FINISHED,
+} FlashHashStage;
+
+static FlashHashStage hashStage = HASH_CHECKSUM;
+static int hashRange = 0;
+static unsigned long hashOffset = 0;
+static unsigned long lastHashChunkMs = 0;
+static uint32_t checksumLow = 0;
+static uint32_t checksumHigh = 0;
+static MD5_CTX md5Context;
+
+/* Private: Read the next chunk of the hashed ranges into the current stage,
+ * a Fletcher-style checksum over words or the MD5.
+ *
+ * Returns true once the last chunk has been read, ready for the next stage.
+ */
+static bool readFlashChunk() {
+    const FlashRange* range = &FLASH_HASH_RANGES[hashRange];
+    unsigned long length = MIN((unsigned long) FLASH_HASH_CHUNK_SIZE,
+            range->length - hashOffset);
+    const void* chunk = (const void*) (range->start + hashOffset);
+    if(hashStage == HASH_CHECKSUM) {
+        const uint32_t* words = (const uint32_t*) chunk;
+        for(unsigned long i = 0; i < length / 4; i++) {
+            checksumLow += words[i];
+            checksumHigh += checksumLow;
+        }
+    } else {
+        MD5_Update(&md5Context, chunk, length);
+    }
+
+    hashOffset += length;
+    if(hashOffset < range->length) {
+        return false;
+    }
+    hashOffset = 0;
+    if(++hashRange < FLASH_HASH_RANGE_COUNT) {
+        return false;
+    }
+    hashRange = 0;
+    return true;
+}
+
+bool openxc::config::hashFlash(bool idle) {
+    if(hashStage == HASH_FINISHED) {
+        return false;
+    }
+
+    if(!idle && time::uptimeMs() - lastHashChunkMs < FLASH_HASH_MAX_DEFER_MS) {
+        return true;
+    }
+    lastHashChunkMs = time::uptimeMs();
+
+    if(!readFlashChunk()) {
+        return true;
+    }
+
+    Configuration* config = getConfiguration();
+    uint32_t checksum = checksumLow ^
+            ((checksumHigh << 16) | (checksumHigh >> 16));
+    if(hashStage == HASH_CHECKSUM) {
+        if(nvm::loadFlashHash(checksum, config->flashHash,
+                    sizeof(config->flashHash))) {
+            debug("Using cached firmware hash %s", config->flashHash);
+            hashStage = HASH_FINISHED;
+        } else {
+            MD5_Init(&md5Context);
+            hashStage = HASH_MD5;
+        }
+    } else {
+        unsigned char result[16];
+        MD5_Final(result, &md5Context);
+        for(int i = 0; i < 16; i++) {
+            sprintf(&config->flashHash[i * 2], "%02x", result[i]);
+        }
+        nvm::storeFlashHash(checksum, config->flashHash);
+        debug("Firmware hash is %s", config->flashHash);
+        hashStage = HASH_FINISHED;
+    }
+    return hashStage != HASH_FINISHED;
+}
+#else
+bool openxc::config::hashFlash(bool idle) {
+    return false;
 }
 #endif
 
@@ -19,6 +19,20 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #endif
 
+/* Public: The most bytes of flash hashed by each call to hashFlash, to keep the
+ * firmware hash from holding up a pass of the main loop.
+ */
+#ifndef FLASH_HASH_CHUNK_SIZE
+#define FLASH_HASH_CHUNK_SIZE 1024
+#endif
+
+/* Public: How long hashFlash waits for an idle pass of the main loop before
+ * hashing a chunk anyway, so a busy VI still finishes the hash.
+ */
+#ifndef FLASH_HASH_MAX_DEFER_MS
+#define FLASH_HASH_MAX_DEFER_MS 100
+#endif
+
 namespace openxc {
 namespace config {
 
@@ -83,6 +97,15 @@ typedef enum {
  * recurringObd2Requests - True if the VI should automatically query for
  * supported OBD-II pids and request them at a pre-defined frequency (in the
  *      diagnostics::obd2 module).
+ * adaptiveObd2Polling - True if the automatic OBD-II requests should be sent
+ *      less often while their values are steady, and more often when they
+ *      change, within the bounds set for each PID in the diagnostics::obd2
+ *      module.
+ * passiveIgnitionCheck - True if the OBD2_IGNITION_CHECK power mode should
+ *      first watch for the engine and vehicle speed in normal mode CAN
+ *      signals, and only send OBD-II requests for them if neither has been
+ *      seen lately. While suspended, the VI waits for CAN activity to wake it
+ *      instead of waking itself up periodically to send requests.
  * obd2BusAddress - If 0, OBD-II requests will not be sent. Otherwise, they will
  *      be sent on the bus with this controller address (i.e. 1 or 2).
  * powerManagement - The active power management mode.
@@ -91,6 +114,11 @@ typedef enum {
  *      value..
  * emulatedData - If true, will generate fake vehicle data and include it in the
  *      published output.
+ * emulatedFrameRate - If greater than 0, the fake data is generated as this
+ *      many raw CAN frames per second, pushed into the CAN receive queues,
+ *      instead of as vehicle messages.
+ * emulatedUnknownIdPercent - The percentage of the emulated CAN frames to give
+ *      an ID that isn't in the active configuration.
  * loggingOutput - Set the output interface used for debug logging.
  * calculateMetrics - If true, metrics on CAN bus and I/O activity will be
  *      calculated and logged. This has serious performance implications at the
@@ -114,10 +142,14 @@ typedef struct {
     const char* environmentMode;
     openxc::payload::PayloadFormat payloadFormat;
     bool recurringObd2Requests;
+    bool adaptiveObd2Polling;
+    bool passiveIgnitionCheck;
     uint8_t obd2BusAddress;
     PowerManagement powerManagement;
     bool sendCanAcks;
     bool emulatedData;
+    unsigned int emulatedFrameRate;
+    uint8_t emulatedUnknownIdPercent;
     LoggingOutputInterface loggingOutput;
     bool calculateMetrics;
     RunLevel desiredRunLevel;
@@ -146,6 +178,19 @@ Configuration* getConfiguration();
  */
 void getFirmwareDescriptor(char* buffer, size_t length);
 
+/* Public: Hash the next chunk of the firmware in flash into flashHash, which
+ * stays empty until the whole image has been hashed. A quick checksum of the
+ * image is read first, and if NVM has a hash cached for the same checksum it's
+ * used instead of computing the MD5 again, so the full hash only runs once
+ * after each firmware update. Call this once per pass of the main loop.
+ *
+ * idle - true if there's nothing else to do this pass. Otherwise a chunk is
+ *      only hashed if none has been for FLASH_HASH_MAX_DEFER_MS.
+ *
+ * Returns true until the hash is finished.
+ */
+bool hashFlash(bool idle);
+
 } // namespace config
 } // namespace openxc
 
@@ -1,9 +1,11 @@
 #include "data_emulator.h"
 #include "can/canread.h"
+#include "can/canqueue.h"
 #include "util/log.h"
 #include "util/timer.h"
 #include "signals.h"
 #include <stdlib.h>
+#include <string.h>
 
 #define MAX_EMULATED_MESSAGES 1000
 #define NUMERICAL_SIGNAL_COUNT 10
@@ -11,6 +13,12 @@
 #define STATE_SIGNAL_COUNT 2
 #define EVENT_SIGNAL_COUNT 2
 #define EMULATOR_SEND_FREQUENCY 500
+// The most frames generated in one call - if the loop falls further behind than
+// this, the missed frames are skipped instead of sent in one burst.
+#define MAX_EMULATED_FRAMES_PER_CALL CAN_RECEIVE_QUEUE_MAX_DEPTH
+// A gap between frames of a played back log longer than this, or a step back in
+// time, is cut short - e.g. where the log's clock was set.
+#define PLAYBACK_MAX_GAP_MS 60000
 
 using openxc::can::read::publishNumericalMessage;
 using openxc::can::read::publishBooleanMessage;
@@ -18,6 +26,12 @@ using openxc::can::read::publishStringMessage;
 using openxc::can::read::publishStringEventedMessage;
 using openxc::can::read::publishStringEventedBooleanMessage;
 using openxc::pipeline::Pipeline;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::util::log::debug;
+
+namespace time = openxc::util::time;
+namespace fs = openxc::interface::fs;
 
 static const char* NUMERICAL_SIGNALS[NUMERICAL_SIGNAL_COUNT] = {
     "steering_wheel_angle",
@@ -67,9 +81,69 @@ static const char* EVENT_SIGNAL_EVENT[EVENT_SIGNAL_COUNT][2] = {
 
 static int messageCount = 0;
 static bool unlimitedEmulatedMessages = true;
+// The time the frames generated so far were due by, or 0 to start again from
+// the next call.
+static unsigned long framesDueUs = 0;
 
 void openxc::emulator::restart() {
     messageCount = 0;
+    framesDueUs = 0;
+}
+
+int openxc::emulator::generateFakeCanFrames(CanBus* buses, int busCount,
+        unsigned int frameRate, uint8_t unknownIdPercent) {
+    if(busCount == 0 || frameRate == 0) {
+        return 0;
+    }
+
+    unsigned long now = time::systemTimeUs();
+    if(framesDueUs == 0) {
+        framesDueUs = now;
+        return 0;
+    }
+
+    unsigned long due = (uint64_t)(now - framesDueUs) * frameRate / 1000000;
+    if(due > MAX_EMULATED_FRAMES_PER_CALL) {
+        due = MAX_EMULATED_FRAMES_PER_CALL;
+        framesDueUs = now;
+    } else {
+        // keep the remainder, so rates that aren't a multiple of the loop
+        // speed still average out
+        framesDueUs += (uint64_t) due * 1000000 / frameRate;
+    }
+
+    int generated = 0;
+    for(unsigned long i = 0; i < due; i++) {
+        CanBus* bus = &buses[0];
+        CanMessage message = {
+            id: (uint32_t) rand() % 0x800,
+            format: CanMessageFormat::STANDARD,
+            data: {0},
+            length: CAN_MESSAGE_SIZE,
+            receivedUs: now
+        };
+
+        if(getMessageCount() > 0 && rand() % 100 >= unknownIdPercent) {
+            CanMessageDefinition* definition =
+                    &getMessages()[rand() % getMessageCount()];
+            message.id = definition->id;
+            message.format = definition->format;
+            if(definition->bus != NULL) {
+                bus = definition->bus;
+            }
+        }
+
+        for(int byte = 0; byte < CAN_MESSAGE_SIZE; byte++) {
+            message.data[byte] = rand();
+        }
+
+        if(openxc::can::queue::push(&bus->receiveQueue, &message)) {
+            ++generated;
+        } else {
+            ++bus->messagesDropped;
+        }
+    }
+    return generated;
 }
 
 void openxc::emulator::generateFakeMeasurements(Pipeline* pipeline) {
@@ -104,3 +178,218 @@ void openxc::emulator::generateFakeMeasurements(Pipeline* pipeline) {
         }
     }
 }
+
+#ifdef FS_SUPPORT
+
+// The playback in progress - see startPlayback
+static openxc::interface::fs::FsDevice* playbackDevice = NULL;
+static char playbackFile[13];
+static bool playbackActive = false;
+static bool playbackJournaled = false;
+static unsigned int playbackSpeed = 100;
+static uint32_t playbackOffset = 0;       // where the next read starts
+static uint8_t playbackBuffer[FS_JOURNAL_BLOCK_SIZE];
+static int playbackLength = 0;            // bytes of the log in playbackBuffer
+static int playbackIndex = 0;             // the next byte of them to use
+static uint8_t playbackRecord[CAN_LOG_RECORD_SIZE];
+static int playbackRecordLength = 0;      // bytes of the record read so far
+// The next frame to push, once it's due
+static bool frameReady = false;
+static CanMessage frame;
+static uint8_t frameBus;
+static uint64_t frameTimestamp;
+// The log's time when playbackStartMs was, to time the frames from
+static uint64_t startTimestamp;
+static uint64_t lastTimestamp;
+static bool playbackStarted = false;
+static unsigned long playbackStartMs;
+static unsigned long framesPlayed;
+
+/* Private: Read the next piece of the log into playbackBuffer - the payload of
+ * the next journal block, or the next sector's worth of a plain log.
+ *
+ * Returns false at the end of the log - the end of the file, a journal block
+ * that's damaged or was never written, or a sector of a preallocated plain log
+ * without a single record in it.
+ */
+static bool readPlayback() {
+    int count = fs::readFileAt(playbackDevice, playbackFile, playbackOffset,
+            playbackBuffer, sizeof(playbackBuffer));
+    if(count <= 0) {
+        return false;
+    }
+
+    playbackIndex = 0;
+    if(playbackJournaled) {
+        int length = fs::openJournalBlock(playbackBuffer, NULL);
+        if(count < FS_JOURNAL_BLOCK_SIZE || length < 0) {
+            return false;
+        }
+        playbackOffset += FS_JOURNAL_BLOCK_SIZE;
+        playbackIndex = FS_JOURNAL_HEADER_SIZE;
+        playbackLength = FS_JOURNAL_HEADER_SIZE + length;
+        return true;
+    }
+
+    playbackOffset += count;
+    playbackLength = count;
+    // every record starts with a sync byte, and there are several records to
+    // a sector
+    return memchr(playbackBuffer, CAN_LOG_RECORD_SYNC, count) != NULL;
+}
+
+/* Private: Put together the next record of the log as frame, skipping ahead to
+ * the next sync byte if a record is damaged. Reads at most one more piece of
+ * the log, so a long stretch without records doesn't hold up the main loop.
+ *
+ * Returns 1 if frame is ready, 0 if there's more to read on the next call, or
+ * -1 at the end of the log.
+ */
+static int readFrame() {
+    bool read = false;
+    while(true) {
+        while(playbackRecordLength < CAN_LOG_RECORD_SIZE) {
+            if(playbackIndex >= playbackLength) {
+                if(read) {
+                    return 0;
+                }
+                if(!readPlayback()) {
+                    return -1;
+                }
+                read = true;
+                continue;
+            }
+
+            uint8_t byte = playbackBuffer[playbackIndex++];
+            if(playbackRecordLength > 0 || byte == CAN_LOG_RECORD_SYNC) {
+                playbackRecord[playbackRecordLength++] = byte;
+            }
+        }
+
+        bool extended;
+        if(fs::decodeCanRecord(playbackRecord, &frameBus, &frame.id,
+                    &extended, frame.data, &frame.length, &frameTimestamp)) {
+            frame.format = extended ? CanMessageFormat::EXTENDED :
+                    CanMessageFormat::STANDARD;
+            playbackRecordLength = 0;
+            return 1;
+        }
+
+        // start again from the next sync byte in what was read
+        const uint8_t* sync = (const uint8_t*) memchr(&playbackRecord[1],
+                CAN_LOG_RECORD_SYNC, CAN_LOG_RECORD_SIZE - 1);
+        if(sync == NULL) {
+            playbackRecordLength = 0;
+        } else {
+            playbackRecordLength = CAN_LOG_RECORD_SIZE - (sync - playbackRecord);
+            memmove(playbackRecord, sync, playbackRecordLength);
+        }
+    }
+}
+
+bool openxc::emulator::startPlayback(openxc::interface::fs::FsDevice* device,
+        const char* name, unsigned int speedPercent) {
+    stopPlayback();
+    if(strlen(name) >= sizeof(playbackFile) ||
+            fs::readFileAt(device, name, 0, playbackBuffer,
+                sizeof(playbackBuffer)) < 0) {
+        debug("Can't play back %s, it doesn't exist", name);
+        return false;
+    }
+
+    playbackDevice = device;
+    strcpy(playbackFile, name);
+    playbackJournaled = fs::openJournalBlock(playbackBuffer, NULL) >= 0;
+    playbackSpeed = speedPercent;
+    playbackOffset = 0;
+    playbackLength = 0;
+    playbackIndex = 0;
+    playbackRecordLength = 0;
+    frameReady = false;
+    playbackStarted = false;
+    framesPlayed = 0;
+    playbackActive = true;
+    debug("Playing back %s at %u%%", name, speedPercent);
+    return true;
+}
+
+void openxc::emulator::stopPlayback() {
+    if(playbackActive) {
+        playbackActive = false;
+        debug("Played back %lu frames of %s", framesPlayed, playbackFile);
+    }
+}
+
+int openxc::emulator::playBack(CanBus* buses, int busCount) {
+    if(!playbackActive) {
+        return 0;
+    }
+
+    int played = 0;
+    while(played < MAX_EMULATED_FRAMES_PER_CALL) {
+        if(!frameReady) {
+            int status = readFrame();
+            if(status < 0) {
+                stopPlayback();
+                break;
+            } else if(status == 0) {
+                break;
+            }
+
+            frameReady = true;
+            if(!playbackStarted || frameTimestamp < lastTimestamp ||
+                    frameTimestamp - lastTimestamp > PLAYBACK_MAX_GAP_MS) {
+                playbackStarted = true;
+                startTimestamp = frameTimestamp;
+                playbackStartMs = time::systemTimeMs();
+            }
+            lastTimestamp = frameTimestamp;
+        }
+
+        if(playbackSpeed > 0 && (uint64_t) (time::systemTimeMs() -
+                    playbackStartMs) * playbackSpeed / 100 <
+                frameTimestamp - startTimestamp) {
+            break;
+        }
+
+        CanBus* bus = NULL;
+        for(int i = 0; i < busCount; i++) {
+            if(buses[i].address == frameBus) {
+                bus = &buses[i];
+                break;
+            }
+        }
+
+        frame.receivedUs = time::systemTimeUs();
+        if(bus == NULL) {
+            frameReady = false;
+        } else if(openxc::can::queue::push(&bus->receiveQueue, &frame)) {
+            frameReady = false;
+            ++played;
+            ++framesPlayed;
+        } else if(playbackSpeed > 0) {
+            frameReady = false;
+            ++bus->messagesDropped;
+        } else {
+            // try again once the queue has room
+            break;
+        }
+    }
+    return played;
+}
+
+#else
+
+bool openxc::emulator::startPlayback(openxc::interface::fs::FsDevice* device,
+        const char* name, unsigned int speedPercent) {
+    debug("Built without MSD_ENABLE, can't play back a CAN log");
+    return false;
+}
+
+void openxc::emulator::stopPlayback() { }
+
+int openxc::emulator::playBack(CanBus* buses, int busCount) {
+    return 0;
+}
+
+#endif // FS_SUPPORT
@@ -2,6 +2,8 @@
 #define __DATA_EMULATOR_H__
 
 #include "pipeline.h"
+#include "can/canutil.h"
+#include "interface/fs.h"
 
 namespace openxc {
 namespace emulator {
@@ -13,8 +15,74 @@ namespace emulator {
  */
 void generateFakeMeasurements(openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Synthesize raw CAN frames at a fixed rate and push them into the
+ * receive queues, as if they had arrived from the CAN controller.
+ *
+ * Unlike generateFakeMeasurements(Pipeline*), the frames go through the same
+ * decode, passthrough and output path as real traffic, so this can be used to
+ * load test a VI on a bench. Call it once per pass of the main loop - it works
+ * out how many frames are due from the time since it last ran.
+ *
+ * Frames use the IDs of the CAN messages in the active configuration, picked
+ * at random and pushed to the bus each message belongs to, except for
+ * unknownIdPercent percent of them (or all of them, if the configuration
+ * doesn't define any messages) which get a random 11-bit ID on the first bus.
+ * The data bytes are random.
+ *
+ * buses - the CAN buses to feed.
+ * busCount - the length of the buses array.
+ * frameRate - the target number of frames per second across all buses.
+ * unknownIdPercent - the percentage of frames, 0 to 100, to give an ID not
+ *      taken from the configuration.
+ *
+ * Returns the number of frames pushed. Frames that don't fit in a bus's receive
+ * queue are counted as dropped by that bus, the same as when the controller
+ * receives faster than the main loop can keep up.
+ */
+int generateFakeCanFrames(CanBus* buses, int busCount, unsigned int frameRate,
+        uint8_t unknownIdPercent);
+
+/* Public: Start counting the measurements and frames to generate again from
+ * now.
+ */
 void restart();
 
+/* Public: Start playing back a raw CAN log (see DEFAULT_FS_RAW_CAN_LOG) from
+ * the SD card, replacing any playback already running. Journaled logs are
+ * read through their journal blocks, stopping at the first damaged one.
+ *
+ * device - The SD card, which must be connected.
+ * name - The name of the log file.
+ * speedPercent - How fast to play the frames back, as a percentage of the
+ *      rate they were logged at - 100 keeps the original timing between
+ *      frames, 200 plays them twice as fast. 0 pushes them as fast as the
+ *      receive queues take them, without dropping any. Either way, a gap of
+ *      more than PLAYBACK_MAX_GAP_MS in the log is cut short.
+ *
+ * Returns false if the file doesn't exist, or the firmware was built without
+ * FS_SUPPORT.
+ */
+bool startPlayback(openxc::interface::fs::FsDevice* device, const char* name,
+        unsigned int speedPercent);
+
+/* Public: Stop the playback started by startPlayback, if there is one.
+ */
+void stopPlayback();
+
+/* Public: Push the frames of the playback that are due into the receive queues
+ * of the buses they were logged on, as if they had arrived from the CAN
+ * controller. Frames logged on a bus that isn't in buses are skipped. Call it
+ * once per pass of the main loop.
+ *
+ * buses - the CAN buses to feed.
+ * busCount - the length of the buses array.
+ *
+ * Returns the number of frames pushed. With a speedPercent other than 0,
+ * frames that don't fit in a bus's receive queue are counted as dropped by
+ * that bus, as in generateFakeCanFrames.
+ */
+int playBack(CanBus* buses, int busCount);
+
 } // namespace emulator
 } // namespace openxc
 
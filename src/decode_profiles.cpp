@@ -0,0 +1,308 @@
+#include "decode_profiles.h"
+#include "util/log.h"
+#include "util/timer.h"
+#include <string.h>
+
+namespace time = openxc::util::time;
+
+using openxc::util::log::debug;
+using openxc::util::log::info;
+using openxc::can::lookupSignal;
+using openxc::profiles::DecodeProfile;
+using openxc::profiles::ProfileRule;
+
+#if DECODE_PROFILE_COUNT > 0
+
+/* Private: A signal's frequency from before the active profile changed it. */
+typedef struct {
+    CanSignal* signal;
+    float frequency;
+} SavedFrequency;
+
+static DecodeProfile PROFILES[DECODE_PROFILE_COUNT];
+static int profileCount = 0;
+static SavedFrequency savedFrequencies[DECODE_PROFILE_FREQUENCY_COUNT];
+static int savedFrequencyCount = 0;
+
+// The profile applied to appliedSignals, or -1 if none is
+static int activeProfile = -1;
+static CanSignal* appliedSignals = NULL;
+// The profile whose condition has held since pendingSinceMs, but isn't active
+// yet
+static int pendingProfile = -1;
+static unsigned long pendingSinceMs = 0;
+
+static int findProfile(const char* name) {
+    for(int i = 0; i < profileCount; i++) {
+        if(!strcmp(PROFILES[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Private: Returns true if the signal is selected by a rule's pattern - its
+ * exact name, or a prefix followed by '*'.
+ */
+static bool matchesSignal(const char* pattern, const CanSignal* signal) {
+    size_t length = strlen(pattern);
+    if(length > 0 && pattern[length - 1] == '*') {
+        return !strncmp(signal->genericName, pattern, length - 1);
+    }
+    return !strcmp(signal->genericName, pattern);
+}
+
+/* Private: Returns the last of the profile's rules that selects the signal,
+ * or NULL if none do or it's a signal some profile's condition is on.
+ */
+static const ProfileRule* ruleFor(const DecodeProfile* profile,
+        const CanSignal* signal) {
+    const ProfileRule* match = NULL;
+    for(int i = 0; i < profile->ruleCount; i++) {
+        if(matchesSignal(profile->rules[i].pattern, signal)) {
+            match = &profile->rules[i];
+        }
+    }
+
+    if(match != NULL) {
+        for(int i = 0; i < profileCount; i++) {
+            if(!strcmp(PROFILES[i].signalName, signal->genericName)) {
+                return NULL;
+            }
+        }
+    }
+    return match;
+}
+
+static void saveFrequency(CanSignal* signal) {
+    for(int i = 0; i < savedFrequencyCount; i++) {
+        if(savedFrequencies[i].signal == signal) {
+            return;
+        }
+    }
+    savedFrequencies[savedFrequencyCount].signal = signal;
+    savedFrequencies[savedFrequencyCount].frequency =
+            signal->frequencyClock.frequency;
+    ++savedFrequencyCount;
+}
+
+static void restoreFrequencies() {
+    for(int i = 0; i < savedFrequencyCount; i++) {
+        CanSignal* signal = savedFrequencies[i].signal;
+        // the clock recomputes its period when it sees the new frequency
+        signal->frequencyClock.frequency = savedFrequencies[i].frequency;
+        signal->message->quietUntilMs = 0;
+    }
+    savedFrequencyCount = 0;
+}
+
+/* Private: Apply a profile's rules to a message's signals, and suspend or
+ * restore the message's acceptance filter to match.
+ */
+static void applyToMessage(const DecodeProfile* profile,
+        CanMessageDefinition* message, CanSignal* signals, int signalCount,
+        CanBus* buses, int busCount) {
+    int matched = 0;
+    int suppressed = 0;
+    for(int i = 0; i < signalCount; i++) {
+        CanSignal* signal = &signals[i];
+        if(signal->message != message) {
+            continue;
+        }
+        ++matched;
+
+        const ProfileRule* rule = profile == NULL ? NULL :
+                ruleFor(profile, signal);
+        bool disable = rule != NULL && !rule->decoded;
+        if(disable) {
+            ++suppressed;
+        }
+        if(signal->profileDisabled != disable) {
+            signal->profileDisabled = disable;
+            // let its message's next frame through, even if it's unchanged
+            message->quietUntilMs = 0;
+        }
+
+        if(rule != NULL && rule->decoded && rule->frequency >= 0) {
+            if(savedFrequencyCount >= DECODE_PROFILE_FREQUENCY_COUNT) {
+                debug("No room to change the frequency of %s",
+                        signal->genericName);
+                continue;
+            }
+            saveFrequency(signal);
+            signal->frequencyClock.frequency = rule->frequency;
+            message->quietUntilMs = 0;
+        }
+    }
+
+    // A message with no signals may still have a custom handler, and raw
+    // passthrough needs every message the bus accepts
+    bool suspend = matched > 0 && suppressed == matched &&
+            message->bus != NULL && !message->bus->passthroughCanMessages;
+    // Filter learning may have removed the same filter already
+    if(suspend && !message->filterSuspended) {
+        if(!message->filterUnlearned) {
+            openxc::can::removeAcceptanceFilter(message->bus, message->id,
+                    message->format, buses, busCount);
+        }
+        message->filterSuspended = true;
+    } else if(!suspend && message->filterSuspended) {
+        if(!message->filterUnlearned) {
+            openxc::can::addAcceptanceFilter(message->bus, message->id,
+                    message->format, buses, busCount);
+        }
+        message->filterSuspended = false;
+    }
+}
+
+static void apply(int index, CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount) {
+    const DecodeProfile* profile = index == -1 ? NULL : &PROFILES[index];
+    restoreFrequencies();
+    openxc::can::beginAcceptanceFilterUpdate();
+    for(int i = 0; i < messageCount; i++) {
+        applyToMessage(profile, &messages[i], signals, signalCount, buses,
+                busCount);
+    }
+    openxc::can::commitAcceptanceFilterUpdate(buses, busCount);
+
+    activeProfile = index;
+    appliedSignals = signals;
+    info("Switched to decode profile %s",
+            profile == NULL ? "none" : profile->name);
+}
+
+static bool conditionHolds(const DecodeProfile* profile, CanSignal* signals,
+        int signalCount) {
+    const CanSignal* signal = lookupSignal(profile->signalName, signals,
+            signalCount);
+    if(signal == NULL || !signal->received) {
+        return false;
+    }
+
+    switch(profile->condition) {
+    case openxc::profiles::BELOW:
+        return signal->lastValue < profile->threshold;
+    case openxc::profiles::ABOVE:
+        return signal->lastValue > profile->threshold;
+    case openxc::profiles::EQUAL:
+        return signal->lastValue == profile->threshold;
+    }
+    return false;
+}
+
+bool openxc::profiles::define(const DecodeProfile* profile,
+        CanSignal* signals, int signalCount, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, int busCount) {
+    int index = findProfile(profile->name);
+    if(index == -1) {
+        if(profileCount >= DECODE_PROFILE_COUNT) {
+            debug("Can't define more than %d decode profiles",
+                    DECODE_PROFILE_COUNT);
+            return false;
+        }
+        index = profileCount++;
+    } else if(index == activeProfile) {
+        apply(-1, signals, signalCount, messages, messageCount, buses,
+                busCount);
+    }
+
+    PROFILES[index] = *profile;
+    PROFILES[index].name[DECODE_PROFILE_NAME_LENGTH - 1] = '\0';
+    PROFILES[index].signalName[MAX_GENERIC_NAME_LENGTH - 1] = '\0';
+    pendingProfile = -1;
+    return true;
+}
+
+bool openxc::profiles::undefine(const char* name, CanSignal* signals,
+        int signalCount, CanMessageDefinition* messages, int messageCount,
+        CanBus* buses, int busCount) {
+    int index = findProfile(name);
+    if(index == -1) {
+        debug("No decode profile named %s", name);
+        return false;
+    }
+
+    if(index == activeProfile) {
+        apply(-1, signals, signalCount, messages, messageCount, buses,
+                busCount);
+    } else if(activeProfile > index) {
+        --activeProfile;
+    }
+
+    for(int i = index; i < profileCount - 1; i++) {
+        PROFILES[i] = PROFILES[i + 1];
+    }
+    --profileCount;
+    pendingProfile = -1;
+    return true;
+}
+
+void openxc::profiles::update(CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount) {
+    if(appliedSignals == NULL) {
+        appliedSignals = signals;
+    } else if(signals != appliedSignals) {
+        // Another message set is active - the old one keeps its profile's
+        // flags and filters, which are its own, and this one starts over
+        // from whatever it was left with
+        apply(-1, signals, signalCount, messages, messageCount, buses,
+                busCount);
+        pendingProfile = -1;
+    }
+
+    if(profileCount == 0) {
+        return;
+    }
+
+    int chosen = -1;
+    for(int i = 0; i < profileCount; i++) {
+        if(conditionHolds(&PROFILES[i], signals, signalCount)) {
+            chosen = i;
+            break;
+        }
+    }
+
+    if(chosen == activeProfile) {
+        pendingProfile = -1;
+    } else if(chosen != pendingProfile) {
+        pendingProfile = chosen;
+        pendingSinceMs = time::systemTimeMs();
+    } else if(time::systemTimeMs() - pendingSinceMs >= DECODE_PROFILE_HOLD_MS) {
+        apply(chosen, signals, signalCount, messages, messageCount, buses,
+                busCount);
+        pendingProfile = -1;
+    }
+}
+
+const char* openxc::profiles::active() {
+    return activeProfile == -1 ? NULL : PROFILES[activeProfile].name;
+}
+
+#else
+
+bool openxc::profiles::define(const DecodeProfile* profile,
+        CanSignal* signals, int signalCount, CanMessageDefinition* messages,
+        int messageCount, CanBus* buses, int busCount) {
+    debug("Built without DECODE_PROFILE_COUNT, can't define decode profiles");
+    return false;
+}
+
+bool openxc::profiles::undefine(const char* name, CanSignal* signals,
+        int signalCount, CanMessageDefinition* messages, int messageCount,
+        CanBus* buses, int busCount) {
+    debug("Built without DECODE_PROFILE_COUNT, can't define decode profiles");
+    return false;
+}
+
+void openxc::profiles::update(CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount) { }
+
+const char* openxc::profiles::active() {
+    return NULL;
+}
+
+#endif // DECODE_PROFILE_COUNT > 0
@@ -0,0 +1,143 @@
+/* Named subsets of the signals to decode, and how often, switched to
+ * automatically as the vehicle changes state - e.g. only the door, lock and
+ * battery signals while parked, and the powertrain at full rate once it's
+ * moving. The messages a profile leaves with no signals to decode are taken out
+ * of the acceptance filters, so the CAN controller drops them instead of
+ * interrupting the CPU for each one.
+ */
+#ifndef __DECODE_PROFILES_H__
+#define __DECODE_PROFILES_H__
+
+#include "can/canutil.h"
+#include "diagnostics.h"
+
+// The number of decode profiles that can be defined at once. Each one costs
+// about 320 bytes of RAM. Use 0 to leave decode profiles out of the firmware.
+#ifndef DECODE_PROFILE_COUNT
+#define DECODE_PROFILE_COUNT 0
+#endif
+
+// The number of signal selections in each profile.
+#ifndef DECODE_PROFILE_RULE_COUNT
+#define DECODE_PROFILE_RULE_COUNT 8
+#endif
+
+// How long a different profile's condition has to hold before it's switched
+// to, so a signal wavering around a threshold doesn't flip the filters back
+// and forth.
+#ifndef DECODE_PROFILE_HOLD_MS
+#define DECODE_PROFILE_HOLD_MS 1000
+#endif
+
+// The number of signals whose frequency the active profile can change. Their
+// frequencies from before the profile are kept here to put back when it ends.
+#ifndef DECODE_PROFILE_FREQUENCY_COUNT
+#define DECODE_PROFILE_FREQUENCY_COUNT 16
+#endif
+
+#define DECODE_PROFILE_NAME_LENGTH 16
+#define DECODE_PROFILE_PATTERN_LENGTH 24
+
+namespace openxc {
+namespace profiles {
+
+/* Public: How a profile's condition signal is compared to its threshold.
+ *
+ * BELOW - the signal's last value is less than the threshold.
+ * ABOVE - the signal's last value is greater than the threshold.
+ * EQUAL - the signal's last value is the threshold, e.g. a state's value.
+ */
+typedef enum {
+    BELOW,
+    ABOVE,
+    EQUAL,
+} ProfileCondition;
+
+/* Public: One selection of signals in a profile.
+ *
+ * pattern - The generic name of a signal, or a prefix followed by '*'.
+ * decoded - False if the signals shouldn't be decoded while the profile is
+ *      active.
+ * frequency - The frequency the signals are published at while the profile
+ *      is active, or a negative number to leave it alone.
+ */
+typedef struct {
+    char pattern[DECODE_PROFILE_PATTERN_LENGTH];
+    bool decoded;
+    float frequency;
+} ProfileRule;
+
+/* Public: A decode profile, active while its condition holds.
+ *
+ * name - The name of the profile.
+ * signalName - The generic name of the signal the condition is on. It's always
+ *      decoded, whatever the rules of any profile say.
+ * condition - How the signal is compared to the threshold.
+ * threshold - The value the signal is compared to.
+ * rules - The signals the profile changes. When more than one matches a signal,
+ *      the last one applies. Signals no rule matches are decoded as usual.
+ * ruleCount - The number of rules.
+ */
+typedef struct {
+    char name[DECODE_PROFILE_NAME_LENGTH];
+    char signalName[MAX_GENERIC_NAME_LENGTH];
+    ProfileCondition condition;
+    float threshold;
+    ProfileRule rules[DECODE_PROFILE_RULE_COUNT];
+    uint8_t ruleCount;
+} DecodeProfile;
+
+/* Public: Add a decode profile, or replace the one with the same name.
+ * Profiles are checked in the order they were first defined, and the first
+ * whose condition holds is the one that's active. If the replaced profile was
+ * active, its changes are undone right away and it's switched to again once
+ * its new condition holds.
+ *
+ * profile - The profile, which is copied.
+ * signals - The active message set's signals.
+ * signalCount - The length of the signals array.
+ * messages - The active message set's messages.
+ * messageCount - The length of the messages array.
+ * buses - The active message set's buses.
+ * busCount - The length of the buses array.
+ *
+ * Returns false if DECODE_PROFILE_COUNT profiles are already defined.
+ */
+bool define(const DecodeProfile* profile, CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount);
+
+/* Public: Remove a decode profile, undoing its changes if it's active.
+ *
+ * Arguments are the same as for define(), except for the profile's name.
+ *
+ * Returns false if no profile has that name.
+ */
+bool undefine(const char* name, CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount);
+
+/* Public: Switch to the first profile whose condition holds, once it has held
+ * for DECODE_PROFILE_HOLD_MS, or back to decoding every signal as usual if
+ * none does. Call this once per pass of the main loop.
+ *
+ * Switching disables the decoding of signals the new profile's rules turn off
+ * (separately from the signal_control command's CanSignal.disabled), sets the
+ * frequencies it chooses, and removes the acceptance filter of each message
+ * with no signals left to decode, unless its bus passes CAN messages through.
+ *
+ * Arguments are the same as for define(), except for the profile.
+ */
+void update(CanSignal* signals, int signalCount,
+        CanMessageDefinition* messages, int messageCount, CanBus* buses,
+        int busCount);
+
+/* Public: Return the name of the active profile, or NULL if every signal is
+ * decoded as usual.
+ */
+const char* active();
+
+} // namespace profiles
+} // namespace openxc
+
+#endif // __DECODE_PROFILES_H__
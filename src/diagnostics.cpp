@@ -5,14 +5,26 @@
 #include "util/log.h"
 #include "util/timer.h"
 #include "obd2.h"
+#include <payload/payload.h>
 #include <bitfield/bitfield.h>
 #include <limits.h>
 #include "config.h"
 
 #define MAX_RECURRING_DIAGNOSTIC_FREQUENCY_HZ 10
-#define DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET 0x8
+
+#define UDS_SESSION_CONTROL_MODE 0x10
+#define UDS_ECU_RESET_MODE 0x11
+#define UDS_TESTER_PRESENT_MODE 0x3e
+#define UDS_DEFAULT_SESSION 0x1
 
 using openxc::diagnostics::ActiveDiagnosticRequest;
+using openxc::diagnostics::DiagnosticRequestList;
+using openxc::diagnostics::DiagnosticRequestQueue;
+using openxc::diagnostics::DiagnosticEcu;
+using openxc::diagnostics::DiagnosticFlowControl;
+using openxc::diagnostics::DiagnosticSession;
+using openxc::diagnostics::CachedDiagnosticResponse;
+using openxc::diagnostics::PooledRequestHandle;
 using openxc::diagnostics::DiagnosticsManager;
 using openxc::diagnostics::DiagnosticResponseDecoder;
 using openxc::diagnostics::DiagnosticResponseCallback;
@@ -21,14 +33,19 @@ using openxc::util::log::debug;
 using openxc::can::lookupBus;
 using openxc::can::addAcceptanceFilter;
 using openxc::can::removeAcceptanceFilter;
+using openxc::can::addAcceptanceFilterRange;
+using openxc::can::removeAcceptanceFilterRange;
 using openxc::can::read::publishNumericalMessage;
 using openxc::pipeline::Pipeline;
 using openxc::signals::getCanBuses;
 using openxc::signals::getCanBusCount;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
 using openxc::config::getConfiguration;
 
 namespace time = openxc::util::time;
 namespace pipeline = openxc::pipeline;
+namespace payload = openxc::payload;
 namespace obd2 = openxc::diagnostics::obd2;
 
 static bool timedOut(ActiveDiagnosticRequest* request) {
@@ -36,41 +53,304 @@ static bool timedOut(ActiveDiagnosticRequest* request) {
     return time::elapsed(&request->timeoutClock, false);
 }
 
+/* Private: Returns true if the request is a recurring functional broadcast
+ * that waits for multiple responses, so it can learn which ECUs answer it.
+ */
+static bool learnsResponders(const ActiveDiagnosticRequest* request) {
+    return DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES > 0 && request->recurring &&
+            request->waitForMultipleResponses &&
+            request->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID;
+}
+
+/* Private: Returns true if the request has learned which ECUs answer it and
+ * all of them have answered since it was sent.
+ */
+static bool knownRespondersAnswered(const ActiveDiagnosticRequest* request) {
+    return learnsResponders(request) &&
+            request->discoveryCycles >= DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES &&
+            request->knownResponders != 0 &&
+            (request->respondersSeen & request->knownResponders) ==
+                request->knownResponders;
+}
+
 /* Private: Returns true if a sufficient response has been received for a
  * diagnostic request.
  *
  * This is true when at least one response has been received and the request is
  * configured to not wait for multiple responses. Functional broadcast requests
- * may often wish to wait the full 100ms for modules to respond.
+ * may often wish to wait the full 100ms for modules to respond, unless they've
+ * learned which modules will.
  */
 static bool responseReceived(ActiveDiagnosticRequest* request) {
-    return !request->waitForMultipleResponses &&
-                request->handle.completed;
+    return (!request->waitForMultipleResponses &&
+                request->handle->completed) ||
+            knownRespondersAnswered(request);
+}
+
+/* Private: Update what a request knows about the ECUs that answer it, once it's
+ * completed. While learning, every ECU that answered is added. A learned
+ * request that timed out without hearing from one of its ECUs starts learning
+ * again, in case they've changed (e.g. one has powered down). Any ECU that
+ * answers is always added, so a new one can be waited for from then on.
+ */
+static void updateKnownResponders(ActiveDiagnosticRequest* request) {
+    if(!learnsResponders(request)) {
+        return;
+    }
+
+    if(request->discoveryCycles < DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES) {
+        ++request->discoveryCycles;
+    } else if(!knownRespondersAnswered(request)) {
+        debug("Not all known ECUs answered a functional request, "
+                "learning them again");
+        request->discoveryCycles = 1;
+        request->knownResponders = 0;
+    }
+    request->knownResponders |= request->respondersSeen;
 }
 
 /* Private: Returns true if the request has timed out waiting for a response,
  *      or a sufficient number of responses has been received.
  */
 static bool requestCompleted(ActiveDiagnosticRequest* request) {
-    return responseReceived(request) || (
-            timedOut(request) && diagnostic_request_sent(&request->handle));
+    // A request only has a handle while it's in flight
+    return request->handle != NULL && (responseReceived(request) || (
+            timedOut(request) && diagnostic_request_sent(request->handle)));
 }
 
-/* Private: Move the entry to the free list and decrement the lock count for any
- * CAN filters it used.
+static DiagnosticRequestHandle* acquireHandle(DiagnosticsManager* manager) {
+    PooledRequestHandle* pooled = LIST_FIRST(&manager->freeRequestHandles);
+    if(pooled == NULL) {
+        return NULL;
+    }
+    LIST_REMOVE(pooled, freeEntries);
+    return &pooled->handle;
+}
+
+static void releaseHandle(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    if(entry->handle != NULL) {
+        // the handle is the first member of its pool entry
+        LIST_INSERT_HEAD(&manager->freeRequestHandles,
+                (PooledRequestHandle*)entry->handle, freeEntries);
+        entry->handle = NULL;
+    }
+}
+
+static bool reached(unsigned long timeMs, unsigned long now) {
+    return (long)(timeMs - now) <= 0;
+}
+
+/* Private: Find the pacing state for the ECU at the arbitration ID on the bus,
+ * claiming a free slot for it if no other active requests are sent to it.
+ */
+static DiagnosticEcu* acquireEcu(DiagnosticsManager* manager, CanBus* bus,
+        uint32_t arbitrationId) {
+    DiagnosticEcu* unused = NULL;
+    for(int i = 0; i < MAX_DIAGNOSTIC_ECUS; i++) {
+        DiagnosticEcu* ecu = &manager->ecus[i];
+        if(ecu->users > 0) {
+            if(ecu->bus == bus && ecu->arbitrationId == arbitrationId) {
+                ++ecu->users;
+                return ecu;
+            }
+        } else if(unused == NULL) {
+            unused = ecu;
+        }
+    }
+
+    if(unused != NULL) {
+        unused->bus = bus;
+        unused->arbitrationId = arbitrationId;
+        unused->users = 1;
+        unused->busy = false;
+        unused->readyMs = 0;
+    } else {
+        debug("No room to track another ECU for diagnostic requests");
+    }
+    return unused;
+}
+
+static void releaseEcu(DiagnosticEcu* ecu) {
+    if(ecu != NULL && --ecu->users == 0) {
+        ecu->busy = false;
+    }
+}
+
+/* Private: Mark a request as no longer in flight, giving its handle back to the
+ * pool and letting its ECU be sent another request after the separation time.
+ */
+static void landRequest(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    if(entry->inFlight) {
+        entry->ecu->busy = false;
+        entry->ecu->readyMs = time::systemTimeMs() +
+                DIAGNOSTIC_ECU_SEPARATION_MS;
+    }
+    entry->inFlight = false;
+    releaseHandle(manager, entry);
+}
+
+/* Private: Reclaim the space of any names in the name table that are no longer
+ * used, moving the rest down and updating the requests that refer to them.
+ */
+static void compactNameTable(DiagnosticsManager* manager) {
+    uint16_t source = 0, destination = 0;
+    while(source < manager->nameTableLength) {
+        uint16_t length = strlen(&manager->nameTable[source + 1]) + 2;
+        if(manager->nameTable[source] != 0) {
+            if(source != destination) {
+                memmove(&manager->nameTable[destination],
+                        &manager->nameTable[source], length);
+                for(int i = 0; i < MAX_SIMULTANEOUS_DIAG_REQUESTS; i++) {
+                    ActiveDiagnosticRequest* entry =
+                            &manager->requestListEntries[i];
+                    if(entry->nameHandle == source + 1) {
+                        entry->nameHandle = destination + 1;
+                    }
+                }
+            }
+            destination += length;
+        }
+        source += length;
+    }
+    manager->nameTableLength = destination;
+}
+
+/* Private: Returns the handle of a name that's already in flash - the generic
+ * name of a signal or of a predefined OBD-II PID - or 0 if it's neither.
+ */
+static uint16_t flashNameHandle(const char* name) {
+    if(strlen(name) >= MAX_GENERIC_NAME_LENGTH) {
+        return 0;
+    }
+
+    CanSignal* signal = openxc::can::lookupSignal(name, getSignals(),
+            getSignalCount());
+    if(signal != NULL && signal - getSignals() < DIAGNOSTIC_NAME_SIGNAL) {
+        return DIAGNOSTIC_NAME_SIGNAL | (signal - getSignals());
+    }
+
+    uint8_t pid;
+    if(obd2::lookupPid(name, &pid)) {
+        return DIAGNOSTIC_NAME_OBD2_PID | pid;
+    }
+    return 0;
+}
+
+/* Private: Returns the handle of a name, storing a reference to it in the name
+ * table if it isn't already in flash and adding it to the table if it isn't
+ * already there. Names are truncated to MAX_GENERIC_NAME_LENGTH - 1
+ * characters.
+ *
+ * Returns the name's handle, 0 if the name is NULL or empty, or -1 if there's
+ * no room left in the table.
+ */
+static int internName(DiagnosticsManager* manager, const char* name) {
+    if(name == NULL || name[0] == '\0') {
+        return 0;
+    }
+
+    uint16_t handle = flashNameHandle(name);
+    if(handle != 0) {
+        return handle;
+    }
+
+    size_t length = strnlen(name, MAX_GENERIC_NAME_LENGTH - 1);
+    uint16_t position = 0;
+    while(position < manager->nameTableLength) {
+        uint8_t* references = (uint8_t*)&manager->nameTable[position];
+        const char* candidate = &manager->nameTable[position + 1];
+        size_t candidateLength = strlen(candidate);
+        if(*references > 0 && *references < UINT8_MAX &&
+                candidateLength == length &&
+                !strncmp(candidate, name, length)) {
+            ++*references;
+            return position + 1;
+        }
+        position += candidateLength + 2;
+    }
+
+    if(manager->nameTableLength + length + 2 > DIAGNOSTIC_NAME_TABLE_SIZE) {
+        compactNameTable(manager);
+        if(manager->nameTableLength + length + 2 >
+                DIAGNOSTIC_NAME_TABLE_SIZE) {
+            debug("No room left in the diagnostic request name table");
+            return -1;
+        }
+    }
+
+    position = manager->nameTableLength;
+    manager->nameTable[position] = 1;
+    memcpy(&manager->nameTable[position + 1], name, length);
+    manager->nameTable[position + 1 + length] = '\0';
+    manager->nameTableLength += length + 2;
+    return position + 1;
+}
+
+static void releaseName(DiagnosticsManager* manager, int nameHandle) {
+    if(nameHandle > 0 && nameHandle < DIAGNOSTIC_NAME_OBD2_PID) {
+        --manager->nameTable[nameHandle - 1];
+    }
+}
+
+/* Private: Returns the name with this handle, or NULL if the handle is 0.
+ */
+static const char* lookupName(const DiagnosticsManager* manager,
+        uint16_t nameHandle) {
+    if(nameHandle & DIAGNOSTIC_NAME_SIGNAL) {
+        int id = nameHandle & ~DIAGNOSTIC_NAME_SIGNAL;
+        return id < getSignalCount() ? getSignals()[id].genericName : NULL;
+    } else if(nameHandle & DIAGNOSTIC_NAME_OBD2_PID) {
+        return obd2::pidName(nameHandle & ~DIAGNOSTIC_NAME_OBD2_PID);
+    } else if(nameHandle == 0) {
+        return NULL;
+    }
+    return &manager->nameTable[nameHandle];
+}
+
+static bool isFunctionalResponse(uint32_t arbitrationId) {
+    return arbitrationId >= OBD2_FUNCTIONAL_RESPONSE_START &&
+            arbitrationId < OBD2_FUNCTIONAL_RESPONSE_START +
+                OBD2_FUNCTIONAL_RESPONSE_COUNT;
+}
+
+/* Private: Returns the list of active requests that a frame with this
+ * arbitration ID could be a response to, besides any functional broadcasts.
+ */
+static DiagnosticRequestList* responseBucket(DiagnosticsManager* manager,
+        uint32_t arbitrationId) {
+    return &manager->responseIndex[arbitrationId &
+            (DIAGNOSTIC_RESPONSE_INDEX_SIZE - 1)];
+}
+
+static void indexRequest(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    if(entry->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
+        LIST_INSERT_HEAD(&manager->functionalRequests, entry, indexEntries);
+    } else {
+        LIST_INSERT_HEAD(responseBucket(manager, entry->arbitration_id +
+                    DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET), entry,
+                indexEntries);
+    }
+}
+
+/* Private: Move the entry to the free list, release its handle, name and ECU
+ * and decrement the lock count for any CAN filters it used.
  */
 static void cancelRequest(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* entry) {
+    landRequest(manager, entry);
+    releaseName(manager, entry->nameHandle);
+    entry->nameHandle = 0;
+    releaseEcu(entry->ecu);
+    entry->ecu = NULL;
+    LIST_REMOVE(entry, indexEntries);
     LIST_INSERT_HEAD(&manager->freeRequestEntries, entry, listEntries);
     if(entry->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
-        for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
-                filter < OBD2_FUNCTIONAL_RESPONSE_START +
-                    OBD2_FUNCTIONAL_RESPONSE_COUNT;
-                filter++) {
-            removeAcceptanceFilter(entry->bus, filter,
-                    CanMessageFormat::STANDARD, getCanBuses(),
-                    getCanBusCount());
-        }
+        removeAcceptanceFilterRange(entry->bus,
+                OBD2_FUNCTIONAL_RESPONSE_START, OBD2_FUNCTIONAL_RESPONSE_COUNT,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
     } else {
         removeAcceptanceFilter(entry->bus,
                 entry->arbitration_id +
@@ -79,23 +359,116 @@ static void cancelRequest(DiagnosticsManager* manager,
     }
 }
 
+/* Private: Returns the time (from time::systemTimeMs) a recurring request next
+ * needs attention - when it times out if it's in flight, otherwise when it's
+ * next due to be sent, or its ECU is ready for it if that's later.
+ */
+static unsigned long nextDueTime(ActiveDiagnosticRequest* entry) {
+    time::FrequencyClock* clock = entry->inFlight ?
+            &entry->timeoutClock : &entry->frequencyClock;
+    unsigned long dueMs = 0;
+    if(clock->lastTick != 0 && clock->frequency != 0) {
+        dueMs = clock->lastTick + time::period(clock);
+    }
+    if(!entry->inFlight && !reached(entry->ecu->readyMs, dueMs)) {
+        dueMs = entry->ecu->readyMs;
+    }
+    return dueMs;
+}
+
+static bool due(const ActiveDiagnosticRequest* entry, unsigned long now) {
+    return reached(entry->nextDueMs, now);
+}
+
+/* Private: Insert a recurring request into the recurring queue, which is kept
+ * in order of when each request next needs attention. It goes after any other
+ * requests due at the same time, so they keep taking turns.
+ */
+static void scheduleRecurringRequest(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    entry->nextDueMs = nextDueTime(entry);
+
+    ActiveDiagnosticRequest* later;
+    TAILQ_FOREACH(later, &manager->recurringRequests, queueEntries) {
+        if((long)(later->nextDueMs - entry->nextDueMs) > 0) {
+            TAILQ_INSERT_BEFORE(later, entry, queueEntries);
+            return;
+        }
+    }
+    TAILQ_INSERT_TAIL(&manager->recurringRequests, entry, queueEntries);
+}
+
+/* Private: Set a recurring request's clock so it's sent in the middle of the
+ * longest stretch of its period that no other recurring request with the same
+ * period is sent in. Each request added at a frequency splits the largest gap
+ * left by the ones before it, so they end up spread over the period in the
+ * same way every time, without moving the ones already running.
+ *
+ * The entry must not be in the recurring queue.
+ */
+static void phaseRecurringRequest(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    unsigned long period = time::period(&entry->frequencyClock);
+    if(period == 0) {
+        return;
+    }
+
+    bool found = false;
+    unsigned long longestGap = 0;
+    unsigned long target = 0;
+    ActiveDiagnosticRequest* start;
+    TAILQ_FOREACH(start, &manager->recurringRequests, queueEntries) {
+        if(start->frequencyClock.lastTick == 0 ||
+                time::period(&start->frequencyClock) != period) {
+            continue;
+        }
+
+        // The gap after this request runs until the next one with the same
+        // period, or all the way around if it's the only one
+        unsigned long startPhase = start->frequencyClock.lastTick % period;
+        unsigned long gap = period;
+        ActiveDiagnosticRequest* other;
+        TAILQ_FOREACH(other, &manager->recurringRequests, queueEntries) {
+            if(other != start && other->frequencyClock.lastTick != 0 &&
+                    time::period(&other->frequencyClock) == period) {
+                gap = MIN(gap, (other->frequencyClock.lastTick % period +
+                            period - startPhase) % period);
+            }
+        }
+
+        if(!found || gap > longestGap) {
+            found = true;
+            longestGap = gap;
+            target = (startPhase + gap / 2) % period;
+        }
+    }
+
+    unsigned long offset = 0;
+    if(found) {
+        offset = (target + period - time::systemTimeMs() % period) % period;
+    }
+    time::setPhase(&entry->frequencyClock, offset);
+}
+
 static void cleanupRequest(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* entry, bool force) {
     if(force || (entry->inFlight && requestCompleted(entry))) {
-        entry->inFlight = false;
+        if(!force) {
+            updateKnownResponders(entry);
+        }
+        landRequest(manager, entry);
 
         char request_string[128] = {0};
-        diagnostic_request_to_string(&entry->handle.request,
+        diagnostic_request_to_string(&entry->request,
                 request_string, sizeof(request_string));
         if(entry->recurring) {
             TAILQ_REMOVE(&manager->recurringRequests, entry, queueEntries);
             if(force) {
                 cancelRequest(manager, entry);
             } else {
-                debug("Moving completed recurring request to the back "
-                        "of the queue: %s", request_string);
-                TAILQ_INSERT_TAIL(&manager->recurringRequests, entry,
-                        queueEntries);
+                debug("Rescheduling completed recurring request: %s",
+                        request_string);
+                scheduleRecurringRequest(manager, entry);
             }
         } else {
             debug("Cancelling completed, non-recurring request: %s",
@@ -106,12 +479,18 @@ static void cleanupRequest(DiagnosticsManager* manager,
     }
 }
 
-// clean up the request list, move as many to the free list as possible
-static void cleanupActiveRequests(DiagnosticsManager* manager, bool force) {
+static void cleanupNonrecurringRequests(DiagnosticsManager* manager,
+        bool force) {
     ActiveDiagnosticRequest* entry, *tmp;
     LIST_FOREACH_SAFE(entry, &manager->nonrecurringRequests, listEntries, tmp) {
         cleanupRequest(manager, entry, force);
     }
+}
+
+// clean up the request list, move as many to the free list as possible
+static void cleanupActiveRequests(DiagnosticsManager* manager, bool force) {
+    ActiveDiagnosticRequest* entry, *tmp;
+    cleanupNonrecurringRequests(manager, force);
 
     TAILQ_FOREACH_SAFE(entry, &manager->recurringRequests, queueEntries, tmp) {
         cleanupRequest(manager, entry, force);
@@ -133,20 +512,92 @@ static bool sendDiagnosticCanMessage(CanBus* bus,
     return true;
 }
 
-static bool sendDiagnosticCanMessageBus1(
-        const uint32_t arbitrationId, const uint8_t* data,
-        const uint8_t size) {
-    return sendDiagnosticCanMessage(&getCanBuses()[0], arbitrationId, data,
-            size);
+/* Private: The frames handed to recordCanMessage, while a request is encoded
+ * to be cached instead of sent.
+ */
+static struct {
+    uint8_t data[CAN_MESSAGE_SIZE];
+    uint8_t length;
+    int count;
+} recordedFrame;
+
+static bool recordCanMessage(const uint32_t arbitrationId,
+        const uint8_t* data, const uint8_t size) {
+    if(recordedFrame.count++ == 0 && size <= sizeof(recordedFrame.data)) {
+        memcpy(recordedFrame.data, data, size);
+        recordedFrame.length = size;
+    }
+    return true;
 }
 
-static bool sendDiagnosticCanMessageBus2(
-        const uint32_t arbitrationId, const uint8_t* data,
-        const uint8_t size) {
-    return sendDiagnosticCanMessage(&getCanBuses()[1], arbitrationId, data,
+static bool discardCanMessage(const uint32_t arbitrationId,
+        const uint8_t* data, const uint8_t size) {
+    return true;
+}
+
+/* Private: Start a request on a handle the way the diagnostics library does,
+ * so it's ready for the response, but give the frame it encodes to sendShim
+ * and don't log it.
+ */
+static void startQuietly(DiagnosticShims* shims, DiagnosticRequest* request,
+        DiagnosticRequestHandle* handle, SendCanMessageShim sendShim) {
+    *handle = generate_diagnostic_request(shims, request, NULL);
+    IsoTpShims isotpShims = handle->isotp_shims;
+    handle->isotp_shims.log = NULL;
+    handle->isotp_shims.send_can_message = sendShim;
+    DiagnosticShims quietShims = *shims;
+    quietShims.log = NULL;
+    start_diagnostic_request(&quietShims, handle);
+    // Anything sent while receiving the response goes out as usual
+    handle->isotp_shims = isotpShims;
+}
+
+/* Private: Encode a recurring request once and keep the frame, if it fits in
+ * one, so sendRequest can send it again as it is.
+ */
+static void cacheRequestFrame(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* entry) {
+    DiagnosticRequestHandle handle;
+    recordedFrame.count = 0;
+    recordedFrame.length = 0;
+    startQuietly(&manager->shims[entry->bus->address - 1], &entry->request,
+            &handle, recordCanMessage);
+
+    entry->frameLength = 0;
+    if(recordedFrame.count == 1 && recordedFrame.length > 0 &&
+            !(handle.completed && !handle.success)) {
+        memcpy(entry->frame, recordedFrame.data, recordedFrame.length);
+        entry->frameLength = recordedFrame.length;
+    }
+}
+
+/* Private: Send a diagnostic request on the bus at ADDRESS. The shims take no
+ * context, so each bus address gets its own instance.
+ */
+template<int ADDRESS>
+static bool sendDiagnosticCanMessageOnBus(const uint32_t arbitrationId,
+        const uint8_t* data, const uint8_t size) {
+    CanBus* bus = lookupBus(ADDRESS, getCanBuses(), getCanBusCount());
+    return bus != NULL && sendDiagnosticCanMessage(bus, arbitrationId, data,
             size);
 }
 
+/* Private: Set up the shims for bus addresses 1 through COUNT.
+ */
+template<int COUNT>
+struct BusShims {
+    static void initialize(DiagnosticShims* shims) {
+        BusShims<COUNT - 1>::initialize(shims);
+        shims[COUNT - 1] = diagnostic_init_shims(openxc::util::log::debug,
+                sendDiagnosticCanMessageOnBus<COUNT>, NULL);
+    }
+};
+
+template<>
+struct BusShims<0> {
+    static void initialize(DiagnosticShims* shims) { }
+};
+
 void openxc::diagnostics::reset(DiagnosticsManager* manager) {
     if(manager->initialized) {
         debug("Clearing existing diagnostic requests");
@@ -156,98 +607,253 @@ void openxc::diagnostics::reset(DiagnosticsManager* manager) {
     TAILQ_INIT(&manager->recurringRequests);
     LIST_INIT(&manager->nonrecurringRequests);
     LIST_INIT(&manager->freeRequestEntries);
+    LIST_INIT(&manager->functionalRequests);
+    for(int i = 0; i < DIAGNOSTIC_RESPONSE_INDEX_SIZE; i++) {
+        LIST_INIT(&manager->responseIndex[i]);
+    }
 
     for(int i = 0; i < MAX_SIMULTANEOUS_DIAG_REQUESTS; i++) {
+        manager->requestListEntries[i].handle = NULL;
+        manager->requestListEntries[i].nameHandle = 0;
+        manager->requestListEntries[i].ecu = NULL;
         LIST_INSERT_HEAD(&manager->freeRequestEntries,
                 &manager->requestListEntries[i], listEntries);
     }
+
+    for(int i = 0; i < MAX_DIAGNOSTIC_ECUS; i++) {
+        manager->ecus[i].users = 0;
+    }
+    for(int i = 0; i < MAX_SHIM_COUNT; i++) {
+        manager->busReadyMs[i] = 0;
+    }
+    for(int i = 0; i < DIAGNOSTIC_SESSION_COUNT; i++) {
+        manager->sessions[i].bus = NULL;
+    }
+
+    LIST_INIT(&manager->freeRequestHandles);
+    for(int i = 0; i < MAX_IN_FLIGHT_DIAG_REQUESTS; i++) {
+        LIST_INSERT_HEAD(&manager->freeRequestHandles,
+                &manager->requestHandles[i], freeEntries);
+    }
+    manager->nameTableLength = 0;
+    for(int i = 0; i < DIAGNOSTIC_RESPONSE_CACHE_SIZE; i++) {
+        manager->responseCache[i].bus = NULL;
+    }
     debug("Reset diagnostics requests");
 }
 
 void openxc::diagnostics::initialize(DiagnosticsManager* manager, CanBus* buses,
         int busCount, uint8_t obd2BusAddress) {
-    if(busCount > 0) {
-        manager->shims[0] = diagnostic_init_shims(openxc::util::log::debug,
-                sendDiagnosticCanMessageBus1, NULL);
-        if(busCount > 1) {
-            manager->shims[1] = diagnostic_init_shims(openxc::util::log::debug,
-                    sendDiagnosticCanMessageBus2, NULL);
-        }
-    }
+    // Every address gets shims, whichever buses the message set uses
+    BusShims<MAX_SHIM_COUNT>::initialize(manager->shims);
 
     reset(manager);
     manager->initialized = true;
+    manager->streamingMinLength = DIAGNOSTIC_STREAMING_MIN_LENGTH;
+    manager->responseCacheTtlMs = DIAGNOSTIC_RESPONSE_CACHE_TTL_MS;
+    manager->dtcMonitorFrequencyHz = OBD2_DTC_MONITOR_FREQUENCY_HZ;
+    for(int i = 0; i < DIAGNOSTIC_FLOW_CONTROL_COUNT; i++) {
+        manager->flowControls[i].bus = NULL;
+    }
 
     manager->obd2Bus = lookupBus(obd2BusAddress, buses, busCount);
     obd2::initialize(manager);
     debug("Initialized diagnostics");
 }
 
-static inline bool conflicting(ActiveDiagnosticRequest* request,
-        ActiveDiagnosticRequest* candidate) {
-    return (candidate->inFlight && candidate != request &&
-            candidate->bus == request->bus &&
-            candidate->arbitration_id == request->arbitration_id);
+static DiagnosticSession* lookupSession(DiagnosticsManager* manager,
+        const CanBus* bus, uint32_t arbitrationId) {
+    for(int i = 0; i < DIAGNOSTIC_SESSION_COUNT; i++) {
+        DiagnosticSession* session = &manager->sessions[i];
+        if(session->bus == bus && session->arbitrationId == arbitrationId) {
+            return session;
+        }
+    }
+    return NULL;
 }
 
+/* Private: Returns the UDS sub-function byte of the request - its PID if it has
+ * one, or else the first byte of its payload - without the
+ * suppress-positive-response bit.
+ */
+static uint8_t subfunction(const DiagnosticRequest* request) {
+    if(request->has_pid) {
+        return request->pid & 0x7f;
+    }
+    return request->payload_length > 0 ? request->payload[0] & 0x7f : 0;
+}
 
-/* Private: Returns true if there are no other active requests to the same arb
- * ID.
+/* Private: Keep track of which ECUs are in a non-default diagnostic session
+ * from the positive responses to session control and reset requests.
  */
-static inline bool clearToSend(DiagnosticsManager* manager,
-        ActiveDiagnosticRequest* request) {
-    ActiveDiagnosticRequest* entry;
-    LIST_FOREACH(entry, &manager->nonrecurringRequests, listEntries) {
-        if(conflicting(request, entry)) {
-            return false;
+static void trackSession(DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* entry,
+        const DiagnosticResponse* response) {
+    if(!response->success || (entry->request.mode != UDS_SESSION_CONTROL_MODE &&
+                entry->request.mode != UDS_ECU_RESET_MODE)) {
+        return;
+    }
+
+    DiagnosticSession* session = lookupSession(manager, entry->bus,
+            entry->arbitration_id);
+    uint8_t type = subfunction(&entry->request);
+    if(entry->request.mode == UDS_ECU_RESET_MODE ||
+            type == UDS_DEFAULT_SESSION) {
+        if(session != NULL) {
+            debug("ECU 0x%x is back in the default diagnostic session",
+                    entry->arbitration_id);
+            session->bus = NULL;
         }
+        return;
     }
 
-    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
-        if(conflicting(request, entry)) {
-            return false;
+    if(session == NULL) {
+        for(int i = 0; session == NULL && i < DIAGNOSTIC_SESSION_COUNT; i++) {
+            if(manager->sessions[i].bus == NULL) {
+                session = &manager->sessions[i];
+            }
+        }
+        if(session == NULL) {
+            debug("Can't keep more than %d ECUs in a diagnostic session",
+                    DIAGNOSTIC_SESSION_COUNT);
+            return;
         }
+        session->bus = entry->bus;
+        session->arbitrationId = entry->arbitration_id;
     }
-    return true;
+    session->type = type;
+    session->keepaliveMs = time::systemTimeMs() +
+            DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS;
+}
+
+/* Private: Send a TesterPresent, with its response suppressed, to each ECU on
+ * the bus that's due one to stay in its diagnostic session. Nothing is
+ * published for them.
+ */
+static void sendTesterPresents(DiagnosticsManager* manager, CanBus* bus) {
+    if(DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS == 0) {
+        return;
+    }
+
+    unsigned long now = time::systemTimeMs();
+    for(int i = 0; i < DIAGNOSTIC_SESSION_COUNT; i++) {
+        DiagnosticSession* session = &manager->sessions[i];
+        if(session->bus == bus && reached(session->keepaliveMs, now)) {
+            uint8_t testerPresent[8] = {0x02, UDS_TESTER_PRESENT_MODE, 0x80};
+            sendDiagnosticCanMessage(bus, session->arbitrationId,
+                    testerPresent, sizeof(testerPresent));
+            session->keepaliveMs = now + DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS;
+        }
+    }
+}
+
+/* Private: Returns true if the request's ECU isn't waiting on a response to
+ * another request, and both the ECU and the bus are past their separation time
+ * since the last request. Requests to different ECUs go out back to back.
+ */
+static inline bool clearToSend(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* request) {
+    unsigned long now = time::systemTimeMs();
+    return !request->ecu->busy && reached(request->ecu->readyMs, now) &&
+            reached(manager->busReadyMs[request->bus->address - 1], now);
 }
 
 static inline bool shouldSend(ActiveDiagnosticRequest* request) {
     return !request->inFlight && (
             (!request->recurring && !requestCompleted(request)) ||
             (request->recurring && time::elapsed(&request->frequencyClock,
-                                                 true)));
+                                                 false)));
 }
 
+/* Private: Send the request if it's due, borrowing a handle from the pool for
+ * while it's in flight. If all of the handles are in use, the request stays
+ * due and is tried again on the next pass.
+ */
 static void sendRequest(DiagnosticsManager* manager, CanBus* bus,
         ActiveDiagnosticRequest* request) {
     if(request->bus == bus && shouldSend(request) &&
             clearToSend(manager, request)) {
+        request->handle = acquireHandle(manager);
+        if(request->handle == NULL) {
+            return;
+        }
+
         time::tick(&request->frequencyClock);
-        start_diagnostic_request(&manager->shims[bus->address - 1],
-                &request->handle);
-        if(request->handle.completed && !request->handle.success) {
+        if(request->frameLength > 0) {
+            startQuietly(&manager->shims[bus->address - 1], &request->request,
+                    request->handle, discardCanMessage);
+            sendDiagnosticCanMessage(bus, request->arbitration_id,
+                    request->frame, request->frameLength);
+        } else {
+            *request->handle = generate_diagnostic_request(
+                    &manager->shims[bus->address - 1], &request->request,
+                    NULL);
+            start_diagnostic_request(&manager->shims[bus->address - 1],
+                    request->handle);
+        }
+        if(request->handle->completed && !request->handle->success) {
             debug("Fatal error sending diagnostic request");
+            releaseHandle(manager, request);
+            if(!request->recurring) {
+                LIST_REMOVE(request, listEntries);
+                cancelRequest(manager, request);
+            }
         } else {
             request->timeoutClock = {0};
             request->timeoutClock.frequency = 10;
             time::tick(&request->timeoutClock);
             request->inFlight = true;
+            request->streamRemaining = 0;
+            request->respondersSeen = 0;
+            request->ecu->busy = true;
+            manager->busReadyMs[bus->address - 1] = time::systemTimeMs() +
+                    DIAGNOSTIC_BUS_SEPARATION_MS;
+
+            // Any request keeps the ECU in its session, as well as a
+            // TesterPresent would
+            DiagnosticSession* session = lookupSession(manager, bus,
+                    request->arbitration_id);
+            if(session != NULL) {
+                session->keepaliveMs = time::systemTimeMs() +
+                        DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS;
+            }
         }
     }
 }
 
 void openxc::diagnostics::sendRequests(DiagnosticsManager* manager,
         CanBus* bus) {
-    cleanupActiveRequests(manager, false);
+    cleanupNonrecurringRequests(manager, false);
 
-    ActiveDiagnosticRequest* entry;
-    LIST_FOREACH(entry, &manager->nonrecurringRequests, listEntries) {
+    ActiveDiagnosticRequest* entry, *tmp;
+    LIST_FOREACH_SAFE(entry, &manager->nonrecurringRequests, listEntries, tmp) {
         sendRequest(manager, bus, entry);
     }
 
-    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+    // The recurring queue is in order of when each request is next due, so
+    // only the front of it needs looking at. Take off everything that's due
+    // first, so a request that's rescheduled for right away (e.g. it's for
+    // another bus) isn't seen twice.
+    DiagnosticRequestQueue dueRequests;
+    TAILQ_INIT(&dueRequests);
+    unsigned long now = time::systemTimeMs();
+    while((entry = TAILQ_FIRST(&manager->recurringRequests)) != NULL &&
+            due(entry, now)) {
+        TAILQ_REMOVE(&manager->recurringRequests, entry, queueEntries);
+        TAILQ_INSERT_TAIL(&dueRequests, entry, queueEntries);
+    }
+
+    while((entry = TAILQ_FIRST(&dueRequests)) != NULL) {
+        TAILQ_REMOVE(&dueRequests, entry, queueEntries);
+        if(entry->inFlight && requestCompleted(entry)) {
+            updateKnownResponders(entry);
+            landRequest(manager, entry);
+        }
         sendRequest(manager, bus, entry);
+        scheduleRecurringRequest(manager, entry);
     }
+
+    sendTesterPresents(manager, bus);
 }
 
 static openxc_VehicleMessage wrapDiagnosticResponseWithSabot(CanBus* bus,
@@ -299,18 +905,42 @@ static openxc_VehicleMessage wrapDiagnosticResponseWithSabot(CanBus* bus,
     return message;
 }
 
+/* Private: Publish the value of a response under its name. A response named
+ * after a signal is published like the signal, so it's sent by ID when the
+ * name dictionary is enabled.
+ */
+static void publishNamedValue(const char* name, uint16_t nameHandle,
+        float value, Pipeline* pipeline) {
+    if(!(nameHandle & DIAGNOSTIC_NAME_SIGNAL)) {
+        publishNumericalMessage(name, value, pipeline);
+        return;
+    }
+
+    const CanSignal* signal = &getSignals()[
+            nameHandle & ~DIAGNOSTIC_NAME_SIGNAL];
+    openxc_DynamicField field = payload::wrapNumber(value);
+    pipeline::publishSignal(name,
+            signal->jsonNameLength == SIGNAL_JSON_NAME_ESCAPED ?
+                0 : signal->jsonNameLength,
+            nameHandle & ~DIAGNOSTIC_NAME_SIGNAL, 0, &field, NULL, pipeline);
+}
+
 static void relayDiagnosticResponse(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* request,
-        const DiagnosticResponse* response, Pipeline* pipeline) {
+        const DiagnosticResponse* response, uint16_t nameHandle,
+        Pipeline* pipeline) {
     float value = diagnostic_payload_to_integer(response);
     if(request->decoder != NULL) {
         value = request->decoder(response, value);
     }
 
-    if(response->success && strnlen(request->name, sizeof(request->name)) > 0) {
+    const char* name = lookupName(manager, nameHandle);
+    if(request->quiet) {
+        // only the callback wants it
+    } else if(response->success && name != NULL) {
         // If name, include 'value' instead of payload, and leave of response
         // details.
-        publishNumericalMessage(request->name, value, pipeline);
+        publishNamedValue(name, nameHandle, value, pipeline);
     } else {
         // If no name, send full details of response but still include 'value'
         // instead of 'payload' if they provided a decoder. The one case you
@@ -326,20 +956,224 @@ static void relayDiagnosticResponse(DiagnosticsManager* manager,
     }
 }
 
+/* Private: Relay a complete response to a request, published with the name
+ * with the given handle if it's not 0. A successful response to a request for
+ * multiple OBD-II PIDs is relayed as a separate response for each PID,
+ * published with the predefined name for the PID if it has one.
+ */
+static void relayCompleteResponse(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* request,
+        const DiagnosticResponse* response, uint16_t nameHandle,
+        Pipeline* pipeline) {
+    if(!response->success || request->decoder != obd2::handleObd2Pid ||
+            !obd2::isMultiPidRequest(&request->request)) {
+        relayDiagnosticResponse(manager, request, response, nameHandle,
+                pipeline);
+        return;
+    }
+
+    DiagnosticResponse pidResponse;
+    int offset = 0;
+    while((offset = obd2::nextPidResponse(response, offset,
+                    &pidResponse)) > 0) {
+        relayDiagnosticResponse(manager, request, &pidResponse,
+                obd2::pidName(pidResponse.pid) != NULL ?
+                    DIAGNOSTIC_NAME_OBD2_PID | pidResponse.pid : 0,
+                pipeline);
+    }
+}
+
+/* Private: Keep a successful, complete response to a one-time request that
+ * expects a single response, to answer identical commands with until it
+ * expires. It replaces an older response to the same request, or else the
+ * oldest response in the cache.
+ */
+static void cacheResponse(DiagnosticsManager* manager,
+        ActiveDiagnosticRequest* request, const DiagnosticResponse* response) {
+    if(manager->responseCacheTtlMs == 0 || request->recurring ||
+            request->waitForMultipleResponses || !response->success) {
+        return;
+    }
+
+    CachedDiagnosticResponse* slot = &manager->responseCache[0];
+    for(int i = 0; i < DIAGNOSTIC_RESPONSE_CACHE_SIZE; i++) {
+        CachedDiagnosticResponse* candidate = &manager->responseCache[i];
+        if(candidate->bus == request->bus && diagnostic_request_equals(
+                    &candidate->request, &request->request)) {
+            slot = candidate;
+            break;
+        } else if(slot->bus != NULL && (candidate->bus == NULL ||
+                (long)(candidate->receivedMs - slot->receivedMs) < 0)) {
+            slot = candidate;
+        }
+    }
+
+    slot->bus = request->bus;
+    slot->request = request->request;
+    slot->response = *response;
+    slot->receivedMs = time::systemTimeMs();
+}
+
+/* Private: Returns the cached response to an identical request on the bus if
+ * it hasn't expired yet, otherwise NULL.
+ */
+static CachedDiagnosticResponse* lookupCachedResponse(
+        DiagnosticsManager* manager, CanBus* bus,
+        const DiagnosticRequest* request) {
+    if(manager->responseCacheTtlMs == 0) {
+        return NULL;
+    }
+
+    for(int i = 0; i < DIAGNOSTIC_RESPONSE_CACHE_SIZE; i++) {
+        CachedDiagnosticResponse* candidate = &manager->responseCache[i];
+        if(candidate->bus == bus && diagnostic_request_equals(
+                    &candidate->request, request) &&
+                !reached(candidate->receivedMs + manager->responseCacheTtlMs,
+                    time::systemTimeMs())) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+/* Private: Publish one raw ISO-TP frame of a streamed response as a
+ * diagnostic response with the frame as its payload.
+ *
+ * The first byte of the payload is the frame's ISO-TP protocol control byte,
+ * which orders the chunks: 0x1N for the first, where the low 12 bits of the
+ * first 2 bytes are the total length of the response, and 0x2N for each chunk
+ * after that, where N is its sequence number mod 16.
+ */
+static void relayStreamedFrame(ActiveDiagnosticRequest* request,
+        CanMessage* message, Pipeline* pipeline) {
+    DiagnosticResponse chunk = {0};
+    chunk.arbitration_id = message->id;
+    chunk.mode = request->request.mode;
+    chunk.has_pid = request->request.has_pid;
+    chunk.pid = request->request.pid;
+    chunk.success = true;
+    memcpy(chunk.payload, message->data, message->length);
+    chunk.payload_length = message->length;
+
+    openxc_VehicleMessage vehicleMessage = wrapDiagnosticResponseWithSabot(
+            request->bus, request, &chunk, 0);
+    pipeline::publish(&vehicleMessage, pipeline);
+}
+
+/* Private: Returns the flow control parameters set for the request's ECU, or
+ * for its bus if the ECU has none of its own, or NULL to use the defaults.
+ */
+static const DiagnosticFlowControl* lookupFlowControl(
+        const DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* request) {
+    const DiagnosticFlowControl* busDefault = NULL;
+    for(int i = 0; i < DIAGNOSTIC_FLOW_CONTROL_COUNT; i++) {
+        const DiagnosticFlowControl* flowControl = &manager->flowControls[i];
+        if(flowControl->bus != request->bus) {
+            continue;
+        }
+
+        if(flowControl->arbitrationId == request->arbitration_id) {
+            return flowControl;
+        } else if(flowControl->arbitrationId == 0) {
+            busDefault = flowControl;
+        }
+    }
+    return busDefault;
+}
+
+/* Private: Clear the ECU to send the next block of a streamed response. */
+static void sendFlowControl(CanBus* bus, ActiveDiagnosticRequest* entry) {
+    uint8_t flowControl[8] = {0x30, entry->blockSize, entry->separationTime};
+    sendDiagnosticCanMessage(bus, entry->arbitration_id, flowControl,
+            sizeof(flowControl));
+    entry->blockRemaining = entry->blockSize;
+}
+
+/* Private: If the frame is part of a response to the request that should be
+ * streamed, relay it right away and keep track of the stream's progress
+ * instead of handing it to the diagnostics library to buffer.
+ *
+ * Returns true if the frame was consumed by a streamed response.
+ */
+static bool streamResponseFrame(DiagnosticsManager* manager, CanBus* bus,
+        ActiveDiagnosticRequest* entry, CanMessage* message,
+        Pipeline* pipeline) {
+    if(manager->streamingMinLength == 0 || entry->decoder != NULL ||
+            entry->quiet ||
+            entry->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID ||
+            message->id != entry->arbitration_id +
+                DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET ||
+            message->length < 2) {
+        return false;
+    }
+
+    uint8_t frameType = message->data[0] >> 4;
+    if(entry->streamRemaining == 0) {
+        uint16_t length = ((message->data[0] & 0xf) << 8) | message->data[1];
+        if(frameType != 1 || length < manager->streamingMinLength) {
+            return false;
+        }
+
+        const DiagnosticFlowControl* parameters = lookupFlowControl(manager,
+                entry);
+        entry->blockSize = parameters != NULL ? parameters->blockSize :
+                DIAGNOSTIC_FLOW_CONTROL_BLOCK_SIZE;
+        entry->separationTime = parameters != NULL ?
+                parameters->separationTime :
+                DIAGNOSTIC_FLOW_CONTROL_SEPARATION_TIME;
+        sendFlowControl(bus, entry);
+        entry->streamRemaining = length - 6;
+        entry->streamSequence = 1;
+    } else if(frameType != 2) {
+        return false;
+    } else if((message->data[0] & 0xf) != entry->streamSequence) {
+        debug("Missed a frame of a streamed diagnostic response, aborting it");
+        entry->streamRemaining = 0;
+        entry->handle->completed = true;
+        entry->handle->success = false;
+        return true;
+    } else {
+        entry->streamSequence = (entry->streamSequence + 1) & 0xf;
+        entry->streamRemaining -= entry->streamRemaining < 7 ?
+                entry->streamRemaining : 7;
+        // The ECU waits for flow control again after each full block
+        if(entry->blockSize > 0 && --entry->blockRemaining == 0 &&
+                entry->streamRemaining > 0) {
+            sendFlowControl(bus, entry);
+        }
+    }
+
+    relayStreamedFrame(entry, message, pipeline);
+    time::tick(&entry->timeoutClock);
+    if(entry->streamRemaining == 0) {
+        entry->handle->completed = true;
+        entry->handle->success = true;
+    }
+    return true;
+}
+
 static void receiveCanMessage(DiagnosticsManager* manager,
         CanBus* bus,
         ActiveDiagnosticRequest* entry,
         CanMessage* message, Pipeline* pipeline) {
-    if(bus == entry->bus && entry->inFlight) {
+    if(bus == entry->bus && entry->inFlight &&
+            !streamResponseFrame(manager, bus, entry, message, pipeline)) {
         DiagnosticResponse response = diagnostic_receive_can_frame(
                 // TODO eek, is bus address and array index this tightly
                 // coupled?
                 &manager->shims[bus->address - 1],
-                &entry->handle, message->id, message->data, message->length);
-        if(response.completed && entry->handle.completed) {
-            if(entry->handle.success) {
-                relayDiagnosticResponse(manager, entry, &response,
-                        pipeline);
+                entry->handle, message->id, message->data, message->length);
+        if(response.completed && isFunctionalResponse(message->id)) {
+            entry->respondersSeen |= 1 << (message->id -
+                    OBD2_FUNCTIONAL_RESPONSE_START);
+        }
+        if(response.completed && entry->handle->completed) {
+            if(entry->handle->success) {
+                trackSession(manager, entry, &response);
+                cacheResponse(manager, entry, &response);
+                relayCompleteResponse(manager, entry, &response,
+                        entry->nameHandle, pipeline);
             } else {
                 debug("Fatal error sending or receiving diagnostic request");
             }
@@ -347,18 +1181,44 @@ static void receiveCanMessage(DiagnosticsManager* manager,
             // Reset the timeout clock while completing the multi-frame receive
             time::tick(&entry->timeoutClock);
         }
+
+        if(knownRespondersAnswered(entry)) {
+            // Everyone it's waiting for has answered, so free up the handle
+            // and the ECUs now instead of when it times out
+            TAILQ_REMOVE(&manager->recurringRequests, entry, queueEntries);
+            updateKnownResponders(entry);
+            landRequest(manager, entry);
+            scheduleRecurringRequest(manager, entry);
+        }
     }
 }
 
+const char* openxc::diagnostics::requestName(const DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* request) {
+    return lookupName(manager, request->nameHandle);
+}
+
 void openxc::diagnostics::receiveCanMessage(DiagnosticsManager* manager,
         CanBus* bus, CanMessage* message, Pipeline* pipeline) {
+    DiagnosticRequestList* bucket = responseBucket(manager, message->id);
+    bool functional = isFunctionalResponse(message->id) &&
+            !LIST_EMPTY(&manager->functionalRequests);
+    if(LIST_EMPTY(bucket) && !functional) {
+        // not a response to anything we're waiting for - most traffic
+        return;
+    }
+
+    // Other arbitration IDs that share the bucket are filtered out by the
+    // diagnostics library when it checks the frame against each request.
     ActiveDiagnosticRequest* entry;
-    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+    LIST_FOREACH(entry, bucket, indexEntries) {
         receiveCanMessage(manager, bus, entry, message, pipeline);
     }
 
-    LIST_FOREACH(entry, &manager->nonrecurringRequests, listEntries) {
-        receiveCanMessage(manager, bus, entry, message, pipeline);
+    if(functional) {
+        LIST_FOREACH(entry, &manager->functionalRequests, indexEntries) {
+            receiveCanMessage(manager, bus, entry, message, pipeline);
+        }
     }
     cleanupActiveRequests(manager, false);
 }
@@ -373,7 +1233,7 @@ static ActiveDiagnosticRequest* lookupRecurringRequest(
     TAILQ_FOREACH_SAFE(entry, &manager->recurringRequests, queueEntries, tmp) {
         ActiveDiagnosticRequest* candidate = entry;
         if(candidate->bus == bus && diagnostic_request_equals(
-                    &candidate->handle.request, request)) {
+                    &candidate->request, request)) {
             TAILQ_REMOVE(&manager->recurringRequests, entry, queueEntries);
             existingEntry = entry;
             break;
@@ -392,6 +1252,44 @@ bool openxc::diagnostics::cancelRecurringRequest(
     return entry != NULL;
 }
 
+static bool validSeparationTime(uint8_t separationTime) {
+    return separationTime <= 0x7f ||
+            (separationTime >= 0xf1 && separationTime <= 0xf9);
+}
+
+bool openxc::diagnostics::setFlowControl(DiagnosticsManager* manager,
+        CanBus* bus, uint32_t arbitrationId, uint8_t blockSize,
+        uint8_t separationTime) {
+    if(!validSeparationTime(separationTime)) {
+        debug("Invalid ISO-TP separation time 0x%x", separationTime);
+        return false;
+    }
+
+    DiagnosticFlowControl* slot = NULL;
+    for(int i = 0; i < DIAGNOSTIC_FLOW_CONTROL_COUNT; i++) {
+        DiagnosticFlowControl* flowControl = &manager->flowControls[i];
+        if(flowControl->bus == bus &&
+                flowControl->arbitrationId == arbitrationId) {
+            slot = flowControl;
+            break;
+        } else if(flowControl->bus == NULL && slot == NULL) {
+            slot = flowControl;
+        }
+    }
+
+    if(slot == NULL) {
+        debug("Can't set flow control for more than %d buses and ECUs",
+                DIAGNOSTIC_FLOW_CONTROL_COUNT);
+        return false;
+    }
+
+    slot->bus = bus;
+    slot->arbitrationId = arbitrationId;
+    slot->blockSize = blockSize;
+    slot->separationTime = separationTime;
+    return true;
+}
+
 static ActiveDiagnosticRequest* getFreeEntry(DiagnosticsManager* manager) {
     ActiveDiagnosticRequest* entry = LIST_FIRST(&manager->freeRequestEntries);
     // Don't remove it from the free list yet, because there's still an
@@ -406,14 +1304,9 @@ static bool updateRequiredAcceptanceFilters(CanBus* bus,
         DiagnosticRequest* request) {
     bool filterStatus = true;
     if(request->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
-        for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
-                filter < OBD2_FUNCTIONAL_RESPONSE_START +
-                OBD2_FUNCTIONAL_RESPONSE_COUNT;
-                filter++) {
-            filterStatus = filterStatus && addAcceptanceFilter(bus, filter,
-                    CanMessageFormat::STANDARD, getCanBuses(),
-                    getCanBusCount());
-        }
+        filterStatus = addAcceptanceFilterRange(bus,
+                OBD2_FUNCTIONAL_RESPONSE_START, OBD2_FUNCTIONAL_RESPONSE_COUNT,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
     } else {
         filterStatus = addAcceptanceFilter(bus,
                 request->arbitration_id +
@@ -430,19 +1323,17 @@ static bool updateRequiredAcceptanceFilters(CanBus* bus,
 }
 
 static void updateDiagnosticRequestEntry(ActiveDiagnosticRequest* entry,
-        DiagnosticsManager* manager, CanBus* bus, DiagnosticRequest* request,
-        const char* name, bool waitForMultipleResponses,
+        CanBus* bus, DiagnosticRequest* request, uint16_t nameHandle,
+        DiagnosticEcu* ecu, bool waitForMultipleResponses,
         const DiagnosticResponseDecoder decoder,
         const DiagnosticResponseCallback callback, float frequencyHz) {
     entry->bus = bus;
     entry->arbitration_id = request->arbitration_id;
-    entry->handle = generate_diagnostic_request(
-            &manager->shims[bus->address - 1], request, NULL);
-    if(name != NULL) {
-        strncpy(entry->name, name, MAX_GENERIC_NAME_LENGTH);
-    } else {
-        entry->name[0] = '\0';
-    }
+    entry->request = *request;
+    entry->ecu = ecu;
+    // the handle is generated when the request is sent
+    entry->handle = NULL;
+    entry->nameHandle = nameHandle;
     entry->waitForMultipleResponses = waitForMultipleResponses;
 
     entry->decoder = decoder;
@@ -453,7 +1344,12 @@ static void updateDiagnosticRequestEntry(ActiveDiagnosticRequest* entry,
     // time out after 100ms
     entry->timeoutClock = {0};
     entry->timeoutClock.frequency = 10;
+    entry->quiet = false;
     entry->inFlight = false;
+    entry->frameLength = 0;
+    entry->knownResponders = 0;
+    entry->respondersSeen = 0;
+    entry->discoveryCycles = 0;
 }
 
 bool openxc::diagnostics::addRequest(DiagnosticsManager* manager,
@@ -462,27 +1358,30 @@ bool openxc::diagnostics::addRequest(DiagnosticsManager* manager,
         const DiagnosticResponseCallback callback) {
     cleanupActiveRequests(manager, false);
 
-    bool added = true;
+    bool added = false;
     ActiveDiagnosticRequest* entry = getFreeEntry(manager);
-    if(entry != NULL) {
-        if(updateRequiredAcceptanceFilters(bus, request)) {
-            updateDiagnosticRequestEntry(entry, manager, bus, request, name,
-                    waitForMultipleResponses, decoder, callback, 0);
+    int nameHandle = -1;
+    DiagnosticEcu* ecu = NULL;
+    if(entry != NULL && (nameHandle = internName(manager, name)) >= 0 &&
+            (ecu = acquireEcu(manager, bus, request->arbitration_id)) != NULL &&
+            updateRequiredAcceptanceFilters(bus, request)) {
+        updateDiagnosticRequestEntry(entry, bus, request, nameHandle, ecu,
+                waitForMultipleResponses, decoder, callback, 0);
 
-            char request_string[128] = {0};
-            diagnostic_request_to_string(&entry->handle.request, request_string,
-                    sizeof(request_string));
+        char request_string[128] = {0};
+        diagnostic_request_to_string(&entry->request, request_string,
+                sizeof(request_string));
 
-            LIST_REMOVE(entry, listEntries);
-            debug("Added one-time diagnostic request on bus %d: %s",
-                    bus->address, request_string);
+        LIST_REMOVE(entry, listEntries);
+        debug("Added one-time diagnostic request on bus %d: %s",
+                bus->address, request_string);
 
-            LIST_INSERT_HEAD(&manager->nonrecurringRequests, entry, listEntries);
-        } else {
-            added = false;
-        }
+        LIST_INSERT_HEAD(&manager->nonrecurringRequests, entry, listEntries);
+        indexRequest(manager, entry);
+        added = true;
     } else {
-        added = false;
+        releaseName(manager, nameHandle);
+        releaseEcu(ecu);
     }
     return added;
 }
@@ -497,47 +1396,89 @@ static bool validateOptionalRequestAttributes(float frequencyHz) {
     return true;
 }
 
-bool openxc::diagnostics::addRecurringRequest(DiagnosticsManager* manager,
+/* Private: Add a recurring request, as with addRecurringRequest. If quiet,
+ * its responses are only handed to the callback.
+ */
+static bool addRecurringEntry(DiagnosticsManager* manager,
         CanBus* bus, DiagnosticRequest* request, const char* name,
         bool waitForMultipleResponses, const DiagnosticResponseDecoder decoder,
-        const DiagnosticResponseCallback callback, float frequencyHz) {
-
+        const DiagnosticResponseCallback callback, float frequencyHz,
+        bool quiet) {
     if(!validateOptionalRequestAttributes(frequencyHz)) {
         return false;
     }
 
     cleanupActiveRequests(manager, false);
 
-    bool added = true;
+    bool added = false;
     if(lookupRecurringRequest(manager, bus, request) == NULL) {
         ActiveDiagnosticRequest* entry = getFreeEntry(manager);
-        if(entry != NULL) {
-            if(updateRequiredAcceptanceFilters(bus, request)) {
-                updateDiagnosticRequestEntry(entry, manager, bus, request, name,
-                        waitForMultipleResponses, decoder, callback, frequencyHz);
+        int nameHandle = -1;
+        DiagnosticEcu* ecu = NULL;
+        if(entry != NULL && (nameHandle = internName(manager, name)) >= 0 &&
+                (ecu = acquireEcu(manager, bus,
+                        request->arbitration_id)) != NULL &&
+                updateRequiredAcceptanceFilters(bus, request)) {
+            updateDiagnosticRequestEntry(entry, bus, request, nameHandle, ecu,
+                    waitForMultipleResponses, decoder, callback, frequencyHz);
+            entry->quiet = quiet;
+            cacheRequestFrame(manager, entry);
 
-                char request_string[128] = {0};
-                diagnostic_request_to_string(&entry->handle.request, request_string,
-                        sizeof(request_string));
+            char request_string[128] = {0};
+            diagnostic_request_to_string(&entry->request, request_string,
+                    sizeof(request_string));
 
-                LIST_REMOVE(entry, listEntries);
-                debug("Added recurring diagnostic request (freq: %f) on bus %d: %s",
-                        frequencyHz, bus->address, request_string);
+            LIST_REMOVE(entry, listEntries);
+            debug("Added recurring diagnostic request (freq: %f) on bus %d: %s",
+                    frequencyHz, bus->address, request_string);
 
-                TAILQ_INSERT_HEAD(&manager->recurringRequests, entry, queueEntries);
-            } else {
-                added = false;
-            }
+            phaseRecurringRequest(manager, entry);
+            scheduleRecurringRequest(manager, entry);
+            indexRequest(manager, entry);
+            added = true;
         } else {
-            added = false;
+            releaseName(manager, nameHandle);
+            releaseEcu(ecu);
         }
     } else {
         debug("Can't add request, one already exists with same key");
-        added = false;
     }
     return added;
 }
 
+bool openxc::diagnostics::addRecurringRequest(DiagnosticsManager* manager,
+        CanBus* bus, DiagnosticRequest* request, const char* name,
+        bool waitForMultipleResponses, const DiagnosticResponseDecoder decoder,
+        const DiagnosticResponseCallback callback, float frequencyHz) {
+    return addRecurringEntry(manager, bus, request, name,
+            waitForMultipleResponses, decoder, callback, frequencyHz, false);
+}
+
+bool openxc::diagnostics::addQuietRecurringRequest(DiagnosticsManager* manager,
+        CanBus* bus, DiagnosticRequest* request,
+        bool waitForMultipleResponses,
+        const DiagnosticResponseCallback callback, float frequencyHz) {
+    return addRecurringEntry(manager, bus, request, NULL,
+            waitForMultipleResponses, NULL, callback, frequencyHz, true);
+}
+
+bool openxc::diagnostics::updateRecurringRequestFrequency(
+        DiagnosticsManager* manager, CanBus* bus, DiagnosticRequest* request,
+        float frequencyHz) {
+    if(frequencyHz <= 0 || !validateOptionalRequestAttributes(frequencyHz)) {
+        return false;
+    }
+
+    ActiveDiagnosticRequest* entry = lookupRecurringRequest(manager, bus,
+            request);
+    if(entry != NULL) {
+        entry->frequencyClock.frequency = frequencyHz;
+        phaseRecurringRequest(manager, entry);
+        scheduleRecurringRequest(manager, entry);
+    }
+    return entry != NULL;
+}
+
 bool openxc::diagnostics::addRecurringRequest(DiagnosticsManager* manager,
         CanBus* bus, DiagnosticRequest* request, const char* name,
         bool waitForMultipleResponses, float frequencyHz) {
@@ -562,6 +1503,73 @@ bool openxc::diagnostics::addRequest(DiagnosticsManager* manager,
     return addRequest(manager, bus, request, NULL, false, NULL, NULL);
 }
 
+/* Private: Returns an active one-time request that will publish exactly what
+ * a new request with these attributes would, or NULL if there isn't one.
+ */
+static ActiveDiagnosticRequest* lookupPendingRequest(
+        DiagnosticsManager* manager, CanBus* bus,
+        const DiagnosticRequest* request, const char* name,
+        bool waitForMultipleResponses,
+        const DiagnosticResponseDecoder decoder) {
+    ActiveDiagnosticRequest* entry;
+    LIST_FOREACH(entry, &manager->nonrecurringRequests, listEntries) {
+        const char* entryName = openxc::diagnostics::requestName(manager,
+                entry);
+        if(entry->bus == bus && entry->decoder == decoder &&
+                entry->callback == NULL &&
+                entry->waitForMultipleResponses == waitForMultipleResponses &&
+                diagnostic_request_equals(&entry->request, request) &&
+                (entryName == name || (entryName != NULL && name != NULL &&
+                    !strcmp(entryName, name)))) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Private: Answer a one-time request command without sending it to the
+ * vehicle, if an identical request was recently answered or is waiting for its
+ * response already.
+ *
+ * Returns true if the command was answered or will be.
+ */
+static bool answerDuplicateRequest(DiagnosticsManager* manager, CanBus* bus,
+        DiagnosticRequest* request, const char* name,
+        bool waitForMultipleResponses,
+        const DiagnosticResponseDecoder decoder) {
+    if(manager->responseCacheTtlMs == 0) {
+        return false;
+    }
+
+    CachedDiagnosticResponse* cached = waitForMultipleResponses ? NULL :
+            lookupCachedResponse(manager, bus, request);
+    if(cached != NULL) {
+        int nameHandle = internName(manager, name);
+        if(nameHandle < 0) {
+            return false;
+        }
+
+        debug("Answering diagnostic request from a cached response");
+        ActiveDiagnosticRequest answered = {0};
+        answered.bus = bus;
+        answered.arbitration_id = request->arbitration_id;
+        answered.request = *request;
+        answered.decoder = decoder;
+        relayCompleteResponse(manager, &answered, &cached->response,
+                nameHandle, &getConfiguration()->pipeline);
+        releaseName(manager, nameHandle);
+        return true;
+    }
+
+    if(lookupPendingRequest(manager, bus, request, name,
+                waitForMultipleResponses, decoder) != NULL) {
+        debug("Identical diagnostic request already pending, sharing its "
+                "response");
+        return true;
+    }
+    return false;
+}
+
 /* Private: After checking for a proper CAN bus and the necessary write
  * permissions, process the requested command.
  */
@@ -617,12 +1625,12 @@ static bool handleAuthorizedCommand(DiagnosticsManager* manager,
                     NULL,
                     commandRequest->frequency);
         } else {
-            status = addRequest(manager, bus, &request,
-                    commandRequest->has_name ?
-                            commandRequest->name : NULL,
-                    multipleResponses,
-                    decoder,
-                    NULL);
+            const char* name = commandRequest->has_name ?
+                    commandRequest->name : NULL;
+            status = answerDuplicateRequest(manager, bus, &request, name,
+                        multipleResponses, decoder) ||
+                    addRequest(manager, bus, &request, name,
+                        multipleResponses, decoder, NULL);
         }
     } else if(diagControlCommand->action == openxc_DiagnosticControlCommand_Action_CANCEL) {
         status = cancelRecurringRequest(manager, bus, &request);
@@ -711,6 +1719,72 @@ bool openxc::diagnostics::handleDiagnosticCommand(
     return status;
 }
 
+int openxc::diagnostics::saveRecurringRequests(DiagnosticsManager* manager,
+        SavedDiagnosticRequest* requests, int maxCount) {
+    int count = 0;
+    ActiveDiagnosticRequest* entry;
+    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+        SavedDecoder decoder;
+        if(entry->decoder == NULL) {
+            decoder = SAVED_DECODER_NONE;
+        } else if(entry->decoder == passthroughDecoder) {
+            decoder = SAVED_DECODER_PASSTHROUGH;
+        } else if(entry->decoder == obd2::handleObd2Pid) {
+            decoder = SAVED_DECODER_OBD2;
+        } else {
+            continue;
+        }
+
+        const char* name = requestName(manager, entry);
+        if(entry->callback != NULL || (name != NULL &&
+                    strlen(name) >= MAX_GENERIC_NAME_LENGTH)) {
+            continue;
+        }
+
+        if(count == maxCount) {
+            debug("No room to save recurring request to 0x%x",
+                    entry->arbitration_id);
+            break;
+        }
+
+        SavedDiagnosticRequest* saved = &requests[count++];
+        memset(saved, 0, sizeof(SavedDiagnosticRequest));
+        saved->busAddress = entry->bus->address;
+        saved->decoder = decoder;
+        saved->waitForMultipleResponses = entry->waitForMultipleResponses;
+        saved->frequencyHz = entry->frequencyClock.frequency;
+        saved->request = entry->request;
+        if(name != NULL) {
+            strcpy(saved->name, name);
+        }
+    }
+    return count;
+}
+
+bool openxc::diagnostics::restoreRecurringRequest(DiagnosticsManager* manager,
+        const SavedDiagnosticRequest* saved) {
+    CanBus* bus = lookupBus(saved->busAddress, getCanBuses(),
+            getCanBusCount());
+    if(bus == NULL || !bus->rawWritable) {
+        debug("Can't restore diagnostic request on bus %d",
+                saved->busAddress);
+        return false;
+    }
+
+    DiagnosticResponseDecoder decoder = NULL;
+    if(saved->decoder == SAVED_DECODER_PASSTHROUGH) {
+        decoder = passthroughDecoder;
+    } else if(saved->decoder == SAVED_DECODER_OBD2) {
+        decoder = obd2::handleObd2Pid;
+    }
+
+    DiagnosticRequest request = saved->request;
+    return addRecurringRequest(manager, bus, &request,
+            saved->name[0] != '\0' ? saved->name : NULL,
+            saved->waitForMultipleResponses, decoder, NULL,
+            saved->frequencyHz);
+}
+
 float openxc::diagnostics::passthroughDecoder(
         const DiagnosticResponse* response, float parsed_payload) {
     return parsed_payload;
@@ -11,20 +11,160 @@
 #include <uds/uds.h>
 #include "openxc.pb.h"
 
-/* Private: The maximum number of simultanous diagnostic requests. Increasing
- * this number will use more memory on the stack.
+/* Private: The maximum number of simultanous diagnostic requests, recurring or
+ * not. Each one costs roughly 100 bytes of RAM - the name and the request
+ * handle used while it's in flight are stored separately.
  */
-#define MAX_SIMULTANEOUS_DIAG_REQUESTS 20
+#ifndef MAX_SIMULTANEOUS_DIAG_REQUESTS
+#define MAX_SIMULTANEOUS_DIAG_REQUESTS 64
+#endif
+
+/* Private: The maximum number of diagnostic requests that can be in flight
+ * (sent and waiting for a response) at one time. A request handle is borrowed
+ * from a pool of this size when a request is sent and returned when it's
+ * completed or times out. Requests that are due while the pool is empty are
+ * sent once a handle is free.
+ */
+#ifndef MAX_IN_FLIGHT_DIAG_REQUESTS
+#define MAX_IN_FLIGHT_DIAG_REQUESTS 8
+#endif
+
+/* Private: The size in bytes of the table that stores the human-readable names
+ * of active diagnostic requests. Each distinct name is stored once, and costs
+ * its length plus 2 bytes. Names that are already in flash - the generic name
+ * of a signal, or of a predefined OBD-II PID - aren't stored at all.
+ */
+#ifndef DIAGNOSTIC_NAME_TABLE_SIZE
+#define DIAGNOSTIC_NAME_TABLE_SIZE 1024
+#endif
+
+/* Private: The flags of a request's name handle that refer to a name in flash
+ * instead of the name table. With DIAGNOSTIC_NAME_SIGNAL, the rest of the
+ * handle is the signal's ID (its index in the signal table), and with
+ * DIAGNOSTIC_NAME_OBD2_PID it's the PID.
+ */
+#define DIAGNOSTIC_NAME_SIGNAL 0x8000
+#define DIAGNOSTIC_NAME_OBD2_PID 0x4000
+
+#if DIAGNOSTIC_NAME_TABLE_SIZE > DIAGNOSTIC_NAME_OBD2_PID
+#error "DIAGNOSTIC_NAME_TABLE_SIZE must fit in 14 bits"
+#endif
 
 /* Private: The maximum length for a human-readable name for a diagnostic
  * response.
  */
 #define MAX_GENERIC_NAME_LENGTH 40
 
-/* Private: Each CAN bus needs its own set of shim functions, so this should
- * match the maximum CAN controller count.
+/* Private: Each CAN bus needs its own set of shim functions, indexed by the
+ * bus address - 1.
+ */
+#define MAX_SHIM_COUNT MAX_CAN_CONTROLLERS
+
+/* Private: Responses to a request sent to an ECU's arbitration ID arrive on
+ * this much higher an arbitration ID.
+ */
+#define DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET 0x8
+
+/* Private: The maximum number of ECUs - distinct request arbitration IDs on
+ * a bus - that can have active requests. Every one needs a CAN acceptance
+ * filter, so there can't be more than there are filters.
+ */
+#define MAX_DIAGNOSTIC_ECUS (MAX_SHIM_COUNT * MAX_ACCEPTANCE_FILTERS)
+
+/* Private: The minimum time in milliseconds after an ECU responds to (or times
+ * out on) a request before another request is sent to it.
+ */
+#ifndef DIAGNOSTIC_ECU_SEPARATION_MS
+#define DIAGNOSTIC_ECU_SEPARATION_MS 0
+#endif
+
+/* Private: The minimum time in milliseconds between sending diagnostic
+ * requests on the same bus, to any ECU.
+ */
+#ifndef DIAGNOSTIC_BUS_SEPARATION_MS
+#define DIAGNOSTIC_BUS_SEPARATION_MS 0
+#endif
+
+/* Public: Responses to physically addressed requests without a decoder that
+ * are at least this many bytes long are streamed by default - relayed one
+ * ISO-TP frame at a time as they arrive, instead of being reassembled in full
+ * first. If 0, responses are never streamed.
+ */
+#ifndef DIAGNOSTIC_STREAMING_MIN_LENGTH
+#define DIAGNOSTIC_STREAMING_MIN_LENGTH 0
+#endif
+
+/* Public: The ISO-TP block size the VI asks an ECU for in the flow control
+ * frame for a streamed response - the number of consecutive frames the ECU
+ * sends before waiting for another flow control frame. If 0, the ECU sends the
+ * whole response without waiting.
+ */
+#ifndef DIAGNOSTIC_FLOW_CONTROL_BLOCK_SIZE
+#define DIAGNOSTIC_FLOW_CONTROL_BLOCK_SIZE 0
+#endif
+
+/* Public: The ISO-TP separation time (STmin) the VI asks an ECU for in the flow
+ * control frame for a streamed response, in its encoded form - 0 to 0x7f for
+ * that many milliseconds between consecutive frames, or 0xf1 to 0xf9 for 100 to
+ * 900 microseconds.
+ */
+#ifndef DIAGNOSTIC_FLOW_CONTROL_SEPARATION_TIME
+#define DIAGNOSTIC_FLOW_CONTROL_SEPARATION_TIME 0
+#endif
+
+/* Public: The number of buses and ECUs that can be given their own flow control
+ * parameters, instead of the DIAGNOSTIC_FLOW_CONTROL_* defaults.
+ */
+#ifndef DIAGNOSTIC_FLOW_CONTROL_COUNT
+#define DIAGNOSTIC_FLOW_CONTROL_COUNT 8
+#endif
+
+/* Public: How often in milliseconds the VI sends a TesterPresent to an ECU
+ * that's in a non-default UDS diagnostic session, to keep it from dropping back
+ * to the default session. Any other request sent to the ECU puts off the next
+ * one. If 0, the VI never sends them.
+ */
+#ifndef DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS
+#define DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS 2000
+#endif
+
+/* Public: The number of ECUs that can be kept in a non-default UDS diagnostic
+ * session at once.
+ */
+#ifndef DIAGNOSTIC_SESSION_COUNT
+#define DIAGNOSTIC_SESSION_COUNT 4
+#endif
+
+/* Public: How many times a recurring functional broadcast request that waits
+ * for multiple responses runs to its full timeout, to learn which ECUs answer
+ * it. After that it completes as soon as all of them have responded, with the
+ * timeout only as a fallback. If it ever times out without a response from one
+ * of them, it learns the ECUs again. If 0, it always waits for the timeout.
+ */
+#ifndef DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES
+#define DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES 3
+#endif
+
+/* Public: The number of responses to one-time diagnostic requests kept to
+ * answer identical requests with.
+ */
+#ifndef DIAGNOSTIC_RESPONSE_CACHE_SIZE
+#define DIAGNOSTIC_RESPONSE_CACHE_SIZE 4
+#endif
+
+/* Public: How long in milliseconds a response to a one-time diagnostic request
+ * command answers identical commands, without sending them to the vehicle. An
+ * identical command that arrives while the request is still waiting for its
+ * response shares that response. If 0, every command is sent.
  */
-#define MAX_SHIM_COUNT 2
+#ifndef DIAGNOSTIC_RESPONSE_CACHE_TTL_MS
+#define DIAGNOSTIC_RESPONSE_CACHE_TTL_MS 0
+#endif
+
+/* Private: The number of buckets in the index of active requests by the
+ * arbitration ID of their responses. Must be a power of 2.
+ */
+#define DIAGNOSTIC_RESPONSE_INDEX_SIZE 16
 
 namespace openxc {
 namespace diagnostics {
@@ -54,17 +194,92 @@ typedef void (*DiagnosticResponseCallback)(
         const DiagnosticResponse* response,
         float parsed_payload);
 
+/* Private: The pacing state of one ECU, shared by all of the active requests
+ * sent to it. An ECU is only sent one request at a time.
+ *
+ * bus - The CAN bus the ECU is on.
+ * arbitrationId - The arbitration ID requests to the ECU are sent to. All
+ *      functional broadcast requests on a bus share one DiagnosticEcu.
+ * users - The number of active requests to the ECU. If 0, this slot is free.
+ * busy - True if a request to the ECU is in flight.
+ * readyMs - The time (from time::systemTimeMs) the ECU can next be sent a
+ *      request, once it isn't busy.
+ */
+struct DiagnosticEcu {
+    CanBus* bus;
+    uint32_t arbitrationId;
+    uint16_t users;
+    bool busy;
+    unsigned long readyMs;
+};
+typedef struct DiagnosticEcu DiagnosticEcu;
+
+/* Private: The ISO-TP flow control parameters for streamed responses from one
+ * ECU, or from every ECU on a bus that isn't given its own.
+ *
+ * bus - The CAN bus of the ECU, or NULL if this slot is free.
+ * arbitrationId - The arbitration ID requests to the ECU are sent to, or 0 for
+ *      the bus's default.
+ * blockSize - The block size, as with DIAGNOSTIC_FLOW_CONTROL_BLOCK_SIZE.
+ * separationTime - The encoded STmin, as with
+ *      DIAGNOSTIC_FLOW_CONTROL_SEPARATION_TIME.
+ */
+struct DiagnosticFlowControl {
+    CanBus* bus;
+    uint32_t arbitrationId;
+    uint8_t blockSize;
+    uint8_t separationTime;
+};
+typedef struct DiagnosticFlowControl DiagnosticFlowControl;
+
+/* Private: An ECU that's been switched to a non-default UDS diagnostic session,
+ * and is kept there with TesterPresent requests.
+ *
+ * bus - The CAN bus of the ECU, or NULL if this slot is free.
+ * arbitrationId - The arbitration ID requests to the ECU are sent to.
+ * type - The diagnostic session type, e.g. 0x3 for the extended session.
+ * keepaliveMs - The time (from time::systemTimeMs) the next TesterPresent is
+ *      due.
+ */
+struct DiagnosticSession {
+    CanBus* bus;
+    uint32_t arbitrationId;
+    uint8_t type;
+    unsigned long keepaliveMs;
+};
+typedef struct DiagnosticSession DiagnosticSession;
+
+/* Private: A recent response to a one-time diagnostic request.
+ *
+ * bus - The CAN bus the request was sent on, or NULL if this slot is empty.
+ * request - The request that was answered.
+ * response - The (complete) response.
+ * receivedMs - The time (from time::systemTimeMs) the response was received.
+ */
+struct CachedDiagnosticResponse {
+    CanBus* bus;
+    DiagnosticRequest request;
+    DiagnosticResponse response;
+    unsigned long receivedMs;
+};
+typedef struct CachedDiagnosticResponse CachedDiagnosticResponse;
+
 /* Private: An active diagnostic request, either recurring or one-time.
  *
  * bus - The CAN bus this request should be made on, or is currently in flight
  *      on.
  * arbitration_id - The arbitration ID (aka message ID) for the request.
+ * request - The parameters for the request.
+ * ecu - (Private) The pacing state of the ECU the request is sent to.
  * handle - (Private) A handle for the request to keep track of it between
  *      sending the frames of the request and receiving all frames of the
- *      response.
- * name - An optional human readable name this response, to be used when
- *      publishing received responses. If the name is NULL, the published output
- *      will use the raw OBD-II response format.
+ *      response. This is borrowed from the manager's handle pool while the
+ *      request is in flight, and is NULL otherwise.
+ * nameHandle - (Private) The offset of this request's human readable name in
+ *      the manager's name table, the signal or PID it's named after with
+ *      DIAGNOSTIC_NAME_SIGNAL or DIAGNOSTIC_NAME_OBD2_PID, or 0 if it has no
+ *      name. Use requestName to look up the name itself. If there is no name,
+ *      the published output will use the raw OBD-II response format.
  * decoder - An optional DiagnosticResponseDecoder to parse the payload of
  *      responses to this request. If the decoder is NULL, the output will
  *      include the raw payload instead of a parsed value.
@@ -77,6 +292,8 @@ typedef void (*DiagnosticResponseCallback)(
  *      for a request it will be removed from the active list. If true, the
  *      request will remain active until the timeout clock expires, to allow it
  *      to receive multiple response (e.g. to a functional broadcast request).
+ * quiet - If true, responses are only handed to the callback, and not
+ *      published.
  *
  * Really Private:
  *
@@ -87,32 +304,88 @@ typedef void (*DiagnosticResponseCallback)(
  *      not used.
  * timeoutClock - A FrequencyClock struct to monitor how long it's been since
  *      this request was sent.
+ * nextDueMs - For a recurring request, the time it next needs attention - when
+ *      it times out if it's in flight, or is next due to be sent if not.
+ * streamRemaining - The number of bytes of a streamed response still to be
+ *      received, or 0 if no response is being streamed.
+ * streamSequence - The sequence number of the next consecutive frame expected
+ *      in a streamed response.
+ * blockSize - The block size sent in the flow control frame for the streamed
+ *      response, or 0 if the ECU sends it without waiting.
+ * separationTime - The encoded STmin sent in the flow control frame for the
+ *      streamed response.
+ * blockRemaining - The number of consecutive frames left in the current block
+ *      of a streamed response, before the ECU waits for flow control again.
+ * frame - For a recurring request that fits in a single CAN frame, the frame
+ *      as the diagnostics library encodes it, so it's sent again as it is
+ *      instead of encoding it every time.
+ * frameLength - The length of frame, or 0 if the request isn't cached and is
+ *      encoded each time it's sent.
+ * knownResponders - For a recurring functional broadcast request, a bit for
+ *      each of the OBD-II functional response IDs that answered it while its
+ *      responders were being learned.
+ * respondersSeen - The functional response IDs that have answered the request
+ *      since it was last sent, in the same form as knownResponders.
+ * discoveryCycles - The number of times the request has run to its timeout
+ *      while learning knownResponders.
  * queueEntries - Internal data structure reference for when this request is in
  *      the recurring requests queue.
  * listEntries - Internal data structure reference for when this request is in
  *      the non-recurring requests list or free list.
+ * indexEntries - Internal data structure reference for when this request is in
+ *      the manager's response index.
  */
 struct ActiveDiagnosticRequest {
     CanBus* bus;
     uint32_t arbitration_id;
-    DiagnosticRequestHandle handle;
-    char name[MAX_GENERIC_NAME_LENGTH];
+    DiagnosticRequest request;
+    DiagnosticEcu* ecu;
+    DiagnosticRequestHandle* handle;
+    uint16_t nameHandle;
     DiagnosticResponseDecoder decoder;
     DiagnosticResponseCallback callback;
     bool recurring;
     bool waitForMultipleResponses;
+    bool quiet;
     bool inFlight;
     openxc::util::time::FrequencyClock frequencyClock;
     openxc::util::time::FrequencyClock timeoutClock;
+    unsigned long nextDueMs;
+    uint16_t streamRemaining;
+    uint8_t streamSequence;
+    uint8_t blockSize;
+    uint8_t separationTime;
+    uint8_t blockRemaining;
+    uint8_t frame[CAN_MESSAGE_SIZE];
+    uint8_t frameLength;
+    uint8_t knownResponders;
+    uint8_t respondersSeen;
+    uint8_t discoveryCycles;
 
     TAILQ_ENTRY(ActiveDiagnosticRequest) queueEntries;
     LIST_ENTRY(ActiveDiagnosticRequest) listEntries;
+    LIST_ENTRY(ActiveDiagnosticRequest) indexEntries;
 };
 typedef struct ActiveDiagnosticRequest ActiveDiagnosticRequest;
 
 LIST_HEAD(DiagnosticRequestList, ActiveDiagnosticRequest);
 TAILQ_HEAD(DiagnosticRequestQueue, ActiveDiagnosticRequest);
 
+/* Private: A request handle in the DiagnosticsManager's pool, for the
+ * diagnostics library to track a request while it's in flight.
+ *
+ * handle - The handle itself.
+ * freeEntries - Internal data structure reference for when this handle is in
+ *      the pool's free list.
+ */
+struct PooledRequestHandle {
+    DiagnosticRequestHandle handle;
+    LIST_ENTRY(PooledRequestHandle) freeEntries;
+};
+typedef struct PooledRequestHandle PooledRequestHandle;
+
+LIST_HEAD(RequestHandleList, PooledRequestHandle);
+
 /* Public: The core structure for running the diagnostics module on the VI.
  *
  * This stores details about the active requests and shims required to connect
@@ -123,12 +396,23 @@ TAILQ_HEAD(DiagnosticRequestQueue, ActiveDiagnosticRequest);
  * obd2Bus - A reference to the CAN bus that should be used for all standard
  *      OBD-II requests, if the bus is not explicitly spcified in the request.
  *      If NULL, all requests require an explicit bus.
+ * streamingMinLength - The length in bytes at which responses are streamed,
+ *      as with DIAGNOSTIC_STREAMING_MIN_LENGTH, which it's initialized to. If
+ *      0, responses are never streamed.
+ * responseCacheTtlMs - How long responses to one-time requests answer
+ *      identical commands, as with DIAGNOSTIC_RESPONSE_CACHE_TTL_MS, which it's
+ *      initialized to. If 0, responses aren't cached.
+ * dtcMonitorFrequencyHz - How often the OBD-II DTC monitor asks for trouble
+ *      codes, as with OBD2_DTC_MONITOR_FREQUENCY_HZ, which it's initialized
+ *      to. If 0, the monitor is off.
  *
  * Private:
  *
- * recurringRequests - A queue of active, recurring diagnostic requests. When a
- *      response is received for a recurring request or it times out, it is
- *      popped from the queue and pushed onto the back.
+ * recurringRequests - A queue of active, recurring diagnostic requests, in
+ *      order of their nextDueMs. When a request is sent, receives a response
+ *      or times out, it is popped from the queue and put back in order of when
+ *      it's next due, so a pass over the requests can stop at the first one
+ *      that isn't due yet.
  * nonrecurringRequests - A list of active one-time diagnostic requests. When a
  *      response is received for a non-recurring request or it times out, it is
  *      removed from this list and placed back in the free list.
@@ -136,15 +420,55 @@ TAILQ_HEAD(DiagnosticRequestQueue, ActiveDiagnosticRequest);
  *      requests. This free list is backed by statically allocated entries in
  *      the requestListEntries attribute.
  * requestListEntries - Static allocation for all active diagnostic requests.
+ * freeRequestHandles - A list of the request handles that aren't in use by an
+ *      in-flight request, backed by the requestHandles attribute.
+ * requestHandles - Static allocation for the handles of in-flight requests.
+ * nameTable - The names of active requests, each stored once no matter how
+ *      many requests use it. A name is stored as a reference count byte
+ *      followed by the NUL-terminated name, and is found by the offset of its
+ *      first character. Names with no remaining references are reclaimed when
+ *      the table fills up.
+ * nameTableLength - The number of bytes of the nameTable in use.
+ * ecus - The pacing state of each ECU with active requests.
+ * busReadyMs - For each bus (by address - 1), the time (from
+ *      time::systemTimeMs) the next request can be sent on it.
+ * responseIndex - Every active request, recurring or not, bucketed by the
+ *      arbitration ID its responses arrive on, so a received frame is only
+ *      matched against the requests it could be a response to.
+ * functionalRequests - The active functional broadcast requests, which are
+ *      answered on a range of arbitration IDs instead of one.
+ * responseCache - Recent responses to one-time requests, to answer identical
+ *      commands with.
+ * flowControls - The flow control parameters set for buses and ECUs with
+ *      setFlowControl.
+ * sessions - The ECUs in a non-default UDS diagnostic session, which the
+ *      manager sends TesterPresent requests to on its own. An ECU is added when
+ *      it answers a DiagnosticSessionControl request for any session but the
+ *      default one, and removed when it answers one for the default session or
+ *      an ECUReset.
  * initialized - True if the DiagnosticsManager has been initialized.
  */
 struct DiagnosticsManager {
     DiagnosticShims shims[MAX_SHIM_COUNT];
     CanBus* obd2Bus;
+    uint16_t streamingMinLength;
+    unsigned long responseCacheTtlMs;
+    float dtcMonitorFrequencyHz;
     DiagnosticRequestQueue recurringRequests;
     DiagnosticRequestList nonrecurringRequests;
     DiagnosticRequestList freeRequestEntries;
     ActiveDiagnosticRequest requestListEntries[MAX_SIMULTANEOUS_DIAG_REQUESTS];
+    RequestHandleList freeRequestHandles;
+    PooledRequestHandle requestHandles[MAX_IN_FLIGHT_DIAG_REQUESTS];
+    char nameTable[DIAGNOSTIC_NAME_TABLE_SIZE];
+    uint16_t nameTableLength;
+    DiagnosticEcu ecus[MAX_DIAGNOSTIC_ECUS];
+    unsigned long busReadyMs[MAX_SHIM_COUNT];
+    DiagnosticRequestList responseIndex[DIAGNOSTIC_RESPONSE_INDEX_SIZE];
+    DiagnosticRequestList functionalRequests;
+    CachedDiagnosticResponse responseCache[DIAGNOSTIC_RESPONSE_CACHE_SIZE];
+    DiagnosticFlowControl flowControls[DIAGNOSTIC_FLOW_CONTROL_COUNT];
+    DiagnosticSession sessions[DIAGNOSTIC_SESSION_COUNT];
     bool initialized;
 };
 typedef struct DiagnosticsManager DiagnosticsManager;
@@ -202,7 +526,9 @@ void reset(DiagnosticsManager* manager);
  * request - The parameters for the request.
  * name - An optional human readable name this response, to be used when
  *      publishing received responses. If the name is NULL, the published output
- *      will use the raw OBD-II response format.
+ *      will use the raw OBD-II response format. Responses named after a signal
+ *      are published like the signal, i.e. by its ID if the pipeline's name
+ *      dictionary is enabled.
  * waitForMultipleResponses - If false, When any response is received
  *      for this request it will be removed from the active list. If true, the
  *      request will remain active until the timeout clock expires, to allow it
@@ -218,8 +544,9 @@ void reset(DiagnosticsManager* manager);
  *      function return false.
  *
  * Returns true if the request was added successfully. Returns false if there
- * wasn't a free active request entry, if the frequency was too high or if the
- * CAN acceptance filters could not be configured,
+ * wasn't a free active request entry or room in the name table, if the
+ * frequency was too high or if the CAN acceptance filters could not be
+ * configured,
  */
 bool addRecurringRequest(DiagnosticsManager* manager,
         CanBus* bus, DiagnosticRequest* request, const char* name,
@@ -239,7 +566,9 @@ bool addRecurringRequest(DiagnosticsManager* manager,
  * request - The parameters for the request.
  * name - An optional human readable name this response, to be used when
  *      publishing received responses. If the name is NULL, the published output
- *      will use the raw OBD-II response format.
+ *      will use the raw OBD-II response format. Responses named after a signal
+ *      are published like the signal, i.e. by its ID if the pipeline's name
+ *      dictionary is enabled.
  * waitForMultipleResponses - If false, When any response is received
  *      for this request it will be removed from the active list. If true, the
  *      request will remain active until the timeout clock expires, to allow it
@@ -252,14 +581,29 @@ bool addRecurringRequest(DiagnosticsManager* manager,
  *      response is received for this request.
  *
  * Returns true if the request was added successfully. Returns false if there
- * wasn't a free active request entry, if the frequency was too high or if the
- * CAN acceptance filters could not be configured,
+ * wasn't a free active request entry or room in the name table, if the
+ * frequency was too high or if the CAN acceptance filters could not be
+ * configured,
  */
 bool addRequest(DiagnosticsManager* manager,
         CanBus* bus, DiagnosticRequest* request, const char* name,
         bool waitForMultipleResponses, const DiagnosticResponseDecoder decoder,
         const DiagnosticResponseCallback callback);
 
+/* Public: Add a recurring diagnostic request whose responses are only handed
+ * to a callback, for the VI's own use, instead of being published. It's
+ * otherwise the same as addRecurringRequest, with no name or decoder.
+ *
+ * callback - The DiagnosticResponseCallback to be notified whenever a response
+ *      is received for this request.
+ *
+ * Returns true if the request was added successfully.
+ */
+bool addQuietRecurringRequest(DiagnosticsManager* manager,
+        CanBus* bus, DiagnosticRequest* request,
+        bool waitForMultipleResponses,
+        const DiagnosticResponseCallback callback, float frequencyHz);
+
 /* Public: A simpler version of the addRecurringRequest function that uses the
  * default response decoder and no response callback.
  */
@@ -300,12 +644,67 @@ bool addRequest(DiagnosticsManager* manager, CanBus* bus,
 bool cancelRecurringRequest(DiagnosticsManager* manager, CanBus* bus,
         DiagnosticRequest* request);
 
+/* Public: Change how often an existing recurring diagnostic request is sent.
+ *
+ * The request keeps its place in its send cycle - the next one is sent a
+ * period of the new frequency after the last.
+ *
+ * manager - The manager for the recurring request.
+ * bus - The bus for the recurring request.
+ * request - Match an existing recurring request with the request argument's
+ *      bus, arbitration ID, mode and (if set) pid.
+ * frequencyHz - The new frequency (in Hz) to send the request, which must be
+ *      above 0 and no more than MAX_RECURRING_DIAGNOSTIC_FREQUENCY_HZ.
+ *
+ * Returns true if a matching recurring request was found and updated.
+ */
+bool updateRecurringRequestFrequency(DiagnosticsManager* manager, CanBus* bus,
+        DiagnosticRequest* request, float frequencyHz);
+
+/* Public: Set the ISO-TP flow control parameters the VI sends when it streams
+ * a response, for every ECU on a bus or for one ECU. A smaller block size keeps
+ * an ECU that answers with no separation time from filling the CAN receive
+ * queue faster than the responses are relayed. The parameters apply from the
+ * next streamed response, and stay set when requests are cancelled.
+ *
+ * Responses that aren't streamed are reassembled by the diagnostics library,
+ * which sends its own flow control.
+ *
+ * manager - The manager to set the parameters on.
+ * bus - The bus of the ECUs.
+ * arbitrationId - The arbitration ID requests to the ECU are sent to, or 0 to
+ *      set the default for every ECU on the bus without its own parameters.
+ * blockSize - The number of consecutive frames the ECU sends before waiting
+ *      for another flow control frame, or 0 to send them all without waiting.
+ * separationTime - The minimum time between consecutive frames, encoded as in
+ *      ISO 15765-2 - 0 to 0x7f milliseconds, or 0xf1 to 0xf9 for 100 to 900
+ *      microseconds.
+ *
+ * Returns false if the separation time isn't a valid encoding, or
+ * DIAGNOSTIC_FLOW_CONTROL_COUNT buses and ECUs already have their own
+ * parameters.
+ */
+bool setFlowControl(DiagnosticsManager* manager, CanBus* bus,
+        uint32_t arbitrationId, uint8_t blockSize, uint8_t separationTime);
+
+/* Public: Look up the human readable name of an active diagnostic request.
+ *
+ * manager - The manager for the request.
+ * request - The request, e.g. as passed to a DiagnosticResponseCallback.
+ *
+ * Returns the name given when the request was added, or NULL if it didn't have
+ * one.
+ */
+const char* requestName(const DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* request);
+
 /* Public: Handle a newly received CAN message, checking to see if it is a
  *      response to an active requests.
  *
  * This must be called for every new CAN message that is received. It will match
  * it to any existing requests, relay the response and perform any necessary
- * callbacks.
+ * callbacks. Messages that can't be a response to an active request are
+ * rejected after one index lookup.
  *
  * manager - The manager that should receive the CAN message.
  * bus - The bus this message was received from.
@@ -319,7 +718,8 @@ void receiveCanMessage(DiagnosticsManager* manager, CanBus* bus,
  *      frames that need to be sent.
  *
  * This should be called from the main loop of the firmware in order to handle
- * multi-frame requests as quickly as possible.
+ * multi-frame requests as quickly as possible. It also sends any TesterPresent
+ * requests that are due to ECUs in a non-default diagnostic session.
  *
  * manager - The manager to send the requests for.
  * bus - The bus to send the requests on.
@@ -342,6 +742,55 @@ void sendRequests(DiagnosticsManager* manager, CanBus* bus);
 bool handleDiagnosticCommand(DiagnosticsManager* manager,
         openxc_ControlCommand* command);
 
+/* Public: How the responses to a saved recurring request are decoded - the
+ * decoders a diagnostic request command can choose.
+ */
+typedef enum {
+    SAVED_DECODER_NONE,
+    SAVED_DECODER_PASSTHROUGH,
+    SAVED_DECODER_OBD2,
+} SavedDecoder;
+
+/* Public: A recurring request added by a diagnostic request command, as kept
+ * in flash to add again at startup (see config::saveConfiguration).
+ *
+ * busAddress - The address of the bus the request is sent on.
+ * decoder - How its responses are decoded.
+ * waitForMultipleResponses - As for addRecurringRequest.
+ * frequencyHz - How often the request is sent.
+ * request - The request itself.
+ * name - The request's name, or an empty string if it has none.
+ */
+typedef struct {
+    uint8_t busAddress;
+    uint8_t decoder;
+    bool waitForMultipleResponses;
+    float frequencyHz;
+    DiagnosticRequest request;
+    char name[MAX_GENERIC_NAME_LENGTH];
+} SavedDiagnosticRequest;
+
+/* Public: Copy out the active recurring requests that were added by diagnostic
+ * request commands. Requests the firmware adds itself - the automatic OBD-II
+ * requests and those in the signal definitions - have callbacks or their own
+ * decoders and are added again at startup anyway, so they're left out.
+ *
+ * manager - The manager with the requests.
+ * requests - The destination for the requests.
+ * maxCount - The most requests to copy.
+ *
+ * Returns the number of requests copied.
+ */
+int saveRecurringRequests(DiagnosticsManager* manager,
+        SavedDiagnosticRequest* requests, int maxCount);
+
+/* Public: Add a recurring request saved by saveRecurringRequests.
+ *
+ * Returns true if the request was added.
+ */
+bool restoreRecurringRequest(DiagnosticsManager* manager,
+        const SavedDiagnosticRequest* saved);
+
 /* Public: A no-op decoder for the payload of a diagnostic response.
  *
  * This is an implementation of DiagnosticResponseDecoder.
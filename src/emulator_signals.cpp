@@ -18,7 +18,7 @@ CanMessageSet MESSAGE_SETS[MESSAGE_SET_COUNT] = {
     { 0, "emulator", 0, 0, 0, 0 },
 };
 
-const int MAX_CAN_BUS_COUNT = 2;
+const int MAX_CAN_BUS_COUNT = MAX_CAN_CONTROLLERS;
 CanBus CAN_BUSES[][MAX_CAN_BUS_COUNT] = {
     { // message set: emulator
     },
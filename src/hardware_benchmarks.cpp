@@ -0,0 +1,190 @@
+#ifdef __BENCHMARK_MODE__
+
+#include "interface/usb.h"
+#include "can/canread.h"
+#include "can/canqueue.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "util/timer.h"
+#include "util/bytebuffer.h"
+#include "payload/payload.h"
+#include "lights.h"
+#include "power.h"
+#include "platform/platform.h"
+#include "config.h"
+#include <string.h>
+
+namespace usb = openxc::interface::usb;
+namespace lights = openxc::lights;
+namespace can = openxc::can;
+namespace platform = openxc::platform;
+namespace time = openxc::util::time;
+namespace power = openxc::power;
+namespace payload = openxc::payload;
+
+using openxc::payload::PayloadFormat;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::config::getConfiguration;
+
+// The number of times each workload runs per measurement, and the number of
+// measurements - the fastest is reported, since interrupts only add cycles.
+#define BENCHMARK_ITERATIONS 100
+#define BENCHMARK_REPEATS 5
+// How often the results are measured and sent again, so a host that connects
+// late still gets them.
+#define BENCHMARK_REPORT_INTERVAL_S 10
+
+/* Private: Run once for each iteration of a workload.
+ *
+ * iteration - the number of the iteration, to vary the input.
+ */
+typedef void (*Workload)(int iteration);
+
+static openxc_VehicleMessage SIMPLE_MESSAGE;
+static uint8_t PAYLOAD[128];
+static CanMessageRing RING;
+static ByteQueue BYTE_QUEUE;
+static BYTE_QUEUE_STORAGE(BYTE_QUEUE_RING, 512);
+static openxc::util::time::FrequencyClock REPORT_CLOCK;
+
+static CanMessage testFrame(int iteration) {
+    CanMessage message = {
+        id: 0,
+        format: CanMessageFormat::STANDARD,
+        data: {(uint8_t) iteration, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc,
+            (uint8_t) (iteration >> 8)},
+        length: 8
+    };
+    return message;
+}
+
+/* Private: Decode every signal in the active configuration from a frame.
+ */
+static void decodeSignals(int iteration) {
+    CanMessage frame = testFrame(iteration);
+    CanSignal* signals = getSignals();
+    for(int i = 0; i < getSignalCount(); i++) {
+        bool send = true;
+        can::read::decodeSignal(&signals[i], &frame, signals,
+                getSignalCount(), &send);
+    }
+}
+
+static void serialize(PayloadFormat format, int iteration) {
+    SIMPLE_MESSAGE.simple_message.value.numeric_value = iteration;
+    payload::serialize(&SIMPLE_MESSAGE, PAYLOAD, sizeof(PAYLOAD), format);
+}
+
+static void serializeJson(int iteration) {
+    serialize(PayloadFormat::JSON, iteration);
+}
+
+static void serializeProtobuf(int iteration) {
+    serialize(PayloadFormat::PROTOBUF, iteration);
+}
+
+static void serializeMessagePack(int iteration) {
+    serialize(PayloadFormat::MESSAGEPACK, iteration);
+}
+
+/* Private: Push a CAN message through a receive ring.
+ */
+static void canQueue(int iteration) {
+    CanMessage frame = testFrame(iteration);
+    can::queue::push(&RING, &frame);
+    can::queue::pop(&RING, &frame);
+}
+
+/* Private: Push a serialized message's worth of bytes through a send queue.
+ */
+static void byteQueue(int iteration) {
+    uint8_t bytes[32];
+    memset(bytes, iteration, sizeof(bytes));
+    openxc::util::bytebuffer::pushBytes(&BYTE_QUEUE, bytes, sizeof(bytes));
+    for(size_t i = 0; i < sizeof(bytes); i++) {
+        BYTE_QUEUE_POP(&BYTE_QUEUE);
+    }
+}
+
+/* Private: Return the fewest cycles an iteration of the workload took over
+ * BENCHMARK_REPEATS runs of BENCHMARK_ITERATIONS.
+ */
+static unsigned long measure(Workload workload) {
+    unsigned long fewest = 0;
+    for(int repeat = 0; repeat < BENCHMARK_REPEATS; repeat++) {
+        unsigned long started = time::cycleCount();
+        for(int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            workload(i);
+        }
+        unsigned long cycles = (time::cycleCount() - started) /
+                BENCHMARK_ITERATIONS;
+        if(repeat == 0 || cycles < fewest) {
+            fewest = cycles;
+        }
+    }
+    return fewest;
+}
+
+/* Private: Measure a workload and send the result over USB as a simple
+ * message, e.g.
+ *
+ *      {"name": "benchmark_decode", "value": 12040, "event": 120.4}
+ *
+ * with the cycles per iteration as the value and the microseconds per
+ * iteration as the event.
+ */
+static void report(const char* name, Workload workload) {
+    unsigned long cycles = measure(workload);
+    openxc_DynamicField value = payload::wrapNumber(cycles);
+    openxc_DynamicField event = payload::wrapNumber(
+            (float) cycles / time::cyclesPerMicrosecond());
+    openxc::pipeline::publishSimple(name, &value, &event,
+            &getConfiguration()->pipeline);
+    // send each result before measuring the next, so the USB transfer doesn't
+    // overlap a measurement
+    openxc::pipeline::process(&getConfiguration()->pipeline);
+}
+
+void initializeBenchmarkInterface() {
+    platform::initialize();
+    time::initialize();
+    power::initialize();
+    lights::initialize();
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+
+    can::queue::initialize(&RING, 0);
+    BYTE_QUEUE_INIT(&BYTE_QUEUE, BYTE_QUEUE_RING);
+    time::initializeClock(&REPORT_CLOCK);
+    REPORT_CLOCK.frequency = 1.0 / BENCHMARK_REPORT_INTERVAL_S;
+
+    SIMPLE_MESSAGE.has_type = true;
+    SIMPLE_MESSAGE.type = openxc_VehicleMessage_Type_SIMPLE;
+    SIMPLE_MESSAGE.has_simple_message = true;
+    SIMPLE_MESSAGE.simple_message.has_name = true;
+    strcpy(SIMPLE_MESSAGE.simple_message.name, "vehicle_speed");
+    SIMPLE_MESSAGE.simple_message.has_value = true;
+    SIMPLE_MESSAGE.simple_message.value.has_type = true;
+    SIMPLE_MESSAGE.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    SIMPLE_MESSAGE.simple_message.value.has_numeric_value = true;
+}
+
+void benchmarkLoop() {
+    if(getConfiguration()->usb.configured &&
+            time::conditionalTick(&REPORT_CLOCK)) {
+        lights::enable(lights::LIGHT_A, lights::COLORS.blue);
+        report("benchmark_decode", decodeSignals);
+        report("benchmark_serialize_json", serializeJson);
+        report("benchmark_serialize_protobuf", serializeProtobuf);
+        report("benchmark_serialize_messagepack", serializeMessagePack);
+        report("benchmark_can_queue", canQueue);
+        report("benchmark_byte_queue", byteQueue);
+        lights::enable(lights::LIGHT_A, lights::COLORS.green);
+    }
+
+    // runs the USB task, which also handles enumeration
+    openxc::pipeline::process(&getConfiguration()->pipeline);
+}
+
+#endif // __BENCHMARK_MODE__
@@ -0,0 +1,12 @@
+#ifdef __BENCHMARK_MODE__
+extern void initializeBenchmarkInterface();
+extern void benchmarkLoop();
+
+int main(void) {
+    initializeBenchmarkInterface();
+    for (;;) {
+        benchmarkLoop();
+    }
+    return 0;
+}
+#endif
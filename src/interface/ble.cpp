@@ -3,19 +3,116 @@
 #include <stddef.h>
 
 #include "util/log.h"
+#include "util/timer.h"
 #include "config.h"
 
 using openxc::util::log::debug;
+using openxc::util::time::uptimeMs;
 
 void openxc::interface::ble::initializeCommon(BleDevice* device) {
     if(device != NULL) {
         debug("Initializing Bluetooth Low Energy common...");
-        QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->receiveQueue);//messages received over BLE characteristic write
-        QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->sendQueue);
+        BYTE_QUEUE_RESET(&device->receiveQueue);//messages received over BLE characteristic write
+        BYTE_QUEUE_RESET(&device->sendQueue);
+        for(int i = 0; i < BLE_CHANNEL_COUNT; i++) {
+            BYTE_QUEUE_RESET(&device->channels[i].sendQueue);
+            device->channels[i].notifying = false;
+        }
+        device->notifying = false;
         device->descriptor.type = InterfaceType::BLE;
+        device->fastConnection = false;
+        device->lastBusyMs = uptimeMs();
     }
 }
 
+ByteQueue* openxc::interface::ble::channelSendQueue(
+        BleDevice* device, BleChannel channel) {
+    if(device->channels[channel].notifying) {
+        return &device->channels[channel].sendQueue;
+    }
+    return &device->sendQueue;
+}
+
+void openxc::interface::ble::setNotifying(BleDevice* device, int channel,
+        bool enabled) {
+    if(channel < 0) {
+        device->notifying = enabled;
+    } else if(channel < BLE_CHANNEL_COUNT) {
+        device->channels[channel].notifying = enabled;
+        if(!enabled) {
+            // Anything still queued would otherwise be stranded
+            BYTE_QUEUE_RESET(&device->channels[channel].sendQueue);
+        }
+    }
+
+    bool anyNotifying = device->notifying;
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++) {
+        anyNotifying = anyNotifying || device->channels[i].notifying;
+    }
+
+    if(anyNotifying) {
+        device->status = BleStatus::NOTIFICATION_ENABLED;
+    } else if(device->status == BleStatus::NOTIFICATION_ENABLED) {
+        device->status = BleStatus::CONNECTED;
+    }
+}
+
+void openxc::interface::ble::setConnectionMode(BleDevice* device,
+        BleConnectionMode mode) {
+    debug("Setting BLE connection mode to %d", mode);
+    device->connectionMode = mode;
+    device->lastBusyMs = uptimeMs();
+}
+
+static int queueFillPercent(ByteQueue* queue) {
+    int capacity = BYTE_QUEUE_CAPACITY(queue);
+    return capacity > 0 ? BYTE_QUEUE_LENGTH(queue) * 100 / capacity : 0;
+}
+
+bool openxc::interface::ble::updateConnectionProfile(BleDevice* device) {
+    bool fast;
+    switch(device->connectionMode) {
+    case BleConnectionMode::THROUGHPUT:
+        fast = true;
+        break;
+    case BleConnectionMode::LOW_POWER:
+        fast = false;
+        break;
+    default: {
+        // the queues may not be the same size, so go by the fullest one
+        int fill = queueFillPercent(&device->sendQueue);
+        for(int i = 0; i < BLE_CHANNEL_COUNT; i++) {
+            int channelFill = queueFillPercent(&device->channels[i].sendQueue);
+            if(channelFill > fill) {
+                fill = channelFill;
+            }
+        }
+        unsigned long now = uptimeMs();
+        if(fill > DEFAULT_BLE_SLOW_CONNECTION_FILL_PERCENT) {
+            device->lastBusyMs = now;
+        }
+
+        // Speed up as soon as a burst starts filling the queue, but only slow
+        // down again once it's been quiet for a while, so a bursty stream
+        // doesn't renegotiate on every burst.
+        fast = device->fastConnection;
+        if(fill >= DEFAULT_BLE_FAST_CONNECTION_FILL_PERCENT) {
+            fast = true;
+        } else if(now - device->lastBusyMs >=
+                DEFAULT_BLE_SLOW_CONNECTION_HOLD_MS) {
+            fast = false;
+        }
+        break;
+    }
+    }
+
+    if(fast == device->fastConnection) {
+        return false;
+    }
+    device->fastConnection = fast;
+    return true;
+}
+
 void openxc::interface::ble::deinitializeCommon(BleDevice* device) {
    
 }
@@ -5,30 +5,104 @@
 #include "interface/interface.h"
 #include "util/bytebuffer.h"
 
+// Send queue fill, in percent, at which an AUTO connection asks for the
+// throughput connection parameters.
+#ifndef DEFAULT_BLE_FAST_CONNECTION_FILL_PERCENT
+#define DEFAULT_BLE_FAST_CONNECTION_FILL_PERCENT 50
+#endif
+
+// How long, in ms, the send queue must stay at or below
+// DEFAULT_BLE_SLOW_CONNECTION_FILL_PERCENT before an AUTO connection goes back
+// to the low power parameters.
+#ifndef DEFAULT_BLE_SLOW_CONNECTION_FILL_PERCENT
+#define DEFAULT_BLE_SLOW_CONNECTION_FILL_PERCENT 10
+#endif
+
+#ifndef DEFAULT_BLE_SLOW_CONNECTION_HOLD_MS
+#define DEFAULT_BLE_SLOW_CONNECTION_HOLD_MS 5000
+#endif
 
 namespace openxc {
 namespace interface {
 namespace ble {
 
-/* Public: A container for an network connection with queues for both input and
- * output.
+/* Public: The radio settings for a BLE device.
  *
- * descriptor - A general descriptor for this interface.
- * sendQueue - A queue of bytes that need to be sent out over an IP network.
- * receiveQueue - A queue of bytes that have been received via an IP network but
- *      not yet processed.
+ * The connection intervals are in the 1.25ms units of the Bluetooth spec.
+ *
+ * slave_min_ms, slave_max_ms, slave_latency - The low power connection
+ *      parameters, used while there's little to send.
+ * fast_min_ms, fast_max_ms - The connection interval used while the send queue
+ *      is busy, always with no slave latency.
  */
-
-
 typedef struct {
     const char * advname;
     uint16_t adv_min_ms;
     uint16_t adv_max_ms;
     uint16_t slave_min_ms; 
     uint16_t slave_max_ms;
+    uint16_t slave_latency;
+    uint16_t fast_min_ms;
+    uint16_t fast_max_ms;
     uint8_t  bdaddr[6];
 }BleSettings;
 
+/* Public: How the connection parameters are chosen.
+ *
+ * AUTO - Use the throughput parameters while the send queue is filling up and
+ *      the low power ones once it has stayed nearly empty for a while.
+ * LOW_POWER - Always use the low power parameters.
+ * THROUGHPUT - Always use the throughput parameters.
+ */
+typedef enum {
+    AUTO = 0,
+    LOW_POWER = 1,
+    THROUGHPUT = 2,
+} BleConnectionMode;
+
+/* Public: The extra notify characteristics, one per class of message, that a
+ * client can subscribe to instead of the main one.
+ *
+ * A message goes out on its class's characteristic if the client has
+ * notifications on for it, otherwise on the main characteristic - so a client
+ * that only knows the main one still gets everything, and one that subscribes
+ * to, say, just COMMAND_RESPONSE gets its responses without waiting behind a
+ * stream of vehicle data.
+ */
+typedef enum {
+    SIMPLE_CHANNEL = 0,
+    CAN_CHANNEL = 1,
+    DIAGNOSTIC_CHANNEL = 2,
+    COMMAND_RESPONSE_CHANNEL = 3,
+} BleChannel;
+
+#define BLE_CHANNEL_COUNT 4
+
+// The number of bytes the main characteristic's send and receive queues hold,
+// and the send queue of each class characteristic. The receive queue only
+// needs room for the largest command a client writes.
+#ifndef BLE_SEND_QUEUE_SIZE
+#define BLE_SEND_QUEUE_SIZE 1024
+#endif
+
+#ifndef BLE_RECEIVE_QUEUE_SIZE
+#define BLE_RECEIVE_QUEUE_SIZE 256
+#endif
+
+#ifndef BLE_CHANNEL_QUEUE_SIZE
+#define BLE_CHANNEL_QUEUE_SIZE 512
+#endif
+
+/* Public: The send side of one class notify characteristic.
+ *
+ * sendQueue - Bytes waiting to be notified on the characteristic.
+ * notifying - True if the client has turned notifications on for it.
+ */
+typedef struct {
+    ByteQueue sendQueue;
+    bool notifying;
+} BleChannelQueue;
+
 typedef enum {
     SET_CONNECTABLE_FAILED = 128,
     ISR_SPI_READ_TIMEDOUT  = 129,
@@ -44,13 +118,38 @@ typedef enum {
     NOTIFICATION_ENABLED = 4,
 } BleStatus;
 
+/* Public: A container for an network connection with queues for both input and
+ * output.
+ *
+ * descriptor - A general descriptor for this interface.
+ * sendQueue - A queue of bytes that need to be sent out on the main notify
+ *      characteristic.
+ * receiveQueue - A queue of bytes that have been received via an IP network but
+ *      not yet processed.
+ * receiveScanner - How far the receiveQueue has been scanned for a complete
+ *      message.
+ * connectionMode - How the connection parameters are chosen.
+ * fastConnection - True if the throughput connection parameters are the ones
+ *      in use (or last requested).
+ * lastBusyMs - When the send queue was last above the low power fill level.
+ * notifying - True if the client has turned notifications on for the main
+ *      characteristic.
+ * channels - The send queues for the class characteristics, indexed by
+ *      BleChannel.
+ */
 typedef struct {
     InterfaceDescriptor descriptor;
     BleSettings         blesettings;
-    QUEUE_TYPE(uint8_t) sendQueue;
-    QUEUE_TYPE(uint8_t) receiveQueue;
+    ByteQueue sendQueue;
+    ByteQueue receiveQueue;
+    openxc::util::bytebuffer::FrameScanner receiveScanner;
     bool configured;
     BleStatus status;
+    BleConnectionMode connectionMode;
+    bool fastConnection;
+    unsigned long lastBusyMs;
+    bool notifying;
+    BleChannelQueue channels[BLE_CHANNEL_COUNT];
 } BleDevice;
 
 
@@ -72,6 +171,34 @@ void read(BleDevice* device);
 
 size_t handleIncomingMessage(uint8_t payload[], size_t length);
 
+/* Public: Find the queue a message for a channel should be sent on - the
+ * channel's own if the client has notifications on for it, otherwise the main
+ * sendQueue.
+ */
+ByteQueue* channelSendQueue(BleDevice* device, BleChannel channel);
+
+/* Public: Record that the client turned notifications on or off for the main
+ * characteristic or a class characteristic, and update the device's status.
+ *
+ * device - The BLE device.
+ * channel - The channel's characteristic, or -1 for the main one.
+ * enabled - True if notifications were turned on.
+ */
+void setNotifying(BleDevice* device, int channel, bool enabled);
+
+/* Public: Change how the connection parameters are chosen. The new mode takes
+ * effect the next time updateConnectionProfile is called.
+ */
+void setConnectionMode(BleDevice* device, BleConnectionMode mode);
+
+/* Public: Decide which connection parameters the device should be using, from
+ * its connection mode and, in AUTO mode, how full its fullest send queue is.
+ *
+ * Returns true if that changed and the platform should ask the central for
+ * the new parameters - see fastConnection.
+ */
+bool updateConnectionProfile(BleDevice* device);
+
 /* Public: Check the connection status of a network device.
  *
  * Returns true if a ble hardware is connected.
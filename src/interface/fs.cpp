@@ -1,17 +1,193 @@
 #include "interface/fs.h"
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include "util/log.h"
+#include "util/bytebuffer.h"
 #include "config.h"
 
 using openxc::util::log::debug;
+using openxc::util::bytebuffer::pushBytes;
 
 void openxc::interface::fs::initializeCommon(FsDevice* device) {
     if(device != NULL) {
         device->descriptor.type = InterfaceType::FS;
-        QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->sendQueue);
+        device->rawCanLog = DEFAULT_FS_RAW_CAN_LOG;
+        BYTE_QUEUE_RESET(&device->sendQueue);
     }
 }
 
 void openxc::interface::fs::deinitializeCommon(FsDevice* device) {
    
 }
+
+/* Private: Write value to the buffer as size little endian bytes.
+ */
+static void writeLittleEndian(uint8_t* buffer, uint64_t value, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t readLittleEndian(const uint8_t* buffer, size_t size) {
+    uint64_t value = 0;
+    for(size_t i = 0; i < size; i++) {
+        value |= (uint64_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+/* Private: Continue a CRC-32 (the zlib/Ethernet polynomial) over more data, a
+ * nibble at a time so the table stays small.
+ */
+static uint32_t updateCrc32(uint32_t crc, const uint8_t* data, size_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    for(size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return crc;
+}
+
+static uint32_t journalBlockCrc(const uint8_t block[], uint16_t length) {
+    uint32_t crc = updateCrc32(0xffffffff, block, 12);
+    crc = updateCrc32(crc, &block[FS_JOURNAL_HEADER_SIZE], length);
+    return crc ^ 0xffffffff;
+}
+
+size_t openxc::interface::fs::encodeCanRecord(uint8_t bus, uint32_t id,
+        bool extended, const uint8_t* data, uint8_t length,
+        uint64_t timestamp, uint8_t record[]) {
+    if(length > 8) {
+        length = 8;
+    }
+
+    memset(record, 0, CAN_LOG_RECORD_SIZE);
+    record[0] = CAN_LOG_RECORD_SYNC;
+    record[1] = extended ? CAN_LOG_FLAG_EXTENDED : 0;
+    record[2] = bus;
+    record[3] = length;
+    writeLittleEndian(&record[4], id, sizeof(uint32_t));
+    writeLittleEndian(&record[8], timestamp, sizeof(uint64_t));
+    if(data != NULL) {
+        memcpy(&record[16], data, length);
+    }
+    return CAN_LOG_RECORD_SIZE;
+}
+
+bool openxc::interface::fs::decodeCanRecord(const uint8_t record[],
+        uint8_t* bus, uint32_t* id, bool* extended, uint8_t* data,
+        uint8_t* length, uint64_t* timestamp) {
+    if(record[0] != CAN_LOG_RECORD_SYNC || record[3] > 8) {
+        return false;
+    }
+
+    *extended = record[1] & CAN_LOG_FLAG_EXTENDED;
+    *bus = record[2];
+    *length = record[3];
+    *id = readLittleEndian(&record[4], sizeof(uint32_t));
+    *timestamp = readLittleEndian(&record[8], sizeof(uint64_t));
+    memcpy(data, &record[16], *length);
+    return true;
+}
+
+bool openxc::interface::fs::logCanMessage(FsDevice* device, uint8_t bus,
+        uint32_t id, bool extended, const uint8_t* data, uint8_t length,
+        uint64_t timestamp) {
+    if(device == NULL || !device->rawCanLog) {
+        return false;
+    }
+
+    uint8_t record[CAN_LOG_RECORD_SIZE];
+    encodeCanRecord(bus, id, extended, data, length, timestamp, record);
+    return pushBytes(&device->sendQueue, record,
+            sizeof(record));
+}
+
+void openxc::interface::fs::sealJournalBlock(uint8_t block[],
+        uint32_t sequence, uint16_t length) {
+    if(length > FS_JOURNAL_PAYLOAD_SIZE) {
+        length = FS_JOURNAL_PAYLOAD_SIZE;
+    }
+
+    writeLittleEndian(&block[0], FS_JOURNAL_MAGIC, sizeof(uint32_t));
+    writeLittleEndian(&block[4], sequence, sizeof(uint32_t));
+    writeLittleEndian(&block[8], length, sizeof(uint16_t));
+    writeLittleEndian(&block[10], 0, sizeof(uint16_t));
+    memset(&block[FS_JOURNAL_HEADER_SIZE + length], 0,
+            FS_JOURNAL_PAYLOAD_SIZE - length);
+    writeLittleEndian(&block[12], journalBlockCrc(block, length),
+            sizeof(uint32_t));
+}
+
+int openxc::interface::fs::openJournalBlock(const uint8_t block[],
+        uint32_t* sequence) {
+    if(readLittleEndian(&block[0], sizeof(uint32_t)) != FS_JOURNAL_MAGIC) {
+        return -1;
+    }
+
+    uint16_t length = readLittleEndian(&block[8], sizeof(uint16_t));
+    if(length > FS_JOURNAL_PAYLOAD_SIZE || readLittleEndian(&block[12],
+                sizeof(uint32_t)) != journalBlockCrc(block, length)) {
+        return -1;
+    }
+
+    if(sequence != NULL) {
+        *sequence = readLittleEndian(&block[4], sizeof(uint32_t));
+    }
+    return length;
+}
+
+size_t openxc::interface::fs::encodeIndexRecord(IndexRecordType type,
+        uint32_t offset, uint64_t timestamp, uint8_t record[]) {
+    record[0] = FS_INDEX_RECORD_SYNC;
+    record[1] = type;
+    writeLittleEndian(&record[2], 0, sizeof(uint16_t));
+    writeLittleEndian(&record[4], offset, sizeof(uint32_t));
+    writeLittleEndian(&record[8], timestamp, sizeof(uint64_t));
+    return FS_INDEX_RECORD_SIZE;
+}
+
+bool openxc::interface::fs::indexFileName(const char* logFile, char* name,
+        size_t size) {
+    const char* extension = strrchr(logFile, '.');
+    if(extension == NULL || extension == logFile) {
+        return false;
+    }
+
+    size_t stemLength = extension - logFile + 1;
+    if(stemLength + strlen(FS_INDEX_EXTENSION) + 1 > size) {
+        return false;
+    }
+    memcpy(name, logFile, stemLength);
+    strcpy(&name[stemLength], FS_INDEX_EXTENSION);
+    return true;
+}
+
+int openxc::interface::fs::formatTripCatalogLine(IndexRecordType type,
+        uint64_t timestamp, const char* logFile, uint32_t offset, char* line,
+        size_t size) {
+    if(type != TRIP_START && type != TRIP_END) {
+        return -1;
+    }
+
+    // printf's support for 64-bit integers varies between C libraries
+    char digits[21];
+    int index = sizeof(digits) - 1;
+    digits[index] = '\0';
+    do {
+        digits[--index] = '0' + timestamp % 10;
+        timestamp /= 10;
+    } while(timestamp > 0);
+
+    int length = snprintf(line, size, "%s,%s,%s,%lu\n",
+            type == TRIP_START ? "start" : "end", &digits[index], logFile,
+            (unsigned long) offset);
+    return length < 0 || (size_t) length >= size ? -1 : length;
+}
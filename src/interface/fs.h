@@ -3,10 +3,82 @@
 
 #include <stdlib.h>
 #include "interface/interface.h"
-#include "util/bytebuffer.h" //to do remove this and add custom type to have 512 size
+#include "util/bytebuffer.h"
 #include "platform_profile.h"
 
+#ifndef DEFAULT_FS_RAW_CAN_LOG
+#define DEFAULT_FS_RAW_CAN_LOG 0
+#endif
 
+// The number of bytes the send queue holds between writes to the session cache.
+#ifndef FS_SEND_QUEUE_SIZE
+#define FS_SEND_QUEUE_SIZE 512
+#endif
+
+// A raw CAN log record is a fixed 24 bytes, all fields little endian:
+//
+//  0: sync byte, CAN_LOG_RECORD_SYNC
+//  1: flags, CAN_LOG_FLAG_EXTENDED if the ID is 29 bits
+//  2: bus address
+//  3: data length, 0 to 8
+//  4: uint32 message ID
+//  8: uint64 timestamp in milliseconds
+// 16: 8 data bytes, zero padded past the data length
+#define CAN_LOG_RECORD_SIZE 24
+#define CAN_LOG_RECORD_SYNC 0xa5
+#define CAN_LOG_FLAG_EXTENDED 0x1
+
+// Set to 1 to write the SD card log as a journal of self-checking blocks (see
+// FS_JOURNAL_BLOCK_SIZE), committed to the card every
+// DEFAULT_FS_JOURNAL_COMMIT_MS, so a power loss costs at most that much data.
+#ifndef DEFAULT_FS_JOURNAL
+#define DEFAULT_FS_JOURNAL 0
+#endif
+
+#ifndef DEFAULT_FS_JOURNAL_COMMIT_MS
+#define DEFAULT_FS_JOURNAL_COMMIT_MS 1000
+#endif
+
+// A journal block is one SD card sector, all fields little endian:
+//
+//  0: uint32 magic, FS_JOURNAL_MAGIC ("JRNL")
+//  4: uint32 sequence number, one more than the block before it
+//  8: uint16 payload length, 0 to FS_JOURNAL_PAYLOAD_SIZE
+// 10: uint16 reserved, 0
+// 12: uint32 CRC-32 of bytes 0 to 11 followed by the payload
+// 16: payload, zero padded to the end of the block
+#define FS_JOURNAL_BLOCK_SIZE 512
+#define FS_JOURNAL_HEADER_SIZE 16
+#define FS_JOURNAL_PAYLOAD_SIZE (FS_JOURNAL_BLOCK_SIZE - FS_JOURNAL_HEADER_SIZE)
+#define FS_JOURNAL_MAGIC 0x4c4e524a
+
+// Set to 1 to keep an index next to each SD card log file, so a host can find
+// a time or a trip in the logs without reading them all.
+#ifndef DEFAULT_FS_INDEX
+#define DEFAULT_FS_INDEX 0
+#endif
+
+// A log file's index is the file of the same name with the FS_INDEX_EXTENSION
+// extension, a list of fixed 16 byte records, all fields little endian:
+//
+//  0: sync byte, FS_INDEX_RECORD_SYNC
+//  1: record type, an fs::IndexRecordType
+//  2: uint16 reserved, 0
+//  4: uint32 offset in the log file
+//  8: uint64 timestamp in milliseconds
+//
+// Everything in the log file from the offset on was logged at or after the
+// timestamp. The offset may fall inside a message, so a reader starting there
+// skips ahead to the next message delimiter, or raw CAN log sync byte.
+#define FS_INDEX_RECORD_SIZE 16
+#define FS_INDEX_RECORD_SYNC 0x5a
+#define FS_INDEX_EXTENSION "IDX"
+#define FS_INDEX_MAX_SIZE 65536
+
+// Every trip start and end across the log files, one line each:
+// "start|end,<timestamp>,<log file>,<offset>".
+#define FS_TRIP_CATALOG_FILE "TRIPS.CSV"
+#define FS_TRIP_CATALOG_MAX_SIZE 65536
 
 typedef enum { //todo should we add this in a new fs.h in platform folder?
     NONE_CONNECTED = 0,
@@ -20,12 +92,22 @@ namespace interface {
 namespace fs {
 
 
+typedef enum {
+    // written each time the log is flushed
+    CHECKPOINT = 0,
+    // the vehicle's CAN buses woke up
+    TRIP_START = 1,
+    // the vehicle's CAN buses went quiet
+    TRIP_END = 2,
+} IndexRecordType;
+
 typedef struct {
     InterfaceDescriptor descriptor;
     //since our write speeds are much higher to the SD card we are excluding the queue here
-    QUEUE_TYPE(uint8_t) sendQueue;
+    ByteQueue sendQueue;
     uint8_t buffer[FS_BUF_SZ];
     bool configured;
+    bool rawCanLog;
 } FsDevice;
 
 void setmode(FS_STATE mode);
@@ -49,6 +131,118 @@ bool initialize(FsDevice* device);
 void write(FsDevice* device, uint8_t *data, uint32_t len);
 
 void processSendQueue(FsDevice* device);
+
+/* Public: Encode a received CAN frame as one fixed size raw log record (see
+ * CAN_LOG_RECORD_SIZE for the layout).
+ *
+ * bus - The address of the bus the frame was received on.
+ * id - The frame's message ID.
+ * extended - true if the ID is a 29-bit extended ID.
+ * data - The frame's data bytes.
+ * length - The number of data bytes, at most 8.
+ * timestamp - The time the frame was received, in milliseconds.
+ * record - A buffer of at least CAN_LOG_RECORD_SIZE bytes for the record.
+ *
+ * Returns the number of bytes written to record, CAN_LOG_RECORD_SIZE.
+ */
+size_t encodeCanRecord(uint8_t bus, uint32_t id, bool extended,
+        const uint8_t* data, uint8_t length, uint64_t timestamp,
+        uint8_t record[]);
+
+/* Public: Decode one raw log record written by encodeCanRecord.
+ *
+ * record - CAN_LOG_RECORD_SIZE bytes of a raw CAN log.
+ * bus - Set to the address of the bus the frame was received on.
+ * id - Set to the frame's message ID.
+ * extended - Set to true if the ID is a 29-bit extended ID.
+ * data - A buffer of at least 8 bytes for the frame's data bytes.
+ * length - Set to the number of data bytes.
+ * timestamp - Set to the time the frame was received, in milliseconds.
+ *
+ * Returns false if record doesn't start with CAN_LOG_RECORD_SYNC or its data
+ * length is more than 8, i.e. it isn't the start of a record.
+ */
+bool decodeCanRecord(const uint8_t record[], uint8_t* bus, uint32_t* id,
+        bool* extended, uint8_t* data, uint8_t* length, uint64_t* timestamp);
+
+/* Public: Write a received CAN frame straight to the device's send queue as a
+ * raw log record, without decoding it or building an OpenXC message, if the
+ * device is in raw CAN log mode.
+ *
+ * The arguments match encodeCanRecord.
+ *
+ * Returns true if the record was queued. A record is never split - if the
+ * whole record doesn't fit in the queue, it's dropped.
+ */
+bool logCanMessage(FsDevice* device, uint8_t bus, uint32_t id, bool extended,
+        const uint8_t* data, uint8_t length, uint64_t timestamp);
+
+/* Public: Fill in the header of a journal block (see FS_JOURNAL_BLOCK_SIZE for
+ * the layout) whose payload is already at block + FS_JOURNAL_HEADER_SIZE, and
+ * zero the rest of the block.
+ *
+ * block - A FS_JOURNAL_BLOCK_SIZE byte block.
+ * sequence - The block's sequence number in the journal.
+ * length - The number of payload bytes, at most FS_JOURNAL_PAYLOAD_SIZE.
+ */
+void sealJournalBlock(uint8_t block[], uint32_t sequence, uint16_t length);
+
+/* Public: Check a journal block read back from the card.
+ *
+ * block - A FS_JOURNAL_BLOCK_SIZE byte block.
+ * sequence - Set to the block's sequence number if it's intact.
+ *
+ * Returns the number of payload bytes, or -1 if the block is not a complete,
+ * intact journal block - never written, or cut short by a power loss.
+ */
+int openJournalBlock(const uint8_t block[], uint32_t* sequence);
+
+/* Public: Encode one log index record (see FS_INDEX_RECORD_SIZE for the
+ * layout).
+ *
+ * type - What the record marks.
+ * offset - The position in the log file it marks.
+ * timestamp - The time at that position, in milliseconds.
+ * record - A buffer of at least FS_INDEX_RECORD_SIZE bytes for the record.
+ *
+ * Returns the number of bytes written to record, FS_INDEX_RECORD_SIZE.
+ */
+size_t encodeIndexRecord(IndexRecordType type, uint32_t offset,
+        uint64_t timestamp, uint8_t record[]);
+
+/* Public: Build the name of a log file's index, e.g. "5F3A2B10.IDX" for
+ * "5F3A2B10.TXT".
+ *
+ * Returns false if the log file name has no extension or the index's name
+ * doesn't fit in size bytes.
+ */
+bool indexFileName(const char* logFile, char* name, size_t size);
+
+/* Public: Format one line of the trip catalog (see FS_TRIP_CATALOG_FILE).
+ *
+ * type - TRIP_START or TRIP_END.
+ * timestamp - When the trip started or ended, in milliseconds.
+ * logFile - The log file the trip starts or ends in.
+ * offset - Where in the log file it starts or ends.
+ * line - A buffer for the line, which ends with a newline.
+ * size - The size of the buffer.
+ *
+ * Returns the length of the line, or -1 if type isn't a trip boundary or the
+ * line doesn't fit.
+ */
+int formatTripCatalogLine(IndexRecordType type, uint64_t timestamp,
+        const char* logFile, uint32_t offset, char* line, size_t size);
+
+/* Public: Mark the start or end of a trip in the current log file's index and
+ * in the trip catalog, if the firmware was built with DEFAULT_FS_INDEX.
+ *
+ * Anything still queued for the card is written to the log first, so it falls
+ * on the right side of the mark.
+ *
+ * device - The SD card.
+ * started - true if the trip started, false if it ended.
+ */
+void markTrip(FsDevice* device, bool started);
  
 bool getSDStatus(void); 
 
@@ -57,6 +251,96 @@ void manager(FsDevice* device);
 //Will return status of SD Card/File system
 bool connected(FsDevice* device);
 
+/* Public: Read a whole file from the SD card's log directory.
+ *
+ * device - The SD card, which must be connected.
+ * name - The name of the file.
+ * buffer - A buffer for the file's contents.
+ * length - The size of the buffer.
+ *
+ * Returns the number of bytes read, or -1 if the file doesn't exist or is
+ * larger than the buffer.
+ */
+int readFile(FsDevice* device, const char* name, uint8_t* buffer,
+        size_t length);
+
+/* Public: Append to a file in the SD card's log directory, creating it if it
+ * doesn't exist.
+ *
+ * device - The SD card, which must be connected.
+ * name - The name of the file.
+ * data - The bytes to append.
+ * length - The number of bytes at data.
+ * maxSize - The largest the file may grow to.
+ *
+ * Returns the size of the file after the write, or -1 if it can't be written
+ * or the write would grow it past maxSize.
+ */
+int appendFile(FsDevice* device, const char* name, const uint8_t* data,
+        size_t length, size_t maxSize);
+
+/* Public: Read part of a file in the SD card's log directory.
+ *
+ * device - The SD card, which must be connected.
+ * name - The name of the file.
+ * offset - The position in the file to start reading at.
+ * buffer - A buffer for the bytes read.
+ * length - The most bytes to read.
+ *
+ * Returns the number of bytes read, 0 at the end of the file, or -1 if the
+ * file doesn't exist.
+ */
+int readFileAt(FsDevice* device, const char* name, size_t offset,
+        uint8_t* buffer, size_t length);
+
+/* Public: Returns the size of a file in the SD card's log directory, or -1 if
+ * it doesn't exist or the card isn't connected.
+ */
+int fileSize(FsDevice* device, const char* name);
+
+/* Public: Delete a file from the SD card's log directory.
+ *
+ * Returns true if the file was deleted.
+ */
+bool removeFile(FsDevice* device, const char* name);
+
+/* Public: Find the oldest finished log file that was started after another,
+ * e.g. to go through the logs in order. The file being written now is never
+ * found.
+ *
+ * device - The SD card, which must be connected.
+ * after - The name of a log file, or NULL to find the oldest one.
+ * name - A buffer for the name of the file found.
+ * size - The size of the buffer, at least 13 bytes for an 8.3 name.
+ *
+ * Returns false if there's no such file.
+ */
+bool nextLogFile(FsDevice* device, const char* after, char* name,
+        size_t size);
+
+/* Public: Start sending a log file over the USB file endpoint, straight from
+ * the card's sectors, while logging carries on. Replaces any stream already
+ * running.
+ *
+ * A file that's finished is sent to its end. The file being written now is
+ * followed as it grows, as far as the last flush, until logging moves on to
+ * a new file. Either way, a "sd_stream" message with the file's name and the
+ * offset the stream stopped at is published when it's done.
+ *
+ * device - The SD card, which must be connected.
+ * name - The name of the file in the log directory, or NULL for the file
+ *      being written now.
+ * offset - Where in the file to start, or -1 for its end as of the last
+ *      flush, to only send what's logged from now on.
+ *
+ * Returns false if the file doesn't exist or USB isn't connected.
+ */
+bool startStream(FsDevice* device, const char* name, int32_t offset);
+
+/* Public: Stop the stream started by startStream, if there is one.
+ */
+void stopStream(FsDevice* device);
+
 //Writes any pending data Unmount SD card release buffers
 void deinitialize(FsDevice* device);
 
@@ -10,8 +10,8 @@ using openxc::util::log::debug;
 void openxc::interface::network::initializeCommon(NetworkDevice* device) {
     if(device != NULL) {
         debug("Initializing Network...");
-        QUEUE_INIT(uint8_t, &device->receiveQueue);
-        QUEUE_INIT(uint8_t, &device->sendQueue);
+        BYTE_QUEUE_RESET(&device->receiveQueue);
+        BYTE_QUEUE_RESET(&device->sendQueue);
         device->descriptor.type = InterfaceType::NETWORK;
     }
 }
@@ -13,6 +13,28 @@
 
 #define USE_DHCP
 
+// The most bytes written to the network clients at once - one full TCP segment
+// on Ethernet.
+#ifndef NETWORK_SEND_BUFFER_SIZE
+#define NETWORK_SEND_BUFFER_SIZE 1460
+#endif
+
+// How long, in milliseconds, a partial segment may be held back while more
+// messages are gathered into it. 0 writes every pass.
+#ifndef DEFAULT_NETWORK_COALESCE_MS
+#define DEFAULT_NETWORK_COALESCE_MS 20
+#endif
+
+// The number of bytes the send and receive queues hold. The receive queue only
+// needs room for the largest command a client sends.
+#ifndef NETWORK_SEND_QUEUE_SIZE
+#define NETWORK_SEND_QUEUE_SIZE 512
+#endif
+
+#ifndef NETWORK_RECEIVE_QUEUE_SIZE
+#define NETWORK_RECEIVE_QUEUE_SIZE 256
+#endif
+
 namespace openxc {
 namespace interface {
 namespace network {
@@ -29,8 +51,13 @@ namespace network {
  * sendQueue - A queue of bytes that need to be sent out over an IP network.
  * receiveQueue - A queue of bytes that have been received via an IP network but
  *      not yet processed.
+ * receiveScanner - How far the receiveQueue has been scanned for a complete
+ *      message.
  * server - An instance of Server which will allow connections from network
- *      clients.
+ *      clients. Everything written to it goes to every connected client.
+ * sendBuffer - Bytes moved out of the sendQueue, gathered into one segment.
+ * sendBufferLength - The number of bytes in sendBuffer.
+ * coalesceStartedMs - When the oldest byte in sendBuffer was moved there.
  */
 typedef struct {
     InterfaceDescriptor descriptor;
@@ -39,11 +66,15 @@ typedef struct {
     bool configured;
 
     // device to host
-    QUEUE_TYPE(uint8_t) sendQueue;
+    ByteQueue sendQueue;
     // host to device
-    QUEUE_TYPE(uint8_t) receiveQueue;
+    ByteQueue receiveQueue;
+    openxc::util::bytebuffer::FrameScanner receiveScanner;
 #if defined(__PIC32__) && defined(__USE_NETWORK__)
     Server* server;
+    uint8_t sendBuffer[NETWORK_SEND_BUFFER_SIZE];
+    int sendBufferLength;
+    unsigned long coalesceStartedMs;
 #endif // __USE_NETWORK__
 } NetworkDevice;
 
@@ -56,8 +87,10 @@ void initializeCommon(NetworkDevice* device);
  */
 void initialize(NetworkDevice* device);
 
-/* Processes the network send queue and sends its bytes to connected network
- * clients.
+/* Processes the network send queue and sends its bytes to all connected
+ * network clients, gathered into segments of up to NETWORK_SEND_BUFFER_SIZE
+ * bytes. A partial segment is held back for up to DEFAULT_NETWORK_COALESCE_MS
+ * so that small messages don't each get a segment of their own.
  */
 void processSendQueue(NetworkDevice* device);
 
@@ -12,13 +12,21 @@ using openxc::util::log::debug;
 void openxc::interface::uart::initializeCommon(UartDevice* device) {
     if(device != NULL) {
         debug("Initializing UART.....");
-        QUEUE_INIT(uint8_t, &device->receiveQueue);
-        QUEUE_INIT(uint8_t, &device->sendQueue);
+        BYTE_QUEUE_RESET(&device->receiveQueue);
+        BYTE_QUEUE_RESET(&device->sendQueue);
 
         device->descriptor.type = InterfaceType::UART;
     }
 }
 
+using openxc::util::bytebuffer::FrameType;
+using openxc::payload::PayloadFormat;
+
+FrameType openxc::interface::uart::frameType(PayloadFormat format) {
+    return format == PayloadFormat::JSON ? FrameType::NULL_DELIMITED :
+            FrameType::CHECKED;
+}
+
 size_t openxc::interface::uart::handleIncomingMessage(uint8_t payload[], size_t length) {
     return openxc::commands::handleIncomingMessage(payload, length,
             &config::getConfiguration()->uart.descriptor);
@@ -8,6 +8,16 @@
 
 #define MAX_DEVICE_ID_LENGTH 17
 
+// The number of bytes the send and receive queues hold. The receive queue only
+// needs room for the largest command a host sends.
+#ifndef UART_SEND_QUEUE_SIZE
+#define UART_SEND_QUEUE_SIZE 512
+#endif
+
+#ifndef UART_RECEIVE_QUEUE_SIZE
+#define UART_RECEIVE_QUEUE_SIZE 256
+#endif
+
 namespace openxc {
 namespace interface {
 namespace uart {
@@ -24,6 +34,8 @@ extern const int BAUD_RATE;
  * sendQueue - A queue of bytes that need to be sent out over UART.
  * receiveQueue - A queue of bytes that have been received via UART but not yet
  *      processed.
+ * receiveScanner - How far the receiveQueue has been scanned for a complete
+ *      message.
  * controller - A pointer to the hardware UART device to use for OpenXC messages.
  * deviceId - If applicable, a unique device ID for an attached UART receiver
  *      (e.g. the MAC of a Bluetooth module)
@@ -33,9 +45,10 @@ typedef struct {
     int baudRate;
 
     // device to host
-    QUEUE_TYPE(uint8_t) sendQueue;
+    ByteQueue sendQueue;
     // host to device
-    QUEUE_TYPE(uint8_t) receiveQueue;
+    ByteQueue receiveQueue;
+    openxc::util::bytebuffer::FrameScanner receiveScanner;
     void* controller;
     char deviceId[MAX_DEVICE_ID_LENGTH];
 } UartDevice;
@@ -92,6 +105,15 @@ bool connected(UartDevice* device);
 
 size_t handleIncomingMessage(uint8_t payload[], size_t length);
 
+/* Public: Returns how messages in a payload format are framed over UART. JSON
+ * is delimited by NULL bytes as on every other interface, but a serial link
+ * can drop or corrupt bytes, so the binary formats are sent in CHECKED frames
+ * both ways - a receiver can tell a damaged message from a good one and pick
+ * up again at the next frame.
+ */
+openxc::util::bytebuffer::FrameType frameType(
+        openxc::payload::PayloadFormat format);
+
 } // namespace uart
 } // namespace interface
 } // namespace openxc
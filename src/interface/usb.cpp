@@ -1,17 +1,22 @@
 #include "interface/usb.h"
 
 #include "util/log.h"
+#include "util/timer.h"
 #include "commands/commands.h"
 #include "config.h"
 
+namespace time = openxc::util::time;
+
 using openxc::util::log::debug;
 
 void openxc::interface::usb::initializeCommon(UsbDevice* usbDevice) {
     debug("Initializing USB.....");
     for(int i = 0; i < ENDPOINT_COUNT; i++) {
-        QUEUE_INIT(uint8_t, &usbDevice->endpoints[i].queue);
+        BYTE_QUEUE_RESET(&usbDevice->endpoints[i].queue);
+        usbDevice->endpoints[i].coalescing = false;
     }
     usbDevice->configured = false;
+    usbDevice->coalesceBudgetUs = DEFAULT_USB_COALESCE_BUDGET_US;
     usbDevice->descriptor.type = InterfaceType::USB;
 }
 
@@ -34,6 +39,40 @@ size_t openxc::interface::usb::handleIncomingMessage(uint8_t payload[], size_t l
             &config::getConfiguration()->usb.descriptor);
 }
 
+bool openxc::interface::usb::readyToSend(UsbDevice* device,
+        UsbEndpoint* endpoint) {
+    int length = BYTE_QUEUE_LENGTH(&endpoint->queue);
+    // The log and file endpoints only get the bus once the data waiting for
+    // the IN endpoint is all on its way
+    if(length == 0 || (endpoint != &device->endpoints[IN_ENDPOINT_INDEX] &&
+                !BYTE_QUEUE_EMPTY(
+                    &device->endpoints[IN_ENDPOINT_INDEX].queue))) {
+        endpoint->coalescing = false;
+        return false;
+    }
+
+    if(length >= MAX_USB_PACKET_SIZE_BYTES || device->coalesceBudgetUs == 0) {
+        endpoint->coalescing = false;
+        return true;
+    }
+
+    unsigned long now = time::systemTimeUs();
+    if(!endpoint->coalescing) {
+        endpoint->coalescing = true;
+        endpoint->coalesceStartedUs = now;
+        endpoint->coalesceLength = length;
+        return false;
+    }
+
+    if(length == endpoint->coalesceLength ||
+            now - endpoint->coalesceStartedUs >= device->coalesceBudgetUs) {
+        endpoint->coalescing = false;
+        return true;
+    }
+    endpoint->coalesceLength = length;
+    return false;
+}
+
 bool openxc::interface::usb::connected(UsbDevice* device) {
     return device != NULL && device->configured;
 }
@@ -15,6 +15,34 @@
 #define USB_BUFFER_SIZE 64
 #define USB_SEND_BUFFER_SIZE 512
 #define MAX_USB_PACKET_SIZE_BYTES USB_BUFFER_SIZE
+// The number of IN packets that can be queued with the USB controller at once,
+// one for each of the even and odd ping-pong buffer descriptors.
+#define USB_PACKET_BUFFER_COUNT 2
+
+// How long an IN endpoint may hold back a partial packet, waiting for enough
+// bytes to send a full one. 0 sends every pass.
+#ifndef DEFAULT_USB_COALESCE_BUDGET_US
+#define DEFAULT_USB_COALESCE_BUDGET_US 500
+#endif
+
+// The number of bytes each endpoint's queue holds. The IN endpoint absorbs the
+// bursts of the data stream; the OUT endpoint only needs room for the largest
+// command a host sends.
+#ifndef USB_SEND_QUEUE_SIZE
+#define USB_SEND_QUEUE_SIZE 1024
+#endif
+
+#ifndef USB_RECEIVE_QUEUE_SIZE
+#define USB_RECEIVE_QUEUE_SIZE 256
+#endif
+
+#ifndef USB_LOG_QUEUE_SIZE
+#define USB_LOG_QUEUE_SIZE 512
+#endif
+
+#ifndef USB_FILE_QUEUE_SIZE
+#define USB_FILE_QUEUE_SIZE 512
+#endif
 
 namespace openxc {
 namespace interface {
@@ -32,19 +60,50 @@ typedef enum {
  * direction - the direction of the endpoint, IN or OUT.
  * queue - A queue of bytes from or for IN or OUT requests, depending on the
  *      direction.
+ * receiveScanner - For an OUT endpoint, how far the queue has been scanned for
+ *      a complete message.
+ * coalescing - For an IN endpoint, true if a partial packet is being held back
+ *      (see readyToSend).
+ * coalesceLength - the queue length when the partial packet was last checked.
+ * coalesceStartedUs - when the partial packet started being held back.
+ *
+ * On PIC32, an IN endpoint sends from a pair of packet buffers in turn, so one
+ * can be filled while the controller sends the other:
+ *
+ * packetBuffers - the packets handed to the controller, which reads them
+ *      straight from memory until their transfers complete.
+ * deviceToHostHandles - the transfer handle for each packet buffer.
+ * nextPacketBuffer - the index of the packet buffer the next write uses.
+ *
+ * On other platforms, an IN endpoint streams from a single buffer into the
+ * controller's double banked endpoint memory:
+ *
+ * sendBuffer - the bytes being sent.
+ * sendLength - the number of bytes in sendBuffer, 0 if it's free.
+ * bytesSent - the number of bytes from sendBuffer already written to the
+ *      endpoint.
  */
 typedef struct {
     uint8_t address;
     uint8_t size;
     UsbEndpointDirection direction;
-    QUEUE_TYPE(uint8_t) queue;
-    // This buffer MUST be non-local, so it doesn't get invalidated when it
-    // falls off the stack
-    uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
+    ByteQueue queue;
+    openxc::util::bytebuffer::FrameScanner receiveScanner;
+    bool coalescing;
+    uint16_t coalesceLength;
+    unsigned long coalesceStartedUs;
+    // These buffers MUST be non-local, so they don't get invalidated when they
+    // fall off the stack
 #ifdef __PIC32__
+    uint8_t packetBuffers[USB_PACKET_BUFFER_COUNT][MAX_USB_PACKET_SIZE_BYTES];
+    USB_HANDLE deviceToHostHandles[USB_PACKET_BUFFER_COUNT];
+    uint8_t nextPacketBuffer;
     char receiveBuffer[MAX_USB_PACKET_SIZE_BYTES];
-    USB_HANDLE deviceToHostHandle;
     USB_HANDLE hostToDeviceHandle;
+#else
+    uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
+    uint16_t sendLength;
+    uint16_t bytesSent;
 #endif // __PIC32__
 } UsbEndpoint;
 
@@ -56,6 +115,9 @@ typedef struct {
  *      by a host. Once true, this will not be set to false until the board is
  *      reset.
  *
+ * coalesceBudgetUs - How many microseconds an IN endpoint may wait to fill a
+ *      whole packet before sending a short one.
+ *
  * device - The UsbDevice attached to the host - only used on PIC32.
  */
 typedef struct {
@@ -64,6 +126,7 @@ typedef struct {
     // how would we index into the array?
     UsbEndpoint endpoints[ENDPOINT_COUNT];
     bool configured;
+    unsigned long coalesceBudgetUs;
 #ifdef __PIC32__
     USBDevice device;
 #endif // __PIC32__
@@ -105,6 +168,28 @@ void read(UsbDevice* device, openxc::util::bytebuffer::IncomingMessageCallback c
 void read(UsbDevice* device, UsbEndpoint* endpoint,
         openxc::util::bytebuffer::IncomingMessageCallback callback);
 
+/* Public: Decide if an IN endpoint should send the bytes in its queue now, or
+ * hold them back to send a whole MAX_USB_PACKET_SIZE_BYTES packet instead of a
+ * short one - each transfer takes a frame slot however small it is.
+ *
+ * A full packet is always ready. A partial one is sent once it's been held for
+ * the device's coalesceBudgetUs, or as soon as a check finds no new bytes
+ * since the last one - when the pipeline has gone idle there's nothing to
+ * wait for.
+ *
+ * The log endpoint is lower priority than the data IN endpoint - it's never
+ * ready while there are bytes queued for the IN endpoint, so however verbose
+ * the logging is it doesn't hold back vehicle data. Log messages are dropped
+ * when its queue fills up instead. The same goes for the file endpoint, which
+ * is only fed as its queue empties.
+ *
+ * device - The USB device the endpoint belongs to.
+ * endpoint - The IN endpoint to check.
+ *
+ * Returns true if the queued bytes should be sent.
+ */
+bool readyToSend(UsbDevice* device, UsbEndpoint* endpoint);
+
 /* Public: Send any bytes in the outgoing data queue over the IN endpoint to the
  * host.
  *
@@ -1,7 +1,7 @@
 extern void initializeVehicleInterface();
 extern void firmwareLoop();
 
-#ifndef __TEST_MODE__
+#if !defined(__TEST_MODE__) && !defined(__BENCHMARK_MODE__)
 int main(void) {
     initializeVehicleInterface();
     for (;;) {
@@ -0,0 +1,151 @@
+#include "message_sets.h"
+#include "signals.h"
+#include "config.h"
+#include "diagnostics.h"
+#include "shared_handlers.h"
+#include "virtual_signals.h"
+#include "can/canread.h"
+#include "can/canwrite.h"
+#include "can/canqueue.h"
+#include "util/log.h"
+
+namespace can = openxc::can;
+namespace diagnostics = openxc::diagnostics;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::signals::getCommands;
+using openxc::signals::getCommandCount;
+using openxc::signals::getMessageSetCount;
+
+/* Private: The arrays of a message set prepared by prepare(), which can't be
+ * looked up again without making the set active.
+ */
+typedef struct {
+    int index;
+    CanBus* buses;
+    int busCount;
+} ResidentMessageSet;
+
+static ResidentMessageSet residentSets[RESIDENT_MESSAGE_SET_COUNT];
+static int residentSetCount = 0;
+
+static ResidentMessageSet* findResidentSet(int index) {
+    for(int i = 0; i < residentSetCount; i++) {
+        if(residentSets[i].index == index) {
+            return &residentSets[i];
+        }
+    }
+    return NULL;
+}
+
+/* Private: Record the active message set's arrays and get its buses and
+ * indexes ready, without touching the CAN controllers.
+ */
+static void prepareActiveSet() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        CanBus* bus = &getCanBuses()[i];
+        can::initializeCommon(bus);
+        can::beginAcceptanceFilterUpdate();
+        can::configureDefaultFilters(bus, getMessages(), getMessageCount(),
+                getCanBuses(), getCanBusCount());
+        can::discardAcceptanceFilterUpdate();
+    }
+
+    can::indexSignalNames(getSignals(), getSignalCount(), getCommands(),
+            getCommandCount());
+    can::read::indexSignalDispatch(getSignals(), getSignalCount());
+    can::read::staggerSignalClocks(getSignals(), getSignalCount());
+
+    ResidentMessageSet* set = &residentSets[residentSetCount++];
+    set->index = getConfiguration()->messageSetIndex;
+    set->buses = getCanBuses();
+    set->busCount = getCanBusCount();
+}
+
+void openxc::signals::sets::prepare() {
+    residentSetCount = 0;
+    if(getMessageSetCount() <= 1) {
+        return;
+    }
+
+    int active = getConfiguration()->messageSetIndex;
+    // leave room for the active set, which is set up as usual afterwards
+    for(int i = 0; i < getMessageSetCount() &&
+            residentSetCount < RESIDENT_MESSAGE_SET_COUNT - 1; i++) {
+        if(i != active) {
+            getConfiguration()->messageSetIndex = i;
+            prepareActiveSet();
+        }
+    }
+    getConfiguration()->messageSetIndex = active;
+
+    ResidentMessageSet* set = &residentSets[residentSetCount++];
+    set->index = active;
+    set->buses = getCanBuses();
+    set->busCount = getCanBusCount();
+    debug("Prepared %d message sets for switching", residentSetCount);
+}
+
+bool openxc::signals::sets::resident(int index) {
+    return findResidentSet(index) != NULL;
+}
+
+bool openxc::signals::sets::activate(int index) {
+    if(index == getConfiguration()->messageSetIndex) {
+        return true;
+    }
+
+    ResidentMessageSet* next = findResidentSet(index);
+    if(next == NULL) {
+        debug("Message set %d isn't resident, can't switch to it", index);
+        return false;
+    }
+
+    CanBus* previousBuses = getCanBuses();
+    int previousBusCount = getCanBusCount();
+    for(int i = 0; i < previousBusCount; i++) {
+        CanBus* bus = can::lookupBus(previousBuses[i].address, next->buses,
+                next->busCount);
+        if(bus == NULL || bus->speed != previousBuses[i].speed) {
+            debug("Message set %d doesn't run bus %d at %d baud, can't "
+                    "switch to it", index, previousBuses[i].address,
+                    previousBuses[i].speed);
+            return false;
+        }
+    }
+
+    for(int i = 0; i < previousBusCount; i++) {
+        can::write::flushOutgoingCanMessageQueue(&previousBuses[i]);
+    }
+
+    // From here on the receive interrupt fills the new set's queues. The few
+    // frames still waiting in the old ones follow whatever arrives meanwhile.
+    getConfiguration()->messageSetIndex = index;
+    can::updateAcceptanceFilterTable(next->buses, next->busCount);
+    for(int i = 0; i < previousBusCount; i++) {
+        CanBus* bus = can::lookupBus(previousBuses[i].address, next->buses,
+                next->busCount);
+        CanMessage message;
+        while(can::queue::pop(&previousBuses[i].receiveQueue, &message)) {
+            if(!can::queue::push(&bus->receiveQueue, &message)) {
+                ++bus->messagesDropped;
+            }
+        }
+    }
+
+    diagnostics::initialize(&getConfiguration()->diagnosticsManager,
+            getCanBuses(), getCanBusCount(),
+            getConfiguration()->obd2BusAddress);
+    signals::initialize(&getConfiguration()->diagnosticsManager);
+    signals::handlers::bindHandlers(getSignals(), getSignalCount());
+    signals::virtuals::bindVirtualSignals(getSignals(), getSignalCount());
+    debug("Switched to message set %d", index);
+    return true;
+}
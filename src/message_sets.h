@@ -0,0 +1,52 @@
+#ifndef __MESSAGE_SETS_H__
+#define __MESSAGE_SETS_H__
+
+#include "can/canutil.h"
+
+namespace openxc {
+namespace signals {
+namespace sets {
+
+/* Public: Get every message set other than the active one ready to be
+ * activated without re-initializing the VI - the software side of its CAN
+ * buses (queues and acceptance filter lists) is initialized and its signals
+ * and commands are indexed, up to RESIDENT_MESSAGE_SET_COUNT sets in all.
+ *
+ * This briefly makes each set active, so it must be called before the CAN
+ * interrupts are enabled, i.e. before the active set's buses are initialized.
+ * The active set is indexed as usual afterwards.
+ */
+void prepare();
+
+/* Public: Return true if the message set was prepared by prepare() and can be
+ * switched to with activate().
+ *
+ * index - the index of the message set in signals::getMessageSets().
+ */
+bool resident(int index);
+
+/* Public: Make another message set active, keeping its signals' state from the
+ * last time it was active.
+ *
+ * The CAN controllers keep running - only their acceptance filters are
+ * reloaded - and frames still waiting to be decoded are moved to the new set's
+ * bus with the same controller address, so nothing received around the switch
+ * is dropped. Outgoing messages already queued for a bus are sent first, as
+ * far as the controller will take them. Diagnostic requests are reset and the
+ * new set's signals::initialize() is called, the same as at startup.
+ *
+ * The set must be resident (see prepare()) and have a bus with the same
+ * address and speed for each of the active set's buses.
+ *
+ * index - the index of the message set in signals::getMessageSets().
+ *
+ * Returns true if the set is active, false if it can't be switched to without
+ * re-initializing the VI.
+ */
+bool activate(int index);
+
+} // namespace sets
+} // namespace signals
+} // namespace openxc
+
+#endif // __MESSAGE_SETS_H__
@@ -4,7 +4,12 @@
 #include "util/log.h"
 #include "shared_handlers.h"
 #include "config.h"
+#include "saved_config.h"
+#include "signals.h"
+#include "can/canread.h"
 #include <limits.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace time = openxc::util::time;
 
@@ -14,50 +19,180 @@ using openxc::diagnostics::ActiveDiagnosticRequest;
 using openxc::config::getConfiguration;
 using openxc::config::PowerManagement;
 using openxc::config::RunLevel;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
 
 #define ENGINE_SPEED_PID 0xc
 #define VEHICLE_SPEED_PID 0xd
+#define MS_PER_SECOND 1000
+
+#define STORED_DTC_MODE 0x3
+#define PENDING_DTC_MODE 0x7
+
+// With adaptive polling, how many requests in a row a PID's values must hold
+// steady for before it's requested less often.
+#define OBD2_ADAPTIVE_STABLE_REQUESTS 5
+
+// How long after the cached supported PIDs last changed to save them to flash,
+// so the answers to all of the queries for them are saved at once.
+#define OBD2_PID_CACHE_SAVE_DELAY_MS 5000
 
 static bool ENGINE_STARTED = false;
 static bool VEHICLE_IN_MOTION = false;
 
 static openxc::util::time::FrequencyClock IGNITION_STATUS_TIMER = {0.5, 0, NULL};
 
+/* Private: True once the ignition has been found to be off, until it's seen
+ * to be back on.
+ */
+static bool IGNITION_OFF = false;
+
+/* Private: For passive ignition checks, the engine and vehicle speed signals on
+ * normal mode CAN if the firmware defines them. They're looked up the first
+ * time they're needed, after the signals are indexed.
+ */
+static CanSignal* ENGINE_SPEED_SIGNAL = NULL;
+static CanSignal* VEHICLE_SPEED_SIGNAL = NULL;
+static bool IGNITION_SIGNALS_LOOKED_UP = false;
+
 /* Private: A representation of an OBD-II PID.
  *
  * pid - The 1 byte PID.
  * name - A human readable name to use for this PID when published.
  * frequency - The frequency to request this PID if supported by the vehicle
  *      when automatic, recurring OBD-II requests are enabled.
+ * minFrequency - With adaptive polling, the lowest frequency to request this
+ *      PID at while its value is steady.
+ * maxFrequency - With adaptive polling, the frequency to request this PID at
+ *      after its value changes.
+ * deadband - With adaptive polling, how far the decoded value has to move to
+ *      count as a change.
  */
 typedef struct {
     uint8_t pid;
     const char* name;
     float frequency;
+    float minFrequency;
+    float maxFrequency;
+    float deadband;
 } Obd2Pid;
 
 /* Private: Pre-defined OBD-II PIDs to query for if supported by the vehicle.
  */
 const Obd2Pid OBD2_PIDS[] = {
-    { pid: ENGINE_SPEED_PID, name: "engine_speed", frequency: 5 },
-    { pid: VEHICLE_SPEED_PID, name: "vehicle_speed", frequency: 5 },
-    { pid: 0x4, name: "engine_load", frequency: 5 },
-    { pid: 0x5, name: "engine_coolant_temperature", frequency: 1 },
-    { pid: 0x33, name: "barometric_pressure", frequency: 1 },
-    { pid: 0x4c, name: "commanded_throttle_position", frequency: 1 },
-    { pid: 0x27, name: "fuel_level", frequency: 1 },
-    { pid: 0xf, name: "intake_air_temperature", frequency: 1 },
-    { pid: 0xb, name: "intake_manifold_pressure", frequency: 1 },
-    { pid: 0x1f, name: "running_time", frequency: 1 },
-    { pid: 0x11, name: "throttle_position", frequency: 5 },
-    { pid: 0xa, name: "fuel_pressure", frequency: 1 },
-    { pid: 0x10, name: "mass_airflow", frequency: 5 },
-    { pid: 0x5a, name: "accelerator_pedal_position", frequency: 5 },
-    { pid: 0x52, name: "ethanol_fuel_percentage", frequency: 1 },
-    { pid: 0x5c, name: "engine_oil_temperature", frequency: 1 },
-    { pid: 0x63, name: "engine_torque", frequency: 1 },
+    { pid: ENGINE_SPEED_PID, name: "engine_speed", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 50 },
+    { pid: VEHICLE_SPEED_PID, name: "vehicle_speed", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 1 },
+    { pid: 0x4, name: "engine_load", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 2 },
+    { pid: 0x5, name: "engine_coolant_temperature", frequency: 1,
+        minFrequency: .2, maxFrequency: 2, deadband: 1 },
+    { pid: 0x33, name: "barometric_pressure", frequency: 1,
+        minFrequency: .1, maxFrequency: 1, deadband: 1 },
+    { pid: 0x4c, name: "commanded_throttle_position", frequency: 1,
+        minFrequency: .5, maxFrequency: 5, deadband: 2 },
+    { pid: 0x27, name: "fuel_level", frequency: 1,
+        minFrequency: .1, maxFrequency: 1, deadband: 1 },
+    { pid: 0xf, name: "intake_air_temperature", frequency: 1,
+        minFrequency: .2, maxFrequency: 2, deadband: 1 },
+    { pid: 0xb, name: "intake_manifold_pressure", frequency: 1,
+        minFrequency: .5, maxFrequency: 5, deadband: 2 },
+    { pid: 0x1f, name: "running_time", frequency: 1,
+        minFrequency: .1, maxFrequency: 1, deadband: 10 },
+    { pid: 0x11, name: "throttle_position", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 2 },
+    { pid: 0xa, name: "fuel_pressure", frequency: 1,
+        minFrequency: .2, maxFrequency: 2, deadband: 5 },
+    { pid: 0x10, name: "mass_airflow", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 2 },
+    { pid: 0x5a, name: "accelerator_pedal_position", frequency: 5,
+        minFrequency: 1, maxFrequency: 10, deadband: 2 },
+    { pid: 0x52, name: "ethanol_fuel_percentage", frequency: 1,
+        minFrequency: .1, maxFrequency: 1, deadband: 1 },
+    { pid: 0x5c, name: "engine_oil_temperature", frequency: 1,
+        minFrequency: .2, maxFrequency: 2, deadband: 1 },
+    { pid: 0x63, name: "engine_torque", frequency: 1,
+        minFrequency: .1, maxFrequency: 1, deadband: 1 },
+};
+
+#define OBD2_PID_COUNT (sizeof(OBD2_PIDS) / sizeof(Obd2Pid))
+
+/* Private: The length in bytes of the data for each mode 1 PID, indexed by
+ * the PID, per SAE J1979. A length of 0 means the PID isn't known.
+ */
+static const uint8_t OBD2_PID_DATA_LENGTHS[] = {
+    // 0x00 - 0x0f
+    4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1,
+    // 0x10 - 0x1f
+    2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2,
+    // 0x20 - 0x2f
+    4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1,
+    // 0x30 - 0x3f
+    1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2,
+    // 0x40 - 0x4f
+    4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4,
+    // 0x50 - 0x5f
+    4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1,
+    // 0x60 - 0x64
+    4, 1, 1, 2, 5,
 };
 
+/* Private: The runtime state of one of the OBD2_PIDS.
+ *
+ * source - The arbitration ID of the responses from the first ECU that said it
+ *      supports the PID, or 0 if none has yet.
+ * requestIndex - The index of the request for this PID in PID_REQUESTS, or -1
+ *      if it isn't being requested.
+ * hasValue - True if a value has been received for the PID.
+ * referenceValue - With adaptive polling, the value the PID last changed to.
+ */
+typedef struct {
+    uint32_t source;
+    int requestIndex;
+    bool hasValue;
+    float referenceValue;
+} Obd2PidState;
+
+/* Private: A recurring request added for some of the OBD2_PIDS.
+ *
+ * request - The request, to find it again in the diagnostics manager.
+ * frequency - The frequency the request is currently sent at.
+ * minFrequency - The lowest frequency adaptive polling can slow the request to,
+ *      the highest minFrequency of its PIDs.
+ * maxFrequency - The frequency adaptive polling speeds the request up to, the
+ *      highest maxFrequency of its PIDs.
+ * lastChangeMs - The time (from time::systemTimeMs) any of its PIDs last
+ *      changed, or it last slowed down.
+ */
+typedef struct {
+    DiagnosticRequest request;
+    float frequency;
+    float minFrequency;
+    float maxFrequency;
+    unsigned long lastChangeMs;
+} Obd2PidRequest;
+
+static Obd2PidState PID_STATES[OBD2_PID_COUNT];
+
+/* Private: The recurring requests added for the OBD2_PIDS, so they can be
+ * replaced when more supported PIDs are found.
+ */
+static Obd2PidRequest PID_REQUESTS[OBD2_PID_COUNT];
+static int PID_REQUEST_COUNT = 0;
+
+/* Private: The source of each of the OBD2_PIDS from the last time the vehicle
+ * was queried for them, or from flash - the PIDs that are requested as soon as
+ * the ignition comes on.
+ */
+static uint32_t CACHED_SOURCES[OBD2_PID_COUNT];
+
+/* Private: True if CACHED_SOURCES has changed since it was saved to flash, and
+ * the time (from time::systemTimeMs) it last changed.
+ */
+static bool CACHE_CHANGED = false;
+static unsigned long CACHE_CHANGED_MS = 0;
+
 static void checkIgnitionStatus(DiagnosticsManager* manager,
         const ActiveDiagnosticRequest* request,
         const DiagnosticResponse* response,
@@ -77,7 +212,8 @@ static void checkIgnitionStatus(DiagnosticsManager* manager,
 static void requestIgnitionStatus(DiagnosticsManager* manager) {
     if(manager->obd2Bus != NULL && (getConfiguration()->powerManagement ==
                 PowerManagement::OBD2_IGNITION_CHECK ||
-            getConfiguration()->recurringObd2Requests)) {
+            getConfiguration()->recurringObd2Requests ||
+            manager->dtcMonitorFrequencyHz > 0)) {
         debug("Sending requests to check ignition status");
         DiagnosticRequest request = {arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
                 mode: 0x1, has_pid: true, pid: ENGINE_SPEED_PID};
@@ -91,6 +227,168 @@ static void requestIgnitionStatus(DiagnosticsManager* manager) {
     }
 }
 
+/* Private: Update the ignition status from a normal mode CAN signal, if it's
+ * been received and its bus is still active.
+ *
+ * Returns true if the signal's last value shows the vehicle is on.
+ */
+static bool observeIgnitionSignal(CanSignal* signal, bool* status) {
+    if(signal == NULL || !signal->received || signal->message == NULL ||
+            !openxc::can::busActive(signal->message->bus)) {
+        return false;
+    }
+    *status = signal->lastValue != 0;
+    return *status;
+}
+
+/* Private: Check the engine and vehicle speed signals on normal mode CAN, and
+ * hold off on active OBD-II ignition checks while either shows the vehicle is
+ * on.
+ */
+static void observeIgnitionSignals() {
+    if(!IGNITION_SIGNALS_LOOKED_UP) {
+        ENGINE_SPEED_SIGNAL = openxc::can::lookupSignal("engine_speed",
+                getSignals(), getSignalCount());
+        VEHICLE_SPEED_SIGNAL = openxc::can::lookupSignal("vehicle_speed",
+                getSignals(), getSignalCount());
+        IGNITION_SIGNALS_LOOKED_UP = true;
+    }
+
+    bool match = observeIgnitionSignal(ENGINE_SPEED_SIGNAL, &ENGINE_STARTED);
+    match = observeIgnitionSignal(VEHICLE_SPEED_SIGNAL, &VEHICLE_IN_MOTION) ||
+            match;
+    if(match) {
+        time::tick(&IGNITION_STATUS_TIMER);
+    }
+}
+
+/* Private: With adaptive polling, adjust how often the request for a PID is sent
+ * after receiving a new value for it.
+ *
+ * A change of more than the PID's deadband from its reference value speeds the
+ * request up to its maximum frequency. Once none of the PIDs in the request
+ * have changed for OBD2_ADAPTIVE_STABLE_REQUESTS periods, it's sent half as
+ * often, down to its minimum frequency.
+ */
+static void adaptPidPolling(DiagnosticsManager* manager, uint16_t pid,
+        float value) {
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        Obd2PidState* state = &PID_STATES[i];
+        if(OBD2_PIDS[i].pid != pid || state->requestIndex < 0) {
+            continue;
+        }
+
+        Obd2PidRequest* pidRequest = &PID_REQUESTS[state->requestIndex];
+        unsigned long now = time::systemTimeMs();
+        float frequency = pidRequest->frequency;
+        if(!state->hasValue) {
+            state->hasValue = true;
+            state->referenceValue = value;
+        } else if(value - state->referenceValue > OBD2_PIDS[i].deadband ||
+                state->referenceValue - value > OBD2_PIDS[i].deadband) {
+            state->referenceValue = value;
+            pidRequest->lastChangeMs = now;
+            frequency = pidRequest->maxFrequency;
+        } else if(now - pidRequest->lastChangeMs >=
+                OBD2_ADAPTIVE_STABLE_REQUESTS * MS_PER_SECOND /
+                    pidRequest->frequency) {
+            pidRequest->lastChangeMs = now;
+            frequency = frequency / 2;
+            if(frequency < pidRequest->minFrequency) {
+                frequency = pidRequest->minFrequency;
+            }
+        }
+
+        if(frequency != pidRequest->frequency &&
+                updateRecurringRequestFrequency(manager, manager->obd2Bus,
+                    &pidRequest->request, frequency)) {
+            debug("Adapted OBD-II request for PID 0x%x to %fHz", pid,
+                    frequency);
+            pidRequest->frequency = frequency;
+        }
+        break;
+    }
+}
+
+static void handlePidResponse(DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* request,
+        const DiagnosticResponse* response,
+        float parsedPayload) {
+    checkIgnitionStatus(manager, request, response, parsedPayload);
+    if(getConfiguration()->adaptiveObd2Polling && response->success) {
+        adaptPidPolling(manager, response->pid, parsedPayload);
+    }
+}
+
+/* Private: Replace the recurring requests for the supported OBD2_PIDS.
+ *
+ * Each PID is requested from the ECU that said it supports it. PIDs from the
+ * same ECU at the same frequency share a request, up to
+ * OBD2_MAX_PIDS_PER_REQUEST at a time.
+ */
+static void updateRecurringPidRequests(DiagnosticsManager* manager) {
+    for(int i = 0; i < PID_REQUEST_COUNT; i++) {
+        cancelRecurringRequest(manager, manager->obd2Bus,
+                &PID_REQUESTS[i].request);
+    }
+    PID_REQUEST_COUNT = 0;
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        PID_STATES[i].requestIndex = -1;
+    }
+
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        if(PID_STATES[i].source == 0 || PID_STATES[i].requestIndex >= 0) {
+            continue;
+        }
+
+        Obd2PidRequest* pidRequest = &PID_REQUESTS[PID_REQUEST_COUNT];
+        pidRequest->frequency = OBD2_PIDS[i].frequency;
+        pidRequest->minFrequency = OBD2_PIDS[i].minFrequency;
+        pidRequest->maxFrequency = OBD2_PIDS[i].maxFrequency;
+        pidRequest->lastChangeMs = time::systemTimeMs();
+        DiagnosticRequest request = {
+                arbitration_id: PID_STATES[i].source -
+                        DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET,
+                mode: 0x1, has_pid: true, pid: OBD2_PIDS[i].pid};
+        PID_STATES[i].requestIndex = PID_REQUEST_COUNT;
+        for(size_t j = i + 1; j < OBD2_PID_COUNT &&
+                request.payload_length < OBD2_MAX_PIDS_PER_REQUEST - 1; j++) {
+            if(PID_STATES[j].requestIndex < 0 &&
+                    PID_STATES[j].source == PID_STATES[i].source &&
+                    OBD2_PIDS[j].frequency == OBD2_PIDS[i].frequency) {
+                request.payload[request.payload_length++] = OBD2_PIDS[j].pid;
+                PID_STATES[j].requestIndex = PID_REQUEST_COUNT;
+                if(OBD2_PIDS[j].minFrequency > pidRequest->minFrequency) {
+                    pidRequest->minFrequency = OBD2_PIDS[j].minFrequency;
+                }
+                if(OBD2_PIDS[j].maxFrequency > pidRequest->maxFrequency) {
+                    pidRequest->maxFrequency = OBD2_PIDS[j].maxFrequency;
+                }
+            }
+        }
+
+        debug("Automatically adding recurring request for %d PIDs from 0x%x to 0x%x",
+                request.payload_length + 1, OBD2_PIDS[i].pid,
+                request.arbitration_id);
+        // A request for a single PID is published under its own name, and
+        // the values in responses to a multi-PID request under the name of
+        // each PID.
+        if(addRecurringRequest(manager, manager->obd2Bus, &request,
+                request.payload_length == 0 ? OBD2_PIDS[i].name : NULL,
+                false, openxc::diagnostics::obd2::handleObd2Pid,
+                handlePidResponse, OBD2_PIDS[i].frequency)) {
+            pidRequest->request = request;
+            ++PID_REQUEST_COUNT;
+        } else {
+            for(size_t j = i; j < OBD2_PID_COUNT; j++) {
+                if(PID_STATES[j].requestIndex == PID_REQUEST_COUNT) {
+                    PID_STATES[j].requestIndex = -1;
+                }
+            }
+        }
+    }
+}
+
 static void checkSupportedPids(DiagnosticsManager* manager,
         const ActiveDiagnosticRequest* request,
         const DiagnosticResponse* response,
@@ -99,32 +397,182 @@ static void checkSupportedPids(DiagnosticsManager* manager,
         return;
     }
 
+    // Only physical requests to the responding ECU are grouped, which need its
+    // 11-bit address.
+    if(response->arbitration_id < OBD2_FUNCTIONAL_RESPONSE_START ||
+            response->arbitration_id >= OBD2_FUNCTIONAL_RESPONSE_START +
+                OBD2_FUNCTIONAL_RESPONSE_COUNT) {
+        return;
+    }
+
     debug("%s", "Querying for supported PIDs from vehicle");
+    bool changed = false;
     for(int i = 0; i < response->payload_length; i++) {
         for(int j = CHAR_BIT - 1; j >= 0; j--) {
             if(response->payload[i] >> j & 0x1) {
-                uint16_t pid = response->pid + (i * CHAR_BIT) + j + 1;
+                // The most significant bit of the first byte is the PID after
+                // the one requested
+                uint16_t pid = response->pid + (i * CHAR_BIT) + CHAR_BIT - j;
                 debug("Vehicle supports PID 0x%02x", pid);
-                for(size_t i = 0; i < sizeof(OBD2_PIDS) / sizeof(Obd2Pid); i++) {
-                    if(OBD2_PIDS[i].pid == pid) {
-                        debug("Automatically adding recurring request for PID 0x%x", pid);
-                        DiagnosticRequest request = {
-                                arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
-                                mode: 0x1, has_pid: true, pid: pid};
-                        addRecurringRequest(manager, manager->obd2Bus, &request,
-                                OBD2_PIDS[i].name, false,
-                                openxc::diagnostics::obd2::handleObd2Pid,
-                                checkIgnitionStatus, OBD2_PIDS[i].frequency);
-                        break;
+                for(size_t k = 0; k < OBD2_PID_COUNT; k++) {
+                    if(OBD2_PIDS[k].pid == pid && PID_STATES[k].source == 0) {
+                        PID_STATES[k].source = response->arbitration_id;
+                        changed = true;
                     }
                 }
             }
         }
     }
+
+    // The answer also covers the cached PIDs the ECU no longer supports
+    for(size_t k = 0; k < OBD2_PID_COUNT; k++) {
+        int offset = OBD2_PIDS[k].pid - response->pid - 1;
+        if(PID_STATES[k].source == response->arbitration_id && offset >= 0 &&
+                offset < response->payload_length * CHAR_BIT &&
+                !(response->payload[offset / CHAR_BIT] >>
+                    (CHAR_BIT - 1 - offset % CHAR_BIT) & 0x1)) {
+            debug("Vehicle no longer supports PID 0x%02x", OBD2_PIDS[k].pid);
+            PID_STATES[k].source = 0;
+            changed = true;
+        }
+    }
+
+    if(changed) {
+        updateRecurringPidRequests(manager);
+        for(size_t k = 0; k < OBD2_PID_COUNT; k++) {
+            if(CACHED_SOURCES[k] != PID_STATES[k].source) {
+                CACHED_SOURCES[k] = PID_STATES[k].source;
+                CACHE_CHANGED = true;
+                CACHE_CHANGED_MS = time::systemTimeMs();
+            }
+        }
+    }
+}
+
+/* Private: The trouble codes an ECU last reported in answer to the DTC
+ * monitor's request for stored or pending codes.
+ *
+ * codes - The codes, each as the 2 bytes of the response.
+ * count - The number of codes.
+ * known - True once the ECU has answered at all.
+ */
+typedef struct {
+    uint16_t codes[OBD2_DTC_MONITOR_MAX_CODES];
+    uint8_t count;
+    bool known;
+} DtcSet;
+
+/* Private: The codes last reported by each ECU that answers on an OBD-II
+ * functional response ID, stored codes first and then pending.
+ */
+static DtcSet DTC_SETS[2][OBD2_FUNCTIONAL_RESPONSE_COUNT];
+
+static bool containsDtc(const uint16_t* codes, int count, uint16_t code) {
+    for(int i = 0; i < count; i++) {
+        if(codes[i] == code) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Private: Publish a trouble code that was added or removed, formatted the
+ * standard way, e.g. 0x0301 as "P0301".
+ */
+static void publishDtc(uint8_t mode, uint16_t code, bool added,
+        openxc::pipeline::Pipeline* pipeline) {
+    static const char SYSTEMS[] = {'P', 'C', 'B', 'U'};
+    char formatted[6];
+    snprintf(formatted, sizeof(formatted), "%c%X%03X", SYSTEMS[code >> 14],
+            (code >> 12) & 0x3, code & 0xfff);
+    openxc::can::read::publishStringEventedBooleanMessage(
+            mode == STORED_DTC_MODE ? "obd2_dtc_stored" : "obd2_dtc_pending",
+            formatted, added, pipeline);
+}
+
+static void handleDtcResponse(DiagnosticsManager* manager,
+        const ActiveDiagnosticRequest* request,
+        const DiagnosticResponse* response,
+        float parsedPayload) {
+    if(!response->success || response->payload_length < 1 ||
+            response->arbitration_id < OBD2_FUNCTIONAL_RESPONSE_START ||
+            response->arbitration_id >= OBD2_FUNCTIONAL_RESPONSE_START +
+                OBD2_FUNCTIONAL_RESPONSE_COUNT) {
+        return;
+    }
+
+    DtcSet* set = &DTC_SETS[response->mode == STORED_DTC_MODE ? 0 : 1][
+            response->arbitration_id - OBD2_FUNCTIONAL_RESPONSE_START];
+    // The first byte is the number of codes, followed by 2 bytes for each
+    uint16_t codes[OBD2_DTC_MONITOR_MAX_CODES];
+    int count = 0;
+    for(int i = 0; i < response->payload[0] &&
+            2 * i + 2 < response->payload_length; i++) {
+        uint16_t code = response->payload[2 * i + 1] << 8 |
+                response->payload[2 * i + 2];
+        if(code == 0 || containsDtc(codes, count, code)) {
+            continue;
+        } else if(count == OBD2_DTC_MONITOR_MAX_CODES) {
+            debug("ECU 0x%x reported more than %d trouble codes",
+                    response->arbitration_id, OBD2_DTC_MONITOR_MAX_CODES);
+            break;
+        }
+        codes[count++] = code;
+    }
+
+    openxc::pipeline::Pipeline* pipeline = &getConfiguration()->pipeline;
+    for(int i = 0; i < set->count; i++) {
+        if(!containsDtc(codes, count, set->codes[i])) {
+            publishDtc(response->mode, set->codes[i], false, pipeline);
+        }
+    }
+    for(int i = 0; i < count; i++) {
+        if(!set->known || !containsDtc(set->codes, set->count, codes[i])) {
+            publishDtc(response->mode, codes[i], true, pipeline);
+        }
+    }
+
+    memcpy(set->codes, codes, count * sizeof(codes[0]));
+    set->count = count;
+    set->known = true;
+}
+
+bool openxc::diagnostics::obd2::startDtcMonitor(DiagnosticsManager* manager) {
+    if(manager->obd2Bus == NULL || manager->dtcMonitorFrequencyHz <= 0) {
+        return false;
+    }
+
+    debug("Starting the DTC monitor");
+    DiagnosticRequest request = {arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
+            mode: STORED_DTC_MODE};
+    bool added = addQuietRecurringRequest(manager, manager->obd2Bus, &request,
+            true, handleDtcResponse, manager->dtcMonitorFrequencyHz);
+    request.mode = PENDING_DTC_MODE;
+    return addQuietRecurringRequest(manager, manager->obd2Bus, &request,
+            true, handleDtcResponse, manager->dtcMonitorFrequencyHz) && added;
+}
+
+bool openxc::diagnostics::obd2::requestDtcs(DiagnosticsManager* manager) {
+    if(manager->obd2Bus == NULL) {
+        return false;
+    }
+
+    DiagnosticRequest request = {arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
+            mode: STORED_DTC_MODE};
+    return addRequest(manager, manager->obd2Bus, &request, NULL, true, NULL,
+            handleDtcResponse);
 }
 
 void openxc::diagnostics::obd2::initialize(DiagnosticsManager* manager) {
-    requestIgnitionStatus(manager);
+    IGNITION_OFF = false;
+    memset(DTC_SETS, 0, sizeof(DTC_SETS));
+    if(getConfiguration()->passiveIgnitionCheck) {
+        // Give normal mode CAN a chance to show the ignition status before
+        // sending any requests for it
+        time::tick(&IGNITION_STATUS_TIMER);
+    } else {
+        requestIgnitionStatus(manager);
+    }
 }
 
 // * CAN traffic will eventualy stop, and we will suspend.
@@ -134,6 +582,7 @@ void openxc::diagnostics::obd2::initialize(DiagnosticsManager* manager) {
 // seconds to start this process over again.
 void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
     static bool pidSupportQueried = false;
+    static bool dtcMonitorStarted = false;
     const int MAX_IGNITION_CHECK_COUNT = 3;
     static int ignitionCheckCount = 0;
 
@@ -141,6 +590,24 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
         return;
     }
 
+    if(CACHE_CHANGED && time::systemTimeMs() - CACHE_CHANGED_MS >=
+            OBD2_PID_CACHE_SAVE_DELAY_MS) {
+        CACHE_CHANGED = false;
+        openxc::config::saveSupportedPids();
+    }
+
+    bool passive = getConfiguration()->passiveIgnitionCheck;
+    if(passive) {
+        observeIgnitionSignals();
+    }
+
+    if(passive && IGNITION_OFF && !ENGINE_STARTED && !VEHICLE_IN_MOTION) {
+        // Don't poll for the ignition once it's off - CAN will go quiet and
+        // we'll suspend, or the signals will show it's back on. CAN activity
+        // after suspending wakes the VI up and starts the checks over.
+        return;
+    }
+
     if(time::elapsed(&IGNITION_STATUS_TIMER, false)) {
         if(ignitionCheckCount >= MAX_IGNITION_CHECK_COUNT &&
                 getConfiguration()->powerManagement ==
@@ -154,6 +621,11 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
             IGNITION_STATUS_TIMER.frequency = .1;
             ignitionCheckCount = 0;
             pidSupportQueried = false;
+            dtcMonitorStarted = false;
+            // whatever was last heard from the engine and vehicle speed is
+            // stale now
+            ENGINE_STARTED = VEHICLE_IN_MOTION = false;
+            IGNITION_OFF = true;
         } else {
             // We haven't received an ignition in 5 seconds. Either the user didn't
             // have either OBD-II request configured as a recurring request (which
@@ -166,10 +638,26 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
     } else if(ENGINE_STARTED || VEHICLE_IN_MOTION) {
         IGNITION_STATUS_TIMER.frequency = .5;
         ignitionCheckCount = 0;
+        IGNITION_OFF = false;
         getConfiguration()->desiredRunLevel = RunLevel::ALL_IO;
+        if(!dtcMonitorStarted) {
+            // any requests for the codes were cancelled with the rest when
+            // the ignition went off
+            dtcMonitorStarted = startDtcMonitor(manager);
+        }
         if(getConfiguration()->recurringObd2Requests && !pidSupportQueried) {
             debug("Ignition is on - querying for supported OBD-II PIDs");
             pidSupportQueried = true;
+            // any requests for the PIDs were cancelled with the rest when the
+            // ignition went off. Start with the PIDs it supported last time,
+            // and let the queries correct them.
+            for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+                PID_STATES[i] = {0};
+                PID_STATES[i].source = CACHED_SOURCES[i];
+                PID_STATES[i].requestIndex = -1;
+            }
+            PID_REQUEST_COUNT = 0;
+            updateRecurringPidRequests(manager);
             DiagnosticRequest request = {
                     arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
                     mode: 0x1,
@@ -184,10 +672,91 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
     }
 }
 
+int openxc::diagnostics::obd2::saveSupportedPids(SavedSupportedPid* pids,
+        int maxCount) {
+    int count = 0;
+    for(size_t i = 0; i < OBD2_PID_COUNT && count < maxCount; i++) {
+        if(CACHED_SOURCES[i] != 0) {
+            pids[count].pid = OBD2_PIDS[i].pid;
+            pids[count].ecu = CACHED_SOURCES[i] -
+                    OBD2_FUNCTIONAL_RESPONSE_START;
+            ++count;
+        }
+    }
+    return count;
+}
+
+void openxc::diagnostics::obd2::restoreSupportedPids(
+        const SavedSupportedPid* pids, int count) {
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        CACHED_SOURCES[i] = 0;
+        for(int j = 0; j < count; j++) {
+            if(pids[j].pid == OBD2_PIDS[i].pid &&
+                    pids[j].ecu < OBD2_FUNCTIONAL_RESPONSE_COUNT) {
+                CACHED_SOURCES[i] = OBD2_FUNCTIONAL_RESPONSE_START +
+                        pids[j].ecu;
+            }
+        }
+    }
+    CACHE_CHANGED = false;
+}
+
 bool openxc::diagnostics::obd2::isObd2Request(DiagnosticRequest* request) {
     return request->mode == 0x1 && request->has_pid && request->pid < 0xff;
 }
 
+bool openxc::diagnostics::obd2::isMultiPidRequest(
+        const DiagnosticRequest* request) {
+    return request->mode == 0x1 && request->has_pid && request->pid < 0xff &&
+            request->payload_length > 0;
+}
+
+int openxc::diagnostics::obd2::nextPidResponse(
+        const DiagnosticResponse* response, int offset,
+        DiagnosticResponse* pidResponse) {
+    uint16_t pid = response->pid;
+    int dataStart = 0;
+    if(offset > 0) {
+        if(offset >= response->payload_length) {
+            return -1;
+        }
+        pid = response->payload[offset];
+        dataStart = offset + 1;
+    }
+
+    int length = pid < sizeof(OBD2_PID_DATA_LENGTHS) ?
+            OBD2_PID_DATA_LENGTHS[pid] : 0;
+    if(length == 0 || dataStart + length > response->payload_length) {
+        return -1;
+    }
+
+    *pidResponse = *response;
+    pidResponse->has_pid = true;
+    pidResponse->pid = pid;
+    memcpy(pidResponse->payload, &response->payload[dataStart], length);
+    pidResponse->payload_length = length;
+    return dataStart + length;
+}
+
+const char* openxc::diagnostics::obd2::pidName(uint8_t pid) {
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        if(OBD2_PIDS[i].pid == pid) {
+            return OBD2_PIDS[i].name;
+        }
+    }
+    return NULL;
+}
+
+bool openxc::diagnostics::obd2::lookupPid(const char* name, uint8_t* pid) {
+    for(size_t i = 0; i < OBD2_PID_COUNT; i++) {
+        if(!strcmp(OBD2_PIDS[i].name, name)) {
+            *pid = OBD2_PIDS[i].pid;
+            return true;
+        }
+    }
+    return false;
+}
+
 float openxc::diagnostics::obd2::handleObd2Pid(
         const DiagnosticResponse* response, float parsedPayload) {
     return diagnostic_decode_obd2_pid(response);
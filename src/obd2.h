@@ -6,10 +6,48 @@
 #include "util/timer.h"
 #include "diagnostics.h"
 
+/* Public: The most PIDs that can be requested in one mode 1 request.
+ */
+#define OBD2_MAX_PIDS_PER_REQUEST 6
+
+/* Public: How often the DTC monitor asks every ECU for its stored (mode 3) and
+ * pending (mode 7) diagnostic trouble codes while the ignition is on, in Hz.
+ * Only the codes that appear or disappear since the last answer are published.
+ * If 0, the monitor is off.
+ */
+#ifndef OBD2_DTC_MONITOR_FREQUENCY_HZ
+#define OBD2_DTC_MONITOR_FREQUENCY_HZ 0
+#endif
+
+/* Public: The most stored or pending trouble codes the DTC monitor keeps track
+ * of for each ECU. Any more in a response are ignored.
+ */
+#ifndef OBD2_DTC_MONITOR_MAX_CODES
+#define OBD2_DTC_MONITOR_MAX_CODES 8
+#endif
+
+/* Public: The most supported PIDs kept in the cache saved to flash.
+ */
+#ifndef OBD2_SAVED_PID_COUNT
+#define OBD2_SAVED_PID_COUNT 24
+#endif
+
 namespace openxc {
 namespace diagnostics {
 namespace obd2 {
 
+/* Public: One of the predefined recurring PIDs the vehicle supports, as it's
+ * cached in flash.
+ *
+ * pid - The PID.
+ * ecu - The ECU that supports it, as the offset of its response arbitration ID
+ *      from OBD2_FUNCTIONAL_RESPONSE_START.
+ */
+typedef struct {
+    uint8_t pid;
+    uint8_t ecu;
+} SavedSupportedPid;
+
 /* Public: The main loop for the OBD-II module of the diagnostics system.
  *
  * This function should be called every time through the main event loop. It
@@ -19,10 +57,17 @@ namespace obd2 {
  * zero, to avoid keeping the CAN bus alive with recurring requests even after
  * the user leaves the vehicle.
  *
+ * With passive ignition checks, the engine and vehicle speed signals on normal
+ * mode CAN are watched first, and OBD-II requests are only sent when neither
+ * has shown the vehicle is on for a couple of seconds. Once the ignition is
+ * found to be off, no more requests are sent until the signals show it's on.
+ *
  * If recurring OBD-II requests are enabled, this will also kick off a
  * diagnostic request for supported PIDs when the engine is on or vehicle is
  * in motion. When the supported PIDs are confirmed, a pre-defined set will be
- * added as recurring requests (see obd2.cpp for those predefined PIDs).
+ * added as recurring requests (see obd2.cpp for those predefined PIDs). PIDs
+ * supported by the same ECU at the same frequency are grouped into requests of
+ * up to OBD2_MAX_PIDS_PER_REQUEST PIDs, sent to that ECU.
  */
 void loop(DiagnosticsManager* manager);
 
@@ -34,12 +79,103 @@ void loop(DiagnosticsManager* manager);
  */
 void initialize(DiagnosticsManager* manager);
 
+/* Public: Start the DTC monitor, with recurring requests for the stored and
+ * pending trouble codes of every ECU on the OBD-II bus at the manager's
+ * dtcMonitorFrequencyHz. The responses aren't published - instead, each code
+ * that an ECU starts or stops reporting is published as e.g.
+ *
+ *      {"name": "obd2_dtc_stored", "value": "P0301", "event": true}
+ *
+ * with the event true when the code is added and false when it's removed. The
+ * first answer from an ECU publishes all of its codes. The loop starts the
+ * monitor on its own when the ignition comes on.
+ *
+ * Returns true if the requests were added.
+ */
+bool startDtcMonitor(DiagnosticsManager* manager);
+
+/* Public: Ask every ECU on the OBD-II bus for its stored trouble codes once.
+ * The codes are published as they are by the DTC monitor, so an ECU's first
+ * answer publishes all of them.
+ *
+ * Returns true if the request was added.
+ */
+bool requestDtcs(DiagnosticsManager* manager);
+
+/* Public: Copy out the cache of which predefined PIDs the vehicle supports,
+ * from the last time they were queried.
+ *
+ * pids - The destination for the supported PIDs.
+ * maxCount - The most PIDs to copy.
+ *
+ * Returns the number of PIDs copied.
+ */
+int saveSupportedPids(SavedSupportedPid* pids, int maxCount);
+
+/* Public: Replace the cache of which predefined PIDs the vehicle supports,
+ * e.g. with one saved to flash. When the ignition comes on, the recurring
+ * requests for the cached PIDs are added right away, instead of after the
+ * vehicle answers the queries for its supported PIDs. The queries are still
+ * sent, and the requests and cache are updated from the answers.
+ *
+ * pids - The supported PIDs, as copied by saveSupportedPids.
+ * count - The length of pids.
+ */
+void restoreSupportedPids(const SavedSupportedPid* pids, int count);
+
 /* Public: Check if a request is an OBD-II PID request.
  *
  * Returns true if the request is a mode 1  request and it has a 1 byte PID.
  */
 bool isObd2Request(DiagnosticRequest* request);
 
+/* Public: Check if a request is for more than one OBD-II PID at once.
+ *
+ * A mode 1 request can list up to OBD2_MAX_PIDS_PER_REQUEST PIDs - the first
+ * in the request's pid and the rest in its payload, one byte each.
+ *
+ * Returns true if the request is an OBD-II PID request with more PIDs in its
+ * payload.
+ */
+bool isMultiPidRequest(const DiagnosticRequest* request);
+
+/* Public: Split out the value of one PID from a response to a multi-PID
+ * request.
+ *
+ * The response's pid is the first PID and its payload is that PID's data,
+ * followed by each other PID and its data. The length of each PID's data is
+ * looked up from the standard mode 1 PID definitions, so splitting stops at
+ * the first PID that isn't recognized.
+ *
+ * response - The response to the multi-PID request.
+ * offset - 0 to split out the first PID, and after that the return value of
+ *      the previous call.
+ * pidResponse - A response to fill in for just the PID that was split out.
+ *
+ * Returns the offset to pass in to split out the next PID, or -1 if there are
+ * no more PIDs in the response.
+ */
+int nextPidResponse(const DiagnosticResponse* response, int offset,
+        DiagnosticResponse* pidResponse);
+
+/* Public: Look up the name a PID is published with when it's requested
+ * automatically.
+ *
+ * Returns the name of the PID, or NULL if it isn't one of the predefined
+ * recurring PIDs.
+ */
+const char* pidName(uint8_t pid);
+
+/* Public: Look up the predefined recurring PID that's published with a name,
+ * the reverse of pidName.
+ *
+ * name - The name to look for.
+ * pid - The destination for the PID.
+ *
+ * Returns true if the name is a predefined PID's.
+ */
+bool lookupPid(const char* name, uint8_t* pid);
+
 /* Public: Decode the payload of an OBD-II PID.
  *
  * This function matches the type signature for a DiagnosticResponseDecoder, so
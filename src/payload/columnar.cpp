@@ -0,0 +1,329 @@
+#include "payload/columnar.h"
+
+#include <math.h>
+#include <string.h>
+#include "payload/messagepack.h"
+#include "openxc.pb.h"
+
+using openxc::payload::columnar::ColumnarBatch;
+using openxc::payload::columnar::ColumnarColumn;
+using openxc::payload::PayloadFormat;
+
+// The largest multiple of the resolution a value may be, so that the change
+// between any two of them still fits in an int32_t.
+#define MAX_QUANTIZED_VALUE (1L << 30)
+
+// Protocol buffer wire types and keys, for the record
+#define WIRETYPE_VARINT 0
+#define WIRETYPE_STRING 2
+#define FIELD_KEY(tag, wiretype) (((tag) << 3) | (wiretype))
+
+static const char NAME[] = COLUMNAR_MESSAGE_NAME;
+#define NAME_LENGTH (sizeof(NAME) - 1)
+
+static const char JSON_PREFIX[] = "{\"name\":\"" COLUMNAR_MESSAGE_NAME
+        "\",\"value\":\"";
+// Includes the record delimiter
+static const char JSON_SUFFIX[] = "\"}";
+
+static const char BASE64_ALPHABET[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t varintSize(uint64_t value) {
+    size_t size = 1;
+    while(value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+static uint8_t* writeVarint(uint8_t* cursor, uint64_t value) {
+    while(value >= 0x80) {
+        *cursor++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *cursor++ = (uint8_t)value;
+    return cursor;
+}
+
+/* Private: Returns the number of bytes of the varint at the cursor. */
+static size_t skipVarint(const uint8_t* cursor) {
+    size_t size = 1;
+    while(*cursor++ & 0x80) {
+        ++size;
+    }
+    return size;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+/* Private: Returns the size of a block as it would be encoded now. */
+static size_t encodedSize(const ColumnarBatch* batch) {
+    size_t size = 1 + varintSize(batch->baseMs) +
+            varintSize(batch->columnCount);
+    for(int i = 0; i < batch->columnCount; i++) {
+        const ColumnarColumn* column = &batch->columns[i];
+        size += varintSize(column->signalId) + sizeof(float) +
+                varintSize(column->sampleCount) +
+                varintSize(column->streamLength) + column->streamLength;
+    }
+    return size;
+}
+
+void openxc::payload::columnar::reset(ColumnarBatch* batch) {
+    batch->columnCount = 0;
+    batch->samplesLength = 0;
+}
+
+bool openxc::payload::columnar::empty(const ColumnarBatch* batch) {
+    return batch->samplesLength == 0;
+}
+
+bool openxc::payload::columnar::add(ColumnarBatch* batch, uint16_t signalId,
+        float resolution, uint64_t timeMs, float value) {
+    int index = 0;
+    while(index < batch->columnCount &&
+            batch->columns[index].signalId != signalId) {
+        ++index;
+    }
+    if(index == batch->columnCount &&
+            batch->columnCount >= COLUMNAR_SIGNAL_COUNT) {
+        return false;
+    }
+
+    if(index == batch->columnCount) {
+        resolution = fabsf(resolution);
+        if(!(resolution > 0)) {
+            resolution = COLUMNAR_DEFAULT_RESOLUTION;
+        }
+    } else {
+        resolution = batch->columns[index].resolution;
+    }
+
+    // Written this way round, NaN isn't in range either
+    double quantized = (double) value / resolution;
+    if(!(fabs(quantized) < MAX_QUANTIZED_VALUE)) {
+        return false;
+    }
+
+    if(empty(batch)) {
+        batch->baseMs = timeMs;
+    }
+    uint64_t offsetMs = timeMs > batch->baseMs ? timeMs - batch->baseMs : 0;
+    if(offsetMs > 0xffffffff) {
+        return false;
+    }
+
+    ColumnarColumn previous = batch->columns[index];
+    uint8_t previousColumnCount = batch->columnCount;
+    ColumnarColumn* column = &batch->columns[index];
+    if(index == batch->columnCount) {
+        column->signalId = signalId;
+        column->resolution = resolution;
+        column->sampleCount = 0;
+        column->streamLength = 0;
+        column->lastOffsetMs = 0;
+        column->lastValue = 0;
+        ++batch->columnCount;
+    }
+
+    if(offsetMs < column->lastOffsetMs) {
+        offsetMs = column->lastOffsetMs;
+    }
+    int32_t quantizedValue = (int32_t) lround(quantized);
+    uint64_t timeDelta = offsetMs - column->lastOffsetMs;
+    uint64_t valueDelta = zigzag((int64_t) quantizedValue - column->lastValue);
+    size_t sampleSize = varintSize(timeDelta) + varintSize(valueDelta);
+
+    column->sampleCount++;
+    column->streamLength += sampleSize;
+    if(batch->samplesLength + 1 + sampleSize > sizeof(batch->samples) ||
+            encodedSize(batch) > COLUMNAR_BLOCK_SIZE) {
+        *column = previous;
+        batch->columnCount = previousColumnCount;
+        return false;
+    }
+
+    uint8_t* cursor = &batch->samples[batch->samplesLength];
+    *cursor++ = index;
+    cursor = writeVarint(cursor, timeDelta);
+    cursor = writeVarint(cursor, valueDelta);
+    batch->samplesLength = cursor - batch->samples;
+    column->lastOffsetMs = offsetMs;
+    column->lastValue = quantizedValue;
+    return true;
+}
+
+int openxc::payload::columnar::encode(const ColumnarBatch* batch,
+        uint8_t block[], size_t length) {
+    if(empty(batch) || length < encodedSize(batch)) {
+        return 0;
+    }
+
+    uint8_t* cursor = block;
+    *cursor++ = COLUMNAR_VERSION;
+    cursor = writeVarint(cursor, batch->baseMs);
+    cursor = writeVarint(cursor, batch->columnCount);
+    for(int i = 0; i < batch->columnCount; i++) {
+        const ColumnarColumn* column = &batch->columns[i];
+        cursor = writeVarint(cursor, column->signalId);
+        uint32_t resolution;
+        memcpy(&resolution, &column->resolution, sizeof(resolution));
+        for(size_t byte = 0; byte < sizeof(resolution); byte++) {
+            *cursor++ = (uint8_t)(resolution >> (8 * byte));
+        }
+        cursor = writeVarint(cursor, column->sampleCount);
+        cursor = writeVarint(cursor, column->streamLength);
+    }
+
+    for(int i = 0; i < batch->columnCount; i++) {
+        const uint8_t* sample = batch->samples;
+        while(sample < &batch->samples[batch->samplesLength]) {
+            size_t sampleSize = skipVarint(sample + 1);
+            sampleSize += skipVarint(sample + 1 + sampleSize);
+            if(*sample == i) {
+                memcpy(cursor, sample + 1, sampleSize);
+                cursor += sampleSize;
+            }
+            sample += 1 + sampleSize;
+        }
+    }
+    return cursor - block;
+}
+
+static uint8_t* writeBase64(uint8_t* cursor, const uint8_t* data,
+        size_t length) {
+    for(size_t i = 0; i < length; i += 3) {
+        uint32_t group = data[i] << 16;
+        if(i + 1 < length) {
+            group |= data[i + 1] << 8;
+        }
+        if(i + 2 < length) {
+            group |= data[i + 2];
+        }
+        *cursor++ = BASE64_ALPHABET[(group >> 18) & 0x3f];
+        *cursor++ = BASE64_ALPHABET[(group >> 12) & 0x3f];
+        *cursor++ = i + 1 < length ? BASE64_ALPHABET[(group >> 6) & 0x3f] :
+                '=';
+        *cursor++ = i + 2 < length ? BASE64_ALPHABET[group & 0x3f] : '=';
+    }
+    return cursor;
+}
+
+static int wrapJson(const uint8_t* block, size_t blockLength,
+        uint8_t payload[], size_t length) {
+    size_t size = sizeof(JSON_PREFIX) - 1 + (blockLength + 2) / 3 * 4 +
+            sizeof(JSON_SUFFIX);
+    if(length < size) {
+        return 0;
+    }
+
+    uint8_t* cursor = payload;
+    memcpy(cursor, JSON_PREFIX, sizeof(JSON_PREFIX) - 1);
+    cursor += sizeof(JSON_PREFIX) - 1;
+    cursor = writeBase64(cursor, block, blockLength);
+    memcpy(cursor, JSON_SUFFIX, sizeof(JSON_SUFFIX));
+    return size;
+}
+
+/* Private: Write a MessagePack map key, as the name of the field or in the
+ * compact schema its integer key - which are all positive fixints.
+ */
+static uint8_t* writeMessagePackKey(uint8_t* cursor,
+        openxc::payload::messagepack::CompactKey key, const char* name,
+        bool compact) {
+    if(compact) {
+        *cursor++ = key;
+    } else {
+        size_t nameLength = strlen(name);
+        *cursor++ = 0xa0 | nameLength;
+        memcpy(cursor, name, nameLength);
+        cursor += nameLength;
+    }
+    return cursor;
+}
+
+static int wrapMessagePack(const uint8_t* block, size_t blockLength,
+        uint8_t payload[], size_t length, bool compact) {
+    namespace messagepack = openxc::payload::messagepack;
+    // fixmap, two keys, fixstr name, bin 16 value
+    size_t size = 1 + 2 * 6 + 1 + NAME_LENGTH + 3 + blockLength;
+    if(length < size) {
+        return 0;
+    }
+
+    uint8_t* cursor = payload;
+    *cursor++ = 0x82;
+    cursor = writeMessagePackKey(cursor, messagepack::NAME_KEY,
+            messagepack::NAME_FIELD_NAME, compact);
+    *cursor++ = 0xa0 | NAME_LENGTH;
+    memcpy(cursor, NAME, NAME_LENGTH);
+    cursor += NAME_LENGTH;
+    cursor = writeMessagePackKey(cursor, messagepack::VALUE_KEY,
+            messagepack::VALUE_FIELD_NAME, compact);
+    *cursor++ = 0xc5;
+    *cursor++ = blockLength >> 8;
+    *cursor++ = blockLength & 0xff;
+    memcpy(cursor, block, blockLength);
+    cursor += blockLength;
+    return cursor - payload;
+}
+
+/* Private: Write a VehicleMessage, prefixed with its length like the
+ * protobuf records in a send queue.
+ */
+static int wrapProtobuf(const uint8_t* block, size_t blockLength,
+        uint8_t payload[], size_t length) {
+    size_t valueLength = 2 + 1 + varintSize(blockLength) + blockLength;
+    size_t simpleLength = 1 + 1 + NAME_LENGTH + 1 + varintSize(valueLength) +
+            valueLength;
+    size_t messageLength = 2 + 1 + varintSize(simpleLength) + simpleLength;
+    if(length < varintSize(messageLength) + messageLength) {
+        return 0;
+    }
+
+    uint8_t* cursor = writeVarint(payload, messageLength);
+    *cursor++ = FIELD_KEY(openxc_VehicleMessage_type_tag, WIRETYPE_VARINT);
+    *cursor++ = openxc_VehicleMessage_Type_SIMPLE;
+    *cursor++ = FIELD_KEY(openxc_VehicleMessage_simple_message_tag,
+            WIRETYPE_STRING);
+    cursor = writeVarint(cursor, simpleLength);
+    *cursor++ = FIELD_KEY(openxc_SimpleMessage_name_tag, WIRETYPE_STRING);
+    *cursor++ = NAME_LENGTH;
+    memcpy(cursor, NAME, NAME_LENGTH);
+    cursor += NAME_LENGTH;
+    *cursor++ = FIELD_KEY(openxc_SimpleMessage_value_tag, WIRETYPE_STRING);
+    cursor = writeVarint(cursor, valueLength);
+    *cursor++ = FIELD_KEY(openxc_DynamicField_type_tag, WIRETYPE_VARINT);
+    *cursor++ = openxc_DynamicField_Type_STRING;
+    *cursor++ = FIELD_KEY(openxc_DynamicField_string_value_tag,
+            WIRETYPE_STRING);
+    cursor = writeVarint(cursor, blockLength);
+    memcpy(cursor, block, blockLength);
+    cursor += blockLength;
+    return cursor - payload;
+}
+
+int openxc::payload::columnar::serialize(const ColumnarBatch* batch,
+        uint8_t payload[], size_t length, PayloadFormat format) {
+    uint8_t block[COLUMNAR_BLOCK_SIZE];
+    int blockLength = encode(batch, block, sizeof(block));
+    if(blockLength == 0) {
+        return 0;
+    }
+
+    switch(format) {
+    case PayloadFormat::JSON:
+        return wrapJson(block, blockLength, payload, length);
+    case PayloadFormat::PROTOBUF:
+        return wrapProtobuf(block, blockLength, payload, length);
+    case PayloadFormat::MESSAGEPACK:
+    case PayloadFormat::MESSAGEPACK_COMPACT:
+        return wrapMessagePack(block, blockLength, payload, length,
+                format == PayloadFormat::MESSAGEPACK_COMPACT);
+    }
+    return 0;
+}
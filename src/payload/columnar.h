@@ -0,0 +1,135 @@
+#ifndef __COLUMNAR_H__
+#define __COLUMNAR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "payload/payload.h"
+
+// The most bytes in one columnar block. Each block goes out as a single
+// record, which with JSON is base64 encoded and about a third bigger.
+#ifndef COLUMNAR_BLOCK_SIZE
+#define COLUMNAR_BLOCK_SIZE 256
+#endif
+
+// The most signals one block has columns for.
+#ifndef COLUMNAR_SIGNAL_COUNT
+#define COLUMNAR_SIGNAL_COUNT 16
+#endif
+
+// The step a signal's values are rounded to if it doesn't have one of its own.
+#define COLUMNAR_DEFAULT_RESOLUTION 0.001f
+
+// The most bytes of the record a block is wrapped in, in any payload format.
+#define COLUMNAR_RECORD_SIZE ((COLUMNAR_BLOCK_SIZE + 2) / 3 * 4 + 48)
+
+#define COLUMNAR_VERSION 1
+
+// The name of the simple message a block is sent as.
+#define COLUMNAR_MESSAGE_NAME "columnar"
+
+// A columnar block holds the numeric samples of a handful of signals over a
+// window of time, grouped by signal so that each signal's samples can be sent
+// as small deltas from the one before. Integers are unsigned LEB128 varints,
+// and signed ones are zigzag encoded first.
+//
+//  version (1 byte)
+//  the time of the first sample in ms - a Unix time if the VI has one
+//  the number of columns
+//  for each column:
+//      the signal ID, as in the signal dictionary
+//      the resolution, a little endian float32 - values are integer multiples
+//      the number of samples
+//      the length of the column's stream in bytes
+//  the streams, in column order, each with every sample of its column as:
+//      the ms since the column's previous sample (or the block's first)
+//      signed, the change in value / resolution since the previous (or 0)
+//
+// A block is sent as a simple message named COLUMNAR_MESSAGE_NAME, with the
+// block as its value: base64 encoded in a JSON string, a MessagePack bin, or
+// the bytes of the string_value of a protobuf DynamicField.
+
+namespace openxc {
+namespace payload {
+namespace columnar {
+
+/* Public: The samples of one signal in a block. */
+typedef struct {
+    uint16_t signalId;
+    float resolution;
+    uint16_t sampleCount;
+    uint16_t streamLength;
+    uint32_t lastOffsetMs;
+    int32_t lastValue;
+} ColumnarColumn;
+
+/* Public: A block being filled. The fields are private to columnar.cpp - it's
+ * a struct so the caller decides where the RAM comes from.
+ *
+ * The samples are kept in the order they arrive, each as its column index and
+ * then its two varints, and only sorted into columns when the block is
+ * encoded.
+ */
+typedef struct {
+    uint64_t baseMs;
+    uint8_t columnCount;
+    ColumnarColumn columns[COLUMNAR_SIGNAL_COUNT];
+    uint8_t samples[COLUMNAR_BLOCK_SIZE];
+    uint16_t samplesLength;
+} ColumnarBatch;
+
+/* Public: Empty a block. */
+void reset(ColumnarBatch* batch);
+
+/* Public: Returns true if a block has no samples. */
+bool empty(const ColumnarBatch* batch);
+
+/* Public: Add a sample of a signal to a block.
+ *
+ * batch - The block.
+ * signalId - The signal's ID.
+ * resolution - The step its values are rounded to. The first sample of a
+ *      signal in a block sets it, and 0 means COLUMNAR_DEFAULT_RESOLUTION.
+ * timeMs - The time of the sample. A sample earlier than the one before it
+ *      is sent as if it came at the same time.
+ * value - The value of the sample.
+ *
+ * Returns false if the sample wasn't added - the block is full or has no room
+ * for another signal (send it and add the sample to the next one), or the
+ * value can't be sent as a multiple of the resolution (send it some other
+ * way).
+ */
+bool add(ColumnarBatch* batch, uint16_t signalId, float resolution,
+        uint64_t timeMs, float value);
+
+/* Public: Encode a block.
+ *
+ * batch - The block.
+ * block - The buffer to store the encoded block, which needs
+ *      COLUMNAR_BLOCK_SIZE bytes.
+ * length - The length of the block buffer.
+ *
+ * Returns the number of bytes written, or 0 if the block is empty or the
+ * buffer too small.
+ */
+int encode(const ColumnarBatch* batch, uint8_t block[], size_t length);
+
+/* Public: Encode a block and wrap it in a record in a payload format, ready to
+ * queue for an endpoint that uses the format.
+ *
+ * batch - The block.
+ * payload - The buffer to store the record, which needs COLUMNAR_RECORD_SIZE
+ *      bytes.
+ * length - The length of the payload buffer.
+ * format - The payload format of the record.
+ *
+ * Returns the number of bytes written, or 0 if the block is empty or the
+ * buffer too small.
+ */
+int serialize(const ColumnarBatch* batch, uint8_t payload[], size_t length,
+        PayloadFormat format);
+
+} // namespace columnar
+} // namespace payload
+} // namespace openxc
+
+#endif // __COLUMNAR_H__
@@ -1,9 +1,16 @@
 #include "payload.h"
 
+#ifdef CJSON_SERIALIZER
 #include <cJSON.h>
+#endif
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <sys/param.h>
 #include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
 
 #include "json.h"
 #include "util/strutil.h"
@@ -14,6 +21,13 @@ namespace payload = openxc::payload;
 
 using openxc::util::log::debug;
 
+// The longest "0x..." CAN data string, including the NULL character
+#if CAN_FD_SUPPORT
+#define CAN_DATA_STRING_SIZE (2 + CAN_FD_MESSAGE_SIZE * 2 + 1)
+#else
+#define CAN_DATA_STRING_SIZE 67
+#endif
+
 const char openxc::payload::json::VERSION_COMMAND_NAME[] = "version";
 const char openxc::payload::json::DEVICE_ID_COMMAND_NAME[] = "device_id";
 const char openxc::payload::json::DEVICE_PLATFORM_COMMAND_NAME[] = "platform";
@@ -29,6 +43,7 @@ const char openxc::payload::json::SD_MOUNT_STATUS_COMMAND_NAME[] = "sd_mount_sta
 const char openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME[] = "json";
 const char openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME[] = "protobuf";
 const char openxc::payload::json::PAYLOAD_FORMAT_MESSAGEPACK_NAME[] = "messagepack";
+const char openxc::payload::json::PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME[] = "messagepack_compact";
 
 const char openxc::payload::json::COMMAND_RESPONSE_FIELD_NAME[] = "command_response";
 const char openxc::payload::json::COMMAND_RESPONSE_MESSAGE_FIELD_NAME[] = "message";
@@ -52,6 +67,51 @@ const char openxc::payload::json::DIAGNOSTIC_NRC_FIELD_NAME[] = "negative_respon
 const char openxc::payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME[] = "payload";
 const char openxc::payload::json::DIAGNOSTIC_VALUE_FIELD_NAME[] = "value";
 
+#ifdef CJSON_SERIALIZER
+
+// The bytes available to the cJSON tree and printed string of one message.
+#ifndef CJSON_ARENA_SIZE
+#define CJSON_ARENA_SIZE 2048
+#endif
+
+/* Private: cJSON's allocations for the message being serialized, handed out in
+ * order from a static block instead of the heap, and all released at once
+ * when the message is done. That makes each allocation constant time, leaves
+ * nothing to fragment and keeps serialization from ever growing the heap.
+ */
+static struct {
+    union {
+        uint8_t bytes[CJSON_ARENA_SIZE];
+        double align;
+    } block;
+    size_t used;
+    bool hooked;
+} arena;
+
+static void* arenaAllocate(size_t size) {
+    size = (size + sizeof(arena.block.align) - 1) &
+            ~(sizeof(arena.block.align) - 1);
+    if(size > CJSON_ARENA_SIZE - arena.used) {
+        return NULL;
+    }
+    void* allocation = &arena.block.bytes[arena.used];
+    arena.used += size;
+    return allocation;
+}
+
+static void arenaFree(void* allocation) {
+    // everything is released together by resetting the arena
+}
+
+static void resetArena() {
+    if(!arena.hooked) {
+        cJSON_Hooks hooks = {arenaAllocate, arenaFree};
+        cJSON_InitHooks(&hooks);
+        arena.hooked = true;
+    }
+    arena.used = 0;
+}
+
 static bool serializeDiagnostic(openxc_VehicleMessage* message, cJSON* root) {
     cJSON_AddNumberToObject(root, payload::json::BUS_FIELD_NAME,
             message->diagnostic_response.bus);
@@ -144,7 +204,7 @@ static bool serializeCan(openxc_VehicleMessage* message, cJSON* root) {
     cJSON_AddNumberToObject(root, payload::json::ID_FIELD_NAME,
             message->can_message.id);
 
-    char encodedData[67];
+    char encodedData[CAN_DATA_STRING_SIZE];
     const char* maxAddress = encodedData + sizeof(encodedData);
     char* encodedDataIndex = encodedData;
     encodedDataIndex += sprintf(encodedDataIndex, "0x");
@@ -200,6 +260,8 @@ static bool serializeSimple(openxc_VehicleMessage* message, cJSON* root) {
     return true;
 }
 
+#endif // CJSON_SERIALIZER
+
 /* Private: Parse a hex string as a byte array.
  *
  * source - The hex string to parse - each byte in the string *must* be
@@ -229,90 +291,436 @@ static size_t dehexlify(const char source[], uint8_t* destination,
     return byteIndex;
 }
 
-static void deserializePassthrough(cJSON* root, openxc_ControlCommand* command) {
+/* Private: A token found by tokenize() in a JSON string, in the style of jsmn.
+ * Tokens are stored in document order, so a token's children directly follow
+ * it - an object's children are its keys, each immediately followed by its
+ * value.
+ *
+ * type - the kind of JSON value.
+ * start - the offset of the first character of the value. For strings this is
+ *      the first character after the opening quote.
+ * end - the offset just past the last character of the value. For strings this
+ *      is the closing quote.
+ * size - the number of direct children - keys and values for an object.
+ * parent - the index of the enclosing object or array, or -1.
+ */
+typedef enum {
+    JSON_TOKEN_OBJECT,
+    JSON_TOKEN_ARRAY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_PRIMITIVE,
+} JsonTokenType;
+
+typedef struct {
+    JsonTokenType type;
+    int16_t start;
+    int16_t end;
+    int16_t size;
+    int16_t parent;
+} JsonToken;
+
+/* Private: A tokenized JSON message. The tokens point into json, which must
+ * stay around (and NULL terminated) as long as the document is used.
+ */
+typedef struct {
+    const char* json;
+    JsonToken tokens[JSON_MAX_TOKENS];
+    int count;
+} JsonDocument;
+
+static int addToken(JsonDocument* document, JsonTokenType type, int start,
+        int end, int parent) {
+    if(document->count >= JSON_MAX_TOKENS) {
+        return -1;
+    }
+
+    if(parent >= 0) {
+        JsonToken* parentToken = &document->tokens[parent];
+        // keys must be strings
+        if(parentToken->type == JSON_TOKEN_OBJECT && parentToken->size % 2 == 0
+                && type != JSON_TOKEN_STRING) {
+            return -1;
+        }
+        ++parentToken->size;
+    }
+
+    JsonToken* token = &document->tokens[document->count];
+    token->type = type;
+    token->start = start;
+    token->end = end;
+    token->size = 0;
+    token->parent = parent;
+    return document->count++;
+}
+
+/* Private: Split the first JSON object in json into tokens, without
+ * allocating anything.
+ *
+ * Returns true if a complete object was found and it fit in JSON_MAX_TOKENS
+ * tokens.
+ */
+static bool tokenize(const char* json, size_t length, JsonDocument* document) {
+    document->json = json;
+    document->count = 0;
+    if(length > INT16_MAX || json[0] != '{') {
+        return false;
+    }
+
+    int parent = -1;
+    for(int position = 0; position < (int)length && json[position] != '\0';
+            position++) {
+        char c = json[position];
+        switch(c) {
+        case '{':
+        case '[':
+            parent = addToken(document, c == '{' ? JSON_TOKEN_OBJECT :
+                    JSON_TOKEN_ARRAY, position, -1, parent);
+            if(parent < 0) {
+                return false;
+            }
+            break;
+        case '}':
+        case ']': {
+            if(parent < 0) {
+                return false;
+            }
+            JsonToken* token = &document->tokens[parent];
+            if(token->type != (c == '}' ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY)
+                    || (token->type == JSON_TOKEN_OBJECT &&
+                        token->size % 2 != 0)) {
+                return false;
+            }
+            token->end = position + 1;
+            parent = token->parent;
+            if(parent < 0) {
+                // ignore anything after the object, like cJSON_Parse
+                return true;
+            }
+            break;
+        }
+        case '"': {
+            int start = position + 1;
+            for(++position; position < (int)length && json[position] != '"';
+                    position++) {
+                if(json[position] == '\0') {
+                    return false;
+                } else if(json[position] == '\\') {
+                    ++position;
+                }
+            }
+            if(position >= (int)length || parent < 0 ||
+                    addToken(document, JSON_TOKEN_STRING, start, position,
+                        parent) < 0) {
+                return false;
+            }
+            break;
+        }
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+        case ':':
+        case ',':
+            break;
+        default: {
+            if(strchr("-0123456789tfn", c) == NULL || parent < 0) {
+                return false;
+            }
+            int start = position;
+            while(position + 1 < (int)length && json[position + 1] != '\0' &&
+                    strchr(" \t\r\n,:]}", json[position + 1]) == NULL) {
+                ++position;
+            }
+            if(addToken(document, JSON_TOKEN_PRIMITIVE, start, position + 1,
+                        parent) < 0) {
+                return false;
+            }
+            break;
+        }
+        }
+    }
+    // the object never closed
+    return false;
+}
+
+/* Private: Returns the index of the token after token and all of its
+ * children.
+ */
+static int nextSibling(const JsonDocument* document, int token) {
+    int next = token + 1;
+    while(next < document->count &&
+            document->tokens[next].start < document->tokens[token].end) {
+        ++next;
+    }
+    return next;
+}
+
+/* Private: Compare a string token with a C string, ignoring case like
+ * cJSON_GetObjectItem.
+ */
+static bool keyEquals(const JsonDocument* document, int token,
+        const char* key) {
+    const JsonToken* keyToken = &document->tokens[token];
+    int keyLength = keyToken->end - keyToken->start;
+    const char* candidate = document->json + keyToken->start;
+    for(int i = 0; i < keyLength; i++) {
+        if(key[i] == '\0' || tolower((unsigned char)candidate[i]) !=
+                tolower((unsigned char)key[i])) {
+            return false;
+        }
+    }
+    return key[keyLength] == '\0';
+}
+
+/* Private: Find the value of the first member of an object with the key.
+ *
+ * Returns the index of the value's token, or -1 if object isn't an object or
+ * has no such member.
+ */
+static int findMember(const JsonDocument* document, int object,
+        const char* key) {
+    if(object < 0 || document->tokens[object].type != JSON_TOKEN_OBJECT) {
+        return -1;
+    }
+
+    int token = object + 1;
+    for(int i = 0; i < document->tokens[object].size; i += 2) {
+        if(keyEquals(document, token, key)) {
+            return token + 1;
+        }
+        token = nextSibling(document, token + 1);
+    }
+    return -1;
+}
+
+static bool isNumber(const JsonDocument* document, int token) {
+    return token >= 0 && document->tokens[token].type == JSON_TOKEN_PRIMITIVE
+            && strchr("-0123456789",
+                    document->json[document->tokens[token].start]) != NULL;
+}
+
+static bool isBoolean(const JsonDocument* document, int token) {
+    return token >= 0 && document->tokens[token].type == JSON_TOKEN_PRIMITIVE
+            && (document->json[document->tokens[token].start] == 't' ||
+                document->json[document->tokens[token].start] == 'f');
+}
+
+static bool isString(const JsonDocument* document, int token) {
+    return token >= 0 && document->tokens[token].type == JSON_TOKEN_STRING;
+}
+
+static double numberValue(const JsonDocument* document, int token) {
+    if(!isNumber(document, token)) {
+        return 0;
+    }
+    return strtod(document->json + document->tokens[token].start, NULL);
+}
+
+/* Private: Returns the value of a token as an integer the way cJSON's valueint
+ * would have it - truncated numbers, 1 for true and 0 for anything else.
+ */
+static int intValue(const JsonDocument* document, int token) {
+    if(isBoolean(document, token)) {
+        return document->json[document->tokens[token].start] == 't';
+    }
+    return (int)numberValue(document, token);
+}
+
+static void appendUtf8(unsigned long codepoint, char* destination,
+        size_t size, size_t* length) {
+    char encoded[3];
+    size_t encodedLength;
+    if(codepoint < 0x80) {
+        encoded[0] = codepoint;
+        encodedLength = 1;
+    } else if(codepoint < 0x800) {
+        encoded[0] = 0xc0 | (codepoint >> 6);
+        encoded[1] = 0x80 | (codepoint & 0x3f);
+        encodedLength = 2;
+    } else {
+        encoded[0] = 0xe0 | (codepoint >> 12);
+        encoded[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        encoded[2] = 0x80 | (codepoint & 0x3f);
+        encodedLength = 3;
+    }
+
+    for(size_t i = 0; i < encodedLength && *length + 1 < size; i++) {
+        destination[(*length)++] = encoded[i];
+    }
+}
+
+/* Private: Copy a string token into destination with its escapes decoded,
+ * truncated to fit and always NULL terminated.
+ *
+ * Returns false if the token isn't a string.
+ */
+static bool copyString(const JsonDocument* document, int token,
+        char* destination, size_t size) {
+    if(!isString(document, token) || size == 0) {
+        return false;
+    }
+
+    const char* source = document->json;
+    size_t length = 0;
+    for(int i = document->tokens[token].start;
+            i < document->tokens[token].end && length + 1 < size; i++) {
+        char c = source[i];
+        if(c != '\\') {
+            destination[length++] = c;
+            continue;
+        }
+
+        c = source[++i];
+        switch(c) {
+            case 'b': destination[length++] = '\b'; break;
+            case 'f': destination[length++] = '\f'; break;
+            case 'n': destination[length++] = '\n'; break;
+            case 'r': destination[length++] = '\r'; break;
+            case 't': destination[length++] = '\t'; break;
+            case 'u': {
+                char hex[5] = {0};
+                strncpy(hex, &source[i + 1], 4);
+                appendUtf8(strtoul(hex, NULL, 16), destination, size, &length);
+                i += strlen(hex);
+                break;
+            }
+            default: destination[length++] = c; break;
+        }
+    }
+    destination[length] = '\0';
+    return true;
+}
+
+/* Private: Check if a string token starts with prefix, the way command names
+ * have always been matched.
+ */
+static bool stringStartsWith(const JsonDocument* document, int token,
+        const char* prefix) {
+    if(!isString(document, token)) {
+        return false;
+    }
+    size_t prefixLength = strlen(prefix);
+    return (size_t)(document->tokens[token].end -
+                document->tokens[token].start) >= prefixLength &&
+            !strncmp(document->json + document->tokens[token].start, prefix,
+                prefixLength);
+}
+
+static bool stringEquals(const JsonDocument* document, int token,
+        const char* value) {
+    return stringStartsWith(document, token, value) &&
+            (size_t)(document->tokens[token].end -
+                document->tokens[token].start) == strlen(value);
+}
+
+static void deserializePassthrough(const JsonDocument* document, int root,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PASSTHROUGH;
     command->has_passthrough_mode_request = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
-    if(element != NULL) {
+    int element = findMember(document, root, "bus");
+    if(element >= 0) {
         command->passthrough_mode_request.has_bus = true;
-        command->passthrough_mode_request.bus = element->valueint;
+        command->passthrough_mode_request.bus = intValue(document, element);
     }
 
-    element = cJSON_GetObjectItem(root, "enabled");
-    if(element != NULL) {
+    element = findMember(document, root, "enabled");
+    if(element >= 0) {
         command->passthrough_mode_request.has_enabled = true;
-        command->passthrough_mode_request.enabled = bool(element->valueint);
+        command->passthrough_mode_request.enabled =
+                bool(intValue(document, element));
     }
 }
 
-static void deserializePayloadFormat(cJSON* root,
+static void deserializePayloadFormat(const JsonDocument* document, int root,
         openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
     command->has_payload_format_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "format");
-    if(element != NULL) {
-        if(!strcmp(element->valuestring,
-                    openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME)) {
-            command->payload_format_command.has_format = true;
-            command->payload_format_command.format =
-                    openxc_PayloadFormatCommand_PayloadFormat_JSON;
-        } else if(!strcmp(element->valuestring,
-                    openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME)) {
-            command->payload_format_command.has_format = true;
-            command->payload_format_command.format =
-                    openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF;
-        }
+    int element = findMember(document, root, "format");
+    if(stringEquals(document, element,
+                openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME)) {
+        command->payload_format_command.has_format = true;
+        command->payload_format_command.format =
+                openxc_PayloadFormatCommand_PayloadFormat_JSON;
+    } else if(stringEquals(document, element,
+                openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME)) {
+        command->payload_format_command.has_format = true;
+        command->payload_format_command.format =
+                openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF;
+    } else if(stringEquals(document, element,
+                openxc::payload::json::PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME)) {
+        command->payload_format_command.has_format = true;
+        command->payload_format_command.format =
+                PAYLOAD_FORMAT_COMMAND_MESSAGEPACK_COMPACT;
     }
 }
 
-static void deserializePredefinedObd2RequestsCommand(cJSON* root,
+static void deserializePredefinedObd2RequestsCommand(
+        const JsonDocument* document, int root,
         openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
     command->has_predefined_obd2_requests_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "enabled");
-    if(element != NULL) {
+    int element = findMember(document, root, "enabled");
+    if(element >= 0) {
         command->predefined_obd2_requests_command.has_enabled = true;
-        command->predefined_obd2_requests_command.enabled = bool(element->valueint);
+        command->predefined_obd2_requests_command.enabled =
+                bool(intValue(document, element));
     }
 }
 
-static void deserializeAfBypass(cJSON* root, openxc_ControlCommand* command) {
+static void deserializeAfBypass(const JsonDocument* document, int root,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS;
     command->has_acceptance_filter_bypass_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
-    if(element != NULL) {
+    int element = findMember(document, root, "bus");
+    if(element >= 0) {
         command->acceptance_filter_bypass_command.has_bus = true;
-        command->acceptance_filter_bypass_command.bus = element->valueint;
+        command->acceptance_filter_bypass_command.bus =
+                intValue(document, element);
     }
 
-    element = cJSON_GetObjectItem(root, "bypass");
-    if(element != NULL) {
+    element = findMember(document, root, "bypass");
+    if(element >= 0) {
         command->acceptance_filter_bypass_command.has_bypass = true;
         command->acceptance_filter_bypass_command.bypass =
-            bool(element->valueint);
+                bool(intValue(document, element));
     }
 }
 
-static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
+/* Private: Decode a hex string token into bytes with dehexlify.
+ *
+ * Returns the number of bytes stored in destination.
+ */
+static size_t dehexlifyToken(const JsonDocument* document, int token,
+        uint8_t* destination, size_t destinationLength) {
+    // room for a 0x prefix, 2 characters per byte and the NULL character
+    char hex[MAX_DIAGNOSTIC_PAYLOAD_SIZE];
+    if(!copyString(document, token, hex, sizeof(hex))) {
+        return 0;
+    }
+    return dehexlify(hex, destination, destinationLength);
+}
+
+static void deserializeDiagnostic(const JsonDocument* document, int root,
+        openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
     command->has_diagnostic_request = true;
 
-    cJSON* action = cJSON_GetObjectItem(root, "action");
-    if(action != NULL && action->type == cJSON_String) {
+    int action = findMember(document, root, "action");
+    if(isString(document, action)) {
         command->diagnostic_request.has_action = true;
-        if(!strcmp(action->valuestring, "add")) {
+        if(stringEquals(document, action, "add")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_ADD;
-        } else if(!strcmp(action->valuestring, "cancel")) {
+        } else if(stringEquals(document, action, "cancel")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_CANCEL;
         } else {
@@ -320,167 +728,160 @@ static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
         }
     }
 
-    cJSON* request = cJSON_GetObjectItem(root, "request");
-    if(request != NULL) {
-        cJSON* element = cJSON_GetObjectItem(request, "bus");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_bus = true;
-            command->diagnostic_request.request.bus = element->valueint;
+    int request = findMember(document, root, "request");
+    if(request >= 0) {
+        openxc_DiagnosticRequest* diagnosticRequest =
+                &command->diagnostic_request.request;
+        int element = findMember(document, request, "bus");
+        if(element >= 0) {
+            diagnosticRequest->has_bus = true;
+            diagnosticRequest->bus = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "mode");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_mode = true;
-            command->diagnostic_request.request.mode = element->valueint;
+        element = findMember(document, request, "mode");
+        if(element >= 0) {
+            diagnosticRequest->has_mode = true;
+            diagnosticRequest->mode = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "id");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_message_id = true;
-            command->diagnostic_request.request.message_id = element->valueint;
+        element = findMember(document, request, "id");
+        if(element >= 0) {
+            diagnosticRequest->has_message_id = true;
+            diagnosticRequest->message_id = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "pid");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_pid = true;
-            command->diagnostic_request.request.pid = element->valueint;
+        element = findMember(document, request, "pid");
+        if(element >= 0) {
+            diagnosticRequest->has_pid = true;
+            diagnosticRequest->pid = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "payload");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_payload = true;
-            command->diagnostic_request.request.payload.size = dehexlify(
-                    element->valuestring,
-                    command->diagnostic_request.request.payload.bytes,
-                    sizeof(((openxc_DiagnosticRequest*)0)->payload.bytes));
+        element = findMember(document, request, "payload");
+        if(element >= 0) {
+            diagnosticRequest->has_payload = true;
+            diagnosticRequest->payload.size = dehexlifyToken(document, element,
+                    diagnosticRequest->payload.bytes,
+                    sizeof(diagnosticRequest->payload.bytes));
         }
 
-        element = cJSON_GetObjectItem(request, "multiple_responses");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_multiple_responses = true;
-            command->diagnostic_request.request.multiple_responses =
-                bool(element->valueint);
+        element = findMember(document, request, "multiple_responses");
+        if(element >= 0) {
+            diagnosticRequest->has_multiple_responses = true;
+            diagnosticRequest->multiple_responses =
+                    bool(intValue(document, element));
         }
 
-        element = cJSON_GetObjectItem(request, "frequency");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_frequency = true;
-            command->diagnostic_request.request.frequency =
-                element->valuedouble;
+        element = findMember(document, request, "frequency");
+        if(element >= 0) {
+            diagnosticRequest->has_frequency = true;
+            diagnosticRequest->frequency = numberValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "decoded_type");
-        if(element != NULL) {
-            if(!strcmp(element->valuestring, "obd2")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
-                        openxc_DiagnosticRequest_DecodedType_OBD2;
-            } else if(!strcmp(element->valuestring, "none")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
-                        openxc_DiagnosticRequest_DecodedType_NONE;
-            }
+        element = findMember(document, request, "decoded_type");
+        if(stringEquals(document, element, "obd2")) {
+            diagnosticRequest->has_decoded_type = true;
+            diagnosticRequest->decoded_type =
+                    openxc_DiagnosticRequest_DecodedType_OBD2;
+        } else if(stringEquals(document, element, "none")) {
+            diagnosticRequest->has_decoded_type = true;
+            diagnosticRequest->decoded_type =
+                    openxc_DiagnosticRequest_DecodedType_NONE;
         }
 
-        element = cJSON_GetObjectItem(request, "name");
-        if(element != NULL && element->type == cJSON_String) {
-            command->diagnostic_request.request.has_name = true;
-            strcpy(command->diagnostic_request.request.name,
-                    element->valuestring);
+        element = findMember(document, request, "name");
+        if(copyString(document, element, diagnosticRequest->name,
+                    sizeof(diagnosticRequest->name))) {
+            diagnosticRequest->has_name = true;
         }
     }
 }
 
-static bool deserializeDynamicField(cJSON* element,
+static bool deserializeDynamicField(const JsonDocument* document, int element,
         openxc_DynamicField* field) {
-    bool status = true;
     field->has_type = true;
-    switch(element->type) {
-        case cJSON_String:
-            field->type = openxc_DynamicField_Type_STRING;
-            field->has_string_value = true;
-            strcpy(field->string_value, element->valuestring);
-            break;
-        case cJSON_False:
-        case cJSON_True:
-            field->type = openxc_DynamicField_Type_BOOL;
-            field->has_boolean_value = true;
-            field->boolean_value = bool(element->valueint);
-            break;
-        case cJSON_Number:
-            field->type = openxc_DynamicField_Type_NUM;
-            field->has_numeric_value = true;
-            field->numeric_value = element->valuedouble;
-            break;
-        default:
-            debug("Unsupported type in value field: %d", element->type);
-            field->has_type = false;
-            status = false;
-            break;
+    if(isString(document, element)) {
+        field->type = openxc_DynamicField_Type_STRING;
+        field->has_string_value = true;
+        copyString(document, element, field->string_value,
+                sizeof(field->string_value));
+    } else if(isBoolean(document, element)) {
+        field->type = openxc_DynamicField_Type_BOOL;
+        field->has_boolean_value = true;
+        field->boolean_value = bool(intValue(document, element));
+    } else if(isNumber(document, element)) {
+        field->type = openxc_DynamicField_Type_NUM;
+        field->has_numeric_value = true;
+        field->numeric_value = numberValue(document, element);
+    } else {
+        debug("Unsupported type in value field: %d",
+                document->tokens[element].type);
+        field->has_type = false;
+        return false;
     }
-    return status;
+    return true;
 }
 
-static void deserializeSimple(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeSimple(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_SIMPLE;
     message->has_simple_message = true;
     openxc_SimpleMessage* simpleMessage = &message->simple_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "name");
-    if(element != NULL && element->type == cJSON_String) {
+    int element = findMember(document, root, "name");
+    if(copyString(document, element, simpleMessage->name,
+                sizeof(simpleMessage->name))) {
         simpleMessage->has_name = true;
-        strcpy(simpleMessage->name, element->valuestring);
     }
 
-    element = cJSON_GetObjectItem(root, "value");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->value)) {
+    element = findMember(document, root, "value");
+    if(element >= 0) {
+        if(deserializeDynamicField(document, element, &simpleMessage->value)) {
             simpleMessage->has_value = true;
         }
     }
 
-    element = cJSON_GetObjectItem(root, "event");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->event)) {
+    element = findMember(document, root, "event");
+    if(element >= 0) {
+        if(deserializeDynamicField(document, element, &simpleMessage->event)) {
             simpleMessage->has_event = true;
         }
     }
 }
 
-static void deserializeCan(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeCan(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_CAN;
     message->has_can_message = true;
     openxc_CanMessage* canMessage = &message->can_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "id");
-    if(element != NULL) {
+    int element = findMember(document, root, "id");
+    if(element >= 0) {
         canMessage->has_id = true;
-        canMessage->id = element->valueint;
+        canMessage->id = intValue(document, element);
 
-        element = cJSON_GetObjectItem(root, "data");
-        if(element != NULL) {
+        element = findMember(document, root, "data");
+        if(element >= 0) {
             canMessage->has_data = true;
-            canMessage->data.size = dehexlify(
-                    element->valuestring,
-                    canMessage->data.bytes,
-                    sizeof(((openxc_CanMessage*)0)->data.bytes));
+            canMessage->data.size = dehexlifyToken(document, element,
+                    canMessage->data.bytes, sizeof(canMessage->data.bytes));
         }
 
-        element = cJSON_GetObjectItem(root, "bus");
-        if(element != NULL) {
+        element = findMember(document, root, "bus");
+        if(element >= 0) {
             canMessage->has_bus = true;
-            canMessage->bus = element->valueint;
+            canMessage->bus = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(root, payload::json::FRAME_FORMAT_FIELD_NAME);
-        if(element != NULL) {
+        element = findMember(document, root,
+                payload::json::FRAME_FORMAT_FIELD_NAME);
+        if(element >= 0) {
             canMessage->has_frame_format = true;
-            if(!strcmp(element->valuestring,
+            if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_STANDARD_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_STANDARD;
-            } else if(!strcmp(element->valuestring,
+            } else if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_EXTENDED_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
             } else {
@@ -492,42 +893,44 @@ static void deserializeCan(cJSON* root, openxc_VehicleMessage* message) {
     }
 }
 
-static void deserializeModemConfiguration(cJSON* root, openxc_ControlCommand* command) {
+static void deserializeModemConfiguration(const JsonDocument* document,
+        int root, openxc_ControlCommand* command) {
     // set up the struct for a modem configuration message
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_MODEM_CONFIGURATION;
     command->has_modem_configuration_command = true;
     openxc_ModemConfigurationCommand* modemConfigurationCommand = &command->modem_configuration_command;
-    
+
     // parse server command
-    cJSON* server = cJSON_GetObjectItem(root, "server");
-    if(server != NULL) {
+    int server = findMember(document, root, "server");
+    if(server >= 0) {
         modemConfigurationCommand->has_serverConnectSettings = true;
-        cJSON* host = cJSON_GetObjectItem(server, "host");
-        if(host != NULL) {
+        int host = findMember(document, server, "host");
+        if(copyString(document, host,
+                    modemConfigurationCommand->serverConnectSettings.host,
+                    sizeof(modemConfigurationCommand->serverConnectSettings.host))) {
             modemConfigurationCommand->serverConnectSettings.has_host = true;
-            strcpy(modemConfigurationCommand->serverConnectSettings.host, host->valuestring);
         }
-        cJSON* port = cJSON_GetObjectItem(server, "port");
-        if(port != NULL) {
+        int port = findMember(document, server, "port");
+        if(port >= 0) {
             modemConfigurationCommand->serverConnectSettings.has_port = true;
-            modemConfigurationCommand->serverConnectSettings.port = port->valueint;
+            modemConfigurationCommand->serverConnectSettings.port =
+                    intValue(document, port);
         }
     }
 }
 
-static void deserializeRTCConfiguration(cJSON* root, openxc_ControlCommand* command) {
-
+static void deserializeRTCConfiguration(const JsonDocument* document,
+        int root, openxc_ControlCommand* command) {
     command->has_type = true;
     command->type = openxc_ControlCommand_Type_RTC_CONFIGURATION;
     command->has_rtc_configuration_command = true;
     openxc_RTCConfigurationCommand* rtcConfigurationCommand = &command->rtc_configuration_command;
-    
-    cJSON* time = cJSON_GetObjectItem(root, "unix_time");
-    if(time != NULL) {
-        
+
+    int time = findMember(document, root, "unix_time");
+    if(time >= 0) {
         rtcConfigurationCommand->has_unix_time = true;
-        rtcConfigurationCommand->unix_time = time->valueint;
+        rtcConfigurationCommand->unix_time = intValue(document, time);
     }
 }
 
@@ -536,103 +939,529 @@ size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
     const char* delimiter = strnchr((const char*)payload, length - 1, '\0');
     size_t messageLength = 0;
     if(delimiter != NULL) {
+        memset(message, 0, sizeof(openxc_VehicleMessage));
         messageLength = (size_t)(delimiter - (const char*)payload) + 1;
-        uint8_t messageBuffer[messageLength];
-        if(messageLength > 0) {
-            memcpy(messageBuffer, payload, messageLength);
-        }
         // There may be junk data at the start of the payload - seek ahead to the
         // start of the message.
-        char* jsonStart = strchr((char*)messageBuffer, '{');
-        if(jsonStart == NULL) {
+        const char* jsonStart = strchr((const char*)payload, '{');
+        if(jsonStart == NULL || jsonStart > delimiter) {
             debug("%s", "No JSON object start found");
             // Return message length so this bogus front matter is erased
             return messageLength;
         }
 
-        cJSON *root = cJSON_Parse(jsonStart);
-        if(root == NULL) {
+        // The tokens point into the payload, which is NULL terminated at the
+        // delimiter, so it doesn't need to be copied
+        JsonDocument document;
+        if(!tokenize(jsonStart, delimiter - jsonStart, &document)) {
             debug("No JSON found in %u byte payload", length);
             // TODO should this return messageLength to eat up corrupt data, or
             // does it need to be 0 so we preserve partial messages?
             return 0;
         }
 
+        const int root = 0;
         message->has_type = true;
-        cJSON* commandNameObject = cJSON_GetObjectItem(root, "command");
-        if(commandNameObject != NULL) {
+        int commandName = findMember(&document, root, "command");
+        if(commandName >= 0) {
             message->has_type = true;
             message->type = openxc_VehicleMessage_Type_CONTROL_COMMAND;
             message->has_control_command = true;
             openxc_ControlCommand* command = &message->control_command;
 
-            if(!strncmp(commandNameObject->valuestring, VERSION_COMMAND_NAME,
-                        strlen(VERSION_COMMAND_NAME))) {
+            if(stringStartsWith(&document, commandName, VERSION_COMMAND_NAME)) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_VERSION;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DEVICE_ID_COMMAND_NAME, strlen(DEVICE_ID_COMMAND_NAME))) {
+            } else if(stringStartsWith(&document, commandName,
+                        DEVICE_ID_COMMAND_NAME)) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_DEVICE_ID;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DEVICE_PLATFORM_COMMAND_NAME, strlen(DEVICE_PLATFORM_COMMAND_NAME))) {
+            } else if(stringStartsWith(&document, commandName,
+                        DEVICE_PLATFORM_COMMAND_NAME)) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_PLATFORM;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DIAGNOSTIC_COMMAND_NAME, strlen(DIAGNOSTIC_COMMAND_NAME))) {
-                deserializeDiagnostic(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PASSTHROUGH_COMMAND_NAME, strlen(PASSTHROUGH_COMMAND_NAME))) {
-                deserializePassthrough(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PREDEFINED_OBD2_REQUESTS_COMMAND_NAME,
-                            strlen(PREDEFINED_OBD2_REQUESTS_COMMAND_NAME))) {
-                deserializePredefinedObd2RequestsCommand(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME,
-                        strlen(ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME))) {
-                deserializeAfBypass(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PAYLOAD_FORMAT_COMMAND_NAME,
-                        strlen(PAYLOAD_FORMAT_COMMAND_NAME))) {
-                deserializePayloadFormat(root, command);
-            } 
-            else if(!strncmp(commandNameObject->valuestring,
-                        MODEM_CONFIGURATION_COMMAND_NAME,
-                        strlen(MODEM_CONFIGURATION_COMMAND_NAME))) {
-                deserializeModemConfiguration(root, command);
-            }
-            else if(!strncmp(commandNameObject->valuestring,
-                        RTC_CONFIGURATION_COMMAND_NAME,
-                        strlen(RTC_CONFIGURATION_COMMAND_NAME))) {
-                deserializeRTCConfiguration(root, command);
-            }
-            else if(!strncmp(commandNameObject->valuestring,
-                        SD_MOUNT_STATUS_COMMAND_NAME,
-                        strlen(SD_MOUNT_STATUS_COMMAND_NAME))) {
+            } else if(stringStartsWith(&document, commandName,
+                        DIAGNOSTIC_COMMAND_NAME)) {
+                deserializeDiagnostic(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        PASSTHROUGH_COMMAND_NAME)) {
+                deserializePassthrough(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        PREDEFINED_OBD2_REQUESTS_COMMAND_NAME)) {
+                deserializePredefinedObd2RequestsCommand(&document, root,
+                        command);
+            } else if(stringStartsWith(&document, commandName,
+                        ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME)) {
+                deserializeAfBypass(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        PAYLOAD_FORMAT_COMMAND_NAME)) {
+                deserializePayloadFormat(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        MODEM_CONFIGURATION_COMMAND_NAME)) {
+                deserializeModemConfiguration(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        RTC_CONFIGURATION_COMMAND_NAME)) {
+                deserializeRTCConfiguration(&document, root, command);
+            } else if(stringStartsWith(&document, commandName,
+                        SD_MOUNT_STATUS_COMMAND_NAME)) {
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_SD_MOUNT_STATUS;
-            }
-            else {
-                debug("Unrecognized command: %s", commandNameObject->valuestring);
+            } else {
+                char name[32];
+                copyString(&document, commandName, name, sizeof(name));
+                debug("Unrecognized command: %s", name);
                 message->has_control_command = false;
             }
+        } else if(findMember(&document, root, "name") < 0) {
+            deserializeCan(&document, root, message);
         } else {
-            cJSON* nameObject = cJSON_GetObjectItem(root, "name");
-            if(nameObject == NULL) {
-                deserializeCan(root, message);
-            } else {
-                deserializeSimple(root, message);
-            }
+            deserializeSimple(&document, root, message);
         }
-        cJSON_Delete(root);
     }
 
     return messageLength;
 }
 
+/* Private: A position in a caller's payload buffer for writing JSON text
+ * without cJSON. Once anything doesn't fit, 'overflow' is set and nothing more
+ * is written.
+ */
+typedef struct {
+    char* buffer;
+    size_t length;
+    size_t position;
+    bool overflow;
+    int members;
+} JsonWriter;
+
+static void writeRaw(JsonWriter* writer, const char* text, size_t textLength) {
+    if(writer->overflow || writer->length - writer->position < textLength) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->position, text, textLength);
+    writer->position += textLength;
+}
+
+static void writeRaw(JsonWriter* writer, const char* text) {
+    writeRaw(writer, text, strlen(text));
+}
+
+// Escapes the same characters, the same way, as cJSON's string printer.
+static void writeString(JsonWriter* writer, const char* value) {
+    writeRaw(writer, "\"", 1);
+    for(const char* character = value; *character != '\0'; ++character) {
+        unsigned char c = *character;
+        if(c > 31 && c != '\"' && c != '\\') {
+            writeRaw(writer, character, 1);
+            continue;
+        }
+
+        char escaped[8];
+        switch(c) {
+            case '\\': strcpy(escaped, "\\\\"); break;
+            case '\"': strcpy(escaped, "\\\""); break;
+            case '\b': strcpy(escaped, "\\b"); break;
+            case '\f': strcpy(escaped, "\\f"); break;
+            case '\n': strcpy(escaped, "\\n"); break;
+            case '\r': strcpy(escaped, "\\r"); break;
+            case '\t': strcpy(escaped, "\\t"); break;
+            default: sprintf(escaped, "\\u%04x", c); break;
+        }
+        writeRaw(writer, escaped);
+    }
+    writeRaw(writer, "\"", 1);
+}
+
+// Powers of ten up to the most decimal places formatShortestFloat will try.
+static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+#define MAX_FLOAT_DECIMAL_PLACES 15
+
+/* Private: Write the decimal digits of an unsigned integer, at least minDigits
+ * of them (zero padded), to the end of a buffer.
+ *
+ * Returns a pointer to the first digit, somewhere before 'end'.
+ */
+static char* formatDigits(char* end, uint64_t value, int minDigits) {
+    char* start = end;
+    do {
+        *--start = '0' + value % 10;
+        value /= 10;
+        --minDigits;
+    } while(value > 0 || minDigits > 0);
+    return start;
+}
+
+static void writeInteger(JsonWriter* writer, int64_t value) {
+    char formatted[21];
+    char* end = formatted + sizeof(formatted);
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+    char* start = formatDigits(end, magnitude, 1);
+    if(value < 0) {
+        *--start = '-';
+    }
+    writeRaw(writer, start, end - start);
+}
+
+/* Private: Write the shortest decimal string that reads back as the same
+ * float, without going through printf.
+ *
+ * Digits are tried one decimal place at a time, and each candidate is checked
+ * by converting it back to a float. The value must be non-integral and within
+ * the range that's printed without an exponent.
+ *
+ * Returns false if no candidate round-tripped, and nothing was written.
+ */
+static bool writeShortestFloat(JsonWriter* writer, float value) {
+    double magnitude = fabs((double)value);
+    for(int places = 1; places <= MAX_FLOAT_DECIMAL_PLACES; places++) {
+        double scale = POWERS_OF_TEN[places];
+        uint64_t scaled = (uint64_t)floor(magnitude * scale + 0.5);
+        if((float)(scaled / scale) != (float)magnitude) {
+            continue;
+        }
+
+        uint64_t fraction = scaled % (uint64_t)scale;
+        while(fraction % 10 == 0 && places > 1) {
+            fraction /= 10;
+            --places;
+        }
+
+        char formatted[40];
+        char* end = formatted + sizeof(formatted);
+        char* start = formatDigits(end, fraction, places);
+        *--start = '.';
+        start = formatDigits(start, scaled / (uint64_t)scale, 1);
+        if(value < 0) {
+            *--start = '-';
+        }
+        writeRaw(writer, start, end - start);
+        return true;
+    }
+    return false;
+}
+
+/* Private: Format a number the way cJSON's number printer would, except that
+ * values that are exactly a float (i.e. nearly every signal value) are written
+ * with the fewest digits that read back as the same float rather than with
+ * printf's fixed 6 decimal places.
+ */
+static void writeNumber(JsonWriter* writer, double value) {
+    if(value <= INT_MAX && value >= INT_MIN &&
+            fabs((double)(int)value - value) <= DBL_EPSILON) {
+        writeInteger(writer, (int)value);
+        return;
+    }
+
+    if(fabs(value) >= 1.0e-6 && fabs(value) <= 1.0e9 &&
+            (double)(float)value == value &&
+            writeShortestFloat(writer, (float)value)) {
+        return;
+    }
+
+    char formatted[64];
+    if(fabs(floor(value) - value) <= DBL_EPSILON &&
+            fabs(value) < 1.0e60) {
+        sprintf(formatted, "%.0f", value);
+    } else if(fabs(value) < 1.0e-6 || fabs(value) > 1.0e9) {
+        sprintf(formatted, "%e", value);
+    } else {
+        sprintf(formatted, "%f", value);
+    }
+    writeRaw(writer, formatted);
+}
+
+/* Private: Start the next member of the object being written, with a comma
+ * before every member but the first.
+ */
+static void writeKey(JsonWriter* writer, const char* fieldName) {
+    if(writer->members++ > 0) {
+        writeRaw(writer, ",", 1);
+    }
+    writeString(writer, fieldName);
+    writeRaw(writer, ":", 1);
+}
+
+static void writeNumberMember(JsonWriter* writer, const char* fieldName,
+        double value) {
+    writeKey(writer, fieldName);
+    writeNumber(writer, value);
+}
+
+static void writeBoolMember(JsonWriter* writer, const char* fieldName,
+        bool value) {
+    writeKey(writer, fieldName);
+    writeRaw(writer, value ? "true" : "false");
+}
+
+static void writeStringMember(JsonWriter* writer, const char* fieldName,
+        const char* value) {
+    writeKey(writer, fieldName);
+    writeString(writer, value);
+}
+
+/* Private: Write bytes as a "0x" prefixed hex string member. The string is cut
+ * off where it would have been by formatting it into a bufferSize byte C
+ * string, so large diagnostic payloads come out as they did from cJSON.
+ */
+static void writeHexMember(JsonWriter* writer, const char* fieldName,
+        const uint8_t* bytes, size_t size, size_t bufferSize) {
+    writeKey(writer, fieldName);
+    writeRaw(writer, "\"0x", 3);
+    size_t used = 2;
+    for(size_t i = 0; i < size && used < bufferSize; i++) {
+        char hex[3];
+        sprintf(hex, "%02x", bytes[i]);
+        writeRaw(writer, hex, MIN(2, bufferSize - used - 1));
+        used += 2;
+    }
+    writeRaw(writer, "\"", 1);
+}
+
+static bool hasDynamicValue(const openxc_DynamicField* field) {
+    return field != NULL && (field->has_numeric_value ||
+            field->has_boolean_value || field->has_string_value);
+}
+
+/* Private: Write the value of a DynamicField, which must have one.
+ */
+static void writeDynamicValue(JsonWriter* writer,
+        const openxc_DynamicField* field) {
+    if(field->has_numeric_value) {
+        writeNumber(writer, field->numeric_value);
+    } else if(field->has_boolean_value) {
+        writeRaw(writer, field->boolean_value ? "true" : "false");
+    } else {
+        writeString(writer, field->string_value);
+    }
+}
+
+/* Private: Write a DynamicField as a JSON member, skipping it entirely if it
+ * has no value.
+ */
+static void writeDynamicField(JsonWriter* writer, const char* fieldName,
+        const openxc_DynamicField* field) {
+    if(hasDynamicValue(field)) {
+        writeKey(writer, fieldName);
+        writeDynamicValue(writer, field);
+    }
+}
+
+size_t openxc::payload::json::plainStringLength(const char* value) {
+    size_t length = 0;
+    for(const char* character = value; *character != '\0'; ++character) {
+        unsigned char c = *character;
+        if(c <= 31 || c == '\"' || c == '\\') {
+            return 0;
+        }
+        ++length;
+    }
+    return length;
+}
+
+// The name member of a simple message up to the name itself, and from the end
+// of the name to the value. These must match NAME_FIELD_NAME and
+// VALUE_FIELD_NAME.
+static const char NAME_PREFIX[] = "\"name\":\"";
+static const char VALUE_PREFIX[] = "\",\"value\":";
+
+int openxc::payload::json::serializeSimple(const char* name,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        const uint64_t* timestamp, uint8_t payload[], size_t length) {
+    return serializeSimple(name, 0, value, event, timestamp, payload, length);
+}
+
+int openxc::payload::json::serializeSimple(const char* name,
+        size_t nameLength, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, const uint64_t* timestamp,
+        uint8_t payload[], size_t length) {
+    JsonWriter writer = {
+        buffer: (char*)payload,
+        length: length,
+        position: 0,
+        overflow: false,
+        members: 0
+    };
+
+    writeRaw(&writer, "{", 1);
+    if(timestamp != NULL) {
+        writeNumberMember(&writer, "timestamp", (double)*timestamp);
+    }
+    if(nameLength > 0 && hasDynamicValue(value)) {
+        if(writer.members++ > 0) {
+            writeRaw(&writer, ",", 1);
+        }
+        writeRaw(&writer, NAME_PREFIX, sizeof(NAME_PREFIX) - 1);
+        writeRaw(&writer, name, nameLength);
+        writeRaw(&writer, VALUE_PREFIX, sizeof(VALUE_PREFIX) - 1);
+        writeDynamicValue(&writer, value);
+        ++writer.members;
+    } else {
+        writeStringMember(&writer, payload::json::NAME_FIELD_NAME, name);
+        writeDynamicField(&writer, payload::json::VALUE_FIELD_NAME, value);
+    }
+    writeDynamicField(&writer, payload::json::EVENT_FIELD_NAME, event);
+    // include the NULL character as a delimiter, like serialize
+    writeRaw(&writer, "}", 2);
+
+    return writer.overflow ? 0 : writer.position;
+}
+
+#ifndef CJSON_SERIALIZER
+
+static void writeDiagnostic(JsonWriter* writer,
+        const openxc_DiagnosticResponse* response) {
+    writeNumberMember(writer, payload::json::BUS_FIELD_NAME, response->bus);
+    writeNumberMember(writer, payload::json::ID_FIELD_NAME,
+            response->message_id);
+    writeNumberMember(writer, payload::json::DIAGNOSTIC_MODE_FIELD_NAME,
+            response->mode);
+    writeBoolMember(writer, payload::json::DIAGNOSTIC_SUCCESS_FIELD_NAME,
+            response->success);
+
+    if(response->has_pid) {
+        writeNumberMember(writer, payload::json::DIAGNOSTIC_PID_FIELD_NAME,
+                response->pid);
+    }
+
+    if(response->has_negative_response_code) {
+        writeNumberMember(writer, payload::json::DIAGNOSTIC_NRC_FIELD_NAME,
+                response->negative_response_code);
+    }
+
+    if(response->has_value) {
+        writeNumberMember(writer, payload::json::DIAGNOSTIC_VALUE_FIELD_NAME,
+                response->value);
+    } else if(response->has_payload) {
+        writeHexMember(writer, payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME,
+                response->payload.bytes, response->payload.size,
+                MAX_DIAGNOSTIC_PAYLOAD_SIZE);
+    }
+}
+
+static const char* commandName(openxc_ControlCommand_Type type) {
+    switch(type) {
+        case openxc_ControlCommand_Type_VERSION:
+            return payload::json::VERSION_COMMAND_NAME;
+        case openxc_ControlCommand_Type_DEVICE_ID:
+            return payload::json::DEVICE_ID_COMMAND_NAME;
+        case openxc_ControlCommand_Type_PLATFORM:
+            return payload::json::DEVICE_PLATFORM_COMMAND_NAME;
+        case openxc_ControlCommand_Type_DIAGNOSTIC:
+            return payload::json::DIAGNOSTIC_COMMAND_NAME;
+        case openxc_ControlCommand_Type_PASSTHROUGH:
+            return payload::json::PASSTHROUGH_COMMAND_NAME;
+        case openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS:
+            return payload::json::ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME;
+        case openxc_ControlCommand_Type_PAYLOAD_FORMAT:
+            return payload::json::PAYLOAD_FORMAT_COMMAND_NAME;
+        case openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS:
+            return payload::json::PREDEFINED_OBD2_REQUESTS_COMMAND_NAME;
+        case openxc_ControlCommand_Type_MODEM_CONFIGURATION:
+            return payload::json::MODEM_CONFIGURATION_COMMAND_NAME;
+        case openxc_ControlCommand_Type_RTC_CONFIGURATION:
+            return payload::json::RTC_CONFIGURATION_COMMAND_NAME;
+        case openxc_ControlCommand_Type_SD_MOUNT_STATUS:
+            return payload::json::SD_MOUNT_STATUS_COMMAND_NAME;
+        default:
+            return NULL;
+    }
+}
+
+static bool writeCommandResponse(JsonWriter* writer,
+        const openxc_CommandResponse* response) {
+    const char* typeString = commandName(response->type);
+    if(typeString == NULL) {
+        return false;
+    }
+
+    writeStringMember(writer, payload::json::COMMAND_RESPONSE_FIELD_NAME,
+            typeString);
+    if(response->has_message) {
+        writeStringMember(writer,
+                payload::json::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
+                response->message);
+    }
+
+    if(response->has_status) {
+        writeBoolMember(writer,
+                payload::json::COMMAND_RESPONSE_STATUS_FIELD_NAME,
+                response->status);
+    }
+    return true;
+}
+
+static void writeCan(JsonWriter* writer, const openxc_CanMessage* message) {
+    writeNumberMember(writer, payload::json::BUS_FIELD_NAME, message->bus);
+    writeNumberMember(writer, payload::json::ID_FIELD_NAME, message->id);
+    writeHexMember(writer, payload::json::DATA_FIELD_NAME,
+            message->data.bytes, message->data.size, CAN_DATA_STRING_SIZE);
+
+    if(message->has_frame_format) {
+        writeStringMember(writer, payload::json::FRAME_FORMAT_FIELD_NAME,
+                message->frame_format == openxc_CanMessage_FrameFormat_STANDARD ?
+                    payload::json::FRAME_FORMAT_STANDARD_NAME :
+                        payload::json::FRAME_FORMAT_EXTENDED_NAME);
+    }
+}
+
+static void writeSimple(JsonWriter* writer,
+        const openxc_SimpleMessage* message) {
+    writeStringMember(writer, payload::json::NAME_FIELD_NAME, message->name);
+    if(message->has_value) {
+        writeDynamicField(writer, payload::json::VALUE_FIELD_NAME,
+                &message->value);
+    }
+    if(message->has_event) {
+        writeDynamicField(writer, payload::json::EVENT_FIELD_NAME,
+                &message->event);
+    }
+}
+
 int openxc::payload::json::serialize(openxc_VehicleMessage* message,
         uint8_t payload[], size_t length) {
+    JsonWriter writer = {
+        buffer: (char*)payload,
+        length: length,
+        position: 0,
+        overflow: false,
+        members: 0
+    };
+
+    writeRaw(&writer, "{", 1);
+    if(message->has_timestamp) {
+        writeNumberMember(&writer, "timestamp", (double)message->timestamp);
+    }
+
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        writeSimple(&writer, &message->simple_message);
+    } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+        writeCan(&writer, &message->can_message);
+    } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
+        writeDiagnostic(&writer, &message->diagnostic_response);
+    } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
+        if(!writeCommandResponse(&writer, &message->command_response)) {
+            return 0;
+        }
+    } else if(message->has_type) {
+        debug("Unrecognized message type -- not sending");
+    }
+
+    // include the NULL character as a delimiter
+    writeRaw(&writer, "}", 2);
+    if(writer.overflow) {
+        debug("Serialized JSON doesn't fit in %d bytes", length);
+        return 0;
+    }
+    return writer.position;
+}
+
+#else
+
+int openxc::payload::json::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    resetArena();
     cJSON* root = cJSON_CreateObject();
     size_t finalLength = 0;
     if(root != NULL) {
@@ -648,7 +1477,7 @@ int openxc::payload::json::serialize(openxc_VehicleMessage* message,
             status = serializeDiagnostic(message, root);
         } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
             status = serializeCommandResponse(message, root);
-        } else {
+        } else if(message->has_type) {
             debug("Unrecognized message type -- not sending");
         }
 
@@ -658,15 +1487,15 @@ int openxc::payload::json::serialize(openxc_VehicleMessage* message,
             // character as a delimiter
             finalLength = MIN(length, strlen(serialized) + 1);
             memcpy(payload, serialized, finalLength);
-
-            free(serialized);
         } else {
-            debug("Converting JSON to string failed -- possibly OOM");
+            debug("Converting JSON to string failed -- possibly out of arena");
         }
-
-        cJSON_Delete(root);
     } else {
-        debug("JSON object is NULL -- probably OOM");
+        debug("JSON object is NULL -- probably out of arena");
     }
+    // The tree and the string are released together
+    arena.used = 0;
     return finalLength;
 }
+
+#endif // CJSON_SERIALIZER
@@ -5,6 +5,12 @@
 
 #define MAX_DIAGNOSTIC_PAYLOAD_SIZE 260
 
+// The most JSON values (including object keys) a command may contain -
+// anything longer is rejected.
+#ifndef JSON_MAX_TOKENS
+#define JSON_MAX_TOKENS 48
+#endif
+
 namespace openxc {
 namespace payload {
 namespace json {
@@ -21,6 +27,7 @@ extern const char PREDEFINED_OBD2_REQUESTS_COMMAND_NAME[];
 extern const char PAYLOAD_FORMAT_JSON_NAME[];
 extern const char PAYLOAD_FORMAT_PROTOBUF_NAME[];
 extern const char PAYLOAD_FORMAT_MESSAGEPACK_NAME[];
+extern const char PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME[];
 
 extern const char COMMAND_RESPONSE_FIELD_NAME[];
 extern const char COMMAND_RESPONSE_MESSAGE_FIELD_NAME[];
@@ -49,6 +56,10 @@ extern const char RTC_CONFIGURATION_COMMAND_NAME[];
 extern const char SD_MOUNT_STATUS_COMMAND_NAME[];
 
 /* Public: Deserialize an OpenXC message from a payload containing JSON.
+ *
+ * The JSON is tokenized in place without allocating anything. Object keys are
+ * matched without regard to case, and a message with more than JSON_MAX_TOKENS
+ * values is treated like invalid JSON.
  *
  * payload - The bytestream payload to parse a message from.
  * length -  The length of the payload.
@@ -60,16 +71,58 @@ extern const char SD_MOUNT_STATUS_COMMAND_NAME[];
 size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* message);
 
 /* Public: Serialize an OpenXC message as JSON and store in the payload.
+ *
+ * The JSON is written straight into the payload without allocating anything,
+ * unless the build defines CJSON_SERIALIZER to go through a cJSON tree as
+ * older versions did. Both produce the same output. The cJSON tree is
+ * allocated from a static arena of CJSON_ARENA_SIZE bytes that's reset for
+ * every message, not from the heap.
  *
  * message - The message to serialize.
  * payload - The buffer to store the payload - must be allocated by the caller.
  * length -  The length of the payload buffer.
  *
- * Returns the number of bytes written to the payload. If the length is 0, an
- * error occurred while serializing.
+ * Returns the number of bytes written to the payload, including the NULL
+ * delimiter. If the length is 0, an error occurred while serializing, e.g. the
+ * message didn't fit.
  */
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
 
+/* Public: Serialize a simple vehicle message as JSON directly from its parts,
+ * without building an openxc_VehicleMessage or a cJSON tree. The output is
+ * identical to serialize(openxc_VehicleMessage*, uint8_t[], size_t) for the
+ * same message.
+ *
+ * name - The name of the message.
+ * value - The value of the message, or NULL if it has none.
+ * event - The event of the message, or NULL if it has none.
+ * timestamp - A pointer to the message's timestamp, or NULL if it has none.
+ * payload - The buffer to store the payload - must be allocated by the caller.
+ * length -  The length of the payload buffer.
+ *
+ * Returns the number of bytes written to the payload, including the NULL
+ * delimiter. If the message doesn't fit, returns 0.
+ */
+int serializeSimple(const char* name, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, const uint64_t* timestamp,
+        uint8_t payload[], size_t length);
+
+/* Public: The same as serializeSimple(const char*, ...), for a name already
+ * known not to need escaping. The name and the keys around it are copied into
+ * the payload as they are, instead of character by character.
+ *
+ * nameLength - The length of the name from plainStringLength, or 0 to check
+ *      and escape the name as usual.
+ */
+int serializeSimple(const char* name, size_t nameLength,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        const uint64_t* timestamp, uint8_t payload[], size_t length);
+
+/* Public: Return the length of a string if it can be written in JSON exactly
+ * as it is, without escaping any characters, or 0 if it can't (or is empty).
+ */
+size_t plainStringLength(const char* value);
+
 } // namespace json
 } // namespace payload
 } // namespace openxc
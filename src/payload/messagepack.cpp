@@ -21,11 +21,16 @@
 #define MESSAGE_PACK_FIXMAP_MARKER   0x80
 #define MESSAGE_PACK_MAX_STRLEN      0x1F
 
-#define MAX_STRLEN 25
-#define MAX_BINLEN 25
+// The longest map key the decoder matches - longer keys are skipped
+#define MESSAGE_PACK_MAX_KEY_LENGTH 31
+// How deeply maps and arrays may be nested in a message
+#ifndef MESSAGE_PACK_MAX_DEPTH
+#define MESSAGE_PACK_MAX_DEPTH 4
+#endif
     
 namespace payload = openxc::payload;
 using openxc::util::log::debug;
+using openxc::payload::messagepack::CompactKey;
 
 const char openxc::payload::messagepack::VERSION_COMMAND_NAME[] = "version";
 const char openxc::payload::messagepack::DEVICE_ID_COMMAND_NAME[] = "device_id";
@@ -39,6 +44,7 @@ const char openxc::payload::messagepack::MODEM_CONFIGURATION_COMMAND_NAME[] = "m
 const char openxc::payload::messagepack::RTC_CONFIGURATION_COMMAND_NAME[] = "rtc_configuration";
 
 const char openxc::payload::messagepack::PAYLOAD_FORMAT_MESSAGEPACK_NAME[] = "messagepack";
+const char openxc::payload::messagepack::PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME[] = "messagepack_compact";
 const char openxc::payload::messagepack::PAYLOAD_FORMAT_PROTOBUF_NAME[] = "protobuf";
 const char openxc::payload::messagepack::PAYLOAD_FORMAT_JSON_NAME[] = "json";
 
@@ -66,23 +72,29 @@ const char openxc::payload::messagepack::DIAGNOSTIC_VALUE_FIELD_NAME[] = "value"
 const char openxc::payload::messagepack::SD_MOUNT_STATUS_COMMAND_NAME[] = "sd_mount_status";
 
 
-enum msgpack_var_type{TYPE_STRING,TYPE_NUMBER,TYPE_TRUE,TYPE_FALSE,TYPE_BINARY,TYPE_MAP};
-
-int32_t dynamic_allocation_bytes = 0;
-
-typedef struct sMsgPackNode{
-    char * string; //points to string header and not the string inorder to derive string 
-    enum   msgpack_var_type type;
-    double valuedouble;
-    int    valueint;
-    char *valuestring;
-    uint8_t *bin;
-    uint8_t binsz;
-    sMsgPackNode *next,*child;
-}sMsgPackNode; 
+// Indexed by CompactKey
+static const char* const COMPACT_KEY_NAMES[MESSAGEPACK_COMPACT_KEY_COUNT] = {
+    "timestamp",
+    payload::messagepack::NAME_FIELD_NAME,
+    payload::messagepack::VALUE_FIELD_NAME,
+    payload::messagepack::EVENT_FIELD_NAME,
+    payload::messagepack::BUS_FIELD_NAME,
+    payload::messagepack::ID_FIELD_NAME,
+    payload::messagepack::DATA_FIELD_NAME,
+    payload::messagepack::FRAME_FORMAT_FIELD_NAME,
+    payload::messagepack::DIAGNOSTIC_MODE_FIELD_NAME,
+    payload::messagepack::DIAGNOSTIC_PID_FIELD_NAME,
+    payload::messagepack::DIAGNOSTIC_SUCCESS_FIELD_NAME,
+    payload::messagepack::DIAGNOSTIC_NRC_FIELD_NAME,
+    payload::messagepack::DIAGNOSTIC_PAYLOAD_FIELD_NAME,
+    payload::messagepack::COMMAND_RESPONSE_FIELD_NAME,
+    payload::messagepack::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
+    payload::messagepack::COMMAND_RESPONSE_STATUS_FIELD_NAME,
+};
 
 typedef struct{
     uint8_t MsgPackMapPairCount;
+    bool compactKeys;
 }meta;
 
 typedef struct{
@@ -93,8 +105,6 @@ typedef struct{
     meta     mobj;
 }sFile;    
 
-sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len);
-
 static size_t msgPackWriteBuffer(cmp_ctx_t *ctx, const void *data, size_t count) {
     
     sFile * smsgb = (sFile *)ctx->buf;
@@ -120,7 +130,7 @@ static bool msgPackReadBuffer(cmp_ctx_t *ctx, void *data, size_t count) {
     return count;
 }
 
-static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, uint8_t len){
+static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, size_t len){
 
     smsgpackb->end   = buf + len - 1;
     smsgpackb->start = buf;
@@ -128,70 +138,83 @@ static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, uint8_t len){
     smsgpackb->wp    = buf;
     
 }
- 
-static void msgPackAddObjectString(cmp_ctx_t *ctx, const char* fname ,const char* obj){
+
+/* Private: Write a map key - the field name, or its integer key if the
+ * message is being serialized with the compact schema.
+ */
+static void msgPackWriteKey(cmp_ctx_t *ctx, CompactKey key){
+    sFile *s = (sFile *)ctx->buf;
+    if(s->mobj.compactKeys) {
+        cmp_write_uint(ctx, key);
+    } else {
+        cmp_write_str(ctx, COMPACT_KEY_NAMES[key],
+                strlen(COMPACT_KEY_NAMES[key]));
+    }
+}
+
+static void msgPackAddObjectString(cmp_ctx_t *ctx, CompactKey key,const char* obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_str(ctx, (const char *)obj, strlen(obj));
     s->mobj.MsgPackMapPairCount++;
 }
-static void msgPackAddObjectDouble(cmp_ctx_t *ctx, const char* fname ,double obj){
+static void msgPackAddObjectDouble(cmp_ctx_t *ctx, CompactKey key,double obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_double(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
-static void msgPackAddObject8bNumeric(cmp_ctx_t *ctx, const char* fname ,uint8_t obj){
+static void msgPackAddObject8bNumeric(cmp_ctx_t *ctx, CompactKey key,uint8_t obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_u8(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
-static void msgPackAddObject16bNumeric(cmp_ctx_t *ctx, const char* fname ,uint16_t obj){
+static void msgPackAddObject16bNumeric(cmp_ctx_t *ctx, CompactKey key,uint16_t obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_u16(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
 /*
-static void msgPackAddObject32bNumeric(cmp_ctx_t *ctx, const char* fname ,uint32_t obj){
+static void msgPackAddObject32bNumeric(cmp_ctx_t *ctx, CompactKey key,uint32_t obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_u32(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
 */
-static void msgPackAddObject64bNumeric(cmp_ctx_t *ctx, const char* fname ,uint32_t obj){
+static void msgPackAddObject64bNumeric(cmp_ctx_t *ctx, CompactKey key,uint32_t obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_u64(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
 /*
-static void msgPackAddObjectFloat(cmp_ctx_t *ctx, const char* fname ,float obj){
+static void msgPackAddObjectFloat(cmp_ctx_t *ctx, CompactKey key,float obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_float(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
 */
-static void msgPackAddObjectBoolean(cmp_ctx_t *ctx, const char* fname ,bool obj){
+static void msgPackAddObjectBoolean(cmp_ctx_t *ctx, CompactKey key,bool obj){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     cmp_write_bool(ctx, obj);
     s->mobj.MsgPackMapPairCount++;
 }
-static void msgPackAddObjectBinary(cmp_ctx_t *ctx, const char* fname ,uint8_t* obj, uint8_t len){
+static void msgPackAddObjectBinary(cmp_ctx_t *ctx, CompactKey key,uint8_t* obj, uint8_t len){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     //cmp_write_bin_marker(ctx, len);
     cmp_write_bin(ctx,(const void *)obj, len); //writes marker as well
     s->mobj.MsgPackMapPairCount++;
 }
 /*
-static void msgPackAddObjectMap(cmp_ctx_t *ctx, const char* fname ,uint8_t* obj,uint8_t len){
+static void msgPackAddObjectMap(cmp_ctx_t *ctx, CompactKey key,uint8_t* obj,uint8_t len){
     sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
+    msgPackWriteKey(ctx, key);
     msgPackWriteBuffer(ctx, obj, len); 
     s->mobj.MsgPackMapPairCount++;
 }
@@ -214,16 +237,16 @@ static void serializeSimple(openxc_VehicleMessage* message,  cmp_ctx_t *ctx) {
         
     const char* name = message->simple_message.name;    
     sFile *s = (sFile *)ctx->buf;
-    msgPackAddObjectString(ctx, payload::messagepack::NAME_FIELD_NAME, name);
+    msgPackAddObjectString(ctx, payload::messagepack::NAME_KEY, name);
 
     if(message->simple_message.has_value) {
-        cmp_write_str(ctx, payload::messagepack::VALUE_FIELD_NAME, strlen(payload::messagepack::VALUE_FIELD_NAME));
+        msgPackWriteKey(ctx, payload::messagepack::VALUE_KEY);
         msgPackAddDynamicField(ctx, &message->simple_message.value);
         s->mobj.MsgPackMapPairCount++;
     }
     
     if(message->simple_message.has_event) {
-        cmp_write_str(ctx, payload::messagepack::EVENT_FIELD_NAME, strlen(payload::messagepack::EVENT_FIELD_NAME));        
+        msgPackWriteKey(ctx, payload::messagepack::EVENT_KEY);
         msgPackAddDynamicField(ctx, &message->simple_message.event);
         s->mobj.MsgPackMapPairCount++;
     }
@@ -231,15 +254,15 @@ static void serializeSimple(openxc_VehicleMessage* message,  cmp_ctx_t *ctx) {
 
 void serializeCan(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
     
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_FIELD_NAME, message->can_message.bus);
+    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_KEY, message->can_message.bus);
     
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_FIELD_NAME, message->can_message.bus);
+    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_KEY, message->can_message.bus);
     
-    msgPackAddObjectBinary(ctx, payload::messagepack::DATA_FIELD_NAME,
+    msgPackAddObjectBinary(ctx, payload::messagepack::DATA_KEY,
             message->can_message.data.bytes,message->can_message.data.size);
             
     if(message->can_message.has_frame_format) {
-        msgPackAddObjectString(ctx, payload::messagepack::FRAME_FORMAT_FIELD_NAME,
+        msgPackAddObjectString(ctx, payload::messagepack::FRAME_FORMAT_KEY,
                 message->can_message.frame_format == openxc_CanMessage_FrameFormat_STANDARD ?
                     payload::messagepack::FRAME_FORMAT_STANDARD_NAME :
                         payload::messagepack::FRAME_FORMAT_EXTENDED_NAME);
@@ -248,33 +271,33 @@ void serializeCan(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
 
 static void serializeDiagnostic(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
         
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_FIELD_NAME,
+    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_KEY,
             message->diagnostic_response.bus);
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_FIELD_NAME,
+    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_KEY,
             message->diagnostic_response.message_id);
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::DIAGNOSTIC_MODE_FIELD_NAME,
+    msgPackAddObject8bNumeric(ctx, payload::messagepack::DIAGNOSTIC_MODE_KEY,
             message->diagnostic_response.mode);
-    msgPackAddObjectBoolean(ctx, payload::messagepack::DIAGNOSTIC_SUCCESS_FIELD_NAME,
+    msgPackAddObjectBoolean(ctx, payload::messagepack::DIAGNOSTIC_SUCCESS_KEY,
             message->diagnostic_response.success);
 
             
     if(message->diagnostic_response.has_pid) {
-        msgPackAddObject16bNumeric(ctx, payload::messagepack::DIAGNOSTIC_PID_FIELD_NAME,
+        msgPackAddObject16bNumeric(ctx, payload::messagepack::DIAGNOSTIC_PID_KEY,
                 message->diagnostic_response.pid);
     }
 
     if(message->diagnostic_response.has_negative_response_code) {
-        msgPackAddObjectDouble(ctx, payload::messagepack::DIAGNOSTIC_NRC_FIELD_NAME,
+        msgPackAddObjectDouble(ctx, payload::messagepack::DIAGNOSTIC_NRC_KEY,
                 message->diagnostic_response.negative_response_code);
     }
 
     if(message->diagnostic_response.has_value) {
-        msgPackAddObjectDouble(ctx, payload::messagepack::DIAGNOSTIC_VALUE_FIELD_NAME,
+        msgPackAddObjectDouble(ctx, payload::messagepack::VALUE_KEY,
                 message->diagnostic_response.value);
                 
     } else if(message->diagnostic_response.has_payload) {
         
-        msgPackAddObjectBinary(ctx, payload::messagepack::DIAGNOSTIC_PAYLOAD_FIELD_NAME, 
+        msgPackAddObjectBinary(ctx, payload::messagepack::DIAGNOSTIC_PAYLOAD_KEY, 
                 message->diagnostic_response.payload.bytes, message->diagnostic_response.payload.size);
         
     }
@@ -311,26 +334,27 @@ static bool serializeCommandResponse(openxc_VehicleMessage* message, cmp_ctx_t *
         return false;
     }
 
-    msgPackAddObjectString(ctx, payload::messagepack::COMMAND_RESPONSE_FIELD_NAME,
+    msgPackAddObjectString(ctx, payload::messagepack::COMMAND_RESPONSE_KEY,
             typeString);
             
             
     if(message->command_response.has_message) {
         msgPackAddObjectString(ctx,
-                payload::messagepack::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
+                payload::messagepack::COMMAND_RESPONSE_MESSAGE_KEY,
                 message->command_response.message);
     }
 
     if(message->command_response.has_status) {
         msgPackAddObjectBoolean(ctx,
-                payload::messagepack::COMMAND_RESPONSE_STATUS_FIELD_NAME,
+                payload::messagepack::COMMAND_RESPONSE_STATUS_KEY,
                 message->command_response.status);
     }
     return true;
 }
 
 
-int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length)
+static int serializeMessage(openxc_VehicleMessage* message, uint8_t payload[],
+        size_t length, bool compactKeys)
 {
 
     sFile smsgpackb;
@@ -344,6 +368,7 @@ int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint
     memset((void*)&smsgpackb,0,sizeof(smsgpackb));
     
     msgPackInitBuffer(&smsgpackb, MessagePackBuffer, MESSAGE_PACK_SERIAL_BUF_SZ);
+    smsgpackb.mobj.compactKeys = compactKeys;
     
     cmp_init(&cmp,(void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
     
@@ -374,7 +399,8 @@ int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint
     */
     if(message->has_timestamp) {
         
-        msgPackAddObject64bNumeric(&cmp, "timestamp", message->timestamp);
+        msgPackAddObject64bNumeric(&cmp, payload::messagepack::TIMESTAMP_KEY,
+                message->timestamp);
                 
     }
     if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
@@ -385,7 +411,7 @@ int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint
         serializeDiagnostic(message, &cmp);
     } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
         serializeCommandResponse(message, &cmp);
-    } else {
+    } else if(message->has_type) {
         debug("Unrecognized message type -- not sending");
     }
     
@@ -403,6 +429,10 @@ int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint
     
 
     finalLength = smsgpackb.wp - smsgpackb.start;
+    if(finalLength > length) {
+        debug("Serialized MessagePack is too big for the payload buffer");
+        return 0;
+    }
     
     memcpy(payload, MessagePackBuffer, finalLength);
     
@@ -423,759 +453,716 @@ int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint
 */
     return finalLength;
 }
-sMsgPackNode * msgPackSeekNode(sMsgPackNode* root,const char * name ){
-    sMsgPackNode * node = root;
-    while(node){
-        if(strcmp(node->string, name) == 0){
-            if(node->child)return node->child;
-            
-            return node;
-        }
-        node = node->next;
-    }
-    //debug("Missing %s",name);
-    return node;
+
+int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    return serializeMessage(message, payload, length, false);
 }
 
-sMsgPackNode* getnode(cmp_ctx_t * ctx){
+int openxc::payload::messagepack::serializeCompact(
+        openxc_VehicleMessage* message, uint8_t payload[], size_t length) {
+    return serializeMessage(message, payload, length, true);
+}
 
-    
-    char vstr[MAX_STRLEN+1];
-    char nstr[MAX_STRLEN+1];
-    char binarr[MAX_BINLEN+1];
-    uint32_t str_size;
-    char binsz = 0;
-    cmp_object_t obj;
-    enum msgpack_var_type type;
-    double vd=0.0;
-    int    vi=0;
-    sMsgPackNode* ch;
-    
-    str_size = MAX_STRLEN;
-    
-    if (!cmp_read_str(ctx, nstr, &str_size)){
-        //debug("Node incomplete %s",cmp_strerror(ctx));
-        return NULL;
-    }
-    
-    if (cmp_read_object(ctx, &obj) == true) { //read value
-        switch (obj.type) {
-            case CMP_TYPE_FIXARRAY:
-            case CMP_TYPE_ARRAY16:
-            case CMP_TYPE_ARRAY32:
-            case CMP_TYPE_EXT8:
-            case CMP_TYPE_EXT16:
-            case CMP_TYPE_EXT32:
-            case CMP_TYPE_FIXEXT1:
-            case CMP_TYPE_FIXEXT2:
-            case CMP_TYPE_FIXEXT4:
-            case CMP_TYPE_FIXEXT8:
-            case CMP_TYPE_FIXEXT16:
-            case CMP_TYPE_NIL:
-            case CMP_TYPE_UINT64:
-            case CMP_TYPE_NEGATIVE_FIXNUM:
-            case CMP_TYPE_SINT8:
-            case CMP_TYPE_SINT16:
-            case CMP_TYPE_SINT32:
-            case CMP_TYPE_SINT64:
-            {
-                debug("Unhandled object %d",obj.type);
-                return NULL;
-                break;
-            }
-            case CMP_TYPE_FIXMAP:
-            case CMP_TYPE_MAP16:
-            case CMP_TYPE_MAP32:
-            {
-                sFile * s = (sFile *)ctx->buf;
-                s->rp--;
-                uint32_t plen = (s->end - s->rp) + 1;
-                ch = msgPackParse(s->rp,&plen);
-                if(ch == NULL){
-                    //debug("Child incomplete %s",cmp_strerror(ctx));
-                    return NULL;
-                }
-                    
-                s->rp += plen + 1;
-                type = msgpack_var_type::TYPE_MAP;
-                 break;
-            }
-            case CMP_TYPE_BIN8:
-            case CMP_TYPE_BIN16:
-            case CMP_TYPE_BIN32:
-            {
-                if(obj.as.bin_size > MAX_BINLEN)
-                {
-                    debug("Payload exceeded limit %d bytes",obj.as.bin_size);
-                    return NULL;
-                }
-                if (!msgPackReadBuffer(ctx, binarr, obj.as.bin_size))
-                {
-                    //debug("Data missing total %d %d %d //%dbytes",obj.as.bin_size,s->rp-s->start,s->end-s->rp,s->end-s->start);
-                    return NULL;
-                }
-                binsz = obj.as.bin_size;
-                type = msgpack_var_type::TYPE_BINARY;
-                break;
-            }
-            
-            case CMP_TYPE_FIXSTR:
-            case CMP_TYPE_STR8:
-            case CMP_TYPE_STR16:
-            case CMP_TYPE_STR32:
-            {
-                if(obj.as.str_size > MAX_STRLEN)
-                    return NULL;
-            
-                if (!msgPackReadBuffer(ctx, vstr, obj.as.str_size))
-                    return NULL;
-                
-                vstr[obj.as.str_size] = 0;
-                type = msgpack_var_type::TYPE_STRING;
-                break;
-            }    
-                
-            case CMP_TYPE_BOOLEAN:
-            {
-                if (obj.as.boolean)
-                    type = msgpack_var_type::TYPE_TRUE;
-                else
-                    type = msgpack_var_type::TYPE_FALSE;
-                
-                break;
-            }
-            case CMP_TYPE_FLOAT:
-            {
-                type = msgpack_var_type::TYPE_NUMBER;
-                vd = obj.as.flt;
-                break;
-            }
-              
-            case CMP_TYPE_DOUBLE:
-            {
-                type = msgpack_var_type::TYPE_NUMBER;
-                vd = obj.as.dbl;
-                break;                
-            }
-                
-            case CMP_TYPE_UINT16:
-            {
-                type = msgpack_var_type::TYPE_NUMBER;
-                vi = obj.as.u16;
-                break;
-            }
-                
-            case CMP_TYPE_UINT32:
-            {
-                type = msgpack_var_type::TYPE_NUMBER;
-                vi = obj.as.u32;
-                break;
-            }
-                
-            case CMP_TYPE_POSITIVE_FIXNUM:
-            case CMP_TYPE_UINT8:
-            {
-                type = msgpack_var_type::TYPE_NUMBER;
-                vi = obj.as.u8;
-                break;
-            }
-            
-            default:
-            {
-                debug("Unrecognized object type %u\n", obj.type);
-                break;
-            }
-        
-        }
-    } else
-    {
-        //debug("Node incomplete %s",cmp_strerror(ctx));
-        return NULL;
-    }
-    sMsgPackNode* node = (sMsgPackNode*)malloc(sizeof(sMsgPackNode));
-    dynamic_allocation_bytes += sizeof(sMsgPackNode);
-    if(node == NULL){
-        debug("Unable to create node in memory");
-        return NULL;
+/* Private: A value read from a MessagePack map by the pull decoder.
+ *
+ * Strings and binary values aren't copied - data points at them in the
+ * payload being decoded. The entries of a nested map or array are left unread
+ * in the stream, and entries counts the objects still to be read or skipped.
+ */
+typedef struct {
+    cmp_object_t object;
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t entries;
+} MsgPackValue;
+
+static bool isMap(const MsgPackValue* value) {
+    return value->object.type == CMP_TYPE_FIXMAP ||
+            value->object.type == CMP_TYPE_MAP16 ||
+            value->object.type == CMP_TYPE_MAP32;
+}
+
+static bool isString(const MsgPackValue* value) {
+    return value->object.type == CMP_TYPE_FIXSTR ||
+            value->object.type == CMP_TYPE_STR8 ||
+            value->object.type == CMP_TYPE_STR16 ||
+            value->object.type == CMP_TYPE_STR32;
+}
+
+static bool isBinary(const MsgPackValue* value) {
+    return value->object.type == CMP_TYPE_BIN8 ||
+            value->object.type == CMP_TYPE_BIN16 ||
+            value->object.type == CMP_TYPE_BIN32;
+}
+
+static bool isNumber(const MsgPackValue* value) {
+    switch(value->object.type) {
+        case CMP_TYPE_POSITIVE_FIXNUM:
+        case CMP_TYPE_NEGATIVE_FIXNUM:
+        case CMP_TYPE_UINT8:
+        case CMP_TYPE_UINT16:
+        case CMP_TYPE_UINT32:
+        case CMP_TYPE_UINT64:
+        case CMP_TYPE_SINT8:
+        case CMP_TYPE_SINT16:
+        case CMP_TYPE_SINT32:
+        case CMP_TYPE_SINT64:
+        case CMP_TYPE_FLOAT:
+        case CMP_TYPE_DOUBLE:
+            return true;
+        default:
+            return false;
     }
-    
-    str_size = strlen(nstr);
-    node->string = (char*)malloc(str_size + 1);
-    dynamic_allocation_bytes += str_size + 1;
-    memcpy(node->string,nstr,str_size);    //copy null terminator as well
-    node->string[str_size] = '\0';    
-    node->type = type;
-    
-    if(node->type == msgpack_var_type::TYPE_BINARY){
-        node->bin = (uint8_t *)malloc(binsz);
-        dynamic_allocation_bytes += binsz;
-        if(node->bin ==NULL){
-            debug("Unable to allocate mem bin");
-        }
-        memcpy(node->bin,binarr,binsz);
-        node->binsz = binsz;
-        //debug("allocated node");
+}
+
+/* Private: Returns a numeric or boolean value as a double, or 0 if it's
+ * neither.
+ */
+static double numberValue(const MsgPackValue* value) {
+    const cmp_object_t* object = &value->object;
+    switch(object->type) {
+        case CMP_TYPE_POSITIVE_FIXNUM:
+        case CMP_TYPE_UINT8:
+            return object->as.u8;
+        case CMP_TYPE_UINT16:
+            return object->as.u16;
+        case CMP_TYPE_UINT32:
+            return object->as.u32;
+        case CMP_TYPE_UINT64:
+            return object->as.u64;
+        case CMP_TYPE_NEGATIVE_FIXNUM:
+        case CMP_TYPE_SINT8:
+            return object->as.s8;
+        case CMP_TYPE_SINT16:
+            return object->as.s16;
+        case CMP_TYPE_SINT32:
+            return object->as.s32;
+        case CMP_TYPE_SINT64:
+            return object->as.s64;
+        case CMP_TYPE_FLOAT:
+            return object->as.flt;
+        case CMP_TYPE_DOUBLE:
+            return object->as.dbl;
+        case CMP_TYPE_BOOLEAN:
+            return object->as.boolean;
+        default:
+            return 0;
     }
-    if(node->type == msgpack_var_type::TYPE_STRING){
-        str_size = strlen(vstr);
-        node->valuestring = (char *)malloc(str_size+1);
-        dynamic_allocation_bytes += str_size + 1;
-        if(node->valuestring == NULL){
-            debug("Unable to allocate mem str");
-        }
-        memcpy(node->valuestring,vstr,str_size);
-        node->valuestring[str_size] = '\0';
+}
+
+static int intValue(const MsgPackValue* value) {
+    return (int)numberValue(value);
+}
+
+static bool stringEquals(const MsgPackValue* value, const char* expected) {
+    return isString(value) && value->size == strlen(expected) &&
+            !memcmp(value->data, expected, value->size);
+}
+
+/* Private: Check if a string value starts with prefix, the way command names
+ * have always been matched.
+ */
+static bool stringStartsWith(const MsgPackValue* value, const char* prefix) {
+    size_t prefixLength = strlen(prefix);
+    return isString(value) && value->size >= prefixLength &&
+            !memcmp(value->data, prefix, prefixLength);
+}
+
+/* Private: Copy a string value into destination, truncated to fit and always
+ * NULL terminated.
+ *
+ * Returns false if the value isn't a string.
+ */
+static bool copyString(const MsgPackValue* value, char* destination,
+        size_t size) {
+    if(!isString(value) || size == 0) {
+        return false;
     }
-    node->child = NULL;
-    if(type == msgpack_var_type::TYPE_MAP){
-        node->child = ch;
+    size_t length = MIN(value->size, size - 1);
+    memcpy(destination, value->data, length);
+    destination[length] = '\0';
+    return true;
+}
+
+/* Private: Copy a binary value into destination, truncated to fit.
+ *
+ * Returns the number of bytes copied.
+ */
+static size_t copyBinary(const MsgPackValue* value, uint8_t* destination,
+        size_t size) {
+    if(!isBinary(value)) {
+        return 0;
     }
-    node->valueint = vi;
-    node->valuedouble = vd;
-    node->next = NULL;
-    return node;
+    size_t length = MIN(value->size, size);
+    memcpy(destination, value->data, length);
+    return length;
 }
 
-void msgPackListNodes(sMsgPackNode* root)
-{
-    sMsgPackNode* n = root;
-    debug("list:");
-    while(n)
-    {
-        if(n->child){
-            debug("child:");
-            msgPackListNodes(n->child);
-        }
-            
-        debug("%s",n->string);
-        n = n->next;
+/* Private: Mark the next count bytes of the stream as read, returning a
+ * pointer to them or NULL if the stream is too short.
+ */
+static const uint8_t* msgPackConsume(cmp_ctx_t* ctx, uint32_t count) {
+    sFile* s = (sFile*)ctx->buf;
+    if(count > (uint32_t)(s->end + 1 - s->rp)) {
+        return NULL;
     }
+    const uint8_t* start = s->rp;
+    s->rp += count;
+    return start;
 }
 
-void MsgPackDelete(sMsgPackNode* root)//rentrant
-{
-    sMsgPackNode *pv, *rp;
-    
-    rp = root;
-    while(root->next){
-        pv = rp->next;
-        while(pv->next){
-                rp = pv;
-                pv = pv->next;
-                if(pv->child){
-                    MsgPackDelete(pv->child);
-                    pv->child = NULL;
-                    goto x;
-                }
-        }
-        //debug("deleting:%s",pv->string);
-        dynamic_allocation_bytes -= (strlen(pv->string) + 1);
-        free(pv->string);
-        
-        if(pv->type == msgpack_var_type::TYPE_STRING){
-            dynamic_allocation_bytes -= (strlen(pv->valuestring) + 1);
-            free(pv->valuestring);
-            
-        }
-        if(pv->type == msgpack_var_type::TYPE_BINARY){
-            dynamic_allocation_bytes -= (pv->binsz);
-            free(pv->bin);
-        }
-        if(pv->child){
-            MsgPackDelete(pv->child);
-        }
-        free(pv);
-        dynamic_allocation_bytes -= sizeof(sMsgPackNode);
-        rp->next = NULL;
-x:
-        rp = root;
+/* Private: Read the next object in the stream as a value. Strings, binary
+ * blobs and extension data are consumed along with their headers; the entries
+ * of maps and arrays are not.
+ *
+ * Returns false if the stream ends before the value does.
+ */
+static bool readValue(cmp_ctx_t* ctx, MsgPackValue* value) {
+    value->data = NULL;
+    value->size = 0;
+    value->entries = 0;
+    if(!cmp_read_object(ctx, &value->object)) {
+        return false;
     }
-    //debug("deleting:%s",root->string);
-    dynamic_allocation_bytes -= (strlen(root->string) + 1);
-    free(root->string);
-    if(root->type == msgpack_var_type::TYPE_STRING){
-        dynamic_allocation_bytes -= (strlen(root->valuestring) + 1);
-        free(root->valuestring);
+
+    switch(value->object.type) {
+        case CMP_TYPE_FIXSTR:
+        case CMP_TYPE_STR8:
+        case CMP_TYPE_STR16:
+        case CMP_TYPE_STR32:
+            value->size = value->object.as.str_size;
+            break;
+        case CMP_TYPE_BIN8:
+        case CMP_TYPE_BIN16:
+        case CMP_TYPE_BIN32:
+            value->size = value->object.as.bin_size;
+            break;
+        case CMP_TYPE_EXT8:
+        case CMP_TYPE_EXT16:
+        case CMP_TYPE_EXT32:
+        case CMP_TYPE_FIXEXT1:
+        case CMP_TYPE_FIXEXT2:
+        case CMP_TYPE_FIXEXT4:
+        case CMP_TYPE_FIXEXT8:
+        case CMP_TYPE_FIXEXT16:
+            value->size = value->object.as.ext.size;
+            break;
+        case CMP_TYPE_FIXMAP:
+        case CMP_TYPE_MAP16:
+        case CMP_TYPE_MAP32:
+            value->entries = value->object.as.map_size * 2;
+            break;
+        case CMP_TYPE_FIXARRAY:
+        case CMP_TYPE_ARRAY16:
+        case CMP_TYPE_ARRAY32:
+            value->entries = value->object.as.array_size;
+            break;
+        default:
+            break;
     }
-    if(pv->type == msgpack_var_type::TYPE_BINARY){
-        dynamic_allocation_bytes -= (root->binsz);
-        free(root->bin);
+
+    if(value->size > 0) {
+        value->data = msgPackConsume(ctx, value->size);
+        if(value->data == NULL) {
+            return false;
+        }
     }
-    free(root);
-    dynamic_allocation_bytes -= sizeof(sMsgPackNode);
+    return true;
 }
 
-sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len){ //reentrant
-    
-    sMsgPackNode *node = NULL;
-    sMsgPackNode *root = NULL;
-    
-    sFile smsgpackb;
-    
-    cmp_ctx_t cmp;
-    
-    if (!(buf[0] > 0x80 && buf[0] < 0x8f)){
-        return NULL;
+/* Private: Skip over the unread entries of a map or array value, and
+ * everything nested in them.
+ */
+static bool skipEntries(cmp_ctx_t* ctx, MsgPackValue* value, int depth) {
+    if(value->entries > 0 && depth >= MESSAGE_PACK_MAX_DEPTH) {
+        debug("MessagePack nested deeper than %d levels",
+                MESSAGE_PACK_MAX_DEPTH);
+        return false;
     }
-    
-    uint32_t map_len;
 
-    msgPackInitBuffer(&smsgpackb, buf, *len);
-    
-    cmp_init(&cmp,(void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
-    
-    
-    if(cmp_read_map(&cmp, &map_len) == false)
-    {
-        return NULL;
-    }
-    
-    //debug("Maplen %d", map_len);
-    root = getnode(&cmp); //get node creates a node on the heap using malloc
-    
-    if( root == NULL)
-    {
-        //debug("Root Node missing");
-        return NULL;
-    }
-    node = root;
-    map_len--;
-    while( map_len ){
-        
-        node->next = getnode(&cmp);
-        
-        if(node->next == NULL){
-            //debug("Message pack contains partial information");
-            MsgPackDelete(root);
-            return NULL;            
-        }        
-        node = node->next;
-        map_len--;
+    while(value->entries > 0) {
+        MsgPackValue entry;
+        if(!readValue(ctx, &entry) || !skipEntries(ctx, &entry, depth + 1)) {
+            return false;
+        }
+        --value->entries;
     }
-    *len = (uint32_t)(smsgpackb.rp - smsgpackb.start); //update bytes read from buffer
-    return root;
+    return true;
 }
 
+/* Private: Read the key and value of the next map entry. Compact schema keys
+ * are translated back to their field names. Keys that don't fit a field name
+ * are read as empty so they don't match anything.
+ */
+static bool readEntry(cmp_ctx_t* ctx, char* key, size_t keySize,
+        MsgPackValue* value) {
+    MsgPackValue keyValue;
+    if(!readValue(ctx, &keyValue)) {
+        return false;
+    }
 
-static void deserializePassthrough(sMsgPackNode* root, openxc_ControlCommand* command) {
-    
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PASSTHROUGH;
-    command->has_passthrough_mode_request = true;
+    if(keyValue.object.type == CMP_TYPE_POSITIVE_FIXNUM) {
+        // a compact schema key
+        const char* name = keyValue.object.as.u8 < MESSAGEPACK_COMPACT_KEY_COUNT ?
+                COMPACT_KEY_NAMES[keyValue.object.as.u8] : "";
+        strncpy(key, name, keySize - 1);
+        key[keySize - 1] = '\0';
+    } else if(!isString(&keyValue)) {
+        return false;
+    } else if(keyValue.size < keySize) {
+        copyString(&keyValue, key, keySize);
+    } else {
+        key[0] = '\0';
+    }
+    return readValue(ctx, value);
+}
 
-    sMsgPackNode* element = msgPackSeekNode(root, "bus");
-    
-    if(element != NULL) {
-        command->passthrough_mode_request.has_bus = true;
-        command->passthrough_mode_request.bus = element->valueint;
+/* Private: A function to store one map entry in a message. It must read or
+ * skip the entries of a nested map or array value itself, or they're skipped
+ * for it.
+ *
+ * Returns false if the stream is malformed.
+ */
+typedef bool (*EntryDecoder)(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination);
+
+/* Private: Pull each entry of a map out of the stream and hand it to decoder.
+ */
+static bool decodeMap(cmp_ctx_t* ctx, MsgPackValue* map, int depth,
+        EntryDecoder decoder, void* destination) {
+    if(depth >= MESSAGE_PACK_MAX_DEPTH) {
+        debug("MessagePack nested deeper than %d levels",
+                MESSAGE_PACK_MAX_DEPTH);
+        return false;
     }
 
-    element = msgPackSeekNode(root, "enabled");
-    if(element != NULL) {
-        command->passthrough_mode_request.has_enabled = true;
-        command->passthrough_mode_request.enabled = bool(element->valueint);
+    for(; map->entries > 0; map->entries -= 2) {
+        char key[MESSAGE_PACK_MAX_KEY_LENGTH + 1];
+        MsgPackValue value;
+        if(!readEntry(ctx, key, sizeof(key), &value) ||
+                (decoder != NULL &&
+                    !decoder(ctx, key, &value, depth + 1, destination)) ||
+                !skipEntries(ctx, &value, depth + 1)) {
+            return false;
+        }
     }
+    return true;
 }
 
-static void deserializePayloadFormat(sMsgPackNode* root,
-        openxc_ControlCommand* command) {
-            
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
-    command->has_payload_format_command = true;
+static bool decodePassthroughEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_PassthroughModeControlCommand* request =
+            (openxc_PassthroughModeControlCommand*)destination;
+    if(!strcmp(key, "bus")) {
+        request->has_bus = true;
+        request->bus = intValue(value);
+    } else if(!strcmp(key, "enabled")) {
+        request->has_enabled = true;
+        request->enabled = bool(intValue(value));
+    }
+    return true;
+}
 
-    sMsgPackNode* element = msgPackSeekNode(root, "format");
-    if(element != NULL) {
-        if(!strcmp(element->valuestring,
+static bool decodePayloadFormatEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_PayloadFormatCommand* command =
+            (openxc_PayloadFormatCommand*)destination;
+    if(!strcmp(key, "format")) {
+        if(stringEquals(value,
                     openxc::payload::messagepack::PAYLOAD_FORMAT_JSON_NAME)) {
-            command->payload_format_command.has_format = true;
-            command->payload_format_command.format =
-                    openxc_PayloadFormatCommand_PayloadFormat_JSON;
-        } else if(!strcmp(element->valuestring,
+            command->has_format = true;
+            command->format = openxc_PayloadFormatCommand_PayloadFormat_JSON;
+        } else if(stringEquals(value,
                     openxc::payload::messagepack::PAYLOAD_FORMAT_PROTOBUF_NAME)) {
-            command->payload_format_command.has_format = true;
-            command->payload_format_command.format =
+            command->has_format = true;
+            command->format =
                     openxc_PayloadFormatCommand_PayloadFormat_PROTOBUF;
-        } else if(!strcmp(element->valuestring,
+        } else if(stringEquals(value,
                     openxc::payload::messagepack::PAYLOAD_FORMAT_MESSAGEPACK_NAME)) {
-            command->payload_format_command.has_format = false;
-            command->payload_format_command.format = openxc_PayloadFormatCommand_PayloadFormat_MESSAGEPACK;
+            command->has_format = false;
+            command->format =
+                    openxc_PayloadFormatCommand_PayloadFormat_MESSAGEPACK;
+        } else if(stringEquals(value,
+                    openxc::payload::messagepack::PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME)) {
+            command->has_format = true;
+            command->format = PAYLOAD_FORMAT_COMMAND_MESSAGEPACK_COMPACT;
         }
     }
+    return true;
 }
 
-static void deserializePredefinedObd2RequestsCommand(sMsgPackNode* root,
-        openxc_ControlCommand* command) {
-            
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
-    command->has_predefined_obd2_requests_command = true;
-
-    sMsgPackNode* element = msgPackSeekNode(root, "enabled");
-    if(element != NULL) {
-        command->predefined_obd2_requests_command.has_enabled = true;
-        command->predefined_obd2_requests_command.enabled = bool(element->valueint);
+static bool decodePredefinedObd2RequestsEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_PredefinedObd2RequestsCommand* command =
+            (openxc_PredefinedObd2RequestsCommand*)destination;
+    if(!strcmp(key, "enabled")) {
+        command->has_enabled = true;
+        command->enabled = bool(intValue(value));
     }
+    return true;
 }
 
-static void deserializeAfBypass(sMsgPackNode* root, openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS;
-    command->has_acceptance_filter_bypass_command = true;
-
-    sMsgPackNode* element = msgPackSeekNode(root, "bus");
-    if(element != NULL) {
-        command->acceptance_filter_bypass_command.has_bus = true;
-        command->acceptance_filter_bypass_command.bus = element->valueint;
+static bool decodeAfBypassEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_AcceptanceFilterBypassCommand* command =
+            (openxc_AcceptanceFilterBypassCommand*)destination;
+    if(!strcmp(key, "bus")) {
+        command->has_bus = true;
+        command->bus = intValue(value);
+    } else if(!strcmp(key, "bypass")) {
+        command->has_bypass = true;
+        command->bypass = bool(intValue(value));
     }
+    return true;
+}
 
-    element = msgPackSeekNode(root, "bypass");
-    if(element != NULL) {
-        command->acceptance_filter_bypass_command.has_bypass = true;
-        command->acceptance_filter_bypass_command.bypass =
-            bool(element->valueint);
+static bool decodeDiagnosticRequestEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_DiagnosticRequest* request = (openxc_DiagnosticRequest*)destination;
+    if(!strcmp(key, "bus")) {
+        request->has_bus = true;
+        request->bus = intValue(value);
+    } else if(!strcmp(key, "mode")) {
+        request->has_mode = true;
+        request->mode = intValue(value);
+    } else if(!strcmp(key, "id")) {
+        request->has_message_id = true;
+        request->message_id = intValue(value);
+    } else if(!strcmp(key, "pid")) {
+        request->has_pid = true;
+        request->pid = intValue(value);
+    } else if(!strcmp(key, "payload")) {
+        request->has_payload = true;
+        request->payload.size = copyBinary(value, request->payload.bytes,
+                sizeof(request->payload.bytes));
+    } else if(!strcmp(key, "multiple_responses")) {
+        request->has_multiple_responses = true;
+        request->multiple_responses = bool(intValue(value));
+    } else if(!strcmp(key, "frequency")) {
+        request->has_frequency = true;
+        request->frequency = numberValue(value);
+    } else if(!strcmp(key, "decoded_type")) {
+        if(stringEquals(value, "obd2")) {
+            request->has_decoded_type = true;
+            request->decoded_type = openxc_DiagnosticRequest_DecodedType_OBD2;
+        } else if(stringEquals(value, "none")) {
+            request->has_decoded_type = true;
+            request->decoded_type = openxc_DiagnosticRequest_DecodedType_NONE;
+        }
+    } else if(!strcmp(key, "name")) {
+        if(copyString(value, request->name, sizeof(request->name))) {
+            request->has_name = true;
+        }
     }
+    return true;
 }
 
-static void deserializeDiagnostic(sMsgPackNode* root, openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
-    command->has_diagnostic_request = true;
-
-    sMsgPackNode* action = msgPackSeekNode(root, "action");
-    if(action != NULL && action->type == msgpack_var_type::TYPE_STRING) {
-        command->diagnostic_request.has_action = true;
-        if(!strcmp(action->valuestring, "add")) {
-            command->diagnostic_request.action =
-                    openxc_DiagnosticControlCommand_Action_ADD;
-        } else if(!strcmp(action->valuestring, "cancel")) {
-            command->diagnostic_request.action =
-                    openxc_DiagnosticControlCommand_Action_CANCEL;
+static bool decodeDiagnosticEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_DiagnosticControlCommand* command =
+            (openxc_DiagnosticControlCommand*)destination;
+    if(!strcmp(key, "action") && isString(value)) {
+        command->has_action = true;
+        if(stringEquals(value, "add")) {
+            command->action = openxc_DiagnosticControlCommand_Action_ADD;
+        } else if(stringEquals(value, "cancel")) {
+            command->action = openxc_DiagnosticControlCommand_Action_CANCEL;
         } else {
-            command->diagnostic_request.has_action = false;
+            command->has_action = false;
         }
+    } else if(!strcmp(key, "request") && isMap(value)) {
+        return decodeMap(ctx, value, depth, decodeDiagnosticRequestEntry,
+                &command->request);
     }
+    return true;
+}
 
-    sMsgPackNode* request = msgPackSeekNode(root, "request");
-    if(request != NULL) {
-     sMsgPackNode * element = msgPackSeekNode(request, "bus");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_bus = true;
-            command->diagnostic_request.request.bus = element->valueint;
-        }
-
-        element = msgPackSeekNode(request, "mode");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_mode = true;
-            command->diagnostic_request.request.mode = element->valueint;
-        }
-
-        element = msgPackSeekNode(request, "id");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_message_id = true;
-            command->diagnostic_request.request.message_id = element->valueint;
-        }
-
-        element = msgPackSeekNode(request, "pid");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_pid = true;
-            command->diagnostic_request.request.pid = element->valueint;
-        }
+static bool decodeDynamicField(const MsgPackValue* value,
+        openxc_DynamicField* field) {
+    field->has_type = true;
+    if(isString(value)) {
+        field->type = openxc_DynamicField_Type_STRING;
+        field->has_string_value = true;
+        copyString(value, field->string_value, sizeof(field->string_value));
+    } else if(value->object.type == CMP_TYPE_BOOLEAN) {
+        field->type = openxc_DynamicField_Type_BOOL;
+        field->has_boolean_value = true;
+        field->boolean_value = value->object.as.boolean;
+    } else if(isNumber(value)) {
+        field->type = openxc_DynamicField_Type_NUM;
+        field->has_numeric_value = true;
+        field->numeric_value = numberValue(value);
+    } else {
+        debug("Unsupported type in value field: %d", value->object.type);
+        field->has_type = false;
+        return false;
+    }
+    return true;
+}
 
-        element = msgPackSeekNode(request, "payload");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_payload = true;
-            if(request->type == msgpack_var_type::TYPE_BINARY){
-                command->diagnostic_request.request.payload.size = request->binsz;
-                memcpy(command->diagnostic_request.request.payload.bytes, 
-                        request->bin,request->binsz);
-            }
+static bool decodeSimpleEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_SimpleMessage* simpleMessage = (openxc_SimpleMessage*)destination;
+    if(!strcmp(key, "name")) {
+        if(copyString(value, simpleMessage->name,
+                    sizeof(simpleMessage->name))) {
+            simpleMessage->has_name = true;
         }
-
-        element = msgPackSeekNode(request, "multiple_responses");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_multiple_responses = true;
-            command->diagnostic_request.request.multiple_responses =
-                bool(element->valueint);
+    } else if(!strcmp(key, "value")) {
+        if(decodeDynamicField(value, &simpleMessage->value)) {
+            simpleMessage->has_value = true;
         }
-
-        element = msgPackSeekNode(request, "frequency");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_frequency = true;
-            command->diagnostic_request.request.frequency =
-                element->valuedouble;
+    } else if(!strcmp(key, "event")) {
+        if(decodeDynamicField(value, &simpleMessage->event)) {
+            simpleMessage->has_event = true;
         }
+    }
+    return true;
+}
 
-        element = msgPackSeekNode(request, "decoded_type");
-        if(element != NULL) {
-            if(!strcmp(element->valuestring, "obd2")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
-                        openxc_DiagnosticRequest_DecodedType_OBD2;
-            } else if(!strcmp(element->valuestring, "none")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
-                        openxc_DiagnosticRequest_DecodedType_NONE;
-            }
+static bool decodeCanEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_CanMessage* canMessage = (openxc_CanMessage*)destination;
+    if(!strcmp(key, "id")) {
+        canMessage->has_id = true;
+        canMessage->id = intValue(value);
+    } else if(!strcmp(key, "data")) {
+        if(isBinary(value)) {
+            canMessage->has_data = true;
+            canMessage->data.size = copyBinary(value, canMessage->data.bytes,
+                    sizeof(canMessage->data.bytes));
         }
-
-        element = msgPackSeekNode(request, "name");
-        if(element != NULL && element->type == msgpack_var_type::TYPE_STRING) {
-            command->diagnostic_request.request.has_name = true;
-            strcpy(command->diagnostic_request.request.name,
-                    element->valuestring);    
+    } else if(!strcmp(key, "bus")) {
+        canMessage->has_bus = true;
+        canMessage->bus = intValue(value);
+    } else if(!strcmp(key, payload::messagepack::FRAME_FORMAT_FIELD_NAME)) {
+        canMessage->has_frame_format = true;
+        if(stringEquals(value, payload::messagepack::FRAME_FORMAT_STANDARD_NAME)) {
+            canMessage->frame_format = openxc_CanMessage_FrameFormat_STANDARD;
+        } else if(stringEquals(value,
+                    payload::messagepack::FRAME_FORMAT_EXTENDED_NAME)) {
+            canMessage->frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
+        } else {
+            canMessage->has_frame_format = false;
         }
     }
+    return true;
 }
 
-static bool deserializeDynamicField(sMsgPackNode* element,
-        openxc_DynamicField* field) {
-    bool status = true;
-    field->has_type = true;
-    switch(element->type) {
-        case msgpack_var_type::TYPE_STRING:
-            field->type = openxc_DynamicField_Type_STRING;
-            field->has_string_value = true;
-            strcpy(field->string_value, element->valuestring);
-            break;
-        case msgpack_var_type::TYPE_FALSE:
-        case msgpack_var_type::TYPE_TRUE:
-            field->type = openxc_DynamicField_Type_BOOL;
-            field->has_boolean_value = true;
-            field->boolean_value = bool(element->valueint);
-            break;
-        case msgpack_var_type::TYPE_NUMBER:
-            field->type = openxc_DynamicField_Type_NUM;
-            field->has_numeric_value = true;
-            field->numeric_value = element->valuedouble;
-            break;
-        default:
-            debug("Unsupported type in value field: %d", element->type);
-            field->has_type = false;
-            status = false;
-            break;
+static bool decodeServerEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_ServerConnectSettings* settings =
+            (openxc_ServerConnectSettings*)destination;
+    if(!strcmp(key, "host")) {
+        if(copyString(value, settings->host, sizeof(settings->host))) {
+            settings->has_host = true;
+        }
+    } else if(!strcmp(key, "port")) {
+        settings->has_port = true;
+        settings->port = intValue(value);
     }
-    return status;
+    return true;
 }
 
-static void deserializeSimple(sMsgPackNode* root, openxc_VehicleMessage* message) {
-    message->has_type = true;
-    message->type = openxc_VehicleMessage_Type_SIMPLE;
-    message->has_simple_message = true;
-    openxc_SimpleMessage* simpleMessage = &message->simple_message;
-
-    sMsgPackNode* element = msgPackSeekNode(root, "name");
-    if(element != NULL && element->type == msgpack_var_type::TYPE_STRING) {
-        simpleMessage->has_name = true;
-        strcpy(simpleMessage->name, element->valuestring);
-    }
-
-    element = msgPackSeekNode(root, "value");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->value)) {
-            simpleMessage->has_value = true;
-        }
+static bool decodeModemConfigurationEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_ModemConfigurationCommand* command =
+            (openxc_ModemConfigurationCommand*)destination;
+    if(!strcmp(key, "server") && isMap(value)) {
+        command->has_serverConnectSettings = true;
+        return decodeMap(ctx, value, depth, decodeServerEntry,
+                &command->serverConnectSettings);
     }
+    return true;
+}
 
-    element = msgPackSeekNode(root, "event");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->event)) {
-            simpleMessage->has_event = true;
-        }
+static bool decodeRTCConfigurationEntry(cmp_ctx_t* ctx, const char* key,
+        MsgPackValue* value, int depth, void* destination) {
+    openxc_RTCConfigurationCommand* command =
+            (openxc_RTCConfigurationCommand*)destination;
+    if(!strcmp(key, "time")) {
+        command->has_unix_time = true;
+        command->unix_time = intValue(value);
     }
+    return true;
 }
 
-static void deserializeCan(sMsgPackNode* root, openxc_VehicleMessage* message) {
-    message->has_type = true;
-    message->type = openxc_VehicleMessage_Type_CAN;
-    message->has_can_message = true;
-    openxc_CanMessage* canMessage = &message->can_message;
+/* Private: Find which kind of message the map at the start of the buffer
+ * holds, and check that all of it is in the buffer.
+ *
+ * Keys can come in any order, so this skims the map once without storing
+ * anything before the entries are decoded into the message.
+ *
+ * command - an output parameter, set to the value of the "command" key. Its
+ *      object type is NIL if the map has no command.
+ * hasName - an output parameter, set if the map has a "name" key.
+ *
+ * Returns the number of bytes in the map, or 0 if it's incomplete or invalid.
+ */
+static uint32_t msgPackScan(uint8_t* buf, uint32_t length, MsgPackValue* command,
+        bool* hasName) {
+    sFile smsgpackb;
+    cmp_ctx_t cmp;
+    msgPackInitBuffer(&smsgpackb, buf, length);
+    cmp_init(&cmp, (void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
+
+    command->object.type = CMP_TYPE_NIL;
+    *hasName = false;
 
-    sMsgPackNode* element = msgPackSeekNode(root, "id");
-    if(element != NULL) {
-        canMessage->has_id = true;
-        canMessage->id = element->valueint;
-        element = msgPackSeekNode(root, "data");
-        if(element != NULL) { 
-            if(element->type == msgpack_var_type::TYPE_BINARY){
-                 canMessage->has_data = true;
-                 canMessage->data.size = element->binsz;
-                 memcpy(canMessage->data.bytes,
-                        element->bin,element->binsz);
-            }
-        }
+    MsgPackValue root;
+    if(!readValue(&cmp, &root) || !isMap(&root)) {
+        return 0;
+    }
 
-        element = msgPackSeekNode(root, "bus");
-        if(element != NULL) {
-            canMessage->has_bus = true;
-            canMessage->bus = element->valueint;
+    for(; root.entries > 0; root.entries -= 2) {
+        char key[MESSAGE_PACK_MAX_KEY_LENGTH + 1];
+        MsgPackValue value;
+        if(!readEntry(&cmp, key, sizeof(key), &value)) {
+            return 0;
         }
 
-        element = msgPackSeekNode(root, payload::messagepack::FRAME_FORMAT_FIELD_NAME);
-        if(element != NULL) {
-            canMessage->has_frame_format = true;
-            if(!strcmp(element->valuestring,
-                        payload::messagepack::FRAME_FORMAT_STANDARD_NAME)) {
-                canMessage->frame_format = openxc_CanMessage_FrameFormat_STANDARD;
-            } else if(!strcmp(element->valuestring,
-                        payload::messagepack::FRAME_FORMAT_EXTENDED_NAME)) {
-                canMessage->frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
-            } else {
-                canMessage->has_frame_format = false;
-            }
+        if(!strcmp(key, "command") && command->object.type == CMP_TYPE_NIL) {
+            *command = value;
+        } else if(!strcmp(key, "name")) {
+            *hasName = true;
         }
-    } else {
-        message->has_can_message = false;
-    }
-}
 
-static void deserializeModemConfiguration(sMsgPackNode* root, openxc_ControlCommand* command) {
-    // set up the struct for a modem configuration message
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_MODEM_CONFIGURATION;
-    command->has_modem_configuration_command = true;
-    openxc_ModemConfigurationCommand* modemConfigurationCommand = &command->modem_configuration_command;
-    
-    // parse server command
-    sMsgPackNode* server = msgPackSeekNode(root, "server");
-    if(server != NULL) {
-        modemConfigurationCommand->has_serverConnectSettings = true;
-        sMsgPackNode* host = msgPackSeekNode(server, "host");
-        if(host != NULL) {
-            modemConfigurationCommand->serverConnectSettings.has_host = true;
-            strcpy(modemConfigurationCommand->serverConnectSettings.host, host->valuestring);
-        }
-        sMsgPackNode* port = msgPackSeekNode(server, "port");
-        if(port != NULL) {
-            modemConfigurationCommand->serverConnectSettings.has_port = true;
-            modemConfigurationCommand->serverConnectSettings.port = port->valueint;
+        if(!skipEntries(&cmp, &value, 1)) {
+            return 0;
         }
     }
+    return (uint32_t)(smsgpackb.rp - smsgpackb.start);
 }
 
-static void deserializeRTCConfiguration(sMsgPackNode* root, openxc_ControlCommand* command) {
-
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_RTC_CONFIGURATION;
-    command->has_rtc_configuration_command = true;
-    openxc_RTCConfigurationCommand* rtcConfigurationCommand = &command->rtc_configuration_command;
-    
-    sMsgPackNode* time = msgPackSeekNode(root, "time");
-    
-    if(time != NULL) {
-        rtcConfigurationCommand->has_unix_time = true;
-        rtcConfigurationCommand->unix_time = time->valueint;
+/* Private: Decode every entry of the map at the start of the buffer into
+ * destination with decoder - see msgPackScan for the length.
+ */
+static void msgPackDecode(uint8_t* buf, uint32_t length, EntryDecoder decoder,
+        void* destination) {
+    sFile smsgpackb;
+    cmp_ctx_t cmp;
+    msgPackInitBuffer(&smsgpackb, buf, length);
+    cmp_init(&cmp, (void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
 
+    MsgPackValue root;
+    if(readValue(&cmp, &root)) {
+        decodeMap(&cmp, &root, 0, decoder, destination);
     }
 }
 
-
-
-
 //Entire data is chunked into a single packet by higher level protocol
 //unable to decode partial messages at this moment correctly
 size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t length,
         openxc_VehicleMessage* message){
-    
-    uint32_t Messagelen=0;
-    uint32_t i = 0;
-    sMsgPackNode *root;
-    //debug("Deserialize %d bytes",length);
-    root = NULL;
+
+    uint32_t messageStart = 0;
+    uint32_t mapLength = 0;
+    MsgPackValue commandName;
+    bool hasName = false;
     //find the start of message by searching for FIXMAPMARKER
-    while(i < length){
-        if(payload[i] > 0x80 && payload[i] < 0x8f){//attempt to parse message if found
-            uint32_t len = length-i;
-            root = msgPackParse(&payload[i],&len);
-            if( root != NULL)//we found a message
-            {
-                //debug("Message Pack Data Complete %d bytes", len);
-                //msgPackListNodes(root);
-                Messagelen = i + len; //message len to discard on success, discarding previous data
+    for(; messageStart < length; messageStart++) {
+        if(payload[messageStart] > 0x80 && payload[messageStart] < 0x8f) {
+            //attempt to parse message if found
+            mapLength = msgPackScan(&payload[messageStart],
+                    length - messageStart, &commandName, &hasName);
+            if(mapLength > 0) {
                 break;
             }
         }
-        i++;
     }
-    if(root == NULL)
-    {
-        //debug("MessagePackMemUsed:%d bytes", dynamic_allocation_bytes);
+    if(mapLength == 0) {
         return 0;
     }
-    sMsgPackNode* commandNameObject = msgPackSeekNode(root, "command");
+    memset(message, 0, sizeof(openxc_VehicleMessage));
 
-    if(commandNameObject != NULL) {
-        
+    uint8_t* map = &payload[messageStart];
+    if(commandName.object.type != CMP_TYPE_NIL) {
         message->has_type = true;
         message->type = openxc_VehicleMessage_Type_CONTROL_COMMAND;
         message->has_control_command = true;
         openxc_ControlCommand* command = &message->control_command;
-        
-        if(!strncmp(commandNameObject->valuestring, VERSION_COMMAND_NAME,
-                    strlen(VERSION_COMMAND_NAME))) {
+
+        if(stringStartsWith(&commandName, VERSION_COMMAND_NAME)) {
             command->has_type = true;
             command->type = openxc_ControlCommand_Type_VERSION;
-        } else if(!strncmp(commandNameObject->valuestring,
-                    DEVICE_ID_COMMAND_NAME, strlen(DEVICE_ID_COMMAND_NAME))) {
+        } else if(stringStartsWith(&commandName, DEVICE_ID_COMMAND_NAME)) {
             command->has_type = true;
             command->type = openxc_ControlCommand_Type_DEVICE_ID;
-        } else if(!strncmp(commandNameObject->valuestring,
-                    DEVICE_PLATFORM_COMMAND_NAME, strlen(DEVICE_PLATFORM_COMMAND_NAME))) {
+        } else if(stringStartsWith(&commandName, DEVICE_PLATFORM_COMMAND_NAME)) {
             command->has_type = true;
             command->type = openxc_ControlCommand_Type_PLATFORM;
-        } else if(!strncmp(commandNameObject->valuestring,
-                    DIAGNOSTIC_COMMAND_NAME, strlen(DIAGNOSTIC_COMMAND_NAME))) {
-            deserializeDiagnostic(root, command);
-        } else if(!strncmp(commandNameObject->valuestring,
-                    PASSTHROUGH_COMMAND_NAME, strlen(PASSTHROUGH_COMMAND_NAME))) {
-            deserializePassthrough(root, command);
-        } else if(!strncmp(commandNameObject->valuestring,
-                    PREDEFINED_OBD2_REQUESTS_COMMAND_NAME,
-                        strlen(PREDEFINED_OBD2_REQUESTS_COMMAND_NAME))) {
-            deserializePredefinedObd2RequestsCommand(root, command);
-        } else if(!strncmp(commandNameObject->valuestring,
-                    ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME,
-                    strlen(ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME))) {
-            deserializeAfBypass(root, command);
-        } else if(!strncmp(commandNameObject->valuestring,
-                    PAYLOAD_FORMAT_COMMAND_NAME,
-                    strlen(PAYLOAD_FORMAT_COMMAND_NAME))) {
-            deserializePayloadFormat(root, command);
-        } 
-        else if(!strncmp(commandNameObject->valuestring,
-                    MODEM_CONFIGURATION_COMMAND_NAME,
-                    strlen(MODEM_CONFIGURATION_COMMAND_NAME))) {
-            deserializeModemConfiguration(root, command);
-        }
-        else if(!strncmp(commandNameObject->valuestring,
-                    RTC_CONFIGURATION_COMMAND_NAME,
-                    strlen(RTC_CONFIGURATION_COMMAND_NAME))) {
-            deserializeRTCConfiguration(root, command);
-        }
-        else if(!strncmp(commandNameObject->valuestring,
-                    SD_MOUNT_STATUS_COMMAND_NAME,
-                    strlen(SD_MOUNT_STATUS_COMMAND_NAME))) {
-                        
-                command->has_type = true;
-                command->type = openxc_ControlCommand_Type_SD_MOUNT_STATUS;
-        }
-        else {
-            debug("Unrecognized command: %s", commandNameObject->valuestring);
-            message->has_control_command = false;
-        }    
-    } else{
-        sMsgPackNode* nameObject = msgPackSeekNode(root, "name");
-        if(nameObject == NULL) {
-            deserializeCan(root, message);
+        } else if(stringStartsWith(&commandName, DIAGNOSTIC_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
+            command->has_diagnostic_request = true;
+            msgPackDecode(map, mapLength, decodeDiagnosticEntry,
+                    &command->diagnostic_request);
+        } else if(stringStartsWith(&commandName, PASSTHROUGH_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_PASSTHROUGH;
+            command->has_passthrough_mode_request = true;
+            msgPackDecode(map, mapLength, decodePassthroughEntry,
+                    &command->passthrough_mode_request);
+        } else if(stringStartsWith(&commandName,
+                    PREDEFINED_OBD2_REQUESTS_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
+            command->has_predefined_obd2_requests_command = true;
+            msgPackDecode(map, mapLength, decodePredefinedObd2RequestsEntry,
+                    &command->predefined_obd2_requests_command);
+        } else if(stringStartsWith(&commandName,
+                    ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS;
+            command->has_acceptance_filter_bypass_command = true;
+            msgPackDecode(map, mapLength, decodeAfBypassEntry,
+                    &command->acceptance_filter_bypass_command);
+        } else if(stringStartsWith(&commandName, PAYLOAD_FORMAT_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
+            command->has_payload_format_command = true;
+            msgPackDecode(map, mapLength, decodePayloadFormatEntry,
+                    &command->payload_format_command);
+        } else if(stringStartsWith(&commandName,
+                    MODEM_CONFIGURATION_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_MODEM_CONFIGURATION;
+            command->has_modem_configuration_command = true;
+            msgPackDecode(map, mapLength, decodeModemConfigurationEntry,
+                    &command->modem_configuration_command);
+        } else if(stringStartsWith(&commandName,
+                    RTC_CONFIGURATION_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_RTC_CONFIGURATION;
+            command->has_rtc_configuration_command = true;
+            msgPackDecode(map, mapLength, decodeRTCConfigurationEntry,
+                    &command->rtc_configuration_command);
+        } else if(stringStartsWith(&commandName,
+                    SD_MOUNT_STATUS_COMMAND_NAME)) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_SD_MOUNT_STATUS;
         } else {
-            deserializeSimple(root, message);
+            char name[MESSAGE_PACK_MAX_KEY_LENGTH + 1] = {0};
+            copyString(&commandName, name, sizeof(name));
+            debug("Unrecognized command: %s", name);
+            message->has_control_command = false;
         }
+    } else if(!hasName) {
+        message->has_type = true;
+        message->type = openxc_VehicleMessage_Type_CAN;
+        message->has_can_message = true;
+        msgPackDecode(map, mapLength, decodeCanEntry, &message->can_message);
+        if(!message->can_message.has_id) {
+            message->has_can_message = false;
+        }
+    } else {
+        message->has_type = true;
+        message->type = openxc_VehicleMessage_Type_SIMPLE;
+        message->has_simple_message = true;
+        msgPackDecode(map, mapLength, decodeSimpleEntry,
+                &message->simple_message);
     }
-    
-    MsgPackDelete(root);
-    Messagelen = MIN(Messagelen,length);
-    //debug("Parsed: %d bytes", Messagelen);
-    //debug("MessagePackMemUsed:%d bytes", dynamic_allocation_bytes);    
-    return Messagelen;        
+
+    return MIN(messageStart + mapLength, length);
 }
-        
@@ -19,6 +19,7 @@ extern const char PREDEFINED_OBD2_REQUESTS_COMMAND_NAME[];
 extern const char PAYLOAD_FORMAT_JSON_NAME[];
 extern const char PAYLOAD_FORMAT_PROTOBUF_NAME[];
 extern const char PAYLOAD_FORMAT_MESSAGEPACK_NAME[];
+extern const char PAYLOAD_FORMAT_MESSAGEPACK_COMPACT_NAME[];
 
 extern const char COMMAND_RESPONSE_FIELD_NAME[];
 extern const char COMMAND_RESPONSE_MESSAGE_FIELD_NAME[];
@@ -46,7 +47,35 @@ extern const char MODEM_CONFIGURATION_COMMAND_NAME[];
 extern const char RTC_CONFIGURATION_COMMAND_NAME[];
 
 extern const char SD_MOUNT_STATUS_COMMAND_NAME[];
+/* Public: The integer keys that replace field names in the compact
+ * MessagePack schema (PayloadFormat::MESSAGEPACK_COMPACT). These values are
+ * part of the wire format - only add to the end.
+ */
+typedef enum {
+    TIMESTAMP_KEY,
+    NAME_KEY,
+    VALUE_KEY,
+    EVENT_KEY,
+    BUS_KEY,
+    ID_KEY,
+    DATA_KEY,
+    FRAME_FORMAT_KEY,
+    DIAGNOSTIC_MODE_KEY,
+    DIAGNOSTIC_PID_KEY,
+    DIAGNOSTIC_SUCCESS_KEY,
+    DIAGNOSTIC_NRC_KEY,
+    DIAGNOSTIC_PAYLOAD_KEY,
+    COMMAND_RESPONSE_KEY,
+    COMMAND_RESPONSE_MESSAGE_KEY,
+    COMMAND_RESPONSE_STATUS_KEY,
+} CompactKey;
+
+#define MESSAGEPACK_COMPACT_KEY_COUNT 16
+
 /* Public: Deserialize an OpenXC message from a payload containing MessagePack.
+ *
+ * Map keys may be the field names or, for the fields in CompactKey, their
+ * compact integer keys.
  *
  * payload - The bytestream payload to parse a message from.
  * length -  The length of the payload.
@@ -68,6 +97,16 @@ size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* mess
  */
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
 
+/* Public: Serialize an OpenXC message as MessagePack with the compact schema,
+ * where every field name is replaced by its CompactKey. The values are the
+ * same as serialize(openxc_VehicleMessage*, uint8_t[], size_t) writes.
+ *
+ * Returns the number of bytes written to the payload. If the length is 0, an
+ * error occurred while serializing.
+ */
+int serializeCompact(openxc_VehicleMessage* message, uint8_t payload[],
+        size_t length);
+
 } // namespace messagepack
 } // namespace payload
 } // namespace openxc
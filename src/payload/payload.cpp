@@ -42,7 +42,8 @@ size_t openxc::payload::deserialize(uint8_t payload[], size_t length,
         bytesRead = payload::json::deserialize(payload, length, message);
     } else if(format == PayloadFormat::PROTOBUF) {
         bytesRead = payload::protobuf::deserialize(payload, length, message);
-    } else if(format == PayloadFormat::MESSAGEPACK){
+    } else if(format == PayloadFormat::MESSAGEPACK ||
+            format == PayloadFormat::MESSAGEPACK_COMPACT) {
         bytesRead = payload::messagepack::deserialize(payload, length, message);
     } else {
         debug("Invalid payload format: %d", format);
@@ -59,8 +60,30 @@ int openxc::payload::serialize(openxc_VehicleMessage* message,
         serializedLength = payload::protobuf::serialize(message, payload, length);
     } else if(format == PayloadFormat::MESSAGEPACK) {
         serializedLength = payload::messagepack::serialize(message, payload, length);
+    } else if(format == PayloadFormat::MESSAGEPACK_COMPACT) {
+        serializedLength = payload::messagepack::serializeCompact(message,
+                payload, length);
     } else {
         debug("Invalid payload format: %d", format);
     }
     return serializedLength;
 }
+
+int openxc::payload::serializeSimple(const char* name,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        const uint64_t* timestamp, uint8_t payload[], size_t length,
+        PayloadFormat format) {
+    return serializeSimple(name, 0, value, event, timestamp, payload, length,
+            format);
+}
+
+int openxc::payload::serializeSimple(const char* name, size_t nameLength,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        const uint64_t* timestamp, uint8_t payload[], size_t length,
+        PayloadFormat format) {
+    if(format == PayloadFormat::JSON) {
+        return payload::json::serializeSimple(name, nameLength, value, event,
+                timestamp, payload, length);
+    }
+    return 0;
+}
@@ -13,8 +13,20 @@ typedef enum {
     JSON,
     PROTOBUF,
     MESSAGEPACK,
+    MESSAGEPACK_COMPACT,
 } PayloadFormat;
 
+#define PAYLOAD_FORMAT_COUNT 4
+
+/* Public: The payload_format_command format that selects the compact
+ * MessagePack schema. The message format's enum has no value for it, so it's
+ * carried as the next unused one and only sent by name ("messagepack_compact")
+ * in JSON or MessagePack commands.
+ */
+#define PAYLOAD_FORMAT_COMMAND_MESSAGEPACK_COMPACT \
+        ((openxc_PayloadFormatCommand_PayloadFormat) \
+            (openxc_PayloadFormatCommand_PayloadFormat_MESSAGEPACK + 1))
+
 /* Public: Deserialize an OpenXC message from the given payload, using the given
  * format.
  *
@@ -27,6 +39,9 @@ typedef enum {
  * length -  The length of the payload.
  * format - The expected format of the message serialized in the payload.
  * message - An output parameter, the object to store the deserialized message.
+ *      It's cleared before a complete message is stored in it, so it doesn't
+ *      need to be initialized - but if no complete message was found its
+ *      contents are undefined.
  *
  * Returns the number of bytes read for a complete message from the payload, if
  * any where found.
@@ -49,6 +64,35 @@ size_t deserialize(uint8_t payload[], size_t length, PayloadFormat format,
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
         PayloadFormat format);
 
+/* Public: Serialize a simple vehicle message directly from its parts, without
+ * building an openxc_VehicleMessage first. Only formats that can write a
+ * simple message straight from its fields (currently JSON) support this.
+ *
+ * name - The name of the message.
+ * value - The value of the message, or NULL if it has none.
+ * event - The event of the message, or NULL if it has none.
+ * timestamp - A pointer to the message's timestamp, or NULL if it has none.
+ * payload - The buffer to store the payload - must be allocated by the caller.
+ * length -  The length of the payload buffer.
+ * format - The serialization format to use in the payload.
+ *
+ * Returns the number of bytes written to the payload. If the length is 0, the
+ * message didn't fit or the format doesn't support this - use
+ * serialize(openxc_VehicleMessage*, ...) instead.
+ */
+int serializeSimple(const char* name, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, const uint64_t* timestamp,
+        uint8_t payload[], size_t length, PayloadFormat format);
+
+/* Public: The same as serializeSimple(const char*, ...), with the length of a
+ * name that's known not to need escaping in JSON - see
+ * json::plainStringLength - or 0 if it isn't known.
+ */
+int serializeSimple(const char* name, size_t nameLength,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        const uint64_t* timestamp, uint8_t payload[], size_t length,
+        PayloadFormat format);
+
 /* Public: Helper functions to wrap values in an openxc_DynamicField
  */
 openxc_DynamicField wrapNumber(float value);
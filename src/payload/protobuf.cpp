@@ -1,11 +1,258 @@
 #include "protobuf.h"
 
 #include <util/log.h>
+#include <string.h>
 #include "pb_encode.h"
 #include "pb_decode.h"
 
 using openxc::util::log::debug;
 
+// Protocol buffer wire types, for the hand-written encoders below.
+#define WIRETYPE_VARINT 0
+#define WIRETYPE_64BIT 1
+#define WIRETYPE_STRING 2
+
+#define FIELD_KEY(tag, wiretype) (((tag) << 3) | (wiretype))
+
+// Every field tag in the encoded message types is below 16, so each key is a
+// single byte.
+#define KEY_SIZE 1
+
+/* Private: Returns the number of bytes needed to encode a value as a varint.
+ */
+static size_t varintSize(uint64_t value) {
+    size_t size = 1;
+    while(value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+static uint8_t* writeVarint(uint8_t* cursor, uint64_t value) {
+    while(value >= 0x80) {
+        *cursor++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *cursor++ = (uint8_t)value;
+    return cursor;
+}
+
+/* Private: Returns the encoded size of a length-delimited field, including its
+ * key and length prefix.
+ */
+static size_t delimitedSize(size_t length) {
+    return KEY_SIZE + varintSize(length) + length;
+}
+
+static uint8_t* writeDelimitedHeader(uint8_t* cursor, uint8_t tag,
+        size_t length) {
+    *cursor++ = FIELD_KEY(tag, WIRETYPE_STRING);
+    return writeVarint(cursor, length);
+}
+
+static uint8_t* writeBytes(uint8_t* cursor, uint8_t tag, const void* data,
+        size_t length) {
+    cursor = writeDelimitedHeader(cursor, tag, length);
+    memcpy(cursor, data, length);
+    return cursor + length;
+}
+
+static uint8_t* writeVarintField(uint8_t* cursor, uint8_t tag,
+        uint64_t value) {
+    *cursor++ = FIELD_KEY(tag, WIRETYPE_VARINT);
+    return writeVarint(cursor, value);
+}
+
+/* Private: Returns the value nanopb would encode for an int32 - negative
+ * values are sign extended to 64 bits.
+ */
+static uint64_t int32Varint(int32_t value) {
+    return (uint64_t)(int64_t)value;
+}
+
+static size_t dynamicFieldSize(const openxc_DynamicField* field) {
+    size_t size = 0;
+    if(field->has_type) {
+        size += KEY_SIZE + varintSize(field->type);
+    }
+    if(field->has_string_value) {
+        size += delimitedSize(strnlen(field->string_value,
+                    sizeof(field->string_value)));
+    }
+    if(field->has_numeric_value) {
+        size += KEY_SIZE + sizeof(uint64_t);
+    }
+    if(field->has_boolean_value) {
+        size += KEY_SIZE + 1;
+    }
+    return size;
+}
+
+static uint8_t* writeDynamicField(uint8_t* cursor, uint8_t tag,
+        const openxc_DynamicField* field, size_t size) {
+    cursor = writeDelimitedHeader(cursor, tag, size);
+    if(field->has_type) {
+        cursor = writeVarintField(cursor, openxc_DynamicField_type_tag,
+                field->type);
+    }
+    if(field->has_string_value) {
+        cursor = writeBytes(cursor, openxc_DynamicField_string_value_tag,
+                field->string_value, strnlen(field->string_value,
+                    sizeof(field->string_value)));
+    }
+    if(field->has_numeric_value) {
+        uint64_t bits;
+        memcpy(&bits, &field->numeric_value, sizeof(bits));
+        *cursor++ = FIELD_KEY(openxc_DynamicField_numeric_value_tag,
+                WIRETYPE_64BIT);
+        // doubles are always little endian on the wire
+        for(size_t i = 0; i < sizeof(bits); i++) {
+            *cursor++ = (uint8_t)(bits >> (8 * i));
+        }
+    }
+    if(field->has_boolean_value) {
+        cursor = writeVarintField(cursor, openxc_DynamicField_boolean_value_tag,
+                field->boolean_value ? 1 : 0);
+    }
+    return cursor;
+}
+
+/* Private: Serialize a SIMPLE or CAN vehicle message (or one with only a
+ * timestamp) straight to wire bytes, without walking the nanopb field
+ * descriptors for the (mostly absent) fields of every other message type.
+ *
+ * The output is byte-for-byte what pb_encode_delimited produces for the same
+ * message, fields in tag order and optional fields only when they are set.
+ *
+ * Returns the number of bytes written, or 0 if the message doesn't fit.
+ */
+static int serializeFast(const openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    size_t bodySize = 0;
+    size_t valueSize = 0, eventSize = 0;
+    size_t nameLength = 0;
+    const openxc_SimpleMessage* simple = &message->simple_message;
+    const openxc_CanMessage* can = &message->can_message;
+
+    if(message->has_type) {
+        bodySize += KEY_SIZE + varintSize(message->type);
+    }
+
+    size_t submessageSize = 0;
+    if(message->has_can_message) {
+        if(can->has_bus) {
+            submessageSize += KEY_SIZE + varintSize(int32Varint(can->bus));
+        }
+        if(can->has_id) {
+            submessageSize += KEY_SIZE + varintSize(can->id);
+        }
+        if(can->has_data) {
+            submessageSize += delimitedSize(can->data.size);
+        }
+        if(can->has_frame_format) {
+            submessageSize += KEY_SIZE + varintSize(can->frame_format);
+        }
+    } else if(message->has_simple_message) {
+        if(simple->has_name) {
+            nameLength = strnlen(simple->name, sizeof(simple->name));
+            submessageSize += delimitedSize(nameLength);
+        }
+        if(simple->has_value) {
+            valueSize = dynamicFieldSize(&simple->value);
+            submessageSize += delimitedSize(valueSize);
+        }
+        if(simple->has_event) {
+            eventSize = dynamicFieldSize(&simple->event);
+            submessageSize += delimitedSize(eventSize);
+        }
+    }
+    if(message->has_can_message || message->has_simple_message) {
+        bodySize += delimitedSize(submessageSize);
+    }
+
+    if(message->has_timestamp) {
+        bodySize += KEY_SIZE + varintSize(message->timestamp);
+    }
+
+    if(varintSize(bodySize) + bodySize > length) {
+        debug("Protobuf message doesn't fit in %d byte buffer", (int)length);
+        return 0;
+    }
+
+    uint8_t* cursor = writeVarint(payload, bodySize);
+    if(message->has_type) {
+        cursor = writeVarintField(cursor, openxc_VehicleMessage_type_tag,
+                message->type);
+    }
+
+    if(message->has_can_message) {
+        cursor = writeDelimitedHeader(cursor,
+                openxc_VehicleMessage_can_message_tag, submessageSize);
+        if(can->has_bus) {
+            cursor = writeVarintField(cursor, openxc_CanMessage_bus_tag,
+                    int32Varint(can->bus));
+        }
+        if(can->has_id) {
+            cursor = writeVarintField(cursor, openxc_CanMessage_id_tag,
+                    can->id);
+        }
+        if(can->has_data) {
+            cursor = writeBytes(cursor, openxc_CanMessage_data_tag,
+                    can->data.bytes, can->data.size);
+        }
+        if(can->has_frame_format) {
+            cursor = writeVarintField(cursor, openxc_CanMessage_frame_format_tag,
+                    can->frame_format);
+        }
+    } else if(message->has_simple_message) {
+        cursor = writeDelimitedHeader(cursor,
+                openxc_VehicleMessage_simple_message_tag, submessageSize);
+        if(simple->has_name) {
+            cursor = writeBytes(cursor, openxc_SimpleMessage_name_tag,
+                    simple->name, nameLength);
+        }
+        if(simple->has_value) {
+            cursor = writeDynamicField(cursor, openxc_SimpleMessage_value_tag,
+                    &simple->value, valueSize);
+        }
+        if(simple->has_event) {
+            cursor = writeDynamicField(cursor, openxc_SimpleMessage_event_tag,
+                    &simple->event, eventSize);
+        }
+    }
+
+    if(message->has_timestamp) {
+        cursor = writeVarintField(cursor, openxc_VehicleMessage_timestamp_tag,
+                message->timestamp);
+    }
+    return cursor - payload;
+}
+
+/* Private: Returns true if the message is one of the shapes serializeFast
+ * handles - a SIMPLE or CAN message with no other sub-message attached, or a
+ * timestamp base record with nothing but a timestamp.
+ */
+static bool fastPathEligible(const openxc_VehicleMessage* message) {
+    if(message->has_diagnostic_response || message->has_control_command ||
+            message->has_command_response) {
+        return false;
+    }
+
+    if(!message->has_type) {
+        return !message->has_can_message && !message->has_simple_message;
+    }
+
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        return message->has_simple_message && !message->has_can_message;
+    } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+        return message->has_can_message && !message->has_simple_message &&
+                message->can_message.data.size <=
+                    sizeof(message->can_message.data.bytes);
+    }
+    return false;
+}
+
 size_t openxc::payload::protobuf::deserialize(uint8_t payload[], size_t length,
         openxc_VehicleMessage* message) {
     pb_istream_t stream = pb_istream_from_buffer(payload, length);
@@ -23,6 +270,10 @@ int openxc::payload::protobuf::serialize(openxc_VehicleMessage* message,
         return 0;
     }
 
+    if(fastPathEligible(message)) {
+        return serializeFast(message, payload, length);
+    }
+
     pb_ostream_t stream = pb_ostream_from_buffer(payload, length);
     if(!pb_encode_delimited(&stream, openxc_VehicleMessage_fields,
             message)) {
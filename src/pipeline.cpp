@@ -2,13 +2,14 @@
 #include "pipeline.h"
 #include "util/log.h"
 #include "util/timer.h"
+#include "util/wall_clock.h"
 #include "util/statistics.h"
 #include "util/bytebuffer.h"
+#include "payload/columnar.h"
 #include "config.h"
 #include "lights.h"
-#define PIPELINE_ENDPOINT_COUNT 5
 #define PIPELINE_STATS_LOG_FREQUENCY_S 15
-#define QUEUE_FLUSH_MAX_TRIES 100
+#define ENDPOINT_FLAG(endpoint) (1 << (endpoint))
 #include "platform_profile.h"
 #ifdef RTC_SUPPORT
 	#include "platform/pic32/rtc.h"
@@ -21,152 +22,1046 @@ namespace fs   =  openxc::interface::fs;
 namespace network = openxc::interface::network;
 namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
+namespace wallclock = openxc::util::wallclock;
 namespace config = openxc::config;
+namespace columnar = openxc::payload::columnar;
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::util::bytebuffer::messageFits;
+using openxc::util::bytebuffer::wrapCheckedFrame;
+using openxc::util::bytebuffer::FrameType;
 using openxc::util::statistics::DeltaStatistic;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
+using openxc::pipeline::Route;
+using openxc::pipeline::currentTimestamp;
 using openxc::interface::InterfaceDescriptor;
 using openxc::interface::InterfaceType;
 using openxc::config::LoggingOutputInterface;
 using openxc::util::time::uptimeMs;
+using openxc::payload::PayloadFormat;
+using openxc::payload::columnar::ColumnarBatch;
 
-unsigned int droppedMessages[PIPELINE_ENDPOINT_COUNT];
+unsigned int droppedMessages[PIPELINE_ENDPOINT_COUNT][MESSAGE_CLASS_COUNT];
 unsigned int sentMessages[PIPELINE_ENDPOINT_COUNT];
 unsigned int dataSent[PIPELINE_ENDPOINT_COUNT];
 unsigned int sendQueueLength[PIPELINE_ENDPOINT_COUNT];
 unsigned int receiveQueueLength[PIPELINE_ENDPOINT_COUNT];
+unsigned int sendQueuePeak[PIPELINE_ENDPOINT_COUNT];
+unsigned int receiveQueuePeak[PIPELINE_ENDPOINT_COUNT];
+unsigned int sendQueueCapacity[PIPELINE_ENDPOINT_COUNT];
+unsigned int receiveQueueCapacity[PIPELINE_ENDPOINT_COUNT];
 
-void conditionalFlush(Pipeline* pipeline,
-        QUEUE_TYPE(uint8_t)* sendQueue, uint8_t* message, int messageSize) {
-    int timeout = QUEUE_FLUSH_MAX_TRIES;
-    while(timeout > 0 && !messageFits(sendQueue, message, messageSize)) {
-        process(pipeline);
-        --timeout;
+static Route routes[PIPELINE_ENDPOINT_COUNT];
+
+/* Private: The messages an endpoint is holding back to send together.
+ *
+ * configured - if false, the endpoint uses the default batch limits.
+ * maxMessages - the number of messages in a full batch.
+ * maxDelayMs - how long a batch may stay open.
+ * count - the number of messages in the open batch, or 0 if none is open.
+ * container - true if the open batch is wrapped in a JSON records object.
+ * openedAt - the time the open batch got its first message.
+ * queue - the send queue the open batch is in.
+ */
+typedef struct {
+    bool configured;
+    uint8_t maxMessages;
+    unsigned int maxDelayMs;
+    uint8_t count;
+    bool container;
+    unsigned long openedAt;
+    ByteQueue* queue;
+} Batch;
+
+static Batch batches[PIPELINE_ENDPOINT_COUNT];
+
+static const char BATCH_HEADER[] = "{\"records\":[";
+// Includes the record delimiter, which is taken off the batched messages
+static const uint8_t BATCH_FOOTER[] = {']', '}', '\0'};
+#define BATCH_HEADER_SIZE ((int) sizeof(BATCH_HEADER) - 1)
+#define BATCH_FOOTER_SIZE ((int) sizeof(BATCH_FOOTER))
+
+#define DEFAULT_RATE_LIMITED_ENDPOINTS (ENDPOINT_FLAG(InterfaceType::BLE) | \
+        ENDPOINT_FLAG(InterfaceType::TELIT))
+
+static bool nameDictionary = false;
+
+// The endpoints sending timestamps as deltas, and the ones whose send queue
+// holds the base record the deltas are from, as ENDPOINT_FLAG()s. See
+// openxc::pipeline::setTimestampDeltas.
+static uint8_t timestampDeltaEndpoints;
+static uint8_t timestampBasedEndpoints;
+static uint64_t timestampBases[PIPELINE_ENDPOINT_COUNT];
+// When the CAN message being handled was received, or 0 if there isn't one
+static unsigned long messageReceivedUs;
+
+// The endpoints sending signals in columnar blocks, as ENDPOINT_FLAG()s, and
+// when each one's open block got its first sample. See
+// openxc::pipeline::setColumnar.
+static uint8_t columnarEndpoints;
+static unsigned long columnarOpenedAt[PIPELINE_ENDPOINT_COUNT];
+
+#if METRICS_SUPPORT
+/* Private: A message being followed from the time its source CAN message was
+ * received until the interface takes it out of the send queue.
+ *
+ * sendQueue - the queue the message is in, or NULL if none is being followed.
+ * receivedUs - when the source CAN message was received.
+ * bytesAhead - the bytes left in the queue up to the end of the message.
+ */
+typedef struct {
+    ByteQueue* sendQueue;
+    unsigned long receivedUs;
+    int bytesAhead;
+} LatencySample;
+
+static LatencySample latencySamples[PIPELINE_ENDPOINT_COUNT];
+static unsigned int latencyHistograms[PIPELINE_ENDPOINT_COUNT][
+        PIPELINE_LATENCY_BUCKET_COUNT];
+#endif
+
+static uint8_t rateLimitedEndpoints = DEFAULT_RATE_LIMITED_ENDPOINTS;
+static float currentRateScale = 1;
+static unsigned long lastRateLimitUpdate;
+static unsigned int rateLimitDrops[PIPELINE_ENDPOINT_COUNT];
+
+// Bytes of each send queue that a message class must leave free for higher
+// priority classes, indexed by MessageClass. Under pressure, bulk CAN
+// passthrough is shed first, then simple messages, while diagnostic and
+// command responses may use the whole queue. Log messages only go to their own
+// USB endpoint queue, so they don't need to leave any room.
+static const int RESERVED_QUEUE_SPACE[MESSAGE_CLASS_COUNT] = {
+    PIPELINE_PRIORITY_RESERVE,      // SIMPLE
+    2 * PIPELINE_PRIORITY_RESERVE,  // CAN
+    0,                              // DIAGNOSTIC
+    0,                              // LOG
+    0,                              // COMMAND_RESPONSE
+};
+
+// The endpoints, for each message class, whose send queues were still too full
+// after a flush during this pass of the main loop, as ENDPOINT_FLAG()s. They
+// aren't flushed or serialized for again until the next
+// openxc::pipeline::process().
+static uint8_t backedUpEndpoints[MESSAGE_CLASS_COUNT];
+
+static bool fitsForClass(ByteQueue* sendQueue, uint8_t* message,
+        int messageSize, MessageClass messageClass) {
+    return messageFits(sendQueue, message,
+            messageSize + RESERVED_QUEUE_SPACE[messageClass]);
+}
+
+/* Private: Returns a bitfield of ENDPOINT_FLAG()s for the endpoints whose
+ * routes accept the message.
+ */
+static uint8_t routedEndpoints(MessageClass messageClass, const char* name) {
+    uint8_t endpoints = 0;
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        if(openxc::pipeline::routed((InterfaceType) i, messageClass, name)) {
+            endpoints |= ENDPOINT_FLAG(i);
+        }
+    }
+    return endpoints;
+}
+
+static uint8_t attachedEndpoints(Pipeline* pipeline);
+static uint8_t connectedEndpoints(Pipeline* pipeline);
+
+/* Private: Returns the position of a SIMPLE message name in a route's signal
+ * filter, or -1 if it isn't there.
+ */
+static int routeSignalIndex(const Route* route, const char* name) {
+    for(int i = 0; i < route->signalCount; i++) {
+        if(route->signals[i] == name || !strcmp(route->signals[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Private: Returns the subset of the endpoints bitfield whose route rate lets
+ * a signal through now, ticking the signal's clock in each of them.
+ */
+static uint8_t dueEndpoints(uint8_t endpoints, const char* name) {
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        Route* route = &routes[i];
+        if(!(endpoints & ENDPOINT_FLAG(i)) || route->frequency == 0) {
+            continue;
+        }
+
+        int signal = routeSignalIndex(route, name);
+        if(signal != -1 && !time::conditionalTick(&route->clocks[signal])) {
+            endpoints &= ~ENDPOINT_FLAG(i);
+        }
+    }
+    return endpoints;
+}
+
+/* Private: Returns the endpoints that will take a message right now - routed
+ * for it, connected, not backed up and, for a signal, due under the route's
+ * rate. The message is counted as dropped for ones that would take it if they
+ * weren't backed up.
+ */
+static uint8_t availableEndpoints(Pipeline* pipeline,
+        MessageClass messageClass, const char* name) {
+    uint8_t endpoints = routedEndpoints(messageClass, name) &
+            connectedEndpoints(pipeline);
+    uint8_t backedUp = endpoints & backedUpEndpoints[messageClass];
+    if(backedUp != 0) {
+        for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+            if(backedUp & ENDPOINT_FLAG(i)) {
+                ++droppedMessages[i][messageClass];
+            }
+        }
+    }
+    endpoints &= ~backedUp;
+    if(messageClass == MessageClass::SIMPLE && name != NULL &&
+            endpoints != 0) {
+        endpoints = dueEndpoints(endpoints, name);
+    }
+    return endpoints;
+}
+
+/* Private: Returns the subset of the endpoints bitfield that is serialized
+ * with the given format.
+ */
+static uint8_t endpointsUsingFormat(uint8_t endpoints, PayloadFormat format) {
+    uint8_t matching = 0;
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        if((endpoints & ENDPOINT_FLAG(i)) &&
+                openxc::pipeline::payloadFormat((InterfaceType) i) == format) {
+            matching |= ENDPOINT_FLAG(i);
+        }
+    }
+    return matching;
+}
+
+/* Private: Mark an endpoint as backed up for a message class, and for every
+ * class that has to leave at least as much of the queue free.
+ */
+static void markBackedUp(InterfaceType endpoint, MessageClass messageClass) {
+    for(int i = 0; i < MESSAGE_CLASS_COUNT; i++) {
+        if(RESERVED_QUEUE_SPACE[i] >= RESERVED_QUEUE_SPACE[messageClass]) {
+            backedUpEndpoints[i] |= ENDPOINT_FLAG(endpoint);
+        }
+    }
+}
+
+static void processEndpoints(Pipeline* pipeline);
+static void closeBatch(int endpoint);
+
+/* Private: Make room for the message in the send queue if it's full, without
+ * blocking.
+ *
+ * The interfaces are flushed at most once. If that doesn't free enough space,
+ * the consumer isn't keeping up - instead of retrying, the endpoint is marked
+ * as backed up for the rest of this pass of the main loop, so CAN receive and
+ * diagnostics aren't held up waiting on it.
+ */
+void conditionalFlush(Pipeline* pipeline, InterfaceType endpoint,
+        ByteQueue* sendQueue, uint8_t* message, int messageSize,
+        MessageClass messageClass) {
+    // Don't process every interface for a message that won't fit even in an
+    // empty queue.
+    if(!openxc::util::bytebuffer::messageCanFit(sendQueue,
+                messageSize + RESERVED_QUEUE_SPACE[messageClass]) ||
+            fitsForClass(sendQueue, message, messageSize, messageClass) ||
+            (backedUpEndpoints[messageClass] & ENDPOINT_FLAG(endpoint))) {
+        return;
+    }
+
+    // the open batch can't be held back any longer if the queue is full
+    closeBatch(endpoint);
+    processEndpoints(pipeline);
+    if(!fitsForClass(sendQueue, message, messageSize, messageClass)) {
+        markBackedUp(endpoint, messageClass);
+    }
+}
+
+static uint8_t batchLimit(int endpoint) {
+    if(endpoint == InterfaceType::TELIT) {
+        return 1;
     }
+    return batches[endpoint].configured ? batches[endpoint].maxMessages :
+            PIPELINE_BATCH_MAX_MESSAGES;
+}
+
+static unsigned int batchDelay(int endpoint) {
+    return batches[endpoint].configured ? batches[endpoint].maxDelayMs :
+            PIPELINE_BATCH_MAX_DELAY_MS;
+}
+
+/* Private: Finish the endpoint's open batch, if it has one, so it's sent with
+ * the next flush. There's always room for the footer, as every message added
+ * to a batch leaves space for it.
+ */
+static void closeBatch(int endpoint) {
+    Batch* batch = &batches[endpoint];
+    if(batch->count == 0) {
+        return;
+    }
+
+    if(batch->container) {
+        openxc::util::bytebuffer::pushBytes(batch->queue, BATCH_FOOTER,
+                BATCH_FOOTER_SIZE);
+    }
+    batch->count = 0;
+    batch->queue = NULL;
+}
+
+/* Private: Add a message to the endpoint's open batch, starting a new one if
+ * there's none or the message doesn't fit in the open one.
+ *
+ * Returns true if the message was queued.
+ */
+static bool addToBatch(InterfaceType endpoint, ByteQueue* sendQueue,
+        uint8_t* message, int messageSize, MessageClass messageClass) {
+    Batch* batch = &batches[endpoint];
+    if(batch->count > 0 && batch->queue != sendQueue) {
+        closeBatch(endpoint);
+    }
+
+    bool container = batch->count > 0 ? batch->container :
+            openxc::pipeline::payloadFormat(endpoint) == PayloadFormat::JSON;
+    if(container && messageSize > 0 && message[messageSize - 1] == '\0') {
+        // the container is delimited as a whole
+        --messageSize;
+    }
+
+    int framing = 0;
+    if(container) {
+        framing = (batch->count > 0 ? 1 : BATCH_HEADER_SIZE) +
+                BATCH_FOOTER_SIZE;
+    }
+    if(batch->count > 0 && !fitsForClass(sendQueue, message,
+                messageSize + framing, messageClass)) {
+        closeBatch(endpoint);
+        if(container) {
+            framing = BATCH_HEADER_SIZE + BATCH_FOOTER_SIZE;
+        }
+    }
+
+    if(!fitsForClass(sendQueue, message, messageSize + framing,
+                messageClass)) {
+        return false;
+    }
+
+    if(batch->count == 0) {
+        batch->container = container;
+        batch->openedAt = time::systemTimeMs();
+        batch->queue = sendQueue;
+        if(container) {
+            openxc::util::bytebuffer::pushBytes(sendQueue,
+                    (const uint8_t*) BATCH_HEADER, BATCH_HEADER_SIZE);
+        }
+    } else if(container) {
+        BYTE_QUEUE_PUSH(sendQueue, (uint8_t) ',');
+    }
+    openxc::util::bytebuffer::pushBytes(sendQueue, message, messageSize);
+
+    if(++batch->count >= batchLimit(endpoint)) {
+        closeBatch(endpoint);
+    }
+    return true;
+}
+
+/* Private: Start following a message that was just added to the end of an
+ * endpoint's send queue, if it came from a CAN message and no other message is
+ * being followed on the endpoint.
+ */
+static void startLatencySample(InterfaceType endpoint,
+        ByteQueue* sendQueue) {
+    #if METRICS_SUPPORT
+    LatencySample* sample = &latencySamples[endpoint];
+    if(messageReceivedUs == 0 || sample->sendQueue != NULL) {
+        return;
+    }
+
+    sample->sendQueue = sendQueue;
+    sample->receivedUs = messageReceivedUs;
+    sample->bytesAhead = BYTE_QUEUE_LENGTH(sendQueue);
+    #endif
+}
+
+/* Private: Count what the interfaces took from the followed messages' queues,
+ * and add the latency of each message that's now been taken to its endpoint's
+ * histogram.
+ *
+ * queuedBefore - the length of each followed message's queue before the
+ *      interfaces were processed.
+ */
+#if METRICS_SUPPORT
+static void finishLatencySamples(const int* queuedBefore) {
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        LatencySample* sample = &latencySamples[i];
+        if(sample->sendQueue == NULL) {
+            continue;
+        }
+
+        sample->bytesAhead -= queuedBefore[i] -
+                BYTE_QUEUE_LENGTH(sample->sendQueue);
+        if(sample->bytesAhead <= 0) {
+            unsigned long latencyUs = time::systemTimeUs() -
+                    sample->receivedUs;
+            int bucket = 0;
+            while(bucket < PIPELINE_LATENCY_BUCKET_COUNT - 1 &&
+                    (latencyUs >> (PIPELINE_LATENCY_FIRST_BUCKET_SHIFT +
+                            bucket)) > 0) {
+                ++bucket;
+            }
+            ++latencyHistograms[i][bucket];
+            sample->sendQueue = NULL;
+        }
+    }
+}
+#endif
+
+bool openxc::pipeline::getLatencyHistogram(InterfaceType endpoint,
+        unsigned int* buckets) {
+    #if METRICS_SUPPORT
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+    memcpy(buckets, latencyHistograms[endpoint],
+            sizeof(latencyHistograms[endpoint]));
+    return true;
+    #else
+    return false;
+    #endif
 }
 
 void sendToEndpoint(openxc::interface::InterfaceType endpointType,
-        QUEUE_TYPE(uint8_t)* sendQueue, QUEUE_TYPE(uint8_t)* receiveQueue,
-        uint8_t* message, int messageSize) {
-    if(!conditionalEnqueue(sendQueue, message, messageSize)) {
-        ++droppedMessages[endpointType];
+        ByteQueue* sendQueue, ByteQueue* receiveQueue,
+        uint8_t* message, int messageSize, MessageClass messageClass) {
+    bool queued;
+    if(batchLimit(endpointType) > 1 && (messageClass == MessageClass::SIMPLE ||
+                messageClass == MessageClass::CAN)) {
+        queued = addToBatch(endpointType, sendQueue, message, messageSize,
+                messageClass);
+    } else {
+        // Keep everything else in order with the batched messages, but don't
+        // hold it back
+        closeBatch(endpointType);
+        queued = fitsForClass(sendQueue, message, messageSize, messageClass) &&
+                conditionalEnqueue(sendQueue, message, messageSize);
+        if(queued) {
+            startLatencySample(endpointType, sendQueue);
+        }
+    }
+
+    if(!queued) {
+        ++droppedMessages[endpointType][messageClass];
     } else {
         ++sentMessages[endpointType];
         dataSent[endpointType] += messageSize;
     }
-    sendQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, sendQueue);
+    sendQueueLength[endpointType] = BYTE_QUEUE_LENGTH(sendQueue);
+    sendQueueCapacity[endpointType] = BYTE_QUEUE_CAPACITY(sendQueue);
+    sendQueuePeak[endpointType] = MAX(sendQueuePeak[endpointType],
+            sendQueueLength[endpointType]);
     // TODO This may not belong here after USB refactoring
-    receiveQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, receiveQueue);
+    if(receiveQueue != NULL) {
+        receiveQueueLength[endpointType] = BYTE_QUEUE_LENGTH(receiveQueue);
+        receiveQueueCapacity[endpointType] = BYTE_QUEUE_CAPACITY(receiveQueue);
+        receiveQueuePeak[endpointType] = MAX(receiveQueuePeak[endpointType],
+                receiveQueueLength[endpointType]);
+    }
 }
 
-void sendToUsb(Pipeline* pipeline, uint8_t* message, int messageSize,
+/* Private: The send functions queue a message on one endpoint. They're only
+ * called for endpoints that are connected, and skip the message classes the
+ * endpoint doesn't take.
+ */
+static void sendToUsb(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass) {
-    if(pipeline->usb->configured) {
-        QUEUE_TYPE(uint8_t)* sendQueue;
-        if(messageClass == MessageClass::LOG) {
-            sendQueue = &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].queue;
-            if(config::getConfiguration()->loggingOutput !=
-                        LoggingOutputInterface::BOTH &&
-                    config::getConfiguration()->loggingOutput !=
-                        LoggingOutputInterface::USB) {
-                return;
-            }
-        } else {
-            sendQueue = &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue;
+    ByteQueue* sendQueue;
+    if(messageClass == MessageClass::LOG) {
+        sendQueue = &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].queue;
+        if(config::getConfiguration()->loggingOutput !=
+                    LoggingOutputInterface::BOTH &&
+                config::getConfiguration()->loggingOutput !=
+                    LoggingOutputInterface::USB) {
+            return;
         }
-
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->usb->descriptor.type, sendQueue,
-                &pipeline->usb->endpoints[OUT_ENDPOINT_INDEX].queue,
-                message, messageSize);
+    } else {
+        sendQueue = &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue;
     }
+
+    conditionalFlush(pipeline, InterfaceType::USB, sendQueue, message,
+            messageSize, messageClass);
+    sendToEndpoint(pipeline->usb->descriptor.type, sendQueue,
+            &pipeline->usb->endpoints[OUT_ENDPOINT_INDEX].queue,
+            message, messageSize, messageClass);
 }
 
-void sendToUart(Pipeline* pipeline, uint8_t* message, int messageSize,
+static void sendToUart(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass) {
-    if(uart::connected(pipeline->uart) && messageClass != MessageClass::LOG) {
-		//if(uart::connected(pipeline->uart)) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->uart->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->uart->descriptor.type, sendQueue,
-                &pipeline->uart->receiveQueue, message, messageSize);
+    if(messageClass == MessageClass::LOG) {
+        return;
     }
+
+    uint8_t frame[messageSize + CHECKED_FRAME_OVERHEAD];
+    if(uart::frameType(openxc::pipeline::payloadFormat(
+                    InterfaceType::UART)) == FrameType::CHECKED) {
+        messageSize = wrapCheckedFrame(message, messageSize, frame,
+                sizeof(frame));
+        message = frame;
+    }
+
+    ByteQueue* sendQueue = &pipeline->uart->sendQueue;
+    conditionalFlush(pipeline, InterfaceType::UART, sendQueue, message,
+            messageSize, messageClass);
+    sendToEndpoint(pipeline->uart->descriptor.type, sendQueue,
+            &pipeline->uart->receiveQueue, message,
+            messageSize, messageClass);
 }
 
 #ifdef TELIT_HE910_SUPPORT
-void sendToTelit(Pipeline* pipeline, uint8_t* message, int messageSize,
+static void sendToTelit(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass) {
-    if(openxc::telitHE910::connected(pipeline->telit) && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->telit->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->telit->descriptor.type, sendQueue, &pipeline->telit->receiveQueue, message,
-                messageSize);
-    }
     // removed UART logging from the telit
+    if(messageClass == MessageClass::LOG) {
+        return;
+    }
+
+    ByteQueue* sendQueue = &pipeline->telit->sendQueue;
+    conditionalFlush(pipeline, InterfaceType::TELIT, sendQueue, message,
+            messageSize, messageClass);
+    sendToEndpoint(pipeline->telit->descriptor.type, sendQueue,
+            &pipeline->telit->receiveQueue, message, messageSize,
+            messageClass);
 }
 #endif
 
 #ifdef BLE_SUPPORT
-void sendToBle(Pipeline* pipeline, uint8_t* message, int messageSize,
+static void sendToBle(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass) {
-        
-    if(ble::connected(pipeline->ble) && messageClass != MessageClass::LOG) { //TODO add a characteristic for sending debug notification messages
-        QUEUE_TYPE(uint8_t)* sendQueue = (QUEUE_TYPE(uint8_t)* )&pipeline->ble->sendQueue;
-        conditionalFlush(pipeline,sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->ble->descriptor.type, sendQueue,(QUEUE_TYPE(uint8_t)* )&pipeline->ble->receiveQueue, message,
-                messageSize);
+    //TODO add a characteristic for sending debug notification messages
+    if(messageClass == MessageClass::LOG) {
+        return;
+    }
+
+    ble::BleChannel channel;
+    switch(messageClass) {
+    case MessageClass::CAN:
+        channel = ble::BleChannel::CAN_CHANNEL;
+        break;
+    case MessageClass::DIAGNOSTIC:
+        channel = ble::BleChannel::DIAGNOSTIC_CHANNEL;
+        break;
+    case MessageClass::COMMAND_RESPONSE:
+        channel = ble::BleChannel::COMMAND_RESPONSE_CHANNEL;
+        break;
+    default:
+        channel = ble::BleChannel::SIMPLE_CHANNEL;
+        break;
     }
 
+    ByteQueue* sendQueue = ble::channelSendQueue(pipeline->ble,
+            channel);
+    conditionalFlush(pipeline, InterfaceType::BLE, sendQueue, message,
+            messageSize, messageClass);
+    sendToEndpoint(pipeline->ble->descriptor.type, sendQueue,
+            &pipeline->ble->receiveQueue, message,
+            messageSize, messageClass);
 }
 #endif
+
 #ifdef FS_SUPPORT
-void sendToFS(Pipeline* pipeline, uint8_t* message, int messageSize,
+static void sendToFS(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass) {
-    if(fs::connected(pipeline->fs) && messageClass != MessageClass::LOG
-                    && messageClass != MessageClass::COMMAND_RESPONSE
-    ) { 
-        QUEUE_TYPE(uint8_t)* sendQueue = (QUEUE_TYPE(uint8_t)* )&pipeline->fs->sendQueue;
-        conditionalFlush(pipeline,sendQueue, message, messageSize);
-        openxc::interface::InterfaceType endpointType = pipeline->fs->descriptor.type;
-        if(!conditionalEnqueue(sendQueue, message, messageSize)) {
-            ++droppedMessages[endpointType];
-        } else {
-        ++sentMessages[endpointType];
-        dataSent[endpointType] += messageSize;
-        }
-        sendQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, sendQueue);
+    if(messageClass == MessageClass::LOG ||
+            messageClass == MessageClass::COMMAND_RESPONSE) {
+        return;
     }
+
+    ByteQueue* sendQueue = &pipeline->fs->sendQueue;
+    conditionalFlush(pipeline, InterfaceType::FS, sendQueue, message,
+            messageSize, messageClass);
+    // the FS device has no receive queue
+    sendToEndpoint(pipeline->fs->descriptor.type, sendQueue, NULL,
+            message, messageSize, messageClass);
 }
 #endif
 
+static void sendToNetwork(Pipeline* pipeline, uint8_t* message,
+        int messageSize, MessageClass messageClass) {
+    if(messageClass == MessageClass::LOG) {
+        return;
+    }
 
-void sendToNetwork(Pipeline* pipeline, uint8_t* message, int messageSize,
-        MessageClass messageClass) {
-    if(pipeline->network != NULL && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->network->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->network->descriptor.type, sendQueue,
-                &pipeline->network->receiveQueue, message, messageSize);
+    ByteQueue* sendQueue = &pipeline->network->sendQueue;
+    conditionalFlush(pipeline, InterfaceType::NETWORK, sendQueue, message,
+            messageSize, messageClass);
+    sendToEndpoint(pipeline->network->descriptor.type, sendQueue,
+            &pipeline->network->receiveQueue, message,
+            messageSize, messageClass);
+}
+
+static bool usbAttached(Pipeline* pipeline) {
+    return pipeline->usb != NULL && pipeline->usb->configured;
+}
+
+static ByteQueue* usbSendQueue(Pipeline* pipeline) {
+    return &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue;
+}
+
+static void processUsb(Pipeline* pipeline) {
+    // Must always process USB, because this function usually runs the MCU's
+    // USB task that handles SETUP and enumeration.
+    usb::processSendQueue(pipeline->usb);
+}
+
+static bool uartAttached(Pipeline* pipeline) {
+    #if defined TELIT_HE910_SUPPORT || defined BLE_SUPPORT
+    // the UART is only used for debug logging alongside the radio
+    return false;
+    #else
+    return pipeline->uart != NULL;
+    #endif
+}
+
+static bool uartConnected(Pipeline* pipeline) {
+    return uart::connected(pipeline->uart);
+}
+
+static ByteQueue* uartSendQueue(Pipeline* pipeline) {
+    return &pipeline->uart->sendQueue;
+}
+
+static void processUart(Pipeline* pipeline) {
+    #ifndef UART_LOGGING_DISABLE
+    if(uart::connected(pipeline->uart) &&
+            batches[InterfaceType::UART].count == 0) {
+        uart::processSendQueue(pipeline->uart);
+    }
+    #endif
+}
+
+#ifdef TELIT_HE910_SUPPORT
+static bool telitAttached(Pipeline* pipeline) {
+    return pipeline->telit != NULL;
+}
+
+static bool telitConnected(Pipeline* pipeline) {
+    return openxc::telitHE910::connected(pipeline->telit);
+}
+
+static ByteQueue* telitSendQueue(Pipeline* pipeline) {
+    return &pipeline->telit->sendQueue;
+}
+
+static void processTelit(Pipeline* pipeline) {
+    if(openxc::telitHE910::connected(pipeline->telit)) {
+        openxc::telitHE910::processSendQueue(pipeline->telit);
+    }
+}
+#endif
+
+#ifdef BLE_SUPPORT
+static bool bleAttached(Pipeline* pipeline) {
+    return pipeline->ble != NULL;
+}
+
+static bool bleConnected(Pipeline* pipeline) {
+    return ble::connected(pipeline->ble);
+}
+
+static ByteQueue* bleSendQueue(Pipeline* pipeline) {
+    return &pipeline->ble->sendQueue;
+}
+
+static void processBle(Pipeline* pipeline) {
+    if(ble::connected(pipeline->ble) &&
+            batches[InterfaceType::BLE].count == 0) {
+        ble::processSendQueue(pipeline->ble);
+    }
+}
+#endif
+
+#ifdef FS_SUPPORT
+static bool fsAttached(Pipeline* pipeline) {
+    // a raw CAN log holds only binary CAN records, no OpenXC messages
+    return pipeline->fs != NULL && !pipeline->fs->rawCanLog;
+}
+
+static bool fsConnected(Pipeline* pipeline) {
+    return fs::connected(pipeline->fs);
+}
+
+static ByteQueue* fsSendQueue(Pipeline* pipeline) {
+    return &pipeline->fs->sendQueue;
+}
+
+static void processFs(Pipeline* pipeline) {
+    if(fs::connected(pipeline->fs) && batches[InterfaceType::FS].count == 0) {
+        fs::processSendQueue(pipeline->fs);
+    }
+}
+#endif
+
+static bool networkAttached(Pipeline* pipeline) {
+    return pipeline->network != NULL;
+}
+
+static ByteQueue* networkSendQueue(Pipeline* pipeline) {
+    return pipeline->network != NULL ? &pipeline->network->sendQueue : NULL;
+}
+
+static void processNetwork(Pipeline* pipeline) {
+    if(pipeline->network != NULL &&
+            batches[InterfaceType::NETWORK].count == 0) {
+       network::processSendQueue(pipeline->network);
+    }
+}
+
+/* Private: The operations of an output endpoint in this build.
+ *
+ * type - the endpoint.
+ * attached - returns true if the pipeline has a device for the endpoint that
+ *      takes OpenXC messages.
+ * connected - returns true if an attached endpoint can be sent to now, or
+ *      NULL if it always can.
+ * send - queues a message on the endpoint.
+ * process - flushes the send queue out to the interface, if it's connected and
+ *      not holding an open batch.
+ * sendQueue - returns the endpoint's send queue.
+ */
+typedef struct {
+    InterfaceType type;
+    bool (*attached)(Pipeline*);
+    bool (*connected)(Pipeline*);
+    void (*send)(Pipeline*, uint8_t*, int, MessageClass);
+    void (*process)(Pipeline*);
+    ByteQueue* (*sendQueue)(Pipeline*);
+} Endpoint;
+
+// Every endpoint compiled in, in the order messages are sent to them. Add an
+// entry here for a new output.
+static const Endpoint ENDPOINTS[] = {
+    {InterfaceType::USB, usbAttached, NULL, sendToUsb, processUsb,
+        usbSendQueue},
+    #ifdef TELIT_HE910_SUPPORT
+    {InterfaceType::TELIT, telitAttached, telitConnected, sendToTelit,
+        processTelit, telitSendQueue},
+    #endif
+    #ifdef BLE_SUPPORT
+    {InterfaceType::BLE, bleAttached, bleConnected, sendToBle, processBle,
+        bleSendQueue},
+    #endif
+    {InterfaceType::UART, uartAttached, uartConnected, sendToUart,
+        processUart, uartSendQueue},
+    #ifdef FS_SUPPORT
+    {InterfaceType::FS, fsAttached, fsConnected, sendToFS, processFs,
+        fsSendQueue},
+    #endif
+    {InterfaceType::NETWORK, networkAttached, NULL, sendToNetwork,
+        processNetwork, networkSendQueue},
+};
+
+#define ENDPOINT_COUNT ((int) (sizeof(ENDPOINTS) / sizeof(ENDPOINTS[0])))
+
+/* Private: Returns a bitfield of ENDPOINT_FLAG()s for the endpoints this build
+ * sends to and the pipeline has a device for, whether or not they're
+ * connected.
+ */
+static uint8_t attachedEndpoints(Pipeline* pipeline) {
+    uint8_t endpoints = 0;
+    for(int i = 0; i < ENDPOINT_COUNT; i++) {
+        if(ENDPOINTS[i].attached(pipeline)) {
+            endpoints |= ENDPOINT_FLAG(ENDPOINTS[i].type);
+        }
+    }
+    return endpoints;
+}
+
+/* Private: Returns a bitfield of ENDPOINT_FLAG()s for the attached endpoints
+ * that are connected. Messages are only serialized and queued for these, so
+ * the send functions don't check again.
+ */
+static uint8_t connectedEndpoints(Pipeline* pipeline) {
+    uint8_t endpoints = 0;
+    for(int i = 0; i < ENDPOINT_COUNT; i++) {
+        const Endpoint* endpoint = &ENDPOINTS[i];
+        if(endpoint->attached(pipeline) && (endpoint->connected == NULL ||
+                    endpoint->connected(pipeline))) {
+            endpoints |= ENDPOINT_FLAG(endpoint->type);
+        }
+    }
+    return endpoints;
+}
+
+void openxc::pipeline::setReceiveTime(unsigned long receivedUs) {
+    messageReceivedUs = receivedUs;
+}
+
+bool openxc::pipeline::currentTimestamp(uint64_t* timestamp) {
+    uint64_t timeUs;
+    if(!wallclock::now(&timeUs)) {
+        #ifdef RTC_SUPPORT
+        // Until the wall clock has its first RTC reading
+        timeUs = syst.tm * 1000;
+        #elif defined TELIT_HE910_SUPPORT
+        timeUs = (uint64_t) uptimeMs() * 1000;
+        #else
+        return false;
+        #endif
+    }
+
+    if(messageReceivedUs != 0) {
+        unsigned long ageUs = openxc::util::time::systemTimeUs() -
+                messageReceivedUs;
+        if(timeUs >= ageUs) {
+            timeUs -= ageUs;
+        }
+    }
+    *timestamp = timeUs / 1000;
+    return true;
+}
+
+/* Private: Queue the message on the endpoints in the endpoints bitfield, which
+ * must all be connected.
+ */
+static void sendToEndpoints(Pipeline* pipeline, uint8_t* message,
+        int messageSize, MessageClass messageClass, uint8_t endpoints) {
+    for(int i = 0; i < ENDPOINT_COUNT && endpoints != 0; i++) {
+        uint8_t flag = ENDPOINT_FLAG(ENDPOINTS[i].type);
+        if(endpoints & flag) {
+            ENDPOINTS[i].send(pipeline, message, messageSize, messageClass);
+            endpoints &= ~flag;
+        }
+    }
+}
+
+/* Private: Returns the send queue of an endpoint, or NULL if it doesn't have
+ * one in this build.
+ */
+static ByteQueue* endpointSendQueue(Pipeline* pipeline,
+        InterfaceType endpoint) {
+    for(int i = 0; i < ENDPOINT_COUNT; i++) {
+        if(ENDPOINTS[i].type == endpoint) {
+            return ENDPOINTS[i].sendQueue(pipeline);
+        }
+    }
+    return NULL;
+}
+
+/* Private: Returns the open columnar block of an endpoint, or NULL if it can't
+ * send blocks in this build. Only the endpoints that can send them take up RAM
+ * for one.
+ */
+static ColumnarBatch* columnarBatch(int endpoint) {
+    #ifdef TELIT_HE910_SUPPORT
+    static ColumnarBatch telitBatch;
+    if(endpoint == InterfaceType::TELIT) {
+        return &telitBatch;
+    }
+    #endif
+    #ifdef FS_SUPPORT
+    static ColumnarBatch fsBatch;
+    if(endpoint == InterfaceType::FS) {
+        return &fsBatch;
+    }
+    #endif
+    return NULL;
+}
+
+/* Private: Send an endpoint's open columnar block, if it has one, and start a
+ * new one. The block is dropped if the endpoint isn't connected any more.
+ */
+static void closeColumnarBatch(Pipeline* pipeline, int endpoint) {
+    ColumnarBatch* batch = columnarBatch(endpoint);
+    if(batch == NULL || columnar::empty(batch)) {
+        return;
+    }
+
+    uint8_t flag = ENDPOINT_FLAG(endpoint);
+    if(connectedEndpoints(pipeline) & flag) {
+        uint8_t payload[COLUMNAR_RECORD_SIZE];
+        int length = columnar::serialize(batch, payload, sizeof(payload),
+                openxc::pipeline::payloadFormat((InterfaceType) endpoint));
+        if(length > 0) {
+            sendToEndpoints(pipeline, payload, length, MessageClass::SIMPLE,
+                    flag);
+        }
+    } else {
+        ++droppedMessages[endpoint][MessageClass::SIMPLE];
+    }
+    columnar::reset(batch);
+}
+
+/* Private: Add a signal's value to the open columnar block of each endpoint in
+ * the bitfield that sends blocks, sending the block first if it's full.
+ *
+ * Returns the endpoints that still need the value sent as a record.
+ */
+static uint8_t addToColumnarBatches(Pipeline* pipeline, uint8_t endpoints,
+        uint16_t signalId, float resolution, float value) {
+    uint8_t columnarTargets = endpoints & columnarEndpoints;
+    if(columnarTargets == 0) {
+        return endpoints;
+    }
+
+    uint64_t timestamp;
+    if(!currentTimestamp(&timestamp)) {
+        timestamp = time::systemTimeMs();
+    }
+
+    unsigned long now = time::systemTimeMs();
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT && columnarTargets != 0; i++) {
+        uint8_t flag = ENDPOINT_FLAG(i);
+        if(!(columnarTargets & flag)) {
+            continue;
+        }
+        columnarTargets &= ~flag;
+
+        ColumnarBatch* batch = columnarBatch(i);
+        if(columnar::empty(batch)) {
+            columnarOpenedAt[i] = now;
+        }
+        if(!columnar::add(batch, signalId, resolution, timestamp, value)) {
+            // If it doesn't fit in a new block either, it can't be sent in
+            // one at all and goes as a record
+            if(columnar::empty(batch)) {
+                continue;
+            }
+            closeColumnarBatch(pipeline, i);
+            columnarOpenedAt[i] = now;
+            if(!columnar::add(batch, signalId, resolution, timestamp,
+                        value)) {
+                continue;
+            }
+        }
+        endpoints &= ~flag;
+    }
+    return endpoints;
+}
+
+bool openxc::pipeline::sendQueuesEmpty(Pipeline* pipeline) {
+    uint8_t endpoints = attachedEndpoints(pipeline);
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        ColumnarBatch* batch = columnarBatch(i);
+        if(batch != NULL && !columnar::empty(batch)) {
+            return false;
+        }
+
+        if(endpoints & ENDPOINT_FLAG(i)) {
+            ByteQueue* sendQueue = endpointSendQueue(pipeline,
+                    (InterfaceType) i);
+            if(sendQueue != NULL && !BYTE_QUEUE_EMPTY(sendQueue)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Private: Send a message to one endpoint with its timestamp as a delta from
+ * the base record at the start of the endpoint's send queue.
+ *
+ * Whatever is in a send queue goes out together, so a queue that's empty (or
+ * that has only been flushed since the base was written) starts a new frame,
+ * and a base record is queued first. The message's own timestamp is put back
+ * before returning.
+ */
+static void sendWithTimestampDelta(openxc_VehicleMessage* message,
+        MessageClass messageClass, InterfaceType endpoint, Pipeline* pipeline,
+        uint8_t payload[], size_t payloadSize) {
+    ByteQueue* sendQueue = endpointSendQueue(pipeline, endpoint);
+    PayloadFormat format = openxc::pipeline::payloadFormat(endpoint);
+    uint64_t timestamp = message->timestamp;
+    uint8_t flag = ENDPOINT_FLAG(endpoint);
+
+    if(sendQueue != NULL && !BYTE_QUEUE_EMPTY(sendQueue) &&
+            (timestampBasedEndpoints & flag) &&
+            timestamp >= timestampBases[endpoint]) {
+        message->timestamp = timestamp - timestampBases[endpoint];
+        size_t length = openxc::payload::serialize(message, payload,
+                payloadSize, format);
+        // Make room now if the message needs it - if that empties the queue,
+        // the base went out with it and a new one is needed
+        conditionalFlush(pipeline, endpoint, sendQueue, payload, length,
+                messageClass);
+        if(!BYTE_QUEUE_EMPTY(sendQueue)) {
+            sendToEndpoints(pipeline, payload, length, messageClass, flag);
+            message->timestamp = timestamp;
+            return;
+        }
+    }
+
+    timestampBasedEndpoints &= ~flag;
+    if(sendQueue != NULL) {
+        openxc_VehicleMessage base = {0};
+        base.has_timestamp = true;
+        base.timestamp = timestamp;
+        size_t length = openxc::payload::serialize(&base, payload,
+                payloadSize, format);
+        sendToEndpoints(pipeline, payload, length, MessageClass::SIMPLE, flag);
+        if(!BYTE_QUEUE_EMPTY(sendQueue)) {
+            timestampBasedEndpoints |= flag;
+            timestampBases[endpoint] = timestamp;
+            message->timestamp = 0;
+        }
+    }
+
+    // Without a base, the message keeps its absolute timestamp
+    size_t length = openxc::payload::serialize(message, payload, payloadSize,
+            format);
+    sendToEndpoints(pipeline, payload, length, messageClass, flag);
+    message->timestamp = timestamp;
+}
+
+/* Private: Serialize the message once for each payload format used by the
+ * endpoints in the bitfield, and queue each payload on the endpoints that use
+ * its format.
+ *
+ * The formats are produced one after another in the same buffer, instead of
+ * all at once, to keep the stack use of a publish the same as with a single
+ * global format.
+ */
+static void serializeAndSend(openxc_VehicleMessage* message,
+        MessageClass messageClass, uint8_t endpoints, Pipeline* pipeline) {
+    // The serializers report how much of the buffer they used, so there's no
+    // need to clear it first.
+    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+
+    uint64_t timestamp;
+    if(currentTimestamp(&timestamp)) {
+        message->timestamp = timestamp;
+        message->has_timestamp = true;
+
+        // Endpoints with their own timestamp base each need their own copy
+        uint8_t deltaEndpoints = endpoints & timestampDeltaEndpoints;
+        for(int i = 0; i < PIPELINE_ENDPOINT_COUNT && deltaEndpoints != 0;
+                i++) {
+            if(deltaEndpoints & ENDPOINT_FLAG(i)) {
+                sendWithTimestampDelta(message, messageClass, (InterfaceType) i,
+                        pipeline, payload, sizeof(payload));
+                deltaEndpoints &= ~ENDPOINT_FLAG(i);
+            }
+        }
+        endpoints &= ~timestampDeltaEndpoints;
+    }
+
+    for(int format = 0; format < PAYLOAD_FORMAT_COUNT && endpoints != 0;
+            format++) {
+        uint8_t formatEndpoints = endpointsUsingFormat(endpoints,
+                (PayloadFormat) format);
+        if(formatEndpoints == 0) {
+            continue;
+        }
+        endpoints &= ~formatEndpoints;
+
+        size_t length = openxc::payload::serialize(message, payload,
+                sizeof(payload), (PayloadFormat) format);
+        sendToEndpoints(pipeline, payload, length, messageClass,
+                formatEndpoints);
     }
 }
 
 void openxc::pipeline::publish(openxc_VehicleMessage* message,
         Pipeline* pipeline) {
-    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE] = {0};
-    #ifdef RTC_SUPPORT
-    message->timestamp = syst.tm;
-    message->has_timestamp = true;
-    #elif defined TELIT_HE910_SUPPORT
-    message->timestamp = uptimeMs();
-    message->has_timestamp = true;
-    #endif
-    
-    size_t length = payload::serialize(message, payload, sizeof(payload),
-            config::getConfiguration()->payloadFormat);
     MessageClass messageClass;
     bool matched = false;
     switch(message->type) {
@@ -189,70 +1084,442 @@ void openxc::pipeline::publish(openxc_VehicleMessage* message,
         case openxc_VehicleMessage_Type_CONTROL_COMMAND:
             break;
     }
-    if(matched) {
-        sendMessage(pipeline, payload, length, messageClass);
-    } else {
+    if(!matched) {
         debug("Trying to serialize unrecognized type: %d", message->type);
+        return;
+    }
+
+    const char* name = NULL;
+    if(messageClass == MessageClass::SIMPLE &&
+            message->simple_message.has_name) {
+        name = message->simple_message.name;
+    }
+    // Don't bother serializing a message that no endpoint wants
+    uint8_t endpoints = availableEndpoints(pipeline, messageClass, name);
+    if(endpoints != 0) {
+        serializeAndSend(message, messageClass, endpoints, pipeline);
+    }
+}
+
+/* Private: Publish a simple message as publishedName to the endpoints in the
+ * bitfield. publishedNameLength is its length if it doesn't need escaping in
+ * JSON, or 0 if that isn't known.
+ */
+static void publishSimpleTo(uint8_t endpoints, const char* publishedName,
+        size_t publishedNameLength, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, Pipeline* pipeline) {
+    if(endpoints == 0) {
+        return;
+    }
+
+    uint8_t jsonEndpoints = endpointsUsingFormat(
+            endpoints & ~timestampDeltaEndpoints, PayloadFormat::JSON);
+    if(jsonEndpoints != 0) {
+        uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+        uint64_t timestamp;
+        bool stamped = currentTimestamp(&timestamp);
+        int length = openxc::payload::serializeSimple(publishedName,
+                publishedNameLength, value, event,
+                stamped ? &timestamp : NULL, payload, sizeof(payload),
+                PayloadFormat::JSON);
+        if(length > 0) {
+            sendToEndpoints(pipeline, payload, length, MessageClass::SIMPLE,
+                    jsonEndpoints);
+            endpoints &= ~jsonEndpoints;
+            if(endpoints == 0) {
+                return;
+            }
+        }
+    }
+
+    // The remaining endpoints need a format that's serialized from a complete
+    // message
+
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strncpy(message.simple_message.name, publishedName,
+            sizeof(message.simple_message.name) - 1);
+
+    if(value != NULL) {
+        message.simple_message.has_value = true;
+        message.simple_message.value = *value;
+    }
+
+    if(event != NULL) {
+        message.simple_message.has_event = true;
+        message.simple_message.event = *event;
     }
+
+    serializeAndSend(&message, MessageClass::SIMPLE, endpoints, pipeline);
+}
+
+void openxc::pipeline::publishSimple(const char* name,
+        const openxc_DynamicField* value, const openxc_DynamicField* event,
+        Pipeline* pipeline) {
+    publishSimpleTo(availableEndpoints(pipeline, MessageClass::SIMPLE, name),
+            name, 0, value, event, pipeline);
+}
+
+void openxc::pipeline::publishSignal(const char* name, size_t nameLength,
+        uint16_t signalId, float resolution, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, Pipeline* pipeline) {
+    uint8_t endpoints = availableEndpoints(pipeline, MessageClass::SIMPLE,
+            name);
+    if((endpoints & columnarEndpoints) && event == NULL && value != NULL &&
+            value->type == openxc_DynamicField_Type_NUM) {
+        endpoints = addToColumnarBatches(pipeline, endpoints, signalId,
+                resolution, value->numeric_value);
+    }
+
+    if(endpoints == 0) {
+        return;
+    }
+
+    if(!nameDictionary) {
+        publishSimpleTo(endpoints, name, nameLength, value, event, pipeline);
+        return;
+    }
+
+    // Written back to front, the longest uint16_t is 5 digits
+    char id[6];
+    char* digit = &id[sizeof(id) - 1];
+    *digit = '\0';
+    do {
+        *--digit = '0' + signalId % 10;
+        signalId /= 10;
+    } while(signalId > 0);
+    publishSimpleTo(endpoints, digit, &id[sizeof(id) - 1] - digit, value,
+            event, pipeline);
+}
+
+void openxc::pipeline::setNameDictionary(bool enabled) {
+    nameDictionary = enabled;
+}
+
+bool openxc::pipeline::nameDictionaryEnabled() {
+    return nameDictionary;
 }
 
 void openxc::pipeline::sendMessage(Pipeline* pipeline, uint8_t* message,
         int messageSize, MessageClass messageClass) {
-    sendToUsb(pipeline, message, messageSize, messageClass);
-    #ifdef TELIT_HE910_SUPPORT
-    sendToTelit(pipeline, message, messageSize, messageClass);
-    #elif defined BLE_SUPPORT
-    sendToBle(pipeline, message, messageSize, messageClass);
-    #else
-    //#ifndef FS_SUPPORT //UART shared with RTC, disable
-    sendToUart(pipeline, message, messageSize, messageClass);
-    //#endif
-    #endif
-    #ifdef FS_SUPPORT
-    sendToFS(pipeline, message, messageSize, messageClass);
-    #endif
-    
-    sendToNetwork(pipeline, message, messageSize, messageClass);
+    uint8_t endpoints = routedEndpoints(messageClass, NULL);
+    sendToEndpoints(pipeline, message, messageSize, messageClass,
+            endpoints & connectedEndpoints(pipeline));
 
     if((config::getConfiguration()->loggingOutput == LoggingOutputInterface::BOTH ||
         config::getConfiguration()->loggingOutput == LoggingOutputInterface::UART)
-            && messageClass == MessageClass::LOG) {
+            && messageClass == MessageClass::LOG
+            && (endpoints & ENDPOINT_FLAG(InterfaceType::UART))) {
         openxc::util::log::debugUart((const char*)message);
         openxc::util::log::debugUart("\r\n");
     }
 }
 
+unsigned int openxc::pipeline::droppedMessageCount(InterfaceType endpoint,
+        MessageClass messageClass) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return 0;
+    }
+    return droppedMessages[endpoint][messageClass];
+}
+
+/* Private: Returns the number of messages of every class dropped for the
+ * endpoint.
+ */
+static unsigned int totalDroppedMessages(int endpoint) {
+    unsigned int total = 0;
+    for(int i = 0; i < MESSAGE_CLASS_COUNT; i++) {
+        total += droppedMessages[endpoint][i];
+    }
+    return total;
+}
+
+bool openxc::pipeline::getEndpointMetrics(InterfaceType endpoint,
+        EndpointMetrics* metrics) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    metrics->sent = sentMessages[endpoint];
+    metrics->dropped = totalDroppedMessages(endpoint);
+    metrics->bytesSent = dataSent[endpoint];
+    metrics->sendQueueLength = sendQueueLength[endpoint];
+    metrics->sendQueuePeak = sendQueuePeak[endpoint];
+    metrics->receiveQueuePeak = receiveQueuePeak[endpoint];
+    metrics->sendQueueCapacity = sendQueueCapacity[endpoint];
+    metrics->receiveQueueCapacity = receiveQueueCapacity[endpoint];
+    return true;
+}
+
+bool openxc::pipeline::setRoute(InterfaceType endpoint,
+        uint8_t messageClasses) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    Route* route = &routes[endpoint];
+    route->blockedClasses = ~messageClasses & ALL_MESSAGE_CLASSES;
+    route->signalCount = 0;
+    route->frequency = 0;
+    return true;
+}
+
+bool openxc::pipeline::addRouteSignal(InterfaceType endpoint,
+        const char* name) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT || name == NULL) {
+        return false;
+    }
+
+    Route* route = &routes[endpoint];
+    if(route->signalCount >= PIPELINE_ROUTE_MAX_SIGNALS) {
+        debug("Route for %d is full, can't add %s", endpoint, name);
+        return false;
+    }
+    time::initializeClock(&route->clocks[route->signalCount]);
+    route->clocks[route->signalCount].frequency = route->frequency;
+    route->signals[route->signalCount++] = name;
+    return true;
+}
+
+bool openxc::pipeline::setRouteFrequency(InterfaceType endpoint,
+        float frequency) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    Route* route = &routes[endpoint];
+    route->frequency = frequency;
+    for(int i = 0; i < PIPELINE_ROUTE_MAX_SIGNALS; i++) {
+        time::initializeClock(&route->clocks[i]);
+        route->clocks[i].frequency = frequency;
+    }
+    return true;
+}
+
+bool openxc::pipeline::setPayloadFormat(InterfaceType endpoint,
+        PayloadFormat format) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    routes[endpoint].hasPayloadFormat = true;
+    routes[endpoint].payloadFormat = format;
+    return true;
+}
+
+PayloadFormat openxc::pipeline::payloadFormat(InterfaceType endpoint) {
+    if(endpoint >= 0 && endpoint < PIPELINE_ENDPOINT_COUNT &&
+            routes[endpoint].hasPayloadFormat) {
+        return routes[endpoint].payloadFormat;
+    }
+    return config::getConfiguration()->payloadFormat;
+}
+
+bool openxc::pipeline::setBatching(InterfaceType endpoint,
+        uint8_t maxMessages, unsigned int maxDelayMs) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT ||
+            endpoint == InterfaceType::TELIT) {
+        return false;
+    }
+
+    closeBatch(endpoint);
+    Batch* batch = &batches[endpoint];
+    batch->configured = maxMessages != 0;
+    batch->maxMessages = maxMessages;
+    batch->maxDelayMs = maxDelayMs;
+    return true;
+}
+
+bool openxc::pipeline::setTimestampDeltas(InterfaceType endpoint,
+        bool enabled) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    if(enabled) {
+        timestampDeltaEndpoints |= ENDPOINT_FLAG(endpoint);
+    } else {
+        timestampDeltaEndpoints &= ~ENDPOINT_FLAG(endpoint);
+    }
+    // Whatever's queued now was sent without a base
+    timestampBasedEndpoints &= ~ENDPOINT_FLAG(endpoint);
+    return true;
+}
+
+bool openxc::pipeline::timestampDeltas(InterfaceType endpoint) {
+    return endpoint >= 0 && endpoint < PIPELINE_ENDPOINT_COUNT &&
+            (timestampDeltaEndpoints & ENDPOINT_FLAG(endpoint));
+}
+
+bool openxc::pipeline::setColumnar(InterfaceType endpoint, bool enabled) {
+    if(columnarBatch(endpoint) == NULL) {
+        return false;
+    }
+
+    if(enabled) {
+        columnarEndpoints |= ENDPOINT_FLAG(endpoint);
+    } else {
+        columnarEndpoints &= ~ENDPOINT_FLAG(endpoint);
+    }
+    return true;
+}
+
+bool openxc::pipeline::columnarEnabled(InterfaceType endpoint) {
+    return endpoint >= 0 && endpoint < PIPELINE_ENDPOINT_COUNT &&
+            (columnarEndpoints & ENDPOINT_FLAG(endpoint));
+}
+
+void openxc::pipeline::resetRoutes() {
+    memset(routes, 0, sizeof(routes));
+    timestampDeltaEndpoints = 0;
+    timestampBasedEndpoints = 0;
+    columnarEndpoints = 0;
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        closeBatch(i);
+        batches[i].configured = false;
+    }
+}
+
+bool openxc::pipeline::routed(InterfaceType endpoint,
+        MessageClass messageClass, const char* name) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
+    }
+
+    const Route* route = &routes[endpoint];
+    if(route->blockedClasses & MESSAGE_CLASS_FLAG(messageClass)) {
+        return false;
+    }
+
+    if(messageClass != MessageClass::SIMPLE || route->signalCount == 0 ||
+            name == NULL) {
+        return true;
+    }
+
+    return routeSignalIndex(route, name) != -1;
+}
+
+bool openxc::pipeline::backedUp(Pipeline* pipeline,
+        MessageClass messageClass) {
+    return (routedEndpoints(messageClass, NULL) & attachedEndpoints(pipeline) &
+            ~backedUpEndpoints[messageClass]) == 0;
+}
+
 void openxc::pipeline::process(Pipeline* pipeline) {
-    // Must always process USB, because this function usually runs the MCU's USB
-    // task that handles SETUP and enumeration.
-    usb::processSendQueue(pipeline->usb);
-    #ifdef TELIT_HE910_SUPPORT
-    if(telitHE910::connected(pipeline->telit)) {
-        telitHE910::processSendQueue(pipeline->telit);
+    unsigned long now = time::systemTimeMs();
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        if(batches[i].count > 0 && now - batches[i].openedAt >= batchDelay(i)) {
+            closeBatch(i);
+        }
+
+        ColumnarBatch* batch = columnarBatch(i);
+        if(batch != NULL && !columnar::empty(batch) &&
+                now - columnarOpenedAt[i] >= PIPELINE_COLUMNAR_WINDOW_MS) {
+            closeColumnarBatch(pipeline, i);
+        }
     }
-    #endif
-    #ifdef BLE_SUPPORT
-    if(ble::connected(pipeline->ble)){
-        ble::processSendQueue(pipeline->ble);
+
+    processEndpoints(pipeline);
+    // Every endpoint gets another chance to flush in the next pass
+    memset(backedUpEndpoints, 0, sizeof(backedUpEndpoints));
+}
+
+/* Private: Flush every interface's send queue out to its physical interface,
+ * except the ones holding an open batch.
+ */
+static void processEndpoints(Pipeline* pipeline) {
+    #if METRICS_SUPPORT
+    int queuedBefore[PIPELINE_ENDPOINT_COUNT];
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        queuedBefore[i] = latencySamples[i].sendQueue != NULL ?
+                BYTE_QUEUE_LENGTH(latencySamples[i].sendQueue) : 0;
     }
     #endif
-    #ifdef FS_SUPPORT
-    if(fs::connected(pipeline->fs)){
-        fs::processSendQueue(pipeline->fs);
+
+    for(int i = 0; i < ENDPOINT_COUNT; i++) {
+        ENDPOINTS[i].process(pipeline);
     }
+
+    #if METRICS_SUPPORT
+    finishLatencySamples(queuedBefore);
     #endif
-    #ifndef UART_LOGGING_DISABLE
-    if(uart::connected(pipeline->uart)) {
-        uart::processSendQueue(pipeline->uart);
+}
+
+/* Private: Returns the number of messages dropped for the endpoint that the
+ * rate limit can do something about - the ones it slows down.
+ */
+static unsigned int rateLimitedDrops(int endpoint) {
+    return droppedMessages[endpoint][MessageClass::SIMPLE] +
+            droppedMessages[endpoint][MessageClass::CAN];
+}
+
+bool openxc::pipeline::setRateLimited(InterfaceType endpoint, bool limited) {
+    if(endpoint < 0 || endpoint >= PIPELINE_ENDPOINT_COUNT) {
+        return false;
     }
-    #endif
-    if(pipeline->network != NULL) {
-       network::processSendQueue(pipeline->network);
+
+    if(limited) {
+        rateLimitedEndpoints |= ENDPOINT_FLAG(endpoint);
+    } else {
+        rateLimitedEndpoints &= ~ENDPOINT_FLAG(endpoint);
+    }
+    return true;
+}
+
+void openxc::pipeline::updateRateLimit() {
+    unsigned long now = time::systemTimeMs();
+    if(now - lastRateLimitUpdate < PIPELINE_RATE_LIMIT_PERIOD_MS) {
+        return;
     }
+    lastRateLimitUpdate = now;
 
+    bool saturated = false;
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        unsigned int drops = rateLimitedDrops(i);
+        if((rateLimitedEndpoints & ENDPOINT_FLAG(i)) &&
+                drops != rateLimitDrops[i]) {
+            saturated = true;
+        }
+        rateLimitDrops[i] = drops;
+    }
+
+    float scale = currentRateScale;
+    if(saturated) {
+        scale /= 2;
+        if(scale < PIPELINE_RATE_SCALE_MIN) {
+            scale = PIPELINE_RATE_SCALE_MIN;
+        }
+    } else if(scale < 1) {
+        scale += PIPELINE_RATE_SCALE_STEP;
+        if(scale > 1) {
+            scale = 1;
+        }
+    }
+
+    if(scale != currentRateScale) {
+        debug("Scaling signal send rates to %f", scale);
+        currentRateScale = scale;
+    }
+}
+
+float openxc::pipeline::rateScale() {
+    return currentRateScale;
+}
+
+void openxc::pipeline::resetRateLimit() {
+    rateLimitedEndpoints = DEFAULT_RATE_LIMITED_ENDPOINTS;
+    currentRateScale = 1;
+    lastRateLimitUpdate = time::systemTimeMs();
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        rateLimitDrops[i] = rateLimitedDrops(i);
+    }
 }
 
 void openxc::pipeline::logStatistics(Pipeline* pipeline) {
+    #if METRICS_SUPPORT
     if(!config::getConfiguration()->calculateMetrics) {
         return;
     }
@@ -280,10 +1547,11 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
     if(time::systemTimeMs() - lastTimeLogged >
             PIPELINE_STATS_LOG_FREQUENCY_S * 1000) {
         for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+            unsigned int dropped = totalDroppedMessages(i);
             statistics::update(&sentMessageStats[i], sentMessages[i]);
-            statistics::update(&droppedMessageStats[i], droppedMessages[i]);
+            statistics::update(&droppedMessageStats[i], dropped);
             statistics::update(&totalMessageStats[i],
-                    sentMessages[i] + droppedMessages[i]);
+                    sentMessages[i] + dropped);
             statistics::update(&dataSentStats[i], dataSent[i]);
             statistics::update(&dataSentStats[i], dataSent[i]);
 
@@ -296,15 +1564,25 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
                 debug("%s avg queue fill percents, Rx: %f, Tx: %f",
                         descriptorToString(&descriptor),
                         statistics::exponentialMovingAverage(&receiveQueueStats[i])
-                            / QUEUE_MAX_LENGTH(uint8_t) * 100,
+                            / MAX(receiveQueueCapacity[i], 1u) * 100,
                         statistics::exponentialMovingAverage(&sendQueueStats[i])
-                            / QUEUE_MAX_LENGTH(uint8_t) * 100);
+                            / MAX(sendQueueCapacity[i], 1u) * 100);
                 debug("%s msgs sent: %d, dropped: %d (avg %f percent)",
                         descriptorToString(&descriptor),
                         sentMessageStats[i].total,
                         droppedMessageStats[i].total,
                         statistics::exponentialMovingAverage(&droppedMessageStats[i]) /
                             statistics::exponentialMovingAverage(&totalMessageStats[i]) * 100);
+                if(dropped > 0) {
+                    debug("%s msgs dropped by class, simple: %d, can: %d, "
+                            "diagnostic: %d, log: %d, command response: %d",
+                            descriptorToString(&descriptor),
+                            droppedMessages[i][MessageClass::SIMPLE],
+                            droppedMessages[i][MessageClass::CAN],
+                            droppedMessages[i][MessageClass::DIAGNOSTIC],
+                            droppedMessages[i][MessageClass::LOG],
+                            droppedMessages[i][MessageClass::COMMAND_RESPONSE]);
+                }
                 debug("%s avg throughput: %fKB / s, %d msgs / s",
                         descriptorToString(&descriptor),
                         statistics::exponentialMovingAverage(&dataSentStats[i])
@@ -315,4 +1593,5 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
             lastTimeLogged = time::systemTimeMs();
         }
     }
+    #endif // METRICS_SUPPORT
 }
@@ -8,6 +8,8 @@
 #include "interface/fs.h"
 #include "platform_profile.h"
 #include "platform/pic32/telit_he910.h"
+#include "payload/payload.h"
+#include "util/timer.h"
 
 
 #ifdef FS_SUPPORT
@@ -23,6 +25,58 @@ using openxc::telitHE910::TelitDevice;
 
 #define MAX_OUTGOING_PAYLOAD_SIZE 340
 
+// One entry per openxc::interface::InterfaceType.
+#define PIPELINE_ENDPOINT_COUNT 6
+
+// The number of bytes of each endpoint's send queue kept free for diagnostic
+// and command responses. Simple messages leave this much room, and CAN
+// passthrough messages twice as much.
+#ifndef PIPELINE_PRIORITY_RESERVE
+#define PIPELINE_PRIORITY_RESERVE 64
+#endif
+
+// How often the adaptive rate limit is re-evaluated, how far it can scale
+// signal send frequencies down, and how much it restores per period once the
+// rate limited endpoints stop dropping messages. See updateRateLimit().
+#ifndef PIPELINE_RATE_LIMIT_PERIOD_MS
+#define PIPELINE_RATE_LIMIT_PERIOD_MS 1000
+#endif
+
+#ifndef PIPELINE_RATE_SCALE_MIN
+#define PIPELINE_RATE_SCALE_MIN 0.125
+#endif
+
+#ifndef PIPELINE_RATE_SCALE_STEP
+#define PIPELINE_RATE_SCALE_STEP 0.125
+#endif
+
+// The default number of simple and CAN messages an endpoint collects into one
+// batch before sending them, and the longest a batch is held back waiting for
+// more. A batch size of 1 sends every message on its own. See setBatching().
+#ifndef PIPELINE_BATCH_MAX_MESSAGES
+#define PIPELINE_BATCH_MAX_MESSAGES 1
+#endif
+
+#ifndef PIPELINE_BATCH_MAX_DELAY_MS
+#define PIPELINE_BATCH_MAX_DELAY_MS 100
+#endif
+
+// The longest a columnar block is held open collecting samples before it's
+// sent, if it doesn't fill up first. See setColumnar().
+#ifndef PIPELINE_COLUMNAR_WINDOW_MS
+#define PIPELINE_COLUMNAR_WINDOW_MS 5000
+#endif
+
+#ifndef PIPELINE_ROUTE_MAX_SIGNALS
+#define PIPELINE_ROUTE_MAX_SIGNALS 16
+#endif
+
+// The buckets of the CAN receive to interface latency histograms. Bucket 0 is
+// under 2^PIPELINE_LATENCY_FIRST_BUCKET_SHIFT microseconds and each one after
+// it doubles, with the last one open-ended.
+#define PIPELINE_LATENCY_BUCKET_COUNT 10
+#define PIPELINE_LATENCY_FIRST_BUCKET_SHIFT 9
+
 namespace openxc {
 namespace pipeline {
 
@@ -34,6 +88,38 @@ typedef enum {
     COMMAND_RESPONSE,
 } MessageClass;
 
+#define MESSAGE_CLASS_COUNT 5
+#define MESSAGE_CLASS_FLAG(messageClass) (1 << (messageClass))
+#define ALL_MESSAGE_CLASSES ((1 << MESSAGE_CLASS_COUNT) - 1)
+
+/* Public: Which messages the pipeline sends to one endpoint.
+ *
+ * The zero value routes everything, so endpoints without a configured route
+ * behave as they always have.
+ *
+ * blockedClasses - a bitfield of MESSAGE_CLASS_FLAG()s for the message classes
+ *      that are not sent to the endpoint.
+ * signalCount - the number of names in signals. If 0, every SIMPLE message is
+ *      sent (unless SIMPLE is blocked); otherwise only named SIMPLE messages
+ *      matching one of the signals are.
+ * signals - the allowed SIMPLE message names. The strings are not copied, so
+ *      they must outlive the route (e.g. a CanSignal's genericName).
+ * frequency - the most times per second each of the signals is sent to the
+ *      endpoint, or 0 to send every one published.
+ * clocks - the clock limiting each signal to the frequency.
+ * hasPayloadFormat - if true, messages are serialized for the endpoint with
+ *      payloadFormat instead of the configuration's global payloadFormat.
+ */
+typedef struct {
+    uint8_t blockedClasses;
+    uint8_t signalCount;
+    const char* signals[PIPELINE_ROUTE_MAX_SIGNALS];
+    float frequency;
+    openxc::util::time::FrequencyClock clocks[PIPELINE_ROUTE_MAX_SIGNALS];
+    bool hasPayloadFormat;
+    openxc::payload::PayloadFormat payloadFormat;
+} Route;
+
 /* Public: A container for all output devices that want to be notified of new
  *      messages from the CAN bus.
  *
@@ -60,8 +146,10 @@ typedef struct {
 } Pipeline;
 
 /* Public: Serialize the message to a bytestream (conforming to the OpenXC
- * standard and the currently selected payload format) and send it out to the
- * pipeline.
+ * standard) and send it out to the pipeline.
+ *
+ * The message is serialized at most once per payload format, and only in the
+ * formats used by endpoints that will receive it.
  *
  * This will accept both raw and translated typed messages.
  *
@@ -71,12 +159,60 @@ typedef struct {
 void publish(openxc_VehicleMessage* message,
         openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Serialize and send a simple vehicle message with a value and an
+ * optional event.
+ *
+ * When the payload format supports it, the message is serialized straight from
+ * these arguments; otherwise an openxc_VehicleMessage is built and passed to
+ * publish(openxc_VehicleMessage*, Pipeline*).
+ *
+ * name - The name of the message.
+ * value - The value of the message, or NULL if it has none.
+ * event - The event of the message, or NULL if it has none.
+ * pipeline - The pipeline to send on.
+ */
+void publishSimple(const char* name, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, Pipeline* pipeline);
+
+/* Public: Serialize and send a simple vehicle message for a signal from the
+ * signal table. It's the same as publishSimple(const char*, ...) unless the
+ * name dictionary is enabled (see setNameDictionary), in which case the
+ * message's name is the signal's ID written as a decimal number instead.
+ *
+ * name - The generic name of the signal, still used to route the message.
+ * nameLength - The length of the name if it's known not to need escaping in
+ *      JSON (see payload::json::plainStringLength), so it can be copied
+ *      straight into the payload, otherwise 0.
+ * signalId - The signal's index in the signal table.
+ * resolution - The smallest step of the signal's value, i.e. its factor, for
+ *      endpoints that send signals in columnar blocks (see setColumnar). 0 if
+ *      it isn't known.
+ * value - The value of the message, or NULL if it has none.
+ * event - The event of the message, or NULL if it has none.
+ * pipeline - The pipeline to send on.
+ */
+void publishSignal(const char* name, size_t nameLength, uint16_t signalId,
+        float resolution, const openxc_DynamicField* value,
+        const openxc_DynamicField* event, Pipeline* pipeline);
+
+/* Public: Choose whether signals are published by ID instead of by name - see
+ * openxc::can::read::publishNameDictionary for how receivers learn the IDs.
+ * Disabled by default.
+ */
+void setNameDictionary(bool enabled);
+
+bool nameDictionaryEnabled();
+
 /* Public: Queue the message to send on all of the interfaces registered with
  *      the pipeline. If the any of the queues does not have sufficient capacity
  *      to store the message, it will be dropped for that interface only (i.e.
  *      UART can be overloaded and dropping messages but USB will continue
  *      with a 100% translation rate).
  *
+ * Lower priority message classes must leave part of each queue free (see
+ * PIPELINE_PRIORITY_RESERVE), so they are dropped before diagnostic and
+ * command responses when an interface falls behind.
+ *
  * pipeline - Container of all pipelines to send the message on.
  * message - The message data as an array of uint8_t.
  * messageSize - The length of the message's byte array.
@@ -86,8 +222,193 @@ void publish(openxc_VehicleMessage* message,
 void sendMessage(Pipeline* pipeline, uint8_t* message, int messageSize,
         MessageClass messageClass);
 
+/* Public: Set the message classes sent to an endpoint and clear its signal
+ * filter. Its payload format is left alone.
+ *
+ * endpoint - the endpoint to configure.
+ * messageClasses - a bitfield of MESSAGE_CLASS_FLAG()s to send to it.
+ *
+ * Returns true if the route was changed, false if the endpoint is unknown.
+ */
+bool setRoute(openxc::interface::InterfaceType endpoint,
+        uint8_t messageClasses);
+
+/* Public: Limit the SIMPLE messages sent to an endpoint to those with the given
+ * name, in addition to any already allowed.
+ *
+ * endpoint - the endpoint to configure.
+ * name - the message name to allow. It isn't copied, see Route.
+ *
+ * Returns true if the name was added, false if the endpoint is unknown or its
+ * filter already has PIPELINE_ROUTE_MAX_SIGNALS names.
+ */
+bool addRouteSignal(openxc::interface::InterfaceType endpoint,
+        const char* name);
+
+/* Public: Limit how often each of the signals allowed by an endpoint's route is
+ * sent to it, so a client that only needs a few updates a second (e.g. a
+ * dashboard over BLE) doesn't get, or cost the serialization of, every value
+ * another endpoint wants. The limit is checked when a signal is published,
+ * after the signal's own frequency, and only applies to the names added with
+ * addRouteSignal - it's cleared with the filter by setRoute.
+ *
+ * endpoint - the endpoint to configure.
+ * frequency - the most times per second to send each signal, or 0 for every
+ *      time it's published.
+ *
+ * Returns true if the rate was changed, false if the endpoint is unknown.
+ */
+bool setRouteFrequency(openxc::interface::InterfaceType endpoint,
+        float frequency);
+
+/* Public: Serialize messages for an endpoint with the given format, regardless
+ * of the global payload format.
+ *
+ * Returns true if the format was changed, false if the endpoint is unknown.
+ */
+bool setPayloadFormat(openxc::interface::InterfaceType endpoint,
+        openxc::payload::PayloadFormat format);
+
+/* Public: Returns the format messages are serialized with for an endpoint -
+ * its own if one was set, otherwise the global payload format.
+ */
+openxc::payload::PayloadFormat payloadFormat(
+        openxc::interface::InterfaceType endpoint);
+
+/* Public: Collect simple and CAN messages for an endpoint into batches
+ * instead of sending each one by itself.
+ *
+ * A batch is sent once it has maxMessages messages, once it's been open for
+ * maxDelayMs, when the next message doesn't fit in the send queue with it, or
+ * before a message of another class (e.g. a command response), which is never
+ * held back. Until then the endpoint's send queue isn't flushed, so the whole
+ * batch goes out in as few transfers as possible. USB is the exception - its
+ * send queue must be processed every pass for enumeration, so it only gets
+ * the container.
+ *
+ * JSON messages in a batch are sent as one container,
+ *
+ *      {"records":[{...},{...}]}
+ *
+ * like the ones the cellular server task posts. Protobuf and MessagePack
+ * messages are already delimited, so they're only held back.
+ *
+ * The Telit send queue is already batched by the server task, so it can't be
+ * batched again here.
+ *
+ * maxMessages - the number of messages in a full batch. 1 turns batching off
+ *      and 0 restores the default, PIPELINE_BATCH_MAX_MESSAGES.
+ * maxDelayMs - the longest a message may wait in an open batch.
+ *
+ * Returns true if the batching was changed.
+ */
+bool setBatching(openxc::interface::InterfaceType endpoint,
+        uint8_t maxMessages, unsigned int maxDelayMs);
+
+/* Public: Choose whether an endpoint's messages carry their timestamp as a
+ * delta from a base timestamp instead of the full value.
+ *
+ * Everything in an endpoint's send queue goes out together (as one SD card
+ * write, or one cellular POST), so when a stamped message is sent to an empty
+ * queue a base record is queued first. It's a message with nothing but a
+ * timestamp, in the endpoint's payload format, e.g. for JSON
+ *
+ *      {"timestamp":1332794184319}
+ *
+ * and the timestamps of the messages after it, up to the next base record,
+ * are the number of milliseconds since it. The deltas are small numbers, i.e.
+ * 1 or 2 byte varints for protocol buffers and MessagePack, and a few digits
+ * for JSON. A base record counts toward the size of a batch (see
+ * setBatching). Builds that don't stamp messages are unaffected.
+ *
+ * Returns true if the mode was changed, false if the endpoint is unknown.
+ */
+bool setTimestampDeltas(openxc::interface::InterfaceType endpoint,
+        bool enabled);
+
+bool timestampDeltas(openxc::interface::InterfaceType endpoint);
+
+/* Public: Choose whether an endpoint sends the numeric values of signals in
+ * columnar blocks (see payload/columnar.h) instead of a record per value.
+ *
+ * A block collects the samples of each signal as small time and value deltas
+ * until it's full or PIPELINE_COLUMNAR_WINDOW_MS after its first sample, and
+ * then goes out as one record in the endpoint's payload format. Signals are
+ * identified by their ID, as with setNameDictionary. Signals with an event,
+ * strings, booleans and every other message class are still sent as records.
+ * Only the Telit and SD card endpoints, whose send queues go out a POST or a
+ * file write at a time, can send blocks.
+ *
+ * Turning the mode off leaves an open block to be sent at the end of its
+ * window.
+ *
+ * Returns true if the mode was changed, false if the endpoint can't send
+ * blocks in this build.
+ */
+bool setColumnar(openxc::interface::InterfaceType endpoint, bool enabled);
+
+bool columnarEnabled(openxc::interface::InterfaceType endpoint);
+
+/* Public: Set timestamp to the time to stamp on outgoing messages, in
+ * milliseconds, if this build stamps them. Once the wall clock is set (see
+ * util::wallclock), by the RTC or a time sync with the host, every build
+ * stamps them with Unix time.
+ *
+ * Returns true if messages should have a timestamp.
+ */
+bool currentTimestamp(uint64_t* timestamp);
+
+/* Public: Stamp the messages published until the next call with the time
+ * their source CAN message was received, instead of the time they're
+ * published, by backdating the current timestamp by the message's age. This
+ * keeps the time a message waited in the receive queue out of its timestamp.
+ *
+ * receivedUs - the system time in microseconds when the CAN message was
+ *      received (see CanMessage), or 0 to stamp messages with the current time
+ *      again.
+ */
+void setReceiveTime(unsigned long receivedUs);
+
+/* Public: Send every message class and signal to every endpoint again, in the
+ * global payload format, with the default batching, absolute timestamps and a
+ * record per signal value.
+ */
+void resetRoutes();
+
+/* Public: Check if a message should be sent to an endpoint.
+ *
+ * endpoint - the endpoint to check.
+ * messageClass - the class of the message.
+ * name - the name of a SIMPLE message, or NULL if it's unknown. Unnamed
+ *      messages are only subject to the class filter.
+ *
+ * Returns true if the route for the endpoint accepts the message.
+ */
+bool routed(openxc::interface::InterfaceType endpoint,
+        MessageClass messageClass, const char* name);
+
+/* Public: Check if a message of the class has nowhere to go right now, i.e.
+ * every endpoint that would receive it is unattached or backed up.
+ *
+ * Sending to an endpoint whose queue is full flushes the interfaces at most
+ * once; if that doesn't make room, the endpoint is backed up for that class
+ * (and lower priority ones) until the next process(). Producers of bulk data
+ * can check this to drop messages before building them.
+ *
+ * pipeline - the pipeline the message would be sent on.
+ * messageClass - the class of the message.
+ *
+ * Returns true if a message of that class would be dropped everywhere.
+ */
+bool backedUp(Pipeline* pipeline, MessageClass messageClass);
+
 /* Public: Perform interface-specific functions to flush all message queues out
- *      to their respective physical interfaces.
+ *      to their respective physical interfaces, and give backed up endpoints
+ *      another chance to receive messages.
+ *
+ * Call this once per pass of the main loop. Batches that have been open for
+ * their endpoint's maximum delay are closed first, so they go out in the same
+ * pass.
  *
  * TODO This is the tricky part with making the pipeline more generic - this
  * needs to call an interface-specific method for each queue.
@@ -96,6 +417,93 @@ void sendMessage(Pipeline* pipeline, uint8_t* message, int messageSize,
  */
 void process(Pipeline* pipeline);
 
+/* Public: Returns the number of messages of a class that were dropped for an
+ * endpoint because its send queue was full.
+ */
+unsigned int droppedMessageCount(openxc::interface::InterfaceType endpoint,
+        MessageClass messageClass);
+
+/* Public: Counters for one output endpoint since startup.
+ *
+ * sent - the number of messages sent.
+ * dropped - the number of messages of every class dropped because the send
+ *      queue was full.
+ * bytesSent - the number of payload bytes sent.
+ * sendQueueLength - the number of bytes in the send queue after the last send.
+ * sendQueuePeak - the most bytes the send queue has held after a send.
+ * receiveQueuePeak - the most bytes seen waiting in the receive queue, which
+ *      is only sampled when sending.
+ * sendQueueCapacity - the most bytes the send queue can hold.
+ * receiveQueueCapacity - the most bytes the receive queue can hold, or 0 if
+ *      the endpoint doesn't have one.
+ */
+typedef struct {
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int bytesSent;
+    unsigned int sendQueueLength;
+    unsigned int sendQueuePeak;
+    unsigned int receiveQueuePeak;
+    unsigned int sendQueueCapacity;
+    unsigned int receiveQueueCapacity;
+} EndpointMetrics;
+
+/* Public: Returns true if none of the attached endpoints has anything waiting
+ * in its send queue or an open columnar block. Messages held in an open batch
+ * don't count, since they wait on a timer.
+ */
+bool sendQueuesEmpty(Pipeline* pipeline);
+
+/* Public: Copy the counters for an endpoint.
+ *
+ * Returns false if the endpoint is unknown.
+ */
+bool getEndpointMetrics(openxc::interface::InterfaceType endpoint,
+        EndpointMetrics* metrics);
+
+/* Public: Copy an endpoint's histogram of the time from receiving a CAN
+ * message to the interface taking a message published from it out of the
+ * send queue. One message at a time is followed per endpoint, so this is a
+ * sample. Messages held in a batch aren't sampled.
+ *
+ * endpoint - the endpoint.
+ * buckets - an array of PIPELINE_LATENCY_BUCKET_COUNT counts to fill in, see
+ *      PIPELINE_LATENCY_FIRST_BUCKET_SHIFT.
+ *
+ * Returns false if the endpoint is unknown or METRICS_SUPPORT is compiled out.
+ */
+bool getLatencyHistogram(openxc::interface::InterfaceType endpoint,
+        unsigned int* buckets);
+
+/* Public: Choose whether messages dropped for an endpoint slow down the
+ * signal send rate. By default only the BLE and Telit links, whose throughput
+ * varies the most, are rate limited.
+ */
+bool setRateLimited(openxc::interface::InterfaceType endpoint, bool limited);
+
+/* Public: Adjust the send rate scale for the drops seen since the last update.
+ *
+ * Once every PIPELINE_RATE_LIMIT_PERIOD_MS, if any rate limited endpoint
+ * dropped simple or CAN messages, the scale is halved (down to
+ * PIPELINE_RATE_SCALE_MIN). Otherwise it's raised by PIPELINE_RATE_SCALE_STEP
+ * until it's back to 1.
+ *
+ * Call this once per pass of the main loop.
+ */
+void updateRateLimit();
+
+/* Public: Returns the factor, between PIPELINE_RATE_SCALE_MIN and 1, that
+ * signal and passthrough message send frequencies are multiplied by to keep
+ * the rate limited endpoints from falling behind. Signals without a frequency
+ * limit aren't affected.
+ */
+float rateScale();
+
+/* Public: Rate limit the default endpoints again and restore the full send
+ * rate.
+ */
+void resetRateLimit();
+
 void logStatistics(Pipeline* pipeline);
 
 } // namespace interface
@@ -1,13 +1,27 @@
 #include "can/canutil.h"
+#include "can/canqueue.h"
+#include "can/canwrite.h"
+#include "can/gateway.h"
 #include "canutil_lpc17xx.h"
 #include "signals.h"
 #include "util/log.h"
+#include "util/timer.h"
+#include "util/ram_function.h"
 
 using openxc::util::log::debug;
-using openxc::signals::getCanBusCount;
-using openxc::signals::getCanBuses;
 using openxc::can::shouldAcceptMessage;
 
+// An upper bound on the frames read from one controller per interrupt, so a
+// saturated bus can't keep us in the ISR forever.
+#define MAX_FRAMES_PER_INTERRUPT 4
+
+// The receive and transmit buffer 1-3 interrupt flags in the ICR.
+#define CAN_ICR_RI (1 << 0)
+#define CAN_ICR_TI1 (1 << 1)
+#define CAN_ICR_TI2 (1 << 9)
+#define CAN_ICR_TI3 (1 << 10)
+
+RAM_FUNCTION
 CanMessage receiveCanMessage(CanBus* bus) {
     CAN_MSG_Type message;
     CAN_ReceiveMsg(CAN_CONTROLLER(bus), &message);
@@ -17,7 +31,8 @@ CanMessage receiveCanMessage(CanBus* bus) {
         format: message.format == STD_ID_FORMAT ?
             CanMessageFormat::STANDARD : CanMessageFormat::EXTENDED,
         data: {0},
-        length: message.len
+        length: message.len,
+        receivedUs: openxc::util::time::systemTimeUs()
     };
 
     memcpy(result.data, message.dataA, 4);
@@ -27,24 +42,48 @@ CanMessage receiveCanMessage(CanBus* bus) {
 
 extern "C" {
 
+// Both controllers share this one interrupt vector, so it checks each
+// controller that has a bus, found directly by its address instead of
+// searching the active message set's buses.
+RAM_FUNCTION
 void CAN_IRQHandler() {
-    for(int i = 0; i < getCanBusCount(); i++) {
-        CanBus* bus = &getCanBuses()[i];
-        if((CAN_IntGetStatus(CAN_CONTROLLER(bus)) & 0x01) == 1) {
-            CanMessage message = receiveCanMessage(bus);
-            if(shouldAcceptMessage(bus, message.id) &&
-                    !QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
-                // An exception to the "don't leave commented out code" rule,
-                // this log statement is useful for debugging performance issues
-                // but if left enabled all of the time, it can can slown down
-                // the interrupt handler so much that it locks up the device in
-                // permanent interrupt handling land.
-                //
-                // debug("Dropped CAN message with ID 0x%02x -- queue is full",
-                // message.id);
-                ++bus->messagesDropped;
+    for(int i = 0; i < CAN_CONTROLLER_COUNT; i++) {
+        CanBus* bus = INTERRUPT_BUSES[i];
+        if(bus == NULL) {
+            continue;
+        }
+        // Reading the ICR clears the receive and transmit interrupts, so read
+        // it once. Then drain every frame the controller has buffered (it has
+        // a double receive buffer) using the receive buffer status bit,
+        // instead of taking another interrupt for each one.
+        uint32_t status = CAN_IntGetStatus(CAN_CONTROLLER(bus));
+        if(status & CAN_ICR_RI) {
+            for(int frames = 0; frames < MAX_FRAMES_PER_INTERRUPT &&
+                    (CAN_CONTROLLER(bus)->GSR & CAN_GSR_RBS); frames++) {
+                CanMessage message = receiveCanMessage(bus);
+                openxc::can::gateway::forward(bus, &message);
+                if(shouldAcceptMessage(bus, message.id) &&
+                        !openxc::can::queue::push(&bus->receiveQueue,
+                            &message)) {
+                    // An exception to the "don't leave commented out code"
+                    // rule, this log statement is useful for debugging
+                    // performance issues but if left enabled all of the time,
+                    // it can can slown down the interrupt handler so much that
+                    // it locks up the device in permanent interrupt handling
+                    // land.
+                    //
+                    // debug("Dropped CAN message with ID 0x%02x -- queue is full",
+                    // message.id);
+                    ++bus->messagesDropped;
+                }
             }
         }
+
+        // A transmit buffer is free again - refill it (and any others) right
+        // away instead of waiting for the main loop
+        if(status & (CAN_ICR_TI1 | CAN_ICR_TI2 | CAN_ICR_TI3)) {
+            openxc::can::write::sendPendingWrites(bus);
+        }
     }
 }
 
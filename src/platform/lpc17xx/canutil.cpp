@@ -1,8 +1,12 @@
 #include "can/canutil.h"
 #include "canutil_lpc17xx.h"
+#include "interrupts_lpc17xx.h"
 #include "signals.h"
+#include "config.h"
 #include "util/log.h"
 #include "lpc17xx_pinsel.h"
+#include "lpc17xx_clkpwr.h"
+#include <stdlib.h>
 
 // Same for both Blueboard and Ford VI prototype
 // CAN1: select P0.21 as RD1. P0.22 as TD1
@@ -12,6 +16,25 @@
 #define CAN_PORT_NUM(BUS) 0
 #define CAN_FUNCNUM(BUS) (BUS == LPC_CAN1 ? 3 : 2)
 
+// The bus off flag and the receive and transmit error counters in the GSR, and
+// the reset mode bit of the MOD register.
+#define CAN_GSR_BUS_OFF (1 << 7)
+#define CAN_GSR_RXERR_SHIFT 16
+#define CAN_GSR_TXERR_SHIFT 24
+#define CAN_MOD_RM (1 << 0)
+#define CAN_MOD_LOM (1 << 1)
+#define CAN_MOD_STM (1 << 2)
+
+// The fields of the BTR, and the fewest and most time quanta the phase
+// segments of a bit can add up to.
+#define CAN_BTR_SJW_SHIFT 14
+#define CAN_BTR_TSEG1_SHIFT 16
+#define CAN_BTR_TSEG2_SHIFT 20
+#define CAN_BTR_MAX_PRESCALER 1024
+#define CAN_BTR_MAX_TSEG1 16
+#define CAN_MIN_BIT_QUANTA 8
+#define CAN_MAX_BIT_QUANTA 25
+
 using openxc::signals::getCanBusCount;
 using openxc::signals::getCanBuses;
 using openxc::util::log::debug;
@@ -19,6 +42,8 @@ using openxc::util::log::debug;
 extern uint16_t CANAF_std_cnt;
 extern uint16_t CANAF_ext_cnt;
 
+CanBus* INTERRUPT_BUSES[CAN_CONTROLLER_COUNT];
+
 static void configureCanControllerPins(LPC_CAN_TypeDef* controller) {
     PINSEL_CFG_Type PinCfg;
     PinCfg.OpenDrain = 0;
@@ -67,42 +92,150 @@ bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount)
     uint16_t filterCount = 0;
     CAN_ERROR result = CAN_OK;
     bool bypassFilters = false;
-    for(int i = 0; i < busCount; i++) {
+    for(int i = 0; i < busCount && result == CAN_OK; i++) {
         CanBus* bus = &buses[i];
         bypassFilters |= bus->bypassFilters;
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(filterCount >= MAX_ACCEPTANCE_FILTERS) {
-                break;
+
+        // Runs of contiguous IDs are loaded as a single group entry, which
+        // takes a word of AF RAM no matter how wide the range.
+        AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+        int rangeCount = compileAcceptanceFilters(bus, ranges,
+                MAX_ACCEPTANCE_FILTERS);
+        for(int j = 0; j < rangeCount && result == CAN_OK; j++) {
+            AcceptanceFilterRange* range = &ranges[j];
+            CAN_ID_FORMAT_Type format =
+                    range->format == CanMessageFormat::STANDARD ?
+                        STD_ID_FORMAT : EXT_ID_FORMAT;
+            if(range->lowId == range->highId) {
+                result = CAN_LoadExplicitEntry(CAN_CONTROLLER(bus),
+                        range->lowId, format);
+            } else {
+                result = CAN_LoadGroupEntry(CAN_CONTROLLER(bus),
+                        range->lowId, range->highId, format);
+            }
+
+            if(result != CAN_OK) {
+                debug("Couldn't add filter 0x%x-0x%x to bus %d", range->lowId,
+                        range->highId, bus->address);
+            } else {
+                ++filterCount;
             }
-            result = CAN_LoadExplicitEntry(CAN_CONTROLLER(bus), entry->filter,
-                   entry->format == CanMessageFormat::STANDARD ?
-                       STD_ID_FORMAT : EXT_ID_FORMAT);
-           if(result != CAN_OK) {
-                debug("Couldn't add filter 0x%x to bus %d", entry->filter,
-                        bus->address);
-                break;
-           }
-           ++filterCount;
         }
     }
 
     // On the LPC17xx, the AF mode is global - if it's off, it's off for
     // both controllers. That's why this is outside the loop above, and
     // we're counting *total* filters, not filters per bus. We also disable the
-    // AF if any of the busses has bypassFilters == true.
-    bypassFilters |= filterCount == 0;
+    // AF if any of the busses has bypassFilters == true, or if the table
+    // couldn't hold every filter - the receive ISR still filters in software
+    // with shouldAcceptMessage, so nothing that was asked for is lost.
+    bypassFilters |= filterCount == 0 || result != CAN_OK;
     if(bypassFilters) {
-        debug("No filters configured or a bus in bypass, disabling AF");
+        debug("No filters configured, a bus in bypass or AF table full, "
+                "disabling AF");
     }
     resetAcceptanceFilterStatus(NULL, !bypassFilters);
-    return result == CAN_OK;
+    return true;
 }
 
 void openxc::can::deinitialize(CanBus* bus) { }
 
+/* Private: Returns the BTR value for the bit rate closest to a speed, and of
+ * those, the one that samples closest to 75% of the way through the bit.
+ *
+ * clock - The controller's peripheral clock in Hz.
+ * speed - The bit rate in bits per second.
+ */
+static uint32_t bitTiming(uint32_t clock, unsigned int speed) {
+    uint32_t timing = 0;
+    uint32_t closest = 0xffffffff;
+    int closestSamplePoint = 0;
+    for(int quanta = CAN_MAX_BIT_QUANTA; quanta >= CAN_MIN_BIT_QUANTA;
+            quanta--) {
+        uint32_t prescaler = (clock + speed * quanta / 2) / (speed * quanta);
+        if(prescaler < 1 || prescaler > CAN_BTR_MAX_PRESCALER) {
+            continue;
+        }
+
+        uint32_t actual = clock / (prescaler * quanta);
+        uint32_t error = actual > speed ? actual - speed : speed - actual;
+        int tseg1 = MIN(quanta * 3 / 4 - 1, CAN_BTR_MAX_TSEG1);
+        int tseg2 = quanta - 1 - tseg1;
+        // The distance from 75%, in thousandths of the bit
+        int samplePoint = abs((1 + tseg1) * 1000 / quanta - 750);
+        if(error < closest || (error == closest &&
+                    samplePoint < closestSamplePoint)) {
+            timing = (prescaler - 1) |
+                    ((MIN(tseg2, 4) - 1) << CAN_BTR_SJW_SHIFT) |
+                    ((tseg1 - 1) << CAN_BTR_TSEG1_SHIFT) |
+                    ((tseg2 - 1) << CAN_BTR_TSEG2_SHIFT);
+            closest = error;
+            closestSamplePoint = samplePoint;
+        }
+    }
+    return timing;
+}
+
+// The BTR and the listen only bit can only be written in reset mode, which
+// takes the controller off the bus until it's cleared.
+void openxc::can::setBitRate(CanBus* bus, unsigned int speed,
+        bool listenOnly) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT ||
+            speed == 0) {
+        return;
+    }
+
+    LPC_CAN_TypeDef* controller = CAN_CONTROLLER(bus);
+    uint32_t mode = controller->MOD & ~CAN_MOD_RM;
+    controller->MOD = mode | CAN_MOD_RM;
+    controller->BTR = bitTiming(CLKPWR_GetPCLK(bus->address == 1 ?
+                CLKPWR_PCLKSEL_CAN1 : CLKPWR_PCLKSEL_CAN2), speed);
+    mode = listenOnly ? mode | CAN_MOD_LOM : mode & ~CAN_MOD_LOM;
+    controller->MOD = mode | CAN_MOD_RM;
+    controller->MOD = mode;
+}
+
+void openxc::can::setOperatingMode(CanBus* bus, bool writable) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT) {
+        return;
+    }
+
+    // The mode bits can only be changed in reset mode
+    LPC_CAN_TypeDef* controller = CAN_CONTROLLER(bus);
+    uint32_t mode = controller->MOD & ~(CAN_MOD_RM | CAN_MOD_LOM |
+            CAN_MOD_STM);
+    if(bus->loopback) {
+        mode |= CAN_MOD_STM;
+    } else if(!writable) {
+        mode |= CAN_MOD_LOM;
+    }
+    controller->MOD |= CAN_MOD_RM;
+    controller->MOD = mode | CAN_MOD_RM;
+    controller->MOD = mode;
+}
+
+void openxc::can::readErrorCounters(CanBus* bus, CanErrorCounters* counters) {
+    uint32_t status = CAN_CONTROLLER(bus)->GSR;
+    counters->transmitErrors = (status >> CAN_GSR_TXERR_SHIFT) & 0xff;
+    counters->receiveErrors = (status >> CAN_GSR_RXERR_SHIFT) & 0xff;
+    counters->busOff = status & CAN_GSR_BUS_OFF;
+}
+
+// Going bus off puts the controller in reset mode, where it stays until the
+// reset bit is cleared - only then does it start counting the recessive bits
+// it needs to see before rejoining the bus.
+void openxc::can::recoverFromBusOff(CanBus* bus) {
+    if(CAN_CONTROLLER(bus)->MOD & CAN_MOD_RM) {
+        CAN_CONTROLLER(bus)->MOD &= ~CAN_MOD_RM;
+    }
+}
+
 void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
         const int busCount) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT) {
+        debug("No CAN controller for bus %d", bus->address);
+        return;
+    }
     can::initializeCommon(bus);
     configureCanControllerPins(CAN_CONTROLLER(bus));
     configureTransceiver();
@@ -115,6 +248,10 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
     static bool CAN_CONTROLLER_INITIALIZED = false;
     if(!CAN_CONTROLLER_INITIALIZED) {
         for(int i = 0; i < getCanBusCount(); i++) {
+            if(getCanBuses()[i].address < 1 ||
+                    getCanBuses()[i].address > CAN_CONTROLLER_COUNT) {
+                continue;
+            }
             debug("Initializing bus %d at %d baud", getCanBuses()[i].address,
                     getCanBuses()[i].speed);
             CAN_Init(CAN_CONTROLLER((&getCanBuses()[i])), getCanBuses()[i].speed);
@@ -141,8 +278,13 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
 
     // enable receiver interrupt
     CAN_IRQCmd(CAN_CONTROLLER(bus), CANINT_RIE, ENABLE);
-    // enable transmit interrupt
+    // enable the transmit interrupt for all three transmit buffers, so each
+    // one is refilled from the pending writes as soon as it's sent
     CAN_IRQCmd(CAN_CONTROLLER(bus), CANINT_TIE1, ENABLE);
+    CAN_IRQCmd(CAN_CONTROLLER(bus), CANINT_TIE2, ENABLE);
+    CAN_IRQCmd(CAN_CONTROLLER(bus), CANINT_TIE3, ENABLE);
 
+    INTERRUPT_BUSES[bus->address - 1] = bus;
+    NVIC_SetPriority(CAN_IRQn, CAN_INTERRUPT_PRIORITY);
     NVIC_EnableIRQ(CAN_IRQn);
 }
@@ -3,8 +3,16 @@
 
 #include "lpc17xx_can.h"
 
-// TODO somewhere earlier we need to catch if the bus address is invalid, e.g. 0
-// or 3
+#include "can/canutil.h"
+
+// The number of CAN controllers on the LPC17xx, for buses 1 and 2.
+#define CAN_CONTROLLER_COUNT 2
+
+// can::initialize skips a bus whose address has no controller.
 #define CAN_CONTROLLER(bus) ((LPC_CAN_TypeDef*)(bus->address == 1 ? LPC_CAN1 : LPC_CAN2))
 
+// The bus on each controller, indexed by bus address - 1, for the interrupt
+// handler. NULL if the controller isn't used.
+extern CanBus* INTERRUPT_BUSES[CAN_CONTROLLER_COUNT];
+
 #endif // __CANUTIL_LPC17XX__
@@ -25,3 +25,14 @@ bool openxc::can::write::sendMessage(const CanBus* bus, const CanMessage* reques
     }
     return sent;
 }
+
+// The receive and transmit interrupts of both controllers share one IRQ, so
+// masking it briefly also holds off receive - the frames stay in the
+// controller's receive buffer until it's unmasked.
+void openxc::can::write::disableTransmitInterrupt(CanBus* bus) {
+    NVIC_DisableIRQ(CAN_IRQn);
+}
+
+void openxc::can::write::enableTransmitInterrupt(CanBus* bus) {
+    NVIC_EnableIRQ(CAN_IRQn);
+}
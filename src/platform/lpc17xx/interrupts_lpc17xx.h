@@ -0,0 +1,26 @@
+#ifndef __INTERRUPTS_LPC17XX__
+#define __INTERRUPTS_LPC17XX__
+
+// The NVIC priority of each interrupt the firmware enables, 0 being the most
+// urgent of the 32 levels. An interrupt preempts the handler of any with a
+// higher number, so these are ordered by how little a handler can be delayed
+// before data is lost:
+//
+// CAN - each controller has a single receive buffer, so a frame that arrives
+//      while the last is still waiting to be read is lost. The handler only
+//      copies frames into the receive queue.
+// Wake up - the CAN activity and program button interrupts, only enabled while
+//      suspended, when nothing else is running.
+// UART - the receive FIFO holds 16 bytes, and flow control stops the host
+//      before it overflows, so it can wait out a CAN frame.
+// USB - the host retries anything the VI isn't ready for, so it can wait the
+//      longest.
+//
+// SysTick is left at the lowest priority by SysTick_Config (see
+// time::systemTimeUs for reading the time from a handler it can't preempt).
+#define CAN_INTERRUPT_PRIORITY 0
+#define WAKE_UP_INTERRUPT_PRIORITY 1
+#define UART_INTERRUPT_PRIORITY 8
+#define USB_INTERRUPT_PRIORITY 16
+
+#endif // __INTERRUPTS_LPC17XX__
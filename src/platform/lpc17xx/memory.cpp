@@ -0,0 +1,18 @@
+#include "util/memory.h"
+#include <malloc.h>
+
+// From the linker script: the heap starts at the end of .bss and newlib's sbrk
+// grows it up towards the stack, which starts at the top of RAM.
+extern uint8_t __end__;
+extern uint8_t __StackTop;
+
+void openxc::util::memory::stackRegion(uint8_t** bottom, uint8_t** top) {
+    *bottom = &__end__ + mallinfo().arena;
+    *top = &__StackTop;
+}
+
+void openxc::util::memory::heapUsage(size_t* used, size_t* reserved) {
+    struct mallinfo info = mallinfo();
+    *used = info.uordblks;
+    *reserved = info.arena;
+}
@@ -0,0 +1,74 @@
+#include "LPC17xx.h"
+#include "util/state_store.h"
+#include "saved_config.h"
+
+// The last 32KB sector of flash holds the util::state_store records, and the
+// one before it the saved configuration. Both are left out of the FLASH region
+// in the linker scripts.
+#define STATE_STORE_SECTOR 29
+#define STATE_STORE_START 0x78000
+#define STATE_STORE_SIZE 0x8000
+#define SAVED_CONFIGURATION_SECTOR 28
+#define SAVED_CONFIGURATION_START 0x70000
+
+// The in-application programming routines in the boot ROM
+#define IAP_LOCATION 0x1FFF1FF1
+#define IAP_PREPARE_SECTORS 50
+#define IAP_COPY_RAM_TO_FLASH 51
+#define IAP_ERASE_SECTORS 52
+#define IAP_CMD_SUCCESS 0
+
+typedef void (*IapEntry)(uint32_t command[], uint32_t result[]);
+
+/* Private: Run an IAP command, after preparing a sector for it.
+ *
+ * Flash can't be read while it's being written, so interrupts are held off
+ * until the command is finished - their handlers and the vector table are in
+ * flash.
+ *
+ * Returns true if the command succeeded.
+ */
+static bool iapCommand(uint32_t sector, uint32_t* command) {
+    IapEntry iap = (IapEntry) IAP_LOCATION;
+    uint32_t prepare[5] = {IAP_PREPARE_SECTORS, sector, sector};
+    uint32_t result[5];
+
+    __disable_irq();
+    iap(prepare, result);
+    if(result[0] == IAP_CMD_SUCCESS) {
+        iap(command, result);
+    }
+    __enable_irq();
+    return result[0] == IAP_CMD_SUCCESS;
+}
+
+const uint8_t* openxc::util::state_store::region(size_t* size) {
+    *size = STATE_STORE_SIZE;
+    return (const uint8_t*) STATE_STORE_START;
+}
+
+void openxc::util::state_store::eraseRegion() {
+    uint32_t command[5] = {IAP_ERASE_SECTORS, STATE_STORE_SECTOR,
+            STATE_STORE_SECTOR, SystemCoreClock / 1000};
+    iapCommand(STATE_STORE_SECTOR, command);
+}
+
+bool openxc::util::state_store::writeSlot(int slot, const uint8_t* data) {
+    uint32_t command[5] = {IAP_COPY_RAM_TO_FLASH,
+            STATE_STORE_START + slot * STATE_STORE_SLOT_SIZE, (uint32_t) data,
+            STATE_STORE_SLOT_SIZE, SystemCoreClock / 1000};
+    return iapCommand(STATE_STORE_SECTOR, command);
+}
+
+const uint8_t* openxc::config::savedConfigurationRegion() {
+    return (const uint8_t*) SAVED_CONFIGURATION_START;
+}
+
+bool openxc::config::writeSavedConfiguration(const uint8_t* data) {
+    uint32_t erase[5] = {IAP_ERASE_SECTORS, SAVED_CONFIGURATION_SECTOR,
+            SAVED_CONFIGURATION_SECTOR, SystemCoreClock / 1000};
+    uint32_t copy[5] = {IAP_COPY_RAM_TO_FLASH, SAVED_CONFIGURATION_START,
+            (uint32_t) data, SAVED_CONFIGURATION_SIZE, SystemCoreClock / 1000};
+    return iapCommand(SAVED_CONFIGURATION_SECTOR, erase) &&
+            iapCommand(SAVED_CONFIGURATION_SECTOR, copy);
+}
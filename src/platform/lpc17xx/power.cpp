@@ -4,6 +4,8 @@
 #include "lpc17xx_pinsel.h"
 #include "lpc17xx_clkpwr.h"
 #include "lpc17xx_wdt.h"
+#include "canutil_lpc17xx.h"
+#include "interrupts_lpc17xx.h"
 
 #define POWER_CONTROL_PORT 2
 #define POWER_CONTROL_PIN 13
@@ -11,6 +13,13 @@
 #define PROGRAM_BUTTON_PORT 2
 #define PROGRAM_BUTTON_PIN 12
 
+// The longest the watchdog can count on the 4MHz IRC, in seconds.
+#define MAX_WAKE_TIMER_SECONDS 4294
+
+// The reset and listen only mode bits of a CAN controller's MOD register.
+#define CAN_MOD_RM (1 << 0)
+#define CAN_MOD_LOM (1 << 1)
+
 namespace gpio = openxc::gpio;
 
 using openxc::gpio::GPIO_VALUE_HIGH;
@@ -18,6 +27,8 @@ using openxc::gpio::GPIO_VALUE_LOW;
 using openxc::gpio::GPIO_DIRECTION_OUTPUT;
 using openxc::util::log::debug;
 
+static bool timerWake = false;
+
 const uint32_t DISABLED_PERIPHERALS[] = {
     CLKPWR_PCONP_PCTIM0,
     CLKPWR_PCONP_PCTIM1,
@@ -70,6 +81,10 @@ void openxc::power::initialize() {
     programButtonPinConfig.Portnum = PROGRAM_BUTTON_PORT;
     programButtonPinConfig.Pinnum = PROGRAM_BUTTON_PIN;
     PINSEL_ConfigPin(&programButtonPinConfig);
+
+    // The watchdog only ever resets the VI out of a suspend
+    timerWake = WDT_ReadTimeOutFlag();
+    WDT_ClrTimeOutFlag();
 }
 
 void openxc::power::handleWake() {
@@ -86,6 +101,8 @@ void openxc::power::handleWake() {
 
 void openxc::power::suspend() {
     debug("Going to low power mode");
+    NVIC_SetPriority(CANActivity_IRQn, WAKE_UP_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(EINT2_IRQn, WAKE_UP_INTERRUPT_PRIORITY);
     NVIC_EnableIRQ(CANActivity_IRQn);
     NVIC_EnableIRQ(EINT2_IRQn);
 
@@ -100,6 +117,121 @@ void openxc::power::suspend() {
     CLKPWR_DeepSleep();
 }
 
+void openxc::power::waitForInterrupt() {
+    // Plain sleep, not deep sleep - the clocks and peripherals keep running
+    CLKPWR_Sleep();
+}
+
+// The clock settings enterLowClock() changed, to put back in exitLowClock().
+static uint32_t savedClockConfig;
+static uint32_t savedCanClockSelect;
+static uint32_t savedCanModes[CAN_CONTROLLER_COUNT];
+
+/* Private: Returns the divider from CCLK for a peripheral clock selection, as
+ * read by CLKPWR_GetPCLKSEL.
+ */
+static int peripheralClockDivider(uint32_t select) {
+    switch(select) {
+    case CLKPWR_PCLKSEL_CCLK_DIV_1:
+        return 1;
+    case CLKPWR_PCLKSEL_CCLK_DIV_2:
+        return 2;
+    case CLKPWR_PCLKSEL_CCLK_DIV_8:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+/* Private: Hold the CAN controllers in reset while their clock changes, so they
+ * don't see a bit at the wrong rate.
+ */
+static void resetCanControllers() {
+    for(int i = 0; i < CAN_CONTROLLER_COUNT; i++) {
+        if(INTERRUPT_BUSES[i] != NULL) {
+            CAN_CONTROLLER(INTERRUPT_BUSES[i])->MOD |= CAN_MOD_RM;
+        }
+    }
+}
+
+/* Private: Take a CAN controller out of reset in the given mode. The listen
+ * only bit can only be changed while the controller is in reset, so it's set
+ * first and the reset bit cleared after.
+ */
+static void startCanController(CanBus* bus, uint32_t mode) {
+    CAN_CONTROLLER(bus)->MOD = mode | CAN_MOD_RM;
+    CAN_CONTROLLER(bus)->MOD = mode & ~CAN_MOD_RM;
+}
+
+/* Private: Pick up a new CCLK in the 1ms system tick.
+ */
+static void updateSystemTick() {
+    SystemCoreClockUpdate();
+    SysTick_Config(SystemCoreClock / 1000);
+}
+
+void openxc::power::enterLowClock() {
+    // The CAN bit timing is set from PCLK_CAN, which is CCLK/4 by default.
+    // Dividing CCLK down by the same amount while switching the CAN1, CAN2 and
+    // acceptance filter clocks to CCLK/1 leaves PCLK_CAN where it was, so the
+    // controllers keep receiving without setting up their baud rate again.
+    savedCanClockSelect = CLKPWR_GetPCLKSEL(CLKPWR_PCLKSEL_CAN1);
+    int divider = peripheralClockDivider(savedCanClockSelect);
+    savedClockConfig = LPC_SC->CCLKCFG;
+
+    for(int i = 0; i < CAN_CONTROLLER_COUNT; i++) {
+        if(INTERRUPT_BUSES[i] != NULL) {
+            savedCanModes[i] = CAN_CONTROLLER(INTERRUPT_BUSES[i])->MOD;
+        }
+    }
+    resetCanControllers();
+
+    if(divider > 1) {
+        LPC_SC->CCLKCFG = (savedClockConfig + 1) * divider - 1;
+        CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_CAN1, CLKPWR_PCLKSEL_CCLK_DIV_1);
+        CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_CAN2, CLKPWR_PCLKSEL_CCLK_DIV_1);
+        CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_ACF, CLKPWR_PCLKSEL_CCLK_DIV_1);
+        updateSystemTick();
+    }
+
+    for(int i = 0; i < CAN_CONTROLLER_COUNT; i++) {
+        if(INTERRUPT_BUSES[i] != NULL) {
+            startCanController(INTERRUPT_BUSES[i],
+                    savedCanModes[i] | CAN_MOD_LOM);
+        }
+    }
+}
+
+void openxc::power::exitLowClock() {
+    resetCanControllers();
+
+    CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_CAN1, savedCanClockSelect);
+    CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_CAN2, savedCanClockSelect);
+    CLKPWR_SetPCLKDiv(CLKPWR_PCLKSEL_ACF, savedCanClockSelect);
+    LPC_SC->CCLKCFG = savedClockConfig;
+    updateSystemTick();
+
+    for(int i = 0; i < CAN_CONTROLLER_COUNT; i++) {
+        if(INTERRUPT_BUSES[i] != NULL) {
+            startCanController(INTERRUPT_BUSES[i], savedCanModes[i]);
+        }
+    }
+}
+
+void openxc::power::armWakeTimer(unsigned long seconds) {
+    if(seconds > MAX_WAKE_TIMER_SECONDS) {
+        seconds = MAX_WAKE_TIMER_SECONDS;
+    }
+    // The IRC keeps the watchdog running in deep sleep, and its reset wakes
+    // the VI just like the OBD-II ignition check's
+    WDT_Init(WDT_CLKSRC_IRC, WDT_MODE_RESET);
+    WDT_Start(seconds * 1000000);
+}
+
+bool openxc::power::wokeFromTimer() {
+    return timerWake;
+}
+
 void openxc::power::enableWatchdogTimer(int microseconds) {
     WDT_Init(WDT_CLKSRC_IRC, WDT_MODE_RESET);
     WDT_Start(microseconds);
@@ -5,6 +5,13 @@
 
 #define DELAY_TIMER LPC_TIM0
 
+// The Cortex-M3 debug registers used to count cycles with the DWT
+#define DEMCR (*(volatile uint32_t*) 0xE000EDFC)
+#define DEMCR_TRCENA (1 << 24)
+#define DWT_CTRL (*(volatile uint32_t*) 0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+#define DWT_CYCCNT (*(volatile uint32_t*) 0xE0001004)
+
 unsigned int SYSTEM_TICK_COUNT;
 
 extern "C" {
@@ -35,7 +42,41 @@ unsigned long openxc::util::time::systemTimeMs() {
     return SYSTEM_TICK_COUNT;
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    // SysTick counts down from LOAD to 0 once per millisecond tick - re-read
+    // if the tick count changed under us
+    unsigned int ticks;
+    uint32_t value;
+    do {
+        ticks = SYSTEM_TICK_COUNT;
+        value = SysTick->VAL;
+    } while(ticks != SYSTEM_TICK_COUNT);
+
+    // From an interrupt that SysTick can't preempt (e.g. the CAN receive
+    // handler), the counter may have wrapped without the tick count being
+    // incremented yet - count that pending tick
+    if(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        value = SysTick->VAL;
+        ++ticks;
+    }
+
+    uint32_t reload = SysTick->LOAD + 1;
+    return ticks * 1000 + (reload - value) * 1000 / reload;
+}
+
+unsigned long openxc::util::time::cycleCount() {
+    return DWT_CYCCNT;
+}
+
+unsigned long openxc::util::time::cyclesPerMicrosecond() {
+    return SystemCoreClock / 1000000;
+}
+
 void openxc::util::time::initialize() {
     // Configure for 1ms tick
     SysTick_Config(SystemCoreClock / 1000);
+
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
 }
@@ -7,6 +7,7 @@
 #include "util/bytebuffer.h"
 #include "util/log.h"
 #include "gpio.h"
+#include "interrupts_lpc17xx.h"
 
 // Only UART1 supports hardware flow control, so this has to be UART1
 #define UART1_DEVICE (LPC_UART_TypeDef*)LPC_UART1
@@ -14,6 +15,11 @@
 #define UART_STATUS_PORT 0
 #define UART_STATUS_PIN 18
 
+#ifndef UART_TX_FIFO_SIZE
+#define UART_TX_FIFO_SIZE 16
+#endif
+#define UART_RX_FIFO_SIZE 16
+
 #ifdef BLUEBOARD
 
 #define UART1_FUNCNUM 2
@@ -45,19 +51,26 @@ using openxc::config::getConfiguration;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::pushBytes;
 using openxc::gpio::GpioValue;
 using openxc::gpio::GpioDirection;
 
 __IO int32_t RTS_STATE;
+// SET while a transmit interrupt is on its way to refill the FIFO, i.e. the
+// send queue is draining in the background
 __IO FlagStatus TRANSMIT_INTERRUPT_STATUS;
 
 /* Disable request to send through RTS line. We cannot handle any more data
  * right now.
+ *
+ * The receive interrupt is masked too - it would otherwise keep firing for the
+ * bytes left in the FIFO, with nowhere to put them.
  */
 void pauseReceive() {
     if(RTS_STATE == ACTIVE) {
         // Disable request to send through RTS line
         UART_FullModemForcePinState(LPC_UART1, UART1_MODEM_PIN_RTS, INACTIVE);
+        UART_IntConfig(UART1_DEVICE, UART_INTCFG_RBR, DISABLE);
         RTS_STATE = INACTIVE;
     }
 }
@@ -67,59 +80,69 @@ void resumeReceive() {
     if (RTS_STATE == INACTIVE) {
         // Enable request to send through RTS line
         UART_FullModemForcePinState(LPC_UART1, UART1_MODEM_PIN_RTS, ACTIVE);
+        UART_IntConfig(UART1_DEVICE, UART_INTCFG_RBR, ENABLE);
         RTS_STATE = ACTIVE;
     }
 }
 
-void disableTransmitInterrupt() {
-    UART_IntConfig(UART1_DEVICE, UART_INTCFG_THRE, DISABLE);
-}
-
 void enableTransmitInterrupt() {
-    TRANSMIT_INTERRUPT_STATUS = SET;
     UART_IntConfig(UART1_DEVICE, UART_INTCFG_THRE, ENABLE);
 }
 
+/* Private: Move everything in the receive FIFO to the receive queue, a chunk
+ * at a time.
+ *
+ * The FIFO only interrupts once it holds 8 bytes (RDA), or when bytes have sat
+ * in it for a few character times without another arriving (CTI) - the line
+ * has gone idle, which is usually the end of a command. Either way the whole
+ * FIFO is drained at once, so a command arrives in a couple of interrupts
+ * instead of one per byte.
+ */
 void handleReceiveInterrupt() {
-    while(!QUEUE_FULL(uint8_t, &getConfiguration()->uart.receiveQueue)) {
-        uint8_t byte;
-        uint32_t received = UART_Receive(UART1_DEVICE, &byte, 1, NONE_BLOCKING);
-        if(received > 0) {
-            QUEUE_PUSH(uint8_t, &getConfiguration()->uart.receiveQueue, byte);
-            if(QUEUE_FULL(uint8_t, &getConfiguration()->uart.receiveQueue)) {
-                pauseReceive();
-            }
-        } else {
+    ByteQueue* queue = &getConfiguration()->uart.receiveQueue;
+    uint8_t chunk[UART_RX_FIFO_SIZE];
+    while(true) {
+        int room = BYTE_QUEUE_AVAILABLE(queue);
+        if(room <= 0) {
+            pauseReceive();
             break;
         }
-    }
-}
 
-void handleTransmitInterrupt() {
-    disableTransmitInterrupt();
-
-    while(UART_CheckBusy(UART1_DEVICE) == SET);
-
-    while(!QUEUE_EMPTY(uint8_t, &getConfiguration()->uart.sendQueue)) {
-        uint8_t byte = QUEUE_PEEK(uint8_t, &getConfiguration()->uart.sendQueue);
-        // We used to use non-blocking here, but then we got into a race
-        // condition - if the transmit interrupt occurred while adding more data
-        // to the queue, you could lose data. We should be able to switch back
-        // to non-blocking if we disabled interrupts while modifying the queue
-        // (good practice anyway) but for now switching this to block sends
-        // seems to work OK without any significant impacts.
-        if(UART_Send(UART1_DEVICE, &byte, 1, BLOCKING)) {
-            QUEUE_POP(uint8_t, &getConfiguration()->uart.sendQueue);
-        } else {
+        uint32_t received = UART_Receive(UART1_DEVICE, chunk,
+                room < (int)sizeof(chunk) ? room : sizeof(chunk),
+                NONE_BLOCKING);
+        if(received == 0) {
             break;
         }
+        pushBytes(queue, chunk, received);
+    }
+}
+
+/* Private: Move up to a FIFO's worth of bytes from the send queue into the
+ * transmit FIFO, without waiting. The FIFO must be empty, i.e. THRE is set.
+ *
+ * Returns the number of bytes written to the FIFO.
+ */
+static int fillTransmitFifo() {
+    ByteQueue* queue = &getConfiguration()->uart.sendQueue;
+    int count = 0;
+    while(count < UART_TX_FIFO_SIZE && !BYTE_QUEUE_EMPTY(queue)) {
+        UART_SendByte(UART1_DEVICE, BYTE_QUEUE_POP(queue));
+        ++count;
     }
+    return count;
+}
 
-    if(QUEUE_EMPTY(uint8_t, &getConfiguration()->uart.sendQueue)) {
-        disableTransmitInterrupt();
+/* Private: Refill the transmit FIFO each time it empties, so the send queue
+ * drains at the full baud rate no matter how busy the main loop is. The ISR is
+ * the only consumer of the send queue while a transmission is running, and the
+ * main loop only pushes, so the queue needs no locking.
+ */
+void handleTransmitInterrupt() {
+    if(fillTransmitFifo() == 0) {
+        // Nothing left to send - processSendQueue restarts the transmission
+        // when more arrives.
         TRANSMIT_INTERRUPT_STATUS = RESET;
-    } else {
-        enableTransmitInterrupt();
     }
 }
 
@@ -161,9 +184,10 @@ void UART1_IRQHandler() {
 void openxc::interface::uart::read(UartDevice* device,
         openxc::util::bytebuffer::IncomingMessageCallback callback) {
     if(device != NULL) {
-        if(!QUEUE_EMPTY(uint8_t, &device->receiveQueue)) {
-            processQueue(&device->receiveQueue, callback);
-            if(!QUEUE_FULL(uint8_t, &device->receiveQueue)) {
+        if(!BYTE_QUEUE_EMPTY(&device->receiveQueue)) {
+            processQueue(&device->receiveQueue, &device->receiveScanner,
+                    frameType(getConfiguration()->payloadFormat), callback);
+            if(!BYTE_QUEUE_FULL(&device->receiveQueue)) {
                 resumeReceive();
             }
         }
@@ -209,14 +233,16 @@ void configureUartPins() {
 void configureFifo() {
     UART_FIFO_CFG_Type fifoConfig;
     UART_FIFOConfigStructInit(&fifoConfig);
+    // Interrupt at 8 bytes - the character timeout interrupt picks up any
+    // fewer once the line goes idle
+    fifoConfig.FIFO_Level = UART_FIFO_TRGLEV2;
     UART_FIFOConfig(UART1_DEVICE, &fifoConfig);
 }
 
 void configureInterrupts() {
     UART_IntConfig(UART1_DEVICE, UART_INTCFG_RBR, ENABLE);
     enableTransmitInterrupt();
-    /* preemption = 1, sub-priority = 1 */
-    NVIC_SetPriority(UART1_IRQn, ((0x01<<3)|0x01));
+    NVIC_SetPriority(UART1_IRQn, UART_INTERRUPT_PRIORITY);
     NVIC_EnableIRQ(UART1_IRQn);
 }
 
@@ -241,8 +267,8 @@ void openxc::interface::uart::writeByte(UartDevice* device, uint8_t byte) {
 }
 
 int openxc::interface::uart::readByte(UartDevice* device) {
-    if(!QUEUE_EMPTY(uint8_t, &device->receiveQueue)) {
-        return QUEUE_POP(uint8_t, &device->receiveQueue);
+    if(!BYTE_QUEUE_EMPTY(&device->receiveQueue)) {
+        return BYTE_QUEUE_POP(&device->receiveQueue);
     }
     return -1;
 }
@@ -269,13 +295,21 @@ void openxc::interface::uart::initialize(UartDevice* device) {
 }
 
 void openxc::interface::uart::processSendQueue(UartDevice* device) {
-    if(!QUEUE_EMPTY(uint8_t, &device->sendQueue)) {
-        if(TRANSMIT_INTERRUPT_STATUS == RESET) {
-            handleTransmitInterrupt();
-        } else {
-            enableTransmitInterrupt();
-        }
+    if(BYTE_QUEUE_EMPTY(&device->sendQueue) ||
+            TRANSMIT_INTERRUPT_STATUS == SET) {
+        // already draining in the background
+        return;
+    }
+
+    // Prime the FIFO to restart the transmission - the transmit interrupt
+    // takes it from there. Keep the ISR out while we're popping the queue.
+    NVIC_DisableIRQ(UART1_IRQn);
+    if(UART_GetLineStatus(UART1_DEVICE) & UART_LINESTAT_THRE) {
+        fillTransmitFifo();
     }
+    // If the FIFO wasn't empty, the interrupt for it emptying is still to come
+    TRANSMIT_INTERRUPT_STATUS = SET;
+    NVIC_EnableIRQ(UART1_IRQn);
 }
 
 bool openxc::interface::uart::connected(UartDevice* device) {
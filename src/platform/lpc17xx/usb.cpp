@@ -7,6 +7,7 @@
 #include "util/log.h"
 #include "util/bytebuffer.h"
 #include "gpio.h"
+#include "interrupts_lpc17xx.h"
 #include "usb_config.h"
 #include "config.h"
 #include "emqueue.h"
@@ -37,10 +38,14 @@ namespace usb = openxc::interface::usb;
 
 using openxc::config::getConfiguration;
 using openxc::util::log::debug;
+using openxc::util::log::warning;
 using openxc::interface::usb::UsbDevice;
 using openxc::interface::usb::UsbEndpoint;
 using openxc::interface::usb::UsbEndpointDirection;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::frameType;
+using openxc::util::bytebuffer::peekBytes;
+using openxc::util::bytebuffer::popBytes;
 using openxc::gpio::GPIO_VALUE_HIGH;
 using openxc::gpio::GPIO_VALUE_LOW;
 
@@ -52,6 +57,8 @@ void configureEndpoints() {
                 endpoint->direction == UsbEndpointDirection::USB_ENDPOINT_DIRECTION_OUT ?
                         ENDPOINT_DIR_OUT : ENDPOINT_DIR_IN,
                 endpoint->size, ENDPOINT_BANK_DOUBLE);
+        // a stream interrupted by reconfiguration can't be resumed
+        endpoint->sendLength = 0;
     }
 }
 
@@ -66,8 +73,9 @@ void EVENT_USB_Device_ControlRequest() {
         return;
     }
 
-    QUEUE_TYPE(uint8_t) payloadQueue;
-    QUEUE_INIT(uint8_t, &payloadQueue);
+    ByteQueue payloadQueue;
+    BYTE_QUEUE_STORAGE(payloadStorage, USB_RECEIVE_QUEUE_SIZE);
+    BYTE_QUEUE_INIT(&payloadQueue, payloadStorage);
 
     // Only read payload of our app's control requests, not USB system's
     if((USB_ControlRequest.bmRequestType >> 7 == 0) &&
@@ -79,8 +87,8 @@ void EVENT_USB_Device_ControlRequest() {
             while(!Endpoint_IsOUTReceived());
             while(Endpoint_BytesInEndpoint()) {
                 uint8_t byte = Endpoint_Read_8();
-                if(!QUEUE_PUSH(uint8_t, &payloadQueue, byte)) {
-                    debug("Dropped control request from host -- queue is full");
+                if(!BYTE_QUEUE_PUSH(&payloadQueue, byte)) {
+                    warning("Dropped control request from host -- queue is full");
                     break;
                 }
                 ++bytesReceived;
@@ -91,10 +99,10 @@ void EVENT_USB_Device_ControlRequest() {
         Endpoint_ClearStatusStage();
     }
 
-    int length = QUEUE_LENGTH(uint8_t, &payloadQueue);
+    int length = BYTE_QUEUE_LENGTH(&payloadQueue);
     uint8_t snapshot[length];
     if(length > 0) {
-        QUEUE_SNAPSHOT(uint8_t, &payloadQueue, snapshot, length);
+        peekBytes(&payloadQueue, snapshot, length);
         openxc::interface::usb::handleIncomingMessage(snapshot, length);
     }
 }
@@ -110,26 +118,51 @@ void EVENT_USB_Device_ConfigurationChanged(void) {
 
 }
 
-/* Private: Flush any queued data out to the USB host. */
+/* Private: Stream the endpoint's queue to the host without blocking.
+ *
+ * The IN endpoint is configured with two banks, so the controller sends one
+ * bank while the next is filled. Writing with a bytesSent counter makes the
+ * stream return as soon as both banks are full instead of waiting for the
+ * host to read them - the rest of sendBuffer is written on the next pass, and
+ * only once it's all sent is sendBuffer refilled from the queue.
+ *
+ * sendBuffer is refilled with whole packets only, unless the partial packet
+ * left at the end of the queue has waited long enough (see usb::readyToSend).
+ */
 static void flushQueueToHost(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
-    if(!usb::connected(usbDevice) || QUEUE_EMPTY(uint8_t, &endpoint->queue)) {
+    if(!usb::connected(usbDevice) || (endpoint->sendLength == 0 &&
+                BYTE_QUEUE_EMPTY(&endpoint->queue))) {
         return;
     }
 
     uint8_t previousEndpoint = Endpoint_GetCurrentEndpoint();
     Endpoint_SelectEndpoint(endpoint->address);
     if(Endpoint_IsINReady()) {
-        // get bytes from transmit FIFO into intermediate buffer
-        int byteCount = 0;
-        while(!QUEUE_EMPTY(uint8_t, &endpoint->queue)
-                && byteCount < USB_SEND_BUFFER_SIZE) {
-            endpoint->sendBuffer[byteCount++] = QUEUE_POP(uint8_t,
-                    &endpoint->queue);
+        if(endpoint->sendLength == 0 && usb::readyToSend(usbDevice, endpoint)) {
+            int length = BYTE_QUEUE_LENGTH(&endpoint->queue);
+            if(length > USB_SEND_BUFFER_SIZE) {
+                length = USB_SEND_BUFFER_SIZE;
+            }
+            if(length >= MAX_USB_PACKET_SIZE_BYTES) {
+                length -= length % MAX_USB_PACKET_SIZE_BYTES;
+            }
+            // get bytes from transmit FIFO into intermediate buffer
+            endpoint->sendLength = popBytes(&endpoint->queue,
+                    endpoint->sendBuffer, length);
+            endpoint->bytesSent = 0;
         }
 
-        if(byteCount > 0) {
-            Endpoint_Write_Stream_LE(endpoint->sendBuffer, byteCount, NULL);
-            Endpoint_ClearIN();
+        if(endpoint->sendLength > 0) {
+            uint8_t status = Endpoint_Write_Stream_LE(endpoint->sendBuffer,
+                    endpoint->sendLength, &endpoint->bytesSent);
+            if(status != ENDPOINT_RWSTREAM_IncompleteTransfer) {
+                if(status == ENDPOINT_RWSTREAM_NoError) {
+                    Endpoint_ClearIN();
+                } else {
+                    warning("USB IN stream failed (%d), dropped data", status);
+                }
+                endpoint->sendLength = 0;
+            }
         }
     }
     Endpoint_SelectEndpoint(previousEndpoint);
@@ -239,6 +272,7 @@ void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
 void openxc::interface::usb::initialize(UsbDevice* usbDevice) {
     usb::initializeCommon(usbDevice);
     USB_Init();
+    NVIC_SetPriority(USB_IRQn, USB_INTERRUPT_PRIORITY);
     ::USB_Connect();
     configureUsbDetection();
 }
@@ -251,8 +285,8 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
     bool receivedData = false;
     while(Endpoint_IsOUTReceived()) {
         while(Endpoint_BytesInEndpoint()) {
-            if(!QUEUE_PUSH(uint8_t, &endpoint->queue, Endpoint_Read_8())) {
-                debug("Dropped write from host -- queue is full");
+            if(!BYTE_QUEUE_PUSH(&endpoint->queue, Endpoint_Read_8())) {
+                warning("Dropped write from host -- queue is full");
             }
             receivedData = true;
         }
@@ -260,7 +294,8 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
     }
 
     if(receivedData) {
-        while(processQueue(&endpoint->queue, callback)) {
+        while(processQueue(&endpoint->queue, &endpoint->receiveScanner,
+                    frameType(getConfiguration()->payloadFormat), callback)) {
             continue;
         }
     }
@@ -24,7 +24,6 @@
 #include "libs/STBTLE/bluenrg_gap.h"
 #include "libs/STBTLE/ble_status.h"
 #include "libs/STBTLE/bluenrg_hal_aci.h"
-#include "ringbuffer/ringbuffer.h"
 
 #include "spi.h"
 #include "hci.h"
@@ -34,6 +33,9 @@
 
 
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::frameType;
+using openxc::util::bytebuffer::peekBytes;
+using openxc::util::bytebuffer::popBytes;
 using openxc::util::log::debug;
 using openxc::util::time::uptimeMs;
 
@@ -41,6 +43,9 @@ using openxc::config::getConfiguration;
 
 using openxc::interface::ble::BleStatus;
 using openxc::interface::ble::BleError;
+using openxc::interface::ble::BleChannel;
+using openxc::interface::ble::setNotifying;
+using openxc::interface::ble::updateConnectionProfile;
 
 
 
@@ -69,6 +74,13 @@ using openxc::interface::ble::BleError;
 
 #define MAX_BLE_NOTIFY_RETRIES            100
 
+//ATT MTU negotiation - a notification carries the MTU less a 3 byte ATT header
+#define BLE_ATT_DEFAULT_MTU              23          //MTU every link starts with until an exchange completes
+#define BLE_ATT_MAX_MTU                  158         //Largest MTU the BlueNRG-MS stack will accept
+#define BLE_ATT_NOTIFY_HEADER_SIZE       3
+#define BLE_MAX_NOTIFY_SIZE              (BLE_ATT_MAX_MTU - BLE_ATT_NOTIFY_HEADER_SIZE)
+#define BLE_MAX_NOTIFIES_PER_PASS        4           //Notifications queued to the radio per pass, while it has buffers
+
 //UUID Generator MACROS
 #define COPY_UUID_128(uuid_struct, uuid_15, uuid_14, uuid_13, uuid_12, uuid_11, uuid_10, uuid_9, uuid_8, uuid_7, uuid_6, uuid_5, uuid_4, uuid_3, uuid_2, uuid_1, uuid_0) \
 do {\
@@ -82,6 +94,12 @@ do {\
 #define COPY_VT_SERVICE_UUID(uuid_struct)  COPY_UUID_128(uuid_struct,0x68,0x00,0xd3,0x8b, 0x42,0x3d, 0x4b,0xdb, 0xba,0x05, 0xc9,0x27,0x6d,0x84,0x53,0xe1) 
 #define COPY_APP_COM_UUID(uuid_struct)     COPY_UUID_128(uuid_struct,0x68,0x00,0xd3,0x8b, 0x52,0x62, 0x11,0xe5, 0x88,0x5d, 0xfe,0xff,0x81,0x9c,0xdc,0xe2)
 #define COPY_APP_RSP_UUID(uuid_struct)     COPY_UUID_128(uuid_struct,0x68,0x00,0xd3,0x8b, 0x52,0x62, 0x11,0xe5, 0x88,0x5d, 0xfe,0xff,0x81,0x9c,0xdc,0xe3)
+//One notify characteristic per BleChannel, ending in e4 (simple) to e7 (command response)
+#define COPY_APP_CHANNEL_UUID(uuid_struct, channel) COPY_UUID_128(uuid_struct,0x68,0x00,0xd3,0x8b, 0x52,0x62, 0x11,0xe5, 0x88,0x5d, 0xfe,0xff,0x81,0x9c,0xdc,0xe4 + (channel))
+
+//Attribute records in the service: its declaration, 2 for the command
+//characteristic and 3 (declaration, value, CCCD) for each notify characteristic
+#define VT_SERVICE_ATTRIBUTE_RECORDS     (1 + 2 + 3 * (1 + BLE_CHANNEL_COUNT))
 
 extern void Test_Deserial(void);
 
@@ -102,6 +120,7 @@ static const uint8_t device_gap_name[]  = "CrossChasm";
 //Memory for circular buffer operation 
 
 uint16_t vtServHandle, appComCharHandle, appRSPCharHandle;
+static uint16_t appChannelCharHandles[BLE_CHANNEL_COUNT];
 static uint16_t service_handle, dev_name_char_handle, appearance_char_handle;
 static uint16_t conn_handle=0;
 static char device_adv_name[16];
@@ -117,53 +136,70 @@ static char device_adv_name[16];
 static void ST_BLE_Failed_CB(uint8_t reason);
 static tBleStatus ST_BLE_Set_Connectable(BleDevice *device);
 
-#define NOTIFY_BUFFER_SZ 32 
-uint8_t notify_buffer[NOTIFY_BUFFER_SZ]; //must be divisble by power of 2
-RingBuffer_t notify_buffer_ring;
+static uint16_t att_mtu = BLE_ATT_DEFAULT_MTU;
 
 #define L2CAP_ATTEMPTS_MAX 5
+#define L2CAP_RETRY_INTERVAL_MS 1000
+#define L2CAP_SUPERVISION_TIMEOUT 600      //6 seconds, in 10ms units
 bool send_l2cap_request = false;
 uint32_t l2cap_request_attempts=0;
 uint32_t l2captimer=0;
 
 #ifdef OPTIMIZE_NOTIFICATION
 #define SMALL_NOTIFY_PACKET_TIMEOUT 1000
-    bool small_packet_notify_present = false;
-    uint32_t small_packet_notify_time_ms;
 #endif
 
+//A notify characteristic and the queue it's sent from. A partial notification
+//is held back until the queue has been quiet for SMALL_NOTIFY_PACKET_TIMEOUT,
+//unless the stream is urgent.
+typedef struct {
+    ByteQueue* queue;
+    uint16_t charHandle;
+    bool urgent;
+    bool small_packet_notify_present;
+    uint32_t small_packet_notify_time_ms;
+} NotifyStream;
+
+//Command responses first, so they never wait behind vehicle data, then the
+//main characteristic and the other classes
+static NotifyStream notify_streams[1 + BLE_CHANNEL_COUNT];
+
 uint32_t notification_fail_retries =0;    
 
 
 static void flush_ble_buffers(void) //flushing out old unsent data sitting in memory
 {
     debug("Flushing ble buffers");
-    while(QUEUE_EMPTY(uint8_t, &getConfiguration()->ble->sendQueue)==false)
+    while(BYTE_QUEUE_EMPTY(&getConfiguration()->ble->sendQueue)==false)
     {
-        QUEUE_POP(uint8_t, &getConfiguration()->ble->sendQueue);
+        BYTE_QUEUE_POP(&getConfiguration()->ble->sendQueue);
     }
-    RingBuffer_Clear(&notify_buffer_ring);
-    
-    while(QUEUE_EMPTY(uint8_t, &getConfiguration()->ble->receiveQueue)==false)
+    while(BYTE_QUEUE_EMPTY(&getConfiguration()->ble->receiveQueue)==false)
     {
-        QUEUE_POP(uint8_t, &getConfiguration()->ble->receiveQueue);
+        BYTE_QUEUE_POP(&getConfiguration()->ble->receiveQueue);
+    }
+    getConfiguration()->ble->notifying = false;
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++)
+    {
+        BYTE_QUEUE_RESET(&getConfiguration()->ble->channels[i].sendQueue);
+        getConfiguration()->ble->channels[i].notifying = false;
     }
     
 }
 
 
-static void app_notification_enable(bool state){
+//channel is -1 for the main characteristic
+static void app_notification_enable(int channel, bool state){
 
     if(state)
     {
-        debug("BLE Notification Enabled");
-        getConfiguration()->ble->status = BleStatus::NOTIFICATION_ENABLED;
+        debug("BLE Notification Enabled on %d", channel);
     }
     else
     {
-        debug("BLE Notification Disabled");
-        getConfiguration()->ble->status = BleStatus::CONNECTED;
+        debug("BLE Notification Disabled on %d", channel);
     }
+    setNotifying(getConfiguration()->ble, channel, state);
 }
 
 static void app_disconnected(void)
@@ -171,6 +207,8 @@ static void app_disconnected(void)
     debug("BLE App Disconnected");
     getConfiguration()->ble->status = BleStatus::RADIO_ON_NOT_ADVERTISING;
     send_l2cap_request = false;
+    getConfiguration()->ble->fastConnection = false;
+    att_mtu = BLE_ATT_DEFAULT_MTU;
     flush_ble_buffers();
 }
 
@@ -188,6 +226,12 @@ static void app_connected(void)
         send_l2cap_request = true;
         l2captimer = uptimeMs();
         l2cap_request_attempts = 0;        
+        // Ask for a larger MTU so each notification can carry more than 20
+        // bytes - the response arrives as EVT_BLUE_ATT_EXCHANGE_MTU_RESP.
+        if(aci_gatt_exchange_configuration(conn_handle) != BLE_STATUS_SUCCESS)
+        {
+            debug("Unable to request ATT MTU exchange");
+        }
     }
 }
 
@@ -197,7 +241,7 @@ tBleStatus GATT_add_services(void)
     uint8_t uuid[16];
     
     COPY_VT_SERVICE_UUID(uuid);
-    ret = aci_gatt_add_serv(UUID_TYPE_128,  uuid, PRIMARY_SERVICE, 7, &vtServHandle);
+    ret = aci_gatt_add_serv(UUID_TYPE_128,  uuid, PRIMARY_SERVICE, VT_SERVICE_ATTRIBUTE_RECORDS, &vtServHandle);
     if (ret != BLE_STATUS_SUCCESS) goto fail;    
     
     COPY_APP_COM_UUID(uuid); //setup incoming command pipe
@@ -208,11 +252,20 @@ tBleStatus GATT_add_services(void)
 
         
     COPY_APP_RSP_UUID(uuid);  //setup outgoing response pipe
-    ret =  aci_gatt_add_char(vtServHandle, UUID_TYPE_128, uuid, 20, CHAR_PROP_NOTIFY, ATTR_PERMISSION_NONE, 0,
+    ret =  aci_gatt_add_char(vtServHandle, UUID_TYPE_128, uuid, BLE_MAX_NOTIFY_SIZE, CHAR_PROP_NOTIFY, ATTR_PERMISSION_NONE, 0,
                              16, 1, &appRSPCharHandle);
     
     if (ret != BLE_STATUS_SUCCESS) goto fail;
 
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++)
+    {
+        COPY_APP_CHANNEL_UUID(uuid, i);  //setup outgoing pipe for one class of message
+        ret =  aci_gatt_add_char(vtServHandle, UUID_TYPE_128, uuid, BLE_MAX_NOTIFY_SIZE, CHAR_PROP_NOTIFY, ATTR_PERMISSION_NONE, 0,
+                                 16, 1, &appChannelCharHandles[i]);
+
+        if (ret != BLE_STATUS_SUCCESS) goto fail;
+    }
+
 
     
             
@@ -235,6 +288,11 @@ tBleStatus GATT_App_Notify(uint8_t* rsp, uint32_t rsplen)
     return aci_gatt_update_char_value(vtServHandle, appRSPCharHandle, 0, rsplen, rsp);    
 }
 
+static tBleStatus GATT_Channel_Notify(uint16_t charHandle, uint8_t* rsp, uint32_t rsplen)
+{
+    return aci_gatt_update_char_value(vtServHandle, charHandle, 0, rsplen, rsp);
+}
+
 
 static void ST_BLE_Failed_CB(uint8_t reason)
 {
@@ -345,20 +403,23 @@ void HCI_Event_CB(void *pckt)
                         
                         for(int i = 0; i < evt->data_length ; i++) { //todo better way to point to device
                         
-                            if(QUEUE_FULL(uint8_t,(QUEUE_TYPE(uint8_t)*)&getConfiguration()->ble->receiveQueue))
+                            if(BYTE_QUEUE_FULL(&getConfiguration()->ble->receiveQueue))
                             {
                                 debug("Command Queue Busy");
                                 break;
                             }
-                            QUEUE_PUSH(uint8_t,(QUEUE_TYPE(uint8_t)*)&getConfiguration()->ble->receiveQueue, (uint8_t) evt->att_data[i]);
+                            BYTE_QUEUE_PUSH(&getConfiguration()->ble->receiveQueue, (uint8_t) evt->att_data[i]);
                         }
-                        processQueue((QUEUE_TYPE(uint8_t)*) &getConfiguration()->ble->receiveQueue, openxc::interface::ble::handleIncomingMessage);//processQueue will dump queue automatically if full    
+                        processQueue(&getConfiguration()->ble->receiveQueue,
+                                &getConfiguration()->ble->receiveScanner,
+                                frameType(getConfiguration()->payloadFormat),
+                                openxc::interface::ble::handleIncomingMessage);//processQueue will dump queue automatically if full    
                     }
                     else if(evt->attr_handle == appRSPCharHandle + 2)  //Notifications were enabled or disabled
                     {
                         if(evt->att_data[0] == 0x01)
                         {
-                            app_notification_enable(TRUE);
+                            app_notification_enable(-1, TRUE);
                             #ifdef BLE_NO_ACT_TIMEOUT_ENABLE
                                 debug("BLE_NO_ACT_TIMEOUT_ENABLE is disabled");
                                 ble_no_act_active = false;            //disable dropping link once notification enabled
@@ -366,9 +427,25 @@ void HCI_Event_CB(void *pckt)
                         }
                         if(evt->att_data[0] == 0x00)
                         {
-                            app_notification_enable(FALSE);
+                            app_notification_enable(-1, FALSE);
                         }    
                     }
+                    else
+                    {
+                        for(int i = 0; i < BLE_CHANNEL_COUNT; i++)
+                        {
+                            if(evt->attr_handle == appChannelCharHandles[i] + 2)
+                            {
+                                app_notification_enable(i, evt->att_data[0] == 0x01);
+                                #ifdef BLE_NO_ACT_TIMEOUT_ENABLE
+                                    if(evt->att_data[0] == 0x01)
+                                    {
+                                        ble_no_act_active = false;
+                                    }
+                                #endif
+                            }
+                        }
+                    }
                 }
                 break;
                 case EVT_BLUE_INITIALIZED:
@@ -380,6 +457,21 @@ void HCI_Event_CB(void *pckt)
                     }
                 }
                 break;
+                case EVT_BLUE_ATT_EXCHANGE_MTU_RESP:
+                {
+                    evt_att_exchange_mtu_resp *resp = (evt_att_exchange_mtu_resp*)blue_evt->data;
+                    att_mtu = resp->server_rx_mtu;
+                    if(att_mtu > BLE_ATT_MAX_MTU)
+                    {
+                        att_mtu = BLE_ATT_MAX_MTU;
+                    }
+                    else if(att_mtu < BLE_ATT_DEFAULT_MTU)
+                    {
+                        att_mtu = BLE_ATT_DEFAULT_MTU;
+                    }
+                    debug("ATT MTU negotiated to %d", att_mtu);
+                }
+                break;
                 case EVT_BLUE_L2CAP_CONN_UPD_RESP:
                 {
                         evt_l2cap_conn_upd_resp *resp = (evt_l2cap_conn_upd_resp*)blue_evt->data;
@@ -512,8 +604,6 @@ bool openxc::interface::ble::initialize(BleDevice* device)
     uint8_t hwVersion; 
     uint16_t fwVersion;
     
-    RingBuffer_Initialize(&notify_buffer_ring,(char*)notify_buffer, NOTIFY_BUFFER_SZ);
-    
     device->status = BleStatus::RADIO_OFF;
     
     initializeCommon(device);
@@ -685,12 +775,30 @@ void openxc::interface::ble::read(BleDevice* device) {
     }
     err = HCI_Process();
 
+    if(device->status >= BleStatus::CONNECTED && updateConnectionProfile(device))
+    {
+        // ask for the new parameters on this pass rather than waiting out
+        // the retry interval
+        send_l2cap_request = true;
+        l2cap_request_attempts = 0;
+        l2captimer = uptimeMs() - L2CAP_RETRY_INTERVAL_MS;
+    }
+
     //send_l2cap_request = false;
-    if(send_l2cap_request == true &&  uptimeMs() > l2captimer + 1000){
+    if(send_l2cap_request == true &&  uptimeMs() - l2captimer >= L2CAP_RETRY_INTERVAL_MS){
         
         l2captimer = uptimeMs(); 
         //debug("Updating L2CAP connection parameters");
-        ret = aci_l2cap_connection_parameter_update_request(conn_handle, device->blesettings.slave_min_ms, device->blesettings.slave_max_ms, 0, 600); 
+        if(device->fastConnection)
+        {
+            ret = aci_l2cap_connection_parameter_update_request(conn_handle, device->blesettings.fast_min_ms,
+                    device->blesettings.fast_max_ms, 0, L2CAP_SUPERVISION_TIMEOUT);
+        }
+        else
+        {
+            ret = aci_l2cap_connection_parameter_update_request(conn_handle, device->blesettings.slave_min_ms,
+                    device->blesettings.slave_max_ms, device->blesettings.slave_latency, L2CAP_SUPERVISION_TIMEOUT);
+        }
         
         if(ret != BLE_STATUS_SUCCESS)
             debug("Failed L2CAP Connection Update");
@@ -744,91 +852,128 @@ bool openxc::interface::ble::connected(BleDevice* device)
 }
 
 
-void openxc::interface::ble::processSendQueue(BleDevice* device) 
-{    
-    static uint8_t ndata[21];
-    char d;uint8_t ret;
-    uint32_t sz;
-    
-    if(connected(device))
-    {
+/* Private: Hand notifications from one stream's queue to the radio, while
+ * the pass still has some of its BLE_MAX_NOTIFIES_PER_PASS left.
+ *
+ * Returns false if the radio refused one, so nothing more should be sent this
+ * pass.
+ */
+static bool notifyStream(NotifyStream* stream, int maxNotifySize,
+        int* notifies)
+{
+    static uint8_t ndata[BLE_MAX_NOTIFY_SIZE];
+    uint8_t ret;
+    int sz;
 
-        while((RingBuffer_FreeSpace(&notify_buffer_ring) > 0) && QUEUE_EMPTY(uint8_t, &device->sendQueue)==false)
+    for(; *notifies < BLE_MAX_NOTIFIES_PER_PASS; (*notifies)++)
+    {
+        sz = BYTE_QUEUE_LENGTH(stream->queue);
+        if(sz == 0)
         {
-            d = QUEUE_POP(uint8_t,&device->sendQueue);
-            RingBuffer_Write(&notify_buffer_ring, &d, 1);
-            
+            break;
         }
         
-        sz = RingBuffer_UsedSpace(&notify_buffer_ring);
-        
-        if(sz > 0)
+        if(sz >= maxNotifySize)
         {
-            if(sz > 20)
-            {
-                sz = 20;
-        
-                small_packet_notify_present = false;
+            sz = maxNotifySize;
+    
+            stream->small_packet_notify_present = false;
 
-            }
-            else
-            {
+        }
+        else if(!stream->urgent)
+        {
 
-                if(small_packet_notify_present == false)
+            if(stream->small_packet_notify_present == false)
+            {
+                stream->small_packet_notify_time_ms = uptimeMs();
+                stream->small_packet_notify_present = true;
+                return true;
+            }
+            else{
+                if( uptimeMs() > stream->small_packet_notify_time_ms + SMALL_NOTIFY_PACKET_TIMEOUT)
                 {
-                    small_packet_notify_time_ms = uptimeMs();
-                    small_packet_notify_present = true;
-                    return;
+                    stream->small_packet_notify_time_ms = uptimeMs();
+                    stream->small_packet_notify_present = false;
                 }
-                else{
-                    if( uptimeMs() > small_packet_notify_time_ms + SMALL_NOTIFY_PACKET_TIMEOUT)
-                    {
-                        small_packet_notify_time_ms = uptimeMs();
-                        small_packet_notify_present = false;
-                    }
-                    else
-                    {
-                        return;
-                    }
+                else
+                {
+                    return true;
                 }
-
             }
-            
-            RingBuffer_Peek(&notify_buffer_ring,(char*) ndata, sz);
-            
-            //Avoiding retries to allow more bandwidth to foreground application
-            
-            ret = GATT_App_Notify((uint8_t*)ndata, sz);
-            
-            if( ret != BLE_STATUS_SUCCESS)
+
+        }
+        
+        sz = peekBytes(stream->queue, ndata, sz);
+        
+        //Avoiding retries to allow more bandwidth to foreground application
+        
+        ret = GATT_Channel_Notify(stream->charHandle, ndata, sz);
+        
+        if( ret != BLE_STATUS_SUCCESS)
+        {
+            if(ret == BLE_STATUS_TIMEOUT)
             {
-                if(ret == BLE_STATUS_TIMEOUT)
+                debug("Notification Timed Out %d",ret);
+                app_disconnected();
+                if(ST_BLE_Set_Connectable(getConfiguration()->ble) != BLE_STATUS_SUCCESS)
                 {
-                    debug("Notification Timed Out %d",ret);
-                    app_disconnected();
-                    if(ST_BLE_Set_Connectable(getConfiguration()->ble) != BLE_STATUS_SUCCESS)
-                    {
-                        ST_BLE_Failed_CB(BleError::SET_CONNECTABLE_FAILED);
-                    }    
-                }
-                else if(notification_fail_retries > MAX_BLE_NOTIFY_RETRIES)
-                {
-                    debug("Notification failed code %d",ret);
-                    notification_fail_retries = 0;
-                    notification_fail_retries++;
-                }
-                
+                    ST_BLE_Failed_CB(BleError::SET_CONNECTABLE_FAILED);
+                }    
             }
-            else
+            else if(notification_fail_retries > MAX_BLE_NOTIFY_RETRIES)
             {
+                debug("Notification failed code %d",ret);
                 notification_fail_retries = 0;
-                RingBuffer_Read(&notify_buffer_ring,(char*) ndata, sz);
-                
+                notification_fail_retries++;
             }
+            // the radio is out of transmit buffers for this connection
+            // event, so leave the rest for the next pass
+            return false;
+        }
+        
+        notification_fail_retries = 0;
+        popBytes(stream->queue, NULL, sz);
+    }
+    return true;
+}
 
-        }    
+void openxc::interface::ble::processSendQueue(BleDevice* device) 
+{    
+    if(!connected(device))
+    {
+        return;
+    }
+
+    notify_streams[0].queue = &device->channels[BleChannel::COMMAND_RESPONSE_CHANNEL].sendQueue;
+    notify_streams[0].charHandle = appChannelCharHandles[BleChannel::COMMAND_RESPONSE_CHANNEL];
+    notify_streams[0].urgent = true;
+    notify_streams[1].queue = &device->sendQueue;
+    notify_streams[1].charHandle = appRSPCharHandle;
+    int stream = 2;
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++)
+    {
+        if(i != BleChannel::COMMAND_RESPONSE_CHANNEL)
+        {
+            notify_streams[stream].queue = &device->channels[i].sendQueue;
+            notify_streams[stream].charHandle = appChannelCharHandles[i];
+            stream++;
+        }
+    }
+
+    // Notifications are packed straight from the send queues up to the
+    // negotiated MTU, and several are handed to the radio per pass so it can
+    // fill each connection event instead of sending one packet per event.
+    int maxNotifySize = att_mtu - BLE_ATT_NOTIFY_HEADER_SIZE;
+    int notifies = 0;
+    for(int i = 0; i < 1 + BLE_CHANNEL_COUNT &&
+            notifies < BLE_MAX_NOTIFIES_PER_PASS; i++)
+    {
+        if(!notifyStream(&notify_streams[i], maxNotifySize, &notifies) ||
+                !connected(device))
+        {
+            break;
+        }
     }
-    return;
 }
 
 #endif
@@ -8,6 +8,7 @@
 #include "spi.h" 
 #include "blueNRG.h"
 #include "hci.h"
+#include "interrupts_pic32.h"
 #include "WProgram.h" //for arduino millis  reference
 #include "platform_profile.h"
 /**
@@ -28,7 +29,7 @@
 uint8_t stickyfisr = 0;
 
 #ifdef BLE_SUPPORT
-void __ISR(_EXTERNAL_0_VECTOR, ipl7) INT0Interrupt() 
+void __ISR(_EXTERNAL_0_VECTOR, ISR_IPL(BLE_INTERRUPT_PRIORITY)) INT0Interrupt() 
 { 
     
     mINT0ClearIntFlag(); 
@@ -77,7 +78,8 @@ int BlueNRG_ISRDeInit(void){
 int BlueNRG_ISRInit(void){
     TRISDSET = (1 << 0);
     LATDSET  = (1 << 0);
-    ConfigINT0(EXT_INT_ENABLE | RISING_EDGE_INT | EXT_INT_PRI_7);
+    ConfigINT0(EXT_INT_ENABLE | RISING_EDGE_INT |
+            EXT_INT_PRIORITY(BLE_INTERRUPT_PRIORITY));
     return (0);
 }/* end BlueNRGISRInit() */
 
@@ -1,7 +1,11 @@
 #include "can/canread.h"
+#include "can/canqueue.h"
+#include "can/canwrite.h"
+#include "can/gateway.h"
 #include "canutil_pic32.h"
 #include "signals.h"
 #include "util/log.h"
+#include "util/timer.h"
 #include "power.h"
 
 namespace power = openxc::power;
@@ -17,7 +21,8 @@ static CanMessage receiveCanMessage(CanBus* bus) {
         id: message->msgSID.SID,
         format: CanMessageFormat::STANDARD,
         data: {0},
-        length: (uint8_t) message->msgEID.DLC
+        length: (uint8_t) message->msgEID.DLC,
+        receivedUs: openxc::util::time::systemTimeUs()
     };
     memcpy(result.data, message->data, CAN_MESSAGE_SIZE);
 
@@ -38,6 +43,16 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
         power::handleWake();
     }
 
+    // refill the transmit FIFO as it drains
+    if((CAN_CONTROLLER(bus)->getModuleEvent() & CAN::TX_EVENT) != 0
+            && CAN_CONTROLLER(bus)->getPendingEventCode()
+            == CAN::CHANNEL0_EVENT) {
+        openxc::can::write::sendPendingWrites(bus);
+        if(bus->pendingWriteCount == 0) {
+            openxc::can::write::disableTransmitInterrupt(bus);
+        }
+    }
+
     // handle the receive message event
     if((CAN_CONTROLLER(bus)->getModuleEvent() & CAN::RX_EVENT) != 0
             && CAN_CONTROLLER(bus)->getPendingEventCode()
@@ -47,7 +62,8 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
                 CAN::RX_CHANNEL_NOT_EMPTY, false);
 
         CanMessage message = receiveCanMessage(bus);
-        if(!QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
+        openxc::can::gateway::forward(bus, &message);
+        if(!openxc::can::queue::push(&bus->receiveQueue, &message)) {
             // An exception to the "don't leave commented out code" rule,
             // this log statement is useful for debugging performance issues
             // but if left enabled all of the time, it can can slown down
@@ -55,7 +71,7 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
             // permanent interrupt handling land.
             //
             // debug("Dropped CAN message with ID 0x%02x -- queue is full with %d",
-                    // message.id, QUEUE_LENGTH(CanMessage, &bus->receiveQueue));
+                    // message.id, openxc::can::queue::length(&bus->receiveQueue));
             ++bus->messagesDropped;
         }
 
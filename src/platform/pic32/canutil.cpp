@@ -3,6 +3,7 @@
 #include "signals.h"
 #include "util/log.h"
 #include "gpio.h"
+#include <plib.h>
 
 #if defined(CROSSCHASM_C5_BT)
     #define CAN1_TRANSCEIVER_SWITCHED
@@ -25,9 +26,13 @@
 #define CAN_RX_CHANNEL 1
 #define BUS_MEMORY_BUFFER_SIZE 2 * 8 * 16
 
+// The bus off flag in each module's CiTREC register, which also holds the
+// receive error counter in bits 0-7 and the transmit error counter in 8-15.
+#define CAN_TREC_TXBO (1 << 21)
+#define CAN_TREC_TERRCNT_SHIFT 8
+
 namespace gpio = openxc::gpio;
 
-using openxc::signals::getCanBuses;
 using openxc::util::log::debug;
 using openxc::gpio::GpioValue;
 using openxc::gpio::GPIO_VALUE_LOW;
@@ -38,13 +43,19 @@ CAN can1Actual(CAN::CAN1);
 CAN can2Actual(CAN::CAN2);
 CAN* can1 = &can1Actual;
 CAN* can2 = &can2Actual;
+CAN* CAN_CONTROLLERS[CAN_CONTROLLER_COUNT] = {&can1Actual, &can2Actual};
 
 /* Private:  A message area for each bus, for 2 channels to store 8 16 byte
  * messages - required by the PIC32 CAN library. We could add this to the CanBus
  * struct, but the PIC32 has way more memory than some of our other supported
  * platforms so I don't want to burden them unnecessarily.
  */
-uint8_t CAN_CONTROLLER_BUFFERS[2][BUS_MEMORY_BUFFER_SIZE];
+uint8_t CAN_CONTROLLER_BUFFERS[CAN_CONTROLLER_COUNT][BUS_MEMORY_BUFFER_SIZE];
+
+/* Private: The bus on each CAN module, indexed by bus address - 1, for its
+ * interrupt handler.
+ */
+static CanBus* INTERRUPT_BUSES[CAN_CONTROLLER_COUNT];
 
 static CAN::OP_MODE switchControllerMode(CanBus* bus, CAN::OP_MODE mode) {
     CAN::OP_MODE previousMode = CAN_CONTROLLER(bus)->getOperatingMode();
@@ -65,6 +76,12 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
                 CAN::SID, CAN::FILTER_MASK_IDE_TYPE);
         CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK1, 0x1FFFFFFF,
                 CAN::EID, CAN::FILTER_MASK_IDE_TYPE);
+        CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK2,
+                0x7FF & ~(CAN_FILTER_BLOCK_SIZE - 1), CAN::SID,
+                CAN::FILTER_MASK_IDE_TYPE);
+        CAN_CONTROLLER(bus)->configureFilterMask(CAN::FILTER_MASK3,
+                0x1FFFFFFF & ~(CAN_FILTER_BLOCK_SIZE - 1), CAN::EID,
+                CAN::FILTER_MASK_IDE_TYPE);
     } else {
         debug("Disabling primary AF filter mask for bus %d to allow "
                 "all messages through", bus->address);
@@ -85,60 +102,96 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
     return true;
 }
 
+/* Private: Returns the number of IDs starting at id that one hardware filter
+ * can match, without matching anything past highId - a whole block under the
+ * block mask if id starts an aligned block that fits, otherwise just id.
+ */
+static uint32_t filterSpan(uint32_t id, uint32_t highId) {
+    if(id % CAN_FILTER_BLOCK_SIZE == 0 &&
+            highId - id >= CAN_FILTER_BLOCK_SIZE - 1) {
+        return CAN_FILTER_BLOCK_SIZE;
+    }
+    return 1;
+}
+
+/* Private: Returns the number of hardware filters needed to match every ID in
+ * the compiled ranges.
+ */
+static int countHardwareFilters(AcceptanceFilterRange* ranges,
+        int rangeCount) {
+    int filterCount = 0;
+    for(int i = 0; i < rangeCount; i++) {
+        for(uint32_t id = ranges[i].lowId; id <= ranges[i].highId;
+                id += filterSpan(id, ranges[i].highId)) {
+            ++filterCount;
+        }
+    }
+    return filterCount;
+}
+
+static void configureHardwareFilter(CanBus* bus, int filter, uint32_t id,
+        CanMessageFormat format, bool block) {
+    // Standard format message IDs match filter mask 0 (or 2 for a block),
+    // extended format IDs match filter mask 1 (or 3)
+    CAN::FILTER_MASK mask;
+    if(format == CanMessageFormat::STANDARD) {
+        mask = block ? CAN::FILTER_MASK2 : CAN::FILTER_MASK0;
+    } else {
+        mask = block ? CAN::FILTER_MASK3 : CAN::FILTER_MASK1;
+    }
+
+    // Must disable before changing or else the filters do not work!
+    CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(filter), false);
+    CAN_CONTROLLER(bus)->configureFilter(CAN::FILTER(filter), id,
+            format == CanMessageFormat::STANDARD ? CAN::SID : CAN::EID);
+    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(filter), mask,
+            CAN::CHANNEL(CAN_RX_CHANNEL));
+    CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(filter), true);
+    debug("Added acceptance filter for %s 0x%x%s on bus %d to AF",
+            format == CanMessageFormat::STANDARD ? "STD" : "EXT", id,
+            block ? " block" : "", bus->address);
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     // For the PIC32 we *could* only change the filters for one bus, but to
     // simplify things we'll reset everything like we have to with the LPC1768
-    uint16_t totalFilterCount = 0;
     for(int i = 0; i < busCount; i++) {
         CanBus* bus = &buses[i];
-        uint16_t busFilterCount = 0;
         CAN::OP_MODE previousMode = switchControllerMode(bus, CAN::CONFIGURATION);
 
-        if(LIST_EMPTY(&bus->acceptanceFilters) || bus->bypassFilters) {
+        AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+        int rangeCount = compileAcceptanceFilters(bus, ranges,
+                MAX_ACCEPTANCE_FILTERS);
+        if(rangeCount <= 0 || bus->bypassFilters) {
             debug("Bus %d has no filters configured or manually set to bypass, "
                     "turning off acceptance filter", bus->address);
             resetAcceptanceFilterStatus(bus, false);
+        } else if(countHardwareFilters(ranges, rangeCount) > CAN_FILTER_COUNT) {
+            debug("Bus %d needs more than %d hardware filters, "
+                    "turning off acceptance filter", bus->address,
+                    CAN_FILTER_COUNT);
+            resetAcceptanceFilterStatus(bus, false);
         } else {
             // Must set the controller's AF filter status first and only once,
             // before configuring, because it wipes anything you've configured
             // when you set it.
             resetAcceptanceFilterStatus(bus, true);
 
-            AcceptanceFilterListEntry* entry;
-            LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-                if(busFilterCount >= MAX_ACCEPTANCE_FILTERS) {
-                    break;
-                }
-
-                // Must disable before changing or else the filters do not work!
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), false);
-                if(entry->format == CanMessageFormat::STANDARD) {
-                    // Standard format message IDs match filter mask 0
-                    debug("Added acceptance filter for STD 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::SID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK0, CAN::CHANNEL(CAN_RX_CHANNEL));
-                } else {
-                    // Extended format message IDs match filter mask 1
-                    debug("Added acceptance filter for EXT 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::EID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK1, CAN::CHANNEL(CAN_RX_CHANNEL));
+            int filterCount = 0;
+            for(int j = 0; j < rangeCount; j++) {
+                uint32_t span;
+                for(uint32_t id = ranges[j].lowId; id <= ranges[j].highId;
+                        id += span) {
+                    span = filterSpan(id, ranges[j].highId);
+                    configureHardwareFilter(bus, filterCount++, id,
+                            ranges[j].format, span > 1);
                 }
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), true);
-
-                ++totalFilterCount;
-                ++busFilterCount;
             }
 
             // Disable the remaining unused filters. When AF is "off" we are
             // actually using filter 0, so we don't want to disable that.
-            for(int disabledFilters = busFilterCount;
-                    disabledFilters < MAX_ACCEPTANCE_FILTERS; ++disabledFilters) {
+            for(int disabledFilters = filterCount;
+                    disabledFilters < CAN_FILTER_COUNT; ++disabledFilters) {
                 CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(disabledFilters), false);
             }
         }
@@ -160,6 +213,9 @@ bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount)
  * without disabling the CAN module itself.
  */
 void openxc::can::deinitialize(CanBus* bus) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT) {
+        return;
+    }
     switchControllerMode(bus, CAN::DISABLE);
 
     // disable off-chip line driver
@@ -170,35 +226,92 @@ void openxc::can::deinitialize(CanBus* bus) {
     #endif
 }
 
-/* Called by the Interrupt Service Routine whenever an event we registered for
- * occurs - this is where we wake up and decide to process a message. */
-static void handleCan1Interrupt() {
-    openxc::can::pic32::handleCanInterrupt(&getCanBuses()[0]);
+void openxc::can::readErrorCounters(CanBus* bus, CanErrorCounters* counters) {
+    uint32_t status = bus->address == 1 ? C1TREC : C2TREC;
+    counters->transmitErrors = (status >> CAN_TREC_TERRCNT_SHIFT) & 0xff;
+    counters->receiveErrors = status & 0xff;
+    counters->busOff = status & CAN_TREC_TXBO;
 }
 
-static void handleCan2Interrupt() {
-    openxc::can::pic32::handleCanInterrupt(&getCanBuses()[1]);
+// The CAN module rejoins the bus by itself once it's seen the recessive bits
+// the spec requires, without waiting to be told.
+void openxc::can::recoverFromBusOff(CanBus* bus) { }
+
+/* Private: Configure the CAN module clock for a speed. The module has to be in
+ * configuration mode.
+ *
+ * The propagation, phase segment 1 and phase segment 2 are configured to have
+ * 3TQ. The CANSetSpeed() function sets the baud.
+ */
+static void configureBitTiming(CanBus* bus, unsigned int speed) {
+    CAN::BIT_CONFIG canBitConfig;
+    canBitConfig.phaseSeg2Tq            = CAN::BIT_3TQ;
+    canBitConfig.phaseSeg1Tq            = CAN::BIT_3TQ;
+    canBitConfig.propagationSegTq       = CAN::BIT_3TQ;
+    canBitConfig.phaseSeg2TimeSelect    = CAN::TRUE;
+    canBitConfig.sample3Time            = CAN::TRUE;
+    canBitConfig.syncJumpWidth          = CAN::BIT_2TQ;
+    CAN_CONTROLLER(bus)->setSpeed(&canBitConfig, SYS_FREQ, speed);
 }
 
+void openxc::can::setBitRate(CanBus* bus, unsigned int speed,
+        bool listenOnly) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT ||
+            speed == 0) {
+        return;
+    }
+
+    switchControllerMode(bus, CAN::CONFIGURATION);
+    configureBitTiming(bus, speed);
+    switchControllerMode(bus, listenOnly ? CAN::LISTEN_ONLY :
+            CAN::NORMAL_OPERATION);
+}
+
+void openxc::can::setOperatingMode(CanBus* bus, bool writable) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT) {
+        return;
+    }
+
+    CAN::OP_MODE mode;
+    if(bus->loopback) {
+        mode = CAN::LOOPBACK;
+    } else if(writable) {
+        mode = CAN::NORMAL_OPERATION;
+    } else {
+        mode = CAN::LISTEN_ONLY;
+    }
+    switchControllerMode(bus, CAN::CONFIGURATION);
+    switchControllerMode(bus, mode);
+}
+
+/* Called by the Interrupt Service Routine whenever an event we registered for
+ * occurs - this is where we wake up and decide to process a message. Each CAN
+ * module has its own interrupt vector and handler, which goes straight to its
+ * bus.
+ */
+template<int ADDRESS>
+static void handleCanModuleInterrupt() {
+    openxc::can::pic32::handleCanInterrupt(INTERRUPT_BUSES[ADDRESS - 1]);
+}
+
+static void (*const INTERRUPT_HANDLERS[CAN_CONTROLLER_COUNT])() = {
+    handleCanModuleInterrupt<1>,
+    handleCanModuleInterrupt<2>,
+};
+
 void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
         const int busCount) {
+    if(bus->address < 1 || bus->address > CAN_CONTROLLER_COUNT) {
+        debug("No CAN module for bus %d", bus->address);
+        return;
+    }
     can::initializeCommon(bus);
     // Switch the CAN module ON and switch it to Configuration mode. Wait till
     // the switch is complete
     CAN_CONTROLLER(bus)->enableModule(true);
     switchControllerMode(bus, CAN::CONFIGURATION);
 
-    // Configure the CAN Module Clock. The CAN::BIT_CONFIG data structure is
-    // used for this purpose. The propagation, phase segment 1 and phase segment
-    // 2 are configured to have 3TQ. The CANSetSpeed() function sets the baud.
-    CAN::BIT_CONFIG canBitConfig;
-    canBitConfig.phaseSeg2Tq            = CAN::BIT_3TQ;
-    canBitConfig.phaseSeg1Tq            = CAN::BIT_3TQ;
-    canBitConfig.propagationSegTq       = CAN::BIT_3TQ;
-    canBitConfig.phaseSeg2TimeSelect    = CAN::TRUE;
-    canBitConfig.sample3Time            = CAN::TRUE;
-    canBitConfig.syncJumpWidth          = CAN::BIT_2TQ;
-    CAN_CONTROLLER(bus)->setSpeed(&canBitConfig, SYS_FREQ, bus->speed);
+    configureBitTiming(bus, bus->speed);
 
     // Assign the buffer area to the CAN module. Note the size of each Channel
     // area. It is 2 (Channels) * 8 (Messages Buffers) 16 (bytes/per message
@@ -230,6 +343,9 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
     CAN_CONTROLLER(bus)->enableChannelEvent(CAN::CHANNEL1,
             CAN::RX_CHANNEL_NOT_EMPTY, true);
     CAN_CONTROLLER(bus)->enableModuleEvent(CAN::RX_EVENT, true);
+    // The transmit channel's event is only enabled while there are pending
+    // writes (see can::write::enableTransmitInterrupt)
+    CAN_CONTROLLER(bus)->enableModuleEvent(CAN::TX_EVENT, true);
 
     // enable the bus activity wake-up event (to enable wake from sleep)
     CAN_CONTROLLER(bus)->enableModuleEvent(
@@ -258,8 +374,8 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
 
     switchControllerMode(bus, mode);
 
-    // TODO an error if the address isn't valid
-    CAN_CONTROLLER(bus)->attachInterrupt(bus->address == 1 ?
-            handleCan1Interrupt : handleCan2Interrupt);
+    INTERRUPT_BUSES[bus->address - 1] = bus;
+    CAN_CONTROLLER(bus)->attachInterrupt(
+            INTERRUPT_HANDLERS[bus->address - 1]);
     debug("Done.");
 }
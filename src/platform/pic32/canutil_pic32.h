@@ -10,8 +10,20 @@
 extern CAN* can1;
 extern CAN* can2;
 
+// The number of CAN modules on the PIC32, for buses 1 and 2.
+#define CAN_CONTROLLER_COUNT 2
+
+// The CAN modules, indexed by bus address - 1.
+extern CAN* CAN_CONTROLLERS[CAN_CONTROLLER_COUNT];
+
 #define SYS_FREQ (80000000L)
-#define CAN_CONTROLLER(bus) ((CAN*)(bus->address == 1 ? can1 : can2))
+
+// The number of acceptance filters in each PIC32 CAN module.
+#define CAN_FILTER_COUNT 32
+// The width of the aligned blocks of IDs matched by a single filter under the
+// block masks (FILTER_MASK2 and FILTER_MASK3) - must be a power of two.
+#define CAN_FILTER_BLOCK_SIZE 8
+#define CAN_CONTROLLER(bus) (CAN_CONTROLLERS[(bus)->address - 1])
 
 namespace openxc {
 namespace can {
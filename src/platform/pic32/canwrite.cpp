@@ -30,8 +30,22 @@ bool openxc::can::write::sendMessage(const CanBus* bus, const CanMessage* reques
         CAN_CONTROLLER(bus)->updateChannel(CAN::CHANNEL0);
         CAN_CONTROLLER(bus)->flushTxChannel(CAN::CHANNEL0);
         return true;
-    } else {
-        debug("Unable to get TX message area");
     }
+    // the transmit FIFO is full - the caller retries, and this is also called
+    // from the transmit interrupt, so don't log here
     return false;
 }
+
+void openxc::can::write::disableTransmitInterrupt(CanBus* bus) {
+    CAN_CONTROLLER(bus)->enableChannelEvent(CAN::CHANNEL0,
+            CAN::TX_CHANNEL_NOT_FULL, false);
+}
+
+void openxc::can::write::enableTransmitInterrupt(CanBus* bus) {
+    // The event fires whenever the transmit FIFO has room, so only ask for it
+    // while there's something left to send
+    if(bus->pendingWriteCount > 0) {
+        CAN_CONTROLLER(bus)->enableChannelEvent(CAN::CHANNEL0,
+                CAN::TX_CHANNEL_NOT_FULL, true);
+    }
+}
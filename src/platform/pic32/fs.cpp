@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include <plib.h>
 #include <stdbool.h>
 #include <ctype.h>
@@ -16,19 +17,49 @@
 #include "rtcc.h"
 #include "commands/commands.h"
 #include "commands/sd_mount_status_command.h"
+#include "commands/sd_stream_command.h"
+#include "can/canread.h"
+#include "interface/usb.h"
 
 static uint32_t file_elapsed_timer=0;
 static uint32_t file_flush_timer=0;
  
 using openxc::util::log::debug;
+using openxc::util::log::warning;
 using openxc::config::getConfiguration;
+using openxc::util::bytebuffer::popBytes;
+using openxc::util::bytebuffer::pushBytes;
+using openxc::can::read::publishStringEventedMessage;
 
 namespace lights = openxc::lights;
 namespace uart = openxc::interface::uart;
+namespace usb = openxc::interface::usb;
 
 
 static FS_STATE fs_mode = FS_STATE::NONE_CONNECTED;
 
+#if DEFAULT_FS_JOURNAL
+// The journal block being filled, its payload written in place after the
+// header (see FS_JOURNAL_BLOCK_SIZE).
+static uint8_t journal_block[FS_JOURNAL_BLOCK_SIZE];
+static uint16_t journal_length = 0;
+static uint32_t journal_sequence = 0;
+static uint32_t journal_commit_timer = 0;
+static bool journal_recovering = false;
+#endif
+
+#if DEFAULT_FS_INDEX
+static uint32_t index_timer = 0;
+#endif
+
+// The log file being sent over the USB file endpoint (see fs::startStream)
+#define STREAM_SECTOR_SIZE 512
+static bool stream_active = false;
+static char stream_file[13];
+static uint32_t stream_offset = 0;
+//the size of the file as its handle saw it when it was opened
+static uint32_t stream_size = 0;
+
 static bool sd_mount_status = false;
 
 extern "C" {
@@ -86,13 +117,205 @@ bool openxc::interface::fs::getSDStatus(void){
     return false;    
     
 }
+#if DEFAULT_FS_JOURNAL
+/* Seal the journal block being filled and pass it on to the session cache.
+ */
+static void writeJournalBlock(openxc::interface::fs::FsDevice* device) {
+    openxc::interface::fs::sealJournalBlock(journal_block, journal_sequence++,
+            journal_length);
+    openxc::interface::fs::write(device, journal_block, FS_JOURNAL_BLOCK_SIZE);
+    journal_length = 0;
+}
+
+/* The recovery pass's check of each block of the last journal - it must be
+ * intact and follow on from the block before it.
+ */
+static uint8_t validateJournalBlock(uint8_t* block) {
+    uint32_t sequence;
+    if(openxc::interface::fs::openJournalBlock(block, &sequence) < 0 ||
+            (journal_recovering && sequence != journal_sequence)) {
+        return false;
+    }
+    journal_recovering = true;
+    journal_sequence = sequence + 1;
+    return true;
+}
+
+/* Find where the journal left by the last run ends - everything up to there
+ * reached the card, and the rest of its preallocated file is still free - and
+ * carry on writing into it, with the sequence numbers following on.
+ */
+static void recoverJournal(void) {
+    uint8_t ret;
+    journal_recovering = false;
+    journal_sequence = 0;
+    journal_length = 0;
+    if(fsmanSessionResume(&ret, FS_JOURNAL_BLOCK_SIZE, &validateJournalBlock)) {
+        debug("Recovered SD journal up to block %d", journal_sequence);
+    } else {
+        debug("No SD journal to resume, starting at block %d", journal_sequence);
+    }
+    journal_recovering = false;
+}
+#endif
+
+#if DEFAULT_FS_INDEX
+static uint64_t indexTimestamp(void) {
+    uint64_t timestamp;
+    if(!openxc::pipeline::currentTimestamp(&timestamp)) {
+        timestamp = openxc::util::time::uptimeMs();
+    }
+    return timestamp;
+}
+
+/* Append a record for the current position in the session file to the file's
+ * index, and if it's a trip boundary, a line to the trip catalog.
+ */
+static void writeIndexRecord(openxc::interface::fs::IndexRecordType type) {
+    const char* log_file = fsmanSessionFileName();
+    char index_file[13];
+    if(log_file == NULL || !openxc::interface::fs::indexFileName(log_file,
+                index_file, sizeof(index_file))){
+        return;
+    }
+    
+    uint32_t offset = fsmanSessionOffset();
+    uint64_t timestamp = indexTimestamp();
+    uint8_t record[FS_INDEX_RECORD_SIZE];
+    openxc::interface::fs::encodeIndexRecord(type, offset, timestamp, record);
+    if(fsmanAppendFile(index_file, record, sizeof(record),
+                FS_INDEX_MAX_SIZE) < 0){
+        debug("Unable to write %s", index_file);
+    }
+    
+    char line[56];
+    int length = openxc::interface::fs::formatTripCatalogLine(type, timestamp,
+            log_file, offset, line, sizeof(line));
+    if(length > 0 && fsmanAppendFile(FS_TRIP_CATALOG_FILE, (uint8_t*) line,
+                length, FS_TRIP_CATALOG_MAX_SIZE) < 0){
+        debug("Unable to add to the trip catalog");
+    }
+}
+#endif
+
+static ByteQueue* streamQueue(void) {
+    return &getConfiguration()->usb.endpoints[FILE_ENDPOINT_INDEX].queue;
+}
+
+/* Whether the stream is of the file being written now, which may grow.
+ */
+static bool streamIsLive(void) {
+    const char* session_file = fsmanSessionFileName();
+    return session_file != NULL && !strcmp(session_file, stream_file);
+}
+
+static void endStream(void) {
+    char offset[12];
+    snprintf(offset, sizeof(offset), "%lu", (unsigned long) stream_offset);
+    publishStringEventedMessage(SD_STREAM_COMMAND_NAME, stream_file, offset,
+            &getConfiguration()->pipeline);
+    debug("Sent %s up to %s", stream_file, offset);
+    fsmanStreamClose();
+    stream_active = false;
+}
+
+/* Read the next piece of the streamed file into the file endpoint's queue, up
+ * to a sector boundary, so after the first read each one is a whole sector.
+ * USB sends it as the queue empties, behind the vehicle data.
+ */
+static void processStream(void) {
+    if(!stream_active) {
+        return;
+    }
+    if(!usb::connected(&getConfiguration()->usb)) {
+        debug("USB disconnected, stopping the SD card stream");
+        fsmanStreamClose();
+        stream_active = false;
+        return;
+    }
+    
+    bool live = streamIsLive();
+    if(stream_offset >= stream_size) {
+        //the handle only knows the size the file had when it was opened
+        if(live && fsmanSessionFlushedBytes() <= stream_size) {
+            return;
+        }
+        int32_t size = fsmanStreamOpen(stream_file, stream_offset);
+        if(size < 0 || (!live && stream_offset >= (uint32_t) size)) {
+            endStream();
+            return;
+        }
+        stream_size = size;
+    }
+    
+    //a preallocated file is full size from the start, so the file being
+    //written is only sent as far as the last flush
+    uint32_t end = stream_size;
+    if(live && fsmanSessionFlushedBytes() < end) {
+        end = fsmanSessionFlushedBytes();
+    }
+    if(stream_offset >= end) {
+        return;
+    }
+    
+    uint32_t length = STREAM_SECTOR_SIZE - stream_offset % STREAM_SECTOR_SIZE;
+    if(length > end - stream_offset) {
+        length = end - stream_offset;
+    }
+    if(length > BYTE_QUEUE_AVAILABLE(streamQueue())) {
+        length = BYTE_QUEUE_AVAILABLE(streamQueue());
+    }
+    if(length == 0) {
+        return;
+    }
+    
+    static uint8_t sector[STREAM_SECTOR_SIZE];
+    int32_t count = fsmanStreamRead(sector, length);
+    if(count <= 0) {
+        //reopen on the next pass to see where the file ends now
+        stream_size = stream_offset;
+        return;
+    }
+    pushBytes(streamQueue(), sector, count);
+    stream_offset += count;
+}
+
 void openxc::interface::fs::processSendQueue(FsDevice* device) 
 {    
-    uint8_t d;
-    while(QUEUE_EMPTY(uint8_t, &device->sendQueue)==false && fsman_available()>0)
+#if DEFAULT_FS_JOURNAL
+    // Collect the queue into journal blocks, which reach the session cache
+    // when full or at the next commit.
+    uint16_t length;
+    
+    while(BYTE_QUEUE_EMPTY(&device->sendQueue)==false && fsman_available()>0)
+    {
+        length = BYTE_QUEUE_LENGTH(&device->sendQueue);
+        if(length > FS_JOURNAL_PAYLOAD_SIZE - journal_length) {
+            length = FS_JOURNAL_PAYLOAD_SIZE - journal_length;
+        }
+        journal_length += popBytes(&device->sendQueue,
+                &journal_block[FS_JOURNAL_HEADER_SIZE + journal_length], length);
+        if(journal_length == FS_JOURNAL_PAYLOAD_SIZE) {
+            writeJournalBlock(device);
+        }
+    }
+    return;
+#endif
+
+    // Move the queue to the session cache in as few writes as possible, never
+    // more than the cache has room for - fs::manager writes the cache to the
+    // card a sector at a time.
+    static uint8_t chunk[FS_SEND_QUEUE_SIZE];
+    uint32_t length;
+    
+    while(BYTE_QUEUE_EMPTY(&device->sendQueue)==false && fsman_available()>0)
     {
-        d = QUEUE_POP(uint8_t,&device->sendQueue);
-        write(device, &d, 1);
+        length = BYTE_QUEUE_LENGTH(&device->sendQueue);
+        if(length > fsman_available()) {
+            length = fsman_available();
+        }
+        length = popBytes(&device->sendQueue, chunk, length);
+        write(device, chunk, length);
     }
     
 }
@@ -127,6 +350,9 @@ bool openxc::interface::fs::initialize(FsDevice* device){
         
     device->configured = true;
     initializeCommon(device);
+#if DEFAULT_FS_JOURNAL
+    recoverJournal();
+#endif
     return device->configured;
     
 }
@@ -146,8 +372,34 @@ void openxc::interface::fs::manager(FsDevice* device){ //session manager for FS
         if(device->configured == false)
             return;
         
+        processStream();
+        
         if(fsmanSessionIsActive()){
         
+            //one sector from the cache to the card per pass, so a slow card
+            //holds up the rest of the loop for a sector write at most
+            if(!fsmanSessionService(&ret)){
+                debug("Unable to write session cache");
+                debug(fsmanGetErrStr(ret));
+            }
+            
+#if DEFAULT_FS_JOURNAL
+            //commit whatever has been logged since the last commit, as a
+            //short block if need be. The file is preallocated so the flush
+            //never grows it - it costs the data sectors and the directory
+            //entry, with no FAT update.
+            if(millis() - journal_commit_timer >= DEFAULT_FS_JOURNAL_COMMIT_MS){
+                journal_commit_timer = millis();
+                if(journal_length > 0){
+                    writeJournalBlock(device);
+                    if(!fsmanSessionFlush(&ret)){
+                        debug("Unable to commit journal");
+                        debug(fsmanGetErrStr(ret));
+                    }
+                    file_flush_timer = secs_elapsed;
+                }
+            }
+#endif
             //flush session based on timeout of data to write entries to the FAT
             if(secs_elapsed > file_flush_timer + FILE_FLUSH_DATA_TIMEOUT_SEC){
                 debug("Performing Flush on FS");
@@ -156,6 +408,14 @@ void openxc::interface::fs::manager(FsDevice* device){ //session manager for FS
                 }
                 file_flush_timer = secs_elapsed;
             }
+#if DEFAULT_FS_INDEX
+            //a journal commit flushes far more often than the index needs,
+            //so checkpoints keep to the flush timeout either way
+            if(secs_elapsed > index_timer + FILE_FLUSH_DATA_TIMEOUT_SEC){
+                writeIndexRecord(CHECKPOINT);
+                index_timer = secs_elapsed;
+            }
+#endif
         }
     }
 }
@@ -191,12 +451,138 @@ void openxc::interface::fs::write(FsDevice* device, uint8_t *data, uint32_t len)
         }
     }
     if(!fsmanSessionWrite(&ret, data, len)){
-        debug("Unable to write data");
+        warning("Unable to write data");
         debug(fsmanGetErrStr(ret));
     }
 
 }    
 
+int openxc::interface::fs::readFile(FsDevice* device, const char* name,
+        uint8_t* buffer, size_t length){
+    
+    if(!connected(device)){
+        return -1;
+    }
+    return fsmanReadFile(name, buffer, length);
+}
+
+int openxc::interface::fs::appendFile(FsDevice* device, const char* name,
+        const uint8_t* data, size_t length, size_t maxSize){
+    
+    if(!connected(device)){
+        return -1;
+    }
+    return fsmanAppendFile(name, data, length, maxSize);
+}
+
+int openxc::interface::fs::readFileAt(FsDevice* device, const char* name,
+        size_t offset, uint8_t* buffer, size_t length){
+    
+    if(!connected(device)){
+        return -1;
+    }
+    return fsmanReadFileAt(name, offset, buffer, length);
+}
+
+int openxc::interface::fs::fileSize(FsDevice* device, const char* name){
+    
+    if(!connected(device)){
+        return -1;
+    }
+    return fsmanFileSize(name);
+}
+
+bool openxc::interface::fs::removeFile(FsDevice* device, const char* name){
+    
+    if(!connected(device)){
+        return false;
+    }
+    return fsmanRemoveFile(name);
+}
+
+bool openxc::interface::fs::nextLogFile(FsDevice* device, const char* after,
+        char* name, size_t size){
+    
+    if(!connected(device) || size < 13){
+        return false;
+    }
+    return fsmanNextLogFile(after, name);
+}
+
+void openxc::interface::fs::markTrip(FsDevice* device, bool started){
+#if DEFAULT_FS_INDEX
+    uint8_t ret;
+    
+    if(!connected(device)){
+        return;
+    }
+    
+    processSendQueue(device);
+#if DEFAULT_FS_JOURNAL
+    //the mark goes on a block boundary, so no block straddles it
+    if(journal_length > 0){
+        writeJournalBlock(device);
+    }
+#endif
+    if(!fsmanSessionIsActive()){
+        if(!started){
+            //nothing was logged since the last trip
+            return;
+        }
+        if(!fsmanSessionStart(&ret)){
+            debug(fsmanGetErrStr(ret));
+            return;
+        }
+    }
+    writeIndexRecord(started ? TRIP_START : TRIP_END);
+#endif
+}
+
+bool openxc::interface::fs::startStream(FsDevice* device, const char* name,
+        int32_t offset){
+    
+    if(!connected(device) || !usb::connected(&getConfiguration()->usb)){
+        return false;
+    }
+    if(name == NULL){
+        name = fsmanSessionFileName();
+        if(name == NULL){
+            debug("Nothing is being logged to stream");
+            return false;
+        }
+    }
+    if(strlen(name) >= sizeof(stream_file)){
+        return false;
+    }
+    
+    stopStream(device);
+    strcpy(stream_file, name);
+    uint32_t start = offset;
+    if(offset < 0){
+        start = streamIsLive() ? fsmanSessionFlushedBytes() : 0xffffffff;
+    }
+    int32_t size = fsmanStreamOpen(stream_file, start);
+    if(size < 0){
+        debug("No %s to stream", stream_file);
+        return false;
+    }
+    stream_size = size;
+    stream_offset = start < stream_size ? start : stream_size;
+    stream_active = true;
+    debug("Streaming %s from %lu", stream_file, (unsigned long) stream_offset);
+    return true;
+}
+
+void openxc::interface::fs::stopStream(FsDevice* device){
+    
+    if(stream_active){
+        fsmanStreamClose();
+        stream_active = false;
+        //don't leave the rest of this stream ahead of the next one
+        BYTE_QUEUE_RESET(streamQueue());
+    }
+}
+
 void openxc::interface::fs::deinitialize(FsDevice* device){
     uint8_t ret;
     
@@ -204,6 +590,12 @@ void openxc::interface::fs::deinitialize(FsDevice* device){
     
     if(getmode() == FS_STATE::VI_CONNECTED){
         if(device->configured == true){
+#if DEFAULT_FS_JOURNAL
+            if(journal_length > 0){
+                writeJournalBlock(device);
+            }
+#endif
+            stream_active = false;
             if(fsmanSessionIsActive()){
                 if(fsmanSessionEnd(&ret)){
                     debug("Unable to end session");
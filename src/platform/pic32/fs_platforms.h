@@ -22,6 +22,22 @@
     
     #define FILE_WRITE_RATE_SEC     DEFAULT_FILE_GENERATE_SECS
     
+    //size of each log file claimed on the card when it's created, 0 to let
+    //files grow as they're written
+    #ifndef DEFAULT_FILE_PREALLOCATE_KB
+        #define DEFAULT_FILE_PREALLOCATE_KB 0
+    #endif
+    
+    //the journal is only safe to write without updating the FAT if the file
+    //never has to grow
+    #if defined(DEFAULT_FS_JOURNAL) && DEFAULT_FS_JOURNAL && DEFAULT_FILE_PREALLOCATE_KB == 0
+        #undef DEFAULT_FILE_PREALLOCATE_KB
+        #define DEFAULT_FILE_PREALLOCATE_KB 1024
+        #warning "DEFAULT_FILE_PREALLOCATE_KB=1024 applied for DEFAULT_FS_JOURNAL"
+    #endif
+    
+    #define FILE_PREALLOCATE_BYTES  ((uint32_t)DEFAULT_FILE_PREALLOCATE_KB * 1024)
+    
     #define FILE_FLUSH_DATA_TIMEOUT_SEC 60
 
 #endif
\ No newline at end of file
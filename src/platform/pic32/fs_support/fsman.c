@@ -21,10 +21,17 @@
 
 static uint8_t* fsbuf;
 static uint32_t fsbufptr=0;
+static uint32_t fsfilepos=0; //bytes of the session file already written to the card
+static uint32_t fsfilesize=0; //size of a preallocated session file, 0 if it grows as written
+static char fsfilename[13]; //name of the session file, while one is open
+static uint32_t fsflushedpos=0; //bytes of the session file safe to read back, as of the last flush
+
+static void fsmanCacheRebase(uint32_t pos);
 
 static uint32_t fsnameseq=0;
 
 static FSFILE* file = NULL; //do we want to encapsulate this data into the device structure? Perhaps in a different approach from current
+static FSFILE* stream = NULL; //a file being read out alongside the session
 
 const char *error_code_str []=
 {
@@ -181,6 +188,76 @@ uint8_t fsmanSessionIsActive(void){
     return TRUE;
 }
 
+/* The name of the session file, or NULL if there isn't a session.
+ */
+const char* fsmanSessionFileName(void){
+    
+    return file == NULL ? NULL : fsfilename;
+}
+
+/* The position in the session file the next byte written will go to,
+ * whether or not the bytes before it have left the cache yet.
+ */
+uint32_t fsmanSessionOffset(void){
+    
+    return fsfilepos + fsbufptr;
+}
+
+/* How much of the session file another handle can read back - the bytes
+ * written to the card as of the last flush, when its directory entry was
+ * brought up to date.
+ */
+uint32_t fsmanSessionFlushedBytes(void){
+    
+    return fsflushedpos;
+}
+
+
+#if DEFAULT_FILE_PREALLOCATE_KB > 0
+/* Claims the whole session file up front by writing it out to
+ * FILE_PREALLOCATE_BYTES in one pass, so its clusters are allocated together,
+ * then reopens it to be overwritten from the start. Writes after this never
+ * extend the cluster chain, and the directory entry is left alone until the
+ * next flush or rotation.
+ */
+static uint8_t fsmanPreallocate(uint8_t * result_code, const char* file_name){
+    
+    uint8_t* zeros = fsbuf; //fill from the cache, while it's empty
+    uint32_t chunk = FS_BUF_SZ;
+    uint32_t remaining = FILE_PREALLOCATE_BYTES;
+    uint32_t sz;
+    
+    if(fsbufptr){
+        __debug("Cache in use, file will grow as written");
+        return TRUE;
+    }
+    memset(zeros, 0, chunk);
+    
+    while(remaining > 0){
+        sz = MIN(remaining, chunk);
+        if (FSfwrite(zeros, 1, sz, file) != sz){
+            *result_code = UNKNOWN_WRITE_ERROR;
+            FSfclose(file);
+            file = NULL;
+            return FALSE;
+        }
+        remaining -= sz;
+    }
+    
+    if (*result_code = FSfclose(file),
+            *result_code != CE_GOOD){
+        file = NULL;
+        return FALSE;
+    }
+    file = FSfopen (file_name,"r+");
+    if (file == NULL){
+        *result_code = UNKNOWN_WRITE_ERROR;
+        return FALSE;
+    }
+    fsfilesize = FILE_PREALLOCATE_BYTES;
+    return TRUE;
+}
+#endif
 
 uint8_t fsmanSessionStart(uint8_t * result_code){
     //open file here
@@ -196,6 +273,7 @@ uint8_t fsmanSessionStart(uint8_t * result_code){
     SetClockVars (ts.tm_year, ts.tm_mon, ts.tm_mday, ts.tm_hour, ts.tm_min, ts.tm_sec);
     
     sprintf(file_name,"%X.TXT", tm_code);
+    strcpy(fsfilename, file_name);
                             
     __debug("Creating %s",file_name);
     
@@ -205,11 +283,91 @@ uint8_t fsmanSessionStart(uint8_t * result_code){
         *result_code = UNKNOWN_WRITE_ERROR;
         return FALSE;
     }
+    fsmanCacheRebase(0); //anything still cached goes at the start of the new file
+    fsfilesize = 0;
+    fsflushedpos = 0;
+#if DEFAULT_FILE_PREALLOCATE_KB > 0
+    if (!fsmanPreallocate(result_code, file_name)){
+        __debug("Preallocating %s failed", file_name);
+        return FALSE;
+    }
+#endif
     return TRUE;
 }
 
+/* The cache is a ring of sectors - the cached byte for file position p is at
+ * fsbuf[p % FS_BUF_SZ], so each sector of the file sits whole in the cache and
+ * can be written on its own.
+ */
+static uint32_t fsmanCacheIndex(uint32_t pos){
+    return pos % FS_BUF_SZ;
+}
+
+/* Bytes from the start of the cache to the next sector boundary in the file.
+ */
+static uint32_t fsmanSectorRemaining(void){
+    return MEDIA_SECTOR_SIZE - (fsfilepos % MEDIA_SECTOR_SIZE);
+}
+
+static uint8_t fsmanFileFull(void){
+    return fsfilesize && fsfilepos >= fsfilesize;
+}
+
+static void fsmanCacheReverse(uint32_t start, uint32_t end){
+    uint8_t t;
+    while(start + 1 < end){
+        end--;
+        t = fsbuf[start];
+        fsbuf[start] = fsbuf[end];
+        fsbuf[end] = t;
+        start++;
+    }
+}
+
+/* Rotates the ring so the cached bytes are written to the file from pos on.
+ */
+static void fsmanCacheRebase(uint32_t pos){
+    uint32_t shift = (fsmanCacheIndex(pos) + FS_BUF_SZ - fsmanCacheIndex(fsfilepos)) % FS_BUF_SZ;
+    if(fsbufptr && shift){
+        fsmanCacheReverse(0, FS_BUF_SZ);
+        fsmanCacheReverse(0, shift);
+        fsmanCacheReverse(shift, FS_BUF_SZ);
+    }
+    fsfilepos = pos;
+}
+
+/* Writes the oldest len bytes of the cache to the session file.
+ */
+static uint8_t fsmanWriteCached(uint8_t * result_code, uint32_t len){
+    
+    uint32_t index = fsmanCacheIndex(fsfilepos);
+    uint32_t sz;
+    while(len > 0){
+        sz = MIN(len, FS_BUF_SZ - index);
+        if (FSfwrite ((void *)&fsbuf[index], 1, sz, file) != sz){
+            *result_code = UNKNOWN_WRITE_ERROR;
+            return FALSE;
+        }
+        fsfilepos += sz;
+        fsbufptr -= sz;
+        len -= sz;
+        index = fsmanCacheIndex(fsfilepos);
+    }
+    return TRUE;
+}
+
+/* Writes everything in the cache to the session file.
+ */
+static uint8_t fsmanWriteCache(uint8_t * result_code){
+    return fsmanWriteCached(result_code, fsbufptr);
+}
+
 uint32_t fsman_available(void){
-    return (FS_BUF_SZ - fsbufptr);
+    uint32_t room = FS_BUF_SZ - fsbufptr;
+    if (fsfilesize && fsfilesize - fsfilepos - fsbufptr < room){
+        room = fsfilesize - fsfilepos - fsbufptr;
+    }
+    return room;
 }
 
 
@@ -224,13 +382,10 @@ uint8_t fsmanSessionReset(uint8_t * result_code){
     if(pending){
         __debug("Resetting session pending to disk %d bytes", pending);
         
-        if (FSfwrite ((void *)fsbuf, 1, pending, file) != pending){
-            *result_code = UNKNOWN_WRITE_ERROR;
+        if (!fsmanWriteCache(result_code)){
             __debug("Write pending bytes failed");
             file = NULL;
             return FALSE;
-        }else{
-            fsbufptr = 0;
         }
     }
     if (*result_code = FSfclose(file),
@@ -239,42 +394,328 @@ uint8_t fsmanSessionReset(uint8_t * result_code){
     }
     return fsmanSessionStart(result_code);
 }
+
+/* Writes the oldest sector in the cache to the card, if a whole one is
+ * waiting, and rotates a preallocated file once it's full. Calling this once
+ * per pass of the main loop keeps each pass down to one sector write, instead
+ * of the whole cache at once when it fills.
+ */
+uint8_t fsmanSessionService(uint8_t * result_code){
+    
+    *result_code = CE_GOOD;
+    if (file == NULL || fsbufptr < fsmanSectorRemaining()){
+        return TRUE;
+    }
+    if (!fsmanWriteCached(result_code, fsmanSectorRemaining())){
+        return FALSE;
+    }
+    if (fsmanFileFull()){
+        //the preallocated file is full, continue in a new one
+        return fsmanSessionReset(result_code);
+    }
+    return TRUE;
+}
+
 uint8_t fsmanSessionWrite(uint8_t * result_code, uint8_t* data, uint32_t len){
     
-    uint32_t sz = MIN(len, FS_BUF_SZ - fsbufptr);
-    memcpy(&fsbuf[fsbufptr],data, sz);
-    fsbufptr += sz;
-    if (fsbufptr >= FS_BUF_SZ){ //todo add a time limit so that we do exceed file size limits
-        if ( FSfwrite(fsbuf, 1, FS_BUF_SZ, file) != FS_BUF_SZ){
-            *result_code = UNKNOWN_WRITE_ERROR;
-            return FALSE;
-        } else{
-            memcpy(fsbuf,&data[sz], len-sz); //copy pending data if any
-            fsbufptr = len-sz;
-            __debug("Wrote %d bytes",FS_BUF_SZ);
+    uint32_t index;
+    uint32_t sz;
+    
+    *result_code = CE_GOOD;
+    while (len > 0){
+        sz = MIN(len, fsman_available());
+        if (sz == 0){
+            //the writer has outrun fsmanSessionService, make room now
+            if (!fsmanSessionService(result_code)){
+                return FALSE;
+            }
+            if (fsman_available() == 0){
+                *result_code = UNKNOWN_WRITE_ERROR;
+                return FALSE;
+            }
+            continue;
         }
+        index = fsmanCacheIndex(fsfilepos + fsbufptr);
+        sz = MIN(sz, FS_BUF_SZ - index);
+        memcpy(&fsbuf[index], data, sz);
+        fsbufptr += sz;
+        data += sz;
+        len -= sz;
     }
-    *result_code = CE_GOOD;
     return TRUE;
 }
 
 uint8_t fsmanSessionFlush(uint8_t * result_code){
 
+    //the only place a partial sector is written, so the data waiting in the
+    //cache reaches the card at least once per flush timeout
+    if(fsbufptr && !fsmanWriteCache(result_code)){
+        return FALSE;
+    }
     if(*result_code = FSfflush(file), 
         *result_code != CE_GOOD){ //writes unwritten data to flash without closing the file
         
         return FALSE;
     }
+    fsflushedpos = fsfilepos;
+    return TRUE;
+}
+
+/* Returns TRUE if the log file named a was started after the one named b -
+ * the names are hex timestamps, so a longer name is a later one.
+ */
+static uint8_t fsmanIsNewerFile(const char* a, const char* b){
+    
+    return strlen(a) > strlen(b) || (strlen(a) == strlen(b) && strcmp(a, b) > 0);
+}
+
+/* Finds the newest log file in VI_LOG, by its hex timestamp name.
+ */
+static uint8_t fsmanLatestFile(char* file_name){
+    
+    SearchRec rec;
+    uint8_t found = FALSE;
+    
+    if(FindFirst("*.TXT", ATTR_MASK & ~ATTR_DIRECTORY, &rec) != 0){
+        return FALSE;
+    }
+    do{
+        if(!found || fsmanIsNewerFile(rec.filename, file_name)){
+            strcpy(file_name, rec.filename);
+            found = TRUE;
+        }
+    }while(FindNext(&rec) == 0);
+    
+    return found;
+}
+
+/* Finds the oldest log file in VI_LOG that was started after the one named
+ * after, or the oldest of all if after is NULL. The session file is skipped,
+ * so only finished files are found.
+ */
+uint8_t fsmanNextLogFile(const char* after, char* file_name){
+    
+    SearchRec rec;
+    uint8_t found = FALSE;
+    
+    if(FindFirst("*.TXT", ATTR_MASK & ~ATTR_DIRECTORY, &rec) != 0){
+        return FALSE;
+    }
+    do{
+        if((after != NULL && !fsmanIsNewerFile(rec.filename, after)) ||
+                (file != NULL && strcmp(rec.filename, fsfilename) == 0)){
+            continue;
+        }
+        if(!found || fsmanIsNewerFile(file_name, rec.filename)){
+            strcpy(file_name, rec.filename);
+            found = TRUE;
+        }
+    }while(FindNext(&rec) == 0);
+    
+    return found;
+}
+
+/* Reopens the newest log file and reads it back one block at a time, until
+ * validate rejects a block. If at least one block was good and some of the
+ * file is left after it, that file becomes the active session again, to be
+ * written from the end of the last good block. The cache must be empty.
+ *
+ * Returns TRUE if the session was resumed.
+ */
+uint8_t fsmanSessionResume(uint8_t * result_code, uint32_t block_size, uint8_t (*validate)(uint8_t* block)){
+    
+    char file_name[13];
+    uint32_t size;
+    uint32_t offset = 0;
+    
+    *result_code = CE_GOOD;
+    if(file != NULL || fsbufptr || block_size > FS_BUF_SZ || !fsmanLatestFile(file_name)){
+        return FALSE;
+    }
+    
+    file = FSfopen (file_name,"r+");
+    if (file == NULL){
+        return FALSE;
+    }
+    FSfseek(file, 0, SEEK_END);
+    size = FSftell(file);
+    FSfseek(file, 0, SEEK_SET);
+    
+    while(offset + block_size <= size &&
+            FSfread(fsbuf, 1, block_size, file) == block_size && validate(fsbuf)){
+        offset += block_size;
+    }
+    
+    if(offset == 0 || offset >= size || FSfseek(file, offset, SEEK_SET) != 0){
+        FSfclose(file);
+        file = NULL;
+        return FALSE;
+    }
+    
+    __debug("Resuming %s at %d of %d bytes", file_name, offset, size);
+    strcpy(fsfilename, file_name);
+    fsfilepos = offset;
+    fsfilesize = size;
+    fsflushedpos = offset;
     return TRUE;
 }
 
+/* Reads a whole file in VI_LOG into buffer, which must have room for all of it.
+ * Nothing else may be using the card, e.g. a session being resumed.
+ *
+ * Returns the number of bytes read, or -1 if the file can't be opened or
+ * doesn't fit.
+ */
+int32_t fsmanReadFile(const char* file_name, uint8_t* buffer, uint32_t len){
+    
+    FSFILE* in;
+    uint32_t size;
+    
+    in = FSfopen (file_name,"r");
+    if (in == NULL){
+        return -1;
+    }
+    FSfseek(in, 0, SEEK_END);
+    size = FSftell(in);
+    FSfseek(in, 0, SEEK_SET);
+    
+    if(size > len || FSfread(buffer, 1, size, in) != size){
+        FSfclose(in);
+        return -1;
+    }
+    FSfclose(in);
+    return size;
+}
+
+/* Appends to a file in VI_LOG, creating it if needed, unless that would grow it
+ * past max_size.
+ *
+ * Returns the size of the file after the write, or -1 if it can't be written
+ * or is full.
+ */
+int32_t fsmanAppendFile(const char* file_name, const uint8_t* data,
+        uint32_t len, uint32_t max_size){
+    
+    FSFILE* out;
+    uint32_t size;
+    
+    out = FSfopen (file_name,"a");
+    if (out == NULL){
+        return -1;
+    }
+    size = FSftell(out);
+    
+    if(size + len > max_size ||
+            FSfwrite(data, 1, len, out) != len){
+        FSfclose(out);
+        return -1;
+    }
+    FSfclose(out);
+    return size + len;
+}
+
+/* Reads up to len bytes of a file in VI_LOG, starting at offset.
+ *
+ * Returns the number of bytes read, 0 past the end of the file, or -1 if the
+ * file can't be opened.
+ */
+int32_t fsmanReadFileAt(const char* file_name, uint32_t offset,
+        uint8_t* buffer, uint32_t len){
+    
+    FSFILE* in;
+    int32_t count;
+    
+    in = FSfopen (file_name,"r");
+    if (in == NULL){
+        return -1;
+    }
+    if(FSfseek(in, offset, SEEK_SET) != 0){
+        FSfclose(in);
+        return 0;
+    }
+    count = FSfread(buffer, 1, len, in);
+    FSfclose(in);
+    return count;
+}
+
+/* Opens a file in VI_LOG to be read a piece at a time with fsmanStreamRead,
+ * from offset on, closing the one opened before. The file keeps its own
+ * handle, so it can be read while the session writes - the size of a file
+ * being written is as of its last flush.
+ *
+ * Returns the size of the file, or -1 if it doesn't exist.
+ */
+int32_t fsmanStreamOpen(const char* file_name, uint32_t offset){
+    
+    int32_t size;
+    
+    fsmanStreamClose();
+    stream = FSfopen (file_name,"r");
+    if (stream == NULL){
+        return -1;
+    }
+    FSfseek(stream, 0, SEEK_END);
+    size = FSftell(stream);
+    FSfseek(stream, MIN(offset, (uint32_t)size), SEEK_SET);
+    return size;
+}
+
+/* Reads up to len bytes from where the last read of the file opened with
+ * fsmanStreamOpen stopped.
+ *
+ * Returns the number of bytes read, 0 at the end of the file, or -1 if no file
+ * is open.
+ */
+int32_t fsmanStreamRead(uint8_t* buffer, uint32_t len){
+    
+    if (stream == NULL){
+        return -1;
+    }
+    return FSfread(buffer, 1, len, stream);
+}
+
+void fsmanStreamClose(void){
+    
+    if (stream != NULL){
+        FSfclose(stream);
+        stream = NULL;
+    }
+}
+
+/* Returns the size of a file in VI_LOG, or -1 if it doesn't exist.
+ */
+int32_t fsmanFileSize(const char* file_name){
+    
+    FSFILE* in;
+    int32_t size;
+    
+    in = FSfopen (file_name,"r");
+    if (in == NULL){
+        return -1;
+    }
+    FSfseek(in, 0, SEEK_END);
+    size = FSftell(in);
+    FSfclose(in);
+    return size;
+}
+
+uint8_t fsmanRemoveFile(const char* file_name){
+    
+    return FSremove(file_name) == 0;
+}
+
 uint8_t fsmanSessionEnd(uint8_t * result_code){
     
+    if (fsbufptr && !fsmanWriteCache(result_code)){
+        
+        return FALSE;
+    }
     if (*result_code = FSfclose (file), 
             *result_code != CE_GOOD){
             
         return FALSE;
     }
+    fsmanStreamClose();
     if(!fsmanDeInit(result_code)){
         return FALSE;
     }
@@ -17,10 +17,24 @@ uint8_t fsmanDeInit      (uint8_t * result_code);
 uint8_t fsmanSessionWrite(uint8_t * result_code, uint8_t* data, uint32_t len);
 uint8_t fsmanSessionReset(uint8_t * result_code);
 uint8_t fsmanSessionFlush(uint8_t * result_code);
+uint8_t fsmanSessionService(uint8_t * result_code);
+uint8_t fsmanSessionResume(uint8_t * result_code, uint32_t block_size, uint8_t (*validate)(uint8_t* block));
 uint8_t fsmanSessionIsActive(void);
 uint8_t fsmanSessionStart(uint8_t * result_code);
 uint8_t fsmanSessionEnd(uint8_t * result_code);
+int32_t fsmanReadFile(const char* file_name, uint8_t* buffer, uint32_t len);
+int32_t fsmanAppendFile(const char* file_name, const uint8_t* data, uint32_t len, uint32_t max_size);
+int32_t fsmanReadFileAt(const char* file_name, uint32_t offset, uint8_t* buffer, uint32_t len);
+int32_t fsmanFileSize(const char* file_name);
+uint8_t fsmanRemoveFile(const char* file_name);
+uint8_t fsmanNextLogFile(const char* after, char* file_name);
 uint32_t fsmanSessionCacheBytesWaiting(void);
+const char* fsmanSessionFileName(void);
+uint32_t fsmanSessionOffset(void);
+uint32_t fsmanSessionFlushedBytes(void);
+int32_t fsmanStreamOpen(const char* file_name, uint32_t offset);
+int32_t fsmanStreamRead(uint8_t* buffer, uint32_t len);
+void fsmanStreamClose(void);
 void fsmanInitHardwareSD(void);
 uint32_t fsman_available(void);
 #ifdef    __cplusplus
@@ -27,19 +27,25 @@ using openxc::http::HTTP_STATUS;
  *   w/o having to invoke an HTTP_REQUEST parser to look for the 'Connection:' field)
  *  - defining the HTTP method to be used (GET, POST, PUT....)
  *  - composing and providing a pointer to the fully-formed HTTP request header
- *  - composing and providing a pointer to the HTTP request body data
+ *  - composing and providing a pointer to the HTTP request body data, or a
+ *   callback to stream it from (with 'Transfer-Encoding: chunked' in the header)
  *  - receiving and handling the entire HTTP response body (in chunks as determined by the client)
  * The HTTP client is responsible for:
  *  - composing and transmitting a complete HTTP request via the socket send callback
  *  - receiving a complete HTTP response (in chunks) via the socket read callback
  *  - parsing the HTTP response header and extracting basic information such as response code (200, 404...)
  *  - returning some basic HTTP response info and the HTTP response body to the caller (in chunks) via the 'put' callback
+ *
+ * The response is parsed as each read from the socket arrives, and nothing of it is kept once it's parsed, so the
+ * caller's parser callbacks see the status, header and body as soon as they're read. The callbacks find their
+ * client through parser->data, so clients on different sockets can be run interleaved.
  */
  
-#define HTTP_TIMEOUT_PERIOD        10000
 #define HTTP_CHECK_RESPONSE_DELAY    500
+#define HTTP_HEADER_END_LENGTH         4     // "\r\n\r\n"
 
-static httpClient* gContext;
+// place to read socket data into for parsing, shared as each read is parsed before execute returns
+static char responseData[HTTP_BUFFERSIZE];
 
 static int http_parser_cb_on_message_begin(http_parser* parser);
 static int http_parser_cb_on_url(http_parser* parser, const char *at, size_t length);
@@ -77,9 +83,8 @@ static int http_parser_cb_on_header_value(http_parser* parser, const char *at, s
 
 static int http_parser_cb_on_headers_complete(http_parser* parser) {
     //debug("Headers Complete Callback!"); 
-    if(gContext) {
-        gContext->responseCode = parser->status_code;
-    }
+    httpClient* client = (httpClient*)parser->data;
+    client->responseCode = parser->status_code;
     return 0;
 }
 
@@ -90,9 +95,9 @@ static int http_parser_cb_on_body(http_parser* parser, const char *at, size_t le
 
 static int http_parser_cb_on_message_complete(http_parser* parser) {
     //debug("On Message Complete Callback!"); 
-    if(gContext) {
-        gContext->responseComplete = true; 
-    }
+    httpClient* client = (httpClient*)parser->data;
+    client->responseComplete = true; 
+    client->keepAlive = http_should_keep_alive(parser);
     return 0;
 }
 
@@ -100,6 +105,7 @@ static int http_parser_cb_on_message_complete(http_parser* parser) {
 httpClient::httpClient() {
 
     timer = 0;
+    timeoutPeriod = HTTP_TIMEOUT_PERIOD;
 
     socketNumber = 1;
     status = HTTP_READY;
@@ -114,8 +120,15 @@ httpClient::httpClient() {
     responseHeaderSize = 0;
     responseBodySize = 0;
     responseCode = 0;
-    memset(responseData, 0x00, bufferSize);
     responseComplete = false;
+    keepAlive = false;
+    holdBody = false;
+    headerEndMatch = 0;
+    
+    chunkLength = 0;
+    chunkSent = 0;
+    lastChunk = false;
+    cbGetRequestData = NULL;
     
     // http-parser callbacks
     parser_settings.on_message_begin = &http_parser_cb_on_message_begin;
@@ -131,14 +144,86 @@ httpClient::httpClient() {
     cbPutResponseData = &httpClient::cbDefault;
 }
 
+/*
+ * Sends the request body as chunks (RFC 7230 section 4.1) pulled from
+ * cbGetRequestData, formatting one chunk at a time and sending it before
+ * asking for the next. Nothing is sent while the callback has no data, so a
+ * long-lived request can pass data on as it's produced.
+ *
+ * Returns false if the socket write failed.
+ */
+bool httpClient::sendChunk() {
+
+    char header[HTTP_CHUNK_HEADER_SIZE + 1];
+    unsigned int length = 0;
+    bool complete = false;
+    
+    if(chunkSent == chunkLength) {
+        // format the next chunk
+        length = cbGetRequestData(chunkBuffer + HTTP_CHUNK_HEADER_SIZE, HTTP_CHUNK_SIZE, &complete);
+        chunkLength = 0;
+        chunkSent = 0;
+        if(length > 0) {
+            sprintf(header, "%04x\r\n", length);
+            memcpy(chunkBuffer, header, HTTP_CHUNK_HEADER_SIZE);
+            chunkLength = HTTP_CHUNK_HEADER_SIZE + length;
+            memcpy(chunkBuffer + chunkLength, "\r\n", 2);
+            chunkLength += 2;
+        }
+        if(complete) {
+            memcpy(chunkBuffer + chunkLength, "0\r\n\r\n", 5);
+            chunkLength += 5;
+            lastChunk = true;
+        }
+        if(chunkLength == 0) {
+            // nothing to send yet
+            return true;
+        }
+        // still making progress, however long the body stays open
+        startTime = uptimeMs();
+    }
+    
+    byteCount = chunkLength - chunkSent;
+    if(!sendSocketData(socketNumber, chunkBuffer + chunkSent, &byteCount)) {
+        return false;
+    }
+    chunkSent += byteCount;
+    bytesSent += byteCount;
+    
+    if(lastChunk && chunkSent == chunkLength) {
+        status = HTTP_RECEIVING_RESPONSE;
+    }
+    return true;
+
+}
+
+/*
+ * Follows the response header's closing "\r\n\r\n" through the bytes read, so holdBody
+ * can stop short of the body.
+ */
+void httpClient::scanHeaderEnd(const char* data, unsigned int length) {
+
+    unsigned int i = 0;
+    
+    for(i = 0; i < length && headerEndMatch < HTTP_HEADER_END_LENGTH; ++i) {
+        if(data[i] == '\r') {
+            headerEndMatch = (headerEndMatch == 2) ? 3 : 1;
+        }
+        else if(data[i] == '\n' && (headerEndMatch == 1 || headerEndMatch == 3)) {
+            ++headerEndMatch;
+        }
+        else {
+            headerEndMatch = 0;
+        }
+    }
+
+}
+
 HTTP_STATUS httpClient::execute() {
  
     switch(status) {
         case HTTP_READY:
         
-            // activate client
-            gContext = this;
-            
             // validate client parameters
             if(!requestHeader || !sendSocketData || !isReceiveDataAvailable || !receiveSocketData) {
                 status = HTTP_FAILED;
@@ -148,6 +233,7 @@ HTTP_STATUS httpClient::execute() {
             startTime = uptimeMs();
             requestHeaderSize = strlen(requestHeader);
             http_parser_init(&parser, HTTP_RESPONSE);
+            parser.data = this;
             status = HTTP_SENDING_REQUEST_HEADER;
             
         case HTTP_SENDING_REQUEST_HEADER:
@@ -168,7 +254,12 @@ HTTP_STATUS httpClient::execute() {
             
         case HTTP_SENDING_REQUEST_BODY:
         
-            if(!requestBody) {
+            if(cbGetRequestData) {
+                if(!sendChunk()) {
+                    status = HTTP_FAILED;
+                }
+            }
+            else if(!requestBody) {
                 status = HTTP_RECEIVING_RESPONSE;
             }
             else {
@@ -192,10 +283,14 @@ HTTP_STATUS httpClient::execute() {
             timer = uptimeMs();
         
             if(isReceiveDataAvailable(socketNumber)) {
-                byteCount = bufferSize;
+                byteCount = HTTP_BUFFERSIZE;
+                if(holdBody && headerEndMatch < HTTP_HEADER_END_LENGTH) {
+                    // only as many bytes as are sure to still be header
+                    byteCount = HTTP_HEADER_END_LENGTH - headerEndMatch;
+                }
                 if(receiveSocketData(socketNumber, responseData, &byteCount)) {
                     bytesReceived += byteCount;
-                    parser.data = responseData;
+                    scanHeaderEnd(responseData, byteCount);
                     if(http_parser_execute(&parser, &parser_settings, responseData, byteCount) != byteCount) {
                         status = HTTP_FAILED;
                         break;
@@ -227,7 +322,7 @@ HTTP_STATUS httpClient::execute() {
     }
     
     // watch for timeout
-    if(uptimeMs() - startTime > HTTP_TIMEOUT_PERIOD) {
+    if(uptimeMs() - startTime > timeoutPeriod) {
         status = HTTP_FAILED;
     }
     
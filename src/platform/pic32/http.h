@@ -5,6 +5,9 @@
 #include <stdio.h>
 
 #define HTTP_BUFFERSIZE        1024
+#define HTTP_CHUNK_SIZE         512     // most body bytes per chunk of a chunked request
+#define HTTP_CHUNK_HEADER_SIZE    6     // 4 hex digits and CRLF
+#define HTTP_TIMEOUT_PERIOD     10000     // default timeoutPeriod
 
 namespace openxc {
 namespace http {
@@ -23,10 +26,23 @@ class httpClient {
  
     private:
     
-        // buffer size
-        static const unsigned int bufferSize = HTTP_BUFFERSIZE;
         // generic timer
         unsigned int timer;
+        
+        // how much of the "\r\n\r\n" ending the response header the last bytes read match, 4 once it's ended
+        unsigned int headerEndMatch;
+        
+        // chunked request body in progress
+        char chunkBuffer[HTTP_CHUNK_HEADER_SIZE + HTTP_CHUNK_SIZE + 7];    // chunk, its CRLF and the last chunk
+        unsigned int chunkLength;            // bytes in chunkBuffer
+        unsigned int chunkSent;                // bytes of chunkBuffer already sent
+        bool lastChunk;                        // chunkBuffer ends the body
+        
+        // send the next piece of a chunked request body
+        bool sendChunk();
+        
+        // follow the end of the response header through bytes read
+        void scanHeaderEnd(const char* data, unsigned int length);
     
     public:
         // http parser
@@ -40,6 +56,7 @@ class httpClient {
         unsigned int socketNumber;
         HTTP_STATUS status;                    // status of the http client state machine
         unsigned int startTime;                // start time of this transaction (used to time out a hanging transaction)
+        unsigned int timeoutPeriod;            // how long the transaction may go without progress before it fails (ms)
         unsigned int bytesSent;                // total bytes sent in this transaction
         unsigned int bytesReceived;            // total bytes received in this transaction
         unsigned int byteCount;                // a general byte counter for the transaction
@@ -52,16 +69,20 @@ class httpClient {
         
         // response details
         bool responseComplete;                // used to signal that http-parser is finished
+        bool keepAlive;                        // the server will keep the connection open for another request
         unsigned int responseHeaderSize;    // not really used
         unsigned int responseBodySize;        // not really used
         unsigned int responseCode;            // HTTP status code (numerical)
-        char responseData[bufferSize];        // place to read socket data into for parsing
+        bool holdBody;                        // leave the body in the socket until the parser's on_headers_complete
+                                            // callback has seen the header, rather than reading past its end
         
         // data callbacks
         bool (*sendSocketData)(unsigned int, char*, unsigned int*);            // callback used to send data to server
         bool (*isReceiveDataAvailable)(unsigned int);                        // callback to find out if there is data available from server
         bool (*receiveSocketData)(unsigned int, char*, unsigned int*);        // callback to receive data from server
-        void (*cbGetRequestData)(char*, unsigned int);
+        // callback to pull the next piece of a chunked request body (used instead of requestBody when set):
+        // copies up to the given number of bytes and returns how many, setting the flag once the body is complete
+        unsigned int (*cbGetRequestData)(char*, unsigned int, bool*);
         void (*cbPutResponseData)(char*, unsigned int);                        // callback to handle server response data
         void (*cbHeaderComplete)();
         
@@ -0,0 +1,29 @@
+#ifndef __INTERRUPTS_PIC32__
+#define __INTERRUPTS_PIC32__
+
+// The interrupt priority level of each handler on the PIC32, 7 being the most
+// urgent. An interrupt only preempts handlers at a lower level.
+//
+// The chipKIT CAN library and the Microchip USB stack install their handlers
+// at level 4 themselves, and a handler has to be compiled for the level its
+// vector runs at, so CAN can't be raised above USB from here - but everything
+// the firmware installs itself is kept below the two of them:
+//
+// BLE - the BlueNRG's IRQ line, whose handler reads whole HCI packets over SPI.
+//      The module holds the line until they're read, so nothing is lost by
+//      letting a CAN frame go first.
+// RTC - the millisecond tick, which only increments a counter.
+#define CAN_INTERRUPT_PRIORITY 4
+#define BLE_INTERRUPT_PRIORITY 3
+#define RTC_INTERRUPT_PRIORITY 2
+
+// The __ISR() level and the peripheral library's priority flags for a priority
+// level, e.g. ISR_IPL(3) is ipl3.
+#define ISR_IPL(priority) _ISR_IPL(priority)
+#define _ISR_IPL(priority) ipl ## priority
+#define EXT_INT_PRIORITY(priority) _EXT_INT_PRIORITY(priority)
+#define _EXT_INT_PRIORITY(priority) EXT_INT_PRI_ ## priority
+#define T2_INT_PRIORITY(priority) _T2_INT_PRIORITY(priority)
+#define _T2_INT_PRIORITY(priority) T2_INT_PRIOR_ ## priority
+
+#endif // __INTERRUPTS_PIC32__
@@ -0,0 +1,18 @@
+#include "util/memory.h"
+#include <malloc.h>
+
+// From the chipKIT linker script: the stack runs down from _stack to _splim,
+// below which is the heap, _min_heap_size bytes from _heap.
+extern uint8_t _splim;
+extern uint8_t _stack;
+
+void openxc::util::memory::stackRegion(uint8_t** bottom, uint8_t** top) {
+    *bottom = &_splim;
+    *top = &_stack;
+}
+
+void openxc::util::memory::heapUsage(size_t* used, size_t* reserved) {
+    struct mallinfo info = mallinfo();
+    *used = info.uordblks;
+    *reserved = info.arena;
+}
@@ -1,20 +1,22 @@
 #include "interface/network.h"
 #include "util/log.h"
 #include "util/bytebuffer.h"
+#include "util/timer.h"
+#include "config.h"
 #include <stddef.h>
 
 #ifdef __USE_NETWORK__
 
-// This size can be set to any arbitrary value. Its
-// function is just to define the size of the send
-// buffer.
-#define MAX_MESSAGE_SIZE 128
 #define DEFAULT_NETWORK_PORT 1776
 #define DEFAULT_MAC_ADDRESS {0, 0, 0, 0, 0, 0}
 #define DEFAULT_IP_ADDRESS {192, 168, 1, 100}
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::popBytes;
+using openxc::util::bytebuffer::frameType;
+using openxc::config::getConfiguration;
+using openxc::util::time::uptimeMs;
 
 Server server = Server(DEFAULT_NETWORK_PORT);
 
@@ -24,6 +26,7 @@ void openxc::interface::network::initialize(NetworkDevice* device) {
         device->macAddress = DEFAULT_MAC_ADDRESS;
         device->ipAddress = DEFAULT_IP_ADDRESS;
         device->server = &server;
+        device->sendBufferLength = 0;
 #ifdef USE_DHCP
         server.begin();
 #else
@@ -34,25 +37,29 @@ void openxc::interface::network::initialize(NetworkDevice* device) {
     }
 }
 
-// The message bytes are sequentially popped from the
-// send queue to the send buffer. After the buffer is full
-// or the queue is empty, the contents of the buffer are
-// sent over the network to listening clients.
+// The message bytes are moved from the send queue to the send buffer every
+// pass, so the queue doesn't back up, and the buffer is written to all
+// connected clients once it holds a full segment or its oldest byte has waited
+// DEFAULT_NETWORK_COALESCE_MS.
 void openxc::interface::network::processSendQueue(NetworkDevice* device) {
-    unsigned int byteCount = 0;
-    char sendBuffer[MAX_MESSAGE_SIZE];
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) &&
-            byteCount < MAX_MESSAGE_SIZE) {
-        sendBuffer[byteCount++] = QUEUE_POP(uint8_t, &device->sendQueue);
+    if(device->sendBufferLength == 0) {
+        device->coalesceStartedMs = uptimeMs();
     }
+    device->sendBufferLength += popBytes(&device->sendQueue,
+            device->sendBuffer + device->sendBufferLength,
+            NETWORK_SEND_BUFFER_SIZE - device->sendBufferLength);
 
     // must call at least one Network method to keep the TCP/IP stack alive,
     // because it's implemented all in software - a quirk of the chipKIT
     // library. Network.PeriodicTasks() is supposed to be specifically for this
     // purpose, but it doesn't seem to have any effect while this does.
     device->server->available();
-    if(byteCount > 0) {
-        device->server->write((uint8_t*) sendBuffer, byteCount);
+    if(device->sendBufferLength > 0 &&
+            (device->sendBufferLength == NETWORK_SEND_BUFFER_SIZE ||
+             uptimeMs() - device->coalesceStartedMs >=
+                DEFAULT_NETWORK_COALESCE_MS)) {
+        device->server->write(device->sendBuffer, device->sendBufferLength);
+        device->sendBufferLength = 0;
     }
 }
 
@@ -62,10 +69,11 @@ void openxc::interface::network::read(NetworkDevice* device,
     if(client) {
         uint8_t byte;
         while((byte = client.read()) != -1 &&
-                !QUEUE_FULL(uint8_t, &device->receiveQueue)) {
-            QUEUE_PUSH(uint8_t, &device->receiveQueue, byte);
+                !BYTE_QUEUE_FULL(&device->receiveQueue)) {
+            BYTE_QUEUE_PUSH(&device->receiveQueue, byte);
         }
-        processQueue(&device->receiveQueue, callback);
+        processQueue(&device->receiveQueue, &device->receiveScanner,
+                frameType(getConfiguration()->payloadFormat), callback);
     }
 }
 
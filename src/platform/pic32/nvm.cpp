@@ -1,39 +1,88 @@
 #include "nvm.h"
 #include "config.h"
 #include "telit_he910.h"
+#include "util/state_store.h"
+#include "saved_config.h"
+#include <string.h>
 extern "C"
 {
 #include "flash.h"
 }
 
+namespace state_store = openxc::util::state_store;
+
 using openxc::config::getConfiguration;
 using openxc::telitHE910::ModemConfigurationDescriptor;
 
+// The firmware hash and the saved configuration are after the modem
+// configuration, so pages written before they were added still load - they
+// just read as erased. The active and flashHashCached words are 0 once
+// written, erased flash being all 1s.
 typedef struct {
     unsigned int active;
     ModemConfigurationDescriptor config;
+    unsigned int flashHashCached;
+    uint32_t flashHashKey;
+    char flashHash[36];
+    unsigned int savedConfiguration[SAVED_CONFIGURATION_SIZE / 4];
 } _EEPROM;
 
 static _EEPROM* eeprom = (_EEPROM*)NVM_START;
 
-void openxc::nvm::store() {
-    unsigned int i = 0;
-    unsigned int writeWord;
-    unsigned int* config = (unsigned int*)&(getConfiguration()->telit->config);
+// A copy of the page to change before it's written back
+static _EEPROM image;
+
+static void erasePage(const _EEPROM* page) {
+    const unsigned int* word = (const unsigned int*)page;
     eraseFlashPage((void*)NVM_START);
-    writeFlashWord((void*)NVM_START+i, (unsigned int)0x00000000);
-    while(i < sizeof(ModemConfigurationDescriptor)) {
-        writeFlashWord((void*)NVM_START+i+4, *(unsigned int*)config);
-        config++;
-        i += 4;
+    for(unsigned int i = 0; i < sizeof(_EEPROM); i += 4) {
+        writeFlashWord((void*)(NVM_START + i), *word++);
     }
 }
 
+/* Private: Rewrite the first half of the page, keeping the state store's
+ * current record in the second half.
+ */
+static void write(const _EEPROM* page) {
+    unsigned int record[STATE_STORE_SLOT_SIZE / 4];
+    bool keepRecord = state_store::copyCurrent((uint8_t*)record);
+    erasePage(page);
+    if(keepRecord) {
+        state_store::writeSlot(0, (const uint8_t*)record);
+    }
+    state_store::initialize();
+}
+
+void openxc::nvm::store() {
+    memcpy(&image, eeprom, sizeof(image));
+    image.active = 0;
+    image.config = getConfiguration()->telit->config;
+    write(&image);
+}
+
 void openxc::nvm::load() {
     ModemConfigurationDescriptor* config = &(getConfiguration()->telit->config);
     memcpy(config, (const void*)(NVM_START+4), sizeof(ModemConfigurationDescriptor));
 }
 
+bool openxc::nvm::loadFlashHash(uint32_t key, char* hash, size_t length) {
+    if(eeprom->flashHashCached != 0 || eeprom->flashHashKey != key ||
+            strlen(eeprom->flashHash) >= length) {
+        return false;
+    }
+    strcpy(hash, eeprom->flashHash);
+    return true;
+}
+
+void openxc::nvm::storeFlashHash(uint32_t key, const char* hash) {
+    memcpy(&image, eeprom, sizeof(image));
+    image.flashHashCached = 0;
+    image.flashHashKey = key;
+    strncpy(image.flashHash, hash, sizeof(image.flashHash) - 1);
+    image.flashHash[sizeof(image.flashHash) - 1] = '\0';
+    write(&image);
+}
+
 bool isActive() {
     return eeprom->active == 0;
 }
@@ -45,3 +94,38 @@ void openxc::nvm::initialize() {
        store();
     }
 }
+
+const uint8_t* openxc::config::savedConfigurationRegion() {
+    return (const uint8_t*)eeprom->savedConfiguration;
+}
+
+bool openxc::config::writeSavedConfiguration(const uint8_t* data) {
+    memcpy(&image, eeprom, sizeof(image));
+    memcpy(image.savedConfiguration, data, SAVED_CONFIGURATION_SIZE);
+    write(&image);
+    return true;
+}
+
+static_assert(sizeof(_EEPROM) <= STATE_STORE_START - NVM_START,
+        "The NVM page's first half must fit the modem and saved "
+        "configurations");
+
+const uint8_t* openxc::util::state_store::region(size_t* size) {
+    *size = STATE_STORE_SIZE;
+    return (const uint8_t*)STATE_STORE_START;
+}
+
+void openxc::util::state_store::eraseRegion() {
+    // The page is erased as a whole, so write the first half back
+    memcpy(&image, eeprom, sizeof(image));
+    erasePage(&image);
+}
+
+bool openxc::util::state_store::writeSlot(int slot, const uint8_t* data) {
+    const unsigned int* word = (const unsigned int*)data;
+    unsigned int address = STATE_STORE_START + slot * STATE_STORE_SLOT_SIZE;
+    for(unsigned int i = 0; i < STATE_STORE_SLOT_SIZE; i += 4) {
+        writeFlashWord((void*)(address + i), *word++);
+    }
+    return true;
+}
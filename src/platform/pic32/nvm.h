@@ -1,9 +1,16 @@
 #ifndef _NVMEM_H_
 #define _NVMEM_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define NVM_START    0x9D07F000
 #define NVM_SIZE     0x1000
 
+// The second half of the NVM page holds the util::state_store records.
+#define STATE_STORE_START (NVM_START + 0x800)
+#define STATE_STORE_SIZE  0x800
+
 namespace openxc {
 namespace nvm {
 
@@ -11,6 +18,25 @@ void initialize();
 void store();
 void load();
 
+/* Public: Look up the firmware hash cached in NVM.
+ *
+ * key - A checksum of the firmware the hash is wanted for.
+ * hash - A buffer for the hash, as a string.
+ * length - The size of the buffer.
+ *
+ * Returns true if the hash cached was computed for the same key, and was
+ * copied into the buffer.
+ */
+bool loadFlashHash(uint32_t key, char* hash, size_t length);
+
+/* Public: Cache a firmware hash in NVM, keeping the stored modem
+ * configuration.
+ *
+ * key - A checksum of the firmware the hash was computed for.
+ * hash - The hash, as a string.
+ */
+void storeFlashHash(uint32_t key, const char* hash);
+
 } // namespace nvm
 } // namespace openxc
 
@@ -2,9 +2,19 @@
 #include "util/log.h"
 #include <plib.h>
 
+// The watchdog's period, fixed by the bootloader's configuration bits.
+#define WATCHDOG_PERIOD_MS 1024
+
 using openxc::util::log::debug;
 
+static unsigned long wakeTimerSeconds = 0;
+static bool timerWake = false;
+
 void openxc::power::initialize() {
+    // The soft reset after a wake timer runs out leaves the watchdog timeout
+    // and sleep flags set
+    timerWake = RCONbits.WDTO && RCONbits.SLEEP;
+    RCONCLR = _RCON_WDTO_MASK | _RCON_SLEEP_MASK;
 }
 
 /* This function will invoke the CPU power save sleep mode.
@@ -23,6 +33,20 @@ void openxc::power::initialize() {
 void openxc::power::suspend() {
     debug("Going to low power mode");
 
+    if(wakeTimerSeconds > 0) {
+        // A watchdog timeout while asleep wakes the CPU instead of resetting
+        // it, so count its periods until the wake timer is up. A CAN wake in
+        // between resets from the ISR with the timeout flag cleared.
+        EnableWDT();
+        for(unsigned long sleptMs = 0; sleptMs < wakeTimerSeconds * 1000;
+                sleptMs += WATCHDOG_PERIOD_MS) {
+            ClearWDT();
+            RCONCLR = _RCON_WDTO_MASK;
+            PowerSaveSleep();
+        }
+        SoftReset();
+    }
+
     PowerSaveSleep();
 
     // The only peripheral configured with wake-up events should be the CAN1
@@ -36,6 +60,26 @@ void openxc::power::handleWake() {
     SoftReset();
 }
 
+void openxc::power::waitForInterrupt() {
+    // Idle mode stops only the CPU, unlike the sleep mode in suspend()
+    PowerSaveIdle();
+}
+
+void openxc::power::enterLowClock() {
+    // The CAN module's bit timing comes from the system clock, so it stays
+    // where it is - the CPU is still idled between frames by waitForInterrupt()
+}
+
+void openxc::power::exitLowClock() { }
+
+void openxc::power::armWakeTimer(unsigned long seconds) {
+    wakeTimerSeconds = seconds;
+}
+
+bool openxc::power::wokeFromTimer() {
+    return timerWake;
+}
+
 void openxc::power::enableWatchdogTimer(int microseconds) {
     // TODO argh, can't change postscaler value from software because it's
     // configured with a #pragma directive in the bootloader. The time for the
@@ -7,6 +7,7 @@
 #include "WProgram.h"
 #include "rtcc.h"
 #include "rtc.h"
+#include "interrupts_pic32.h"
 
 volatile ts syst;
 
@@ -14,7 +15,7 @@ static uint32_t last_time_check;
 void RTC_IsrTimeVarUpdate(void);
 static uint8_t timer_deinit = 0;
 #ifdef RTC_SUPPORT
-void __ISR(_TIMER_2_VECTOR,ipl2) _TIMER2_HANDLER(void) 
+void __ISR(_TIMER_2_VECTOR, ISR_IPL(RTC_INTERRUPT_PRIORITY)) _TIMER2_HANDLER(void) 
 {
     syst.isr_unix_time[0]++;
     if(syst.isr_unix_time[0] == 0) //overflow
@@ -25,7 +26,7 @@ void __ISR(_TIMER_2_VECTOR,ipl2) _TIMER2_HANDLER(void)
 void RTC_InitTimer(void){
     //Generate a 1ms timer event
     OpenTimer2( T2_ON | T2_SOURCE_INT | T2_PS_1_256, 313);
-    ConfigIntTimer2( T2_INT_ON | T2_INT_PRIOR_2);
+    ConfigIntTimer2( T2_INT_ON | T2_INT_PRIORITY(RTC_INTERRUPT_PRIORITY));
 }
 
 void RTC_IsrTimeVarUpdate(void) //Call this regularly somewhere ever hour or so
@@ -73,13 +74,15 @@ uint32_t RTC_GetTimeDateUnix(void){
     return (syst.tm/1000);
 }
 
-void rtc_task(void){
+BOOL rtc_task(void){
     
     if((syst.isr_unix_time[0] - last_time_check) > RTC_UPDATE_INT_MS)
     {
 		last_time_check = syst.isr_unix_time[0];
         RTC_IsrTimeVarUpdate();
+        return true;
     }
+    return false;
 }
 
 void rtc_timer_ms_deinit(void){
@@ -16,7 +16,8 @@ BOOL RTC_Init(void);
 BOOL RTC_SetTimeUnix(uint32_t unixtime);
 BOOL RTC_GetTimeDateDecimal(struct tm * ts);
 void RTC_IsrTimeVarUpdate(void);
-void rtc_task(void);
+// Returns true if syst.tm was just read from the RTC
+BOOL rtc_task(void);
 uint32_t RTC_GetTimeDateUnix(void);
 void rtc_timer_ms_deinit(void);
 
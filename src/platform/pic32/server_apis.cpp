@@ -4,35 +4,70 @@
 #include "config.h"
 #include "payload/payload.h"
 #include "power.h"
+#include "interface/fs.h"
+#include "util/delta.h"
+#include "util/log.h"
+
+#if DEFAULT_FIRMWARE_DELTA && defined(FS_SUPPORT)
+#define FIRMWARE_DELTA_SUPPORT
+#endif
 
 /*PRIVATE VARIABLES*/
 
 static const unsigned int commandBufferSize = 512;
 static uint8_t commandBuffer[commandBufferSize];
 static uint8_t* pCommandBuffer = commandBuffer;
+static bool postKeepAlive = false;      // the server kept the connection open after the last POST
+static bool logKeepAlive = false;       // the same, for the last log POST
+static bool commandsKeepAlive = false;  // the same, for the last GET for commands
+#ifdef FIRMWARE_DELTA_SUPPORT
+static openxc::util::delta::DeltaPatch firmwarePatch;
+static bool firmwareDelta = false;      // the firmware response is a delta patch
+#endif
 
 /*PRIVATE FUNCTION DECLARATIONS*/
 
 static int cbOnBody(http_parser* parser, const char* at, size_t length);
 static int cbOnStatus(http_parser* parser, const char* at, size_t length);
 static int cbHeaderComplete(http_parser* parser);
+#ifdef FIRMWARE_DELTA_SUPPORT
+static int cbFirmwareBody(http_parser* parser, const char* at, size_t length);
+static bool stageFirmware(const uint8_t* data, size_t length, void* context);
+#endif
+static API_RETURN postData(char* deviceId, char* host, char* data, unsigned int len, bool deflated,
+        unsigned int (*source)(char*, unsigned int, bool*));
 
 using openxc::server_api::API_RETURN;
 using openxc::config::getConfiguration;
 using openxc::payload::PayloadFormat;
-using openxc::telitHE910::readSocketOne;
+using openxc::interface::InterfaceType;
 using openxc::power::enableWatchdogTimer;
+using openxc::util::log::debug;
+
+namespace fs = openxc::interface::fs;
+namespace delta = openxc::util::delta;
 
 /*API CALLS (PUBLIC)*/
 
-API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char* data, unsigned int len) {
+API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char* data, unsigned int len, bool deflated) {
+    return postData(deviceId, host, data, len, deflated, NULL);
+}
+
+API_RETURN openxc::server_api::serverPOSTstream(char* deviceId, char* host, unsigned int (*source)(char*, unsigned int, bool*)) {
+    return postData(deviceId, host, NULL, 0, false, source);
+}
+
+bool openxc::server_api::serverPOSTkeepAlive(void) {
+    return postKeepAlive;
+}
+
+API_RETURN openxc::server_api::serverPOSTlog(char* deviceId, char* host, const char* file, uint32_t offset,
+        unsigned int length, uint32_t total, char* data, unsigned int len, bool deflated) {
 
     static API_RETURN ret = None;
     static http::httpClient client;
-    static char header[256];
+    static char header[320];
     static unsigned int state = 0;
-    static const char* ctJSON = "application/json";
-    static const char* ctPROTOBUF = "application/x-protobuf";
     
     switch(state)
     {
@@ -40,15 +75,21 @@ API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char*
             state = 0;
         case 0:
             ret = Working;
-            // compose the header for POST /data
-            sprintf(header, "POST /api/%s/data HTTP/1.1\r\n"
+            // compose the header for POST /logs, the range being of the file
+            // itself whether or not the body is compressed
+            sprintf(header, "POST /api/%s/logs/%s HTTP/1.1\r\n"
                     "Content-Length: %u\r\n"
-                    "Content-Type: %s\r\n"
+                    "Content-Type: application/octet-stream\r\n"
+                    "Content-Range: bytes %lu-%lu/%lu\r\n"
+                    "%s"
                     "Host: %s\r\n"
-                    "Connection: Keep-Alive\r\n\r\n", deviceId, len, getConfiguration()->payloadFormat == PayloadFormat::PROTOBUF ? ctPROTOBUF : ctJSON, host);
+                    "Connection: Keep-Alive\r\n\r\n", deviceId, file, len,
+                    (unsigned long)offset, (unsigned long)(offset + length - 1),
+                    (unsigned long)total,
+                    deflated ? "Content-Encoding: deflate\r\n" : "", host);
             // configure the HTTP client
             client = http::httpClient();
-            client.socketNumber = POST_DATA_SOCKET;
+            client.socketNumber = POST_LOG_SOCKET;
             client.requestHeader = header;
             client.requestBody = data;
             client.requestBodySize = len;
@@ -72,11 +113,24 @@ API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char*
                     // nothing to do while client is in progress
                     break;
                 case http::HTTP_COMPLETE:
-                    ret = Success;
+                    // the part only counts as uploaded if the server took it
+                    if(client.responseCode >= 200 && client.responseCode < 300)
+                    {
+                        ret = Success;
+                        logKeepAlive = client.keepAlive;
+                    }
+                    else
+                    {
+                        debug("Server refused log %s at %lu: %u", file,
+                                (unsigned long)offset, client.responseCode);
+                        ret = Failed;
+                        logKeepAlive = false;
+                    }
                     state = 0;
                     break;
                 case http::HTTP_FAILED:
                     ret = Failed;
+                    logKeepAlive = false;
                     state = 0;
                     break;
             }
@@ -87,11 +141,15 @@ API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char*
 
 }
 
+bool openxc::server_api::serverPOSTlogKeepAlive(void) {
+    return logKeepAlive;
+}
+
 API_RETURN openxc::server_api::serverGETfirmware(char* deviceId, char* host) {
 
     static API_RETURN ret = None;
     static http::httpClient client;
-    static char header[256];
+    static char header[320];
     static unsigned int state = 0;
     
     switch(state)
@@ -100,11 +158,19 @@ API_RETURN openxc::server_api::serverGETfirmware(char* deviceId, char* host) {
             state = 0;
         case 0:
             ret = Working;
-            // compose the header for GET /firmware
+            // compose the header for GET /firmware, only offering to take a
+            // delta if there's somewhere to stage it
             sprintf(header, "GET /api/%s/firmware HTTP/1.1\r\n"
                     "If-None-Match: \"%s\"\r\n"
+                    "%s"
                     "Host: %s\r\n"
-                    "Connection: Keep-Alive\r\n\r\n", deviceId, getConfiguration()->flashHash, host);
+                    "Connection: Keep-Alive\r\n\r\n", deviceId, getConfiguration()->flashHash,
+#ifdef FIRMWARE_DELTA_SUPPORT
+                    fs::connected(getConfiguration()->fs) ? "A-IM: " FIRMWARE_DELTA_IM "\r\n" : "",
+#else
+                    "",
+#endif
+                    host);
             // configure the HTTP client
             client = http::httpClient();
             client.socketNumber = GET_FIRMWARE_SOCKET;
@@ -117,7 +183,16 @@ API_RETURN openxc::server_api::serverGETfirmware(char* deviceId, char* host) {
             client.cbPutResponseData = NULL;
             client.sendSocketData = &openxc::telitHE910::writeSocket;
             client.isReceiveDataAvailable = &openxc::telitHE910::isSocketDataAvailable;
-            client.receiveSocketData = &openxc::telitHE910::readSocketOne;
+            client.receiveSocketData = &openxc::telitHE910::readSocket;
+            // a full image is left in the socket for the bootloader to read
+            // after the reset, so nothing past the header is read until
+            // cbHeaderComplete has seen the status
+            client.holdBody = true;
+#ifdef FIRMWARE_DELTA_SUPPORT
+            // a patch is read in full, not just up to the headers
+            firmwareDelta = false;
+            client.parser_settings.on_body = &cbFirmwareBody;
+#endif
             state = 1;
             break;
             
@@ -135,10 +210,33 @@ API_RETURN openxc::server_api::serverGETfirmware(char* deviceId, char* host) {
                 case http::HTTP_COMPLETE:
                     ret = Success;
                     state = 0;
+#ifdef FIRMWARE_DELTA_SUPPORT
+                    if(firmwareDelta)
+                    {
+                        if(firmwarePatch.status == delta::DELTA_COMPLETE)
+                        {
+                            debug("Staged patched firmware, resetting to install it");
+                            enableWatchdogTimer(0);
+                        }
+                        else
+                        {
+                            debug("Firmware patch is incomplete, discarding it");
+                            fs::removeFile(getConfiguration()->fs, FIRMWARE_STAGE_FILE);
+                            ret = Failed;
+                        }
+                    }
+#endif
                     break;
                 case http::HTTP_FAILED:
                     ret = Failed;
                     state = 0;
+#ifdef FIRMWARE_DELTA_SUPPORT
+                    if(firmwareDelta)
+                    {
+                        debug("Firmware patch failed, discarding it");
+                        fs::removeFile(getConfiguration()->fs, FIRMWARE_STAGE_FILE);
+                    }
+#endif
                     break;
             }
             break;
@@ -161,10 +259,17 @@ API_RETURN openxc::server_api::serverGETcommands(char* deviceId, char* host, uin
             state = 0;
         case 0:
             ret = Working;
-            // compose the header for GET /firmware
+            // compose the header for GET /configure
+#if DEFAULT_COMMAND_LONG_POLL_S > 0
+            sprintf(header, "GET /api/%s/configure HTTP/1.1\r\n"
+                    "Prefer: wait=%u\r\n"
+                    "Host: %s\r\n"
+                    "Connection: Keep-Alive\r\n\r\n", deviceId, DEFAULT_COMMAND_LONG_POLL_S, host);
+#else
             sprintf(header, "GET /api/%s/configure HTTP/1.1\r\n"
                     "Host: %s\r\n"
                     "Connection: Keep-Alive\r\n\r\n", deviceId, host);
+#endif
             // configure the HTTP client
             client = http::httpClient();
             client.socketNumber = GET_COMMANDS_SOCKET;
@@ -177,6 +282,8 @@ API_RETURN openxc::server_api::serverGETcommands(char* deviceId, char* host, uin
             client.sendSocketData = &openxc::telitHE910::writeSocket;
             client.isReceiveDataAvailable = &openxc::telitHE910::isSocketDataAvailable;
             client.receiveSocketData = &openxc::telitHE910::readSocket;
+            // the server may sit on the request for as long as it was asked to
+            client.timeoutPeriod = DEFAULT_COMMAND_LONG_POLL_S * 1000 + HTTP_TIMEOUT_PERIOD;
             state = 1;
             break;
             
@@ -193,10 +300,12 @@ API_RETURN openxc::server_api::serverGETcommands(char* deviceId, char* host, uin
                     break;
                 case http::HTTP_COMPLETE:
                     ret = Success;
+                    commandsKeepAlive = client.keepAlive;
                     state = 0;
                     break;
                 case http::HTTP_FAILED:
                     ret = Failed;
+                    commandsKeepAlive = false;
                     state = 0;
                     break;
             }
@@ -209,6 +318,10 @@ API_RETURN openxc::server_api::serverGETcommands(char* deviceId, char* host, uin
     
 }
 
+bool openxc::server_api::serverGETcommandsKeepAlive(void) {
+    return commandsKeepAlive;
+}
+
 void openxc::server_api::resetCommandBuffer(void) {
     pCommandBuffer = commandBuffer;
 }
@@ -217,6 +330,86 @@ unsigned int openxc::server_api::bytesCommandBuffer(void) {
     return int(pCommandBuffer - commandBuffer);
 }
 
+/*POST (PRIVATE)*/
+
+// POSTs vehicle data, either from a buffer or (if source is set) streamed from
+// the source as a chunked body
+static API_RETURN postData(char* deviceId, char* host, char* data, unsigned int len, bool deflated,
+        unsigned int (*source)(char*, unsigned int, bool*)) {
+
+    static API_RETURN ret = None;
+    static http::httpClient client;
+    static char header[256];
+    static unsigned int state = 0;
+    static const char* ctJSON = "application/json";
+    static const char* ctPROTOBUF = "application/x-protobuf";
+    char lengthField[32];
+    
+    switch(state)
+    {
+        default:
+            state = 0;
+        case 0:
+            ret = Working;
+            // compose the header for POST /data
+            if(source) {
+                strcpy(lengthField, "Transfer-Encoding: chunked");
+            }
+            else {
+                sprintf(lengthField, "Content-Length: %u", len);
+            }
+            sprintf(header, "POST /api/%s/data HTTP/1.1\r\n"
+                    "%s\r\n"
+                    "Content-Type: %s\r\n"
+                    "%s"
+                    "Host: %s\r\n"
+                    "Connection: Keep-Alive\r\n\r\n", deviceId, lengthField,
+                    openxc::pipeline::payloadFormat(InterfaceType::TELIT) ==
+                        PayloadFormat::PROTOBUF ? ctPROTOBUF : ctJSON,
+                    deflated ? "Content-Encoding: deflate\r\n" : "", host);
+            // configure the HTTP client
+            client = http::httpClient();
+            client.socketNumber = POST_DATA_SOCKET;
+            client.requestHeader = header;
+            client.requestBody = data;
+            client.requestBodySize = len;
+            client.cbGetRequestData = source;
+            client.cbPutResponseData = NULL;
+            client.sendSocketData = &openxc::telitHE910::writeSocket;
+            client.isReceiveDataAvailable = &openxc::telitHE910::isSocketDataAvailable;
+            client.receiveSocketData = &openxc::telitHE910::readSocket;
+            state = 1;
+            break;
+            
+        case 1:
+            // run the HTTP client
+            switch(client.execute())
+            {
+                case http::HTTP_READY:
+                case http::HTTP_SENDING_REQUEST_HEADER:
+                case http::HTTP_SENDING_REQUEST_BODY:
+                case http::HTTP_RECEIVING_RESPONSE:
+                case http::HTTP_WAIT:
+                    // nothing to do while client is in progress
+                    break;
+                case http::HTTP_COMPLETE:
+                    ret = Success;
+                    postKeepAlive = client.keepAlive;
+                    state = 0;
+                    break;
+                case http::HTTP_FAILED:
+                    ret = Failed;
+                    postKeepAlive = false;
+                    state = 0;
+                    break;
+            }
+            break;
+    }
+    
+    return ret;
+
+}
+
 /*HTTP CALLBACKS (PRIVATE)*/
 
 static int cbOnBody(http_parser* parser, const char* at, size_t length) {
@@ -240,9 +433,34 @@ static int cbHeaderComplete(http_parser* parser) {
     {
         enableWatchdogTimer(0);
     }
+#ifdef FIRMWARE_DELTA_SUPPORT
+    else if(parser->status_code == 226)
+    {
+        // rebuild the new firmware from the running one as the patch arrives
+        firmwareDelta = true;
+        fs::removeFile(getConfiguration()->fs, FIRMWARE_STAGE_FILE);
+        delta::begin(&firmwarePatch, (const uint8_t*)FIRMWARE_IMAGE_START,
+                FIRMWARE_IMAGE_LENGTH, stageFirmware, NULL);
+    }
+#endif
     else
     {
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+#ifdef FIRMWARE_DELTA_SUPPORT
+static int cbFirmwareBody(http_parser* parser, const char* at, size_t length) {
+    if(!firmwareDelta)
+    {
+        return 0;
+    }
+    return delta::apply(&firmwarePatch, (const uint8_t*)at, length) == delta::DELTA_FAILED ? 1 : 0;
+}
+
+static bool stageFirmware(const uint8_t* data, size_t length, void* context) {
+    return fs::appendFile(getConfiguration()->fs, FIRMWARE_STAGE_FILE, data, length,
+            FIRMWARE_IMAGE_LENGTH) >= 0;
+}
+#endif
\ No newline at end of file
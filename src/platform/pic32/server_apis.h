@@ -5,6 +5,57 @@
 #define GET_FIRMWARE_SOCKET        1
 #define POST_DATA_SOCKET        2
 #define GET_COMMANDS_SOCKET        3
+#define POST_LOG_SOCKET        4
+
+// Set to 1 to send POST data bodies with the deflate content encoding, if the
+// server accepts it.
+#ifndef DEFAULT_POST_DATA_DEFLATE
+#define DEFAULT_POST_DATA_DEFLATE 0
+#endif
+
+// Set to 1 to stream records to the server as they're produced, as a chunked
+// POST body, instead of POSTing them in batches.
+#ifndef DEFAULT_POST_DATA_CHUNKED
+#define DEFAULT_POST_DATA_CHUNKED 0
+#endif
+
+// Set to 1 to ask the server for firmware updates as a delta patch against the
+// running firmware (with "A-IM: openxc-delta", RFC 3229), rebuilt as it
+// arrives into FIRMWARE_STAGE_FILE on the SD card for the bootloader to
+// install. Only with FS_SUPPORT.
+#ifndef DEFAULT_FIRMWARE_DELTA
+#define DEFAULT_FIRMWARE_DELTA 0
+#endif
+
+#define FIRMWARE_DELTA_IM "openxc-delta"
+#define FIRMWARE_STAGE_FILE "FIRMWARE.BIN"
+
+// How long, in seconds, to ask the server to hold a GET for commands open
+// until it has some to send ("Prefer: wait=N", RFC 7240), so they arrive within
+// a round trip instead of at the next poll. Set to 0 to poll every
+// GET_COMMANDS_INTERVAL without waiting. A server that ignores the preference
+// and answers right away is still only polled every GET_COMMANDS_INTERVAL.
+#ifndef DEFAULT_COMMAND_LONG_POLL_S
+#define DEFAULT_COMMAND_LONG_POLL_S 0
+#endif
+
+// Set to 1 to upload the finished log files on the SD card to the server in
+// the background, LOG_UPLOAD_CHUNK_SIZE bytes per POST, whenever there's no
+// vehicle data waiting to be sent. Each chunk says where it goes in the file
+// with a Content-Range header, and how far each file got is kept in
+// LOG_UPLOAD_PROGRESS_FILE, so an upload picks up where it stopped after a
+// dropped connection or a reset. Only with FS_SUPPORT.
+#ifndef DEFAULT_LOG_UPLOAD
+#define DEFAULT_LOG_UPLOAD 0
+#endif
+
+#define LOG_UPLOAD_CHUNK_SIZE 1024
+#define LOG_UPLOAD_PROGRESS_FILE "UPLOAD.CSV"
+
+// The firmware image a patch is applied to - the exception vectors and the
+// program, up to the NVM page.
+#define FIRMWARE_IMAGE_START 0x9D000000
+#define FIRMWARE_IMAGE_LENGTH 0x7F000
 
 namespace openxc {
 namespace server_api{
@@ -18,9 +69,67 @@ typedef enum {
 } API_RETURN;
 
 // external functions
-API_RETURN serverPOSTdata(char* deviceId, char* host, char* data, unsigned int len);
+
+/* Public: POST vehicle data to the server.
+ *
+ * deflated - true if data is a zlib stream, to be sent with
+ *      "Content-Encoding: deflate" (see openxc::util::deflate::compress).
+ */
+API_RETURN serverPOSTdata(char* deviceId, char* host, char* data, unsigned int len, bool deflated);
+
+/* Public: POST vehicle data to the server as a chunked body, pulled from
+ * source for as long as it takes to say the body is complete. See
+ * http::httpClient::cbGetRequestData.
+ */
+API_RETURN serverPOSTstream(char* deviceId, char* host, unsigned int (*source)(char*, unsigned int, bool*));
+
+/* Public: Returns true if the server kept the connection open after the last
+ * POST, so the next one can reuse the socket without checking on it.
+ */
+bool serverPOSTkeepAlive(void);
+
+/* Public: POST part of a log file from the SD card to the server, as
+ * /api/<deviceId>/logs/<file>, with a "Content-Range: bytes first-last/total"
+ * header saying which part of the file it is.
+ *
+ * file - The name of the log file.
+ * offset - Where in the file the part starts.
+ * length - How many bytes of the file the part is.
+ * total - The size of the whole file.
+ * data - The body, the part itself or (if deflated) a zlib stream of it.
+ * len - The number of bytes at data.
+ * deflated - true to send the body with "Content-Encoding: deflate".
+ *
+ * Returns Failed unless the server answers with a 2xx status, so the part
+ * can be sent again. See serverPOSTlogKeepAlive for whether the socket is
+ * still open after a Success.
+ */
+API_RETURN serverPOSTlog(char* deviceId, char* host, const char* file, uint32_t offset,
+        unsigned int length, uint32_t total, char* data, unsigned int len, bool deflated);
+
+/* Public: Returns true if the server kept the connection open after the last
+ * log POST.
+ */
+bool serverPOSTlogKeepAlive(void);
+
+/* Public: Ask the server if there's newer firmware than the running one,
+ * identified by its hash. If there is, the VI resets into the bootloader to
+ * install it. With DEFAULT_FIRMWARE_DELTA, the server may answer with a delta
+ * patch instead (226 IM Used), which is applied as it's received and staged on
+ * the SD card, and the VI only resets once the staged image checks out.
+ */
 API_RETURN serverGETfirmware(char* deviceId, char* host);
+
+/* Public: GET the commands the server has for the VI. With
+ * DEFAULT_COMMAND_LONG_POLL_S, the server may hold the request open for up to
+ * that long until it has commands to send.
+ */
 API_RETURN serverGETcommands(char* deviceId, char* host, uint8_t** result, unsigned int* len);
+
+/* Public: Returns true if the server kept the connection open after the last
+ * GET for commands.
+ */
+bool serverGETcommandsKeepAlive(void);
 void resetCommandBuffer(void);
 unsigned int bytesCommandBuffer(void);
 
@@ -4,27 +4,84 @@
 #include "telit_he910.h"
 #include "server_task.h"
 #include "server_apis.h"
+#include "http.h"
+#include "util/deflate.h"
+#include "util/log.h"
+#include "interface/fs.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #define GET_FIRMWARE_INTERVAL    600000
 #define GET_COMMANDS_INTERVAL    10000
 #define POST_DATA_MAX_INTERVAL    5000
+#define POST_DATA_MAX_ATTEMPTS    2
+#define POST_BUFFER_COUNT         (SEND_BUFFER_COUNT - 1)
+#define LOG_UPLOAD_INTERVAL       60000
+
+// With DEFAULT_SERVER_TLS every request shares the modem's one SSL socket (see
+// claimSocket), so a connection the server kept open after the last request on
+// a socket may have been closed by a request on another since.
+#define KEEP_ALIVE_TRUSTED (!DEFAULT_SERVER_TLS)
+
+#if DEFAULT_LOG_UPLOAD && defined(FS_SUPPORT)
+#define LOG_UPLOAD_SUPPORT
+#endif
+
+// A line of LOG_UPLOAD_PROGRESS_FILE is the log file's name padded to 12
+// characters, a comma, and the number of bytes of it uploaded as 10 digits.
+#define LOG_UPLOAD_PROGRESS_LINE_SIZE   24
+#define LOG_UPLOAD_PROGRESS_MAX_SIZE    (LOG_UPLOAD_PROGRESS_LINE_SIZE * 256)
+
+typedef enum {
+    POST_BUFFER_FREE,       // ready to be filled from the send buffer
+    POST_BUFFER_FILLED,     // waiting for its turn to be posted
+    POST_BUFFER_POSTING     // POST in progress
+} POST_BUFFER_STATE;
+
+typedef struct {
+    POST_BUFFER_STATE state;
+    unsigned int byteCount;
+    unsigned int attempts;
+    bool deflated;
+    char* data;             // the POST body, framed in place around records
+    char* records;          // the send buffer taken from the modem
+} PostBuffer;
 
 using openxc::server_api::serverGETfirmware;
 using openxc::server_api::serverPOSTdata;
+using openxc::server_api::serverPOSTstream;
+using openxc::server_api::serverPOSTkeepAlive;
 using openxc::server_api::serverGETcommands;
+using openxc::server_api::serverGETcommandsKeepAlive;
+using openxc::server_api::serverPOSTlog;
+using openxc::server_api::serverPOSTlogKeepAlive;
 using openxc::server_api::API_RETURN;
 using openxc::util::time::uptimeMs;
 using openxc::telitHE910::TelitDevice;
 using openxc::telitHE910::isSocketOpen;
 using openxc::telitHE910::openSocket;
 using openxc::telitHE910::closeSocket;
+using openxc::telitHE910::claimSocket;
+using openxc::telitHE910::releaseSocket;
 using openxc::telitHE910::resetSendBuffer;
 using openxc::telitHE910::bytesSendBuffer;
-using openxc::telitHE910::readAllSendBuffer;
+using openxc::telitHE910::popSendBuffer;
+using openxc::telitHE910::takeSendBuffer;
+using openxc::telitHE910::releaseSendBuffer;
 using openxc::server_api::resetCommandBuffer;
 using openxc::config::getConfiguration;
 using openxc::payload::PayloadFormat;
+using openxc::interface::InterfaceType;
+
+using openxc::util::log::debug;
+
+namespace deflate = openxc::util::deflate;
+namespace fs = openxc::interface::fs;
+
+// true while flushDataBuffer has vehicle data to POST, so log uploads stay out
+// of its way
+static bool postPending = false;
 
 void openxc::server_task::firmwareCheck(TelitDevice* device) {
     
@@ -37,6 +94,12 @@ void openxc::server_task::firmwareCheck(TelitDevice* device) {
         default:
             state = 0;
         case 0:
+            // the server compares against the firmware hash, so wait until
+            // it's been computed
+            if(getConfiguration()->flashHash[0] == '\0')
+            {
+                break;
+            }
             // check interval if it's not our first time
             if(!first)
             {
@@ -56,10 +119,16 @@ void openxc::server_task::firmwareCheck(TelitDevice* device) {
             break;
             
         case 1:
+            if(!claimSocket(GET_FIRMWARE_SOCKET))
+            {
+                // another request has the modem's SSL socket
+                break;
+            }
             if(!isSocketOpen(GET_FIRMWARE_SOCKET))
             {
                 if(!openSocket(GET_FIRMWARE_SOCKET, device->config.serverConnectSettings))
                 {
+                    releaseSocket(GET_FIRMWARE_SOCKET);
                     state = 0;
                 }
                 else
@@ -89,6 +158,7 @@ void openxc::server_task::firmwareCheck(TelitDevice* device) {
                     // either we got a 200 OK, in which case we went for reset
                     // or we got a 204/error, in which case we have a dangling transaction
                     closeSocket(GET_FIRMWARE_SOCKET);
+                    releaseSocket(GET_FIRMWARE_SOCKET);
                     //timer = uptimeMs();
                     state = 0;
                     break;
@@ -100,50 +170,162 @@ void openxc::server_task::firmwareCheck(TelitDevice* device) {
     
 }
 
+#if !DEFAULT_POST_DATA_CHUNKED
+
+/* Private: Take the modem's send buffer as the body of a POST, in the
+ * endpoint's payload format, leaving a free send buffer to fill while the POST
+ * is in progress. The body is framed around the records where the pipeline
+ * wrote them, so they're never copied again.
+ *
+ * Returns false if there's no free send buffer to swap in yet.
+ */
+static bool fillPostBuffer(TelitDevice* device, PostBuffer* buffer) {
+
+    unsigned int length = 0;
+    unsigned int i = 0;
+    
+    buffer->records = takeSendBuffer(device, &length);
+    if(buffer->records == NULL)
+    {
+        return false;
+    }
+    
+    switch(openxc::pipeline::payloadFormat(InterfaceType::TELIT))
+    {
+        case PayloadFormat::JSON:
+        
+            // the root record goes in the free space in front of the records
+            buffer->data = buffer->records - 12;
+            memcpy(buffer->data, "{\"records\":[", 12);
+            buffer->byteCount = 12 + length;
+            
+            // replace the nulls with commas to create a JSON array
+            for(i = 12; i < buffer->byteCount; ++i)
+            {
+                if(buffer->data[i] == '\0')
+                    buffer->data[i] = ',';
+            }
+            
+            // back over the trailing comma
+            if(buffer->data[buffer->byteCount-1] == ',')
+                buffer->byteCount--;
+            
+            // end the array
+            buffer->data[buffer->byteCount++] = ']';
+            buffer->data[buffer->byteCount++] = '}';
+        
+            break;
+            
+        case PayloadFormat::PROTOBUF:
+        case PayloadFormat::MESSAGEPACK:
+        case PayloadFormat::MESSAGEPACK_COMPACT:
+        
+            buffer->data = buffer->records;
+            buffer->byteCount = length;
+        
+            break;
+    }
+    
+    buffer->deflated = false;
+#if DEFAULT_POST_DATA_DEFLATE
+    // only one buffer is filled at a time, so they can share the scratch space
+    static uint8_t compressed[SEND_BUFFER_SIZE + SEND_BUFFER_FRAMING];
+    size_t compressedCount = deflate::compress((uint8_t*)buffer->data,
+            buffer->byteCount, compressed, buffer->byteCount);
+    if(compressedCount > 0) {
+        memcpy(buffer->data, compressed, compressedCount);
+        buffer->byteCount = compressedCount;
+        buffer->deflated = true;
+    }
+#endif
+    
+    buffer->attempts = 0;
+    buffer->state = POST_BUFFER_FILLED;
+    return true;
+
+}
+
+/* Private: Give a POST buffer's send buffer back to the modem once it's been
+ * posted (or given up on).
+ */
+static void freePostBuffer(TelitDevice* device, PostBuffer* buffer) {
+
+    releaseSendBuffer(device, buffer->records);
+    buffer->records = NULL;
+    buffer->state = POST_BUFFER_FREE;
+
+}
+
 void openxc::server_task::flushDataBuffer(TelitDevice* device) {
 
     static bool first = true;
     static unsigned int state = 0;
     static unsigned int lastFlushTime = 0;
     static const unsigned int flushSize = 2048;
-    static char postBuffer[SEND_BUFFER_SIZE + 64]; // extra space needed for root record
-    static unsigned int byteCount = 0;
-    unsigned int i = 0;
+    static PostBuffer postBuffers[POST_BUFFER_COUNT];
+    static unsigned int fillIndex = 0;    // next buffer to fill
+    static unsigned int postIndex = 0;    // oldest filled buffer, the one being posted
     static unsigned int bufSize = 0;
+    static bool keptAlive = false;        // the socket is known to be open from the last POST
+    PostBuffer* buffer = NULL;
     
-    switch(state)
+    // Filling a POST buffer doesn't wait for the POST before it, so the send
+    // buffer keeps emptying while a slow POST is in progress.
+    
+    // conditions to flush the outgoing data buffer
+        // a) buffer has reached the flush size
+        // b) buffer has not been flushed for the time period POST_DATA_MAX_INTERVAL (and there is something in there)
+        // c) minimum amount of time has passed since lastFlushTime (depends on socket status) - not yet implemented
+    if(postBuffers[fillIndex].state == POST_BUFFER_FREE)
     {
-        default:
-            state = 0;
-        case 0:
-            // conditions to flush the outgoing data buffer
-                // a) buffer has reached the flush size
-                // b) buffer has not been flushed for the time period POST_DATA_MAX_INTERVAL (and there is something in there)
-                // c) minimum amount of time has passed since lastFlushTime (depends on socket status) - not yet implemented
-            if(!first)
+        if(!first)
+        {
+            bufSize = bytesSendBuffer(device);
+            if( (bufSize >= flushSize) || 
+                ((uptimeMs() - lastFlushTime >= POST_DATA_MAX_INTERVAL) && (bufSize > 0)) )
             {
-                bufSize = bytesSendBuffer(device);
-                if( (bufSize >= flushSize) || 
-                    ((uptimeMs() - lastFlushTime >= POST_DATA_MAX_INTERVAL) && (bufSize > 0)) )
+                if(fillPostBuffer(device, &postBuffers[fillIndex]))
                 {
                     lastFlushTime = uptimeMs();
-                    state = 1;
+                    fillIndex = (fillIndex + 1) % POST_BUFFER_COUNT;
                 }
             }
-            else
+        }
+        else if(fillPostBuffer(device, &postBuffers[fillIndex]))
+        {
+            first = false;
+            lastFlushTime = uptimeMs();
+            fillIndex = (fillIndex + 1) % POST_BUFFER_COUNT;
+        }
+    }
+    
+    buffer = &postBuffers[postIndex];
+    
+    switch(state)
+    {
+        default:
+            state = 0;
+        case 0:
+            // wait for a filled buffer to post
+            if(buffer->state == POST_BUFFER_FILLED)
             {
-                first = false;
-                lastFlushTime = uptimeMs();
                 state = 1;
             }
             break;
             
         case 1:
-            // ensure we have an open TCP/IP socket
-            if(!isSocketOpen(POST_DATA_SOCKET))
+            if(!claimSocket(POST_DATA_SOCKET))
+            {
+                // another request has the modem's SSL socket
+                break;
+            }
+            // ensure we have an open TCP/IP socket (no need to ask the modem
+            // if the server kept it open after the last POST)
+            if(!(keptAlive && KEEP_ALIVE_TRUSTED) && !isSocketOpen(POST_DATA_SOCKET))
             {
                 if(!openSocket(POST_DATA_SOCKET, device->config.serverConnectSettings))
                 {
+                    releaseSocket(POST_DATA_SOCKET);
                     state = 0;
                 }
                 else
@@ -159,46 +341,183 @@ void openxc::server_task::flushDataBuffer(TelitDevice* device) {
             
         case 2:
             
-            switch(getConfiguration()->payloadFormat)
-            {
-                case PayloadFormat::JSON:
-                
-                    // pre-populate the send buffer with root record
-                    memcpy(postBuffer, "{\"records\":[", 12);
-                    byteCount = 12;
-                    
-                    // get all bytes from the send buffer (so we have room to fill it again as we POST)
-                    byteCount += readAllSendBuffer(device, postBuffer+byteCount, sizeof(postBuffer) - byteCount);
-                    resetSendBuffer(device);
-                    
-                    // replace the nulls with commas to create a JSON array
-                    for(i = 0; i < byteCount; ++i)
+            buffer->state = POST_BUFFER_POSTING;
+            buffer->attempts++;
+            state = 3;
+            
+            break;
+            
+        case 3:
+        
+            // call the POSTdata API
+            switch(serverPOSTdata(device->deviceId, device->config.serverConnectSettings.host, buffer->data, buffer->byteCount, buffer->deflated))
+            {
+                case server_api::None:
+                case server_api::Working:
+                    // if we are working, do nothing
+                    break;
+                default:
+                case server_api::Success:
+                    freePostBuffer(device, buffer);
+                    postIndex = (postIndex + 1) % POST_BUFFER_COUNT;
+                    keptAlive = serverPOSTkeepAlive();
+                    releaseSocket(POST_DATA_SOCKET);
+                    state = 0;
+                    break;
+                case server_api::Failed:
+                    keptAlive = false;
+                    //lastFlushTime = uptimeMs();
+                    // try the same buffer again, unless it keeps failing,
+                    // so one bad POST doesn't hold up the ones behind it
+                    if(buffer->attempts >= POST_DATA_MAX_ATTEMPTS)
                     {
-                        if(postBuffer[i] == '\0')
-                            postBuffer[i] = ',';
+                        freePostBuffer(device, buffer);
+                        postIndex = (postIndex + 1) % POST_BUFFER_COUNT;
                     }
-                    
-                    // back over the trailing comma
-                    if(postBuffer[byteCount-1] == ',')
-                        byteCount--;
-                    
-                    // end the array
-                    postBuffer[byteCount++] = ']';
-                    postBuffer[byteCount++] = '}';
-                
-                    break;
-                    
-                case PayloadFormat::PROTOBUF:
-                case PayloadFormat::MESSAGEPACK:
-                
-                    // get all bytes from the send buffer (so we have room to fill it again as we POST)
-                    byteCount = 0;
-                    byteCount += readAllSendBuffer(device, postBuffer+byteCount, sizeof(postBuffer) - byteCount);
-                    resetSendBuffer(device);
-                
+                    else
+                    {
+                        buffer->state = POST_BUFFER_FILLED;
+                    }
+                    state = 0;
+                    closeSocket(POST_DATA_SOCKET);
+                    releaseSocket(POST_DATA_SOCKET);
                     break;
             }
+            break;
+    }
+    
+    postPending = state != 0 || postBuffers[postIndex].state != POST_BUFFER_FREE;
+    return;
+
+}
+
+#else
+
+// The body being streamed - see streamRecords
+static bool streamOpened = false;           // the JSON root record has been sent
+static bool streamPendingComma = false;     // a JSON record ended and another may follow
+static unsigned long streamStartTime = 0;
+
+/* Private: The chunked POST body source. Moves whatever is in the modem's send
+ * buffer into the next chunk as records come in, joining JSON records into
+ * one {"records":[...]} array as fillPostBuffer does. The body is complete once
+ * it has been open for POST_DATA_MAX_INTERVAL and has reached the end of a
+ * record.
+ */
+static unsigned int streamRecords(char* data, unsigned int maxLen, bool* complete) {
+
+    static char records[HTTP_CHUNK_SIZE];
+    TelitDevice* device = getConfiguration()->telit;
+    bool json = openxc::pipeline::payloadFormat(InterfaceType::TELIT) == PayloadFormat::JSON;
+    unsigned int count = 0;
+    unsigned int recordCount = 0;
+    unsigned int i = 0;
+    bool boundary = false;
+    
+    if(json)
+    {
+        if(!streamOpened)
+        {
+            memcpy(data, "{\"records\":[", 12);
+            count = 12;
+            streamOpened = true;
+        }
+        
+        // leave room for a comma held over from the last chunk and the end of
+        // the array
+        recordCount = popSendBuffer(device, records, maxLen - count - 3);
+        
+        // the nulls between records become commas, but only once another
+        // record follows
+        for(i = 0; i < recordCount; ++i)
+        {
+            if(records[i] == '\0')
+            {
+                streamPendingComma = true;
+            }
+            else
+            {
+                if(streamPendingComma)
+                {
+                    data[count++] = ',';
+                    streamPendingComma = false;
+                }
+                data[count++] = records[i];
+            }
+        }
+        boundary = recordCount > 0 && records[recordCount - 1] == '\0';
+    }
+    else
+    {
+        count = popSendBuffer(device, data, maxLen);
+    }
+    boundary = boundary || bytesSendBuffer(device) == 0;
+    
+    if(boundary && uptimeMs() - streamStartTime >= POST_DATA_MAX_INTERVAL)
+    {
+        *complete = true;
+        if(json)
+        {
+            data[count++] = ']';
+            data[count++] = '}';
+        }
+    }
+    
+    return count;
+
+}
+
+void openxc::server_task::flushDataBuffer(TelitDevice* device) {
+
+    static unsigned int state = 0;
+    static bool keptAlive = false;        // the socket is known to be open from the last POST
+    
+    // Records go out as they're produced, as chunks of a POST that stays open
+    // for POST_DATA_MAX_INTERVAL, instead of waiting for a batch to fill.
+    
+    switch(state)
+    {
+        default:
+            state = 0;
+        case 0:
+            // start a POST as soon as there's something to send
+            if(bytesSendBuffer(device) > 0)
+            {
+                state = 1;
+            }
+            break;
+            
+        case 1:
+            if(!claimSocket(POST_DATA_SOCKET))
+            {
+                // another request has the modem's SSL socket
+                break;
+            }
+            // ensure we have an open TCP/IP socket (no need to ask the modem
+            // if the server kept it open after the last POST)
+            if(!(keptAlive && KEEP_ALIVE_TRUSTED) && !isSocketOpen(POST_DATA_SOCKET))
+            {
+                if(!openSocket(POST_DATA_SOCKET, device->config.serverConnectSettings))
+                {
+                    releaseSocket(POST_DATA_SOCKET);
+                    state = 0;
+                }
+                else
+                {
+                    state = 2;
+                }
+            }
+            else
+            {
+                state = 2;
+            }
+            break;
             
+        case 2:
+        
+            streamOpened = false;
+            streamPendingComma = false;
+            streamStartTime = uptimeMs();
             state = 3;
             
             break;
@@ -206,7 +525,7 @@ void openxc::server_task::flushDataBuffer(TelitDevice* device) {
         case 3:
         
             // call the POSTdata API
-            switch(serverPOSTdata(device->deviceId, device->config.serverConnectSettings.host, postBuffer, byteCount))
+            switch(serverPOSTstream(device->deviceId, device->config.serverConnectSettings.host, &streamRecords))
             {
                 case server_api::None:
                 case server_api::Working:
@@ -214,29 +533,278 @@ void openxc::server_task::flushDataBuffer(TelitDevice* device) {
                     break;
                 default:
                 case server_api::Success:
+                    keptAlive = serverPOSTkeepAlive();
+                    releaseSocket(POST_DATA_SOCKET);
                     state = 0;
                     break;
                 case server_api::Failed:
-                    //lastFlushTime = uptimeMs();
+                    keptAlive = false;
                     state = 0;
                     closeSocket(POST_DATA_SOCKET);
+                    releaseSocket(POST_DATA_SOCKET);
                     break;
             }
             break;
     }
     
+    postPending = state != 0;
+    return;
+
+}
+
+#endif // DEFAULT_POST_DATA_CHUNKED
+
+#ifdef LOG_UPLOAD_SUPPORT
+
+// The log file being uploaded and how much of it the server has
+static char uploadFile[13];
+static uint32_t uploadOffset = 0;
+static bool uploadProgressLoaded = false;
+
+/* Private: Pick up where uploads stopped before the last reset, from the last
+ * line of LOG_UPLOAD_PROGRESS_FILE.
+ */
+static void loadUploadProgress() {
+
+    char line[LOG_UPLOAD_PROGRESS_LINE_SIZE + 1];
+    char* comma = NULL;
+    char* end = NULL;
+    int size = fs::fileSize(getConfiguration()->fs, LOG_UPLOAD_PROGRESS_FILE);
+    
+    uploadFile[0] = '\0';
+    uploadOffset = 0;
+    size -= size % LOG_UPLOAD_PROGRESS_LINE_SIZE;
+    if(size <= 0 || fs::readFileAt(getConfiguration()->fs, LOG_UPLOAD_PROGRESS_FILE,
+            size - LOG_UPLOAD_PROGRESS_LINE_SIZE, (uint8_t*)line,
+            LOG_UPLOAD_PROGRESS_LINE_SIZE) != LOG_UPLOAD_PROGRESS_LINE_SIZE)
+    {
+        return;
+    }
+    
+    line[LOG_UPLOAD_PROGRESS_LINE_SIZE] = '\0';
+    comma = strchr(line, ',');
+    if(comma == NULL || comma - line > 12)
+    {
+        return;
+    }
+    // the name is padded with spaces
+    end = comma;
+    while(end > line && end[-1] == ' ')
+    {
+        --end;
+    }
+    *end = '\0';
+    strcpy(uploadFile, line);
+    uploadOffset = strtoul(comma + 1, NULL, 10);
+
+}
+
+/* Private: Record how far the upload has got. Lines are only ever appended,
+ * so a reset while writing can't lose what was there, until the file is full
+ * and starts again.
+ */
+static void saveUploadProgress() {
+
+    char line[LOG_UPLOAD_PROGRESS_LINE_SIZE + 1];
+    
+    sprintf(line, "%-12s,%010lu\n", uploadFile, (unsigned long)uploadOffset);
+    if(fs::appendFile(getConfiguration()->fs, LOG_UPLOAD_PROGRESS_FILE, (uint8_t*)line,
+            LOG_UPLOAD_PROGRESS_LINE_SIZE, LOG_UPLOAD_PROGRESS_MAX_SIZE) < 0)
+    {
+        fs::removeFile(getConfiguration()->fs, LOG_UPLOAD_PROGRESS_FILE);
+        fs::appendFile(getConfiguration()->fs, LOG_UPLOAD_PROGRESS_FILE, (uint8_t*)line,
+                LOG_UPLOAD_PROGRESS_LINE_SIZE, LOG_UPLOAD_PROGRESS_MAX_SIZE);
+    }
+
+}
+
+/* Private: Read the next part of the log files to upload - the rest of the
+ * file in progress if it has any, or else the start of the next finished one.
+ *
+ * Returns the number of bytes read, or 0 if there's nothing left to upload.
+ */
+static unsigned int readUploadChunk(char* chunk, uint32_t* total) {
+
+    int size = 0;
+    int count = 0;
+    
+    while(true)
+    {
+        if(uploadFile[0] != '\0')
+        {
+            size = fs::fileSize(getConfiguration()->fs, uploadFile);
+            if(size > 0 && (uint32_t)size > uploadOffset)
+            {
+                count = fs::readFileAt(getConfiguration()->fs, uploadFile, uploadOffset,
+                        (uint8_t*)chunk, LOG_UPLOAD_CHUNK_SIZE);
+                if(count > 0)
+                {
+                    *total = size;
+                    return count;
+                }
+            }
+        }
+        
+        // the file is done (or gone), go on to the next one
+        if(!fs::nextLogFile(getConfiguration()->fs, uploadFile[0] != '\0' ? uploadFile : NULL,
+                uploadFile, sizeof(uploadFile)))
+        {
+            return 0;
+        }
+        uploadOffset = 0;
+    }
+
+}
+
+void openxc::server_task::uploadLogs(TelitDevice* device) {
+
+    static unsigned int state = 0;
+    static unsigned long timer = 0;
+    static bool first = true;
+    static bool keptAlive = false;        // the socket is known to be open from the last POST
+    static char chunk[LOG_UPLOAD_CHUNK_SIZE];
+    static unsigned int chunkLength = 0;
+    static uint32_t total = 0;
+    static char* body = NULL;
+    static unsigned int bodyLength = 0;
+    static bool deflated = false;
+    
+    // Uploads only use the link while the vehicle data has nothing waiting,
+    // one chunk per POST, so a chunk holds up live data by one POST at most.
+    
+    switch(state)
+    {
+        default:
+            state = 0;
+        case 0:
+            // go again once there's nothing left to upload or it's failed
+            if(!first && uptimeMs() - timer < LOG_UPLOAD_INTERVAL)
+            {
+                break;
+            }
+            if(postPending || bytesSendBuffer(device) > 0 || !fs::connected(getConfiguration()->fs))
+            {
+                break;
+            }
+            if(!uploadProgressLoaded)
+            {
+                loadUploadProgress();
+                uploadProgressLoaded = true;
+            }
+            
+            chunkLength = readUploadChunk(chunk, &total);
+            if(chunkLength == 0)
+            {
+                first = false;
+                timer = uptimeMs();
+                break;
+            }
+            
+            body = chunk;
+            bodyLength = chunkLength;
+            deflated = false;
+#if DEFAULT_POST_DATA_DEFLATE
+            {
+                static uint8_t compressed[LOG_UPLOAD_CHUNK_SIZE];
+                size_t compressedCount = deflate::compress((uint8_t*)chunk,
+                        chunkLength, compressed, chunkLength);
+                if(compressedCount > 0) {
+                    body = (char*)compressed;
+                    bodyLength = compressedCount;
+                    deflated = true;
+                }
+            }
+#endif
+            state = 1;
+            break;
+            
+        case 1:
+            if(!claimSocket(POST_LOG_SOCKET))
+            {
+                // another request has the modem's SSL socket
+                break;
+            }
+            // ensure we have an open TCP/IP socket (no need to ask the modem
+            // if the server kept it open after the last POST)
+            if(!(keptAlive && KEEP_ALIVE_TRUSTED) && !isSocketOpen(POST_LOG_SOCKET))
+            {
+                if(!openSocket(POST_LOG_SOCKET, device->config.serverConnectSettings))
+                {
+                    releaseSocket(POST_LOG_SOCKET);
+                    first = false;
+                    timer = uptimeMs();
+                    state = 0;
+                }
+                else
+                {
+                    state = 2;
+                }
+            }
+            else
+            {
+                state = 2;
+            }
+            break;
+            
+        case 2:
+            // call the POSTlog API
+            switch(serverPOSTlog(device->deviceId, device->config.serverConnectSettings.host,
+                    uploadFile, uploadOffset, chunkLength, total, body, bodyLength, deflated))
+            {
+                case server_api::None:
+                case server_api::Working:
+                    // if we are working, do nothing
+                    break;
+                default:
+                case server_api::Success:
+                    uploadOffset += chunkLength;
+                    saveUploadProgress();
+                    keptAlive = serverPOSTlogKeepAlive();
+                    releaseSocket(POST_LOG_SOCKET);
+                    if(uploadOffset >= total)
+                    {
+                        debug("Uploaded log %s", uploadFile);
+                    }
+                    state = 0;
+                    break;
+                case server_api::Failed:
+                    // the same chunk is sent again on the next try
+                    keptAlive = false;
+                    closeSocket(POST_LOG_SOCKET);
+                    releaseSocket(POST_LOG_SOCKET);
+                    first = false;
+                    timer = uptimeMs();
+                    state = 0;
+                    break;
+            }
+            break;
+    }
+
     return;
 
 }
 
+#else
+
+void openxc::server_task::uploadLogs(TelitDevice* device) { }
+
+#endif // LOG_UPLOAD_SUPPORT
+
 void openxc::server_task::commandCheck(TelitDevice* device) {
 
     static unsigned int state = 0;
     static bool first = true;
     static unsigned long timer = 0xFFFF;
+    static unsigned long interval = GET_COMMANDS_INTERVAL;
+    static bool keptAlive = false;        // the socket is known to be open from the last GET
     uint8_t* pCommand = NULL;
     unsigned int cmd_len = 0;
 
+    // With DEFAULT_COMMAND_LONG_POLL_S, the server holds each GET until it has
+    // commands, so the next one can go out as soon as the last is answered -
+    // but not sooner than GET_COMMANDS_INTERVAL after the last went out unless
+    // it brought commands, in case the server answers without waiting.
+
     switch(state)
     {
         default:
@@ -246,7 +814,7 @@ void openxc::server_task::commandCheck(TelitDevice* device) {
             if(!first)
             {
                 // request commands on interval
-                if(uptimeMs() - timer > GET_COMMANDS_INTERVAL)
+                if(uptimeMs() - timer >= interval)
                 {
                     timer = uptimeMs();
                     state = 1;
@@ -261,10 +829,18 @@ void openxc::server_task::commandCheck(TelitDevice* device) {
             break;
             
         case 1:
-            if(!isSocketOpen(GET_COMMANDS_SOCKET))
+            if(!claimSocket(GET_COMMANDS_SOCKET))
+            {
+                // another request has the modem's SSL socket
+                break;
+            }
+            // ensure we have an open TCP/IP socket (no need to ask the modem
+            // if the server kept it open after the last GET)
+            if(!(keptAlive && KEEP_ALIVE_TRUSTED) && !isSocketOpen(GET_COMMANDS_SOCKET))
             {
                 if(!openSocket(GET_COMMANDS_SOCKET, device->config.serverConnectSettings))
                 {
+                    releaseSocket(GET_COMMANDS_SOCKET);
                     state = 0;
                 }
                 else
@@ -288,17 +864,27 @@ void openxc::server_task::commandCheck(TelitDevice* device) {
                     break;
                 default:
                 case server_api::Success:
+                    interval = GET_COMMANDS_INTERVAL;
                     if((pCommand != NULL) && (cmd_len > 0))
                     {
                         // send the contents of commandBuffer to the command handler
                         commands::handleIncomingMessage(pCommand, cmd_len, &( device->descriptor ) );
+#if DEFAULT_COMMAND_LONG_POLL_S > 0
+                        // ask again right away
+                        interval = 0;
+#endif
                     }
                     resetCommandBuffer();
+                    keptAlive = serverGETcommandsKeepAlive();
+                    releaseSocket(GET_COMMANDS_SOCKET);
                     state = 0;
                     break;
                 case server_api::Failed:
                     resetCommandBuffer();
                     closeSocket(GET_COMMANDS_SOCKET);
+                    releaseSocket(GET_COMMANDS_SOCKET);
+                    keptAlive = false;
+                    interval = GET_COMMANDS_INTERVAL;
                     state = 0;
                     break;
             }
@@ -7,5 +7,11 @@ void firmwareCheck(telitHE910::TelitDevice* device);
 void flushDataBuffer(telitHE910::TelitDevice* device);
 void commandCheck(telitHE910::TelitDevice* device);
 
+/* Public: Upload the finished log files on the SD card to the server a chunk
+ * at a time, while flushDataBuffer has nothing to send. Does nothing unless
+ * the firmware was built with DEFAULT_LOG_UPLOAD and FS_SUPPORT.
+ */
+void uploadLogs(telitHE910::TelitDevice* device);
+
 }
 }
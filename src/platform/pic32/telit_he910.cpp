@@ -4,12 +4,14 @@
 #include "WProgram.h"
 #include "util/log.h"
 #include "util/timer.h"
+#include "util/task.h"
 #include "gpio.h"
 #include "config.h"
 #include "can/canread.h"
 #include "commands/commands.h"
 #include "interface/interface.h"
 #include "http.h"
+#include "interface/fs.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -19,6 +21,8 @@ namespace can = openxc::can; // using this to get publishVehicleMessage() for GP
 namespace http = openxc::http;
 namespace telit = openxc::telitHE910;
 namespace commands = openxc::commands;
+namespace task = openxc::util::task;
+namespace fs = openxc::interface::fs;
 
 using openxc::interface::uart::UartDevice;
 using openxc::gpio::GpioValue;
@@ -36,8 +40,16 @@ using openxc::payload::PayloadFormat;
 /*PRIVATE MACROS*/
 
 #define TELIT_MAX_MESSAGE_SIZE         512
+#define TELIT_MAX_SOCKET_WRITE_SIZE   1500     // largest payload AT#SSENDEXT takes
+#define TELIT_MAX_SSL_WRITE_SIZE      1023     // largest payload AT#SSLSENDEXT takes
+#define SSL_CONNECT_TIMEOUT_MS       30000     // AT#SSLD, handshake included
+#define SOCKET_PROMPT_TIMEOUT_MS      5000
+#define SOCKET_WRITE_TIMEOUT_MS      10000
 #define NETWORK_CONNECT_TIMEOUT     150000
 #define PDP_MAX_ATTEMPTS                 3
+#define AT_COMMAND_QUEUE_SIZE            4
+#define AT_COMMAND_MAX_LENGTH           96
+#define URC_MAX_LENGTH                  48
 
 /*PRIVATE VARIABLES*/
 
@@ -53,22 +65,151 @@ static char recv_data[1024];    // common buffer for receiving data from the mod
 static char* pRx = recv_data;
 static TelitDevice* telitDevice;
 static bool connect = false;
-static uint8_t sendBuffer[SEND_BUFFER_SIZE];
-static uint8_t* pSendBuffer = sendBuffer;
+// The pipeline fills sendBuffer, one of the SEND_BUFFER_COUNT buffers in the pool that hasn't been taken
+static uint8_t sendBufferPool[SEND_BUFFER_COUNT][SEND_BUFFER_FRAMING + SEND_BUFFER_SIZE + SEND_BUFFER_FRAMING];
+static bool sendBufferTaken[SEND_BUFFER_COUNT];
+static unsigned int sendBufferIndex = 0;
+static uint8_t* sendBuffer = sendBufferPool[0] + SEND_BUFFER_FRAMING;
+static uint8_t* pSendBuffer = sendBufferPool[0] + SEND_BUFFER_FRAMING;
+
+#if defined(FS_SUPPORT) && DEFAULT_CELLULAR_SPOOL_KB > 0
+#define CELLULAR_SPOOL_SUPPORT
+#endif
+
+// While there's data in the spool, only the first sendBufferVisible bytes of
+// the send buffer - read back from the spool - may be sent. The rest is newer
+// data held back until the spool is drained, and appended to the spool if the
+// buffer fills up.
+static bool spooling = false;
+static unsigned int sendBufferVisible = 0;
+static unsigned int spoolLength = 0;        // bytes in the spool file
+static unsigned int spoolOffset = 0;        // bytes of it read back
+static bool spoolChecked = false;
+static unsigned int lastSpoolDrain = 0;
 
 static TELIT_CONNECTION_STATE state = telit::POWER_OFF;
 
+// A socket write in flight - see writeSocket
+typedef enum {
+    SOCKET_WRITE_IDLE,
+    SOCKET_WRITE_WAIT_PROMPT,
+    SOCKET_WRITE_WAIT_OK
+} SOCKET_WRITE_STATE;
+
+static SOCKET_WRITE_STATE socketWriteState = SOCKET_WRITE_IDLE;
+static char* socketWriteData = NULL;
+static unsigned int socketWriteLength = 0;
+static unsigned int socketWriteEcho = 0;       // echoed bytes still to discard
+static unsigned int socketWriteSent = 0;       // sent bytes not yet reported to the caller
+static unsigned long socketWriteTimer = 0;
+
+// Private: A callback for a queued AT command, called once the command completes. The modem's response is in
+// recv_data for getResponse until the callback returns.
+typedef void (*AtCommandCallback)(TelitDevice* device, bool success);
+
+typedef struct {
+    char command[AT_COMMAND_MAX_LENGTH];
+    const char* response;           // the end of a successful response
+    const char* error;              // the end of a failed response, or NULL to wait for the timeout
+    uint32_t timeoutMs;
+    AtCommandCallback callback;
+} AtCommand;
+
+typedef enum {
+    STEP_IDLE,
+    STEP_PENDING,
+    STEP_OK,
+    STEP_FAILED
+} COMMAND_STEP;
+
+static AtCommand commandQueue[AT_COMMAND_QUEUE_SIZE];
+static unsigned int commandQueueStart = 0;
+static unsigned int commandQueueCount = 0;
+static bool commandActive = false;             // the command at the front of the queue has been sent
+static unsigned long commandTimer = 0;
+static COMMAND_STEP commandStep = STEP_IDLE;   // the connection state's command, see runCommand
+
+// Private: A handler for an unsolicited result code, called with the rest of the line after its prefix.
+typedef void (*UrcHandler)(TelitDevice* device, const char* value);
+
+typedef struct {
+    const char* prefix;
+    UrcHandler handler;
+} UnsolicitedResult;
+
+static char urcLine[URC_MAX_LENGTH + 1];
+static unsigned int urcLength = 0;
+static bool urcOverflow = false;
+static unsigned int rxPayloadBytes = 0;        // socket data still to be read, which isn't scanned for URCs
+
+// what the connection states have learned from the modem
+static unsigned int simStatus = 0;
+static telit::NetworkConnectionStatus networkStatus = telit::UNKNOWN;
+static bool registrationChanged = false;       // set by a +CREG URC
+static bool pdpConnected = false;
+
+#if DEFAULT_SERVER_TLS
+// The modem's one SSL socket, which stands in for every socket number
+#define SSL_SOCKET_ID 1
+static unsigned int sslSocketOwner = 0;        // the socket number that claimed it, 0 if none - see claimSocket
+static bool sslDataPending = false;            // set by a SSLSRING URC, until a read comes up short
+#endif
+
+#if DEFAULT_GPS_NMEA_STREAM
+// The sentences the modem is asked to stream, each kept until getGPSLocation
+// publishes it - only the latest of each type is kept
+typedef enum {
+    NMEA_RMC,
+    NMEA_GGA,
+    NMEA_GSA,
+    NMEA_SENTENCE_COUNT
+} NMEA_SENTENCE;
+
+#define NMEA_MAX_LENGTH 82
+
+static const char* nmeaTypes[NMEA_SENTENCE_COUNT] = {"RMC", "GGA", "GSA"};
+static char nmeaLine[NMEA_MAX_LENGTH + 1];     // the sentence being received
+static unsigned int nmeaLength = 0;            // 0 until a '$' starts a sentence
+static char nmeaSentences[NMEA_SENTENCE_COUNT][NMEA_MAX_LENGTH + 1];
+static bool nmeaPending[NMEA_SENTENCE_COUNT];
+#endif
+
 /*PRIVATE FUNCTIONS*/
 
-static bool autobaud(openxc::telitHE910::TelitDevice* device);
 static void telit_setIoDirection(void);
 static void setPowerState(bool enable);
 static bool sendCommand(TelitDevice* device, const char* command, const char* response, uint32_t timeoutMs);
 static bool sendCommand(TelitDevice* device, const char* command, const char* response, const char* error, uint32_t timeoutMs);
 static void sendData(TelitDevice* device, char* data, unsigned int len);
 static void clearRxBuffer(void);
+static bool pollSocketWrite(TelitDevice* device);
+static bool finishSocketWrite(TelitDevice* device);
 static bool getResponse(const char* startToken, const char* stopToken, char* response, unsigned int maxLen);
 static bool parseGPSACP(const char* GPSACP);
+static int readModemByte(TelitDevice* device);
+static bool queueCommand(const char* command, const char* response, const char* error, uint32_t timeoutMs, AtCommandCallback callback);
+static void pollCommands(TelitDevice* device);
+static void finishCommand(TelitDevice* device);
+static void resetCommands(void);
+static COMMAND_STEP runCommand(const char* command, const char* error, uint32_t timeoutMs, AtCommandCallback callback);
+static void scanUrc(TelitDevice* device, char c);
+static void onRegistrationUrc(TelitDevice* device, const char* value);
+#if DEFAULT_SERVER_TLS
+static void onSslRingUrc(TelitDevice* device, const char* value);
+#endif
+static void onStep(TelitDevice* device, bool success);
+static void onSIMStatus(TelitDevice* device, bool success);
+static void onIMEI(TelitDevice* device, bool success);
+static void onICCID(TelitDevice* device, bool success);
+static void onRegistration(TelitDevice* device, bool success);
+static void onCurrentNetwork(TelitDevice* device, bool success);
+static void onPDPContext(TelitDevice* device, bool success);
+static void formatConnectionMode(char* command, telit::OperatorSelectMode mode, telit::NetworkDescriptor network);
+static bool parseCurrentNetwork(telit::NetworkDescriptor* network);
+#if DEFAULT_GPS_NMEA_STREAM
+static void scanNmea(char c);
+static void publishNmea();
+#endif
 
 namespace openxc {
 namespace telitHE910 {
@@ -95,6 +236,9 @@ TELIT_CONNECTION_STATE openxc::telitHE910::getDeviceState() {
 
 TELIT_CONNECTION_STATE openxc::telitHE910::connectionManager(TelitDevice* device) 
 {    
+    // move the AT command in flight along, and read out anything unsolicited
+    pollCommands(device);
+    
     switch(state)
     {
         case POWER_OFF:
@@ -154,33 +298,6 @@ bool openxc::telitHE910::connected(TelitDevice* device) {
     return connect;
 }
 
-static bool autobaud(openxc::telitHE910::TelitDevice* device) {
-
-    bool rc = false;
-    unsigned int i = 0;
-
-    // loop through a set of baud rates looking for a valid response
-    for(i = 0; i < 3; ++i)
-    {
-        // set local baud rate to next attempt
-        uart::changeBaudRate(device->uart, bauds[i]);
-        
-        // attempt set the remote baud rate to desired (config.h) value
-        if(openxc::telitHE910::setBaud(UART_BAUD_RATE) == true)
-        {
-            // match local baud to desired value
-            uart::changeBaudRate(device->uart, UART_BAUD_RATE);
-            
-            // we're good!
-            rc = true;
-            break;
-        }
-    }
-    
-    return rc;
-
-}
-
 static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Power_Off(TelitDevice* device) {
 
     TELIT_CONNECTION_STATE l_state = POWER_OFF;
@@ -189,6 +306,7 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Power_Off(TelitDevice* dev
         
     setPowerState(false);
     telitDevice = device;
+    resetCommands();
     l_state = POWER_ON_DELAY;
     
     return l_state;
@@ -266,125 +384,280 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Power_Up_Delay(TelitDevice
 
 }
 
+/* Each AT command below is queued on the first call and checked on the calls after, so the connection states
+ * never wait on the modem - see runCommand. */
+
 static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Initialize(TelitDevice* device) {
 
     TELIT_CONNECTION_STATE l_state = INITIALIZE;
     static unsigned int sub_state = 0;
     static unsigned int timer = 0;
-    static unsigned int SIMstatus = 0;
-    static char ICCID[32];
-    static char IMEI[32];
+    static unsigned int baud_index = 0;
+    char command[AT_COMMAND_MAX_LENGTH] = {};
+    COMMAND_STEP step;
     
     switch(sub_state)
     {
         case 0:
         
-            // figure out the baud rate
-            if(autobaud(device))
+            // figure out the baud rate - set the local baud rate to the next attempt
+            uart::changeBaudRate(device->uart, bauds[baud_index]);
+            sub_state = 1;
+        
+            break;
+            
+        case 1:
+        
+            // attempt set the remote baud rate to desired (config.h) value
+            sprintf(command, "AT+IPR=%u\r\n", UART_BAUD_RATE);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
             {
+                // match local baud to desired value
+                uart::changeBaudRate(device->uart, UART_BAUD_RATE);
+                baud_index = 0;
                 timer = uptimeMs() + 1000;
-                sub_state = 1;
+                sub_state = 2;
             }
-            else
+            else if(step == STEP_FAILED)
             {
-                debug("Failed to set the baud rate for Telit HE910...is the device connected to 12V power?");
-                l_state = POWER_OFF;
-                break;
+                sub_state = 0;
+                if(++baud_index == sizeof(bauds) / sizeof(bauds[0]))
+                {
+                    debug("Failed to set the baud rate for Telit HE910...is the device connected to 12V power?");
+                    baud_index = 0;
+                    l_state = POWER_OFF;
+                }
             }
         
             break;
             
-        case 1:
+        case 2:
         
             if(uptimeMs() > timer)
             {
-                sub_state = 2;
+                sub_state = 3;
             }
         
             break;
             
-        case 2:
+        case 3:
             
             // save settings
-            if(saveSettings() == false)
+            if(step = runCommand("AT&W0\r\n", NULL, 1000, NULL), step == STEP_FAILED)
             {
                 debug("Failed to save modem settings, continuing with device initialization.");
             }
+            if(step != STEP_PENDING)
+            {
+                sub_state = 4;
+            }
+            
+            break;
+            
+        case 4:
             
             // check SIM status
-            if(getSIMStatus(&SIMstatus) == false)
+            if(step = runCommand("AT#QSS?\r\n", NULL, 1000, onSIMStatus), step == STEP_OK)
+            {
+                sub_state = 5;
+            }
+            else if(step == STEP_FAILED)
             {
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
             
+            break;
+            
+        case 5:
+            
             // start the GPS chip
-            if(device->config.globalPositioningSettings.gpsEnable)
+            if(!device->config.globalPositioningSettings.gpsEnable)
             {
-                if(setGPSPowerState(true) == false)
-                {
-                    sub_state = 0;
-                    l_state = POWER_OFF;
-                    break;
-                }
+                sub_state = 7;
             }
-            
-            // make sure SIM is installed, else exit
-            if(SIMstatus != 1)
+            else if(step = runCommand("AT$GPSP=1\r\n", NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 6;
+            }
+            else if(step == STEP_FAILED)
             {
-                debug("SIM not detected, aborting device initialization.");
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
             
-            // get device identifier (IMEI)
-            if(getDeviceIMEI(IMEI) == false)
+            break;
+            
+        case 6:
+            
+#if DEFAULT_GPS_NMEA_STREAM
+            // stream RMC, GGA and GSA sentences as unsolicited $GPSNMUN lines
+            if(step = runCommand("AT$GPSNMUN=1,1,0,1,0,1,0\r\n", NULL, 1000, NULL), step == STEP_FAILED)
+            {
+                debug("Failed to start the GPS NMEA stream");
+            }
+            if(step != STEP_PENDING)
+            {
+                sub_state = 7;
+            }
+#else
+            sub_state = 7;
+#endif
+            
+            break;
+            
+        case 7:
+            
+            // make sure SIM is installed, else exit
+            if(simStatus != 1)
             {
+                debug("SIM not detected, aborting device initialization.");
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
-            memcpy(device->deviceId, IMEI, strlen(IMEI) < MAX_DEVICE_ID_LENGTH ? strlen(IMEI) : MAX_DEVICE_ID_LENGTH);
+            // get device identifier (IMEI) - carry on without it if the modem doesn't answer
+            else if(runCommand("AT+CGSN\r\n", NULL, 2000, onIMEI) != STEP_PENDING)
+            {
+                sub_state = 8;
+            }
+            
+            break;
+            
+        case 8:
             
             // get SIM number (ICCID)
-            if(getICCID(ICCID) == false)
+            if(step = runCommand("AT#CCID\r\n", NULL, 1000, onICCID), step == STEP_OK)
+            {
+                sub_state = 9;
+            }
+            else if(step == STEP_FAILED)
             {
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
-            memcpy(device->ICCID, ICCID, strlen(ICCID) < MAX_ICCID_LENGTH ? strlen(ICCID) : MAX_ICCID_LENGTH);
+            
+            break;
+            
+        case 9:
             
             // set mobile operator connect mode
-            if(setNetworkConnectionMode(device->config.networkOperatorSettings.operatorSelectMode, device->config.networkOperatorSettings.networkDescriptor) == false)
+            formatConnectionMode(command, device->config.networkOperatorSettings.operatorSelectMode, device->config.networkOperatorSettings.networkDescriptor);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 10;
+            }
+            else if(step == STEP_FAILED)
             {
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
             
+            break;
+            
+        case 10:
+            
             // configure data session
-            if(configurePDPContext(device->config.networkDataSettings) == false)
+            snprintf(command, sizeof(command), "AT+CGDCONT=1,\"IP\",\"%s\"\r\n", device->config.networkDataSettings.APN);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 11;
+            }
+            else if(step == STEP_FAILED)
             {
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
             
+            break;
+            
+        case 11:
+            
             // configure a single TCP/IP socket
-            if(configureSocket(1, device->config.socketConnectSettings) == false)
+            sprintf(command, "AT#SCFG=1,1,%u,%u,%u,%u\r\n", device->config.socketConnectSettings.packetSize,
+                device->config.socketConnectSettings.idleTimeout, device->config.socketConnectSettings.connectTimeout,
+                device->config.socketConnectSettings.txFlushTimer);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 12;
+            }
+            else if(step == STEP_FAILED)
             {
                 sub_state = 0;
                 l_state = POWER_OFF;
-                break;
             }
             
-            sub_state = 0;
-            l_state = WAIT_FOR_NETWORK;
+            break;
+            
+        case 12:
+            
+            // report network registration changes as they happen (+CREG: <stat>)
+            if(step = runCommand("AT+CREG=1\r\n", NULL, 1000, NULL), step == STEP_FAILED)
+            {
+                debug("Failed to enable network registration reports, continuing with device initialization.");
+            }
+            if(step != STEP_PENDING)
+            {
+#if DEFAULT_SERVER_TLS
+                sub_state = 13;
+#else
+                sub_state = 0;
+                l_state = WAIT_FOR_NETWORK;
+#endif
+            }
             
             break;
+            
+#if DEFAULT_SERVER_TLS
+        case 13:
+            
+            // enable the SSL socket
+            if(step = runCommand("AT#SSLEN=1,1\r\n", NULL, 1000, NULL), step == STEP_FAILED)
+            {
+                // already enabled if the modem wasn't power cycled
+                debug("Failed to enable the SSL socket, continuing with device initialization.");
+            }
+            if(step != STEP_PENDING)
+            {
+                sub_state = 14;
+            }
+            
+            break;
+            
+        case 14:
+            
+            // any cipher suite the server offers, checking its certificate against the stored CA certificate if asked to
+            sprintf(command, "AT#SSLSECCFG=%u,0,%u\r\n", SSL_SOCKET_ID, DEFAULT_SERVER_TLS == 2 ? 1 : 0);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 15;
+            }
+            else if(step == STEP_FAILED)
+            {
+                sub_state = 0;
+                l_state = POWER_OFF;
+            }
+            
+            break;
+            
+        case 15:
+            
+            // configure the SSL socket like the TCP/IP one, with SSLSRING URCs for received data
+            sprintf(command, "AT#SSLCFG=%u,1,%u,%u,100,%u,1\r\n", SSL_SOCKET_ID,
+                device->config.socketConnectSettings.packetSize, device->config.socketConnectSettings.idleTimeout,
+                device->config.socketConnectSettings.txFlushTimer);
+            if(step = runCommand(command, NULL, 1000, NULL), step == STEP_OK)
+            {
+                sub_state = 0;
+                l_state = WAIT_FOR_NETWORK;
+            }
+            else if(step == STEP_FAILED)
+            {
+                sub_state = 0;
+                l_state = POWER_OFF;
+            }
+            
+            break;
+#endif // DEFAULT_SERVER_TLS
     }
     
     return l_state;
@@ -397,8 +670,7 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Wait_For_Network(TelitDevi
     static unsigned int sub_state = 0;
     static unsigned int timer = 0;
     static unsigned int timeout = 0;
-    static NetworkDescriptor current_network = {};
-    static NetworkConnectionStatus connectStatus = UNKNOWN;
+    COMMAND_STEP step;
     
     switch(sub_state)
     {
@@ -411,22 +683,19 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Wait_For_Network(TelitDevi
     
         case 1:
             
-            if(getNetworkConnectionStatus(&connectStatus))
+            if(step = runCommand("AT+CREG?\r\n", NULL, 1000, onRegistration), step == STEP_PENDING)
             {
-                if(connectStatus == REGISTERED_HOME || (device->config.networkOperatorSettings.allowDataRoaming && connectStatus == REGISTERED_ROAMING))
-                {
-                    if(getCurrentNetwork(&current_network))
-                    {
-                        debug("Telit connected to PLMN %u, access type %u", current_network.PLMN, current_network.networkType);
-                    }
-                    sub_state = 0;
-                    l_state = CLOSE_PDP;
-                }
-                else
-                {
-                    timer = uptimeMs() + 500;
-                    sub_state = 2;
-                }
+                break;
+            }
+            if(step == STEP_OK && (networkStatus == REGISTERED_HOME || (device->config.networkOperatorSettings.allowDataRoaming && networkStatus == REGISTERED_ROAMING)))
+            {
+                sub_state = 3;
+            }
+            else
+            {
+                registrationChanged = false;
+                timer = uptimeMs() + 500;
+                sub_state = 2;
             }
             
             break;
@@ -438,11 +707,22 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Wait_For_Network(TelitDevi
                 sub_state = 0;
                 l_state = POWER_OFF;
             }
-            else if(uptimeMs() > timer)
+            else if(uptimeMs() > timer || registrationChanged)
             {
                 sub_state = 1;
             }
         
+            break;
+            
+        case 3:
+        
+            // only for the log, so carry on whether it answers or not
+            if(runCommand("AT+COPS?\r\n", NULL, 1000, onCurrentNetwork) != STEP_PENDING)
+            {
+                sub_state = 0;
+                l_state = CLOSE_PDP;
+            }
+        
             break;
     }
     
@@ -453,17 +733,15 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Wait_For_Network(TelitDevi
 static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Close_PDP(TelitDevice* device) {
     
     TELIT_CONNECTION_STATE l_state = CLOSE_PDP;
-    static unsigned int sub_state = 0;
+    COMMAND_STEP step;
     
     // deactivate data session (just in case the network thinks we still have an active PDP context)
-    if(closePDPContext())
+    if(step = runCommand("AT#SGACT=1,0\r\n", NULL, 1000, NULL), step == STEP_OK)
     {
-        sub_state = 0;
         l_state = OPEN_PDP_DELAY;
     }
-    else
+    else if(step == STEP_FAILED)
     {    
-        sub_state = 0;
         l_state = POWER_OFF;
     }
     
@@ -505,14 +783,15 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Open_PDP(TelitDevice* devi
     
     TELIT_CONNECTION_STATE l_state = OPEN_PDP;
     static uint8_t pdp_counter = 0;
+    COMMAND_STEP step;
     
-    // activate data session
-    if(openPDPContext())
+    // activate data session - the network can take up to 30s to answer
+    if(step = runCommand("AT#SGACT=1,1\r\n", "ERROR", 30000, NULL), step == STEP_OK)
     {
         pdp_counter = 0;
         l_state = READY;
     }
-    else
+    else if(step == STEP_FAILED)
     {    
         if(pdp_counter < PDP_MAX_ATTEMPTS)
         {
@@ -534,37 +813,56 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Ready(TelitDevice* device)
     TELIT_CONNECTION_STATE l_state = READY;
     static unsigned int sub_state = 0;
     static unsigned int timer = 0;
-    bool pdp_connected = false;
-    NetworkConnectionStatus connectStatus = UNKNOWN;
+    COMMAND_STEP step;
 
     switch(sub_state)
     {
         case 0:
         
-            if(getNetworkConnectionStatus(&connectStatus), (connectStatus != REGISTERED_HOME && connectStatus != REGISTERED_ROAMING))
+            if(step = runCommand("AT+CREG?\r\n", NULL, 1000, onRegistration), step == STEP_PENDING)
+            {
+                break;
+            }
+            if(step == STEP_FAILED || (networkStatus != REGISTERED_HOME && networkStatus != REGISTERED_ROAMING))
             {
                 debug("Modem has lost network connection");
                 connect = false;
                 l_state = WAIT_FOR_NETWORK;
             }
-            else if(getPDPContext(&pdp_connected), !pdp_connected)
+            else
+            {
+                sub_state = 1;
+            }
+        
+            break;
+            
+        case 1:
+        
+            if(step = runCommand("AT#SGACT?\r\n", NULL, 1000, onPDPContext), step == STEP_PENDING)
+            {
+                break;
+            }
+            if(step == STEP_FAILED || !pdpConnected)
             {
                 debug("Modem has lost data session");
                 connect = false;
+                sub_state = 0;
                 l_state = CLOSE_PDP;
             }
             else
             {
                 connect = true;
+                registrationChanged = false;
                 timer = uptimeMs() + 1000;
-                sub_state = 1;
+                sub_state = 2;
             }
         
             break;
             
-        case 1:
+        case 2:
         
-            if(uptimeMs() > timer)
+            // check again every second, or right away if the modem reports a change in registration
+            if(uptimeMs() > timer || registrationChanged)
                 sub_state = 0;
         
             break;
@@ -573,6 +871,117 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Ready(TelitDevice* device)
     return l_state;
 }
 
+/*CONNECTION STATE RESPONSES*/
+
+/* Private: The callback for a connection state's command, see runCommand. The callbacks below parse the
+ * response first, and call this with whether that worked. */
+static void onStep(TelitDevice* device, bool success) {
+    commandStep = success ? STEP_OK : STEP_FAILED;
+}
+
+static void onSIMStatus(TelitDevice* device, bool success) {
+
+    char temp[8] = {};
+    
+    if(success && getResponse("#QSS: ", "\r\n\r\n", temp, 7)) {
+        simStatus = atoi(&temp[2]);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+static void onIMEI(TelitDevice* device, bool success) {
+
+    char IMEI[32] = {};
+    
+    if(success && getResponse("AT+CGSN\r\n\r\n", "\r\n\r\nOK\r\n", IMEI, 31)) {
+        memcpy(device->deviceId, IMEI, strlen(IMEI) < MAX_DEVICE_ID_LENGTH ? strlen(IMEI) : MAX_DEVICE_ID_LENGTH);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+static void onICCID(TelitDevice* device, bool success) {
+
+    char ICCID[32] = {};
+    
+    if(success && getResponse("#CCID: ", "\r\n\r\n", ICCID, 31)) {
+        memcpy(device->ICCID, ICCID, strlen(ICCID) < MAX_ICCID_LENGTH ? strlen(ICCID) : MAX_ICCID_LENGTH);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+static void onRegistration(TelitDevice* device, bool success) {
+
+    char temp[8] = {};
+    
+    // response: +CREG: <n>,<stat>
+    networkStatus = telit::UNKNOWN;
+    if(success && getResponse("+CREG: ", "\r\n\r\nOK\r\n", temp, 7)) {
+        networkStatus = (telit::NetworkConnectionStatus)atoi(&temp[2]);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+static void onCurrentNetwork(TelitDevice* device, bool success) {
+
+    telit::NetworkDescriptor network = {};
+    
+    if(success && parseCurrentNetwork(&network)) {
+        debug("Telit connected to PLMN %u, access type %u", network.PLMN, network.networkType);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+static void onPDPContext(TelitDevice* device, bool success) {
+
+    char temp[32] = {};
+    
+    pdpConnected = false;
+    if(success && getResponse("#SGACT: 1,", "\r\n\r\nOK\r\n", temp, 31)) {
+        pdpConnected = (bool)atoi(temp);
+    } else {
+        success = false;
+    }
+    onStep(device, success);
+
+}
+
+/* Private: The unsolicited +CREG: <stat> the modem sends when its network registration changes, once it's been
+ * enabled with AT+CREG=1. The response to AT+CREG? starts the same way, but has the mode first. */
+static void onRegistrationUrc(TelitDevice* device, const char* value) {
+
+    if(strchr(value, ',') == NULL) {
+        networkStatus = (telit::NetworkConnectionStatus)atoi(value);
+        registrationChanged = true;
+    }
+
+}
+
+#if DEFAULT_SERVER_TLS
+// SSLSRING: <SSId>,<dataLen> - data received on the SSL socket
+static void onSslRingUrc(TelitDevice* device, const char* value) {
+
+    if((unsigned int)atoi(value) == SSL_SOCKET_ID) {
+        sslDataPending = true;
+    }
+
+}
+#endif
+
 /*MODEM AT COMMANDS*/
 
 bool openxc::telitHE910::saveSettings() {
@@ -684,43 +1093,7 @@ bool openxc::telitHE910::setNetworkConnectionMode(OperatorSelectMode mode, Netwo
     bool rc = true;
     char command[64] = {};
 
-    switch(mode) {
-        case AUTOMATIC:
-        
-            sprintf(command, "AT+COPS=0,2\r\n");
-
-            break;
-            
-        case MANUAL:
-        
-            sprintf(command, "AT+COPS=1,2,%u,%u\r\n", network.PLMN, network.networkType);
-        
-            break;
-            
-        case DEREGISTER:
-        
-            sprintf(command, "AT+COPS=2,2");
-            
-            break;
-            
-        case SET_ONLY:
-        
-            sprintf(command, "AT+COPS=3,2");
-            
-            break;
-            
-        case MANUAL_AUTOMATIC:
-        
-            sprintf(command, "AT+COPS=4,2,%u,%u\r\n", network.PLMN, network.networkType);
-            
-            break;
-            
-        default:
-        
-            debug("Modem received invalid operator select mode");
-            
-            break;
-    }
+    formatConnectionMode(command, mode, network);
     
     if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", 1000) == false) {
         rc = false;
@@ -755,19 +1128,32 @@ bool openxc::telitHE910::getNetworkConnectionStatus(NetworkConnectionStatus* sta
 bool openxc::telitHE910::getCurrentNetwork(NetworkDescriptor* network) {
 
     bool rc = true;
-    char temp[32] = {};
-    char* p = NULL;
-    
-    // response: +COPS: <mode>,<format>,<oper>,<AcT>
     
     if(sendCommand(telitDevice, "AT+COPS?\r\n", "\r\n\r\nOK\r\n", 1000) == false) {
         rc = false;
         goto fcn_exit;
     }
-    if(getResponse("+COPS: ", "\r\n\r\nOK\r\n", temp, 31) == false) {
+    if(parseCurrentNetwork(network) == false) {
         rc = false;
         goto fcn_exit;
     }
+    
+    fcn_exit:
+    return rc;
+
+}
+
+/* Private: Parse the operator out of the response to AT+COPS? in recv_data. */
+static bool parseCurrentNetwork(telit::NetworkDescriptor* network) {
+
+    char temp[32] = {};
+    char* p = NULL;
+    
+    // response: +COPS: <mode>,<format>,<oper>,<AcT>
+    
+    if(getResponse("+COPS: ", "\r\n\r\nOK\r\n", temp, 31) == false) {
+        return false;
+    }
     if(p = strchr(temp, ','), p) {
         p++;
         if(p = strchr(p, ','), p) {
@@ -779,9 +1165,50 @@ bool openxc::telitHE910::getCurrentNetwork(NetworkDescriptor* network) {
             }
         }
     }
-    
-    fcn_exit:
-    return rc;
+    return true;
+
+}
+
+/* Private: Write the AT+COPS command that sets the operator select mode to command. */
+static void formatConnectionMode(char* command, telit::OperatorSelectMode mode, telit::NetworkDescriptor network) {
+
+    switch(mode) {
+        case telit::AUTOMATIC:
+        
+            sprintf(command, "AT+COPS=0,2\r\n");
+
+            break;
+            
+        case telit::MANUAL:
+        
+            sprintf(command, "AT+COPS=1,2,%u,%u\r\n", network.PLMN, network.networkType);
+        
+            break;
+            
+        case telit::DEREGISTER:
+        
+            sprintf(command, "AT+COPS=2,2");
+            
+            break;
+            
+        case telit::SET_ONLY:
+        
+            sprintf(command, "AT+COPS=3,2");
+            
+            break;
+            
+        case telit::MANUAL_AUTOMATIC:
+        
+            sprintf(command, "AT+COPS=4,2,%u,%u\r\n", network.PLMN, network.networkType);
+            
+            break;
+            
+        default:
+        
+            debug("Modem received invalid operator select mode");
+            
+            break;
+    }
 
 }
 
@@ -876,11 +1303,21 @@ bool openxc::telitHE910::openSocket(unsigned int socketNumber, ServerConnectSett
     bool rc = true;
     char command[128] = {};
 
+#if DEFAULT_SERVER_TLS
+    // connected in command mode, so the OK only comes once the TLS handshake is done
+    sprintf(command,"AT#SSLD=%u,%u,\"%s\",0,1\r\n", SSL_SOCKET_ID, serverSettings.port, serverSettings.host);
+    sslDataPending = false;
+    if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", "ERROR", SSL_CONNECT_TIMEOUT_MS) == false) {
+        rc = false;
+        goto fcn_exit;
+    }
+#else
     sprintf(command,"AT#SD=%u,0,%u,\"%s\",255,1,1\r\n", socketNumber, serverSettings.port, serverSettings.host);
     if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", "ERROR", 15000) == false) {
         rc = false;
         goto fcn_exit;
     }
+#endif
     
     fcn_exit:
     return rc;
@@ -904,7 +1341,12 @@ bool openxc::telitHE910::closeSocket(unsigned int socketNumber) {
     bool rc = true;
     char command[16] = {};
 
+#if DEFAULT_SERVER_TLS
+    sprintf(command,"AT#SSLH=%u\r\n", SSL_SOCKET_ID);
+    sslDataPending = false;
+#else
     sprintf(command,"AT#SH=%u\r\n", socketNumber);
+#endif
     if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", "ERROR", 5000) == false) {
         rc = false;
         goto fcn_exit;
@@ -915,12 +1357,55 @@ bool openxc::telitHE910::closeSocket(unsigned int socketNumber) {
     
 }
 
+bool openxc::telitHE910::claimSocket(unsigned int socketNumber) {
+
+#if DEFAULT_SERVER_TLS
+    // a connection left open by the last request is kept, as every request
+    // goes to the same server
+    if(sslSocketOwner != 0 && sslSocketOwner != socketNumber) {
+        return false;
+    }
+    sslSocketOwner = socketNumber;
+#endif
+    return true;
+
+}
+
+void openxc::telitHE910::releaseSocket(unsigned int socketNumber) {
+
+#if DEFAULT_SERVER_TLS
+    if(sslSocketOwner == socketNumber) {
+        sslSocketOwner = 0;
+    }
+#endif
+
+}
+
 bool openxc::telitHE910::getSocketStatus(unsigned int socketNumber, SocketStatus* status) {
 
     bool rc = true;
     char command[16] = {};
     char temp[8] = {};
     
+#if DEFAULT_SERVER_TLS
+    // #SSLS: <SSId>,<state>[,<cipher>] - connected is 2, and there's no
+    // suspended state, as data only ever goes through commands
+    sprintf(command, "AT#SSLS=%u\r\n", SSL_SOCKET_ID);
+    if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", 1000) == false) {
+        rc = false;
+        goto fcn_exit;
+    }
+    if(getResponse("#SSLS: ", "\r\n\r\nOK\r\n", temp, 7) == false) {
+        rc = false;
+        goto fcn_exit;
+    }
+    if(atoi(&temp[2]) == 2) {
+        *status = sslDataPending ? SOCKET_SUSPENDED_DATA_PENDING : SOCKET_SUSPENDED;
+    } else {
+        *status = SOCKET_CLOSED;
+        sslDataPending = false;
+    }
+#else
     sprintf(command, "AT#SS=%u\r\n", socketNumber);
     if(sendCommand(telitDevice, command, "\r\n\r\nOK\r\n", 1000) == false) {
         rc = false;
@@ -931,6 +1416,7 @@ bool openxc::telitHE910::getSocketStatus(unsigned int socketNumber, SocketStatus
         goto fcn_exit;
     }
     *status = (SocketStatus)atoi(&temp[2]);
+#endif
     
     fcn_exit:
     return rc;
@@ -953,63 +1439,136 @@ bool openxc::telitHE910::writeSocket(unsigned int socketNumber, char* data, unsi
 
     bool rc = true;
     char command[32];
-    unsigned long timer = 0;
-    unsigned int i = 0;
-    int rx_byte = 0;
-    unsigned int maxWrite = 0;
-    
-    // calculate max bytes to write
-    maxWrite = (*len > TELIT_MAX_MESSAGE_SIZE) ? TELIT_MAX_MESSAGE_SIZE : *len;
+    unsigned int tx_cnt = 0;
+    unsigned int tx_size = 0;
     
-    // issue the socket write command
-    sprintf(command, "AT#SSENDEXT=%u,%u\r\n", socketNumber, maxWrite);
-    if(sendCommand(telitDevice, command, "> ", 5000) == false) {
+    // collect the result of the last chunk, if it's done
+    if(pollSocketWrite(telitDevice) == false) {
         rc = false;
         goto fcn_exit;
     }
     
-    // clear the receive buffer
-    clearRxBuffer();
-    
-    // send data through the socket
-    sendData(telitDevice, data, maxWrite);
-    
-    // start the receive timer
-    timer = uptimeMs() + 10000;
-    
-    // read out the socket data echo (don't need to store it)
-    while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
-            ++i;
-        }
-        if(i == maxWrite) {
-            break;
+    // start the next chunk once the modem has accepted the last one, and isn't
+    // busy with a queued command
+    if(socketWriteState == SOCKET_WRITE_IDLE && !commandActive && socketWriteSent == 0 && *len > 0) {
+#if DEFAULT_SERVER_TLS
+        socketWriteLength = (*len > TELIT_MAX_SSL_WRITE_SIZE) ? TELIT_MAX_SSL_WRITE_SIZE : *len;
+#else
+        socketWriteLength = (*len > TELIT_MAX_SOCKET_WRITE_SIZE) ? TELIT_MAX_SOCKET_WRITE_SIZE : *len;
+#endif
+        socketWriteData = data;
+        
+        // issue the socket write command, the data follows the prompt
+        clearRxBuffer();
+#if DEFAULT_SERVER_TLS
+        sprintf(command, "AT#SSLSENDEXT=%u,%u\r\n", SSL_SOCKET_ID, socketWriteLength);
+#else
+        sprintf(command, "AT#SSENDEXT=%u,%u\r\n", socketNumber, socketWriteLength);
+#endif
+        tx_size = strlen(command);
+        for(tx_cnt = 0; tx_cnt < tx_size; ++tx_cnt) {
+            uart::writeByte(telitDevice->uart, command[tx_cnt]);
         }
-        if(uptimeMs() >= timer) {
+        socketWriteTimer = uptimeMs();
+        socketWriteState = SOCKET_WRITE_WAIT_PROMPT;
+        
+        if(pollSocketWrite(telitDevice) == false) {
             rc = false;
             goto fcn_exit;
         }
     }
+    
+    // report the chunk as written once it's been handed to the modem
+    *len = socketWriteSent;
+    socketWriteSent = 0;
+    
+    fcn_exit:
+    if(rc == false) {
+        *len = 0;
+        socketWriteSent = 0;
+    }
+    return rc;
 
-    // get the OK
-    while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
-            *pRx++ = rx_byte;
-        }
-        if(strstr(recv_data, "OK")) {
-            rc = true;
+}
+
+/* Private: Move the socket write in flight along as far as the bytes the modem
+ * has sent back allow, without waiting for more: send the data once the
+ * prompt arrives, then discard its echo and look for the OK.
+ *
+ * Returns false if the write failed or timed out, after which no write is in
+ * flight.
+ */
+static bool pollSocketWrite(TelitDevice* device) {
+
+    int rx_byte = 0;
+    
+    switch(socketWriteState) {
+    
+        case SOCKET_WRITE_WAIT_PROMPT:
+            while(rx_byte = readModemByte(device), rx_byte > -1) {
+                if(pRx < recv_data + sizeof(recv_data) - 1) {
+                    *pRx++ = rx_byte;
+                }
+            }
+            if(strstr(recv_data, "> ")) {
+                clearRxBuffer();
+                sendData(device, socketWriteData, socketWriteLength);
+                socketWriteEcho = socketWriteLength;
+                rxPayloadBytes = socketWriteLength;
+                socketWriteSent = socketWriteLength;
+                socketWriteTimer = uptimeMs();
+                socketWriteState = SOCKET_WRITE_WAIT_OK;
+            }
+            else if(strstr(recv_data, "ERROR") || uptimeMs() - socketWriteTimer >= SOCKET_PROMPT_TIMEOUT_MS) {
+                debug("Socket write prompt not received");
+                socketWriteState = SOCKET_WRITE_IDLE;
+                return false;
+            }
+            break;
+            
+        case SOCKET_WRITE_WAIT_OK:
+            // read out the socket data echo (don't need to store it)
+            while(rx_byte = readModemByte(device), rx_byte > -1) {
+                if(socketWriteEcho > 0) {
+                    --socketWriteEcho;
+                }
+                else if(pRx < recv_data + sizeof(recv_data) - 1) {
+                    *pRx++ = rx_byte;
+                }
+            }
+            if(socketWriteEcho == 0 && strstr(recv_data, "OK")) {
+                socketWriteState = SOCKET_WRITE_IDLE;
+            }
+            else if(strstr(recv_data, "ERROR") || uptimeMs() - socketWriteTimer >= SOCKET_WRITE_TIMEOUT_MS) {
+                debug("Socket write not acknowledged");
+                socketWriteState = SOCKET_WRITE_IDLE;
+                return false;
+            }
+            break;
+            
+        default:
             break;
-        }
-        if(uptimeMs() >= timer) {
+            
+    }
+    
+    return true;
+
+}
+
+/* Private: Wait for the socket write in flight, if any, so another command can
+ * use the modem.
+ */
+static bool finishSocketWrite(TelitDevice* device) {
+
+    bool rc = true;
+    
+    while(socketWriteState != SOCKET_WRITE_IDLE) {
+        task::yield();
+        if(pollSocketWrite(device) == false) {
             rc = false;
-            goto fcn_exit;
         }
     }
-
-    // update write count
-    *len = maxWrite;
     
-    fcn_exit:
     return rc;
 
 }
@@ -1030,8 +1589,13 @@ bool openxc::telitHE910::readSocket(unsigned int socketNumber, char* data, unsig
     maxRead = (*len > TELIT_MAX_MESSAGE_SIZE) ? TELIT_MAX_MESSAGE_SIZE : *len;
     
     // issue the socket read command
+#if DEFAULT_SERVER_TLS
+    sprintf(command, "AT#SSLRECV=%u,%u\r\n", SSL_SOCKET_ID, maxRead);
+    sprintf(reply, "#SSLRECV: ");
+#else
     sprintf(command, "AT#SRECV=%u,%u\r\n", socketNumber, maxRead);
     sprintf(reply, "#SRECV: %u,", socketNumber);
+#endif
     if(sendCommand(telitDevice, command, reply, 1000) == false) {
         rc = false;
         goto fcn_exit;
@@ -1046,12 +1610,13 @@ bool openxc::telitHE910::readSocket(unsigned int socketNumber, char* data, unsig
         rc = false;
         goto fcn_exit;
     }
-    pS += 10;
+    pS += strlen(reply);
     pRx = pS;
     
     // read to end of line
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(pS, "\r\n")) {
@@ -1064,12 +1629,14 @@ bool openxc::telitHE910::readSocket(unsigned int socketNumber, char* data, unsig
     }    
     // get the read count
     readCount = atoi(pS);
+    rxPayloadBytes = readCount;
     pS = pRx;
     
     // read the socket data
     i = 0;
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
             ++i;
         }
@@ -1085,10 +1652,17 @@ bool openxc::telitHE910::readSocket(unsigned int socketNumber, char* data, unsig
     memcpy(data, pS, readCount);
     *len = readCount;
     pS = pRx;
+#if DEFAULT_SERVER_TLS
+    // a short read emptied the modem's buffer, until the next SSLSRING
+    if(readCount < maxRead) {
+        sslDataPending = false;
+    }
+#endif
     
     // finish with OK
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(pS, "\r\n\r\nOK\r\n")) {
@@ -1121,8 +1695,13 @@ bool openxc::telitHE910::readSocketOne(unsigned int socketNumber, char* data, un
     maxRead = (*len > 1) ? 1 : *len;
     
     // issue the socket read command
+#if DEFAULT_SERVER_TLS
+    sprintf(command, "AT#SSLRECV=%u,%u\r\n", SSL_SOCKET_ID, maxRead);
+    sprintf(reply, "#SSLRECV: ");
+#else
     sprintf(command, "AT#SRECV=%u,%u\r\n", socketNumber, maxRead);
     sprintf(reply, "#SRECV: %u,", socketNumber);
+#endif
     if(sendCommand(telitDevice, command, reply, 1000) == false) {
         rc = false;
         goto fcn_exit;
@@ -1137,12 +1716,13 @@ bool openxc::telitHE910::readSocketOne(unsigned int socketNumber, char* data, un
         rc = false;
         goto fcn_exit;
     }
-    pS += 10;
+    pS += strlen(reply);
     pRx = pS;
     
     // read to end of line
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(pS, "\r\n")) {
@@ -1155,12 +1735,14 @@ bool openxc::telitHE910::readSocketOne(unsigned int socketNumber, char* data, un
     }    
     // get the read count
     readCount = atoi(pS);
+    rxPayloadBytes = readCount;
     pS = pRx;
     
     // read the socket data
     i = 0;
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
             ++i;
         }
@@ -1176,10 +1758,17 @@ bool openxc::telitHE910::readSocketOne(unsigned int socketNumber, char* data, un
     memcpy(data, pS, readCount);
     *len = readCount;
     pS = pRx;
+#if DEFAULT_SERVER_TLS
+    // a short read emptied the modem's buffer, until the next SSLSRING
+    if(readCount < maxRead) {
+        sslDataPending = false;
+    }
+#endif
     
     // finish with OK
     while(1) {
-        if(rx_byte = uart::readByte(telitDevice->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(telitDevice), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(pS, "\r\n\r\nOK\r\n")) {
@@ -1196,6 +1785,204 @@ bool openxc::telitHE910::readSocketOne(unsigned int socketNumber, char* data, un
 
 }
 
+/*ASYNC AT COMMANDS*/
+
+// the unsolicited result codes picked out of everything the modem sends
+static const UnsolicitedResult URC_HANDLERS[] = {
+    {"+CREG: ", onRegistrationUrc},
+#if DEFAULT_SERVER_TLS
+    {"SSLSRING: ", onSslRingUrc},
+#endif
+};
+
+/*
+ * Private:
+ *
+ * Queues an AT command to be sent once the modem is free, without waiting for it. pollCommands sends it and
+ * watches for the response, and calls the callback once it's complete.
+ *
+ * Returns false if the queue is full or the command is too long.
+ */
+static bool queueCommand(const char* command, const char* response, const char* error, uint32_t timeoutMs, AtCommandCallback callback) {
+
+    AtCommand* entry = NULL;
+    
+    if(commandQueueCount >= AT_COMMAND_QUEUE_SIZE || strlen(command) >= AT_COMMAND_MAX_LENGTH) {
+        debug("Unable to queue AT command %s", command);
+        return false;
+    }
+    
+    entry = &commandQueue[(commandQueueStart + commandQueueCount) % AT_COMMAND_QUEUE_SIZE];
+    strcpy(entry->command, command);
+    entry->response = response;
+    entry->error = error;
+    entry->timeoutMs = timeoutMs;
+    entry->callback = callback;
+    ++commandQueueCount;
+    
+    return true;
+
+}
+
+/*
+ * Private:
+ *
+ * Moves the queued AT commands along as far as the bytes the modem has sent back allow, without waiting for
+ * more: sends the next command once the modem is free, and completes it on its response, its error or its
+ * timeout. With nothing queued, reads out whatever the modem sends unsolicited. Call repeatedly.
+ */
+static void pollCommands(TelitDevice* device) {
+
+    AtCommand* entry = NULL;
+    AtCommandCallback callback = NULL;
+    bool success = false;
+    int rx_byte = 0;
+    
+    // the modem takes one command at a time
+    if(socketWriteState != SOCKET_WRITE_IDLE) {
+        return;
+    }
+    
+    if(!commandActive) {
+        if(commandQueueCount == 0) {
+            // readModemByte picks out any URCs
+            while(readModemByte(device) > -1);
+            return;
+        }
+        entry = &commandQueue[commandQueueStart];
+        clearRxBuffer();
+        sendData(device, entry->command, strlen(entry->command));
+        commandTimer = uptimeMs();
+        commandActive = true;
+    }
+    
+    entry = &commandQueue[commandQueueStart];
+    while(rx_byte = readModemByte(device), rx_byte > -1) {
+        if(pRx < recv_data + sizeof(recv_data) - 1) {
+            *pRx++ = rx_byte;
+            *pRx = '\0';
+        }
+    }
+    
+    if(strstr(recv_data, entry->response)) {
+        success = true;
+    }
+    else if((entry->error != NULL && strstr(recv_data, entry->error)) || uptimeMs() - commandTimer >= entry->timeoutMs) {
+        success = false;
+    }
+    else {
+        return;
+    }
+    
+    // free the slot first, so the callback can queue the next command
+    callback = entry->callback;
+    commandQueueStart = (commandQueueStart + 1) % AT_COMMAND_QUEUE_SIZE;
+    --commandQueueCount;
+    commandActive = false;
+    if(callback != NULL) {
+        callback(device, success);
+    }
+
+}
+
+/* Private: Wait for the queued AT command in flight, if any, so another command can use the modem. */
+static void finishCommand(TelitDevice* device) {
+
+    while(commandActive) {
+        task::yield();
+        pollCommands(device);
+    }
+
+}
+
+/* Private: Drop all queued AT commands, e.g. when the modem is powered off. */
+static void resetCommands() {
+
+    commandQueueCount = 0;
+    commandActive = false;
+    commandStep = STEP_IDLE;
+
+}
+
+/*
+ * Private:
+ *
+ * Runs one AT command for a connection state, which is called over and over until it's done: the first call
+ * queues the command, the calls after return STEP_PENDING until it completes, and the one after that returns
+ * STEP_OK or STEP_FAILED and makes the next call start a new command. A state must call this until it's done
+ * before moving on to another command or state.
+ *
+ * command - The command, only read by the first call.
+ * error - The end of a failed response, or NULL to wait for "OK" until the timeout.
+ * callback - A callback to parse the response, which must finish by calling onStep. NULL if there's nothing
+ *      to parse.
+ */
+static COMMAND_STEP runCommand(const char* command, const char* error, uint32_t timeoutMs, AtCommandCallback callback) {
+
+    COMMAND_STEP step = commandStep;
+    
+    switch(commandStep) {
+    
+        case STEP_IDLE:
+        
+            if(queueCommand(command, "\r\n\r\nOK\r\n", error, timeoutMs, callback != NULL ? callback : onStep) == false) {
+                return STEP_FAILED;
+            }
+            commandStep = STEP_PENDING;
+            step = STEP_PENDING;
+            
+            break;
+            
+        case STEP_PENDING:
+        
+            break;
+            
+        default:
+        
+            commandStep = STEP_IDLE;
+            
+            break;
+    
+    }
+    
+    return step;
+
+}
+
+/*
+ * Private:
+ *
+ * Feeds one byte from the modem to the line being received, and calls the handler for any unsolicited result
+ * code it turns out to be. Lines too long to be a URC are dropped.
+ */
+static void scanUrc(TelitDevice* device, char c) {
+
+    unsigned int i = 0;
+    unsigned int prefixLength = 0;
+    
+    if(c == '\r' || c == '\n') {
+        if(urcLength > 0 && !urcOverflow) {
+            urcLine[urcLength] = '\0';
+            for(i = 0; i < sizeof(URC_HANDLERS) / sizeof(URC_HANDLERS[0]); ++i) {
+                prefixLength = strlen(URC_HANDLERS[i].prefix);
+                if(!strncmp(urcLine, URC_HANDLERS[i].prefix, prefixLength)) {
+                    URC_HANDLERS[i].handler(device, &urcLine[prefixLength]);
+                    break;
+                }
+            }
+        }
+        urcLength = 0;
+        urcOverflow = false;
+    }
+    else if(urcLength < URC_MAX_LENGTH) {
+        urcLine[urcLength++] = c;
+    }
+    else {
+        urcOverflow = true;
+    }
+
+}
+
 /*SEND/RECEIVE*/
 
 static bool sendCommand(TelitDevice* device, const char* command, const char* response, uint32_t timeoutMs) {
@@ -1209,6 +1996,10 @@ static bool sendCommand(TelitDevice* device, const char* command, const char* re
     
     unsigned long timer = 0;
     
+    // the modem takes one command at a time
+    finishSocketWrite(device);
+    finishCommand(device);
+    
     // clear the receive buffer
     clearRxBuffer();
     
@@ -1223,7 +2014,8 @@ static bool sendCommand(TelitDevice* device, const char* command, const char* re
     
     // receive the response
     while(uptimeMs() - timer < timeoutMs) {
-        if(rx_byte = uart::readByte(device->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(device), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(recv_data, response)) {
@@ -1247,6 +2039,10 @@ static bool sendCommand(TelitDevice* device, const char* command, const char* re
     
     unsigned long timer = 0;
     
+    // the modem takes one command at a time
+    finishSocketWrite(device);
+    finishCommand(device);
+    
     // clear the receive buffer
     clearRxBuffer();
     
@@ -1261,7 +2057,8 @@ static bool sendCommand(TelitDevice* device, const char* command, const char* re
     
     // receive the response
     while(uptimeMs() - timer < timeoutMs) {
-        if(rx_byte = uart::readByte(device->uart), rx_byte > -1) {
+        task::yield();
+        if(rx_byte = readModemByte(device), rx_byte > -1) {
             *pRx++ = rx_byte;
         }
         if(strstr(recv_data, response)) {
@@ -1280,8 +2077,10 @@ static bool sendCommand(TelitDevice* device, const char* command, const char* re
 
 static void clearRxBuffer() {
 
-    // purge the HardwareSerial buffer
-    ((HardwareSerial*)telitDevice->uart->controller)->purge();
+    // read out the HardwareSerial buffer instead of purging it, so no URC or
+    // streamed GPS sentence is lost
+    rxPayloadBytes = 0;
+    while(readModemByte(telitDevice) > -1);
 
     // clear the modem buffer
     memset(recv_data, 0x00, 256);
@@ -1291,6 +2090,29 @@ static void clearRxBuffer() {
 
 }
 
+/* Private: Read a byte from the modem, if one is waiting, and look for
+ * unsolicited result codes and streamed GPS sentences in it. Every byte from
+ * the modem is read through here, so one that arrives in the middle of a
+ * command response isn't missed. Socket data isn't scanned.
+ *
+ * Returns the byte, or -1 if there was none.
+ */
+static int readModemByte(TelitDevice* device) {
+    int rx_byte = uart::readByte(device->uart);
+    if(rx_byte > -1) {
+        if(rxPayloadBytes > 0) {
+            --rxPayloadBytes;
+        }
+        else {
+            scanUrc(device, (char)rx_byte);
+#if DEFAULT_GPS_NMEA_STREAM
+            scanNmea((char)rx_byte);
+#endif
+        }
+    }
+    return rx_byte;
+}
+
 static bool getResponse(const char* startToken, const char* stopToken, char* response, unsigned int maxLen) {
     
     bool rc = true;
@@ -1403,6 +2225,16 @@ bool openxc::telitHE910::getGPSPowerState(bool* enable) {
 
 bool openxc::telitHE910::getGPSLocation() {
 
+#if DEFAULT_GPS_NMEA_STREAM
+    // read what the modem has streamed since the last call, without waiting
+    // for more - unless a socket write in flight is waiting for its reply, in
+    // which case it reads the bytes (and scans them) itself
+    if(socketWriteState == SOCKET_WRITE_IDLE) {
+        while(readModemByte(telitDevice) > -1);
+    }
+    publishNmea();
+    return true;
+#else
     bool rc = true;
     char temp[128] = {};
     static unsigned long next_update = 0;
@@ -1428,6 +2260,7 @@ bool openxc::telitHE910::getGPSLocation() {
     
     fcn_exit:
     return rc;
+#endif
 
 }
 
@@ -1565,6 +2398,300 @@ static bool parseGPSACP(const char* GPSACP) {
     return rc;
 }
 
+#if DEFAULT_GPS_NMEA_STREAM
+
+/*
+ * Private:
+ *
+ * Checks a complete NMEA sentence ("$GPRMC,...*hh") against its checksum, and keeps it if it's one of the
+ * types the modem was asked to stream. Talkers other than GPS (e.g. $GN for multiple systems) are kept too.
+ */
+static void finishNmea() {
+    char* checksum = strchr(nmeaLine, '*');
+    if(checksum == NULL || nmeaLength < 7 || nmeaLine[1] != 'G') {
+        return;
+    }
+    
+    unsigned char sum = 0;
+    for(char* c = &nmeaLine[1]; c < checksum; ++c) {
+        sum ^= *c;
+    }
+    if(sum != (unsigned char)strtoul(checksum + 1, NULL, 16)) {
+        return;
+    }
+    *checksum = '\0';
+    
+    for(unsigned int i = 0; i < NMEA_SENTENCE_COUNT; ++i) {
+        if(!strncmp(&nmeaLine[3], nmeaTypes[i], 3) && nmeaLine[6] == ',') {
+            strcpy(nmeaSentences[i], nmeaLine);
+            nmeaPending[i] = true;
+            break;
+        }
+    }
+}
+
+/*
+ * Private:
+ *
+ * Feeds one byte from the modem to the sentence being received. A '$' always starts a new sentence, so the
+ * "$GPSNMUN: " prefix of an unsolicited line and anything cut off in the middle are dropped.
+ */
+static void scanNmea(char c) {
+    if(c == '$') {
+        nmeaLine[0] = c;
+        nmeaLength = 1;
+    }
+    else if(nmeaLength == 0) {
+        return;
+    }
+    else if(c == '\r' || c == '\n') {
+        nmeaLine[nmeaLength] = '\0';
+        finishNmea();
+        nmeaLength = 0;
+    }
+    else if(nmeaLength < NMEA_MAX_LENGTH) {
+        nmeaLine[nmeaLength++] = c;
+    }
+    else {
+        nmeaLength = 0;
+    }
+}
+
+/*
+ * Private:
+ *
+ * Copies a comma separated field of a sentence (0 is the sentence type) into field.
+ * Returns true if the field isn't empty.
+ */
+static bool nmeaField(const char* sentence, unsigned int index, char* field, unsigned int size) {
+    const char* p1 = sentence;
+    for(unsigned int i = 0; i < index; ++i) {
+        if(p1 = strchr(p1, ','), !p1) {
+            field[0] = '\0';
+            return false;
+        }
+        ++p1;
+    }
+    
+    unsigned int length = strcspn(p1, ",");
+    if(length > size - 1) {
+        length = size - 1;
+    }
+    memcpy(field, p1, length);
+    field[length] = '\0';
+    return length > 0;
+}
+
+/*
+ * Private:
+ *
+ * Converts an NMEA latitude or longitude (ddmm.mmmm or dddmm.mmmm) and its hemisphere to signed degrees.
+ */
+static float nmeaDegrees(const char* value, unsigned int degreeDigits, const char* hemisphere) {
+    char degrees[4] = {};
+    memcpy(degrees, value, degreeDigits);
+    float result = (float)atoi(degrees) + atof(value + degreeDigits) / 60.0;
+    if(hemisphere[0] == 'S' || hemisphere[0] == 'W') {
+        result = -result;
+    }
+    return result;
+}
+
+/*
+ * Private:
+ *
+ * Publishes the GPS signals in the sentences received since the last call, the same signals getGPSLocation
+ * publishes from $GPSACP.
+ */
+static void publishNmea() {
+    openxc::pipeline::Pipeline* pipeline = &getConfiguration()->pipeline;
+    openxc::telitHE910::GlobalPositioningSettings* gpsConfig =
+            &getConfiguration()->telit->config.globalPositioningSettings;
+    char field[16];
+    char hemisphere[2];
+    
+    // $GPRMC,<UTC>,<status>,<latitude>,<N/S>,<longitude>,<E/W>,<spkn>,<cog>,<date>,...
+    if(nmeaPending[NMEA_RMC]) {
+        const char* rmc = nmeaSentences[NMEA_RMC];
+        nmeaPending[NMEA_RMC] = false;
+        
+        if(nmeaField(rmc, 1, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_time) {
+            publishGPSSignal("gps_time", field, pipeline);
+        }
+        // only a valid fix has a position
+        if(nmeaField(rmc, 2, field, sizeof(field)) && field[0] == 'A') {
+            if(nmeaField(rmc, 3, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_latitude) {
+                nmeaField(rmc, 4, hemisphere, sizeof(hemisphere));
+                publishGPSSignal("gps_latitude", nmeaDegrees(field, 2, hemisphere), pipeline);
+            }
+            if(nmeaField(rmc, 5, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_longitude) {
+                nmeaField(rmc, 6, hemisphere, sizeof(hemisphere));
+                publishGPSSignal("gps_longitude", nmeaDegrees(field, 3, hemisphere), pipeline);
+            }
+            if(nmeaField(rmc, 7, field, sizeof(field))) {
+                if(gpsConfig->gpsEnableSignal_gps_speed) {
+                    publishGPSSignal("gps_speed", (float)(atof(field) * 1.852), pipeline);
+                }
+                if(gpsConfig->gpsEnableSignal_gps_speed_knots) {
+                    publishGPSSignal("gps_speed_knots", (float)atof(field), pipeline);
+                }
+            }
+            if(nmeaField(rmc, 8, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_course) {
+                publishGPSSignal("gps_course", (float)atof(field), pipeline);
+            }
+        }
+        if(nmeaField(rmc, 9, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_date) {
+            publishGPSSignal("gps_date", field, pipeline);
+        }
+    }
+    
+    // $GPGGA,<UTC>,<latitude>,<N/S>,<longitude>,<E/W>,<quality>,<nsat>,<hdop>,<altitude>,...
+    if(nmeaPending[NMEA_GGA]) {
+        const char* gga = nmeaSentences[NMEA_GGA];
+        nmeaPending[NMEA_GGA] = false;
+        
+        if(nmeaField(gga, 7, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_nsat) {
+            publishGPSSignal("gps_nsat", (float)atoi(field), pipeline);
+        }
+        if(nmeaField(gga, 8, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_hdop) {
+            publishGPSSignal("gps_hdop", (float)atof(field), pipeline);
+        }
+        if(nmeaField(gga, 9, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_altitude) {
+            publishGPSSignal("gps_altitude", (float)atof(field), pipeline);
+        }
+    }
+    
+    // $GPGSA,<mode>,<fix>,... where fix is 1 (none), 2 (2D) or 3 (3D), the same as $GPSACP
+    if(nmeaPending[NMEA_GSA]) {
+        const char* gsa = nmeaSentences[NMEA_GSA];
+        nmeaPending[NMEA_GSA] = false;
+        
+        if(nmeaField(gsa, 2, field, sizeof(field)) && gpsConfig->gpsEnableSignal_gps_fix) {
+            unsigned int fix = atoi(field);
+            if(fix < openxc::telitHE910::FIX_MAX_ENUM) {
+                publishGPSSignal("gps_fix", (char*)gps_fix_enum[fix], pipeline);
+            }
+        }
+    }
+}
+
+#endif // DEFAULT_GPS_NMEA_STREAM
+
+/*SPOOL*/
+
+#ifdef CELLULAR_SPOOL_SUPPORT
+
+/*
+ * Private:
+ *
+ * Picks up a spool left on the SD card by an earlier run, the first time the card is connected.
+ */
+static void checkSpool() {
+    if(spoolChecked || !fs::connected(getConfiguration()->fs)) {
+        return;
+    }
+    spoolChecked = true;
+    
+    int size = fs::fileSize(getConfiguration()->fs, CELLULAR_SPOOL_FILE);
+    if(size > 0) {
+        debug("Found %d bytes of spooled cellular data", size);
+        // anything already in the sendBuffer is newer, so hold it back
+        spooling = true;
+        sendBufferVisible = 0;
+        spoolLength = size;
+        spoolOffset = 0;
+    } else if(size == 0) {
+        fs::removeFile(getConfiguration()->fs, CELLULAR_SPOOL_FILE);
+    }
+}
+
+/*
+ * Private:
+ *
+ * Appends the data held back in the sendBuffer - all of it, if nothing is spooled yet - to the spool.
+ * Returns true if there's room in the sendBuffer again.
+ */
+static bool spill() {
+    unsigned int staged = (pSendBuffer - sendBuffer) - sendBufferVisible;
+    int size = fs::appendFile(getConfiguration()->fs, CELLULAR_SPOOL_FILE,
+            sendBuffer + sendBufferVisible, staged, DEFAULT_CELLULAR_SPOOL_KB * 1024);
+    if(size < 0) {
+        return false;
+    }
+    
+    if(!spooling) {
+        debug("Cellular data is backed up, spooling to the SD card");
+        spooling = true;
+        sendBufferVisible = 0;
+        spoolOffset = 0;
+    }
+    spoolLength = size;
+    pSendBuffer = sendBuffer + sendBufferVisible;
+    return true;
+}
+
+/*
+ * Private:
+ *
+ * Once the modem is connected and the last chunk read back from the spool has been sent, reads the
+ * next chunk into the front of the sendBuffer, ahead of the data held back, at no more than
+ * DEFAULT_CELLULAR_SPOOL_DRAIN_RATE. JSON chunks end on a record so a POST never splits one.
+ */
+static void drainSpool(TelitDevice* device) {
+    if(!spooling || sendBufferVisible > 0 || !telit::connected(device) ||
+            uptimeMs() - lastSpoolDrain < 1000UL * CELLULAR_SPOOL_CHUNK_SIZE /
+                DEFAULT_CELLULAR_SPOOL_DRAIN_RATE) {
+        return;
+    }
+    
+    unsigned int staged = pSendBuffer - sendBuffer;
+    unsigned int length = SEND_BUFFER_SIZE - staged;
+    if(length > CELLULAR_SPOOL_CHUNK_SIZE) {
+        length = CELLULAR_SPOOL_CHUNK_SIZE;
+    }
+    if(length > spoolLength - spoolOffset) {
+        length = spoolLength - spoolOffset;
+    }
+    if(length == 0 && spoolOffset < spoolLength) {
+        return;
+    }
+    lastSpoolDrain = uptimeMs();
+    
+    memmove(sendBuffer + length, sendBuffer, staged);
+    int count = fs::readFileAt(getConfiguration()->fs, CELLULAR_SPOOL_FILE,
+            spoolOffset, sendBuffer, length);
+    if(count < 0) {
+        memmove(sendBuffer, sendBuffer + length, staged);
+        return;
+    }
+    
+    unsigned int kept = count;
+    if(getConfiguration()->payloadFormat == PayloadFormat::JSON &&
+            spoolOffset + count < spoolLength) {
+        while(kept > 0 && sendBuffer[kept - 1] != '\0') {
+            kept--;
+        }
+        if(kept == 0) {
+            // a record longer than a chunk goes out in pieces
+            kept = count;
+        }
+    }
+    memmove(sendBuffer + kept, sendBuffer + length, staged);
+    pSendBuffer = sendBuffer + kept + staged;
+    sendBufferVisible = kept;
+    spoolOffset += kept;
+    
+    if(spoolOffset >= spoolLength || count == 0) {
+        debug("Sent all %d bytes of spooled cellular data", spoolLength);
+        fs::removeFile(getConfiguration()->fs, CELLULAR_SPOOL_FILE);
+        spooling = false;
+        spoolLength = 0;
+        spoolOffset = 0;
+    }
+}
+
+#endif // CELLULAR_SPOOL_SUPPORT
+
 /*PIPELINE*/
 
 /*
@@ -1587,9 +2714,20 @@ void openxc::telitHE910::processSendQueue(TelitDevice* device) {
     // our "sendBuffer" will buffer up multiple QUEUEs before flushing on a time and/or data watermark.
 
     // pop bytes from the device send queue (stop short of sendBuffer overflow)
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) && (pSendBuffer - sendBuffer) < SEND_BUFFER_SIZE) {
-        *pSendBuffer++ = QUEUE_POP(uint8_t, &device->sendQueue);
-    }
+    pSendBuffer += openxc::util::bytebuffer::popBytes(&device->sendQueue,
+            pSendBuffer, SEND_BUFFER_SIZE - (pSendBuffer - sendBuffer));
+
+#ifdef CELLULAR_SPOOL_SUPPORT
+    checkSpool();
+    // the sendBuffer overflowed, so spill it to the SD card instead of letting
+    // the pipeline drop what's left in the queue
+    if(!BYTE_QUEUE_EMPTY(&device->sendQueue) &&
+            pSendBuffer == sendBuffer + SEND_BUFFER_SIZE && spill()) {
+        pSendBuffer += openxc::util::bytebuffer::popBytes(&device->sendQueue,
+                pSendBuffer, SEND_BUFFER_SIZE - (pSendBuffer - sendBuffer));
+    }
+    drainSpool(device);
+#endif
 
     return;
 
@@ -1611,7 +2749,15 @@ unsigned int openxc::telitHE910::sizeSendBuffer(TelitDevice* device) {
  * Resets the tracking pointer for the device data send buffer, which resets buffer to empty state.
  */
 void openxc::telitHE910::resetSendBuffer(TelitDevice* device) {
-    pSendBuffer = sendBuffer;
+    if(spooling) {
+        // keep the data held back while the spool drains
+        unsigned int staged = (pSendBuffer - sendBuffer) - sendBufferVisible;
+        memmove(sendBuffer, sendBuffer + sendBufferVisible, staged);
+        pSendBuffer = sendBuffer + staged;
+        sendBufferVisible = 0;
+    } else {
+        pSendBuffer = sendBuffer;
+    }
  }
  
 /*
@@ -1620,6 +2766,9 @@ void openxc::telitHE910::resetSendBuffer(TelitDevice* device) {
  * Returns number of bytes stored in the device data send buffer.
  */
 unsigned int openxc::telitHE910::bytesSendBuffer(TelitDevice* device) {
+    if(spooling) {
+        return sendBufferVisible;
+    }
     return int(pSendBuffer - sendBuffer);
  }
  
@@ -1635,3 +2784,61 @@ unsigned int openxc::telitHE910::readAllSendBuffer(TelitDevice* device, char* de
     memcpy(destination, sendBuffer, write_len);
     return write_len;
  }
+
+/*
+ * Public:
+ *
+ * Moves bytes from the front of the device data send buffer to the destination pointer, within the limits of the specified length.
+ */
+unsigned int openxc::telitHE910::popSendBuffer(TelitDevice* device, char* destination, unsigned int read_len) {
+    unsigned int write_len = readAllSendBuffer(device, destination, read_len);
+    memmove(sendBuffer, sendBuffer + write_len, (pSendBuffer - sendBuffer) - write_len);
+    pSendBuffer -= write_len;
+    if(spooling) {
+        sendBufferVisible -= write_len;
+    }
+    return write_len;
+ }
+
+/*
+ * Public:
+ *
+ * Takes the send buffer being filled and starts filling a free one, see telit_he910.h.
+ */
+char* openxc::telitHE910::takeSendBuffer(TelitDevice* device, unsigned int* length) {
+    unsigned int next = sendBufferIndex;
+    unsigned int staged = 0;
+    uint8_t* taken = sendBuffer;
+    
+    do {
+        next = (next + 1) % SEND_BUFFER_COUNT;
+    } while(next != sendBufferIndex && sendBufferTaken[next]);
+    if(next == sendBufferIndex) {
+        return NULL;
+    }
+    
+    // anything held back while the spool drains carries over to the next buffer
+    *length = bytesSendBuffer(device);
+    staged = (pSendBuffer - sendBuffer) - *length;
+    sendBufferTaken[sendBufferIndex] = true;
+    sendBufferIndex = next;
+    sendBuffer = sendBufferPool[next] + SEND_BUFFER_FRAMING;
+    memcpy(sendBuffer, taken + *length, staged);
+    pSendBuffer = sendBuffer + staged;
+    sendBufferVisible = 0;
+    
+    return (char*)taken;
+ }
+
+/*
+ * Public:
+ *
+ * Gives back a send buffer from takeSendBuffer.
+ */
+void openxc::telitHE910::releaseSendBuffer(TelitDevice* device, char* buffer) {
+    for(unsigned int i = 0; i < SEND_BUFFER_COUNT; ++i) {
+        if((char*)sendBufferPool[i] + SEND_BUFFER_FRAMING == buffer) {
+            sendBufferTaken[i] = false;
+        }
+    }
+ }
@@ -108,8 +108,8 @@ typedef struct {
     openxc::interface::InterfaceDescriptor descriptor;
     ModemConfigurationDescriptor config;
     openxc::interface::uart::UartDevice* uart;
-    QUEUE_TYPE(uint8_t) sendQueue;
-    QUEUE_TYPE(uint8_t) receiveQueue;
+    ByteQueue sendQueue;
+    ByteQueue receiveQueue;
     char deviceId[MAX_DEVICE_ID_LENGTH];
     char ICCID[MAX_ICCID_LENGTH];
 } TelitDevice;
@@ -129,6 +129,60 @@ typedef enum {
 
 #define SEND_BUFFER_SIZE 4096
 
+// The number of bytes the send queue holds between moves to the send buffer.
+#ifndef TELIT_SEND_QUEUE_SIZE
+#define TELIT_SEND_QUEUE_SIZE 512
+#endif
+
+// The pipeline fills one send buffer while the others wait for or are in a
+// POST, posted from where they are - see takeSendBuffer. A chunked POST reads
+// records out as they're produced, so it only needs the one.
+#ifndef SEND_BUFFER_COUNT
+#if DEFAULT_POST_DATA_CHUNKED
+#define SEND_BUFFER_COUNT 1
+#else
+#define SEND_BUFFER_COUNT 3
+#endif
+#endif
+
+// Free space kept before and after the data in each send buffer, so a POST body
+// can be framed around the data in place, e.g. as {"records":[...]}.
+#define SEND_BUFFER_FRAMING 16
+
+// How much the send buffer may spill to CELLULAR_SPOOL_FILE on the SD card,
+// in KB, when it overflows - e.g. while the modem is out of coverage. The spool
+// is sent, oldest first, before any newer data once the link is back up. Use 0
+// to drop the overflow instead.
+#ifndef DEFAULT_CELLULAR_SPOOL_KB
+#define DEFAULT_CELLULAR_SPOOL_KB 4096
+#endif
+
+// How fast, in bytes per second, the spool is read back into the send buffer,
+// to leave the link some room for live data while it catches up.
+#ifndef DEFAULT_CELLULAR_SPOOL_DRAIN_RATE
+#define DEFAULT_CELLULAR_SPOOL_DRAIN_RATE 2048
+#endif
+
+#define CELLULAR_SPOOL_FILE "SPOOL.BIN"
+#define CELLULAR_SPOOL_CHUNK_SIZE 1024
+
+// Set to 1 to have the modem stream NMEA sentences as they're generated,
+// instead of polling it with AT$GPSACP every gpsInterval. GPS signals are then
+// published at the receiver's own rate, and the blocking GPS query no longer
+// holds up the cellular connection.
+#ifndef DEFAULT_GPS_NMEA_STREAM
+#define DEFAULT_GPS_NMEA_STREAM 0
+#endif
+
+// Set to 1 to connect to the server over TLS, with the modem's own SSL socket
+// (AT#SSLD) doing the encryption so none of it runs on the PIC32, or 2 to also
+// have the modem check the server's certificate against the CA certificate
+// stored in it with AT#SSLSECDATA. The modem has one SSL socket, so the server
+// tasks take turns with it - see claimSocket.
+#ifndef DEFAULT_SERVER_TLS
+#define DEFAULT_SERVER_TLS 0
+#endif
+
 /*
  * INITIALIZATION FUNCTIONS
  *
@@ -137,7 +191,8 @@ typedef enum {
  * The deinitialization function will suspend all network activity and power down the modem.
  */
  
-/*Public: State machine to manage the telit modem. Call repeatedly.*/
+/*Public: State machine to manage the telit modem. Call repeatedly - each call only moves the AT command in flight
+  along and never waits on the modem's response, and reads out any unsolicited result codes while the modem is idle.*/
 TELIT_CONNECTION_STATE connectionManager(TelitDevice* device);
 
 /*Public: Gets the device manager state.*/
@@ -262,7 +317,31 @@ bool isSocketOpen(unsigned int socketNumber);
 /*Public: Closes the specified TCP/IP socket number.*/
 bool closeSocket(unsigned int socketNumber);
 
-/*Public: Sends data on the specified TCP/IP socket number.*/
+/*Public: Takes the connection to the server for a request on the specified socket number, before it's opened.
+ * With DEFAULT_SERVER_TLS every socket number shares the modem's one SSL socket, so this returns false while a
+ * request on another socket number has it, and the caller should try again later. Always true otherwise.*/
+bool claimSocket(unsigned int socketNumber);
+
+/*Public: Hands back the connection taken with claimSocket once the request is done, open or not.*/
+void releaseSocket(unsigned int socketNumber);
+
+/*Public: Sends data on the specified TCP/IP socket number, without waiting
+ * for the modem to acknowledge it.
+ * 
+ * Each call hands at most one chunk (of up to 1500 bytes, or 1023 with
+ * DEFAULT_SERVER_TLS) to the modem, once it has accepted the one before, so a
+ * call may write nothing and the caller should call again with the same data.
+ * The modem's acknowledgement is collected on a later call, or before the next
+ * command is sent to it.
+ * 
+ * socketNumber: the TCP/IP socket to write to
+ * data: the bytes to send, which must stay valid until they've been reported
+ *      as written
+ * len: pointer to the number of bytes to send, replaced with the number
+ *      handed to the modem on return
+ * 
+ * Returns false if the modem rejected or didn't acknowledge a chunk.
+ */
 bool writeSocket(unsigned int socketNumber, char* data, unsigned int *len);
 
 /*Public: Reads data from the specified TCP/IP socket number.
@@ -312,14 +391,35 @@ bool connected(TelitDevice* device);
 /*Public: Returns number of bytes allocated for the device data send buffer.*/
 unsigned int sizeSendBuffer(TelitDevice* device);
 
-/*Public: Resets the tracking pointer for the device data send buffer, which resets buffer to empty state.*/
+/*Public: Resets the tracking pointer for the device data send buffer, which empties it of everything that
+ * bytesSendBuffer counts.*/
 void resetSendBuffer(TelitDevice* device);
 
-/*Public: Returns number of bytes stored in the device data send buffer.*/
+/*Public: Returns number of bytes stored in the device data send buffer that are ready to send. While spooled
+ * data is being drained from the SD card, newer data is held back and not counted.*/
 unsigned int bytesSendBuffer(TelitDevice* device);
 
 /*Public: Copies all bytes from the device data send buffer to the destination pointer, within the limits of the specified length.*/
 unsigned int readAllSendBuffer(TelitDevice* device, char* destination, unsigned int read_len);
+
+/*Public: Moves up to read_len bytes from the front of the device data send buffer to the destination pointer,
+ * leaving the rest in the buffer. Returns the number of bytes moved.
+ */
+unsigned int popSendBuffer(TelitDevice* device, char* destination, unsigned int read_len);
+
+/*Public: Takes the send buffer being filled, with the bytesSendBuffer bytes in it, and starts filling a free one
+ * instead - so the data can be posted straight from the buffer the pipeline wrote it to, without copying it out.
+ * There are SEND_BUFFER_FRAMING bytes free before and after the data. Give the buffer back with
+ * releaseSendBuffer once it's been sent.
+ *
+ * length - (output) the number of bytes in the buffer.
+ *
+ * Returns the data, or NULL if all SEND_BUFFER_COUNT buffers are taken - the one being filled then keeps filling.
+ */
+char* takeSendBuffer(TelitDevice* device, unsigned int* length);
+
+/*Public: Gives back a send buffer from takeSendBuffer, to be filled again.*/
+void releaseSendBuffer(TelitDevice* device, char* buffer);
  
 void flushDataBuffer(TelitDevice* device);
 void firmwareCheck(TelitDevice* device);
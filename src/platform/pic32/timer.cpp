@@ -9,4 +9,17 @@ unsigned long openxc::util::time::systemTimeMs() {
     return millis();
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    return micros();
+}
+
+unsigned long openxc::util::time::cycleCount() {
+    return _CP0_GET_COUNT();
+}
+
+unsigned long openxc::util::time::cyclesPerMicrosecond() {
+    // The core timer increments every other system clock cycle
+    return F_CPU / 2 / 1000000;
+}
+
 void openxc::util::time::initialize() { }
@@ -22,6 +22,7 @@
  */
 #include "interface/uart.h"
 #include "util/bytebuffer.h"
+#include "config.h"
 #include "util/log.h"
 #include "atcommander.h"
 #include "WProgram.h"
@@ -62,6 +63,8 @@ namespace gpio = openxc::gpio;
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::config::getConfiguration;
+using openxc::util::bytebuffer::popBytes;
 using openxc::util::time::uptimeMs;
 
 extern const AtCommanderPlatform AT_PLATFORM_RN42;
@@ -75,11 +78,12 @@ void openxc::interface::uart::read(UartDevice* device,
         int bytesAvailable = ((HardwareSerial*)device->controller)->available();
         if(bytesAvailable > 0) {
             for(int i = 0; i < bytesAvailable &&
-                    !QUEUE_FULL(uint8_t, &device->receiveQueue); i++) {
+                    !BYTE_QUEUE_FULL(&device->receiveQueue); i++) {
                 char byte = ((HardwareSerial*)device->controller)->read();
-                QUEUE_PUSH(uint8_t, &device->receiveQueue, (uint8_t) byte);
+                BYTE_QUEUE_PUSH(&device->receiveQueue, (uint8_t) byte);
             }
-            processQueue(&device->receiveQueue, callback);
+            processQueue(&device->receiveQueue, &device->receiveScanner,
+                    frameType(getConfiguration()->payloadFormat), callback);
         }
     }
 }
@@ -145,16 +149,11 @@ void openxc::interface::uart::initialize(UartDevice* device) {
 // send queue before returning.
 void openxc::interface::uart::processSendQueue(UartDevice* device) {
 #ifndef UART_LOGGING_DISABLE    
-    int byteCount = 0;
-    char sendBuffer[MAX_MESSAGE_SIZE];
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) &&
-                    byteCount < MAX_MESSAGE_SIZE) {
-        sendBuffer[byteCount++] = QUEUE_POP(uint8_t, &device->sendQueue);
-    }
+    uint8_t sendBuffer[MAX_MESSAGE_SIZE];
+    int byteCount = popBytes(&device->sendQueue, sendBuffer, MAX_MESSAGE_SIZE);
 
     if(byteCount > 0) {
-        ((HardwareSerial*)device->controller)->write((const uint8_t*)sendBuffer,
-                byteCount);
+        ((HardwareSerial*)device->controller)->write(sendBuffer, byteCount);
     }
 #endif
 }
@@ -16,11 +16,14 @@ namespace usb = openxc::interface::usb;
 namespace fs = openxc::interface::fs;
 
 using openxc::util::log::debug;
+using openxc::util::log::warning;
 using openxc::interface::usb::UsbDevice;
 using openxc::interface::usb::UsbEndpoint;
 using openxc::interface::usb::UsbEndpointDirection;
 using openxc::gpio::GPIO_DIRECTION_INPUT;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::frameType;
+using openxc::util::bytebuffer::popBytes;
 using openxc::config::getConfiguration;
 
 // This is a reference to the last packet read
@@ -44,6 +47,16 @@ static void armForRead(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
             endpoint->size);
 }
 
+/* Private: Start over with the first packet buffer, to match the controller's
+ * ping-pong state after the endpoint is (re)enabled.
+ */
+static void resetPacketBuffers(UsbEndpoint* endpoint) {
+    for(int i = 0; i < USB_PACKET_BUFFER_COUNT; i++) {
+        endpoint->deviceToHostHandles[i] = 0;
+    }
+    endpoint->nextPacketBuffer = 0;
+}
+
 static uint8_t INCOMING_EP0_DATA_BUFFER[256];
 static size_t INCOMING_EP0_DATA_SIZE;
 static void handleCompletedEP0OutTransfer() {
@@ -81,6 +94,7 @@ boolean usbCallback(USB_EVENT event, void *pdata, word size) {
             } else {
                 getConfiguration()->usb.device.EnableEndpoint(endpoint->address,
                         USB_IN_ENABLED|USB_HANDSHAKE_ENABLED|USB_DISALLOW_SETUP);
+                resetPacketBuffers(endpoint);
             }
         }
         break;
@@ -119,10 +133,9 @@ boolean usbCallback(USB_EVENT event, void *pdata, word size) {
     return true;
 }
 
-bool waitForHandle(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
+bool waitForHandle(UsbDevice* usbDevice, USB_HANDLE handle) {
     int i = 0;
-    while(usbDevice->configured &&
-            usbDevice->device.HandleBusy(endpoint->deviceToHostHandle)) {
+    while(usbDevice->configured && usbDevice->device.HandleBusy(handle)) {
         if(++i > USB_HANDLE_MAX_WAIT_COUNT) {
             // The reason we want to exit this loop early is that if USB is
             // attached and configured, but the host isn't sending an IN
@@ -135,6 +148,39 @@ bool waitForHandle(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
     return true;
 }
 
+/* Private: Send up to USB_SEND_BUFFER_SIZE bytes from the endpoint's queue,
+ * one packet at a time through its pair of packet buffers.
+ *
+ * The controller is in full ping-pong mode, so it alternates between the even
+ * and odd buffer descriptors and DMAs each packet straight from its buffer.
+ * While one packet is on the wire, the next is copied into the other buffer
+ * and queued behind it - we only wait when both are still in flight. The
+ * Microchip library doesn't copy the data to its own internal buffer, so a
+ * packet buffer can't be touched until its transfer completes (see #171).
+ *
+ * A trailing partial packet may be held back for a later pass, to go out as
+ * part of a full one (see usb::readyToSend).
+ */
+static void flushQueueToHost(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
+    int bytesSent = 0;
+    while(usbDevice->configured && bytesSent < USB_SEND_BUFFER_SIZE &&
+            usb::readyToSend(usbDevice, endpoint)) {
+        uint8_t buffer = endpoint->nextPacketBuffer;
+        if(!waitForHandle(usbDevice, endpoint->deviceToHostHandles[buffer])) {
+            // The bytes are still in the queue, so nothing is lost - try again
+            // on the next pass
+            return;
+        }
+
+        int byteCount = popBytes(&endpoint->queue,
+                endpoint->packetBuffers[buffer], MAX_USB_PACKET_SIZE_BYTES);
+        endpoint->deviceToHostHandles[buffer] = usbDevice->device.GenWrite(
+                endpoint->address, endpoint->packetBuffers[buffer], byteCount);
+        endpoint->nextPacketBuffer = (buffer + 1) % USB_PACKET_BUFFER_COUNT;
+        bytesSent += byteCount;
+    }
+}
+
 void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
 
 #ifdef FS_SUPPORT    
@@ -144,39 +190,9 @@ void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
 #endif    
     for(int i = 0; i < ENDPOINT_COUNT; i++) {
         UsbEndpoint* endpoint = &usbDevice->endpoints[i];
-
-        // Don't touch usbDevice->sendBuffer if there's still a pending transfer
-        if(!waitForHandle(usbDevice, endpoint)) {
-            return;
-        }
-
-        while(usbDevice->configured &&
-                !QUEUE_EMPTY(uint8_t, &endpoint->queue)) {
-            int byteCount = 0;
-            while(!QUEUE_EMPTY(uint8_t, &endpoint->queue) &&
-                    byteCount < USB_SEND_BUFFER_SIZE) {
-                endpoint->sendBuffer[byteCount++] = QUEUE_POP(uint8_t,
-                        &endpoint->queue);
-            }
-
-            int nextByteIndex = 0;
-            while(nextByteIndex < byteCount) {
-                // Make sure the USB write is 100% complete before messing with
-                // this buffer after we copy the message into it - the Microchip
-                // library doesn't copy the data to its own internal buffer. See
-                // #171 for background on this issue.
-                if(!waitForHandle(usbDevice, endpoint)) {
-                    debug("USB not responding in a timely fashion, dropped data");
-                    return;
-                }
-
-                int bytesToTransfer = min(MAX_USB_PACKET_SIZE_BYTES,
-                        byteCount - nextByteIndex);
-                endpoint->deviceToHostHandle = usbDevice->device.GenWrite(
-                        endpoint->address,
-                        &endpoint->sendBuffer[nextByteIndex], bytesToTransfer);
-                nextByteIndex += bytesToTransfer;
-            }
+        if(endpoint->direction ==
+                UsbEndpointDirection::USB_ENDPOINT_DIRECTION_IN) {
+            flushQueueToHost(usbDevice, endpoint);
         }
     }
 }
@@ -225,14 +241,16 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
         size_t length = device->device.HandleGetLength(
                 endpoint->hostToDeviceHandle);
         for(int i = 0; i < endpoint->size && i < length; i++) {
-            if(!QUEUE_PUSH(uint8_t, &endpoint->queue,
+            if(!BYTE_QUEUE_PUSH(&endpoint->queue,
                         endpoint->receiveBuffer[i])) {
-                debug("Dropped write from host -- queue is full");
+                warning("Dropped write from host -- queue is full");
             }
         }
 
         if(length > 0) {
-            while(processQueue(&endpoint->queue, callback)) {
+            while(processQueue(&endpoint->queue, &endpoint->receiveScanner,
+                        frameType(getConfiguration()->payloadFormat),
+                        callback)) {
                 continue;
             }
         }
@@ -28,7 +28,11 @@ ROM USB_DEVICE_DESCRIPTOR device_dsc_gen=
 ROM BYTE configDescriptor_gen[]={
     sizeof(USB_CONFIGURATION_DESCRIPTOR),
     USB_DESCRIPTOR_CONFIGURATION,                // CONFIGURATION descriptor type
+#ifdef FS_SUPPORT
+    0x2E,0x00,            // Total length of data for this cfg
+#else
     0x27,0x00,            // Total length of data for this cfg
+#endif
     INTERFACE_COUNT,                      // Number of interfaces in this cfg
     1,                      // Index value of this configuration
     0,                      // Configuration string index
@@ -67,6 +71,15 @@ ROM BYTE configDescriptor_gen[]={
     _BULK,                       // Attributes
     DATA_ENDPOINT_SIZE,0x00,
     1,                         // Interval, unused by bulk endpoint
+
+#ifdef FS_SUPPORT
+    sizeof(USB_ENDPOINT_DESCRIPTOR),
+    USB_DESCRIPTOR_ENDPOINT, //Endpoint Descriptor
+    (ENDPOINT_DIR_IN | FILE_ENDPOINT_NUMBER),                  // EndpointAddress
+    _BULK,                       // Attributes
+    DATA_ENDPOINT_SIZE,0x00,
+    1,                         // Interval, unused by bulk endpoint
+#endif
 };
 
 #ifdef FS_SUPPORT    
@@ -9,6 +9,7 @@
 #include "util/log.h"
 #include "can/canread.h"
 #include "platform_profile.h"
+#include "snapshot.h"
 #define OBD2_IGNITION_CHECK_WATCHDOG_TIMEOUT_MICROSECONDS 15000000
 
 
@@ -26,14 +27,9 @@ using openxc::config::getConfiguration;
 using openxc::config::PowerManagement;
 using openxc::config::RunLevel;
 
-void openxc::platform::suspend(Pipeline* pipeline) {
-    debug("CAN went silent - disabling LED");
-
-    // De-init and shut down all peripherals to save power
-    for(int i = 0; i < getCanBusCount(); ++i) {
-        can::deinitialize(&getCanBuses()[i]);
-    }
-
+/* Private: Shut down the lights and every output interface.
+ */
+static void deinitializeOutputs(Pipeline* pipeline) {
     lights::deinitialize();
     usb::deinitialize(pipeline->usb);
     bluetooth::deinitialize();
@@ -46,13 +42,43 @@ void openxc::platform::suspend(Pipeline* pipeline) {
     #ifdef TELIT_HE910_SUPPORT
     telit::deinitialize();
     #endif
+}
+
+void openxc::platform::suspend(Pipeline* pipeline) {
+    debug("CAN went silent - disabling LED");
 
-    if(getConfiguration()->powerManagement == PowerManagement::OBD2_IGNITION_CHECK) {
+    // De-init and shut down all peripherals to save power
+    for(int i = 0; i < getCanBusCount(); ++i) {
+        can::deinitialize(&getCanBuses()[i]);
+    }
+
+    deinitializeOutputs(pipeline);
+
+    if(getConfiguration()->powerManagement == PowerManagement::OBD2_IGNITION_CHECK &&
+            !getConfiguration()->passiveIgnitionCheck) {
         debug("Enabling watchdog timer to poll for ignition status via OBD-II");
         power::enableWatchdogTimer(OBD2_IGNITION_CHECK_WATCHDOG_TIMEOUT_MICROSECONDS);
+    } else if(SNAPSHOT_INTERVAL_S > 0) {
+        debug("Waking up for a diagnostic snapshot in %ds",
+                SNAPSHOT_INTERVAL_S);
+        power::armWakeTimer(SNAPSHOT_INTERVAL_S);
     }
 
     // Wait for peripherals to disabled before sleeping
     time::delayMs(100);
     power::suspend();
 }
+
+void openxc::platform::enterListenSuspend(Pipeline* pipeline) {
+    debug("CAN went silent - listening for a wake frame");
+    deinitializeOutputs(pipeline);
+
+    // Wait for peripherals to disabled before slowing down
+    time::delayMs(100);
+    power::enterLowClock();
+}
+
+void openxc::platform::exitListenSuspend() {
+    power::exitLowClock();
+    lights::initialize();
+}
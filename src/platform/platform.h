@@ -16,6 +16,18 @@ void initialize();
  */
 void suspend(openxc::pipeline::Pipeline* pipeline);
 
+/* Public: De-init and disable every peripheral except CAN, and slow the
+ * microcontroller down with CAN receive still running, to listen for a wake
+ * frame instead of suspending. See LISTEN_SUSPEND in power.h.
+ */
+void enterListenSuspend(openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Restore the clock and lights after enterListenSuspend(). The output
+ * interfaces are brought back up by the main loop, on the way to the ALL_IO run
+ * level.
+ */
+void exitListenSuspend();
+
 } // namespace platform
 } // namespace openxc
 
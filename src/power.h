@@ -1,6 +1,27 @@
 #ifndef _POWER_H_
 #define _POWER_H_
 
+/* Public: Set to 0 to keep the main loop from sleeping the CPU when it has
+ * nothing to do. See waitForInterrupt().
+ */
+#ifndef IDLE_SLEEP
+#define IDLE_SLEEP 1
+#endif
+
+/* Public: Set to 1 to keep listening on CAN while suspended instead of
+ * shutting everything down. The microcontroller drops to a low clock with only
+ * CAN receive running, the frames are kept in RAM and the VI comes back up
+ * without a reset when a wake frame arrives, so the frames that woke it aren't
+ * lost.
+ *
+ * Define LISTEN_SUSPEND_WAKE_IDS as a comma separated list of message IDs to
+ * wake only on those, e.g. an ignition or door status message. If it's not
+ * defined, any frame the VI would accept wakes it.
+ */
+#ifndef LISTEN_SUSPEND
+#define LISTEN_SUSPEND 0
+#endif
+
 namespace openxc {
 namespace power {
 
@@ -27,6 +48,35 @@ void suspend();
  */
 void handleWake();
 
+/* Public: Stop the CPU until the next interrupt, leaving the peripherals and
+ * their interrupts running. The system timer interrupts every millisecond, so
+ * this never waits longer than that.
+ */
+void waitForInterrupt();
+
+/* Public: Slow the CPU down as far as it can go while CAN receive keeps
+ * running, and put the CAN controllers in listen only mode. The system timer
+ * keeps its 1ms tick.
+ */
+void enterLowClock();
+
+/* Public: Restore the clock and CAN controller modes after enterLowClock().
+ */
+void exitLowClock();
+
+/* Public: Wake back up from the next suspend() on a timer, after about the
+ * given number of seconds, unless CAN activity wakes the VI first. Like a wake
+ * on CAN, it resets the microcontroller, and wokeFromTimer() returns true once
+ * it's back up.
+ */
+void armWakeTimer(unsigned long seconds);
+
+/* Public: Returns true if the VI started up because the timer from
+ * armWakeTimer() woke it from a suspend, rather than on power up or CAN
+ * activity. Only valid after initialize().
+ */
+bool wokeFromTimer();
+
 void enableWatchdogTimer(int microseconds);
 
 void disableWatchdogTimer();
@@ -0,0 +1,203 @@
+#include "saved_config.h"
+#include "config.h"
+#include "can/autobaud.h"
+#include "diagnostics.h"
+#include "obd2.h"
+#include "signals.h"
+#include "util/log.h"
+#include "util/state_store.h"
+#include <string.h>
+
+namespace diagnostics = openxc::diagnostics;
+namespace obd2 = openxc::diagnostics::obd2;
+namespace autobaud = openxc::can::autobaud;
+namespace state_store = openxc::util::state_store;
+
+using openxc::diagnostics::SavedDiagnosticRequest;
+using openxc::diagnostics::obd2::SavedSupportedPid;
+using openxc::config::getConfiguration;
+using openxc::payload::PayloadFormat;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::util::log::debug;
+
+#define SAVED_CONFIGURATION_MAGIC 0x3143584f // "OXC1"
+
+/* Private: The saved settings of one CAN bus.
+ */
+typedef struct {
+    uint8_t address;
+    bool passthroughCanMessages;
+    bool bypassFilters;
+    uint32_t speed;
+} SavedBus;
+
+/* Private: The saved configuration as it's laid out in flash. The length is
+ * the size of the struct, so a configuration saved by firmware that laid it
+ * out differently isn't applied, and the checksum covers everything after it.
+ * The supported PIDs are cached on their own, without the settings if they
+ * haven't been saved.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t length;
+    uint16_t checksum;
+    bool settingsSaved;
+    uint8_t payloadFormat;
+    bool recurringObd2Requests;
+    uint8_t busCount;
+    uint8_t requestCount;
+    uint8_t pidCount;
+    SavedBus buses[MAX_CAN_CONTROLLERS];
+    SavedDiagnosticRequest requests[SAVED_DIAGNOSTIC_REQUEST_COUNT];
+    SavedSupportedPid pids[OBD2_SAVED_PID_COUNT];
+} SavedConfiguration;
+
+#define SAVED_CONFIGURATION_HEADER_SIZE 8
+
+static_assert(sizeof(SavedConfiguration) <= SAVED_CONFIGURATION_SIZE,
+        "SAVED_DIAGNOSTIC_REQUEST_COUNT is too high to fit in flash");
+
+// Word aligned for the platforms' flash writes
+static uint32_t buffer[SAVED_CONFIGURATION_SIZE / 4];
+
+static uint16_t bodyChecksum(const SavedConfiguration* saved) {
+    return state_store::checksum(
+            (const uint8_t*) saved + SAVED_CONFIGURATION_HEADER_SIZE,
+            sizeof(SavedConfiguration) - SAVED_CONFIGURATION_HEADER_SIZE);
+}
+
+/* Private: Copy the saved configuration out of flash into the buffer, for
+ * alignment.
+ *
+ * Returns the copy, or NULL if there isn't a valid one.
+ */
+static SavedConfiguration* loadSaved() {
+    memcpy(buffer, savedConfigurationRegion(), sizeof(buffer));
+    SavedConfiguration* saved = (SavedConfiguration*) buffer;
+    if(saved->magic != SAVED_CONFIGURATION_MAGIC ||
+            saved->length != sizeof(SavedConfiguration) ||
+            saved->checksum != bodyChecksum(saved) ||
+            saved->busCount > MAX_CAN_CONTROLLERS ||
+            saved->requestCount > SAVED_DIAGNOSTIC_REQUEST_COUNT ||
+            saved->pidCount > OBD2_SAVED_PID_COUNT) {
+        return NULL;
+    }
+    return saved;
+}
+
+bool openxc::config::saveConfiguration() {
+    memset(buffer, 0xff, sizeof(buffer));
+    SavedConfiguration* saved = (SavedConfiguration*) buffer;
+    memset(saved, 0, sizeof(SavedConfiguration));
+    saved->magic = SAVED_CONFIGURATION_MAGIC;
+    saved->length = sizeof(SavedConfiguration);
+    saved->settingsSaved = true;
+    saved->payloadFormat = getConfiguration()->payloadFormat;
+    saved->recurringObd2Requests = getConfiguration()->recurringObd2Requests;
+    saved->busCount = MIN(getCanBusCount(), MAX_CAN_CONTROLLERS);
+    for(int i = 0; i < saved->busCount; i++) {
+        CanBus* bus = &getCanBuses()[i];
+        saved->buses[i].address = bus->address;
+        saved->buses[i].passthroughCanMessages = bus->passthroughCanMessages;
+        // The filters are bypassed while the speed is searched for, but
+        // that's not the setting to come back up with
+        saved->buses[i].bypassFilters = autobaud::searching(bus) ?
+                bus->autoBaudBypassFilters : bus->bypassFilters;
+        saved->buses[i].speed = bus->speed;
+    }
+    saved->requestCount = diagnostics::saveRecurringRequests(
+            &getConfiguration()->diagnosticsManager, saved->requests,
+            SAVED_DIAGNOSTIC_REQUEST_COUNT);
+    saved->pidCount = obd2::saveSupportedPids(saved->pids,
+            OBD2_SAVED_PID_COUNT);
+    saved->checksum = bodyChecksum(saved);
+
+    bool status = writeSavedConfiguration((const uint8_t*) buffer) &&
+            !memcmp(savedConfigurationRegion(), buffer, sizeof(buffer));
+    debug("%s configuration with %d diagnostic requests",
+            status ? "Saved" : "Couldn't save", saved->requestCount);
+    return status;
+}
+
+bool openxc::config::saveSupportedPids() {
+    SavedConfiguration* saved = loadSaved();
+    if(saved == NULL) {
+        memset(buffer, 0xff, sizeof(buffer));
+        saved = (SavedConfiguration*) buffer;
+        memset(saved, 0, sizeof(SavedConfiguration));
+        saved->magic = SAVED_CONFIGURATION_MAGIC;
+        saved->length = sizeof(SavedConfiguration);
+    }
+
+    memset(saved->pids, 0, sizeof(saved->pids));
+    saved->pidCount = obd2::saveSupportedPids(saved->pids,
+            OBD2_SAVED_PID_COUNT);
+    saved->checksum = bodyChecksum(saved);
+    if(!memcmp(savedConfigurationRegion(), buffer, sizeof(buffer))) {
+        return true;
+    }
+
+    bool status = writeSavedConfiguration((const uint8_t*) buffer) &&
+            !memcmp(savedConfigurationRegion(), buffer, sizeof(buffer));
+    debug("%s %d supported PIDs", status ? "Saved" : "Couldn't save",
+            saved->pidCount);
+    return status;
+}
+
+bool openxc::config::clearSavedConfiguration() {
+    memset(buffer, 0xff, sizeof(buffer));
+    return writeSavedConfiguration((const uint8_t*) buffer);
+}
+
+bool openxc::config::restoreConfiguration() {
+    const SavedConfiguration* saved = loadSaved();
+    if(saved == NULL) {
+        return false;
+    }
+
+    obd2::restoreSupportedPids(saved->pids, saved->pidCount);
+    if(!saved->settingsSaved) {
+        return false;
+    }
+
+    if(saved->payloadFormat < PAYLOAD_FORMAT_COUNT) {
+        getConfiguration()->payloadFormat =
+                (PayloadFormat) saved->payloadFormat;
+    }
+    getConfiguration()->recurringObd2Requests = saved->recurringObd2Requests;
+
+    for(int i = 0; i < saved->busCount; i++) {
+        CanBus* bus = openxc::can::lookupBus(saved->buses[i].address,
+                getCanBuses(), getCanBusCount());
+        if(bus != NULL) {
+            bus->passthroughCanMessages =
+                    saved->buses[i].passthroughCanMessages;
+            if(autobaud::searching(bus)) {
+                bus->autoBaudBypassFilters = saved->buses[i].bypassFilters;
+            } else if(bus->bypassFilters != saved->buses[i].bypassFilters) {
+                openxc::can::setAcceptanceFilterStatus(bus,
+                        !saved->buses[i].bypassFilters, getCanBuses(),
+                        getCanBusCount());
+            }
+
+            // The speed found by the last search is the most likely one
+            if(autobaud::enabled(bus) && saved->buses[i].speed > 0) {
+                bus->speed = saved->buses[i].speed;
+                autobaud::start(bus, getCanBuses(), getCanBusCount());
+            }
+        }
+    }
+
+    int restored = 0;
+    for(int i = 0; i < saved->requestCount; i++) {
+        if(diagnostics::restoreRecurringRequest(
+                    &getConfiguration()->diagnosticsManager,
+                    &saved->requests[i])) {
+            ++restored;
+        }
+    }
+    debug("Restored saved configuration with %d of %d diagnostic requests",
+            restored, saved->requestCount);
+    return true;
+}
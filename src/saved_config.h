@@ -0,0 +1,76 @@
+/* The runtime configuration the host sets with control commands - payload
+ * format, passthrough and acceptance filter bypass for each bus, the automatic
+ * OBD-II requests and recurring diagnostic requests - saved to flash on
+ * request, so the VI comes up configured instead of waiting for the host to
+ * send the same commands again after every boot. The speed of each bus is
+ * saved along with it, for the buses whose speed is searched for, and the
+ * OBD-II PIDs the vehicle supports, which are also saved on their own whenever
+ * they change.
+ */
+#ifndef __SAVED_CONFIG_H__
+#define __SAVED_CONFIG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The size of the flash set aside by each platform for the saved
+// configuration. It's written as a whole, and the LPC17xx can only write
+// 256, 512, 1024 or 4096 bytes at a time.
+#define SAVED_CONFIGURATION_SIZE 1024
+
+// The most recurring diagnostic requests saved with the configuration.
+#ifndef SAVED_DIAGNOSTIC_REQUEST_COUNT
+#define SAVED_DIAGNOSTIC_REQUEST_COUNT 8
+#endif
+
+namespace openxc {
+namespace config {
+
+/* Public: Save the current runtime configuration and the recurring diagnostic
+ * requests added by commands to flash, replacing what was saved before.
+ *
+ * Returns true if the configuration was saved.
+ */
+bool saveConfiguration();
+
+/* Public: Save the OBD-II PIDs the vehicle supports to flash, keeping the rest
+ * of the saved configuration as it is. If there isn't one, only the PIDs are
+ * saved, and the VI still starts with its default settings.
+ *
+ * Returns true if the PIDs are saved.
+ */
+bool saveSupportedPids();
+
+/* Public: Erase the saved configuration and supported PIDs, so the VI starts
+ * with its defaults again.
+ *
+ * Returns true if it was erased.
+ */
+bool clearSavedConfiguration();
+
+/* Public: Apply the saved configuration and supported PIDs, if there are any.
+ * Call this once the CAN buses and the diagnostics manager are initialized.
+ *
+ * Returns true if a saved configuration was applied, not just the PIDs. One
+ * saved by firmware with a different layout is ignored.
+ */
+bool restoreConfiguration();
+
+/* Public: Return the flash set aside for the saved configuration,
+ * SAVED_CONFIGURATION_SIZE bytes, implemented by each platform.
+ */
+const uint8_t* savedConfigurationRegion();
+
+/* Public: Replace the saved configuration in flash, implemented by each
+ * platform.
+ *
+ * data - SAVED_CONFIGURATION_SIZE bytes to write, word aligned.
+ *
+ * Returns true if it was written.
+ */
+bool writeSavedConfiguration(const uint8_t* data);
+
+} // namespace config
+} // namespace openxc
+
+#endif // __SAVED_CONFIG_H__
@@ -2,6 +2,7 @@
 #include "can/canwrite.h"
 #include "payload/payload.h"
 #include "util/log.h"
+#include "util/state_store.h"
 
 #define OCCUPANCY_STATUS_GENERIC_NAME "occupancy_status"
 #define PSI_PER_KPA 0.145037738
@@ -11,7 +12,27 @@ float rollingOdometerSinceRestart = 0;
 float totalOdometerAtRestart = 0;
 float fuelConsumedSinceRestartLiters = 0;
 
+/* Private: The running totals saveState() keeps, with the last value of each
+ * counter signal they were added up from, so the first frame after a restart
+ * is counted from there instead of from 0.
+ */
+typedef struct {
+    float rotationsSinceRestart;
+    float rotationsLastValue;
+    float rollingOdometerSinceRestart;
+    float rollingOdometerLastValue;
+    float totalOdometerAtRestart;
+    float fuelConsumedSinceRestartLiters;
+    float fuelFlowLastValue;
+} HandlerState;
+
+static float rotationsLastValue;
+static float rollingOdometerLastValue;
+static float fuelFlowLastValue;
+static bool stateRestored;
+
 namespace can = openxc::can;
+namespace state_store = openxc::util::state_store;
 
 using openxc::util::log::debug;
 using openxc::can::read::stateDecoder;
@@ -22,6 +43,7 @@ using openxc::can::read::parseSignalBitfield;
 using openxc::can::read::shouldSend;
 using openxc::can::lookupSignal;
 using openxc::pipeline::Pipeline;
+using openxc::signals::handlers::HandlerContext;
 
 const float openxc::signals::handlers::LITERS_PER_GALLON = 3.78541178;
 const float openxc::signals::handlers::LITERS_PER_UL = .000001;
@@ -103,10 +125,99 @@ openxc_DynamicField openxc::signals::handlers::tirePressureDecoder(
     return tireIdValue;
 }
 
+static HandlerContext CONTEXT;
+
+void openxc::signals::handlers::bindHandlers(CanSignal* signals,
+        int signalCount) {
+    CONTEXT.signals = signals;
+    CONTEXT.signalCount = signalCount;
+    CONTEXT.totalOdometer = lookupSignal("total_odometer", signals,
+            signalCount);
+    CONTEXT.steeringWheelAngleSign = lookupSignal("steering_wheel_angle_sign",
+            signals, signalCount);
+    CONTEXT.latitudeDegrees = lookupSignal("latitude_degrees", signals,
+            signalCount);
+    CONTEXT.latitudeMinutes = lookupSignal("latitude_minutes", signals,
+            signalCount);
+    CONTEXT.latitudeMinuteFraction = lookupSignal("latitude_minute_fraction",
+            signals, signalCount);
+    CONTEXT.longitudeDegrees = lookupSignal("longitude_degrees", signals,
+            signalCount);
+    CONTEXT.longitudeMinutes = lookupSignal("longitude_minutes", signals,
+            signalCount);
+    CONTEXT.longitudeMinuteFraction = lookupSignal("longitude_minute_fraction",
+            signals, signalCount);
+    CONTEXT.buttonType = lookupSignal("button_type", signals, signalCount);
+    CONTEXT.buttonState = lookupSignal("button_state", signals, signalCount);
+    CONTEXT.turnSignalLeft = lookupSignal("turn_signal_left", signals,
+            signalCount);
+    CONTEXT.turnSignalRight = lookupSignal("turn_signal_right", signals,
+            signalCount);
+}
+
+const HandlerContext* openxc::signals::handlers::handlerContext() {
+    return &CONTEXT;
+}
+
+/* Private: Return a signal a handler depends on - the one resolved by
+ * bindHandlers if the handler was called with the bound signal array,
+ * otherwise the result of looking it up by name.
+ */
+static CanSignal* dependentSignal(CanSignal* bound, const char* name,
+        CanSignal* signals, int signalCount) {
+    if(signals != NULL && signals == CONTEXT.signals &&
+            signalCount == CONTEXT.signalCount) {
+        return bound;
+    }
+    return lookupSignal(name, signals, signalCount);
+}
+
+/* Private: Return the value a counter signal is counted on from - its last
+ * value, or the one saved with the handler state if it hasn't been received
+ * since startup.
+ */
+static float countedFrom(CanSignal* signal, float savedValue) {
+    if(!signal->received && stateRestored) {
+        return savedValue;
+    }
+    return signal->lastValue;
+}
+
+void openxc::signals::handlers::saveState() {
+    HandlerState state = {
+        rotationsSinceRestart: rotationsSinceRestart,
+        rotationsLastValue: rotationsLastValue,
+        rollingOdometerSinceRestart: rollingOdometerSinceRestart,
+        rollingOdometerLastValue: rollingOdometerLastValue,
+        totalOdometerAtRestart: totalOdometerAtRestart,
+        fuelConsumedSinceRestartLiters: fuelConsumedSinceRestartLiters,
+        fuelFlowLastValue: fuelFlowLastValue
+    };
+    if(!state_store::store(&state, sizeof(state))) {
+        debug("Unable to save the handler state");
+    }
+}
+
+void openxc::signals::handlers::restoreState() {
+    HandlerState state;
+    if(!state_store::load(&state, sizeof(state))) {
+        return;
+    }
+
+    rotationsSinceRestart = state.rotationsSinceRestart;
+    rotationsLastValue = state.rotationsLastValue;
+    rollingOdometerSinceRestart = state.rollingOdometerSinceRestart;
+    rollingOdometerLastValue = state.rollingOdometerLastValue;
+    totalOdometerAtRestart = state.totalOdometerAtRestart;
+    fuelConsumedSinceRestartLiters = state.fuelConsumedSinceRestartLiters;
+    fuelFlowLastValue = state.fuelFlowLastValue;
+    stateRestored = true;
+}
+
 float firstReceivedOdometerValue(CanSignal* signals, int signalCount) {
     if(totalOdometerAtRestart == 0) {
-        CanSignal* odometerSignal = lookupSignal("total_odometer", signals,
-                signalCount);
+        CanSignal* odometerSignal = dependentSignal(CONTEXT.totalOdometer,
+                "total_odometer", signals, signalCount);
         if(odometerSignal != NULL && odometerSignal->received) {
             totalOdometerAtRestart = odometerSignal->lastValue;
         }
@@ -117,12 +228,13 @@ float firstReceivedOdometerValue(CanSignal* signals, int signalCount) {
 openxc_DynamicField handleRollingOdometer(CanSignal* signal, CanSignal* signals,
        int signalCount, float value, bool* send,
        float factor) {
-    if(value < signal->lastValue) {
-        rollingOdometerSinceRestart += signal->maxValue - signal->lastValue
-            + value;
+    float lastValue = countedFrom(signal, rollingOdometerLastValue);
+    if(value < lastValue) {
+        rollingOdometerSinceRestart += signal->maxValue - lastValue + value;
     } else {
-        rollingOdometerSinceRestart += value - signal->lastValue;
+        rollingOdometerSinceRestart += value - lastValue;
     }
+    rollingOdometerLastValue = value;
 
     return openxc::payload::wrapNumber(firstReceivedOdometerValue(signals, signalCount) +
         (factor * rollingOdometerSinceRestart));
@@ -157,10 +269,12 @@ openxc_DynamicField openxc::signals::handlers::handleStrictBoolean(CanSignal* si
 openxc_DynamicField openxc::signals::handlers::handleFuelFlow(CanSignal* signal,
         CanSignal* signals, int signalCount, float value,
         bool* send, float multiplier) {
-    if(value < signal->lastValue) {
-        value = signal->maxValue - signal->lastValue + value;
+    float lastValue = countedFrom(signal, fuelFlowLastValue);
+    fuelFlowLastValue = value;
+    if(value < lastValue) {
+        value = signal->maxValue - lastValue + value;
     } else {
-        value = value - signal->lastValue;
+        value = value - lastValue;
     }
     fuelConsumedSinceRestartLiters += multiplier * value;
     return openxc::payload::wrapNumber(fuelConsumedSinceRestartLiters);
@@ -187,18 +301,24 @@ openxc_DynamicField openxc::signals::handlers::handleInverted(CanSignal* signal,
 
 void openxc::signals::handlers::handleGpsMessage(CanMessage* message,
         CanSignal* signals, int signalCount, Pipeline* pipeline) {
-    CanSignal* latitudeDegreesSignal =
-        lookupSignal("latitude_degrees", signals, signalCount);
-    CanSignal* latitudeMinutesSignal =
-        lookupSignal("latitude_minutes", signals, signalCount);
-    CanSignal* latitudeMinuteFractionSignal =
-        lookupSignal("latitude_minute_fraction", signals, signalCount);
-    CanSignal* longitudeDegreesSignal =
-        lookupSignal("longitude_degrees", signals, signalCount);
-    CanSignal* longitudeMinutesSignal =
-        lookupSignal("longitude_minutes", signals, signalCount);
-    CanSignal* longitudeMinuteFractionSignal =
-        lookupSignal("longitude_minute_fraction", signals, signalCount);
+    CanSignal* latitudeDegreesSignal = dependentSignal(
+            CONTEXT.latitudeDegrees, "latitude_degrees", signals,
+            signalCount);
+    CanSignal* latitudeMinutesSignal = dependentSignal(
+            CONTEXT.latitudeMinutes, "latitude_minutes", signals,
+            signalCount);
+    CanSignal* latitudeMinuteFractionSignal = dependentSignal(
+            CONTEXT.latitudeMinuteFraction, "latitude_minute_fraction",
+            signals, signalCount);
+    CanSignal* longitudeDegreesSignal = dependentSignal(
+            CONTEXT.longitudeDegrees, "longitude_degrees", signals,
+            signalCount);
+    CanSignal* longitudeMinutesSignal = dependentSignal(
+            CONTEXT.longitudeMinutes, "longitude_minutes", signals,
+            signalCount);
+    CanSignal* longitudeMinuteFractionSignal = dependentSignal(
+            CONTEXT.longitudeMinuteFraction, "longitude_minute_fraction",
+            signals, signalCount);
 
     if(latitudeDegreesSignal == NULL ||
             latitudeMinutesSignal == NULL ||
@@ -244,7 +364,8 @@ openxc_DynamicField openxc::signals::handlers::handleExteriorLightSwitch(CanSign
 openxc_DynamicField openxc::signals::handlers::handleUnsignedSteeringWheelAngle(
         CanSignal* signal, CanSignal* signals, int signalCount,
         Pipeline* pipeline, float value, bool* send) {
-    CanSignal* steeringAngleSign = lookupSignal("steering_wheel_angle_sign",
+    CanSignal* steeringAngleSign = dependentSignal(
+            CONTEXT.steeringWheelAngleSign, "steering_wheel_angle_sign",
             signals, signalCount);
 
     if(steeringAngleSign == NULL) {
@@ -262,21 +383,23 @@ openxc_DynamicField openxc::signals::handlers::handleUnsignedSteeringWheelAngle(
 openxc_DynamicField openxc::signals::handlers::handleMultisizeWheelRotationCount(
         CanSignal* signal, CanSignal* signals, int signalCount,
         float value, bool* send, float tireRadius) {
-    if(value < signal->lastValue) {
-        rotationsSinceRestart += signal->maxValue - signal->lastValue + value;
+    float lastValue = countedFrom(signal, rotationsLastValue);
+    if(value < lastValue) {
+        rotationsSinceRestart += signal->maxValue - lastValue + value;
     } else {
-        rotationsSinceRestart += value - signal->lastValue;
+        rotationsSinceRestart += value - lastValue;
     }
+    rotationsLastValue = value;
     return openxc::payload::wrapNumber(firstReceivedOdometerValue(signals,
             signalCount) + (2 * PI * tireRadius * rotationsSinceRestart));
 }
 
 void openxc::signals::handlers::handleButtonEventMessage(CanMessage* message,
         CanSignal* signals, int signalCount, Pipeline* pipeline) {
-    CanSignal* buttonTypeSignal = lookupSignal("button_type", signals,
-            signalCount);
-    CanSignal* buttonStateSignal = lookupSignal("button_state", signals,
-            signalCount);
+    CanSignal* buttonTypeSignal = dependentSignal(CONTEXT.buttonType,
+            "button_type", signals, signalCount);
+    CanSignal* buttonStateSignal = dependentSignal(CONTEXT.buttonState,
+            "button_state", signals, signalCount);
 
     if(buttonTypeSignal == NULL || buttonStateSignal == NULL) {
         debug("Unable to find button type and state signals");
@@ -311,9 +434,11 @@ void openxc::signals::handlers::handleTurnSignalCommand(const char* name,
     const char* direction = value->string_value;
     CanSignal* signal = NULL;
     if(!strcmp("left", direction)) {
-        signal = lookupSignal("turn_signal_left", signals, signalCount);
+        signal = dependentSignal(CONTEXT.turnSignalLeft, "turn_signal_left",
+                signals, signalCount);
     } else if(!strcmp("right", direction)) {
-        signal = lookupSignal("turn_signal_right", signals, signalCount);
+        signal = dependentSignal(CONTEXT.turnSignalRight,
+                "turn_signal_right", signals, signalCount);
     }
 
     if(signal != NULL) {
@@ -6,6 +6,14 @@
 #include "interface/usb.h"
 #include "diagnostics.h"
 
+/* Public: Set to 1 to save the counter handlers' running totals when the VI
+ * suspends, and load them again when it starts, so the signals derived from
+ * them are right from the first frame after a reset. See saveState().
+ */
+#ifndef PERSIST_HANDLER_STATE
+#define PERSIST_HANDLER_STATE 0
+#endif
+
 namespace openxc {
 namespace signals {
 namespace handlers {
@@ -22,6 +30,55 @@ extern const char TIRE_PRESSURE_GENERIC_NAME[];
 extern const float PI;
 #endif
 
+/* Public: The other signals the shared handlers depend on, resolved by name
+ * once by bindHandlers instead of on every frame. Any that aren't in the
+ * signal array are NULL.
+ *
+ * signals - The signal array the context was bound to. Handlers called with
+ *      any other array look their signals up by name as before.
+ * signalCount - The length of the signals array.
+ */
+struct HandlerContext {
+    CanSignal* signals;
+    int signalCount;
+    CanSignal* totalOdometer;
+    CanSignal* steeringWheelAngleSign;
+    CanSignal* latitudeDegrees;
+    CanSignal* latitudeMinutes;
+    CanSignal* latitudeMinuteFraction;
+    CanSignal* longitudeDegrees;
+    CanSignal* longitudeMinutes;
+    CanSignal* longitudeMinuteFraction;
+    CanSignal* buttonType;
+    CanSignal* buttonState;
+    CanSignal* turnSignalLeft;
+    CanSignal* turnSignalRight;
+};
+typedef struct HandlerContext HandlerContext;
+
+/* Public: Resolve the signals the shared handlers depend on. Call this once
+ * the active message set is known, e.g. right after signals::initialize().
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ */
+void bindHandlers(CanSignal* signals, int signalCount);
+
+/* Public: Return the context last bound by bindHandlers. */
+const HandlerContext* handlerContext();
+
+/* Public: Save the running totals the counter handlers keep - wheel
+ * rotations, the rolling odometer and fuel consumed - to the state store, so
+ * they carry on from the same values after a suspend or reset instead of
+ * starting over. See PERSIST_HANDLER_STATE.
+ */
+void saveState();
+
+/* Public: Load the running totals last saved by saveState(), if there are
+ * any. Call this once at startup, after the state store is initialized.
+ */
+void restoreState();
+
 /* Interpret the given signal as a wheel rotation counter, and transform it to
  * an absolute distance travelled since the car was started.
  *
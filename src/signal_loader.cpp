@@ -0,0 +1,362 @@
+#include "signal_loader.h"
+#include "signals.h"
+#include "config.h"
+#include "can/canread.h"
+#include "util/log.h"
+#include <string.h>
+
+namespace can = openxc::can;
+
+using openxc::util::log::debug;
+using openxc::config::getConfiguration;
+using openxc::pipeline::Pipeline;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+
+#if LOADABLE_SIGNAL_COUNT > 0
+
+/* Private: The same layout as CanSignalState, whose members are const so it
+ * can't be kept in a pool that's filled in at runtime.
+ */
+typedef struct {
+    int value;
+    const char* name;
+} LoadedSignalState;
+
+static CanMessageDefinition LOADED_MESSAGES[LOADABLE_MESSAGE_COUNT];
+static CanSignal LOADED_SIGNALS[LOADABLE_SIGNAL_COUNT];
+static LoadedSignalState LOADED_STATES[LOADABLE_SIGNAL_STATE_COUNT];
+
+// Images read from the SD card or received with the signal_definitions command
+// are kept here, since the loaded names point into them.
+static uint32_t IMAGE_BUFFER[SIGNAL_DEFINITIONS_MAX_SIZE / sizeof(uint32_t)];
+static size_t imageBufferLength = 0;
+
+static int loadedMessageCount = 0;
+static int loadedSignalCount = 0;
+static int loadedMessageSetIndex = -1;
+
+static uint32_t readLittleEndian(const uint8_t* buffer, size_t size) {
+    uint32_t value = 0;
+    for(size_t i = 0; i < size; i++) {
+        value |= (uint32_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+static float readFloat(const uint8_t* buffer) {
+    uint32_t bits = readLittleEndian(buffer, sizeof(uint32_t));
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Private: Return the NUL terminated name at an offset in the image, or NULL if
+ * it runs past the end.
+ */
+static const char* readName(const uint8_t* image, size_t length,
+        size_t offset) {
+    if(offset >= length || memchr(&image[offset], '\0',
+                length - offset) == NULL) {
+        return NULL;
+    }
+    return (const char*) &image[offset];
+}
+
+static SignalDecoder lookupDecoder(uint8_t decoder) {
+    switch(decoder) {
+    case openxc::signals::loader::SIGNAL_DEFINITION_BOOLEAN:
+        return can::read::booleanDecoder;
+    case openxc::signals::loader::SIGNAL_DEFINITION_STATE:
+        return can::read::stateDecoder;
+    case openxc::signals::loader::SIGNAL_DEFINITION_IGNORE:
+        return can::read::ignoreDecoder;
+    default:
+        return NULL;
+    }
+}
+
+/* Private: Drop the loaded definitions and their acceptance filters.
+ */
+static void clear() {
+    if(loadedMessageCount > 0 &&
+            loadedMessageSetIndex == getConfiguration()->messageSetIndex) {
+        can::beginAcceptanceFilterUpdate();
+        for(int i = 0; i < loadedMessageCount; i++) {
+            can::removeAcceptanceFilter(LOADED_MESSAGES[i].bus,
+                    LOADED_MESSAGES[i].id, LOADED_MESSAGES[i].format,
+                    getCanBuses(), getCanBusCount());
+        }
+        can::commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount());
+    }
+    loadedMessageCount = 0;
+    loadedSignalCount = 0;
+    loadedMessageSetIndex = -1;
+}
+
+static bool loadMessages(const uint8_t* records, int count) {
+    for(int i = 0; i < count; i++) {
+        const uint8_t* record = &records[i * SIGNAL_DEFINITION_MESSAGE_SIZE];
+        CanBus* bus = can::lookupBus(record[4], getCanBuses(),
+                getCanBusCount());
+        if(bus == NULL) {
+            debug("Signal definitions refer to unknown bus %d", record[4]);
+            return false;
+        }
+
+        CanMessageDefinition* message = &LOADED_MESSAGES[i];
+        memset(message, 0, sizeof(CanMessageDefinition));
+        message->bus = bus;
+        message->id = readLittleEndian(&record[0], sizeof(uint32_t));
+        message->format = record[5] ? CanMessageFormat::EXTENDED :
+                CanMessageFormat::STANDARD;
+        openxc::util::time::initializeClock(&message->frequencyClock);
+        message->frequencyClock.frequency = readFloat(&record[8]);
+        message->forceSendChanged = record[6];
+    }
+    return true;
+}
+
+static bool loadStates(const uint8_t* image, size_t length,
+        const uint8_t* records, int count) {
+    for(int i = 0; i < count; i++) {
+        const uint8_t* record = &records[i * SIGNAL_DEFINITION_STATE_SIZE];
+        LOADED_STATES[i].value = (int32_t) readLittleEndian(&record[0],
+                sizeof(uint32_t));
+        LOADED_STATES[i].name = readName(image, length,
+                readLittleEndian(&record[4], sizeof(uint16_t)));
+        if(LOADED_STATES[i].name == NULL) {
+            debug("Signal state %d has no name", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool loadSignals(const uint8_t* image, size_t length,
+        const uint8_t* records, int count, int messageCount, int stateCount) {
+    for(int i = 0; i < count; i++) {
+        const uint8_t* record = &records[i * SIGNAL_DEFINITION_SIGNAL_SIZE];
+        int message = readLittleEndian(&record[0], sizeof(uint16_t));
+        int firstState = readLittleEndian(&record[28], sizeof(uint16_t));
+        CanSignal* signal = &LOADED_SIGNALS[i];
+        memset(signal, 0, sizeof(CanSignal));
+
+        signal->genericName = readName(image, length,
+                readLittleEndian(&record[2], sizeof(uint16_t)));
+        if(signal->genericName == NULL || message >= messageCount ||
+                record[5] == 0 ||
+                record[4] + record[5] > CAN_MAX_MESSAGE_SIZE * 8 ||
+                firstState + record[30] > stateCount) {
+            debug("Signal %d is malformed", i);
+            return false;
+        }
+
+        signal->message = &LOADED_MESSAGES[message];
+        signal->bitPosition = record[4];
+        signal->bitSize = record[5];
+        signal->decoder = lookupDecoder(record[6]);
+        signal->sendSame = record[7] & SIGNAL_DEFINITION_SEND_SAME;
+        signal->forceSendChanged = record[7] & SIGNAL_DEFINITION_FORCE_SEND;
+        signal->factor = readFloat(&record[8]);
+        signal->offset = readFloat(&record[12]);
+        signal->minValue = readFloat(&record[16]);
+        signal->maxValue = readFloat(&record[20]);
+        openxc::util::time::initializeClock(&signal->frequencyClock);
+        signal->frequencyClock.frequency = readFloat(&record[24]);
+        if(record[30] > 0) {
+            signal->states = (const CanSignalState*) &LOADED_STATES[firstState];
+            signal->stateCount = record[30];
+        }
+        signal->decimalPlaces = record[31];
+        signal->extraction = SIGNAL_EXTRACTION_UNPREPARED;
+        signal->stateLookup = SIGNAL_STATES_UNPREPARED;
+    }
+    return true;
+}
+
+bool openxc::signals::loader::load(const uint8_t* image, size_t length) {
+    clear();
+    if(image == NULL) {
+        return false;
+    }
+
+    if(length < SIGNAL_DEFINITIONS_HEADER_SIZE ||
+            readLittleEndian(&image[0], sizeof(uint32_t)) !=
+                SIGNAL_DEFINITIONS_MAGIC ||
+            image[4] != SIGNAL_DEFINITIONS_VERSION) {
+        debug("Not a signal definitions image");
+        return false;
+    }
+
+    int messageCount = readLittleEndian(&image[6], sizeof(uint16_t));
+    int signalCount = readLittleEndian(&image[8], sizeof(uint16_t));
+    int stateCount = readLittleEndian(&image[10], sizeof(uint16_t));
+    size_t imageLength = readLittleEndian(&image[12], sizeof(uint32_t));
+    size_t recordsLength = SIGNAL_DEFINITIONS_HEADER_SIZE +
+            messageCount * SIGNAL_DEFINITION_MESSAGE_SIZE +
+            signalCount * SIGNAL_DEFINITION_SIGNAL_SIZE +
+            stateCount * SIGNAL_DEFINITION_STATE_SIZE;
+    if(imageLength > length || recordsLength > imageLength) {
+        debug("Signal definitions image is truncated");
+        return false;
+    }
+
+    if(messageCount > LOADABLE_MESSAGE_COUNT ||
+            signalCount > LOADABLE_SIGNAL_COUNT ||
+            stateCount > LOADABLE_SIGNAL_STATE_COUNT) {
+        debug("%d messages, %d signals and %d states don't fit in the loader",
+                messageCount, signalCount, stateCount);
+        return false;
+    }
+
+    const uint8_t* messages = &image[SIGNAL_DEFINITIONS_HEADER_SIZE];
+    const uint8_t* signals = messages +
+            messageCount * SIGNAL_DEFINITION_MESSAGE_SIZE;
+    const uint8_t* states = signals +
+            signalCount * SIGNAL_DEFINITION_SIGNAL_SIZE;
+    if(!loadMessages(messages, messageCount) ||
+            !loadStates(image, imageLength, states, stateCount) ||
+            !loadSignals(image, imageLength, signals, signalCount,
+                messageCount, stateCount)) {
+        return false;
+    }
+
+    loadedMessageCount = messageCount;
+    loadedSignalCount = signalCount;
+    loadedMessageSetIndex = getConfiguration()->messageSetIndex;
+
+    can::beginAcceptanceFilterUpdate();
+    for(int i = 0; i < loadedMessageCount; i++) {
+        can::addAcceptanceFilter(LOADED_MESSAGES[i].bus, LOADED_MESSAGES[i].id,
+                LOADED_MESSAGES[i].format, getCanBuses(), getCanBusCount());
+    }
+    can::commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount());
+    can::read::indexSignalDispatch(LOADED_SIGNALS, loadedSignalCount);
+    can::read::staggerSignalClocks(LOADED_SIGNALS, loadedSignalCount);
+
+    debug("Loaded %d signals in %d messages", loadedSignalCount,
+            loadedMessageCount);
+    return true;
+}
+
+bool openxc::signals::loader::receive(size_t offset, const uint8_t* data,
+        size_t length) {
+    if(offset == 0) {
+        imageBufferLength = 0;
+    }
+
+    if(offset != imageBufferLength ||
+            offset + length > sizeof(IMAGE_BUFFER)) {
+        debug("Signal definitions chunk at %d is out of order or too large",
+                (int) offset);
+        return false;
+    }
+
+    uint8_t* image = (uint8_t*) IMAGE_BUFFER;
+    if(imageBufferLength == 0) {
+        // the definitions being replaced point into this buffer
+        clear();
+    }
+    memcpy(&image[offset], data, length);
+    imageBufferLength += length;
+
+    if(imageBufferLength < SIGNAL_DEFINITIONS_HEADER_SIZE ||
+            imageBufferLength < readLittleEndian(&image[12],
+                sizeof(uint32_t))) {
+        return true;
+    }
+    return load(image, imageBufferLength);
+}
+
+#ifdef FS_SUPPORT
+bool openxc::signals::loader::loadFile(
+        openxc::interface::fs::FsDevice* device) {
+    clear();
+    int length = openxc::interface::fs::readFile(device,
+            SIGNAL_DEFINITIONS_FILE, (uint8_t*) IMAGE_BUFFER,
+            sizeof(IMAGE_BUFFER));
+    if(length <= 0) {
+        return false;
+    }
+    imageBufferLength = length;
+    return load((uint8_t*) IMAGE_BUFFER, imageBufferLength);
+}
+#endif
+
+bool openxc::signals::loader::loaded() {
+    return loadedMessageCount > 0 &&
+            loadedMessageSetIndex == getConfiguration()->messageSetIndex;
+}
+
+CanMessageDefinition* openxc::signals::loader::getMessages() {
+    return LOADED_MESSAGES;
+}
+
+int openxc::signals::loader::getMessageCount() {
+    return loadedMessageCount;
+}
+
+CanSignal* openxc::signals::loader::getSignals() {
+    return LOADED_SIGNALS;
+}
+
+int openxc::signals::loader::getSignalCount() {
+    return loadedSignalCount;
+}
+
+bool openxc::signals::loader::decodeCanMessage(Pipeline* pipeline,
+        CanBus* bus, CanMessage* message) {
+    if(!loaded()) {
+        return false;
+    }
+    can::read::dispatchMessage(bus, message, LOADED_MESSAGES,
+            loadedMessageCount, LOADED_SIGNALS, loadedSignalCount, pipeline);
+    return true;
+}
+
+#else
+
+bool openxc::signals::loader::load(const uint8_t* image, size_t length) {
+    debug("Built without LOADABLE_SIGNAL_COUNT, can't load signals");
+    return false;
+}
+
+bool openxc::signals::loader::receive(size_t offset, const uint8_t* data,
+        size_t length) {
+    return load(data, length);
+}
+
+#ifdef FS_SUPPORT
+bool openxc::signals::loader::loadFile(
+        openxc::interface::fs::FsDevice* device) {
+    return false;
+}
+#endif
+
+bool openxc::signals::loader::loaded() {
+    return false;
+}
+
+CanMessageDefinition* openxc::signals::loader::getMessages() {
+    return NULL;
+}
+
+int openxc::signals::loader::getMessageCount() {
+    return 0;
+}
+
+CanSignal* openxc::signals::loader::getSignals() {
+    return NULL;
+}
+
+int openxc::signals::loader::getSignalCount() {
+    return 0;
+}
+
+bool openxc::signals::loader::decodeCanMessage(Pipeline* pipeline,
+        CanBus* bus, CanMessage* message) {
+    return false;
+}
+
+#endif // LOADABLE_SIGNAL_COUNT > 0
@@ -0,0 +1,166 @@
+#ifndef __SIGNAL_LOADER_H__
+#define __SIGNAL_LOADER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "can/canutil.h"
+#include "pipeline.h"
+
+#ifdef FS_SUPPORT
+#include "interface/fs.h"
+#endif
+
+// The number of signals that can be loaded at runtime. Use 0 to leave the
+// loader out of the firmware.
+#ifndef LOADABLE_SIGNAL_COUNT
+#define LOADABLE_SIGNAL_COUNT 0
+#endif
+
+#ifndef LOADABLE_MESSAGE_COUNT
+#define LOADABLE_MESSAGE_COUNT 32
+#endif
+
+#ifndef LOADABLE_SIGNAL_STATE_COUNT
+#define LOADABLE_SIGNAL_STATE_COUNT 64
+#endif
+
+// The largest image that can be read from the SD card or received with the
+// signal_definitions command. Images linked into flash can be any size.
+#ifndef SIGNAL_DEFINITIONS_MAX_SIZE
+#define SIGNAL_DEFINITIONS_MAX_SIZE 2048
+#endif
+
+// Read from the VI_LOG directory of the SD card when it's mounted.
+#define SIGNAL_DEFINITIONS_FILE "SIGNALS.BIN"
+
+// A signal definitions image is a header, followed by the message, signal and
+// state records and then the NUL terminated names. All fields are little
+// endian and floats are IEEE 754 singles. Names are referred to by their
+// offset from the start of the image, and are used in place.
+//
+// Header:
+//  0: uint32 magic, SIGNAL_DEFINITIONS_MAGIC ("OXSD")
+//  4: uint8 version, SIGNAL_DEFINITIONS_VERSION
+//  5: uint8 reserved, 0
+//  6: uint16 message count
+//  8: uint16 signal count
+// 10: uint16 state count
+// 12: uint32 length of the whole image
+//
+// Message record:
+//  0: uint32 message ID
+//  4: uint8 bus address
+//  5: uint8 1 if the ID is 29 bits
+//  6: uint8 1 to send a changed value regardless of the max frequency
+//  7: uint8 reserved, 0
+//  8: float max frequency, 0 for no limit
+//
+// Signal record:
+//  0: uint16 index of its message record
+//  2: uint16 offset of its name
+//  4: uint8 bit position
+//  5: uint8 bit size
+//  6: uint8 decoder, a SignalDefinitionDecoder
+//  7: uint8 flags, SIGNAL_DEFINITION_SEND_SAME | SIGNAL_DEFINITION_FORCE_SEND
+//  8: float factor
+// 12: float offset
+// 16: float min value
+// 20: float max value
+// 24: float max frequency, 0 for no limit
+// 28: uint16 index of its first state record
+// 30: uint8 number of state records
+// 31: uint8 decimal places, 0 to send the full value
+//
+// State record:
+//  0: int32 value
+//  4: uint16 offset of its name
+//  6: uint16 reserved, 0
+#define SIGNAL_DEFINITIONS_MAGIC 0x4453584f
+#define SIGNAL_DEFINITIONS_VERSION 1
+#define SIGNAL_DEFINITIONS_HEADER_SIZE 16
+#define SIGNAL_DEFINITION_MESSAGE_SIZE 12
+#define SIGNAL_DEFINITION_SIGNAL_SIZE 32
+#define SIGNAL_DEFINITION_STATE_SIZE 8
+#define SIGNAL_DEFINITION_SEND_SAME 0x1
+#define SIGNAL_DEFINITION_FORCE_SEND 0x2
+
+namespace openxc {
+namespace signals {
+namespace loader {
+
+/* Public: The decoders a loaded signal can use.
+ */
+typedef enum {
+    SIGNAL_DEFINITION_NUMERIC = 0,
+    SIGNAL_DEFINITION_BOOLEAN = 1,
+    SIGNAL_DEFINITION_STATE = 2,
+    SIGNAL_DEFINITION_IGNORE = 3,
+} SignalDefinitionDecoder;
+
+/* Public: Replace the loaded signal definitions with the ones in an image
+ * (see SIGNAL_DEFINITIONS_MAGIC for the format).
+ *
+ * The definitions are built in the same tables the generated code uses, bound
+ * to the active message set's buses by address, and their messages are added
+ * to the acceptance filters. The image isn't copied - signal and state names
+ * point into it - so it must stay put while it's loaded, e.g. be linked into
+ * flash.
+ *
+ * image - The image, or NULL to clear the loaded definitions.
+ * length - The number of bytes available at image.
+ *
+ * Returns true if the definitions were loaded. If the image is malformed,
+ * refers to a bus that isn't in the active message set or doesn't fit in
+ * LOADABLE_SIGNAL_COUNT, LOADABLE_MESSAGE_COUNT or LOADABLE_SIGNAL_STATE_COUNT,
+ * nothing is loaded and the previous definitions are cleared.
+ */
+bool load(const uint8_t* image, size_t length);
+
+/* Public: Receive part of an image into the loader's own buffer, and load it
+ * once the whole image has arrived.
+ *
+ * offset - The position of the data in the image. 0 starts a new image.
+ * data - The bytes of the image.
+ * length - The number of bytes at data.
+ *
+ * Returns true if the data was stored and, if the image is complete, loaded.
+ */
+bool receive(size_t offset, const uint8_t* data, size_t length);
+
+#ifdef FS_SUPPORT
+/* Public: Load SIGNAL_DEFINITIONS_FILE from the SD card into the loader's own
+ * buffer, if it exists.
+ *
+ * device - The mounted SD card.
+ *
+ * Returns true if definitions were loaded from the card.
+ */
+bool loadFile(openxc::interface::fs::FsDevice* device);
+#endif
+
+/* Public: Return true if signal definitions are loaded for the active message
+ * set.
+ */
+bool loaded();
+
+CanMessageDefinition* getMessages();
+
+int getMessageCount();
+
+CanSignal* getSignals();
+
+int getSignalCount();
+
+/* Public: Decode a received CAN message with the loaded definitions, in place
+ * of signals::decodeCanMessage.
+ *
+ * Returns true if definitions are loaded, whether or not this message had one.
+ */
+bool decodeCanMessage(openxc::pipeline::Pipeline* pipeline, CanBus* bus,
+        CanMessage* message);
+
+} // namespace loader
+} // namespace signals
+} // namespace openxc
+
+#endif // __SIGNAL_LOADER_H__
@@ -0,0 +1,77 @@
+#include "snapshot.h"
+#include "obd2.h"
+#include "power.h"
+#include "config.h"
+#include "util/log.h"
+#include "util/timer.h"
+
+namespace time = openxc::util::time;
+namespace obd2 = openxc::diagnostics::obd2;
+
+using openxc::util::log::debug;
+using openxc::diagnostics::DiagnosticsManager;
+using openxc::pipeline::Pipeline;
+using openxc::config::getConfiguration;
+using openxc::config::PowerManagement;
+
+#define MS_PER_SECOND 1000
+
+static const uint8_t SNAPSHOT_PIDS[] = {SNAPSHOT_OBD2_PIDS};
+
+static bool snapshotActive = false;
+static unsigned long snapshotStartMs;
+
+bool openxc::snapshot::start(DiagnosticsManager* manager) {
+    snapshotActive = false;
+    if(SNAPSHOT_INTERVAL_S == 0 || !power::wokeFromTimer() ||
+            (getConfiguration()->powerManagement ==
+                PowerManagement::OBD2_IGNITION_CHECK &&
+            !getConfiguration()->passiveIgnitionCheck)) {
+        return false;
+    }
+
+    debug("Woke up on the timer, taking a diagnostic snapshot");
+    if(manager->obd2Bus != NULL) {
+        DiagnosticRequest request = {
+                arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
+                mode: 0x1,
+                has_pid: true};
+        for(size_t i = 0; i < sizeof(SNAPSHOT_PIDS); i++) {
+            request.pid = SNAPSHOT_PIDS[i];
+            diagnostics::addRequest(manager, manager->obd2Bus, &request,
+                    obd2::pidName(request.pid), false, obd2::handleObd2Pid,
+                    NULL);
+        }
+        #if SNAPSHOT_DTCS
+        obd2::requestDtcs(manager);
+        #endif
+    } else {
+        debug("No OBD-II bus for the snapshot's requests");
+    }
+
+    snapshotActive = true;
+    snapshotStartMs = time::systemTimeMs();
+    return true;
+}
+
+bool openxc::snapshot::active() {
+    return snapshotActive;
+}
+
+bool openxc::snapshot::update(Pipeline* pipeline) {
+    if(!snapshotActive) {
+        return false;
+    }
+
+    unsigned long elapsedMs = time::systemTimeMs() - snapshotStartMs;
+    if(elapsedMs < SNAPSHOT_WINDOW_S * MS_PER_SECOND) {
+        return false;
+    } else if(!openxc::pipeline::sendQueuesEmpty(pipeline) &&
+            elapsedMs < 2 * SNAPSHOT_WINDOW_S * MS_PER_SECOND) {
+        return false;
+    }
+
+    debug("Diagnostic snapshot finished after %lums", elapsedMs);
+    snapshotActive = false;
+    return true;
+}
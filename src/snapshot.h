@@ -0,0 +1,66 @@
+/* Periodic diagnostic snapshots while the vehicle is off. While suspended, a
+ * timer wakes the VI every SNAPSHOT_INTERVAL_S, it sends a few one-time
+ * diagnostic requests - e.g. the battery voltage and stored trouble codes -
+ * and goes back to sleep once the answers are out to its outputs, so the SD
+ * card or cellular upload sees the vehicle's state on a schedule without the
+ * VI staying awake.
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "diagnostics.h"
+#include "pipeline.h"
+
+// How often to wake from a suspend for a snapshot, in seconds. Use 0 to only
+// wake on CAN activity. The LPC17xx can wait at most 4294 seconds.
+#ifndef SNAPSHOT_INTERVAL_S
+#define SNAPSHOT_INTERVAL_S 0
+#endif
+
+// How long a snapshot stays awake for responses, the GPS and the outputs to
+// come up, before suspending again. If the outputs still have something queued,
+// it waits up to twice as long for them to catch up.
+#ifndef SNAPSHOT_WINDOW_S
+#define SNAPSHOT_WINDOW_S 30
+#endif
+
+// The mode 1 PIDs requested in a snapshot, comma separated.
+#ifndef SNAPSHOT_OBD2_PIDS
+#define SNAPSHOT_OBD2_PIDS 0x42, 0x5
+#endif
+
+// 1 to also request the stored trouble codes in a snapshot.
+#ifndef SNAPSHOT_DTCS
+#define SNAPSHOT_DTCS 1
+#endif
+
+namespace openxc {
+namespace snapshot {
+
+/* Public: Start a snapshot if the wake timer woke the VI, sending its
+ * diagnostic requests on the OBD-II bus. Call this once at startup, after
+ * diagnostics are initialized.
+ *
+ * It's skipped when actively checking the ignition over OBD-II, which already
+ * wakes the VI on the watchdog to send its own requests.
+ *
+ * Returns true if a snapshot started, in which case the outputs should be
+ * brought up.
+ */
+bool start(openxc::diagnostics::DiagnosticsManager* manager);
+
+/* Public: Return true while a snapshot is in progress. */
+bool active();
+
+/* Public: Check whether a snapshot in progress is over. Call this from the main
+ * loop instead of the usual check for CAN going quiet.
+ *
+ * Returns true once the window is over and the outputs' send queues are empty,
+ * or it's run twice as long as the window, and the VI should suspend.
+ */
+bool update(openxc::pipeline::Pipeline* pipeline);
+
+} // namespace snapshot
+} // namespace openxc
+
+#endif // __SNAPSHOT_H__
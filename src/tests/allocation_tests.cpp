@@ -0,0 +1,250 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_spy.h"
+#include "signals.h"
+#include "config.h"
+#include "pipeline.h"
+#include "can/canread.h"
+#include "commands/commands.h"
+
+namespace usb = openxc::interface::usb;
+namespace can = openxc::can;
+namespace pipeline = openxc::pipeline;
+namespace spy = openxc::util::memory::spy;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+using openxc::commands::handleIncomingMessage;
+using openxc::payload::PayloadFormat;
+using openxc::interface::InterfaceDescriptor;
+using openxc::interface::InterfaceType;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+// How many of each message to send through, so anything that only allocates
+// now and then - e.g. when a buffer fills - gets the chance to
+#define MESSAGE_COUNT 20
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+InterfaceDescriptor DESCRIPTOR = {
+    allowRawWrites: true,
+    type: InterfaceType::USB
+};
+
+static void resetQueues() {
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+}
+
+static void publishSimple() {
+    can::read::publishNumericalMessage("vehicle_speed", 42.5,
+            &getConfiguration()->pipeline);
+}
+
+static void publishCan() {
+    CanBus* bus = &getCanBuses()[0];
+    bus->passthroughCanMessages = true;
+    CanMessage message = {
+        id: 0x42,
+        format: CanMessageFormat::STANDARD,
+        data: {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0},
+        length: 8
+    };
+    can::read::passthroughMessage(bus, &message, NULL, 0,
+            &getConfiguration()->pipeline);
+}
+
+static void publishDiagnostic() {
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_DIAGNOSTIC;
+    message.has_diagnostic_response = true;
+    message.diagnostic_response.bus = 1;
+    message.diagnostic_response.message_id = 0x7e8;
+    message.diagnostic_response.mode = 1;
+    message.diagnostic_response.success = true;
+    message.diagnostic_response.has_pid = true;
+    message.diagnostic_response.pid = 12;
+    message.diagnostic_response.has_payload = true;
+    message.diagnostic_response.payload.size = 2;
+    message.diagnostic_response.payload.bytes[0] = 0x1a;
+    message.diagnostic_response.payload.bytes[1] = 0xf8;
+    pipeline::publish(&message, &getConfiguration()->pipeline);
+}
+
+/* Private: Publish a message many times in a payload format, emptying the
+ * output queue between each so none are dropped, and return the number of
+ * heap allocations it took.
+ */
+static int countPublishAllocations(PayloadFormat format,
+        void (*publish)()) {
+    getConfiguration()->payloadFormat = format;
+    bool published = false;
+    spy::resetAllocationCount();
+    for(int i = 0; i < MESSAGE_COUNT; i++) {
+        FAKE_TIME += 1000;
+        publish();
+        pipeline::process(&getConfiguration()->pipeline);
+        published = published || !BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
+        BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    }
+    int allocations = spy::getAllocationCount();
+
+    ck_assert(published);
+    return allocations;
+}
+
+/* Private: Handle a command many times and return the number of heap
+ * allocations it took.
+ */
+static int countCommandAllocations(PayloadFormat format, uint8_t* request,
+        size_t requestLength) {
+    getConfiguration()->payloadFormat = format;
+    size_t handled = 0;
+    spy::resetAllocationCount();
+    for(int i = 0; i < MESSAGE_COUNT; i++) {
+        handled += handleIncomingMessage(request, requestLength, &DESCRIPTOR);
+        BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+        QUEUE_INIT(CanMessage, &getCanBuses()[0].sendQueue);
+    }
+    int allocations = spy::getAllocationCount();
+
+    ck_assert(handled > 0);
+    return allocations;
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    initializeVehicleInterface();
+    resetQueues();
+}
+
+void teardown() {
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    getCanBuses()[0].passthroughCanMessages = false;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_shim_counts_allocations)
+{
+    spy::resetAllocationCount();
+    void* pointer = malloc(16);
+    pointer = realloc(pointer, 32);
+    free(pointer);
+    free(calloc(4, 4));
+    int allocations = spy::getAllocationCount();
+    ck_assert_int_eq(allocations, 3);
+}
+END_TEST
+
+START_TEST (test_publish_simple)
+{
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::JSON,
+                publishSimple), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::PROTOBUF,
+                publishSimple), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::MESSAGEPACK,
+                publishSimple), 0);
+    ck_assert_int_eq(countPublishAllocations(
+                PayloadFormat::MESSAGEPACK_COMPACT, publishSimple), 0);
+}
+END_TEST
+
+START_TEST (test_publish_can)
+{
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::JSON,
+                publishCan), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::PROTOBUF,
+                publishCan), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::MESSAGEPACK,
+                publishCan), 0);
+    ck_assert_int_eq(countPublishAllocations(
+                PayloadFormat::MESSAGEPACK_COMPACT, publishCan), 0);
+}
+END_TEST
+
+START_TEST (test_publish_diagnostic)
+{
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::JSON,
+                publishDiagnostic), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::PROTOBUF,
+                publishDiagnostic), 0);
+    ck_assert_int_eq(countPublishAllocations(PayloadFormat::MESSAGEPACK,
+                publishDiagnostic), 0);
+}
+END_TEST
+
+START_TEST (test_json_command)
+{
+    uint8_t request[] = "{\"command\": \"version\"}\0";
+    ck_assert_int_eq(countCommandAllocations(PayloadFormat::JSON, request,
+                sizeof(request)), 0);
+}
+END_TEST
+
+START_TEST (test_json_can_write)
+{
+    uint8_t request[] = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"}\0";
+    ck_assert_int_eq(countCommandAllocations(PayloadFormat::JSON, request,
+                sizeof(request)), 0);
+}
+END_TEST
+
+START_TEST (test_messagepack_can_write)
+{
+    //{"bus": 1,"id": 42,"data":"0x1234"};
+    uint8_t request[21] = {
+        0x83, 0xA3, 0x62, 0x75, 0x73, 0xCC, 0x01, 0xA2,
+        0x69, 0x64, 0xCC, 0x2A, 0xA4, 0x64, 0x61, 0x74,
+        0x61, 0xC4, 0x02, 0x12, 0x34
+    };
+    ck_assert_int_eq(countCommandAllocations(PayloadFormat::MESSAGEPACK,
+                request, sizeof(request)), 0);
+}
+END_TEST
+
+Suite* allocationSuite(void) {
+    Suite* s = suite_create("allocation");
+    TCase *tc_shim = tcase_create("shim");
+    tcase_add_test(tc_shim, test_shim_counts_allocations);
+    suite_add_tcase(s, tc_shim);
+
+    TCase *tc_publish = tcase_create("publish");
+    tcase_add_checked_fixture(tc_publish, setup, teardown);
+    tcase_add_test(tc_publish, test_publish_simple);
+    tcase_add_test(tc_publish, test_publish_can);
+    tcase_add_test(tc_publish, test_publish_diagnostic);
+    suite_add_tcase(s, tc_publish);
+
+    TCase *tc_commands = tcase_create("commands");
+    tcase_add_checked_fixture(tc_commands, setup, teardown);
+    tcase_add_test(tc_commands, test_json_command);
+    tcase_add_test(tc_commands, test_json_can_write);
+    tcase_add_test(tc_commands, test_messagepack_can_write);
+    suite_add_tcase(s, tc_commands);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = allocationSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include <check.h>
+#include <stdint.h>
+#include "signals.h"
+#include "can/autobaud.h"
+#include "config.h"
+
+#include "canutil_spy.h"
+
+namespace can = openxc::can;
+namespace autobaud = openxc::can::autobaud;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+
+extern unsigned long FAKE_TIME;
+
+CanBus* bus;
+
+void setup() {
+    FAKE_TIME = 1000;
+    can::spy::setErrorCounters(0, 0, false);
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+    bus->speed = 500000;
+    bus->bypassFilters = false;
+}
+
+void teardown() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+/* Private: Let the search listen for one dwell, hearing messages from a
+ * vehicle whose bus runs at vehicleSpeed.
+ */
+void listen(unsigned int vehicleSpeed) {
+    if(can::spy::bitRate() == vehicleSpeed) {
+        bus->messagesReceived += CAN_AUTO_BAUD_MIN_FRAMES;
+    }
+    autobaud::update(bus, true, getCanBuses(), getCanBusCount());
+    FAKE_TIME += CAN_AUTO_BAUD_DWELL_MS;
+    autobaud::update(bus, true, getCanBuses(), getCanBusCount());
+}
+
+START_TEST (test_start_listens_at_configured_speed)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    ck_assert(autobaud::searching(bus));
+    ck_assert_int_eq(can::spy::bitRate(), 500000);
+    ck_assert(can::spy::listenOnly());
+    ck_assert(bus->bypassFilters);
+}
+END_TEST
+
+START_TEST (test_locks_on_configured_speed)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    listen(500000);
+    ck_assert(!autobaud::searching(bus));
+    ck_assert_int_eq(bus->speed, 500000);
+    ck_assert_int_eq(can::spy::bitRate(), 500000);
+    ck_assert(!can::spy::listenOnly());
+    ck_assert(!bus->bypassFilters);
+}
+END_TEST
+
+START_TEST (test_finds_other_speed)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    for(int i = 0; i < 8 && autobaud::searching(bus); i++) {
+        listen(125000);
+    }
+    ck_assert(!autobaud::searching(bus));
+    ck_assert_int_eq(bus->speed, 125000);
+    ck_assert_int_eq(can::spy::bitRate(), 125000);
+    ck_assert(!can::spy::listenOnly());
+}
+END_TEST
+
+START_TEST (test_stays_listen_only_if_not_writable)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    bus->messagesReceived += CAN_AUTO_BAUD_MIN_FRAMES;
+    autobaud::update(bus, false, getCanBuses(), getCanBusCount());
+    ck_assert(!autobaud::searching(bus));
+    ck_assert(can::spy::listenOnly());
+}
+END_TEST
+
+START_TEST (test_errors_outweigh_frames)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    bus->messagesReceived += CAN_AUTO_BAUD_MIN_FRAMES;
+    bus->receiveErrorCount = CAN_AUTO_BAUD_MIN_FRAMES;
+    autobaud::update(bus, true, getCanBuses(), getCanBusCount());
+    ck_assert(autobaud::searching(bus));
+}
+END_TEST
+
+START_TEST (test_wraps_around_candidates)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    for(int i = 0; i < 8; i++) {
+        ck_assert(autobaud::searching(bus));
+        listen(0);
+    }
+    ck_assert(autobaud::searching(bus));
+    ck_assert_int_eq(can::spy::bitRate(), 500000);
+}
+END_TEST
+
+START_TEST (test_keeps_bypassed_filters)
+{
+    bus->bypassFilters = true;
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    listen(500000);
+    ck_assert(bus->bypassFilters);
+}
+END_TEST
+
+START_TEST (test_restart_keeps_filter_setting)
+{
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    bus->speed = 250000;
+    autobaud::start(bus, getCanBuses(), getCanBusCount());
+    ck_assert_int_eq(can::spy::bitRate(), 250000);
+    listen(250000);
+    ck_assert(!bus->bypassFilters);
+}
+END_TEST
+
+START_TEST (test_loopback_not_enabled)
+{
+    bus->autoBaud = true;
+    ck_assert(autobaud::enabled(bus));
+    bus->loopback = true;
+    ck_assert(!autobaud::enabled(bus));
+    bus->loopback = false;
+    bus->autoBaud = false;
+}
+END_TEST
+
+Suite* autobaudSuite(void) {
+    Suite* s = suite_create("autobaud");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_start_listens_at_configured_speed);
+    tcase_add_test(tc_core, test_locks_on_configured_speed);
+    tcase_add_test(tc_core, test_finds_other_speed);
+    tcase_add_test(tc_core, test_stays_listen_only_if_not_writable);
+    tcase_add_test(tc_core, test_errors_outweigh_frames);
+    tcase_add_test(tc_core, test_wraps_around_candidates);
+    tcase_add_test(tc_core, test_keeps_bypassed_filters);
+    tcase_add_test(tc_core, test_restart_keeps_filter_setting);
+    tcase_add_test(tc_core, test_loopback_not_enabled);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = autobaudSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+/* Host-side benchmarks of the decode, serialize and command hot paths, built
+ * against the same platform stubs as the unit tests by the "benchmarks" make
+ * target.
+ *
+ * The results are written as JSON to the file named by the first argument, or
+ * to stdout if there is none. The pipeline stubs print what they send, so
+ * write the results to a file if you want to parse them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "signals.h"
+#include "config.h"
+#include "pipeline.h"
+#include "diagnostics.h"
+#include "can/canread.h"
+#include "commands/commands.h"
+#include "payload/payload.h"
+
+namespace can = openxc::can;
+namespace diagnostics = openxc::diagnostics;
+namespace payload = openxc::payload;
+namespace usb = openxc::interface::usb;
+
+using openxc::interface::InterfaceDescriptor;
+using openxc::interface::InterfaceType;
+using openxc::payload::PayloadFormat;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+#define DEFAULT_ITERATIONS 100000
+#define WARMUP_ITERATIONS 1000
+#define NS_PER_SECOND 1000000000.0
+
+/* Private: Run once for each iteration of a benchmark.
+ *
+ * iteration - the number of the iteration, to vary the input.
+ */
+typedef void (*BenchmarkFunction)(int iteration);
+
+/* Private: A benchmark of one hot path.
+ *
+ * name - the name it's reported with.
+ * prepare - if not NULL, called before each iteration outside of the timing,
+ *      to set up state that run consumes.
+ * run - the code under test.
+ */
+typedef struct {
+    const char* name;
+    BenchmarkFunction prepare;
+    BenchmarkFunction run;
+} Benchmark;
+
+static const CanMessage SIGNAL_MESSAGE = {
+    id: 0,
+    format: CanMessageFormat::STANDARD,
+    data: {0xeb},
+};
+
+static const DiagnosticRequest DIAGNOSTIC_REQUEST = {
+    arbitration_id: 0x7e0,
+    mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+    has_pid: true,
+    pid: 0x2,
+    pid_length: 1
+};
+
+static uint8_t CAN_WRITE_REQUEST[] =
+        "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"}\0";
+
+static InterfaceDescriptor DESCRIPTOR = {
+    allowRawWrites: true,
+    type: InterfaceType::USB
+};
+
+static openxc_VehicleMessage SIMPLE_MESSAGE;
+static uint8_t PAYLOAD[256];
+
+static double nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+/* Private: Empty the output queues so publishing never waits on the stubbed
+ * interfaces, which don't drain them.
+ */
+static void resetOutputQueues() {
+    BYTE_QUEUE_RESET(
+            &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue);
+    BYTE_QUEUE_RESET(&getConfiguration()->uart.sendQueue);
+    for(int i = 0; i < getCanBusCount(); i++) {
+        QUEUE_INIT(CanMessage, &getCanBuses()[i].sendQueue);
+    }
+}
+
+static void translateSignal(int iteration) {
+    CanMessage message = SIGNAL_MESSAGE;
+    message.data[0] = (uint8_t) iteration;
+    can::read::translateSignal(&getSignals()[0], &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    resetOutputQueues();
+}
+
+static void passthroughMessage(int iteration) {
+    CanMessage message = {
+        id: getMessages()[2].id,
+        format: CanMessageFormat::STANDARD,
+        data: {(uint8_t) iteration, (uint8_t) (iteration >> 8)}
+    };
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    resetOutputQueues();
+}
+
+static void serialize(PayloadFormat format, int iteration) {
+    SIMPLE_MESSAGE.simple_message.value.numeric_value = iteration;
+    if(payload::serialize(&SIMPLE_MESSAGE, PAYLOAD, sizeof(PAYLOAD),
+                format) == 0) {
+        fprintf(stderr, "Unable to serialize a message\n");
+        exit(1);
+    }
+}
+
+static void serializeJson(int iteration) {
+    serialize(PayloadFormat::JSON, iteration);
+}
+
+static void serializeProtobuf(int iteration) {
+    serialize(PayloadFormat::PROTOBUF, iteration);
+}
+
+static void serializeMessagePack(int iteration) {
+    serialize(PayloadFormat::MESSAGEPACK, iteration);
+}
+
+static void serializeMessagePackCompact(int iteration) {
+    serialize(PayloadFormat::MESSAGEPACK_COMPACT, iteration);
+}
+
+static void handleCanWriteCommand(int iteration) {
+    if(openxc::commands::handleIncomingMessage(CAN_WRITE_REQUEST,
+                sizeof(CAN_WRITE_REQUEST), &DESCRIPTOR) == 0) {
+        fprintf(stderr, "Unable to handle a command\n");
+        exit(1);
+    }
+    resetOutputQueues();
+}
+
+static CanMessage diagnosticResponse() {
+    CanMessage message = {
+        id: DIAGNOSTIC_REQUEST.arbitration_id + 0x8,
+        format: CanMessageFormat::STANDARD,
+        data: {0x03, 0x41, 0x02, 0x45},
+        length: 8
+    };
+    return message;
+}
+
+static void receiveUnrelatedFrame(int iteration) {
+    CanMessage message = SIGNAL_MESSAGE;
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &message, &getConfiguration()->pipeline);
+}
+
+static void sendDiagnosticRequest(int iteration) {
+    DiagnosticRequest request = DIAGNOSTIC_REQUEST;
+    diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &request, "benchmark", false);
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0]);
+    resetOutputQueues();
+}
+
+static void receiveDiagnosticResponse(int iteration) {
+    CanMessage message = diagnosticResponse();
+    message.data[3] = (uint8_t) iteration;
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &message, &getConfiguration()->pipeline);
+    resetOutputQueues();
+}
+
+static const Benchmark BENCHMARKS[] = {
+    {"translateSignal", NULL, translateSignal},
+    {"passthroughMessage", NULL, passthroughMessage},
+    {"serialize_json", NULL, serializeJson},
+    {"serialize_protobuf", NULL, serializeProtobuf},
+    {"serialize_messagepack", NULL, serializeMessagePack},
+    {"serialize_messagepack_compact", NULL, serializeMessagePackCompact},
+    {"handleIncomingMessage_can_write", NULL, handleCanWriteCommand},
+    {"diagnostics_receiveCanMessage_unrelated", NULL, receiveUnrelatedFrame},
+    {"diagnostics_receiveCanMessage_response", sendDiagnosticRequest,
+        receiveDiagnosticResponse},
+};
+
+static void initialize() {
+    initializeVehicleInterface();
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    getCanBuses()[0].rawWritable = true;
+    getCanBuses()[0].passthroughDeltas = false;
+    can::clearPassthroughFilters(&getCanBuses()[0]);
+    openxc::pipeline::setNameDictionary(false);
+
+    // publish every value, without a frequency limit or deadband
+    CanSignal* signal = &getSignals()[0];
+    signal->sendSame = true;
+    signal->frequencyClock = {0};
+    signal->decoder = NULL;
+    signal->deadband = 0;
+    signal->relativeDeadband = 0;
+
+    diagnostics::initialize(&getConfiguration()->diagnosticsManager,
+            getCanBuses(), getCanBusCount(), 0);
+
+    SIMPLE_MESSAGE.has_type = true;
+    SIMPLE_MESSAGE.type = openxc_VehicleMessage_Type_SIMPLE;
+    SIMPLE_MESSAGE.has_simple_message = true;
+    SIMPLE_MESSAGE.simple_message.has_name = true;
+    strcpy(SIMPLE_MESSAGE.simple_message.name, "vehicle_speed");
+    SIMPLE_MESSAGE.simple_message.has_value = true;
+    SIMPLE_MESSAGE.simple_message.value.has_type = true;
+    SIMPLE_MESSAGE.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    SIMPLE_MESSAGE.simple_message.value.has_numeric_value = true;
+}
+
+/* Private: Run a benchmark and return the average nanoseconds per iteration.
+ * Without a prepare step the whole run is timed at once, so the clock isn't
+ * part of the result.
+ */
+static double measure(const Benchmark* benchmark, int iterations) {
+    for(int i = 0; i < WARMUP_ITERATIONS; i++) {
+        if(benchmark->prepare != NULL) {
+            benchmark->prepare(i);
+        }
+        benchmark->run(i);
+        ++FAKE_TIME;
+    }
+
+    double elapsed = 0;
+    if(benchmark->prepare == NULL) {
+        double started = nowNs();
+        for(int i = 0; i < iterations; i++) {
+            benchmark->run(i);
+        }
+        elapsed = nowNs() - started;
+    } else {
+        for(int i = 0; i < iterations; i++) {
+            // the diagnostics manager needs the time to move on to send a
+            // request again
+            ++FAKE_TIME;
+            benchmark->prepare(i);
+            double started = nowNs();
+            benchmark->run(i);
+            elapsed += nowNs() - started;
+        }
+    }
+    return elapsed / iterations;
+}
+
+int main(int argc, char** argv) {
+    FILE* output = stdout;
+    if(argc > 1) {
+        output = fopen(argv[1], "w");
+        if(output == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    int iterations = DEFAULT_ITERATIONS;
+    const char* configuredIterations = getenv("BENCHMARK_ITERATIONS");
+    if(configuredIterations != NULL && atoi(configuredIterations) > 0) {
+        iterations = atoi(configuredIterations);
+    }
+
+    initialize();
+
+    int benchmarkCount = sizeof(BENCHMARKS) / sizeof(Benchmark);
+    fprintf(output, "{\"iterations\": %d, \"benchmarks\": [\n", iterations);
+    for(int i = 0; i < benchmarkCount; i++) {
+        double nsPerFrame = measure(&BENCHMARKS[i], iterations);
+        fprintf(output, "    {\"name\": \"%s\", \"ns_per_frame\": %.1f, "
+                "\"frames_per_second\": %.0f}%s\n", BENCHMARKS[i].name,
+                nsPerFrame, NS_PER_SECOND / nsPerFrame,
+                i < benchmarkCount - 1 ? "," : "");
+    }
+    fprintf(output, "]}\n");
+
+    if(output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,436 @@
+/* Replay a recorded CAN trace through the firmware on the development
+ * machine, as fast as it will go, built against the test platform by the
+ * "replay" make target.
+ *
+ *      replay.bin <trace> [report]
+ *
+ * The trace can be a candump log ("(1436509052.249713) can0 123#DEADBEEF"),
+ * plain candump output ("can0  123   [4]  DE AD BE EF"), a Vector ASC log or a
+ * raw CAN log from the SD card (see CAN_LOG_RECORD_SIZE), journaled or not.
+ * The interfaces in a candump log are assigned to the buses in the order they
+ * first appear, and ASC channels and raw log bus addresses are matched to the
+ * bus addresses.
+ *
+ * Each frame is queued on its bus with the test clock at the frame's
+ * timestamp, and the main loop runs once per frame. What the firmware sends
+ * out over USB goes to stdout, and a JSON report of the throughput, drops and
+ * output size is written to the report file (or stderr).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "signals.h"
+#include "config.h"
+#include "pipeline.h"
+#include "can/canutil.h"
+#include "can/canqueue.h"
+#include "interface/fs.h"
+
+namespace can = openxc::can;
+namespace fs = openxc::interface::fs;
+namespace usb = openxc::interface::usb;
+
+using openxc::interface::InterfaceType;
+using openxc::pipeline::EndpointMetrics;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+using openxc::config::RunLevel;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+extern void firmwareLoop();
+
+#define MAX_LINE_LENGTH 256
+#define MAX_INTERFACES 8
+#define MAX_INTERFACE_NAME_LENGTH 16
+#define MAX_DRAIN_LOOPS 10000
+#define NS_PER_SECOND 1000000000.0
+
+/* Private: A frame read from a trace.
+ *
+ * busIndex - the index of the bus in getCanBuses() it was received on, or -1
+ *      if there's no matching bus.
+ * timestampMs - when it was received, relative to the start of the trace.
+ */
+typedef struct {
+    int busIndex;
+    unsigned long timestampMs;
+    CanMessage message;
+} TraceFrame;
+
+/* Private: The totals for the report.
+ */
+typedef struct {
+    unsigned int frames;
+    unsigned int skippedFrames;
+    unsigned int unreadableLines;
+    unsigned int loops;
+    unsigned long traceDurationMs;
+} ReplayTotals;
+
+static char interfaceNames[MAX_INTERFACES][MAX_INTERFACE_NAME_LENGTH];
+static int interfaceCount;
+static double firstTimestamp = -1;
+
+/* Private: Return the index of the bus with the given controller address, or
+ * the address - 1 if no bus uses it, or -1 if neither is a bus.
+ */
+static int busIndexForAddress(int address) {
+    CanBus* bus = can::lookupBus(address, getCanBuses(), getCanBusCount());
+    if(bus != NULL) {
+        return bus - getCanBuses();
+    }
+    return address >= 1 && address <= getCanBusCount() ? address - 1 : -1;
+}
+
+/* Private: Return the bus for a candump interface name, assigning the next bus
+ * to a name seen for the first time.
+ */
+static int busIndexForInterface(const char* name) {
+    for(int i = 0; i < interfaceCount; i++) {
+        if(!strncmp(interfaceNames[i], name, MAX_INTERFACE_NAME_LENGTH - 1)) {
+            return i < getCanBusCount() ? i : -1;
+        }
+    }
+
+    if(interfaceCount >= MAX_INTERFACES) {
+        return -1;
+    }
+    strncpy(interfaceNames[interfaceCount], name,
+            MAX_INTERFACE_NAME_LENGTH - 1);
+    ++interfaceCount;
+    return interfaceCount - 1 < getCanBusCount() ? interfaceCount - 1 : -1;
+}
+
+static unsigned long relativeTimestampMs(double seconds) {
+    if(firstTimestamp < 0) {
+        firstTimestamp = seconds;
+    }
+    if(seconds < firstTimestamp) {
+        return 0;
+    }
+    return (unsigned long) ((seconds - firstTimestamp) * 1000);
+}
+
+static bool parseId(const char* token, CanMessage* message) {
+    char* end;
+    message->id = strtoul(token, &end, 16);
+    if(end == token) {
+        return false;
+    }
+    // candump marks extended IDs by their 8 digits, ASC with a trailing x
+    message->format = end - token > 3 || *end == 'x' ?
+            CanMessageFormat::EXTENDED : CanMessageFormat::STANDARD;
+    return true;
+}
+
+/* Private: Parse "123#DEADBEEF". Remote frames and CAN FD frames aren't
+ * replayed.
+ */
+static bool parseCompactFrame(char* token, CanMessage* message) {
+    char* separator = strchr(token, '#');
+    if(separator == NULL || separator[1] == '#' || separator[1] == 'R') {
+        return false;
+    }
+    *separator = '\0';
+    if(!parseId(token, message)) {
+        return false;
+    }
+
+    const char* data = separator + 1;
+    message->length = 0;
+    while(isxdigit(data[0]) && isxdigit(data[1]) && message->length < 8) {
+        char byte[3] = {data[0], data[1], '\0'};
+        message->data[message->length++] = strtoul(byte, NULL, 16);
+        data += 2;
+    }
+    return true;
+}
+
+/* Private: Parse "<length> <byte> <byte>...", the bytes in hex.
+ */
+static bool parseDataBytes(char* lengthToken, CanMessage* message) {
+    int length = atoi(lengthToken);
+    if(length < 0 || length > 8) {
+        return false;
+    }
+    message->length = length;
+    for(int i = 0; i < length; i++) {
+        char* token = strtok(NULL, " \t");
+        if(token == NULL) {
+            return false;
+        }
+        message->data[i] = strtoul(token, NULL, 16);
+    }
+    return true;
+}
+
+/* Private: Parse a line of a candump log, plain candump output or an ASC log.
+ *
+ * Returns 1 for a frame, 0 for a line with no frame (a header or comment) and
+ * -1 for a line that looks like a frame but couldn't be read.
+ */
+static int parseTextLine(char* line, TraceFrame* frame) {
+    memset(frame, 0, sizeof(TraceFrame));
+    char* token = strtok(line, " \t\r\n");
+    if(token == NULL) {
+        return 0;
+    }
+
+    double timestamp = 0;
+    if(token[0] == '(') {
+        timestamp = atof(token + 1);
+        token = strtok(NULL, " \t\r\n");
+    } else if(isdigit(token[0]) && strchr(token, '.') != NULL) {
+        // ASC: <time> <channel> <id> Rx d <length> <bytes>
+        timestamp = atof(token);
+        char* channel = strtok(NULL, " \t");
+        char* id = strtok(NULL, " \t");
+        char* direction = strtok(NULL, " \t");
+        char* type = strtok(NULL, " \t");
+        if(channel == NULL || id == NULL || direction == NULL ||
+                type == NULL || !isdigit(channel[0]) || strcmp(type, "d")) {
+            // error frames, statistics and other events
+            return 0;
+        }
+        frame->busIndex = busIndexForAddress(atoi(channel));
+        frame->timestampMs = relativeTimestampMs(timestamp);
+        char* length = strtok(NULL, " \t");
+        return length != NULL && parseId(id, &frame->message) &&
+                parseDataBytes(length, &frame->message) ? 1 : -1;
+    }
+
+    // candump: <interface> <id>#<data> or <interface> <id> [<length>] <bytes>
+    char* interface = token;
+    token = strtok(NULL, " \t\r\n");
+    if(interface == NULL || token == NULL || !isalpha(interface[0])) {
+        return 0;
+    }
+
+    int result;
+    if(strchr(token, '#') != NULL) {
+        result = parseCompactFrame(token, &frame->message) ? 1 : -1;
+    } else {
+        char* length = strtok(NULL, " \t\r\n");
+        if(length == NULL || length[0] != '[') {
+            // not a frame, e.g. the header of an ASC log
+            return 0;
+        }
+        result = parseId(token, &frame->message) &&
+                parseDataBytes(length + 1, &frame->message) ? 1 : -1;
+    }
+
+    if(result > 0) {
+        frame->busIndex = busIndexForInterface(interface);
+        frame->timestampMs = relativeTimestampMs(timestamp);
+    }
+    return result;
+}
+
+/* Private: Queue a frame on its bus and run the main loop for it.
+ */
+static void replayFrame(TraceFrame* frame, ReplayTotals* totals) {
+    if(frame->busIndex < 0) {
+        ++totals->skippedFrames;
+        return;
+    }
+
+    CanBus* bus = &getCanBuses()[frame->busIndex];
+    FAKE_TIME = 1000 + frame->timestampMs;
+    frame->message.receivedUs = FAKE_TIME * 1000;
+    while(!can::queue::push(&bus->receiveQueue, &frame->message)) {
+        firmwareLoop();
+        ++totals->loops;
+    }
+    firmwareLoop();
+    ++totals->loops;
+    ++totals->frames;
+    totals->traceDurationMs = frame->timestampMs;
+}
+
+static void replayText(FILE* trace, ReplayTotals* totals) {
+    char line[MAX_LINE_LENGTH];
+    TraceFrame frame;
+    while(fgets(line, sizeof(line), trace) != NULL) {
+        int result = parseTextLine(line, &frame);
+        if(result > 0) {
+            replayFrame(&frame, totals);
+        } else if(result < 0) {
+            ++totals->unreadableLines;
+        }
+    }
+}
+
+/* Private: Replay a stream of raw CAN log records, resynchronizing on the
+ * sync byte after anything that isn't a valid record.
+ */
+static size_t replayRecords(uint8_t* records, size_t length,
+        ReplayTotals* totals) {
+    size_t offset = 0;
+    while(length - offset >= CAN_LOG_RECORD_SIZE) {
+        uint8_t* record = &records[offset];
+        if(record[0] != CAN_LOG_RECORD_SYNC || record[3] > 8) {
+            ++offset;
+            continue;
+        }
+
+        TraceFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.busIndex = busIndexForAddress(record[2]);
+        frame.message.format = record[1] & CAN_LOG_FLAG_EXTENDED ?
+                CanMessageFormat::EXTENDED : CanMessageFormat::STANDARD;
+        frame.message.length = record[3];
+        uint64_t timestamp = 0;
+        for(int i = 0; i < 4; i++) {
+            frame.message.id |= (uint32_t) record[4 + i] << (i * 8);
+        }
+        for(int i = 0; i < 8; i++) {
+            timestamp |= (uint64_t) record[8 + i] << (i * 8);
+        }
+        memcpy(frame.message.data, &record[16], frame.message.length);
+        frame.timestampMs = relativeTimestampMs(timestamp / 1000.0);
+        replayFrame(&frame, totals);
+        offset += CAN_LOG_RECORD_SIZE;
+    }
+    return offset;
+}
+
+static void replayBinary(FILE* trace, bool journaled, ReplayTotals* totals) {
+    // Records can span journal blocks, so keep what's left of the last one
+    uint8_t buffer[FS_JOURNAL_BLOCK_SIZE + CAN_LOG_RECORD_SIZE];
+    size_t buffered = 0;
+    uint8_t block[FS_JOURNAL_BLOCK_SIZE];
+    size_t read;
+    while((read = fread(block, 1, sizeof(block), trace)) > 0) {
+        int length = read;
+        const uint8_t* payload = block;
+        if(journaled) {
+            uint32_t sequence;
+            length = read == sizeof(block) ?
+                    fs::openJournalBlock(block, &sequence) : -1;
+            if(length < 0) {
+                ++totals->unreadableLines;
+                continue;
+            }
+            payload = &block[FS_JOURNAL_HEADER_SIZE];
+        }
+
+        memcpy(&buffer[buffered], payload, length);
+        buffered += length;
+        size_t used = replayRecords(buffer, buffered, totals);
+        memmove(buffer, &buffer[used], buffered - used);
+        buffered -= used;
+    }
+}
+
+static void replay(FILE* trace, ReplayTotals* totals) {
+    int first = fgetc(trace);
+    ungetc(first, trace);
+    if(first == CAN_LOG_RECORD_SYNC) {
+        replayBinary(trace, false, totals);
+    } else if(first == (FS_JOURNAL_MAGIC & 0xff)) {
+        replayBinary(trace, true, totals);
+    } else {
+        replayText(trace, totals);
+    }
+}
+
+static void initialize() {
+    initializeVehicleInterface();
+    while(getConfiguration()->runLevel != RunLevel::ALL_IO) {
+        firmwareLoop();
+    }
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    // The test platform's UART never sends anything, so leave it out rather
+    // than count everything published to it as dropped
+    getConfiguration()->pipeline.uart = NULL;
+}
+
+/* Private: Run the main loop until everything queued has been sent.
+ */
+static void drain(ReplayTotals* totals) {
+    for(int i = 0; i < MAX_DRAIN_LOOPS; i++) {
+        bool empty = openxc::pipeline::sendQueuesEmpty(
+                &getConfiguration()->pipeline);
+        for(int j = 0; j < getCanBusCount(); j++) {
+            empty = empty && can::queue::empty(&getCanBuses()[j].receiveQueue);
+        }
+        if(empty) {
+            break;
+        }
+        firmwareLoop();
+        ++totals->loops;
+    }
+}
+
+static void report(FILE* output, ReplayTotals* totals, double elapsedNs) {
+    EndpointMetrics metrics = {0};
+    openxc::pipeline::getEndpointMetrics(InterfaceType::USB, &metrics);
+
+    fprintf(output, "{\"frames\": %u, \"skipped_frames\": %u, "
+            "\"unreadable_lines\": %u, \"loops\": %u,\n",
+            totals->frames, totals->skippedFrames, totals->unreadableLines,
+            totals->loops);
+    fprintf(output, " \"trace_seconds\": %.3f, \"replay_seconds\": %.3f, "
+            "\"frames_per_second\": %.0f, \"ns_per_frame\": %.1f,\n",
+            totals->traceDurationMs / 1000.0, elapsedNs / NS_PER_SECOND,
+            elapsedNs > 0 ? totals->frames * NS_PER_SECOND / elapsedNs : 0,
+            totals->frames > 0 ? elapsedNs / totals->frames : 0);
+    fprintf(output, " \"buses\": [");
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::CanBusCounters counters;
+        can::snapshotCounters(&getCanBuses()[i], &counters);
+        fprintf(output, "%s{\"address\": %d, \"received\": %u, "
+                "\"dropped\": %u}", i > 0 ? ", " : "",
+                getCanBuses()[i].address, counters.received,
+                counters.dropped);
+    }
+    fprintf(output, "],\n");
+    fprintf(output, " \"usb\": {\"sent\": %u, \"dropped\": %u, "
+            "\"bytes\": %u}}\n", metrics.sent, metrics.dropped,
+            metrics.bytesSent);
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <trace> [report]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* trace = fopen(argv[1], "rb");
+    if(trace == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    FILE* output = stderr;
+    if(argc > 2) {
+        output = fopen(argv[2], "w");
+        if(output == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    initialize();
+
+    ReplayTotals totals = {0};
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    replay(trace, &totals);
+    drain(&totals);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    fclose(trace);
+
+    report(output, &totals, (finished.tv_sec - started.tv_sec) *
+            NS_PER_SECOND + (finished.tv_nsec - started.tv_nsec));
+    if(output != stderr) {
+        fclose(output);
+    }
+    return 0;
+}
@@ -4,14 +4,23 @@
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::pushBytes;
+using openxc::util::bytebuffer::peekBytes;
+using openxc::util::bytebuffer::popBytes;
+using openxc::util::bytebuffer::wrapCheckedFrame;
+using openxc::util::bytebuffer::FrameScanner;
+using openxc::util::bytebuffer::FrameType;
 
-QUEUE_TYPE(uint8_t) queue;
+ByteQueue queue;
+BYTE_QUEUE_STORAGE(storage, 512);
 bool called;
 size_t callbackDataRead;
 int calledTimes;
+FrameScanner scanner;
 
 void setup() {
-    QUEUE_INIT(uint8_t, &queue);
+    BYTE_QUEUE_INIT(&queue, storage);
+    memset(&scanner, 0, sizeof(scanner));
     called = false;
     callbackDataRead = 0;
     calledTimes = 0;
@@ -28,6 +37,21 @@ size_t callback(uint8_t* message, size_t length) {
     return callbackDataRead;
 }
 
+uint8_t receivedFrame[16];
+size_t receivedFrameLength;
+bool frameParses;
+size_t frameCallback(uint8_t* message, size_t length) {
+    calledTimes++;
+    receivedFrameLength = length;
+    memcpy(receivedFrame, message, length < sizeof(receivedFrame) ?
+            length : sizeof(receivedFrame));
+    return frameParses ? length : 0;
+}
+
+static void pushString(const char* data, int length) {
+    fail_unless(pushBytes(&queue, (const uint8_t*)data, length));
+}
+
 START_TEST (test_empty_doesnt_call)
 {
     processQueue(&queue, callback);
@@ -37,33 +61,33 @@ END_TEST
 
 START_TEST (test_missing_callback)
 {
-    QUEUE_PUSH(uint8_t, &queue, 128);
+    BYTE_QUEUE_PUSH(&queue, 128);
     processQueue(&queue, NULL);
     fail_if(called);
-    fail_if(QUEUE_EMPTY(uint8_t, &queue));
+    fail_if(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
 START_TEST (test_parse_multiple)
 {
     callbackDataRead = 2;
-    QUEUE_PUSH(uint8_t, &queue, 128);
-    QUEUE_PUSH(uint8_t, &queue, 0);
-    QUEUE_PUSH(uint8_t, &queue, 64);
-    QUEUE_PUSH(uint8_t, &queue, 0);
+    BYTE_QUEUE_PUSH(&queue, 128);
+    BYTE_QUEUE_PUSH(&queue, 0);
+    BYTE_QUEUE_PUSH(&queue, 64);
+    BYTE_QUEUE_PUSH(&queue, 0);
 
     processQueue(&queue, callback);
     processQueue(&queue, callback);
     ck_assert_int_eq(calledTimes, 2);
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
 START_TEST (test_data_sent_to_callback)
 {
     callbackDataRead = 2;
-    QUEUE_PUSH(uint8_t, &queue, 128);
-    QUEUE_PUSH(uint8_t, &queue, 0);
+    BYTE_QUEUE_PUSH(&queue, 128);
+    BYTE_QUEUE_PUSH(&queue, 0);
     processQueue(&queue, callback);
     ck_assert_int_eq(received_message[0], 128);
     ck_assert_int_eq(received_message[1], 0);
@@ -73,35 +97,35 @@ END_TEST
 START_TEST (test_success_clears)
 {
     callbackDataRead = 2;
-    QUEUE_PUSH(uint8_t, &queue, 128);
-    QUEUE_PUSH(uint8_t, &queue, 0);
+    BYTE_QUEUE_PUSH(&queue, 128);
+    BYTE_QUEUE_PUSH(&queue, 0);
     processQueue(&queue, callback);
     fail_unless(called);
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
 START_TEST (test_failure_clears_too)
 {
     callbackDataRead = 2;
-    QUEUE_PUSH(uint8_t, &queue, 128);
-    QUEUE_PUSH(uint8_t, &queue, 0);
+    BYTE_QUEUE_PUSH(&queue, 128);
+    BYTE_QUEUE_PUSH(&queue, 0);
     processQueue(&queue, callback);
     fail_unless(called);
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
 START_TEST (test_full_clears)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &queue, 128);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) + 1; i++) {
+        BYTE_QUEUE_PUSH(&queue, 128);
     }
-    fail_unless(QUEUE_FULL(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_FULL(&queue));
 
     callbackDataRead = 0;
     processQueue(&queue, callback);
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
@@ -123,10 +147,10 @@ END_TEST
 
 START_TEST (test_enqueue_full)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &queue, 128);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) + 1; i++) {
+        BYTE_QUEUE_PUSH(&queue, 128);
     }
-    fail_unless(QUEUE_FULL(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_FULL(&queue));
 
     char* message = "a message";
     bool result = conditionalEnqueue(&queue, (uint8_t*)message, 10);
@@ -136,8 +160,8 @@ END_TEST
 
 START_TEST (test_enqueue_just_enough_room)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) - 11; i++) {
-        QUEUE_PUSH(uint8_t, &queue, 128);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) - 11; i++) {
+        BYTE_QUEUE_PUSH(&queue, 128);
     }
 
     char* message = "a message";
@@ -148,8 +172,8 @@ END_TEST
 
 START_TEST (test_enqueue_no_room_for_crlf)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) - 9; i++) {
-        QUEUE_PUSH(uint8_t, &queue, 128);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) - 9; i++) {
+        BYTE_QUEUE_PUSH(&queue, 128);
     }
 
     char* message = "a message";
@@ -158,6 +182,258 @@ START_TEST (test_enqueue_no_room_for_crlf)
 }
 END_TEST
 
+START_TEST (test_push_pop_bytes)
+{
+    uint8_t message[] = {1, 2, 3, 4, 5};
+    fail_unless(pushBytes(&queue, message, sizeof(message)));
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 5);
+
+    uint8_t result[8];
+    ck_assert_int_eq(peekBytes(&queue, result, sizeof(result)), 5);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 5);
+    ck_assert_int_eq(result[4], 5);
+
+    ck_assert_int_eq(popBytes(&queue, result, 2), 2);
+    ck_assert_int_eq(result[0], 1);
+    ck_assert_int_eq(result[1], 2);
+    ck_assert_int_eq(popBytes(&queue, NULL, 8), 3);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_push_bytes_wraps_around)
+{
+    // leave the head and tail right before the end of the ring
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) - 2; i++) {
+        BYTE_QUEUE_PUSH(&queue, 0);
+        BYTE_QUEUE_POP(&queue);
+    }
+
+    uint8_t message[] = {1, 2, 3, 4, 5, 6};
+    fail_unless(pushBytes(&queue, message, sizeof(message)));
+    for(int i = 0; i < 3; i++) {
+        ck_assert_int_eq(BYTE_QUEUE_POP(&queue), i + 1);
+    }
+
+    uint8_t result[3];
+    ck_assert_int_eq(popBytes(&queue, result, sizeof(result)), 3);
+    ck_assert_int_eq(result[0], 4);
+    ck_assert_int_eq(result[2], 6);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+
+    fail_unless(pushBytes(&queue, message, sizeof(message)));
+    BYTE_QUEUE_PUSH(&queue, 7);
+    for(int i = 0; i < 7; i++) {
+        ck_assert_int_eq(BYTE_QUEUE_POP(&queue), i + 1);
+    }
+}
+END_TEST
+
+START_TEST (test_push_bytes_too_long)
+{
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) - 3; i++) {
+        BYTE_QUEUE_PUSH(&queue, 128);
+    }
+
+    uint8_t message[] = {1, 2, 3, 4};
+    fail_if(pushBytes(&queue, message, sizeof(message)));
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue),
+            BYTE_QUEUE_CAPACITY(&queue) - 3);
+    fail_unless(pushBytes(&queue, message, 3));
+    fail_unless(BYTE_QUEUE_FULL(&queue));
+}
+END_TEST
+
+START_TEST (test_null_delimited_waits_for_delimiter)
+{
+    frameParses = true;
+    pushString("{\"a\"", 4);
+    fail_if(processQueue(&queue, &scanner, FrameType::NULL_DELIMITED,
+                frameCallback));
+    fail_if(processQueue(&queue, &scanner, FrameType::NULL_DELIMITED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 0);
+    ck_assert_int_eq(scanner.scanned, 4);
+
+    pushString(":1}\0{", 5);
+    fail_unless(processQueue(&queue, &scanner, FrameType::NULL_DELIMITED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedFrameLength, 8);
+    ck_assert_int_eq(receivedFrame[7], '\0');
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 1);
+    ck_assert_int_eq(scanner.scanned, 0);
+}
+END_TEST
+
+START_TEST (test_null_delimited_drops_unparseable)
+{
+    frameParses = false;
+    pushString("junk\0{", 6);
+    fail_unless(processQueue(&queue, &scanner, FrameType::NULL_DELIMITED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 1);
+}
+END_TEST
+
+START_TEST (test_length_prefixed)
+{
+    frameParses = true;
+    // a two byte varint prefix of 130, split across reads
+    uint8_t prefix[] = {0x82};
+    fail_unless(pushBytes(&queue, prefix, sizeof(prefix)));
+    fail_if(processQueue(&queue, &scanner, FrameType::LENGTH_PREFIXED,
+                frameCallback));
+
+    uint8_t rest[130];
+    memset(rest, 0x42, sizeof(rest));
+    rest[0] = 0x01;
+    fail_unless(pushBytes(&queue, rest, 100));
+    fail_if(processQueue(&queue, &scanner, FrameType::LENGTH_PREFIXED,
+                frameCallback));
+    ck_assert_int_eq(scanner.frameLength, 132);
+    ck_assert_int_eq(scanner.scanned, 2);
+
+    fail_unless(pushBytes(&queue, rest, 31));
+    fail_unless(processQueue(&queue, &scanner, FrameType::LENGTH_PREFIXED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedFrameLength, 132);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_frame_wraps_around_ring)
+{
+    // leave the head right before the end of the ring
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) - 2; i++) {
+        BYTE_QUEUE_PUSH(&queue, 0);
+        BYTE_QUEUE_POP(&queue);
+    }
+
+    frameParses = true;
+    pushString("{\"a\":1}\0", 8);
+    fail_unless(processQueue(&queue, &scanner, FrameType::NULL_DELIMITED,
+                frameCallback));
+    ck_assert_int_eq(receivedFrameLength, 8);
+    ck_assert(!memcmp(receivedFrame, "{\"a\":1}\0", 8));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_unframed_only_reparses_new_data)
+{
+    frameParses = false;
+    pushString("abc", 3);
+    fail_if(processQueue(&queue, &scanner, FrameType::UNFRAMED,
+                frameCallback));
+    fail_if(processQueue(&queue, &scanner, FrameType::UNFRAMED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+
+    pushString("d", 1);
+    frameParses = true;
+    fail_unless(processQueue(&queue, &scanner, FrameType::UNFRAMED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 2);
+    ck_assert_int_eq(receivedFrameLength, 4);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_scanner_resets_on_type_change)
+{
+    frameParses = true;
+    pushString("{\"a\"", 4);
+    processQueue(&queue, &scanner, FrameType::NULL_DELIMITED, frameCallback);
+    ck_assert_int_eq(scanner.scanned, 4);
+
+    BYTE_QUEUE_RESET(&queue);
+    uint8_t message[] = {0x2, 0x8, 0x1};
+    fail_unless(pushBytes(&queue, message, sizeof(message)));
+    fail_unless(processQueue(&queue, &scanner, FrameType::LENGTH_PREFIXED,
+                frameCallback));
+    ck_assert_int_eq(receivedFrameLength, 3);
+}
+END_TEST
+
+/* Private: Wrap the message in a CHECKED frame and queue it.
+ */
+static int pushCheckedFrame(const char* message, int length) {
+    uint8_t frame[length + CHECKED_FRAME_OVERHEAD];
+    int frameLength = wrapCheckedFrame((const uint8_t*)message, length, frame,
+            sizeof(frame));
+    fail_unless(pushBytes(&queue, frame, frameLength));
+    return frameLength;
+}
+
+START_TEST (test_checked_frame)
+{
+    uint8_t frame[16];
+    ck_assert_int_eq(wrapCheckedFrame((const uint8_t*)"123456789", 9, frame,
+                sizeof(frame)), 15);
+    ck_assert_int_eq(frame[0], CHECKED_FRAME_SYNC_1);
+    ck_assert_int_eq(frame[1], CHECKED_FRAME_SYNC_2);
+    ck_assert_int_eq(frame[2], 9);
+    ck_assert_int_eq(frame[3], 0);
+    fail_if(memcmp(&frame[4], "123456789", 9));
+    fail_if(wrapCheckedFrame((const uint8_t*)"123456789", 9, frame, 14));
+
+    frameParses = true;
+    // split across reads
+    fail_unless(pushBytes(&queue, frame, 6));
+    fail_if(processQueue(&queue, &scanner, FrameType::CHECKED,
+                frameCallback));
+    ck_assert_int_eq(scanner.frameLength, 15);
+    fail_unless(pushBytes(&queue, &frame[6], 9));
+    fail_unless(processQueue(&queue, &scanner, FrameType::CHECKED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedFrameLength, 9);
+    fail_if(memcmp(receivedFrame, "123456789", 9));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_checked_frame_skips_noise)
+{
+    frameParses = true;
+    // a sync marker in the noise with a length that doesn't fit in a queue
+    uint8_t noise[] = {0x00, 0xa5, 0x5a, 0xff, 0xff, 0xa5, 0x13};
+    fail_unless(pushBytes(&queue, noise, sizeof(noise)));
+    pushCheckedFrame("{}", 2);
+    fail_unless(processQueue(&queue, &scanner, FrameType::CHECKED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedFrameLength, 2);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
+START_TEST (test_checked_frame_resynchronizes)
+{
+    frameParses = true;
+    pushCheckedFrame("corrupted", 9);
+    // flip a bit in the payload
+    queue.elements[queue.head + 6] ^= 0x1;
+
+    // a frame that lost its first bytes
+    uint8_t truncated[9 + CHECKED_FRAME_OVERHEAD];
+    int length = wrapCheckedFrame((const uint8_t*)"truncated", 9, truncated,
+            sizeof(truncated));
+    fail_unless(pushBytes(&queue, &truncated[3], length - 3));
+    pushCheckedFrame("good", 4);
+
+    fail_unless(processQueue(&queue, &scanner, FrameType::CHECKED,
+                frameCallback));
+    ck_assert_int_eq(calledTimes, 1);
+    ck_assert_int_eq(receivedFrameLength, 4);
+    fail_if(memcmp(receivedFrame, "good", 4));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+}
+END_TEST
+
 Suite* buffersSuite(void) {
     Suite* s = suite_create("buffers");
     TCase *tc_core = tcase_create("core");
@@ -180,6 +456,26 @@ Suite* buffersSuite(void) {
     tcase_add_test(tc_conditional, test_enqueue_just_enough_room);
     suite_add_tcase(s, tc_conditional);
 
+    TCase *tc_bulk = tcase_create("bulk");
+    tcase_add_checked_fixture (tc_bulk, setup, teardown);
+    tcase_add_test(tc_bulk, test_push_pop_bytes);
+    tcase_add_test(tc_bulk, test_push_bytes_wraps_around);
+    tcase_add_test(tc_bulk, test_push_bytes_too_long);
+    suite_add_tcase(s, tc_bulk);
+
+    TCase *tc_framing = tcase_create("framing");
+    tcase_add_checked_fixture (tc_framing, setup, teardown);
+    tcase_add_test(tc_framing, test_null_delimited_waits_for_delimiter);
+    tcase_add_test(tc_framing, test_null_delimited_drops_unparseable);
+    tcase_add_test(tc_framing, test_length_prefixed);
+    tcase_add_test(tc_framing, test_frame_wraps_around_ring);
+    tcase_add_test(tc_framing, test_unframed_only_reparses_new_data);
+    tcase_add_test(tc_framing, test_scanner_resets_on_type_change);
+    tcase_add_test(tc_framing, test_checked_frame);
+    tcase_add_test(tc_framing, test_checked_frame_skips_noise);
+    tcase_add_test(tc_framing, test_checked_frame_resynchronizes);
+    suite_add_tcase(s, tc_framing);
+
     return s;
 }
 
@@ -0,0 +1,298 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "can/canqueue.h"
+
+namespace queue = openxc::can::queue;
+
+CanMessageRing ring;
+
+static CanMessage messageWithId(uint32_t id) {
+    CanMessage message = {
+        id: id,
+        format: CanMessageFormat::STANDARD,
+        data: {0x1, 0x2},
+        length: 2
+    };
+    return message;
+}
+
+void setup() {
+    queue::initialize(&ring, 0);
+}
+
+START_TEST (test_initialize_default_depth)
+{
+    fail_unless(queue::empty(&ring));
+    ck_assert_int_eq(queue::length(&ring), 0);
+    ck_assert_int_eq(queue::capacity(&ring), CAN_RECEIVE_QUEUE_MAX_DEPTH);
+}
+END_TEST
+
+START_TEST (test_initialize_rounds_down)
+{
+    queue::initialize(&ring, 6);
+    ck_assert_int_eq(queue::capacity(&ring), 4);
+
+    queue::initialize(&ring, CAN_RECEIVE_QUEUE_MAX_DEPTH * 2);
+    ck_assert_int_eq(queue::capacity(&ring), CAN_RECEIVE_QUEUE_MAX_DEPTH);
+}
+END_TEST
+
+START_TEST (test_push_pop)
+{
+    CanMessage message = messageWithId(0x42);
+    fail_unless(queue::push(&ring, &message));
+    ck_assert_int_eq(queue::length(&ring), 1);
+
+    CanMessage result;
+    fail_unless(queue::pop(&ring, &result));
+    ck_assert_int_eq(result.id, 0x42);
+    ck_assert_int_eq(result.length, 2);
+    ck_assert_int_eq(result.data[1], 0x2);
+    fail_unless(queue::empty(&ring));
+}
+END_TEST
+
+START_TEST (test_pop_empty)
+{
+    CanMessage result;
+    fail_if(queue::pop(&ring, &result));
+}
+END_TEST
+
+START_TEST (test_peek_received_time)
+{
+    unsigned long receivedUs;
+    fail_if(queue::peekReceivedUs(&ring, &receivedUs));
+
+    CanMessage message = messageWithId(0x42);
+    message.receivedUs = 1234;
+    queue::push(&ring, &message);
+    message.format = CanMessageFormat::EXTENDED;
+    message.receivedUs = 5678;
+    queue::push(&ring, &message);
+
+    fail_unless(queue::peekReceivedUs(&ring, &receivedUs));
+    ck_assert_int_eq(receivedUs, 1234);
+    ck_assert_int_eq(queue::length(&ring), 2);
+
+    CanMessage result;
+    queue::pop(&ring, &result);
+    fail_unless(queue::peekReceivedUs(&ring, &receivedUs));
+    ck_assert_int_eq(receivedUs, 5678);
+}
+END_TEST
+
+START_TEST (test_fill_er_up)
+{
+    queue::initialize(&ring, 4);
+    for(int i = 0; i < 4; i++) {
+        CanMessage message = messageWithId(i);
+        fail_unless(queue::push(&ring, &message),
+                "wasn't able to add the %dth element", i + 1);
+    }
+    fail_unless(queue::full(&ring));
+
+    CanMessage extra = messageWithId(99);
+    fail_if(queue::push(&ring, &extra));
+
+    for(int i = 0; i < 4; i++) {
+        CanMessage result;
+        fail_unless(queue::pop(&ring, &result));
+        ck_assert_int_eq(result.id, i);
+    }
+    fail_unless(queue::empty(&ring));
+}
+END_TEST
+
+START_TEST (test_index_wraparound)
+{
+    queue::initialize(&ring, 4);
+    // run the free-running indices past their 16-bit limit
+    for(uint32_t i = 0; i < 70000; i++) {
+        CanMessage message = messageWithId(i);
+        // the IDs outgrow 11 bits
+        message.format = CanMessageFormat::EXTENDED;
+        fail_unless(queue::push(&ring, &message));
+        CanMessage result;
+        fail_unless(queue::pop(&ring, &result));
+        ck_assert_int_eq(result.id, i);
+    }
+    fail_unless(queue::empty(&ring));
+    ck_assert_int_eq(queue::length(&ring), 0);
+}
+END_TEST
+
+START_TEST (test_packed_fields)
+{
+    CanMessage message = messageWithId(0x7ff);
+    message.receivedUs = 123456;
+    fail_unless(queue::push(&ring, &message));
+    message = messageWithId(0x1fffffff);
+    message.format = CanMessageFormat::EXTENDED;
+    message.length = 8;
+    message.data[7] = 0x8;
+    fail_unless(queue::push(&ring, &message));
+
+    CanMessage result;
+    fail_unless(queue::pop(&ring, &result));
+    ck_assert_int_eq(result.id, 0x7ff);
+    ck_assert_int_eq(result.format, CanMessageFormat::STANDARD);
+    ck_assert_int_eq(result.receivedUs, 123456);
+    ck_assert_int_eq(result.length, 2);
+    ck_assert_int_eq(result.data[2], 0);
+
+    fail_unless(queue::pop(&ring, &result));
+    ck_assert_int_eq(result.id, 0x1fffffff);
+    ck_assert_int_eq(result.format, CanMessageFormat::EXTENDED);
+    ck_assert_int_eq(result.length, 8);
+    ck_assert_int_eq(result.data[7], 0x8);
+}
+END_TEST
+
+START_TEST (test_no_length_is_full_frame)
+{
+    CanMessage message = messageWithId(0x42);
+    message.length = 0;
+    message.data[7] = 0x8;
+    fail_unless(queue::push(&ring, &message));
+
+    CanMessage result;
+    fail_unless(queue::pop(&ring, &result));
+    ck_assert_int_eq(result.length, 0);
+    ck_assert_int_eq(result.data[7], 0x8);
+}
+END_TEST
+
+START_TEST (test_storage_fits_full_depth)
+{
+    for(int i = 0; i < CAN_RECEIVE_QUEUE_MAX_DEPTH; i++) {
+        CanMessage message = messageWithId(i);
+        message.length = CAN_MESSAGE_SIZE;
+        fail_unless(queue::push(&ring, &message),
+                "wasn't able to add the %dth element", i + 1);
+    }
+    fail_unless(queue::full(&ring));
+}
+END_TEST
+
+#if CAN_FD_SUPPORT
+
+static CanMessage fdMessage(uint32_t id, uint8_t length) {
+    CanMessage message = messageWithId(id);
+    message.format = CanMessageFormat::EXTENDED;
+    message.length = length;
+    message.receivedUs = id * 1000;
+    memset(message.data, 0, sizeof(message.data));
+    for(int i = 0; i < length; i++) {
+        message.data[i] = id + i;
+    }
+    return message;
+}
+
+static void assertFdMessage(const CanMessage* message, uint32_t id,
+        uint8_t length) {
+    ck_assert_int_eq(message->id, id);
+    ck_assert_int_eq(message->length, length);
+    ck_assert_int_eq(message->receivedUs, id * 1000);
+    for(int i = 0; i < CAN_FD_MESSAGE_SIZE; i++) {
+        ck_assert_int_eq(message->data[i], i < length ? (uint8_t)(id + i) : 0);
+    }
+}
+
+START_TEST (test_fd_push_pop)
+{
+    CanMessage message = fdMessage(0x42, CAN_FD_MESSAGE_SIZE);
+    fail_unless(queue::push(&ring, &message));
+
+    CanMessage result;
+    memset(&result, 0xff, sizeof(result));
+    fail_unless(queue::pop(&ring, &result));
+    assertFdMessage(&result, 0x42, CAN_FD_MESSAGE_SIZE);
+    ck_assert_int_eq(result.format, CanMessageFormat::EXTENDED);
+    fail_unless(queue::empty(&ring));
+}
+END_TEST
+
+START_TEST (test_fd_storage_full)
+{
+    int count = 0;
+    CanMessage message = fdMessage(count, CAN_FD_MESSAGE_SIZE);
+    while(queue::push(&ring, &message)) {
+        message = fdMessage(++count, CAN_FD_MESSAGE_SIZE);
+    }
+    fail_unless(count > 1);
+    fail_if(queue::full(&ring));
+
+    // freeing the oldest frame makes room at the start of the storage
+    CanMessage result;
+    fail_unless(queue::pop(&ring, &result));
+    assertFdMessage(&result, 0, CAN_FD_MESSAGE_SIZE);
+    fail_unless(queue::push(&ring, &message));
+
+    for(int i = 1; i <= count; i++) {
+        fail_unless(queue::pop(&ring, &result));
+        assertFdMessage(&result, i, CAN_FD_MESSAGE_SIZE);
+    }
+    fail_unless(queue::empty(&ring));
+}
+END_TEST
+
+START_TEST (test_fd_mixed_lengths_wraparound)
+{
+    const uint8_t lengths[] = {1, 8, 64, 3, 12, 48, 20};
+    const int lengthCount = sizeof(lengths) / sizeof(lengths[0]);
+    uint32_t popped = 0;
+    for(uint32_t i = 0; i < 70000; i++) {
+        CanMessage message = fdMessage(i, lengths[i % lengthCount]);
+        fail_unless(queue::push(&ring, &message));
+        // keep a few frames in the ring so they straddle the wrap
+        if(queue::length(&ring) > 3) {
+            CanMessage result;
+            fail_unless(queue::pop(&ring, &result));
+            assertFdMessage(&result, popped, lengths[popped % lengthCount]);
+            ++popped;
+        }
+    }
+    ck_assert_int_eq(queue::length(&ring), 70000 - popped);
+}
+END_TEST
+
+#endif // CAN_FD_SUPPORT
+
+Suite* suite(void) {
+    Suite* s = suite_create("canqueue");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_initialize_default_depth);
+    tcase_add_test(tc_core, test_initialize_rounds_down);
+    tcase_add_test(tc_core, test_push_pop);
+    tcase_add_test(tc_core, test_pop_empty);
+    tcase_add_test(tc_core, test_peek_received_time);
+    tcase_add_test(tc_core, test_fill_er_up);
+    tcase_add_test(tc_core, test_index_wraparound);
+    tcase_add_test(tc_core, test_packed_fields);
+    tcase_add_test(tc_core, test_no_length_is_full_frame);
+    tcase_add_test(tc_core, test_storage_fits_full_depth);
+#if CAN_FD_SUPPORT
+    tcase_add_test(tc_core, test_fd_push_pop);
+    tcase_add_test(tc_core, test_fd_storage_full);
+    tcase_add_test(tc_core, test_fd_mixed_lengths_wraparound);
+#endif
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
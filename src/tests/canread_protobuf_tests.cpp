@@ -28,10 +28,10 @@ using openxc::config::getConfiguration;
 
 extern void initializeVehicleInterface();
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
 }
 
 void setup() {
@@ -47,8 +47,8 @@ void setup() {
 }
 
 openxc_VehicleMessage decodeProtobufMessage(Pipeline* pipeline) {
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue) + 1];
-    QUEUE_SNAPSHOT(uint8_t, &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(&pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue) + 1];
+    BYTE_QUEUE_SNAPSHOT(&pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
 
     openxc_VehicleMessage decodedMessage = {0};
     pb_istream_t stream = pb_istream_from_buffer(snapshot, sizeof(snapshot));
@@ -1,15 +1,19 @@
 #include <check.h>
 #include <stdint.h>
 #include <string>
+#include <string.h>
+#include <canutil/read.h>
 #include "signals.h"
 #include "can/canutil.h"
 #include "can/canread.h"
 #include "can/canwrite.h"
 #include "pipeline.h"
 #include "config.h"
+#include "virtual_signals.h"
 
 namespace usb = openxc::interface::usb;
 namespace can = openxc::can;
+namespace virtuals = openxc::signals::virtuals;
 
 using openxc::can::read::booleanDecoder;
 using openxc::can::read::ignoreDecoder;
@@ -23,6 +27,7 @@ using openxc::pipeline::Pipeline;
 using openxc::signals::getSignalCount;
 using openxc::signals::getSignals;
 using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
 using openxc::signals::getMessages;
 using openxc::signals::getMessageCount;
 using openxc::config::getConfiguration;
@@ -39,11 +44,11 @@ const CanMessage TEST_MESSAGE = {
 extern unsigned long FAKE_TIME;
 extern void initializeVehicleInterface();
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
         IN_ENDPOINT_INDEX].queue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
 }
 
 
@@ -55,12 +60,21 @@ void setup() {
     getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
     usb::initialize(&getConfiguration()->usb);
     getConfiguration()->usb.configured = true;
+    getCanBuses()[0].passthroughDeltas = false;
     for(int i = 0; i < getSignalCount(); i++) {
         getSignals()[i].received = false;
         getSignals()[i].sendSame = true;
         getSignals()[i].frequencyClock = {0};
         getSignals()[i].decoder = NULL;
+        getSignals()[i].decimalPlaces = 0;
+        getSignals()[i].deadband = 0;
+        getSignals()[i].relativeDeadband = 0;
+        getSignals()[i].disabled = false;
     }
+    openxc::pipeline::setNameDictionary(false);
+    can::read::resetAggregations();
+    virtuals::resetVirtualSignals();
+    can::clearPassthroughFilters(&getCanBuses()[0]);
 }
 
 START_TEST (test_passthrough_decoder)
@@ -113,14 +127,42 @@ START_TEST (test_state_decoder)
 }
 END_TEST
 
+START_TEST (test_decode_signal_builtin_decoders)
+{
+    bool send = true;
+    getSignals()[1].decoder = stateDecoder;
+    openxc_DynamicField decoded = can::read::decodeSignal(&getSignals()[1], 2,
+            getSignals(), getSignalCount(), &send);
+    ck_assert_str_eq(decoded.string_value, getSignals()[1].states[1].name);
+    fail_unless(send);
+
+    getSignals()[1].decoder = booleanDecoder;
+    decoded = can::read::decodeSignal(&getSignals()[1], 2, getSignals(),
+            getSignalCount(), &send);
+    ck_assert(decoded.type == openxc_DynamicField_Type_BOOL);
+    ck_assert(decoded.boolean_value);
+
+    getSignals()[1].decoder = NULL;
+    decoded = can::read::decodeSignal(&getSignals()[1], 2, getSignals(),
+            getSignalCount(), &send);
+    ck_assert(decoded.type == openxc_DynamicField_Type_NUM);
+    ck_assert_int_eq(decoded.numeric_value, 2);
+
+    getSignals()[1].decoder = ignoreDecoder;
+    can::read::decodeSignal(&getSignals()[1], 2, getSignals(),
+            getSignalCount(), &send);
+    fail_if(send);
+}
+END_TEST
+
 START_TEST (test_send_numerical)
 {
     fail_unless(queueEmpty());
     publishNumericalMessage("test", 42, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"test\",\"value\":42}\0");
 }
@@ -133,11 +175,11 @@ START_TEST (test_preserve_float_precision)
     publishNumericalMessage("test", value, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
-            "{\"name\":\"test\",\"value\":42.500000}\0");
+            "{\"name\":\"test\",\"value\":42.5}\0");
 }
 END_TEST
 
@@ -147,8 +189,8 @@ START_TEST (test_send_boolean)
     publishBooleanMessage("test", false, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":false}\0");
@@ -161,8 +203,8 @@ START_TEST (test_send_string)
     publishStringMessage("test", "string", &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"string\"}\0");
@@ -188,8 +230,8 @@ START_TEST (test_send_evented_boolean)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":false}\0");
@@ -215,8 +257,8 @@ START_TEST (test_send_evented_string)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":\"event\"}\0");
@@ -241,8 +283,8 @@ START_TEST (test_send_evented_float)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":43}\0");
@@ -260,7 +302,7 @@ START_TEST (test_passthrough_force_send_changed)
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -272,6 +314,43 @@ START_TEST (test_passthrough_force_send_changed)
 }
 END_TEST
 
+START_TEST (test_passthrough_selected_ids)
+{
+    ck_assert(can::addPassthroughFilter(&getCanBuses()[0], 0x100, 0x700,
+                CanMessageFormat::STANDARD, 0, getMessages(), getMessageCount(),
+                getCanBuses(), getCanBusCount()));
+    ck_assert(can::addPassthroughFilter(&getCanBuses()[0], 0x42, 0x7ff,
+                CanMessageFormat::STANDARD, 0, getMessages(), getMessageCount(),
+                getCanBuses(), getCanBusCount()));
+
+    CanMessage message = {
+        id: 0x200,
+        format: CanMessageFormat::STANDARD,
+        data: {0x12, 0x34}
+    };
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+
+    message.id = 0x1ab;
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    message.id = 0x42;
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    message.format = CanMessageFormat::EXTENDED;
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+}
+END_TEST
+
 START_TEST (test_passthrough_limited_frequency)
 {
     fail_unless(queueEmpty());
@@ -283,7 +362,7 @@ START_TEST (test_passthrough_limited_frequency)
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -294,6 +373,51 @@ START_TEST (test_passthrough_limited_frequency)
 }
 END_TEST
 
+static void assertOutput(const char* expected) {
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot, expected);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+}
+
+START_TEST (test_passthrough_deltas)
+{
+    getCanBuses()[0].passthroughDeltas = true;
+    CanMessageDefinition* definition = &getMessages()[2];
+    definition->sentLength = 0;
+    CanMessage message = {
+        id: definition->id,
+        format: CanMessageFormat::STANDARD,
+        data: {0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF1},
+        length: 8
+    };
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    // the first frame is always sent in full
+    assertOutput("{\"bus\":1,\"id\":2,\"data\":\"0x123456789abcdef1\"}\0");
+
+    message.data[1] = 0x35;
+    message.data[7] = 0xF2;
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    assertOutput("{\"bus\":1,\"id\":2,\"data\":\"0x8235f2\"}\0");
+
+    for(int i = 2; i < CAN_PASSTHROUGH_KEYFRAME_INTERVAL; i++) {
+        message.data[0] = i;
+        can::read::passthroughMessage(&getCanBuses()[0], &message,
+                getMessages(), getMessageCount(),
+                &getConfiguration()->pipeline);
+        BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    }
+
+    message.data[0] = 0x12;
+    can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
+            getMessageCount(), &getConfiguration()->pipeline);
+    assertOutput("{\"bus\":1,\"id\":2,\"data\":\"0x123556789abcdef2\"}\0");
+}
+END_TEST
+
 START_TEST (test_passthrough_message)
 {
     fail_unless(queueEmpty());
@@ -307,8 +431,8 @@ START_TEST (test_passthrough_message)
             &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"bus\":1,\"id\":42,\"data\":\"0x123456789abcdef1\"}\0");
@@ -343,8 +467,8 @@ START_TEST (test_default_decoder)
     fail_if(queueEmpty());
     fail_unless(getSignals()[0].received);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":-19990}\0");
@@ -371,11 +495,211 @@ START_TEST (test_translate_many_signals)
         fail_unless(getSignals()[i].received);
     }
     fail_unless(USB_PROCESSED);
-    // 8 signals sent
-    ck_assert_int_eq(15 * 34 + 2, SENT_BYTES);
-    // 6 in the output queue
+    // 13 signals sent - simple messages leave PIPELINE_PRIORITY_RESERVE bytes
+    // of the queue free, so it's flushed before it's completely full
+    ck_assert_int_eq(13 * 34 + 2, SENT_BYTES);
+    // 3 in the output queue
     fail_if(queueEmpty());
-    ck_assert_int_eq(1 * 34, QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE));
+    ck_assert_int_eq(3 * 34, BYTE_QUEUE_LENGTH(OUTPUT_QUEUE));
+}
+END_TEST
+
+static void checkOnlyMessageZeroSignalsReceived() {
+    for(int i = 0; i < getSignalCount(); i++) {
+        if(getSignals()[i].message == &getMessages()[0]) {
+            fail_unless(getSignals()[i].received,
+                    "signal %d should have been translated", i);
+        } else {
+            fail_if(getSignals()[i].received,
+                    "signal %d shouldn't have been translated", i);
+        }
+    }
+}
+
+START_TEST (test_translate_message_signals)
+{
+    fail_unless(can::read::indexSignalDispatch(getSignals(),
+                getSignalCount()));
+    // the two torque signals aren't next to each other in the signal array
+    ck_assert_int_eq(getMessages()[0].signalCount, 2);
+
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    checkOnlyMessageZeroSignalsReceived();
+}
+END_TEST
+
+START_TEST (test_translate_message_signals_not_indexed)
+{
+    can::read::indexSignalDispatch(NULL, 0);
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    checkOnlyMessageZeroSignalsReceived();
+}
+END_TEST
+
+START_TEST (test_translate_message_signals_skips_disabled)
+{
+    fail_unless(can::read::indexSignalDispatch(getSignals(),
+                getSignalCount()));
+    getSignals()[0].disabled = true;
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(getSignals()[0].received);
+    fail_unless(getSignals()[6].received);
+
+    can::read::indexSignalDispatch(NULL, 0);
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(getSignals()[0].received);
+}
+END_TEST
+
+START_TEST (test_translate_message_signals_rejects_bad_checksum)
+{
+    CanMessageProtection protection = {
+        checksumType: CHECKSUM_XOR,
+        checksumByte: 7
+    };
+    getMessages()[0].protection = &protection;
+    CanMessage message = TEST_MESSAGE;
+    message.length = 8;
+    can::read::translateMessageSignals(&getMessages()[0], &message,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+    fail_if(getSignals()[0].received);
+    ck_assert_int_eq(protection.checksumErrors, 1);
+
+    message.data[7] = 0xeb;
+    can::read::translateMessageSignals(&getMessages()[0], &message,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(getSignals()[0].received);
+    getMessages()[0].protection = NULL;
+}
+END_TEST
+
+START_TEST (test_dispatch_message)
+{
+    fail_unless(can::read::dispatchMessage(&getCanBuses()[0], &TEST_MESSAGE,
+                getMessages(), getMessageCount(), getSignals(),
+                getSignalCount(), &getConfiguration()->pipeline));
+    checkOnlyMessageZeroSignalsReceived();
+
+    CanMessage undefined = TEST_MESSAGE;
+    undefined.id = 0x7ff;
+    fail_if(can::read::dispatchMessage(&getCanBuses()[0], &undefined,
+                getMessages(), getMessageCount(), getSignals(),
+                getSignalCount(), &getConfiguration()->pipeline));
+}
+END_TEST
+
+START_TEST (test_parse_signal_matches_generic)
+{
+    const CanMessage message = {
+        id: 0,
+        format: STANDARD,
+        data: {0xeb, 0x12, 0x9f, 0x00, 0x7c, 0xa5, 0x31, 0xff},
+    };
+    for(int position = 0; position < CAN_MESSAGE_SIZE * 8; position++) {
+        for(int size = 1; position + size <= CAN_MESSAGE_SIZE * 8 && size <= 32;
+                size++) {
+            CanSignal signal = {0};
+            signal.bitPosition = position;
+            signal.bitSize = size;
+            signal.factor = 0.5;
+            signal.offset = -10;
+            float expected = bitfield_parse_float(message.data,
+                    CAN_MESSAGE_SIZE, position, size, 0.5, -10);
+            ck_assert(can::read::parseSignalBitfield(&signal, &message)
+                    == expected);
+            ck_assert_int_eq(signal.extraction, SIGNAL_EXTRACTION_SHIFT_MASK);
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_parse_signal_integer_scaling)
+{
+    const CanMessage message = {
+        id: 0,
+        format: STANDARD,
+        data: {0xeb, 0x12, 0x9f, 0x00, 0x7c, 0xa5, 0x31, 0xff},
+    };
+    const float factors[] = {1, 2, -3, 1001};
+    const float offsets[] = {0, -10, 400, -30000};
+    for(int i = 0; i < 4; i++) {
+        for(int size = 1; size <= 12; size++) {
+            CanSignal signal = {0};
+            signal.bitPosition = 3;
+            signal.bitSize = size;
+            signal.factor = factors[i];
+            signal.offset = offsets[i];
+            float expected = bitfield_parse_float(message.data,
+                    CAN_MESSAGE_SIZE, 3, size, factors[i], offsets[i]);
+            ck_assert(can::read::parseSignalBitfield(&signal, &message)
+                    == expected);
+            fail_unless(signal.integerScaling);
+        }
+    }
+
+    CanSignal wide = {0};
+    wide.bitPosition = 8;
+    wide.bitSize = 32;
+    wide.factor = 1;
+    can::read::parseSignalBitfield(&wide, &message);
+    fail_if(wide.integerScaling);
+
+    CanSignal fractional = {0};
+    fractional.bitSize = 8;
+    fractional.factor = 0.1;
+    can::read::parseSignalBitfield(&fractional, &message);
+    fail_if(fractional.integerScaling);
+}
+END_TEST
+
+START_TEST (test_parse_signal_odd_layout)
+{
+    CanSignal signal = {0};
+    signal.bitPosition = 60;
+    signal.bitSize = 8;
+    signal.factor = 1;
+    float expected = bitfield_parse_float(TEST_MESSAGE.data, CAN_MESSAGE_SIZE,
+            60, 8, 1, 0);
+    ck_assert(can::read::parseSignalBitfield(&signal, &TEST_MESSAGE)
+            == expected);
+    ck_assert_int_eq(signal.extraction, SIGNAL_EXTRACTION_GENERIC);
+}
+END_TEST
+
+START_TEST (test_load_frame_changed_bytes)
+{
+    CanMessageDefinition definition = {0};
+    CanMessage message = {
+        id: 0,
+        format: STANDARD,
+        data: {0x12, 0x34},
+    };
+    CanFrame frame = can::read::loadFrame(&definition, &message);
+    ck_assert_int_eq(frame.changedBytes, 0xff);
+    fail_unless(frame.data == 0x1234000000000000LL);
+
+    frame = can::read::loadFrame(&definition, &message);
+    ck_assert_int_eq(frame.changedBytes, 0);
+
+    message.data[1] = 0x35;
+    message.data[7] = 0x1;
+    frame = can::read::loadFrame(&definition, &message);
+    ck_assert_int_eq(frame.changedBytes, 0x82);
+
+    CanSignal signal = {0};
+    signal.bitPosition = 4;
+    signal.bitSize = 4;
+    fail_if(can::read::signalChanged(&signal, &frame));
+    signal.bitSize = 8;
+    fail_unless(can::read::signalChanged(&signal, &frame));
+    signal.bitPosition = 56;
+    fail_unless(can::read::signalChanged(&signal, &frame));
 }
 END_TEST
 
@@ -387,14 +711,61 @@ START_TEST (test_translate_float)
     fail_if(queueEmpty());
     fail_unless(getSignals()[0].received);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":42}\0");
 }
 END_TEST
 
+START_TEST (test_translate_decimal_places)
+{
+    getSignals()[0].decimalPlaces = 2;
+    bool send = true;
+    openxc_DynamicField decoded = can::read::decodeSignal(&getSignals()[0],
+            3.14159f, getSignals(), getSignalCount(), &send);
+    publishVehicleMessage("test", &decoded, &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot, "{\"name\":\"test\",\"value\":3.14}\0");
+}
+END_TEST
+
+START_TEST (test_translate_with_name_dictionary)
+{
+    openxc::pipeline::setNameDictionary(true);
+    getSignals()[1].decoder = floatDecoder;
+    can::read::translateSignal(&getSignals()[1],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot, "{\"name\":\"1\",\"value\":42}\0");
+}
+END_TEST
+
+START_TEST (test_publish_name_dictionary)
+{
+    can::read::publishNameDictionary(getSignals(), 2,
+            &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    std::string expected = std::string(
+            "{\"name\":\"signal_dictionary\",\"value\":0,\"event\":\"") +
+            getSignals()[0].genericName + "\"}";
+    ck_assert_str_eq((char*)snapshot, expected.c_str());
+}
+END_TEST
+
 int frequencyTestCounter = 0;
 openxc_DynamicField floatDecoderFrequencyTest(CanSignal* signal, CanSignal* signals,
         int signalCount, Pipeline* pipeline, float value, bool* send) {
@@ -444,8 +815,8 @@ START_TEST (test_translate_string)
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":\"foo\"}\0");
@@ -465,7 +836,7 @@ START_TEST (test_unlimited_frequency)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
@@ -479,7 +850,7 @@ START_TEST (test_limited_frequency)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -513,7 +884,7 @@ START_TEST (test_preserve_last_value)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
 
     CanMessage message = {
         id: 0,
@@ -525,8 +896,8 @@ START_TEST (test_preserve_last_value)
             getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":-19990}\0");
@@ -541,19 +912,288 @@ START_TEST (test_dont_send_same)
             getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"brake_pedal_status\",\"value\":true}\0");
 
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[2],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
 }
 END_TEST
 
+static bool sendAndRecord(CanSignal* signal, float value) {
+    bool send = can::read::shouldSend(signal, value);
+    signal->received = true;
+    signal->lastValue = value;
+    return send;
+}
+
+START_TEST (test_deadband)
+{
+    CanSignal* signal = &getSignals()[0];
+    signal->deadband = 1;
+    fail_unless(sendAndRecord(signal, 10));
+    fail_if(sendAndRecord(signal, 10.5));
+    fail_if(sendAndRecord(signal, 9.2));
+    fail_unless(sendAndRecord(signal, 11.5));
+    // compared against the last value sent, not the last one received
+    fail_if(sendAndRecord(signal, 11));
+    fail_if(sendAndRecord(signal, 12.4));
+    fail_unless(sendAndRecord(signal, 12.6));
+}
+END_TEST
+
+START_TEST (test_relative_deadband)
+{
+    CanSignal* signal = &getSignals()[0];
+    signal->relativeDeadband = .1;
+    fail_unless(sendAndRecord(signal, 100));
+    fail_if(sendAndRecord(signal, 105));
+    fail_unless(sendAndRecord(signal, 111));
+}
+END_TEST
+
+START_TEST (test_deadband_force_send_changed)
+{
+    CanSignal* signal = &getSignals()[0];
+    signal->deadband = 1;
+    signal->forceSendChanged = true;
+    signal->frequencyClock.frequency = 1;
+    fail_unless(sendAndRecord(signal, 10));
+    fail_if(sendAndRecord(signal, 10.5));
+    fail_unless(sendAndRecord(signal, 12));
+    signal->forceSendChanged = false;
+}
+END_TEST
+
+START_TEST (test_skip_decoding_unchanged)
+{
+    frequencyTestCounter = 0;
+    getSignals()[0].sendSame = false;
+    getSignals()[0].decoder = floatDecoderFrequencyTest;
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 1);
+
+    CanMessage changed = TEST_MESSAGE;
+    changed.data[0] = 0x1b;
+    can::read::translateSignal(&getSignals()[0],
+            &changed, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 2);
+}
+END_TEST
+
+START_TEST (test_always_decode_unchanged)
+{
+    frequencyTestCounter = 0;
+    getSignals()[0].sendSame = false;
+    getSignals()[0].alwaysDecode = true;
+    getSignals()[0].decoder = floatDecoderFrequencyTest;
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 2);
+    getSignals()[0].alwaysDecode = false;
+}
+END_TEST
+
+static void sendOnlyChangedMessageZeroSignals() {
+    for(int i = 0; i < getSignalCount(); i++) {
+        if(getSignals()[i].message == &getMessages()[0]) {
+            getSignals()[i].sendSame = false;
+        }
+    }
+}
+
+START_TEST (test_translate_message_skips_unchanged)
+{
+    fail_unless(can::read::indexSignalDispatch(getSignals(),
+                getSignalCount()));
+    sendOnlyChangedMessageZeroSignals();
+    frequencyTestCounter = 0;
+    getSignals()[0].decoder = floatDecoderFrequencyTest;
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 1);
+    fail_unless(getMessages()[0].quietUntilMs > FAKE_TIME);
+
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 1);
+
+    CanMessage changed = TEST_MESSAGE;
+    changed.data[0] = 0x1b;
+    can::read::translateMessageSignals(&getMessages()[0], &changed,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 2);
+
+    // a signal that sends every value needs every frame
+    getSignals()[6].sendSame = true;
+    can::read::translateMessageSignals(&getMessages()[0], &changed,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(getMessages()[0].quietUntilMs, 0);
+    getMessages()[0].frameLoaded = false;
+}
+END_TEST
+
+START_TEST (test_translate_unchanged_message_when_clock_due)
+{
+    fail_unless(can::read::indexSignalDispatch(getSignals(),
+                getSignalCount()));
+    sendOnlyChangedMessageZeroSignals();
+    getSignals()[0].frequencyClock.frequency = 1;
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(getMessages()[0].quietUntilMs, FAKE_TIME + 1000);
+
+    FAKE_TIME += 500;
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(getSignals()[0].frequencyClock.lastTick, 1000);
+
+    // the clock still ticks on time, as it would for each signal
+    FAKE_TIME += 500;
+    can::read::translateMessageSignals(&getMessages()[0], &TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(getSignals()[0].frequencyClock.lastTick, FAKE_TIME);
+    getMessages()[0].frameLoaded = false;
+}
+END_TEST
+
+START_TEST (test_aggregate_signal)
+{
+    getSignals()[0].decoder = floatDecoder;
+    ck_assert(can::read::setAggregation(&getSignals()[0], 1000));
+    ck_assert_int_eq(can::read::aggregationWindow(&getSignals()[0]), 1000);
+    for(int i = 0; i < 3; i++) {
+        can::read::translateSignal(&getSignals()[0],
+                &TEST_MESSAGE, getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline);
+    }
+    fail_unless(queueEmpty());
+    fail_unless(getSignals()[0].received);
+
+    can::read::publishAggregates(&getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+
+    FAKE_TIME += 1000;
+    can::read::publishAggregates(&getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    for(size_t i = 0; i < sizeof(snapshot) - 1; i++) {
+        if(snapshot[i] == NULL) {
+            snapshot[i] = ' ';
+        }
+    }
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"torque_at_transmission\","
+                "\"value\":42,\"event\":\"min\"}") != NULL);
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"torque_at_transmission\","
+                "\"value\":42,\"event\":\"mean\"}") != NULL);
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"torque_at_transmission\","
+                "\"value\":3,\"event\":\"count\"}") != NULL);
+
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    FAKE_TIME += 1000;
+    can::read::publishAggregates(&getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_aggregate_disabled)
+{
+    getSignals()[0].decoder = floatDecoder;
+    ck_assert(can::read::setAggregation(&getSignals()[0], 1000));
+    ck_assert(can::read::setAggregation(&getSignals()[0], 0));
+    ck_assert_int_eq(can::read::aggregationWindow(&getSignals()[0]), 0);
+    can::read::translateSignal(&getSignals()[0],
+            &TEST_MESSAGE, getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_virtual_signal_recomputed_on_change)
+{
+    virtuals::VirtualSignal doubled = {};
+    doubled.output.genericName = "doubled_torque";
+    doubled.output.sendSame = true;
+    doubled.inputNames[0] = "torque_at_transmission";
+    doubled.inputCount = 1;
+    doubled.compute = virtuals::sumInputs;
+    doubled.parameter = 2;
+    ck_assert(virtuals::addVirtualSignal(&doubled));
+    virtuals::bindVirtualSignals(getSignals(), getSignalCount());
+
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(doubled.output.received);
+    ck_assert_int_eq(doubled.output.lastValue, -39980);
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    for(size_t i = 0; i < sizeof(snapshot) - 1; i++) {
+        if(snapshot[i] == NULL) {
+            snapshot[i] = ' ';
+        }
+    }
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot,
+                "{\"name\":\"doubled_torque\",\"value\":-39980}") != NULL);
+
+    // the input didn't change, so there's nothing to recompute
+    doubled.output.received = false;
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(doubled.output.received);
+}
+END_TEST
+
+START_TEST (test_virtual_signal_missing_input)
+{
+    virtuals::VirtualSignal sum = {};
+    sum.output.genericName = "sum";
+    sum.inputNames[0] = "torque_at_transmission";
+    sum.inputNames[1] = "not_a_signal";
+    sum.inputCount = 2;
+    sum.compute = virtuals::sumInputs;
+    sum.parameter = 1;
+    ck_assert(virtuals::addVirtualSignal(&sum));
+    virtuals::bindVirtualSignals(getSignals(), getSignalCount());
+
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(sum.output.received);
+}
+END_TEST
+
+START_TEST (test_virtual_signal_accumulate_rollover)
+{
+    CanSignal counter = {};
+    counter.maxValue = 100;
+    virtuals::VirtualSignal total = {};
+    total.inputs[0] = &counter;
+    total.inputCount = 1;
+    total.parameter = .5;
+
+    bool send = true;
+    counter.lastValue = 90;
+    ck_assert_int_eq(virtuals::accumulateRollover(&total, 0, 80, &send), 5);
+    counter.lastValue = 10;
+    ck_assert_int_eq(virtuals::accumulateRollover(&total, 0, 90, &send), 15);
+    fail_unless(send);
+}
+END_TEST
+
 Suite* canreadSuite(void) {
     Suite* s = suite_create("canread");
     TCase *tc_core = tcase_create("core");
@@ -562,6 +1202,11 @@ Suite* canreadSuite(void) {
     tcase_add_test(tc_core, test_boolean_decoder);
     tcase_add_test(tc_core, test_ignore_decoder);
     tcase_add_test(tc_core, test_state_decoder);
+    tcase_add_test(tc_core, test_decode_signal_builtin_decoders);
+    tcase_add_test(tc_core, test_parse_signal_matches_generic);
+    tcase_add_test(tc_core, test_parse_signal_integer_scaling);
+    tcase_add_test(tc_core, test_parse_signal_odd_layout);
+    tcase_add_test(tc_core, test_load_frame_changed_bytes);
     suite_add_tcase(s, tc_core);
 
     TCase *tc_sending = tcase_create("sending");
@@ -576,12 +1221,17 @@ Suite* canreadSuite(void) {
     tcase_add_test(tc_sending, test_passthrough_message);
     tcase_add_test(tc_sending, test_passthrough_limited_frequency);
     tcase_add_test(tc_sending, test_passthrough_force_send_changed);
+    tcase_add_test(tc_sending, test_passthrough_selected_ids);
+    tcase_add_test(tc_sending, test_passthrough_deltas);
     suite_add_tcase(s, tc_sending);
 
     TCase *tc_translate = tcase_create("translate");
     tcase_add_checked_fixture(tc_translate, setup, NULL);
     tcase_add_test(tc_translate, test_translate_float);
     tcase_add_test(tc_translate, test_translate_string);
+    tcase_add_test(tc_translate, test_translate_with_name_dictionary);
+    tcase_add_test(tc_translate, test_translate_decimal_places);
+    tcase_add_test(tc_translate, test_publish_name_dictionary);
     tcase_add_test(tc_translate, test_limited_frequency);
     tcase_add_test(tc_translate, test_unlimited_frequency);
     tcase_add_test(tc_translate, test_always_send_first);
@@ -589,6 +1239,13 @@ Suite* canreadSuite(void) {
     tcase_add_test(tc_translate, test_translate_ignore_decoder_still_received);
     tcase_add_test(tc_translate, test_default_decoder);
     tcase_add_test(tc_translate, test_dont_send_same);
+    tcase_add_test(tc_translate, test_skip_decoding_unchanged);
+    tcase_add_test(tc_translate, test_deadband);
+    tcase_add_test(tc_translate, test_relative_deadband);
+    tcase_add_test(tc_translate, test_deadband_force_send_changed);
+    tcase_add_test(tc_translate, test_always_decode_unchanged);
+    tcase_add_test(tc_translate, test_aggregate_signal);
+    tcase_add_test(tc_translate, test_aggregate_disabled);
     tcase_add_test(tc_translate, test_translate_respects_send_value);
     tcase_add_test(tc_translate,
             test_decoder_called_every_time_with_nonzero_frequency);
@@ -596,6 +1253,19 @@ Suite* canreadSuite(void) {
             test_decoder_called_every_time_with_unlimited_frequency);
     tcase_add_test(tc_translate,
             test_translate_many_signals);
+    tcase_add_test(tc_translate, test_translate_message_signals);
+    tcase_add_test(tc_translate, test_translate_message_signals_not_indexed);
+    tcase_add_test(tc_translate, test_translate_message_skips_unchanged);
+    tcase_add_test(tc_translate,
+            test_translate_unchanged_message_when_clock_due);
+    tcase_add_test(tc_translate,
+            test_translate_message_signals_skips_disabled);
+    tcase_add_test(tc_translate,
+            test_translate_message_signals_rejects_bad_checksum);
+    tcase_add_test(tc_translate, test_dispatch_message);
+    tcase_add_test(tc_translate, test_virtual_signal_recomputed_on_change);
+    tcase_add_test(tc_translate, test_virtual_signal_missing_input);
+    tcase_add_test(tc_translate, test_virtual_signal_accumulate_rollover);
     suite_add_tcase(s, tc_translate);
 
     return s;
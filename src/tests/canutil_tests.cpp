@@ -24,7 +24,10 @@ using openxc::signals::getSignalCount;
 using openxc::signals::getCommands;
 using openxc::signals::getCommandCount;
 
+extern unsigned long FAKE_TIME;
+
 void setup() {
+    can::spy::setErrorCounters(0, 0, false);
     for(int i = 0; i < getCanBusCount(); i++) {
         can::initializeCommon(&getCanBuses()[i]);
     }
@@ -104,6 +107,52 @@ START_TEST (test_lookup_signal_state_by_value)
 }
 END_TEST
 
+static const CanSignalState DIRECT_STATES[] = {
+    {3, "three"}, {4, "four"}, {5, "five"},
+};
+
+static const CanSignalState SORTED_STATES[] = {
+    {1, "one"}, {4, "four"}, {9, "nine"}, {16, "sixteen"},
+};
+
+static const CanSignalState UNSORTED_STATES[] = {
+    {4, "four"}, {1, "one"}, {9, "nine"},
+};
+
+START_TEST (test_prepared_signal_states)
+{
+    CanSignal signal = {0};
+    signal.states = DIRECT_STATES;
+    signal.stateCount = 3;
+    openxc::can::prepareSignalStates(&signal);
+    ck_assert_int_eq(signal.stateLookup, SIGNAL_STATES_DIRECT);
+    fail_unless(lookupSignalState(5, &signal) == &DIRECT_STATES[2]);
+    fail_unless(lookupSignalState(3, &signal) == &DIRECT_STATES[0]);
+    fail_unless(lookupSignalState(2, &signal) == NULL);
+    fail_unless(lookupSignalState(6, &signal) == NULL);
+
+    memset(&signal, 0, sizeof(signal));
+    signal.states = SORTED_STATES;
+    signal.stateCount = 4;
+    openxc::can::prepareSignalStates(&signal);
+    ck_assert_int_eq(signal.stateLookup, SIGNAL_STATES_SORTED);
+    for(int i = 0; i < 4; i++) {
+        fail_unless(lookupSignalState(SORTED_STATES[i].value, &signal) ==
+                &SORTED_STATES[i]);
+    }
+    fail_unless(lookupSignalState(5, &signal) == NULL);
+    fail_unless(lookupSignalState(17, &signal) == NULL);
+
+    memset(&signal, 0, sizeof(signal));
+    signal.states = UNSORTED_STATES;
+    signal.stateCount = 3;
+    openxc::can::prepareSignalStates(&signal);
+    ck_assert_int_eq(signal.stateLookup, SIGNAL_STATES_LINEAR);
+    fail_unless(lookupSignalState(1, &signal) == &UNSORTED_STATES[1]);
+    fail_unless(lookupSignalState(2, &signal) == NULL);
+}
+END_TEST
+
 START_TEST (test_lookup_command)
 {
     fail_unless(lookupCommand("does_not_exist", getCommands(), getCommandCount()
@@ -113,6 +162,32 @@ START_TEST (test_lookup_command)
 }
 END_TEST
 
+START_TEST (test_lookup_indexed_signal)
+{
+    can::indexSignalNames(getSignals(), getSignalCount(), getCommands(),
+            getCommandCount());
+    for(int i = 0; i < getSignalCount(); i++) {
+        CanSignal* signal = lookupSignal(getSignals()[i].genericName,
+                getSignals(), getSignalCount());
+        ck_assert_str_eq(signal->genericName, getSignals()[i].genericName);
+    }
+    fail_unless(lookupSignal("does_not_exist", getSignals(), getSignalCount())
+            == NULL);
+    fail_unless(lookupSignal("command", getSignals(),
+            getSignalCount(), false) == &getSignals()[4]);
+    fail_unless(lookupSignal("command", getSignals(),
+            getSignalCount(), true) == &getSignals()[5]);
+    fail_unless(lookupSignal("torque_at_transmission", getSignals(),
+            getSignalCount()) == &getSignals()[0]);
+
+    fail_unless(lookupCommand("does_not_exist", getCommands(), getCommandCount()
+                ) == NULL);
+    fail_unless(lookupCommand("turn_signal_status", getCommands(), getCommandCount())
+            == &getCommands()[0]);
+    can::indexSignalNames(NULL, 0, NULL, 0);
+}
+END_TEST
+
 START_TEST (test_initialize)
 {
     CanBus bus = {500, 0x101};
@@ -121,6 +196,107 @@ START_TEST (test_initialize)
 }
 END_TEST
 
+START_TEST (test_snapshot_counters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->messagesReceived = 10;
+    bus->messagesDropped = 2;
+    bus->passthroughDropped = 3;
+
+    can::CanBusCounters counters;
+    can::snapshotCounters(bus, &counters);
+    ck_assert_int_eq(counters.received, 10);
+    ck_assert_int_eq(counters.dropped, 5);
+    ck_assert_int_eq(counters.receiveQueueLength, 0);
+    ck_assert_int_eq(counters.sendQueueLength, 0);
+}
+END_TEST
+
+START_TEST (test_frame_bit_length)
+{
+    // 34 dominant bits from the start of frame through the CRC, with a stuff
+    // bit after every 5 of them
+    CanMessage empty = {0, CanMessageFormat::STANDARD, {0}, 0};
+    ck_assert_int_eq(can::frameBitLength(&empty), 53);
+
+    CanMessage alternating = {0x123, CanMessageFormat::STANDARD,
+        {0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55}, 8};
+    ck_assert_int_eq(can::frameBitLength(&alternating), 112);
+
+    CanMessage extended = {0x18daf110, CanMessageFormat::EXTENDED,
+        {0x2, 0x1, 0xc}, 8};
+    ck_assert_int_eq(can::frameBitLength(&extended), 142);
+}
+END_TEST
+
+START_TEST (test_bus_load)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->speed = 500000;
+    bus->bitsReceived += 250000;
+    bus->messagesReceived += 100;
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busLoad, 0);
+
+    FAKE_TIME += CAN_BUS_LOAD_WINDOW_MS;
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busLoad, 500);
+
+    // Dropped messages count at the average length of the received ones
+    bus->bitsReceived += 125000;
+    bus->messagesReceived += 50;
+    bus->messagesDropped += 50;
+    FAKE_TIME += CAN_BUS_LOAD_WINDOW_MS;
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busLoad, 500);
+
+    FAKE_TIME += CAN_BUS_LOAD_WINDOW_MS;
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busLoad, 0);
+    ck_assert_int_eq(bus->peakBusLoad, 500);
+}
+END_TEST
+
+START_TEST (test_error_counters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    can::spy::setErrorCounters(12, 130, false);
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->transmitErrorCount, 12);
+    ck_assert_int_eq(bus->receiveErrorCount, 130);
+    ck_assert_int_eq(bus->peakErrorCount, 130);
+
+    can::spy::setErrorCounters(0, 1, false);
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->receiveErrorCount, 1);
+    ck_assert_int_eq(bus->peakErrorCount, 130);
+}
+END_TEST
+
+START_TEST (test_bus_off_recovery)
+{
+    CanBus* bus = &getCanBuses()[0];
+    int recoveries = can::spy::busOffRecoveryCount();
+    can::spy::setErrorCounters(255, 0, true);
+    can::updateBusStatus(bus);
+    ck_assert(bus->busOff);
+    ck_assert_int_eq(bus->busOffCount, 1);
+    ck_assert_int_eq(can::spy::busOffRecoveryCount(), recoveries + 1);
+
+    // Still recovering - the same bus off isn't counted twice
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busOffCount, 1);
+
+    can::spy::setErrorCounters(0, 0, false);
+    can::updateBusStatus(bus);
+    ck_assert(!bus->busOff);
+
+    can::spy::setErrorCounters(255, 0, true);
+    can::updateBusStatus(bus);
+    ck_assert_int_eq(bus->busOffCount, 2);
+}
+END_TEST
+
 START_TEST (test_get_can_message_definition_predefined)
 {
     CanMessageDefinition* message = lookupMessageDefinition(&getCanBuses()[0], 1,
@@ -148,6 +324,109 @@ START_TEST (test_register_can_message)
 }
 END_TEST
 
+START_TEST (test_register_can_message_extended)
+{
+    ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID, CanMessageFormat::EXTENDED, getMessages(), getMessageCount()));
+    CanMessageDefinition* message = lookupMessageDefinition(&getCanBuses()[0],
+            MESSAGE_ID, CanMessageFormat::EXTENDED, getMessages(), getMessageCount());
+    ck_assert(message != NULL);
+    ck_assert(message->format == CanMessageFormat::EXTENDED);
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], MESSAGE_ID,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount()) == NULL);
+}
+END_TEST
+
+START_TEST (test_lookup_j1939_by_pgn)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->j1939 = true;
+    ck_assert(registerMessageDefinition(bus, 0x18fef100,
+                CanMessageFormat::EXTENDED, getMessages(), getMessageCount()));
+    // Same PGN from another source address, at another priority
+    CanMessageDefinition* message = lookupMessageDefinition(bus, 0x0cfef117,
+            CanMessageFormat::EXTENDED, getMessages(), getMessageCount());
+    ck_assert(message != NULL);
+    ck_assert_int_eq(message->id, 0x18fef100);
+    ck_assert(lookupMessageDefinition(bus, 0x18fef200,
+            CanMessageFormat::EXTENDED, getMessages(),
+            getMessageCount()) == NULL);
+    bus->j1939 = false;
+    ck_assert(lookupMessageDefinition(bus, 0x0cfef117,
+            CanMessageFormat::EXTENDED, getMessages(),
+            getMessageCount()) == NULL);
+}
+END_TEST
+
+START_TEST (test_register_can_message_fill_dynamic)
+{
+    for(int i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID + i,
+                    CanMessageFormat::STANDARD, getMessages(),
+                    getMessageCount()));
+    }
+    ck_assert_int_eq(can::dynamicMessagePoolUsage(), MAX_DYNAMIC_MESSAGE_COUNT);
+
+    // Use every message but the second, so it's the least recently used
+    for(int i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        if(i != 1) {
+            ck_assert(lookupMessageDefinition(&getCanBuses()[0],
+                    MESSAGE_ID + i, CanMessageFormat::STANDARD,
+                    getMessages(), getMessageCount()) != NULL);
+        }
+    }
+
+    ck_assert(registerMessageDefinition(&getCanBuses()[0], 999,
+                CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
+    ck_assert_int_eq(getCanBuses()[0].dynamicMessagesEvicted, 1);
+    ck_assert_int_eq(getCanBuses()[0].dynamicMessageCount,
+            MAX_DYNAMIC_MESSAGE_COUNT);
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], 999,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount())
+            != NULL);
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], MESSAGE_ID + 1,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount())
+            == NULL);
+
+    for(int i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        if(i != 1) {
+            CanMessageDefinition* message = lookupMessageDefinition(
+                    &getCanBuses()[0], MESSAGE_ID + i,
+                    CanMessageFormat::STANDARD, getMessages(),
+                    getMessageCount());
+            ck_assert(message != NULL);
+            ck_assert_int_eq(message->id, MESSAGE_ID + i);
+        }
+    }
+
+    // predefined messages are still found alongside the dynamic ones
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], 1,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount())
+            == &getMessages()[1]);
+}
+END_TEST
+
+START_TEST (test_dynamic_messages_shared_between_buses)
+{
+    for(int i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID + i,
+                    CanMessageFormat::STANDARD, getMessages(),
+                    getMessageCount()));
+    }
+
+    ck_assert(registerMessageDefinition(&getCanBuses()[1], MESSAGE_ID,
+                CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
+    ck_assert_int_eq(getCanBuses()[0].dynamicMessagesEvicted, 1);
+    ck_assert_int_eq(getCanBuses()[0].dynamicMessageCount,
+            MAX_DYNAMIC_MESSAGE_COUNT - 1);
+    ck_assert_int_eq(getCanBuses()[1].dynamicMessageCount, 1);
+
+    ck_assert(unregisterMessageDefinition(&getCanBuses()[1], MESSAGE_ID,
+                CanMessageFormat::STANDARD));
+    ck_assert_int_eq(can::dynamicMessagePoolUsage(),
+            MAX_DYNAMIC_MESSAGE_COUNT - 1);
+}
+END_TEST
+
 START_TEST (test_register_can_message_twice)
 {
     ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID, CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
@@ -219,19 +498,203 @@ START_TEST (test_set_acceptance_filter_status)
 }
 END_TEST
 
+START_TEST (test_should_accept_message_filtered)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    uint32_t ids[] = {0x7e8, 0x1, 0x42, 0x100};
+    for(int i = 0; i < 4; i++) {
+        ck_assert(can::addAcceptanceFilter(bus, ids[i],
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    }
+
+    for(int i = 0; i < 4; i++) {
+        ck_assert(can::shouldAcceptMessage(bus, ids[i]));
+    }
+    ck_assert(!can::shouldAcceptMessage(bus, 0x2));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7ff));
+
+    can::removeAcceptanceFilter(bus, 0x42, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!can::shouldAcceptMessage(bus, 0x42));
+    ck_assert(can::shouldAcceptMessage(bus, 0x100));
+}
+END_TEST
+
+START_TEST (test_should_accept_message_extended)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    uint32_t ids[] = {0x0, 0x7ff, 0x800, 0x18daf110, 0x1fffffff};
+    for(int i = 0; i < 5; i++) {
+        ck_assert(can::addAcceptanceFilter(bus, ids[i],
+                CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount()));
+    }
+
+    for(int i = 0; i < 5; i++) {
+        ck_assert(can::shouldAcceptMessage(bus, ids[i]));
+    }
+    ck_assert(!can::shouldAcceptMessage(bus, 0x1));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7fe));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x801));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x18daf111));
+
+    can::removeAcceptanceFilter(bus, 0x7ff, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+    can::removeAcceptanceFilter(bus, 0x18daf110, CanMessageFormat::EXTENDED,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7ff));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x18daf110));
+    ck_assert(can::shouldAcceptMessage(bus, 0x0));
+    ck_assert(can::shouldAcceptMessage(bus, 0x1fffffff));
+}
+END_TEST
+
+START_TEST (test_should_accept_message_bypassed)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = true;
+    ck_assert(can::shouldAcceptMessage(bus, 0x2));
+}
+END_TEST
+
+START_TEST (test_filter_range_updates_hardware_once)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    int updates = can::spy::acceptanceFilterUpdateCount();
+    ck_assert(can::addAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(updates + 1, can::spy::acceptanceFilterUpdateCount());
+    for(uint32_t id = 0x7e8; id <= 0x7ef; id++) {
+        ck_assert(can::shouldAcceptMessage(bus, id));
+    }
+
+    can::removeAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
+    ck_assert_int_eq(updates + 2, can::spy::acceptanceFilterUpdateCount());
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7e8));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7ef));
+}
+END_TEST
+
+START_TEST (test_filter_range_refcounted)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(can::addAcceptanceFilter(bus, 0x7e9,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert(can::addAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    can::removeAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
+    ck_assert(can::shouldAcceptMessage(bus, 0x7e9));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7e8));
+}
+END_TEST
+
+START_TEST (test_filter_range_rolled_back_when_full)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    for(int i = 0; i < MAX_ACCEPTANCE_FILTERS - 2; i++) {
+        ck_assert(can::addAcceptanceFilter(bus, 0x100 + i,
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    }
+
+    ck_assert(!can::addAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7e8));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x7e9));
+    ck_assert(can::addAcceptanceFilterRange(bus, 0x7e8, 2,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+}
+END_TEST
+
+START_TEST (test_nested_filter_batches)
+{
+    CanBus* bus = &getCanBuses()[0];
+    int updates = can::spy::acceptanceFilterUpdateCount();
+    can::beginAcceptanceFilterUpdate();
+    ck_assert(can::addAcceptanceFilter(bus, 0x42,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert(can::addAcceptanceFilterRange(bus, 0x7e8, 8,
+            CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(updates, can::spy::acceptanceFilterUpdateCount());
+    ck_assert(can::commitAcceptanceFilterUpdate(getCanBuses(),
+            getCanBusCount()));
+    ck_assert_int_eq(updates + 1, can::spy::acceptanceFilterUpdateCount());
+    ck_assert(!can::commitAcceptanceFilterUpdate(getCanBuses(),
+            getCanBusCount()));
+}
+END_TEST
+
+START_TEST (test_compile_filters_merges_ranges)
+{
+    CanBus* bus = &getCanBuses()[0];
+    uint32_t ids[] = {0x7ea, 0x100, 0x7e8, 0x7e9, 0x101, 0x42};
+    for(int i = 0; i < 6; i++) {
+        ck_assert(can::addAcceptanceFilter(bus, ids[i],
+                CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount()));
+    }
+    ck_assert(can::addAcceptanceFilter(bus, 0x102,
+            CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount()));
+
+    AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+    ck_assert_int_eq(4, can::compileAcceptanceFilters(bus, ranges,
+                MAX_ACCEPTANCE_FILTERS));
+    ck_assert_int_eq(0x42, ranges[0].lowId);
+    ck_assert_int_eq(0x42, ranges[0].highId);
+    ck_assert_int_eq(0x100, ranges[1].lowId);
+    ck_assert_int_eq(0x101, ranges[1].highId);
+    ck_assert_int_eq(0x7e8, ranges[2].lowId);
+    ck_assert_int_eq(0x7ea, ranges[2].highId);
+    ck_assert_int_eq(CanMessageFormat::STANDARD, ranges[2].format);
+    // an extended ID doesn't extend a run of standard IDs
+    ck_assert_int_eq(0x102, ranges[3].lowId);
+    ck_assert_int_eq(CanMessageFormat::EXTENDED, ranges[3].format);
+
+    ck_assert_int_eq(-1, can::compileAcceptanceFilters(bus, ranges, 3));
+}
+END_TEST
+
+START_TEST (test_compile_filters_empty)
+{
+    AcceptanceFilterRange ranges[MAX_ACCEPTANCE_FILTERS];
+    ck_assert_int_eq(0, can::compileAcceptanceFilters(&getCanBuses()[0],
+                ranges, MAX_ACCEPTANCE_FILTERS));
+}
+END_TEST
+
 Suite* canutilSuite(void) {
     Suite* s = suite_create("canutil");
     TCase *tc_core = tcase_create("core");
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_initialize);
+    tcase_add_test(tc_core, test_snapshot_counters);
+    tcase_add_test(tc_core, test_frame_bit_length);
+    tcase_add_test(tc_core, test_bus_load);
+    tcase_add_test(tc_core, test_error_counters);
+    tcase_add_test(tc_core, test_bus_off_recovery);
     tcase_add_test(tc_core, test_can_signal_struct);
     tcase_add_test(tc_core, test_can_signal_states);
     tcase_add_test(tc_core, test_lookup_signal);
     tcase_add_test(tc_core, test_lookup_writable_signal);
     tcase_add_test(tc_core, test_lookup_signal_state_by_name);
     tcase_add_test(tc_core, test_lookup_signal_state_by_value);
+    tcase_add_test(tc_core, test_prepared_signal_states);
     tcase_add_test(tc_core, test_lookup_command);
+    tcase_add_test(tc_core, test_lookup_indexed_signal);
     tcase_add_test(tc_core, test_set_acceptance_filter_status);
+    tcase_add_test(tc_core, test_should_accept_message_filtered);
+    tcase_add_test(tc_core, test_should_accept_message_extended);
+    tcase_add_test(tc_core, test_should_accept_message_bypassed);
+    tcase_add_test(tc_core, test_filter_range_updates_hardware_once);
+    tcase_add_test(tc_core, test_filter_range_refcounted);
+    tcase_add_test(tc_core, test_filter_range_rolled_back_when_full);
+    tcase_add_test(tc_core, test_nested_filter_batches);
+    tcase_add_test(tc_core, test_compile_filters_merges_ranges);
+    tcase_add_test(tc_core, test_compile_filters_empty);
     suite_add_tcase(s, tc_core);
 
     TCase *tc_message_def = tcase_create("message_definitions");
@@ -239,6 +702,10 @@ Suite* canutilSuite(void) {
     tcase_add_test(tc_message_def, test_get_can_message_definition_predefined);
     tcase_add_test(tc_message_def, test_get_can_message_definition_undefined);
     tcase_add_test(tc_message_def, test_register_can_message);
+    tcase_add_test(tc_message_def, test_register_can_message_extended);
+    tcase_add_test(tc_message_def, test_lookup_j1939_by_pgn);
+    tcase_add_test(tc_message_def, test_register_can_message_fill_dynamic);
+    tcase_add_test(tc_message_def, test_dynamic_messages_shared_between_buses);
     tcase_add_test(tc_message_def, test_register_can_message_twice);
     tcase_add_test(tc_message_def, test_register_can_message_diff_bus);
     tcase_add_test(tc_message_def, test_unregister_can_message);
@@ -23,6 +23,10 @@ void setup() {
         getSignals()[i].frequencyClock = {0};
     }
     QUEUE_INIT(CanMessage, &getCanBuses()[0].sendQueue);
+    getCanBuses()[0].pendingWriteCount = 0;
+    getCanBuses()[0].writesExpired = 0;
+    getCanBuses()[0].writeHandler = openxc::can::write::sendMessage;
+    can::write::clearPeriodicWrites();
 }
 
 START_TEST (test_build_message)
@@ -332,6 +336,135 @@ START_TEST (test_basic_flush)
 }
 END_TEST
 
+extern unsigned long FAKE_TIME;
+
+static uint32_t WRITTEN_IDS[CAN_PENDING_WRITE_COUNT];
+static int writtenCount = 0;
+static bool controllerBusy = false;
+
+bool recordingWriteHandler(const CanBus* bus, const CanMessage* message) {
+    if(controllerBusy) {
+        return false;
+    }
+    WRITTEN_IDS[writtenCount++] = message->id;
+    return true;
+}
+
+static void queueMessage(uint32_t id, CanMessageFormat format) {
+    CanMessage message = {id: id, format: format};
+    can::write::enqueueMessage(&getCanBuses()[0], &message);
+}
+
+START_TEST (test_flush_in_arbitration_order)
+{
+    writtenCount = 0;
+    controllerBusy = false;
+    getCanBuses()[0].writeHandler = recordingWriteHandler;
+    queueMessage(0x7df, CanMessageFormat::STANDARD);
+    queueMessage(0x100, CanMessageFormat::EXTENDED);
+    queueMessage(0x200, CanMessageFormat::STANDARD);
+    queueMessage(0x7df, CanMessageFormat::STANDARD);
+    queueMessage(0x40, CanMessageFormat::STANDARD);
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+
+    ck_assert_int_eq(writtenCount, 5);
+    // an extended ID's base is its top 11 bits, so 0x100 is at the front
+    ck_assert_int_eq(WRITTEN_IDS[0], 0x100);
+    ck_assert_int_eq(WRITTEN_IDS[1], 0x40);
+    ck_assert_int_eq(WRITTEN_IDS[2], 0x200);
+    ck_assert_int_eq(WRITTEN_IDS[3], 0x7df);
+    ck_assert_int_eq(WRITTEN_IDS[4], 0x7df);
+    ck_assert_int_eq(getCanBuses()[0].pendingWriteCount, 0);
+}
+END_TEST
+
+START_TEST (test_busy_controller_retries_then_expires)
+{
+    writtenCount = 0;
+    controllerBusy = true;
+    getCanBuses()[0].writeHandler = recordingWriteHandler;
+    queueMessage(0x300, CanMessageFormat::STANDARD);
+    CanMessage urgent = {id: 0x310, format: CanMessageFormat::STANDARD};
+    ck_assert(can::write::enqueueMessage(&getCanBuses()[0], &urgent, 10));
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(getCanBuses()[0].pendingWriteCount, 2);
+    fail_unless(QUEUE_EMPTY(CanMessage, &getCanBuses()[0].sendQueue));
+
+    // the deadlined message has expired by the time the controller is free
+    FAKE_TIME += 11;
+    controllerBusy = false;
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 1);
+    ck_assert_int_eq(WRITTEN_IDS[0], 0x300);
+    ck_assert_int_eq(getCanBuses()[0].writesExpired, 1);
+
+    controllerBusy = true;
+    queueMessage(0x320, CanMessageFormat::STANDARD);
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    FAKE_TIME += CAN_WRITE_RETRY_MS + 1;
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(getCanBuses()[0].pendingWriteCount, 0);
+    ck_assert_int_eq(getCanBuses()[0].writesExpired, 2);
+}
+END_TEST
+
+START_TEST (test_transmit_interrupt_sends_pending)
+{
+    writtenCount = 0;
+    controllerBusy = true;
+    getCanBuses()[0].writeHandler = recordingWriteHandler;
+    queueMessage(0x500, CanMessageFormat::STANDARD);
+    queueMessage(0x400, CanMessageFormat::STANDARD);
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(getCanBuses()[0].pendingWriteCount, 2);
+
+    // a transmit buffer emptied - the interrupt sends without a flush
+    controllerBusy = false;
+    can::write::sendPendingWrites(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 2);
+    ck_assert_int_eq(WRITTEN_IDS[0], 0x400);
+    ck_assert_int_eq(WRITTEN_IDS[1], 0x500);
+    ck_assert_int_eq(getCanBuses()[0].pendingWriteCount, 0);
+}
+END_TEST
+
+START_TEST (test_periodic_write)
+{
+    writtenCount = 0;
+    controllerBusy = false;
+    getCanBuses()[0].writeHandler = recordingWriteHandler;
+    CanMessage keepAlive = {id: 0x7df, format: CanMessageFormat::STANDARD};
+    ck_assert(can::write::addPeriodicWrite(&getCanBuses()[0], &keepAlive, 10));
+    ck_assert(can::write::addPeriodicWrite(&getCanBuses()[1], &keepAlive, 10));
+
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 1);
+    ck_assert_int_eq(WRITTEN_IDS[0], 0x7df);
+
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 1);
+
+    FAKE_TIME += 100;
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 2);
+
+    ck_assert(can::write::removePeriodicWrite(&getCanBuses()[0], 0x7df,
+                CanMessageFormat::STANDARD));
+    fail_if(can::write::removePeriodicWrite(&getCanBuses()[0], 0x7df,
+                CanMessageFormat::STANDARD));
+    FAKE_TIME += 100;
+    can::write::flushOutgoingCanMessageQueue(&getCanBuses()[0]);
+    ck_assert_int_eq(writtenCount, 2);
+}
+END_TEST
+
+START_TEST (test_periodic_write_invalid_frequency)
+{
+    CanMessage keepAlive = {id: 0x7df, format: CanMessageFormat::STANDARD};
+    fail_if(can::write::addPeriodicWrite(&getCanBuses()[0], &keepAlive, 0));
+}
+END_TEST
+
 Suite* canwriteSuite(void) {
     Suite* s = suite_create("canwrite");
 
@@ -370,6 +503,11 @@ Suite* canwriteSuite(void) {
     tcase_add_checked_fixture(tc_flush, setup, NULL);
     tcase_add_test(tc_flush, test_flush_empty);
     tcase_add_test(tc_flush, test_basic_flush);
+    tcase_add_test(tc_flush, test_flush_in_arbitration_order);
+    tcase_add_test(tc_flush, test_busy_controller_retries_then_expires);
+    tcase_add_test(tc_flush, test_transmit_interrupt_sends_pending);
+    tcase_add_test(tc_flush, test_periodic_write);
+    tcase_add_test(tc_flush, test_periodic_write_invalid_frequency);
     tcase_add_test(tc_flush, test_no_flush_handler);
     tcase_add_test(tc_flush, test_failed_flush_handler);
     suite_add_tcase(s, tc_flush);
@@ -0,0 +1,212 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "capture.h"
+#include "signals.h"
+#include "can/canread.h"
+#include "pipeline.h"
+#include "config.h"
+
+namespace usb = openxc::interface::usb;
+namespace can = openxc::can;
+namespace capture = openxc::capture;
+
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::signals::getCanBuses;
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+static void receive(uint32_t id) {
+    CanMessage message = {
+        id: id,
+        format: CanMessageFormat::STANDARD,
+        data: {0x1, 0x2},
+        length: 2,
+        receivedUs: FAKE_TIME * 1000
+    };
+    capture::record(&getCanBuses()[0], &message);
+}
+
+/* Private: Return the output queue as a string, with the delimiters between
+ * messages replaced by spaces.
+ */
+static void readOutput(char* output, size_t size) {
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, (uint8_t*) output, size);
+    size_t length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+    if(length > size - 1) {
+        length = size - 1;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(output[i] == '\0') {
+            output[i] = ' ';
+        }
+    }
+    output[length] = '\0';
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    initializeVehicleInterface();
+    getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    getSignals()[0].received = false;
+    getSignals()[0].sendSame = true;
+    getSignals()[0].frequencyClock = {0};
+    capture::clearTriggers();
+    capture::reset();
+}
+
+const CanMessage TEST_MESSAGE = {
+    id: 0,
+    format: STANDARD,
+    data: {0xeb},
+};
+
+const CanMessage OTHER_TEST_MESSAGE = {
+    id: 0,
+    format: STANDARD,
+    data: {0xec},
+};
+
+START_TEST (test_dump_around_trigger)
+{
+    receive(0x1);
+    FAKE_TIME = 10000;
+    receive(0x2);
+    ck_assert(capture::trigger("test"));
+    ck_assert(capture::dumping());
+
+    FAKE_TIME = 11000;
+    receive(0x3);
+    FAKE_TIME = 13000;
+    receive(0x4);
+    capture::process(&getConfiguration()->pipeline);
+    ck_assert(!capture::dumping());
+
+    char output[512];
+    readOutput(output, sizeof(output));
+    const char* start = strstr(output,
+            "{\"name\":\"can_capture\",\"value\":\"test\","
+            "\"event\":\"start\"}");
+    const char* end = strstr(output,
+            "{\"name\":\"can_capture\",\"value\":\"test\",\"event\":\"end\"}");
+    ck_assert(start != NULL);
+    ck_assert(end != NULL);
+    ck_assert(start < end);
+    ck_assert(strstr(output, "\"id\":1,") == NULL);
+    ck_assert(strstr(output, "\"id\":2,") != NULL);
+    ck_assert(strstr(output, "\"id\":3,") != NULL);
+    ck_assert(strstr(output, "\"id\":4,") == NULL);
+}
+END_TEST
+
+START_TEST (test_dump_waits_for_post_trigger_window)
+{
+    receive(0x1);
+    ck_assert(capture::trigger("test"));
+    capture::process(&getConfiguration()->pipeline);
+    ck_assert(capture::dumping());
+
+    FAKE_TIME += 1000;
+    receive(0x2);
+    capture::process(&getConfiguration()->pipeline);
+    ck_assert(capture::dumping());
+
+    FAKE_TIME += DEFAULT_CAN_CAPTURE_POST_TRIGGER_MS;
+    capture::process(&getConfiguration()->pipeline);
+    ck_assert(!capture::dumping());
+
+    char output[512];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "\"id\":1,") != NULL);
+    ck_assert(strstr(output, "\"id\":2,") != NULL);
+}
+END_TEST
+
+START_TEST (test_ring_overwrites_oldest)
+{
+    for(int i = 0; i < CAN_CAPTURE_FRAME_COUNT + 1; i++) {
+        receive(0x100 + i);
+    }
+    ck_assert(capture::trigger("test"));
+    capture::process(&getConfiguration()->pipeline);
+
+    char output[USB_SEND_QUEUE_SIZE + 1];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "\"id\":256,") == NULL);
+    ck_assert(strstr(output, "\"id\":257,") != NULL);
+}
+END_TEST
+
+START_TEST (test_signal_trigger)
+{
+    ck_assert(capture::addTrigger("torque_at_transmission",
+                capture::CHANGED, 0));
+    receive(0x1);
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert(!capture::dumping());
+
+    can::read::translateSignal(&getSignals()[0], &OTHER_TEST_MESSAGE,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert(capture::dumping());
+}
+END_TEST
+
+START_TEST (test_signal_trigger_threshold)
+{
+    ck_assert(capture::addTrigger("torque_at_transmission",
+                capture::ABOVE, 0));
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert(!capture::dumping());
+
+    capture::clearTriggers();
+    getSignals()[0].received = false;
+    ck_assert(capture::addTrigger("torque_at_transmission",
+                capture::BELOW, 0));
+    can::read::translateSignal(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert(capture::dumping());
+}
+END_TEST
+
+START_TEST (test_trigger_unknown_signal)
+{
+    ck_assert(!capture::addTrigger("not_a_signal", capture::CHANGED, 0));
+}
+END_TEST
+
+Suite* captureSuite(void) {
+    Suite* s = suite_create("capture");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_dump_around_trigger);
+    tcase_add_test(tc_core, test_dump_waits_for_post_trigger_window);
+    tcase_add_test(tc_core, test_ring_overwrites_oldest);
+    tcase_add_test(tc_core, test_signal_trigger);
+    tcase_add_test(tc_core, test_signal_trigger_threshold);
+    tcase_add_test(tc_core, test_trigger_unknown_signal);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = captureSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
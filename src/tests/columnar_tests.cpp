@@ -0,0 +1,165 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "payload/columnar.h"
+
+namespace columnar = openxc::payload::columnar;
+
+using openxc::payload::PayloadFormat;
+using openxc::payload::columnar::ColumnarBatch;
+
+ColumnarBatch batch;
+
+// Two samples of signal 3 in steps of 0.5, one of signal 7 with the default
+// resolution, then one of signal 3 from before the last
+static void addSamples() {
+    ck_assert(columnar::add(&batch, 3, 0.5, 1000, 10));
+    ck_assert(columnar::add(&batch, 7, 0, 1010, 1.5));
+    ck_assert(columnar::add(&batch, 3, 0.5, 1100, 9.5));
+    ck_assert(columnar::add(&batch, 3, 0.5, 1050, 11));
+}
+
+static const uint8_t EXPECTED_BLOCK[] = {
+    0x01, 0xe8, 0x07, 0x02,
+    0x03, 0x00, 0x00, 0x00, 0x3f, 0x03, 0x06,
+    0x07, 0x6f, 0x12, 0x83, 0x3a, 0x01, 0x03,
+    0x00, 0x28, 0x64, 0x01, 0x00, 0x06,
+    0x0a, 0xb8, 0x17,
+};
+
+void setup() {
+    columnar::reset(&batch);
+}
+
+START_TEST (test_empty)
+{
+    ck_assert(columnar::empty(&batch));
+    uint8_t block[COLUMNAR_BLOCK_SIZE];
+    ck_assert_int_eq(columnar::encode(&batch, block, sizeof(block)), 0);
+}
+END_TEST
+
+START_TEST (test_encode_columns)
+{
+    addSamples();
+    ck_assert(!columnar::empty(&batch));
+
+    uint8_t block[COLUMNAR_BLOCK_SIZE];
+    int length = columnar::encode(&batch, block, sizeof(block));
+    ck_assert_int_eq(length, sizeof(EXPECTED_BLOCK));
+    ck_assert(!memcmp(block, EXPECTED_BLOCK, sizeof(EXPECTED_BLOCK)));
+}
+END_TEST
+
+START_TEST (test_value_out_of_range)
+{
+    ck_assert(!columnar::add(&batch, 3, 1, 1000, 1e12));
+    ck_assert(columnar::empty(&batch));
+}
+END_TEST
+
+START_TEST (test_too_many_signals)
+{
+    for(int i = 0; i < COLUMNAR_SIGNAL_COUNT; i++) {
+        ck_assert(columnar::add(&batch, i, 1, 1000, i));
+    }
+    ck_assert(!columnar::add(&batch, COLUMNAR_SIGNAL_COUNT, 1, 1000, 1));
+    ck_assert(columnar::add(&batch, 0, 1, 1010, 1));
+}
+END_TEST
+
+START_TEST (test_full_block_fits)
+{
+    int count = 0;
+    while(columnar::add(&batch, 1, 0.01, 1000 + count * 100, count * 1000)) {
+        ++count;
+    }
+    ck_assert(count > 1);
+
+    uint8_t block[COLUMNAR_BLOCK_SIZE];
+    ck_assert(columnar::encode(&batch, block, sizeof(block)) > 0);
+    uint8_t payload[COLUMNAR_RECORD_SIZE];
+    for(int format = 0; format < PAYLOAD_FORMAT_COUNT; format++) {
+        ck_assert(columnar::serialize(&batch, payload, sizeof(payload),
+                    (PayloadFormat) format) > 0);
+    }
+}
+END_TEST
+
+START_TEST (test_json_record)
+{
+    addSamples();
+    uint8_t payload[COLUMNAR_RECORD_SIZE];
+    const char expected[] = "{\"name\":\"columnar\",\"value\":"
+            "\"AegHAgMAAAA/AwYHbxKDOgEDAChkAQAGCrgX\"}";
+    ck_assert_int_eq(columnar::serialize(&batch, payload, sizeof(payload),
+                PayloadFormat::JSON), sizeof(expected));
+    ck_assert(!memcmp(payload, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_messagepack_compact_record)
+{
+    addSamples();
+    uint8_t payload[COLUMNAR_RECORD_SIZE];
+    const uint8_t header[] = {0x82, 0x01, 0xa8, 'c', 'o', 'l', 'u', 'm', 'n',
+            'a', 'r', 0x02, 0xc5, 0x00, sizeof(EXPECTED_BLOCK)};
+    ck_assert_int_eq(columnar::serialize(&batch, payload, sizeof(payload),
+                PayloadFormat::MESSAGEPACK_COMPACT),
+            sizeof(header) + sizeof(EXPECTED_BLOCK));
+    ck_assert(!memcmp(payload, header, sizeof(header)));
+    ck_assert(!memcmp(payload + sizeof(header), EXPECTED_BLOCK,
+                sizeof(EXPECTED_BLOCK)));
+}
+END_TEST
+
+START_TEST (test_protobuf_record_delimited)
+{
+    addSamples();
+    uint8_t payload[COLUMNAR_RECORD_SIZE];
+    int length = columnar::serialize(&batch, payload, sizeof(payload),
+            PayloadFormat::PROTOBUF);
+    ck_assert(length > (int) sizeof(EXPECTED_BLOCK));
+    ck_assert_int_eq(payload[0], length - 1);
+    ck_assert(!memcmp(payload + length - sizeof(EXPECTED_BLOCK),
+                EXPECTED_BLOCK, sizeof(EXPECTED_BLOCK)));
+}
+END_TEST
+
+START_TEST (test_reset)
+{
+    addSamples();
+    columnar::reset(&batch);
+    ck_assert(columnar::empty(&batch));
+}
+END_TEST
+
+Suite* columnarSuite(void) {
+    Suite* s = suite_create("columnar");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_empty);
+    tcase_add_test(tc_core, test_encode_columns);
+    tcase_add_test(tc_core, test_value_out_of_range);
+    tcase_add_test(tc_core, test_too_many_signals);
+    tcase_add_test(tc_core, test_full_block_fits);
+    tcase_add_test(tc_core, test_json_record);
+    tcase_add_test(tc_core, test_messagepack_compact_record);
+    tcase_add_test(tc_core, test_protobuf_record_delimited);
+    tcase_add_test(tc_core, test_reset);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = columnarSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include <check.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "signals.h"
 #include "config.h"
 #include "diagnostics.h"
@@ -7,11 +8,21 @@
 #include "lights.h"
 #include "config.h"
 #include "pipeline.h"
+#include "can/canwrite.h"
+#include "can/canqueue.h"
+#include "util/wall_clock.h"
+#include "util/log.h"
+#include "decode_profiles.h"
+#include "commands/write_ack_command.h"
 
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
+namespace wallclock = openxc::util::wallclock;
+namespace logging = openxc::util::log;
+namespace profiles = openxc::profiles;
 
 using openxc::pipeline::Pipeline;
+using openxc::pipeline::MessageClass;
 using openxc::signals::getCanBuses;
 using openxc::signals::getActiveMessageSet;
 using openxc::commands::handleIncomingMessage;
@@ -20,17 +31,21 @@ using openxc::config::getConfiguration;
 using openxc::config::getFirmwareDescriptor;
 using openxc::signals::getCanBuses;
 using openxc::signals::getCanBusCount;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::can::lookupSignal;
 using openxc::payload::PayloadFormat;
 using openxc::interface::InterfaceDescriptor;
 using openxc::interface::InterfaceType;
 
 extern void initializeVehicleInterface();
+extern unsigned long FAKE_TIME;
 
 extern char LAST_COMMAND_NAME[];
 extern openxc_DynamicField LAST_COMMAND_VALUE;
 extern openxc_DynamicField LAST_COMMAND_EVENT;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
         IN_ENDPOINT_INDEX].queue;
 
 openxc_VehicleMessage CAN_MESSAGE = {0};
@@ -43,7 +58,7 @@ InterfaceDescriptor DESCRIPTOR = {
 };
 
 bool outputQueueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
 }
 
 static bool canQueueEmpty(int bus) {
@@ -70,6 +85,8 @@ void setup() {
     getActiveMessageSet()->busCount = 2;
     getCanBuses()[0].rawWritable = true;
     resetQueues();
+    openxc::pipeline::resetRoutes();
+    openxc::pipeline::setNameDictionary(false);
 
     CAN_MESSAGE.has_type = true;
     CAN_MESSAGE.type = openxc_VehicleMessage_Type_CAN;
@@ -323,8 +340,10 @@ START_TEST (test_named_diagnostic_request)
 
     ck_assert(!LIST_EMPTY(&getConfiguration()
             ->diagnosticsManager.nonrecurringRequests));
-    ck_assert_str_eq(LIST_FIRST(&getConfiguration()->diagnosticsManager
-            .nonrecurringRequests)->name, "foobar");
+    ck_assert_str_eq(diagnostics::requestName(
+            &getConfiguration()->diagnosticsManager,
+            LIST_FIRST(&getConfiguration()->diagnosticsManager
+                .nonrecurringRequests)), "foobar");
 }
 END_TEST
 
@@ -550,6 +569,538 @@ START_TEST (test_simple_write_not_allowed)
 }
 END_TEST
 
+START_TEST (test_pipeline_route_command)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"uart\", "
+            "\"event\": \"can,transmission_gear_position\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(canQueueEmpty(0));
+
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::CAN, NULL));
+    fail_if(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::DIAGNOSTIC, NULL));
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::SIMPLE, "transmission_gear_position"));
+    fail_if(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::SIMPLE, "torque_at_transmission"));
+    fail_unless(openxc::pipeline::routed(InterfaceType::USB,
+                MessageClass::DIAGNOSTIC, NULL));
+}
+END_TEST
+
+START_TEST (test_signal_dictionary_command)
+{
+    uint8_t request[] = "{\"name\": \"signal_dictionary\", \"value\": true}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::nameDictionaryEnabled());
+
+    uint8_t disable[] = "{\"name\": \"signal_dictionary\", \"value\": false}\0";
+    ck_assert(handleIncomingMessage(disable, sizeof(disable), &DESCRIPTOR));
+    fail_if(openxc::pipeline::nameDictionaryEnabled());
+}
+END_TEST
+
+START_TEST (test_latest_values_command)
+{
+    CanSignal* signal = &getSignals()[0];
+    signal->received = true;
+    signal->lastValue = 42;
+    signal->lastReceivedMs = FAKE_TIME - 100;
+
+    uint8_t request[] = "{\"name\": \"latest_values\", "
+            "\"value\": \"torque_at_transmission\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_if(outputQueueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"torque_at_transmission\","
+                "\"value\":42,\"event\":100}") != NULL);
+}
+END_TEST
+
+START_TEST (test_latest_values_command_unknown_signal)
+{
+    getSignals()[0].received = true;
+    uint8_t request[] = "{\"name\": \"latest_values\", "
+            "\"value\": \"torque_at_transmission,foo\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(outputQueueEmpty());
+}
+END_TEST
+
+START_TEST (test_message_set_command)
+{
+    uint8_t request[] = "{\"name\": \"message_set\", "
+            "\"value\": \"shared_handler_tests\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 1);
+
+    uint8_t back[] = "{\"name\": \"message_set\", \"value\": 0}\0";
+    ck_assert(handleIncomingMessage(back, sizeof(back), &DESCRIPTOR));
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 0);
+}
+END_TEST
+
+START_TEST (test_message_set_command_unknown_set)
+{
+    uint8_t request[] = "{\"name\": \"message_set\", \"value\": \"foo\"}\0";
+    handleIncomingMessage(request, sizeof(request), &DESCRIPTOR);
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 0);
+}
+END_TEST
+
+START_TEST (test_write_signals_command)
+{
+    uint8_t request[] = "{\"name\": \"write_signals\", "
+            "\"value\": \"test_signal1=true,test_signal3=1\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &getCanBuses()[0].sendQueue), 1);
+    CanMessage message = QUEUE_POP(CanMessage, &getCanBuses()[0].sendQueue);
+    ck_assert_int_eq(message.id, 4);
+    ck_assert_int_eq(message.data[0], 0xa0);
+}
+END_TEST
+
+START_TEST (test_write_signals_command_different_messages)
+{
+    uint8_t request[] = "{\"name\": \"write_signals\", "
+            "\"value\": \"test_signal1=true,test_signal9=true\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(canQueueEmpty(0));
+}
+END_TEST
+
+START_TEST (test_periodic_write_command)
+{
+    uint8_t request[] = "{\"name\": \"periodic_write\", "
+            "\"value\": \"1,0x7df,0x023e00\", \"event\": 0.5}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert(openxc::can::write::removePeriodicWrite(&getCanBuses()[0], 0x7df,
+                CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_periodic_write_command_not_raw_writable)
+{
+    getCanBuses()[0].rawWritable = false;
+    uint8_t request[] = "{\"name\": \"periodic_write\", "
+            "\"value\": \"1,0x7df,0x023e00\", \"event\": 0.5}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_if(openxc::can::write::removePeriodicWrite(&getCanBuses()[0], 0x7df,
+                CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_command_batch)
+{
+    uint8_t begin[] = "{\"name\": \"command_batch\", \"value\": \"begin\"}\0";
+    ck_assert(handleIncomingMessage(begin, sizeof(begin), &DESCRIPTOR));
+
+    uint8_t passthrough[] = "{\"command\": \"passthrough\", \"bus\": 1, "
+            "\"enabled\": true}\0";
+    ck_assert(handleIncomingMessage(passthrough, sizeof(passthrough),
+                &DESCRIPTOR));
+    uint8_t missingBus[] = "{\"command\": \"passthrough\", "
+            "\"enabled\": true}\0";
+    ck_assert(handleIncomingMessage(missingBus, sizeof(missingBus),
+                &DESCRIPTOR));
+    ck_assert(getCanBuses()[0].passthroughCanMessages);
+    fail_unless(outputQueueEmpty());
+
+    uint8_t end[] = "{\"name\": \"command_batch\", \"value\": \"end\"}\0";
+    ck_assert(handleIncomingMessage(end, sizeof(end), &DESCRIPTOR));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"command_batch\","
+                "\"value\":\"10\",\"event\":1}") != NULL);
+}
+END_TEST
+
+static bool outputContains(const char* expected) {
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    return strstr((char*)snapshot, expected) != NULL;
+}
+
+static void stopWriteAcks() {
+    uint8_t stop[] = "{\"name\": \"write_acks\", \"value\": 0}\0";
+    ck_assert(handleIncomingMessage(stop, sizeof(stop), &DESCRIPTOR));
+}
+
+START_TEST (test_write_acks_window_full)
+{
+    uint8_t acks[] = "{\"name\": \"write_acks\", \"value\": 2}\0";
+    ck_assert(handleIncomingMessage(acks, sizeof(acks), &DESCRIPTOR));
+
+    ck_assert(handleIncomingMessage(CAN_REQUEST, sizeof(CAN_REQUEST),
+                &DESCRIPTOR));
+    fail_unless(outputQueueEmpty());
+    uint8_t noBus[] = "{\"bus\": 3, \"id\": 42, \"data\": \"0x1234\"}\0";
+    ck_assert(handleIncomingMessage(noBus, sizeof(noBus), &DESCRIPTOR));
+    ck_assert(outputContains("{\"name\":\"write_acks\",\"value\":2,"
+                "\"event\":\"10\"}"));
+
+    stopWriteAcks();
+}
+END_TEST
+
+START_TEST (test_write_acks_interval)
+{
+    uint8_t acks[] = "{\"name\": \"write_acks\", \"value\": 8, "
+            "\"event\": 100}\0";
+    ck_assert(handleIncomingMessage(acks, sizeof(acks), &DESCRIPTOR));
+
+    ck_assert(handleIncomingMessage(WRITABLE_SIMPLE_REQUEST,
+                sizeof(WRITABLE_SIMPLE_REQUEST), &DESCRIPTOR));
+    uint8_t unknown[] = "{\"name\": \"foobar\", \"value\": true}\0";
+    ck_assert(handleIncomingMessage(unknown, sizeof(unknown), &DESCRIPTOR));
+    openxc::commands::updateWriteAcks();
+    fail_unless(outputQueueEmpty());
+
+    FAKE_TIME += 100;
+    openxc::commands::updateWriteAcks();
+    ck_assert(outputContains("{\"name\":\"write_acks\",\"value\":2,"
+                "\"event\":\"10\"}"));
+
+    stopWriteAcks();
+}
+END_TEST
+
+START_TEST (test_write_acks_off)
+{
+    ck_assert(handleIncomingMessage(CAN_REQUEST, sizeof(CAN_REQUEST),
+                &DESCRIPTOR));
+    FAKE_TIME += WRITE_ACK_DEFAULT_INTERVAL_MS;
+    openxc::commands::updateWriteAcks();
+    fail_unless(outputQueueEmpty());
+}
+END_TEST
+
+START_TEST (test_time_sync_command)
+{
+    uint8_t request[] = "{\"name\": \"time_sync\", "
+            "\"value\": \"1760000000000000\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"time_sync\","
+                "\"value\":\"1760000000000000\"") != NULL);
+    ck_assert(!wallclock::hostSynchronized());
+
+    uint8_t response[] = "{\"name\": \"time_sync\", "
+            "\"value\": \"1760000000000000\", "
+            "\"event\": \"1760000000020000\"}\0";
+    ck_assert(handleIncomingMessage(response, sizeof(response), &DESCRIPTOR));
+    ck_assert(wallclock::hostSynchronized());
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert(timeUs >= 1760000000000000ULL &&
+            timeUs <= 1760000000020000ULL);
+
+    // Keep the other tests' messages unstamped
+    wallclock::reset();
+}
+END_TEST
+
+START_TEST (test_time_sync_command_unmatched)
+{
+    uint8_t response[] = "{\"name\": \"time_sync\", "
+            "\"value\": \"1760000000000000\", "
+            "\"event\": \"1760000000020000\"}\0";
+    ck_assert(handleIncomingMessage(response, sizeof(response), &DESCRIPTOR));
+    ck_assert(!wallclock::hostSynchronized());
+}
+END_TEST
+
+START_TEST (test_signal_control_command)
+{
+    uint8_t disable[] = "{\"name\": \"signal_control\", "
+            "\"value\": \"test_signal*\", \"event\": false}\0";
+    ck_assert(handleIncomingMessage(disable, sizeof(disable), &DESCRIPTOR));
+    for(int i = 0; i < getSignalCount(); i++) {
+        ck_assert_int_eq(getSignals()[i].disabled, !strncmp(
+                getSignals()[i].genericName, "test_signal", 11));
+    }
+
+    uint8_t frequency[] = "{\"name\": \"signal_control\", "
+            "\"value\": \"brake_pedal_status\", \"event\": 5}\0";
+    ck_assert(handleIncomingMessage(frequency, sizeof(frequency),
+                &DESCRIPTOR));
+    CanSignal* signal = lookupSignal("brake_pedal_status", getSignals(),
+            getSignalCount());
+    ck_assert(signal->frequencyClock.frequency == 5);
+    signal->frequencyClock.frequency = 0;
+
+    uint8_t enable[] = "{\"name\": \"signal_control\", "
+            "\"value\": \"*\", \"event\": true}\0";
+    ck_assert(handleIncomingMessage(enable, sizeof(enable), &DESCRIPTOR));
+    for(int i = 0; i < getSignalCount(); i++) {
+        ck_assert(!getSignals()[i].disabled);
+    }
+}
+END_TEST
+
+/* Private: Returns true if there's an active recurring diagnostic request
+ * with the name.
+ */
+static bool hasRecurringRequest(const char* name) {
+    diagnostics::DiagnosticsManager* manager =
+            &getConfiguration()->diagnosticsManager;
+    diagnostics::ActiveDiagnosticRequest* entry;
+    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+        const char* entryName = diagnostics::requestName(manager, entry);
+        if(entryName != NULL && !strcmp(entryName, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+START_TEST (test_save_config_command)
+{
+    uint8_t passthrough[] = "{\"command\": \"passthrough\", \"bus\": 1, "
+            "\"enabled\": true}\0";
+    ck_assert(handleIncomingMessage(passthrough, sizeof(passthrough),
+                &DESCRIPTOR));
+    uint8_t request[] = "{\"command\": \"diagnostic_request\", "
+            "\"action\": \"add\", \"request\": {\"name\": \"saved\", "
+            "\"bus\": 1, \"id\": 2, \"mode\": 1, \"frequency\": 1}}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    uint8_t save[] = "{\"name\": \"save_config\", \"value\": \"save\"}\0";
+    ck_assert(handleIncomingMessage(save, sizeof(save), &DESCRIPTOR));
+
+    getCanBuses()[0].passthroughCanMessages = false;
+    initializeVehicleInterface();
+    ck_assert(getCanBuses()[0].passthroughCanMessages);
+    ck_assert(hasRecurringRequest("saved"));
+
+    uint8_t clear[] = "{\"name\": \"save_config\", "
+            "\"value\": \"clear\"}\0";
+    ck_assert(handleIncomingMessage(clear, sizeof(clear), &DESCRIPTOR));
+    getCanBuses()[0].passthroughCanMessages = false;
+    initializeVehicleInterface();
+    ck_assert(!getCanBuses()[0].passthroughCanMessages);
+    ck_assert(!hasRecurringRequest("saved"));
+}
+END_TEST
+
+START_TEST (test_metrics_command)
+{
+    getCanBuses()[0].messagesReceived = 7;
+    getCanBuses()[0].messagesDropped = 2;
+
+    uint8_t request[] = "{\"name\": \"metrics\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"metrics\","
+                "\"value\":\"uptime\",") != NULL);
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"metrics\","
+                "\"value\":\"can1\",\"event\":\"7,2,0,0\"}") != NULL);
+}
+END_TEST
+
+START_TEST (test_metrics_command_high_water)
+{
+    CanMessage message = {0x42, CanMessageFormat::STANDARD, {0}, 8};
+    openxc::can::write::enqueueMessage(&getCanBuses()[0], &message);
+    openxc::can::write::enqueueMessage(&getCanBuses()[0], &message);
+
+    uint8_t request[] = "{\"name\": \"metrics\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "{\"name\":\"metrics\","
+                "\"value\":\"memory\",") != NULL);
+    char expected[64];
+    snprintf(expected, sizeof(expected),
+            "\"value\":\"can1_queue\",\"event\":\"0,%d,2,%d\"}",
+            openxc::can::queue::capacity(&getCanBuses()[0].receiveQueue),
+            QUEUE_MAX_LENGTH(CanMessage));
+    ck_assert(strstr((char*)snapshot, expected) != NULL);
+}
+END_TEST
+
+START_TEST (test_metrics_command_bus_errors)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->transmitErrorCount = 8;
+    bus->receiveErrorCount = 130;
+    bus->peakErrorCount = 136;
+    bus->busOffCount = 1;
+
+    uint8_t request[] = "{\"name\": \"metrics\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot,
+                "\"value\":\"can1_errors\",\"event\":\"8,130,136,1\"}")
+            != NULL);
+}
+END_TEST
+
+START_TEST (test_ble_connection_command)
+{
+    openxc::interface::ble::BleDevice device;
+    memset(&device, 0, sizeof(device));
+    getConfiguration()->ble = &device;
+
+    uint8_t request[] = "{\"name\": \"ble_connection\", "
+            "\"value\": \"throughput\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(device.connectionMode,
+            openxc::interface::ble::BleConnectionMode::THROUGHPUT);
+
+    uint8_t unknown[] = "{\"name\": \"ble_connection\", "
+            "\"value\": \"warp\"}\0";
+    handleIncomingMessage(unknown, sizeof(unknown), &DESCRIPTOR);
+    ck_assert_int_eq(device.connectionMode,
+            openxc::interface::ble::BleConnectionMode::THROUGHPUT);
+    fail_unless(canQueueEmpty(0));
+
+    getConfiguration()->ble = NULL;
+}
+END_TEST
+
+START_TEST (test_log_level_command)
+{
+    uint8_t request[] = "{\"name\": \"log_level\", \"value\": \"warning\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(logging::getLevel(), logging::LOG_LEVEL_WARNING);
+
+    uint8_t unknown[] = "{\"name\": \"log_level\", \"value\": \"loud\"}\0";
+    handleIncomingMessage(unknown, sizeof(unknown), &DESCRIPTOR);
+    ck_assert_int_eq(logging::getLevel(), logging::LOG_LEVEL_WARNING);
+
+    logging::setLevel(logging::LOG_LEVEL_DEBUG);
+}
+END_TEST
+
+START_TEST (test_decode_profile_command)
+{
+    CanSignal* signal = lookupSignal("transmission_gear_position",
+            getSignals(), getSignalCount());
+    signal->received = true;
+    signal->lastValue = 2;
+
+    uint8_t request[] = "{\"name\": \"decode_profile\", \"value\": "
+            "\"parked\", \"event\": \"transmission_gear_position=third,"
+            "brake_*=off,torque_at_transmission=2\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    for(int i = 0; i < 2; i++) {
+        profiles::update(getSignals(), getSignalCount(),
+                openxc::signals::getMessages(),
+                openxc::signals::getMessageCount(), getCanBuses(),
+                getCanBusCount());
+        FAKE_TIME += DECODE_PROFILE_HOLD_MS;
+    }
+    ck_assert_str_eq(profiles::active(), "parked");
+    ck_assert(lookupSignal("brake_pedal_status", getSignals(),
+                getSignalCount())->profileDisabled);
+
+    uint8_t remove[] = "{\"name\": \"decode_profile\", \"value\": "
+            "\"parked\", \"event\": \"none\"}\0";
+    ck_assert(handleIncomingMessage(remove, sizeof(remove), &DESCRIPTOR));
+    ck_assert(profiles::active() == NULL);
+    ck_assert(!lookupSignal("brake_pedal_status", getSignals(),
+                getSignalCount())->profileDisabled);
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_unknown_signal)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"uart\", "
+            "\"event\": \"can,not_a_signal\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::DIAGNOSTIC, NULL));
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_rate)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"uart\", "
+            "\"event\": \"transmission_gear_position,rate=2\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::SIMPLE, "transmission_gear_position"));
+
+    // a rate only applies to the signals listed with it
+    uint8_t rateOnly[] = "{\"name\": \"pipeline_route\", "
+            "\"value\": \"usb\", \"event\": \"rate=2\"}\0";
+    ck_assert(handleIncomingMessage(rateOnly, sizeof(rateOnly), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::routed(InterfaceType::USB,
+                MessageClass::SIMPLE, "torque_at_transmission"));
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_format)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"uart\", "
+            "\"event\": \"protobuf\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::UART) ==
+            PayloadFormat::PROTOBUF);
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::USB) ==
+            PayloadFormat::JSON);
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::CAN, NULL));
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_batch)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"uart\", "
+            "\"event\": \"batch=8\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::routed(InterfaceType::UART,
+                MessageClass::SIMPLE, NULL));
+
+    // the cellular server task already batches, so the whole route is
+    // rejected
+    uint8_t telitRequest[] = "{\"name\": \"pipeline_route\", "
+            "\"value\": \"telit\", \"event\": \"none,batch=8\"}\0";
+    ck_assert(handleIncomingMessage(telitRequest, sizeof(telitRequest),
+                &DESCRIPTOR));
+    fail_unless(openxc::pipeline::routed(InterfaceType::TELIT,
+                MessageClass::SIMPLE, NULL));
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_deltas)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"fs\", "
+            "\"event\": \"deltas\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_unless(openxc::pipeline::timestampDeltas(InterfaceType::FS));
+    fail_unless(openxc::pipeline::routed(InterfaceType::FS,
+                MessageClass::CAN, NULL));
+
+    uint8_t absolute[] = "{\"name\": \"pipeline_route\", \"value\": \"fs\", "
+            "\"event\": \"absolute\"}\0";
+    ck_assert(handleIncomingMessage(absolute, sizeof(absolute), &DESCRIPTOR));
+    fail_if(openxc::pipeline::timestampDeltas(InterfaceType::FS));
+}
+END_TEST
+
+START_TEST (test_pipeline_route_command_columnar_only_telit_and_fs)
+{
+    uint8_t request[] = "{\"name\": \"pipeline_route\", \"value\": \"usb\", "
+            "\"event\": \"columnar\"}\0";
+    ck_assert(!handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    fail_if(openxc::pipeline::columnarEnabled(InterfaceType::USB));
+}
+END_TEST
+
 START_TEST (test_simple_write_allowed_by_signal_override)
 {
     getCanBuses()[0].rawWritable = false;
@@ -588,8 +1139,8 @@ START_TEST (test_version_message_in_stream)
     char firmwareDescriptor[256] = {0};
     getFirmwareDescriptor(firmwareDescriptor, sizeof(firmwareDescriptor));
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, firmwareDescriptor) != NULL);
 }
@@ -603,8 +1154,8 @@ START_TEST (test_device_id_message_in_stream)
     ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
     ck_assert(!outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot,
                 getConfiguration()->uart.deviceId) != NULL);
@@ -786,6 +1337,13 @@ START_TEST (test_validate_device_id_command)
 }
 END_TEST
 
+START_TEST (test_validate_unknown_command)
+{
+    CONTROL_COMMAND.control_command.type = (openxc_ControlCommand_Type) 99;
+    ck_assert(!validate(&CONTROL_COMMAND));
+}
+END_TEST
+
 START_TEST (test_validate_passthrough_commmand)
 {
     CONTROL_COMMAND.control_command.type = openxc_ControlCommand_Type_PASSTHROUGH;
@@ -857,6 +1415,15 @@ START_TEST (test_payload_format_command)
 }
 END_TEST
 
+START_TEST (test_payload_format_command_compact)
+{
+    uint8_t request[] = "{\"command\": \"payload_format\", \"format\": \"messagepack_compact\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert_int_eq(PayloadFormat::MESSAGEPACK_COMPACT,
+            getConfiguration()->payloadFormat);
+}
+END_TEST
+
 START_TEST (test_validate_predefined_obd2_command)
 {
     CONTROL_COMMAND.control_command.type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
@@ -900,6 +1467,41 @@ Suite* suite(void) {
     tcase_add_test(tc_complex_commands, test_simple_write_not_allowed);
     tcase_add_test(tc_complex_commands, test_simple_write_missing_value);
     tcase_add_test(tc_complex_commands, test_simple_write_no_match);
+    tcase_add_test(tc_complex_commands, test_pipeline_route_command);
+    tcase_add_test(tc_complex_commands,
+            test_pipeline_route_command_unknown_signal);
+    tcase_add_test(tc_complex_commands, test_signal_dictionary_command);
+    tcase_add_test(tc_complex_commands, test_latest_values_command);
+    tcase_add_test(tc_complex_commands,
+            test_latest_values_command_unknown_signal);
+    tcase_add_test(tc_complex_commands, test_message_set_command);
+    tcase_add_test(tc_complex_commands, test_message_set_command_unknown_set);
+    tcase_add_test(tc_complex_commands, test_write_signals_command);
+    tcase_add_test(tc_complex_commands,
+            test_write_signals_command_different_messages);
+    tcase_add_test(tc_complex_commands, test_periodic_write_command);
+    tcase_add_test(tc_complex_commands,
+            test_periodic_write_command_not_raw_writable);
+    tcase_add_test(tc_complex_commands, test_command_batch);
+    tcase_add_test(tc_complex_commands, test_write_acks_window_full);
+    tcase_add_test(tc_complex_commands, test_write_acks_interval);
+    tcase_add_test(tc_complex_commands, test_write_acks_off);
+    tcase_add_test(tc_complex_commands, test_metrics_command);
+    tcase_add_test(tc_complex_commands, test_metrics_command_high_water);
+    tcase_add_test(tc_complex_commands, test_metrics_command_bus_errors);
+    tcase_add_test(tc_complex_commands, test_save_config_command);
+    tcase_add_test(tc_complex_commands, test_time_sync_command);
+    tcase_add_test(tc_complex_commands, test_time_sync_command_unmatched);
+    tcase_add_test(tc_complex_commands, test_signal_control_command);
+    tcase_add_test(tc_complex_commands, test_ble_connection_command);
+    tcase_add_test(tc_complex_commands, test_log_level_command);
+    tcase_add_test(tc_complex_commands, test_decode_profile_command);
+    tcase_add_test(tc_complex_commands, test_pipeline_route_command_rate);
+    tcase_add_test(tc_complex_commands, test_pipeline_route_command_format);
+    tcase_add_test(tc_complex_commands, test_pipeline_route_command_batch);
+    tcase_add_test(tc_complex_commands, test_pipeline_route_command_deltas);
+    tcase_add_test(tc_complex_commands,
+            test_pipeline_route_command_columnar_only_telit_and_fs);
     tcase_add_test(tc_complex_commands, test_custom_command);
     tcase_add_test(tc_complex_commands, test_custom_evented_command);
     tcase_add_test(tc_complex_commands,
@@ -936,6 +1538,7 @@ Suite* suite(void) {
     tcase_add_test(tc_control_commands, test_passthrough_request_message);
     tcase_add_test(tc_control_commands, test_bypass_command);
     tcase_add_test(tc_control_commands, test_payload_format_command);
+    tcase_add_test(tc_control_commands, test_payload_format_command_compact);
     tcase_add_test(tc_control_commands, test_predefined_obd2_command);
     suite_add_tcase(s, tc_control_commands);
 
@@ -966,6 +1569,7 @@ Suite* suite(void) {
     tcase_add_test(tc_validation, test_validate_version_command);
     tcase_add_test(tc_validation, test_validate_device_platform_command);
     tcase_add_test(tc_validation, test_validate_device_id_command);
+    tcase_add_test(tc_validation, test_validate_unknown_command);
     tcase_add_test(tc_validation, test_validate_passthrough_commmand);
     tcase_add_test(tc_validation, test_validate_bypass_command);
     tcase_add_test(tc_validation, test_validate_payload_format_command);
@@ -0,0 +1,239 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "signals.h"
+#include "decode_profiles.h"
+
+namespace can = openxc::can;
+namespace profiles = openxc::profiles;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+using openxc::profiles::DecodeProfile;
+
+extern unsigned long FAKE_TIME;
+
+CanBus* bus;
+CanSignal* gear;
+CanSignal* brake;
+CanSignal* measurement;
+
+static void update() {
+    profiles::update(getSignals(), getSignalCount(), getMessages(),
+            getMessageCount(), getCanBuses(), getCanBusCount());
+}
+
+static void define(const char* name, const char* pattern, bool decoded,
+        float frequency) {
+    DecodeProfile profile = {};
+    strcpy(profile.name, name);
+    strcpy(profile.signalName, "measurement");
+    profile.condition = profiles::BELOW;
+    profile.threshold = 1;
+    strcpy(profile.rules[0].pattern, pattern);
+    profile.rules[0].decoded = decoded;
+    profile.rules[0].frequency = frequency;
+    profile.ruleCount = 1;
+    ck_assert(profiles::define(&profile, getSignals(), getSignalCount(),
+                getMessages(), getMessageCount(), getCanBuses(),
+                getCanBusCount()));
+}
+
+static void undefine(const char* name) {
+    profiles::undefine(name, getSignals(), getSignalCount(), getMessages(),
+            getMessageCount(), getCanBuses(), getCanBusCount());
+}
+
+/* Private: Run the main loop's update before and after the profile hold time,
+ * so a profile whose condition holds is switched to.
+ */
+static void settle() {
+    update();
+    FAKE_TIME += DECODE_PROFILE_HOLD_MS;
+    update();
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+    can::configureDefaultFilters(bus, getMessages(), getMessageCount(),
+            getCanBuses(), getCanBusCount());
+    for(int i = 0; i < getSignalCount(); i++) {
+        getSignals()[i].profileDisabled = false;
+        getSignals()[i].frequencyClock = {0};
+    }
+    for(int i = 0; i < getMessageCount(); i++) {
+        getMessages()[i].filterSuspended = false;
+    }
+
+    gear = can::lookupSignal("transmission_gear_position", getSignals(),
+            getSignalCount());
+    brake = can::lookupSignal("brake_pedal_status", getSignals(),
+            getSignalCount());
+    measurement = can::lookupSignal("measurement", getSignals(),
+            getSignalCount());
+    measurement->received = true;
+    measurement->lastValue = 0;
+}
+
+void teardown() {
+    undefine("parked");
+    undefine("moving");
+    bus->passthroughCanMessages = false;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_switch_after_hold)
+{
+    define("parked", "transmission_gear_position", false, -1);
+    update();
+    ck_assert(profiles::active() == NULL);
+    ck_assert(!gear->profileDisabled);
+
+    FAKE_TIME += DECODE_PROFILE_HOLD_MS;
+    update();
+    ck_assert_str_eq(profiles::active(), "parked");
+    ck_assert(gear->profileDisabled);
+    ck_assert(!brake->profileDisabled);
+}
+END_TEST
+
+START_TEST (test_wavering_condition_doesnt_switch)
+{
+    define("parked", "transmission_gear_position", false, -1);
+    update();
+    FAKE_TIME += DECODE_PROFILE_HOLD_MS / 2;
+    measurement->lastValue = 5;
+    update();
+    measurement->lastValue = 0;
+    update();
+    FAKE_TIME += DECODE_PROFILE_HOLD_MS / 2;
+    update();
+    ck_assert(profiles::active() == NULL);
+}
+END_TEST
+
+START_TEST (test_suspends_filter_of_undecoded_message)
+{
+    ck_assert(can::shouldAcceptMessage(bus, 1));
+    define("parked", "transmission_gear_position", false, -1);
+    settle();
+    ck_assert(!can::shouldAcceptMessage(bus, 1));
+    ck_assert(can::shouldAcceptMessage(bus, 2));
+
+    measurement->lastValue = 5;
+    settle();
+    ck_assert(profiles::active() == NULL);
+    ck_assert(!gear->profileDisabled);
+    ck_assert(can::shouldAcceptMessage(bus, 1));
+}
+END_TEST
+
+START_TEST (test_passthrough_bus_keeps_filter)
+{
+    bus->passthroughCanMessages = true;
+    define("parked", "transmission_gear_position", false, -1);
+    settle();
+    ck_assert(gear->profileDisabled);
+    ck_assert(can::shouldAcceptMessage(bus, 1));
+}
+END_TEST
+
+START_TEST (test_condition_signal_always_decoded)
+{
+    define("parked", "*", false, -1);
+    settle();
+    ck_assert(gear->profileDisabled);
+    ck_assert(!measurement->profileDisabled);
+    ck_assert(can::shouldAcceptMessage(bus, 3));
+}
+END_TEST
+
+START_TEST (test_frequency_restored)
+{
+    brake->frequencyClock.frequency = 10;
+    define("parked", "brake_pedal_status", true, 2);
+    settle();
+    ck_assert(!brake->profileDisabled);
+    ck_assert(brake->frequencyClock.frequency == 2);
+
+    undefine("parked");
+    ck_assert(profiles::active() == NULL);
+    ck_assert(brake->frequencyClock.frequency == 10);
+}
+END_TEST
+
+START_TEST (test_first_matching_profile_wins)
+{
+    define("parked", "transmission_gear_position", false, -1);
+    define("moving", "brake_pedal_status", false, -1);
+    settle();
+    ck_assert_str_eq(profiles::active(), "parked");
+    ck_assert(!brake->profileDisabled);
+
+    undefine("parked");
+    ck_assert(!gear->profileDisabled);
+    settle();
+    ck_assert_str_eq(profiles::active(), "moving");
+    ck_assert(brake->profileDisabled);
+}
+END_TEST
+
+START_TEST (test_profile_limit)
+{
+    char name[DECODE_PROFILE_NAME_LENGTH];
+    for(int i = 0; i < DECODE_PROFILE_COUNT; i++) {
+        snprintf(name, sizeof(name), "profile%d", i);
+        define(name, "brake_pedal_status", false, -1);
+    }
+
+    DecodeProfile profile = {};
+    strcpy(profile.name, "extra");
+    ck_assert(!profiles::define(&profile, getSignals(), getSignalCount(),
+                getMessages(), getMessageCount(), getCanBuses(),
+                getCanBusCount()));
+
+    for(int i = 0; i < DECODE_PROFILE_COUNT; i++) {
+        snprintf(name, sizeof(name), "profile%d", i);
+        undefine(name);
+    }
+}
+END_TEST
+
+Suite* decodeProfilesSuite(void) {
+    Suite* s = suite_create("decode_profiles");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_switch_after_hold);
+    tcase_add_test(tc_core, test_wavering_condition_doesnt_switch);
+    tcase_add_test(tc_core, test_suspends_filter_of_undecoded_message);
+    tcase_add_test(tc_core, test_passthrough_bus_keeps_filter);
+    tcase_add_test(tc_core, test_condition_signal_always_decoded);
+    tcase_add_test(tc_core, test_frequency_restored);
+    tcase_add_test(tc_core, test_first_matching_profile_wins);
+    tcase_add_test(tc_core, test_profile_limit);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = decodeProfilesSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
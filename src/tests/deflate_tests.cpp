@@ -0,0 +1,84 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/deflate.h"
+
+namespace deflate = openxc::util::deflate;
+
+void setup() {
+}
+
+START_TEST (test_compress_empty)
+{
+    uint8_t output[16];
+    const uint8_t expected[] = {0x28, 0x15, 0x03, 0x00,
+        0x00, 0x00, 0x00, 0x01};
+    ck_assert_int_eq(deflate::compress(NULL, 0, output, sizeof(output)),
+            sizeof(expected));
+    ck_assert(!memcmp(output, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_compress_repeated_string)
+{
+    const uint8_t input[] = "abcabcabcabc";
+    uint8_t output[32];
+    // literals for "abc" then one 9 byte copy from 3 back
+    const uint8_t expected[] = {0x28, 0x15, 0x4b, 0x4c, 0x4a, 0x86, 0x23,
+        0x00, 0x1d, 0xe0, 0x04, 0x99};
+    ck_assert_int_eq(deflate::compress(input, sizeof(input) - 1, output,
+                sizeof(output)), sizeof(expected));
+    ck_assert(!memcmp(output, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_compress_json_records)
+{
+    char input[2048] = "{\"records\":[";
+    while(strlen(input) < sizeof(input) - 64) {
+        strcat(input, "{\"name\":\"vehicle_speed\",\"value\":42},");
+    }
+    strcat(input, "{\"name\":\"engine_speed\",\"value\":1200}]}");
+
+    uint8_t output[sizeof(input)];
+    size_t length = deflate::compress((const uint8_t*)input, strlen(input),
+            output, sizeof(output));
+    ck_assert(length > 0);
+    ck_assert(length < strlen(input) / 10);
+}
+END_TEST
+
+START_TEST (test_compress_output_too_small)
+{
+    const uint8_t input[] = "not going to fit";
+    uint8_t output[8];
+    ck_assert_int_eq(deflate::compress(input, sizeof(input) - 1, output,
+                sizeof(output)), 0);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("deflate");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_compress_empty);
+    tcase_add_test(tc_core, test_compress_repeated_string);
+    tcase_add_test(tc_core, test_compress_json_records);
+    tcase_add_test(tc_core, test_compress_output_too_small);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/delta.h"
+
+namespace delta = openxc::util::delta;
+
+using openxc::util::delta::DeltaPatch;
+
+static const uint8_t SOURCE[] = "the quick brown fox jumps over the lazy dog";
+
+static uint8_t target[128];
+static size_t targetLength;
+static bool sinkFails;
+
+static bool sink(const uint8_t* data, size_t length, void* context) {
+    if(sinkFails || targetLength + length > sizeof(target)) {
+        return false;
+    }
+    memcpy(&target[targetLength], data, length);
+    targetLength += length;
+    return true;
+}
+
+/* Private: Write a patch header for the expected target into the buffer.
+ *
+ * Returns the length of the header.
+ */
+static size_t header(uint8_t* patch, const char* expected) {
+    uint32_t sourceLength = sizeof(SOURCE) - 1;
+    uint32_t length = strlen(expected);
+    memcpy(patch, DELTA_MAGIC, 4);
+    memcpy(&patch[4], &sourceLength, 4);
+    memcpy(&patch[8], &length, 4);
+
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    MD5_Update(&md5, expected, length);
+    MD5_Final(&patch[12], &md5);
+    return DELTA_HEADER_SIZE;
+}
+
+static delta::DeltaStatus applyAll(const uint8_t* patch, size_t length,
+        size_t pieceSize) {
+    DeltaPatch state;
+    delta::begin(&state, SOURCE, sizeof(SOURCE) - 1, sink, NULL);
+    delta::DeltaStatus status = delta::DELTA_IN_PROGRESS;
+    for(size_t i = 0; i < length; i += pieceSize) {
+        status = delta::apply(&state, &patch[i],
+                length - i < pieceSize ? length - i : pieceSize);
+    }
+    return status;
+}
+
+void setup() {
+    memset(target, 0, sizeof(target));
+    targetLength = 0;
+    sinkFails = false;
+}
+
+START_TEST (test_copy_and_insert)
+{
+    const char* expected = "the quick red fox";
+    uint8_t patch[64];
+    size_t length = header(patch, expected);
+    const uint8_t instructions[] = {
+        0x01, 0, 10,            // "the quick "
+        0x03, 3, 'r', 'e', 'd', // "red"
+        0x01, 15, 4,            // " fox"
+    };
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_COMPLETE);
+    ck_assert_int_eq(targetLength, strlen(expected));
+    ck_assert(!memcmp(target, expected, targetLength));
+}
+END_TEST
+
+START_TEST (test_add_changes)
+{
+    // "fox" to "goy", with the 'o' unchanged
+    const char* expected = "goy";
+    uint8_t patch[64];
+    size_t length = header(patch, expected);
+    const uint8_t instructions[] = {
+        0x02, 16, 3, 2,
+        0, 1,                   // 'f' + 1
+        1, 1,                   // 'o' as is, then 'x' + 1
+    };
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_COMPLETE);
+    ck_assert(!memcmp(target, expected, strlen(expected)));
+}
+END_TEST
+
+START_TEST (test_one_byte_at_a_time)
+{
+    const char* expected = "lazy dog, quick fox";
+    uint8_t patch[64];
+    size_t length = header(patch, expected);
+    const uint8_t instructions[] = {
+        0x01, 35, 8,
+        0x03, 2, ',', ' ',
+        0x02, 4, 5, 0,
+        0x01, 15, 4,
+    };
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, 1), delta::DELTA_COMPLETE);
+    ck_assert(!memcmp(target, expected, strlen(expected)));
+}
+END_TEST
+
+START_TEST (test_long_varint)
+{
+    char expected[128];
+    memset(expected, 'x', 127);
+    expected[127] = '\0';
+    uint8_t patch[256];
+    size_t length = header(patch, expected);
+    // 127 as a two byte varint
+    const uint8_t instructions[] = {0x03, 0xff, 0x00};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+    memset(&patch[length], 'x', 127);
+    length += 127;
+
+    ck_assert_int_eq(applyAll(patch, length, 10), delta::DELTA_COMPLETE);
+    ck_assert_int_eq(targetLength, 127);
+}
+END_TEST
+
+START_TEST (test_wrong_source)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the");
+    patch[4] = 1;
+    const uint8_t instructions[] = {0x01, 0, 3};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+    ck_assert_int_eq(targetLength, 0);
+}
+END_TEST
+
+START_TEST (test_copy_outside_source)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "dogs");
+    const uint8_t instructions[] = {0x01, 40, 4};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+}
+END_TEST
+
+START_TEST (test_past_end_of_target)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the");
+    const uint8_t instructions[] = {0x01, 0, 4};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+}
+END_TEST
+
+START_TEST (test_bad_checksum)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the");
+    patch[12] ^= 0xff;
+    const uint8_t instructions[] = {0x01, 0, 3};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+}
+END_TEST
+
+START_TEST (test_bad_opcode)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the");
+    patch[length++] = 0x7f;
+
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+}
+END_TEST
+
+START_TEST (test_sink_fails)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the");
+    const uint8_t instructions[] = {0x01, 0, 3};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    sinkFails = true;
+    ck_assert_int_eq(applyAll(patch, length, length), delta::DELTA_FAILED);
+}
+END_TEST
+
+START_TEST (test_incomplete)
+{
+    uint8_t patch[64];
+    size_t length = header(patch, "the quick");
+    const uint8_t instructions[] = {0x01, 0, 3};
+    memcpy(&patch[length], instructions, sizeof(instructions));
+    length += sizeof(instructions);
+
+    ck_assert_int_eq(applyAll(patch, length, length),
+            delta::DELTA_IN_PROGRESS);
+}
+END_TEST
+
+Suite* deltaSuite(void) {
+    Suite* s = suite_create("delta");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_copy_and_insert);
+    tcase_add_test(tc_core, test_add_changes);
+    tcase_add_test(tc_core, test_one_byte_at_a_time);
+    tcase_add_test(tc_core, test_long_varint);
+    tcase_add_test(tc_core, test_wrong_source);
+    tcase_add_test(tc_core, test_copy_outside_source);
+    tcase_add_test(tc_core, test_past_end_of_target);
+    tcase_add_test(tc_core, test_bad_checksum);
+    tcase_add_test(tc_core, test_bad_opcode);
+    tcase_add_test(tc_core, test_sink_fails);
+    tcase_add_test(tc_core, test_incomplete);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = deltaSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -1,8 +1,11 @@
 #include <check.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "signals.h"
 #include "config.h"
 #include "diagnostics.h"
+#include "obd2.h"
+#include "saved_config.h"
 #include "platform/platform.h"
 
 #include "canutil_spy.h"
@@ -22,7 +25,7 @@ using openxc::config::getConfiguration;
 extern void initializeVehicleInterface();
 extern long FAKE_TIME;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
 
 DiagnosticRequest request = {
     arbitration_id: 0x7e0,
@@ -44,7 +47,7 @@ static bool canQueueEmpty(int bus) {
 }
 
 bool outputQueueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
 }
 
 static void resetQueues() {
@@ -61,6 +64,7 @@ void setup() {
     openxc::can::setAcceptanceFilterStatus(&getCanBuses()[0], true, getCanBuses(), getCanBusCount());
     getCanBuses()[0].rawWritable = true;
     request.pid = 2;
+    request.payload_length = 0;
     request.arbitration_id = 0x7e0;
     initializeVehicleInterface();
     getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
@@ -130,8 +134,8 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") == NULL);
     ck_assert(strstr((char*)snapshot, "bar") != NULL);
@@ -149,7 +153,7 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
 
     diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager, &getCanBuses()[0],
             &message, &getConfiguration()->pipeline);
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") == NULL);
     ck_assert(strstr((char*)snapshot, "bar") != NULL);
@@ -162,7 +166,7 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
 
     diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager, &getCanBuses()[0],
             &message, &getConfiguration()->pipeline);
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") != NULL);
     ck_assert(strstr((char*)snapshot, "bar") == NULL);
@@ -202,6 +206,88 @@ START_TEST(test_unable_to_cancel_nonrecurring)
 }
 END_TEST
 
+static openxc_ControlCommand oneTimeRequestCommand() {
+    openxc_ControlCommand command = {0};
+    command.has_type = true;
+    command.type = openxc_ControlCommand_Type_DIAGNOSTIC;
+    command.has_diagnostic_request = true;
+    command.diagnostic_request.has_action = true;
+    command.diagnostic_request.action = openxc_DiagnosticControlCommand_Action_ADD;
+    command.diagnostic_request.request.has_bus = true;
+    command.diagnostic_request.request.bus = 1;
+    command.diagnostic_request.request.has_message_id = true;
+    command.diagnostic_request.request.message_id = request.arbitration_id;
+    command.diagnostic_request.request.has_mode = true;
+    command.diagnostic_request.request.mode = request.mode;
+    command.diagnostic_request.request.has_pid = true;
+    command.diagnostic_request.request.pid = request.pid;
+    return command;
+}
+
+static int countNonrecurring() {
+    int count = 0;
+    ActiveDiagnosticRequest* entry;
+    LIST_FOREACH(entry,
+            &getConfiguration()->diagnosticsManager.nonrecurringRequests,
+            listEntries) {
+        ++count;
+    }
+    return count;
+}
+
+START_TEST(test_duplicate_command_shares_pending_request)
+{
+    getConfiguration()->diagnosticsManager.responseCacheTtlMs = 1000;
+    openxc_ControlCommand command = oneTimeRequestCommand();
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    ck_assert_int_eq(1, countNonrecurring());
+}
+END_TEST
+
+START_TEST(test_duplicate_command_answered_from_cache)
+{
+    getConfiguration()->diagnosticsManager.responseCacheTtlMs = 1000;
+    openxc_ControlCommand command = oneTimeRequestCommand();
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+          &getCanBuses()[0], &message, &getConfiguration()->pipeline);
+    fail_if(outputQueueEmpty());
+    resetQueues();
+
+    FAKE_TIME += 500;
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    fail_if(outputQueueEmpty());
+    ck_assert_int_eq(0, countNonrecurring());
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    fail_unless(canQueueEmpty(0));
+
+    // once the cached response expires, the request goes to the vehicle again
+    resetQueues();
+    FAKE_TIME += 600;
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    fail_unless(outputQueueEmpty());
+    ck_assert_int_eq(1, countNonrecurring());
+}
+END_TEST
+
+START_TEST(test_duplicate_command_sent_without_cache)
+{
+    openxc_ControlCommand command = oneTimeRequestCommand();
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    ck_assert(diagnostics::handleDiagnosticCommand(
+             &getConfiguration()->diagnosticsManager, &command));
+    ck_assert_int_eq(2, countNonrecurring());
+}
+END_TEST
+
 START_TEST(test_cancel_recurring_from_command)
 {
     openxc_ControlCommand command = {0};
@@ -294,8 +380,8 @@ START_TEST (test_add_basic_request)
           &getCanBuses()[0], &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"bus\":1,\"id\":2016,\"mode\":1,\"success\":true,\"pid\":2,\"payload\":\"0x45\"}\0");
 }
@@ -313,8 +399,8 @@ START_TEST (test_recognized_obd2_request_overridden)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "value") != NULL);
     ck_assert(strstr((char*)snapshot, "payload") == NULL);
@@ -331,8 +417,8 @@ START_TEST (test_recognized_obd2_request)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     // only doing OBD-II autodetection for commands, still need to be able to
     // pass NULL to addRequest to say no decoder, and don't put 'value' in.
@@ -341,6 +427,63 @@ START_TEST (test_recognized_obd2_request)
 }
 END_TEST
 
+START_TEST (test_multi_pid_response_split)
+{
+    request.pid = 0xc;
+    request.payload[0] = 0xd;
+    request.payload_length = 1;
+    ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &request, NULL, false,
+            diagnostics::obd2::handleObd2Pid, NULL));
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    fail_if(canQueueEmpty(0));
+
+    CanMessage response = {
+       id: request.arbitration_id + 0x8,
+       format: CanMessageFormat::STANDARD,
+       data: {0x06, 0x41, 0xc, 0x1a, 0xf8, 0xd, 0x32},
+       length: 8
+    };
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager, &getCanBuses()[0],
+            &response, &getConfiguration()->pipeline);
+    fail_if(outputQueueEmpty());
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "engine_speed") != NULL);
+    ck_assert(strstr((char*)snapshot, "vehicle_speed") != NULL);
+}
+END_TEST
+
+START_TEST (test_split_pid_response_stops_at_unknown_pid)
+{
+    DiagnosticResponse response = {0};
+    response.success = true;
+    response.mode = 0x1;
+    response.has_pid = true;
+    response.pid = 0xd;
+    uint8_t payload[] = {0x32, 0xc, 0x1a, 0xf8, 0xff, 0x1};
+    memcpy(response.payload, payload, sizeof(payload));
+    response.payload_length = sizeof(payload);
+
+    DiagnosticResponse pidResponse;
+    int offset = diagnostics::obd2::nextPidResponse(&response, 0, &pidResponse);
+    ck_assert_int_eq(1, offset);
+    ck_assert_int_eq(0xd, pidResponse.pid);
+    ck_assert_int_eq(1, pidResponse.payload_length);
+
+    offset = diagnostics::obd2::nextPidResponse(&response, offset, &pidResponse);
+    ck_assert_int_eq(4, offset);
+    ck_assert_int_eq(0xc, pidResponse.pid);
+    ck_assert_int_eq(2, pidResponse.payload_length);
+    ck_assert_int_eq(0x1a, pidResponse.payload[0]);
+
+    ck_assert_int_eq(-1, diagnostics::obd2::nextPidResponse(&response, offset,
+                &pidResponse));
+}
+END_TEST
+
 START_TEST (test_padding_on_by_default)
 {
     ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
@@ -376,6 +519,34 @@ START_TEST (test_padding_disabled)
 }
 END_TEST
 
+START_TEST (test_recurring_request_frame_cached)
+{
+    request.no_frame_padding = true;
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                &request, 1));
+    ck_assert_int_eq(TAILQ_FIRST(&manager->recurringRequests)->frameLength, 3);
+    // encoding it to cache doesn't send it
+    fail_unless(canQueueEmpty(0));
+
+    for(int i = 0; i < 2; i++) {
+        diagnostics::sendRequests(manager, &getCanBuses()[0]);
+        fail_if(canQueueEmpty(0));
+        CanMessage message = QUEUE_POP(CanMessage,
+                &getCanBuses()[0].sendQueue);
+        ck_assert_int_eq(message.id, 0x7e0);
+        ck_assert_int_eq(message.length, 3);
+        ck_assert_int_eq(message.data[0], 2);
+        ck_assert_int_eq(message.data[1],
+                OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST);
+        ck_assert_int_eq(message.data[2], 0x2);
+        fail_unless(canQueueEmpty(0));
+        FAKE_TIME += 2000;
+    }
+    request.no_frame_padding = false;
+}
+END_TEST
+
 START_TEST (test_add_request_other_bus)
 {
     ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
@@ -386,8 +557,8 @@ START_TEST (test_add_request_other_bus)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":69}\0");
 }
@@ -403,8 +574,8 @@ START_TEST (test_add_request_with_name)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":69}\0");
 }
@@ -478,8 +649,8 @@ START_TEST (test_add_request_with_name_and_decoder)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":138}\0");
 }
@@ -541,6 +712,270 @@ START_TEST (test_add_recurring)
 }
 END_TEST
 
+START_TEST (test_stream_long_response)
+{
+    getConfiguration()->diagnosticsManager.streamingMinLength = 8;
+    ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &request));
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    fail_if(canQueueEmpty(0));
+    resetQueues();
+
+    CanMessage frame = message;
+    uint8_t firstFrame[] = {0x10, 0x14, 0x41, 0x02, 0x1, 0x2, 0x3, 0x4};
+    memcpy(frame.data, firstFrame, sizeof(firstFrame));
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+          &getCanBuses()[0], &frame, &getConfiguration()->pipeline);
+    // the first chunk is relayed right away, and the flow control sent
+    fail_if(outputQueueEmpty());
+    fail_if(canQueueEmpty(0));
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"payload\":\"0x1014410201020304\"") != NULL);
+
+    for(uint8_t sequence = 1; sequence <= 2; sequence++) {
+        resetQueues();
+        uint8_t consecutiveFrame[] = {(uint8_t)(0x20 | sequence),
+                0x5, 0x6, 0x7, 0x8, 0x9, 0xa, 0xb};
+        memcpy(frame.data, consecutiveFrame, sizeof(consecutiveFrame));
+        diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+              &getCanBuses()[0], &frame, &getConfiguration()->pipeline);
+        fail_if(outputQueueEmpty());
+    }
+
+    // 6 + 7 + 7 bytes is the whole response, so the request is done
+    resetQueues();
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    fail_unless(canQueueEmpty(0));
+    ck_assert(LIST_EMPTY(
+            &getConfiguration()->diagnosticsManager.nonrecurringRequests));
+}
+END_TEST
+
+START_TEST (test_stream_aborted_on_missed_frame)
+{
+    getConfiguration()->diagnosticsManager.streamingMinLength = 8;
+    ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
+            &getCanBuses()[0], &request));
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+
+    CanMessage frame = message;
+    uint8_t firstFrame[] = {0x10, 0x14, 0x41, 0x02, 0x1, 0x2, 0x3, 0x4};
+    memcpy(frame.data, firstFrame, sizeof(firstFrame));
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+          &getCanBuses()[0], &frame, &getConfiguration()->pipeline);
+
+    resetQueues();
+    uint8_t skippedFrame[] = {0x22, 0x5, 0x6, 0x7, 0x8, 0x9, 0xa, 0xb};
+    memcpy(frame.data, skippedFrame, sizeof(skippedFrame));
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+          &getCanBuses()[0], &frame, &getConfiguration()->pipeline);
+    fail_unless(outputQueueEmpty());
+    ck_assert(LIST_EMPTY(
+            &getConfiguration()->diagnosticsManager.nonrecurringRequests));
+}
+END_TEST
+
+START_TEST (test_stream_flow_control_blocks)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    manager->streamingMinLength = 8;
+    ck_assert(diagnostics::setFlowControl(manager, &getCanBuses()[0], 0, 1, 0));
+    ck_assert(diagnostics::setFlowControl(manager, &getCanBuses()[0],
+                request.arbitration_id, 2, 5));
+    ck_assert(!diagnostics::setFlowControl(manager, &getCanBuses()[0],
+                request.arbitration_id, 2, 0x80));
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request));
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    resetQueues();
+
+    CanMessage frame = message;
+    uint8_t firstFrame[] = {0x10, 0x1e, 0x41, 0x02, 0x1, 0x2, 0x3, 0x4};
+    memcpy(frame.data, firstFrame, sizeof(firstFrame));
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &frame,
+            &getConfiguration()->pipeline);
+    // the ECU's own parameters win over the bus's
+    CanMessage flowControl = QUEUE_POP(CanMessage,
+            &getCanBuses()[0].sendQueue);
+    ck_assert_int_eq(flowControl.id, request.arbitration_id);
+    ck_assert_int_eq(flowControl.data[0], 0x30);
+    ck_assert_int_eq(flowControl.data[1], 2);
+    ck_assert_int_eq(flowControl.data[2], 5);
+
+    // 6 + 4 * 7 bytes covers the response, and the ECU is cleared again after
+    // each block of 2 except the last
+    for(uint8_t sequence = 1; sequence <= 4; sequence++) {
+        resetQueues();
+        uint8_t consecutiveFrame[] = {(uint8_t)(0x20 | sequence),
+                0x5, 0x6, 0x7, 0x8, 0x9, 0xa, 0xb};
+        memcpy(frame.data, consecutiveFrame, sizeof(consecutiveFrame));
+        diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &frame,
+                &getConfiguration()->pipeline);
+        ck_assert(canQueueEmpty(0) == (sequence != 2));
+        if(sequence == 2) {
+            flowControl = QUEUE_POP(CanMessage, &getCanBuses()[0].sendQueue);
+            ck_assert_int_eq(flowControl.data[0], 0x30);
+            ck_assert_int_eq(flowControl.data[1], 2);
+        }
+    }
+
+    resetQueues();
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    ck_assert(LIST_EMPTY(&manager->nonrecurringRequests));
+}
+END_TEST
+
+/* Send a DiagnosticSessionControl request for the session type to 0x7e0 and
+ * answer it positively.
+ */
+static void changeSession(uint8_t type) {
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    DiagnosticRequest sessionControl = {
+        arbitration_id: 0x7e0,
+        mode: 0x10,
+    };
+    sessionControl.payload[0] = type;
+    sessionControl.payload_length = 1;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0],
+                &sessionControl));
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+
+    CanMessage response = message;
+    uint8_t positiveResponse[] = {0x02, 0x50, type};
+    memcpy(response.data, positiveResponse, sizeof(positiveResponse));
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &response,
+            &getConfiguration()->pipeline);
+    resetQueues();
+}
+
+START_TEST (test_session_kept_alive_with_tester_present)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    changeSession(0x3);
+
+    FAKE_TIME += DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS - 1;
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    fail_unless(canQueueEmpty(0));
+
+    FAKE_TIME += 1;
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    CanMessage testerPresent = QUEUE_POP(CanMessage,
+            &getCanBuses()[0].sendQueue);
+    ck_assert_int_eq(testerPresent.id, 0x7e0);
+    ck_assert_int_eq(testerPresent.data[0], 0x2);
+    ck_assert_int_eq(testerPresent.data[1], 0x3e);
+    ck_assert_int_eq(testerPresent.data[2], 0x80);
+    fail_unless(canQueueEmpty(0));
+    // nothing is published for it
+    fail_unless(outputQueueEmpty());
+
+    changeSession(0x1);
+    FAKE_TIME += DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS;
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    fail_unless(canQueueEmpty(0));
+}
+END_TEST
+
+START_TEST (test_request_puts_off_tester_present)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    changeSession(0x3);
+
+    FAKE_TIME += DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS / 2;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request));
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+            &getConfiguration()->pipeline);
+    resetQueues();
+
+    FAKE_TIME += DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS / 2;
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    fail_unless(canQueueEmpty(0));
+}
+END_TEST
+
+/* Answer the DTC monitor's request for stored trouble codes from 0x7e8, once
+ * it's in flight - it takes turns with the request for pending codes.
+ */
+static void answerStoredDtcs(const uint8_t* data, size_t length) {
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    CanMessage response = message;
+    memcpy(response.data, data, length);
+    for(int i = 0; i < 20; i++) {
+        FAKE_TIME += 150;
+        diagnostics::sendRequests(manager, &getCanBuses()[0]);
+        ActiveDiagnosticRequest* entry;
+        TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+            if(entry->request.mode == 0x3 && entry->inFlight) {
+                resetQueues();
+                diagnostics::receiveCanMessage(manager, &getCanBuses()[0],
+                        &response, &getConfiguration()->pipeline);
+                return;
+            }
+        }
+    }
+    ck_abort_msg("The request for stored DTCs was never sent");
+}
+
+static bool outputContains(const char* text) {
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    return strstr((char*)snapshot, text) != NULL;
+}
+
+START_TEST (test_dtc_monitor_publishes_changes)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    manager->obd2Bus = &getCanBuses()[0];
+    manager->dtcMonitorFrequencyHz = 1;
+    ck_assert(diagnostics::obd2::startDtcMonitor(manager));
+
+    uint8_t twoCodes[] = {0x06, 0x43, 0x02, 0x03, 0x01, 0x01, 0x71};
+    answerStoredDtcs(twoCodes, sizeof(twoCodes));
+    ck_assert(outputContains("\"obd2_dtc_stored\""));
+    ck_assert(outputContains("\"P0301\""));
+    ck_assert(outputContains("\"P0171\""));
+    // the response itself isn't published
+    ck_assert(!outputContains("payload"));
+
+    answerStoredDtcs(twoCodes, sizeof(twoCodes));
+    fail_unless(outputQueueEmpty());
+
+    uint8_t oneCode[] = {0x04, 0x43, 0x01, 0x03, 0x01};
+    answerStoredDtcs(oneCode, sizeof(oneCode));
+    ck_assert(outputContains("\"P0171\",\"event\":false"));
+    ck_assert(!outputContains("P0301"));
+}
+END_TEST
+
+START_TEST (test_supported_pids_cached_in_flash)
+{
+    diagnostics::obd2::SavedSupportedPid pids[] = {{0xc, 0}, {0xd, 1}};
+    diagnostics::obd2::restoreSupportedPids(pids, 2);
+    ck_assert(openxc::config::saveSupportedPids());
+
+    diagnostics::obd2::restoreSupportedPids(NULL, 0);
+    diagnostics::obd2::SavedSupportedPid saved[OBD2_SAVED_PID_COUNT];
+    ck_assert_int_eq(0, diagnostics::obd2::saveSupportedPids(saved,
+                OBD2_SAVED_PID_COUNT));
+
+    // only the PIDs were saved, not the rest of the configuration
+    ck_assert(!openxc::config::restoreConfiguration());
+    ck_assert_int_eq(2, diagnostics::obd2::saveSupportedPids(saved,
+                OBD2_SAVED_PID_COUNT));
+    ck_assert_int_eq(0xc, saved[0].pid);
+    ck_assert_int_eq(0, saved[0].ecu);
+    ck_assert_int_eq(0xd, saved[1].pid);
+    ck_assert_int_eq(1, saved[1].ecu);
+
+    ck_assert(openxc::config::clearSavedConfiguration());
+    diagnostics::obd2::restoreSupportedPids(NULL, 0);
+}
+END_TEST
+
 START_TEST (test_receive_nonrecurring_twice)
 {
     ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
@@ -865,8 +1300,8 @@ START_TEST(test_broadcast_response_arb_id)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "2024") != NULL);
     ck_assert(strstr((char*)snapshot, "2015") == NULL);
@@ -884,8 +1319,8 @@ START_TEST(test_passthrough_decoder)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "69") != NULL);
 }
@@ -918,11 +1353,11 @@ END_TEST
 START_TEST(test_use_all_free_entries_for_recurring)
 {
     for(int i = 0; i < MAX_SIMULTANEOUS_DIAG_REQUESTS; i++) {
-        request.arbitration_id = 1 + i;
+        request.pid = 1 + i;
         ck_assert(diagnostics::addRecurringRequest(&getConfiguration()->diagnosticsManager,
                 &getCanBuses()[0], &request, 1));
     }
-    ++request.arbitration_id;
+    ++request.pid;
     ck_assert(!diagnostics::addRecurringRequest(&getConfiguration()->diagnosticsManager,
             &getCanBuses()[0], &request, 1));
 }
@@ -931,16 +1366,271 @@ END_TEST
 START_TEST(test_use_all_free_entries)
 {
     for(int i = 0; i < MAX_SIMULTANEOUS_DIAG_REQUESTS; i++) {
-        request.arbitration_id = 1 + i;
+        request.pid = 1 + i;
         ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
                 &getCanBuses()[0], &request));
     }
-    ++request.arbitration_id;
+    ++request.pid;
     ck_assert(!diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
             &getCanBuses()[0], &request));
 }
 END_TEST
 
+static int countInFlight() {
+    int count = 0;
+    for(int i = 0; i < MAX_SIMULTANEOUS_DIAG_REQUESTS; i++) {
+        if(getConfiguration()->diagnosticsManager.requestListEntries[i].inFlight) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+START_TEST(test_broadcast_completes_once_known_ecus_answer)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    request.arbitration_id = OBD2_FUNCTIONAL_BROADCAST_ID;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+            &request, NULL, true, 2));
+    CanMessage secondResponse = message;
+    secondResponse.id = OBD2_FUNCTIONAL_RESPONSE_START + 1;
+
+    for(int i = 0; i < DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES; i++) {
+        diagnostics::sendRequests(manager, &getCanBuses()[0]);
+        diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+                &getConfiguration()->pipeline);
+        diagnostics::receiveCanMessage(manager, &getCanBuses()[0],
+                &secondResponse, &getConfiguration()->pipeline);
+        // still learning which ECUs answer, so it waits for the timeout
+        ck_assert_int_eq(1, countInFlight());
+        FAKE_TIME += 500;
+    }
+
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+            &getConfiguration()->pipeline);
+    ck_assert_int_eq(1, countInFlight());
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0],
+            &secondResponse, &getConfiguration()->pipeline);
+    ck_assert_int_eq(0, countInFlight());
+}
+END_TEST
+
+START_TEST(test_broadcast_relearns_missing_ecu)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    request.arbitration_id = OBD2_FUNCTIONAL_BROADCAST_ID;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+            &request, NULL, true, 2));
+    CanMessage secondResponse = message;
+    secondResponse.id = OBD2_FUNCTIONAL_RESPONSE_START + 1;
+
+    for(int i = 0; i < DIAGNOSTIC_RESPONDER_DISCOVERY_CYCLES; i++) {
+        diagnostics::sendRequests(manager, &getCanBuses()[0]);
+        diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+                &getConfiguration()->pipeline);
+        diagnostics::receiveCanMessage(manager, &getCanBuses()[0],
+                &secondResponse, &getConfiguration()->pipeline);
+        FAKE_TIME += 500;
+    }
+
+    // the second ECU doesn't answer, so it times out and starts learning again
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+            &getConfiguration()->pipeline);
+    ck_assert_int_eq(1, countInFlight());
+    FAKE_TIME += 500;
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    ActiveDiagnosticRequest* entry = TAILQ_FIRST(&manager->recurringRequests);
+    ck_assert_int_eq(entry->discoveryCycles, 1);
+    ck_assert_int_eq(entry->knownResponders, 1);
+}
+END_TEST
+
+START_TEST(test_in_flight_limited_by_handle_pool)
+{
+    for(int i = 0; i < MAX_IN_FLIGHT_DIAG_REQUESTS + 1; i++) {
+        request.arbitration_id = 0x700 + i;
+        ck_assert(diagnostics::addRequest(&getConfiguration()->diagnosticsManager,
+                &getCanBuses()[0], &request));
+    }
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    ck_assert_int_eq(MAX_IN_FLIGHT_DIAG_REQUESTS, countInFlight());
+
+    // the one left over is sent once a handle is returned
+    FAKE_TIME += 200;
+    diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, &getCanBuses()[0]);
+    ck_assert_int_eq(1, countInFlight());
+}
+END_TEST
+
+START_TEST(test_one_request_in_flight_per_ecu)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    request.pid = 3;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request));
+    request.pid = 2;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request));
+    request.arbitration_id = 0x7e1;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request));
+
+    // one each to 0x7e0 and 0x7e1, back to back
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    ck_assert_int_eq(2, countInFlight());
+
+    // the response to PID 2 frees up 0x7e0 for the request for PID 3
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+            &getConfiguration()->pipeline);
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    ck_assert_int_eq(2, countInFlight());
+}
+END_TEST
+
+START_TEST(test_update_recurring_frequency)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                &request, 1));
+    ck_assert(diagnostics::updateRecurringRequestFrequency(manager,
+                &getCanBuses()[0], &request, 5));
+    ck_assert(TAILQ_FIRST(&manager->recurringRequests)->frequencyClock.frequency
+            == 5);
+
+    ck_assert(!diagnostics::updateRecurringRequestFrequency(manager,
+                &getCanBuses()[0], &request, 20));
+    ck_assert(!diagnostics::updateRecurringRequestFrequency(manager,
+                &getCanBuses()[0], &request, 0));
+
+    request.pid = 3;
+    ck_assert(!diagnostics::updateRecurringRequestFrequency(manager,
+                &getCanBuses()[0], &request, 5));
+}
+END_TEST
+
+START_TEST(test_request_names_shared)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                &request, "foo", false, 1));
+    uint16_t tableLength = manager->nameTableLength;
+
+    request.pid = 3;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                &request, "foo", false, 1));
+    ck_assert_int_eq(tableLength, manager->nameTableLength);
+
+    ActiveDiagnosticRequest* entry;
+    TAILQ_FOREACH(entry, &manager->recurringRequests, queueEntries) {
+        ck_assert_str_eq(diagnostics::requestName(manager, entry), "foo");
+    }
+}
+END_TEST
+
+START_TEST(test_request_names_reclaimed)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    char name[MAX_GENERIC_NAME_LENGTH];
+    for(int i = 0; i < DIAGNOSTIC_NAME_TABLE_SIZE; i++) {
+        snprintf(name, sizeof(name), "name_%d", i);
+        ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                    &request, name, false, 1));
+        ck_assert_str_eq(diagnostics::requestName(manager,
+                    TAILQ_FIRST(&manager->recurringRequests)), name);
+        ck_assert(diagnostics::cancelRecurringRequest(manager,
+                    &getCanBuses()[0], &request));
+    }
+}
+END_TEST
+
+START_TEST(test_request_named_after_signal)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    uint16_t tableLength = manager->nameTableLength;
+    ck_assert(diagnostics::addRequest(manager, &getCanBuses()[0], &request,
+                "transmission_gear_position", false));
+    // The name comes from the signal table instead
+    ck_assert_int_eq(tableLength, manager->nameTableLength);
+    ck_assert_str_eq(diagnostics::requestName(manager,
+                LIST_FIRST(&manager->nonrecurringRequests)),
+            "transmission_gear_position");
+
+    openxc::pipeline::setNameDictionary(true);
+    diagnostics::sendRequests(manager, &getCanBuses()[0]);
+    diagnostics::receiveCanMessage(manager, &getCanBuses()[0], &message,
+            &getConfiguration()->pipeline);
+    openxc::pipeline::setNameDictionary(false);
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot, "{\"name\":\"1\",\"value\":69}");
+}
+END_TEST
+
+START_TEST(test_request_named_after_pid)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    uint16_t tableLength = manager->nameTableLength;
+    ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                &request, "engine_speed", false, 1));
+    ck_assert_int_eq(tableLength, manager->nameTableLength);
+    ck_assert_str_eq(diagnostics::requestName(manager,
+                TAILQ_FIRST(&manager->recurringRequests)), "engine_speed");
+}
+END_TEST
+
+static void assertRecurringInDueOrder() {
+    ActiveDiagnosticRequest* entry;
+    ActiveDiagnosticRequest* previous = NULL;
+    TAILQ_FOREACH(entry, &getConfiguration()->diagnosticsManager.recurringRequests,
+            queueEntries) {
+        if(previous != NULL) {
+            ck_assert((long)(entry->nextDueMs - previous->nextDueMs) >= 0);
+        }
+        previous = entry;
+    }
+}
+
+START_TEST(test_recurring_requests_kept_in_due_order)
+{
+    const float frequencies[] = {1, 10, 2, 5, 10, 1};
+    for(int i = 0; i < 6; i++) {
+        request.arbitration_id = 0x700 + i;
+        ck_assert(diagnostics::addRecurringRequest(&getConfiguration()->diagnosticsManager,
+                &getCanBuses()[0], &request, frequencies[i]));
+        assertRecurringInDueOrder();
+    }
+
+    for(int i = 0; i < 50; i++) {
+        FAKE_TIME += 50;
+        diagnostics::sendRequests(&getConfiguration()->diagnosticsManager,
+                &getCanBuses()[0]);
+        assertRecurringInDueOrder();
+        ck_assert((long)(TAILQ_FIRST(&getConfiguration()->diagnosticsManager.recurringRequests)->nextDueMs
+                    - FAKE_TIME) > 0);
+    }
+}
+END_TEST
+
+START_TEST(test_recurring_requests_spread_over_period)
+{
+    DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+    for(int i = 0; i < 3; i++) {
+        request.pid = 2 + i;
+        ck_assert(diagnostics::addRecurringRequest(manager, &getCanBuses()[0],
+                    &request, 1));
+    }
+
+    ActiveDiagnosticRequest* first = TAILQ_FIRST(&manager->recurringRequests);
+    ActiveDiagnosticRequest* second = TAILQ_NEXT(first, queueEntries);
+    ActiveDiagnosticRequest* third = TAILQ_NEXT(second, queueEntries);
+    // the second one added goes half a period after the first, and the third
+    // in the middle of the gap between them, so it's next in the queue
+    ck_assert_int_eq(second->nextDueMs - first->nextDueMs, 250);
+    ck_assert_int_eq(third->nextDueMs - first->nextDueMs, 500);
+}
+END_TEST
+
 int countFilters(CanBus* bus) {
     int filterCount = 0;
     AcceptanceFilterListEntry* entry;
@@ -1016,15 +1706,30 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_padding_on_by_default);
     tcase_add_test(tc_core, test_padding_enabled);
     tcase_add_test(tc_core, test_padding_disabled);
+    tcase_add_test(tc_core, test_recurring_request_frame_cached);
+    tcase_add_test(tc_core, test_broadcast_completes_once_known_ecus_answer);
+    tcase_add_test(tc_core, test_broadcast_relearns_missing_ecu);
     tcase_add_test(tc_core, test_simultaneous_recurring_nonrecurring);
     tcase_add_test(tc_core, test_cancel_recurring);
     tcase_add_test(tc_core, test_cancel_recurring_from_command);
     tcase_add_test(tc_core, test_cancel_invalid);
     tcase_add_test(tc_core, test_unable_to_cancel_nonrecurring);
     tcase_add_test(tc_core, test_add_nonrecurring_doesnt_clobber_recurring);
+    tcase_add_test(tc_core, test_duplicate_command_shares_pending_request);
+    tcase_add_test(tc_core, test_duplicate_command_answered_from_cache);
+    tcase_add_test(tc_core, test_duplicate_command_sent_without_cache);
+    tcase_add_test(tc_core, test_stream_long_response);
+    tcase_add_test(tc_core, test_stream_aborted_on_missed_frame);
+    tcase_add_test(tc_core, test_stream_flow_control_blocks);
+    tcase_add_test(tc_core, test_session_kept_alive_with_tester_present);
+    tcase_add_test(tc_core, test_request_puts_off_tester_present);
+    tcase_add_test(tc_core, test_dtc_monitor_publishes_changes);
+    tcase_add_test(tc_core, test_supported_pids_cached_in_flash);
     tcase_add_test(tc_core, test_receive_nonrecurring_twice);
     tcase_add_test(tc_core, test_nonrecurring_timeout);
     tcase_add_test(tc_core, test_recognized_obd2_request);
+    tcase_add_test(tc_core, test_multi_pid_response_split);
+    tcase_add_test(tc_core, test_split_pid_response_stops_at_unknown_pid);
     tcase_add_test(tc_core, test_recognized_obd2_request_overridden);
 
     tcase_add_test(tc_core, test_recurring_staggered);
@@ -1038,6 +1743,13 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_requests_on_multiple_buses);
     tcase_add_test(tc_core, test_use_all_free_entries);
     tcase_add_test(tc_core, test_use_all_free_entries_for_recurring);
+    tcase_add_test(tc_core, test_in_flight_limited_by_handle_pool);
+    tcase_add_test(tc_core, test_one_request_in_flight_per_ecu);
+    tcase_add_test(tc_core, test_update_recurring_frequency);
+    tcase_add_test(tc_core, test_request_names_shared);
+    tcase_add_test(tc_core, test_request_names_reclaimed);
+    tcase_add_test(tc_core, test_request_named_after_signal);
+    tcase_add_test(tc_core, test_request_named_after_pid);
     tcase_add_test(tc_core, test_broadcast_can_filters);
     tcase_add_test(tc_core, test_can_filters);
     tcase_add_test(tc_core, test_can_filters_disabled);
@@ -1054,6 +1766,8 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_request_callback);
 
     tcase_add_test(tc_core, test_recurring_obd2_build);
+    tcase_add_test(tc_core, test_recurring_requests_kept_in_due_order);
+    tcase_add_test(tc_core, test_recurring_requests_spread_over_period);
 
     tcase_add_test(tc_core, test_ignition_check_power_management_uses_watchdog);
 
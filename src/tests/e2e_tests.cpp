@@ -0,0 +1,160 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "can/e2e.h"
+#include "signals.h"
+
+namespace e2e = openxc::can::e2e;
+
+using openxc::signals::getCanBuses;
+
+CanMessageProtection protection;
+CanMessageDefinition definition;
+CanMessage message;
+
+/* Private: Fill in the message's 4 bit counter in the low bits of byte 1 and
+ * its CRC in byte 0.
+ */
+static void setCounter(uint8_t counter) {
+    message.data[1] = (message.data[1] & 0xf0) | counter;
+    message.data[0] = e2e::checksum(CHECKSUM_CRC8_SAE_J1850, message.data,
+            message.length, 0);
+}
+
+void setup() {
+    memset(&protection, 0, sizeof(protection));
+    protection.checksumType = CHECKSUM_CRC8_SAE_J1850;
+    protection.checksumByte = 0;
+    protection.counterBitPosition = 12;
+    protection.counterBitSize = 4;
+
+    memset(&definition, 0, sizeof(definition));
+    definition.bus = &getCanBuses()[0];
+    definition.protection = &protection;
+    definition.bus->framesRejected = 0;
+
+    memset(&message, 0, sizeof(message));
+    message.format = CanMessageFormat::STANDARD;
+    message.length = 8;
+    message.data[3] = 0x42;
+}
+
+START_TEST (test_crc8_sae_j1850)
+{
+    const uint8_t data[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    // The standard check value, with the checksum byte out of the way
+    ck_assert_int_eq(e2e::checksum(CHECKSUM_CRC8_SAE_J1850, data,
+                sizeof(data), 0xff), 0x4b);
+}
+END_TEST
+
+START_TEST (test_xor)
+{
+    const uint8_t data[] = {0x12, 0x34, 0xff, 0x56};
+    ck_assert_int_eq(e2e::checksum(CHECKSUM_XOR, data, sizeof(data), 2),
+            0x12 ^ 0x34 ^ 0x56);
+}
+END_TEST
+
+START_TEST (test_no_protection)
+{
+    definition.protection = NULL;
+    ck_assert(e2e::validate(&definition, &message));
+}
+END_TEST
+
+START_TEST (test_counter_advances)
+{
+    setCounter(14);
+    ck_assert(e2e::validate(&definition, &message));
+    setCounter(15);
+    ck_assert(e2e::validate(&definition, &message));
+    setCounter(0);
+    ck_assert(e2e::validate(&definition, &message));
+    ck_assert_int_eq(definition.bus->framesRejected, 0);
+}
+END_TEST
+
+START_TEST (test_counter_repeated)
+{
+    setCounter(3);
+    ck_assert(e2e::validate(&definition, &message));
+    ck_assert(!e2e::validate(&definition, &message));
+    ck_assert_int_eq(protection.counterErrors, 1);
+    ck_assert_int_eq(definition.bus->framesRejected, 1);
+
+    setCounter(4);
+    ck_assert(e2e::validate(&definition, &message));
+}
+END_TEST
+
+START_TEST (test_counter_jump)
+{
+    protection.maxCounterDelta = 2;
+    setCounter(3);
+    ck_assert(e2e::validate(&definition, &message));
+    setCounter(5);
+    ck_assert(e2e::validate(&definition, &message));
+    setCounter(8);
+    ck_assert(!e2e::validate(&definition, &message));
+    ck_assert_int_eq(protection.counterErrors, 1);
+
+    // Back in step from the frame that jumped
+    setCounter(9);
+    ck_assert(e2e::validate(&definition, &message));
+}
+END_TEST
+
+START_TEST (test_bad_checksum)
+{
+    setCounter(3);
+    ck_assert(e2e::validate(&definition, &message));
+    setCounter(4);
+    message.data[3] ^= 0x1;
+    ck_assert(!e2e::validate(&definition, &message));
+    ck_assert_int_eq(protection.checksumErrors, 1);
+    ck_assert_int_eq(protection.counterErrors, 0);
+
+    // The corrupt frame's counter wasn't taken
+    message.data[3] ^= 0x1;
+    ck_assert(e2e::validate(&definition, &message));
+}
+END_TEST
+
+START_TEST (test_frame_too_short)
+{
+    message.length = 1;
+    protection.checksumType = CHECKSUM_NONE;
+    ck_assert(!e2e::validate(&definition, &message));
+    ck_assert_int_eq(protection.counterErrors, 1);
+}
+END_TEST
+
+Suite* e2eSuite(void) {
+    Suite* s = suite_create("e2e");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_crc8_sae_j1850);
+    tcase_add_test(tc_core, test_xor);
+    tcase_add_test(tc_core, test_no_protection);
+    tcase_add_test(tc_core, test_counter_advances);
+    tcase_add_test(tc_core, test_counter_repeated);
+    tcase_add_test(tc_core, test_counter_jump);
+    tcase_add_test(tc_core, test_bad_checksum);
+    tcase_add_test(tc_core, test_frame_too_short);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = e2eSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
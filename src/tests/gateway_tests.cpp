@@ -0,0 +1,174 @@
+#include <check.h>
+#include <stdint.h>
+#include "signals.h"
+#include "can/gateway.h"
+
+namespace can = openxc::can;
+namespace gateway = openxc::can::gateway;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+
+CanBus* source;
+CanBus* destination;
+
+static CanMessage lastWritten;
+static int writeCount;
+static bool writeSucceeds;
+
+static bool recordingWriteHandler(const CanBus* bus, const CanMessage* message) {
+    if(writeSucceeds) {
+        lastWritten = *message;
+        ++writeCount;
+    }
+    return writeSucceeds;
+}
+
+void setup() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    source = &getCanBuses()[0];
+    destination = &getCanBuses()[1];
+    destination->rawWritable = true;
+    destination->writeHandler = recordingWriteHandler;
+    writeCount = 0;
+    writeSucceeds = true;
+}
+
+void teardown() {
+    destination->rawWritable = false;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_forward_matching_id)
+{
+    ck_assert(gateway::addRoute(source, 0x42, 0x7ff,
+                CanMessageFormat::STANDARD, destination, 0x42, getCanBuses(),
+                getCanBusCount()));
+
+    CanMessage message = {id: 0x42, format: CanMessageFormat::STANDARD,
+            data: {1, 2, 3}, length: 3};
+    ck_assert(gateway::forward(source, &message));
+    ck_assert_int_eq(writeCount, 1);
+    ck_assert_int_eq(lastWritten.id, 0x42);
+    ck_assert_int_eq(lastWritten.length, 3);
+    ck_assert_int_eq(lastWritten.data[2], 3);
+    ck_assert_int_eq(source->gatewayForwarded, 1);
+
+    message.id = 0x43;
+    ck_assert(!gateway::forward(source, &message));
+    ck_assert_int_eq(writeCount, 1);
+    message.id = 0x42;
+    message.format = CanMessageFormat::EXTENDED;
+    ck_assert(!gateway::forward(source, &message));
+    ck_assert_int_eq(writeCount, 1);
+}
+END_TEST
+
+START_TEST (test_forward_remapped_group)
+{
+    ck_assert(gateway::addRoute(source, 0x100, 0x7f0,
+                CanMessageFormat::STANDARD, destination, 0x200, getCanBuses(),
+                getCanBusCount()));
+
+    CanMessage message = {id: 0x10a, format: CanMessageFormat::STANDARD};
+    ck_assert(gateway::forward(source, &message));
+    ck_assert_int_eq(lastWritten.id, 0x20a);
+}
+END_TEST
+
+START_TEST (test_route_adds_acceptance_filters)
+{
+    ck_assert(!can::shouldAcceptMessage(source, 0x104));
+    gateway::addRoute(source, 0x100, 0x7f8, CanMessageFormat::STANDARD,
+            destination, 0x100, getCanBuses(), getCanBusCount());
+    ck_assert(can::shouldAcceptMessage(source, 0x104));
+
+    gateway::clearRoutes(source, getCanBuses(), getCanBusCount());
+    ck_assert(!can::shouldAcceptMessage(source, 0x104));
+    ck_assert_int_eq(source->gatewayRouteCount, 0);
+}
+END_TEST
+
+START_TEST (test_dropped_if_controller_full)
+{
+    gateway::addRoute(source, 0x42, 0x7ff, CanMessageFormat::STANDARD,
+            destination, 0x42, getCanBuses(), getCanBusCount());
+
+    writeSucceeds = false;
+    CanMessage message = {id: 0x42, format: CanMessageFormat::STANDARD};
+    ck_assert(!gateway::forward(source, &message));
+    ck_assert_int_eq(source->gatewayDropped, 1);
+}
+END_TEST
+
+START_TEST (test_dropped_while_main_loop_writes)
+{
+    gateway::addRoute(source, 0x42, 0x7ff, CanMessageFormat::STANDARD,
+            destination, 0x42, getCanBuses(), getCanBusCount());
+
+    destination->writing = true;
+    CanMessage message = {id: 0x42, format: CanMessageFormat::STANDARD};
+    ck_assert(!gateway::forward(source, &message));
+    ck_assert_int_eq(writeCount, 0);
+    ck_assert_int_eq(source->gatewayDropped, 1);
+    destination->writing = false;
+}
+END_TEST
+
+START_TEST (test_destination_must_be_writable)
+{
+    destination->rawWritable = false;
+    ck_assert(!gateway::addRoute(source, 0x42, 0x7ff,
+                CanMessageFormat::STANDARD, destination, 0x42, getCanBuses(),
+                getCanBusCount()));
+    ck_assert(!gateway::addRoute(source, 0x42, 0x7ff,
+                CanMessageFormat::STANDARD, source, 0x42, getCanBuses(),
+                getCanBusCount()));
+    ck_assert_int_eq(source->gatewayRouteCount, 0);
+}
+END_TEST
+
+START_TEST (test_route_limit)
+{
+    for(int i = 0; i < CAN_GATEWAY_ROUTE_COUNT; i++) {
+        ck_assert(gateway::addRoute(source, i, 0x7ff,
+                    CanMessageFormat::STANDARD, destination, i, getCanBuses(),
+                    getCanBusCount()));
+    }
+    ck_assert(!gateway::addRoute(source, 0x42, 0x7ff,
+                CanMessageFormat::STANDARD, destination, 0x42, getCanBuses(),
+                getCanBusCount()));
+}
+END_TEST
+
+Suite* gatewaySuite(void) {
+    Suite* s = suite_create("gateway");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_forward_matching_id);
+    tcase_add_test(tc_core, test_forward_remapped_group);
+    tcase_add_test(tc_core, test_route_adds_acceptance_filters);
+    tcase_add_test(tc_core, test_dropped_if_controller_full);
+    tcase_add_test(tc_core, test_dropped_while_main_loop_writes);
+    tcase_add_test(tc_core, test_destination_must_be_writable);
+    tcase_add_test(tc_core, test_route_limit);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = gatewaySuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
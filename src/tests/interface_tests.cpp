@@ -1,9 +1,18 @@
 #include <check.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "interface/interface.h"
+#include "interface/fs.h"
+#include "interface/usb.h"
+#include "interface/ble.h"
 
 namespace interface = openxc::interface;
+namespace fs = openxc::interface::fs;
+namespace usb = openxc::interface::usb;
+namespace ble = openxc::interface::ble;
+
+extern unsigned long FAKE_TIME;
 
 using openxc::interface::InterfaceDescriptor;
 using openxc::interface::InterfaceType;
@@ -40,6 +49,371 @@ START_TEST (test_unknown_descriptor_string)
 }
 END_TEST
 
+START_TEST (test_encode_can_record)
+{
+    uint8_t data[] = {0x1, 0x2, 0x3};
+    uint8_t record[CAN_LOG_RECORD_SIZE];
+    const uint8_t expected[CAN_LOG_RECORD_SIZE] = {0xa5, 0x0, 0x1, 0x3,
+        0xe8, 0x07, 0x0, 0x0,
+        0xe8, 0x03, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+        0x1, 0x2, 0x3, 0x0, 0x0, 0x0, 0x0, 0x0};
+
+    ck_assert_int_eq(fs::encodeCanRecord(1, 0x7e8, false, data, sizeof(data),
+            1000, record), CAN_LOG_RECORD_SIZE);
+    ck_assert(!memcmp(record, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_encode_extended_can_record)
+{
+    uint8_t data[] = {0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8};
+    uint8_t record[CAN_LOG_RECORD_SIZE];
+    fs::encodeCanRecord(2, 0x18db33f1, true, data, sizeof(data),
+            0x123456789aLL, record);
+
+    ck_assert_int_eq(record[1], CAN_LOG_FLAG_EXTENDED);
+    ck_assert_int_eq(record[2], 2);
+    ck_assert_int_eq(record[3], 8);
+    const uint8_t expectedId[] = {0xf1, 0x33, 0xdb, 0x18};
+    ck_assert(!memcmp(&record[4], expectedId, sizeof(expectedId)));
+    const uint8_t expectedTimestamp[] = {0x9a, 0x78, 0x56, 0x34, 0x12, 0x0,
+        0x0, 0x0};
+    ck_assert(!memcmp(&record[8], expectedTimestamp,
+                sizeof(expectedTimestamp)));
+    ck_assert(!memcmp(&record[16], data, sizeof(data)));
+}
+END_TEST
+
+START_TEST (test_decode_can_record)
+{
+    uint8_t data[] = {0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8};
+    uint8_t record[CAN_LOG_RECORD_SIZE];
+    fs::encodeCanRecord(2, 0x18db33f1, true, data, sizeof(data),
+            0x123456789aLL, record);
+
+    uint8_t bus;
+    uint32_t id;
+    bool extended;
+    uint8_t decoded[8];
+    uint8_t length;
+    uint64_t timestamp;
+    ck_assert(fs::decodeCanRecord(record, &bus, &id, &extended, decoded,
+                &length, &timestamp));
+    ck_assert_int_eq(bus, 2);
+    ck_assert_int_eq(id, 0x18db33f1);
+    ck_assert(extended);
+    ck_assert_int_eq(length, 8);
+    ck_assert(timestamp == 0x123456789aLL);
+    ck_assert(!memcmp(decoded, data, sizeof(data)));
+
+    record[0] = 0;
+    ck_assert(!fs::decodeCanRecord(record, &bus, &id, &extended, decoded,
+                &length, &timestamp));
+}
+END_TEST
+
+START_TEST (test_log_can_message)
+{
+    fs::FsDevice device;
+    BYTE_QUEUE_STORAGE(storage, FS_SEND_QUEUE_SIZE);
+    memset(&device, 0, sizeof(device));
+    BYTE_QUEUE_INIT(&device.sendQueue, storage);
+    fs::initializeCommon(&device);
+    ByteQueue* queue = &device.sendQueue;
+
+    uint8_t data[] = {0x1, 0x2};
+    device.rawCanLog = false;
+    fail_if(fs::logCanMessage(&device, 1, 0x42, false, data, sizeof(data),
+                1000));
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(queue), 0);
+
+    device.rawCanLog = true;
+    fail_unless(fs::logCanMessage(&device, 1, 0x42, false, data, sizeof(data),
+                1000));
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(queue), CAN_LOG_RECORD_SIZE);
+    ck_assert_int_eq(BYTE_QUEUE_POP(queue), CAN_LOG_RECORD_SYNC);
+}
+END_TEST
+
+START_TEST (test_seal_journal_block)
+{
+    uint8_t block[FS_JOURNAL_BLOCK_SIZE];
+    memset(block, 0xff, sizeof(block));
+    memcpy(&block[FS_JOURNAL_HEADER_SIZE], "abc", 3);
+    fs::sealJournalBlock(block, 7, 3);
+
+    const uint8_t expected[FS_JOURNAL_HEADER_SIZE + 4] = {
+        'J', 'R', 'N', 'L',
+        0x7, 0x0, 0x0, 0x0,
+        0x3, 0x0, 0x0, 0x0,
+        0x18, 0xfa, 0xf6, 0x1c,
+        'a', 'b', 'c', 0x0};
+    ck_assert(!memcmp(block, expected, sizeof(expected)));
+    ck_assert_int_eq(block[FS_JOURNAL_BLOCK_SIZE - 1], 0);
+}
+END_TEST
+
+START_TEST (test_open_journal_block)
+{
+    uint8_t block[FS_JOURNAL_BLOCK_SIZE];
+    uint32_t sequence = 0;
+    memset(&block[FS_JOURNAL_HEADER_SIZE], 0x42, FS_JOURNAL_PAYLOAD_SIZE);
+    fs::sealJournalBlock(block, 0x12345678, FS_JOURNAL_PAYLOAD_SIZE);
+
+    ck_assert_int_eq(fs::openJournalBlock(block, &sequence),
+            FS_JOURNAL_PAYLOAD_SIZE);
+    ck_assert_int_eq(sequence, 0x12345678);
+}
+END_TEST
+
+START_TEST (test_open_damaged_journal_block)
+{
+    uint8_t block[FS_JOURNAL_BLOCK_SIZE];
+    uint32_t sequence = 0;
+    memset(&block[FS_JOURNAL_HEADER_SIZE], 0x42, 100);
+    fs::sealJournalBlock(block, 1, 100);
+
+    block[FS_JOURNAL_HEADER_SIZE + 50] ^= 0x1;
+    ck_assert_int_eq(fs::openJournalBlock(block, &sequence), -1);
+    ck_assert_int_eq(sequence, 0);
+
+    // an unwritten, zero filled block
+    memset(block, 0, sizeof(block));
+    ck_assert_int_eq(fs::openJournalBlock(block, &sequence), -1);
+}
+END_TEST
+
+START_TEST (test_encode_index_record)
+{
+    uint8_t record[FS_INDEX_RECORD_SIZE];
+    const uint8_t expected[FS_INDEX_RECORD_SIZE] = {0x5a, 0x1, 0x0, 0x0,
+        0x0, 0x20, 0x1, 0x0,
+        0x9a, 0x78, 0x56, 0x34, 0x12, 0x0, 0x0, 0x0};
+
+    ck_assert_int_eq(fs::encodeIndexRecord(fs::TRIP_START, 0x12000,
+            0x123456789aLL, record), FS_INDEX_RECORD_SIZE);
+    ck_assert(!memcmp(record, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_index_file_name)
+{
+    char name[13];
+    ck_assert(fs::indexFileName("5A3B1C00.TXT", name, sizeof(name)));
+    ck_assert_str_eq(name, "5A3B1C00.IDX");
+
+    ck_assert(!fs::indexFileName("5A3B1C00", name, sizeof(name)));
+    ck_assert(!fs::indexFileName("5A3B1C00.TXT", name, 12));
+}
+END_TEST
+
+START_TEST (test_format_trip_catalog_line)
+{
+    char line[48];
+    ck_assert_int_eq(fs::formatTripCatalogLine(fs::TRIP_START,
+            1507123456789LL, "5A3B1C00.TXT", 0, line, sizeof(line)), 35);
+    ck_assert_str_eq(line, "start,1507123456789,5A3B1C00.TXT,0\n");
+
+    fs::formatTripCatalogLine(fs::TRIP_END, 0, "5A3B2A40.TXT", 81920, line,
+            sizeof(line));
+    ck_assert_str_eq(line, "end,0,5A3B2A40.TXT,81920\n");
+
+    ck_assert_int_eq(fs::formatTripCatalogLine(fs::CHECKPOINT, 0,
+            "5A3B1C00.TXT", 0, line, sizeof(line)), -1);
+    ck_assert_int_eq(fs::formatTripCatalogLine(fs::TRIP_START,
+            1507123456789LL, "5A3B1C00.TXT", 0, line, 35), -1);
+}
+END_TEST
+
+static BYTE_QUEUE_STORAGE(USB_QUEUES[ENDPOINT_COUNT], USB_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(BLE_SEND_QUEUE, BLE_SEND_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(BLE_RECEIVE_QUEUE, BLE_RECEIVE_QUEUE_SIZE);
+static BYTE_QUEUE_STORAGE(BLE_CHANNEL_QUEUES[BLE_CHANNEL_COUNT],
+        BLE_CHANNEL_QUEUE_SIZE);
+
+/* Private: Set up a device of our own, with storage for its queues. */
+static void initializeUsb(usb::UsbDevice* device) {
+    memset(device, 0, sizeof(*device));
+    for(int i = 0; i < ENDPOINT_COUNT; i++) {
+        BYTE_QUEUE_INIT(&device->endpoints[i].queue, USB_QUEUES[i]);
+    }
+    usb::initializeCommon(device);
+}
+
+static void initializeBle(ble::BleDevice* device) {
+    memset(device, 0, sizeof(*device));
+    BYTE_QUEUE_INIT(&device->sendQueue, BLE_SEND_QUEUE);
+    BYTE_QUEUE_INIT(&device->receiveQueue, BLE_RECEIVE_QUEUE);
+    for(int i = 0; i < BLE_CHANNEL_COUNT; i++) {
+        BYTE_QUEUE_INIT(&device->channels[i].sendQueue, BLE_CHANNEL_QUEUES[i]);
+    }
+    ble::initializeCommon(device);
+}
+
+static void queueBytes(usb::UsbEndpoint* endpoint, int count) {
+    for(int i = 0; i < count; i++) {
+        BYTE_QUEUE_PUSH(&endpoint->queue, 0x42);
+    }
+}
+
+START_TEST (test_usb_full_packet_ready)
+{
+    usb::UsbDevice device;
+    initializeUsb(&device);
+    usb::UsbEndpoint* endpoint = &device.endpoints[0];
+
+    fail_if(usb::readyToSend(&device, endpoint));
+    queueBytes(endpoint, MAX_USB_PACKET_SIZE_BYTES);
+    fail_unless(usb::readyToSend(&device, endpoint));
+}
+END_TEST
+
+START_TEST (test_usb_partial_packet_sent_when_idle)
+{
+    usb::UsbDevice device;
+    initializeUsb(&device);
+    usb::UsbEndpoint* endpoint = &device.endpoints[0];
+
+    queueBytes(endpoint, 10);
+    fail_if(usb::readyToSend(&device, endpoint));
+    queueBytes(endpoint, 10);
+    fail_if(usb::readyToSend(&device, endpoint));
+    // nothing new arrived since the last check
+    fail_unless(usb::readyToSend(&device, endpoint));
+}
+END_TEST
+
+START_TEST (test_usb_partial_packet_sent_after_budget)
+{
+    usb::UsbDevice device;
+    initializeUsb(&device);
+    device.coalesceBudgetUs = 2000;
+    usb::UsbEndpoint* endpoint = &device.endpoints[0];
+
+    queueBytes(endpoint, 10);
+    fail_if(usb::readyToSend(&device, endpoint));
+    FAKE_TIME += 1;
+    queueBytes(endpoint, 10);
+    fail_if(usb::readyToSend(&device, endpoint));
+    FAKE_TIME += 1;
+    queueBytes(endpoint, 10);
+    fail_unless(usb::readyToSend(&device, endpoint));
+}
+END_TEST
+
+START_TEST (test_usb_coalescing_disabled)
+{
+    usb::UsbDevice device;
+    initializeUsb(&device);
+    device.coalesceBudgetUs = 0;
+    usb::UsbEndpoint* endpoint = &device.endpoints[0];
+
+    queueBytes(endpoint, 1);
+    fail_unless(usb::readyToSend(&device, endpoint));
+}
+END_TEST
+
+START_TEST (test_usb_log_endpoint_waits_for_data)
+{
+    usb::UsbDevice device;
+    initializeUsb(&device);
+    usb::UsbEndpoint* data = &device.endpoints[IN_ENDPOINT_INDEX];
+    usb::UsbEndpoint* log = &device.endpoints[LOG_ENDPOINT_INDEX];
+
+    queueBytes(log, MAX_USB_PACKET_SIZE_BYTES);
+    queueBytes(data, 1);
+    fail_if(usb::readyToSend(&device, log));
+
+    BYTE_QUEUE_RESET(&data->queue);
+    fail_unless(usb::readyToSend(&device, log));
+}
+END_TEST
+
+static void fillBleQueue(ble::BleDevice* device, int percent) {
+    BYTE_QUEUE_RESET(&device->sendQueue);
+    int count = BYTE_QUEUE_CAPACITY(&device->sendQueue) * percent / 100;
+    for(int i = 0; i < count; i++) {
+        BYTE_QUEUE_PUSH(&device->sendQueue, 0);
+    }
+}
+
+START_TEST (test_ble_auto_connection_speeds_up_when_busy)
+{
+    ble::BleDevice device;
+    initializeBle(&device);
+
+    fail_if(ble::updateConnectionProfile(&device));
+    fail_if(device.fastConnection);
+
+    fillBleQueue(&device, DEFAULT_BLE_FAST_CONNECTION_FILL_PERCENT);
+    fail_unless(ble::updateConnectionProfile(&device));
+    fail_unless(device.fastConnection);
+    fail_if(ble::updateConnectionProfile(&device));
+}
+END_TEST
+
+START_TEST (test_ble_auto_connection_slows_down_when_quiet)
+{
+    ble::BleDevice device;
+    initializeBle(&device);
+    fillBleQueue(&device, DEFAULT_BLE_FAST_CONNECTION_FILL_PERCENT);
+    fail_unless(ble::updateConnectionProfile(&device));
+
+    fillBleQueue(&device, 0);
+    FAKE_TIME += DEFAULT_BLE_SLOW_CONNECTION_HOLD_MS - 1;
+    fail_if(ble::updateConnectionProfile(&device));
+    fail_unless(device.fastConnection);
+
+    FAKE_TIME += 1;
+    fail_unless(ble::updateConnectionProfile(&device));
+    fail_if(device.fastConnection);
+}
+END_TEST
+
+START_TEST (test_ble_fixed_connection_modes)
+{
+    ble::BleDevice device;
+    initializeBle(&device);
+
+    ble::setConnectionMode(&device, ble::BleConnectionMode::THROUGHPUT);
+    fail_unless(ble::updateConnectionProfile(&device));
+    fail_unless(device.fastConnection);
+
+    ble::setConnectionMode(&device, ble::BleConnectionMode::LOW_POWER);
+    fillBleQueue(&device, 100);
+    fail_unless(ble::updateConnectionProfile(&device));
+    fail_if(device.fastConnection);
+}
+END_TEST
+
+START_TEST (test_ble_channel_queues)
+{
+    ble::BleDevice device;
+    initializeBle(&device);
+    ByteQueue* mainQueue = &device.sendQueue;
+
+    ble::setNotifying(&device, -1, true);
+    ck_assert_int_eq(device.status, ble::BleStatus::NOTIFICATION_ENABLED);
+    fail_unless(ble::channelSendQueue(&device,
+                ble::BleChannel::COMMAND_RESPONSE_CHANNEL) == mainQueue);
+
+    ble::setNotifying(&device, ble::BleChannel::COMMAND_RESPONSE_CHANNEL,
+            true);
+    fail_unless(ble::channelSendQueue(&device,
+                ble::BleChannel::COMMAND_RESPONSE_CHANNEL) ==
+            &device.channels[ble::BleChannel::COMMAND_RESPONSE_CHANNEL].sendQueue);
+    fail_unless(ble::channelSendQueue(&device,
+                ble::BleChannel::CAN_CHANNEL) == mainQueue);
+
+    // still notifying on a class characteristic
+    ble::setNotifying(&device, -1, false);
+    ck_assert_int_eq(device.status, ble::BleStatus::NOTIFICATION_ENABLED);
+    ble::setNotifying(&device, ble::BleChannel::COMMAND_RESPONSE_CHANNEL,
+            false);
+    ck_assert_int_eq(device.status, ble::BleStatus::CONNECTED);
+}
+END_TEST
+
 Suite* buffersSuite(void) {
     Suite* s = suite_create("interface");
     TCase *tc_core = tcase_create("core");
@@ -47,6 +421,25 @@ Suite* buffersSuite(void) {
     tcase_add_test(tc_core, test_uart_descriptor_string);
     tcase_add_test(tc_core, test_network_descriptor_string);
     tcase_add_test(tc_core, test_unknown_descriptor_string);
+    tcase_add_test(tc_core, test_encode_can_record);
+    tcase_add_test(tc_core, test_encode_extended_can_record);
+    tcase_add_test(tc_core, test_decode_can_record);
+    tcase_add_test(tc_core, test_log_can_message);
+    tcase_add_test(tc_core, test_seal_journal_block);
+    tcase_add_test(tc_core, test_open_journal_block);
+    tcase_add_test(tc_core, test_open_damaged_journal_block);
+    tcase_add_test(tc_core, test_encode_index_record);
+    tcase_add_test(tc_core, test_index_file_name);
+    tcase_add_test(tc_core, test_format_trip_catalog_line);
+    tcase_add_test(tc_core, test_usb_full_packet_ready);
+    tcase_add_test(tc_core, test_usb_partial_packet_sent_when_idle);
+    tcase_add_test(tc_core, test_usb_partial_packet_sent_after_budget);
+    tcase_add_test(tc_core, test_usb_coalescing_disabled);
+    tcase_add_test(tc_core, test_usb_log_endpoint_waits_for_data);
+    tcase_add_test(tc_core, test_ble_auto_connection_speeds_up_when_busy);
+    tcase_add_test(tc_core, test_ble_auto_connection_slows_down_when_quiet);
+    tcase_add_test(tc_core, test_ble_fixed_connection_modes);
+    tcase_add_test(tc_core, test_ble_channel_queues);
     suite_add_tcase(s, tc_core);
     return s;
 }
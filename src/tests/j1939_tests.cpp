@@ -0,0 +1,214 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "can/j1939.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "config.h"
+
+namespace usb = openxc::interface::usb;
+namespace can = openxc::can;
+namespace j1939 = openxc::can::j1939;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+CanBus* bus;
+
+// A BAM of an 11 byte DM1 (PGN 0xfeca) from address 0x00
+const uint8_t DM1_BAM[] = {32, 11, 0, 2, 0xff, 0xca, 0xfe, 0};
+const uint8_t DM1_PACKET_1[] = {1, 0x03, 0x00, 0xff, 0xff, 0x04, 0x00, 0xf0};
+const uint8_t DM1_PACKET_2[] = {2, 0x00, 0x01, 0x08, 0x00, 0xff, 0xff, 0xff};
+
+// A 9 byte DM3 (PGN 0xfecc) sent from address 0x00 to 0x17 in a connection
+const uint8_t DM3_RTS[] = {16, 9, 0, 2, 0xff, 0xcc, 0xfe, 0};
+const uint8_t DM3_CTS[] = {17, 2, 1, 0xff, 0xff, 0xcc, 0xfe, 0};
+const uint8_t DM3_ABORT[] = {255, 1, 0xff, 0xff, 0xff, 0xcc, 0xfe, 0};
+const uint8_t DM3_PACKET_1[] = {1, 1, 2, 3, 4, 5, 6, 7};
+const uint8_t DM3_PACKET_2[] = {2, 8, 9, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static void receive(uint32_t id, const uint8_t data[]) {
+    CanMessage message = {
+        id: id,
+        format: CanMessageFormat::EXTENDED,
+        data: {0},
+        length: 8
+    };
+    memcpy(message.data, data, CAN_MESSAGE_SIZE);
+    j1939::receive(bus, &message, &getConfiguration()->pipeline);
+}
+
+/* Private: Return the output queue as a string, with the delimiters between
+ * messages replaced by spaces.
+ */
+static void readOutput(char* output, size_t size) {
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, (uint8_t*) output, size);
+    size_t length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+    if(length > size - 1) {
+        length = size - 1;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(output[i] == '\0') {
+            output[i] = ' ';
+        }
+    }
+    output[length] = '\0';
+}
+
+static bool published() {
+    return !BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    initializeVehicleInterface();
+    getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+    j1939::reset();
+}
+
+void teardown() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_id_fields)
+{
+    ck_assert_int_eq(j1939::pgn(0x18feca00), 0xfeca);
+    ck_assert_int_eq(j1939::priority(0x18feca00), 6);
+    ck_assert_int_eq(j1939::sourceAddress(0x18feca00), 0x00);
+    ck_assert_int_eq(j1939::destinationAddress(0x18feca00),
+            J1939_GLOBAL_ADDRESS);
+
+    // PDU1 - the PDU specific byte is the destination, not part of the PGN
+    ck_assert_int_eq(j1939::pgn(0x18ea0017), 0xea00);
+    ck_assert_int_eq(j1939::sourceAddress(0x18ea0017), 0x17);
+    ck_assert_int_eq(j1939::destinationAddress(0x18ea0017), 0x00);
+
+    ck_assert_int_eq(j1939::messageKey(0x0cfef117),
+            j1939::messageKey(0x18fef100));
+}
+END_TEST
+
+START_TEST (test_bam_reassembled)
+{
+    receive(0x1cecff00, DM1_BAM);
+    receive(0x1cebff00, DM1_PACKET_1);
+    ck_assert(!published());
+    receive(0x1cebff00, DM1_PACKET_2);
+
+    char output[256];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "{\"name\":\"j1939\",\"value\":\"1:0xfeca:0x00\","
+            "\"event\":\"0300ffff0400f000010800\"}") != NULL);
+}
+END_TEST
+
+START_TEST (test_bam_missed_packet)
+{
+    receive(0x1cecff00, DM1_BAM);
+    receive(0x1cebff00, DM1_PACKET_2);
+    receive(0x1cebff00, DM1_PACKET_1);
+    receive(0x1cebff00, DM1_PACKET_2);
+    ck_assert(!published());
+}
+END_TEST
+
+START_TEST (test_connection_reassembled)
+{
+    receive(0x1cec1700, DM3_RTS);
+    receive(0x1cec0017, DM3_CTS);
+    receive(0x1ceb1700, DM3_PACKET_1);
+    // Sent again after a CTS from the receiver
+    receive(0x1ceb1700, DM3_PACKET_1);
+    receive(0x1ceb1700, DM3_PACKET_2);
+
+    char output[256];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "\"value\":\"1:0xfecc:0x00\","
+            "\"event\":\"010203040506070809\"") != NULL);
+}
+END_TEST
+
+START_TEST (test_connection_aborted)
+{
+    receive(0x1cec1700, DM3_RTS);
+    receive(0x1ceb1700, DM3_PACKET_1);
+    // By the receiver
+    receive(0x1cec0017, DM3_ABORT);
+    receive(0x1ceb1700, DM3_PACKET_2);
+    ck_assert(!published());
+}
+END_TEST
+
+START_TEST (test_timed_out)
+{
+    receive(0x1cecff00, DM1_BAM);
+    receive(0x1cebff00, DM1_PACKET_1);
+    FAKE_TIME += J1939_TP_TIMEOUT_MS + 1;
+    receive(0x1cebff00, DM1_PACKET_2);
+    ck_assert(!published());
+}
+END_TEST
+
+START_TEST (test_oversize_dropped)
+{
+    const uint8_t bam[] = {32, J1939_TP_BUFFER_SIZE + 1, 0,
+            (J1939_TP_BUFFER_SIZE + 7) / 7, 0xff, 0xca, 0xfe, 0};
+    receive(0x1cecff00, bam);
+    ck_assert_int_eq(j1939::droppedTransferCount(), 1);
+}
+END_TEST
+
+START_TEST (test_sessions_full)
+{
+    for(int source = 0; source < J1939_TP_SESSION_COUNT; source++) {
+        receive(0x1cecff00 | source, DM1_BAM);
+    }
+    ck_assert_int_eq(j1939::droppedTransferCount(), 0);
+    receive(0x1cecff00 | J1939_TP_SESSION_COUNT, DM1_BAM);
+    ck_assert_int_eq(j1939::droppedTransferCount(), 1);
+}
+END_TEST
+
+Suite* j1939Suite(void) {
+    Suite* s = suite_create("j1939");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_id_fields);
+    tcase_add_test(tc_core, test_bam_reassembled);
+    tcase_add_test(tc_core, test_bam_missed_packet);
+    tcase_add_test(tc_core, test_connection_reassembled);
+    tcase_add_test(tc_core, test_connection_aborted);
+    tcase_add_test(tc_core, test_timed_out);
+    tcase_add_test(tc_core, test_oversize_dropped);
+    tcase_add_test(tc_core, test_sessions_full);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = j1939Suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -1,9 +1,11 @@
 #include <check.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 #include "commands/commands.h"
 #include "payload/json.h"
+#include "payload/payload.h"
 
 namespace json = openxc::payload::json;
 
@@ -173,6 +175,220 @@ START_TEST (test_deserialize_message_after_junk)
 }
 END_TEST
 
+START_TEST (test_deserialize_simple_escaped_string)
+{
+    uint8_t rawRequest[] = "{\"Name\": \"turn_signal_status\", \"value\": \"le\\\"ft\\u0021\"}\0";
+    openxc_VehicleMessage deserialized = {0};
+    json::deserialize(rawRequest, sizeof(rawRequest), &deserialized);
+    ck_assert_int_eq(openxc_VehicleMessage_Type_SIMPLE, deserialized.type);
+    ck_assert(deserialized.simple_message.has_name);
+    ck_assert_str_eq("turn_signal_status", deserialized.simple_message.name);
+    ck_assert(deserialized.simple_message.has_value);
+    ck_assert_int_eq(openxc_DynamicField_Type_STRING,
+            deserialized.simple_message.value.type);
+    ck_assert_str_eq("le\"ft!",
+            deserialized.simple_message.value.string_value);
+}
+END_TEST
+
+START_TEST (test_deserialize_too_many_tokens)
+{
+    std::string request = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\", \"extra\": [";
+    for(int i = 0; i < JSON_MAX_TOKENS; i++) {
+        request += i == 0 ? "1" : ", 1";
+    }
+    request += "]}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(0, json::deserialize((uint8_t*)request.c_str(),
+                request.length() + 1, &deserialized));
+    ck_assert(!deserialized.has_type);
+}
+END_TEST
+
+START_TEST (test_deserialize_incomplete)
+{
+    uint8_t rawRequest[] = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"\0";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(0, json::deserialize(rawRequest, sizeof(rawRequest),
+                &deserialized));
+}
+END_TEST
+
+static void checkSimpleMatches(const char* name, openxc_DynamicField* value,
+        openxc_DynamicField* event, uint64_t* timestamp) {
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, name);
+    if(value != NULL) {
+        message.simple_message.has_value = true;
+        message.simple_message.value = *value;
+    }
+    if(event != NULL) {
+        message.simple_message.has_event = true;
+        message.simple_message.event = *event;
+    }
+    if(timestamp != NULL) {
+        message.has_timestamp = true;
+        message.timestamp = *timestamp;
+    }
+
+    uint8_t expected[256] = {0};
+    int expectedLength = json::serialize(&message, expected, sizeof(expected));
+    uint8_t payload[256] = {0};
+    int length = json::serializeSimple(name, value, event, timestamp, payload,
+            sizeof(payload));
+    ck_assert_int_eq(length, expectedLength);
+    ck_assert_str_eq((char*)payload, (char*)expected);
+
+    // copying a name that doesn't need escaping gives the same bytes
+    size_t nameLength = json::plainStringLength(name);
+    ck_assert_int_eq(nameLength, strlen(name));
+    memset(payload, 0, sizeof(payload));
+    length = json::serializeSimple(name, nameLength, value, event, timestamp,
+            payload, sizeof(payload));
+    ck_assert_int_eq(length, expectedLength);
+    ck_assert_str_eq((char*)payload, (char*)expected);
+}
+
+START_TEST (test_serialize_simple_matches_message)
+{
+    openxc_DynamicField number = openxc::payload::wrapNumber(-19990);
+    checkSimpleMatches("torque_at_transmission", &number, NULL, NULL);
+    number = openxc::payload::wrapNumber(42.5);
+    checkSimpleMatches("test", &number, NULL, NULL);
+    number = openxc::payload::wrapNumber(0.0000001);
+    checkSimpleMatches("tiny", &number, NULL, NULL);
+    number = openxc::payload::wrapNumber(1e10);
+    checkSimpleMatches("huge", &number, NULL, NULL);
+
+    openxc_DynamicField string = openxc::payload::wrapString("a \"quoted\"\n\\");
+    openxc_DynamicField boolean = openxc::payload::wrapBoolean(false);
+    checkSimpleMatches("evented", &string, &boolean, NULL);
+    checkSimpleMatches("no_value", NULL, NULL, NULL);
+
+    uint64_t timestamp = 1332794184319LL;
+    checkSimpleMatches("stamped", &boolean, NULL, &timestamp);
+}
+END_TEST
+
+static void checkSerializedNumber(float value, const char* expected) {
+    openxc_DynamicField number = openxc::payload::wrapNumber(value);
+    uint8_t payload[64] = {0};
+    ck_assert(json::serializeSimple("n", &number, NULL, NULL, payload,
+                sizeof(payload)) > 0);
+    ck_assert_str_eq((char*)payload, expected);
+}
+
+START_TEST (test_serialize_shortest_float)
+{
+    checkSerializedNumber(0.1f, "{\"name\":\"n\",\"value\":0.1}");
+    checkSerializedNumber(-3.14159f, "{\"name\":\"n\",\"value\":-3.14159}");
+    checkSerializedNumber(1.0f / 3, "{\"name\":\"n\",\"value\":0.33333334}");
+    checkSerializedNumber(123456.75f, "{\"name\":\"n\",\"value\":123456.75}");
+    checkSerializedNumber(0.000015f, "{\"name\":\"n\",\"value\":0.000015}");
+    checkSerializedNumber(-7, "{\"name\":\"n\",\"value\":-7}");
+}
+END_TEST
+
+START_TEST (test_serialize_simple_too_long)
+{
+    openxc_DynamicField number = openxc::payload::wrapNumber(1);
+    uint8_t payload[16];
+    ck_assert_int_eq(json::serializeSimple("a_long_signal_name", &number, NULL,
+                NULL, payload, sizeof(payload)), 0);
+}
+END_TEST
+
+START_TEST (test_plain_string_length)
+{
+    ck_assert_int_eq(json::plainStringLength("vehicle_speed"), 13);
+    ck_assert_int_eq(json::plainStringLength("a \"quoted\" name"), 0);
+    ck_assert_int_eq(json::plainStringLength("back\\slash"), 0);
+    ck_assert_int_eq(json::plainStringLength("new\nline"), 0);
+    ck_assert_int_eq(json::plainStringLength(""), 0);
+}
+END_TEST
+
+START_TEST (test_serialize_simple_known_name_too_long)
+{
+    openxc_DynamicField number = openxc::payload::wrapNumber(1);
+    uint8_t payload[16];
+    ck_assert_int_eq(json::serializeSimple("a_long_signal_name", 18, &number,
+                NULL, NULL, payload, sizeof(payload)), 0);
+}
+END_TEST
+
+START_TEST (test_serialize_can)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 42;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 2;
+    message.can_message.data.bytes[0] = 0x12;
+    message.can_message.data.bytes[1] = 0xab;
+    message.can_message.has_frame_format = true;
+    message.can_message.frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
+
+    uint8_t payload[256] = {0};
+    const char expected[] = "{\"bus\":1,\"id\":42,\"data\":\"0x12ab\","
+            "\"frame_format\":\"extended\"}";
+    ck_assert_int_eq(json::serialize(&message, payload, sizeof(payload)),
+            sizeof(expected));
+    ck_assert_str_eq((char*)payload, expected);
+}
+END_TEST
+
+START_TEST (test_serialize_diagnostic)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_DIAGNOSTIC;
+    message.has_diagnostic_response = true;
+    message.diagnostic_response.bus = 1;
+    message.diagnostic_response.message_id = 0x7e8;
+    message.diagnostic_response.mode = 1;
+    message.diagnostic_response.success = false;
+    message.diagnostic_response.has_pid = true;
+    message.diagnostic_response.pid = 12;
+    message.diagnostic_response.has_negative_response_code = true;
+    message.diagnostic_response.negative_response_code = 0x31;
+    message.diagnostic_response.has_payload = true;
+    message.diagnostic_response.payload.size = 1;
+    message.diagnostic_response.payload.bytes[0] = 0x7f;
+
+    uint8_t payload[256] = {0};
+    ck_assert(json::serialize(&message, payload, sizeof(payload)) > 0);
+    ck_assert_str_eq((char*)payload, "{\"bus\":1,\"id\":2024,\"mode\":1,"
+            "\"success\":false,\"pid\":12,\"negative_response_code\":49,"
+            "\"payload\":\"0x7f\"}");
+}
+END_TEST
+
+START_TEST (test_serialize_too_long)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_COMMAND_RESPONSE;
+    message.has_command_response = true;
+    message.command_response.has_type = true;
+    message.command_response.type = openxc_ControlCommand_Type_VERSION;
+    message.command_response.has_message = true;
+    strcpy(message.command_response.message, "7.2.1");
+
+    uint8_t payload[16];
+    ck_assert_int_eq(json::serialize(&message, payload, sizeof(payload)), 0);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("json_payload");
     TCase *tc_json_payload = tcase_create("json_payload");
@@ -188,6 +404,17 @@ Suite* suite(void) {
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write);
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write_with_format);
     tcase_add_test(tc_json_payload, test_deserialize_message_after_junk);
+    tcase_add_test(tc_json_payload, test_deserialize_simple_escaped_string);
+    tcase_add_test(tc_json_payload, test_deserialize_too_many_tokens);
+    tcase_add_test(tc_json_payload, test_deserialize_incomplete);
+    tcase_add_test(tc_json_payload, test_serialize_simple_matches_message);
+    tcase_add_test(tc_json_payload, test_serialize_simple_too_long);
+    tcase_add_test(tc_json_payload, test_serialize_shortest_float);
+    tcase_add_test(tc_json_payload, test_plain_string_length);
+    tcase_add_test(tc_json_payload, test_serialize_simple_known_name_too_long);
+    tcase_add_test(tc_json_payload, test_serialize_can);
+    tcase_add_test(tc_json_payload, test_serialize_diagnostic);
+    tcase_add_test(tc_json_payload, test_serialize_too_long);
     suite_add_tcase(s, tc_json_payload);
 
     return s;
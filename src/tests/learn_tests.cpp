@@ -0,0 +1,197 @@
+#include <check.h>
+#include <stdint.h>
+#include "can/learn.h"
+#include "signals.h"
+
+namespace can = openxc::can;
+namespace learn = openxc::can::learn;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getMessages;
+using openxc::signals::getMessageCount;
+
+extern unsigned long FAKE_TIME;
+
+CanBus* bus;
+
+static void receive(uint32_t id) {
+    CanMessage message = {id: id, format: CanMessageFormat::STANDARD};
+    learn::record(bus, &message, getMessages(), getMessageCount(),
+            getCanBuses(), getCanBusCount());
+}
+
+static bool start() {
+    return learn::start(bus, CAN_FILTER_LEARN_WINDOW_MS, getMessages(),
+            getMessageCount(), getCanBuses(), getCanBusCount());
+}
+
+/* Private: Run the main loop's update at the end of the learning window. */
+static void finish() {
+    FAKE_TIME += CAN_FILTER_LEARN_WINDOW_MS;
+    learn::update(bus, getMessages(), getMessageCount(), getCanBuses(),
+            getCanBusCount());
+}
+
+static void forget() {
+    learn::forget(bus, getMessages(), getMessageCount(), getCanBuses(),
+            getCanBusCount());
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    for(int i = 0; i < getMessageCount(); i++) {
+        getMessages()[i].filterSuspended = false;
+        getMessages()[i].filterUnlearned = false;
+    }
+    bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    bus->passthroughCanMessages = false;
+    can::configureDefaultFilters(bus, getMessages(), getMessageCount(),
+            getCanBuses(), getCanBusCount());
+}
+
+void teardown() {
+    forget();
+    can::clearPassthroughFilters(bus);
+    bus->passthroughCanMessages = false;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_bypassed_while_learning)
+{
+    ck_assert(start());
+    ck_assert(bus->bypassFilters);
+    ck_assert(can::shouldAcceptMessage(bus, 0x300));
+
+    FAKE_TIME += CAN_FILTER_LEARN_WINDOW_MS - 1;
+    learn::update(bus, getMessages(), getMessageCount(), getCanBuses(),
+            getCanBusCount());
+    ck_assert(bus->learningFilters);
+    ck_assert(bus->bypassFilters);
+}
+END_TEST
+
+START_TEST (test_unheard_ids_filtered)
+{
+    start();
+    receive(1);
+    receive(2);
+    receive(0x300);
+    finish();
+
+    ck_assert(!bus->learningFilters);
+    ck_assert(!bus->bypassFilters);
+    ck_assert(can::shouldAcceptMessage(bus, 1));
+    ck_assert(can::shouldAcceptMessage(bus, 2));
+    ck_assert(!can::shouldAcceptMessage(bus, 3));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x300));
+}
+END_TEST
+
+START_TEST (test_forget_restores_filters)
+{
+    bus->bypassFilters = true;
+    start();
+    receive(1);
+    finish();
+    ck_assert(!bus->bypassFilters);
+    ck_assert(!can::shouldAcceptMessage(bus, 3));
+
+    forget();
+    ck_assert(bus->bypassFilters);
+    bus->bypassFilters = false;
+    ck_assert(can::shouldAcceptMessage(bus, 3));
+}
+END_TEST
+
+START_TEST (test_selected_passthrough_ids_added)
+{
+    bus->passthroughCanMessages = true;
+    ck_assert(can::addPassthroughFilter(bus, 0x100, 0x700,
+                CanMessageFormat::STANDARD, 0, getMessages(),
+                getMessageCount(), getCanBuses(), getCanBusCount()));
+    start();
+    receive(0x123);
+    receive(0x234);
+    finish();
+    ck_assert(can::shouldAcceptMessage(bus, 0x123));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x234));
+
+    forget();
+    ck_assert(!can::shouldAcceptMessage(bus, 0x123));
+    ck_assert(can::shouldAcceptMessage(bus, 1));
+}
+END_TEST
+
+START_TEST (test_relearn_forgets_previous)
+{
+    bus->passthroughCanMessages = true;
+    start();
+    receive(0x123);
+    finish();
+    ck_assert(can::shouldAcceptMessage(bus, 0x123));
+
+    start();
+    receive(0x124);
+    finish();
+    ck_assert(can::shouldAcceptMessage(bus, 0x124));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x123));
+}
+END_TEST
+
+START_TEST (test_too_many_ids)
+{
+    bus->passthroughCanMessages = true;
+    start();
+    for(int i = 0; i <= CAN_FILTER_LEARN_ID_COUNT; i++) {
+        receive(0x400 + i);
+    }
+    ck_assert(!bus->learningFilters);
+    ck_assert(!bus->bypassFilters);
+    ck_assert(can::shouldAcceptMessage(bus, 3));
+    ck_assert(!can::shouldAcceptMessage(bus, 0x400));
+}
+END_TEST
+
+START_TEST (test_not_while_surveying)
+{
+    bus->surveying = true;
+    ck_assert(!start());
+    ck_assert(!bus->learningFilters);
+    bus->surveying = false;
+}
+END_TEST
+
+Suite* learnSuite(void) {
+    Suite* s = suite_create("learn");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_bypassed_while_learning);
+    tcase_add_test(tc_core, test_unheard_ids_filtered);
+    tcase_add_test(tc_core, test_forget_restores_filters);
+    tcase_add_test(tc_core, test_selected_passthrough_ids_added);
+    tcase_add_test(tc_core, test_relearn_forgets_previous);
+    tcase_add_test(tc_core, test_too_many_ids);
+    tcase_add_test(tc_core, test_not_while_surveying);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = learnSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/memory.h"
+
+namespace memory = openxc::util::memory;
+
+static uint8_t* bottom;
+static uint8_t* top;
+
+void setup() {
+    memory::stackRegion(&bottom, &top);
+    memory::paintStack();
+}
+
+START_TEST (test_unused_stack)
+{
+    ck_assert_int_eq(memory::stackHighWater(), 0);
+    ck_assert_int_eq(memory::stackSize(), top - bottom);
+}
+END_TEST
+
+START_TEST (test_stack_high_water)
+{
+    memset(top - 40, 0, 40);
+    ck_assert_int_eq(memory::stackHighWater(), 40);
+
+    // a frame that only wrote part of a buffer still counts from its end
+    top[-100] = 0;
+    ck_assert_int_eq(memory::stackHighWater(), 100);
+
+    // and the mark stays once the stack has shrunk back
+    memset(top - 40, 0xa5, 40);
+    ck_assert_int_eq(memory::stackHighWater(), 100);
+}
+END_TEST
+
+START_TEST (test_whole_stack_used)
+{
+    bottom[0] = 0;
+    ck_assert_int_eq(memory::stackHighWater(), top - bottom);
+}
+END_TEST
+
+Suite* memorySuite(void) {
+    Suite* s = suite_create("memory");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_unused_stack);
+    tcase_add_test(tc_core, test_stack_high_water);
+    tcase_add_test(tc_core, test_whole_stack_used);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = memorySuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
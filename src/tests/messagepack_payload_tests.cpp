@@ -4,6 +4,7 @@
 
 #include "commands/commands.h"
 #include "payload/messagepack.h"
+#include "payload/payload.h"
 
 namespace messagepack = openxc::payload::messagepack;
 
@@ -192,6 +193,100 @@ START_TEST (test_deserialize_message_after_junk)
 END_TEST
 
 
+START_TEST (test_deserialize_command_after_fields)
+{
+    //{"bus": 1,"enabled": true,"command":"passthrough"}
+    uint8_t rawRequest[35] = {
+    0x83, 0xA3, 0x62, 0x75, 0x73, 0x01, 0xA7, 0x65,
+    0x6E, 0x61, 0x62, 0x6C, 0x65, 0x64, 0xC3, 0xA7,
+    0x63, 0x6F, 0x6D, 0x6D, 0x61, 0x6E, 0x64, 0xAB,
+    0x70, 0x61, 0x73, 0x73, 0x74, 0x68, 0x72, 0x6F,
+    0x75, 0x67, 0x68
+    };
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(35, messagepack::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+    ck_assert(validate(&deserialized));
+    ck_assert_int_eq(openxc_ControlCommand_Type_PASSTHROUGH,
+            deserialized.control_command.type);
+    ck_assert_int_eq(1, deserialized.control_command.passthrough_mode_request.bus);
+    ck_assert(deserialized.control_command.passthrough_mode_request.enabled);
+}
+END_TEST
+
+START_TEST (test_deserialize_diagnostic_skips_unknown)
+{
+    //{"command":"diagnostic_request","extra":{"a":[1,2]},
+    //      "request":{"bus":1,"id":2,"mode":1}}
+    uint8_t rawRequest[64] = {
+    0x83, 0xA7, 0x63, 0x6F, 0x6D, 0x6D, 0x61, 0x6E,
+    0x64, 0xB2, 0x64, 0x69, 0x61, 0x67, 0x6E, 0x6F,
+    0x73, 0x74, 0x69, 0x63, 0x5F, 0x72, 0x65, 0x71,
+    0x75, 0x65, 0x73, 0x74, 0xA5, 0x65, 0x78, 0x74,
+    0x72, 0x61, 0x81, 0xA1, 0x61, 0x92, 0x01, 0x02,
+    0xA7, 0x72, 0x65, 0x71, 0x75, 0x65, 0x73, 0x74,
+    0x83, 0xA3, 0x62, 0x75, 0x73, 0x01, 0xA2, 0x69,
+    0x64, 0x02, 0xA4, 0x6D, 0x6F, 0x64, 0x65, 0x01
+    };
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(64, messagepack::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+    ck_assert_int_eq(openxc_ControlCommand_Type_DIAGNOSTIC,
+            deserialized.control_command.type);
+    openxc_DiagnosticRequest* request =
+            &deserialized.control_command.diagnostic_request.request;
+    ck_assert_int_eq(1, request->bus);
+    ck_assert_int_eq(2, request->message_id);
+    ck_assert_int_eq(1, request->mode);
+}
+END_TEST
+
+START_TEST (test_deserialize_incomplete)
+{
+    //{"bus": 1,"id": 42,"data":"0x12 - the last byte of data is missing
+    uint8_t rawRequest[20] = {
+    0x83, 0xA3, 0x62, 0x75, 0x73, 0xCC, 0x01, 0xA2,
+    0x69, 0x64, 0xCC, 0x2A, 0xA4, 0x64, 0x61, 0x74,
+    0x61, 0xC4, 0x02, 0x12
+    };
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(0, messagepack::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+    ck_assert(!deserialized.has_type);
+}
+END_TEST
+
+START_TEST (test_serialize_compact)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "vehicle_speed");
+    message.simple_message.has_value = true;
+    message.simple_message.value = openxc::payload::wrapNumber(42);
+    message.has_timestamp = true;
+    message.timestamp = 1000;
+
+    uint8_t full[256] = {0};
+    uint8_t compact[256] = {0};
+    int fullLength = messagepack::serialize(&message, full, sizeof(full));
+    int compactLength = messagepack::serializeCompact(&message, compact,
+            sizeof(compact));
+    ck_assert(fullLength > 0);
+    ck_assert(compactLength > 0);
+    // "timestamp", "name" and "value" are each replaced by a 1 byte key
+    ck_assert_int_eq(fullLength - compactLength, 10 + 5 + 6 - 3);
+    ck_assert_int_eq(compact[1], messagepack::TIMESTAMP_KEY);
+
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(compactLength, messagepack::deserialize(compact,
+                compactLength, &deserialized));
+    ck_assert_int_eq(openxc_VehicleMessage_Type_SIMPLE, deserialized.type);
+    ck_assert_str_eq("vehicle_speed", deserialized.simple_message.name);
+    ck_assert(deserialized.simple_message.has_value);
+    ck_assert_int_eq(42, deserialized.simple_message.value.numeric_value);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("messagepack_payload");
     TCase *tc_msgpck_payload = tcase_create("messagepack_payload");
@@ -207,6 +302,10 @@ Suite* suite(void) {
     tcase_add_test(tc_msgpck_payload, test_deserialize_can_message_write);
     tcase_add_test(tc_msgpck_payload, test_deserialize_can_message_write_with_format);
     tcase_add_test(tc_msgpck_payload, test_deserialize_message_after_junk);
+    tcase_add_test(tc_msgpck_payload, test_deserialize_command_after_fields);
+    tcase_add_test(tc_msgpck_payload, test_deserialize_diagnostic_skips_unknown);
+    tcase_add_test(tc_msgpck_payload, test_deserialize_incomplete);
+    tcase_add_test(tc_msgpck_payload, test_serialize_compact);
     suite_add_tcase(s, tc_msgpck_payload);
     return s;
 }
@@ -1,5 +1,6 @@
 #include <check.h>
 #include <stdint.h>
+#include <string.h>
 #include "pipeline.h"
 #include "emqueue.h"
 #include "config.h"
@@ -10,16 +11,24 @@ namespace usb = openxc::interface::usb;
 
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
+using openxc::pipeline::setRoute;
+using openxc::pipeline::addRouteSignal;
+using openxc::pipeline::publishSimple;
+using openxc::interface::InterfaceType;
+using openxc::payload::PayloadFormat;
 using openxc::config::getConfiguration;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
-QUEUE_TYPE(uint8_t)* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue;
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+ByteQueue* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue;
 
 extern bool USB_PROCESSED;
 extern bool UART_PROCESSED;
 extern bool NETWORK_PROCESSED;
+extern unsigned long FAKE_TIME;
 
 void setup() {
+    // before the queues are reset, so no open batch is left half in one
+    openxc::pipeline::resetRoutes();
     getConfiguration()->pipeline.usb = &getConfiguration()->usb;
     getConfiguration()->pipeline.uart = NULL;
     getConfiguration()->pipeline.network = NULL;
@@ -27,6 +36,11 @@ void setup() {
     uart::initialize(&getConfiguration()->uart);
     network::initialize(&getConfiguration()->network);
     getConfiguration()->usb.configured = true;
+    openxc::pipeline::resetRateLimit();
+    openxc::pipeline::setNameDictionary(false);
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    // start a new pass, so nothing is backed up from an earlier test
+    process(&getConfiguration()->pipeline);
     USB_PROCESSED = false;
     UART_PROCESSED = false;
     NETWORK_PROCESSED = false;
@@ -37,10 +51,10 @@ START_TEST (test_log_to_usb)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::LOG);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, LOG_QUEUE)];
-    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
-    ck_assert(!QUEUE_EMPTY(uint8_t, &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue));
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(LOG_QUEUE)];
+    ck_assert(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+    ck_assert(!BYTE_QUEUE_EMPTY(&getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue));
+    BYTE_QUEUE_SNAPSHOT(&getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -50,8 +64,8 @@ START_TEST (test_only_usb)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE)];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -59,10 +73,10 @@ END_TEST
 START_TEST (test_full_network)
 {
     getConfiguration()->pipeline.network = &getConfiguration()->network;
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &getConfiguration()->pipeline.network->sendQueue, (uint8_t) 128);
+    for(int i = 0; i < NETWORK_SEND_QUEUE_SIZE + 1; i++) {
+        BYTE_QUEUE_PUSH(&getConfiguration()->pipeline.network->sendQueue, (uint8_t) 128);
     }
-    fail_unless(QUEUE_FULL(uint8_t, &getConfiguration()->pipeline.network->sendQueue));
+    fail_unless(BYTE_QUEUE_FULL(&getConfiguration()->pipeline.network->sendQueue));
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
@@ -72,10 +86,10 @@ END_TEST
 START_TEST (test_full_uart)
 {
     getConfiguration()->pipeline.uart = &getConfiguration()->uart;
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, (uint8_t) 128);
+    for(int i = 0; i < UART_SEND_QUEUE_SIZE + 1; i++) {
+        BYTE_QUEUE_PUSH(&getConfiguration()->pipeline.uart->sendQueue, (uint8_t) 128);
     }
-    fail_unless(QUEUE_FULL(uint8_t, &getConfiguration()->pipeline.uart->sendQueue));
+    fail_unless(BYTE_QUEUE_FULL(&getConfiguration()->pipeline.uart->sendQueue));
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
@@ -84,27 +98,38 @@ END_TEST
 
 START_TEST (test_full_usb)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, OUTPUT_QUEUE, (uint8_t) 128);
+    for(int i = 0; i < USB_SEND_QUEUE_SIZE + 1; i++) {
+        BYTE_QUEUE_PUSH(OUTPUT_QUEUE, (uint8_t) 128);
     }
-    fail_unless(QUEUE_FULL(uint8_t, OUTPUT_QUEUE));
+    fail_unless(BYTE_QUEUE_FULL(OUTPUT_QUEUE));
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 }
 END_TEST
 
+START_TEST (test_oversized_message_not_flushed)
+{
+    uint8_t message[USB_SEND_QUEUE_SIZE];
+    memset(message, 'a', sizeof(message));
+    sendMessage(&getConfiguration()->pipeline, message, sizeof(message),
+            MessageClass::SIMPLE);
+    fail_if(USB_PROCESSED);
+    fail_unless(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+}
+END_TEST
+
 START_TEST (test_with_uart)
 {
     getConfiguration()->pipeline.uart = &getConfiguration()->uart;
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE)];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(&getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -116,18 +141,330 @@ START_TEST (test_with_uart_and_network)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE)];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(&getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.network->sendQueue, snapshot, sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(&getConfiguration()->pipeline.network->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
 
+START_TEST (test_route_blocks_class)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    setRoute(InterfaceType::UART,
+            ALL_MESSAGE_CLASSES & ~MESSAGE_CLASS_FLAG(MessageClass::SIMPLE));
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    fail_if(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+    fail_unless(BYTE_QUEUE_EMPTY(&getConfiguration()->pipeline.uart->sendQueue));
+
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::CAN);
+    fail_if(BYTE_QUEUE_EMPTY(&getConfiguration()->pipeline.uart->sendQueue));
+}
+END_TEST
+
+START_TEST (test_route_signal_filter)
+{
+    setRoute(InterfaceType::USB, MESSAGE_CLASS_FLAG(MessageClass::SIMPLE));
+    addRouteSignal(InterfaceType::USB, "vehicle_speed");
+
+    openxc_DynamicField value = {0};
+    value.has_type = true;
+    value.type = openxc_DynamicField_Type_NUM;
+    value.has_numeric_value = true;
+    value.numeric_value = 42;
+    publishSimple("engine_speed", &value, NULL, &getConfiguration()->pipeline);
+    fail_unless(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+    fail_if(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_route_signal_frequency)
+{
+    FAKE_TIME = 1000;
+    setRoute(InterfaceType::USB, MESSAGE_CLASS_FLAG(MessageClass::SIMPLE));
+    addRouteSignal(InterfaceType::USB, "vehicle_speed");
+    addRouteSignal(InterfaceType::USB, "engine_speed");
+    openxc::pipeline::setRouteFrequency(InterfaceType::USB, 2);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+    int length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+    fail_unless(length > 0);
+
+    // each signal has its own clock
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(OUTPUT_QUEUE), length);
+    publishSimple("engine_speed", &value, NULL, &getConfiguration()->pipeline);
+    fail_unless(BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) > length);
+    length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+
+    FAKE_TIME += 500;
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+    fail_unless(BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) > length);
+}
+END_TEST
+START_TEST (test_uart_binary_checked_frames)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    openxc::pipeline::setPayloadFormat(InterfaceType::UART,
+            PayloadFormat::PROTOBUF);
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    // only UART is framed
+    uint8_t snapshot[8 + CHECKED_FRAME_OVERHEAD];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "message");
+
+    ByteQueue* sendQueue = &getConfiguration()->pipeline.uart->sendQueue;
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(sendQueue), sizeof(snapshot));
+    BYTE_QUEUE_SNAPSHOT(sendQueue, snapshot, sizeof(snapshot));
+    ck_assert_int_eq(snapshot[0], CHECKED_FRAME_SYNC_1);
+    ck_assert_int_eq(snapshot[1], CHECKED_FRAME_SYNC_2);
+    ck_assert_int_eq(snapshot[2], 8);
+    ck_assert_int_eq(snapshot[3], 0);
+    ck_assert_str_eq((char*)&snapshot[CHECKED_FRAME_HEADER_SIZE], "message");
+}
+END_TEST
+
+START_TEST (test_endpoint_payload_format)
+{
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::USB) ==
+            PayloadFormat::JSON);
+    getConfiguration()->payloadFormat = PayloadFormat::PROTOBUF;
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::USB) ==
+            PayloadFormat::PROTOBUF);
+    openxc::pipeline::setPayloadFormat(InterfaceType::USB, PayloadFormat::JSON);
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::USB) ==
+            PayloadFormat::JSON);
+    fail_unless(openxc::pipeline::payloadFormat(InterfaceType::UART) ==
+            PayloadFormat::PROTOBUF);
+
+    openxc_DynamicField value = {0};
+    value.has_type = true;
+    value.type = openxc_DynamicField_Type_NUM;
+    value.has_numeric_value = true;
+    value.numeric_value = 42;
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = '\0';
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"vehicle_speed\",\"value\":42}");
+}
+END_TEST
+
+START_TEST (test_full_uart_keeps_room_for_responses)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+    while(BYTE_QUEUE_AVAILABLE(uartQueue) > 30) {
+        BYTE_QUEUE_PUSH(uartQueue, (uint8_t) 128);
+    }
+
+    unsigned int droppedSimple = openxc::pipeline::droppedMessageCount(
+            InterfaceType::UART, MessageClass::SIMPLE);
+    const char* message = "message";
+    int length = BYTE_QUEUE_LENGTH(uartQueue);
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(uartQueue), length);
+    ck_assert_int_eq(openxc::pipeline::droppedMessageCount(InterfaceType::UART,
+                MessageClass::SIMPLE), droppedSimple + 1);
+
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(uartQueue), length + 8);
+}
+END_TEST
+
+START_TEST (test_backed_up_endpoint_not_flushed_again)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    setRoute(InterfaceType::USB, 0);
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+    while(!BYTE_QUEUE_FULL(uartQueue)) {
+        BYTE_QUEUE_PUSH(uartQueue, (uint8_t) 128);
+    }
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_unless(UART_PROCESSED);
+    fail_unless(openxc::pipeline::backedUp(&getConfiguration()->pipeline,
+                MessageClass::SIMPLE));
+    fail_unless(openxc::pipeline::backedUp(&getConfiguration()->pipeline,
+                MessageClass::CAN));
+    fail_if(openxc::pipeline::backedUp(&getConfiguration()->pipeline,
+                MessageClass::COMMAND_RESPONSE));
+
+    UART_PROCESSED = false;
+    unsigned int dropped = openxc::pipeline::droppedMessageCount(
+            InterfaceType::UART, MessageClass::SIMPLE);
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_if(UART_PROCESSED);
+    ck_assert_int_eq(openxc::pipeline::droppedMessageCount(InterfaceType::UART,
+                MessageClass::SIMPLE), dropped + 1);
+
+    process(&getConfiguration()->pipeline);
+    fail_if(openxc::pipeline::backedUp(&getConfiguration()->pipeline,
+                MessageClass::SIMPLE));
+}
+END_TEST
+
+START_TEST (test_rate_limit_follows_drops)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    openxc::pipeline::setRateLimited(InterfaceType::UART, true);
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+    while(!BYTE_QUEUE_FULL(uartQueue)) {
+        BYTE_QUEUE_PUSH(uartQueue, (uint8_t) 128);
+    }
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    // not a full period yet
+    openxc::pipeline::updateRateLimit();
+    ck_assert(openxc::pipeline::rateScale() == 1);
+
+    FAKE_TIME += PIPELINE_RATE_LIMIT_PERIOD_MS;
+    openxc::pipeline::updateRateLimit();
+    ck_assert(openxc::pipeline::rateScale() == 0.5);
+
+    // nothing dropped in the next period, so the rate starts to come back
+    BYTE_QUEUE_RESET(uartQueue);
+    FAKE_TIME += PIPELINE_RATE_LIMIT_PERIOD_MS;
+    openxc::pipeline::updateRateLimit();
+    ck_assert(openxc::pipeline::rateScale() ==
+            0.5 + PIPELINE_RATE_SCALE_STEP);
+}
+END_TEST
+
+START_TEST (test_rate_limit_ignores_other_endpoints)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+    while(!BYTE_QUEUE_FULL(uartQueue)) {
+        BYTE_QUEUE_PUSH(uartQueue, (uint8_t) 128);
+    }
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    FAKE_TIME += PIPELINE_RATE_LIMIT_PERIOD_MS;
+    openxc::pipeline::updateRateLimit();
+    ck_assert(openxc::pipeline::rateScale() == 1);
+}
+END_TEST
+
+static void assertQueued(ByteQueue* queue, const char* expected,
+        int expectedLength) {
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(queue), expectedLength);
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(queue)];
+    BYTE_QUEUE_SNAPSHOT(queue, snapshot, sizeof(snapshot));
+    fail_if(memcmp(snapshot, expected, expectedLength));
+}
+
+START_TEST (test_name_dictionary)
+{
+    setRoute(InterfaceType::USB, MESSAGE_CLASS_FLAG(MessageClass::SIMPLE));
+    addRouteSignal(InterfaceType::USB, "vehicle_speed");
+    openxc::pipeline::setNameDictionary(true);
+
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    openxc::pipeline::publishSignal("engine_speed", 0, 7, 1, &value, NULL,
+            &getConfiguration()->pipeline);
+    fail_unless(BYTE_QUEUE_EMPTY(OUTPUT_QUEUE));
+
+    // still routed by name, but sent by ID
+    openxc::pipeline::publishSignal("vehicle_speed", 0, 12, 1, &value, NULL,
+            &getConfiguration()->pipeline);
+    const char expected[] = "{\"name\":\"12\",\"value\":42}";
+    assertQueued(OUTPUT_QUEUE, expected, sizeof(expected));
+}
+END_TEST
+
+START_TEST (test_batch_json_container)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    setRoute(InterfaceType::USB, 0);
+    fail_unless(openxc::pipeline::setBatching(InterfaceType::UART, 2, 100));
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+
+    const char* message = "{\"a\":1}";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    process(&getConfiguration()->pipeline);
+    // held back until the batch is full
+    fail_if(UART_PROCESSED);
+
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    const char expected[] = "{\"records\":[{\"a\":1},{\"a\":1}]}";
+    assertQueued(uartQueue, expected, sizeof(expected));
+    process(&getConfiguration()->pipeline);
+    fail_unless(UART_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_batch_closed_after_delay)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    setRoute(InterfaceType::USB, 0);
+    openxc::pipeline::setBatching(InterfaceType::UART, 5, 100);
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+
+    const char* message = "{\"a\":1}";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    process(&getConfiguration()->pipeline);
+    fail_if(UART_PROCESSED);
+
+    FAKE_TIME += 100;
+    process(&getConfiguration()->pipeline);
+    fail_unless(UART_PROCESSED);
+    const char expected[] = "{\"records\":[{\"a\":1}]}";
+    assertQueued(uartQueue, expected, sizeof(expected));
+}
+END_TEST
+
+START_TEST (test_command_response_not_batched)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    setRoute(InterfaceType::USB, 0);
+    openxc::pipeline::setBatching(InterfaceType::UART, 5, 100);
+    ByteQueue* uartQueue = &getConfiguration()->pipeline.uart->sendQueue;
+
+    const char* message = "{\"a\":1}";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    const char* response = "{\"b\":2}";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)response, 8,
+            MessageClass::COMMAND_RESPONSE);
+    const char expected[] = "{\"records\":[{\"a\":1}]}\0{\"b\":2}";
+    assertQueued(uartQueue, expected, sizeof(expected));
+
+    process(&getConfiguration()->pipeline);
+    fail_unless(UART_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_telit_not_batched)
+{
+    fail_if(openxc::pipeline::setBatching(InterfaceType::TELIT, 5, 100));
+}
+END_TEST
+
+START_TEST (test_usb_not_columnar)
+{
+    fail_if(openxc::pipeline::setColumnar(InterfaceType::USB, true));
+    fail_if(openxc::pipeline::columnarEnabled(InterfaceType::USB));
+}
+END_TEST
+
 START_TEST (test_process_usb)
 {
     process(&getConfiguration()->pipeline);
@@ -158,20 +495,58 @@ START_TEST (test_process_all)
 }
 END_TEST
 
+START_TEST (test_latency_sampled)
+{
+    unsigned int before[PIPELINE_LATENCY_BUCKET_COUNT];
+    ck_assert(openxc::pipeline::getLatencyHistogram(InterfaceType::USB,
+                before));
+
+    openxc::pipeline::setReceiveTime(FAKE_TIME * 1000 - 600);
+    openxc_DynamicField value = openxc::payload::wrapNumber(42);
+    publishSimple("vehicle_speed", &value, NULL, &getConfiguration()->pipeline);
+    openxc::pipeline::setReceiveTime(0);
+    process(&getConfiguration()->pipeline);
+
+    unsigned int after[PIPELINE_LATENCY_BUCKET_COUNT];
+    ck_assert(openxc::pipeline::getLatencyHistogram(InterfaceType::USB,
+                after));
+    // 600us is in the 512-1023us bucket
+    ck_assert_int_eq(after[1] - before[1], 1);
+    ck_assert_int_eq(after[0], before[0]);
+}
+END_TEST
+
 Suite* pipelineSuite(void) {
     Suite* s = suite_create("pipeline");
     TCase *tc_core = tcase_create("core");
     tcase_add_checked_fixture(tc_core, setup, NULL);
     tcase_add_test(tc_core, test_only_usb);
+    tcase_add_test(tc_core, test_oversized_message_not_flushed);
     tcase_add_test(tc_core, test_with_uart);
     tcase_add_test(tc_core, test_with_uart_and_network);
     tcase_add_test(tc_core, test_full_usb);
     tcase_add_test(tc_core, test_full_uart);
     tcase_add_test(tc_core, test_full_network);
     tcase_add_test(tc_core, test_process_all);
+    tcase_add_test(tc_core, test_latency_sampled);
     tcase_add_test(tc_core, test_process_usb_and_uart);
     tcase_add_test(tc_core, test_process_usb);
     tcase_add_test(tc_core, test_log_to_usb);
+    tcase_add_test(tc_core, test_route_blocks_class);
+    tcase_add_test(tc_core, test_route_signal_filter);
+    tcase_add_test(tc_core, test_route_signal_frequency);
+    tcase_add_test(tc_core, test_uart_binary_checked_frames);
+    tcase_add_test(tc_core, test_endpoint_payload_format);
+    tcase_add_test(tc_core, test_full_uart_keeps_room_for_responses);
+    tcase_add_test(tc_core, test_backed_up_endpoint_not_flushed_again);
+    tcase_add_test(tc_core, test_rate_limit_follows_drops);
+    tcase_add_test(tc_core, test_rate_limit_ignores_other_endpoints);
+    tcase_add_test(tc_core, test_name_dictionary);
+    tcase_add_test(tc_core, test_batch_json_container);
+    tcase_add_test(tc_core, test_batch_closed_after_delay);
+    tcase_add_test(tc_core, test_command_response_not_batched);
+    tcase_add_test(tc_core, test_telit_not_batched);
+    tcase_add_test(tc_core, test_usb_not_columnar);
     suite_add_tcase(s, tc_core);
 
     return s;
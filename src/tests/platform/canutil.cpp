@@ -1,13 +1,60 @@
 #include "canutil_spy.h"
 
 static bool _acceptanceFiltersUpdated = false;
+static int _acceptanceFilterUpdateCount = 0;
+static CanErrorCounters _errorCounters;
+static int _busOffRecoveryCount = 0;
+static unsigned int _bitRate = 0;
+static bool _listenOnly = false;
 
 bool openxc::can::spy::acceptanceFiltersUpdated() {
     return _acceptanceFiltersUpdated;
 }
 
+int openxc::can::spy::acceptanceFilterUpdateCount() {
+    return _acceptanceFilterUpdateCount;
+}
+
+void openxc::can::spy::setErrorCounters(uint8_t transmitErrors,
+        uint8_t receiveErrors, bool busOff) {
+    _errorCounters.transmitErrors = transmitErrors;
+    _errorCounters.receiveErrors = receiveErrors;
+    _errorCounters.busOff = busOff;
+}
+
+int openxc::can::spy::busOffRecoveryCount() {
+    return _busOffRecoveryCount;
+}
+
+unsigned int openxc::can::spy::bitRate() {
+    return _bitRate;
+}
+
+bool openxc::can::spy::listenOnly() {
+    return _listenOnly;
+}
+
+void openxc::can::setBitRate(CanBus* bus, unsigned int speed,
+        bool listenOnly) {
+    _bitRate = speed;
+    _listenOnly = listenOnly;
+}
+
+void openxc::can::setOperatingMode(CanBus* bus, bool writable) {
+    _listenOnly = !bus->loopback && !writable;
+}
+
+void openxc::can::readErrorCounters(CanBus* bus, CanErrorCounters* counters) {
+    *counters = _errorCounters;
+}
+
+void openxc::can::recoverFromBusOff(CanBus* bus) {
+    ++_busOffRecoveryCount;
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     _acceptanceFiltersUpdated = true;
+    ++_acceptanceFilterUpdateCount;
     return true;
 }
 
@@ -9,6 +9,27 @@ namespace spy {
 
 bool acceptanceFiltersUpdated();
 
+/* Public: The number of times the AF table has been written to hardware since
+ * the tests started.
+ */
+int acceptanceFilterUpdateCount();
+
+/* Public: Set what every bus's controller reports from readErrorCounters.
+ */
+void setErrorCounters(uint8_t transmitErrors, uint8_t receiveErrors,
+        bool busOff);
+
+/* Public: The number of times recoverFromBusOff has been called since the
+ * tests started.
+ */
+int busOffRecoveryCount();
+
+/* Public: The speed from the last call to setBitRate, and the mode from the
+ * last call to setBitRate or setOperatingMode.
+ */
+unsigned int bitRate();
+bool listenOnly();
+
 } // spy
 } // can
 } // openxc
@@ -3,3 +3,7 @@
 bool openxc::can::write::sendMessage(const CanBus* bus, const CanMessage* request) {
     return false;
 }
+
+void openxc::can::write::disableTransmitInterrupt(CanBus* bus) { }
+
+void openxc::can::write::enableTransmitInterrupt(CanBus* bus) { }
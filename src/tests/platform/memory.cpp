@@ -0,0 +1,47 @@
+#include "memory_spy.h"
+
+// A stand-in for the stack, so the tests can paint it and play at using it
+static uint32_t STACK[64];
+
+static int allocations = 0;
+
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    ++allocations;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    ++allocations;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    ++allocations;
+    return __real_realloc(pointer, size);
+}
+
+}
+
+int openxc::util::memory::spy::getAllocationCount() {
+    return allocations;
+}
+
+void openxc::util::memory::spy::resetAllocationCount() {
+    allocations = 0;
+}
+
+void openxc::util::memory::stackRegion(uint8_t** bottom, uint8_t** top) {
+    *bottom = (uint8_t*) STACK;
+    *top = (uint8_t*) &STACK[64];
+}
+
+void openxc::util::memory::heapUsage(size_t* used, size_t* reserved) {
+    *used = 0;
+    *reserved = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef __MEMORY_SPY_H__
+#define __MEMORY_SPY_H__
+
+#include "util/memory.h"
+
+// The test builds link with malloc, calloc and realloc wrapped (see tests.mk),
+// so the calls the firmware and the libraries built with it make into the heap
+// are counted. Calls from inside the C library and libcheck aren't - and
+// check's assertions allocate, so read the count before asserting anything.
+
+namespace openxc {
+namespace util {
+namespace memory {
+namespace spy {
+
+/* Public: Returns the number of heap allocations since the count was last
+ * reset.
+ */
+int getAllocationCount();
+
+void resetAllocationCount();
+
+} // namespace spy
+} // namespace memory
+} // namespace util
+} // namespace openxc
+
+#endif
@@ -0,0 +1,42 @@
+#include "util/state_store.h"
+#include "saved_config.h"
+#include <string.h>
+
+// RAM standing in for the store's flash, with only a few slots so the tests
+// wrap around it quickly
+static uint8_t REGION[STATE_STORE_SLOT_SIZE * 4];
+static bool regionErased = false;
+
+const uint8_t* openxc::util::state_store::region(size_t* size) {
+    if(!regionErased) {
+        eraseRegion();
+    }
+    *size = sizeof(REGION);
+    return REGION;
+}
+
+void openxc::util::state_store::eraseRegion() {
+    memset(REGION, 0xff, sizeof(REGION));
+    regionErased = true;
+}
+
+bool openxc::util::state_store::writeSlot(int slot, const uint8_t* data) {
+    // Like flash, writing can only clear bits
+    for(int i = 0; i < STATE_STORE_SLOT_SIZE; i++) {
+        REGION[slot * STATE_STORE_SLOT_SIZE + i] &= data[i];
+    }
+    return true;
+}
+
+// Only the first word, the magic number, has to read as erased
+static uint32_t SAVED_CONFIGURATION[SAVED_CONFIGURATION_SIZE / 4] = {
+    0xffffffff};
+
+const uint8_t* openxc::config::savedConfigurationRegion() {
+    return (const uint8_t*) SAVED_CONFIGURATION;
+}
+
+bool openxc::config::writeSavedConfiguration(const uint8_t* data) {
+    memcpy(SAVED_CONFIGURATION, data, sizeof(SAVED_CONFIGURATION));
+    return true;
+}
@@ -1,17 +1,48 @@
 #include "power_spy.h"
 
 int watchdogTime = 0;
+int interruptWaits = 0;
+unsigned long wakeTimerSeconds = 0;
+bool timerWake = false;
 
 int openxc::power::spy::getWatchdogTime() {
     return watchdogTime;
 }
 
+int openxc::power::spy::getInterruptWaitCount() {
+    return interruptWaits;
+}
+
+unsigned long openxc::power::spy::getWakeTimer() {
+    return wakeTimerSeconds;
+}
+
+void openxc::power::spy::setWokeFromTimer(bool woke) {
+    timerWake = woke;
+}
+
 void openxc::power::initialize() { }
 
 void openxc::power::handleWake() { }
 
 void openxc::power::suspend() { }
 
+void openxc::power::waitForInterrupt() {
+    ++interruptWaits;
+}
+
+void openxc::power::enterLowClock() { }
+
+void openxc::power::exitLowClock() { }
+
+void openxc::power::armWakeTimer(unsigned long seconds) {
+    wakeTimerSeconds = seconds;
+}
+
+bool openxc::power::wokeFromTimer() {
+    return timerWake;
+}
+
 void openxc::power::enableWatchdogTimer(int microseconds) {
     watchdogTime = microseconds;
 }
@@ -9,6 +9,12 @@ namespace spy {
 
 int getWatchdogTime();
 
+int getInterruptWaitCount();
+
+unsigned long getWakeTimer();
+
+void setWokeFromTimer(bool woke);
+
 } // namespace spy
 } // namespace power
 } // namespace openxc
@@ -38,6 +38,22 @@ CanBus CAN_BUSES[][MAX_CAN_BUS_COUNT] = {
         },
 
     },
+    { // message set: shared_handler_tests
+        {
+            speed: 500000,
+            address: 1,
+            maxMessageFrequency: 0,
+            rawWritable: false
+        },
+
+        {
+            speed: 125000,
+            address: 2,
+            maxMessageFrequency: 1,
+            rawWritable: false
+        },
+
+    },
 };
 
 const int MAX_MESSAGE_COUNT = 6;
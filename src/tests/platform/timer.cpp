@@ -8,4 +8,16 @@ unsigned long openxc::util::time::systemTimeMs() {
     return FAKE_TIME;
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    return FAKE_TIME * 1000;
+}
+
+unsigned long openxc::util::time::cycleCount() {
+    return systemTimeUs();
+}
+
+unsigned long openxc::util::time::cyclesPerMicrosecond() {
+    return 1;
+}
+
 void openxc::util::time::initialize() { }
@@ -17,10 +17,10 @@ void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
         UsbEndpoint* endpoint = &usbDevice->endpoints[i];
         if(endpoint->direction == UsbEndpointDirection::USB_ENDPOINT_DIRECTION_IN) {
             printf("USB endpoint %d buffer:\n", i);
-            uint8_t snapshot[QUEUE_LENGTH(uint8_t, &endpoint->queue) + 1];
-            QUEUE_SNAPSHOT(uint8_t, &endpoint->queue, snapshot, sizeof(snapshot));
+            uint8_t snapshot[BYTE_QUEUE_LENGTH(&endpoint->queue) + 1];
+            BYTE_QUEUE_SNAPSHOT(&endpoint->queue, snapshot, sizeof(snapshot));
             SENT_BYTES += sizeof(snapshot);
-            QUEUE_INIT(uint8_t, &endpoint->queue);
+            BYTE_QUEUE_RESET(&endpoint->queue);
             for(size_t i = 0; i < sizeof(snapshot) - 1; i++) {
                 if(snapshot[i] == 0) {
                     printf("\n");
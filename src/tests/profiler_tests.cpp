@@ -0,0 +1,96 @@
+#include <check.h>
+#include <stdint.h>
+
+#include "util/profiler.h"
+#include "config.h"
+
+namespace profiler = openxc::util::profiler;
+namespace statistics = openxc::util::statistics;
+
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+
+void setup() {
+    FAKE_TIME = 1000;
+    getConfiguration()->calculateMetrics = true;
+}
+
+void teardown() {
+    getConfiguration()->calculateMetrics = false;
+}
+
+START_TEST (test_stage_totals_each_pass)
+{
+    profiler::startLoop();
+    FAKE_TIME += 2;
+    profiler::endStage(profiler::CAN_RECEIVE);
+    FAKE_TIME += 1;
+    profiler::endStage(profiler::DIAGNOSTICS);
+    FAKE_TIME += 3;
+    profiler::endStage(profiler::CAN_RECEIVE);
+    FAKE_TIME += 4;
+    profiler::endStage(profiler::PIPELINE);
+    profiler::endLoop();
+
+    // The test platform counts a cycle per microsecond
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::CAN_RECEIVE)), 5000);
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::DIAGNOSTICS)), 1000);
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::PIPELINE)), 4000);
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::USB_READ)), 0);
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::LOOP_STAGE_COUNT)), 10000);
+
+    profiler::startLoop();
+    FAKE_TIME += 1;
+    profiler::endStage(profiler::CAN_RECEIVE);
+    profiler::endLoop();
+    ck_assert_int_eq(statistics::minimum(
+                profiler::stageStatistic(profiler::CAN_RECEIVE)), 1000);
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::CAN_RECEIVE)), 5000);
+}
+END_TEST
+
+START_TEST (test_not_timed_without_metrics)
+{
+    getConfiguration()->calculateMetrics = false;
+    profiler::startLoop();
+    FAKE_TIME += 50;
+    profiler::endStage(profiler::EMULATOR);
+    profiler::endLoop();
+
+    getConfiguration()->calculateMetrics = true;
+    profiler::startLoop();
+    profiler::endLoop();
+    ck_assert_int_eq(statistics::maximum(
+                profiler::stageStatistic(profiler::EMULATOR)), 0);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("profiler");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_stage_totals_each_pass);
+    tcase_add_test(tc_core, test_not_timed_without_metrics);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "payload/protobuf.h"
+
+namespace protobuf = openxc::payload::protobuf;
+
+void setup() {
+}
+
+static openxc_VehicleMessage numericalMessage() {
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "speed");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = 42;
+    return message;
+}
+
+START_TEST (test_serialize_simple)
+{
+    openxc_VehicleMessage message = numericalMessage();
+    uint8_t payload[64] = {0};
+    const uint8_t expected[] = {0x18,
+        0x08, 0x02,
+        0x1a, 0x14,
+            0x0a, 0x05, 's', 'p', 'e', 'e', 'd',
+            0x12, 0x0b,
+                0x08, 0x02,
+                0x19, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x45, 0x40};
+
+    ck_assert_int_eq(protobuf::serialize(&message, payload, sizeof(payload)),
+            sizeof(expected));
+    ck_assert(!memcmp(payload, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_can)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 0x7e8;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 3;
+    message.can_message.data.bytes[0] = 0x1;
+    message.can_message.data.bytes[1] = 0x2;
+    message.can_message.data.bytes[2] = 0x3;
+    message.can_message.has_frame_format = true;
+    message.can_message.frame_format = openxc_CanMessage_FrameFormat_STANDARD;
+    message.has_timestamp = true;
+    message.timestamp = 1000;
+
+    uint8_t payload[64] = {0};
+    const uint8_t expected[] = {0x13,
+        0x08, 0x01,
+        0x12, 0x0c,
+            0x08, 0x01,
+            0x10, 0xe8, 0x0f,
+            0x1a, 0x03, 0x01, 0x02, 0x03,
+            0x20, 0x01,
+        0x38, 0xe8, 0x07};
+
+    ck_assert_int_eq(protobuf::serialize(&message, payload, sizeof(payload)),
+            sizeof(expected));
+    ck_assert(!memcmp(payload, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_timestamp_base)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_timestamp = true;
+    message.timestamp = 1000;
+
+    uint8_t payload[16] = {0};
+    const uint8_t expected[] = {0x03, 0x38, 0xe8, 0x07};
+    ck_assert_int_eq(protobuf::serialize(&message, payload, sizeof(payload)),
+            sizeof(expected));
+    ck_assert(!memcmp(payload, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_too_long)
+{
+    openxc_VehicleMessage message = numericalMessage();
+    uint8_t payload[24] = {0};
+    ck_assert_int_eq(protobuf::serialize(&message, payload, sizeof(payload)),
+            0);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("protobuf_payload");
+    TCase *tc_protobuf_payload = tcase_create("protobuf_payload");
+    tcase_add_checked_fixture(tc_protobuf_payload, setup, NULL);
+    tcase_add_test(tc_protobuf_payload, test_serialize_simple);
+    tcase_add_test(tc_protobuf_payload, test_serialize_can);
+    tcase_add_test(tc_protobuf_payload, test_serialize_timestamp_base);
+    tcase_add_test(tc_protobuf_payload, test_serialize_too_long);
+    suite_add_tcase(s, tc_protobuf_payload);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -3,10 +3,10 @@
 #include "emqueue.h"
 #include <stdio.h>
 #include <stdlib.h>
-// we don't really need this but it gets around an issue with multiple
-// definitions of the byte queue
 #include "util/bytebuffer.h"
 
+#define BYTE_QUEUE_SIZE 512
+
 typedef struct {
     int i;
     char bytes[8];
@@ -17,6 +17,8 @@ QUEUE_DEFINE(test_t);
 QUEUE_DECLARE(int, 256);
 QUEUE_DEFINE(int);
 
+static BYTE_QUEUE_STORAGE(STORAGE, BYTE_QUEUE_SIZE);
+
 START_TEST (test_struct_element)
 {
     QUEUE_TYPE(test_t) queue;
@@ -34,44 +36,44 @@ END_TEST
 
 START_TEST (test_push)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
-    fail_unless(QUEUE_PUSH(uint8_t, &queue, 0xEF));
-    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 1);
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+    fail_unless(BYTE_QUEUE_PUSH(&queue, 0xEF));
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 1);
 }
 END_TEST
 
 START_TEST (test_pop)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
     uint8_t original_value = 0xEF;
-    QUEUE_PUSH(uint8_t, &queue, original_value);
-    uint8_t value = QUEUE_POP(uint8_t, &queue);
+    BYTE_QUEUE_PUSH(&queue, original_value);
+    uint8_t value = BYTE_QUEUE_POP(&queue);
     ck_assert_int_eq(value, original_value);
 }
 END_TEST
 
 START_TEST (test_fill_er_up)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        bool success = QUEUE_PUSH(uint8_t, &queue, (uint8_t) (i % 255));
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        bool success = BYTE_QUEUE_PUSH(&queue, (uint8_t) (i % 255));
         fail_unless(success, "wasn't able to add the %dth element", i + 1);
     }
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        uint8_t value = QUEUE_POP(uint8_t, &queue);
-        if(i < QUEUE_MAX_LENGTH(uint8_t) - 1) {
-            fail_unless(!QUEUE_EMPTY(uint8_t, &queue),
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        uint8_t value = BYTE_QUEUE_POP(&queue);
+        if(i < BYTE_QUEUE_CAPACITY(&queue) - 1) {
+            fail_unless(!BYTE_QUEUE_EMPTY(&queue),
                     "didn't expect queue to be empty on %dth iteration", i + 1);
         }
         uint8_t expected = i % 255;
         ck_assert_int_eq(value, expected);
     }
-    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
 }
 END_TEST
 
@@ -100,82 +102,114 @@ END_TEST
 
 START_TEST (test_length)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
-    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 0);
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        QUEUE_PUSH(uint8_t, &queue,  (uint8_t) (i % 255));
-        if(i == QUEUE_MAX_LENGTH(uint8_t) - 1) {
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 0);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        BYTE_QUEUE_PUSH(&queue,  (uint8_t) (i % 255));
+        if(i == BYTE_QUEUE_CAPACITY(&queue) - 1) {
             break;
         }
-        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), i + 1);
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), i + 1);
     }
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        QUEUE_POP(uint8_t, &queue);
-        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), QUEUE_MAX_LENGTH(uint8_t) - i - 1);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        BYTE_QUEUE_POP(&queue);
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), BYTE_QUEUE_CAPACITY(&queue) - i - 1);
     }
-    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 0);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 0);
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        QUEUE_PUSH(uint8_t, &queue, (uint8_t) (i % 255));
-        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), i + 1);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        BYTE_QUEUE_PUSH(&queue, (uint8_t) (i % 255));
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), i + 1);
     }
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) / 2; i++) {
-        QUEUE_POP(uint8_t, &queue);
-        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), QUEUE_MAX_LENGTH(uint8_t) - i - 1);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) / 2; i++) {
+        BYTE_QUEUE_POP(&queue);
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), BYTE_QUEUE_CAPACITY(&queue) - i - 1);
     }
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) / 2; i++) {
-        QUEUE_PUSH(uint8_t, &queue, (uint8_t) (i % 255));
-        int expectedLength =  i + (QUEUE_MAX_LENGTH(uint8_t) / 2) + 1;
-        ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), expectedLength);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue) / 2; i++) {
+        BYTE_QUEUE_PUSH(&queue, (uint8_t) (i % 255));
+        int expectedLength =  i + (BYTE_QUEUE_CAPACITY(&queue) / 2) + 1;
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), expectedLength);
     }
 }
 END_TEST
 
 START_TEST (test_available)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
-    ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, &queue), QUEUE_MAX_LENGTH(uint8_t));
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        QUEUE_PUSH(uint8_t, &queue,  (uint8_t) (i % 255));
-        if(i == QUEUE_MAX_LENGTH(uint8_t) - 1) {
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
+    ck_assert_int_eq(BYTE_QUEUE_AVAILABLE(&queue), BYTE_QUEUE_CAPACITY(&queue));
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        BYTE_QUEUE_PUSH(&queue,  (uint8_t) (i % 255));
+        if(i == BYTE_QUEUE_CAPACITY(&queue) - 1) {
             break;
         }
-        ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, &queue),
-                QUEUE_MAX_LENGTH(uint8_t) - i - 1);
+        ck_assert_int_eq(BYTE_QUEUE_AVAILABLE(&queue),
+                BYTE_QUEUE_CAPACITY(&queue) - i - 1);
     }
 
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
-        QUEUE_POP(uint8_t, &queue);
-        ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, &queue), i + 1);
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
+        BYTE_QUEUE_POP(&queue);
+        ck_assert_int_eq(BYTE_QUEUE_AVAILABLE(&queue), i + 1);
     }
-    ck_assert_int_eq(QUEUE_AVAILABLE(uint8_t, &queue), QUEUE_MAX_LENGTH(uint8_t));
+    ck_assert_int_eq(BYTE_QUEUE_AVAILABLE(&queue), BYTE_QUEUE_CAPACITY(&queue));
 }
 END_TEST
 
 START_TEST (test_snapshot)
 {
-    QUEUE_TYPE(uint8_t) queue;
-    QUEUE_INIT(uint8_t, &queue);
-    uint8_t expected[QUEUE_MAX_LENGTH(uint8_t)];
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
+    ByteQueue queue;
+    BYTE_QUEUE_INIT(&queue, STORAGE);
+    uint8_t expected[BYTE_QUEUE_SIZE];
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
         uint8_t value = i % 255;
-        QUEUE_PUSH(uint8_t, &queue, value);
+        BYTE_QUEUE_PUSH(&queue, value);
         expected[i] = value;
     }
 
-    uint8_t snapshot[QUEUE_MAX_LENGTH(uint8_t)];
-    QUEUE_SNAPSHOT(uint8_t, &queue, snapshot, sizeof(snapshot));
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t); i++) {
+    uint8_t snapshot[BYTE_QUEUE_SIZE];
+    BYTE_QUEUE_SNAPSHOT(&queue, snapshot, sizeof(snapshot));
+    for(int i = 0; i < BYTE_QUEUE_CAPACITY(&queue); i++) {
         ck_assert_int_eq(snapshot[i], expected[i]);
     }
 }
 END_TEST
 
+START_TEST (test_capacity)
+{
+    ByteQueue queue;
+    BYTE_QUEUE_STORAGE(storage, 10);
+    BYTE_QUEUE_INIT(&queue, storage);
+    ck_assert_int_eq(BYTE_QUEUE_CAPACITY(&queue), 10);
+    for(int i = 0; i < 10; i++) {
+        fail_unless(BYTE_QUEUE_PUSH(&queue, (uint8_t) i));
+    }
+    fail_unless(BYTE_QUEUE_FULL(&queue));
+    fail_if(BYTE_QUEUE_PUSH(&queue, 0xEF));
+
+    // wrap around the end of the ring
+    for(int i = 0; i < 25; i++) {
+        ck_assert_int_eq(BYTE_QUEUE_POP(&queue), i);
+        fail_unless(BYTE_QUEUE_PUSH(&queue, (uint8_t) (i + 10)));
+        ck_assert_int_eq(BYTE_QUEUE_LENGTH(&queue), 10);
+    }
+}
+END_TEST
+
+START_TEST (test_no_storage)
+{
+    ByteQueue queue = {};
+    fail_unless(BYTE_QUEUE_EMPTY(&queue));
+    ck_assert_int_eq(BYTE_QUEUE_CAPACITY(&queue), 0);
+    ck_assert_int_eq(BYTE_QUEUE_AVAILABLE(&queue), 0);
+    fail_if(BYTE_QUEUE_PUSH(&queue, 0xEF));
+    fail_if(openxc::util::bytebuffer::messageCanFit(&queue, 1));
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("queue");
     TCase *tc_core = tcase_create("core");
@@ -187,6 +221,8 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_available);
     tcase_add_test(tc_core, test_snapshot);
     tcase_add_test(tc_core, test_struct_element);
+    tcase_add_test(tc_core, test_capacity);
+    tcase_add_test(tc_core, test_no_storage);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -0,0 +1,99 @@
+#include <check.h>
+#include <stddef.h>
+
+#include "util/rate_group.h"
+
+namespace rategroup = openxc::util::rategroup;
+
+extern unsigned long FAKE_TIME;
+
+static int fastRuns;
+static int slowRuns;
+
+static void countFastRun() {
+    ++fastRuns;
+}
+
+static void countSlowRun() {
+    ++slowRuns;
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    fastRuns = 0;
+    slowRuns = 0;
+    rategroup::clear();
+}
+
+void teardown() {
+    rategroup::clear();
+}
+
+START_TEST (test_runs_once_per_period)
+{
+    rategroup::addTask(rategroup::RATE_10_MS, countFastRun);
+    rategroup::addTask(rategroup::RATE_1_S, countSlowRun);
+    rategroup::run();
+    ck_assert_int_eq(fastRuns, 0);
+
+    for(int i = 0; i < 100; i++) {
+        FAKE_TIME += 10;
+        rategroup::run();
+        rategroup::run();
+    }
+    ck_assert_int_eq(fastRuns, 100);
+    ck_assert_int_eq(slowRuns, 1);
+}
+END_TEST
+
+START_TEST (test_late_run_not_repeated)
+{
+    rategroup::addTask(rategroup::RATE_100_MS, countSlowRun);
+    FAKE_TIME += 350;
+    rategroup::run();
+    rategroup::run();
+    ck_assert_int_eq(slowRuns, 1);
+
+    // The next period starts from the late run
+    FAKE_TIME += 90;
+    rategroup::run();
+    ck_assert_int_eq(slowRuns, 1);
+    FAKE_TIME += 10;
+    rategroup::run();
+    ck_assert_int_eq(slowRuns, 2);
+}
+END_TEST
+
+START_TEST (test_add_task_again)
+{
+    ck_assert(rategroup::addTask(rategroup::RATE_10_MS, countFastRun));
+    ck_assert(rategroup::addTask(rategroup::RATE_10_MS, countFastRun));
+    FAKE_TIME += 10;
+    rategroup::run();
+    ck_assert_int_eq(fastRuns, 1);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("rate_group");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_runs_once_per_period);
+    tcase_add_test(tc_core, test_late_run_not_repeated);
+    tcase_add_test(tc_core, test_add_task_again);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "can/selftest.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "config.h"
+
+namespace usb = openxc::interface::usb;
+namespace can = openxc::can;
+namespace selftest = openxc::can::selftest;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+CanBus* bus;
+
+static void update() {
+    selftest::update(bus, true, getCanBuses(), getCanBusCount(),
+            &getConfiguration()->pipeline);
+}
+
+/* Private: Take the frames the self test queued to send, and if deliver is
+ * true, receive them as the controller would in loopback mode.
+ */
+static void loopBack(bool deliver) {
+    while(!QUEUE_EMPTY(CanMessage, &bus->sendQueue)) {
+        CanMessage frame = QUEUE_POP(CanMessage, &bus->sendQueue);
+        if(deliver) {
+            selftest::record(bus, &frame);
+        }
+    }
+}
+
+/* Private: Run the main loop through a step, every 10ms, and let it settle.
+ */
+static void runStep(bool deliver) {
+    unsigned long started = FAKE_TIME;
+    for(; FAKE_TIME < started + CAN_SELF_TEST_STEP_MS; FAKE_TIME += 10) {
+        update();
+        loopBack(deliver);
+    }
+    FAKE_TIME = started + CAN_SELF_TEST_STEP_MS + CAN_SELF_TEST_SETTLE_MS;
+    update();
+}
+
+/* Private: Return the output queue as a string, with the delimiters between
+ * messages replaced by spaces.
+ */
+static void readOutput(char* output, size_t size) {
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, (uint8_t*) output, size);
+    size_t length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+    if(length > size - 1) {
+        length = size - 1;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(output[i] == '\0') {
+            output[i] = ' ';
+        }
+    }
+    output[length] = '\0';
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    initializeVehicleInterface();
+    getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+    bus->loopback = false;
+    bus->bypassFilters = false;
+    bus->passthroughCanMessages = false;
+    ck_assert(selftest::start(bus, getCanBuses(), getCanBusCount()));
+}
+
+void teardown() {
+    selftest::stop(bus);
+    loopBack(false);
+    update();
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_start_loopback)
+{
+    ck_assert(selftest::running(bus));
+    ck_assert(bus->loopback);
+    ck_assert(bus->bypassFilters);
+    ck_assert(bus->passthroughCanMessages);
+    ck_assert(!selftest::start(&getCanBuses()[1], getCanBuses(),
+                getCanBusCount()));
+}
+END_TEST
+
+START_TEST (test_sends_at_rate)
+{
+    update();
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->sendQueue), 1);
+    CanMessage frame = QUEUE_POP(CanMessage, &bus->sendQueue);
+    ck_assert_int_eq(frame.id, CAN_SELF_TEST_MESSAGE_ID);
+    ck_assert_int_eq(frame.length, 8);
+
+    FAKE_TIME += 20;
+    update();
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->sendQueue),
+            CAN_SELF_TEST_START_RATE * 20 / 1000);
+}
+END_TEST
+
+START_TEST (test_clean_step_doubles_rate)
+{
+    runStep(true);
+    char output[256];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "{\"name\":\"can_self_test\",\"value\":\"1:250\","
+            "\"event\":\"sent=248,received=248,dropped=0,"
+            "output_dropped=0\"}") != NULL);
+    ck_assert(strstr(output, "knee") == NULL);
+
+    update();
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->sendQueue), 1);
+    ck_assert(selftest::running(bus));
+}
+END_TEST
+
+START_TEST (test_knee_after_loss)
+{
+    runStep(true);
+    runStep(false);
+    char output[512];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "\"value\":\"1:500\",\"event\":\"sent=496,"
+            "received=0,") != NULL);
+    ck_assert(strstr(output, "{\"name\":\"can_self_test\",\"value\":"
+            "\"1:knee\",\"event\":\"rate=250\"}") != NULL);
+
+    update();
+    ck_assert(!selftest::running(bus));
+    ck_assert(!bus->loopback);
+    ck_assert(!bus->bypassFilters);
+    ck_assert(!bus->passthroughCanMessages);
+}
+END_TEST
+
+START_TEST (test_stop_waits_for_send_queue)
+{
+    update();
+    selftest::stop(bus);
+    update();
+    ck_assert(selftest::running(bus));
+    ck_assert(bus->loopback);
+
+    loopBack(true);
+    update();
+    ck_assert(!selftest::running(bus));
+    ck_assert(!bus->loopback);
+}
+END_TEST
+
+Suite* selftestSuite(void) {
+    Suite* s = suite_create("selftest");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_start_loopback);
+    tcase_add_test(tc_core, test_sends_at_rate);
+    tcase_add_test(tc_core, test_clean_step_doubles_rate);
+    tcase_add_test(tc_core, test_knee_after_loss);
+    tcase_add_test(tc_core, test_stop_waits_for_send_queue);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = selftestSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -4,8 +4,10 @@
 #include "can/canwrite.h"
 #include "config.h"
 #include "signals.h"
+#include "util/state_store.h"
 
 namespace usb = openxc::interface::usb;
+namespace state_store = openxc::util::state_store;
 
 using openxc::can::write::encodeState;
 using openxc::can::write::encodeNumber;
@@ -22,10 +24,12 @@ using openxc::signals::getSignals;
 using openxc::signals::getCanBuses;
 using openxc::config::getConfiguration;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+extern float fuelConsumedSinceRestartLiters;
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return BYTE_QUEUE_EMPTY(OUTPUT_QUEUE);
 }
 
 void setup() {
@@ -61,6 +65,28 @@ START_TEST (test_button_event_handler)
 }
 END_TEST
 
+START_TEST (test_button_event_handler_bound)
+{
+    openxc::signals::handlers::bindHandlers(getSignals(), getSignalCount());
+    const openxc::signals::handlers::HandlerContext* context =
+            openxc::signals::handlers::handlerContext();
+    fail_unless(context->buttonType == openxc::can::lookupSignal(
+                "button_type", getSignals(), getSignalCount()));
+    fail_unless(context->buttonState == openxc::can::lookupSignal(
+                "button_state", getSignals(), getSignalCount()));
+    fail_unless(context->turnSignalLeft == NULL);
+
+    bool send = true;
+    CanMessage message = {0};
+    buildMessage(&getSignals()[0], encodeState(&getSignals()[0], "down", &send), message.data, sizeof(message.data));
+    buildMessage(&getSignals()[1], encodeState(&getSignals()[1], "stuck", &send), message.data, sizeof(message.data));
+    handleButtonEventMessage(&message, getSignals(), getSignalCount(),
+            &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    openxc::signals::handlers::bindHandlers(NULL, 0);
+}
+END_TEST
+
 START_TEST (test_button_event_handler_bad_type)
 {
     fail_unless(queueEmpty());
@@ -85,8 +111,8 @@ START_TEST (test_button_event_handler_correct_types)
             &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "event") == NULL);
     fail_if(strstr((char*)snapshot, "value") == NULL);
@@ -122,8 +148,8 @@ START_TEST (test_tire_pressure_as_decoder)
     openxc::can::read::decodeSignal(signal, &message, getSignals(), getSignalCount(), &send);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "front_left") == NULL);
 }
@@ -139,8 +165,8 @@ START_TEST (test_tire_pressure_handler)
     fail_if(queueEmpty());
     ck_assert_str_eq(decodedTireId.string_value, "front_left");
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "front_left") == NULL);
 }
@@ -169,6 +195,32 @@ START_TEST (test_fuel_handler)
 }
 END_TEST
 
+START_TEST (test_fuel_handler_state_restored)
+{
+    state_store::eraseRegion();
+    state_store::initialize();
+    bool send = true;
+    CanSignal* signal = &getSignals()[6];
+    signal->received = true;
+    signal->lastValue = 0;
+    float consumed = handleFuelFlow(signal, getSignals(), getSignalCount(), 5,
+            &send, 1).numeric_value;
+    signal->lastValue = 5;
+    openxc::signals::handlers::saveState();
+
+    // As if the VI was reset
+    fuelConsumedSinceRestartLiters = 0;
+    signal->received = false;
+    signal->lastValue = 0;
+    state_store::initialize();
+    openxc::signals::handlers::restoreState();
+
+    float result = handleFuelFlow(signal, getSignals(), getSignalCount(), 7,
+            &send, 1).numeric_value;
+    ck_assert_int_eq(consumed + 2, result);
+}
+END_TEST
+
 START_TEST (test_door_handler)
 {
     bool send = true;
@@ -179,8 +231,8 @@ START_TEST (test_door_handler)
     fail_if(queueEmpty());
     ck_assert_str_eq(decodedDoorId.string_value, "driver");
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[BYTE_QUEUE_LENGTH(OUTPUT_QUEUE) + 1];
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "driver") == NULL);
 }
@@ -197,6 +249,7 @@ Suite* handlerSuite(void) {
     TCase *tc_button_handler = tcase_create("button");
     tcase_add_checked_fixture(tc_button_handler, setup, NULL);
     tcase_add_test(tc_button_handler, test_button_event_handler);
+    tcase_add_test(tc_button_handler, test_button_event_handler_bound);
     tcase_add_test(tc_button_handler, test_button_event_handler_bad_type);
     tcase_add_test(tc_button_handler, test_button_event_handler_bad_state);
     tcase_add_test(tc_button_handler, test_button_event_handler_correct_types);
@@ -210,6 +263,7 @@ Suite* handlerSuite(void) {
     TCase *tc_fuel_handler = tcase_create("fuel");
     tcase_add_checked_fixture(tc_fuel_handler, setup, NULL);
     tcase_add_test(tc_fuel_handler, test_fuel_handler);
+    tcase_add_test(tc_fuel_handler, test_fuel_handler_state_restored);
     suite_add_tcase(s, tc_fuel_handler);
 
     TCase *tc_tire_pressure = tcase_create("tire_pressure");
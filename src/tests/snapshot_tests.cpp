@@ -0,0 +1,149 @@
+#include <check.h>
+#include <stdint.h>
+#include "snapshot.h"
+#include "signals.h"
+#include "config.h"
+#include "diagnostics.h"
+
+#include "power_spy.h"
+
+namespace diagnostics = openxc::diagnostics;
+namespace snapshot = openxc::snapshot;
+namespace usb = openxc::interface::usb;
+namespace power = openxc::power;
+
+using openxc::diagnostics::ActiveDiagnosticRequest;
+using openxc::diagnostics::DiagnosticsManager;
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+using openxc::config::PowerManagement;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+DiagnosticsManager* manager = &getConfiguration()->diagnosticsManager;
+PowerManagement powerManagement;
+bool passiveIgnitionCheck;
+
+static int oneTimeRequestCount() {
+    int count = 0;
+    ActiveDiagnosticRequest* entry;
+    LIST_FOREACH(entry, &manager->nonrecurringRequests, listEntries) {
+        ++count;
+    }
+    return count;
+}
+
+/* Private: Run the main loop's check at the given time into the snapshot. */
+static bool updateAt(unsigned long elapsedMs) {
+    FAKE_TIME = 1000 + elapsedMs;
+    return snapshot::update(&getConfiguration()->pipeline);
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    power::spy::setWokeFromTimer(false);
+    initializeVehicleInterface();
+    powerManagement = getConfiguration()->powerManagement;
+    passiveIgnitionCheck = getConfiguration()->passiveIgnitionCheck;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    diagnostics::initialize(manager, getCanBuses(), getCanBusCount(), 1);
+    power::spy::setWokeFromTimer(true);
+}
+
+void teardown() {
+    getConfiguration()->powerManagement = powerManagement;
+    getConfiguration()->passiveIgnitionCheck = passiveIgnitionCheck;
+    power::spy::setWokeFromTimer(false);
+}
+
+START_TEST (test_not_without_timer_wake)
+{
+    power::spy::setWokeFromTimer(false);
+    ck_assert(!snapshot::start(manager));
+    ck_assert(!snapshot::active());
+    ck_assert(!snapshot::update(&getConfiguration()->pipeline));
+}
+END_TEST
+
+START_TEST (test_not_with_active_ignition_check)
+{
+    getConfiguration()->powerManagement = PowerManagement::OBD2_IGNITION_CHECK;
+    getConfiguration()->passiveIgnitionCheck = false;
+    ck_assert(!snapshot::start(manager));
+    ck_assert(!snapshot::active());
+}
+END_TEST
+
+START_TEST (test_requests_added)
+{
+    int before = oneTimeRequestCount();
+    ck_assert(snapshot::start(manager));
+    ck_assert(snapshot::active());
+    // the two default PIDs and the stored trouble codes
+    ck_assert_int_eq(oneTimeRequestCount() - before, 3);
+}
+END_TEST
+
+START_TEST (test_over_after_window)
+{
+    ck_assert(snapshot::start(manager));
+    ck_assert(!updateAt(SNAPSHOT_WINDOW_S * 1000 - 1));
+    ck_assert(snapshot::active());
+    ck_assert(updateAt(SNAPSHOT_WINDOW_S * 1000));
+    ck_assert(!snapshot::active());
+    ck_assert(!updateAt(SNAPSHOT_WINDOW_S * 1000 + 1));
+}
+END_TEST
+
+START_TEST (test_waits_for_outputs)
+{
+    ck_assert(snapshot::start(manager));
+    BYTE_QUEUE_PUSH(OUTPUT_QUEUE, (uint8_t) 'x');
+    ck_assert(!updateAt(SNAPSHOT_WINDOW_S * 1000));
+    ck_assert(!updateAt(2 * SNAPSHOT_WINDOW_S * 1000 - 1));
+    ck_assert(updateAt(2 * SNAPSHOT_WINDOW_S * 1000));
+}
+END_TEST
+
+START_TEST (test_outputs_caught_up)
+{
+    ck_assert(snapshot::start(manager));
+    BYTE_QUEUE_PUSH(OUTPUT_QUEUE, (uint8_t) 'x');
+    ck_assert(!updateAt(SNAPSHOT_WINDOW_S * 1000));
+    BYTE_QUEUE_RESET(OUTPUT_QUEUE);
+    ck_assert(updateAt(SNAPSHOT_WINDOW_S * 1000 + 1));
+}
+END_TEST
+
+Suite* snapshotSuite(void) {
+    Suite* s = suite_create("snapshot");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_not_without_timer_wake);
+    tcase_add_test(tc_core, test_not_with_active_ignition_check);
+    tcase_add_test(tc_core, test_requests_added);
+    tcase_add_test(tc_core, test_over_after_window);
+    tcase_add_test(tc_core, test_waits_for_outputs);
+    tcase_add_test(tc_core, test_outputs_caught_up);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = snapshotSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/state_store.h"
+
+namespace state_store = openxc::util::state_store;
+
+static uint8_t* slot(int index) {
+    size_t size;
+    return (uint8_t*) &state_store::region(&size)[
+            index * STATE_STORE_SLOT_SIZE];
+}
+
+static int slotCount() {
+    size_t size;
+    state_store::region(&size);
+    return size / STATE_STORE_SLOT_SIZE;
+}
+
+static bool slotErased(int index) {
+    for(int i = 0; i < STATE_STORE_SLOT_SIZE; i++) {
+        if(slot(index)[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void setup() {
+    state_store::eraseRegion();
+    state_store::initialize();
+}
+
+START_TEST (test_empty)
+{
+    uint32_t state = 0;
+    ck_assert(!state_store::load(&state, sizeof(state)));
+}
+END_TEST
+
+START_TEST (test_store_and_load)
+{
+    uint32_t state = 42;
+    ck_assert(state_store::store(&state, sizeof(state)));
+
+    state_store::initialize();
+    uint32_t loaded = 0;
+    ck_assert(state_store::load(&loaded, sizeof(loaded)));
+    ck_assert_int_eq(loaded, 42);
+}
+END_TEST
+
+START_TEST (test_unchanged_not_written)
+{
+    uint32_t state = 42;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(slotErased(1));
+
+    state = 43;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(!slotErased(1));
+}
+END_TEST
+
+START_TEST (test_wraps_around)
+{
+    uint32_t state;
+    for(state = 1; state <= (uint32_t) slotCount() + 1; state++) {
+        ck_assert(state_store::store(&state, sizeof(state)));
+    }
+    ck_assert(!slotErased(0));
+    ck_assert(slotErased(1));
+
+    state_store::initialize();
+    uint32_t loaded = 0;
+    ck_assert(state_store::load(&loaded, sizeof(loaded)));
+    ck_assert_int_eq(loaded, slotCount() + 1);
+
+    // Picks up after the record that survived the erase
+    state = 100;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(!slotErased(1));
+}
+END_TEST
+
+START_TEST (test_damaged_record_falls_back)
+{
+    uint32_t state = 1;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    state = 2;
+    ck_assert(state_store::store(&state, sizeof(state)));
+
+    // As if the reset came in the middle of writing it
+    slot(1)[STATE_STORE_HEADER_SIZE] = 0xff;
+    state_store::initialize();
+    uint32_t loaded = 0;
+    ck_assert(state_store::load(&loaded, sizeof(loaded)));
+    ck_assert_int_eq(loaded, 1);
+
+    // The damaged slot isn't written over
+    state = 3;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(!slotErased(2));
+}
+END_TEST
+
+START_TEST (test_different_length)
+{
+    uint32_t state = 42;
+    ck_assert(state_store::store(&state, sizeof(state)));
+
+    uint16_t loaded;
+    ck_assert(!state_store::load(&loaded, sizeof(loaded)));
+}
+END_TEST
+
+START_TEST (test_too_long)
+{
+    uint8_t state[STATE_STORE_MAX_LENGTH + 1] = {0};
+    ck_assert(!state_store::store(state, sizeof(state)));
+    ck_assert(state_store::store(state, STATE_STORE_MAX_LENGTH));
+}
+END_TEST
+
+START_TEST (test_copy_current)
+{
+    uint32_t record[STATE_STORE_SLOT_SIZE / 4];
+    ck_assert(!state_store::copyCurrent((uint8_t*) record));
+
+    uint32_t state = 1;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    state = 2;
+    ck_assert(state_store::store(&state, sizeof(state)));
+    ck_assert(state_store::copyCurrent((uint8_t*) record));
+
+    // As a platform sharing the flash page would put it back
+    state_store::eraseRegion();
+    state_store::writeSlot(0, (const uint8_t*) record);
+    state_store::initialize();
+    uint32_t loaded = 0;
+    ck_assert(state_store::load(&loaded, sizeof(loaded)));
+    ck_assert_int_eq(loaded, 2);
+}
+END_TEST
+
+Suite* stateStoreSuite(void) {
+    Suite* s = suite_create("state_store");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_empty);
+    tcase_add_test(tc_core, test_store_and_load);
+    tcase_add_test(tc_core, test_unchanged_not_written);
+    tcase_add_test(tc_core, test_wraps_around);
+    tcase_add_test(tc_core, test_damaged_record_falls_back);
+    tcase_add_test(tc_core, test_different_length);
+    tcase_add_test(tc_core, test_too_long);
+    tcase_add_test(tc_core, test_copy_current);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = stateStoreSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -5,6 +5,9 @@
 
 using openxc::util::statistics::Statistic;
 using openxc::util::statistics::DeltaStatistic;
+using openxc::util::statistics::WindowStatistic;
+using openxc::util::statistics::FixedStatistic;
+using openxc::util::statistics::FixedDeltaStatistic;
 
 namespace statistics = openxc::util::statistics;
 
@@ -93,6 +96,84 @@ START_TEST (test_delta_stat_exponential_average)
 }
 END_TEST
 
+START_TEST (test_fixed_average_starts_at_first_value)
+{
+    FixedStatistic stat;
+    statistics::initialize(&stat);
+    statistics::update(&stat, 500);
+    ck_assert(statistics::exponentialMovingAverage(&stat) == 500);
+    ck_assert_int_eq(statistics::minimum(&stat), 500);
+    ck_assert_int_eq(statistics::maximum(&stat), 500);
+}
+END_TEST
+
+START_TEST (test_fixed_exponential_moving_average)
+{
+    FixedStatistic stat;
+    statistics::initialize(&stat);
+    for(int i = 1; i <= 10; i++) {
+        statistics::update(&stat, i);
+    }
+    float average = statistics::exponentialMovingAverage(&stat);
+    ck_assert(average > 5);
+    ck_assert(average < 5.5);
+}
+END_TEST
+
+START_TEST (test_fixed_average_settles_on_constant)
+{
+    FixedStatistic stat;
+    statistics::initialize(&stat);
+    statistics::update(&stat, 0);
+    for(int i = 0; i < 200; i++) {
+        statistics::update(&stat, 1234);
+    }
+    ck_assert(statistics::exponentialMovingAverage(&stat) > 1233);
+    ck_assert(statistics::exponentialMovingAverage(&stat) <= 1234);
+}
+END_TEST
+
+START_TEST (test_fixed_average_shift)
+{
+    FixedStatistic stat;
+    statistics::initialize(&stat);
+    stat.shift = 1;
+    statistics::update(&stat, 0);
+    statistics::update(&stat, 8);
+    ck_assert(statistics::exponentialMovingAverage(&stat) == 4);
+    statistics::update(&stat, -3);
+    ck_assert(statistics::exponentialMovingAverage(&stat) == .5);
+}
+END_TEST
+
+START_TEST (test_fixed_delta_stat)
+{
+    FixedDeltaStatistic stat;
+    statistics::initialize(&stat);
+    statistics::update(&stat, 1);
+    statistics::update(&stat, 2);
+    statistics::update(&stat, 10);
+    ck_assert_int_eq(statistics::minimum(&stat), 1);
+    ck_assert_int_eq(statistics::maximum(&stat), 8);
+    ck_assert_int_eq(stat.total, 10);
+}
+END_TEST
+
+START_TEST (test_window_stat)
+{
+    WindowStatistic stat;
+    statistics::initialize(&stat);
+    ck_assert(statistics::mean(&stat) == 0);
+    statistics::update(&stat, 2.5);
+    statistics::update(&stat, -1);
+    statistics::update(&stat, 4.5);
+    ck_assert(stat.min == -1);
+    ck_assert(stat.max == 4.5);
+    ck_assert_int_eq(stat.count, 3);
+    ck_assert(statistics::mean(&stat) == 2);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("statistics");
     TCase *tc_core = tcase_create("core");
@@ -103,6 +184,12 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_delta_stat_min_max);
     tcase_add_test(tc_core, test_delta_stat_exponential_average);
     tcase_add_test(tc_core, test_average_starts_at_first_value);
+    tcase_add_test(tc_core, test_window_stat);
+    tcase_add_test(tc_core, test_fixed_average_starts_at_first_value);
+    tcase_add_test(tc_core, test_fixed_exponential_moving_average);
+    tcase_add_test(tc_core, test_fixed_average_settles_on_constant);
+    tcase_add_test(tc_core, test_fixed_average_shift);
+    tcase_add_test(tc_core, test_fixed_delta_stat);
     suite_add_tcase(s, tc_core);
 
     return s;
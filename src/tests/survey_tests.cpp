@@ -0,0 +1,200 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "can/survey.h"
+#include "signals.h"
+#include "pipeline.h"
+#include "config.h"
+
+namespace usb = openxc::interface::usb;
+namespace can = openxc::can;
+namespace survey = openxc::can::survey;
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+
+extern unsigned long FAKE_TIME;
+extern void initializeVehicleInterface();
+
+ByteQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].queue;
+
+CanBus* bus;
+
+static void receive(uint32_t id, uint8_t firstByte, uint8_t length,
+        unsigned long receivedUs) {
+    CanMessage message = {
+        id: id,
+        format: CanMessageFormat::STANDARD,
+        data: {firstByte, 0x2},
+        length: length,
+        receivedUs: receivedUs
+    };
+    survey::record(bus, &message);
+}
+
+/* Private: Return the output queue as a string, with the delimiters between
+ * messages replaced by spaces.
+ */
+static void readOutput(char* output, size_t size) {
+    BYTE_QUEUE_SNAPSHOT(OUTPUT_QUEUE, (uint8_t*) output, size);
+    size_t length = BYTE_QUEUE_LENGTH(OUTPUT_QUEUE);
+    if(length > size - 1) {
+        length = size - 1;
+    }
+    for(size_t i = 0; i < length; i++) {
+        if(output[i] == '\0') {
+            output[i] = ' ';
+        }
+    }
+    output[length] = '\0';
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    initializeVehicleInterface();
+    getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(survey::start(bus, getCanBuses(), getCanBusCount()));
+}
+
+void teardown() {
+    survey::stop(bus, getCanBuses(), getCanBusCount());
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+START_TEST (test_period_and_jitter)
+{
+    receive(0x42, 1, 8, 1000000);
+    receive(0x42, 1, 8, 1100000);
+    receive(0x42, 1, 8, 1190000);
+    receive(0x42, 1, 8, 1300000);
+
+    const survey::SurveyStatistics* statistics = survey::lookup(bus, 0x42,
+            CanMessageFormat::STANDARD);
+    ck_assert(statistics != NULL);
+    ck_assert_int_eq(statistics->count, 4);
+    ck_assert_int_eq((int) (statistics->meanPeriodUs + .5), 100000);
+    // periods of 100, 90 and 110ms
+    ck_assert_int_eq((int) (statistics->periodM2 + .5), 200000000);
+}
+END_TEST
+
+START_TEST (test_lengths_and_changed_bytes)
+{
+    receive(0x42, 1, 8, 1000000);
+    receive(0x42, 1, 4, 1100000);
+    receive(0x42, 7, 8, 1200000);
+
+    const survey::SurveyStatistics* statistics = survey::lookup(bus, 0x42,
+            CanMessageFormat::STANDARD);
+    ck_assert_int_eq(statistics->minLength, 4);
+    ck_assert_int_eq(statistics->maxLength, 8);
+    ck_assert_int_eq(statistics->changedBytes, 0x1);
+    ck_assert(survey::lookup(bus, 0x43, CanMessageFormat::STANDARD) == NULL);
+}
+END_TEST
+
+START_TEST (test_bypasses_filters_until_stopped)
+{
+    ck_assert(bus->surveying);
+    ck_assert(bus->bypassFilters);
+
+    survey::stop(bus, getCanBuses(), getCanBusCount());
+    ck_assert(!bus->surveying);
+    ck_assert(!bus->bypassFilters);
+    ck_assert(survey::lookup(bus, 0x42, CanMessageFormat::STANDARD) == NULL);
+}
+END_TEST
+
+START_TEST (test_untracked_when_full)
+{
+    for(int i = 0; i < CAN_SURVEY_ID_COUNT; i++) {
+        receive(0x100 + i, 1, 8, 1000000);
+    }
+    ck_assert_int_eq(survey::untrackedCount(), 0);
+
+    receive(0x200, 1, 8, 1000000);
+    ck_assert_int_eq(survey::untrackedCount(), 1);
+    for(int i = 0; i < CAN_SURVEY_ID_COUNT; i++) {
+        ck_assert(survey::lookup(bus, 0x100 + i,
+                    CanMessageFormat::STANDARD) != NULL);
+    }
+}
+END_TEST
+
+START_TEST (test_restart_keeps_other_buses)
+{
+    CanBus* other = &getCanBuses()[1];
+    CanMessage message = {id: 0x42, format: CanMessageFormat::STANDARD,
+            data: {1}, length: 1, receivedUs: 1000000};
+    survey::start(other, getCanBuses(), getCanBusCount());
+    for(int i = 0; i < CAN_SURVEY_ID_COUNT / 2; i++) {
+        message.id = 0x100 + i;
+        survey::record(other, &message);
+        receive(0x100 + i, 1, 8, 1000000);
+    }
+
+    survey::start(bus, getCanBuses(), getCanBusCount());
+    for(int i = 0; i < CAN_SURVEY_ID_COUNT / 2; i++) {
+        ck_assert(survey::lookup(other, 0x100 + i,
+                    CanMessageFormat::STANDARD) != NULL);
+        ck_assert(survey::lookup(bus, 0x100 + i,
+                    CanMessageFormat::STANDARD) == NULL);
+    }
+    survey::stop(other, getCanBuses(), getCanBusCount());
+}
+END_TEST
+
+START_TEST (test_publish_summary)
+{
+    receive(0x42, 1, 8, 1000000);
+    receive(0x42, 1, 8, 1100000);
+    survey::process(&getConfiguration()->pipeline);
+    ck_assert_int_eq(BYTE_QUEUE_LENGTH(OUTPUT_QUEUE), 0);
+
+    FAKE_TIME += CAN_SURVEY_INTERVAL_MS;
+    survey::process(&getConfiguration()->pipeline);
+    char output[512];
+    readOutput(output, sizeof(output));
+    ck_assert(strstr(output, "{\"name\":\"can_survey\",\"value\":\"1:0x42\","
+            "\"event\":\"count=2,period_us=100000,jitter_us=0,length=8-8,"
+            "changed=0x0\"}") != NULL);
+}
+END_TEST
+
+Suite* surveySuite(void) {
+    Suite* s = suite_create("survey");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_period_and_jitter);
+    tcase_add_test(tc_core, test_lengths_and_changed_bytes);
+    tcase_add_test(tc_core, test_bypasses_filters_until_stopped);
+    tcase_add_test(tc_core, test_untracked_when_full);
+    tcase_add_test(tc_core, test_restart_keeps_other_buses);
+    tcase_add_test(tc_core, test_publish_summary);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = surveySuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include <check.h>
+#include <stddef.h>
+
+#include "util/task.h"
+
+namespace task = openxc::util::task;
+
+extern unsigned long FAKE_TIME;
+
+static int runs;
+
+static void countRun() {
+    ++runs;
+}
+
+static void yieldAgain() {
+    ++runs;
+    ck_assert(task::yielding());
+    FAKE_TIME += TASK_YIELD_INTERVAL_MS;
+    task::yield();
+}
+
+void setup() {
+    FAKE_TIME = 1000;
+    runs = 0;
+    task::setBackgroundTask(countRun);
+}
+
+void teardown() {
+    task::setBackgroundTask(NULL);
+}
+
+START_TEST (test_yield_runs_at_most_once_per_interval)
+{
+    task::yield();
+    ck_assert_int_eq(runs, 0);
+
+    FAKE_TIME += TASK_YIELD_INTERVAL_MS;
+    task::yield();
+    task::yield();
+    ck_assert_int_eq(runs, 1);
+
+    FAKE_TIME += TASK_YIELD_INTERVAL_MS;
+    task::yield();
+    ck_assert_int_eq(runs, 2);
+    ck_assert(!task::yielding());
+}
+END_TEST
+
+START_TEST (test_yield_not_reentrant)
+{
+    task::setBackgroundTask(yieldAgain);
+    FAKE_TIME += TASK_YIELD_INTERVAL_MS;
+    task::yield();
+    ck_assert_int_eq(runs, 1);
+}
+END_TEST
+
+START_TEST (test_yield_without_task)
+{
+    task::setBackgroundTask(NULL);
+    FAKE_TIME += TASK_YIELD_INTERVAL_MS;
+    task::yield();
+    ck_assert_int_eq(runs, 0);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("task");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_yield_runs_at_most_once_per_interval);
+    tcase_add_test(tc_core, test_yield_not_reentrant);
+    tcase_add_test(tc_core, test_yield_without_task);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -9,8 +9,12 @@ TEST_OBJDIR = build/$(TEST_DIR)
 TEST_SRC=$(wildcard $(TEST_DIR)/*_tests.cpp)
 TESTS=$(patsubst %.cpp,$(TEST_OBJDIR)/%.bin,$(TEST_SRC))
 TEST_LIBS = -lcheck -lrt -lpthread
+# Count the heap allocations made by anything built with the tests, see
+# tests/platform/memory_spy.h
+TEST_HEAP_WRAP = -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
 
-NON_TESTABLE_SRCS = signals.cpp main.cpp hardware_tests_main.cpp
+NON_TESTABLE_SRCS = signals.cpp main.cpp hardware_tests_main.cpp \
+				   hardware_benchmarks_main.cpp
 
 TEST_C_SRCS = $(CROSSPLATFORM_C_SRCS) $(wildcard tests/platform/*.c) \
 			  $(LIBS_PATH)/nanopb/pb_decode.c
@@ -68,9 +72,16 @@ test_long: test_short
 	@make messagepack_output_compile_test
 	@make emulator_compile_test
 	@make msd_emulator_compile_test
+	@make emulated_frames_compile_test
 	@make stats_compile_test
 	@make msd_stats_compile_test
 	@make debug_stats_compile_test
+	@make deferred_logging_compile_test
+	@make no_metrics_compile_test
+	@make no_idle_sleep_compile_test
+	@make benchmark_mode_compile_test
+	@make msd_loadable_signals_compile_test
+	@make can_capture_compile_test
 	@make msd_mapped_compile_test
 	@make msd_passthrough_compile_test
 	@make msd_diag_compile_test
@@ -109,14 +120,54 @@ unit_tests: CXX = $(TEST_CXX)
 unit_tests: CPPFLAGS = -I/usr/local -c -Wall -Werror -g -ggdb -coverage
 unit_tests: CFLAGS = $(CC_SUPRESSED_ERRORS) $(CFLAGS_STD)
 unit_tests: CXXFLAGS =  $(CXX_SUPRESSED_ERRORS) $(CXXFLAGS_STD)
-unit_tests: LDFLAGS = -lm -coverage
+unit_tests: LDFLAGS = -lm -coverage $(TEST_HEAP_WRAP)
 unit_tests: LDLIBS = $(TEST_LIBS)
 unit_tests: INCLUDE_PATHS += -I./tests/platform/
+unit_tests: LOADABLE_SIGNAL_COUNT = 8
+unit_tests: CAN_CAPTURE_FRAME_COUNT = 16
+unit_tests: DECODE_PROFILE_COUNT = 4
+unit_tests: CAN_SURVEY_ID_COUNT = 16
+unit_tests: CAN_FILTER_LEARN_ID_COUNT = 8
+unit_tests: CAN_SELF_TEST = 1
+unit_tests: J1939_TP_SESSION_COUNT = 2
+unit_tests: SNAPSHOT_INTERVAL_S = 3600
 unit_tests: $(TESTS)
 	@set -o $(TEST_SET_OPTS) >/dev/null 2>&1
 	@export SHELLOPTS
 	@sh tests/runtests.sh $(TEST_OBJDIR)/$(TEST_DIR)
 
+BENCHMARK_DIR = $(TEST_DIR)/benchmarks
+BENCHMARK_OBJDIR = build/benchmarks
+BENCHMARK_OBJS = $(patsubst %,$(BENCHMARK_OBJDIR)/%,$(TEST_OBJ_FILES))
+BENCHMARK_BIN = $(BENCHMARK_OBJDIR)/$(BENCHMARK_DIR)/benchmarks.bin
+BENCHMARK_RESULTS = $(BENCHMARK_OBJDIR)/results.json
+REPLAY_BIN = $(BENCHMARK_OBJDIR)/$(BENCHMARK_DIR)/replay.bin
+REPLAY_OUTPUT = $(BENCHMARK_OBJDIR)/replay_output
+REPLAY_REPORT = $(BENCHMARK_OBJDIR)/replay.json
+
+# Built like the unit tests, against the test platform, but optimized and
+# without coverage. The results are also left in $(BENCHMARK_RESULTS).
+benchmarks replay: LD = $(TEST_LD)
+benchmarks replay: CC = $(TEST_CC)
+benchmarks replay: CXX = $(TEST_CXX)
+benchmarks replay: CPPFLAGS = -I/usr/local -c -Wall -Werror -O2
+benchmarks replay: CFLAGS = $(CC_SUPRESSED_ERRORS) $(CFLAGS_STD)
+benchmarks replay: CXXFLAGS =  $(CXX_SUPRESSED_ERRORS) $(CXXFLAGS_STD)
+benchmarks replay: LDFLAGS = -lm $(TEST_HEAP_WRAP)
+benchmarks replay: LDLIBS = -lrt
+benchmarks replay: INCLUDE_PATHS += -I./tests/platform/
+benchmarks: $(BENCHMARK_BIN)
+	@./$(BENCHMARK_BIN) $(BENCHMARK_RESULTS) > /dev/null
+	@cat $(BENCHMARK_RESULTS)
+
+# Replay a CAN trace through the firmware, e.g. make replay TRACE=drive.log -
+# the USB output is left in $(REPLAY_OUTPUT) and the report in
+# $(REPLAY_REPORT).
+replay: $(REPLAY_BIN)
+	@test -n "$(TRACE)" || (echo "Set TRACE to the CAN log to replay" && false)
+	@./$(REPLAY_BIN) $(TRACE) $(REPLAY_REPORT) > $(REPLAY_OUTPUT)
+	@cat $(REPLAY_REPORT)
+
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, default_compile_test, DEBUG=0, code_generation_test))
 $(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_default_compile_test, DEBUG=0 MSD_ENABLE=1, code_generation_test))
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, diag_compile_test, DEBUG=0, diagnostic_code_generation_test))
@@ -129,9 +180,23 @@ $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, passthrough_compile_test, DEBUG=0, co
 $(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_passthrough_compile_test, DEBUG=0 MSD_ENABLE=1, copy_passthrough_signals))
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, emulator_compile_test, DEBUG=0 DEFAULT_EMULATED_DATA_STATUS=1, )) #empty emulator
 $(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_emulator_compile_test, DEBUG=0 DEFAULT_EMULATED_DATA_STATUS=1 MSD_ENABLE=1, )) #empty emulator
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, emulated_frames_compile_test, DEBUG=0 DEFAULT_EMULATED_DATA_STATUS=1 DEFAULT_EMULATED_FRAME_RATE=2000, code_generation_test))
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, stats_compile_test, DEFAULT_METRICS_STATUS=1 DEBUG=0, code_generation_test))
 $(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_stats_compile_test, DEFAULT_METRICS_STATUS=1 DEBUG=0 MSD_ENABLE=1, code_generation_test))
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, debug_stats_compile_test, DEBUG=1 DEFAULT_METRICS_STATUS=1, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, deferred_logging_compile_test, DEBUG=1 DEFERRED_LOGGING=1, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, no_metrics_compile_test, DEBUG=1 METRICS_SUPPORT=0, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, no_idle_sleep_compile_test, DEBUG=1 IDLE_SLEEP=0, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, benchmark_mode_compile_test, DEBUG=0 BENCHMARK_MODE_ONLY=1, code_generation_test))
+$(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_loadable_signals_compile_test, DEBUG=0 MSD_ENABLE=1 LOADABLE_SIGNAL_COUNT=64, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, can_capture_compile_test, DEBUG=0 CAN_CAPTURE_FRAME_COUNT=512, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, decode_profiles_compile_test, DEBUG=0 DECODE_PROFILE_COUNT=4, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, can_survey_compile_test, DEBUG=0 CAN_SURVEY_ID_COUNT=128, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, af_learn_compile_test, DEBUG=0 CAN_FILTER_LEARN_ID_COUNT=64, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, can_self_test_compile_test, DEBUG=0 CAN_SELF_TEST=1, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, j1939_compile_test, DEBUG=0 J1939_TP_SESSION_COUNT=4, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, snapshot_compile_test, DEBUG=0 SNAPSHOT_INTERVAL_S=3600, code_generation_test))
+$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, ordered_receive_compile_test, DEBUG=0 CAN_ORDERED_RECEIVE=1, code_generation_test))
 #no more MSD below here - can add later
 # TODO see https://github.com/openxc/vi-firmware/issues/189
 #$(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, network_compile_test, NETWORK=1, code_generation_test))
@@ -200,5 +265,17 @@ $(TEST_OBJDIR)/%.bin: $(TEST_OBJDIR)/%.o $(TEST_OBJS)
 	@mkdir -p $(dir $@)
 	$(LD) $(LDFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $^ $(LDLIBS)
 
+$(BENCHMARK_OBJDIR)/%.o: %.cpp .firmware_options
+	@mkdir -p $(dir $@)
+	$(CXX) $(CPPFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $<
+
+$(BENCHMARK_OBJDIR)/%.o: %.c .firmware_options
+	@mkdir -p $(dir $@)
+	$(CC) $(CPPFLAGS) $(CC_SYMBOLS) $(CFLAGS) $(INCLUDE_PATHS) -o $@ $<
+
+$(BENCHMARK_OBJDIR)/%.bin: $(BENCHMARK_OBJDIR)/%.o $(BENCHMARK_OBJS)
+	@mkdir -p $(dir $@)
+	$(LD) $(LDFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $^ $(LDLIBS)
+
 cppclean:
 	cppclean $(INCLUDE_PATHS) --exclude libs --exclude tests .  | grep -v "declared but not defined" | grep -v static
@@ -6,6 +6,9 @@
 using openxc::util::time::systemTimeMs;
 using openxc::util::time::FrequencyClock;
 using openxc::util::time::tick;
+using openxc::util::time::period;
+using openxc::util::time::setPhase;
+using openxc::util::time::phaseOffset;
 
 void setup() {
 }
@@ -101,6 +104,97 @@ START_TEST (test_nonconditional_tick)
 }
 END_TEST
 
+START_TEST (test_scaled_tick_waits_longer)
+{
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = timeMock;
+    clock.frequency = 1;
+    ck_assert(scaledConditionalTick(&clock, 0.5));
+
+    fakeTime += 1000;
+    ck_assert(!scaledConditionalTick(&clock, 0.5));
+    fakeTime += 1000;
+    ck_assert(scaledConditionalTick(&clock, 0.5));
+    ck_assert(clock.frequency == 1);
+
+    clock.frequency = 0;
+    ck_assert(scaledConditionalTick(&clock, 0.5));
+    ck_assert(scaledConditionalTick(&clock, 0.5));
+}
+END_TEST
+
+START_TEST (test_period_rounds_up_and_follows_frequency)
+{
+    FrequencyClock clock = {3};
+    clock.timeFunction = timeMock;
+    ck_assert_int_eq(period(&clock), 334);
+    ck_assert(conditionalTick(&clock));
+
+    fakeTime += 333;
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 1;
+    ck_assert(conditionalTick(&clock));
+
+    clock.frequency = 10;
+    ck_assert_int_eq(period(&clock), 100);
+    fakeTime += 100;
+    ck_assert(conditionalTick(&clock));
+
+    clock.frequency = 0;
+    ck_assert_int_eq(period(&clock), 0);
+    ck_assert(conditionalTick(&clock));
+}
+END_TEST
+
+START_TEST (test_phase_delays_next_tick)
+{
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = timeMock;
+    clock.frequency = 1;
+    setPhase(&clock, 250);
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 249;
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 1;
+    ck_assert(conditionalTick(&clock));
+    fakeTime += 999;
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 1;
+    ck_assert(conditionalTick(&clock));
+
+    setPhase(&clock, 0);
+    ck_assert(conditionalTick(&clock));
+    setPhase(&clock, 1250);
+    fakeTime += 249;
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 1;
+    ck_assert(conditionalTick(&clock));
+}
+END_TEST
+
+START_TEST (test_phase_ignores_unlimited_clock)
+{
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = timeMock;
+    setPhase(&clock, 250);
+    ck_assert_int_eq(clock.lastTick, 0);
+    ck_assert(conditionalTick(&clock));
+}
+END_TEST
+
+START_TEST (test_phase_offsets_spread_evenly)
+{
+    ck_assert_int_eq(phaseOffset(0, 4, 1000), 0);
+    ck_assert_int_eq(phaseOffset(1, 4, 1000), 250);
+    ck_assert_int_eq(phaseOffset(3, 4, 1000), 750);
+    ck_assert_int_eq(phaseOffset(2, 3, 100), 66);
+    ck_assert_int_eq(phaseOffset(0, 0, 100), 0);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("timer");
     TCase *tc_core = tcase_create("core");
@@ -111,6 +205,11 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_first_tick_always_true);
     tcase_add_test(tc_core, test_staggered_not_true_at_start);
     tcase_add_test(tc_core, test_nonconditional_tick);
+    tcase_add_test(tc_core, test_scaled_tick_waits_longer);
+    tcase_add_test(tc_core, test_period_rounds_up_and_follows_frequency);
+    tcase_add_test(tc_core, test_phase_delays_next_tick);
+    tcase_add_test(tc_core, test_phase_ignores_unlimited_clock);
+    tcase_add_test(tc_core, test_phase_offsets_spread_evenly);
     suite_add_tcase(s, tc_core);
 
     return s;
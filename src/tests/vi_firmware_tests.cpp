@@ -1,14 +1,24 @@
 #include <check.h>
 #include <stdint.h>
 #include "signals.h"
+#include "can/canqueue.h"
+#include "can/canwrite.h"
 #include "diagnostics.h"
 #include "lights.h"
 #include "config.h"
 #include "pipeline.h"
 #include "power.h"
+#include "power_spy.h"
+#include "data_emulator.h"
+#include "message_sets.h"
+#include "signal_loader.h"
+#include <string.h>
 
+namespace can = openxc::can;
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
+namespace power = openxc::power;
+namespace loader = openxc::signals::loader;
 
 using openxc::pipeline::Pipeline;
 using openxc::signals::getCanBuses;
@@ -21,6 +31,8 @@ extern unsigned long FAKE_TIME;
 // TODO this should be refactored out of vi_firmware.cpp, and include a header
 // file so we don't have to use extern.
 extern void receiveCan(Pipeline* pipeline, CanBus* bus);
+extern void receiveCanInOrder(Pipeline* pipeline, CanBus* buses,
+        const int busCount);
 extern void checkBusActivity();
 extern void initializeVehicleInterface();
 extern void firmwareLoop();
@@ -31,6 +43,7 @@ static bool canQueueEmpty(int bus) {
 }
 
 void setup() {
+    loader::load(NULL, 0);
     initializeVehicleInterface();
     fail_unless(canQueueEmpty(0));
 }
@@ -44,7 +57,7 @@ CanMessage message = {
 START_TEST (test_update_data_lights_can_active)
 {
     CanBus* bus = &getCanBuses()[0];
-    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    can::queue::push(&bus->receiveQueue, &message);
     receiveCan(&getConfiguration()->pipeline, bus);
 
     checkBusActivity();
@@ -61,7 +74,7 @@ START_TEST (test_update_data_lights_can_inactive)
                 openxc::lights::COLORS.red));
 
     CanBus* bus = &getCanBuses()[0];
-    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    can::queue::push(&bus->receiveQueue, &message);
     receiveCan(&getConfiguration()->pipeline, bus);
 
     FAKE_TIME += (openxc::can::CAN_ACTIVE_TIMEOUT_S * 1000) * 2;
@@ -72,7 +85,7 @@ END_TEST
 START_TEST (test_update_data_lights_suspend)
 {
     CanBus* bus = &getCanBuses()[0];
-    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    can::queue::push(&bus->receiveQueue, &message);
     receiveCan(&getConfiguration()->pipeline, bus);
 
     FAKE_TIME += (openxc::can::CAN_ACTIVE_TIMEOUT_S * 1000) * 2;
@@ -89,12 +102,303 @@ START_TEST (test_update_data_lights_suspend)
 }
 END_TEST
 
+START_TEST (test_early_can_replayed_once_outputs_ready)
+{
+    CanBus* bus = &getCanBuses()[0];
+    unsigned int received = bus->messagesReceived;
+    ck_assert(getConfiguration()->runLevel !=
+            openxc::config::RunLevel::ALL_IO);
+
+    can::queue::push(&bus->receiveQueue, &message);
+    firmwareLoop();
+    ck_assert(can::queue::empty(&bus->receiveQueue));
+    ck_assert_int_eq(bus->messagesReceived, received);
+
+    while(getConfiguration()->runLevel != openxc::config::RunLevel::ALL_IO) {
+        firmwareLoop();
+    }
+    firmwareLoop();
+    ck_assert_int_eq(bus->messagesReceived, received + 1);
+}
+END_TEST
+
+START_TEST (test_receive_can_batch_limit)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->maxReceiveBatchSize = 2;
+    for(int i = 0; i < 3; i++) {
+        can::queue::push(&bus->receiveQueue, &message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(can::queue::length(&bus->receiveQueue), 1);
+    ck_assert_int_eq(bus->lastReceiveBatchSize, 2);
+
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert(can::queue::empty(&bus->receiveQueue));
+    ck_assert_int_eq(bus->lastReceiveBatchSize, 1);
+    bus->maxReceiveBatchSize = 0;
+}
+END_TEST
+
+START_TEST (test_receive_can_batch_default)
+{
+    CanBus* bus = &getCanBuses()[0];
+    for(int i = 0; i < DEFAULT_CAN_RECEIVE_BATCH_SIZE; i++) {
+        can::queue::push(&bus->receiveQueue, &message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert(can::queue::empty(&bus->receiveQueue));
+    ck_assert_int_eq(bus->lastReceiveBatchSize,
+            DEFAULT_CAN_RECEIVE_BATCH_SIZE);
+}
+END_TEST
+
+static void pushAt(CanBus* bus, uint32_t id, unsigned long receivedUs) {
+    CanMessage frame = message;
+    frame.id = id;
+    frame.receivedUs = receivedUs;
+    can::queue::push(&bus->receiveQueue, &frame);
+}
+
+START_TEST (test_receive_can_in_order)
+{
+    getConfiguration()->payloadFormat = openxc::payload::PayloadFormat::JSON;
+    usb::initialize(&getConfiguration()->usb);
+    getConfiguration()->usb.configured = true;
+    CanBus* first = &getCanBuses()[0];
+    CanBus* second = &getCanBuses()[1];
+    first->passthroughCanMessages = true;
+    second->passthroughCanMessages = true;
+
+    pushAt(first, 0x701, 100);
+    pushAt(first, 0x703, 300);
+    pushAt(second, 0x702, 200);
+    receiveCanInOrder(&getConfiguration()->pipeline, getCanBuses(),
+            getCanBusCount());
+    ck_assert(can::queue::empty(&first->receiveQueue));
+    ck_assert(can::queue::empty(&second->receiveQueue));
+    ck_assert_int_eq(first->lastReceiveBatchSize, 2);
+    ck_assert_int_eq(second->lastReceiveBatchSize, 1);
+
+    ByteQueue* output = &getConfiguration()->usb.endpoints[
+            IN_ENDPOINT_INDEX].queue;
+    char json[512] = {0};
+    BYTE_QUEUE_SNAPSHOT(output, (uint8_t*) json, sizeof(json) - 1);
+    int length = BYTE_QUEUE_LENGTH(output);
+    for(int i = 0; i < length && i < (int) sizeof(json) - 1; i++) {
+        if(json[i] == '\0') {
+            json[i] = ' ';
+        }
+    }
+    const char* firstFrame = strstr(json, "\"id\":1793");
+    const char* secondFrame = strstr(json, "\"id\":1794");
+    const char* thirdFrame = strstr(json, "\"id\":1795");
+    ck_assert(firstFrame != NULL && secondFrame != NULL && thirdFrame != NULL);
+    ck_assert(firstFrame < secondFrame);
+    ck_assert(secondFrame < thirdFrame);
+
+    first->passthroughCanMessages = false;
+    second->passthroughCanMessages = false;
+}
+END_TEST
+
+START_TEST (test_emulated_frames_paced)
+{
+    CanBus* bus = &getCanBuses()[0];
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert(can::queue::empty(&bus->receiveQueue));
+
+    openxc::emulator::restart();
+    ck_assert_int_eq(openxc::emulator::generateFakeCanFrames(getCanBuses(),
+                getCanBusCount(), 1000, 100), 0);
+    FAKE_TIME += 10;
+    ck_assert_int_eq(openxc::emulator::generateFakeCanFrames(getCanBuses(),
+                getCanBusCount(), 1000, 100), 10);
+    ck_assert_int_eq(can::queue::length(&bus->receiveQueue), 10);
+    ck_assert_int_eq(openxc::emulator::generateFakeCanFrames(getCanBuses(),
+                getCanBusCount(), 1000, 100), 0);
+}
+END_TEST
+
+START_TEST (test_switch_message_set_keeps_received_frames)
+{
+    CanBus* previous = &getCanBuses()[0];
+    can::queue::push(&previous->receiveQueue, &message);
+
+    ck_assert(openxc::signals::sets::resident(1));
+    ck_assert(openxc::signals::sets::activate(1));
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 1);
+    ck_assert(getCanBuses() != previous);
+    ck_assert(can::queue::empty(&previous->receiveQueue));
+    ck_assert_int_eq(can::queue::length(&getCanBuses()[0].receiveQueue), 1);
+
+    ck_assert(openxc::signals::sets::activate(0));
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 0);
+    ck_assert_int_eq(can::queue::length(&previous->receiveQueue), 1);
+    receiveCan(&getConfiguration()->pipeline, previous);
+}
+END_TEST
+
+START_TEST (test_switch_to_missing_message_set)
+{
+    ck_assert(!openxc::signals::sets::activate(5));
+    ck_assert_int_eq(getConfiguration()->messageSetIndex, 0);
+}
+END_TEST
+
+// One message, 0x7a on bus 1, with a numeric signal in the first byte and a
+// state signal in the second.
+static uint8_t SIGNAL_DEFINITIONS[128];
+
+static void writeLittleEndian(uint8_t* buffer, uint32_t value, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void writeFloat(uint8_t* buffer, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    writeLittleEndian(buffer, bits, sizeof(bits));
+}
+
+static size_t buildSignalDefinitions() {
+    uint8_t* image = SIGNAL_DEFINITIONS;
+    memset(image, 0, sizeof(SIGNAL_DEFINITIONS));
+    writeLittleEndian(&image[0], SIGNAL_DEFINITIONS_MAGIC, 4);
+    image[4] = SIGNAL_DEFINITIONS_VERSION;
+    writeLittleEndian(&image[6], 1, 2);
+    writeLittleEndian(&image[8], 2, 2);
+    writeLittleEndian(&image[10], 2, 2);
+
+    uint8_t* record = &image[SIGNAL_DEFINITIONS_HEADER_SIZE];
+    writeLittleEndian(&record[0], 0x7a, 4);
+    record[4] = 1;
+    record += SIGNAL_DEFINITION_MESSAGE_SIZE;
+
+    size_t names = SIGNAL_DEFINITIONS_HEADER_SIZE +
+            SIGNAL_DEFINITION_MESSAGE_SIZE +
+            2 * SIGNAL_DEFINITION_SIGNAL_SIZE +
+            2 * SIGNAL_DEFINITION_STATE_SIZE;
+    const char* strings[] = {"loaded_speed", "loaded_gear", "first", "second"};
+    size_t offsets[4];
+    size_t end = names;
+    for(int i = 0; i < 4; i++) {
+        offsets[i] = end;
+        strcpy((char*) &image[end], strings[i]);
+        end += strlen(strings[i]) + 1;
+    }
+
+    for(int i = 0; i < 2; i++) {
+        writeLittleEndian(&record[2], offsets[i], 2);
+        record[4] = i * 8;
+        record[5] = 8;
+        record[6] = i == 0 ? loader::SIGNAL_DEFINITION_NUMERIC :
+                loader::SIGNAL_DEFINITION_STATE;
+        writeFloat(&record[8], 1);
+        writeFloat(&record[20], 255);
+        record[30] = i == 0 ? 0 : 2;
+        record += SIGNAL_DEFINITION_SIGNAL_SIZE;
+    }
+
+    for(int i = 0; i < 2; i++) {
+        writeLittleEndian(&record[0], i + 1, 4);
+        writeLittleEndian(&record[4], offsets[i + 2], 2);
+        record += SIGNAL_DEFINITION_STATE_SIZE;
+    }
+
+    writeLittleEndian(&image[12], end, 4);
+    return end;
+}
+
+START_TEST (test_decode_with_loaded_signal_definitions)
+{
+    size_t length = buildSignalDefinitions();
+    ck_assert(loader::load(SIGNAL_DEFINITIONS, length));
+    ck_assert(loader::loaded());
+    ck_assert_int_eq(loader::getSignalCount(), 2);
+
+    CanSignal* signals = loader::getSignals();
+    ck_assert_str_eq(signals[0].genericName, "loaded_speed");
+    ck_assert(signals[0].genericName >= (char*) SIGNAL_DEFINITIONS &&
+            signals[0].genericName < (char*) SIGNAL_DEFINITIONS + length);
+
+    CanBus* bus = &getCanBuses()[0];
+    CanMessage frame = {
+        id: 0x7a,
+        format: CanMessageFormat::STANDARD,
+        data: {0x2a, 0x2}
+    };
+    can::queue::push(&bus->receiveQueue, &frame);
+    receiveCan(&getConfiguration()->pipeline, bus);
+
+    ck_assert(signals[0].received);
+    ck_assert_int_eq(signals[0].lastValue, 42);
+    ck_assert(signals[1].received);
+    ck_assert_int_eq(signals[1].lastValue, 2);
+}
+END_TEST
+
+START_TEST (test_reject_malformed_signal_definitions)
+{
+    size_t length = buildSignalDefinitions();
+    ck_assert(!loader::load(SIGNAL_DEFINITIONS, length - 1));
+    ck_assert(!loader::loaded());
+
+    // a message on a bus that isn't in the active message set
+    SIGNAL_DEFINITIONS[SIGNAL_DEFINITIONS_HEADER_SIZE + 4] = 9;
+    ck_assert(!loader::load(SIGNAL_DEFINITIONS, length));
+    ck_assert(!loader::loaded());
+}
+END_TEST
+
+START_TEST (test_receive_signal_definitions_in_chunks)
+{
+    size_t length = buildSignalDefinitions();
+    ck_assert(loader::receive(0, SIGNAL_DEFINITIONS, 20));
+    ck_assert(!loader::loaded());
+    ck_assert(!loader::receive(30,
+                &SIGNAL_DEFINITIONS[30], length - 30));
+    ck_assert(loader::receive(20, &SIGNAL_DEFINITIONS[20],
+                length - 20));
+    ck_assert(loader::loaded());
+    ck_assert_str_eq(loader::getSignals()[1].genericName,
+            "loaded_gear");
+}
+END_TEST
+
 START_TEST (test_loop)
 {
     firmwareLoop();
 }
 END_TEST
 
+START_TEST (test_loop_sleeps_when_idle)
+{
+    while(getConfiguration()->runLevel != openxc::config::RunLevel::ALL_IO) {
+        firmwareLoop();
+    }
+    int waits = power::spy::getInterruptWaitCount();
+    firmwareLoop();
+    ck_assert_int_eq(power::spy::getInterruptWaitCount(), waits + 1);
+}
+END_TEST
+
+START_TEST (test_loop_stays_awake_with_pending_writes)
+{
+    // The test platform's controller never accepts a write, so it stays
+    // pending until its deadline
+    CanBus* bus = &getCanBuses()[0];
+    bus->writeHandler = openxc::can::write::sendMessage;
+    can::write::enqueueMessage(bus, &message);
+    int waits = power::spy::getInterruptWaitCount();
+    firmwareLoop();
+    ck_assert_int_eq(power::spy::getInterruptWaitCount(), waits);
+    bus->writeHandler = NULL;
+    bus->pendingWriteCount = 0;
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("firmware");
     TCase *tc_core = tcase_create("core");
@@ -102,8 +406,20 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_update_data_lights_can_active);
     tcase_add_test(tc_core, test_update_data_lights_can_inactive);
     tcase_add_test(tc_core, test_update_data_lights_suspend);
+    tcase_add_test(tc_core, test_early_can_replayed_once_outputs_ready);
+    tcase_add_test(tc_core, test_receive_can_batch_limit);
+    tcase_add_test(tc_core, test_receive_can_batch_default);
+    tcase_add_test(tc_core, test_receive_can_in_order);
+    tcase_add_test(tc_core, test_emulated_frames_paced);
+    tcase_add_test(tc_core, test_switch_message_set_keeps_received_frames);
+    tcase_add_test(tc_core, test_switch_to_missing_message_set);
+    tcase_add_test(tc_core, test_decode_with_loaded_signal_definitions);
+    tcase_add_test(tc_core, test_reject_malformed_signal_definitions);
+    tcase_add_test(tc_core, test_receive_signal_definitions_in_chunks);
 
     tcase_add_test(tc_core, test_loop);
+    tcase_add_test(tc_core, test_loop_sleeps_when_idle);
+    tcase_add_test(tc_core, test_loop_stays_awake_with_pending_writes);
 
     suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,141 @@
+#include <check.h>
+#include <stdint.h>
+
+#include "util/wall_clock.h"
+
+namespace wallclock = openxc::util::wallclock;
+
+extern unsigned long FAKE_TIME;
+
+void setup() {
+    FAKE_TIME = 1000;
+    wallclock::reset();
+}
+
+START_TEST (test_not_set)
+{
+    uint64_t timeUs;
+    ck_assert(!wallclock::now(&timeUs));
+}
+END_TEST
+
+START_TEST (test_counts_local_time)
+{
+    uint64_t start = wallclock::localTimeUs();
+    FAKE_TIME += 1500;
+    ck_assert_int_eq(wallclock::localTimeUs() - start, 1500000);
+}
+END_TEST
+
+START_TEST (test_set_from_seconds)
+{
+    wallclock::setFromSeconds(1000000);
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    // Somewhere in the second the RTC read
+    ck_assert(timeUs >= 1000000000000ULL && timeUs < 1000001000000ULL);
+
+    FAKE_TIME += 2000;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert(timeUs >= 1000002000000ULL && timeUs < 1000003000000ULL);
+}
+END_TEST
+
+START_TEST (test_seconds_narrow_offset)
+{
+    // The second ticked over between these two readings, 400ms apart, so
+    // it's somewhere in those 400ms
+    wallclock::setFromSeconds(1000000);
+    FAKE_TIME += 400;
+    wallclock::setFromSeconds(1000001);
+
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert(timeUs >= 1000001000000ULL && timeUs < 1000001400000ULL);
+}
+END_TEST
+
+START_TEST (test_seconds_step)
+{
+    wallclock::setFromSeconds(1000000);
+    FAKE_TIME += 100;
+    wallclock::setFromSeconds(2000000);
+
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert(timeUs >= 2000000000000ULL && timeUs < 2000001000000ULL);
+}
+END_TEST
+
+START_TEST (test_synchronize)
+{
+    uint64_t receivedUs = wallclock::localTimeUs();
+    FAKE_TIME += 2;
+    uint64_t sentUs = wallclock::localTimeUs();
+    // 10ms each way, with the host's clock 5s ahead of the local time when
+    // the request arrived
+    uint64_t hostSentUs = receivedUs + 5000000 - 10000;
+    uint64_t hostReceivedUs = sentUs + 5000000 + 10000;
+    ck_assert(wallclock::synchronize(hostSentUs, receivedUs, sentUs,
+                hostReceivedUs));
+    ck_assert(wallclock::hostSynchronized());
+
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert_int_eq(timeUs, sentUs + 5000000);
+}
+END_TEST
+
+START_TEST (test_synchronize_inconsistent)
+{
+    uint64_t receivedUs = wallclock::localTimeUs();
+    FAKE_TIME += 20;
+    uint64_t sentUs = wallclock::localTimeUs();
+    // A 10ms round trip can't include 20ms of the VI replying
+    ck_assert(!wallclock::synchronize(5000000, receivedUs, sentUs, 5010000));
+    uint64_t timeUs;
+    ck_assert(!wallclock::now(&timeUs));
+}
+END_TEST
+
+START_TEST (test_seconds_ignored_once_synchronized)
+{
+    uint64_t localUs = wallclock::localTimeUs();
+    ck_assert(wallclock::synchronize(3000000000000ULL, localUs, localUs,
+                3000000000000ULL));
+    wallclock::setFromSeconds(1000000);
+
+    uint64_t timeUs;
+    ck_assert(wallclock::now(&timeUs));
+    ck_assert(timeUs == 3000000000000ULL);
+}
+END_TEST
+
+Suite* wallClockSuite(void) {
+    Suite* s = suite_create("wall_clock");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_not_set);
+    tcase_add_test(tc_core, test_counts_local_time);
+    tcase_add_test(tc_core, test_set_from_seconds);
+    tcase_add_test(tc_core, test_seconds_narrow_offset);
+    tcase_add_test(tc_core, test_seconds_step);
+    tcase_add_test(tc_core, test_synchronize);
+    tcase_add_test(tc_core, test_synchronize_inconsistent);
+    tcase_add_test(tc_core, test_seconds_ignored_once_synchronized);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = wallClockSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
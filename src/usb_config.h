@@ -21,17 +21,30 @@ extern "C" {
 #define OUT_ENDPOINT_NUMBER 5
 #define LOG_ENDPOINT_NUMBER 11
 #define INTERFACE_COUNT 1
+#ifdef FS_SUPPORT
+// Streams log files off the SD card while it's logging (see fs::startStream)
+#define FILE_ENDPOINT_NUMBER 14
+#define ENDPOINT_COUNT 4
+#else
 #define ENDPOINT_COUNT 3
+#endif
 // Take note - this is not the *number of endpoints* but the highest endpoint
 // number used, e.g. we have 2 endpoints but one is 5 and the other is 11 - this
 // must be 11!
+#ifdef FS_SUPPORT
+#define MAX_ENDPOINT_NUMBER 14
+#else
 #define MAX_ENDPOINT_NUMBER 11
+#endif
 #define CONTROL_ENDPOINT_SIZE 64
 #define DATA_ENDPOINT_SIZE 64
 
 #define IN_ENDPOINT_INDEX 0
 #define OUT_ENDPOINT_INDEX 1
 #define LOG_ENDPOINT_INDEX 2
+#ifdef FS_SUPPORT
+#define FILE_ENDPOINT_INDEX 3
+#endif
 
 // Ford Motor Company USB Vendor ID
 #define VENDOR_ID 0x1bc4
@@ -1,51 +1,346 @@
 #include "bytebuffer.h"
 #include "strutil.h"
 #include "util/log.h"
-
-QUEUE_DEFINE(uint8_t)
+#include <string.h>
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::IncomingMessageCallback;
+using openxc::util::bytebuffer::FrameScanner;
+using openxc::util::bytebuffer::FrameType;
+using openxc::util::bytebuffer::popBytes;
+using openxc::payload::PayloadFormat;
 
-bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
-        IncomingMessageCallback callback) {
-    int length = QUEUE_LENGTH(uint8_t, queue);
-    if(length == 0) {
-        return false;
+// The longest varint length prefix for a message that could fit in a queue.
+#define MAX_LENGTH_PREFIX_SIZE 5
+
+FrameType openxc::util::bytebuffer::frameType(PayloadFormat format) {
+    switch(format) {
+        case PayloadFormat::JSON:
+            return FrameType::NULL_DELIMITED;
+        case PayloadFormat::PROTOBUF:
+            return FrameType::LENGTH_PREFIXED;
+        default:
+            return FrameType::UNFRAMED;
+    }
+}
+
+/* Private: Continue a CRC-16/CCITT (polynomial 0x1021) over one more byte, a
+ * nibble at a time so the table stays small.
+ */
+static uint16_t updateCrc16(uint16_t crc, uint8_t byte) {
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+    };
+    crc = (crc << 4) ^ table[(crc >> 12) ^ (byte >> 4)];
+    crc = (crc << 4) ^ table[(crc >> 12) ^ (byte & 0xf)];
+    return crc;
+}
+
+int openxc::util::bytebuffer::wrapCheckedFrame(const uint8_t* message,
+        int messageSize, uint8_t* frame, int frameSize) {
+    if(messageSize < 0 || messageSize > 0xffff ||
+            messageSize + CHECKED_FRAME_OVERHEAD > frameSize) {
+        return 0;
+    }
+
+    frame[0] = CHECKED_FRAME_SYNC_1;
+    frame[1] = CHECKED_FRAME_SYNC_2;
+    frame[2] = messageSize & 0xff;
+    frame[3] = messageSize >> 8;
+    memcpy(&frame[CHECKED_FRAME_HEADER_SIZE], message, messageSize);
+
+    uint16_t crc = 0xffff;
+    for(int i = 2; i < CHECKED_FRAME_HEADER_SIZE + messageSize; i++) {
+        crc = updateCrc16(crc, frame[i]);
+    }
+    frame[CHECKED_FRAME_HEADER_SIZE + messageSize] = crc >> 8;
+    frame[CHECKED_FRAME_HEADER_SIZE + messageSize + 1] = crc & 0xff;
+    return messageSize + CHECKED_FRAME_OVERHEAD;
+}
+
+static void resetScanner(FrameScanner* scanner, FrameType type) {
+    scanner->type = type;
+    scanner->scanned = 0;
+    scanner->frameLength = 0;
+    scanner->prefix = 0;
+}
+
+static void copyOut(ByteQueue* queue, int start, uint8_t* destination,
+        int length);
+
+/* Private: Returns the byte at offset from the front of the queue.
+ */
+static uint8_t byteAt(ByteQueue* queue, int offset) {
+    int index = queue->head + offset;
+    return queue->elements[index < queue->size ? index : index - queue->size];
+}
+
+/* Private: Examine the bytes of the queue that the scanner hasn't seen yet.
+ *
+ * Returns the length of the complete message at the front of the queue, or 0
+ * if there isn't one yet.
+ */
+static int scanFrame(ByteQueue* queue, FrameScanner* scanner,
+        int length) {
+    switch(scanner->type) {
+    case FrameType::NULL_DELIMITED:
+        for(; scanner->scanned < length; ++scanner->scanned) {
+            if(byteAt(queue, scanner->scanned) == '\0') {
+                scanner->frameLength = scanner->scanned + 1;
+                break;
+            }
+        }
+        break;
+    case FrameType::LENGTH_PREFIXED:
+        while(scanner->frameLength == 0 && scanner->scanned < length) {
+            uint8_t byte = byteAt(queue, scanner->scanned);
+            scanner->prefix |= (uint32_t)(byte & 0x7f) <<
+                    (7 * scanner->scanned);
+            ++scanner->scanned;
+            if(!(byte & 0x80)) {
+                scanner->frameLength = scanner->scanned + scanner->prefix;
+            } else if(scanner->scanned >= MAX_LENGTH_PREFIX_SIZE) {
+                debug("Incoming length prefix is corrupt - dropping it");
+                scanner->frameLength = scanner->scanned;
+            }
+        }
+        break;
+    case FrameType::CHECKED:
+        // see processCheckedFrame
+        break;
+    case FrameType::UNFRAMED:
+        // Without a delimiter, the only way to know if the message is complete
+        // is to parse it - but only when something new has arrived.
+        return length > scanner->scanned ? length : 0;
+    }
+
+    return scanner->frameLength > 0 && scanner->frameLength <= length ?
+            scanner->frameLength : 0;
+}
+
+/* Private: Pass a message to the callback, straight from the queue's storage
+ * unless it wraps around the end of the ring.
+ */
+static size_t passToCallback(ByteQueue* queue, int offset,
+        int length, IncomingMessageCallback callback) {
+    int start = queue->head + offset;
+    if(start >= queue->size) {
+        start -= queue->size;
+    }
+    if(start + length <= queue->size) {
+        return callback(&queue->elements[start], length);
+    }
+
+    uint8_t message[length];
+    copyOut(queue, start, message, length);
+    return callback(message, length);
+}
+
+/* Private: Returns true if the CRC at the end of the CHECKED frame at the front
+ * of the queue matches its contents.
+ */
+static bool checkedFrameValid(ByteQueue* queue, int frameLength) {
+    uint16_t crc = 0xffff;
+    int end = frameLength - 2;
+    for(int i = 2; i < end; i++) {
+        crc = updateCrc16(crc, byteAt(queue, i));
+    }
+    return crc == ((byteAt(queue, end) << 8) | byteAt(queue, end + 1));
+}
+
+/* Private: Look for a complete, valid CHECKED frame at the front of the queue,
+ * discarding anything in front of it, and pass its payload to the callback.
+ * The scanner's frameLength is the length of the frame whose header is at the
+ * front of the queue, once it's been read.
+ *
+ * Returns the length of the frame removed from the queue, or 0 if there isn't
+ * a whole one yet.
+ */
+static size_t processCheckedFrame(ByteQueue* queue,
+        FrameScanner* scanner, IncomingMessageCallback callback) {
+    while(true) {
+        int length = BYTE_QUEUE_LENGTH(queue);
+        if(scanner->frameLength == 0) {
+            int skip = 0;
+            while(skip < length && !(byteAt(queue, skip) ==
+                        CHECKED_FRAME_SYNC_1 && (skip + 1 == length ||
+                        byteAt(queue, skip + 1) == CHECKED_FRAME_SYNC_2))) {
+                ++skip;
+            }
+            if(skip > 0) {
+                popBytes(queue, NULL, skip);
+                length -= skip;
+            }
+            if(length < CHECKED_FRAME_HEADER_SIZE) {
+                return 0;
+            }
+
+            int payloadLength = byteAt(queue, 2) | (byteAt(queue, 3) << 8);
+            if(!openxc::util::bytebuffer::messageCanFit(queue,
+                        payloadLength + CHECKED_FRAME_OVERHEAD)) {
+                // can't be a real frame, so look for the next one
+                popBytes(queue, NULL, 1);
+                continue;
+            }
+            scanner->frameLength = payloadLength + CHECKED_FRAME_OVERHEAD;
+            scanner->scanned = CHECKED_FRAME_HEADER_SIZE;
+        }
+
+        int frameLength = scanner->frameLength;
+        if(length < frameLength) {
+            return 0;
+        }
+
+        scanner->frameLength = 0;
+        scanner->scanned = 0;
+        if(!checkedFrameValid(queue, frameLength)) {
+            debug("Incoming frame failed its CRC - resynchronizing");
+            popBytes(queue, NULL, 1);
+            continue;
+        }
+
+        if(passToCallback(queue, CHECKED_FRAME_HEADER_SIZE,
+                    frameLength - CHECKED_FRAME_OVERHEAD, callback) == 0) {
+            debug("Dropping incoming %d byte message that didn't parse",
+                    frameLength - CHECKED_FRAME_OVERHEAD);
+        }
+        popBytes(queue, NULL, frameLength);
+        return frameLength;
     }
+}
 
-    uint8_t snapshot[length];
-    QUEUE_SNAPSHOT(uint8_t, queue, snapshot, length);
+bool openxc::util::bytebuffer::processQueue(ByteQueue* queue,
+        FrameScanner* scanner, FrameType type,
+        IncomingMessageCallback callback) {
     if(callback == NULL) {
         debug("Callback is NULL (%p) -- unable to handle queue at %p",
                 callback, queue);
         return false;
     }
 
-    size_t parsedLength = callback(snapshot, length);
-    for(size_t i = 0; i < parsedLength; i++) {
-        QUEUE_POP(uint8_t, queue);
+    int length = BYTE_QUEUE_LENGTH(queue);
+    // Start over if the framing changed or the queue was emptied under us
+    if(scanner->type != type || scanner->scanned > length) {
+        resetScanner(scanner, type);
+    }
+
+    size_t parsedLength = 0;
+    int frameLength = 0;
+    if(type == FrameType::CHECKED) {
+        parsedLength = processCheckedFrame(queue, scanner, callback);
+    } else if(length > 0) {
+        frameLength = scanFrame(queue, scanner, length);
     }
+    if(frameLength > 0) {
+        parsedLength = passToCallback(queue, 0, frameLength, callback);
 
-    if(QUEUE_FULL(uint8_t, queue)) {
+        if(type == FrameType::UNFRAMED) {
+            // Don't parse these same bytes again until more arrive
+            scanner->scanned = parsedLength > 0 ? 0 : length;
+        } else {
+            if(parsedLength == 0) {
+                debug("Dropping incoming %d byte message that didn't parse",
+                        frameLength);
+                parsedLength = frameLength;
+            }
+            resetScanner(scanner, type);
+        }
+        popBytes(queue, NULL, parsedLength);
+    }
+
+    if(BYTE_QUEUE_FULL(queue)) {
         debug("Incoming write is too long - dumping queue");
-        QUEUE_INIT(uint8_t, queue);
+        BYTE_QUEUE_RESET(queue);
+        resetScanner(scanner, type);
     }
     return parsedLength > 0;
 }
 
-bool openxc::util::bytebuffer::messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
+bool openxc::util::bytebuffer::processQueue(ByteQueue* queue,
+        IncomingMessageCallback callback) {
+    FrameScanner scanner = {FrameType::UNFRAMED, 0, 0, 0};
+    if(BYTE_QUEUE_EMPTY(queue)) {
+        return false;
+    }
+    return processQueue(queue, &scanner, FrameType::UNFRAMED, callback);
+}
+
+bool openxc::util::bytebuffer::messageFits(ByteQueue* queue, uint8_t* message,
         int messageSize) {
-    return queue != NULL && QUEUE_AVAILABLE(uint8_t, queue) >= messageSize + 2;
+    return queue != NULL && BYTE_QUEUE_AVAILABLE(queue) >= messageSize + 2;
 }
 
-bool openxc::util::bytebuffer::conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
+bool openxc::util::bytebuffer::messageCanFit(ByteQueue* queue,
         int messageSize) {
-    if(messageFits(queue, message, messageSize)) {
-        for(int i = 0; i < messageSize; i++) {
-            QUEUE_PUSH(uint8_t, queue, (uint8_t)message[i]);
-        }
-        return true;
+    return queue != NULL && BYTE_QUEUE_CAPACITY(queue) >= messageSize + 2;
+}
+
+bool openxc::util::bytebuffer::conditionalEnqueue(ByteQueue* queue, uint8_t* message,
+        int messageSize) {
+    return messageFits(queue, message, messageSize) &&
+            pushBytes(queue, message, messageSize);
+}
+
+/* Private: Copy length bytes out of the ring starting at start, wrapping
+ * around the end of the ring if necessary.
+ */
+static void copyOut(ByteQueue* queue, int start, uint8_t* destination,
+        int length) {
+    int firstRun = queue->size - start;
+    if(firstRun > length) {
+        firstRun = length;
+    }
+    memcpy(destination, &queue->elements[start], firstRun);
+    memcpy(destination + firstRun, queue->elements, length - firstRun);
+}
+
+bool openxc::util::bytebuffer::pushBytes(ByteQueue* queue,
+        const uint8_t* data, int length) {
+    if(queue == NULL || length < 0 ||
+            BYTE_QUEUE_AVAILABLE(queue) < length) {
+        return false;
+    }
+
+    int tail = queue->tail;
+    int firstRun = queue->size - tail;
+    if(firstRun > length) {
+        firstRun = length;
+    }
+    memcpy(&queue->elements[tail], data, firstRun);
+    memcpy(queue->elements, data + firstRun, length - firstRun);
+    tail += length;
+    queue->tail = tail < queue->size ? tail : tail - queue->size;
+    return true;
+}
+
+int openxc::util::bytebuffer::peekBytes(ByteQueue* queue,
+        uint8_t* destination, int length) {
+    int available = BYTE_QUEUE_LENGTH(queue);
+    if(length > available) {
+        length = available;
+    }
+    if(length > 0) {
+        copyOut(queue, queue->head, destination, length);
+    }
+    return length > 0 ? length : 0;
+}
+
+int openxc::util::bytebuffer::popBytes(ByteQueue* queue,
+        uint8_t* destination, int length) {
+    int available = BYTE_QUEUE_LENGTH(queue);
+    if(length > available) {
+        length = available;
+    }
+    if(length <= 0) {
+        return 0;
+    }
+
+    int head = queue->head;
+    if(destination != NULL) {
+        copyOut(queue, head, destination, length);
     }
-    return false;
+    head += length;
+    queue->head = head < queue->size ? head : head - queue->size;
+    return length;
 }
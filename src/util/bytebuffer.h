@@ -3,13 +3,127 @@
 
 #include "emqueue.h"
 #include "commands/commands.h"
+#include "payload/payload.h"
 
-QUEUE_DECLARE(uint8_t, 512)
+/* Public: A single-producer, single-consumer ring of bytes, for the send and
+ * receive queues of the interfaces.
+ *
+ * The storage isn't part of the type, as it is for an emqueue queue, so each
+ * interface can size each direction for what it has to absorb (see config.cpp)
+ * while everything that fills and drains the queues only needs a ByteQueue*.
+ * Like an emqueue queue, the ring is one byte longer than the capacity so a
+ * full queue can be told apart from an empty one. A queue that was never given
+ * storage is always empty and has no room.
+ *
+ * head - the offset in 'elements' of the next byte to pop.
+ * tail - the offset in 'elements' of the next byte to push.
+ * size - the length of 'elements', one more than the capacity.
+ * elements - the ring's storage.
+ */
+typedef struct {
+    int head;
+    int tail;
+    int size;
+    uint8_t* elements;
+} ByteQueue;
+
+// Declare the storage for a ByteQueue that holds up to 'capacity' bytes.
+#define BYTE_QUEUE_STORAGE(name, capacity) uint8_t name[(capacity) + 1]
+
+// The ByteQueue operations, in the shape of emqueue's macros. 'storage' must be
+// an array declared with BYTE_QUEUE_STORAGE, not a pointer.
+#define BYTE_QUEUE_INIT(queue, storage) \
+        openxc::util::bytebuffer::initializeQueue(queue, storage, \
+                sizeof(storage))
+#define BYTE_QUEUE_RESET(queue) openxc::util::bytebuffer::resetQueue(queue)
+#define BYTE_QUEUE_CAPACITY(queue) \
+        openxc::util::bytebuffer::queueCapacity(queue)
+#define BYTE_QUEUE_LENGTH(queue) openxc::util::bytebuffer::queueLength(queue)
+#define BYTE_QUEUE_AVAILABLE(queue) \
+        openxc::util::bytebuffer::queueAvailable(queue)
+#define BYTE_QUEUE_EMPTY(queue) openxc::util::bytebuffer::queueEmpty(queue)
+#define BYTE_QUEUE_FULL(queue) openxc::util::bytebuffer::queueFull(queue)
+#define BYTE_QUEUE_PUSH(queue, value) \
+        openxc::util::bytebuffer::pushByte(queue, value)
+#define BYTE_QUEUE_POP(queue) openxc::util::bytebuffer::popByte(queue)
+#define BYTE_QUEUE_SNAPSHOT(queue, destination, length) \
+        openxc::util::bytebuffer::peekBytes(queue, destination, length)
 
 namespace openxc {
 namespace util {
 namespace bytebuffer {
 
+/* Public: Give a queue its storage and empty it.
+ *
+ * queue - The queue to initialize.
+ * storage - The ring for the queue, one byte longer than its capacity.
+ * size - The length of the storage.
+ */
+inline void initializeQueue(ByteQueue* queue, uint8_t* storage, int size) {
+    queue->elements = storage;
+    queue->size = size;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+/* Public: Empty a queue, keeping its storage.
+ */
+inline void resetQueue(ByteQueue* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+/* Public: Returns the most bytes the queue can hold.
+ */
+inline int queueCapacity(const ByteQueue* queue) {
+    return queue->size > 0 ? queue->size - 1 : 0;
+}
+
+/* Public: Returns the number of bytes in the queue.
+ */
+inline int queueLength(const ByteQueue* queue) {
+    int length = queue->tail - queue->head;
+    return length < 0 ? length + queue->size : length;
+}
+
+/* Public: Returns the number of bytes that can still be pushed.
+ */
+inline int queueAvailable(const ByteQueue* queue) {
+    return queueCapacity(queue) - queueLength(queue);
+}
+
+inline bool queueEmpty(const ByteQueue* queue) {
+    return queue->head == queue->tail;
+}
+
+inline bool queueFull(const ByteQueue* queue) {
+    return queueAvailable(queue) <= 0;
+}
+
+/* Public: Add a byte to the back of the queue.
+ *
+ * Returns false if the queue is full.
+ */
+inline bool pushByte(ByteQueue* queue, uint8_t value) {
+    if(queueFull(queue)) {
+        return false;
+    }
+    int tail = queue->tail;
+    queue->elements[tail] = value;
+    queue->tail = tail + 1 == queue->size ? 0 : tail + 1;
+    return true;
+}
+
+/* Public: Remove and return the byte at the front of the queue, which must not
+ * be empty.
+ */
+inline uint8_t popByte(ByteQueue* queue) {
+    int head = queue->head;
+    uint8_t value = queue->elements[head];
+    queue->head = head + 1 == queue->size ? 0 : head + 1;
+    return value;
+}
+
 /* Public: The type signature for a callback to receive new command data.
  *
  * buffer - The received command buffer. It may contain an incomplete command, a
@@ -21,17 +135,105 @@ namespace bytebuffer {
  */
 typedef size_t (*IncomingMessageCallback)(uint8_t* buffer, size_t length);
 
+/* Public: How the messages in a byte queue are delimited.
+ *
+ * NULL_DELIMITED - each message ends with a NULL byte (JSON).
+ * LENGTH_PREFIXED - each message starts with its length as a varint
+ *      (delimited protocol buffers).
+ * UNFRAMED - the end of a message can only be found by parsing it
+ *      (MessagePack).
+ * CHECKED - each message is wrapped by wrapCheckedFrame with a sync marker,
+ *      its length and a CRC, so a receiver can find the next message after
+ *      bytes are lost or corrupted (binary formats over UART).
+ */
+typedef enum {
+    NULL_DELIMITED,
+    LENGTH_PREFIXED,
+    UNFRAMED,
+    CHECKED,
+} FrameType;
+
+// A CHECKED frame is the two sync bytes, the payload length as a little-endian
+// uint16_t, the payload and a big-endian CRC-16/CCITT of the length and
+// payload.
+#define CHECKED_FRAME_SYNC_1 0xa5
+#define CHECKED_FRAME_SYNC_2 0x5a
+#define CHECKED_FRAME_HEADER_SIZE 4
+#define CHECKED_FRAME_OVERHEAD (CHECKED_FRAME_HEADER_SIZE + 2)
+
+/* Public: How far processQueue has looked for the end of the message at the
+ * front of a byte queue, so a message that arrives in pieces is only scanned
+ * once. Keep one per receive queue, starting zeroed.
+ *
+ * type - the frame type the scan was for.
+ * scanned - the number of bytes from the front of the queue already examined.
+ * frameLength - the total length of the message at the front of the queue, or
+ *      0 if it isn't known yet.
+ * prefix - the length prefix read so far, for LENGTH_PREFIXED frames.
+ */
+typedef struct {
+    FrameType type;
+    int scanned;
+    int frameLength;
+    uint32_t prefix;
+} FrameScanner;
+
+/* Public: Returns the frame type of incoming messages in a payload format.
+ */
+FrameType frameType(openxc::payload::PayloadFormat format);
+
+/* Public: Wrap a message in a CHECKED frame.
+ *
+ * message - The message to wrap.
+ * messageSize - The length of the message.
+ * frame - The buffer for the frame, which can't overlap the message.
+ * frameSize - The size of the frame buffer, which needs CHECKED_FRAME_OVERHEAD
+ *      bytes more than the message.
+ *
+ * Returns the length of the frame, or 0 if it doesn't fit.
+ */
+int wrapCheckedFrame(const uint8_t* message, int messageSize, uint8_t* frame,
+        int frameSize);
+
+/* Public: Find a complete message at the front of the queue, remove it and
+ * pass it to the callback. Only the bytes that arrived since the last call are
+ * examined, and the callback isn't called until a whole message is in the
+ * queue. The message is passed straight from the queue's storage, unless it
+ * wraps around the end of the ring and has to be copied.
+ *
+ * A complete NULL_DELIMITED, LENGTH_PREFIXED or CHECKED message that the
+ * callback can't parse is dropped. A CHECKED message is passed to the callback
+ * without its framing, and only if its CRC matches - bytes in front of the
+ * sync marker are discarded, and after a bad CRC or an impossible length the
+ * search for the next frame starts again one byte past the bad one's sync
+ * marker. If no message is found and the queue is full, the queue is reset back
+ * to empty.
+ *
+ * queue - The queue of bytes to check for a message.
+ * scanner - The scan state kept for this queue.
+ * type - The frame type of the messages in the queue.
+ * callback - A function that will return the number of bytes parsed for an
+ *      OpenXC message in the data it's given.
+ *
+ * Returns true if a complete message was found in the queue and removed.
+ */
+bool processQueue(ByteQueue* queue, FrameScanner* scanner,
+        FrameType type, IncomingMessageCallback callback);
+
 /* Public: Search for a complete message in the queue, remove it and pass it to
  * the callback. If no message is found, reset the queue back to empty if it's
  * full.
  *
+ * This is the same as processQueue with an UNFRAMED scanner that's reset on
+ * every call, so the callback gets everything in the queue each time.
+ *
  * queue - The queue of bytes to check for a message.
  * callback - A function that will return true if an OpenXC message is found in
  *          the queue.
  *
  * Returns true if a completed message was found in the queue and removed.
  */
-bool processQueue(QUEUE_TYPE(uint8_t)* queue, IncomingMessageCallback callback);
+bool processQueue(ByteQueue* queue, IncomingMessageCallback callback);
 
 /* Public: Add the message to the byte queue if there is room.
  *
@@ -42,7 +244,7 @@ bool processQueue(QUEUE_TYPE(uint8_t)* queue, IncomingMessageCallback callback);
  * Returns true if the message was able to fit in the queue and was added.
  * Returns false otherwise, or if queue is NULL.
  */
-bool conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
+bool conditionalEnqueue(ByteQueue* queue, uint8_t* message,
         int messageSize);
 
 /* Public: Check if a message plus a CRLF will fit in the byte queue.
@@ -54,7 +256,56 @@ bool conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
  * Returns true if the message will able to fit in the queue.
  * Returns false otherwise, or if queue is NULL.
  */
-bool messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t* message, int messageSize);
+bool messageFits(ByteQueue* queue, uint8_t* message, int messageSize);
+
+/* Public: Check if a message plus a CRLF could ever fit in a byte queue, i.e.
+ * if it would fit in it when empty.
+ *
+ * queue - The queue the message is for.
+ * messageSize - The length of the message.
+ *
+ * Returns true if the message is small enough for the queue.
+ */
+bool messageCanFit(ByteQueue* queue, int messageSize);
+
+/* Public: Append a block of bytes to the queue in at most two copies (one
+ * before and one after the end of the ring), instead of one BYTE_QUEUE_PUSH
+ * per byte.
+ *
+ * The bytes are only published to the consumer once the whole block is
+ * written, so this is safe for the same single producer / single consumer use
+ * as BYTE_QUEUE_PUSH.
+ *
+ * queue - The queue to add the bytes.
+ * data - The bytes to append.
+ * length - The number of bytes to append.
+ *
+ * Returns true if all of the bytes fit and were added. Nothing is added if
+ * they don't all fit, or if queue is NULL.
+ */
+bool pushBytes(ByteQueue* queue, const uint8_t* data, int length);
+
+/* Public: Copy up to length bytes from the front of the queue without removing
+ * them (see BYTE_QUEUE_SNAPSHOT).
+ *
+ * queue - The queue to copy from.
+ * destination - The buffer to receive the bytes.
+ * length - The maximum number of bytes to copy.
+ *
+ * Returns the number of bytes copied.
+ */
+int peekBytes(ByteQueue* queue, uint8_t* destination, int length);
+
+/* Public: Remove up to length bytes from the front of the queue.
+ *
+ * queue - The queue to remove bytes from.
+ * destination - The buffer to receive the removed bytes, or NULL to discard
+ *      them.
+ * length - The maximum number of bytes to remove.
+ *
+ * Returns the number of bytes removed.
+ */
+int popBytes(ByteQueue* queue, uint8_t* destination, int length);
 
 } // namespace bytebuffer
 } // namespace util
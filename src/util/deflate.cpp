@@ -0,0 +1,255 @@
+#include "deflate.h"
+
+#include <string.h>
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+// How many earlier occurrences of a hash to try before settling for the best
+// match so far
+#define MAX_CHAIN 16
+
+#define WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+#define ADLER_MODULUS 65521
+// The most bytes that can be summed before the Adler-32 sums overflow 32 bits
+#define ADLER_NMAX 5552
+
+#define END_OF_BLOCK 256
+
+namespace deflate = openxc::util::deflate;
+
+// Indexed by length code - 257
+static const uint16_t LENGTH_BASE[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+    67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA_BITS[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
+    5, 5, 5, 0
+};
+
+// Indexed by distance code
+static const uint16_t DISTANCE_BASE[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+    769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA_BITS[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+    11, 11, 12, 12, 13, 13
+};
+
+// The most recent position + 1 of each hash (0 for none), and for each
+// position in the window the position + 1 of the one before it with the same
+// hash.
+static uint16_t hashHeads[HASH_SIZE];
+static uint16_t hashChain[DEFLATE_WINDOW_SIZE];
+
+/* Private: Deflate bits are packed starting from the least significant bit of
+ * each byte.
+ */
+typedef struct {
+    uint8_t* output;
+    size_t capacity;
+    size_t length;
+    uint32_t bits;
+    int bitCount;
+    bool overflow;
+} BitWriter;
+
+static void writeByte(BitWriter* writer, uint8_t byte) {
+    if(writer->length < writer->capacity) {
+        writer->output[writer->length++] = byte;
+    } else {
+        writer->overflow = true;
+    }
+}
+
+static void writeBits(BitWriter* writer, uint32_t value, int count) {
+    writer->bits |= value << writer->bitCount;
+    writer->bitCount += count;
+    while(writer->bitCount >= 8) {
+        writeByte(writer, writer->bits & 0xff);
+        writer->bits >>= 8;
+        writer->bitCount -= 8;
+    }
+}
+
+static void flushBits(BitWriter* writer) {
+    if(writer->bitCount > 0) {
+        writeByte(writer, writer->bits & 0xff);
+    }
+    writer->bits = 0;
+    writer->bitCount = 0;
+}
+
+/* Private: Write a Huffman code, which unlike everything else in a deflate
+ * stream is packed starting from its most significant bit.
+ */
+static void writeCode(BitWriter* writer, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for(int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    writeBits(writer, reversed, length);
+}
+
+/* Private: Write a literal/length symbol with the fixed Huffman code from
+ * RFC 1951 section 3.2.6.
+ */
+static void writeSymbol(BitWriter* writer, int symbol) {
+    if(symbol < 144) {
+        writeCode(writer, 0x30 + symbol, 8);
+    } else if(symbol < 256) {
+        writeCode(writer, 0x190 + symbol - 144, 9);
+    } else if(symbol < 280) {
+        writeCode(writer, symbol - 256, 7);
+    } else {
+        writeCode(writer, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void writeMatch(BitWriter* writer, int length, int distance) {
+    int code = sizeof(LENGTH_BASE) / sizeof(LENGTH_BASE[0]) - 1;
+    while(LENGTH_BASE[code] > length) {
+        --code;
+    }
+    writeSymbol(writer, 257 + code);
+    writeBits(writer, length - LENGTH_BASE[code], LENGTH_EXTRA_BITS[code]);
+
+    code = sizeof(DISTANCE_BASE) / sizeof(DISTANCE_BASE[0]) - 1;
+    while(DISTANCE_BASE[code] > distance) {
+        --code;
+    }
+    // distance codes are all 5 bits long
+    writeCode(writer, code, 5);
+    writeBits(writer, distance - DISTANCE_BASE[code],
+            DISTANCE_EXTRA_BITS[code]);
+}
+
+static int hash(const uint8_t* data) {
+    uint32_t key = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (key * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/* Private: Record that the 3 bytes at position start a string, for later
+ * matches to find.
+ */
+static void insertString(const uint8_t* input, size_t position) {
+    int key = hash(&input[position]);
+    hashChain[position & WINDOW_MASK] = hashHeads[key];
+    hashHeads[key] = position + 1;
+}
+
+/* Private: Find the longest earlier copy of the string at position within
+ * the window.
+ *
+ * Returns the length of the match, or 0 if it's shorter than MIN_MATCH.
+ */
+static int longestMatch(const uint8_t* input, size_t length, size_t position,
+        int* distance) {
+    int maxLength = length - position;
+    if(maxLength > MAX_MATCH) {
+        maxLength = MAX_MATCH;
+    }
+
+    int bestLength = 0;
+    uint16_t candidate = hashHeads[hash(&input[position])];
+    for(int chain = 0; candidate != 0 && chain < MAX_CHAIN; chain++) {
+        size_t start = candidate - 1;
+        if(position - start > DEFLATE_WINDOW_SIZE) {
+            break;
+        }
+
+        int matchLength = 0;
+        while(matchLength < maxLength &&
+                input[start + matchLength] == input[position + matchLength]) {
+            ++matchLength;
+        }
+        if(matchLength > bestLength) {
+            bestLength = matchLength;
+            *distance = position - start;
+            if(bestLength == maxLength) {
+                break;
+            }
+        }
+        candidate = hashChain[start & WINDOW_MASK];
+    }
+    return bestLength >= MIN_MATCH ? bestLength : 0;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t length) {
+    uint32_t a = 1, b = 0;
+    while(length > 0) {
+        size_t block = length < ADLER_NMAX ? length : ADLER_NMAX;
+        length -= block;
+        while(block-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_MODULUS;
+        b %= ADLER_MODULUS;
+    }
+    return (b << 16) | a;
+}
+
+size_t openxc::util::deflate::compress(const uint8_t* input, size_t length,
+        uint8_t* output, size_t outputLength) {
+    if(length > DEFLATE_MAX_INPUT_LENGTH) {
+        return 0;
+    }
+
+    BitWriter writer = {
+        output: output,
+        capacity: outputLength,
+        length: 0,
+        bits: 0,
+        bitCount: 0,
+        overflow: false
+    };
+
+    // zlib header - deflate with the window size, and a check value that
+    // makes the two bytes a multiple of 31
+    int windowBits = 8;
+    while((1 << windowBits) < DEFLATE_WINDOW_SIZE) {
+        ++windowBits;
+    }
+    uint8_t cmf = ((windowBits - 8) << 4) | 8;
+    writeByte(&writer, cmf);
+    writeByte(&writer, 31 - (cmf << 8) % 31);
+
+    // a single, final block with the fixed codes
+    writeBits(&writer, 1, 1);
+    writeBits(&writer, 1, 2);
+
+    memset(hashHeads, 0, sizeof(hashHeads));
+    size_t position = 0;
+    while(position < length && !writer.overflow) {
+        int matchLength = 0, distance = 0;
+        if(length - position >= MIN_MATCH) {
+            matchLength = longestMatch(input, length, position, &distance);
+            insertString(input, position);
+        }
+
+        if(matchLength > 0) {
+            writeMatch(&writer, matchLength, distance);
+            for(size_t end = position + matchLength; ++position < end;) {
+                if(length - position >= MIN_MATCH) {
+                    insertString(input, position);
+                }
+            }
+        } else {
+            writeSymbol(&writer, input[position++]);
+        }
+    }
+    writeSymbol(&writer, END_OF_BLOCK);
+    flushBits(&writer);
+
+    uint32_t checksum = adler32(input, length);
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        writeByte(&writer, checksum >> shift);
+    }
+
+    return writer.overflow ? 0 : writer.length;
+}
@@ -0,0 +1,50 @@
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// How far back, in bytes, the encoder looks for repeated strings. Must be a
+// power of two between 256 and 32768 - each byte of window costs 2 bytes of
+// RAM for the match chains.
+#ifndef DEFLATE_WINDOW_SIZE
+#define DEFLATE_WINDOW_SIZE 1024
+#endif
+
+// The match hash table has 1 << DEFLATE_HASH_BITS entries of 2 bytes each.
+#ifndef DEFLATE_HASH_BITS
+#define DEFLATE_HASH_BITS 10
+#endif
+
+// The longest input compress accepts.
+#define DEFLATE_MAX_INPUT_LENGTH 65535
+
+namespace openxc {
+namespace util {
+namespace deflate {
+
+/* Public: Compress a buffer as a zlib stream (RFC 1950), i.e. what HTTP calls
+ * the "deflate" content encoding.
+ *
+ * The data is written as a single deflate block with the fixed Huffman codes,
+ * finding repeated strings within the last DEFLATE_WINDOW_SIZE bytes. That
+ * gives up a little of what zlib would get in exchange for a few KB of RAM and
+ * no code tables to build - repetitive data like a batch of JSON records
+ * still compresses to a fraction of its size.
+ *
+ * input - The bytes to compress.
+ * length - The number of bytes in input, at most DEFLATE_MAX_INPUT_LENGTH.
+ * output - The buffer to write the compressed stream to.
+ * outputLength - The size of output.
+ *
+ * Returns the length of the compressed stream, or 0 if it doesn't fit in
+ * output (or the input is too long).
+ */
+size_t compress(const uint8_t* input, size_t length, uint8_t* output,
+        size_t outputLength);
+
+} // namespace deflate
+} // namespace util
+} // namespace openxc
+
+#endif // __DEFLATE_H__
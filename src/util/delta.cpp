@@ -0,0 +1,251 @@
+#include "util/delta.h"
+#include <string.h>
+
+using openxc::util::delta::DeltaPatch;
+using openxc::util::delta::DeltaSink;
+using openxc::util::delta::DeltaStatus;
+
+namespace delta = openxc::util::delta;
+
+#define DELTA_COPY 0x01
+#define DELTA_ADD 0x02
+#define DELTA_INSERT 0x03
+
+typedef enum {
+    STATE_HEADER,
+    STATE_OPCODE,
+    STATE_OFFSET,
+    STATE_LENGTH,
+    STATE_CHANGES,
+    STATE_SKIP,
+    STATE_ADD,
+    STATE_INSERT,
+    STATE_DONE,
+} DeltaState;
+
+static uint32_t readUint32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+            ((uint32_t) data[3] << 24);
+}
+
+static void fail(DeltaPatch* patch) {
+    patch->status = delta::DELTA_FAILED;
+    patch->state = STATE_DONE;
+}
+
+/* Private: Pass the buffered part of the target image on to the sink.
+ */
+static void flush(DeltaPatch* patch) {
+    if(patch->outputLength == 0) {
+        return;
+    }
+    MD5_Update(&patch->md5, patch->output, patch->outputLength);
+    if(!patch->sink(patch->output, patch->outputLength, patch->context)) {
+        fail(patch);
+    }
+    patch->outputLength = 0;
+}
+
+static void emit(DeltaPatch* patch, const uint8_t* data, size_t length) {
+    patch->written += length;
+    while(length > 0 && patch->status == delta::DELTA_IN_PROGRESS) {
+        size_t count = DELTA_OUTPUT_CHUNK_SIZE - patch->outputLength;
+        if(count > length) {
+            count = length;
+        }
+        memcpy(&patch->output[patch->outputLength], data, count);
+        patch->outputLength += count;
+        data += count;
+        length -= count;
+        if(patch->outputLength == DELTA_OUTPUT_CHUNK_SIZE) {
+            flush(patch);
+        }
+    }
+}
+
+/* Private: Start the next instruction, or check the target image if it's
+ * complete.
+ */
+static void nextInstruction(DeltaPatch* patch) {
+    if(patch->status != delta::DELTA_IN_PROGRESS) {
+        return;
+    }
+
+    if(patch->written < patch->targetLength) {
+        patch->state = STATE_OPCODE;
+        return;
+    }
+
+    flush(patch);
+    uint8_t digest[16];
+    MD5_Final(digest, &patch->md5);
+    if(patch->status == delta::DELTA_IN_PROGRESS) {
+        patch->status = memcmp(digest, &patch->header[12], sizeof(digest)) ?
+                delta::DELTA_FAILED : delta::DELTA_COMPLETE;
+    }
+    patch->state = STATE_DONE;
+}
+
+static void finishAdd(DeltaPatch* patch) {
+    emit(patch, &patch->source[patch->offset + patch->position],
+            patch->length - patch->position);
+    nextInstruction(patch);
+}
+
+/* Private: Accumulate a byte of a varint.
+ *
+ * Returns true once the varint is complete, with its value in patch->varint.
+ */
+static bool readVarint(DeltaPatch* patch, uint8_t byte) {
+    if(patch->varintShift > 28 ||
+            (patch->varintShift == 28 && (byte & 0x7f) > 0xf)) {
+        fail(patch);
+        return false;
+    }
+    patch->varint |= (uint32_t) (byte & 0x7f) << patch->varintShift;
+    patch->varintShift += 7;
+    return !(byte & 0x80);
+}
+
+static void readHeader(DeltaPatch* patch) {
+    patch->targetLength = readUint32(&patch->header[8]);
+    if(memcmp(patch->header, DELTA_MAGIC, 4) ||
+            readUint32(&patch->header[4]) != patch->sourceLength) {
+        fail(patch);
+        return;
+    }
+    MD5_Init(&patch->md5);
+    nextInstruction(patch);
+}
+
+/* Private: Check that an instruction stays inside the source and the target.
+ */
+static bool inBounds(DeltaPatch* patch) {
+    if(patch->length > patch->targetLength - patch->written) {
+        return false;
+    }
+    return patch->opcode == DELTA_INSERT || (
+            patch->offset <= patch->sourceLength &&
+            patch->length <= patch->sourceLength - patch->offset);
+}
+
+static void readField(DeltaPatch* patch, uint32_t value) {
+    switch(patch->state) {
+    case STATE_OFFSET:
+        patch->offset = value;
+        patch->state = STATE_LENGTH;
+        break;
+    case STATE_LENGTH:
+        patch->length = value;
+        if(!inBounds(patch)) {
+            fail(patch);
+        } else if(patch->opcode == DELTA_COPY) {
+            emit(patch, &patch->source[patch->offset], patch->length);
+            nextInstruction(patch);
+        } else if(patch->opcode == DELTA_ADD) {
+            patch->position = 0;
+            patch->state = STATE_CHANGES;
+        } else if(patch->length > 0) {
+            patch->state = STATE_INSERT;
+        } else {
+            nextInstruction(patch);
+        }
+        break;
+    case STATE_CHANGES:
+        patch->changes = value;
+        if(patch->changes == 0) {
+            finishAdd(patch);
+        } else {
+            patch->state = STATE_SKIP;
+        }
+        break;
+    case STATE_SKIP:
+        if(value >= patch->length - patch->position) {
+            fail(patch);
+            break;
+        }
+        emit(patch, &patch->source[patch->offset + patch->position], value);
+        patch->position += value;
+        patch->state = STATE_ADD;
+        break;
+    }
+}
+
+void openxc::util::delta::begin(DeltaPatch* patch, const uint8_t* source,
+        size_t sourceLength, DeltaSink sink, void* context) {
+    memset(patch, 0, sizeof(DeltaPatch));
+    patch->source = source;
+    patch->sourceLength = sourceLength;
+    patch->sink = sink;
+    patch->context = context;
+    patch->status = DELTA_IN_PROGRESS;
+    patch->state = STATE_HEADER;
+}
+
+DeltaStatus openxc::util::delta::apply(DeltaPatch* patch, const uint8_t* data,
+        size_t length) {
+    size_t i = 0;
+    while(i < length && patch->state != STATE_DONE) {
+        uint8_t byte = data[i];
+        switch(patch->state) {
+        case STATE_HEADER:
+            patch->header[patch->headerLength++] = byte;
+            ++i;
+            if(patch->headerLength == DELTA_HEADER_SIZE) {
+                readHeader(patch);
+            }
+            break;
+        case STATE_OPCODE:
+            patch->opcode = byte;
+            ++i;
+            patch->varint = 0;
+            patch->varintShift = 0;
+            if(byte == DELTA_COPY || byte == DELTA_ADD) {
+                patch->state = STATE_OFFSET;
+            } else if(byte == DELTA_INSERT) {
+                patch->state = STATE_LENGTH;
+            } else {
+                fail(patch);
+            }
+            break;
+        case STATE_ADD: {
+            uint8_t sum = patch->source[patch->offset + patch->position] +
+                    byte;
+            ++i;
+            emit(patch, &sum, 1);
+            ++patch->position;
+            patch->varint = 0;
+            patch->varintShift = 0;
+            if(--patch->changes == 0) {
+                finishAdd(patch);
+            } else {
+                patch->state = STATE_SKIP;
+            }
+            break;
+        }
+        case STATE_INSERT: {
+            size_t count = length - i;
+            if(count > patch->length) {
+                count = patch->length;
+            }
+            emit(patch, &data[i], count);
+            i += count;
+            patch->length -= count;
+            if(patch->length == 0) {
+                nextInstruction(patch);
+            }
+            break;
+        }
+        default:
+            ++i;
+            if(readVarint(patch, byte)) {
+                uint32_t value = patch->varint;
+                patch->varint = 0;
+                patch->varintShift = 0;
+                readField(patch, value);
+            }
+            break;
+        }
+    }
+    return patch->status;
+}
@@ -0,0 +1,114 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "md5.h"
+
+// The most bytes of the patched image held in RAM before they're passed on.
+#ifndef DELTA_OUTPUT_CHUNK_SIZE
+#define DELTA_OUTPUT_CHUNK_SIZE 256
+#endif
+
+// A delta patch rebuilds a target image from a source image that's already on
+// the device, so only what changed between them has to be sent. Integers are
+// little endian, and the lengths and offsets in instructions are unsigned
+// LEB128 varints.
+//
+//  0: "OXD1"
+//  4: uint32 length of the source image the patch was made against
+//  8: uint32 length of the target image
+// 12: the MD5 of the target image, 16 bytes
+// 28: instructions, until the whole target image is written:
+//      0x01 COPY   - source offset, length: copy bytes from the source.
+//      0x02 ADD    - source offset, length, change count, then for each change
+//                    the number of bytes to copy unchanged and a byte to add
+//                    (mod 256) to the next one. The rest of the length is
+//                    copied unchanged. This covers code that only moved, where
+//                    a few bytes of each address in it differ.
+//      0x03 INSERT - length, then that many bytes to write as is.
+#define DELTA_MAGIC "OXD1"
+#define DELTA_HEADER_SIZE 28
+
+namespace openxc {
+namespace util {
+namespace delta {
+
+/* Public: Where a patched image is written, a chunk at a time and in order.
+ *
+ * data - The next bytes of the target image.
+ * length - The number of bytes at data.
+ * context - The context passed to begin.
+ *
+ * Returns false if the bytes couldn't be stored, which fails the patch.
+ */
+typedef bool (*DeltaSink)(const uint8_t* data, size_t length, void* context);
+
+typedef enum {
+    DELTA_IN_PROGRESS,
+    DELTA_COMPLETE,
+    DELTA_FAILED,
+} DeltaStatus;
+
+/* Public: A patch being applied as it arrives. The fields are private to
+ * delta.cpp - it's a struct so the caller decides where the RAM comes from.
+ */
+typedef struct {
+    const uint8_t* source;
+    size_t sourceLength;
+    DeltaSink sink;
+    void* context;
+    DeltaStatus status;
+
+    uint8_t header[DELTA_HEADER_SIZE];
+    size_t headerLength;
+    uint32_t targetLength;
+    uint32_t written;
+    MD5_CTX md5;
+
+    uint8_t state;
+    uint8_t opcode;
+    uint32_t varint;
+    uint8_t varintShift;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t changes;
+    uint32_t position;
+
+    uint8_t output[DELTA_OUTPUT_CHUNK_SIZE];
+    size_t outputLength;
+} DeltaPatch;
+
+/* Public: Start applying a patch.
+ *
+ * patch - The patch state.
+ * source - The image the patch was made against. It's read at random, so it
+ *      must be addressable as a whole, e.g. the firmware in flash.
+ * sourceLength - The number of bytes at source.
+ * sink - Where to write the patched image.
+ * context - Passed to the sink.
+ */
+void begin(DeltaPatch* patch, const uint8_t* source, size_t sourceLength,
+        DeltaSink sink, void* context);
+
+/* Public: Apply the next bytes of a patch, in whatever pieces it arrives in.
+ * The patched image is written to the sink as it's rebuilt, so no more than
+ * DELTA_OUTPUT_CHUNK_SIZE bytes of it are ever held in RAM.
+ *
+ * patch - The patch state.
+ * data - The next bytes of the patch.
+ * length - The number of bytes at data.
+ *
+ * Returns DELTA_COMPLETE once the whole target image has been written and its
+ * MD5 matches the patch, or DELTA_FAILED if the patch is malformed, was made
+ * against a different source, reaches outside the source or the target, fails
+ * the MD5 check or the sink fails. Bytes after the end of the patch are
+ * ignored.
+ */
+DeltaStatus apply(DeltaPatch* patch, const uint8_t* data, size_t length);
+
+} // namespace delta
+} // namespace util
+} // namespace openxc
+
+#endif // __DELTA_H__
@@ -2,34 +2,457 @@
 #include "pipeline.h"
 #include <stdio.h>
 #include "config.h"
+#include "util/timer.h"
 #include <stdarg.h>
+#include <string.h>
 
 #define LOG_QUEUE_FLUSH_MAX_TRIES 5
 
 const int openxc::util::log::MAX_LOG_LINE_LENGTH = 256;
 
 namespace usb = openxc::interface::usb;
+namespace time = openxc::util::time;
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::interface::usb::UsbDevice;
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
 using openxc::config::getConfiguration;
+using openxc::util::log::LogLevel;
 
-void openxc::util::log::debug(const char* format, ...) {
+static LogLevel currentLevel = (LogLevel) LOG_LEVEL;
+
+#ifdef __DEBUG__
+
+/* Private: Send a completed log message to the LOG message class.
+ */
+static void sendLogMessage(const char* buffer) {
+    // Send strlen + 1 so we make sure to include the NULL character as a
+    // delimiter
+    openxc::pipeline::sendMessage(&getConfiguration()->pipeline,
+            (uint8_t*) buffer,
+            strnlen(buffer, openxc::util::log::MAX_LOG_LINE_LENGTH) + 1,
+            MessageClass::LOG);
+}
+
+/* Private: How many more messages a call site can log right now.
+ *
+ * format - the format string the call site passes, which identifies it.
+ * lastMs - when it last logged, or tried to.
+ * credit - thousandths of a message, up to LOG_RATE_LIMIT_BURST messages.
+ */
+struct CallSiteRate {
+    const char* format;
+    unsigned long lastMs;
+    unsigned int credit;
+};
+
+static CallSiteRate callSites[LOG_RATE_LIMIT_CALL_SITES];
+static unsigned int rateLimitedMessages;
+static unsigned long lastRateLimitReportMs;
+
+/* Private: Take one message's worth of credit from a call site's token
+ * bucket.
+ *
+ * Returns true if the call site is over its rate and the message should be
+ * dropped.
+ */
+static bool rateLimited(const char* format) {
+    if(LOG_RATE_LIMIT_PER_S == 0) {
+        return false;
+    }
+
+    const unsigned int fullCredit = LOG_RATE_LIMIT_BURST * 1000;
+    unsigned long now = time::systemTimeMs();
+    CallSiteRate* site = NULL;
+    CallSiteRate* leastRecent = &callSites[0];
+    for(int i = 0; i < LOG_RATE_LIMIT_CALL_SITES; i++) {
+        if(callSites[i].format == format) {
+            site = &callSites[i];
+            break;
+        }
+        if(callSites[i].lastMs < leastRecent->lastMs) {
+            leastRecent = &callSites[i];
+        }
+    }
+
+    if(site == NULL) {
+        site = leastRecent;
+        site->format = format;
+        site->credit = fullCredit;
+    } else {
+        unsigned long elapsedMs = now - site->lastMs;
+        // Checked first so the multiplication can't overflow after a long
+        // quiet spell
+        if(elapsedMs >= fullCredit ||
+                site->credit + elapsedMs * LOG_RATE_LIMIT_PER_S >= fullCredit) {
+            site->credit = fullCredit;
+        } else {
+            site->credit += elapsedMs * LOG_RATE_LIMIT_PER_S;
+        }
+    }
+    site->lastMs = now;
+
+    if(site->credit < 1000) {
+        ++rateLimitedMessages;
+        return true;
+    }
+    site->credit -= 1000;
+    return false;
+}
+
+/* Private: Log how many messages the rate limit dropped, at most once a
+ * second.
+ */
+static void reportRateLimited() {
+    unsigned long now = time::systemTimeMs();
+    if(rateLimitedMessages == 0 || now - lastRateLimitReportMs < 1000) {
+        return;
+    }
+
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "Rate limited %u log messages",
+            rateLimitedMessages);
+    rateLimitedMessages = 0;
+    lastRateLimitReportMs = now;
+    sendLogMessage(buffer);
+}
+
+#endif // __DEBUG__
+
+#if defined(__DEBUG__) && defined(DEFERRED_LOGGING)
+
+/* Private: The kind of value a printf conversion takes.
+ *
+ * NONE - the conversion doesn't take an argument, e.g. "%%".
+ * INTEGER - an int or smaller.
+ * LONG - a long.
+ * REAL - a float or double, which is passed as a double.
+ * POINTER - a pointer printed as an address with "%p".
+ * UNSUPPORTED - a string or anything else whose value can't just be copied.
+ */
+enum ArgumentType {
+    NONE,
+    INTEGER,
+    LONG,
+    REAL,
+    POINTER,
+    UNSUPPORTED
+};
+
+union LogArgument {
+    int integer;
+    long longInteger;
+    double real;
+    const void* pointer;
+};
+
+/* Private: A log message waiting to be formatted.
+ *
+ * format - the format string passed to debug().
+ * arguments - copies of its arguments, in order.
+ */
+struct DeferredLogMessage {
+    const char* format;
+    LogArgument arguments[LOG_DEFERRED_MAX_ARGUMENTS];
+};
+
+static DeferredLogMessage deferredMessages[LOG_DEFERRED_QUEUE_LENGTH];
+static unsigned int deferredHead;
+static unsigned int deferredTail;
+static unsigned int droppedMessages;
+
+/* Private: Find the next conversion in a format string.
+ *
+ * format - the format string, at or before the conversion.
+ * start - set to where the conversion's '%' is.
+ * length - set to the length of the conversion, including the '%'.
+ *
+ * Returns the type of argument the conversion takes, or NONE with start set to
+ * NULL if there are no more conversions.
+ */
+static ArgumentType nextConversion(const char* format, const char** start,
+        size_t* length) {
+    const char* percent = strchr(format, '%');
+    *start = percent;
+    if(percent == NULL) {
+        return NONE;
+    }
+
+    const char* cursor = percent + 1;
+    while(*cursor != '\0' && strchr("-+ #0123456789.", *cursor) != NULL) {
+        ++cursor;
+    }
+
+    bool isLong = false;
+    if(*cursor == 'l') {
+        isLong = true;
+        ++cursor;
+    } else if(*cursor == 'h') {
+        ++cursor;
+    }
+
+    char conversion = *cursor;
+    *length = cursor - percent + (conversion != '\0' ? 1 : 0);
+    switch(conversion) {
+    case '%':
+        return NONE;
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+        return isLong ? LONG : INTEGER;
+    case 'f':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        return REAL;
+    case 'p':
+        return POINTER;
+    default:
+        // strings, "*" widths, "ll" and anything unknown
+        return UNSUPPORTED;
+    }
+}
+
+/* Private: Copy the arguments for a format into a deferred message.
+ *
+ * Returns false if the message can't be deferred.
+ */
+static bool captureArguments(DeferredLogMessage* message, va_list args) {
+    const char* conversion;
+    size_t length;
+    int count = 0;
+    for(const char* cursor = message->format;; cursor = conversion + length) {
+        ArgumentType type = nextConversion(cursor, &conversion, &length);
+        if(conversion == NULL) {
+            return true;
+        }
+        if(type == NONE) {
+            continue;
+        }
+        if(type == UNSUPPORTED || count == LOG_DEFERRED_MAX_ARGUMENTS) {
+            return false;
+        }
+
+        LogArgument* argument = &message->arguments[count++];
+        switch(type) {
+        case INTEGER:
+            argument->integer = va_arg(args, int);
+            break;
+        case LONG:
+            argument->longInteger = va_arg(args, long);
+            break;
+        case REAL:
+            argument->real = va_arg(args, double);
+            break;
+        default:
+            argument->pointer = va_arg(args, const void*);
+            break;
+        }
+    }
+}
+
+/* Private: Format a deferred message one conversion at a time, since its
+ * arguments can't be turned back into a va_list.
+ */
+static void formatDeferredMessage(const DeferredLogMessage* message,
+        char* buffer, size_t bufferSize) {
+    size_t used = 0;
+    int count = 0;
+    const char* cursor = message->format;
+    while(*cursor != '\0' && used < bufferSize - 1) {
+        const char* conversion;
+        size_t length;
+        ArgumentType type = nextConversion(cursor, &conversion, &length);
+        if(conversion == NULL) {
+            conversion = cursor + strlen(cursor);
+            length = 0;
+        }
+
+        // The literal text up to the conversion
+        size_t literalLength = conversion - cursor;
+        if(literalLength > bufferSize - 1 - used) {
+            literalLength = bufferSize - 1 - used;
+        }
+        memcpy(&buffer[used], cursor, literalLength);
+        used += literalLength;
+        cursor = conversion + length;
+        if(length == 0) {
+            break;
+        }
+
+        char spec[16];
+        if(length >= sizeof(spec)) {
+            break;
+        }
+        memcpy(spec, conversion, length);
+        spec[length] = '\0';
+
+        const LogArgument* argument = &message->arguments[count];
+        int written;
+        switch(type) {
+        case INTEGER:
+            written = snprintf(&buffer[used], bufferSize - used, spec,
+                    argument->integer);
+            ++count;
+            break;
+        case LONG:
+            written = snprintf(&buffer[used], bufferSize - used, spec,
+                    argument->longInteger);
+            ++count;
+            break;
+        case REAL:
+            written = snprintf(&buffer[used], bufferSize - used, spec,
+                    argument->real);
+            ++count;
+            break;
+        case POINTER:
+            written = snprintf(&buffer[used], bufferSize - used, spec,
+                    argument->pointer);
+            ++count;
+            break;
+        default:
+            written = snprintf(&buffer[used], bufferSize - used, "%%");
+            break;
+        }
+
+        if(written > 0) {
+            used += written;
+            if(used > bufferSize - 1) {
+                used = bufferSize - 1;
+            }
+        }
+    }
+    buffer[used] = '\0';
+}
+
+/* Private: Queue a log message to be formatted by flush().
+ *
+ * Returns true if the message was taken care of (queued or dropped), false if
+ * it has to be formatted now.
+ */
+static bool deferMessage(const char* format, va_list args) {
+    if(deferredHead - deferredTail == LOG_DEFERRED_QUEUE_LENGTH) {
+        ++droppedMessages;
+        return true;
+    }
+
+    DeferredLogMessage* message = &deferredMessages[
+            deferredHead % LOG_DEFERRED_QUEUE_LENGTH];
+    message->format = format;
+    if(!captureArguments(message, args)) {
+        return false;
+    }
+    ++deferredHead;
+    return true;
+}
 
+static void flushDeferred() {
+    char buffer[openxc::util::log::MAX_LOG_LINE_LENGTH];
+    while(deferredTail != deferredHead) {
+        formatDeferredMessage(&deferredMessages[
+                    deferredTail % LOG_DEFERRED_QUEUE_LENGTH],
+                buffer, sizeof(buffer));
+        ++deferredTail;
+        sendLogMessage(buffer);
+    }
+
+    if(droppedMessages > 0) {
+        snprintf(buffer, sizeof(buffer), "Dropped %u deferred log messages",
+                droppedMessages);
+        droppedMessages = 0;
+        sendLogMessage(buffer);
+    }
+}
+
+#endif // __DEBUG__ && DEFERRED_LOGGING
+
+void openxc::util::log::flush() {
+#ifdef __DEBUG__
+    #ifdef DEFERRED_LOGGING
+    flushDeferred();
+    #endif
+    reportRateLimited();
+#endif // __DEBUG__
+}
+
+#ifdef __DEBUG__
+
+/* Private: Drop a message if it's less important than the current level or
+ * its call site is over its rate, otherwise defer it or send it now.
+ */
+static void logMessage(LogLevel level, const char* format, va_list args) {
+    if(level > currentLevel || rateLimited(format)) {
+        return;
+    }
+
+    #ifdef DEFERRED_LOGGING
+    // deferMessage consumes the arguments even when it can't defer them
+    va_list deferredArgs;
+    va_copy(deferredArgs, args);
+    bool deferred = deferMessage(format, deferredArgs);
+    va_end(deferredArgs);
+    if(deferred) {
+        return;
+    }
+    #endif
+
+    char buffer[openxc::util::log::MAX_LOG_LINE_LENGTH];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    sendLogMessage(buffer);
+}
+
+#endif // __DEBUG__
+
+void openxc::util::log::debug(const char* format, ...) {
 #ifdef __DEBUG__
     va_list args;
     va_start(args, format);
+    logMessage(LOG_LEVEL_DEBUG, format, args);
+    va_end(args);
+#endif // __DEBUG__
+}
 
-    char buffer[MAX_LOG_LINE_LENGTH];
-    vsnprintf(buffer, MAX_LOG_LINE_LENGTH, format, args);
+void openxc::util::log::info(const char* format, ...) {
+#ifdef __DEBUG__
+    va_list args;
+    va_start(args, format);
+    logMessage(LOG_LEVEL_INFO, format, args);
+    va_end(args);
+#endif // __DEBUG__
+}
 
-    // Send strlen + 1 so we make sure to include the NULL character as a
-    // delimiter
-    pipeline::sendMessage(&getConfiguration()->pipeline, (uint8_t*) buffer,
-            strnlen(buffer, MAX_LOG_LINE_LENGTH) + 1, MessageClass::LOG);
+void openxc::util::log::warning(const char* format, ...) {
+#ifdef __DEBUG__
+    va_list args;
+    va_start(args, format);
+    logMessage(LOG_LEVEL_WARNING, format, args);
+    va_end(args);
+#endif // __DEBUG__
+}
 
+void openxc::util::log::error(const char* format, ...) {
+#ifdef __DEBUG__
+    va_list args;
+    va_start(args, format);
+    logMessage(LOG_LEVEL_ERROR, format, args);
     va_end(args);
 #endif // __DEBUG__
 }
+
+bool openxc::util::log::setLevel(LogLevel level) {
+    if(level < LOG_LEVEL_ERROR || level >= LOG_LEVEL_COUNT) {
+        return false;
+    }
+    currentLevel = level;
+    return true;
+}
+
+LogLevel openxc::util::log::getLevel() {
+    return currentLevel;
+}
@@ -1,12 +1,63 @@
 #ifndef _LOG_H_
 #define _LOG_H_
 
+/* Public: The number of log messages a DEFERRED_LOGGING build can hold until
+ * the next flush(). Each one costs about 40 bytes of RAM.
+ */
+#ifndef LOG_DEFERRED_QUEUE_LENGTH
+#define LOG_DEFERRED_QUEUE_LENGTH 16
+#endif
+
+/* Public: The most arguments a log message can have and still be deferred.
+ */
+#define LOG_DEFERRED_MAX_ARGUMENTS 4
+
+/* Public: The most verbose level of messages sent at startup, as a LogLevel -
+ * 3 sends everything. It can be changed at runtime with setLevel().
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 3
+#endif
+
+/* Public: How many messages from one call site can be sent in a burst, and
+ * how many more per second after that. Anything beyond is dropped and counted,
+ * so a message repeated in a tight loop when the VI is already overloaded
+ * doesn't add to the load. 0 messages per second turns rate limiting off.
+ */
+#ifndef LOG_RATE_LIMIT_BURST
+#define LOG_RATE_LIMIT_BURST 10
+#endif
+
+#ifndef LOG_RATE_LIMIT_PER_S
+#define LOG_RATE_LIMIT_PER_S 2
+#endif
+
+/* Public: The number of call sites whose rate is tracked at once. When a new
+ * one is logged the least recently logged one is forgotten. Each costs 16
+ * bytes of RAM.
+ */
+#ifndef LOG_RATE_LIMIT_CALL_SITES
+#define LOG_RATE_LIMIT_CALL_SITES 16
+#endif
+
 namespace openxc {
 namespace util {
 namespace log {
 
 extern const int MAX_LOG_LINE_LENGTH;
 
+/* Public: How important a log message is. Messages less important than the
+ * current level (see setLevel) are dropped before they're formatted.
+ */
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+} LogLevel;
+
+#define LOG_LEVEL_COUNT 4
+
 /* Public: Initialize the debug logging framework. This function must be called
  *      before using debug().
  */
@@ -17,11 +68,50 @@ void initialize();
  *
  * This appends a \r\n to the end of the message.
  *
+ * In a DEFERRED_LOGGING build, the format and the raw arguments are queued
+ * instead and the message is only formatted and sent by the next flush(), so
+ * logging costs little more than a copy. The format must be a string literal
+ * (or otherwise outlive the call). Messages with string arguments, more than
+ * LOG_DEFERRED_MAX_ARGUMENTS arguments or unsupported conversions are still
+ * formatted and sent immediately, ahead of any queued ones. If the queue is full the message is dropped,
+ * and the number dropped is logged by the next flush().
+ *
  * format - A printf-style format string.
  * args - printf-style arguments that match the format string.
  */
 void debug(const char* format, ...);
 
+/* Public: Log a message at LOG_LEVEL_INFO, LOG_LEVEL_WARNING or
+ * LOG_LEVEL_ERROR, otherwise the same as debug() (which logs at
+ * LOG_LEVEL_DEBUG).
+ *
+ * Every level is rate limited per call site, by the address of the format
+ * string (see LOG_RATE_LIMIT_BURST), so the format must be a string literal.
+ */
+void info(const char* format, ...);
+
+void warning(const char* format, ...);
+
+void error(const char* format, ...);
+
+/* Public: Set the least important level of message that's sent, e.g.
+ * LOG_LEVEL_WARNING to send only warnings and errors.
+ *
+ * Returns false if the level is unknown.
+ */
+bool setLevel(LogLevel level);
+
+/* Public: Returns the least important level of message that's sent.
+ */
+LogLevel getLevel();
+
+/* Public: Format and send the log messages that debug() deferred, oldest
+ * first, and at most once a second the number of messages the rate limit
+ * dropped. Call this once per pass of the main loop, where the time it takes
+ * doesn't hold up anything else.
+ */
+void flush();
+
 /* Private: Log a completed message to UART.
  */
 void debugUart(const char* message);
@@ -0,0 +1,45 @@
+#include "util/memory.h"
+
+#define STACK_PAINT 0xa5a5a5a5
+
+/* Private: Returns the first whole word at or above an address.
+ */
+static uint32_t* alignedWord(uint8_t* address) {
+    return (uint32_t*) (((uintptr_t) address + 3) & ~(uintptr_t) 3);
+}
+
+void openxc::util::memory::paintStack() {
+    uint8_t* bottom;
+    uint8_t* top;
+    stackRegion(&bottom, &top);
+
+    uint8_t* end = (uint8_t*) __builtin_frame_address(0) - STACK_PAINT_MARGIN;
+    if(end < bottom || end > top) {
+        // not running on this stack, e.g. the tests' stand-in region
+        end = top;
+    }
+
+    for(uint32_t* word = alignedWord(bottom); word < (uint32_t*) end;
+            word++) {
+        *word = STACK_PAINT;
+    }
+}
+
+size_t openxc::util::memory::stackHighWater() {
+    uint8_t* bottom;
+    uint8_t* top;
+    stackRegion(&bottom, &top);
+
+    uint32_t* word = alignedWord(bottom);
+    while(word < (uint32_t*) top && *word == STACK_PAINT) {
+        ++word;
+    }
+    return word < (uint32_t*) top ? top - (uint8_t*) word : 0;
+}
+
+size_t openxc::util::memory::stackSize() {
+    uint8_t* bottom;
+    uint8_t* top;
+    stackRegion(&bottom, &top);
+    return top > bottom ? top - bottom : 0;
+}
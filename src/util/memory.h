@@ -0,0 +1,60 @@
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The bytes below the caller's frame that paintStack() leaves alone, for its
+// own frame and anything an interrupt pushes while it runs.
+#ifndef STACK_PAINT_MARGIN
+#define STACK_PAINT_MARGIN 64
+#endif
+
+// How much of the stack and heap the firmware has used, to size buffers and
+// queues by instead of guessing. The unused part of the stack is painted with
+// a pattern at startup, and the deepest the stack has reached since is the
+// lowest word that no longer holds it - so a buffer left partly unwritten in a
+// deep frame can make it read a little low.
+
+namespace openxc {
+namespace util {
+namespace memory {
+
+/* Public: Fill the stack below the caller's frame with the pattern that
+ * stackHighWater() looks for. Call this first thing at startup, from as
+ * shallow a frame as possible.
+ */
+void paintStack();
+
+/* Public: Returns the most bytes of the stack used since paintStack(), or the
+ * whole stack if it was never painted.
+ */
+size_t stackHighWater();
+
+/* Public: Returns the bytes the stack can grow to before it reaches the heap
+ * or the end of its region.
+ */
+size_t stackSize();
+
+/* Public: Look up how much of the heap is in use, implemented by each
+ * platform.
+ *
+ * used - (output) the bytes currently allocated.
+ * reserved - (output) the bytes the allocator has taken for the heap, which
+ *      only grows with the most it has ever needed at once.
+ */
+void heapUsage(size_t* used, size_t* reserved);
+
+/* Public: Find the stack, implemented by each platform.
+ *
+ * bottom - (output) the lowest address the stack can grow down to, e.g. the
+ *      top of the heap.
+ * top - (output) the address the stack starts from.
+ */
+void stackRegion(uint8_t** bottom, uint8_t** top);
+
+} // namespace memory
+} // namespace util
+} // namespace openxc
+
+#endif // __MEMORY_H__
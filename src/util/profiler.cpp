@@ -0,0 +1,121 @@
+#include "util/profiler.h"
+#include "util/timer.h"
+#include "util/log.h"
+#include "config.h"
+#include <stddef.h>
+
+#define LOOP_STATS_LOG_FREQUENCY_S 15
+
+namespace time = openxc::util::time;
+namespace statistics = openxc::util::statistics;
+
+using openxc::util::statistics::FixedStatistic;
+using openxc::util::profiler::LoopStage;
+using openxc::util::log::debug;
+
+#if METRICS_SUPPORT
+
+static const char* STAGE_NAMES[] = {
+    "CAN receive",
+    "diagnostics",
+    "USB read",
+    "interface read",
+    "CAN write",
+    "statistics",
+    "emulator",
+    "filesystem",
+    "pipeline",
+    "whole loop"
+};
+
+// One statistic per stage, and the last one for the whole pass
+static FixedStatistic stageStats[
+        openxc::util::profiler::LOOP_STAGE_COUNT + 1];
+static unsigned long stageCycles[openxc::util::profiler::LOOP_STAGE_COUNT];
+static unsigned long loopStarted;
+static unsigned long stageStarted;
+static bool profiling;
+static bool initializedStats;
+
+void openxc::util::profiler::startLoop() {
+    profiling = config::getConfiguration()->calculateMetrics;
+    if(!profiling) {
+        return;
+    }
+
+    if(!initializedStats) {
+        for(int i = 0; i <= LOOP_STAGE_COUNT; i++) {
+            statistics::initialize(&stageStats[i]);
+        }
+        initializedStats = true;
+    }
+
+    loopStarted = stageStarted = time::cycleCount();
+}
+
+void openxc::util::profiler::endStage(LoopStage stage) {
+    if(!profiling) {
+        return;
+    }
+
+    unsigned long now = time::cycleCount();
+    stageCycles[stage] += now - stageStarted;
+    stageStarted = now;
+}
+
+void openxc::util::profiler::endLoop() {
+    if(!profiling) {
+        return;
+    }
+
+    for(int i = 0; i < LOOP_STAGE_COUNT; i++) {
+        statistics::update(&stageStats[i], stageCycles[i]);
+        stageCycles[i] = 0;
+    }
+    statistics::update(&stageStats[LOOP_STAGE_COUNT],
+            time::cycleCount() - loopStarted);
+    profiling = false;
+}
+
+const FixedStatistic* openxc::util::profiler::stageStatistic(
+        LoopStage stage) {
+    return &stageStats[stage];
+}
+
+void openxc::util::profiler::logStatistics() {
+    if(!config::getConfiguration()->calculateMetrics || !initializedStats) {
+        return;
+    }
+
+    static unsigned long lastTimeLogged;
+    if(time::systemTimeMs() - lastTimeLogged >
+            LOOP_STATS_LOG_FREQUENCY_S * 1000) {
+        unsigned long cyclesPerUs = time::cyclesPerMicrosecond();
+        for(int i = 0; i <= LOOP_STAGE_COUNT; i++) {
+            debug("Loop %s time: min %d us, max %d us, avg %f us",
+                    STAGE_NAMES[i],
+                    (int)(statistics::minimum(&stageStats[i]) / cyclesPerUs),
+                    (int)(statistics::maximum(&stageStats[i]) / cyclesPerUs),
+                    statistics::exponentialMovingAverage(&stageStats[i]) /
+                        cyclesPerUs);
+        }
+        lastTimeLogged = time::systemTimeMs();
+    }
+}
+
+#else
+
+void openxc::util::profiler::startLoop() { }
+
+void openxc::util::profiler::endStage(LoopStage stage) { }
+
+void openxc::util::profiler::endLoop() { }
+
+const FixedStatistic* openxc::util::profiler::stageStatistic(
+        LoopStage stage) {
+    return NULL;
+}
+
+void openxc::util::profiler::logStatistics() { }
+
+#endif // METRICS_SUPPORT
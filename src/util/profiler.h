@@ -0,0 +1,69 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "util/statistics.h"
+
+namespace openxc {
+namespace util {
+namespace profiler {
+
+/* Public: The stages of the main firmware loop that are timed separately.
+ *
+ * CAN_RECEIVE - decoding and publishing received CAN messages.
+ * DIAGNOSTICS - sending diagnostic requests and OBD-II polling.
+ * USB_READ - reading and handling commands from USB.
+ * INTERFACE_READ - the cellular, BLE or UART interface and the network.
+ * CAN_WRITE - flushing the outgoing CAN message queues.
+ * STATISTICS - checking bus activity, lights, aggregates and metrics.
+ * EMULATOR - generating emulated data.
+ * FILESYSTEM - the SD card manager and RTC.
+ * PIPELINE - sending queued output to each interface.
+ */
+typedef enum {
+    CAN_RECEIVE,
+    DIAGNOSTICS,
+    USB_READ,
+    INTERFACE_READ,
+    CAN_WRITE,
+    STATISTICS,
+    EMULATOR,
+    FILESYSTEM,
+    PIPELINE,
+    LOOP_STAGE_COUNT
+} LoopStage;
+
+/* Public: Start timing a pass of the main loop. The loop is only timed while
+ * metrics are enabled (see calculateMetrics in the configuration), since
+ * updating the statistics costs a little time every pass.
+ */
+void startLoop();
+
+/* Public: Add the cycles since startLoop() or the previous endStage() to a
+ * stage. A stage can end more than once in a pass (e.g. once per CAN bus), and
+ * it's counted as the total.
+ */
+void endStage(LoopStage stage);
+
+/* Public: Finish timing a pass of the main loop, updating the min, max and
+ * moving average of each stage's cycles and of the whole pass.
+ */
+void endLoop();
+
+/* Public: Return the statistics of a stage's cycles per pass, or of the whole
+ * pass if stage is LOOP_STAGE_COUNT. Divide by
+ * openxc::util::time::cyclesPerMicrosecond() for microseconds. Returns NULL if
+ * METRICS_SUPPORT is compiled out.
+ */
+const openxc::util::statistics::FixedStatistic* stageStatistic(
+        LoopStage stage);
+
+/* Public: Log the time each stage of the main loop takes, in microseconds,
+ * periodically while metrics are enabled.
+ */
+void logStatistics();
+
+} // namespace profiler
+} // namespace util
+} // namespace openxc
+
+#endif // _PROFILER_H_
@@ -0,0 +1,23 @@
+#ifndef __RAM_FUNCTION_H__
+#define __RAM_FUNCTION_H__
+
+// 1 to run the functions marked RAM_FUNCTION from RAM. At 100MHz the LPC17xx
+// waits on flash for most instruction fetches outside its small prefetch
+// buffer, so the CAN receive and decode path runs faster from SRAM - at the
+// cost of the RAM its code takes, which comes out of the heap and stack.
+#ifndef RAM_FUNCTIONS
+#define RAM_FUNCTIONS 0
+#endif
+
+// Mark a function definition to be copied to RAM at startup with the
+// initialized data (see the .data section of LPC17xx-base.ld). It's kept out
+// of line so callers don't pull its body back into flash, and the linker adds
+// a veneer for calls between flash and RAM, which are too far apart for a
+// direct branch. Nothing changes on the other platforms.
+#if RAM_FUNCTIONS && defined(__LPC17XX__)
+#define RAM_FUNCTION __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAM_FUNCTION
+#endif
+
+#endif // __RAM_FUNCTION_H__
@@ -0,0 +1,65 @@
+#include "util/rate_group.h"
+#include "util/timer.h"
+#include <string.h>
+
+namespace time = openxc::util::time;
+
+using openxc::util::rategroup::Rate;
+using openxc::util::rategroup::Task;
+using openxc::util::rategroup::RATE_GROUP_COUNT;
+
+typedef struct {
+    Task tasks[RATE_GROUP_MAX_TASKS];
+    int taskCount;
+    unsigned long lastRunMs;
+} RateGroup;
+
+static const unsigned long PERIODS_MS[RATE_GROUP_COUNT] = {10, 100, 1000};
+
+static RateGroup groups[RATE_GROUP_COUNT];
+static unsigned long lastCheckMs;
+
+bool openxc::util::rategroup::addTask(Rate rate, Task task) {
+    RateGroup* group = &groups[rate];
+    for(int i = 0; i < group->taskCount; i++) {
+        if(group->tasks[i] == task) {
+            return true;
+        }
+    }
+
+    if(group->taskCount >= RATE_GROUP_MAX_TASKS) {
+        return false;
+    }
+    group->tasks[group->taskCount++] = task;
+    return true;
+}
+
+void openxc::util::rategroup::run() {
+    unsigned long now = time::systemTimeMs();
+    // Every period is a multiple of the fastest, so nothing can be due before
+    // it is
+    if(now - lastCheckMs < PERIODS_MS[0]) {
+        return;
+    }
+    lastCheckMs = now;
+
+    for(int i = 0; i < RATE_GROUP_COUNT; i++) {
+        RateGroup* group = &groups[i];
+        if(now - group->lastRunMs < PERIODS_MS[i]) {
+            continue;
+        }
+
+        group->lastRunMs = now;
+        for(int j = 0; j < group->taskCount; j++) {
+            group->tasks[j]();
+        }
+    }
+}
+
+void openxc::util::rategroup::clear() {
+    memset(groups, 0, sizeof(groups));
+    lastCheckMs = time::systemTimeMs();
+    for(int i = 0; i < RATE_GROUP_COUNT; i++) {
+        groups[i].lastRunMs = lastCheckMs;
+    }
+}
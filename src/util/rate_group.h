@@ -0,0 +1,53 @@
+#ifndef _RATE_GROUP_H_
+#define _RATE_GROUP_H_
+
+/* Public: The most tasks that can be added to one rate group.
+ */
+#ifndef RATE_GROUP_MAX_TASKS
+#define RATE_GROUP_MAX_TASKS 4
+#endif
+
+namespace openxc {
+namespace util {
+namespace rategroup {
+
+/* Public: How often the tasks in a rate group run. The fastest group comes
+ * first.
+ */
+typedef enum {
+    RATE_10_MS,
+    RATE_100_MS,
+    RATE_1_S,
+    RATE_GROUP_COUNT
+} Rate;
+
+/* Public: A piece of housekeeping work run from a rate group.
+ */
+typedef void (*Task)();
+
+/* Public: Run a task every period of a rate group, in the order the group's
+ * tasks were added. Adding a task that's already in the group does nothing, so
+ * it's safe to add the tasks again when the VI is re-initialized.
+ *
+ * Returns false if the group is already full.
+ */
+bool addTask(Rate rate, Task task);
+
+/* Public: Run the tasks of every rate group whose period is up. Call this each
+ * time through the main loop - unless the fastest group is due, it only reads
+ * the time once.
+ *
+ * A group that's run late starts its next period from when it actually ran, so
+ * it never runs twice in a row to catch up.
+ */
+void run();
+
+/* Public: Remove all tasks and restart every group's period.
+ */
+void clear();
+
+} // namespace rategroup
+} // namespace util
+} // namespace openxc
+
+#endif // _RATE_GROUP_H_
@@ -0,0 +1,154 @@
+#include "util/state_store.h"
+#include <string.h>
+
+namespace state_store = openxc::util::state_store;
+
+#define ERASED_SEQUENCE 0xffffffff
+
+// Word aligned for the platforms' flash writes
+static uint32_t slotBuffer[STATE_STORE_SLOT_SIZE / 4];
+static int currentSlot = -1;
+static int nextSlot;
+static uint32_t sequence;
+
+static void fletcher16(const uint8_t* data, size_t length, uint16_t* sum1,
+        uint16_t* sum2) {
+    for(size_t i = 0; i < length; i++) {
+        *sum1 = (*sum1 + data[i]) % 255;
+        *sum2 = (*sum2 + *sum1) % 255;
+    }
+}
+
+/* Private: Returns the checksum of a record - the sequence number, the length
+ * and length bytes of state.
+ */
+static uint16_t recordChecksum(const uint8_t* slot, size_t length) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    fletcher16(slot, 6, &sum1, &sum2);
+    fletcher16(&slot[STATE_STORE_HEADER_SIZE], length, &sum1, &sum2);
+    return (sum2 << 8) | sum1;
+}
+
+static uint32_t slotSequence(const uint8_t* slot) {
+    uint32_t value;
+    memcpy(&value, slot, sizeof(value));
+    return value;
+}
+
+static uint16_t slotLength(const uint8_t* slot) {
+    uint16_t length;
+    memcpy(&length, &slot[4], sizeof(length));
+    return length;
+}
+
+/* Private: Returns true if a slot holds a whole record.
+ */
+static bool validSlot(const uint8_t* slot) {
+    uint16_t length = slotLength(slot);
+    if(slotSequence(slot) == ERASED_SEQUENCE ||
+            length > STATE_STORE_MAX_LENGTH) {
+        return false;
+    }
+
+    uint16_t stored;
+    memcpy(&stored, &slot[6], sizeof(stored));
+    return stored == recordChecksum(slot, length);
+}
+
+uint16_t openxc::util::state_store::checksum(const void* data,
+        size_t length) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    fletcher16((const uint8_t*) data, length, &sum1, &sum2);
+    return (sum2 << 8) | sum1;
+}
+
+void openxc::util::state_store::initialize() {
+    size_t size;
+    const uint8_t* start = region(&size);
+    int slotCount = size / STATE_STORE_SLOT_SIZE;
+
+    currentSlot = -1;
+    nextSlot = slotCount;
+    sequence = 0;
+    for(int i = 0; i < slotCount; i++) {
+        const uint8_t* slot = &start[i * STATE_STORE_SLOT_SIZE];
+        if(slotSequence(slot) == ERASED_SEQUENCE) {
+            // Slots are used in order, so the first empty one is the next
+            nextSlot = i;
+            break;
+        }
+        if(validSlot(slot) && (currentSlot == -1 ||
+                slotSequence(slot) > sequence)) {
+            currentSlot = i;
+            sequence = slotSequence(slot);
+        }
+    }
+}
+
+bool openxc::util::state_store::load(void* state, size_t length) {
+    if(currentSlot == -1) {
+        return false;
+    }
+
+    size_t size;
+    const uint8_t* slot = &region(&size)[currentSlot * STATE_STORE_SLOT_SIZE];
+    if(slotLength(slot) != length) {
+        return false;
+    }
+    memcpy(state, &slot[STATE_STORE_HEADER_SIZE], length);
+    return true;
+}
+
+bool openxc::util::state_store::store(const void* state, size_t length) {
+    if(length > STATE_STORE_MAX_LENGTH) {
+        return false;
+    }
+
+    size_t size;
+    const uint8_t* start = region(&size);
+    int slotCount = size / STATE_STORE_SLOT_SIZE;
+    if(currentSlot != -1) {
+        const uint8_t* current = &start[currentSlot * STATE_STORE_SLOT_SIZE];
+        if(slotLength(current) == length && !memcmp(
+                    &current[STATE_STORE_HEADER_SIZE], state, length)) {
+            return true;
+        }
+    }
+
+    if(nextSlot >= slotCount) {
+        eraseRegion();
+        nextSlot = 0;
+    }
+
+    uint8_t* record = (uint8_t*) slotBuffer;
+    memset(record, 0xff, sizeof(slotBuffer));
+    uint32_t recordSequence = sequence + 1;
+    uint16_t recordLength = length;
+    memcpy(record, &recordSequence, sizeof(recordSequence));
+    memcpy(&record[4], &recordLength, sizeof(recordLength));
+    memcpy(&record[STATE_STORE_HEADER_SIZE], state, length);
+    uint16_t sum = recordChecksum(record, length);
+    memcpy(&record[6], &sum, sizeof(sum));
+
+    int slot = nextSlot++;
+    if(!writeSlot(slot, record) ||
+            !validSlot(&start[slot * STATE_STORE_SLOT_SIZE])) {
+        return false;
+    }
+    currentSlot = slot;
+    sequence = recordSequence;
+    return true;
+}
+
+bool openxc::util::state_store::copyCurrent(uint8_t* record) {
+    if(currentSlot == -1) {
+        return false;
+    }
+
+    size_t size;
+    memcpy(record, &region(&size)[currentSlot * STATE_STORE_SLOT_SIZE],
+            STATE_STORE_SLOT_SIZE);
+    return true;
+}
@@ -0,0 +1,109 @@
+#ifndef __STATE_STORE_H__
+#define __STATE_STORE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The size of each record in the store, and so the most state it can hold
+// with the header. The LPC17xx can't write less than 256 bytes of flash at a
+// time.
+#ifndef STATE_STORE_SLOT_SIZE
+#ifdef __LPC17XX__
+#define STATE_STORE_SLOT_SIZE 256
+#else
+#define STATE_STORE_SLOT_SIZE 64
+#endif
+#endif
+
+// A small store for state that should outlive a suspend or reset, kept in a
+// page of flash set aside by each platform. Each store() writes a new record
+// to the next empty slot instead of erasing the page, which only happens once
+// every slot has been used - so the page wears out that many times slower.
+//
+// Each slot is a record:
+//
+//  0: uint32 sequence number, one more than the record before it. Erased
+//     flash (0xffffffff) is an empty slot.
+//  4: uint16 length of the state
+//  6: uint16 Fletcher-16 checksum of the sequence number, length and state
+//  8: the state
+//
+// The record with the highest sequence number and a good checksum is the
+// current one, so a record cut short by a reset leaves the one before it.
+#define STATE_STORE_HEADER_SIZE 8
+#define STATE_STORE_MAX_LENGTH (STATE_STORE_SLOT_SIZE - STATE_STORE_HEADER_SIZE)
+
+namespace openxc {
+namespace util {
+namespace state_store {
+
+/* Public: Find the current record and the next empty slot. Call this before
+ * load() or store().
+ */
+void initialize();
+
+/* Public: Copy the current state into a buffer.
+ *
+ * state - The destination for the state.
+ * length - The size of the state. If the stored state isn't the same size,
+ *      e.g. it was written by firmware with a different layout, it isn't
+ *      loaded.
+ *
+ * Returns true if the state was loaded.
+ */
+bool load(void* state, size_t length);
+
+/* Public: Write a new record with the state, if it's changed since the
+ * current one.
+ *
+ * state - The state.
+ * length - The size of the state, at most STATE_STORE_MAX_LENGTH.
+ *
+ * Returns true if the state is stored.
+ */
+bool store(const void* state, size_t length);
+
+/* Public: Copy the current record as it's stored, for a platform that keeps
+ * the store in a flash page it shares. Before it erases the page to rewrite
+ * its own data, it can write the record back to slot 0 and call initialize()
+ * again.
+ *
+ * record - A buffer of STATE_STORE_SLOT_SIZE bytes, word aligned.
+ *
+ * Returns false if there's no current record.
+ */
+bool copyCurrent(uint8_t* record);
+
+/* Public: Return the Fletcher-16 checksum the store uses for its records, for
+ * other data kept in flash.
+ */
+uint16_t checksum(const void* data, size_t length);
+
+/* Public: Return the flash set aside for the store, implemented by each
+ * platform.
+ *
+ * size - (output) The size of the region, a multiple of
+ *      STATE_STORE_SLOT_SIZE.
+ */
+const uint8_t* region(size_t* size);
+
+/* Public: Erase the store's region back to all 1s, implemented by each
+ * platform.
+ */
+void eraseRegion();
+
+/* Public: Write one slot of the store's region, implemented by each platform.
+ * The slot must be erased.
+ *
+ * slot - The index of the slot.
+ * data - STATE_STORE_SLOT_SIZE bytes to write, word aligned.
+ *
+ * Returns true if the slot was written.
+ */
+bool writeSlot(int slot, const uint8_t* data);
+
+} // namespace state_store
+} // namespace util
+} // namespace openxc
+
+#endif // __STATE_STORE_H__
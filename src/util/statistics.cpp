@@ -17,6 +17,25 @@ void openxc::util::statistics::initialize(Statistic* stat) {
     stat->alpha = .1;
 }
 
+void openxc::util::statistics::initialize(FixedStatistic* stat) {
+    stat->min = INT_MAX;
+    stat->max = INT_MIN;
+    stat->scaledAverage = 0;
+    stat->shift = FIXED_STATISTIC_SHIFT;
+}
+
+void openxc::util::statistics::initialize(FixedDeltaStatistic* stat) {
+    stat->total = 0;
+    initialize(&stat->statistic);
+}
+
+void openxc::util::statistics::initialize(WindowStatistic* stat) {
+    stat->min = 0;
+    stat->max = 0;
+    stat->total = 0;
+    stat->count = 0;
+}
+
 void openxc::util::statistics::update(Statistic* stat, int newValue) {
     if(stat->min == INT_MAX && stat->max == INT_MIN) {
         stat->movingAverage = newValue;
@@ -35,6 +54,44 @@ void openxc::util::statistics::update(DeltaStatistic* stat, int newValue) {
     update(&stat->statistic, delta);
 }
 
+void openxc::util::statistics::update(FixedStatistic* stat, int newValue) {
+    if(stat->min == INT_MAX && stat->max == INT_MIN) {
+        stat->scaledAverage = newValue * (1 << stat->shift);
+    } else {
+        // average += alpha * (newValue - average), with everything scaled up
+        // by 1 / alpha
+        stat->scaledAverage += newValue - (stat->scaledAverage >> stat->shift);
+    }
+
+    stat->min = MIN(newValue, stat->min);
+    stat->max = MAX(newValue, stat->max);
+}
+
+void openxc::util::statistics::update(FixedDeltaStatistic* stat,
+        int newValue) {
+    int delta = newValue - stat->total;
+    stat->total = newValue;
+    update(&stat->statistic, delta);
+}
+
+void openxc::util::statistics::update(WindowStatistic* stat, float newValue) {
+    if(stat->count == 0) {
+        stat->min = stat->max = newValue;
+    } else {
+        stat->min = MIN(newValue, stat->min);
+        stat->max = MAX(newValue, stat->max);
+    }
+    stat->total += newValue;
+    stat->count++;
+}
+
+float openxc::util::statistics::mean(const WindowStatistic* stat) {
+    if(stat->count == 0) {
+        return 0;
+    }
+    return stat->total / stat->count;
+}
+
 float openxc::util::statistics::exponentialMovingAverage(const Statistic* stat) {
     return stat->movingAverage;
 }
@@ -43,6 +100,16 @@ float openxc::util::statistics::exponentialMovingAverage(const DeltaStatistic* s
     return exponentialMovingAverage(&stat->statistic);
 }
 
+float openxc::util::statistics::exponentialMovingAverage(
+        const FixedStatistic* stat) {
+    return (float) stat->scaledAverage / (1 << stat->shift);
+}
+
+float openxc::util::statistics::exponentialMovingAverage(
+        const FixedDeltaStatistic* stat) {
+    return exponentialMovingAverage(&stat->statistic);
+}
+
 int openxc::util::statistics::minimum(const Statistic* stat) {
     return stat->min;
 }
@@ -58,3 +125,19 @@ int openxc::util::statistics::maximum(const Statistic* stat) {
 int openxc::util::statistics::maximum(const DeltaStatistic* stat) {
     return stat->statistic.max;
 }
+
+int openxc::util::statistics::minimum(const FixedStatistic* stat) {
+    return stat->min;
+}
+
+int openxc::util::statistics::minimum(const FixedDeltaStatistic* stat) {
+    return stat->statistic.min;
+}
+
+int openxc::util::statistics::maximum(const FixedStatistic* stat) {
+    return stat->max;
+}
+
+int openxc::util::statistics::maximum(const FixedDeltaStatistic* stat) {
+    return stat->statistic.max;
+}
@@ -1,6 +1,22 @@
 #ifndef _STATISTICS_H_
 #define _STATISTICS_H_
 
+#include <stdint.h>
+
+/* Public: Set to 0 to compile out the bus, pipeline and loop statistics and
+ * the RAM they use. The calculateMetrics setting then has no effect.
+ */
+#ifndef METRICS_SUPPORT
+#define METRICS_SUPPORT 1
+#endif
+
+/* Public: The default window of a FixedStatistic's moving average, as a power
+ * of two - 3 is an alpha of 1/8, the closest to a Statistic's .1.
+ */
+#ifndef FIXED_STATISTIC_SHIFT
+#define FIXED_STATISTIC_SHIFT 3
+#endif
+
 namespace openxc {
 namespace util {
 namespace statistics {
@@ -26,6 +42,44 @@ typedef struct {
     Statistic statistic;
 } DeltaStatistic;
 
+/* Public: A Statistic whose moving average is kept in fixed point, with alpha
+ * a power of two so an update is only adds and shifts. Use it for values
+ * updated every pass of the main loop, or from an interrupt - without an FPU
+ * (e.g. on the LPC17xx) a Statistic's float math is done in software.
+ *
+ * min - holds the minimum value seen so far.
+ * max - holds the maximum value seen so far.
+ * scaledAverage - the exponential moving average seen so far, times
+ *      2^shift. Values must be within +/-2^(31 - shift) so it can't overflow.
+ * shift - alpha == 1 / 2^shift. The default is FIXED_STATISTIC_SHIFT.
+ */
+typedef struct {
+    int min;
+    int max;
+    int32_t scaledAverage;
+    uint8_t shift;
+} FixedStatistic;
+
+typedef struct {
+    int total;
+    FixedStatistic statistic;
+} FixedDeltaStatistic;
+
+/* Public: A helper struct for summarizing every value seen over a window, e.g.
+ * to send one message per interval in place of each sample.
+ *
+ * min - the minimum value seen since the statistic was initialized.
+ * max - the maximum value seen since the statistic was initialized.
+ * total - the sum of the values seen.
+ * count - the number of values seen.
+ */
+typedef struct {
+    float min;
+    float max;
+    float total;
+    unsigned int count;
+} WindowStatistic;
+
 /* Public: Initialize a new Statistic.
  *
  * stat - the Statistic to initialize.
@@ -34,6 +88,12 @@ void initialize(Statistic* stat);
 
 void initialize(DeltaStatistic* stat);
 
+void initialize(FixedStatistic* stat);
+
+void initialize(FixedDeltaStatistic* stat);
+
+void initialize(WindowStatistic* stat);
+
 /* Public: Update the statistic with a new observed value.
  *
  * stat - the Statistic object to update.
@@ -43,18 +103,41 @@ void update(Statistic* stat, int newValue);
 
 void update(DeltaStatistic* stat, int newValue);
 
+void update(FixedStatistic* stat, int newValue);
+
+void update(FixedDeltaStatistic* stat, int newValue);
+
+void update(WindowStatistic* stat, float newValue);
+
+/* Public: Return the mean of the values seen by a WindowStatistic, or 0 if it
+ * hasn't seen any.
+ */
+float mean(const WindowStatistic* stat);
+
 float exponentialMovingAverage(const Statistic* stat);
 
 float exponentialMovingAverage(const DeltaStatistic* stat);
 
+float exponentialMovingAverage(const FixedStatistic* stat);
+
+float exponentialMovingAverage(const FixedDeltaStatistic* stat);
+
 int minimum(const Statistic* stat);
 
 int minimum(const DeltaStatistic* stat);
 
+int minimum(const FixedStatistic* stat);
+
+int minimum(const FixedDeltaStatistic* stat);
+
 int maximum(const Statistic* stat);
 
 int maximum(const DeltaStatistic* stat);
 
+int maximum(const FixedStatistic* stat);
+
+int maximum(const FixedDeltaStatistic* stat);
+
 
 } // namespace statistics
 } // namespace util
@@ -0,0 +1,36 @@
+#include "util/task.h"
+#include "util/timer.h"
+#include <stddef.h>
+
+namespace time = openxc::util::time;
+
+using openxc::util::task::BackgroundTask;
+
+static BackgroundTask backgroundTask;
+static unsigned long lastRunMs;
+static bool running;
+
+void openxc::util::task::setBackgroundTask(BackgroundTask task) {
+    backgroundTask = task;
+    lastRunMs = time::systemTimeMs();
+}
+
+void openxc::util::task::yield() {
+    if(backgroundTask == NULL || running) {
+        return;
+    }
+
+    unsigned long now = time::systemTimeMs();
+    if(now - lastRunMs < TASK_YIELD_INTERVAL_MS) {
+        return;
+    }
+
+    lastRunMs = now;
+    running = true;
+    backgroundTask();
+    running = false;
+}
+
+bool openxc::util::task::yielding() {
+    return running;
+}
@@ -0,0 +1,46 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+/* Public: The minimum time between two runs of the background task from
+ * yield(), in milliseconds.
+ */
+#ifndef TASK_YIELD_INTERVAL_MS
+#define TASK_YIELD_INTERVAL_MS 1
+#endif
+
+namespace openxc {
+namespace util {
+namespace task {
+
+/* Public: A function that yield() runs to keep the time critical work going.
+ */
+typedef void (*BackgroundTask)();
+
+/* Public: Set the work that has to keep running at a minimum rate even while
+ * the main loop is stuck waiting in a long operation, e.g. draining the CAN
+ * receive queues and servicing USB.
+ *
+ * task - the function to run from yield(), or NULL to do nothing.
+ */
+void setBackgroundTask(BackgroundTask task);
+
+/* Public: Give the background task a chance to run from inside an operation
+ * that waits on something slow (a modem response, a socket write). Call it
+ * every time around the wait loop - it runs the task at most once every
+ * TASK_YIELD_INTERVAL_MS, and not at all if called from inside the task
+ * itself.
+ *
+ * The background task must not call back into the operation that's waiting,
+ * so it should stick to work that only queues data.
+ */
+void yield();
+
+/* Public: Returns true while yield() is running the background task.
+ */
+bool yielding();
+
+} // namespace task
+} // namespace util
+} // namespace openxc
+
+#endif // _TASK_H_
@@ -14,10 +14,28 @@ unsigned long openxc::util::time::uptimeMs() {
     return systemTimeMs() - startupTimeMs();
 }
 
-/* Private: Return the period in ms given the frequency in hertz.
+/* Private: Return the period in whole ms given the frequency in hertz, rounded
+ * up so that waiting for it is never shorter than the exact period.
  */
-static float frequencyToPeriod(float frequency) {
-    return 1 / frequency * MS_PER_SECOND;
+static unsigned long frequencyToPeriod(float frequency) {
+    if(frequency <= 0) {
+        return 0;
+    }
+
+    float exactPeriod = MS_PER_SECOND / frequency;
+    unsigned long period = (unsigned long) exactPeriod;
+    if(period < exactPeriod) {
+        ++period;
+    }
+    return period;
+}
+
+unsigned long openxc::util::time::period(FrequencyClock* clock) {
+    if(clock->frequency != clock->periodFrequency) {
+        clock->periodMs = frequencyToPeriod(clock->frequency);
+        clock->periodFrequency = clock->frequency;
+    }
+    return clock->periodMs;
 }
 
 bool openxc::util::time::conditionalTick(FrequencyClock* clock) {
@@ -35,28 +53,61 @@ static openxc::util::time::TimeFunction getTimeFunction(
        openxc::util::time::systemTimeMs;
 }
 
-bool openxc::util::time::elapsed(FrequencyClock* clock, bool stagger) {
-    if(clock == NULL) {
-        return true;
-    }
-
-    float period = frequencyToPeriod(clock->frequency);
-    float elapsedTime = 0;
+/* Private: Returns true if the period (in ms, 0 for unlimited) has passed
+ * since the clock last ticked.
+ */
+static bool elapsedAtPeriod(openxc::util::time::FrequencyClock* clock,
+        unsigned long period, bool stagger) {
+    unsigned long elapsedTime = 0;
     if(!started(clock) && stagger) {
-        clock->lastTick = getTimeFunction(clock)() - (rand() % int(period));
+        clock->lastTick = getTimeFunction(clock)() -
+                (period > 0 ? rand() % period : 0);
     } else {
         // Make sure it ticks the the first call to conditionalTick(...)
         elapsedTime = !started(clock) ? period :
                 getTimeFunction(clock)() - clock->lastTick;
     }
 
-    return clock->frequency == 0 || elapsedTime >= period;
+    return period == 0 || elapsedTime >= period;
+}
+
+bool openxc::util::time::elapsed(FrequencyClock* clock, bool stagger) {
+    if(clock == NULL) {
+        return true;
+    }
+    return elapsedAtPeriod(clock, period(clock), stagger);
 }
 
 void openxc::util::time::tick(FrequencyClock* clock) {
     clock->lastTick = getTimeFunction(clock)();
 }
 
+void openxc::util::time::setPhase(FrequencyClock* clock,
+        unsigned long offsetMs) {
+    unsigned long clockPeriod = period(clock);
+    if(clockPeriod > 0) {
+        // This can wrap below 0 soon after startup, which is fine since the
+        // elapsed time is found by subtracting it from the current time
+        clock->lastTick = getTimeFunction(clock)() - clockPeriod +
+                offsetMs % clockPeriod;
+        if(!started(clock)) {
+            // 0 means the clock has never ticked, so tick a millisecond later
+            // rather than forgetting the phase
+            clock->lastTick = 1;
+        }
+    }
+}
+
+unsigned long openxc::util::time::phaseOffset(int index, int count,
+        unsigned long periodMs) {
+    if(count <= 0) {
+        return 0;
+    }
+    // Multiply first so small periods with many clocks still spread out, in
+    // 64 bits since that can overflow with long periods
+    return (unsigned long) ((unsigned long long) periodMs * index / count);
+}
+
 bool openxc::util::time::conditionalTick(FrequencyClock* clock, bool stagger) {
     bool tick = elapsed(clock, stagger);
     if(tick) {
@@ -66,8 +117,26 @@ bool openxc::util::time::conditionalTick(FrequencyClock* clock, bool stagger) {
     return tick;
 }
 
+bool openxc::util::time::scaledConditionalTick(FrequencyClock* clock,
+        float scale) {
+    if(clock == NULL) {
+        return true;
+    }
+
+    // The common case is an unscaled pipeline, which can use the cached period
+    unsigned long scaledPeriod = scale == 1 ? period(clock) :
+            frequencyToPeriod(clock->frequency * scale);
+    bool tick = elapsedAtPeriod(clock, scaledPeriod, false);
+    if(tick) {
+        clock->lastTick = getTimeFunction(clock)();
+    }
+    return tick;
+}
+
 void openxc::util::time::initializeClock(FrequencyClock* clock) {
     clock->lastTick = 0;
     clock->frequency = 0;
     clock->timeFunction = systemTimeMs;
+    clock->periodMs = 0;
+    clock->periodFrequency = 0;
 }
@@ -12,11 +12,21 @@ typedef unsigned long (*TimeFunction)();
  * frequency - the clock freuquency in Hz.
  * lastTime - the last time (in milliseconds since startup) that the clock
  *      ticked.
+ * timeFunction - the function to read the time from, or NULL for
+ *      systemTimeMs.
+ * periodMs - the period for periodFrequency in whole milliseconds, rounded up,
+ *      so the clock can be checked without any floating point math.
+ * periodFrequency - the frequency periodMs was computed for. If it doesn't
+ *      match frequency (e.g. the frequency was changed, or the clock was
+ *      initialized with only a frequency), the period is recomputed the next
+ *      time it's needed. Generated code can fill in both to skip that.
  */
 typedef struct {
     float frequency;
     unsigned long lastTick;
     TimeFunction timeFunction;
+    unsigned long periodMs;
+    float periodFrequency;
 } FrequencyClock;
 
 /* Public: Initialize a FrequencyClock structure back to a fresh start - never
@@ -35,7 +45,8 @@ void initializeClock(FrequencyClock* clock);
  * stagger - If true, adds a random offset to the starting time (between 0 and 1
  *      full period), which is useful if you are initializing multiple clocks
  *      and you want to stagger their ticks. This only applies to the first tick
- *      of the clock.
+ *      of the clock. Random offsets can still land close together - use
+ *      setPhase to spread a known set of clocks evenly.
  *
  * Return true if the clock should tick.
  */
@@ -46,6 +57,14 @@ bool conditionalTick(FrequencyClock* clock, bool stagger);
  */
 bool conditionalTick(FrequencyClock* clock);
 
+/* Public: The same as conditionalTick(FrequencyClock), but as if the clock's
+ * frequency was multiplied by scale. The clock's frequency isn't modified, and
+ * a clock with a frequency of 0 (unlimited) stays unlimited.
+ *
+ * scale - the frequency multiplier, e.g. 0.5 to tick half as often.
+ */
+bool scaledConditionalTick(FrequencyClock* clock, float scale);
+
 /* Public: Determine if the clock's tick timer has elapsed and it should tick.
  * Does *not* actually tick the clock.
  *
@@ -55,6 +74,32 @@ bool conditionalTick(FrequencyClock* clock);
  */
 bool elapsed(FrequencyClock* clock, bool stagger);
 
+/* Public: Return the clock's period in milliseconds, rounded up, or 0 if its
+ * frequency is 0. It's only computed when the frequency changes.
+ */
+unsigned long period(FrequencyClock* clock);
+
+/* Public: Set a clock back so its next tick is offsetMs from now, instead of
+ * right away. Clocks sharing a period that are given different offsets tick at
+ * different points in it, rather than all on the same pass through the main
+ * loop - see phaseOffset. A clock with a frequency of 0 is left alone.
+ *
+ * clock - The clock to set.
+ * offsetMs - How far into its period the clock should next tick, in
+ *      milliseconds. An offset of a full period or more wraps around.
+ */
+void setPhase(FrequencyClock* clock, unsigned long offsetMs);
+
+/* Public: Return the offset into a period, in milliseconds, for one of a
+ * number of clocks sharing that period, so that all of them are spread evenly
+ * over it. The first clock's offset is always 0.
+ *
+ * index - The position of the clock among those sharing the period.
+ * count - The number of clocks sharing the period.
+ * periodMs - The period, in milliseconds.
+ */
+unsigned long phaseOffset(int index, int count, unsigned long periodMs);
+
 /* Public: Force the clock to tick, regardless of it its time has actually
  * elapsed.
  */
@@ -68,6 +113,23 @@ void delayMs(unsigned long delayInMs);
  */
 unsigned long systemTimeMs();
 
+/* Public: Return the current system time in microseconds, for timing intervals
+ * shorter than a millisecond. This wraps around about every 71 minutes, so
+ * only compare two of these times by subtracting them.
+ */
+unsigned long systemTimeUs();
+
+/* Public: Return a free-running count of processor cycles, for timing short
+ * stretches of code. On PIC32 this is the core timer, which runs at half the
+ * CPU clock. It wraps around often (every few seconds to a minute), so only
+ * compare two of these counts by subtracting them.
+ */
+unsigned long cycleCount();
+
+/* Public: Return the number of cycleCount() ticks in a microsecond.
+ */
+unsigned long cyclesPerMicrosecond();
+
 /* Public: Perform any one-time initialization required to use system times,
  * including those for system time and the delayMs function.
  */
@@ -0,0 +1,94 @@
+#include "util/wall_clock.h"
+#include "util/timer.h"
+#include "util/log.h"
+
+namespace time = openxc::util::time;
+
+using openxc::util::log::debug;
+
+#define US_PER_SECOND 1000000
+
+static uint64_t localUs;
+static unsigned long lastSystemUs;
+static bool counting;
+
+// Unix time is the localTimeUs() plus the offset
+static bool set;
+static bool synchronized;
+static int64_t offsetUs;
+// The offsets every RTC reading since the last step agrees with
+static int64_t minOffsetUs;
+static int64_t maxOffsetUs;
+
+uint64_t openxc::util::wallclock::localTimeUs() {
+    unsigned long systemUs = time::systemTimeUs();
+    if(!counting) {
+        lastSystemUs = systemUs;
+        counting = true;
+    }
+    localUs += (unsigned long) (systemUs - lastSystemUs);
+    lastSystemUs = systemUs;
+    return localUs;
+}
+
+void openxc::util::wallclock::update() {
+    localTimeUs();
+}
+
+bool openxc::util::wallclock::toUnixTimeUs(uint64_t local,
+        uint64_t* timeUs) {
+    if(!set) {
+        return false;
+    }
+    *timeUs = local + offsetUs;
+    return true;
+}
+
+bool openxc::util::wallclock::now(uint64_t* timeUs) {
+    return toUnixTimeUs(localTimeUs(), timeUs);
+}
+
+void openxc::util::wallclock::setFromSeconds(uint32_t unixSeconds) {
+    if(synchronized) {
+        return;
+    }
+
+    int64_t lowest = (int64_t) unixSeconds * US_PER_SECOND -
+            (int64_t) localTimeUs();
+    int64_t highest = lowest + US_PER_SECOND - 1;
+    if(set && lowest <= maxOffsetUs && highest >= minOffsetUs) {
+        minOffsetUs = lowest > minOffsetUs ? lowest : minOffsetUs;
+        maxOffsetUs = highest < maxOffsetUs ? highest : maxOffsetUs;
+    } else {
+        minOffsetUs = lowest;
+        maxOffsetUs = highest;
+    }
+    offsetUs = minOffsetUs + (maxOffsetUs - minOffsetUs) / 2;
+    set = true;
+}
+
+bool openxc::util::wallclock::synchronize(uint64_t hostSentUs,
+        uint64_t receivedUs, uint64_t sentUs, uint64_t hostReceivedUs) {
+    if(hostReceivedUs < hostSentUs || sentUs < receivedUs ||
+            hostReceivedUs - hostSentUs < sentUs - receivedUs) {
+        debug("Time sync exchange is inconsistent, ignoring it");
+        return false;
+    }
+
+    offsetUs = ((int64_t) (hostSentUs - receivedUs) +
+            (int64_t) (hostReceivedUs - sentUs)) / 2;
+    set = true;
+    synchronized = true;
+    debug("Synced clock with host, round trip %lu us", (unsigned long) (
+                (hostReceivedUs - hostSentUs) - (sentUs - receivedUs)));
+    return true;
+}
+
+bool openxc::util::wallclock::hostSynchronized() {
+    return synchronized;
+}
+
+void openxc::util::wallclock::reset() {
+    set = false;
+    synchronized = false;
+}
@@ -0,0 +1,80 @@
+#ifndef __WALL_CLOCK_H__
+#define __WALL_CLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A clock for absolute timestamps with more resolution than its sources. It
+// counts microseconds with the system timer, and keeps an offset from that
+// count to Unix time, set from whole seconds of an RTC or, more accurately,
+// from a time sync exchange with a host.
+//
+// An RTC reading of s seconds only says the time is somewhere in [s, s + 1),
+// so the offset is narrowed to what every reading since the last step agrees
+// on, and set to the middle of that. A reading that disagrees with the rest
+// (e.g. the RTC was set) starts over from it.
+
+namespace openxc {
+namespace util {
+namespace wallclock {
+
+/* Public: Return a count of microseconds since startup that doesn't wrap
+ * around, extended from time::systemTimeUs(). It has to be called at least
+ * once every time the system time in microseconds wraps around - see update().
+ */
+uint64_t localTimeUs();
+
+/* Public: Keep the clock counting. Call this from the main loop.
+ */
+void update();
+
+/* Public: Look up the current time.
+ *
+ * timeUs - (output) Microseconds since the Unix epoch.
+ *
+ * Returns false if the clock hasn't been set yet.
+ */
+bool now(uint64_t* timeUs);
+
+/* Public: Convert a localTimeUs() to Unix time.
+ *
+ * Returns false if the clock hasn't been set yet.
+ */
+bool toUnixTimeUs(uint64_t localUs, uint64_t* timeUs);
+
+/* Public: Discipline the clock with the whole seconds read from an RTC just
+ * now. It's ignored once the clock has been synced with a host.
+ */
+void setFromSeconds(uint32_t unixSeconds);
+
+/* Public: Set the clock from a request and response with a host, the way NTP
+ * does: the host sends its time, the VI notes when it received that and when
+ * it sent its reply, and the host says when the reply arrived. Assuming the
+ * trip takes as long each way, the host's clock was halfway between its two
+ * times when the VI was halfway between its own.
+ *
+ * hostSentUs - The host's time when it sent the request, in microseconds
+ *      since the Unix epoch.
+ * receivedUs - The localTimeUs() when the VI received the request.
+ * sentUs - The localTimeUs() when the VI sent its reply.
+ * hostReceivedUs - The host's time when the reply arrived.
+ *
+ * Returns false if the times are inconsistent, e.g. the round trip was shorter
+ * than the time the VI took to reply, leaving the clock as it was.
+ */
+bool synchronize(uint64_t hostSentUs, uint64_t receivedUs, uint64_t sentUs,
+        uint64_t hostReceivedUs);
+
+/* Public: Returns true if the clock was set by synchronize().
+ */
+bool hostSynchronized();
+
+/* Public: Forget the time, as at startup.
+ */
+void reset();
+
+} // namespace wallclock
+} // namespace util
+} // namespace openxc
+
+#endif // __WALL_CLOCK_H__
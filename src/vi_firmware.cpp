@@ -1,5 +1,11 @@
 #include "interface/usb.h"
 #include "can/canread.h"
+#include "can/canqueue.h"
+#include "can/autobaud.h"
+#include "can/survey.h"
+#include "can/learn.h"
+#include "can/selftest.h"
+#include "can/j1939.h"
 #include "interface/uart.h"
 #include "interface/network.h"
 #include "signals.h"
@@ -7,6 +13,12 @@
 #include "cJSON.h"
 #include "pipeline.h"
 #include "util/timer.h"
+#include "util/profiler.h"
+#include "util/task.h"
+#include "util/rate_group.h"
+#include "util/state_store.h"
+#include "util/wall_clock.h"
+#include "util/memory.h"
 #include "lights.h"
 #include "power.h"
 #include "bluetooth.h"
@@ -16,9 +28,18 @@
 #include "platform/platform.h"
 #include "diagnostics.h"
 #include "obd2.h"
+#include "shared_handlers.h"
+#include "virtual_signals.h"
 #include "data_emulator.h"
+#include "message_sets.h"
+#include "signal_loader.h"
+#include "capture.h"
+#include "snapshot.h"
+#include "decode_profiles.h"
 #include "config.h"
+#include "saved_config.h"
 #include "commands/commands.h"
+#include "commands/write_ack_command.h"
 #include "platform/pic32/nvm.h"
 
 #ifdef RTC_SUPPORT
@@ -33,8 +54,15 @@ namespace fs = openxc::interface::fs;
 namespace usb = openxc::interface::usb;
 namespace lights = openxc::lights;
 namespace can = openxc::can;
+namespace autobaud = openxc::can::autobaud;
+namespace survey = openxc::can::survey;
+namespace learn = openxc::can::learn;
+namespace selftest = openxc::can::selftest;
+namespace j1939 = openxc::can::j1939;
 namespace platform = openxc::platform;
 namespace time = openxc::util::time;
+namespace statistics = openxc::util::statistics;
+namespace memory = openxc::util::memory;
 namespace signals = openxc::signals;
 namespace diagnostics = openxc::diagnostics;
 namespace power = openxc::power;
@@ -44,6 +72,14 @@ namespace config = openxc::config;
 namespace telit = openxc::telitHE910;
 namespace server_task = openxc::server_task;
 namespace nvm = openxc::nvm;
+namespace profiler = openxc::util::profiler;
+namespace task = openxc::util::task;
+namespace rategroup = openxc::util::rategroup;
+namespace capture = openxc::capture;
+namespace snapshot = openxc::snapshot;
+namespace profiles = openxc::profiles;
+namespace state_store = openxc::util::state_store;
+namespace wallclock = openxc::util::wallclock;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBuses;
@@ -60,9 +96,43 @@ using openxc::config::RunLevel;
 static bool BUS_WAS_ACTIVE;
 static bool SUSPENDED;
 
+// The milliseconds to wait at the end of initializeVehicleInterface()
+#define STARTUP_SETTLE_MS 500
+
+/* Private: A received CAN message held back while the outputs start up.
+ */
+typedef struct {
+    CanBus* bus;
+    CanMessage message;
+} EarlyCanMessage;
+
+// A ring, so a listen suspend can keep the most recent frames - it's only
+// ever appended to otherwise.
+static EarlyCanMessage EARLY_CAN_MESSAGES[CAN_EARLY_CAPTURE_DEPTH];
+static int earlyCanMessageStart;
+static int earlyCanMessageCount;
+
+/* Private: The steps of initializeIO(), one per pass of the main loop.
+ *
+ * IO_STAGE_FILESYSTEM - the RTC and SD card.
+ * IO_STAGE_USB - USB.
+ * IO_STAGE_UART - the UART.
+ * IO_STAGE_WIRELESS - BLE or the Bluetooth module.
+ * IO_STAGE_NETWORK - Ethernet.
+ */
+typedef enum {
+    IO_STAGE_FILESYSTEM,
+    IO_STAGE_USB,
+    IO_STAGE_UART,
+    IO_STAGE_WIRELESS,
+    IO_STAGE_NETWORK,
+    IO_STAGE_COUNT
+} IoStage;
+
+static int nextIoStage;
+
 /* Public: Update the color and status of a board's light that shows the output
- * interface status. This function is intended to be called each time through
- * the main program loop.
+ * interface status. The main loop runs this from its 100ms rate group.
  */
 void updateInterfaceLight() {
 	//Interface connected = green led enabled/attached
@@ -95,11 +165,117 @@ void updateInterfaceLight() {
 
 }
 
+#if LISTEN_SUSPEND
+#ifdef LISTEN_SUSPEND_WAKE_IDS
+static const uint32_t WAKE_IDS[] = {LISTEN_SUSPEND_WAKE_IDS};
+#endif
+
+/* Private: Returns true if a frame with this ID ends a listen suspend.
+ */
+static bool isWakeId(uint32_t id) {
+    #ifdef LISTEN_SUSPEND_WAKE_IDS
+    for(size_t i = 0; i < sizeof(WAKE_IDS) / sizeof(WAKE_IDS[0]); i++) {
+        if(WAKE_IDS[i] == id) {
+            return true;
+        }
+    }
+    return false;
+    #else
+    return true;
+    #endif
+}
+
+/* Private: Move everything in the bus's receive queue into the early capture
+ * buffer, overwriting the oldest frames once it's full, so the receive queue
+ * never fills up and drops the wake frame.
+ *
+ * Returns true if one of the frames was a wake ID.
+ */
+static bool listenForWake(CanBus* bus) {
+    bool wake = false;
+    CanMessage message;
+    while(can::queue::pop(&bus->receiveQueue, &message)) {
+        if(earlyCanMessageCount == CAN_EARLY_CAPTURE_DEPTH) {
+            earlyCanMessageStart = (earlyCanMessageStart + 1) %
+                    CAN_EARLY_CAPTURE_DEPTH;
+            --earlyCanMessageCount;
+        }
+        EarlyCanMessage* early = &EARLY_CAN_MESSAGES[(earlyCanMessageStart +
+                earlyCanMessageCount) % CAN_EARLY_CAPTURE_DEPTH];
+        early->bus = bus;
+        early->message = message;
+        ++earlyCanMessageCount;
+        wake = wake || isWakeId(message.id);
+    }
+    return wake;
+}
+
+/* Private: Suspend with CAN receive still running at a low clock until a wake
+ * ID arrives, then start back up to ALL_IO without a reset. The frames received
+ * in the meantime are replayed once the outputs are up, so the ones that woke
+ * the VI aren't lost.
+ */
+static void listenUntilWake() {
+    platform::enterListenSuspend(&getConfiguration()->pipeline);
+
+    bool wake = false;
+    while(!wake) {
+        for(int i = 0; i < getCanBusCount(); i++) {
+            wake = listenForWake(&getCanBuses()[i]) || wake;
+        }
+        if(!wake) {
+            power::waitForInterrupt();
+        }
+    }
+
+    platform::exitListenSuspend();
+    debug("Woke up from listening with %d CAN messages",
+            earlyCanMessageCount);
+    nextIoStage = 0;
+    getConfiguration()->runLevel = RunLevel::CAN_ONLY;
+    getConfiguration()->desiredRunLevel = RunLevel::ALL_IO;
+}
+#endif
+
+/* Private: Put the VI to sleep until CAN activity wakes it, or the snapshot
+ * timer if there is one.
+ */
+static void suspendVehicleInterface() {
+    #ifdef RTC_SUPPORT
+    rtc_timer_ms_deinit();
+    #endif
+    #if PERSIST_HANDLER_STATE
+    signals::handlers::saveState();
+    #endif
+    #if LISTEN_SUSPEND
+    // Actively checking for the ignition over OBD-II relies on the watchdog
+    // resetting the VI out of a full suspend
+    if(getConfiguration()->powerManagement !=
+            PowerManagement::OBD2_IGNITION_CHECK ||
+            getConfiguration()->passiveIgnitionCheck) {
+        listenUntilWake();
+        return;
+    }
+    #endif
+    platform::suspend(&getConfiguration()->pipeline);
+}
+
 /* Public: Update the color and status of a board's light that shows the status
- * of the CAN bus. This function is intended to be called each time through the
- * main program loop.
+ * of the CAN bus. The main loop runs this from its 10ms rate group.
  */
 void checkBusActivity() {
+    if(snapshot::active()) {
+        // The responses to the snapshot's own requests look like CAN waking
+        // up, so the usual checks wait until it's over. If the vehicle really
+        // did wake up, its CAN traffic wakes the VI again right away.
+        if(snapshot::update(&getConfiguration()->pipeline)) {
+            SUSPENDED = true;
+            BUS_WAS_ACTIVE = false;
+            suspendVehicleInterface();
+        }
+        return;
+    }
+
     bool busActive = false;
     for(int i = 0; i < getCanBusCount(); i++) {
         busActive = busActive || can::busActive(&getCanBuses()[i]);
@@ -124,6 +300,9 @@ void checkBusActivity() {
     
         BUS_WAS_ACTIVE = true;
         SUSPENDED = false;
+        #ifdef FS_SUPPORT
+        fs::markTrip(getConfiguration()->fs, true);
+        #endif
     } else if(!busActive && (BUS_WAS_ACTIVE || (time::uptimeMs() >
             (unsigned long)openxc::can::CAN_ACTIVE_TIMEOUT_S * 1000 &&
             !SUSPENDED))) {
@@ -137,16 +316,18 @@ void checkBusActivity() {
         
         
         SUSPENDED = true;
+        #ifdef FS_SUPPORT
+        if(BUS_WAS_ACTIVE) {
+            fs::markTrip(getConfiguration()->fs, false);
+        }
+        #endif
         BUS_WAS_ACTIVE = false;
         #ifdef FS_SUPPORT
         if(fs::getmode() !=  FS_STATE::USB_CONNECTED){
         #endif        
         if(getConfiguration()->powerManagement != PowerManagement::ALWAYS_ON) {
             // stay awake at least CAN_ACTIVE_TIMEOUT_S after power on
-        #ifdef RTC_SUPPORT
-        rtc_timer_ms_deinit();
-        #endif
-            platform::suspend(&getConfiguration()->pipeline);
+            suspendVehicleInterface();
         }
 #ifdef FS_SUPPORT
         }
@@ -154,68 +335,360 @@ void checkBusActivity() {
     }
 }
 
+/* Private: Returns true if the bus's controller should send ACKs and allow
+ * writes, rather than only listen.
+ */
+static bool busWritable(CanBus* bus) {
+    return bus->rawWritable || getConfiguration()->sendCanAcks ||
+            can::signalsWritable(bus, getSignals(), getSignalCount());
+}
+
 void initializeAllCan() {
     for(int i = 0; i < getCanBusCount(); i++) {
         CanBus* bus = &(getCanBuses()[i]);
-
-        bool writable = bus->rawWritable ||
-            can::signalsWritable(bus, getSignals(), getSignalCount());
-        if(getConfiguration()->sendCanAcks) {
-            writable = true;
+        // A bus whose speed isn't known yet only listens until it's found, so
+        // it never disturbs the bus at the wrong speed
+        if(autobaud::enabled(bus)) {
+            can::initialize(bus, false, getCanBuses(), getCanBusCount());
+            autobaud::start(bus, getCanBuses(), getCanBusCount());
+        } else {
+            can::initialize(bus, busWritable(bus), getCanBuses(),
+                    getCanBusCount());
         }
-        can::initialize(bus, writable, getCanBuses(), getCanBusCount());
     }
 }
 
-/*
- * Check to see if a packet has been received. If so, read the packet and print
- * the packet payload to the uart monitor.
+/* Private: Pull received CAN messages off of the bus's receive queue and
+ * decode them.
+ *
+ * Up to bus->maxReceiveBatchSize frames are handled in one pass, stopping early
+ * if the queue empties or the bus's receiveBatchBudgetMs runs out, so a busy
+ * bus can't starve the rest of the main loop.
  */
-void receiveCan(Pipeline* pipeline, CanBus* bus) {
-    if(!QUEUE_EMPTY(CanMessage, &bus->receiveQueue)) {
-        CanMessage message = QUEUE_POP(CanMessage, &bus->receiveQueue);
-        signals::decodeCanMessage(pipeline, bus, &message);
-        if(bus->passthroughCanMessages) {
-            openxc::can::read::passthroughMessage(bus, &message, getMessages(),
+#ifdef FS_SUPPORT
+/* Private: If the SD card is in raw CAN log mode, write the frame to it as is,
+ * before any decoding.
+ */
+static void logRawCanMessage(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    if(pipeline->fs == NULL || !pipeline->fs->rawCanLog ||
+            !fs::connected(pipeline->fs)) {
+        return;
+    }
+
+    uint64_t timestamp;
+    if(!openxc::pipeline::currentTimestamp(&timestamp)) {
+        timestamp = time::uptimeMs();
+    }
+    fs::logCanMessage(pipeline->fs, bus->address, message->id,
+            message->format == CanMessageFormat::EXTENDED, message->data,
+            message->length, timestamp);
+}
+#endif
+
+/* Private: Decode and publish a received CAN message, and give it to the
+ * diagnostics manager.
+ */
+static void handleCanMessage(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    // Everything published for this message is stamped with when it was
+    // received, not when it got to the front of the queue
+    openxc::pipeline::setReceiveTime(message->receivedUs);
+    capture::record(bus, message);
+    #ifdef FS_SUPPORT
+    logRawCanMessage(pipeline, bus, message);
+    #endif
+    // A survey sends a summary of the bus instead of its frames
+    bool passthrough = bus->passthroughCanMessages && !bus->surveying;
+    if(bus->surveying) {
+        survey::record(bus, message);
+    }
+    selftest::record(bus, message);
+    if(bus->j1939) {
+        j1939::receive(bus, message, pipeline);
+    }
+    if(bus->learningFilters) {
+        learn::record(bus, message, getMessages(), getMessageCount(),
+                getCanBuses(), getCanBusCount());
+    }
+    if(signals::loader::decodeCanMessage(pipeline, bus, message)) {
+        if(passthrough) {
+            openxc::can::read::passthroughMessage(bus, message,
+                    signals::loader::getMessages(),
+                    signals::loader::getMessageCount(), pipeline);
+        }
+    } else {
+        signals::decodeCanMessage(pipeline, bus, message);
+        if(passthrough) {
+            openxc::can::read::passthroughMessage(bus, message, getMessages(),
                     getMessageCount(), pipeline);
         }
+    }
 
-        bus->lastMessageReceived = time::systemTimeMs();
-        ++bus->messagesReceived;
+    bus->lastMessageReceived = time::systemTimeMs();
+    ++bus->messagesReceived;
+    bus->bitsReceived += can::frameBitLength(message);
 
-        diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
-                bus, &message, pipeline);
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+            bus, message, pipeline);
+    openxc::pipeline::setReceiveTime(0);
+}
+
+static int receiveBatchLimit(CanBus* bus) {
+    return bus->maxReceiveBatchSize > 0 ?
+            bus->maxReceiveBatchSize : DEFAULT_CAN_RECEIVE_BATCH_SIZE;
+}
+
+static bool receiveBudgetSpent(CanBus* bus, unsigned long batchStarted) {
+    return bus->receiveBatchBudgetMs > 0 && bus->lastMessageReceived -
+            batchStarted >= bus->receiveBatchBudgetMs;
+}
+
+static void finishReceiveBatch(CanBus* bus, int handled) {
+    if(handled > 0) {
+        bus->lastReceiveBatchSize = handled;
+        #if METRICS_SUPPORT
+        if(getConfiguration()->calculateMetrics) {
+            statistics::update(&bus->receiveBatchStats, handled);
+        }
+        #endif
     }
 }
 
+void receiveCan(Pipeline* pipeline, CanBus* bus) {
+    int maxBatchSize = receiveBatchLimit(bus);
+    unsigned long batchStarted = time::systemTimeMs();
+    int handled = 0;
+    CanMessage message;
+    while(handled < maxBatchSize &&
+            can::queue::pop(&bus->receiveQueue, &message)) {
+        handleCanMessage(pipeline, bus, &message);
+        ++handled;
+
+        if(receiveBudgetSpent(bus, batchStarted)) {
+            break;
+        }
+    }
+    finishReceiveBatch(bus, handled);
+}
+
+/* Private: Returns the index of the bus whose oldest queued frame was received
+ * first, out of the ones not in the skipped bitfield, or -1 if none of them
+ * has a frame queued.
+ */
+static int earliestBus(CanBus* buses, const int busCount, uint32_t skipped) {
+    int earliest = -1;
+    unsigned long earliestUs = 0;
+    for(int i = 0; i < busCount && i < 32; i++) {
+        unsigned long receivedUs;
+        if((skipped & (1UL << i)) || !can::queue::peekReceivedUs(
+                    &buses[i].receiveQueue, &receivedUs)) {
+            continue;
+        }
+        // Compared by difference, since the microsecond clock wraps
+        if(earliest == -1 || (long) (receivedUs - earliestUs) < 0) {
+            earliest = i;
+            earliestUs = receivedUs;
+        }
+    }
+    return earliest;
+}
+
+/* Public: Handle the frames waiting in the receive queues of all of the buses,
+ * oldest first across them (see CAN_ORDERED_RECEIVE). Each bus still handles
+ * no more than its batch of frames, and stops once its receiveBatchBudgetMs
+ * runs out, counted from the start of the pass.
+ */
+void receiveCanInOrder(Pipeline* pipeline, CanBus* buses, const int busCount) {
+    unsigned long batchStarted = time::systemTimeMs();
+    uint32_t finished = 0;
+    int handled[32] = {0};
+    CanMessage message;
+    int index;
+    while((index = earliestBus(buses, busCount, finished)) != -1) {
+        CanBus* bus = &buses[index];
+        can::queue::pop(&bus->receiveQueue, &message);
+        handleCanMessage(pipeline, bus, &message);
+        if(++handled[index] >= receiveBatchLimit(bus) ||
+                receiveBudgetSpent(bus, batchStarted)) {
+            finished |= 1UL << index;
+        }
+    }
+
+    for(int i = 0; i < busCount && i < 32; i++) {
+        finishReceiveBatch(&buses[i], handled[i]);
+    }
+}
+
+/* Private: Returns true while the output interfaces are still being brought
+ * up, one per pass of the main loop. Received CAN messages are held back until
+ * then, so the first ones after power on aren't published to outputs that
+ * can't send them yet.
+ */
+static bool startingIO() {
+    return getConfiguration()->desiredRunLevel == RunLevel::ALL_IO &&
+            getConfiguration()->runLevel != RunLevel::ALL_IO;
+}
+
+/* Private: Move everything in the bus's receive queue into the early capture
+ * buffer, to make room for the receive interrupt. If the capture buffer is
+ * full, what's left stays in the receive queue.
+ */
+static void captureEarlyCan(CanBus* bus) {
+    while(earlyCanMessageCount < CAN_EARLY_CAPTURE_DEPTH) {
+        EarlyCanMessage* early = &EARLY_CAN_MESSAGES[(earlyCanMessageStart +
+                earlyCanMessageCount) % CAN_EARLY_CAPTURE_DEPTH];
+        if(!can::queue::pop(&bus->receiveQueue, &early->message)) {
+            break;
+        }
+        early->bus = bus;
+        ++earlyCanMessageCount;
+    }
+}
+
+/* Private: Move everything in the receive queues into the early capture
+ * buffer, oldest first across the buses, like captureEarlyCan.
+ */
+static void captureEarlyCanInOrder(CanBus* buses, const int busCount) {
+    int index;
+    while(earlyCanMessageCount < CAN_EARLY_CAPTURE_DEPTH &&
+            (index = earliestBus(buses, busCount, 0)) != -1) {
+        EarlyCanMessage* early = &EARLY_CAN_MESSAGES[(earlyCanMessageStart +
+                earlyCanMessageCount) % CAN_EARLY_CAPTURE_DEPTH];
+        can::queue::pop(&buses[index].receiveQueue, &early->message);
+        early->bus = &buses[index];
+        ++earlyCanMessageCount;
+    }
+}
+
+/* Private: Take the frames waiting on all of the buses at once, oldest first,
+ * into the early capture buffer while the outputs are starting or otherwise
+ * straight into the pipeline.
+ */
+static void receiveAllCan(bool capturing) {
+    if(capturing) {
+        captureEarlyCanInOrder(getCanBuses(), getCanBusCount());
+    } else {
+        receiveCanInOrder(&getConfiguration()->pipeline, getCanBuses(),
+                getCanBusCount());
+    }
+}
+
+/* Private: Handle every message held in the early capture buffer, in the order
+ * they were received.
+ */
+static void replayEarlyCan(Pipeline* pipeline) {
+    if(earlyCanMessageCount > 0) {
+        debug("Replaying %d CAN messages received during startup",
+                earlyCanMessageCount);
+    }
+    for(int i = 0; i < earlyCanMessageCount; i++) {
+        EarlyCanMessage* early = &EARLY_CAN_MESSAGES[(earlyCanMessageStart + i)
+                % CAN_EARLY_CAPTURE_DEPTH];
+        handleCanMessage(pipeline, early->bus, &early->message);
+    }
+    earlyCanMessageStart = 0;
+    earlyCanMessageCount = 0;
+}
+
+/* Private: The work that keeps going while the main loop is blocked in a long
+ * operation, run from util::task::yield() - draining the CAN receive queues
+ * into the pipeline and flushing the pipeline, which also runs the USB task.
+ * Reading and handling commands waits for the main loop, since a command could
+ * call back into the operation that's blocked.
+ */
+static void serviceWhileBlocked() {
+    if(CAN_ORDERED_RECEIVE) {
+        receiveAllCan(startingIO());
+    } else {
+        for(int i = 0; i < getCanBusCount(); i++) {
+            if(startingIO()) {
+                captureEarlyCan(&getCanBuses()[i]);
+            } else {
+                receiveCan(&getConfiguration()->pipeline, &getCanBuses()[i]);
+            }
+        }
+    }
+    openxc::pipeline::process(&getConfiguration()->pipeline);
+}
+
+/* Public: Bring up the next output interface, moving to the ALL_IO run level
+ * after the last one. This is called once per pass of the main loop until
+ * then, so CAN messages keep being captured in between instead of waiting for
+ * every interface (the SD card mount and Bluetooth module can take a while).
+ */
 void initializeIO() {
-    
-    debug("Moving to ALL I/O runlevel");
+    switch(nextIoStage) {
+        case IO_STAGE_FILESYSTEM:
+            debug("Moving to ALL I/O runlevel");
+            #ifdef RTC_SUPPORT
+            RTC_Init();
+            #endif
+            #ifdef FS_SUPPORT
+            if(fs::initialize(getConfiguration()->fs)) {
+                signals::loader::loadFile(getConfiguration()->fs);
+            }
+            #endif
+            break;
+        case IO_STAGE_USB:
+            usb::initialize(&getConfiguration()->usb);
+            break;
+        case IO_STAGE_UART:
+            #ifndef UART_LOGGING_DISABLE
+            uart::initialize(&getConfiguration()->uart);
+            #endif
+            break;
+        case IO_STAGE_WIRELESS:
+            #ifdef BLE_SUPPORT
+            ble::initialize(getConfiguration()->ble);
+            #endif
+            #ifdef BLUETOOTH_SUPPORT
+            bluetooth::start(&getConfiguration()->uart);
+            #endif
+            break;
+        case IO_STAGE_NETWORK:
+            network::initialize(&getConfiguration()->network);
+            break;
+    }
+
+    if(++nextIoStage == IO_STAGE_COUNT) {
+        nextIoStage = 0;
+        getConfiguration()->runLevel = RunLevel::ALL_IO;
+    }
+}
+
+/* Private: Update the interface light once the output interfaces are up.
+ */
+static void updateInterfaceLightWhenRunning() {
+    if(getConfiguration()->runLevel == RunLevel::ALL_IO) {
+        updateInterfaceLight();
+    }
+}
+
+/* Private: Log the CAN bus, pipeline and main loop statistics - each only logs
+ * once its own logging period is up.
+ */
+static void logAllStatistics() {
+    can::logBusStatistics(getCanBuses(), getCanBusCount());
+    openxc::pipeline::logStatistics(&getConfiguration()->pipeline);
+    profiler::logStatistics();
+}
+
+/* Private: Keep the wall clock in step with the RTC, if there is one, and
+ * catch the wrap of the microsecond timer.
+ */
+static void updateClock() {
     #ifdef RTC_SUPPORT
-    RTC_Init();
-    #endif    
-    
-    #ifdef FS_SUPPORT    
-    fs::initialize(getConfiguration()->fs);
-    #endif    
-    usb::initialize(&getConfiguration()->usb);
-    
-    #ifndef UART_LOGGING_DISABLE
-    uart::initialize(&getConfiguration()->uart); 
-    #endif
-    
-    #ifdef BLE_SUPPORT
-    ble::initialize(getConfiguration()->ble);
-    #endif
-    #ifdef BLUETOOTH_SUPPORT
-    bluetooth::start(&getConfiguration()->uart);
+    if(rtc_task()) {
+        wallclock::setFromSeconds(syst.tm / 1000);
+    }
     #endif
-    network::initialize(&getConfiguration()->network);
-    getConfiguration()->runLevel = RunLevel::ALL_IO;
-    
+    wallclock::update();
 }
 
 void initializeVehicleInterface() {
+    // before anything else has used the stack
+    memory::paintStack();
     #ifdef TELIT_HE910_SUPPORT
     nvm::initialize();
     #endif
@@ -226,55 +699,138 @@ void initializeVehicleInterface() {
     lights::initialize();
 
     srand(time::systemTimeMs());
+    // before the CAN interrupts are enabled, since it switches sets briefly
+    signals::sets::prepare();
     initializeAllCan();
 
     char descriptor[128];
     config::getFirmwareDescriptor(descriptor, sizeof(descriptor));
     debug("Performing minimal initialization for %s", descriptor);
     BUS_WAS_ACTIVE = false;
+    nextIoStage = 0;
+    earlyCanMessageStart = 0;
+    earlyCanMessageCount = 0;
 
     diagnostics::initialize(&getConfiguration()->diagnosticsManager,
             getCanBuses(), getCanBusCount(),
             getConfiguration()->obd2BusAddress);
     signals::initialize(&getConfiguration()->diagnosticsManager);
+    can::indexSignalNames(getSignals(), getSignalCount(),
+            signals::getCommands(), signals::getCommandCount());
+    can::read::indexSignalDispatch(getSignals(), getSignalCount());
+    can::read::staggerSignalClocks(getSignals(), getSignalCount());
+    signals::handlers::bindHandlers(getSignals(), getSignalCount());
+    #if PERSIST_HANDLER_STATE
+    state_store::initialize();
+    signals::handlers::restoreState();
+    #endif
+    signals::virtuals::bindVirtualSignals(getSignals(), getSignalCount());
+    // after signals::initialize, so the saved requests don't take the place
+    // of the ones in the signal definitions
+    config::restoreConfiguration();
     getConfiguration()->runLevel = RunLevel::CAN_ONLY;
 
     if(getConfiguration()->powerManagement ==
             PowerManagement::OBD2_IGNITION_CHECK) {
         getConfiguration()->desiredRunLevel = RunLevel::CAN_ONLY;
     } else {
+        // The main loop brings up the output interfaces
+        getConfiguration()->desiredRunLevel = RunLevel::ALL_IO;
+    }
+    // after the saved configuration, so the snapshot goes to the outputs it
+    // picked
+    if(snapshot::start(&getConfiguration()->diagnosticsManager)) {
         getConfiguration()->desiredRunLevel = RunLevel::ALL_IO;
-        initializeIO();
     }
 
+    task::setBackgroundTask(serviceWhileBlocked);
+    // The housekeeping that's too slow to need a look every pass. CAN and
+    // output work, and the filesystem manager's writes, stay in the main loop.
+    rategroup::addTask(rategroup::RATE_10_MS, checkBusActivity);
+    rategroup::addTask(rategroup::RATE_100_MS,
+            updateInterfaceLightWhenRunning);
+    rategroup::addTask(rategroup::RATE_1_S, logAllStatistics);
+    rategroup::addTask(rategroup::RATE_1_S, updateClock);
+
     // If we don't delay a little bit, time::elapsed seems to return true no
-    // matter what for DEBUG=0 builds.
-    time::delayMs(500);
+    // matter what for DEBUG=0 builds. CAN is already running, so keep the
+    // receive queues from overflowing in the meantime.
+    for(int i = 0; i < STARTUP_SETTLE_MS; i++) {
+        time::delayMs(1);
+        for(int j = 0; j < getCanBusCount(); j++) {
+            captureEarlyCan(&getCanBuses()[j]);
+        }
+    }
+}
+
+/* Private: Returns true if the last pass through the main loop left nothing
+ * behind for the next one to do - every CAN queue and output queue is empty.
+ *
+ * Incoming bytes on an interface and new CAN frames both arrive by interrupt,
+ * and the system timer interrupts every millisecond to drive the timed work
+ * (diagnostic requests, batching, statistics), so it's safe to sleep until the
+ * next interrupt when this is true.
+ */
+static bool idle() {
+    if(startingIO() || earlyCanMessageCount > 0 || capture::dumping()) {
+        return false;
+    }
+
+    for(int i = 0; i < getCanBusCount(); i++) {
+        CanBus* bus = &getCanBuses()[i];
+        if(!can::queue::empty(&bus->receiveQueue) ||
+                !QUEUE_EMPTY(CanMessage, &bus->sendQueue) ||
+                bus->pendingWriteCount > 0) {
+            return false;
+        }
+    }
+    return openxc::pipeline::sendQueuesEmpty(&getConfiguration()->pipeline);
 }
 
 void firmwareLoop() {
-    if(getConfiguration()->runLevel != RunLevel::ALL_IO &&
-            getConfiguration()->desiredRunLevel == RunLevel::ALL_IO) {
+    if(startingIO()) {
         initializeIO();
     }
+
+    profiler::startLoop();
+    bool startingOutputs = startingIO();
+    if(!startingOutputs) {
+        replayEarlyCan(&getConfiguration()->pipeline);
+    }
+    // If an output interface can't keep up, the pipeline flushes it at most
+    // once and then treats it as backed up until the pipeline::process() at
+    // the end of this loop, dropping what it can't queue rather than stalling
+    // CAN receive and diagnostics here.
+    if(CAN_ORDERED_RECEIVE) {
+        receiveAllCan(startingOutputs);
+    }
     for(int i = 0; i < getCanBusCount(); i++) {
-        // In normal operation, if no output interface is enabled/attached (e.g.
-        // no USB or Bluetooth, the loop will stall here. Deep down in
-        // receiveCan when it tries to append messages to the queue it will
-        // reach a point where it tries to flush the (full) queue. Since nothing
-        // is attached, that will just keep timing out. Just be aware that if
-        // you need to modify the firmware to not use any interfaces, you'll
-        // have to change that or enable the flush functionality to write to
-        // your desired output interface.
         CanBus* bus = &(getCanBuses()[i]);
-        receiveCan(&getConfiguration()->pipeline, bus);
+        if(!CAN_ORDERED_RECEIVE) {
+            if(startingOutputs) {
+                captureEarlyCan(bus);
+            } else {
+                receiveCan(&getConfiguration()->pipeline, bus);
+            }
+        }
+        can::updateBusStatus(bus);
+        autobaud::update(bus, busWritable(bus), getCanBuses(),
+                getCanBusCount());
+        learn::update(bus, getMessages(), getMessageCount(), getCanBuses(),
+                getCanBusCount());
+        selftest::update(bus, busWritable(bus), getCanBuses(),
+                getCanBusCount(), &getConfiguration()->pipeline);
+        profiler::endStage(profiler::CAN_RECEIVE);
         diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, bus);
+        profiler::endStage(profiler::DIAGNOSTICS);
     }
 
     diagnostics::obd2::loop(&getConfiguration()->diagnosticsManager);
+    profiler::endStage(profiler::DIAGNOSTICS);
 
     if(getConfiguration()->runLevel == RunLevel::ALL_IO) {
         usb::read(&getConfiguration()->usb, usb::handleIncomingMessage);
+        profiler::endStage(profiler::USB_READ);
         #ifdef TELIT_HE910_SUPPORT
         telit::connectionManager(getConfiguration()->telit);
         if(telit::connected(getConfiguration()->telit)) {
@@ -284,6 +840,7 @@ void firmwareLoop() {
             server_task::firmwareCheck(getConfiguration()->telit);
             server_task::flushDataBuffer(getConfiguration()->telit);
             server_task::commandCheck(getConfiguration()->telit);
+            server_task::uploadLogs(getConfiguration()->telit);
         }
         #elif defined BLE_SUPPORT
         ble::read(getConfiguration()->ble); 
@@ -292,22 +849,27 @@ void firmwareLoop() {
         #endif
         network::read(&getConfiguration()->network,
                 network::handleIncomingMessage);
+        commands::updateWriteAcks();
+        profiler::endStage(profiler::INTERFACE_READ);
     }
 
     for(int i = 0; i < getCanBusCount(); i++) {
         can::write::flushOutgoingCanMessageQueue(&getCanBuses()[i]);
     }
-
-    checkBusActivity();
-    if(getConfiguration()->runLevel == RunLevel::ALL_IO) {
-        updateInterfaceLight();
-    }
+    profiler::endStage(profiler::CAN_WRITE);
 
     signals::loop();
+    profiles::update(getSignals(), getSignalCount(), getMessages(),
+            getMessageCount(), getCanBuses(), getCanBusCount());
+    can::read::publishAggregates(&getConfiguration()->pipeline);
+    capture::process(&getConfiguration()->pipeline);
+    survey::process(&getConfiguration()->pipeline);
 
-    can::logBusStatistics(getCanBuses(), getCanBusCount());
-    openxc::pipeline::logStatistics(&getConfiguration()->pipeline);
+    rategroup::run();
+    openxc::pipeline::updateRateLimit();
+    profiler::endStage(profiler::STATISTICS);
 
+    openxc::emulator::playBack(getCanBuses(), getCanBusCount());
     if(getConfiguration()->emulatedData) {
         static bool connected = false;
         if(!connected && openxc::interface::anyConnected()) {
@@ -318,15 +880,36 @@ void firmwareLoop() {
         }
 
         if(connected) {
-            openxc::emulator::generateFakeMeasurements(
-                    &getConfiguration()->pipeline);
+            if(getConfiguration()->emulatedFrameRate > 0) {
+                openxc::emulator::generateFakeCanFrames(getCanBuses(),
+                        getCanBusCount(),
+                        getConfiguration()->emulatedFrameRate,
+                        getConfiguration()->emulatedUnknownIdPercent);
+            } else {
+                openxc::emulator::generateFakeMeasurements(
+                        &getConfiguration()->pipeline);
+            }
         }
     }
+    profiler::endStage(profiler::EMULATOR);
     #ifdef FS_SUPPORT
     fs::manager(getConfiguration()->fs);
     #endif
-    #ifdef RTC_SUPPORT
-    rtc_task();
-    #endif
+    profiler::endStage(profiler::FILESYSTEM);
+    openxc::util::log::flush();
     openxc::pipeline::process(&getConfiguration()->pipeline);
+    profiler::endStage(profiler::PIPELINE);
+    profiler::endLoop();
+
+    bool loopIdle = idle();
+    // Don't sleep while the firmware hash is being computed, it's the idle
+    // passes that compute it
+    if(config::hashFlash(loopIdle)) {
+        loopIdle = false;
+    }
+    #if IDLE_SLEEP
+    if(loopIdle) {
+        power::waitForInterrupt();
+    }
+    #endif
 }
@@ -0,0 +1,138 @@
+#include "virtual_signals.h"
+#include "can/canread.h"
+#include "util/log.h"
+
+using openxc::util::log::debug;
+using openxc::can::lookupSignal;
+using openxc::can::read::shouldSend;
+using openxc::can::read::publishNumericalMessage;
+using openxc::pipeline::Pipeline;
+using openxc::signals::virtuals::VirtualSignal;
+
+static VirtualSignal* VIRTUAL_SIGNALS[MAX_VIRTUAL_SIGNALS];
+static int virtualSignalCount = 0;
+
+static CanSignal* boundSignals = NULL;
+static int boundSignalCount = 0;
+
+/* Private: Resolve a virtual signal's inputs in the bound signal array.
+ */
+static void bindInputs(VirtualSignal* signal) {
+    for(int i = 0; i < signal->inputCount; i++) {
+        signal->inputs[i] = boundSignals == NULL ? NULL :
+                lookupSignal(signal->inputNames[i], boundSignals,
+                    boundSignalCount);
+        if(signal->inputs[i] == NULL) {
+            debug("Virtual signal %s is missing input %s",
+                    signal->output.genericName, signal->inputNames[i]);
+        }
+    }
+}
+
+static bool inputsBound(const VirtualSignal* signal) {
+    for(int i = 0; i < signal->inputCount; i++) {
+        if(signal->inputs[i] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool openxc::signals::virtuals::addVirtualSignal(VirtualSignal* signal) {
+    if(signal == NULL || signal->compute == NULL ||
+            signal->inputCount > MAX_VIRTUAL_SIGNAL_INPUTS) {
+        return false;
+    }
+
+    for(int i = 0; i < virtualSignalCount; i++) {
+        if(VIRTUAL_SIGNALS[i] == signal) {
+            bindInputs(signal);
+            return true;
+        }
+    }
+
+    if(virtualSignalCount >= MAX_VIRTUAL_SIGNALS) {
+        debug("Can't register more than %d virtual signals",
+                MAX_VIRTUAL_SIGNALS);
+        return false;
+    }
+    VIRTUAL_SIGNALS[virtualSignalCount++] = signal;
+    bindInputs(signal);
+    return true;
+}
+
+void openxc::signals::virtuals::removeVirtualSignal(VirtualSignal* signal) {
+    for(int i = 0; i < virtualSignalCount; i++) {
+        if(VIRTUAL_SIGNALS[i] == signal) {
+            VIRTUAL_SIGNALS[i] = VIRTUAL_SIGNALS[--virtualSignalCount];
+            return;
+        }
+    }
+}
+
+void openxc::signals::virtuals::resetVirtualSignals() {
+    virtualSignalCount = 0;
+}
+
+void openxc::signals::virtuals::bindVirtualSignals(CanSignal* signals,
+        int signalCount) {
+    boundSignals = signals;
+    boundSignalCount = signalCount;
+    for(int i = 0; i < virtualSignalCount; i++) {
+        bindInputs(VIRTUAL_SIGNALS[i]);
+    }
+}
+
+void openxc::signals::virtuals::inputChanged(const CanSignal* signal,
+        float previous, Pipeline* pipeline) {
+    for(int i = 0; i < virtualSignalCount; i++) {
+        VirtualSignal* virtualSignal = VIRTUAL_SIGNALS[i];
+        for(int input = 0; input < virtualSignal->inputCount; input++) {
+            if(virtualSignal->inputs[input] != signal) {
+                continue;
+            }
+
+            if(!inputsBound(virtualSignal)) {
+                break;
+            }
+
+            bool send = true;
+            float value = virtualSignal->compute(virtualSignal, input,
+                    previous, &send);
+            if(send && shouldSend(&virtualSignal->output, value)) {
+                publishNumericalMessage(virtualSignal->output.genericName,
+                        value, pipeline);
+            }
+            if(send) {
+                virtualSignal->output.received = true;
+                virtualSignal->output.lastValue = value;
+            }
+            break;
+        }
+    }
+}
+
+float openxc::signals::virtuals::accumulateRollover(VirtualSignal* signal,
+        int input, float previous, bool* send) {
+    const CanSignal* counter = signal->inputs[0];
+    if(input == 0) {
+        if(counter->lastValue < previous) {
+            signal->state += counter->maxValue - previous + counter->lastValue;
+        } else {
+            signal->state += counter->lastValue - previous;
+        }
+    }
+    return signal->parameter * signal->state;
+}
+
+float openxc::signals::virtuals::sumInputs(VirtualSignal* signal, int input,
+        float previous, bool* send) {
+    float sum = 0;
+    for(int i = 0; i < signal->inputCount; i++) {
+        if(!signal->inputs[i]->received) {
+            *send = false;
+        }
+        sum += signal->inputs[i]->lastValue;
+    }
+    return signal->parameter * sum;
+}
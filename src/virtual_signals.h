@@ -0,0 +1,124 @@
+/* Signals computed from other signals, updated as their inputs change. */
+#ifndef _VIRTUAL_SIGNALS_H_
+#define _VIRTUAL_SIGNALS_H_
+
+#include "can/canutil.h"
+#include "pipeline.h"
+
+// The most virtual signals that can be registered at once.
+#ifndef MAX_VIRTUAL_SIGNALS
+#define MAX_VIRTUAL_SIGNALS 8
+#endif
+
+#define MAX_VIRTUAL_SIGNAL_INPUTS 4
+
+namespace openxc {
+namespace signals {
+namespace virtuals {
+
+struct VirtualSignal;
+
+/* Public: The type signature for a virtual signal's computation, called each
+ * time one of its inputs is received with a new value.
+ *
+ * The current values of all inputs are in signal->inputs[i]->lastValue (an
+ * input that hasn't been received yet has 'received' false), so a computation
+ * can either start over from them or, using the previous value of the input
+ * that changed, update a running result kept in signal->state.
+ *
+ * signal - The virtual signal.
+ * input - The index of the input that changed.
+ * previous - That input's value before it changed. The first time an input is
+ *      received, this is the same as its current value.
+ * send - (output) Flip this to false if the result should not be published.
+ *
+ * Returns the new value of the virtual signal.
+ */
+typedef float (*VirtualSignalFunction)(struct VirtualSignal* signal,
+        int input, float previous, bool* send);
+
+/* Public: A signal whose value is computed from other signals.
+ *
+ * output - The virtual signal as published. Only its genericName and the
+ *      fields that control when a value is sent (sendSame, forceSendChanged,
+ *      frequencyClock, deadband and relativeDeadband) need to be set - it has
+ *      no message. received and lastValue are kept up to date, the same as for
+ *      a CAN signal.
+ * inputNames - The generic names of the signals it's computed from.
+ * inputCount - The number of inputs, at most MAX_VIRTUAL_SIGNAL_INPUTS.
+ * compute - The computation, called whenever an input changes.
+ * parameter - A constant for the computation, e.g. a unit conversion factor.
+ * inputs - The input signals, resolved by name by bindVirtualSignals. If any
+ *      is missing in the active message set, the virtual signal isn't
+ *      computed.
+ * state - A running result for the computation to keep, e.g. a total.
+ */
+struct VirtualSignal {
+    CanSignal output;
+    const char* inputNames[MAX_VIRTUAL_SIGNAL_INPUTS];
+    uint8_t inputCount;
+    VirtualSignalFunction compute;
+    float parameter;
+    CanSignal* inputs[MAX_VIRTUAL_SIGNAL_INPUTS];
+    float state;
+};
+typedef struct VirtualSignal VirtualSignal;
+
+/* Public: Register a virtual signal, e.g. from signals::initialize(). It's
+ * bound to the signal array last passed to bindVirtualSignals.
+ *
+ * signal - The virtual signal, which must stay valid until it's removed by
+ *      removeVirtualSignal or resetVirtualSignals. Registering it again only
+ *      binds it again.
+ *
+ * Returns true if the signal was registered, false if MAX_VIRTUAL_SIGNALS are
+ * already registered or it has too many inputs.
+ */
+bool addVirtualSignal(VirtualSignal* signal);
+
+/* Public: Unregister a virtual signal.
+ *
+ * signal - The virtual signal to stop computing.
+ */
+void removeVirtualSignal(VirtualSignal* signal);
+
+/* Public: Unregister all virtual signals. */
+void resetVirtualSignals();
+
+/* Public: Resolve the inputs of every virtual signal by name. Call this once
+ * the active message set is known, e.g. right after signals::initialize().
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ */
+void bindVirtualSignals(CanSignal* signals, int signalCount);
+
+/* Public: Recompute and publish the virtual signals that depend on a signal
+ * whose value just changed. This is called by can::read::translateSignal,
+ * and returns right away if there are no virtual signals.
+ *
+ * signal - The signal that changed.
+ * previous - Its value before it changed.
+ * pipeline - The pipeline to publish any results to.
+ */
+void inputChanged(const CanSignal* signal, float previous,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: A computation for a total of how much a rolling counter (the first
+ * input) has increased, e.g. fuel consumed or distance travelled since the VI
+ * started, scaled by signal->parameter. The counter rolls over after its
+ * maxValue, the same as for handleFuelFlow in the shared handlers.
+ */
+float accumulateRollover(VirtualSignal* signal, int input, float previous,
+        bool* send);
+
+/* Public: A computation for the sum of all inputs, each scaled by
+ * signal->parameter. Nothing is sent until every input has been received.
+ */
+float sumInputs(VirtualSignal* signal, int input, float previous, bool* send);
+
+} // namespace virtuals
+} // namespace signals
+} // namespace openxc
+
+#endif // _VIRTUAL_SIGNALS_H_